@@ -23,15 +23,23 @@
 
 #include <config.h>
 
+#ifdef HAVE_MALLINFO
+# include <malloc.h>
+#endif
+
 #include "admin_server.h"
 #include "datatypes.h"
+#include "domain_conf.h"
 #include "viralloc.h"
+#include "vircommandbroker.h"
 #include "virerror.h"
+#include "vireventpoll.h"
 #include "viridentity.h"
 #include "virlog.h"
 #include "virnetdaemon.h"
 #include "virnetserver.h"
 #include "virstring.h"
+#include "virthread.h"
 #include "virthreadpool.h"
 #include "virtypedparam.h"
 
@@ -86,14 +94,24 @@ adminServerGetThreadPoolParameters(virNetServerPtr srv,
     size_t freeWorkers;
     size_t nPrioWorkers;
     size_t jobQueueDepth;
+    virThreadPoolJobWaitStats jobWait;
     virTypedParameterPtr tmpparams = NULL;
+    const char *jobWaitFields[VIR_THREADPOOL_JOB_WAIT_BUCKETS] = {
+        VIR_THREADPOOL_JOB_WAIT_1MS,
+        VIR_THREADPOOL_JOB_WAIT_10MS,
+        VIR_THREADPOOL_JOB_WAIT_100MS,
+        VIR_THREADPOOL_JOB_WAIT_1S,
+        VIR_THREADPOOL_JOB_WAIT_LONGER,
+    };
+    size_t i;
 
     virCheckFlags(0, -1);
 
     if (virNetServerGetThreadPoolParameters(srv, &minWorkers, &maxWorkers,
                                             &nWorkers, &freeWorkers,
                                             &nPrioWorkers,
-                                            &jobQueueDepth) < 0) {
+                                            &jobQueueDepth,
+                                            &jobWait) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("Unable to retrieve threadpool parameters"));
         goto cleanup;
@@ -129,6 +147,28 @@ adminServerGetThreadPoolParameters(virNetServerPtr srv,
                               jobQueueDepth) < 0)
         goto cleanup;
 
+    if (virTypedParamsAddULLong(&tmpparams, nparams,
+                                &maxparams, VIR_THREADPOOL_JOB_WAIT_COUNT,
+                                jobWait.jobs) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams,
+                                &maxparams, VIR_THREADPOOL_JOB_WAIT_TOTAL,
+                                jobWait.total) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams,
+                                &maxparams, VIR_THREADPOOL_JOB_WAIT_MAX,
+                                jobWait.max) < 0)
+        goto cleanup;
+
+    for (i = 0; i < VIR_THREADPOOL_JOB_WAIT_BUCKETS; i++) {
+        if (virTypedParamsAddULLong(&tmpparams, nparams,
+                                    &maxparams, jobWaitFields[i],
+                                    jobWait.buckets[i]) < 0)
+            goto cleanup;
+    }
+
     *params = tmpparams;
     tmpparams = NULL;
     ret = 0;
@@ -221,6 +261,10 @@ adminClientGetInfo(virNetServerClientPtr client,
     int ret = -1;
     int maxparams = 0;
     bool readonly;
+    unsigned long long poolHits;
+    unsigned long long poolMisses;
+    unsigned long long streamReceived;
+    unsigned long long streamSent;
     char *sock_addr = NULL;
     const char *attr = NULL;
     virTypedParameterPtr tmpparams = NULL;
@@ -294,6 +338,26 @@ adminClientGetInfo(virNetServerClientPtr client,
                                 VIR_CLIENT_INFO_SELINUX_CONTEXT, attr) < 0))
         goto cleanup;
 
+    virNetServerClientGetMessagePoolStats(client, &poolHits, &poolMisses);
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_CLIENT_INFO_MESSAGE_POOL_HITS,
+                                poolHits) < 0 ||
+        virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_CLIENT_INFO_MESSAGE_POOL_MISSES,
+                                poolMisses) < 0)
+        goto cleanup;
+
+    virNetServerClientGetStreamStats(client, &streamReceived, &streamSent);
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_CLIENT_INFO_STREAM_BYTES_RECEIVED,
+                                streamReceived) < 0 ||
+        virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_CLIENT_INFO_STREAM_BYTES_SENT,
+                                streamSent) < 0)
+        goto cleanup;
+
     *params = tmpparams;
     tmpparams = NULL;
     ret = 0;
@@ -321,10 +385,17 @@ adminServerGetClientLimits(virNetServerPtr srv,
 {
     int ret = -1;
     int maxparams = 0;
+    unsigned int clientRate, clientBurst, identityRate, identityBurst;
+    int keepaliveInterval;
+    unsigned int keepaliveCount;
     virTypedParameterPtr tmpparams = NULL;
 
     virCheckFlags(0, -1);
 
+    virNetServerGetRequestRateLimits(srv, &clientRate, &clientBurst,
+                                     &identityRate, &identityBurst);
+    virNetServerGetKeepAlive(srv, &keepaliveInterval, &keepaliveCount);
+
     if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
                               VIR_SERVER_CLIENTS_MAX,
                               virNetServerGetMaxClients(srv)) < 0)
@@ -345,6 +416,41 @@ adminServerGetClientLimits(virNetServerPtr srv,
                               virNetServerGetCurrentUnauthClients(srv)) < 0)
         goto cleanup;
 
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_CLIENTS_REQUEST_RATE,
+                              clientRate) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_CLIENTS_REQUEST_BURST,
+                              clientBurst) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_IDENTITY_REQUEST_RATE,
+                              identityRate) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_IDENTITY_REQUEST_BURST,
+                              identityBurst) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_CLIENTS_REQUESTS_MAX,
+                              virNetServerGetClientRequestsMax(srv)) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddInt(&tmpparams, nparams, &maxparams,
+                             VIR_SERVER_KEEPALIVE_INTERVAL,
+                             keepaliveInterval) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_KEEPALIVE_COUNT,
+                              keepaliveCount) < 0)
+        goto cleanup;
+
     *params = tmpparams;
     tmpparams = NULL;
     ret = 0;
@@ -362,6 +468,13 @@ adminServerSetClientLimits(virNetServerPtr srv,
 {
     long long int maxClients = -1;
     long long int maxClientsUnauth = -1;
+    long long int clientRate = -1;
+    long long int clientBurst = -1;
+    long long int identityRate = -1;
+    long long int identityBurst = -1;
+    long long int keepaliveInterval = -2;
+    long long int keepaliveCount = -1;
+    unsigned int requestsMax = 0;
     virTypedParameterPtr param = NULL;
 
     virCheckFlags(0, -1);
@@ -371,6 +484,20 @@ adminServerSetClientLimits(virNetServerPtr srv,
                                VIR_TYPED_PARAM_UINT,
                                VIR_SERVER_CLIENTS_UNAUTH_MAX,
                                VIR_TYPED_PARAM_UINT,
+                               VIR_SERVER_CLIENTS_REQUEST_RATE,
+                               VIR_TYPED_PARAM_UINT,
+                               VIR_SERVER_CLIENTS_REQUEST_BURST,
+                               VIR_TYPED_PARAM_UINT,
+                               VIR_SERVER_IDENTITY_REQUEST_RATE,
+                               VIR_TYPED_PARAM_UINT,
+                               VIR_SERVER_IDENTITY_REQUEST_BURST,
+                               VIR_TYPED_PARAM_UINT,
+                               VIR_SERVER_CLIENTS_REQUESTS_MAX,
+                               VIR_TYPED_PARAM_UINT,
+                               VIR_SERVER_KEEPALIVE_INTERVAL,
+                               VIR_TYPED_PARAM_INT,
+                               VIR_SERVER_KEEPALIVE_COUNT,
+                               VIR_TYPED_PARAM_UINT,
                                NULL) < 0)
         return -1;
 
@@ -382,9 +509,540 @@ adminServerSetClientLimits(virNetServerPtr srv,
                                    VIR_SERVER_CLIENTS_UNAUTH_MAX)))
         maxClientsUnauth = param->value.ui;
 
+    if ((param = virTypedParamsGet(params, nparams,
+                                   VIR_SERVER_CLIENTS_REQUEST_RATE)))
+        clientRate = param->value.ui;
+
+    if ((param = virTypedParamsGet(params, nparams,
+                                   VIR_SERVER_CLIENTS_REQUEST_BURST)))
+        clientBurst = param->value.ui;
+
+    if ((param = virTypedParamsGet(params, nparams,
+                                   VIR_SERVER_IDENTITY_REQUEST_RATE)))
+        identityRate = param->value.ui;
+
+    if ((param = virTypedParamsGet(params, nparams,
+                                   VIR_SERVER_IDENTITY_REQUEST_BURST)))
+        identityBurst = param->value.ui;
+
+    if ((param = virTypedParamsGet(params, nparams,
+                                   VIR_SERVER_CLIENTS_REQUESTS_MAX))) {
+        if (!param->value.ui) {
+            virReportError(VIR_ERR_INVALID_ARG, "%s",
+                           _("client_requests_max must be greater than 0"));
+            return -1;
+        }
+        requestsMax = param->value.ui;
+    }
+
+    if ((param = virTypedParamsGet(params, nparams,
+                                   VIR_SERVER_KEEPALIVE_INTERVAL))) {
+        if (param->value.i < -1) {
+            virReportError(VIR_ERR_INVALID_ARG, "%s",
+                           _("keepalive_interval must be -1 or greater"));
+            return -1;
+        }
+        keepaliveInterval = param->value.i;
+    }
+
+    if ((param = virTypedParamsGet(params, nparams,
+                                   VIR_SERVER_KEEPALIVE_COUNT)))
+        keepaliveCount = param->value.ui;
+
     if (virNetServerSetClientLimits(srv, maxClients,
                                     maxClientsUnauth) < 0)
         return -1;
 
+    virNetServerSetRequestRateLimits(srv, clientRate, clientBurst,
+                                     identityRate, identityBurst);
+    virNetServerSetKeepAlive(srv, keepaliveInterval, keepaliveCount);
+    virNetServerSetClientRequestsMax(srv, requestsMax);
+
     return 0;
 }
+
+/* How many callbacks adminConnectGetEventLoopStats reports at most */
+#define ADMIN_EVENT_LOOP_CALLBACKS_MAX 32
+
+static int
+adminAddEventLoopCallbackStats(virTypedParameterPtr *params,
+                               int *nparams,
+                               int *maxparams)
+{
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    virEventPollCallbackStatsPtr stats = NULL;
+    size_t nstats = 0;
+    size_t i, j;
+    int ret = -1;
+
+    if (virEventPollGetCallbackStats(&stats, &nstats,
+                                     ADMIN_EVENT_LOOP_CALLBACKS_MAX) < 0)
+        return -1;
+
+    if (virTypedParamsAddUInt(params, nparams, maxparams,
+                              VIR_EVENT_LOOP_CALLBACKS_COUNT, nstats) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nstats; i++) {
+        struct {
+            const char *name;
+            unsigned long long value;
+        } fields[] = {
+            { "calls", stats[i].calls },
+            { "timeTotal", stats[i].timeTotal },
+            { "timeMax", stats[i].timeMax },
+            { "stalls", stats[i].stalls },
+        };
+
+        snprintf(field, sizeof(field), "callback.%zu.name", i);
+        if (virTypedParamsAddString(params, nparams, maxparams, field,
+                                    stats[i].name) < 0)
+            goto cleanup;
+
+        snprintf(field, sizeof(field), "callback.%zu.type", i);
+        if (virTypedParamsAddString(params, nparams, maxparams, field,
+                                    stats[i].timer ? "timer" : "handle") < 0)
+            goto cleanup;
+
+        for (j = 0; j < ARRAY_CARDINALITY(fields); j++) {
+            snprintf(field, sizeof(field), "callback.%zu.%s", i, fields[j].name);
+            if (virTypedParamsAddULLong(params, nparams, maxparams, field,
+                                        fields[j].value) < 0)
+                goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    virEventPollCallbackStatsFree(stats, nstats);
+    return ret;
+}
+
+int
+adminConnectGetEventLoopStats(virTypedParameterPtr *params,
+                              int *nparams,
+                              unsigned int flags)
+{
+    int ret = -1;
+    int maxparams = 0;
+    virEventPollStats stats;
+    virTypedParameterPtr tmpparams = NULL;
+
+    virCheckFlags(VIR_ADMIN_EVENT_LOOP_STATS_CALLBACKS, -1);
+
+    virEventPollGetStats(&stats);
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_EVENT_LOOP_TIMERS,
+                                stats.timers) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_EVENT_LOOP_TIMERS_ARMED,
+                                stats.timersArmed) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_EVENT_LOOP_TIMERS_FIRED,
+                                stats.timersFired) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_EVENT_LOOP_TIMERS_FIRED_RATE,
+                                stats.timersFiredRate) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_EVENT_LOOP_TIMERS_LATE_TOTAL,
+                                stats.timersLateTotal) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_EVENT_LOOP_TIMERS_LATE_MAX,
+                                stats.timersLateMax) < 0)
+        goto cleanup;
+
+    if ((flags & VIR_ADMIN_EVENT_LOOP_STATS_CALLBACKS) &&
+        adminAddEventLoopCallbackStats(&tmpparams, nparams, &maxparams) < 0)
+        goto cleanup;
+
+    *params = tmpparams;
+    tmpparams = NULL;
+    ret = 0;
+
+ cleanup:
+    virTypedParamsFree(tmpparams, *nparams);
+    return ret;
+}
+
+int
+adminConnectGetEventLoopParameters(virTypedParameterPtr *params,
+                                   int *nparams,
+                                   unsigned int flags)
+{
+    int ret = -1;
+    int maxparams = 0;
+    virTypedParameterPtr tmpparams = NULL;
+
+    virCheckFlags(0, -1);
+
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_EVENT_LOOP_THREADS,
+                              virEventPollGetLoopThreads()) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_EVENT_LOOP_STALL_THRESHOLD,
+                              virEventPollGetStallThreshold()) < 0)
+        goto cleanup;
+
+    *params = tmpparams;
+    tmpparams = NULL;
+    ret = 0;
+
+ cleanup:
+    virTypedParamsFree(tmpparams, *nparams);
+    return ret;
+}
+
+int
+adminConnectSetEventLoopParameters(virTypedParameterPtr params,
+                                   int nparams,
+                                   unsigned int flags)
+{
+    virTypedParameterPtr param = NULL;
+
+    virCheckFlags(0, -1);
+
+    if (virTypedParamsValidate(params, nparams,
+                               VIR_EVENT_LOOP_THREADS,
+                               VIR_TYPED_PARAM_UINT,
+                               VIR_EVENT_LOOP_STALL_THRESHOLD,
+                               VIR_TYPED_PARAM_UINT,
+                               NULL) < 0)
+        return -1;
+
+    if ((param = virTypedParamsGet(params, nparams,
+                                   VIR_EVENT_LOOP_THREADS))) {
+        if (!param->value.ui) {
+            virReportError(VIR_ERR_INVALID_ARG, "%s",
+                           _("number of event loop threads must be "
+                             "greater than 0"));
+            return -1;
+        }
+
+        if (virEventPollSetLoopThreads(param->value.ui) < 0)
+            return -1;
+    }
+
+    if ((param = virTypedParamsGet(params, nparams,
+                                   VIR_EVENT_LOOP_STALL_THRESHOLD)))
+        virEventPollSetStallThreshold(param->value.ui);
+
+    return 0;
+}
+
+static int
+adminServerAddProcStats(virTypedParameterPtr *params,
+                        int *nparams,
+                        int *maxparams,
+                        size_t num,
+                        virNetServerProgramProcStatsPtr stats)
+{
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    const char *bucketFields[VIR_NET_SERVER_PROGRAM_TIME_BUCKETS] = {
+        "dispatchUnder10us", "dispatchUnder100us", "dispatchUnder1ms",
+        "dispatchUnder10ms", "dispatchUnder100ms", "dispatchUnder1s",
+        "dispatchOver1s",
+    };
+    struct {
+        const char *name;
+        unsigned long long value;
+    } fields[] = {
+        { "calls", stats->calls },
+        { "errors", stats->errors },
+        { "queueTimeTotal", stats->queueTotal },
+        { "queueTimeMax", stats->queueMax },
+        { "dispatchTimeTotal", stats->dispatchTotal },
+        { "dispatchTimeMax", stats->dispatchMax },
+        { "encodeTimeTotal", stats->encodeTotal },
+        { "encodeTimeMax", stats->encodeMax },
+    };
+    size_t i;
+
+    snprintf(field, sizeof(field), "rpc.%zu.program", num);
+    if (virTypedParamsAddUInt(params, nparams, maxparams, field,
+                              stats->program) < 0)
+        return -1;
+
+    snprintf(field, sizeof(field), "rpc.%zu.proc", num);
+    if (virTypedParamsAddInt(params, nparams, maxparams, field,
+                             stats->proc) < 0)
+        return -1;
+
+    for (i = 0; i < ARRAY_CARDINALITY(fields); i++) {
+        snprintf(field, sizeof(field), "rpc.%zu.%s", num, fields[i].name);
+        if (virTypedParamsAddULLong(params, nparams, maxparams, field,
+                                    fields[i].value) < 0)
+            return -1;
+    }
+
+    for (i = 0; i < VIR_NET_SERVER_PROGRAM_TIME_BUCKETS; i++) {
+        snprintf(field, sizeof(field), "rpc.%zu.%s", num, bucketFields[i]);
+        if (virTypedParamsAddULLong(params, nparams, maxparams, field,
+                                    stats->buckets[i]) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+int
+adminServerGetRPCStats(virNetServerPtr srv,
+                       virTypedParameterPtr *params,
+                       int *nparams,
+                       unsigned int flags)
+{
+    int ret = -1;
+    int maxparams = 0;
+    virNetServerProgramProcStatsPtr stats = NULL;
+    size_t nstats = 0;
+    virTypedParameterPtr tmpparams = NULL;
+    size_t i;
+
+    virCheckFlags(0, -1);
+
+    if (virNetServerGetProcStats(srv, &stats, &nstats) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_RPC_STATS_COUNT, nstats) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nstats; i++) {
+        if (adminServerAddProcStats(&tmpparams, nparams, &maxparams,
+                                    i, &stats[i]) < 0)
+            goto cleanup;
+    }
+
+    *params = tmpparams;
+    tmpparams = NULL;
+    ret = 0;
+
+ cleanup:
+    virTypedParamsFree(tmpparams, *nparams);
+    VIR_FREE(stats);
+    return ret;
+}
+
+int
+adminConnectGetCommandBrokerStats(virTypedParameterPtr *params,
+                                  int *nparams,
+                                  unsigned int flags)
+{
+    int ret = -1;
+    int maxparams = 0;
+    virCommandBrokerStats stats;
+    virTypedParameterPtr tmpparams = NULL;
+
+    virCheckFlags(0, -1);
+
+    virCommandBrokerGetStats(&stats);
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_COMMAND_BROKER_COMMANDS,
+                                stats.commands) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_COMMAND_BROKER_FAILURES,
+                                stats.failures) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_COMMAND_BROKER_LATENCY_TOTAL,
+                                stats.latencyTotal) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_COMMAND_BROKER_LATENCY_MAX,
+                                stats.latencyMax) < 0)
+        goto cleanup;
+
+    *params = tmpparams;
+    tmpparams = NULL;
+    ret = 0;
+
+ cleanup:
+    virTypedParamsFree(tmpparams, *nparams);
+    return ret;
+}
+
+int
+adminConnectGetMemoryStats(virTypedParameterPtr *params,
+                           int *nparams,
+                           unsigned int flags)
+{
+    int ret = -1;
+    int maxparams = 0;
+    size_t internStrings;
+    size_t internBytes;
+    unsigned long long internHits;
+    virTypedParameterPtr tmpparams = NULL;
+#ifdef HAVE_MALLINFO
+    struct mallinfo heap;
+#endif
+
+    virCheckFlags(0, -1);
+
+#ifdef HAVE_MALLINFO
+    /* the fields are int, they wrap around past 2GiB */
+    heap = mallinfo();
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_MEMORY_STATS_HEAP_USED,
+                                (unsigned int) heap.uordblks +
+                                (unsigned int) heap.hblkhd) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_MEMORY_STATS_HEAP_FREE,
+                                (unsigned int) heap.fordblks) < 0)
+        goto cleanup;
+#endif
+
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_MEMORY_STATS_DOMAIN_OBJECTS,
+                              virDomainObjGetCount()) < 0)
+        goto cleanup;
+
+    virStringInternGetStats(&internStrings, &internBytes, &internHits);
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_MEMORY_STATS_INTERN_STRINGS,
+                                internStrings) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_MEMORY_STATS_INTERN_BYTES,
+                                internBytes) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_MEMORY_STATS_INTERN_HITS,
+                                internHits) < 0)
+        goto cleanup;
+
+    *params = tmpparams;
+    tmpparams = NULL;
+    ret = 0;
+
+ cleanup:
+    virTypedParamsFree(tmpparams, *nparams);
+    return ret;
+}
+
+/* Keeps the reply within ADMIN_CONNECT_LOCK_STATS_MAX */
+#define ADMIN_LOCK_STATS_MAX 32
+
+static int
+adminAddLockStats(virTypedParameterPtr *params,
+                  int *nparams,
+                  int *maxparams,
+                  size_t num,
+                  virMutexContentionStatsPtr stats)
+{
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    size_t i;
+
+    snprintf(field, sizeof(field), "lock.%zu.name", num);
+    if (virTypedParamsAddString(params, nparams, maxparams, field,
+                                stats->name) < 0)
+        return -1;
+
+    snprintf(field, sizeof(field), "lock.%zu.contended", num);
+    if (virTypedParamsAddULLong(params, nparams, maxparams, field,
+                                stats->contended) < 0)
+        return -1;
+
+    snprintf(field, sizeof(field), "lock.%zu.waitTotal", num);
+    if (virTypedParamsAddULLong(params, nparams, maxparams, field,
+                                stats->waitTotal) < 0)
+        return -1;
+
+    snprintf(field, sizeof(field), "lock.%zu.waitMax", num);
+    if (virTypedParamsAddULLong(params, nparams, maxparams, field,
+                                stats->waitMax) < 0)
+        return -1;
+
+    snprintf(field, sizeof(field), "lock.%zu.holder.count", num);
+    if (virTypedParamsAddUInt(params, nparams, maxparams, field,
+                              stats->nholders) < 0)
+        return -1;
+
+    for (i = 0; i < stats->nholders; i++) {
+        virMutexContentionHolderPtr holder = &stats->holders[i];
+
+        snprintf(field, sizeof(field), "lock.%zu.holder.%zu.name", num, i);
+        if (virTypedParamsAddString(params, nparams, maxparams, field,
+                                    holder->site) < 0)
+            return -1;
+
+        snprintf(field, sizeof(field),
+                 "lock.%zu.holder.%zu.contended", num, i);
+        if (virTypedParamsAddULLong(params, nparams, maxparams, field,
+                                    holder->contended) < 0)
+            return -1;
+
+        snprintf(field, sizeof(field),
+                 "lock.%zu.holder.%zu.waitTotal", num, i);
+        if (virTypedParamsAddULLong(params, nparams, maxparams, field,
+                                    holder->waitTotal) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+int
+adminConnectGetLockStats(virTypedParameterPtr *params,
+                         int *nparams,
+                         unsigned int flags)
+{
+    int ret = -1;
+    int maxparams = 0;
+    virMutexContentionStatsPtr stats = NULL;
+    size_t nstats = 0;
+    size_t i;
+    virTypedParameterPtr tmpparams = NULL;
+
+    virCheckFlags(0, -1);
+
+    if (virMutexGetContentionStats(&stats, &nstats, ADMIN_LOCK_STATS_MAX) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddBoolean(&tmpparams, nparams, &maxparams,
+                                 VIR_LOCK_STATS_PROFILING,
+                                 virMutexGetProfiling()) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_LOCK_STATS_COUNT, nstats) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nstats; i++) {
+        if (adminAddLockStats(&tmpparams, nparams, &maxparams,
+                              i, &stats[i]) < 0)
+            goto cleanup;
+    }
+
+    *params = tmpparams;
+    tmpparams = NULL;
+    ret = 0;
+
+ cleanup:
+    virMutexContentionStatsFree(stats, nstats);
+    virTypedParamsFree(tmpparams, *nparams);
+    return ret;
+}
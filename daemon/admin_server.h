@@ -72,4 +72,33 @@ int adminServerSetClientLimits(virNetServerPtr srv,
                                int nparams,
                                unsigned int flags);
 
+int adminConnectGetEventLoopStats(virTypedParameterPtr *params,
+                                  int *nparams,
+                                  unsigned int flags);
+
+int adminConnectGetEventLoopParameters(virTypedParameterPtr *params,
+                                       int *nparams,
+                                       unsigned int flags);
+
+int adminConnectSetEventLoopParameters(virTypedParameterPtr params,
+                                       int nparams,
+                                       unsigned int flags);
+
+int adminServerGetRPCStats(virNetServerPtr srv,
+                           virTypedParameterPtr *params,
+                           int *nparams,
+                           unsigned int flags);
+
+int adminConnectGetCommandBrokerStats(virTypedParameterPtr *params,
+                                      int *nparams,
+                                      unsigned int flags);
+
+int adminConnectGetMemoryStats(virTypedParameterPtr *params,
+                               int *nparams,
+                               unsigned int flags);
+
+int adminConnectGetLockStats(virTypedParameterPtr *params,
+                             int *nparams,
+                             unsigned int flags);
+
 #endif /* __LIBVIRTD_ADMIN_SERVER_H__ */
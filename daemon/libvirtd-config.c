@@ -156,6 +156,8 @@ daemonConfigNew(bool privileged ATTRIBUTE_UNUSED)
     data->max_requests = 20;
     data->max_client_requests = 5;
 
+    data->event_loop_threads = 1;
+
     data->audit_level = 1;
     data->audit_logging = 0;
 
@@ -248,6 +250,7 @@ daemonConfigFree(struct daemonConfig *data)
     VIR_FREE(data->host_uuid_source);
     VIR_FREE(data->log_filters);
     VIR_FREE(data->log_outputs);
+    VIR_FREE(data->trace_file);
 
     VIR_FREE(data);
 }
@@ -352,6 +355,23 @@ daemonConfigLoadOptions(struct daemonConfig *data,
         goto error;
     if (virConfGetValueUInt(conf, "max_client_requests", &data->max_client_requests) < 0)
         goto error;
+    if (virConfGetValueUInt(conf, "max_client_request_rate", &data->max_client_request_rate) < 0)
+        goto error;
+    if (virConfGetValueUInt(conf, "max_client_request_burst", &data->max_client_request_burst) < 0)
+        goto error;
+    if (virConfGetValueUInt(conf, "max_identity_request_rate", &data->max_identity_request_rate) < 0)
+        goto error;
+    if (virConfGetValueUInt(conf, "max_identity_request_burst", &data->max_identity_request_burst) < 0)
+        goto error;
+
+    if (virConfGetValueUInt(conf, "event_loop_threads", &data->event_loop_threads) < 0)
+        goto error;
+    if (virConfGetValueUInt(conf, "event_coalesce_interval", &data->event_coalesce_interval) < 0)
+        goto error;
+    if (virConfGetValueUInt(conf, "event_loop_stall_threshold", &data->event_loop_stall_threshold) < 0)
+        goto error;
+    if (virConfGetValueBool(conf, "lock_profiling", &data->lock_profiling) < 0)
+        goto error;
 
     if (virConfGetValueUInt(conf, "admin_min_workers", &data->admin_min_workers) < 0)
         goto error;
@@ -380,6 +400,10 @@ daemonConfigLoadOptions(struct daemonConfig *data,
         goto error;
     if (virConfGetValueString(conf, "log_outputs", &data->log_outputs) < 0)
         goto error;
+    if (virConfGetValueUInt(conf, "log_queue_length", &data->log_queue_length) < 0)
+        goto error;
+    if (virConfGetValueString(conf, "trace_file", &data->trace_file) < 0)
+        goto error;
 
     if (virConfGetValueInt(conf, "keepalive_interval", &data->keepalive_interval) < 0)
         goto error;
@@ -394,6 +418,9 @@ daemonConfigLoadOptions(struct daemonConfig *data,
     if (virConfGetValueUInt(conf, "ovs_timeout", &data->ovs_timeout) < 0)
         goto error;
 
+    if (virConfGetValueBool(conf, "command_broker", &data->command_broker) < 0)
+        goto error;
+
     return 0;
 
  error:
@@ -73,10 +73,21 @@ struct daemonConfig {
 
     unsigned int max_requests;
     unsigned int max_client_requests;
+    unsigned int max_client_request_rate;
+    unsigned int max_client_request_burst;
+    unsigned int max_identity_request_rate;
+    unsigned int max_identity_request_burst;
+
+    unsigned int event_loop_threads;
+    unsigned int event_coalesce_interval;
+    unsigned int event_loop_stall_threshold;
+    bool lock_profiling;
 
     unsigned int log_level;
     char *log_filters;
     char *log_outputs;
+    unsigned int log_queue_length;
+    char *trace_file;
 
     unsigned int audit_level;
     bool audit_logging;
@@ -94,6 +105,8 @@ struct daemonConfig {
     unsigned int admin_keepalive_count;
 
     unsigned int ovs_timeout;
+
+    bool command_broker;
 };
 
 
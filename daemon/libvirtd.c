@@ -32,6 +32,7 @@
 #include <grp.h>
 
 #include "libvirt_internal.h"
+#include "vircommandbroker.h"
 #include "virerror.h"
 #include "virfile.h"
 #include "virlog.h"
@@ -50,10 +51,12 @@
 #include "virconf.h"
 #include "virnetlink.h"
 #include "virnetdaemon.h"
+#include "vireventpoll.h"
 #include "remote.h"
 #include "virhook.h"
 #include "viraudit.h"
 #include "virstring.h"
+#include "virtrace.h"
 #include "locking/lock_manager.h"
 #include "viraccessmanager.h"
 #include "virutil.h"
@@ -354,10 +357,10 @@ static void daemonInitialize(void)
 {
     /*
      * Note that the order is important: the first ones have a higher
-     * priority when calling virStateInitialize. We must register the
-     * network, storage and nodedev drivers before any stateful domain
-     * driver, since their resources must be auto-started before any
-     * domains can be auto-started.
+     * priority when calling virStateInitialize and virStateAutoStart. We
+     * must register the network, storage and nodedev drivers before any
+     * stateful domain driver, since their resources must be auto-started
+     * before any domains can be auto-started.
      */
     /* We don't care if any of these fail, because the whole point
      * is to allow users to only install modules they want to use.
@@ -887,8 +890,6 @@ static void daemonRunStateInit(void *opaque)
         goto cleanup;
     }
 
-    driversInitialized = true;
-
 #ifdef HAVE_DBUS
     /* Tie the non-privileged libvirtd to the session/shutdown lifecycle */
     if (!virNetDaemonIsPrivileged(dmn)) {
@@ -910,6 +911,14 @@ static void daemonRunStateInit(void *opaque)
 #endif
     /* Only now accept clients from network */
     virNetDaemonUpdateServices(dmn, true);
+
+    /* The clients don't have to wait for the autostart networks, storage
+     * pools and domains to be started. The shutdown remains inhibited
+     * until they are, and so does any driver cleanup or reload. */
+    virStateAutoStart();
+
+    driversInitialized = true;
+
  cleanup:
     daemonInhibitCallback(false, dmn);
     virObjectUnref(dmn);
@@ -1339,6 +1348,28 @@ int main(int argc, char **argv) {
         goto cleanup;
     }
 
+    /* Fork the command broker while the daemon is still small and
+     * doesn't run any thread yet */
+    if (config->command_broker &&
+        virCommandBrokerStart() < 0) {
+        ret = VIR_DAEMON_ERR_INIT;
+        goto cleanup;
+    }
+
+    /* The writer thread wouldn't survive daemonizing, so it can only
+     * be started now */
+    if (config->log_queue_length &&
+        virLogSetAsync(config->log_queue_length) < 0) {
+        ret = VIR_DAEMON_ERR_INIT;
+        goto cleanup;
+    }
+
+    if (config->trace_file &&
+        virTraceSetOutput(config->trace_file, "libvirtd") < 0) {
+        ret = VIR_DAEMON_ERR_INIT;
+        goto cleanup;
+    }
+
     if (virNetlinkStartup() < 0) {
         ret = VIR_DAEMON_ERR_INIT;
         goto cleanup;
@@ -1361,12 +1392,25 @@ int main(int argc, char **argv) {
         goto cleanup;
     }
 
+    virNetServerSetRequestRateLimits(srv,
+                                     config->max_client_request_rate,
+                                     config->max_client_request_burst,
+                                     config->max_identity_request_rate,
+                                     config->max_identity_request_burst);
+
     if (!(dmn = virNetDaemonNew()) ||
         virNetDaemonAddServer(dmn, srv) < 0) {
         ret = VIR_DAEMON_ERR_INIT;
         goto cleanup;
     }
 
+    if (virEventPollSetLoopThreads(config->event_loop_threads) < 0) {
+        ret = VIR_DAEMON_ERR_INIT;
+        goto cleanup;
+    }
+    virEventPollSetStallThreshold(config->event_loop_stall_threshold);
+    virMutexSetProfiling(config->lock_profiling);
+
     /* Beyond this point, nothing should rely on using
      * getuid/geteuid() == 0, for privilege level checks.
      */
@@ -1383,6 +1427,7 @@ int main(int argc, char **argv) {
     remoteProcs[REMOTE_PROC_AUTH_SASL_STEP].needAuth = false;
     remoteProcs[REMOTE_PROC_AUTH_SASL_START].needAuth = false;
     remoteProcs[REMOTE_PROC_AUTH_POLKIT].needAuth = false;
+    remoteSetEventCoalesceInterval(config->event_coalesce_interval);
     if (!(remoteProgram = virNetServerProgramNew(REMOTE_PROGRAM,
                                                  REMOTE_PROTOCOL_VERSION,
                                                  remoteProcs,
@@ -1585,5 +1630,8 @@ int main(int argc, char **argv) {
      * 'dmn' as a parameter are done, we can finally unref 'dmn' */
     virObjectUnref(dmn);
 
+    /* Write out whatever is still queued */
+    virLogSetAsync(0);
+
     return ret;
 }
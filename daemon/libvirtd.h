@@ -79,6 +79,9 @@ struct daemonClientPrivate {
     virConnectPtr conn;
 
     daemonClientStreamPtr streams;
+    /* Whether the client accepts stream data messages larger than
+     * VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX */
+    bool largeStreamFrames;
 };
 
 /* Separate private data for admin connection */
@@ -37,6 +37,7 @@
 #include "virnetserverservice.h"
 #include "virnetserver.h"
 #include "virfile.h"
+#include "virhash.h"
 #include "virtypedparam.h"
 #include "virdbus.h"
 #include "virprocess.h"
@@ -52,6 +53,8 @@
 #include "viraccessapicheckqemu.h"
 #include "virpolkit.h"
 #include "virthreadjob.h"
+#include "virtrace.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
@@ -76,13 +79,50 @@ VIR_LOG_INIT("daemon.remote");
 # define HYPER_TO_ULONG(_to, _from) (_to) = (_from)
 #endif
 
+typedef struct daemonClientEventCoalesce daemonClientEventCoalesce;
+typedef daemonClientEventCoalesce *daemonClientEventCoalescePtr;
+
 struct daemonClientEventCallback {
     virNetServerClientPtr client;
     int eventID;
     int callbackID;
     bool legacy;
+    daemonClientEventCoalescePtr coalesce;
+};
+
+typedef void (*daemonClientEventCoalesceSend)(daemonClientEventCallbackPtr callback,
+                                              virDomainPtr dom,
+                                              long long value);
+
+/* The state of the coalesced events of one callback for one domain */
+typedef struct daemonClientEventPending daemonClientEventPending;
+typedef daemonClientEventPending *daemonClientEventPendingPtr;
+struct daemonClientEventPending {
+    unsigned long long sent;  /* when the last event was sent, in ms */
+    bool pending;             /* whether the latest event is held back */
+    virDomainPtr dom;
+    long long value;
+};
+
+/* Events of a callback which only report the latest value of something
+ * and are not sent more often than remoteEventCoalesceInterval */
+struct daemonClientEventCoalesce {
+    virObjectLockable parent;
+
+    /* Copy of the callback, with a reference on the client, for
+     * sending held back events after it is gone */
+    daemonClientEventCallback callback;
+    daemonClientEventCoalesceSend sendFunc;
+
+    virHashTablePtr domains;  /* UUID -> daemonClientEventPending */
+    int timer;
+    unsigned long long due;   /* when the timer fires, 0 if disabled */
+    bool closed;
 };
 
+static virClassPtr daemonClientEventCoalesceClass;
+static unsigned int remoteEventCoalesceInterval;
+
 static virDomainPtr get_nonnull_domain(virConnectPtr conn, remote_nonnull_domain domain);
 static virNetworkPtr get_nonnull_network(virConnectPtr conn, remote_nonnull_network network);
 static virInterfacePtr get_nonnull_interface(virConnectPtr conn, remote_nonnull_interface iface);
@@ -121,13 +161,301 @@ remoteDispatchObjectEventSend(virNetServerClientPtr client,
                               xdrproc_t proc,
                               void *data);
 
+static void daemonClientEventCoalesceClose(daemonClientEventCoalescePtr coalesce);
+
 static void
 remoteEventCallbackFree(void *opaque)
 {
+    daemonClientEventCallbackPtr callback = opaque;
+
+    if (callback->coalesce)
+        daemonClientEventCoalesceClose(callback->coalesce);
     VIR_FREE(opaque);
 }
 
 
+/**
+ * remoteSetEventCoalesceInterval:
+ * @interval: minimum interval between events, in milliseconds
+ *
+ * Set how often the events only reporting the latest value of
+ * something may be sent to a client for a given callback and domain.
+ * Those coming sooner are held back and replaced by the next one.
+ * The value of 0 disables coalescing.
+ */
+void
+remoteSetEventCoalesceInterval(unsigned int interval)
+{
+    remoteEventCoalesceInterval = interval;
+}
+
+
+static void
+daemonClientEventCoalesceDispose(void *obj)
+{
+    daemonClientEventCoalescePtr coalesce = obj;
+
+    virHashFree(coalesce->domains);
+    virObjectUnref(coalesce->callback.client);
+}
+
+
+static int
+daemonClientEventCoalesceOnceInit(void)
+{
+    if (!(daemonClientEventCoalesceClass =
+          virClassNew(virClassForObjectLockable(),
+                      "daemonClientEventCoalesce",
+                      sizeof(daemonClientEventCoalesce),
+                      daemonClientEventCoalesceDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(daemonClientEventCoalesce)
+
+
+static void
+daemonClientEventPendingFree(void *payload,
+                             const void *name ATTRIBUTE_UNUSED)
+{
+    daemonClientEventPendingPtr pending = payload;
+
+    virObjectUnref(pending->dom);
+    VIR_FREE(pending);
+}
+
+
+struct daemonClientEventCoalesceData {
+    unsigned long long now;
+    unsigned long long next;  /* when the next held event is due */
+    daemonClientEventPendingPtr due;
+    size_t ndue;
+};
+
+
+static int
+daemonClientEventCoalesceCollect(void *payload,
+                                 const void *name ATTRIBUTE_UNUSED,
+                                 void *opaque)
+{
+    daemonClientEventPendingPtr pending = payload;
+    struct daemonClientEventCoalesceData *data = opaque;
+    unsigned long long when = pending->sent + remoteEventCoalesceInterval;
+
+    if (!pending->pending)
+        return 0;
+
+    /* Try again later if we can't send it now */
+    if (when <= data->now &&
+        VIR_APPEND_ELEMENT_COPY(data->due, data->ndue, *pending) < 0)
+        when = data->now + remoteEventCoalesceInterval;
+
+    if (when > data->now) {
+        if (!data->next || when < data->next)
+            data->next = when;
+        return 0;
+    }
+
+    /* The copy now owns the reference on the domain */
+    pending->dom = NULL;
+    pending->pending = false;
+    pending->sent = data->now;
+    return 0;
+}
+
+
+static int
+daemonClientEventCoalesceIdle(const void *payload,
+                              const void *name ATTRIBUTE_UNUSED,
+                              const void *opaque)
+{
+    const daemonClientEventPending *pending = payload;
+    const unsigned long long *now = opaque;
+
+    return !pending->pending &&
+        pending->sent + remoteEventCoalesceInterval <= *now;
+}
+
+
+static void
+daemonClientEventCoalesceTimer(int timer ATTRIBUTE_UNUSED,
+                               void *opaque)
+{
+    daemonClientEventCoalescePtr coalesce = opaque;
+    struct daemonClientEventCoalesceData data = { 0 };
+    daemonClientEventCallback callback;
+    size_t i;
+
+    virObjectLock(coalesce);
+    coalesce->due = 0;
+
+    if (coalesce->closed) {
+        virObjectUnlock(coalesce);
+        return;
+    }
+
+    if (virTimeMillisNow(&data.now) < 0) {
+        virEventUpdateTimeout(coalesce->timer, -1);
+        virObjectUnlock(coalesce);
+        return;
+    }
+
+    virHashForEach(coalesce->domains, daemonClientEventCoalesceCollect, &data);
+
+    /* Forget about the domains which are quiet again */
+    virHashRemoveSet(coalesce->domains, daemonClientEventCoalesceIdle,
+                     &data.now);
+
+    coalesce->due = data.next;
+    virEventUpdateTimeout(coalesce->timer,
+                          data.next ? data.next - data.now : -1);
+    callback = coalesce->callback;
+    virObjectUnlock(coalesce);
+
+    /* The client lock is taken when sending, which must not be done
+     * while holding ours */
+    for (i = 0; i < data.ndue; i++) {
+        coalesce->sendFunc(&callback, data.due[i].dom, data.due[i].value);
+        virObjectUnref(data.due[i].dom);
+    }
+    VIR_FREE(data.due);
+}
+
+
+static daemonClientEventCoalescePtr
+daemonClientEventCoalesceNew(daemonClientEventCallbackPtr callback,
+                             daemonClientEventCoalesceSend sendFunc)
+{
+    daemonClientEventCoalescePtr coalesce;
+
+    if (daemonClientEventCoalesceInitialize() < 0)
+        return NULL;
+
+    if (!(coalesce = virObjectLockableNew(daemonClientEventCoalesceClass)))
+        return NULL;
+
+    if (!(coalesce->domains = virHashCreate(0, daemonClientEventPendingFree)))
+        goto error;
+
+    coalesce->callback = *callback;
+    coalesce->callback.coalesce = NULL;
+    virObjectRef(coalesce->callback.client);
+    coalesce->sendFunc = sendFunc;
+
+    /* The timer has its own reference */
+    if ((coalesce->timer = virEventAddTimeout(-1,
+                                              daemonClientEventCoalesceTimer,
+                                              coalesce,
+                                              virObjectFreeCallback)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("could not initialize event coalescing timer"));
+        goto error;
+    }
+    virObjectRef(coalesce);
+
+    return coalesce;
+
+ error:
+    virObjectUnref(coalesce);
+    return NULL;
+}
+
+
+static void
+daemonClientEventCoalesceClose(daemonClientEventCoalescePtr coalesce)
+{
+    virObjectLock(coalesce);
+    coalesce->closed = true;
+    if (coalesce->timer != -1) {
+        virEventRemoveTimeout(coalesce->timer);
+        coalesce->timer = -1;
+    }
+    virHashRemoveAll(coalesce->domains);
+    virObjectUnlock(coalesce);
+    virObjectUnref(coalesce);
+}
+
+
+/**
+ * remoteRelayDomainEventCoalesce:
+ * @callback: the callback the event is for
+ * @dom: the domain the event is about
+ * @value: the latest value reported by the event
+ * @sendFunc: function sending the event to the client
+ *
+ * Send the event to the client, unless there was another one for the
+ * same domain less than remoteEventCoalesceInterval ago.  In that case
+ * it is held back until the interval is over, replacing any older
+ * event held back.
+ */
+static void
+remoteRelayDomainEventCoalesce(daemonClientEventCallbackPtr callback,
+                               virDomainPtr dom,
+                               long long value,
+                               daemonClientEventCoalesceSend sendFunc)
+{
+    daemonClientEventCoalescePtr coalesce;
+    daemonClientEventPendingPtr pending;
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    unsigned long long now;
+    unsigned long long when;
+
+    if (remoteEventCoalesceInterval == 0 ||
+        virTimeMillisNow(&now) < 0)
+        goto immediate;
+
+    /* Events are dispatched from the event loop, and the callback is
+     * not freed while that happens, so there's no race here */
+    if (!callback->coalesce &&
+        !(callback->coalesce = daemonClientEventCoalesceNew(callback,
+                                                            sendFunc)))
+        goto immediate;
+    coalesce = callback->coalesce;
+
+    virUUIDFormat(dom->uuid, uuidstr);
+
+    virObjectLock(coalesce);
+    if (!(pending = virHashLookup(coalesce->domains, uuidstr))) {
+        if (VIR_ALLOC(pending) < 0 ||
+            virHashAddEntry(coalesce->domains, uuidstr, pending) < 0) {
+            VIR_FREE(pending);
+            virObjectUnlock(coalesce);
+            goto immediate;
+        }
+    }
+
+    when = pending->sent + remoteEventCoalesceInterval;
+    if (when <= now) {
+        /* Anything held back is older than this one */
+        virObjectUnref(pending->dom);
+        pending->dom = NULL;
+        pending->pending = false;
+        pending->sent = now;
+        virObjectUnlock(coalesce);
+        goto immediate;
+    }
+
+    VIR_DEBUG("Holding back event for domain %s, callback %d, until %llu",
+              dom->name, callback->callbackID, when);
+    virObjectUnref(pending->dom);
+    pending->dom = virObjectRef(dom);
+    pending->value = value;
+    pending->pending = true;
+
+    if (!coalesce->due || when < coalesce->due) {
+        coalesce->due = when;
+        virEventUpdateTimeout(coalesce->timer, when - now);
+    }
+    virObjectUnlock(coalesce);
+    return;
+
+ immediate:
+    sendFunc(callback, dom, value);
+}
+
+
 static bool
 remoteRelayDomainEventCheckACL(virNetServerClientPtr client,
                                virConnectPtr conn, virDomainPtr dom)
@@ -367,23 +695,13 @@ remoteRelayDomainEventReboot(virConnectPtr conn,
 }
 
 
-static int
-remoteRelayDomainEventRTCChange(virConnectPtr conn,
-                                virDomainPtr dom,
-                                long long offset,
-                                void *opaque)
+static void
+remoteRelayDomainEventRTCChangeSend(daemonClientEventCallbackPtr callback,
+                                    virDomainPtr dom,
+                                    long long offset)
 {
-    daemonClientEventCallbackPtr callback = opaque;
     remote_domain_event_rtc_change_msg data;
 
-    if (callback->callbackID < 0 ||
-        !remoteRelayDomainEventCheckACL(callback->client, conn, dom))
-        return -1;
-
-    VIR_DEBUG("Relaying domain rtc change event %s %d %lld, callback %d legacy %d",
-              dom->name, dom->id, offset,
-              callback->callbackID, callback->legacy);
-
     /* build return data */
     memset(&data, 0, sizeof(data));
     make_nonnull_domain(&data.dom, dom);
@@ -401,11 +719,31 @@ remoteRelayDomainEventRTCChange(virConnectPtr conn,
                                       REMOTE_PROC_DOMAIN_EVENT_CALLBACK_RTC_CHANGE,
                                       (xdrproc_t)xdr_remote_domain_event_callback_rtc_change_msg, &msg);
     }
+}
+
+
+static int
+remoteRelayDomainEventRTCChange(virConnectPtr conn,
+                                virDomainPtr dom,
+                                long long offset,
+                                void *opaque)
+{
+    daemonClientEventCallbackPtr callback = opaque;
+
+    if (callback->callbackID < 0 ||
+        !remoteRelayDomainEventCheckACL(callback->client, conn, dom))
+        return -1;
+
+    VIR_DEBUG("Relaying domain rtc change event %s %d %lld, callback %d legacy %d",
+              dom->name, dom->id, offset,
+              callback->callbackID, callback->legacy);
+
+    remoteRelayDomainEventCoalesce(callback, dom, offset,
+                                   remoteRelayDomainEventRTCChangeSend);
 
     return 0;
 }
 
-
 static int
 remoteRelayDomainEventWatchdog(virConnectPtr conn,
                                virDomainPtr dom,
@@ -886,22 +1224,13 @@ remoteRelayDomainEventPMSuspend(virConnectPtr conn,
     return 0;
 }
 
-static int
-remoteRelayDomainEventBalloonChange(virConnectPtr conn,
-                                    virDomainPtr dom,
-                                    unsigned long long actual,
-                                    void *opaque)
+static void
+remoteRelayDomainEventBalloonChangeSend(daemonClientEventCallbackPtr callback,
+                                        virDomainPtr dom,
+                                        long long actual)
 {
-    daemonClientEventCallbackPtr callback = opaque;
     remote_domain_event_balloon_change_msg data;
 
-    if (callback->callbackID < 0 ||
-        !remoteRelayDomainEventCheckACL(callback->client, conn, dom))
-        return -1;
-
-    VIR_DEBUG("Relaying domain balloon change event %s %d %lld, callback %d",
-              dom->name, dom->id, actual, callback->callbackID);
-
     /* build return data */
     memset(&data, 0, sizeof(data));
     make_nonnull_domain(&data.dom, dom);
@@ -919,6 +1248,26 @@ remoteRelayDomainEventBalloonChange(virConnectPtr conn,
                                       REMOTE_PROC_DOMAIN_EVENT_CALLBACK_BALLOON_CHANGE,
                                       (xdrproc_t)xdr_remote_domain_event_callback_balloon_change_msg, &msg);
     }
+}
+
+
+static int
+remoteRelayDomainEventBalloonChange(virConnectPtr conn,
+                                    virDomainPtr dom,
+                                    unsigned long long actual,
+                                    void *opaque)
+{
+    daemonClientEventCallbackPtr callback = opaque;
+
+    if (callback->callbackID < 0 ||
+        !remoteRelayDomainEventCheckACL(callback->client, conn, dom))
+        return -1;
+
+    VIR_DEBUG("Relaying domain balloon change event %s %d %lld, callback %d",
+              dom->name, dom->id, actual, callback->callbackID);
+
+    remoteRelayDomainEventCoalesce(callback, dom, actual,
+                                   remoteRelayDomainEventBalloonChangeSend);
 
     return 0;
 }
@@ -1147,6 +1496,27 @@ remoteRelayDomainEventDeviceAdded(virConnectPtr conn,
 }
 
 
+static void
+remoteRelayDomainEventMigrationIterationSend(daemonClientEventCallbackPtr callback,
+                                             virDomainPtr dom,
+                                             long long iteration)
+{
+    remote_domain_event_callback_migration_iteration_msg data;
+
+    /* build return data */
+    memset(&data, 0, sizeof(data));
+    data.callbackID = callback->callbackID;
+    make_nonnull_domain(&data.dom, dom);
+
+    data.iteration = iteration;
+
+    remoteDispatchObjectEventSend(callback->client, remoteProgram,
+                                  REMOTE_PROC_DOMAIN_EVENT_CALLBACK_MIGRATION_ITERATION,
+                                  (xdrproc_t)xdr_remote_domain_event_callback_migration_iteration_msg,
+                                  &data);
+}
+
+
 static int
 remoteRelayDomainEventMigrationIteration(virConnectPtr conn,
                                          virDomainPtr dom,
@@ -1154,7 +1524,6 @@ remoteRelayDomainEventMigrationIteration(virConnectPtr conn,
                                          void *opaque)
 {
     daemonClientEventCallbackPtr callback = opaque;
-    remote_domain_event_callback_migration_iteration_msg data;
 
     if (callback->callbackID < 0 ||
         !remoteRelayDomainEventCheckACL(callback->client, conn, dom))
@@ -1164,17 +1533,8 @@ remoteRelayDomainEventMigrationIteration(virConnectPtr conn,
               "callback %d, iteration %d",
               dom->name, dom->id, callback->callbackID, iteration);
 
-    /* build return data */
-    memset(&data, 0, sizeof(data));
-    data.callbackID = callback->callbackID;
-    make_nonnull_domain(&data.dom, dom);
-
-    data.iteration = iteration;
-
-    remoteDispatchObjectEventSend(callback->client, remoteProgram,
-                                  REMOTE_PROC_DOMAIN_EVENT_CALLBACK_MIGRATION_ITERATION,
-                                  (xdrproc_t)xdr_remote_domain_event_callback_migration_iteration_msg,
-                                  &data);
+    remoteRelayDomainEventCoalesce(callback, dom, iteration,
+                                   remoteRelayDomainEventMigrationIterationSend);
 
     return 0;
 }
@@ -1340,6 +1700,81 @@ remoteRelayDomainEventBlockThreshold(virConnectPtr conn,
 }
 
 
+static int
+remoteRelayDomainEventStats(virConnectPtr conn,
+                            virDomainPtr dom,
+                            virTypedParameterPtr params,
+                            int nparams,
+                            void *opaque)
+{
+    daemonClientEventCallbackPtr callback = opaque;
+    remote_domain_event_callback_stats_msg data;
+
+    if (callback->callbackID < 0 ||
+        !remoteRelayDomainEventCheckACL(callback->client, conn, dom))
+        return -1;
+
+    VIR_DEBUG("Relaying domain stats event %s %d, callback %d, params %p %d",
+              dom->name, dom->id, callback->callbackID, params, nparams);
+
+    /* build return data */
+    memset(&data, 0, sizeof(data));
+    data.callbackID = callback->callbackID;
+    make_nonnull_domain(&data.dom, dom);
+
+    if (virTypedParamsSerialize(params, nparams,
+                                (virTypedParameterRemotePtr *) &data.params.params_val,
+                                &data.params.params_len,
+                                VIR_TYPED_PARAM_STRING_OKAY) < 0)
+        return -1;
+
+    remoteDispatchObjectEventSend(callback->client, remoteProgram,
+                                  REMOTE_PROC_DOMAIN_EVENT_CALLBACK_STATS,
+                                  (xdrproc_t)xdr_remote_domain_event_callback_stats_msg,
+                                  &data);
+
+    return 0;
+}
+
+
+static int
+remoteRelayDomainEventBlockJobGroup(virConnectPtr conn,
+                                    virDomainPtr dom,
+                                    virTypedParameterPtr params,
+                                    int nparams,
+                                    void *opaque)
+{
+    daemonClientEventCallbackPtr callback = opaque;
+    remote_domain_event_callback_block_job_group_msg data;
+
+    if (callback->callbackID < 0 ||
+        !remoteRelayDomainEventCheckACL(callback->client, conn, dom))
+        return -1;
+
+    VIR_DEBUG("Relaying domain block job group event %s %d, callback %d, "
+              "params %p %d",
+              dom->name, dom->id, callback->callbackID, params, nparams);
+
+    /* build return data */
+    memset(&data, 0, sizeof(data));
+    data.callbackID = callback->callbackID;
+    make_nonnull_domain(&data.dom, dom);
+
+    if (virTypedParamsSerialize(params, nparams,
+                                (virTypedParameterRemotePtr *) &data.params.params_val,
+                                &data.params.params_len,
+                                VIR_TYPED_PARAM_STRING_OKAY) < 0)
+        return -1;
+
+    remoteDispatchObjectEventSend(callback->client, remoteProgram,
+                                  REMOTE_PROC_DOMAIN_EVENT_CALLBACK_BLOCK_JOB_GROUP,
+                                  (xdrproc_t)xdr_remote_domain_event_callback_block_job_group_msg,
+                                  &data);
+
+    return 0;
+}
+
+
 static virConnectDomainEventGenericCallback domainEventCallbacks[] = {
     VIR_DOMAIN_EVENT_CALLBACK(remoteRelayDomainEventLifecycle),
     VIR_DOMAIN_EVENT_CALLBACK(remoteRelayDomainEventReboot),
@@ -1366,6 +1801,8 @@ static virConnectDomainEventGenericCallback domainEventCallbacks[] = {
     VIR_DOMAIN_EVENT_CALLBACK(remoteRelayDomainEventDeviceRemovalFailed),
     VIR_DOMAIN_EVENT_CALLBACK(remoteRelayDomainEventMetadataChange),
     VIR_DOMAIN_EVENT_CALLBACK(remoteRelayDomainEventBlockThreshold),
+    VIR_DOMAIN_EVENT_CALLBACK(remoteRelayDomainEventStats),
+    VIR_DOMAIN_EVENT_CALLBACK(remoteRelayDomainEventBlockJobGroup),
 };
 
 verify(ARRAY_CARDINALITY(domainEventCallbacks) == VIR_DOMAIN_EVENT_ID_LAST);
@@ -3171,6 +3608,53 @@ remoteDispatchDomainGetPerfEvents(virNetServerPtr server ATTRIBUTE_UNUSED,
     return rv;
 }
 
+static int
+remoteDispatchDomainBlockJobGroupGetStats(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                          virNetServerClientPtr client ATTRIBUTE_UNUSED,
+                                          virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                          virNetMessageErrorPtr rerr,
+                                          remote_domain_block_job_group_get_stats_args *args,
+                                          remote_domain_block_job_group_get_stats_ret *ret)
+{
+    virDomainPtr dom = NULL;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    int rv = -1;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if (!(dom = get_nonnull_domain(priv->conn, args->dom)))
+        goto cleanup;
+
+    if (virDomainBlockJobGroupGetStats(dom, &params, &nparams, args->flags) < 0)
+        goto cleanup;
+
+    if (nparams > REMOTE_DOMAIN_BLOCK_JOB_GROUP_PARAMETERS_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("nparams too large"));
+        goto cleanup;
+    }
+
+    if (virTypedParamsSerialize(params, nparams,
+                                (virTypedParameterRemotePtr *) &ret->params.params_val,
+                                &ret->params.params_len,
+                                VIR_TYPED_PARAM_STRING_OKAY) < 0)
+        goto cleanup;
+
+    rv = 0;
+
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virTypedParamsFree(params, nparams);
+    virObjectUnref(dom);
+    return rv;
+}
+
 static int
 remoteDispatchDomainGetBlockJobInfo(virNetServerPtr server ATTRIBUTE_UNUSED,
                                     virNetServerClientPtr client ATTRIBUTE_UNUSED,
@@ -4716,6 +5200,15 @@ static int remoteDispatchConnectSupportsFeature(virNetServerPtr server ATTRIBUTE
     case VIR_DRV_FEATURE_FD_PASSING:
     case VIR_DRV_FEATURE_REMOTE_EVENT_CALLBACK:
     case VIR_DRV_FEATURE_REMOTE_CLOSE_CALLBACK:
+    case VIR_DRV_FEATURE_REMOTE_CALL_BATCH:
+        supported = 1;
+        break;
+
+    case VIR_DRV_FEATURE_REMOTE_STREAM_LARGE_FRAMES:
+        /* Only clients which can receive large frames ask for them */
+        virMutexLock(&priv->lock);
+        priv->largeStreamFrames = true;
+        virMutexUnlock(&priv->lock);
         supported = 1;
         break;
 
@@ -4736,6 +5229,66 @@ static int remoteDispatchConnectSupportsFeature(virNetServerPtr server ATTRIBUTE
 }
 
 
+static int
+remoteDispatchDomainOpenConsole(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                virNetServerClientPtr client,
+                                virNetMessagePtr msg,
+                                virNetMessageErrorPtr rerr,
+                                remote_domain_open_console_args *args)
+{
+    virDomainPtr dom = NULL;
+    int rv = -1;
+    char *dev_name;
+    unsigned int flags = args->flags;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+    virStreamPtr st = NULL;
+    daemonClientStreamPtr stream = NULL;
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if (!(dom = get_nonnull_domain(priv->conn, args->dom)))
+        goto cleanup;
+
+    dev_name = args->dev_name ? *args->dev_name : NULL;
+
+    if (!(st = virStreamNew(priv->conn, VIR_STREAM_NONBLOCK)) ||
+        !(stream = daemonCreateClientStream(client, st, remoteProgram,
+                                            &msg->header, false)))
+        goto cleanup;
+
+    /* Coalescing is done by the daemon, the driver never sees it */
+    if (flags & VIR_DOMAIN_CONSOLE_COALESCE) {
+        daemonClientStreamSetCoalesce(stream, true);
+        flags &= ~VIR_DOMAIN_CONSOLE_COALESCE;
+    }
+
+    if (virDomainOpenConsole(dom, dev_name, st, flags) < 0)
+        goto cleanup;
+
+    if (daemonAddClientStream(client, stream, true) < 0)
+        goto cleanup;
+
+    rv = 0;
+
+ cleanup:
+    if (rv < 0) {
+        virNetMessageSaveError(rerr);
+        if (stream) {
+            virStreamAbort(st);
+            daemonFreeClientStream(client, stream);
+        } else {
+            virObjectUnref(st);
+        }
+    }
+    virObjectUnref(dom);
+    return rv;
+}
+
+
 static int
 remoteDispatchDomainOpenGraphics(virNetServerPtr server ATTRIBUTE_UNUSED,
                                  virNetServerClientPtr client ATTRIBUTE_UNUSED,
@@ -5373,7 +5926,7 @@ remoteDispatchDomainMigratePrepareTunnel3Params(virNetServerPtr server ATTRIBUTE
 
     if (!(st = virStreamNew(priv->conn, VIR_STREAM_NONBLOCK)) ||
         !(stream = daemonCreateClientStream(client, st, remoteProgram,
-                                            &msg->header)))
+                                            &msg->header, false)))
         goto cleanup;
 
     if (virDomainMigratePrepareTunnel3Params(priv->conn, st, params, nparams,
@@ -6636,6 +7189,75 @@ remoteDispatchConnectGetAllDomainStats(virNetServerPtr server ATTRIBUTE_UNUSED,
 }
 
 
+static int
+remoteDispatchConnectListAllDomainsFields(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                          virNetServerClientPtr client,
+                                          virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                          virNetMessageErrorPtr rerr,
+                                          remote_connect_list_all_domains_fields_args *args,
+                                          remote_connect_list_all_domains_fields_ret *ret)
+{
+    int rv = -1;
+    size_t i;
+    struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
+    virDomainStatsRecordPtr *records = NULL;
+    int nrecords = 0;
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if ((nrecords = virConnectListAllDomainsFields(priv->conn,
+                                                   args->fields,
+                                                   args->need_results ? &records : NULL,
+                                                   args->flags)) < 0)
+        goto cleanup;
+
+    if (nrecords > REMOTE_DOMAIN_LIST_MAX) {
+        virReportError(VIR_ERR_RPC,
+                       _("Too many domains '%d' for limit '%d'"),
+                       nrecords, REMOTE_DOMAIN_LIST_MAX);
+        goto cleanup;
+    }
+
+    if (records && nrecords) {
+        if (VIR_ALLOC_N(ret->records.records_val, nrecords) < 0)
+            goto cleanup;
+
+        ret->records.records_len = nrecords;
+
+        for (i = 0; i < nrecords; i++) {
+            remote_domain_stats_record *dst = ret->records.records_val + i;
+
+            make_nonnull_domain(&dst->dom, records[i]->dom);
+
+            if (virTypedParamsSerialize(records[i]->params,
+                                        records[i]->nparams,
+                                        (virTypedParameterRemotePtr *) &dst->params.params_val,
+                                        &dst->params.params_len,
+                                        VIR_TYPED_PARAM_STRING_OKAY) < 0)
+                goto cleanup;
+        }
+    } else {
+        ret->records.records_len = 0;
+        ret->records.records_val = NULL;
+    }
+
+    ret->ret = nrecords;
+
+    rv = 0;
+
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+
+    virDomainStatsRecordListFree(records);
+
+    return rv;
+}
+
+
 static int
 remoteDispatchNodeAllocPages(virNetServerPtr server ATTRIBUTE_UNUSED,
                              virNetServerClientPtr client,
@@ -6953,6 +7575,55 @@ remoteDispatchStorageVolGetInfoFlags(virNetServerPtr server ATTRIBUTE_UNUSED,
 }
 
 
+static int
+remoteDispatchConnectCompareCPUs(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                 virNetServerClientPtr client,
+                                 virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                 virNetMessageErrorPtr rerr,
+                                 remote_connect_compare_cpus_args *args,
+                                 remote_connect_compare_cpus_ret *ret)
+{
+    int rv = -1;
+    unsigned int ncpus = args->xmlCPUs.xmlCPUs_len;
+    int *results = NULL;
+    char *baseline = NULL;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(results, ncpus * ncpus) < 0)
+        goto cleanup;
+
+    if (virConnectCompareCPUs(priv->conn,
+                              (const char **) args->xmlCPUs.xmlCPUs_val,
+                              ncpus, results,
+                              args->want_baseline ? &baseline : NULL,
+                              args->flags) < 0)
+        goto cleanup;
+
+    if (baseline) {
+        if (VIR_ALLOC(ret->baseline) < 0)
+            goto cleanup;
+        VIR_STEAL_PTR(*ret->baseline, baseline);
+    }
+
+    ret->results.results_len = ncpus * ncpus;
+    VIR_STEAL_PTR(ret->results.results_val, results);
+    rv = 0;
+
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    VIR_FREE(results);
+    VIR_FREE(baseline);
+    return rv;
+}
+
+
 /*----- Helpers. -----*/
 
 /* get_nonnull_domain and get_nonnull_network turn an on-wire
@@ -38,6 +38,8 @@ extern size_t lxcNProcs;
 extern virNetServerProgramProc qemuProcs[];
 extern size_t qemuNProcs;
 
+void remoteSetEventCoalesceInterval(unsigned int interval);
+
 void remoteClientFreeFunc(void *data);
 void *remoteClientInitHook(virNetServerClientPtr client,
                            void *opaque);
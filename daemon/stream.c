@@ -29,6 +29,7 @@
 #include "virlog.h"
 #include "virnetserverclient.h"
 #include "virerror.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_STREAMS
 
@@ -47,14 +48,33 @@ struct daemonClientStream {
     bool recvEOF;
     bool closed;
 
+    /* Whether holes may be transferred in both directions */
+    bool allowSkip;
+
     int filterID;
 
     virNetMessagePtr rx;
     bool tx;
+    /* Outgoing messages not yet written to the client */
+    unsigned int txQueued;
+
+    /* With coalescing, reads following shortly after the last message
+     * are delayed so that bursts of output go out in one message */
+    unsigned int coalesceDelay;
+    int coalesceTimer;
+    unsigned long long lastSend;
 
     daemonClientStreamPtr next;
 };
 
+/* How many outgoing messages of a stream may be waiting to be written
+ * to the client before we stop reading from the stream */
+#define DAEMON_STREAM_TX_WINDOW 4
+
+/* How long in milliseconds a coalescing stream waits for more data */
+#define DAEMON_STREAM_COALESCE_DELAY 10
+
+
 static int
 daemonStreamHandleWrite(virNetServerClientPtr client,
                         daemonClientStream *stream);
@@ -80,7 +100,7 @@ daemonStreamUpdateEvents(daemonClientStream *stream)
         return;
     if (stream->rx)
         newEvents |= VIR_STREAM_EVENT_WRITABLE;
-    if (stream->tx && !stream->recvEOF)
+    if (stream->tx && !stream->recvEOF && stream->coalesceTimer == -1)
         newEvents |= VIR_STREAM_EVENT_READABLE;
 
     virStreamEventUpdateCallback(stream->st, newEvents);
@@ -98,9 +118,12 @@ daemonStreamMessageFinished(virNetMessagePtr msg,
                             void *opaque)
 {
     daemonClientStream *stream = opaque;
-    VIR_DEBUG("stream=%p proc=%d serial=%u",
-              stream, msg->header.proc, msg->header.serial);
+    VIR_DEBUG("stream=%p proc=%d serial=%u queued=%u",
+              stream, msg->header.proc, msg->header.serial,
+              stream->txQueued);
 
+    if (stream->txQueued)
+        stream->txQueued--;
     stream->tx = true;
     daemonStreamUpdateEvents(stream);
 
@@ -108,6 +131,85 @@ daemonStreamMessageFinished(virNetMessagePtr msg,
 }
 
 
+/*
+ * Invoked when the delay of a coalescing stream expires, reads
+ * everything that arrived in the meantime
+ */
+static void
+daemonStreamCoalesceTimeout(int timer, void *opaque)
+{
+    virNetServerClientPtr client = opaque;
+    daemonClientStream *stream;
+    daemonClientPrivatePtr priv = virNetServerClientGetPrivateData(client);
+
+    virEventRemoveTimeout(timer);
+
+    virMutexLock(&priv->lock);
+
+    stream = priv->streams;
+    while (stream) {
+        if (stream->coalesceTimer == timer)
+            break;
+        stream = stream->next;
+    }
+
+    if (!stream)
+        goto cleanup;
+
+    stream->coalesceTimer = -1;
+
+    if (!stream->closed && !stream->recvEOF &&
+        daemonStreamHandleRead(client, stream) < 0) {
+        daemonRemoveClientStream(client, stream);
+        virNetServerClientClose(client);
+        goto cleanup;
+    }
+
+    daemonStreamUpdateEvents(stream);
+
+ cleanup:
+    virMutexUnlock(&priv->lock);
+}
+
+
+/*
+ * Decide whether reading a coalescing stream should wait for more data.
+ * Much like Nagle's algorithm, data is sent right away unless a message
+ * is still queued or was sent less than the delay ago.
+ *
+ * Returns true if the read was postponed
+ */
+static bool
+daemonStreamDelayRead(virNetServerClientPtr client,
+                      daemonClientStream *stream)
+{
+    unsigned long long now;
+
+    if (!stream->coalesceDelay || stream->coalesceTimer != -1)
+        return false;
+
+    if (virTimeMillisNow(&now) < 0) {
+        virResetLastError();
+        return false;
+    }
+
+    if (!stream->txQueued && now - stream->lastSend >= stream->coalesceDelay)
+        return false;
+
+    if ((stream->coalesceTimer = virEventAddTimeout(stream->coalesceDelay,
+                                                    daemonStreamCoalesceTimeout,
+                                                    virObjectRef(client),
+                                                    virObjectFreeCallback)) < 0) {
+        virObjectUnref(client);
+        stream->coalesceTimer = -1;
+        return false;
+    }
+
+    daemonStreamUpdateEvents(stream);
+    return true;
+}
+
+
 /*
  * Callback that gets invoked when a stream becomes writable/readable
  */
@@ -144,10 +246,21 @@ daemonStreamEvent(virStreamPtr st, int events, void *opaque)
         }
     }
 
+    /* Output held back for coalescing must go out before the hangup */
+    if (stream->coalesceTimer != -1 &&
+        (events & (VIR_STREAM_EVENT_ERROR | VIR_STREAM_EVENT_HANGUP))) {
+        virEventRemoveTimeout(stream->coalesceTimer);
+        stream->coalesceTimer = -1;
+        events |= VIR_STREAM_EVENT_READABLE;
+    }
+
     if (!stream->closed && !stream->recvEOF &&
         (events & (VIR_STREAM_EVENT_READABLE))) {
         events = events & ~(VIR_STREAM_EVENT_READABLE);
-        if (daemonStreamHandleRead(client, stream) < 0) {
+        if (!(events & (VIR_STREAM_EVENT_ERROR | VIR_STREAM_EVENT_HANGUP)) &&
+            daemonStreamDelayRead(client, stream)) {
+            /* read later, together with what follows */
+        } else if (daemonStreamHandleRead(client, stream) < 0) {
             daemonRemoveClientStream(client, stream);
             virNetServerClientClose(client);
             goto cleanup;
@@ -209,6 +322,7 @@ daemonStreamEvent(virStreamPtr st, int events, void *opaque)
         msg->cb = daemonStreamMessageFinished;
         msg->opaque = stream;
         stream->refs++;
+        stream->txQueued++;
         if (virNetServerProgramSendStreamData(remoteProgram,
                                               client,
                                               msg,
@@ -285,7 +399,8 @@ daemonStreamFilter(virNetServerClientPtr client ATTRIBUTE_UNUSED,
 
     virMutexLock(&stream->priv->lock);
 
-    if (msg->header.type != VIR_NET_STREAM)
+    if (msg->header.type != VIR_NET_STREAM &&
+        msg->header.type != VIR_NET_STREAM_HOLE)
         goto cleanup;
 
     if (!virNetServerProgramMatches(stream->prog, msg))
@@ -312,6 +427,7 @@ daemonStreamFilter(virNetServerClientPtr client ATTRIBUTE_UNUSED,
 /*
  * @conn: a connection object to associate the stream with
  * @header: the method call to associate with the stream
+ * @allowSkip: whether holes may be sent or received on the stream
  *
  * Creates a new stream for this conn
  *
@@ -321,13 +437,14 @@ daemonClientStream *
 daemonCreateClientStream(virNetServerClientPtr client,
                          virStreamPtr st,
                          virNetServerProgramPtr prog,
-                         virNetMessageHeaderPtr header)
+                         virNetMessageHeaderPtr header,
+                         bool allowSkip)
 {
     daemonClientStream *stream;
     daemonClientPrivatePtr priv = virNetServerClientGetPrivateData(client);
 
-    VIR_DEBUG("client=%p, proc=%d, serial=%u, st=%p",
-              client, header->proc, header->serial, st);
+    VIR_DEBUG("client=%p, proc=%d, serial=%u, st=%p, allowSkip=%d",
+              client, header->proc, header->serial, st, allowSkip);
 
     if (VIR_ALLOC(stream) < 0)
         return NULL;
@@ -339,10 +456,28 @@ daemonCreateClientStream(virNetServerClientPtr client,
     stream->serial = header->serial;
     stream->filterID = -1;
     stream->st = st;
+    stream->allowSkip = allowSkip;
+    stream->coalesceTimer = -1;
 
     return stream;
 }
 
+
+/*
+ * @stream: a client stream
+ * @coalesce: whether to batch bursts of outgoing data
+ *
+ * Makes reads which follow shortly after the previous message wait
+ * DAEMON_STREAM_COALESCE_DELAY milliseconds for more data, so that
+ * chatty streams such as consoles send fewer, larger messages.
+ */
+void
+daemonClientStreamSetCoalesce(daemonClientStream *stream,
+                              bool coalesce)
+{
+    stream->coalesceDelay = coalesce ? DAEMON_STREAM_COALESCE_DELAY : 0;
+}
+
 /*
  * @stream: an unused client stream
  *
@@ -462,6 +597,11 @@ daemonRemoveClientStream(virNetServerClientPtr client,
         stream->filterID = -1;
     }
 
+    if (stream->coalesceTimer != -1) {
+        virEventRemoveTimeout(stream->coalesceTimer);
+        stream->coalesceTimer = -1;
+    }
+
     if (!stream->closed) {
         stream->closed = true;
         virStreamEventRemoveCallback(stream->st);
@@ -529,6 +669,7 @@ daemonStreamHandleWriteData(virNetServerClientPtr client,
 
     if (ret > 0) {
         msg->bufferOffset += ret;
+        virNetServerClientAddStreamBytes(client, ret, 0);
 
         /* Partial write, so indicate we have more todo later */
         if (msg->bufferOffset < msg->bufferLength)
@@ -557,6 +698,62 @@ daemonStreamHandleWriteData(virNetServerClientPtr client,
 }
 
 
+/*
+ * Process a hole in the incoming data, as announced by the client.
+ *
+ * Returns 0 if the hole was processed or an error was sent,
+ * 1 if the stream could not take the hole yet,
+ * -1 upon fatal error
+ */
+static int
+daemonStreamHandleHole(virNetServerClientPtr client,
+                       daemonClientStream *stream,
+                       virNetMessagePtr msg)
+{
+    int ret;
+    virNetStreamHole data;
+
+    VIR_DEBUG("client=%p, stream=%p, proc=%d, serial=%u",
+              client, stream, msg->header.proc, msg->header.serial);
+
+    memset(&data, 0, sizeof(data));
+
+    if (!stream->allowSkip) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("stream does not support holes"));
+        ret = -1;
+    } else if (virNetMessageDecodePayload(msg,
+                                          (xdrproc_t) xdr_virNetStreamHole,
+                                          &data) < 0) {
+        ret = -1;
+    } else {
+        ret = virStreamSendHole(stream->st, data.length, data.flags);
+    }
+
+    if (ret == -2) {
+        /* Blocking, so try again once the stream is writable */
+        return 1;
+    } else if (ret < 0) {
+        virNetMessageError rerr;
+
+        memset(&rerr, 0, sizeof(rerr));
+
+        VIR_INFO("Stream send hole failed");
+        stream->closed = true;
+        virStreamEventRemoveCallback(stream->st);
+        virStreamAbort(stream->st);
+
+        return virNetServerProgramSendReplyError(stream->prog,
+                                                 client,
+                                                 msg,
+                                                 &rerr,
+                                                 &msg->header);
+    }
+
+    return 0;
+}
+
+
 /*
  * Process a finish handshake from the client.
  *
@@ -672,7 +869,10 @@ daemonStreamHandleWrite(virNetServerClientPtr client,
             break;
 
         case VIR_NET_CONTINUE:
-            ret = daemonStreamHandleWriteData(client, stream, msg);
+            if (msg->header.type == VIR_NET_STREAM_HOLE)
+                ret = daemonStreamHandleHole(client, stream, msg);
+            else
+                ret = daemonStreamHandleWriteData(client, stream, msg);
             break;
 
         case VIR_NET_ERROR:
@@ -717,7 +917,9 @@ daemonStreamHandleWrite(virNetServerClientPtr client,
  * Invoked when a stream is signalled as having data
  * available to read. This reads up to one message
  * worth of data, and then queues that for transmission
- * to the client.
+ * to the client. Up to DAEMON_STREAM_TX_WINDOW messages
+ * may be queued before reading stops until the client
+ * catches up.
  *
  * Returns 0 if data was queued for TX, or an error RPC
  * was sent, or -1 on fatal error, indicating client should
@@ -727,6 +929,7 @@ static int
 daemonStreamHandleRead(virNetServerClientPtr client,
                        daemonClientStream *stream)
 {
+    daemonClientPrivatePtr priv = virNetServerClientGetPrivateData(client);
     virNetMessagePtr msg = NULL;
     virNetMessageError rerr;
     char *buffer;
@@ -734,6 +937,9 @@ daemonStreamHandleRead(virNetServerClientPtr client,
     int ret = -1;
     int rv;
 
+    if (priv->largeStreamFrames)
+        bufferLen = VIR_NET_MESSAGE_STREAM_PAYLOAD_MAX;
+
     VIR_DEBUG("client=%p, stream=%p tx=%d closed=%d",
               client, stream, stream->tx, stream->closed);
 
@@ -757,8 +963,42 @@ daemonStreamHandleRead(virNetServerClientPtr client,
     if (!(msg = virNetMessageNew(false)))
         goto cleanup;
 
-    rv = virStreamRecv(stream->st, buffer, bufferLen);
-    if (rv == -2) {
+    if (stream->allowSkip)
+        rv = virStreamRecvFlags(stream->st, buffer, bufferLen,
+                                VIR_STREAM_RECV_STOP_AT_HOLE);
+    else
+        rv = virStreamRecv(stream->st, buffer, bufferLen);
+
+    if (rv == -3) {
+        long long length;
+
+        if (virStreamRecvHole(stream->st, &length, 0) < 0) {
+            if (virNetServerProgramSendStreamError(remoteProgram,
+                                                   client,
+                                                   msg,
+                                                   &rerr,
+                                                   stream->procedure,
+                                                   stream->serial) < 0)
+                goto cleanup;
+            msg = NULL;
+        } else {
+            if (++stream->txQueued >= DAEMON_STREAM_TX_WINDOW)
+                stream->tx = false;
+
+            msg->cb = daemonStreamMessageFinished;
+            msg->opaque = stream;
+            stream->refs++;
+            if (virNetServerProgramSendStreamHole(remoteProgram,
+                                                  client,
+                                                  msg,
+                                                  stream->procedure,
+                                                  stream->serial,
+                                                  length,
+                                                  0) < 0)
+                goto cleanup;
+            msg = NULL;
+        }
+    } else if (rv == -2) {
         /* Should never get this, since we're only called when we know
          * we're readable, but hey things change... */
     } else if (rv < 0) {
@@ -771,9 +1011,16 @@ daemonStreamHandleRead(virNetServerClientPtr client,
             goto cleanup;
         msg = NULL;
     } else {
-        stream->tx = false;
+        if (++stream->txQueued >= DAEMON_STREAM_TX_WINDOW)
+            stream->tx = false;
         if (rv == 0)
             stream->recvEOF = true;
+        else
+            virNetServerClientAddStreamBytes(client, 0, rv);
+
+        if (stream->coalesceDelay &&
+            virTimeMillisNow(&stream->lastSend) < 0)
+            virResetLastError();
 
         msg->cb = daemonStreamMessageFinished;
         msg->opaque = stream;
@@ -30,11 +30,15 @@ daemonClientStream *
 daemonCreateClientStream(virNetServerClientPtr client,
                          virStreamPtr st,
                          virNetServerProgramPtr prog,
-                         virNetMessageHeaderPtr hdr);
+                         virNetMessageHeaderPtr hdr,
+                         bool allowSkip);
 
 int daemonFreeClientStream(virNetServerClientPtr client,
                            daemonClientStream *stream);
 
+void daemonClientStreamSetCoalesce(daemonClientStream *stream,
+                                   bool coalesce);
+
 int daemonAddClientStream(virNetServerClientPtr client,
                           daemonClientStream *stream,
                           bool transmit);
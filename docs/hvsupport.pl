@@ -186,6 +186,9 @@ foreach my $drivertable (@drivertable) {
                     $api = "vir$name";
                 } elsif ($name =~ /\w+(Open|Close)/) {
                     next;
+                } elsif ($name eq "SecretLookupValue") {
+                    # internal only method without public API
+                    next;
                 } else {
                     die "driver $name does not have a public API";
                 }
@@ -247,6 +250,7 @@ foreach my $src (@srcs) {
 
                 if (!exists($groups{$ingrp}->{apis}->{$api})) {
                     next if $api =~ /\w(Open|Close)/;
+                    next if $api eq "secretLookupValue";
 
                     die "Found unexpected method $api in $ingrp\n";
                 }
@@ -189,6 +189,103 @@ virAdmServerPtr virAdmConnectLookupServer(virAdmConnectPtr conn,
 
 # define VIR_THREADPOOL_JOB_QUEUE_DEPTH "jobQueueDepth"
 
+/**
+ * VIR_THREADPOOL_JOB_WAIT_COUNT:
+ * Macro for the threadpool jobWaitCount attribute: represents the number of
+ * jobs taken off the queue by a worker since the server was started, as
+ * VIR_TYPED_PARAM_ULLONG.
+ *
+ * NOTE: This attribute is read-only and any attempt to set it will be denied
+ * by daemon
+ */
+
+# define VIR_THREADPOOL_JOB_WAIT_COUNT "jobWaitCount"
+
+/**
+ * VIR_THREADPOOL_JOB_WAIT_TOTAL:
+ * Macro for the threadpool jobWaitTotal attribute: represents the sum of the
+ * times jobs have spent waiting in the queue before a worker picked them up,
+ * in milliseconds, as VIR_TYPED_PARAM_ULLONG.
+ *
+ * NOTE: This attribute is read-only and any attempt to set it will be denied
+ * by daemon
+ */
+
+# define VIR_THREADPOOL_JOB_WAIT_TOTAL "jobWaitTotal"
+
+/**
+ * VIR_THREADPOOL_JOB_WAIT_MAX:
+ * Macro for the threadpool jobWaitMax attribute: represents the longest time
+ * a job has spent waiting in the queue, in milliseconds, as
+ * VIR_TYPED_PARAM_ULLONG.
+ *
+ * NOTE: This attribute is read-only and any attempt to set it will be denied
+ * by daemon
+ */
+
+# define VIR_THREADPOOL_JOB_WAIT_MAX "jobWaitMax"
+
+/**
+ * VIR_THREADPOOL_JOB_WAIT_1MS:
+ * Macro for the threadpool jobWaitUnder1ms attribute: represents the number
+ * of jobs which waited in the queue for less than 1 millisecond, as
+ * VIR_TYPED_PARAM_ULLONG. Together with the following attributes it forms a
+ * histogram of queue wait times.
+ *
+ * NOTE: This attribute is read-only and any attempt to set it will be denied
+ * by daemon
+ */
+
+# define VIR_THREADPOOL_JOB_WAIT_1MS "jobWaitUnder1ms"
+
+/**
+ * VIR_THREADPOOL_JOB_WAIT_10MS:
+ * Macro for the threadpool jobWaitUnder10ms attribute: represents the number
+ * of jobs which waited in the queue for at least 1 but less than 10
+ * milliseconds, as VIR_TYPED_PARAM_ULLONG.
+ *
+ * NOTE: This attribute is read-only and any attempt to set it will be denied
+ * by daemon
+ */
+
+# define VIR_THREADPOOL_JOB_WAIT_10MS "jobWaitUnder10ms"
+
+/**
+ * VIR_THREADPOOL_JOB_WAIT_100MS:
+ * Macro for the threadpool jobWaitUnder100ms attribute: represents the number
+ * of jobs which waited in the queue for at least 10 but less than 100
+ * milliseconds, as VIR_TYPED_PARAM_ULLONG.
+ *
+ * NOTE: This attribute is read-only and any attempt to set it will be denied
+ * by daemon
+ */
+
+# define VIR_THREADPOOL_JOB_WAIT_100MS "jobWaitUnder100ms"
+
+/**
+ * VIR_THREADPOOL_JOB_WAIT_1S:
+ * Macro for the threadpool jobWaitUnder1s attribute: represents the number
+ * of jobs which waited in the queue for at least 100 milliseconds but less
+ * than a second, as VIR_TYPED_PARAM_ULLONG.
+ *
+ * NOTE: This attribute is read-only and any attempt to set it will be denied
+ * by daemon
+ */
+
+# define VIR_THREADPOOL_JOB_WAIT_1S "jobWaitUnder1s"
+
+/**
+ * VIR_THREADPOOL_JOB_WAIT_LONGER:
+ * Macro for the threadpool jobWaitOver1s attribute: represents the number
+ * of jobs which waited in the queue for a second or longer, as
+ * VIR_TYPED_PARAM_ULLONG.
+ *
+ * NOTE: This attribute is read-only and any attempt to set it will be denied
+ * by daemon
+ */
+
+# define VIR_THREADPOOL_JOB_WAIT_LONGER "jobWaitOver1s"
+
 /* Tunables for a server workerpool */
 int virAdmServerGetThreadPoolParameters(virAdmServerPtr srv,
                                         virTypedParameterPtr *params,
@@ -345,6 +442,50 @@ virAdmServerLookupClient(virAdmServerPtr srv,
 
 # define VIR_CLIENT_INFO_SELINUX_CONTEXT "selinux_context"
 
+/**
+ * VIR_CLIENT_INFO_MESSAGE_POOL_HITS:
+ * Macro represents the number of the client's requests which were received
+ * into a previously used message buffer, as VIR_TYPED_PARAM_ULLONG.
+ *
+ * NOTE: This attribute is read-only and any attempt to set it will be denied
+ * by daemon
+ */
+
+# define VIR_CLIENT_INFO_MESSAGE_POOL_HITS "msg_pool_hits"
+
+/**
+ * VIR_CLIENT_INFO_MESSAGE_POOL_MISSES:
+ * Macro represents the number of the client's requests for which a new
+ * message buffer had to be allocated, as VIR_TYPED_PARAM_ULLONG.
+ *
+ * NOTE: This attribute is read-only and any attempt to set it will be denied
+ * by daemon
+ */
+
+# define VIR_CLIENT_INFO_MESSAGE_POOL_MISSES "msg_pool_misses"
+
+/**
+ * VIR_CLIENT_INFO_STREAM_BYTES_RECEIVED:
+ * Macro represents the number of bytes of stream data received from the
+ * client, as VIR_TYPED_PARAM_ULLONG.
+ *
+ * NOTE: This attribute is read-only and any attempt to set it will be denied
+ * by daemon
+ */
+
+# define VIR_CLIENT_INFO_STREAM_BYTES_RECEIVED "stream_bytes_received"
+
+/**
+ * VIR_CLIENT_INFO_STREAM_BYTES_SENT:
+ * Macro represents the number of bytes of stream data sent to the client,
+ * as VIR_TYPED_PARAM_ULLONG.
+ *
+ * NOTE: This attribute is read-only and any attempt to set it will be denied
+ * by daemon
+ */
+
+# define VIR_CLIENT_INFO_STREAM_BYTES_SENT "stream_bytes_sent"
+
 int virAdmClientGetInfo(virAdmClientPtr client,
                         virTypedParameterPtr *params,
                         int *nparams,
@@ -394,6 +535,72 @@ int virAdmClientClose(virAdmClientPtr client, unsigned int flags);
 
 # define VIR_SERVER_CLIENTS_UNAUTH_CURRENT "nclients_unauth"
 
+/**
+ * VIR_SERVER_CLIENTS_REQUEST_RATE:
+ * Macro for per-server client_request_rate limit: represents the upper limit
+ * to number of requests per second a single client can send before reading
+ * from it is paused, as VIR_TYPED_PARAM_UINT. The value of 0 means unlimited.
+ */
+
+# define VIR_SERVER_CLIENTS_REQUEST_RATE "client_request_rate"
+
+/**
+ * VIR_SERVER_CLIENTS_REQUEST_BURST:
+ * Macro for per-server client_request_burst limit: represents the number of
+ * requests a single idle client can send at once regardless of
+ * VIR_SERVER_CLIENTS_REQUEST_RATE, as VIR_TYPED_PARAM_UINT. The value of 0
+ * means the same as the rate.
+ */
+
+# define VIR_SERVER_CLIENTS_REQUEST_BURST "client_request_burst"
+
+/**
+ * VIR_SERVER_IDENTITY_REQUEST_RATE:
+ * Macro for per-server identity_request_rate limit: same as
+ * VIR_SERVER_CLIENTS_REQUEST_RATE, but shared by all the clients
+ * authenticated as the same identity, as VIR_TYPED_PARAM_UINT.
+ */
+
+# define VIR_SERVER_IDENTITY_REQUEST_RATE "identity_request_rate"
+
+/**
+ * VIR_SERVER_IDENTITY_REQUEST_BURST:
+ * Macro for per-server identity_request_burst limit: same as
+ * VIR_SERVER_CLIENTS_REQUEST_BURST, but shared by all the clients
+ * authenticated as the same identity, as VIR_TYPED_PARAM_UINT.
+ */
+
+# define VIR_SERVER_IDENTITY_REQUEST_BURST "identity_request_burst"
+
+/**
+ * VIR_SERVER_CLIENTS_REQUESTS_MAX:
+ * Macro for per-server client_requests_max limit: represents the upper limit
+ * to number of requests a single client can have in flight, as
+ * VIR_TYPED_PARAM_UINT. Changes apply to the connected clients as well.
+ */
+
+# define VIR_SERVER_CLIENTS_REQUESTS_MAX "client_requests_max"
+
+/**
+ * VIR_SERVER_KEEPALIVE_INTERVAL:
+ * Macro for per-server keepalive_interval attribute: represents the number
+ * of seconds a client may stay silent before the server sends it a
+ * keepalive request, as VIR_TYPED_PARAM_INT. The value of -1 disables
+ * keepalive. Changes apply to clients connecting afterwards.
+ */
+
+# define VIR_SERVER_KEEPALIVE_INTERVAL "keepalive_interval"
+
+/**
+ * VIR_SERVER_KEEPALIVE_COUNT:
+ * Macro for per-server keepalive_count attribute: represents the number of
+ * keepalive requests a client may leave unanswered before it is
+ * disconnected, as VIR_TYPED_PARAM_UINT. Changes apply to clients
+ * connecting afterwards.
+ */
+
+# define VIR_SERVER_KEEPALIVE_COUNT "keepalive_count"
+
 int virAdmServerGetClientLimits(virAdmServerPtr srv,
                                 virTypedParameterPtr *params,
                                 int *nparams,
@@ -420,6 +627,264 @@ int virAdmConnectSetLoggingFilters(virAdmConnectPtr conn,
                                    const char *filters,
                                    unsigned int flags);
 
+/* Event loop statistics */
+
+/**
+ * VIR_EVENT_LOOP_TIMERS:
+ * Macro for the event loop timers attribute: represents the number of
+ * timers currently registered with the daemon's event loop, as
+ * VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_EVENT_LOOP_TIMERS "timers"
+
+/**
+ * VIR_EVENT_LOOP_TIMERS_ARMED:
+ * Macro for the event loop timersArmed attribute: represents the number of
+ * registered timers which are currently enabled, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_EVENT_LOOP_TIMERS_ARMED "timersArmed"
+
+/**
+ * VIR_EVENT_LOOP_TIMERS_FIRED:
+ * Macro for the event loop timersFired attribute: represents the total
+ * number of timer callbacks invoked since the daemon started, as
+ * VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_EVENT_LOOP_TIMERS_FIRED "timersFired"
+
+/**
+ * VIR_EVENT_LOOP_TIMERS_FIRED_RATE:
+ * Macro for the event loop timersFiredRate attribute: represents the number
+ * of timer callbacks invoked during the last full second, as
+ * VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_EVENT_LOOP_TIMERS_FIRED_RATE "timersFiredRate"
+
+/**
+ * VIR_EVENT_LOOP_TIMERS_LATE_TOTAL:
+ * Macro for the event loop timersLateTotal attribute: represents the sum
+ * of delays in milliseconds between the expiry of a timer and the
+ * invocation of its callback, over all the callbacks invoked since the
+ * daemon started, as VIR_TYPED_PARAM_ULLONG. Dividing it by
+ * VIR_EVENT_LOOP_TIMERS_FIRED gives the average delay.
+ */
+
+# define VIR_EVENT_LOOP_TIMERS_LATE_TOTAL "timersLateTotal"
+
+/**
+ * VIR_EVENT_LOOP_TIMERS_LATE_MAX:
+ * Macro for the event loop timersLateMax attribute: represents the longest
+ * delay in milliseconds between the expiry of a timer and the invocation of
+ * its callback since the daemon started, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_EVENT_LOOP_TIMERS_LATE_MAX "timersLateMax"
+
+/**
+ * VIR_EVENT_LOOP_CALLBACKS_COUNT:
+ * Macro for the event loop callbacks.count attribute: represents the number
+ * of callback functions for which timing statistics are reported, as
+ * VIR_TYPED_PARAM_UINT. Only returned with
+ * VIR_ADMIN_EVENT_LOOP_STATS_CALLBACKS, see virAdmConnectGetEventLoopStats
+ * for the attributes of each callback.
+ */
+
+# define VIR_EVENT_LOOP_CALLBACKS_COUNT "callbacks.count"
+
+typedef enum {
+    /* report the callbacks which blocked the event loop the longest */
+    VIR_ADMIN_EVENT_LOOP_STATS_CALLBACKS = (1 << 0),
+} virAdmConnectGetEventLoopStatsFlags;
+
+int virAdmConnectGetEventLoopStats(virAdmConnectPtr conn,
+                                   virTypedParameterPtr *params,
+                                   int *nparams,
+                                   unsigned int flags);
+
+/* Event loop parameters */
+
+/**
+ * VIR_EVENT_LOOP_THREADS:
+ * Macro for the event loop threads parameter: represents the number of
+ * threads new client connections are spread over, including the main
+ * event loop, as VIR_TYPED_PARAM_UINT. Lowering it leaves the connected
+ * clients with the thread already serving them.
+ */
+
+# define VIR_EVENT_LOOP_THREADS "threads"
+
+/**
+ * VIR_EVENT_LOOP_STALL_THRESHOLD:
+ * Macro for the event loop stallThreshold parameter: represents the time
+ * in milliseconds a callback may block the event loop before a warning is
+ * logged, as VIR_TYPED_PARAM_UINT. The value of 0 stops timing callbacks.
+ */
+
+# define VIR_EVENT_LOOP_STALL_THRESHOLD "stallThreshold"
+
+int virAdmConnectGetEventLoopParameters(virAdmConnectPtr conn,
+                                        virTypedParameterPtr *params,
+                                        int *nparams,
+                                        unsigned int flags);
+
+int virAdmConnectSetEventLoopParameters(virAdmConnectPtr conn,
+                                        virTypedParameterPtr params,
+                                        int nparams,
+                                        unsigned int flags);
+
+/* RPC statistics */
+
+/**
+ * VIR_SERVER_RPC_STATS_COUNT:
+ * Macro for the server rpc.count attribute: represents the number of RPC
+ * procedures for which statistics are reported, as VIR_TYPED_PARAM_UINT.
+ * See virAdmServerGetRPCStats for the attributes of each procedure.
+ */
+
+# define VIR_SERVER_RPC_STATS_COUNT "rpc.count"
+
+int virAdmServerGetRPCStats(virAdmServerPtr srv,
+                            virTypedParameterPtr *params,
+                            int *nparams,
+                            unsigned int flags);
+
+/* Command broker statistics */
+
+/**
+ * VIR_COMMAND_BROKER_COMMANDS:
+ * Macro for the command broker commands attribute: represents the number
+ * of commands run by the broker since the daemon started, as
+ * VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_COMMAND_BROKER_COMMANDS "commands"
+
+/**
+ * VIR_COMMAND_BROKER_FAILURES:
+ * Macro for the command broker failures attribute: represents the number
+ * of commands the broker failed to start, which the daemon then ran by
+ * itself, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_COMMAND_BROKER_FAILURES "failures"
+
+/**
+ * VIR_COMMAND_BROKER_LATENCY_TOTAL:
+ * Macro for the command broker latencyTotal attribute: represents the sum
+ * of the times in microseconds from asking the broker to run a command
+ * until it started, over all the commands it ran, as
+ * VIR_TYPED_PARAM_ULLONG. Dividing it by VIR_COMMAND_BROKER_COMMANDS gives
+ * the average latency.
+ */
+
+# define VIR_COMMAND_BROKER_LATENCY_TOTAL "latencyTotal"
+
+/**
+ * VIR_COMMAND_BROKER_LATENCY_MAX:
+ * Macro for the command broker latencyMax attribute: represents the
+ * longest time in microseconds it took the broker to start a command, as
+ * VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_COMMAND_BROKER_LATENCY_MAX "latencyMax"
+
+int virAdmConnectGetCommandBrokerStats(virAdmConnectPtr conn,
+                                       virTypedParameterPtr *params,
+                                       int *nparams,
+                                       unsigned int flags);
+
+/* Daemon memory statistics */
+
+/**
+ * VIR_MEMORY_STATS_HEAP_USED:
+ * Macro for the memory heapUsed attribute: represents the number of bytes
+ * the daemon allocated from the heap and didn't free yet, as
+ * VIR_TYPED_PARAM_ULLONG. Only reported if the C library provides this
+ * figure.
+ */
+
+# define VIR_MEMORY_STATS_HEAP_USED "heapUsed"
+
+/**
+ * VIR_MEMORY_STATS_HEAP_FREE:
+ * Macro for the memory heapFree attribute: represents the number of bytes
+ * the heap of the daemon holds without using them, as
+ * VIR_TYPED_PARAM_ULLONG. Only reported if the C library provides this
+ * figure.
+ */
+
+# define VIR_MEMORY_STATS_HEAP_FREE "heapFree"
+
+/**
+ * VIR_MEMORY_STATS_DOMAIN_OBJECTS:
+ * Macro for the memory domainObjects attribute: represents the number of
+ * domain objects of all the drivers of the daemon, as
+ * VIR_TYPED_PARAM_UINT.
+ */
+
+# define VIR_MEMORY_STATS_DOMAIN_OBJECTS "domainObjects"
+
+/**
+ * VIR_MEMORY_STATS_INTERN_STRINGS:
+ * Macro for the memory internStrings attribute: represents the number of
+ * distinct strings, like security model or disk driver names, shared by
+ * all the objects using them, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_MEMORY_STATS_INTERN_STRINGS "internStrings"
+
+/**
+ * VIR_MEMORY_STATS_INTERN_BYTES:
+ * Macro for the memory internBytes attribute: represents the size in
+ * bytes of the shared strings, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_MEMORY_STATS_INTERN_BYTES "internBytes"
+
+/**
+ * VIR_MEMORY_STATS_INTERN_HITS:
+ * Macro for the memory internHits attribute: represents how often an
+ * object used one of the shared strings instead of a copy of its own, as
+ * VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_MEMORY_STATS_INTERN_HITS "internHits"
+
+int virAdmConnectGetMemoryStats(virAdmConnectPtr conn,
+                                virTypedParameterPtr *params,
+                                int *nparams,
+                                unsigned int flags);
+
+/* Daemon lock contention statistics */
+
+/**
+ * VIR_LOCK_STATS_PROFILING:
+ * Macro for the lock profiling attribute: represents whether the daemon
+ * profiles the contention of its locks, as configured by lock_profiling in
+ * libvirtd.conf, as VIR_TYPED_PARAM_BOOLEAN.
+ */
+
+# define VIR_LOCK_STATS_PROFILING "profiling"
+
+/**
+ * VIR_LOCK_STATS_COUNT:
+ * Macro for the lock locks.count attribute: represents the number of kinds
+ * of locks for which contention statistics are reported, as
+ * VIR_TYPED_PARAM_UINT. See virAdmConnectGetLockStats for the attributes of
+ * each of them.
+ */
+
+# define VIR_LOCK_STATS_COUNT "locks.count"
+
+int virAdmConnectGetLockStats(virAdmConnectPtr conn,
+                              virTypedParameterPtr *params,
+                              int *nparams,
+                              unsigned int flags);
+
 # ifdef __cplusplus
 }
 # endif
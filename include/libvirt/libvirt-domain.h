@@ -823,6 +823,15 @@ typedef enum {
      */
     VIR_MIGRATE_TLS               = (1 << 16),
 
+    /* With VIR_MIGRATE_POSTCOPY_AUTO, libvirt itself decides whether the
+     * migration has to be switched to post-copy mode. Once the first pass
+     * over guest memory is done, the rate at which the guest dirties its
+     * memory is compared to the migration bandwidth and if pre-copy is not
+     * expected to converge, the migration is switched to post-copy.
+     * VIR_MIGRATE_POSTCOPY has to be set as well.
+     */
+    VIR_MIGRATE_POSTCOPY_AUTO     = (1 << 17),
+
 } virDomainMigrateFlags;
 
 
@@ -1106,6 +1115,11 @@ virDomainPtr            virDomainLookupByUUID   (virConnectPtr conn,
                                                  const unsigned char *uuid);
 virDomainPtr            virDomainLookupByUUIDString     (virConnectPtr conn,
                                                          const char *uuid);
+int                     virConnectLookupDomainsByUUID   (virConnectPtr conn,
+                                                         const unsigned char *uuids,
+                                                         unsigned int nuuids,
+                                                         virDomainPtr **doms,
+                                                         unsigned int flags);
 
 typedef enum {
     VIR_DOMAIN_SHUTDOWN_DEFAULT        = 0,        /* hypervisor choice */
@@ -2007,6 +2021,10 @@ int virDomainDetachDevice(virDomainPtr domain, const char *xml);
 
 int virDomainAttachDeviceFlags(virDomainPtr domain,
                                const char *xml, unsigned int flags);
+int virDomainAttachDevices(virDomainPtr domain,
+                           const char **xmls,
+                           unsigned int ndevices,
+                           unsigned int flags);
 int virDomainDetachDeviceFlags(virDomainPtr domain,
                                const char *xml, unsigned int flags);
 int virDomainUpdateDeviceFlags(virDomainPtr domain,
@@ -2028,6 +2046,15 @@ typedef enum {
     VIR_DOMAIN_STATS_INTERFACE = (1 << 4), /* return domain interfaces info */
     VIR_DOMAIN_STATS_BLOCK = (1 << 5), /* return domain block info */
     VIR_DOMAIN_STATS_PERF = (1 << 6), /* return domain perf event info */
+    VIR_DOMAIN_STATS_GUEST = (1 << 7), /* return info reported by the guest
+                                          agent */
+    VIR_DOMAIN_STATS_PRESSURE = (1 << 8), /* return domain resource pressure
+                                             info */
+    VIR_DOMAIN_STATS_JOB = (1 << 9), /* return domain job contention info */
+    VIR_DOMAIN_STATS_MONITOR = (1 << 10), /* return QEMU monitor command
+                                             latency info */
+    VIR_DOMAIN_STATS_DIRTYRATE = (1 << 11), /* return guest memory dirty
+                                               rate info */
 } virDomainStatsTypes;
 
 typedef enum {
@@ -2042,6 +2069,7 @@ typedef enum {
     VIR_CONNECT_GET_ALL_DOMAINS_STATS_SHUTOFF = VIR_CONNECT_LIST_DOMAINS_SHUTOFF,
     VIR_CONNECT_GET_ALL_DOMAINS_STATS_OTHER = VIR_CONNECT_LIST_DOMAINS_OTHER,
 
+    VIR_CONNECT_GET_ALL_DOMAINS_STATS_CACHED = 1 << 29, /* allow recently cached stats */
     VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING = 1 << 30, /* include backing chain for block stats */
     VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS = 1U << 31, /* enforce requested stats */
 } virConnectGetAllDomainStatsFlags;
@@ -2058,6 +2086,26 @@ int virDomainListGetStats(virDomainPtr *doms,
 
 void virDomainStatsRecordListFree(virDomainStatsRecordPtr *stats);
 
+/**
+ * virDomainListFields:
+ *
+ * Fields reported about every domain by virConnectListAllDomainsFields().
+ */
+typedef enum {
+    VIR_DOMAIN_LIST_FIELD_STATE       = 1 << 0, /* state and reason */
+    VIR_DOMAIN_LIST_FIELD_VCPUS       = 1 << 1, /* current and maximum vcpus */
+    VIR_DOMAIN_LIST_FIELD_MEMORY      = 1 << 2, /* current and maximum memory */
+    VIR_DOMAIN_LIST_FIELD_TITLE       = 1 << 3, /* title metadata */
+    VIR_DOMAIN_LIST_FIELD_DESCRIPTION = 1 << 4, /* description metadata */
+    VIR_DOMAIN_LIST_FIELD_MANAGEDSAVE = 1 << 5, /* has a managed save image */
+    VIR_DOMAIN_LIST_FIELD_AUTOSTART   = 1 << 6, /* is started with the host */
+} virDomainListFields;
+
+int virConnectListAllDomainsFields(virConnectPtr conn,
+                                   unsigned int fields,
+                                   virDomainStatsRecordPtr **records,
+                                   unsigned int flags);
+
 /*
  * Perf Event API
  */
@@ -3390,6 +3438,25 @@ int virDomainAbortJob(virDomainPtr dom);
  */
 # define VIR_DOMAIN_JOB_AUTO_CONVERGE_THROTTLE  "auto_converge_throttle"
 
+/**
+ * VIR_DOMAIN_JOB_AUTO_TUNE_ADJUSTMENTS:
+ *
+ * virDomainGetJobStats field: number of times the hypervisor's migration
+ * auto-tuning changed the downtime limit, compression cache size or
+ * auto-convergence throttling to make the migration complete in time,
+ * as VIR_TYPED_PARAM_UINT.
+ */
+# define VIR_DOMAIN_JOB_AUTO_TUNE_ADJUSTMENTS   "auto_tune_adjustments"
+
+/**
+ * VIR_DOMAIN_JOB_AUTO_TUNE_DOWNTIME:
+ *
+ * virDomainGetJobStats field: the migration downtime limit in
+ * milliseconds as currently set by migration auto-tuning, as
+ * VIR_TYPED_PARAM_ULLONG.
+ */
+# define VIR_DOMAIN_JOB_AUTO_TUNE_DOWNTIME      "auto_tune_downtime"
+
 
 /**
  * virConnectDomainEventGenericCallback:
@@ -4304,6 +4371,58 @@ typedef void (*virConnectDomainEventBlockThresholdCallback)(virConnectPtr conn,
                                                             unsigned long long excess,
                                                             void *opaque);
 
+/**
+ * virConnectDomainEventStatsCallback:
+ * @conn: connection object
+ * @dom: domain on which the event occurred
+ * @params: changed statistics
+ * @nparams: size of the params array
+ * @opaque: application specified data
+ *
+ * This callback is invoked periodically for domains which were set up
+ * to report their statistics using virDomainSetStatsEvent. @params
+ * follow the naming of virConnectGetAllDomainStats and only contain
+ * the fields whose value changed since the previous event for the
+ * domain. The first event after virDomainSetStatsEvent was called
+ * contains all fields.
+ *
+ * The callee must not free @params, the array is freed once the
+ * callback returns.
+ *
+ * The callback signature to use when registering for an event of type
+ * VIR_DOMAIN_EVENT_ID_STATS with virConnectDomainEventRegisterAny()
+ */
+typedef void (*virConnectDomainEventStatsCallback)(virConnectPtr conn,
+                                                   virDomainPtr dom,
+                                                   virTypedParameterPtr params,
+                                                   int nparams,
+                                                   void *opaque);
+
+/**
+ * virConnectDomainEventBlockJobGroupCallback:
+ * @conn: connection object
+ * @dom: domain on which the event occurred
+ * @params: statistics of the block job group
+ * @nparams: size of the params array
+ * @opaque: application specified data
+ *
+ * This callback is invoked whenever a block job of a group started by
+ * virDomainBlockJobGroupStart starts or ends. @params contain the same
+ * statistics virDomainBlockJobGroupGetStats reports. The last event of a
+ * group has no pending or running disks left.
+ *
+ * The callee must not free @params, the array is freed once the
+ * callback returns.
+ *
+ * The callback signature to use when registering for an event of type
+ * VIR_DOMAIN_EVENT_ID_BLOCK_JOB_GROUP with virConnectDomainEventRegisterAny()
+ */
+typedef void (*virConnectDomainEventBlockJobGroupCallback)(virConnectPtr conn,
+                                                           virDomainPtr dom,
+                                                           virTypedParameterPtr params,
+                                                           int nparams,
+                                                           void *opaque);
+
 /**
  * VIR_DOMAIN_EVENT_CALLBACK:
  *
@@ -4346,6 +4465,8 @@ typedef enum {
     VIR_DOMAIN_EVENT_ID_DEVICE_REMOVAL_FAILED = 22, /* virConnectDomainEventDeviceRemovalFailedCallback */
     VIR_DOMAIN_EVENT_ID_METADATA_CHANGE = 23, /* virConnectDomainEventMetadataChangeCallback */
     VIR_DOMAIN_EVENT_ID_BLOCK_THRESHOLD = 24, /* virConnectDomainEventBlockThresholdCallback */
+    VIR_DOMAIN_EVENT_ID_STATS = 25,          /* virConnectDomainEventStatsCallback */
+    VIR_DOMAIN_EVENT_ID_BLOCK_JOB_GROUP = 26, /* virConnectDomainEventBlockJobGroupCallback */
 
 # ifdef VIR_ENUM_SENTINELS
     VIR_DOMAIN_EVENT_ID_LAST
@@ -4382,6 +4503,8 @@ typedef enum {
                                             connection */
     VIR_DOMAIN_CONSOLE_SAFE = (1 << 1), /* check if the console driver supports
                                            safe console operations */
+    VIR_DOMAIN_CONSOLE_COALESCE = (1 << 2), /* let the remote daemon batch
+                                               bursts of console output */
 } virDomainConsoleFlags;
 
 int virDomainOpenConsole(virDomainPtr dom,
@@ -4669,4 +4792,178 @@ int virDomainSetBlockThreshold(virDomainPtr domain,
                                unsigned long long threshold,
                                unsigned int flags);
 
+int virDomainSetStatsEvent(virDomainPtr domain,
+                           unsigned int stats,
+                           unsigned int interval,
+                           unsigned int flags);
+
+int virDomainBackupBegin(virDomainPtr domain,
+                         const char *backupXML,
+                         unsigned int flags);
+
+char *virDomainBackupGetXMLDesc(virDomainPtr domain,
+                                unsigned int flags);
+
+typedef enum {
+    /* discard the checkpoint created when the backup started */
+    VIR_DOMAIN_BACKUP_END_ABORT = (1 << 0),
+
+    /* delete the checkpoint the backup was incremental to */
+    VIR_DOMAIN_BACKUP_END_DROP_INCREMENTAL = (1 << 1),
+} virDomainBackupEndFlags;
+
+int virDomainBackupEnd(virDomainPtr domain,
+                       unsigned int flags);
+
+/**
+ * VIR_DOMAIN_BLOCK_JOB_GROUP_DISK:
+ * Macro for the block job group parameter naming a disk to run the job on,
+ * either by its target (vda) or by its source path, as
+ * VIR_TYPED_PARAM_STRING. The parameter has to be given once for each disk
+ * of the group.
+ */
+# define VIR_DOMAIN_BLOCK_JOB_GROUP_DISK "disk"
+
+/**
+ * VIR_DOMAIN_BLOCK_JOB_GROUP_TYPE:
+ * Macro for the block job group parameter selecting the job run on every
+ * disk, as VIR_TYPED_PARAM_INT. VIR_DOMAIN_BLOCK_JOB_TYPE_PULL, the
+ * default, pulls the whole backing chain into the active image, as
+ * virDomainBlockPull does. VIR_DOMAIN_BLOCK_JOB_TYPE_COMMIT commits all the
+ * images between the active one and the bottom of the chain into the
+ * latter, as virDomainBlockCommit with the backing image of the active one
+ * as top and no base does.
+ */
+# define VIR_DOMAIN_BLOCK_JOB_GROUP_TYPE "type"
+
+/**
+ * VIR_DOMAIN_BLOCK_JOB_GROUP_BANDWIDTH:
+ * Macro for the block job group parameter limiting the bandwidth all the
+ * running jobs of the group share, in bytes per second, as
+ * VIR_TYPED_PARAM_ULLONG. The limit is split evenly among the running
+ * jobs. 0, the default, means no limit.
+ */
+# define VIR_DOMAIN_BLOCK_JOB_GROUP_BANDWIDTH "bandwidth"
+
+/**
+ * VIR_DOMAIN_BLOCK_JOB_GROUP_CONCURRENCY:
+ * Macro for the block job group parameter limiting the number of jobs
+ * running at the same time, as VIR_TYPED_PARAM_UINT. The disks are
+ * processed in the order they were given. 0, the default, starts the jobs
+ * on all disks at once.
+ */
+# define VIR_DOMAIN_BLOCK_JOB_GROUP_CONCURRENCY "concurrency"
+
+/**
+ * VIR_DOMAIN_BLOCK_JOB_GROUP_DISKS:
+ * Macro for the block job group statistic counting the disks of the
+ * group, as VIR_TYPED_PARAM_UINT.
+ */
+# define VIR_DOMAIN_BLOCK_JOB_GROUP_DISKS "disks"
+
+/**
+ * VIR_DOMAIN_BLOCK_JOB_GROUP_PENDING:
+ * Macro for the block job group statistic counting the disks waiting for
+ * their job to start, as VIR_TYPED_PARAM_UINT.
+ */
+# define VIR_DOMAIN_BLOCK_JOB_GROUP_PENDING "pending"
+
+/**
+ * VIR_DOMAIN_BLOCK_JOB_GROUP_RUNNING:
+ * Macro for the block job group statistic counting the running jobs, as
+ * VIR_TYPED_PARAM_UINT.
+ */
+# define VIR_DOMAIN_BLOCK_JOB_GROUP_RUNNING "running"
+
+/**
+ * VIR_DOMAIN_BLOCK_JOB_GROUP_COMPLETED:
+ * Macro for the block job group statistic counting the jobs which
+ * completed, as VIR_TYPED_PARAM_UINT.
+ */
+# define VIR_DOMAIN_BLOCK_JOB_GROUP_COMPLETED "completed"
+
+/**
+ * VIR_DOMAIN_BLOCK_JOB_GROUP_FAILED:
+ * Macro for the block job group statistic counting the jobs which failed
+ * or could not be started, as VIR_TYPED_PARAM_UINT.
+ */
+# define VIR_DOMAIN_BLOCK_JOB_GROUP_FAILED "failed"
+
+/**
+ * VIR_DOMAIN_BLOCK_JOB_GROUP_CANCELED:
+ * Macro for the block job group statistic counting the jobs which were
+ * canceled, including the ones which never started, as
+ * VIR_TYPED_PARAM_UINT.
+ */
+# define VIR_DOMAIN_BLOCK_JOB_GROUP_CANCELED "canceled"
+
+/**
+ * VIR_DOMAIN_BLOCK_JOB_GROUP_CUR:
+ * Macro for the block job group statistic summing up the progress of the
+ * jobs which started, as VIR_TYPED_PARAM_ULLONG. Together with
+ * VIR_DOMAIN_BLOCK_JOB_GROUP_END it has the same meaning as the cur and
+ * end fields of virDomainBlockJobInfo.
+ */
+# define VIR_DOMAIN_BLOCK_JOB_GROUP_CUR "cur"
+
+/**
+ * VIR_DOMAIN_BLOCK_JOB_GROUP_END:
+ * Macro for the block job group statistic summing up the end of the jobs
+ * which started, as VIR_TYPED_PARAM_ULLONG.
+ */
+# define VIR_DOMAIN_BLOCK_JOB_GROUP_END "end"
+
+/**
+ * VIR_DOMAIN_BLOCK_JOB_GROUP_ELAPSED:
+ * Macro for the block job group statistic giving the time since the group
+ * was started, in milliseconds, as VIR_TYPED_PARAM_ULLONG.
+ */
+# define VIR_DOMAIN_BLOCK_JOB_GROUP_ELAPSED "elapsed"
+
+/**
+ * VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_PREFIX:
+ * The statistics of every disk of a block job group are reported with
+ * their own prefix, "disk.<num>.", where num counts from 0 in the order
+ * of the disks of the group.
+ */
+# define VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_PREFIX "disk."
+
+/**
+ * VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_SUFFIX_NAME:
+ * The target of the disk, as VIR_TYPED_PARAM_STRING.
+ */
+# define VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_SUFFIX_NAME ".name"
+
+/**
+ * VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_SUFFIX_STATE:
+ * The state of the job of the disk, as VIR_TYPED_PARAM_INT, see
+ * virDomainBlockJobGroupDiskState.
+ */
+# define VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_SUFFIX_STATE ".state"
+
+typedef enum {
+    VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_PENDING = 0,
+    VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_RUNNING = 1,
+    VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_COMPLETED = 2,
+    VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_FAILED = 3,
+    VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_CANCELED = 4,
+
+# ifdef VIR_ENUM_SENTINELS
+    VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_LAST
+# endif
+} virDomainBlockJobGroupDiskState;
+
+int virDomainBlockJobGroupStart(virDomainPtr domain,
+                                virTypedParameterPtr params,
+                                int nparams,
+                                unsigned int flags);
+
+int virDomainBlockJobGroupGetStats(virDomainPtr domain,
+                                   virTypedParameterPtr *params,
+                                   int *nparams,
+                                   unsigned int flags);
+
+int virDomainBlockJobGroupAbort(virDomainPtr domain,
+                                unsigned int flags);
+
 #endif /* __VIR_LIBVIRT_DOMAIN_H__ */
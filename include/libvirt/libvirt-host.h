@@ -661,6 +661,19 @@ char *virConnectBaselineCPU(virConnectPtr conn,
                             unsigned int ncpus,
                             unsigned int flags);
 
+int virConnectCompareCPUs(virConnectPtr conn,
+                          const char **xmlCPUs,
+                          unsigned int ncpus,
+                          int *results,
+                          char **baseline,
+                          unsigned int flags);
+
+
+typedef enum {
+    VIR_NODE_GET_FREE_PAGES_RESERVED = (1 << 0), /* Report pages reserved for
+                                                    domains instead of free
+                                                    pages. */
+} virNodeGetFreePagesFlags;
 
 int virNodeGetFreePages(virConnectPtr conn,
                         unsigned int npages,
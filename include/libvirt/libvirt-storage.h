@@ -346,16 +346,84 @@ virStorageVolPtr        virStorageVolCreateXMLFrom      (virStoragePoolPtr pool,
                                                          const char *xmldesc,
                                                          virStorageVolPtr clonevol,
                                                          unsigned int flags);
+typedef enum {
+    VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM = 1 << 0, /* Use sparse stream */
+} virStorageVolDownloadFlags;
+
 int                     virStorageVolDownload           (virStorageVolPtr vol,
                                                          virStreamPtr stream,
                                                          unsigned long long offset,
                                                          unsigned long long length,
                                                          unsigned int flags);
+typedef enum {
+    VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM = 1 << 0,  /* Use sparse stream */
+} virStorageVolUploadFlags;
+
 int                     virStorageVolUpload             (virStorageVolPtr vol,
                                                          virStreamPtr stream,
                                                          unsigned long long offset,
                                                          unsigned long long length,
                                                          unsigned int flags);
+
+/**
+ * virStorageVolRangeSinkFunc:
+ * @vol: the volume being downloaded
+ * @offset: position of @data within the volume
+ * @data: buffer with the downloaded data
+ * @nbytes: size of the data
+ * @opaque: optional application provided data
+ *
+ * The virStorageVolRangeSinkFunc callback stores the data received by
+ * virStorageVolDownloadParallel(). It is called from several threads at
+ * once, each of them handling its own range of the volume, so it must
+ * be thread safe and must not depend on the order of the calls.
+ *
+ * Returns the number of bytes consumed, which may be less than @nbytes
+ * in which case the callback is invoked again for the remainder, or -1
+ * to abort the whole transfer.
+ */
+typedef int (*virStorageVolRangeSinkFunc)(virStorageVolPtr vol,
+                                          unsigned long long offset,
+                                          const char *data,
+                                          size_t nbytes,
+                                          void *opaque);
+
+/**
+ * virStorageVolRangeSourceFunc:
+ * @vol: the volume being uploaded
+ * @offset: position of @data within the volume
+ * @data: buffer to fill with the data to upload
+ * @nbytes: space available in @data
+ * @opaque: optional application provided data
+ *
+ * The virStorageVolRangeSourceFunc callback provides the data sent by
+ * virStorageVolUploadParallel(). It is called from several threads at
+ * once, each of them handling its own range of the volume, so it must
+ * be thread safe and must not depend on the order of the calls.
+ *
+ * Returns the number of bytes filled, 0 if there is no data for @offset,
+ * which fails the transfer, or -1 to abort the whole transfer.
+ */
+typedef int (*virStorageVolRangeSourceFunc)(virStorageVolPtr vol,
+                                            unsigned long long offset,
+                                            char *data,
+                                            size_t nbytes,
+                                            void *opaque);
+
+int                     virStorageVolDownloadParallel   (virStorageVolPtr vol,
+                                                         unsigned long long offset,
+                                                         unsigned long long length,
+                                                         unsigned int nstreams,
+                                                         virStorageVolRangeSinkFunc handler,
+                                                         void *opaque,
+                                                         unsigned int flags);
+int                     virStorageVolUploadParallel     (virStorageVolPtr vol,
+                                                         unsigned long long offset,
+                                                         unsigned long long length,
+                                                         unsigned int nstreams,
+                                                         virStorageVolRangeSourceFunc handler,
+                                                         void *opaque,
+                                                         unsigned int flags);
 int                     virStorageVolDelete             (virStorageVolPtr vol,
                                                          unsigned int flags);
 int                     virStorageVolWipe               (virStorageVolPtr vol,
@@ -45,6 +45,23 @@ int virStreamRecv(virStreamPtr st,
                   char *data,
                   size_t nbytes);
 
+typedef enum {
+    VIR_STREAM_RECV_STOP_AT_HOLE = (1 << 0),
+} virStreamRecvFlagsValues;
+
+int virStreamRecvFlags(virStreamPtr st,
+                       char *data,
+                       size_t nbytes,
+                       unsigned int flags);
+
+int virStreamSendHole(virStreamPtr st,
+                      long long length,
+                      unsigned int flags);
+
+int virStreamRecvHole(virStreamPtr st,
+                      long long *length,
+                      unsigned int flags);
+
 
 /**
  * virStreamSourceFunc:
@@ -24,6 +24,9 @@ AC_DEFUN([LIBVIRT_CHECK_DLOPEN], [
 
   AC_CHECK_HEADER([dlfcn.h],, [with_dlfcn=no])
   AC_SEARCH_LIBS([dlopen], [dl],, [with_dlopen=no])
+  if test "x$with_dlopen" = "xyes"; then
+    AC_CHECK_FUNCS([dladdr])
+  fi
 
   case $ac_cv_search_dlopen:$host_os in
     'none required'* | *:mingw* | *:msvc*)
@@ -33,6 +33,9 @@ AC_DEFUN([LIBVIRT_CHECK_XDR], [
     dnl check for cygwin's variation in xdr function names
     AC_CHECK_FUNCS([xdr_u_int64_t],[],[],[#include <rpc/xdr.h>])
 
+    dnl xdr_sizeof allows RPC messages to be sized before encoding
+    AC_CHECK_FUNCS([xdr_sizeof],[],[],[#include <rpc/xdr.h>])
+
     dnl Cygwin/recent glibc requires -I/usr/include/tirpc for <rpc/rpc.h>
     old_CFLAGS=$CFLAGS
     AC_CACHE_CHECK([where to find <rpc/rpc.h>], [lv_cv_xdr_cflags], [
@@ -22,12 +22,17 @@
 
 #include "viraccessdriverpolkit.h"
 #include "viralloc.h"
+#include "virbuffer.h"
 #include "vircommand.h"
+#include "virdbus.h"
+#include "virhash.h"
 #include "virlog.h"
 #include "virprocess.h"
 #include "virerror.h"
 #include "virpolkit.h"
 #include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_ACCESS
 
@@ -39,16 +44,236 @@ VIR_LOG_INIT("access.accessdriverpolkit");
 
 #define VIR_ACCESS_DRIVER_POLKIT_ACTION_PREFIX "org.libvirt.api"
 
+/* How long, in milliseconds, a denial of polkitd is reused for. Rules
+ * may depend on the state of the session of the caller, or on it having
+ * authenticated recently, which can change meanwhile without polkitd
+ * signalling anything. So a client can stay denied for this long after
+ * it would have been allowed, which is why allowed checks are never
+ * cached: they could outlive an expired authentication or a session
+ * which went inactive. */
+#define VIR_ACCESS_DRIVER_POLKIT_CACHE_TTL (10 * 1000)
+/* Upper bound on the number of cached decisions */
+#define VIR_ACCESS_DRIVER_POLKIT_CACHE_MAX 4096
+
+/* polkitd emits Changed whenever its rules or actions are reloaded */
+#define VIR_ACCESS_DRIVER_POLKIT_RULE_CHANGED \
+    "type='signal'" \
+    ",interface='org.freedesktop.PolicyKit1.Authority'" \
+    ",member='Changed'"
+
+#define VIR_ACCESS_DRIVER_POLKIT_RULE_NAMEOWNERCHANGED \
+    "type='signal'" \
+    ",interface='"DBUS_INTERFACE_DBUS"'" \
+    ",member='NameOwnerChanged'" \
+    ",arg0='org.freedesktop.PolicyKit1'"
+
 typedef struct _virAccessDriverPolkitPrivate virAccessDriverPolkitPrivate;
 typedef virAccessDriverPolkitPrivate *virAccessDriverPolkitPrivatePtr;
 
 struct _virAccessDriverPolkitPrivate {
     bool ignore;
+
+    /* Recent denials of polkitd, only used while we are notified of
+     * changes to its configuration */
+    virMutex lock;
+    virHashTablePtr cache;
+    bool watching;
+};
+
+typedef struct _virAccessDriverPolkitDecision virAccessDriverPolkitDecision;
+typedef virAccessDriverPolkitDecision *virAccessDriverPolkitDecisionPtr;
+
+struct _virAccessDriverPolkitDecision {
+    int result; /* 1 if allowed, 0 if denied */
+    unsigned long long expires;
 };
 
 
-static void virAccessDriverPolkitCleanup(virAccessManagerPtr manager ATTRIBUTE_UNUSED)
+static DBusHandlerResult
+virAccessDriverPolkitDBusFilter(DBusConnection *connection ATTRIBUTE_UNUSED,
+                                DBusMessage *message,
+                                void *user_data)
+{
+    virAccessDriverPolkitPrivatePtr priv = user_data;
+    const char *name = NULL;
+
+    if (dbus_message_is_signal(message, DBUS_INTERFACE_DBUS,
+                               "NameOwnerChanged")) {
+        if (!dbus_message_get_args(message, NULL,
+                                   DBUS_TYPE_STRING, &name,
+                                   DBUS_TYPE_INVALID) ||
+            STRNEQ(name, "org.freedesktop.PolicyKit1"))
+            return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    } else if (!dbus_message_is_signal(message,
+                                       "org.freedesktop.PolicyKit1.Authority",
+                                       "Changed")) {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+
+    VIR_DEBUG("Flushing cached decisions after polkitd changed");
+    virMutexLock(&priv->lock);
+    virHashRemoveAll(priv->cache);
+    virMutexUnlock(&priv->lock);
+
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+
+static int
+virAccessDriverPolkitSetup(virAccessManagerPtr manager)
+{
+    virAccessDriverPolkitPrivatePtr priv = virAccessManagerGetPrivateData(manager);
+    DBusConnection *sysbus;
+
+    if (virMutexInit(&priv->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+
+    if (!(priv->cache = virHashCreate(64, virHashValueFree)))
+        return -1;
+
+    /* Without notifications a cached decision could outlive the rule
+     * it was based on, so don't cache anything then */
+    if (!(sysbus = virDBusGetSystemBus())) {
+        VIR_WARN("Cannot watch polkitd for changes, not caching decisions: %s",
+                 virGetLastErrorMessage());
+        virResetLastError();
+        return 0;
+    }
+
+    dbus_bus_add_match(sysbus, VIR_ACCESS_DRIVER_POLKIT_RULE_CHANGED, NULL);
+    dbus_bus_add_match(sysbus, VIR_ACCESS_DRIVER_POLKIT_RULE_NAMEOWNERCHANGED,
+                       NULL);
+    if (!dbus_connection_add_filter(sysbus, virAccessDriverPolkitDBusFilter,
+                                    priv, NULL)) {
+        VIR_WARN("Adding a filter to the DBus connection failed");
+        dbus_bus_remove_match(sysbus, VIR_ACCESS_DRIVER_POLKIT_RULE_CHANGED,
+                              NULL);
+        dbus_bus_remove_match(sysbus,
+                              VIR_ACCESS_DRIVER_POLKIT_RULE_NAMEOWNERCHANGED,
+                              NULL);
+        return 0;
+    }
+
+    priv->watching = true;
+    return 0;
+}
+
+
+static void virAccessDriverPolkitCleanup(virAccessManagerPtr manager)
+{
+    virAccessDriverPolkitPrivatePtr priv = virAccessManagerGetPrivateData(manager);
+    DBusConnection *sysbus;
+
+    if (priv->watching &&
+        (sysbus = virDBusGetSystemBus())) {
+        dbus_bus_remove_match(sysbus, VIR_ACCESS_DRIVER_POLKIT_RULE_CHANGED,
+                              NULL);
+        dbus_bus_remove_match(sysbus,
+                              VIR_ACCESS_DRIVER_POLKIT_RULE_NAMEOWNERCHANGED,
+                              NULL);
+        dbus_connection_remove_filter(sysbus, virAccessDriverPolkitDBusFilter,
+                                      priv);
+    }
+
+    virHashFree(priv->cache);
+    virMutexDestroy(&priv->lock);
+}
+
+
+/*
+ * Build the key a decision is cached under. Each value is prefixed
+ * with its length so the attributes of different objects can't be
+ * mixed up.
+ */
+static char *
+virAccessDriverPolkitFormatCacheKey(const char *actionid,
+                                    pid_t pid,
+                                    unsigned long long startTime,
+                                    uid_t uid,
+                                    const char **attrs)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+
+    virBufferAsprintf(&buf, "%lld:%llu:%llu:%s",
+                      (long long) pid, startTime,
+                      (unsigned long long) uid, actionid);
+
+    for (i = 0; attrs[i] && attrs[i + 1]; i += 2)
+        virBufferAsprintf(&buf, ":%s=%zu:%s",
+                          attrs[i], strlen(attrs[i + 1]), attrs[i + 1]);
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+/*
+ * Returns the cached decision for @key, or -1 if there is none.
+ */
+static int
+virAccessDriverPolkitCacheLookup(virAccessDriverPolkitPrivatePtr priv,
+                                 const char *key,
+                                 unsigned long long now)
 {
+    virAccessDriverPolkitDecisionPtr decision;
+    int ret = -1;
+
+    virMutexLock(&priv->lock);
+    if ((decision = virHashLookup(priv->cache, key))) {
+        if (now < decision->expires)
+            ret = decision->result;
+        else
+            virHashRemoveEntry(priv->cache, key);
+    }
+    virMutexUnlock(&priv->lock);
+
+    return ret;
+}
+
+
+static int
+virAccessDriverPolkitCacheExpired(const void *payload,
+                                  const void *name ATTRIBUTE_UNUSED,
+                                  const void *opaque)
+{
+    const virAccessDriverPolkitDecision *decision = payload;
+    const unsigned long long *now = opaque;
+
+    return *now >= decision->expires;
+}
+
+
+static void
+virAccessDriverPolkitCacheStore(virAccessDriverPolkitPrivatePtr priv,
+                                const char *key,
+                                unsigned long long now,
+                                int result)
+{
+    virAccessDriverPolkitDecisionPtr decision;
+
+    if (VIR_ALLOC_QUIET(decision) < 0)
+        return;
+
+    decision->result = result;
+    decision->expires = now + VIR_ACCESS_DRIVER_POLKIT_CACHE_TTL;
+
+    virMutexLock(&priv->lock);
+    if (virHashSize(priv->cache) >= VIR_ACCESS_DRIVER_POLKIT_CACHE_MAX &&
+        virHashRemoveSet(priv->cache, virAccessDriverPolkitCacheExpired,
+                         &now) == 0)
+        virHashRemoveAll(priv->cache);
+
+    if (virHashUpdateEntry(priv->cache, key, decision) < 0) {
+        VIR_FREE(decision);
+        virResetLastError();
+    }
+    virMutexUnlock(&priv->lock);
 }
 
 
@@ -113,16 +338,19 @@ virAccessDriverPolkitGetCaller(const char *actionid,
 
 
 static int
-virAccessDriverPolkitCheck(virAccessManagerPtr manager ATTRIBUTE_UNUSED,
+virAccessDriverPolkitCheck(virAccessManagerPtr manager,
                            const char *typename,
                            const char *permname,
                            const char **attrs)
 {
+    virAccessDriverPolkitPrivatePtr priv = virAccessManagerGetPrivateData(manager);
     char *actionid = NULL;
+    char *key = NULL;
     int ret = -1;
     pid_t pid;
     uid_t uid;
     unsigned long long startTime;
+    unsigned long long now = 0;
     int rv;
 
     if (!(actionid = virAccessDriverPolkitFormatAction(typename, permname)))
@@ -137,6 +365,19 @@ virAccessDriverPolkitCheck(virAccessManagerPtr manager ATTRIBUTE_UNUSED,
     VIR_DEBUG("Check action '%s' for process '%lld' time %lld uid %d",
               actionid, (long long) pid, startTime, uid);
 
+    if (priv->watching) {
+        if (virTimeMillisNow(&now) < 0 ||
+            !(key = virAccessDriverPolkitFormatCacheKey(actionid, pid,
+                                                        startTime, uid,
+                                                        attrs)))
+            goto cleanup;
+
+        if ((ret = virAccessDriverPolkitCacheLookup(priv, key, now)) >= 0) {
+            VIR_DEBUG("Using cached decision %d", ret);
+            goto cleanup;
+        }
+    }
+
     rv = virPolkitCheckAuth(actionid,
                             pid,
                             startTime,
@@ -154,7 +395,13 @@ virAccessDriverPolkitCheck(virAccessManagerPtr manager ATTRIBUTE_UNUSED,
         }
     }
 
+    /* Only denials are remembered, see VIR_ACCESS_DRIVER_POLKIT_CACHE_TTL.
+     * Errors talking to polkitd are not worth remembering either */
+    if (key && ret == 0)
+        virAccessDriverPolkitCacheStore(priv, key, now, ret);
+
  cleanup:
+    VIR_FREE(key);
     VIR_FREE(actionid);
     return ret;
 }
@@ -402,6 +649,7 @@ virAccessDriverPolkitCheckStorageVol(virAccessManagerPtr manager,
 virAccessDriver accessDriverPolkit = {
     .privateDataLen = sizeof(virAccessDriverPolkitPrivate),
     .name = "polkit",
+    .setup = virAccessDriverPolkitSetup,
     .cleanup = virAccessDriverPolkitCleanup,
     .checkConnect = virAccessDriverPolkitCheckConnect,
     .checkDomain = virAccessDriverPolkitCheckDomain,
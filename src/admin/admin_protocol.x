@@ -48,6 +48,24 @@ const ADMIN_CLIENT_INFO_PARAMETERS_MAX = 64;
 /* Upper limit on number of client processing controls */
 const ADMIN_SERVER_CLIENT_LIMITS_MAX = 32;
 
+/* Upper limit on number of event loop statistics */
+const ADMIN_CONNECT_EVENT_LOOP_STATS_MAX = 256;
+
+/* Upper limit on number of RPC statistics */
+const ADMIN_SERVER_RPC_STATS_MAX = 65536;
+
+/* Upper limit on number of command broker statistics */
+const ADMIN_CONNECT_COMMAND_BROKER_STATS_MAX = 32;
+
+/* Upper limit on number of memory statistics */
+const ADMIN_CONNECT_MEMORY_STATS_MAX = 32;
+
+/* Upper limit on number of lock contention statistics */
+const ADMIN_CONNECT_LOCK_STATS_MAX = 1024;
+
+/* Upper limit on number of event loop parameters */
+const ADMIN_CONNECT_EVENT_LOOP_PARAMETERS_MAX = 32;
+
 /* A long string, which may NOT be NULL. */
 typedef string admin_nonnull_string<ADMIN_STRING_MAX>;
 
@@ -211,6 +229,60 @@ struct admin_connect_set_logging_filters_args {
     unsigned int flags;
 };
 
+struct admin_connect_get_event_loop_stats_args {
+    unsigned int flags;
+};
+
+struct admin_connect_get_event_loop_stats_ret {
+    admin_typed_param params<ADMIN_CONNECT_EVENT_LOOP_STATS_MAX>;
+};
+
+struct admin_server_get_rpc_stats_args {
+    admin_nonnull_server srv;
+    unsigned int flags;
+};
+
+struct admin_server_get_rpc_stats_ret {
+    admin_typed_param params<ADMIN_SERVER_RPC_STATS_MAX>;
+};
+
+struct admin_connect_get_command_broker_stats_args {
+    unsigned int flags;
+};
+
+struct admin_connect_get_command_broker_stats_ret {
+    admin_typed_param params<ADMIN_CONNECT_COMMAND_BROKER_STATS_MAX>;
+};
+
+struct admin_connect_get_memory_stats_args {
+    unsigned int flags;
+};
+
+struct admin_connect_get_memory_stats_ret {
+    admin_typed_param params<ADMIN_CONNECT_MEMORY_STATS_MAX>;
+};
+
+struct admin_connect_get_lock_stats_args {
+    unsigned int flags;
+};
+
+struct admin_connect_get_lock_stats_ret {
+    admin_typed_param params<ADMIN_CONNECT_LOCK_STATS_MAX>;
+};
+
+struct admin_connect_get_event_loop_parameters_args {
+    unsigned int flags;
+};
+
+struct admin_connect_get_event_loop_parameters_ret {
+    admin_typed_param params<ADMIN_CONNECT_EVENT_LOOP_PARAMETERS_MAX>;
+};
+
+struct admin_connect_set_event_loop_parameters_args {
+    admin_typed_param params<ADMIN_CONNECT_EVENT_LOOP_PARAMETERS_MAX>;
+    unsigned int flags;
+};
+
 /* Define the program number, protocol version and procedure numbers here. */
 const ADMIN_PROGRAM = 0x06900690;
 const ADMIN_PROTOCOL_VERSION = 1;
@@ -316,5 +388,40 @@ enum admin_procedure {
     /**
      * @generate: both
      */
-    ADMIN_PROC_CONNECT_SET_LOGGING_FILTERS = 17
+    ADMIN_PROC_CONNECT_SET_LOGGING_FILTERS = 17,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_CONNECT_GET_EVENT_LOOP_STATS = 18,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_SERVER_GET_RPC_STATS = 19,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_CONNECT_GET_COMMAND_BROKER_STATS = 20,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_CONNECT_GET_MEMORY_STATS = 21,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_CONNECT_GET_LOCK_STATS = 22,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_CONNECT_GET_EVENT_LOOP_PARAMETERS = 23,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_CONNECT_SET_EVENT_LOOP_PARAMETERS = 24
 };
@@ -49,6 +49,7 @@ while (<DRVFILE>) {
         my $drv = $1;
 
         next if $drv =~ /virDrvState/;
+        next if $drv =~ /virDrvSecretLookupValue/;
         next if $drv =~ /virDrvDomainMigrate(Prepare|Perform|Confirm|Begin|Finish)/;
 
         my $sym = $drv;
@@ -0,0 +1,439 @@
+/*
+ * backup_conf.c: domain backup XML processing
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "internal.h"
+#include "virbitmap.h"
+#include "virbuffer.h"
+#include "backup_conf.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virlog.h"
+#include "virstring.h"
+#include "virxml.h"
+
+#define VIR_FROM_THIS VIR_FROM_DOMAIN
+
+VIR_LOG_INIT("conf.backup_conf");
+
+VIR_ENUM_IMPL(virDomainBackupTransport, VIR_DOMAIN_BACKUP_TRANSPORT_LAST,
+              "tcp")
+
+static void
+virDomainBackupDiskDefClear(virDomainBackupDiskDefPtr disk)
+{
+    VIR_FREE(disk->name);
+    VIR_FREE(disk->scratch);
+}
+
+void
+virDomainBackupDefFree(virDomainBackupDefPtr def)
+{
+    size_t i;
+
+    if (!def)
+        return;
+
+    VIR_FREE(def->incremental);
+    VIR_FREE(def->checkpoint);
+    VIR_FREE(def->host);
+    for (i = 0; i < def->ndisks; i++)
+        virDomainBackupDiskDefClear(&def->disks[i]);
+    VIR_FREE(def->disks);
+    VIR_FREE(def);
+}
+
+
+static int
+virDomainBackupDiskDefParseXML(xmlNodePtr node,
+                               xmlXPathContextPtr ctxt,
+                               virDomainBackupDiskDefPtr def,
+                               unsigned int flags)
+{
+    int ret = -1;
+    char *backup = NULL;
+    char *created = NULL;
+    xmlNodePtr saved = ctxt->node;
+
+    ctxt->node = node;
+
+    if (!(def->name = virXMLPropString(node, "name"))) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("missing name from disk backup element"));
+        goto cleanup;
+    }
+
+    if ((backup = virXMLPropString(node, "backup")) &&
+        (def->backup = virTristateBoolTypeFromString(backup)) <= 0) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("unknown disk backup setting '%s'"), backup);
+        goto cleanup;
+    }
+
+    def->scratch = virXPathString("string(./scratch/@file)", ctxt);
+    if (def->scratch && def->backup == VIR_TRISTATE_BOOL_NO) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("scratch file requested for disk '%s' "
+                         "excluded from the backup"), def->name);
+        goto cleanup;
+    }
+
+    if ((flags & VIR_DOMAIN_BACKUP_PARSE_INTERNAL) &&
+        (created = virXPathString("string(./scratch/@created)", ctxt)))
+        def->scratchCreated = STREQ(created, "yes");
+
+    ret = 0;
+ cleanup:
+    ctxt->node = saved;
+    VIR_FREE(backup);
+    VIR_FREE(created);
+    return ret;
+}
+
+
+static virDomainBackupDefPtr
+virDomainBackupDefParse(xmlXPathContextPtr ctxt,
+                        unsigned int flags)
+{
+    virDomainBackupDefPtr def = NULL;
+    virDomainBackupDefPtr ret = NULL;
+    xmlNodePtr *nodes = NULL;
+    xmlNodePtr node;
+    char *tmp = NULL;
+    size_t i;
+    int n;
+
+    if (VIR_ALLOC(def) < 0)
+        goto cleanup;
+
+    def->incremental = virXPathString("string(./incremental)", ctxt);
+
+    if ((node = virXPathNode("./checkpoint", ctxt)) &&
+        !(def->checkpoint = virXMLPropString(node, "name"))) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("missing name from checkpoint element"));
+        goto cleanup;
+    }
+
+    if (def->checkpoint && def->incremental &&
+        STREQ(def->checkpoint, def->incremental)) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("checkpoint '%s' can't be both the base and the "
+                         "result of the backup"), def->checkpoint);
+        goto cleanup;
+    }
+
+    if ((node = virXPathNode("./server", ctxt))) {
+        if ((tmp = virXMLPropString(node, "transport")) &&
+            (def->transport = virDomainBackupTransportTypeFromString(tmp)) < 0) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                           _("unknown backup server transport '%s'"), tmp);
+            goto cleanup;
+        }
+        VIR_FREE(tmp);
+
+        def->host = virXMLPropString(node, "name");
+
+        if ((tmp = virXMLPropString(node, "port")) &&
+            (virStrToLong_uip(tmp, NULL, 10, &def->port) < 0 ||
+             def->port > 65535)) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("invalid backup server port '%s'"), tmp);
+            goto cleanup;
+        }
+        VIR_FREE(tmp);
+
+        if ((flags & VIR_DOMAIN_BACKUP_PARSE_INTERNAL) &&
+            (tmp = virXMLPropString(node, "allocated")))
+            def->portAllocated = STREQ(tmp, "yes");
+        VIR_FREE(tmp);
+    }
+
+    if ((n = virXPathNodeSet("./disks/*", ctxt, &nodes)) < 0)
+        goto cleanup;
+    if (n && VIR_ALLOC_N(def->disks, n) < 0)
+        goto cleanup;
+    def->ndisks = n;
+    for (i = 0; i < def->ndisks; i++) {
+        if (virDomainBackupDiskDefParseXML(nodes[i], ctxt,
+                                           &def->disks[i], flags) < 0)
+            goto cleanup;
+    }
+
+    ret = def;
+    def = NULL;
+
+ cleanup:
+    VIR_FREE(nodes);
+    VIR_FREE(tmp);
+    virDomainBackupDefFree(def);
+    return ret;
+}
+
+
+virDomainBackupDefPtr
+virDomainBackupDefParseNode(xmlDocPtr xml,
+                            xmlNodePtr root,
+                            unsigned int flags)
+{
+    xmlXPathContextPtr ctxt = NULL;
+    virDomainBackupDefPtr def = NULL;
+
+    if (!xmlStrEqual(root->name, BAD_CAST "domainbackup")) {
+        virReportError(VIR_ERR_XML_ERROR, "%s", _("domainbackup"));
+        goto cleanup;
+    }
+
+    ctxt = xmlXPathNewContext(xml);
+    if (ctxt == NULL) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    ctxt->node = root;
+    def = virDomainBackupDefParse(ctxt, flags);
+ cleanup:
+    xmlXPathFreeContext(ctxt);
+    return def;
+}
+
+
+virDomainBackupDefPtr
+virDomainBackupDefParseString(const char *xmlStr,
+                              unsigned int flags)
+{
+    virDomainBackupDefPtr ret = NULL;
+    xmlDocPtr xml;
+    int keepBlanksDefault = xmlKeepBlanksDefault(0);
+
+    if ((xml = virXMLParse(NULL, xmlStr, _("(domain_backup)")))) {
+        xmlKeepBlanksDefault(keepBlanksDefault);
+        ret = virDomainBackupDefParseNode(xml, xmlDocGetRootElement(xml),
+                                          flags);
+        xmlFreeDoc(xml);
+    }
+    xmlKeepBlanksDefault(keepBlanksDefault);
+
+    return ret;
+}
+
+
+static int
+virDomainBackupCompareDiskIndex(const void *a, const void *b)
+{
+    const virDomainBackupDiskDef *diska = a;
+    const virDomainBackupDiskDef *diskb = b;
+
+    /* Integer overflow shouldn't be a problem here.  */
+    return diska->idx - diskb->idx;
+}
+
+
+/**
+ * virDomainBackupAlignDisks:
+ * @def: backup definition
+ * @dom: definition of the domain being backed up
+ *
+ * Matches the disks of @def with the ones of @dom and adds an entry for
+ * every disk that was not mentioned. Those are part of the backup unless
+ * some disk was explicitly listed with backup='yes'. Read-only and empty
+ * drives are never backed up.
+ *
+ * Returns 0 on success, -1 with error reported otherwise.
+ */
+int
+virDomainBackupAlignDisks(virDomainBackupDefPtr def,
+                          virDomainDefPtr dom)
+{
+    int ret = -1;
+    virBitmapPtr map = NULL;
+    bool explicit = false;
+    size_t ndisks;
+    size_t i;
+
+    if (def->ndisks > dom->ndisks) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("too many disk backup requests for domain"));
+        goto cleanup;
+    }
+
+    /* Unlikely to have a guest without disks but technically possible.  */
+    if (!dom->ndisks) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (!(map = virBitmapNew(dom->ndisks)))
+        goto cleanup;
+
+    for (i = 0; i < def->ndisks; i++) {
+        virDomainBackupDiskDefPtr disk = &def->disks[i];
+        virDomainDiskDefPtr domdisk;
+        int idx = virDomainDiskIndexByName(dom, disk->name, false);
+
+        if (idx < 0) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                           _("no disk named '%s'"), disk->name);
+            goto cleanup;
+        }
+
+        if (virBitmapIsBitSet(map, idx)) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                           _("disk '%s' specified twice"), disk->name);
+            goto cleanup;
+        }
+        ignore_value(virBitmapSetBit(map, idx));
+        disk->idx = idx;
+        domdisk = dom->disks[idx];
+
+        if (!disk->backup)
+            disk->backup = VIR_TRISTATE_BOOL_YES;
+
+        if (disk->backup == VIR_TRISTATE_BOOL_YES) {
+            if (virStorageSourceIsEmpty(domdisk->src) ||
+                domdisk->src->readonly) {
+                virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                               _("disk '%s' can't be backed up"),
+                               disk->name);
+                goto cleanup;
+            }
+            explicit = true;
+        }
+
+        if (STRNEQ(disk->name, domdisk->dst)) {
+            VIR_FREE(disk->name);
+            if (VIR_STRDUP(disk->name, domdisk->dst) < 0)
+                goto cleanup;
+        }
+    }
+
+    /* Provide defaults for all remaining disks.  */
+    ndisks = def->ndisks;
+    if (VIR_EXPAND_N(def->disks, def->ndisks, dom->ndisks - def->ndisks) < 0)
+        goto cleanup;
+
+    for (i = 0; i < dom->ndisks; i++) {
+        virDomainBackupDiskDefPtr disk;
+
+        if (virBitmapIsBitSet(map, i))
+            continue;
+        disk = &def->disks[ndisks++];
+        if (VIR_STRDUP(disk->name, dom->disks[i]->dst) < 0)
+            goto cleanup;
+        disk->idx = i;
+
+        if (explicit ||
+            virStorageSourceIsEmpty(dom->disks[i]->src) ||
+            dom->disks[i]->src->readonly)
+            disk->backup = VIR_TRISTATE_BOOL_NO;
+        else
+            disk->backup = VIR_TRISTATE_BOOL_YES;
+    }
+
+    qsort(&def->disks[0], def->ndisks, sizeof(def->disks[0]),
+          virDomainBackupCompareDiskIndex);
+
+    ret = 0;
+
+ cleanup:
+    virBitmapFree(map);
+    return ret;
+}
+
+
+static void
+virDomainBackupDiskDefFormat(virBufferPtr buf,
+                             virDomainBackupDiskDefPtr disk,
+                             unsigned int flags)
+{
+    virBufferEscapeString(buf, "<disk name='%s'", disk->name);
+    if (disk->backup)
+        virBufferAsprintf(buf, " backup='%s'",
+                          virTristateBoolTypeToString(disk->backup));
+
+    if (!disk->scratch) {
+        virBufferAddLit(buf, "/>\n");
+        return;
+    }
+
+    virBufferAddLit(buf, ">\n");
+    virBufferAdjustIndent(buf, 2);
+    virBufferEscapeString(buf, "<scratch file='%s'", disk->scratch);
+    if ((flags & VIR_DOMAIN_BACKUP_FORMAT_INTERNAL) && disk->scratchCreated)
+        virBufferAddLit(buf, " created='yes'");
+    virBufferAddLit(buf, "/>\n");
+    virBufferAdjustIndent(buf, -2);
+    virBufferAddLit(buf, "</disk>\n");
+}
+
+
+int
+virDomainBackupDefFormatBuf(virBufferPtr buf,
+                            virDomainBackupDefPtr def,
+                            unsigned int flags)
+{
+    size_t i;
+
+    virBufferAddLit(buf, "<domainbackup>\n");
+    virBufferAdjustIndent(buf, 2);
+
+    virBufferEscapeString(buf, "<incremental>%s</incremental>\n",
+                          def->incremental);
+    virBufferEscapeString(buf, "<checkpoint name='%s'/>\n", def->checkpoint);
+
+    virBufferAsprintf(buf, "<server transport='%s'",
+                      virDomainBackupTransportTypeToString(def->transport));
+    virBufferEscapeString(buf, " name='%s'", def->host);
+    if (def->port)
+        virBufferAsprintf(buf, " port='%u'", def->port);
+    if ((flags & VIR_DOMAIN_BACKUP_FORMAT_INTERNAL) && def->portAllocated)
+        virBufferAddLit(buf, " allocated='yes'");
+    virBufferAddLit(buf, "/>\n");
+
+    if (def->ndisks) {
+        virBufferAddLit(buf, "<disks>\n");
+        virBufferAdjustIndent(buf, 2);
+        for (i = 0; i < def->ndisks; i++)
+            virDomainBackupDiskDefFormat(buf, &def->disks[i], flags);
+        virBufferAdjustIndent(buf, -2);
+        virBufferAddLit(buf, "</disks>\n");
+    }
+
+    virBufferAdjustIndent(buf, -2);
+    virBufferAddLit(buf, "</domainbackup>\n");
+
+    return virBufferCheckError(buf);
+}
+
+
+char *
+virDomainBackupDefFormat(virDomainBackupDefPtr def,
+                         unsigned int flags)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+
+    if (virDomainBackupDefFormatBuf(&buf, def, flags) < 0) {
+        virBufferFreeAndReset(&buf);
+        return NULL;
+    }
+
+    return virBufferContentAndReset(&buf);
+}
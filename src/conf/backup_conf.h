@@ -0,0 +1,96 @@
+/*
+ * backup_conf.h: domain backup XML processing
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BACKUP_CONF_H
+# define __BACKUP_CONF_H
+
+# include "internal.h"
+# include "domain_conf.h"
+# include "virbuffer.h"
+# include "virutil.h"
+
+typedef enum {
+    VIR_DOMAIN_BACKUP_TRANSPORT_TCP = 0,
+
+    VIR_DOMAIN_BACKUP_TRANSPORT_LAST
+} virDomainBackupTransport;
+
+/* Stores the backup setup of a single disk */
+typedef struct _virDomainBackupDiskDef virDomainBackupDiskDef;
+typedef virDomainBackupDiskDef *virDomainBackupDiskDefPtr;
+struct _virDomainBackupDiskDef {
+    char *name;     /* name matching the <target dev='...' of the domain */
+    int idx;        /* index within the domain disks that matches name */
+    int backup;     /* virTristateBool */
+
+    /* file collecting the original content of the clusters the guest
+     * overwrites while the backup is running */
+    char *scratch;
+
+    /* Internal use.  */
+    bool scratchCreated; /* @scratch was created by libvirt */
+};
+
+/* Stores the complete backup job setup */
+typedef struct _virDomainBackupDef virDomainBackupDef;
+typedef virDomainBackupDef *virDomainBackupDefPtr;
+struct _virDomainBackupDef {
+    /* Public XML.  */
+    char *incremental;  /* checkpoint the exported changes are relative to */
+    char *checkpoint;   /* checkpoint created when the backup starts */
+
+    int transport;      /* virDomainBackupTransport */
+    char *host;
+    unsigned int port;  /* 0 picks a port from the migration range */
+
+    size_t ndisks; /* should not exceed dom->ndisks */
+    virDomainBackupDiskDef *disks;
+
+    /* Internal use.  */
+    bool portAllocated; /* @port was taken from the migration range */
+};
+
+typedef enum {
+    VIR_DOMAIN_BACKUP_PARSE_INTERNAL = 1 << 0,
+} virDomainBackupParseFlags;
+
+typedef enum {
+    VIR_DOMAIN_BACKUP_FORMAT_INTERNAL = 1 << 0,
+} virDomainBackupFormatFlags;
+
+VIR_ENUM_DECL(virDomainBackupTransport)
+
+void virDomainBackupDefFree(virDomainBackupDefPtr def);
+
+virDomainBackupDefPtr virDomainBackupDefParseString(const char *xmlStr,
+                                                    unsigned int flags);
+virDomainBackupDefPtr virDomainBackupDefParseNode(xmlDocPtr xml,
+                                                  xmlNodePtr root,
+                                                  unsigned int flags);
+int virDomainBackupDefFormatBuf(virBufferPtr buf,
+                                virDomainBackupDefPtr def,
+                                unsigned int flags);
+char *virDomainBackupDefFormat(virDomainBackupDefPtr def,
+                               unsigned int flags);
+
+int virDomainBackupAlignDisks(virDomainBackupDefPtr def,
+                              virDomainDefPtr dom);
+
+#endif /* __BACKUP_CONF_H */
@@ -42,6 +42,7 @@
 #include "virfile.h"
 #include "virhostcpu.h"
 #include "virhostmem.h"
+#include "virhosttopology.h"
 #include "virlog.h"
 #include "virnuma.h"
 #include "virstring.h"
@@ -1155,6 +1156,7 @@ int
 virCapabilitiesGetNodeInfo(virNodeInfoPtr nodeinfo)
 {
     virArch hostarch = virArchFromHost();
+    virHostTopologyPtr topology;
     unsigned long long memorybytes;
 
     memset(nodeinfo, 0, sizeof(*nodeinfo));
@@ -1166,53 +1168,47 @@ virCapabilitiesGetNodeInfo(virNodeInfoPtr nodeinfo)
         return -1;
     nodeinfo->memory = memorybytes / 1024;
 
-    if (virHostCPUGetInfo(hostarch,
-                          &nodeinfo->cpus, &nodeinfo->mhz,
-                          &nodeinfo->nodes, &nodeinfo->sockets,
-                          &nodeinfo->cores, &nodeinfo->threads) < 0)
+    if (!(topology = virHostTopologyGet()))
         return -1;
 
+    nodeinfo->cpus = topology->cpus;
+    nodeinfo->mhz = topology->mhz;
+    nodeinfo->nodes = topology->nodes;
+    nodeinfo->sockets = topology->sockets;
+    nodeinfo->cores = topology->cores;
+    nodeinfo->threads = topology->threads;
+
+    virObjectUnref(topology);
     return 0;
 }
 
-/* returns 1 on success, 0 if the detection failed and -1 on hard error */
 static int
-virCapabilitiesFillCPUInfo(int cpu_id ATTRIBUTE_UNUSED,
-                           virCapsHostNUMACellCPUPtr cpu ATTRIBUTE_UNUSED)
+virCapabilitiesFillCPUInfo(const virHostTopologyCPU *hostcpu,
+                           virCapsHostNUMACellCPUPtr cpu)
 {
-#ifdef __linux__
-    cpu->id = cpu_id;
-
-    if (virHostCPUGetSocket(cpu_id, &cpu->socket_id) < 0 ||
-        virHostCPUGetCore(cpu_id, &cpu->core_id) < 0)
-        return -1;
+    cpu->id = hostcpu->id;
+    cpu->socket_id = hostcpu->socket;
+    cpu->core_id = hostcpu->core;
 
-    if (!(cpu->siblings = virHostCPUGetSiblingsList(cpu_id)))
+    if (hostcpu->siblings &&
+        !(cpu->siblings = virBitmapNewCopy(hostcpu->siblings)))
         return -1;
 
     return 0;
-#else
-    virReportError(VIR_ERR_NO_SUPPORT, "%s",
-                   _("node cpu info not implemented on this platform"));
-    return -1;
-#endif
 }
 
 static int
-virCapabilitiesGetNUMASiblingInfo(int node,
+virCapabilitiesGetNUMASiblingInfo(const virHostTopologyNode *node,
                                   virCapsHostNUMACellSiblingInfoPtr *siblings,
                                   int *nsiblings)
 {
     virCapsHostNUMACellSiblingInfoPtr tmp = NULL;
     int tmp_size = 0;
     int ret = -1;
-    int *distances = NULL;
-    int ndistances = 0;
+    const int *distances = node->distances;
+    int ndistances = node->ndistances;
     size_t i;
 
-    if (virNumaGetDistances(node, &distances, &ndistances) < 0)
-        goto cleanup;
-
     if (!distances) {
         *siblings = NULL;
         *nsiblings = 0;
@@ -1240,7 +1236,6 @@ virCapabilitiesGetNUMASiblingInfo(int node,
     tmp_size = 0;
     ret = 0;
  cleanup:
-    VIR_FREE(distances);
     VIR_FREE(tmp);
     return ret;
 }
@@ -1276,7 +1271,8 @@ virCapabilitiesGetNUMAPagesInfo(int node,
 
 
 static int
-virCapabilitiesInitNUMAFake(virCapsPtr caps)
+virCapabilitiesInitNUMAFake(virCapsPtr caps,
+                            virHostTopologyPtr topology)
 {
     virNodeInfo nodeinfo;
     virCapsHostNUMACellCPUPtr cpus;
@@ -1284,7 +1280,6 @@ virCapabilitiesInitNUMAFake(virCapsPtr caps)
     int s, c, t;
     int id, cid;
     int onlinecpus ATTRIBUTE_UNUSED;
-    bool tmp;
 
     if (virCapabilitiesGetNodeInfo(&nodeinfo) < 0)
         return -1;
@@ -1299,9 +1294,9 @@ virCapabilitiesInitNUMAFake(virCapsPtr caps)
     for (s = 0; s < nodeinfo.sockets; s++) {
         for (c = 0; c < nodeinfo.cores; c++) {
             for (t = 0; t < nodeinfo.threads; t++) {
-                if (virHostCPUGetOnline(id, &tmp) < 0)
-                    goto error;
-                if (tmp) {
+                /* CPUs are assumed to be online where that's unknown */
+                if (!topology->online ||
+                    virBitmapIsBitSet(topology->online, id)) {
                     cpus[cid].id = id;
                     cpus[cid].socket_id = s;
                     cpus[cid].core_id = c;
@@ -1336,63 +1331,58 @@ virCapabilitiesInitNUMAFake(virCapsPtr caps)
     return -1;
 }
 
+/*
+ * The topology comes from the host topology snapshot, only the hugepage
+ * pools, which can be resized any time, are read on every call.
+ */
 int
 virCapabilitiesInitNUMA(virCapsPtr caps)
 {
-    int n;
-    unsigned long long memory;
+    virHostTopologyPtr topology;
     virCapsHostNUMACellCPUPtr cpus = NULL;
-    virBitmapPtr cpumap = NULL;
     virCapsHostNUMACellSiblingInfoPtr siblings = NULL;
     int nsiblings = 0;
     virCapsHostNUMACellPageInfoPtr pageinfo = NULL;
     int npageinfo;
     int ret = -1;
     int ncpus = 0;
-    int cpu;
     bool topology_failed = false;
-    int max_node;
+    size_t n;
 
-    if (!virNumaIsAvailable())
-        return virCapabilitiesInitNUMAFake(caps);
+    if (!(topology = virHostTopologyGet()))
+        return -1;
 
-    if ((max_node = virNumaGetMaxNode()) < 0)
+    if (!topology->numa) {
+        ret = virCapabilitiesInitNUMAFake(caps, topology);
         goto cleanup;
+    }
 
-    for (n = 0; n <= max_node; n++) {
+    for (n = 0; n < topology->ncells; n++) {
+        const virHostTopologyNode *node = &topology->cells[n];
         size_t i;
 
-        if ((ncpus = virNumaGetNodeCPUs(n, &cpumap)) < 0) {
-            if (ncpus == -2)
-                continue;
-
-            goto cleanup;
-        }
-
+        ncpus = node->ncpus;
         if (VIR_ALLOC_N(cpus, ncpus) < 0)
             goto cleanup;
-        cpu = 0;
 
-        for (i = 0; i < virBitmapSize(cpumap); i++) {
-            if (virBitmapIsBitSet(cpumap, i)) {
-                if (virCapabilitiesFillCPUInfo(i, cpus + cpu++) < 0) {
-                    topology_failed = true;
-                    virResetLastError();
-                }
-            }
+        for (i = 0; i < ncpus; i++) {
+            if (virCapabilitiesFillCPUInfo(&node->cpus[i], cpus + i) < 0)
+                goto cleanup;
+            if (!node->cpus[i].siblings)
+                topology_failed = true;
         }
 
-        if (virCapabilitiesGetNUMASiblingInfo(n, &siblings, &nsiblings) < 0)
-            goto cleanup;
+        /* report the topology for all or none of the CPUs in the cell */
+        if (topology_failed)
+            virCapabilitiesClearHostNUMACellCPUTopology(cpus, ncpus);
 
-        if (virCapabilitiesGetNUMAPagesInfo(n, &pageinfo, &npageinfo) < 0)
+        if (virCapabilitiesGetNUMASiblingInfo(node, &siblings, &nsiblings) < 0)
             goto cleanup;
 
-        /* Detect the amount of memory in the numa cell in KiB */
-        virNumaGetNodeMemory(n, &memory, NULL);
-        memory >>= 10;
+        if (virCapabilitiesGetNUMAPagesInfo(node->id, &pageinfo, &npageinfo) < 0)
+            goto cleanup;
 
-        if (virCapabilitiesAddHostNUMACell(caps, n, memory,
+        if (virCapabilitiesAddHostNUMACell(caps, node->id, node->memory,
                                            ncpus, cpus,
                                            nsiblings, siblings,
                                            npageinfo, pageinfo) < 0)
@@ -1401,20 +1391,19 @@ virCapabilitiesInitNUMA(virCapsPtr caps)
         cpus = NULL;
         siblings = NULL;
         pageinfo = NULL;
-        virBitmapFree(cpumap);
-        cpumap = NULL;
+        topology_failed = false;
     }
 
     ret = 0;
 
  cleanup:
-    if ((topology_failed || ret < 0) && cpus)
+    if (ret < 0 && cpus)
         virCapabilitiesClearHostNUMACellCPUTopology(cpus, ncpus);
 
-    virBitmapFree(cpumap);
     VIR_FREE(cpus);
     VIR_FREE(siblings);
     VIR_FREE(pageinfo);
+    virObjectUnref(topology);
     return ret;
 }
 
@@ -23,6 +23,8 @@
 
 #include <config.h>
 
+#include <strings.h>
+
 #include "viralloc.h"
 #include "virlog.h"
 #include "virstring.h"
@@ -567,6 +569,7 @@ virDomainPCIAddressReserveAddrInternal(virDomainPCIAddressSetPtr addrs,
 
     /* mark the requested function as reserved */
     bus->slot[addr->slot].functions |= (1 << addr->function);
+    bus->usedSlots |= 1U << addr->slot;
     VIR_DEBUG("Reserving PCI address %s (aggregate='%s')", addrStr,
               bus->slot[addr->slot].aggregate ? "true" : "false");
 
@@ -633,7 +636,11 @@ int
 virDomainPCIAddressReleaseAddr(virDomainPCIAddressSetPtr addrs,
                                virPCIDeviceAddressPtr addr)
 {
-    addrs->buses[addr->bus].slot[addr->slot].functions &= ~(1 << addr->function);
+    virDomainPCIAddressBusPtr bus = &addrs->buses[addr->bus];
+
+    bus->slot[addr->slot].functions &= ~(1 << addr->function);
+    if (!bus->slot[addr->slot].functions)
+        bus->usedSlots &= ~(1U << addr->slot);
     return 0;
 }
 
@@ -675,18 +682,37 @@ virDomainPCIAddressFindUnusedFunctionOnBus(virDomainPCIAddressBusPtr bus,
                                            virDomainPCIConnectFlags flags,
                                            bool *found)
 {
-    int ret = -1;
-    char *addrStr = NULL;
-
     *found = false;
 
-    if (!(addrStr = virDomainPCIAddressAsString(searchAddr)))
-        goto cleanup;
-
-    if (!virDomainPCIAddressFlagsCompatible(searchAddr, addrStr, bus->flags,
+    /* The address string is only used for error reporting, which is
+     * disabled here, so don't bother formatting it for every bus.
+     */
+    if (!virDomainPCIAddressFlagsCompatible(searchAddr, NULL, bus->flags,
                                             flags, false, false)) {
         VIR_DEBUG("PCI bus %.4x:%.2x is not compatible with the device",
                   searchAddr->domain, searchAddr->bus);
+    } else if (!(flags & VIR_PCI_CONNECT_AGGREGATE_SLOT)) {
+        /* Only a completely unused slot will do, so pick the first
+         * clear bit at or after the starting slot straight from the
+         * bus' usage mask.
+         */
+        unsigned int freeSlots = ~bus->usedSlots;
+
+        if (searchAddr->slot <= bus->maxSlot) {
+            freeSlots &= ~0U << searchAddr->slot;
+            if (bus->maxSlot < VIR_PCI_ADDRESS_SLOT_LAST)
+                freeSlots &= (1U << (bus->maxSlot + 1)) - 1;
+
+            if (freeSlots) {
+                searchAddr->slot = ffs(freeSlots) - 1;
+                *found = true;
+            }
+        }
+
+        if (!*found) {
+            VIR_DEBUG("PCI bus %.4x:%.2x has no free slots",
+                      searchAddr->domain, searchAddr->bus);
+        }
     } else {
         while (searchAddr->slot <= bus->maxSlot) {
             if (bus->slot[searchAddr->slot].functions == 0) {
@@ -727,11 +753,7 @@ virDomainPCIAddressFindUnusedFunctionOnBus(virDomainPCIAddressBusPtr bus,
         }
     }
 
-    ret = 0;
-
- cleanup:
-    VIR_FREE(addrStr);
-    return ret;
+    return 0;
 }
 
 
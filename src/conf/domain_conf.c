@@ -53,10 +53,13 @@
 #include "device_conf.h"
 #include "network_conf.h"
 #include "virtpm.h"
+#include "virtrace.h"
 #include "virstring.h"
 #include "virnetdev.h"
 #include "virhostdev.h"
 #include "virmdev.h"
+#include "vircrypto.h"
+#include "viratomic.h"
 
 #define VIR_FROM_THIS VIR_FROM_DOMAIN
 
@@ -75,6 +78,22 @@ struct _virDomainXMLOption {
 
     /* XML namespace callbacks */
     virDomainXMLNamespace ns;
+
+    /* parsed definitions, see virDomainDefParseString */
+    virMutex parseCacheLock;
+    virHashTablePtr parseCache;
+    unsigned long long parseCacheTick;
+};
+
+typedef struct _virDomainDefParseCacheEntry virDomainDefParseCacheEntry;
+typedef virDomainDefParseCacheEntry *virDomainDefParseCacheEntryPtr;
+struct _virDomainDefParseCacheEntry {
+    char *source;                   /* the XML which was parsed */
+    unsigned int flags;
+    virCapsPtr caps;
+    char *stamp;                    /* see virDomainDefParseCacheStamp */
+    char *xml;                      /* the parsed definition, formatted */
+    unsigned long long lastUsed;
 };
 
 #define VIR_DOMAIN_DEF_FORMAT_COMMON_FLAGS             \
@@ -876,6 +895,7 @@ VIR_ENUM_IMPL(virDomainShmemModel, VIR_DOMAIN_SHMEM_MODEL_LAST,
 
 static virClassPtr virDomainObjClass;
 static virClassPtr virDomainXMLOptionClass;
+static int virDomainObjCount;
 static void virDomainObjDispose(void *obj);
 static void virDomainXMLOptionClassDispose(void *obj);
 
@@ -906,6 +926,28 @@ virDomainXMLOptionClassDispose(void *obj)
 
     if (xmlopt->config.privFree)
         (xmlopt->config.privFree)(xmlopt->config.priv);
+
+    if (xmlopt->parseCache) {
+        virHashFree(xmlopt->parseCache);
+        virMutexDestroy(&xmlopt->parseCacheLock);
+    }
+}
+
+
+static void
+virDomainDefParseCacheEntryFree(void *payload,
+                                const void *name ATTRIBUTE_UNUSED)
+{
+    virDomainDefParseCacheEntryPtr entry = payload;
+
+    if (!entry)
+        return;
+
+    VIR_FREE(entry->source);
+    VIR_FREE(entry->stamp);
+    VIR_FREE(entry->xml);
+    virObjectUnref(entry->caps);
+    VIR_FREE(entry);
 }
 
 /**
@@ -1073,6 +1115,22 @@ virDomainXMLOptionNew(virDomainDefParserConfigPtr config,
         xmlopt->config.macPrefix[1] = 0x54;
     }
 
+    if (xmlopt->config.parseCacheSize) {
+        if (virMutexInit(&xmlopt->parseCacheLock) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("unable to init parse cache mutex"));
+            virObjectUnref(xmlopt);
+            return NULL;
+        }
+
+        if (!(xmlopt->parseCache = virHashCreate(xmlopt->config.parseCacheSize,
+                                                 virDomainDefParseCacheEntryFree))) {
+            virMutexDestroy(&xmlopt->parseCacheLock);
+            virObjectUnref(xmlopt);
+            return NULL;
+        }
+    }
+
     return xmlopt;
 }
 
@@ -1739,14 +1797,11 @@ virDomainDiskGetDriver(virDomainDiskDefPtr def)
 int
 virDomainDiskSetDriver(virDomainDiskDefPtr def, const char *name)
 {
+    const char *tmp = def->src->driverName;
     int ret;
-    char *tmp = def->src->driverName;
 
-    ret = VIR_STRDUP(def->src->driverName, name);
-    if (ret < 0)
+    if ((ret = virStringIntern(&def->src->driverName, name)) < 0)
         def->src->driverName = tmp;
-    else
-        VIR_FREE(tmp);
     return ret;
 }
 
@@ -2806,6 +2861,7 @@ void virDomainDefFree(virDomainDefPtr def)
     VIR_FREE(def->description);
     VIR_FREE(def->title);
     VIR_FREE(def->hyperv_vendor_id);
+    VIR_FREE(def->caps_features);
 
     virBlkioDeviceArrayClear(def->blkio.devices,
                              def->blkio.ndevices);
@@ -2846,6 +2902,7 @@ void virDomainDefFree(virDomainDefPtr def)
         (def->ns.free)(def->namespaceData);
 
     xmlFreeNode(def->metadata);
+    virHashFree(def->metadataCache);
 
     VIR_FREE(def);
 }
@@ -2863,6 +2920,7 @@ static void virDomainObjDispose(void *obj)
         (dom->privateDataFreeFunc)(dom->privateData);
 
     virDomainSnapshotObjListFree(dom->snapshots);
+    ignore_value(virAtomicIntDecAndTest(&virDomainObjCount));
 }
 
 virDomainObjPtr
@@ -2875,6 +2933,7 @@ virDomainObjNew(virDomainXMLOptionPtr xmlopt)
 
     if (!(domain = virObjectLockableNew(virDomainObjClass)))
         return NULL;
+    virAtomicIntInc(&virDomainObjCount);
 
     if (virCondInit(&domain->cond) < 0) {
         virReportSystemError(errno, "%s",
@@ -2904,6 +2963,19 @@ virDomainObjNew(virDomainXMLOptionPtr xmlopt)
 }
 
 
+/**
+ * virDomainObjGetCount:
+ *
+ * Returns the number of domain objects of all the drivers which exist in
+ * the process.
+ */
+unsigned int
+virDomainObjGetCount(void)
+{
+    return virAtomicIntGet(&virDomainObjCount);
+}
+
+
 virDomainDefPtr
 virDomainDefNew(void)
 {
@@ -7172,7 +7244,8 @@ virSecurityLabelDefsParseXML(virDomainDefPtr def,
             /* Copy model from host. */
             VIR_DEBUG("Found seclabel without a model, using '%s'",
                       host->secModels[0].model);
-            if (VIR_STRDUP(def->seclabels[0]->model, host->secModels[0].model) < 0)
+            if (virStringIntern(&def->seclabels[0]->model,
+                                host->secModels[0].model) < 0)
                 goto error;
 
             if (STREQ(def->seclabels[0]->model, "none") &&
@@ -7261,7 +7334,11 @@ virSecurityDeviceLabelDefParseXML(virSecurityDeviceLabelDefPtr **seclabels_rtn,
                     goto error;
                 }
             }
-            seclabels[i]->model = model;
+            if (virStringIntern(&seclabels[i]->model, model) < 0) {
+                VIR_FREE(model);
+                goto error;
+            }
+            VIR_FREE(model);
         }
 
         /* Can't use overrides if top-level doesn't allow relabeling.  */
@@ -7610,42 +7687,75 @@ virDomainDiskBackingStoreParse(xmlXPathContextPtr ctxt,
 }
 
 #define PARSE_IOTUNE(val)                                                      \
-    if (virXPathULongLong("string(./iotune/" #val ")",                         \
-                          ctxt, &def->blkdeviotune.val) == -2) {               \
-        virReportError(VIR_ERR_XML_ERROR,                                      \
-                       _("disk iotune field '%s' must be an integer"), #val);  \
-        return -1;                                                             \
+    if (xmlStrEqual(cur->name, BAD_CAST #val)) {                               \
+        if (virDomainDiskDefIotuneParseValue(cur, #val,                        \
+                                             &def->blkdeviotune.val) < 0)      \
+            return -1;                                                         \
+        continue;                                                              \
     }
 
+static int
+virDomainDiskDefIotuneParseValue(xmlNodePtr node,
+                                 const char *name,
+                                 unsigned long long *value)
+{
+    char *str = (char *)xmlNodeGetContent(node);
+    int ret = 0;
+
+    if (str && *str &&
+        virStrToLong_ull(str, NULL, 10, value) < 0) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("disk iotune field '%s' must be an integer"), name);
+        ret = -1;
+    }
+
+    VIR_FREE(str);
+    return ret;
+}
+
 static int
 virDomainDiskDefIotuneParse(virDomainDiskDefPtr def,
-                            xmlXPathContextPtr ctxt)
+                            xmlNodePtr node)
 {
-    PARSE_IOTUNE(total_bytes_sec);
-    PARSE_IOTUNE(read_bytes_sec);
-    PARSE_IOTUNE(write_bytes_sec);
-    PARSE_IOTUNE(total_iops_sec);
-    PARSE_IOTUNE(read_iops_sec);
-    PARSE_IOTUNE(write_iops_sec);
+    xmlNodePtr cur;
 
-    PARSE_IOTUNE(total_bytes_sec_max);
-    PARSE_IOTUNE(read_bytes_sec_max);
-    PARSE_IOTUNE(write_bytes_sec_max);
-    PARSE_IOTUNE(total_iops_sec_max);
-    PARSE_IOTUNE(read_iops_sec_max);
-    PARSE_IOTUNE(write_iops_sec_max);
+    /* Walk the children once rather than looking each of the values
+     * up with XPath */
+    for (cur = node->children; cur; cur = cur->next) {
+        if (cur->type != XML_ELEMENT_NODE)
+            continue;
 
-    PARSE_IOTUNE(size_iops_sec);
+        PARSE_IOTUNE(total_bytes_sec);
+        PARSE_IOTUNE(read_bytes_sec);
+        PARSE_IOTUNE(write_bytes_sec);
+        PARSE_IOTUNE(total_iops_sec);
+        PARSE_IOTUNE(read_iops_sec);
+        PARSE_IOTUNE(write_iops_sec);
 
-    PARSE_IOTUNE(total_bytes_sec_max_length);
-    PARSE_IOTUNE(read_bytes_sec_max_length);
-    PARSE_IOTUNE(write_bytes_sec_max_length);
-    PARSE_IOTUNE(total_iops_sec_max_length);
-    PARSE_IOTUNE(read_iops_sec_max_length);
-    PARSE_IOTUNE(write_iops_sec_max_length);
+        PARSE_IOTUNE(total_bytes_sec_max);
+        PARSE_IOTUNE(read_bytes_sec_max);
+        PARSE_IOTUNE(write_bytes_sec_max);
+        PARSE_IOTUNE(total_iops_sec_max);
+        PARSE_IOTUNE(read_iops_sec_max);
+        PARSE_IOTUNE(write_iops_sec_max);
 
-    def->blkdeviotune.group_name =
-        virXPathString("string(./iotune/group_name)", ctxt);
+        PARSE_IOTUNE(size_iops_sec);
+
+        PARSE_IOTUNE(total_bytes_sec_max_length);
+        PARSE_IOTUNE(read_bytes_sec_max_length);
+        PARSE_IOTUNE(write_bytes_sec_max_length);
+        PARSE_IOTUNE(total_iops_sec_max_length);
+        PARSE_IOTUNE(read_iops_sec_max_length);
+        PARSE_IOTUNE(write_iops_sec_max_length);
+
+        if (!def->blkdeviotune.group_name &&
+            xmlStrEqual(cur->name, BAD_CAST "group_name")) {
+            def->blkdeviotune.group_name = (char *)xmlNodeGetContent(cur);
+            if (def->blkdeviotune.group_name &&
+                !*def->blkdeviotune.group_name)
+                VIR_FREE(def->blkdeviotune.group_name);
+        }
+    }
 
     if ((def->blkdeviotune.total_bytes_sec &&
          def->blkdeviotune.read_bytes_sec) ||
@@ -7911,7 +8021,10 @@ virDomainDiskDefDriverParseXML(virDomainDiskDefPtr def,
     char *tmp = NULL;
     int ret = -1;
 
-    def->src->driverName = virXMLPropString(cur, "name");
+    tmp = virXMLPropString(cur, "name");
+    if (virStringIntern(&def->src->driverName, tmp) < 0)
+        goto cleanup;
+    VIR_FREE(tmp);
 
     if ((tmp = virXMLPropString(cur, "cache")) &&
         (def->cachemode = virDomainDiskCacheTypeFromString(tmp)) < 0) {
@@ -8177,7 +8290,7 @@ virDomainDiskDefParseXML(virDomainXMLOptionPtr xmlopt,
                 goto error;
             }
         } else if (xmlStrEqual(cur->name, BAD_CAST "iotune")) {
-            if (virDomainDiskDefIotuneParse(def, ctxt) < 0)
+            if (virDomainDiskDefIotuneParse(def, cur) < 0)
                 goto error;
         } else if (xmlStrEqual(cur->name, BAD_CAST "readonly")) {
             def->src->readonly = true;
@@ -8666,6 +8779,48 @@ virDomainDefHasMemoryHotplug(const virDomainDef *def)
 }
 
 
+/**
+ * virDomainDefGetCapsFeature:
+ * @def: domain definition
+ * @feature: virDomainCapsFeature
+ *
+ * Returns the virTristateSwitch state of the capability @feature.
+ */
+int
+virDomainDefGetCapsFeature(const virDomainDef *def,
+                           int feature)
+{
+    if (!def->caps_features)
+        return VIR_TRISTATE_SWITCH_ABSENT;
+    return def->caps_features[feature];
+}
+
+
+/**
+ * virDomainDefSetCapsFeature:
+ * @def: domain definition
+ * @feature: virDomainCapsFeature
+ * @state: virTristateSwitch
+ *
+ * Sets the state of the capability @feature, allocating the states of all
+ * the capabilities on the first one.
+ *
+ * Returns 0 on success, -1 on OOM.
+ */
+int
+virDomainDefSetCapsFeature(virDomainDefPtr def,
+                           int feature,
+                           int state)
+{
+    if (!def->caps_features &&
+        VIR_ALLOC_N(def->caps_features, VIR_DOMAIN_CAPS_FEATURE_LAST) < 0)
+        return -1;
+
+    def->caps_features[feature] = state;
+    return 0;
+}
+
+
 /**
  * virDomainDefGetMemoryInitial:
  * @def: domain definition
@@ -8858,7 +9013,10 @@ virDomainControllerDefParseXML(xmlNodePtr node,
         goto error;
     }
 
-    if (queues && virStrToLong_ui(queues, NULL, 10, &def->queues) < 0) {
+    if (STREQ_NULLABLE(queues, "auto")) {
+        def->queuesAuto = true;
+    } else if (queues &&
+               virStrToLong_ui(queues, NULL, 10, &def->queues) < 0) {
         virReportError(VIR_ERR_XML_ERROR,
                        _("Malformed 'queues' value '%s'"), queues);
         goto error;
@@ -9522,6 +9680,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
     char *event_idx = NULL;
     char *queues = NULL;
     char *rx_queue_size = NULL;
+    xmlNodePtr driverHost = NULL;
+    xmlNodePtr driverGuest = NULL;
     char *str = NULL;
     char *filter = NULL;
     char *internal = NULL;
@@ -9695,6 +9855,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
                 event_idx = virXMLPropString(cur, "event_idx");
                 queues = virXMLPropString(cur, "queues");
                 rx_queue_size = virXMLPropString(cur, "rx_queue_size");
+                driverHost = virXMLChildElement(cur, "host");
+                driverGuest = virXMLChildElement(cur, "guest");
             } else if (xmlStrEqual(cur->name, BAD_CAST "filterref")) {
                 if (filter) {
                     virReportError(VIR_ERR_XML_ERROR, "%s",
@@ -10067,7 +10229,9 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             }
             def->driver.virtio.event_idx = val;
         }
-        if (queues) {
+        if (STREQ_NULLABLE(queues, "auto")) {
+            def->driver.virtio.queuesAuto = true;
+        } else if (queues) {
             unsigned int q;
             if (virStrToLong_uip(queues, NULL, 10, &q) < 0) {
                 virReportError(VIR_ERR_XML_DETAIL,
@@ -10088,7 +10252,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             }
             def->driver.virtio.rx_queue_size = q;
         }
-        if ((str = virXPathString("string(./driver/host/@csum)", ctxt))) {
+        if (driverHost &&
+            (str = virXMLPropString(driverHost, "csum"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host csum mode '%s'"),
@@ -10098,7 +10263,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.csum = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/host/@gso)", ctxt))) {
+        if (driverHost &&
+            (str = virXMLPropString(driverHost, "gso"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host gso mode '%s'"),
@@ -10108,7 +10274,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.gso = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/host/@tso4)", ctxt))) {
+        if (driverHost &&
+            (str = virXMLPropString(driverHost, "tso4"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host tso4 mode '%s'"),
@@ -10118,7 +10285,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.tso4 = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/host/@tso6)", ctxt))) {
+        if (driverHost &&
+            (str = virXMLPropString(driverHost, "tso6"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host tso6 mode '%s'"),
@@ -10128,7 +10296,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.tso6 = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/host/@ecn)", ctxt))) {
+        if (driverHost &&
+            (str = virXMLPropString(driverHost, "ecn"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host ecn mode '%s'"),
@@ -10138,7 +10307,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.ecn = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/host/@ufo)", ctxt))) {
+        if (driverHost &&
+            (str = virXMLPropString(driverHost, "ufo"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host ufo mode '%s'"),
@@ -10148,7 +10318,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.ufo = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/host/@mrg_rxbuf)", ctxt))) {
+        if (driverHost &&
+            (str = virXMLPropString(driverHost, "mrg_rxbuf"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host mrg_rxbuf mode '%s'"),
@@ -10158,7 +10329,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.mrg_rxbuf = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/guest/@csum)", ctxt))) {
+        if (driverGuest &&
+            (str = virXMLPropString(driverGuest, "csum"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown guest csum mode '%s'"),
@@ -10168,7 +10340,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.guest.csum = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/guest/@tso4)", ctxt))) {
+        if (driverGuest &&
+            (str = virXMLPropString(driverGuest, "tso4"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown guest tso4 mode '%s'"),
@@ -10178,7 +10351,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.guest.tso4 = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/guest/@tso6)", ctxt))) {
+        if (driverGuest &&
+            (str = virXMLPropString(driverGuest, "tso6"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown guest tso6 mode '%s'"),
@@ -10188,7 +10362,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.guest.tso6 = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/guest/@ecn)", ctxt))) {
+        if (driverGuest &&
+            (str = virXMLPropString(driverGuest, "ecn"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown guest ecn mode '%s'"),
@@ -10198,7 +10373,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.guest.ecn = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/guest/@ufo)", ctxt))) {
+        if (driverGuest &&
+            (str = virXMLPropString(driverGuest, "ufo"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown guest ufo mode '%s'"),
@@ -14667,8 +14843,14 @@ int virDomainDiskInsert(virDomainDefPtr def,
     return 0;
 }
 
-void virDomainDiskInsertPreAlloced(virDomainDefPtr def,
-                                   virDomainDiskDefPtr disk)
+/* @indexes, if not NULL, holds the drive index of each of the disks in
+ * @def so that they don't have to be parsed from the target name again
+ * for every disk inserted */
+static int
+virDomainDiskFindInsertPosition(virDomainDefPtr def,
+                                virDomainDiskDefPtr disk,
+                                int diskIndex,
+                                const int *indexes)
 {
     int idx;
     /* Tentatively plan to insert disk at the end. */
@@ -14680,14 +14862,15 @@ void virDomainDiskInsertPreAlloced(virDomainDefPtr def,
      * that position
      */
     for (idx = (def->ndisks - 1); idx >= 0; idx--) {
+        if (def->disks[idx]->bus != disk->bus)
+            continue;
+
         /* If bus matches and current disk is after
          * new disk, then new disk should go here */
-        if (def->disks[idx]->bus == disk->bus &&
-            (virDiskNameToIndex(def->disks[idx]->dst) >
-             virDiskNameToIndex(disk->dst))) {
+        if ((indexes ? indexes[idx] :
+             virDiskNameToIndex(def->disks[idx]->dst)) > diskIndex) {
             insertAt = idx;
-        } else if (def->disks[idx]->bus == disk->bus &&
-                   insertAt == -1) {
+        } else if (insertAt == -1) {
             /* Last disk with match bus is before the
              * new disk, then put new disk just after
              */
@@ -14695,6 +14878,17 @@ void virDomainDiskInsertPreAlloced(virDomainDefPtr def,
         }
     }
 
+    return insertAt;
+}
+
+
+void virDomainDiskInsertPreAlloced(virDomainDefPtr def,
+                                   virDomainDiskDefPtr disk)
+{
+    int insertAt = virDomainDiskFindInsertPosition(def, disk,
+                                                   virDiskNameToIndex(disk->dst),
+                                                   NULL);
+
     /* VIR_INSERT_ELEMENT_INPLACE will never return an error here. */
     ignore_value(VIR_INSERT_ELEMENT_INPLACE(def->disks, insertAt,
                                             def->ndisks, disk));
@@ -15853,6 +16047,17 @@ virDomainDefParseIOThreads(virDomainDefPtr def,
     }
     VIR_FREE(tmp);
 
+    tmp = virXPathString("string(./iothreads[1]/@placement)", ctxt);
+    if (tmp &&
+        (def->iothreadsPlacement =
+         virDomainCpuPlacementModeTypeFromString(tmp)) < 0) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("unsupported iothreads placement mode '%s'"), tmp);
+        VIR_FREE(tmp);
+        goto error;
+    }
+    VIR_FREE(tmp);
+
     /* Extract any iothread id's defined */
     if ((n = virXPathNodeSet("./iothreadids/iothread", ctxt, &nodes)) < 0)
         goto error;
@@ -16763,6 +16968,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     bool usb_other = false;
     bool usb_master = false;
     char *netprefix = NULL;
+    int *diskIndexes = NULL;
 
     if (flags & VIR_DOMAIN_DEF_PARSE_VALIDATE_SCHEMA) {
         char *schema = virFileFindResource("domain.rng",
@@ -16970,6 +17176,23 @@ virDomainDefParseXML(xmlDocPtr xml,
         VIR_FREE(tmp);
     }
 
+    if ((n = virXPathUInt("string(./memoryBacking/allocation/@threads)",
+                          ctxt, &def->mem.allocation_threads)) == -2 ||
+        (n == 0 && def->mem.allocation_threads == 0)) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("memoryBacking/allocation/threads must be "
+                         "a positive integer"));
+        goto error;
+    }
+
+    if (def->mem.allocation_threads &&
+        def->mem.allocation == VIR_DOMAIN_MEMORY_ALLOCATION_ONDEMAND) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("memory allocation threads are not allowed with "
+                         "memory allocation ondemand"));
+        goto error;
+    }
+
     if (virXPathNode("./memoryBacking/hugepages", ctxt)) {
         /* hugepages will be used */
 
@@ -17602,6 +17825,8 @@ virDomainDefParseXML(xmlDocPtr xml,
 
     for (i = 0; i < n; i++) {
         int val = virDomainCapsFeatureTypeFromString((const char *)nodes[i]->name);
+        int state = VIR_TRISTATE_SWITCH_ON;
+
         if (val < 0) {
             virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                            _("unexpected capability feature '%s'"), nodes[i]->name);
@@ -17613,17 +17838,18 @@ virDomainDefParseXML(xmlDocPtr xml,
             ctxt->node = nodes[i];
 
             if ((tmp = virXPathString("string(./@state)", ctxt))) {
-                if ((def->caps_features[val] = virTristateSwitchTypeFromString(tmp)) == -1) {
+                if ((state = virTristateSwitchTypeFromString(tmp)) == -1) {
                     virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                    _("unknown state attribute '%s' of feature capability '%s'"),
                                    tmp, virDomainFeatureTypeToString(val));
                     goto error;
                 }
                 VIR_FREE(tmp);
-            } else {
-                def->caps_features[val] = VIR_TRISTATE_SWITCH_ON;
             }
             ctxt->node = node;
+
+            if (virDomainDefSetCapsFeature(def, val, state) < 0)
+                goto error;
         }
     }
     VIR_FREE(nodes);
@@ -17761,10 +17987,14 @@ virDomainDefParseXML(xmlDocPtr xml,
     if ((n = virXPathNodeSet("./devices/disk", ctxt, &nodes)) < 0)
         goto error;
 
-    if (n && VIR_ALLOC_N(def->disks, n) < 0)
+    if (n && (VIR_ALLOC_N(def->disks, n) < 0 ||
+              VIR_ALLOC_N(diskIndexes, n) < 0))
         goto error;
 
     for (i = 0; i < n; i++) {
+        size_t ndisks = def->ndisks;
+        int diskIndex;
+        int insertAt;
         virDomainDiskDefPtr disk = virDomainDiskDefParseXML(xmlopt,
                                                             nodes[i],
                                                             ctxt,
@@ -17775,9 +18005,19 @@ virDomainDefParseXML(xmlDocPtr xml,
         if (!disk)
             goto error;
 
-        virDomainDiskInsertPreAlloced(def, disk);
+        /* Same as virDomainDiskInsertPreAlloced, but without parsing the
+         * target of every disk already inserted, which made definitions
+         * with many disks quadratically slow to parse and so to copy */
+        diskIndex = virDiskNameToIndex(disk->dst);
+        insertAt = virDomainDiskFindInsertPosition(def, disk, diskIndex,
+                                                   diskIndexes);
+        ignore_value(VIR_INSERT_ELEMENT_INPLACE(def->disks, insertAt,
+                                                def->ndisks, disk));
+        ignore_value(VIR_INSERT_ELEMENT_INPLACE(diskIndexes, insertAt,
+                                                ndisks, diskIndex));
     }
     VIR_FREE(nodes);
+    VIR_FREE(diskIndexes);
 
     /* analysis of the controller devices */
     if ((n = virXPathNodeSet("./devices/controller", ctxt, &nodes)) < 0)
@@ -18428,6 +18668,7 @@ virDomainDefParseXML(xmlDocPtr xml,
  error:
     VIR_FREE(tmp);
     VIR_FREE(nodes);
+    VIR_FREE(diskIndexes);
     virHashFree(bootHash);
     virDomainDefFree(def);
     return NULL;
@@ -18531,13 +18772,40 @@ virDomainObjParseXML(xmlDocPtr xml,
 }
 
 
+/* Only definitions which come out the same from every parse can be
+ * cached, therefore neither the UUID nor any MAC address may be left for
+ * the parser to generate. */
+static bool
+virDomainDefParseCacheable(xmlDocPtr xml)
+{
+    xmlXPathContextPtr ctxt;
+    bool ret;
+
+    if (!(ctxt = xmlXPathNewContext(xml)))
+        return false;
+
+    ctxt->node = xmlDocGetRootElement(xml);
+    ret = virXPathBoolean("boolean(./uuid) and "
+                          "not(./devices/interface[not(mac/@address)])",
+                          ctxt) == 1;
+
+    xmlXPathFreeContext(ctxt);
+    return ret;
+}
+
+
+/*
+ * @cacheable: if not NULL, set to whether the parsed definition may be
+ *             stored in the parse cache
+ */
 static virDomainDefPtr
 virDomainDefParse(const char *xmlStr,
                   const char *filename,
                   virCapsPtr caps,
                   virDomainXMLOptionPtr xmlopt,
                   void *parseOpaque,
-                  unsigned int flags)
+                  unsigned int flags,
+                  bool *cacheable)
 {
     xmlDocPtr xml;
     virDomainDefPtr def = NULL;
@@ -18546,6 +18814,8 @@ virDomainDefParse(const char *xmlStr,
     if ((xml = virXMLParse(filename, xmlStr, _("(domain_definition)")))) {
         def = virDomainDefParseNode(xml, xmlDocGetRootElement(xml), caps,
                                     xmlopt, parseOpaque, flags);
+        if (def && cacheable)
+            *cacheable = virDomainDefParseCacheable(xml);
         xmlFreeDoc(xml);
     }
 
@@ -18553,6 +18823,144 @@ virDomainDefParse(const char *xmlStr,
     return def;
 }
 
+
+static char *
+virDomainDefParseCacheKey(const char *xmlStr,
+                          virCapsPtr caps,
+                          unsigned int flags)
+{
+    char *input = NULL;
+    char *key = NULL;
+
+    if (virAsprintf(&input, "%p %x %s", caps, flags, xmlStr) < 0)
+        return NULL;
+
+    ignore_value(virCryptoHashString(VIR_CRYPTO_HASH_SHA256, input, &key));
+    VIR_FREE(input);
+    return key;
+}
+
+
+/* Returns the driver's stamp for @def into @stamp, which stays NULL if the
+ * driver has no state to track. Returns -1 if @def may not be cached. */
+static int
+virDomainDefParseCacheStamp(virDomainXMLOptionPtr xmlopt,
+                            const virDomainDef *def,
+                            virCapsPtr caps,
+                            char **stamp)
+{
+    *stamp = NULL;
+
+    if (!xmlopt->config.parseCacheStampCallback)
+        return 0;
+
+    if (!(*stamp = xmlopt->config.parseCacheStampCallback(def, caps,
+                                                          xmlopt->config.priv))) {
+        virResetLastError();
+        return -1;
+    }
+
+    return 0;
+}
+
+
+struct virDomainDefParseCacheOldestData {
+    const char *name;
+    unsigned long long lastUsed;
+};
+
+static int
+virDomainDefParseCacheFindOldest(void *payload,
+                                 const void *name,
+                                 void *opaque)
+{
+    virDomainDefParseCacheEntryPtr entry = payload;
+    struct virDomainDefParseCacheOldestData *data = opaque;
+
+    if (!data->name || entry->lastUsed < data->lastUsed) {
+        data->name = name;
+        data->lastUsed = entry->lastUsed;
+    }
+
+    return 0;
+}
+
+
+/* Stores @def parsed from the XML keyed by @key, evicting the least
+ * recently used definition if the cache is full. */
+static void
+virDomainDefParseCacheAdd(virDomainXMLOptionPtr xmlopt,
+                          const char *key,
+                          const char *xmlStr,
+                          virCapsPtr caps,
+                          unsigned int flags,
+                          virDomainDefPtr def)
+{
+    virDomainDefParseCacheEntryPtr entry = NULL;
+
+    if (VIR_ALLOC(entry) < 0)
+        goto error;
+
+    if (virDomainDefParseCacheStamp(xmlopt, def, caps, &entry->stamp) < 0) {
+        virDomainDefParseCacheEntryFree(entry, NULL);
+        return;
+    }
+
+    if (VIR_STRDUP(entry->source, xmlStr) < 0 ||
+        !(entry->xml = virDomainDefFormat(def, caps,
+                                          VIR_DOMAIN_DEF_FORMAT_SECURE)))
+        goto error;
+    entry->flags = flags;
+    entry->caps = virObjectRef(caps);
+
+    virMutexLock(&xmlopt->parseCacheLock);
+
+    if (virHashSize(xmlopt->parseCache) >=
+        (ssize_t) xmlopt->config.parseCacheSize) {
+        struct virDomainDefParseCacheOldestData data = { NULL, 0 };
+
+        virHashForEach(xmlopt->parseCache,
+                       virDomainDefParseCacheFindOldest, &data);
+        if (data.name)
+            virHashRemoveEntry(xmlopt->parseCache, data.name);
+    }
+
+    entry->lastUsed = ++xmlopt->parseCacheTick;
+    if (virHashUpdateEntry(xmlopt->parseCache, key, entry) < 0) {
+        virDomainDefParseCacheEntryFree(entry, NULL);
+        virResetLastError();
+    }
+
+    virMutexUnlock(&xmlopt->parseCacheLock);
+    return;
+
+ error:
+    virDomainDefParseCacheEntryFree(entry, NULL);
+    virResetLastError();
+}
+
+
+/**
+ * virDomainDefParseString:
+ * @xmlStr: domain XML
+ * @caps: driver capabilities
+ * @xmlopt: XML parser configuration object
+ * @parseOpaque: opaque data passed to the post parse callbacks
+ * @flags: bitwise-OR of virDomainDefParseFlags
+ *
+ * Parses @xmlStr into a new domain definition.
+ *
+ * If @xmlopt was configured with a parseCacheSize, definitions of inactive
+ * XML parsed without @parseOpaque are remembered under the hash of the XML,
+ * @caps and @flags. Parsing the same XML again then starts from the stored
+ * definition, which was already post-processed, the same way virDomainDefCopy
+ * does; validation still runs as requested by @flags. The stored definition
+ * is reused only while the driver's parseCacheStampCallback, which covers
+ * the state the post parse callbacks looked at beyond @caps, reports the
+ * same stamp, and the XML is parsed from scratch otherwise.
+ *
+ * Returns the definition or NULL on error.
+ */
 virDomainDefPtr
 virDomainDefParseString(const char *xmlStr,
                         virCapsPtr caps,
@@ -18560,7 +18968,65 @@ virDomainDefParseString(const char *xmlStr,
                         void *parseOpaque,
                         unsigned int flags)
 {
-    return virDomainDefParse(xmlStr, NULL, caps, xmlopt, parseOpaque, flags);
+    virDomainDefParseCacheEntryPtr entry;
+    virDomainDefPtr def = NULL;
+    char *key = NULL;
+    char *xml = NULL;
+    char *stamp = NULL;
+    char *newStamp = NULL;
+    bool cacheable = false;
+
+    if (!xmlopt || !xmlopt->parseCache || !caps || parseOpaque ||
+        !(flags & VIR_DOMAIN_DEF_PARSE_INACTIVE) ||
+        (flags & VIR_DOMAIN_DEF_PARSE_STATUS))
+        return virDomainDefParse(xmlStr, NULL, caps, xmlopt, parseOpaque,
+                                 flags, NULL);
+
+    if (!(key = virDomainDefParseCacheKey(xmlStr, caps, flags))) {
+        virResetLastError();
+        return virDomainDefParse(xmlStr, NULL, caps, xmlopt, parseOpaque,
+                                 flags, NULL);
+    }
+
+    virMutexLock(&xmlopt->parseCacheLock);
+    if ((entry = virHashLookup(xmlopt->parseCache, key)) &&
+        entry->caps == caps && entry->flags == flags &&
+        STREQ(entry->source, xmlStr)) {
+        entry->lastUsed = ++xmlopt->parseCacheTick;
+        if (VIR_STRDUP_QUIET(xml, entry->xml) < 0 ||
+            VIR_STRDUP_QUIET(stamp, entry->stamp) < 0)
+            VIR_FREE(xml);
+    }
+    virMutexUnlock(&xmlopt->parseCacheLock);
+
+    if (xml) {
+        VIR_DEBUG("Using cached definition %s", key);
+        if (!(def = virDomainDefParse(xml, NULL, caps, xmlopt, NULL,
+                                      flags, NULL)))
+            goto cleanup;
+
+        if (virDomainDefParseCacheStamp(xmlopt, def, caps, &newStamp) == 0 &&
+            STREQ_NULLABLE(stamp, newStamp))
+            goto cleanup;
+
+        VIR_DEBUG("Cached definition %s is stale", key);
+        virDomainDefFree(def);
+        def = NULL;
+    }
+
+    if (!(def = virDomainDefParse(xmlStr, NULL, caps, xmlopt, NULL,
+                                  flags, &cacheable)))
+        goto cleanup;
+
+    if (cacheable)
+        virDomainDefParseCacheAdd(xmlopt, key, xmlStr, caps, flags, def);
+
+ cleanup:
+    VIR_FREE(newStamp);
+    VIR_FREE(stamp);
+    VIR_FREE(xml);
+    VIR_FREE(key);
+    return def;
 }
 
 virDomainDefPtr
@@ -18570,7 +19036,8 @@ virDomainDefParseFile(const char *filename,
                       void *parseOpaque,
                       unsigned int flags)
 {
-    return virDomainDefParse(NULL, filename, caps, xmlopt, parseOpaque, flags);
+    return virDomainDefParse(NULL, filename, caps, xmlopt, parseOpaque,
+                             flags, NULL);
 }
 
 
@@ -21196,8 +21663,8 @@ virDomainControllerDefFormat(virBufferPtr buf,
     }
 
     if (pciModel || pciTarget ||
-        def->queues || def->cmd_per_lun || def->max_sectors || def->ioeventfd ||
-        def->iothread ||
+        def->queues || def->queuesAuto || def->cmd_per_lun ||
+        def->max_sectors || def->ioeventfd || def->iothread ||
         virDomainDeviceInfoNeedsFormat(&def->info, flags) || pcihole64) {
         virBufferAddLit(buf, ">\n");
         virBufferAdjustIndent(buf, 2);
@@ -21239,11 +21706,13 @@ virDomainControllerDefFormat(virBufferPtr buf,
             }
         }
 
-        if (def->queues || def->cmd_per_lun ||
+        if (def->queues || def->queuesAuto || def->cmd_per_lun ||
             def->max_sectors || def->ioeventfd || def->iothread) {
             virBufferAddLit(buf, "<driver");
             if (def->queues)
                 virBufferAsprintf(buf, " queues='%u'", def->queues);
+            else if (def->queuesAuto)
+                virBufferAddLit(buf, " queues='auto'");
 
             if (def->cmd_per_lun)
                 virBufferAsprintf(buf, " cmd_per_lun='%u'", def->cmd_per_lun);
@@ -21841,6 +22310,8 @@ virDomainVirtioNetDriverFormat(char **outstr,
     }
     if (def->driver.virtio.queues)
         virBufferAsprintf(&buf, "queues='%u' ", def->driver.virtio.queues);
+    else if (def->driver.virtio.queuesAuto)
+        virBufferAddLit(&buf, "queues='auto' ");
     if (def->driver.virtio.rx_queue_size)
         virBufferAsprintf(&buf, "rx_queue_size='%u' ",
                           def->driver.virtio.rx_queue_size);
@@ -23765,6 +24236,9 @@ virDomainDefHasCapabilitiesFeatures(virDomainDefPtr def)
 {
     size_t i;
 
+    if (!def->caps_features)
+        return false;
+
     for (i = 0; i < VIR_DOMAIN_CAPS_FEATURE_LAST; i++) {
         if (def->caps_features[i] != VIR_TRISTATE_SWITCH_ABSENT)
             return true;
@@ -23987,6 +24461,46 @@ virDomainDefIothreadShouldFormat(virDomainDefPtr def)
 }
 
 
+/* Size of the most recently formatted domain definition */
+static int virDomainDefFormatSizeHint;
+
+/* Formats the title, description and custom metadata of @def */
+static int
+virDomainDefFormatMetadata(virBufferPtr buf,
+                           virDomainDefPtr def)
+{
+    virBufferEscapeString(buf, "<title>%s</title>\n", def->title);
+
+    virBufferEscapeString(buf, "<description>%s</description>\n",
+                          def->description);
+
+    if (def->metadata) {
+        xmlBufferPtr xmlbuf;
+        int oldIndentTreeOutput = xmlIndentTreeOutput;
+
+        /* Indentation on output requires that we previously set
+         * xmlKeepBlanksDefault to 0 when parsing; also, libxml does 2
+         * spaces per level of indentation of intermediate elements,
+         * but no leading indentation before the starting element.
+         * Thankfully, libxml maps what looks like globals into
+         * thread-local uses, so we are thread-safe.  */
+        xmlIndentTreeOutput = 1;
+        xmlbuf = xmlBufferCreate();
+        if (xmlNodeDump(xmlbuf, def->metadata->doc, def->metadata,
+                        virBufferGetIndent(buf, false) / 2, 1) < 0) {
+            xmlBufferFree(xmlbuf);
+            xmlIndentTreeOutput = oldIndentTreeOutput;
+            return -1;
+        }
+        virBufferAsprintf(buf, "%s\n", (char *) xmlBufferContent(xmlbuf));
+        xmlBufferFree(xmlbuf);
+        xmlIndentTreeOutput = oldIndentTreeOutput;
+    }
+
+    return 0;
+}
+
+
 /* This internal version appends to an existing buffer
  * (possibly with auto-indent), rather than flattening
  * to string.
@@ -24005,6 +24519,7 @@ virDomainDefFormatInternal(virDomainDefPtr def,
     virBuffer childrenBuf = VIR_BUFFER_INITIALIZER;
     int indent;
     char *netprefix = NULL;
+    unsigned int start = virBufferUse(buf);
 
     virCheckFlags(VIR_DOMAIN_DEF_FORMAT_COMMON_FLAGS |
                   VIR_DOMAIN_DEF_FORMAT_STATUS |
@@ -24013,6 +24528,9 @@ virDomainDefFormatInternal(virDomainDefPtr def,
                   VIR_DOMAIN_DEF_FORMAT_CLOCK_ADJUST,
                   -1);
 
+    /* assume that this definition is about as large as the previous one */
+    virBufferReserve(buf, virAtomicIntGet(&virDomainDefFormatSizeHint));
+
     if (!(type = virDomainVirtTypeToString(def->virtType))) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("unexpected domain type %d"), def->virtType);
@@ -24036,33 +24554,8 @@ virDomainDefFormatInternal(virDomainDefPtr def,
     virUUIDFormat(uuid, uuidstr);
     virBufferAsprintf(buf, "<uuid>%s</uuid>\n", uuidstr);
 
-    virBufferEscapeString(buf, "<title>%s</title>\n", def->title);
-
-    virBufferEscapeString(buf, "<description>%s</description>\n",
-                          def->description);
-
-    if (def->metadata) {
-        xmlBufferPtr xmlbuf;
-        int oldIndentTreeOutput = xmlIndentTreeOutput;
-
-        /* Indentation on output requires that we previously set
-         * xmlKeepBlanksDefault to 0 when parsing; also, libxml does 2
-         * spaces per level of indentation of intermediate elements,
-         * but no leading indentation before the starting element.
-         * Thankfully, libxml maps what looks like globals into
-         * thread-local uses, so we are thread-safe.  */
-        xmlIndentTreeOutput = 1;
-        xmlbuf = xmlBufferCreate();
-        if (xmlNodeDump(xmlbuf, def->metadata->doc, def->metadata,
-                        virBufferGetIndent(buf, false) / 2, 1) < 0) {
-            xmlBufferFree(xmlbuf);
-            xmlIndentTreeOutput = oldIndentTreeOutput;
-            goto error;
-        }
-        virBufferAsprintf(buf, "%s\n", (char *) xmlBufferContent(xmlbuf));
-        xmlBufferFree(xmlbuf);
-        xmlIndentTreeOutput = oldIndentTreeOutput;
-    }
+    if (virDomainDefFormatMetadata(buf, def) < 0)
+        goto error;
 
     if (virDomainDefHasMemoryHotplug(def)) {
         virBufferAsprintf(buf,
@@ -24150,7 +24643,8 @@ virDomainDefFormatInternal(virDomainDefPtr def,
     }
 
     if (def->mem.nhugepages || def->mem.nosharepages || def->mem.locked
-        || def->mem.source || def->mem.access || def->mem.allocation)
+        || def->mem.source || def->mem.access || def->mem.allocation
+        || def->mem.allocation_threads)
     {
         virBufferAddLit(buf, "<memoryBacking>\n");
         virBufferAdjustIndent(buf, 2);
@@ -24166,9 +24660,16 @@ virDomainDefFormatInternal(virDomainDefPtr def,
         if (def->mem.access)
             virBufferAsprintf(buf, "<access mode='%s'/>\n",
                 virDomainMemoryAccessTypeToString(def->mem.access));
-        if (def->mem.allocation)
-            virBufferAsprintf(buf, "<allocation mode='%s'/>\n",
-                virDomainMemoryAllocationTypeToString(def->mem.allocation));
+        if (def->mem.allocation || def->mem.allocation_threads) {
+            virBufferAddLit(buf, "<allocation");
+            if (def->mem.allocation)
+                virBufferAsprintf(buf, " mode='%s'",
+                    virDomainMemoryAllocationTypeToString(def->mem.allocation));
+            if (def->mem.allocation_threads)
+                virBufferAsprintf(buf, " threads='%u'",
+                                  def->mem.allocation_threads);
+            virBufferAddLit(buf, "/>\n");
+        }
 
         virBufferAdjustIndent(buf, -2);
         virBufferAddLit(buf, "</memoryBacking>\n");
@@ -24177,9 +24678,18 @@ virDomainDefFormatInternal(virDomainDefPtr def,
     if (virDomainCpuDefFormat(buf, def) < 0)
         goto error;
 
-    if (def->niothreadids > 0) {
+    if (def->iothreadsPlacement == VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO) {
+        virBufferAddLit(buf, "<iothreads placement='auto'");
+        if (def->niothreadids > 0)
+            virBufferAsprintf(buf, ">%zu</iothreads>\n", def->niothreadids);
+        else
+            virBufferAddLit(buf, "/>\n");
+    } else if (def->niothreadids > 0) {
         virBufferAsprintf(buf, "<iothreads>%zu</iothreads>\n",
                           def->niothreadids);
+    }
+
+    if (def->niothreadids > 0) {
         if (virDomainDefIothreadShouldFormat(def)) {
             virBufferAddLit(buf, "<iothreadids>\n");
             virBufferAdjustIndent(buf, 2);
@@ -24488,11 +24998,12 @@ virDomainDefFormatInternal(virDomainDefPtr def,
                                   virDomainCapabilitiesPolicyTypeToString(def->features[i]));
                 virBufferAdjustIndent(buf, 2);
                 for (j = 0; j < VIR_DOMAIN_CAPS_FEATURE_LAST; j++) {
-                    if (def->caps_features[j] != VIR_TRISTATE_SWITCH_ABSENT)
+                    int state = virDomainDefGetCapsFeature(def, j);
+
+                    if (state != VIR_TRISTATE_SWITCH_ABSENT)
                         virBufferAsprintf(buf, "<%s state='%s'/>\n",
                                           virDomainCapsFeatureTypeToString(j),
-                                          virTristateSwitchTypeToString(
-                                              def->caps_features[j]));
+                                          virTristateSwitchTypeToString(state));
                 }
                 virBufferAdjustIndent(buf, -2);
                 virBufferAddLit(buf, "</capabilities>\n");
@@ -24758,6 +25269,8 @@ virDomainDefFormatInternal(virDomainDefPtr def,
     if (virBufferCheckError(buf) < 0)
         goto error;
 
+    virAtomicIntSet(&virDomainDefFormatSizeHint, virBufferUse(buf) - start);
+
     return 0;
 
  error:
@@ -25007,6 +25520,11 @@ virDomainSaveConfig(const char *configDir,
     if (virDomainSaveXML(configDir, def, xml))
         goto cleanup;
 
+    /* the config includes all the metadata now */
+    if (configDir &&
+        virDomainDeleteMetadata(configDir, def->name) < 0)
+        goto cleanup;
+
     ret = 0;
  cleanup:
     VIR_FREE(xml);
@@ -25025,6 +25543,7 @@ virDomainSaveStatus(virDomainXMLOptionPtr xmlopt,
                           VIR_DOMAIN_DEF_FORMAT_PCI_ORIG_STATES |
                           VIR_DOMAIN_DEF_FORMAT_CLOCK_ADJUST);
 
+    int span = virTraceSpanBegin("virDomainSaveStatus");
     int ret = -1;
     char *xml;
 
@@ -25037,6 +25556,7 @@ virDomainSaveStatus(virDomainXMLOptionPtr xmlopt,
     ret = 0;
  cleanup:
     VIR_FREE(xml);
+    virTraceSpanEnd(span);
     return ret;
 }
 
@@ -25067,6 +25587,9 @@ virDomainDeleteConfig(const char *configDir,
         goto cleanup;
     }
 
+    if (virDomainDeleteMetadata(configDir, dom->def->name) < 0)
+        goto cleanup;
+
     ret = 0;
 
  cleanup:
@@ -25085,6 +25608,170 @@ char
     return ret;
 }
 
+
+/* The metadata file stores the title, description and custom metadata of
+ * a persistent domain changed by virDomainObjSetMetadata since its config
+ * was last saved. It doesn't end in .xml so that it isn't mistaken for
+ * the config of another domain. */
+static char *
+virDomainMetadataFile(const char *dir,
+                      const char *name)
+{
+    char *ret;
+
+    ignore_value(virAsprintf(&ret, "%s/%s.metadata", dir, name));
+    return ret;
+}
+
+
+static int
+virDomainSaveMetadata(const char *configDir,
+                      virDomainDefPtr def)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    char *metadataFile = NULL;
+    char *xml = NULL;
+    int ret = -1;
+
+    if (!configDir)
+        return 0;
+
+    virBufferAddLit(&buf, "<domainmetadata>\n");
+    virBufferAdjustIndent(&buf, 2);
+    if (virDomainDefFormatMetadata(&buf, def) < 0)
+        goto cleanup;
+    virBufferAdjustIndent(&buf, -2);
+    virBufferAddLit(&buf, "</domainmetadata>\n");
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+    xml = virBufferContentAndReset(&buf);
+
+    if (!(metadataFile = virDomainMetadataFile(configDir, def->name)))
+        goto cleanup;
+
+    virUUIDFormat(def->uuid, uuidstr);
+    ret = virXMLSaveFile(metadataFile,
+                         virXMLPickShellSafeComment(def->name, uuidstr),
+                         "edit", xml);
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(metadataFile);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+/**
+ * virDomainDefLoadMetadata:
+ * @configDir: directory of the domain configs
+ * @def: persistent definition parsed from its config in @configDir
+ *
+ * Replaces the title, description and custom metadata of @def by the
+ * ones virDomainObjSetMetadata stored next to the config since it was
+ * last saved, if any.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virDomainDefLoadMetadata(const char *configDir,
+                         virDomainDefPtr def)
+{
+    char *metadataFile = NULL;
+    xmlDocPtr xml = NULL;
+    xmlXPathContextPtr ctxt = NULL;
+    xmlNodePtr node;
+    xmlNodePtr metadata = NULL;
+    int ret = -1;
+
+    if (!(metadataFile = virDomainMetadataFile(configDir, def->name)))
+        goto cleanup;
+
+    if (!virFileExists(metadataFile)) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Loading metadata of domain '%s' from '%s'",
+              def->name, metadataFile);
+
+    if (!(xml = virXMLParseFileCtxt(metadataFile, &ctxt)))
+        goto cleanup;
+
+    if (!xmlStrEqual(ctxt->node->name, BAD_CAST "domainmetadata")) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("unexpected root element <%s> in '%s', "
+                         "expecting <domainmetadata>"),
+                       ctxt->node->name, metadataFile);
+        goto cleanup;
+    }
+
+    if ((node = virXPathNode("./metadata[1]", ctxt))) {
+        if (!(metadata = xmlCopyNode(node, 1))) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        virXMLNodeSanitizeNamespaces(metadata);
+    }
+
+    VIR_FREE(def->title);
+    def->title = virXPathString("string(./title[1])", ctxt);
+    VIR_FREE(def->description);
+    def->description = virXPathString("string(./description[1])", ctxt);
+
+    xmlFreeNode(def->metadata);
+    VIR_STEAL_PTR(def->metadata, metadata);
+    virHashFree(def->metadataCache);
+    def->metadataCache = NULL;
+
+    ret = 0;
+
+ cleanup:
+    xmlFreeNode(metadata);
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(xml);
+    VIR_FREE(metadataFile);
+    return ret;
+}
+
+
+/**
+ * virDomainDeleteMetadata:
+ * @configDir: directory of the domain configs
+ * @name: name of the domain
+ *
+ * Removes the metadata stored by virDomainObjSetMetadata next to the
+ * config of domain @name, once the config itself is up to date or gone.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virDomainDeleteMetadata(const char *configDir,
+                        const char *name)
+{
+    char *metadataFile;
+    int ret = -1;
+
+    if (!(metadataFile = virDomainMetadataFile(configDir, name)))
+        return -1;
+
+    if (unlink(metadataFile) < 0 &&
+        errno != ENOENT) {
+        virReportSystemError(errno,
+                             _("cannot remove domain metadata %s"),
+                             metadataFile);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(metadataFile);
+    return ret;
+}
+
 /* Translates a device name of the form (regex) "[fhv]d[a-z]+" into
  * the corresponding bus,index combination (e.g. sda => (0,0), sdi (1,1),
  *                                               hdd => (1,1), vdaa => (0,26))
@@ -25390,11 +26077,16 @@ virDomainDefCopy(virDomainDefPtr src,
     if (migratable)
         format_flags |= VIR_DOMAIN_DEF_FORMAT_INACTIVE | VIR_DOMAIN_DEF_FORMAT_MIGRATABLE;
 
-    /* Easiest to clone via a round-trip through XML.  */
+    /* Easiest to clone via a round-trip through XML.  The XML of a
+     * copy is hardly ever parsed twice, so it's not worth going through
+     * the parse cache of virDomainDefParseString: hashing the XML and
+     * formatting the result once more to store it would just double the
+     * cost of the copy and evict the definitions worth keeping.  */
     if (!(xml = virDomainDefFormat(src, caps, format_flags)))
         return NULL;
 
-    ret = virDomainDefParseString(xml, caps, xmlopt, parseOpaque, parse_flags);
+    ret = virDomainDefParse(xml, NULL, caps, xmlopt, parseOpaque, parse_flags,
+                            NULL);
 
     VIR_FREE(xml);
     return ret;
@@ -25969,6 +26661,7 @@ virDomainObjGetMetadata(virDomainObjPtr vm,
                         unsigned int flags)
 {
     virDomainDefPtr def;
+    char *cached = NULL;
     char *ret = NULL;
 
     virCheckFlags(VIR_DOMAIN_AFFECT_LIVE |
@@ -25995,11 +26688,33 @@ virDomainObjGetMetadata(virDomainObjPtr vm,
         break;
 
     case VIR_DOMAIN_METADATA_ELEMENT:
-        if (!def->metadata)
+        if (!def->metadata || !uri)
+            break;
+
+        if (def->metadataCache &&
+            (cached = virHashLookup(def->metadataCache, uri))) {
+            if (VIR_STRDUP(ret, cached) < 0)
+                goto cleanup;
             break;
+        }
 
         if (virXMLExtractNamespaceXML(def->metadata, uri, &ret) < 0)
             goto cleanup;
+
+        /* applications keep polling their own element, keep it formatted */
+        if (ret) {
+            if (!def->metadataCache &&
+                !(def->metadataCache = virHashCreate(4, virHashValueFree)))
+                goto cleanup;
+
+            if (VIR_STRDUP(cached, ret) < 0)
+                goto cleanup;
+
+            if (virHashAddEntry(def->metadataCache, uri, cached) < 0) {
+                VIR_FREE(cached);
+                goto cleanup;
+            }
+        }
         break;
 
     /* coverity[dead_error_begin] */
@@ -26011,8 +26726,11 @@ virDomainObjGetMetadata(virDomainObjPtr vm,
         virReportError(VIR_ERR_NO_DOMAIN_METADATA, "%s",
                        _("Requested metadata element is not present"));
 
- cleanup:
     return ret;
+
+ cleanup:
+    VIR_FREE(ret);
+    return NULL;
 }
 
 
@@ -26074,6 +26792,9 @@ virDomainDefSetMetadata(virDomainDefPtr def,
             }
         }
 
+        if (def->metadataCache)
+            ignore_value(virHashRemoveEntry(def->metadataCache, uri));
+
         /* remove possible other nodes sharing the namespace */
         while ((old = virXMLFindChildNodeByNs(def->metadata, uri))) {
             xmlUnlinkNode(old);
@@ -26135,7 +26856,8 @@ virDomainObjSetMetadata(virDomainObjPtr vm,
                                     uri) < 0)
             return -1;
 
-        if (virDomainSaveConfig(configDir, caps, persistentDef) < 0)
+        /* there's no need to format and rewrite the whole config */
+        if (virDomainSaveMetadata(configDir, persistentDef) < 0)
             return -1;
     }
 
@@ -796,6 +796,7 @@ struct _virDomainControllerDef {
     int idx;
     int model; /* -1 == undef */
     unsigned int queues;
+    bool queuesAuto; /* queues derived from the vCPUs when starting */
     unsigned int cmd_per_lun;
     unsigned int max_sectors;
     int ioeventfd; /* enum virTristateSwitch */
@@ -957,6 +958,7 @@ struct _virDomainNetDef {
             virTristateSwitch ioeventfd;
             virTristateSwitch event_idx;
             unsigned int queues; /* Multiqueue virtio-net */
+            bool queuesAuto; /* queues derived from the vCPUs */
             unsigned int rx_queue_size;
             struct {
                 virTristateSwitch csum;
@@ -2167,6 +2169,7 @@ struct _virDomainMemtune {
     int source; /* enum virDomainMemorySource */
     int access; /* enum virDomainMemoryAccess */
     int allocation; /* enum virDomainMemoryAllocation */
+    unsigned int allocation_threads; /* 0 for the hypervisor default */
 };
 
 typedef struct _virDomainPowerManagement virDomainPowerManagement;
@@ -2229,6 +2232,9 @@ struct _virDomainDef {
 
     size_t niothreadids;
     virDomainIOThreadIDDefPtr *iothreadids;
+    /* With VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO the driver adds iothreads,
+     * assigns them to the disks and pins them when starting the domain */
+    int iothreadsPlacement; /* enum virDomainCpuPlacementMode */
 
     virDomainCputune cputune;
 
@@ -2260,8 +2266,10 @@ struct _virDomainDef {
     virGICVersion gic_version;
     char *hyperv_vendor_id;
 
-    /* These options are of type virTristateSwitch: ON = keep, OFF = drop */
-    int caps_features[VIR_DOMAIN_CAPS_FEATURE_LAST];
+    /* These options are of type virTristateSwitch: ON = keep, OFF = drop.
+     * Hardly any domain sets one, so the VIR_DOMAIN_CAPS_FEATURE_LAST
+     * states are only allocated by virDomainDefSetCapsFeature. */
+    int *caps_features;
 
     virDomainClockDef clock;
 
@@ -2348,6 +2356,9 @@ struct _virDomainDef {
 
     /* Application-specific custom metadata */
     xmlNodePtr metadata;
+    /* The children of @metadata formatted by virDomainObjGetMetadata,
+     * indexed by namespace URI */
+    virHashTablePtr metadataCache;
 };
 
 
@@ -2356,6 +2367,10 @@ void virDomainDefSetMemoryTotal(virDomainDefPtr def, unsigned long long size);
 unsigned long long virDomainDefGetMemoryTotal(const virDomainDef *def);
 bool virDomainDefHasMemoryHotplug(const virDomainDef *def);
 
+int virDomainDefGetCapsFeature(const virDomainDef *def, int feature);
+int virDomainDefSetCapsFeature(virDomainDefPtr def, int feature, int state)
+    ATTRIBUTE_RETURN_CHECK;
+
 typedef enum {
     VIR_DOMAIN_KEY_WRAP_CIPHER_NAME_AES,
     VIR_DOMAIN_KEY_WRAP_CIPHER_NAME_DEA,
@@ -2398,6 +2413,11 @@ struct _virDomainObj {
     unsigned int persistent : 1;
     unsigned int updated : 1;
     unsigned int removing : 1;
+    unsigned int lazy : 1; /* def only holds the name and UUID so far */
+
+    /* Last access of a lazily loaded def, 0 unless def was loaded
+     * by virDomainObjList on access */
+    unsigned int lazyStamp;
 
     virDomainDefPtr def; /* The current definition */
     virDomainDefPtr newDef; /* New definition to activate at shutdown */
@@ -2479,6 +2499,14 @@ typedef int (*virDomainDeviceDefValidateCallback)(const virDomainDeviceDef *dev,
                                                   const virDomainDef *def,
                                                   void *opaque);
 
+/* Returns a string identifying the driver state, outside of @caps, which
+ * the post parse callbacks depended on while processing @def, or NULL if
+ * @def may not be cached. A definition is only reused from the parse
+ * cache as long as its stamp stays the same. */
+typedef char *(*virDomainDefParseCacheStampCallback)(const virDomainDef *def,
+                                                     virCapsPtr caps,
+                                                     void *opaque);
+
 typedef struct _virDomainDefParserConfig virDomainDefParserConfig;
 typedef virDomainDefParserConfig *virDomainDefParserConfigPtr;
 struct _virDomainDefParserConfig {
@@ -2491,6 +2519,9 @@ struct _virDomainDefParserConfig {
     virDomainDefValidateCallback domainValidateCallback;
     virDomainDeviceDefValidateCallback deviceValidateCallback;
 
+    /* parse cache callbacks */
+    virDomainDefParseCacheStampCallback parseCacheStampCallback;
+
     /* private data for the callbacks */
     void *priv;
     virFreeCallback privFree;
@@ -2498,6 +2529,7 @@ struct _virDomainDefParserConfig {
     /* data */
     unsigned int features; /* virDomainDefFeatures */
     unsigned char macPrefix[VIR_MAC_PREFIX_BUFLEN];
+    size_t parseCacheSize; /* definitions virDomainDefParseString caches */
 };
 
 typedef void *(*virDomainXMLPrivateDataAllocFunc)(void);
@@ -2565,6 +2597,7 @@ void virDomainDefVcpuOrderClear(virDomainDefPtr def);
 int  virDomainDefGetVcpusTopology(const virDomainDef *def,
                                   unsigned int *maxvcpus);
 
+unsigned int virDomainObjGetCount(void);
 virDomainObjPtr virDomainObjNew(virDomainXMLOptionPtr caps)
     ATTRIBUTE_NONNULL(1);
 
@@ -2988,6 +3021,11 @@ int virDomainDeleteConfig(const char *configDir,
                           const char *autostartDir,
                           virDomainObjPtr dom);
 
+int virDomainDefLoadMetadata(const char *configDir,
+                             virDomainDefPtr def);
+int virDomainDeleteMetadata(const char *configDir,
+                            const char *name);
+
 char *virDomainConfigFile(const char *dir,
                           const char *name);
 
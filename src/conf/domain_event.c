@@ -61,6 +61,8 @@ static virClassPtr virDomainEventJobCompletedClass;
 static virClassPtr virDomainEventDeviceRemovalFailedClass;
 static virClassPtr virDomainEventMetadataChangeClass;
 static virClassPtr virDomainEventBlockThresholdClass;
+static virClassPtr virDomainEventStatsClass;
+static virClassPtr virDomainEventBlockJobGroupClass;
 
 static void virDomainEventDispose(void *obj);
 static void virDomainEventLifecycleDispose(void *obj);
@@ -83,6 +85,8 @@ static void virDomainEventJobCompletedDispose(void *obj);
 static void virDomainEventDeviceRemovalFailedDispose(void *obj);
 static void virDomainEventMetadataChangeDispose(void *obj);
 static void virDomainEventBlockThresholdDispose(void *obj);
+static void virDomainEventStatsDispose(void *obj);
+static void virDomainEventBlockJobGroupDispose(void *obj);
 
 static void
 virDomainEventDispatchDefaultFunc(virConnectPtr conn,
@@ -291,6 +295,24 @@ struct _virDomainEventBlockThreshold {
 typedef struct _virDomainEventBlockThreshold virDomainEventBlockThreshold;
 typedef virDomainEventBlockThreshold *virDomainEventBlockThresholdPtr;
 
+struct _virDomainEventStats {
+    virDomainEvent parent;
+
+    virTypedParameterPtr params;
+    int nparams;
+};
+typedef struct _virDomainEventStats virDomainEventStats;
+typedef virDomainEventStats *virDomainEventStatsPtr;
+
+struct _virDomainEventBlockJobGroup {
+    virDomainEvent parent;
+
+    virTypedParameterPtr params;
+    int nparams;
+};
+typedef struct _virDomainEventBlockJobGroup virDomainEventBlockJobGroup;
+typedef virDomainEventBlockJobGroup *virDomainEventBlockJobGroupPtr;
+
 
 static int
 virDomainEventsOnceInit(void)
@@ -421,6 +443,18 @@ virDomainEventsOnceInit(void)
                       sizeof(virDomainEventBlockThreshold),
                       virDomainEventBlockThresholdDispose)))
         return -1;
+    if (!(virDomainEventStatsClass =
+          virClassNew(virDomainEventClass,
+                      "virDomainEventStats",
+                      sizeof(virDomainEventStats),
+                      virDomainEventStatsDispose)))
+        return -1;
+    if (!(virDomainEventBlockJobGroupClass =
+          virClassNew(virDomainEventClass,
+                      "virDomainEventBlockJobGroup",
+                      sizeof(virDomainEventBlockJobGroup),
+                      virDomainEventBlockJobGroupDispose)))
+        return -1;
     return 0;
 }
 
@@ -630,6 +664,26 @@ virDomainEventBlockThresholdDispose(void *obj)
 }
 
 
+static void
+virDomainEventStatsDispose(void *obj)
+{
+    virDomainEventStatsPtr event = obj;
+    VIR_DEBUG("obj=%p", event);
+
+    virTypedParamsFree(event->params, event->nparams);
+}
+
+
+static void
+virDomainEventBlockJobGroupDispose(void *obj)
+{
+    virDomainEventBlockJobGroupPtr event = obj;
+    VIR_DEBUG("obj=%p", event);
+
+    virTypedParamsFree(event->params, event->nparams);
+}
+
+
 static void *
 virDomainEventNew(virClassPtr klass,
                   int eventID,
@@ -1758,6 +1812,100 @@ virDomainEventBlockThresholdNewFromDom(virDomainPtr dom,
 }
 
 
+/* This function consumes @params, even on failure. */
+static virObjectEventPtr
+virDomainEventStatsNew(int id,
+                       const char *name,
+                       unsigned char *uuid,
+                       virTypedParameterPtr params,
+                       int nparams)
+{
+    virDomainEventStatsPtr ev;
+
+    if (virDomainEventsInitialize() < 0)
+        goto error;
+
+    if (!(ev = virDomainEventNew(virDomainEventStatsClass,
+                                 VIR_DOMAIN_EVENT_ID_STATS,
+                                 id, name, uuid)))
+        goto error;
+
+    ev->params = params;
+    ev->nparams = nparams;
+
+    return (virObjectEventPtr)ev;
+
+ error:
+    virTypedParamsFree(params, nparams);
+    return NULL;
+}
+
+virObjectEventPtr
+virDomainEventStatsNewFromObj(virDomainObjPtr obj,
+                              virTypedParameterPtr params,
+                              int nparams)
+{
+    return virDomainEventStatsNew(obj->def->id, obj->def->name,
+                                  obj->def->uuid, params, nparams);
+}
+
+virObjectEventPtr
+virDomainEventStatsNewFromDom(virDomainPtr dom,
+                              virTypedParameterPtr params,
+                              int nparams)
+{
+    return virDomainEventStatsNew(dom->id, dom->name, dom->uuid,
+                                  params, nparams);
+}
+
+
+/* This function consumes @params, even on failure. */
+static virObjectEventPtr
+virDomainEventBlockJobGroupNew(int id,
+                               const char *name,
+                               unsigned char *uuid,
+                               virTypedParameterPtr params,
+                               int nparams)
+{
+    virDomainEventBlockJobGroupPtr ev;
+
+    if (virDomainEventsInitialize() < 0)
+        goto error;
+
+    if (!(ev = virDomainEventNew(virDomainEventBlockJobGroupClass,
+                                 VIR_DOMAIN_EVENT_ID_BLOCK_JOB_GROUP,
+                                 id, name, uuid)))
+        goto error;
+
+    ev->params = params;
+    ev->nparams = nparams;
+
+    return (virObjectEventPtr)ev;
+
+ error:
+    virTypedParamsFree(params, nparams);
+    return NULL;
+}
+
+virObjectEventPtr
+virDomainEventBlockJobGroupNewFromObj(virDomainObjPtr obj,
+                                      virTypedParameterPtr params,
+                                      int nparams)
+{
+    return virDomainEventBlockJobGroupNew(obj->def->id, obj->def->name,
+                                          obj->def->uuid, params, nparams);
+}
+
+virObjectEventPtr
+virDomainEventBlockJobGroupNewFromDom(virDomainPtr dom,
+                                      virTypedParameterPtr params,
+                                      int nparams)
+{
+    return virDomainEventBlockJobGroupNew(dom->id, dom->name, dom->uuid,
+                                          params, nparams);
+}
+
+
 static void
 virDomainEventDispatchDefaultFunc(virConnectPtr conn,
                                   virObjectEventPtr event,
@@ -2041,6 +2189,30 @@ virDomainEventDispatchDefaultFunc(virConnectPtr conn,
                                                               cbopaque);
             goto cleanup;
         }
+
+    case VIR_DOMAIN_EVENT_ID_STATS:
+        {
+            virDomainEventStatsPtr statsEvent;
+
+            statsEvent = (virDomainEventStatsPtr)event;
+            ((virConnectDomainEventStatsCallback)cb)(conn, dom,
+                                                     statsEvent->params,
+                                                     statsEvent->nparams,
+                                                     cbopaque);
+            goto cleanup;
+        }
+
+    case VIR_DOMAIN_EVENT_ID_BLOCK_JOB_GROUP:
+        {
+            virDomainEventBlockJobGroupPtr groupEvent;
+
+            groupEvent = (virDomainEventBlockJobGroupPtr)event;
+            ((virConnectDomainEventBlockJobGroupCallback)cb)(conn, dom,
+                                                             groupEvent->params,
+                                                             groupEvent->nparams,
+                                                             cbopaque);
+            goto cleanup;
+        }
     case VIR_DOMAIN_EVENT_ID_LAST:
         break;
     }
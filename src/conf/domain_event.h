@@ -259,6 +259,26 @@ virDomainEventBlockThresholdNewFromDom(virDomainPtr dom,
                                        unsigned long long threshold,
                                        unsigned long long excess);
 
+virObjectEventPtr
+virDomainEventStatsNewFromObj(virDomainObjPtr obj,
+                              virTypedParameterPtr params,
+                              int nparams);
+
+virObjectEventPtr
+virDomainEventStatsNewFromDom(virDomainPtr dom,
+                              virTypedParameterPtr params,
+                              int nparams);
+
+virObjectEventPtr
+virDomainEventBlockJobGroupNewFromObj(virDomainObjPtr obj,
+                                      virTypedParameterPtr params,
+                                      int nparams);
+
+virObjectEventPtr
+virDomainEventBlockJobGroupNewFromDom(virDomainPtr dom,
+                                      virTypedParameterPtr params,
+                                      int nparams);
+
 int
 virDomainEventStateRegister(virConnectPtr conn,
                             virObjectEventStatePtr state,
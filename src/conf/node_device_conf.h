@@ -27,6 +27,7 @@
 
 # include "internal.h"
 # include "virbitmap.h"
+# include "virhash.h"
 # include "virutil.h"
 # include "virscsihost.h"
 # include "virpci.h"
@@ -306,6 +307,11 @@ typedef virNodeDeviceObjList *virNodeDeviceObjListPtr;
 struct _virNodeDeviceObjList {
     size_t count;
     virNodeDeviceObjPtr *objs;
+
+    /* Indexes of @objs by name and sysfs path, created along with the
+     * first device. They don't own the objects. */
+    virHashTablePtr names;
+    virHashTablePtr sysfsPaths;
 };
 
 char *
@@ -3147,7 +3147,7 @@ virNWFilterRuleDefDetailsFormat(virBufferPtr buf,
 }
 
 
-static int
+int
 virNWFilterRuleDefFormat(virBufferPtr buf,
                          virNWFilterRuleDefPtr def)
 {
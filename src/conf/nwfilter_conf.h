@@ -584,6 +584,10 @@ virNWFilterDefParseNode(xmlDocPtr xml,
 char *
 virNWFilterDefFormat(const virNWFilterDef *def);
 
+int
+virNWFilterRuleDefFormat(virBufferPtr buf,
+                         virNWFilterRuleDefPtr def);
+
 int
 virNWFilterSaveXML(const char *configDir,
                    virNWFilterDefPtr def,
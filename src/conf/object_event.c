@@ -32,6 +32,7 @@
 #include "datatypes.h"
 #include "viralloc.h"
 #include "virerror.h"
+#include "virhash.h"
 #include "virobject.h"
 #include "virstring.h"
 
@@ -58,10 +59,32 @@ struct _virObjectEventCallback {
 typedef struct _virObjectEventCallback virObjectEventCallback;
 typedef virObjectEventCallback *virObjectEventCallbackPtr;
 
+/* The callbacks registered for one event ID, in registration order */
+struct _virObjectEventCallbackBucket {
+    size_t count;
+    virObjectEventCallbackPtr *callbacks;
+};
+typedef struct _virObjectEventCallbackBucket virObjectEventCallbackBucket;
+typedef virObjectEventCallbackBucket *virObjectEventCallbackBucketPtr;
+
+/* The callbacks filtering on one object key, or on none, by event ID */
+struct _virObjectEventCallbackIndex {
+    size_t count;
+    size_t nbuckets;
+    virObjectEventCallbackBucketPtr *buckets;
+};
+typedef struct _virObjectEventCallbackIndex virObjectEventCallbackIndex;
+typedef virObjectEventCallbackIndex *virObjectEventCallbackIndexPtr;
+
 struct _virObjectEventCallbackList {
     unsigned int nextID;
     size_t count;
     virObjectEventCallbackPtr *callbacks;
+
+    /* The same callbacks indexed by event ID, so that dispatching an
+     * event doesn't have to walk the whole list */
+    virObjectEventCallbackIndex global;
+    virHashTablePtr keys;  /* object key -> virObjectEventCallbackIndex */
 };
 
 struct _virObjectEventQueue {
@@ -154,6 +177,141 @@ virObjectEventCallbackFree(virObjectEventCallbackPtr cb)
     VIR_FREE(cb);
 }
 
+
+static void
+virObjectEventCallbackIndexClear(virObjectEventCallbackIndexPtr index)
+{
+    size_t i;
+
+    for (i = 0; i < index->nbuckets; i++) {
+        if (index->buckets[i])
+            VIR_FREE(index->buckets[i]->callbacks);
+        VIR_FREE(index->buckets[i]);
+    }
+    VIR_FREE(index->buckets);
+    index->nbuckets = 0;
+    index->count = 0;
+}
+
+
+static void
+virObjectEventCallbackIndexFree(void *payload,
+                                const void *name ATTRIBUTE_UNUSED)
+{
+    virObjectEventCallbackIndexPtr index = payload;
+
+    if (!index)
+        return;
+
+    virObjectEventCallbackIndexClear(index);
+    VIR_FREE(index);
+}
+
+
+/**
+ * virObjectEventCallbackListGetBucket:
+ * @cbList: the list
+ * @eventID: the event ID
+ * @key: the object key, or NULL for callbacks not filtering on one
+ *
+ * Get the callbacks of @cbList registered for @eventID and @key, in
+ * the order they were added.  The bucket stays valid while the
+ * callbacks are only marked for deletion, that is while dispatching.
+ *
+ * Returns the bucket, or NULL if there are no such callbacks.
+ */
+static virObjectEventCallbackBucketPtr
+virObjectEventCallbackListGetBucket(virObjectEventCallbackListPtr cbList,
+                                    int eventID,
+                                    const char *key)
+{
+    virObjectEventCallbackIndexPtr index = &cbList->global;
+
+    if (key && !(index = virHashLookup(cbList->keys, key)))
+        return NULL;
+
+    if (eventID < 0 || eventID >= index->nbuckets)
+        return NULL;
+
+    return index->buckets[eventID];
+}
+
+
+static int
+virObjectEventCallbackListIndexAdd(virObjectEventCallbackListPtr cbList,
+                                   virObjectEventCallbackPtr cb)
+{
+    virObjectEventCallbackIndexPtr index = &cbList->global;
+    virObjectEventCallbackBucketPtr bucket;
+
+    if (cb->eventID < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("invalid event ID %d"), cb->eventID);
+        return -1;
+    }
+
+    if (cb->key_filter && !(index = virHashLookup(cbList->keys, cb->key))) {
+        if (VIR_ALLOC(index) < 0 ||
+            virHashAddEntry(cbList->keys, cb->key, index) < 0) {
+            VIR_FREE(index);
+            return -1;
+        }
+    }
+
+    if (cb->eventID >= index->nbuckets &&
+        VIR_EXPAND_N(index->buckets, index->nbuckets,
+                     cb->eventID + 1 - index->nbuckets) < 0)
+        goto error;
+
+    if (!index->buckets[cb->eventID] &&
+        VIR_ALLOC(index->buckets[cb->eventID]) < 0)
+        goto error;
+    bucket = index->buckets[cb->eventID];
+
+    if (VIR_APPEND_ELEMENT(bucket->callbacks, bucket->count, cb) < 0)
+        goto error;
+
+    index->count++;
+    return 0;
+
+ error:
+    if (cb->key_filter && index->count == 0)
+        virHashRemoveEntry(cbList->keys, cb->key);
+    return -1;
+}
+
+
+static void
+virObjectEventCallbackListIndexRemove(virObjectEventCallbackListPtr cbList,
+                                      virObjectEventCallbackPtr cb)
+{
+    virObjectEventCallbackIndexPtr index = &cbList->global;
+    virObjectEventCallbackBucketPtr bucket;
+    size_t i;
+
+    if (cb->key_filter && !(index = virHashLookup(cbList->keys, cb->key)))
+        return;
+
+    if (cb->eventID < 0 || cb->eventID >= index->nbuckets ||
+        !(bucket = index->buckets[cb->eventID]))
+        return;
+
+    for (i = 0; i < bucket->count; i++) {
+        if (bucket->callbacks[i] == cb) {
+            VIR_DELETE_ELEMENT(bucket->callbacks, i, bucket->count);
+            index->count--;
+            break;
+        }
+    }
+
+    if (index->count == 0) {
+        if (cb->key_filter)
+            virHashRemoveEntry(cbList->keys, cb->key);
+        else
+            virObjectEventCallbackIndexClear(index);
+    }
+}
+
 /**
  * virObjectEventCallbackListFree:
  * @list: event callback list head
@@ -174,6 +332,8 @@ virObjectEventCallbackListFree(virObjectEventCallbackListPtr list)
         VIR_FREE(list->callbacks[i]);
     }
     VIR_FREE(list->callbacks);
+    virObjectEventCallbackIndexClear(&list->global);
+    virHashFree(list->keys);
     VIR_FREE(list);
 }
 
@@ -208,11 +368,24 @@ virObjectEventCallbackListCount(virConnectPtr conn,
                                 const char *key,
                                 bool serverFilter)
 {
+    virObjectEventCallbackBucketPtr bucket;
+    virObjectEventCallbackPtr *callbacks = cbList->callbacks;
+    size_t ncallbacks = cbList->count;
     size_t i;
     int ret = 0;
 
-    for (i = 0; i < cbList->count; i++) {
-        virObjectEventCallbackPtr cb = cbList->callbacks[i];
+    /* With serverFilter only the callbacks filtering exactly on @key
+     * count, which is what the index gives us */
+    if (serverFilter) {
+        if (!(bucket = virObjectEventCallbackListGetBucket(cbList, eventID,
+                                                           key)))
+            return 0;
+        callbacks = bucket->callbacks;
+        ncallbacks = bucket->count;
+    }
+
+    for (i = 0; i < ncallbacks; i++) {
+        virObjectEventCallbackPtr cb = callbacks[i];
 
         if (cb->filter)
             continue;
@@ -258,6 +431,7 @@ virObjectEventCallbackListRemoveID(virConnectPtr conn,
 
             if (cb->freecb)
                 (*cb->freecb)(cb->opaque);
+            virObjectEventCallbackListIndexRemove(cbList, cb);
             virObjectEventCallbackFree(cb);
             VIR_DELETE_ELEMENT(cbList->callbacks, i, cbList->count);
             return ret;
@@ -307,6 +481,7 @@ virObjectEventCallbackListPurgeMarked(virObjectEventCallbackListPtr cbList)
             virFreeCallback freecb = cbList->callbacks[n]->freecb;
             if (freecb)
                 (*freecb)(cbList->callbacks[n]->opaque);
+            virObjectEventCallbackListIndexRemove(cbList, cbList->callbacks[n]);
             virObjectEventCallbackFree(cbList->callbacks[n]);
 
             VIR_DELETE_ELEMENT(cbList->callbacks, n, cbList->count);
@@ -345,13 +520,17 @@ virObjectEventCallbackLookup(virConnectPtr conn,
                              bool legacy,
                              int *remoteID)
 {
+    virObjectEventCallbackBucketPtr bucket;
     size_t i;
 
     if (remoteID)
         *remoteID = -1;
 
-    for (i = 0; i < cbList->count; i++) {
-        virObjectEventCallbackPtr cb = cbList->callbacks[i];
+    if (!(bucket = virObjectEventCallbackListGetBucket(cbList, eventID, key)))
+        return -1;
+
+    for (i = 0; i < bucket->count; i++) {
+        virObjectEventCallbackPtr cb = bucket->callbacks[i];
 
         if (cb->deleted)
             continue;
@@ -449,9 +628,14 @@ virObjectEventCallbackListAddID(virConnectPtr conn,
     cb->filter_opaque = filter_opaque;
     cb->legacy = legacy;
 
-    if (VIR_APPEND_ELEMENT(cbList->callbacks, cbList->count, cb) < 0)
+    if (virObjectEventCallbackListIndexAdd(cbList, cb) < 0)
         goto cleanup;
 
+    if (VIR_APPEND_ELEMENT(cbList->callbacks, cbList->count, cb) < 0) {
+        virObjectEventCallbackListIndexRemove(cbList, cb);
+        goto cleanup;
+    }
+
     /* When additional filtering is being done, every client callback
      * is matched to exactly one server callback.  */
     if (filter) {
@@ -572,7 +756,9 @@ virObjectEventStateNew(void)
     if (!(state = virObjectLockableNew(virObjectEventStateClass)))
         return NULL;
 
-    if (VIR_ALLOC(state->callbacks) < 0)
+    if (VIR_ALLOC(state->callbacks) < 0 ||
+        !(state->callbacks->keys =
+          virHashCreate(0, virObjectEventCallbackIndexFree)))
         goto error;
 
     if (!(state->queue = virObjectEventQueueNew()))
@@ -693,14 +879,36 @@ virObjectEventStateDispatchCallbacks(virObjectEventStatePtr state,
                                      virObjectEventPtr event,
                                      virObjectEventCallbackListPtr callbacks)
 {
-    size_t i;
-    /* Cache this now, since we may be dropping the lock,
-       and have more callbacks added. We're guaranteed not
-       to have any removed */
-    size_t cbCount = callbacks->count;
-
-    for (i = 0; i < cbCount; i++) {
-        virObjectEventCallbackPtr cb = callbacks->callbacks[i];
+    virObjectEventCallbackBucketPtr global;
+    virObjectEventCallbackBucketPtr keyed = NULL;
+    size_t nglobal = 0;
+    size_t nkeyed = 0;
+    size_t i = 0;
+    size_t j = 0;
+
+    /* Only the callbacks registered for this event ID, either for all
+     * objects or for this one, can match.  Cache the counts now, since
+     * we may be dropping the lock, and have more callbacks added. We're
+     * guaranteed not to have any removed */
+    if ((global = virObjectEventCallbackListGetBucket(callbacks,
+                                                      event->eventID, NULL)))
+        nglobal = global->count;
+    if (event->meta.key &&
+        (keyed = virObjectEventCallbackListGetBucket(callbacks,
+                                                     event->eventID,
+                                                     event->meta.key)))
+        nkeyed = keyed->count;
+
+    /* Merge both by callback ID to keep the registration order */
+    while (i < nglobal || j < nkeyed) {
+        virObjectEventCallbackPtr cb;
+
+        if (j == nkeyed ||
+            (i < nglobal &&
+             global->callbacks[i]->callbackID < keyed->callbacks[j]->callbackID))
+            cb = global->callbacks[i++];
+        else
+            cb = keyed->callbacks[j++];
 
         if (!virObjectEventDispatchMatchCallback(event, cb))
             continue;
@@ -102,9 +102,40 @@ void virDomainSnapshotDefFree(virDomainSnapshotDefPtr def)
         virDomainSnapshotDiskDefClear(&def->disks[i]);
     VIR_FREE(def->disks);
     virDomainDefFree(def->dom);
+    VIR_FREE(def->domxml);
     VIR_FREE(def);
 }
 
+
+/**
+ * virDomainSnapshotDefLoadDom:
+ * @def: snapshot definition
+ * @caps: driver capabilities
+ * @xmlopt: driver XML options
+ *
+ * Parses the domain definition of a snapshot which was parsed with
+ * VIR_DOMAIN_SNAPSHOT_PARSE_LAZY, anything touching def->dom has to call
+ * this first. The domain definition is kept unparsed if this fails.
+ *
+ * Returns 0 on success, even if the snapshot has no domain definition,
+ * and -1 on error.
+ */
+int
+virDomainSnapshotDefLoadDom(virDomainSnapshotDefPtr def,
+                            virCapsPtr caps,
+                            virDomainXMLOptionPtr xmlopt)
+{
+    if (def->dom || !def->domxml)
+        return 0;
+
+    if (!(def->dom = virDomainDefParseString(def->domxml, caps, xmlopt, NULL,
+                                             def->domflags)))
+        return -1;
+
+    VIR_FREE(def->domxml);
+    return 0;
+}
+
 static int
 virDomainSnapshotDiskDefParseXML(xmlNodePtr node,
                                  xmlXPathContextPtr ctxt,
@@ -279,10 +310,20 @@ virDomainSnapshotDefParse(xmlXPathContextPtr ctxt,
                                _("missing domain in snapshot"));
                 goto cleanup;
             }
-            def->dom = virDomainDefParseNode(ctxt->node->doc, domainNode,
-                                             caps, xmlopt, NULL, domainflags);
-            if (!def->dom)
-                goto cleanup;
+            if (flags & VIR_DOMAIN_SNAPSHOT_PARSE_LAZY) {
+                /* listing and walking the snapshots doesn't need the
+                 * domain, which is most of the work of parsing */
+                if (!(def->domxml = virXMLNodeToString(ctxt->node->doc,
+                                                       domainNode)))
+                    goto cleanup;
+                def->domflags = domainflags;
+            } else {
+                def->dom = virDomainDefParseNode(ctxt->node->doc, domainNode,
+                                                 caps, xmlopt, NULL,
+                                                 domainflags);
+                if (!def->dom)
+                    goto cleanup;
+            }
         } else {
             VIR_WARN("parsing older snapshot that lacks domain");
         }
@@ -731,6 +772,13 @@ char *virDomainSnapshotDefFormat(const char *domain_uuid,
         virBufferAdjustIndent(&buf, -2);
         virBufferAddLit(&buf, "</disks>\n");
     }
+    if (def->domxml && !def->dom) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("domain definition of snapshot %s is not loaded"),
+                       def->name);
+        virBufferFreeAndReset(&buf);
+        return NULL;
+    }
     if (def->dom) {
         if (virDomainDefFormatInternal(def->dom, caps, flags, &buf) < 0) {
             virBufferFreeAndReset(&buf);
@@ -1006,44 +1054,67 @@ virDomainSnapshotForEachChild(virDomainSnapshotObjPtr snapshot,
     return snapshot->nchildren;
 }
 
-struct snapshot_act_on_descendant {
-    int number;
-    virHashIterator iter;
-    void *data;
-};
-
-static int
-virDomainSnapshotActOnDescendant(void *payload,
-                                 const void *name,
-                                 void *data)
-{
-    virDomainSnapshotObjPtr obj = payload;
-    struct snapshot_act_on_descendant *curr = data;
-
-    curr->number += 1 + virDomainSnapshotForEachDescendant(obj,
-                                                           curr->iter,
-                                                           curr->data);
-    (curr->iter)(payload, name, curr->data);
-    return 0;
-}
-
 /* Run iter(data) on all descendants of snapshot, while ignoring all
  * other entries in snapshots.  Return the number of descendants
- * visited.  No particular ordering is guaranteed.  */
+ * visited.  The descendants of a snapshot are visited before the
+ * snapshot itself, which allows iter to free the snapshot it was called
+ * on, but no particular ordering is guaranteed otherwise.  */
 int
 virDomainSnapshotForEachDescendant(virDomainSnapshotObjPtr snapshot,
                                    virHashIterator iter,
                                    void *data)
 {
-    struct snapshot_act_on_descendant act;
+    virDomainSnapshotObjPtr curr = snapshot->first_child;
+    virDomainSnapshotObjPtr next;
+    int number = 0;
+
+    if (!curr)
+        return 0;
 
-    act.number = 0;
-    act.iter = iter;
-    act.data = data;
-    virDomainSnapshotForEachChild(snapshot,
-                                  virDomainSnapshotActOnDescendant, &act);
+    /* Walk the tree without recursing, long chains of snapshots are
+     * common and each level would cost a stack frame */
+    while (curr->first_child)
+        curr = curr->first_child;
 
-    return act.number;
+    while (curr != snapshot) {
+        if (curr->sibling) {
+            next = curr->sibling;
+            while (next->first_child)
+                next = next->first_child;
+        } else {
+            next = curr->parent;
+        }
+
+        (iter)(curr, curr->def->name, data);
+        number++;
+        curr = next;
+    }
+
+    return number;
+}
+
+/* Count the snapshots below @root, the same as
+ * virDomainSnapshotForEachDescendant would visit.  */
+static size_t
+virDomainSnapshotCountDescendants(virDomainSnapshotObjPtr root)
+{
+    virDomainSnapshotObjPtr curr = root->first_child;
+    size_t count = 0;
+
+    while (curr) {
+        count++;
+        if (curr->first_child) {
+            curr = curr->first_child;
+            continue;
+        }
+        while (curr != root && !curr->sibling)
+            curr = curr->parent;
+        if (curr == root)
+            break;
+        curr = curr->sibling;
+    }
+
+    return count;
 }
 
 /* Struct and callback function used as a hash table callback; each call
@@ -1063,29 +1134,41 @@ virDomainSnapshotSetRelations(void *payload,
 {
     virDomainSnapshotObjPtr obj = payload;
     struct snapshot_set_relation *curr = data;
-    virDomainSnapshotObjPtr tmp;
+    virDomainSnapshotObjPtr parent;
 
-    obj->parent = virDomainSnapshotFindByName(curr->snapshots,
-                                              obj->def->parent);
-    if (!obj->parent) {
+    parent = virDomainSnapshotFindByName(curr->snapshots, obj->def->parent);
+    if (!parent) {
         curr->err = -1;
-        obj->parent = &curr->snapshots->metaroot;
+        parent = &curr->snapshots->metaroot;
         VIR_WARN("snapshot %s lacks parent", obj->def->name);
-    } else {
-        tmp = obj->parent;
-        while (tmp && tmp->def) {
-            if (tmp == obj) {
-                curr->err = -1;
-                obj->parent = &curr->snapshots->metaroot;
-                VIR_WARN("snapshot %s in circular chain", obj->def->name);
-                break;
-            }
-            tmp = tmp->parent;
-        }
     }
-    obj->parent->nchildren++;
-    obj->sibling = obj->parent->first_child;
-    obj->parent->first_child = obj;
+    virDomainSnapshotSetParent(obj, parent);
+    return 0;
+}
+
+/* Callback used when not all snapshots can be reached from the metaroot,
+ * which means some of them are in a circular parent chain.  Moves the
+ * first snapshot on a circle found from the given one up the tree to the
+ * metaroot, which breaks the circle.  */
+static int
+virDomainSnapshotBreakCircle(void *payload,
+                             const void *name ATTRIBUTE_UNUSED,
+                             void *data)
+{
+    virDomainSnapshotObjPtr obj = payload;
+    struct snapshot_set_relation *curr = data;
+    ssize_t steps = virHashSize(curr->snapshots->objs);
+
+    /* more steps than there are snapshots only happen on a circle */
+    while (obj->def && steps-- >= 0)
+        obj = obj->parent;
+
+    if (obj->def) {
+        curr->err = -1;
+        VIR_WARN("snapshot %s in circular chain", obj->def->name);
+        virDomainSnapshotDropParent(obj);
+        virDomainSnapshotSetParent(obj, &curr->snapshots->metaroot);
+    }
     return 0;
 }
 
@@ -1098,35 +1181,88 @@ virDomainSnapshotUpdateRelations(virDomainSnapshotObjListPtr snapshots)
     struct snapshot_set_relation act = { snapshots, 0 };
 
     virHashForEach(snapshots->objs, virDomainSnapshotSetRelations, &act);
+
+    /* Snapshots on a circle, and all below them, can't be reached from
+     * the metaroot.  Only look for the circles if there are any.  */
+    if (virDomainSnapshotCountDescendants(&snapshots->metaroot) !=
+        virHashSize(snapshots->objs))
+        virHashForEach(snapshots->objs, virDomainSnapshotBreakCircle, &act);
+
     return act.err;
 }
 
+/* Make snapshot the first child of parent, the snapshot must not have
+ * a parent yet.  */
+void
+virDomainSnapshotSetParent(virDomainSnapshotObjPtr snapshot,
+                           virDomainSnapshotObjPtr parent)
+{
+    snapshot->parent = parent;
+    parent->nchildren++;
+    snapshot->prev_sibling = NULL;
+    snapshot->sibling = parent->first_child;
+    if (parent->first_child)
+        parent->first_child->prev_sibling = snapshot;
+    parent->first_child = snapshot;
+}
+
 /* Prepare to reparent or delete snapshot, by removing it from its
  * current listed parent.  Note that when bulk removing all children
- * of a parent, it is faster to just 0 the count rather than calling
- * this function on each child.  */
+ * of a parent, it is faster to call virDomainSnapshotDropChildren on
+ * the parent rather than calling this function on each child.  */
 void
 virDomainSnapshotDropParent(virDomainSnapshotObjPtr snapshot)
 {
-    virDomainSnapshotObjPtr prev = NULL;
-    virDomainSnapshotObjPtr curr = NULL;
+    if (!snapshot->parent) {
+        VIR_WARN("inconsistent snapshot relations");
+        return;
+    }
 
     snapshot->parent->nchildren--;
-    curr = snapshot->parent->first_child;
-    while (curr != snapshot) {
-        if (!curr) {
-            VIR_WARN("inconsistent snapshot relations");
-            return;
-        }
-        prev = curr;
-        curr = curr->sibling;
-    }
-    if (prev)
-        prev->sibling = snapshot->sibling;
+    if (snapshot->prev_sibling)
+        snapshot->prev_sibling->sibling = snapshot->sibling;
     else
         snapshot->parent->first_child = snapshot->sibling;
+    if (snapshot->sibling)
+        snapshot->sibling->prev_sibling = snapshot->prev_sibling;
     snapshot->parent = NULL;
     snapshot->sibling = NULL;
+    snapshot->prev_sibling = NULL;
+}
+
+/* Make all children of from children of to, e.g. when deleting from
+ * but not its children.  */
+void
+virDomainSnapshotMoveChildren(virDomainSnapshotObjPtr from,
+                              virDomainSnapshotObjPtr to)
+{
+    virDomainSnapshotObjPtr child;
+    virDomainSnapshotObjPtr last = NULL;
+
+    if (!from->first_child)
+        return;
+
+    for (child = from->first_child; child; child = child->sibling) {
+        child->parent = to;
+        last = child;
+    }
+
+    last->sibling = to->first_child;
+    if (to->first_child)
+        to->first_child->prev_sibling = last;
+    to->first_child = from->first_child;
+    to->nchildren += from->nchildren;
+
+    from->first_child = NULL;
+    from->nchildren = 0;
+}
+
+/* Forget all children of snapshot, e.g. after they were all deleted.  */
+void
+virDomainSnapshotDropChildren(virDomainSnapshotObjPtr snapshot)
+{
+    snapshot->first_child = NULL;
+    snapshot->nchildren = 0;
 }
 
 int
@@ -78,6 +78,9 @@ struct _virDomainSnapshotDef {
 
     /* Internal use.  */
     bool current; /* At most one snapshot in the list should have this set */
+    char *domxml; /* <domain> left unparsed by VIR_DOMAIN_SNAPSHOT_PARSE_LAZY,
+                     dom is NULL until virDomainSnapshotDefLoadDom */
+    unsigned int domflags; /* virDomainDefParseFlags to parse domxml with */
 };
 
 struct _virDomainSnapshotObj {
@@ -87,6 +90,7 @@ struct _virDomainSnapshotObj {
                                        virDomainSnapshotUpdateRelations, or
                                        after virDomainSnapshotDropParent */
     virDomainSnapshotObjPtr sibling; /* NULL if last child of parent */
+    virDomainSnapshotObjPtr prev_sibling; /* NULL if first child of parent */
     size_t nchildren;
     virDomainSnapshotObjPtr first_child; /* NULL if no children */
 };
@@ -99,6 +103,8 @@ typedef enum {
     VIR_DOMAIN_SNAPSHOT_PARSE_DISKS    = 1 << 1,
     VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL = 1 << 2,
     VIR_DOMAIN_SNAPSHOT_PARSE_OFFLINE  = 1 << 3,
+    /* with REDEFINE, leave the domain definition to be parsed on demand */
+    VIR_DOMAIN_SNAPSHOT_PARSE_LAZY     = 1 << 4,
 } virDomainSnapshotParseFlags;
 
 virDomainSnapshotDefPtr virDomainSnapshotDefParseString(const char *xmlStr,
@@ -111,6 +117,9 @@ virDomainSnapshotDefPtr virDomainSnapshotDefParseNode(xmlDocPtr xml,
                                                       virDomainXMLOptionPtr xmlopt,
                                                       unsigned int flags);
 void virDomainSnapshotDefFree(virDomainSnapshotDefPtr def);
+int virDomainSnapshotDefLoadDom(virDomainSnapshotDefPtr def,
+                                virCapsPtr caps,
+                                virDomainXMLOptionPtr xmlopt);
 char *virDomainSnapshotDefFormat(const char *domain_uuid,
                                  virDomainSnapshotDefPtr def,
                                  virCapsPtr caps,
@@ -143,7 +152,12 @@ int virDomainSnapshotForEachDescendant(virDomainSnapshotObjPtr snapshot,
                                        virHashIterator iter,
                                        void *data);
 int virDomainSnapshotUpdateRelations(virDomainSnapshotObjListPtr snapshots);
+void virDomainSnapshotSetParent(virDomainSnapshotObjPtr snapshot,
+                                virDomainSnapshotObjPtr parent);
 void virDomainSnapshotDropParent(virDomainSnapshotObjPtr snapshot);
+void virDomainSnapshotMoveChildren(virDomainSnapshotObjPtr from,
+                                   virDomainSnapshotObjPtr to);
+void virDomainSnapshotDropChildren(virDomainSnapshotObjPtr snapshot);
 
 # define VIR_DOMAIN_SNAPSHOT_FILTERS_METADATA           \
                (VIR_DOMAIN_SNAPSHOT_LIST_METADATA     | \
@@ -1081,6 +1081,85 @@ virStorageSize(const char *unit,
 }
 
 
+static int
+virStorageVolTimestampParse(xmlXPathContextPtr ctxt,
+                            const char *xpath,
+                            struct timespec *ts)
+{
+    char *str = NULL;
+    char *end;
+    unsigned long long sec;
+    long nsec = 0;
+    int ret = -1;
+
+    /* Not known, as virStorageVolTimestampFormat puts it */
+    ts->tv_sec = 0;
+    ts->tv_nsec = -1;
+
+    if (!(str = virXPathString(xpath, ctxt)))
+        return 0;
+
+    if (virStrToLong_ull(str, &end, 10, &sec) < 0 ||
+        (*end == '.' && virStrToLong_l(end + 1, NULL, 10, &nsec) < 0) ||
+        (*end != '.' && *end != '\0')) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("malformed volume timestamp '%s'"), str);
+        goto cleanup;
+    }
+
+    ts->tv_sec = sec;
+    ts->tv_nsec = nsec;
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(str);
+    return ret;
+}
+
+
+/*
+ * Parse what virStorageVolDefFormat reports about a volume beyond its
+ * configuration, so that volumes saved by libvirtd come back as they
+ * were found by the pool refresh.
+ */
+static int
+virStorageVolDefParseState(xmlXPathContextPtr ctxt,
+                           virStorageSourcePtr target)
+{
+    char *physical = NULL;
+    char *unit = NULL;
+    int ret = -1;
+
+    if ((physical = virXPathString("string(./physical)", ctxt))) {
+        unit = virXPathString("string(./physical/@unit)", ctxt);
+        if (virStorageSize(unit, physical, &target->physical) < 0)
+            goto cleanup;
+    }
+
+    if (virXPathNode("./target/timestamps", ctxt)) {
+        if (VIR_ALLOC(target->timestamps) < 0)
+            goto cleanup;
+
+        if (virStorageVolTimestampParse(ctxt, "string(./target/timestamps/atime)",
+                                        &target->timestamps->atime) < 0 ||
+            virStorageVolTimestampParse(ctxt, "string(./target/timestamps/mtime)",
+                                        &target->timestamps->mtime) < 0 ||
+            virStorageVolTimestampParse(ctxt, "string(./target/timestamps/ctime)",
+                                        &target->timestamps->ctime) < 0 ||
+            virStorageVolTimestampParse(ctxt, "string(./target/timestamps/btime)",
+                                        &target->timestamps->btime) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(physical);
+    VIR_FREE(unit);
+    return ret;
+}
+
+
 static virStorageVolDefPtr
 virStorageVolDefParseXML(virStoragePoolDefPtr pool,
                          xmlXPathContextPtr ctxt,
@@ -1099,7 +1178,8 @@ virStorageVolDefParseXML(virStoragePoolDefPtr pool,
     int n;
 
     virCheckFlags(VIR_VOL_XML_PARSE_NO_CAPACITY |
-                  VIR_VOL_XML_PARSE_OPT_CAPACITY, NULL);
+                  VIR_VOL_XML_PARSE_OPT_CAPACITY |
+                  VIR_VOL_XML_PARSE_STATE, NULL);
 
     options = virStorageVolOptionsForPoolType(pool->type);
     if (options == NULL)
@@ -1241,6 +1321,10 @@ virStorageVolDefParseXML(virStoragePoolDefPtr pool,
         VIR_FREE(nodes);
     }
 
+    if ((flags & VIR_VOL_XML_PARSE_STATE) &&
+        virStorageVolDefParseState(ctxt, &ret->target) < 0)
+        goto error;
+
  cleanup:
     VIR_FREE(nodes);
     VIR_FREE(allocation);
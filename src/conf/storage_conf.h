@@ -68,6 +68,8 @@ struct _virStorageVolDef {
 
     bool building;
     unsigned int in_use;
+    unsigned long long refreshed; /* last refreshVol, in ms since the
+                                   * epoch; 0 if never refreshed */
 
     virStorageVolSource source;
     virStorageSource target;
@@ -260,6 +262,8 @@ typedef enum {
     VIR_VOL_XML_PARSE_NO_CAPACITY  = 1 << 0,
     /* do not require volume capacity if the volume has a backing store */
     VIR_VOL_XML_PARSE_OPT_CAPACITY = 1 << 1,
+    /* parse the output only fields saved in libvirtd's state */
+    VIR_VOL_XML_PARSE_STATE        = 1 << 2,
 } virStorageVolDefParseFlags;
 
 virStorageVolDefPtr
@@ -29,9 +29,14 @@
 #include "virdomainobjlist.h"
 #include "snapshot_conf.h"
 #include "viralloc.h"
+#include "viratomic.h"
 #include "virfile.h"
 #include "virlog.h"
 #include "virstring.h"
+#include "virhashcode.h"
+#include "virhostcpu.h"
+#include "virthreadpool.h"
+#include "virxml.h"
 
 #define VIR_FROM_THIS VIR_FROM_DOMAIN
 
@@ -42,7 +47,9 @@ static void virDomainObjListDispose(void *obj);
 
 
 struct _virDomainObjList {
-    virObjectLockable parent;
+    /* Lookups and exports only need a shared lock, Add, Remove,
+     * Rename and ForEach take it exclusively */
+    virObjectRWLockable parent;
 
     /* uuid string -> virDomainObj  mapping
      * for O(1), lockless lookup-by-uuid */
@@ -51,12 +58,33 @@ struct _virDomainObjList {
     /* name -> virDomainObj mapping for O(1),
      * lockless lookup-by-name */
     virHashTable *objsName;
+
+    /* id -> virDomainObj mapping for O(1) lookup-by-id. Drivers
+     * assign IDs without telling the list, so entries are checked
+     * against the object on lookup and refreshed on a miss. Entries
+     * do not hold a reference, every object has at most one and it
+     * is dropped when the object leaves the list. */
+    virHashTable *objsID;
+
+    /* Lazy loading of persistent configs, see virDomainObjListSetLazyLoad.
+     * The counters are atomic. */
+    size_t lazyMax;
+    int lazyLoaded; /* objects with a def loaded on access */
+    int lazyClock; /* source of virDomainObj.lazyStamp */
+    int lazyEvict; /* set once lazyLoaded exceeds lazyMax */
+
+    /* The parameters of parsing the configs, protected by lazyLock
+     * as objects load their def without holding the list lock */
+    virMutex lazyLock;
+    char *lazyConfigDir;
+    virCapsPtr lazyCaps;
+    virDomainXMLOptionPtr lazyXMLOpt;
 };
 
 
 static int virDomainObjListOnceInit(void)
 {
-    if (!(virDomainObjListClass = virClassNew(virClassForObjectLockable(),
+    if (!(virDomainObjListClass = virClassNew(virClassForObjectRWLockable(),
                                               "virDomainObjList",
                                               sizeof(virDomainObjList),
                                               virDomainObjListDispose)))
@@ -67,6 +95,25 @@ static int virDomainObjListOnceInit(void)
 
 VIR_ONCE_GLOBAL_INIT(virDomainObjList)
 
+
+static uint32_t virDomainObjListIDCode(const void *name, uint32_t seed)
+{
+    int id = (int)(intptr_t)name;
+    return virHashCodeGen(&id, sizeof(id), seed);
+}
+
+
+static bool virDomainObjListIDEqual(const void *namea, const void *nameb)
+{
+    return namea == nameb;
+}
+
+
+static void *virDomainObjListIDCopy(const void *name)
+{
+    return (void *)name;
+}
+
 virDomainObjListPtr virDomainObjListNew(void)
 {
     virDomainObjListPtr doms;
@@ -74,11 +121,22 @@ virDomainObjListPtr virDomainObjListNew(void)
     if (virDomainObjListInitialize() < 0)
         return NULL;
 
-    if (!(doms = virObjectLockableNew(virDomainObjListClass)))
+    if (!(doms = virObjectRWLockableNew(virDomainObjListClass)))
         return NULL;
 
+    if (virMutexInit(&doms->lazyLock) < 0) {
+        virReportSystemError(errno, "%s", _("unable to initialize mutex"));
+        virObjectUnref(doms);
+        return NULL;
+    }
+
     if (!(doms->objs = virHashCreate(50, virObjectFreeHashData)) ||
-        !(doms->objsName = virHashCreate(50, virObjectFreeHashData))) {
+        !(doms->objsName = virHashCreate(50, virObjectFreeHashData)) ||
+        !(doms->objsID = virHashCreateFull(50, NULL,
+                                           virDomainObjListIDCode,
+                                           virDomainObjListIDEqual,
+                                           virDomainObjListIDCopy,
+                                           NULL))) {
         virObjectUnref(doms);
         return NULL;
     }
@@ -91,8 +149,14 @@ static void virDomainObjListDispose(void *obj)
 {
     virDomainObjListPtr doms = obj;
 
+    virHashFree(doms->objsID);
     virHashFree(doms->objs);
     virHashFree(doms->objsName);
+
+    VIR_FREE(doms->lazyConfigDir);
+    virObjectUnref(doms->lazyCaps);
+    virObjectUnref(doms->lazyXMLOpt);
+    virMutexDestroy(&doms->lazyLock);
 }
 
 
@@ -112,17 +176,267 @@ static int virDomainObjListSearchID(const void *payload,
     return want;
 }
 
+static int virDomainObjListSearchObj(const void *payload,
+                                     const void *name ATTRIBUTE_UNUSED,
+                                     const void *data)
+{
+    return payload == data;
+}
+
+
+/* The caller must hold the lock on 'doms' */
+static void
+virDomainObjListRemoveID(virDomainObjListPtr doms,
+                         virDomainObjPtr obj)
+{
+    /* The ID may have been reset already, so look for the object */
+    virHashRemoveSet(doms->objsID, virDomainObjListSearchObj, obj);
+}
+
+
+/* The caller must hold the lock on 'doms' */
+static void
+virDomainObjListAddID(virDomainObjListPtr doms,
+                      virDomainObjPtr obj,
+                      int id)
+{
+    virDomainObjListRemoveID(doms, obj);
+    if (virHashUpdateEntry(doms->objsID, (void *)(intptr_t)id, obj) < 0)
+        virResetLastError();
+}
+
+
+/* Flags of parsing the persistent config of a domain */
+#define VIR_DOMAIN_OBJ_LIST_CONFIG_PARSE_FLAGS \
+    (VIR_DOMAIN_DEF_PARSE_INACTIVE | \
+     VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS | \
+     VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE)
+
+
+/*
+ * Replaces the name and UUID only definition of @obj, which must be
+ * locked, by the one parsed from its config, or just records the access
+ * if it is complete already.
+ *
+ * Returns 0 on success, -1 on error
+ */
+static int
+virDomainObjListLazyLoad(virDomainObjListPtr doms,
+                         virDomainObjPtr obj)
+{
+    char *configDir = NULL;
+    char *configFile = NULL;
+    virCapsPtr caps = NULL;
+    virDomainXMLOptionPtr xmlopt = NULL;
+    virDomainDefPtr def = NULL;
+    int ret = -1;
+
+    if (!obj->lazy) {
+        if (obj->lazyStamp)
+            obj->lazyStamp = virAtomicIntInc(&doms->lazyClock);
+        return 0;
+    }
+
+    virMutexLock(&doms->lazyLock);
+    if (VIR_STRDUP(configDir, doms->lazyConfigDir) >= 0)
+        configFile = virDomainConfigFile(configDir, obj->def->name);
+    caps = virObjectRef(doms->lazyCaps);
+    xmlopt = virObjectRef(doms->lazyXMLOpt);
+    virMutexUnlock(&doms->lazyLock);
+
+    if (!configFile)
+        goto cleanup;
+
+    VIR_DEBUG("Loading config file '%s' on access", configFile);
+    if (!(def = virDomainDefParseFile(configFile, caps, xmlopt, NULL,
+                                      VIR_DOMAIN_OBJ_LIST_CONFIG_PARSE_FLAGS)))
+        goto cleanup;
+
+    if (STRNEQ(def->name, obj->def->name) ||
+        memcmp(def->uuid, obj->def->uuid, VIR_UUID_BUFLEN) != 0) {
+        virReportError(VIR_ERR_OPERATION_FAILED,
+                       _("config file '%s' no longer describes domain '%s'"),
+                       configFile, obj->def->name);
+        goto cleanup;
+    }
+
+    if (virDomainDefLoadMetadata(configDir, def) < 0)
+        goto cleanup;
+
+    virDomainDefFree(obj->def);
+    VIR_STEAL_PTR(obj->def, def);
+    obj->lazy = 0;
+    obj->lazyStamp = virAtomicIntInc(&doms->lazyClock);
+
+    if ((size_t) virAtomicIntInc(&doms->lazyLoaded) > doms->lazyMax)
+        virAtomicIntSet(&doms->lazyEvict, 1);
+
+    ret = 0;
+
+ cleanup:
+    virDomainDefFree(def);
+    virObjectUnref(xmlopt);
+    virObjectUnref(caps);
+    VIR_FREE(configFile);
+    VIR_FREE(configDir);
+    return ret;
+}
+
+
+/* The caller must hold the lock on 'obj' */
+static void
+virDomainObjListLazyForget(virDomainObjListPtr doms,
+                           virDomainObjPtr obj)
+{
+    if (obj->lazyStamp) {
+        virAtomicIntAdd(&doms->lazyLoaded, -1);
+        obj->lazyStamp = 0;
+    }
+}
+
+
+struct virDomainObjListLazyEntry {
+    virDomainObjPtr obj;
+    unsigned int stamp;
+};
+
+struct virDomainObjListLazyData {
+    struct virDomainObjListLazyEntry *entries;
+    size_t nentries;
+};
+
+
+static int
+virDomainObjListLazyCollect(void *payload,
+                            const void *name ATTRIBUTE_UNUSED,
+                            void *opaque)
+{
+    virDomainObjPtr obj = payload;
+    struct virDomainObjListLazyData *data = opaque;
+    unsigned int stamp = obj->lazyStamp;
+
+    /* Only a hint, checked again with the object locked */
+    if (stamp) {
+        data->entries[data->nentries].obj = obj;
+        data->entries[data->nentries++].stamp = stamp;
+    }
+    return 0;
+}
+
+
+static int
+virDomainObjListLazyCompare(const void *a,
+                            const void *b)
+{
+    const struct virDomainObjListLazyEntry *ea = a;
+    const struct virDomainObjListLazyEntry *eb = b;
+
+    if (ea->stamp < eb->stamp)
+        return -1;
+    return ea->stamp > eb->stamp;
+}
+
+
+/*
+ * Drops the definitions loaded on access, least recently used first,
+ * until no more than lazyMax of them are left. Only persistent inactive
+ * domains nobody but @doms holds a reference to are considered, their
+ * config is the definition then. The caller must not hold any lock of
+ * @doms or its objects.
+ */
+static void
+virDomainObjListLazyEvict(virDomainObjListPtr doms)
+{
+    struct virDomainObjListLazyData data = { NULL, 0 };
+    size_t i;
+
+    if (!doms->lazyMax ||
+        !virAtomicIntCompareExchange(&doms->lazyEvict, 1, 0))
+        return;
+
+    virObjectRWLockWrite(doms);
+    if (VIR_ALLOC_N_QUIET(data.entries, virHashSize(doms->objs)) < 0)
+        goto cleanup;
+
+    virHashForEach(doms->objs, virDomainObjListLazyCollect, &data);
+    qsort(data.entries, data.nentries, sizeof(*data.entries),
+          virDomainObjListLazyCompare);
+
+    for (i = 0; i < data.nentries &&
+         (size_t) virAtomicIntGet(&doms->lazyLoaded) > doms->lazyMax; i++) {
+        virDomainObjPtr obj = data.entries[i].obj;
+        virDomainDefPtr stub;
+
+        virObjectLock(obj);
+        /* References are only acquired with the list lock held, the
+         * two of the hash tables are all that is left of an idle object */
+        if (obj->lazyStamp && obj->persistent && !obj->removing &&
+            !obj->newDef && !virDomainObjIsActive(obj) &&
+            virObjectGetRefs(obj) == 2 &&
+            (stub = virDomainDefNewFull(obj->def->name, obj->def->uuid, -1))) {
+            VIR_DEBUG("Dropping the definition of domain '%s'",
+                      obj->def->name);
+            virDomainDefFree(obj->def);
+            obj->def = stub;
+            obj->lazy = 1;
+            virDomainObjListLazyForget(doms, obj);
+        }
+        virObjectUnlock(obj);
+    }
+
+ cleanup:
+    virObjectRWUnlock(doms);
+    VIR_FREE(data.entries);
+}
+
+
+/**
+ * virDomainObjListSetLazyLoad:
+ * @doms: domain object list
+ * @maxLoaded: number of definitions loaded on access to keep, 0 disables
+ *
+ * Makes virDomainObjListLoadAllConfigs only read the name and UUID
+ * from the persistent configs of the domains which are not autostarted.
+ * Their definition is parsed when they are looked up or collected, and
+ * dropped again for the least recently used inactive domains once more
+ * than @maxLoaded of them are loaded. Callbacks of
+ * virDomainObjListForEach get the objects as they are and can only rely
+ * on the name and UUID of the definition of inactive domains.
+ *
+ * Must be called before the configs are loaded.
+ */
+void
+virDomainObjListSetLazyLoad(virDomainObjListPtr doms,
+                            size_t maxLoaded)
+{
+    doms->lazyMax = maxLoaded;
+}
+
+
 static virDomainObjPtr
 virDomainObjListFindByIDInternal(virDomainObjListPtr doms,
                                  int id,
                                  bool ref)
 {
     virDomainObjPtr obj;
-    virObjectLock(doms);
-    obj = virHashSearch(doms->objs, virDomainObjListSearchID, &id);
+    virObjectRWLockRead(doms);
+    if (!(obj = virHashLookup(doms->objsID, (void *)(intptr_t)id)) ||
+        !virDomainObjListSearchID(obj, NULL, &id)) {
+        /* Refreshing the index needs exclusive access */
+        virObjectRWUnlock(doms);
+        virObjectRWLockWrite(doms);
+        if ((obj = virHashLookup(doms->objsID, (void *)(intptr_t)id)) &&
+            !virDomainObjListSearchID(obj, NULL, &id)) {
+            virHashRemoveEntry(doms->objsID, (void *)(intptr_t)id);
+            obj = NULL;
+        }
+        if (!obj &&
+            (obj = virHashSearch(doms->objs, virDomainObjListSearchID, &id)))
+            virDomainObjListAddID(doms, obj, id);
+    }
     if (ref) {
         virObjectRef(obj);
-        virObjectUnlock(doms);
+        virObjectRWUnlock(doms);
     }
     if (obj) {
         virObjectLock(obj);
@@ -134,7 +448,7 @@ virDomainObjListFindByIDInternal(virDomainObjListPtr doms,
         }
     }
     if (!ref)
-        virObjectUnlock(doms);
+        virObjectRWUnlock(doms);
     return obj;
 }
 
@@ -160,17 +474,19 @@ virDomainObjListFindByUUIDInternal(virDomainObjListPtr doms,
     char uuidstr[VIR_UUID_STRING_BUFLEN];
     virDomainObjPtr obj;
 
-    virObjectLock(doms);
+    virDomainObjListLazyEvict(doms);
+
+    virObjectRWLockRead(doms);
     virUUIDFormat(uuid, uuidstr);
 
     obj = virHashLookup(doms->objs, uuidstr);
     if (ref) {
         virObjectRef(obj);
-        virObjectUnlock(doms);
+        virObjectRWUnlock(doms);
     }
     if (obj) {
         virObjectLock(obj);
-        if (obj->removing) {
+        if (obj->removing || virDomainObjListLazyLoad(doms, obj) < 0) {
             virObjectUnlock(obj);
             if (ref)
                 virObjectUnref(obj);
@@ -178,7 +494,7 @@ virDomainObjListFindByUUIDInternal(virDomainObjListPtr doms,
         }
     }
     if (!ref)
-        virObjectUnlock(doms);
+        virObjectRWUnlock(doms);
     return obj;
 }
 
@@ -204,13 +520,15 @@ virDomainObjPtr virDomainObjListFindByName(virDomainObjListPtr doms,
 {
     virDomainObjPtr obj;
 
-    virObjectLock(doms);
+    virDomainObjListLazyEvict(doms);
+
+    virObjectRWLockRead(doms);
     obj = virHashLookup(doms->objsName, name);
     virObjectRef(obj);
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
     if (obj) {
         virObjectLock(obj);
-        if (obj->removing) {
+        if (obj->removing || virDomainObjListLazyLoad(doms, obj) < 0) {
             virObjectUnlock(obj);
             virObjectUnref(obj);
             obj = NULL;
@@ -275,6 +593,15 @@ virDomainObjListAddLocked(virDomainObjListPtr doms,
             }
         }
 
+        /* The definition is handed back as @oldDef, so complete it
+         * first. A broken config is replaced anyway. */
+        if (vm->lazy && virDomainObjListLazyLoad(doms, vm) < 0) {
+            VIR_WARN("Replacing unloadable definition of domain '%s': %s",
+                     vm->def->name, virGetLastErrorMessage());
+            virResetLastError();
+            vm->lazy = 0;
+        }
+
         virDomainObjAssignDef(vm,
                               def,
                               !!(flags & VIR_DOMAIN_OBJ_LIST_ADD_LIVE),
@@ -308,6 +635,9 @@ virDomainObjListAddLocked(virDomainObjListPtr doms,
         /* Since domain is in two hash tables, increment the
          * reference counter */
         virObjectRef(vm);
+
+        if (def->id != -1)
+            virDomainObjListAddID(doms, vm, def->id);
     }
  cleanup:
     return vm;
@@ -327,9 +657,9 @@ virDomainObjPtr virDomainObjListAdd(virDomainObjListPtr doms,
 {
     virDomainObjPtr ret;
 
-    virObjectLock(doms);
+    virObjectRWLockWrite(doms);
     ret = virDomainObjListAddLocked(doms, def, xmlopt, flags, oldDef);
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
     return ret;
 }
 
@@ -349,13 +679,15 @@ void virDomainObjListRemove(virDomainObjListPtr doms,
     virObjectRef(dom);
     virObjectUnlock(dom);
 
-    virObjectLock(doms);
+    virObjectRWLockWrite(doms);
     virObjectLock(dom);
+    virDomainObjListLazyForget(doms, dom);
+    virDomainObjListRemoveID(doms, dom);
     virHashRemoveEntry(doms->objs, uuidstr);
     virHashRemoveEntry(doms->objsName, dom->def->name);
     virObjectUnlock(dom);
     virObjectUnref(dom);
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
 }
 
 
@@ -394,7 +726,7 @@ virDomainObjListRename(virDomainObjListPtr doms,
      * hold a lock on dom but not refcount it. */
     virObjectRef(dom);
     virObjectUnlock(dom);
-    virObjectLock(doms);
+    virObjectRWLockWrite(doms);
     virObjectLock(dom);
     virObjectUnref(dom);
 
@@ -420,7 +752,7 @@ virDomainObjListRename(virDomainObjListPtr doms,
 
     ret = 0;
  cleanup:
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
     VIR_FREE(old_name);
     return ret;
 }
@@ -438,86 +770,159 @@ void virDomainObjListRemoveLocked(virDomainObjListPtr doms,
 
     virUUIDFormat(dom->def->uuid, uuidstr);
 
+    virDomainObjListLazyForget(doms, dom);
+    virDomainObjListRemoveID(doms, dom);
     virHashRemoveEntry(doms->objs, uuidstr);
     virHashRemoveEntry(doms->objsName, dom->def->name);
     virObjectUnlock(dom);
 }
 
 
-static virDomainObjPtr
-virDomainObjListLoadConfig(virDomainObjListPtr doms,
-                           virCapsPtr caps,
-                           virDomainXMLOptionPtr xmlopt,
-                           const char *configDir,
-                           const char *autostartDir,
-                           const char *name,
-                           virDomainLoadConfigNotify notify,
-                           void *opaque)
+/*
+ * Reads just the name and UUID of the domain in @configFile, which is
+ * far cheaper than the complete parser. Returns a definition holding
+ * only those, or NULL if the file needs the complete parser, e.g. to
+ * generate a missing UUID.
+ */
+static virDomainDefPtr
+virDomainObjListLoadConfigScan(const char *configFile)
+{
+    xmlDocPtr xml;
+    xmlXPathContextPtr ctxt = NULL;
+    char *name = NULL;
+    char *uuidstr = NULL;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    virDomainDefPtr def = NULL;
+
+    if (!(xml = virXMLParseFileCtxt(configFile, &ctxt)))
+        return NULL;
+
+    if (!xmlStrEqual(ctxt->node->name, BAD_CAST "domain"))
+        goto cleanup;
+
+    if (!(name = virXPathString("string(./name[1])", ctxt)) ||
+        !(uuidstr = virXPathString("string(./uuid[1])", ctxt)) ||
+        virUUIDParse(uuidstr, uuid) < 0)
+        goto cleanup;
+
+    def = virDomainDefNewFull(name, uuid, -1);
+
+ cleanup:
+    VIR_FREE(name);
+    VIR_FREE(uuidstr);
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(xml);
+    return def;
+}
+
+
+/*
+ * If @lazy is true on input, the domains which are not autostarted only
+ * get the definition of virDomainObjListLoadConfigScan. @lazy is set to
+ * whether @retdef is such a one.
+ */
+static int
+virDomainObjListLoadConfigParse(virCapsPtr caps,
+                                virDomainXMLOptionPtr xmlopt,
+                                const char *configDir,
+                                const char *autostartDir,
+                                const char *name,
+                                bool *lazy,
+                                virDomainDefPtr *retdef,
+                                int *autostart)
 {
     char *configFile = NULL, *autostartLink = NULL;
     virDomainDefPtr def = NULL;
-    virDomainObjPtr dom;
-    int autostart;
-    virDomainDefPtr oldDef = NULL;
+    int ret = -1;
 
     if ((configFile = virDomainConfigFile(configDir, name)) == NULL)
-        goto error;
-    if (!(def = virDomainDefParseFile(configFile, caps, xmlopt, NULL,
-                                      VIR_DOMAIN_DEF_PARSE_INACTIVE |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE)))
-        goto error;
+        goto cleanup;
 
     if ((autostartLink = virDomainConfigFile(autostartDir, name)) == NULL)
-        goto error;
-
-    if ((autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
-        goto error;
+        goto cleanup;
 
-    if (!(dom = virDomainObjListAddLocked(doms, def, xmlopt, 0, &oldDef)))
-        goto error;
+    if ((*autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
+        goto cleanup;
 
-    dom->autostart = autostart;
+    /* autostarted domains are going to need the whole definition soon */
+    if (*lazy && !*autostart)
+        def = virDomainObjListLoadConfigScan(configFile);
+    *lazy = !!def;
 
-    if (notify)
-        (*notify)(dom, oldDef == NULL, opaque);
+    if (!def &&
+        (!(def = virDomainDefParseFile(configFile, caps, xmlopt, NULL,
+                                       VIR_DOMAIN_OBJ_LIST_CONFIG_PARSE_FLAGS)) ||
+         virDomainDefLoadMetadata(configDir, def) < 0))
+        goto cleanup;
 
-    virDomainDefFree(oldDef);
-    VIR_FREE(configFile);
-    VIR_FREE(autostartLink);
-    return dom;
+    VIR_STEAL_PTR(*retdef, def);
+    ret = 0;
 
- error:
+ cleanup:
     VIR_FREE(configFile);
     VIR_FREE(autostartLink);
     virDomainDefFree(def);
-    return NULL;
+    return ret;
 }
 
 
 static virDomainObjPtr
-virDomainObjListLoadStatus(virDomainObjListPtr doms,
-                           const char *statusDir,
-                           const char *name,
-                           virCapsPtr caps,
+virDomainObjListLoadConfig(virDomainObjListPtr doms,
                            virDomainXMLOptionPtr xmlopt,
+                           virDomainDefPtr def,
+                           int autostart,
                            virDomainLoadConfigNotify notify,
                            void *opaque)
+{
+    virDomainObjPtr dom;
+    virDomainDefPtr oldDef = NULL;
+
+    if (!(dom = virDomainObjListAddLocked(doms, def, xmlopt, 0, &oldDef))) {
+        virDomainDefFree(def);
+        return NULL;
+    }
+
+    dom->autostart = autostart;
+
+    if (notify)
+        (*notify)(dom, oldDef == NULL, opaque);
+
+    virDomainDefFree(oldDef);
+    return dom;
+}
+
+
+static virDomainObjPtr
+virDomainObjListLoadStatusParse(const char *statusDir,
+                                const char *name,
+                                virCapsPtr caps,
+                                virDomainXMLOptionPtr xmlopt)
 {
     char *statusFile = NULL;
     virDomainObjPtr obj = NULL;
-    char uuidstr[VIR_UUID_STRING_BUFLEN];
 
     if ((statusFile = virDomainConfigFile(statusDir, name)) == NULL)
-        goto error;
+        return NULL;
 
-    if (!(obj = virDomainObjParseFile(statusFile, caps, xmlopt,
-                                      VIR_DOMAIN_DEF_PARSE_STATUS |
-                                      VIR_DOMAIN_DEF_PARSE_ACTUAL_NET |
-                                      VIR_DOMAIN_DEF_PARSE_PCI_ORIG_STATES |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE)))
-        goto error;
+    obj = virDomainObjParseFile(statusFile, caps, xmlopt,
+                                VIR_DOMAIN_DEF_PARSE_STATUS |
+                                VIR_DOMAIN_DEF_PARSE_ACTUAL_NET |
+                                VIR_DOMAIN_DEF_PARSE_PCI_ORIG_STATES |
+                                VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
+                                VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE);
+
+    VIR_FREE(statusFile);
+    return obj;
+}
+
+
+static virDomainObjPtr
+virDomainObjListLoadStatus(virDomainObjListPtr doms,
+                           virDomainObjPtr obj,
+                           virDomainLoadConfigNotify notify,
+                           void *opaque)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
 
     virUUIDFormat(obj->def->uuid, uuidstr);
 
@@ -540,19 +945,252 @@ virDomainObjListLoadStatus(virDomainObjListPtr doms,
      * reference counter */
     virObjectRef(obj);
 
+    if (obj->def->id != -1)
+        virDomainObjListAddID(doms, obj, obj->def->id);
+
     if (notify)
         (*notify)(obj, 1, opaque);
 
-    VIR_FREE(statusFile);
     return obj;
 
  error:
     virObjectUnref(obj);
-    VIR_FREE(statusFile);
     return NULL;
 }
 
 
+/* Upper bound of the threads parsing the files in
+ * virDomainObjListLoadAllConfigs */
+#define VIR_DOMAIN_OBJ_LIST_LOAD_MAX_WORKERS 16
+
+typedef struct _virDomainObjListLoadData virDomainObjListLoadData;
+typedef virDomainObjListLoadData *virDomainObjListLoadDataPtr;
+struct _virDomainObjListLoadData {
+    const char *configDir;
+    const char *autostartDir;
+    int liveStatus;
+    bool lazy;
+    virCapsPtr caps;
+    virDomainXMLOptionPtr xmlopt;
+
+    virMutex lock;
+    virCond cond;
+    size_t pending;
+};
+
+typedef struct _virDomainObjListLoadJob virDomainObjListLoadJob;
+typedef virDomainObjListLoadJob *virDomainObjListLoadJobPtr;
+struct _virDomainObjListLoadJob {
+    virDomainObjListLoadDataPtr data;
+    char *name;
+
+    /* results of the parsing, either of the two */
+    virDomainObjPtr obj;
+    virDomainDefPtr def;
+    int autostart;
+    bool lazy; /* @def is just the name and UUID */
+};
+
+
+static void
+virDomainObjListLoadParse(virDomainObjListLoadJobPtr job)
+{
+    virDomainObjListLoadDataPtr data = job->data;
+
+    /* NB: ignoring errors, so one malformed config doesn't
+       kill the whole process */
+    VIR_INFO("Loading config file '%s.xml'", job->name);
+    if (data->liveStatus) {
+        /* the object is locked again by the thread adding it to the list */
+        if ((job->obj = virDomainObjListLoadStatusParse(data->configDir,
+                                                        job->name,
+                                                        data->caps,
+                                                        data->xmlopt)))
+            virObjectUnlock(job->obj);
+    } else {
+        job->lazy = data->lazy;
+        if (virDomainObjListLoadConfigParse(data->caps, data->xmlopt,
+                                            data->configDir,
+                                            data->autostartDir, job->name,
+                                            &job->lazy, &job->def,
+                                            &job->autostart) < 0)
+            job->def = NULL;
+    }
+}
+
+
+static void
+virDomainObjListLoadWorker(void *jobdata,
+                           void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainObjListLoadJobPtr job = jobdata;
+    virDomainObjListLoadDataPtr data = job->data;
+
+    virDomainObjListLoadParse(job);
+    virResetLastError();
+
+    virMutexLock(&data->lock);
+    if (--data->pending == 0)
+        virCondSignal(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+static int
+virDomainObjListLoadParsePool(virDomainObjListLoadDataPtr data,
+                              virDomainObjListLoadJobPtr jobs,
+                              size_t njobs,
+                              size_t nworkers)
+{
+    virThreadPoolPtr pool = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (virMutexInit(&data->lock) < 0)
+        return -1;
+    if (virCondInit(&data->cond) < 0) {
+        virMutexDestroy(&data->lock);
+        return -1;
+    }
+
+    if (!(pool = virThreadPoolNew(0, nworkers, 0,
+                                  virDomainObjListLoadWorker, NULL)))
+        goto cleanup;
+
+    virMutexLock(&data->lock);
+    for (i = 0; i < njobs; i++) {
+        data->pending++;
+
+        if (virThreadPoolSendJob(pool, 0, &jobs[i]) < 0) {
+            /* Parse this one ourselves rather than failing */
+            data->pending--;
+            virResetLastError();
+            virMutexUnlock(&data->lock);
+            virDomainObjListLoadParse(&jobs[i]);
+            virMutexLock(&data->lock);
+        }
+    }
+
+    while (data->pending) {
+        /* Workers still reference @data, so there is nothing better to
+         * do than to keep waiting */
+        if (virCondWait(&data->cond, &data->lock) < 0)
+            VIR_WARN("cannot wait on condition");
+    }
+    virMutexUnlock(&data->lock);
+
+    ret = 0;
+
+ cleanup:
+    virThreadPoolFree(pool);
+    virCondDestroy(&data->cond);
+    virMutexDestroy(&data->lock);
+    return ret;
+}
+
+
+/*
+ * Parse the files of all the @jobs, on a pool of threads when there is
+ * more than one of them.
+ */
+static void
+virDomainObjListLoadParseAll(virDomainObjListLoadDataPtr data,
+                             virDomainObjListLoadJobPtr jobs,
+                             size_t njobs)
+{
+    size_t nworkers = MIN(njobs, VIR_DOMAIN_OBJ_LIST_LOAD_MAX_WORKERS);
+    int ncpus;
+    size_t i;
+
+    if ((ncpus = virHostCPUGetCount()) > 0)
+        nworkers = MIN(nworkers, ncpus);
+
+    if (nworkers > 1 &&
+        virDomainObjListLoadParsePool(data, jobs, njobs, nworkers) == 0)
+        return;
+
+    virResetLastError();
+    for (i = 0; i < njobs; i++)
+        virDomainObjListLoadParse(&jobs[i]);
+}
+
+
+/*
+ * Adds the domain of the name and UUID only definition of @job to
+ * @doms. A domain known already keeps its definition if it was not
+ * loaded so far either, otherwise it is updated from the complete one.
+ */
+static virDomainObjPtr
+virDomainObjListLoadLazyConfig(virDomainObjListPtr doms,
+                               virDomainObjListLoadJobPtr job,
+                               virDomainLoadConfigNotify notify,
+                               void *opaque)
+{
+    virDomainObjListLoadDataPtr data = job->data;
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    virDomainObjPtr dom;
+
+    virUUIDFormat(job->def->uuid, uuidstr);
+    if (!(dom = virHashLookup(doms->objs, uuidstr)))
+        dom = virHashLookup(doms->objsName, job->def->name);
+
+    if (!dom) {
+        if ((dom = virDomainObjListLoadConfig(doms, data->xmlopt, job->def,
+                                              job->autostart,
+                                              notify, opaque)))
+            dom->lazy = 1;
+        job->def = NULL;
+        return dom;
+    }
+
+    virObjectLock(dom);
+    if (dom->lazy &&
+        STREQ(dom->def->name, job->def->name) &&
+        memcmp(dom->def->uuid, job->def->uuid, VIR_UUID_BUFLEN) == 0) {
+        dom->autostart = job->autostart;
+        if (notify)
+            (*notify)(dom, 0, opaque);
+        return dom;
+    }
+    virObjectUnlock(dom);
+
+    virDomainDefFree(job->def);
+    job->def = NULL;
+    job->lazy = false;
+    if (virDomainObjListLoadConfigParse(data->caps, data->xmlopt,
+                                        data->configDir, data->autostartDir,
+                                        job->name, &job->lazy, &job->def,
+                                        &job->autostart) < 0) {
+        virResetLastError();
+        return NULL;
+    }
+
+    dom = virDomainObjListLoadConfig(doms, data->xmlopt, job->def,
+                                     job->autostart, notify, opaque);
+    job->def = NULL;
+    return dom;
+}
+
+
+/**
+ * virDomainObjListLoadAllConfigs:
+ * @doms: domain object list
+ * @configDir: directory holding the XML files
+ * @autostartDir: directory holding the autostart links
+ * @liveStatus: whether the files are status XMLs of running domains
+ * @caps: driver capabilities
+ * @xmlopt: XML parser configuration
+ * @notify: called for every loaded domain
+ * @opaque: data for @notify
+ *
+ * Loads the domains of all the XML files in @configDir into @doms. The
+ * files are parsed on a pool of threads, the domains are then added to
+ * @doms in the order of the directory entries. Malformed files are
+ * skipped. See virDomainObjListSetLazyLoad for loading persistent
+ * configs on access.
+ *
+ * Returns 0 on success, -1 if listing @configDir failed.
+ */
 int
 virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
                                const char *configDir,
@@ -563,8 +1201,12 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
                                virDomainLoadConfigNotify notify,
                                void *opaque)
 {
+    virDomainObjListLoadData data;
+    virDomainObjListLoadJobPtr jobs = NULL;
+    size_t njobs = 0;
     DIR *dir;
     struct dirent *entry;
+    size_t i;
     int ret = -1;
     int rc;
 
@@ -573,43 +1215,87 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
     if ((rc = virDirOpenIfExists(&dir, configDir)) <= 0)
         return rc;
 
-    virObjectLock(doms);
+    memset(&data, 0, sizeof(data));
+    data.configDir = configDir;
+    data.autostartDir = autostartDir;
+    data.liveStatus = liveStatus;
+    data.caps = caps;
+    data.xmlopt = xmlopt;
+
+    if (!liveStatus && doms->lazyMax > 0) {
+        char *lazyDir = NULL;
+
+        if (VIR_STRDUP(lazyDir, configDir) < 0)
+            goto cleanup;
+
+        virMutexLock(&doms->lazyLock);
+        VIR_FREE(doms->lazyConfigDir);
+        doms->lazyConfigDir = lazyDir;
+        virObjectUnref(doms->lazyCaps);
+        doms->lazyCaps = virObjectRef(caps);
+        virObjectUnref(doms->lazyXMLOpt);
+        doms->lazyXMLOpt = virObjectRef(xmlopt);
+        virMutexUnlock(&doms->lazyLock);
 
-    while ((ret = virDirRead(dir, &entry, configDir)) > 0) {
-        virDomainObjPtr dom;
+        data.lazy = true;
+    }
+
+    while ((rc = virDirRead(dir, &entry, configDir)) > 0) {
+        virDomainObjListLoadJob job = { .data = &data };
 
         if (!virFileStripSuffix(entry->d_name, ".xml"))
             continue;
 
-        /* NB: ignoring errors, so one malformed config doesn't
-           kill the whole process */
-        VIR_INFO("Loading config file '%s.xml'", entry->d_name);
-        if (liveStatus)
-            dom = virDomainObjListLoadStatus(doms,
-                                             configDir,
-                                             entry->d_name,
-                                             caps,
-                                             xmlopt,
-                                             notify,
-                                             opaque);
-        else
-            dom = virDomainObjListLoadConfig(doms,
-                                             caps,
-                                             xmlopt,
-                                             configDir,
-                                             autostartDir,
-                                             entry->d_name,
-                                             notify,
-                                             opaque);
+        if (VIR_STRDUP(job.name, entry->d_name) < 0 ||
+            VIR_APPEND_ELEMENT(jobs, njobs, job) < 0) {
+            VIR_FREE(job.name);
+            goto cleanup;
+        }
+    }
+    VIR_DIR_CLOSE(dir);
+
+    if (rc < 0)
+        goto cleanup;
+
+    virDomainObjListLoadParseAll(&data, jobs, njobs);
+
+    virObjectRWLockWrite(doms);
+    for (i = 0; i < njobs; i++) {
+        virDomainObjPtr dom = NULL;
+
+        if (jobs[i].obj) {
+            virObjectLock(jobs[i].obj);
+            dom = virDomainObjListLoadStatus(doms, jobs[i].obj,
+                                             notify, opaque);
+            jobs[i].obj = NULL;
+        } else if (jobs[i].def && jobs[i].lazy) {
+            dom = virDomainObjListLoadLazyConfig(doms, &jobs[i],
+                                                 notify, opaque);
+        } else if (jobs[i].def) {
+            dom = virDomainObjListLoadConfig(doms, xmlopt, jobs[i].def,
+                                             jobs[i].autostart,
+                                             notify, opaque);
+            jobs[i].def = NULL;
+        }
+
         if (dom) {
             if (!liveStatus)
                 dom->persistent = 1;
             virObjectUnlock(dom);
         }
     }
+    virObjectRWUnlock(doms);
+
+    ret = 0;
 
+ cleanup:
     VIR_DIR_CLOSE(dir);
-    virObjectUnlock(doms);
+    for (i = 0; i < njobs; i++) {
+        VIR_FREE(jobs[i].name);
+        virObjectUnref(jobs[i].obj);
+        virDomainDefFree(jobs[i].def);
+    }
+    VIR_FREE(jobs);
     return ret;
 }
 
@@ -653,9 +1339,9 @@ virDomainObjListNumOfDomains(virDomainObjListPtr doms,
                              virConnectPtr conn)
 {
     struct virDomainObjListData data = { filter, conn, active, 0 };
-    virObjectLock(doms);
-    virHashForEach(doms->objs, virDomainObjListCount, &data);
-    virObjectUnlock(doms);
+    virObjectRWLockRead(doms);
+    virHashForEachShared(doms->objs, virDomainObjListCount, &data);
+    virObjectRWUnlock(doms);
     return data.count;
 }
 
@@ -697,9 +1383,9 @@ virDomainObjListGetActiveIDs(virDomainObjListPtr doms,
 {
     struct virDomainIDData data = { filter, conn,
                                     0, maxids, ids };
-    virObjectLock(doms);
-    virHashForEach(doms->objs, virDomainObjListCopyActiveIDs, &data);
-    virObjectUnlock(doms);
+    virObjectRWLockRead(doms);
+    virHashForEachShared(doms->objs, virDomainObjListCopyActiveIDs, &data);
+    virObjectRWUnlock(doms);
     return data.numids;
 }
 
@@ -751,9 +1437,9 @@ virDomainObjListGetInactiveNames(virDomainObjListPtr doms,
     struct virDomainNameData data = { filter, conn,
                                       0, 0, maxnames, names };
     size_t i;
-    virObjectLock(doms);
-    virHashForEach(doms->objs, virDomainObjListCopyInactiveNames, &data);
-    virObjectUnlock(doms);
+    virObjectRWLockRead(doms);
+    virHashForEachShared(doms->objs, virDomainObjListCopyInactiveNames, &data);
+    virObjectRWUnlock(doms);
     if (data.oom) {
         for (i = 0; i < data.numnames; i++)
             VIR_FREE(data.names[i]);
@@ -792,9 +1478,9 @@ virDomainObjListForEach(virDomainObjListPtr doms,
     struct virDomainListIterData data = {
         callback, opaque, 0,
     };
-    virObjectLock(doms);
+    virObjectRWLockWrite(doms);
     virHashForEach(doms->objs, virDomainObjListHelper, &data);
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
     return data.ret;
 }
 
@@ -881,17 +1567,21 @@ virDomainObjListCollectIterator(void *payload,
 }
 
 
+/* If @lazydoms is not NULL, the listed objects get their definition
+ * loaded, see virDomainObjListSetLazyLoad */
 static void
 virDomainObjListFilter(virDomainObjPtr **list,
                        size_t *nvms,
                        virConnectPtr conn,
                        virDomainObjListACLFilter filter,
-                       unsigned int flags)
+                       unsigned int flags,
+                       virDomainObjListPtr lazydoms)
 {
     size_t i = 0;
 
     while (i < *nvms) {
         virDomainObjPtr vm = (*list)[i];
+        bool skip;
 
         virObjectLock(vm);
 
@@ -899,10 +1589,21 @@ virDomainObjListFilter(virDomainObjPtr **list,
          * 1) it's being removed.
          * 2) connection does not have ACL to see it
          * 3) it doesn't match the filter
+         * 4) its definition can't be loaded
          */
-        if (vm->removing ||
-            (filter && !filter(conn, vm->def)) ||
-            !virDomainObjMatchFilter(vm, flags)) {
+        skip = vm->removing ||
+               (filter && !filter(conn, vm->def)) ||
+               !virDomainObjMatchFilter(vm, flags);
+
+        if (!skip && lazydoms &&
+            virDomainObjListLazyLoad(lazydoms, vm) < 0) {
+            VIR_WARN("Not listing domain '%s': %s",
+                     vm->def->name, virGetLastErrorMessage());
+            virResetLastError();
+            skip = true;
+        }
+
+        if (skip) {
             virObjectUnlock(vm);
             virObjectUnref(vm);
             VIR_DELETE_ELEMENT(*list, i, *nvms);
@@ -915,27 +1616,31 @@ virDomainObjListFilter(virDomainObjPtr **list,
 }
 
 
-int
-virDomainObjListCollect(virDomainObjListPtr domlist,
-                        virConnectPtr conn,
-                        virDomainObjPtr **vms,
-                        size_t *nvms,
-                        virDomainObjListACLFilter filter,
-                        unsigned int flags)
+static int
+virDomainObjListCollectInternal(virDomainObjListPtr domlist,
+                                virConnectPtr conn,
+                                virDomainObjPtr **vms,
+                                size_t *nvms,
+                                virDomainObjListACLFilter filter,
+                                unsigned int flags,
+                                bool load)
 {
     struct virDomainListData data = { NULL, 0 };
 
-    virObjectLock(domlist);
+    virDomainObjListLazyEvict(domlist);
+
+    virObjectRWLockRead(domlist);
     sa_assert(domlist->objs);
     if (VIR_ALLOC_N(data.vms, virHashSize(domlist->objs)) < 0) {
-        virObjectUnlock(domlist);
+        virObjectRWUnlock(domlist);
         return -1;
     }
 
-    virHashForEach(domlist->objs, virDomainObjListCollectIterator, &data);
-    virObjectUnlock(domlist);
+    virHashForEachShared(domlist->objs, virDomainObjListCollectIterator, &data);
+    virObjectRWUnlock(domlist);
 
-    virDomainObjListFilter(&data.vms, &data.nvms, conn, filter, flags);
+    virDomainObjListFilter(&data.vms, &data.nvms, conn, filter, flags,
+                           load ? domlist : NULL);
 
     *nvms = data.nvms;
     *vms = data.vms;
@@ -944,6 +1649,19 @@ virDomainObjListCollect(virDomainObjListPtr domlist,
 }
 
 
+int
+virDomainObjListCollect(virDomainObjListPtr domlist,
+                        virConnectPtr conn,
+                        virDomainObjPtr **vms,
+                        size_t *nvms,
+                        virDomainObjListACLFilter filter,
+                        unsigned int flags)
+{
+    return virDomainObjListCollectInternal(domlist, conn, vms, nvms,
+                                           filter, flags, true);
+}
+
+
 int
 virDomainObjListConvert(virDomainObjListPtr domlist,
                         virConnectPtr conn,
@@ -962,7 +1680,9 @@ virDomainObjListConvert(virDomainObjListPtr domlist,
     *nvms = 0;
     *vms = NULL;
 
-    virObjectLock(domlist);
+    virDomainObjListLazyEvict(domlist);
+
+    virObjectRWLockRead(domlist);
     for (i = 0; i < ndoms; i++) {
         virDomainPtr dom = doms[i];
 
@@ -972,7 +1692,7 @@ virDomainObjListConvert(virDomainObjListPtr domlist,
             if (skip_missing)
                 continue;
 
-            virObjectUnlock(domlist);
+            virObjectRWUnlock(domlist);
             virReportError(VIR_ERR_NO_DOMAIN,
                            _("no domain with matching uuid '%s' (%s)"),
                            uuidstr, dom->name);
@@ -982,15 +1702,15 @@ virDomainObjListConvert(virDomainObjListPtr domlist,
         virObjectRef(vm);
 
         if (VIR_APPEND_ELEMENT(*vms, *nvms, vm) < 0) {
-            virObjectUnlock(domlist);
+            virObjectRWUnlock(domlist);
             virObjectUnref(vm);
             goto error;
         }
     }
-    virObjectUnlock(domlist);
+    virObjectRWUnlock(domlist);
 
     sa_assert(*vms);
-    virDomainObjListFilter(vms, nvms, conn, filter, flags);
+    virDomainObjListFilter(vms, nvms, conn, filter, flags, domlist);
 
     return 0;
 
@@ -1016,7 +1736,9 @@ virDomainObjListExport(virDomainObjListPtr domlist,
     size_t i;
     int ret = -1;
 
-    if (virDomainObjListCollect(domlist, conn, &vms, &nvms, filter, flags) < 0)
+    /* the name, UUID and ID are known without loading the definitions */
+    if (virDomainObjListCollectInternal(domlist, conn, &vms, &nvms,
+                                        filter, flags, false) < 0)
         return -1;
 
     if (domains) {
@@ -1045,3 +1767,156 @@ virDomainObjListExport(virDomainObjListPtr domlist,
     virObjectListFreeCount(vms, nvms);
     return ret;
 }
+
+
+/* Fill @record with @fields of @vm, which must be locked */
+static int
+virDomainObjListExportFieldsOne(virDomainObjPtr vm,
+                                unsigned int fields,
+                                virDomainStatsRecordPtr record)
+{
+    int maxparams = 0;
+
+    if (fields & VIR_DOMAIN_LIST_FIELD_STATE) {
+        int state;
+        int reason;
+
+        state = virDomainObjGetState(vm, &reason);
+        if (virTypedParamsAddInt(&record->params, &record->nparams,
+                                 &maxparams, "state", state) < 0 ||
+            virTypedParamsAddInt(&record->params, &record->nparams,
+                                 &maxparams, "state.reason", reason) < 0)
+            return -1;
+    }
+
+    if (fields & VIR_DOMAIN_LIST_FIELD_VCPUS) {
+        if (virTypedParamsAddUInt(&record->params, &record->nparams,
+                                  &maxparams, "vcpu.current",
+                                  virDomainDefGetVcpus(vm->def)) < 0 ||
+            virTypedParamsAddUInt(&record->params, &record->nparams,
+                                  &maxparams, "vcpu.maximum",
+                                  virDomainDefGetVcpusMax(vm->def)) < 0)
+            return -1;
+    }
+
+    if (fields & VIR_DOMAIN_LIST_FIELD_MEMORY) {
+        if (virTypedParamsAddULLong(&record->params, &record->nparams,
+                                    &maxparams, "memory.current",
+                                    vm->def->mem.cur_balloon) < 0 ||
+            virTypedParamsAddULLong(&record->params, &record->nparams,
+                                    &maxparams, "memory.maximum",
+                                    virDomainDefGetMemoryTotal(vm->def)) < 0)
+            return -1;
+    }
+
+    if ((fields & VIR_DOMAIN_LIST_FIELD_TITLE) && vm->def->title &&
+        virTypedParamsAddString(&record->params, &record->nparams,
+                                &maxparams, "title", vm->def->title) < 0)
+        return -1;
+
+    if ((fields & VIR_DOMAIN_LIST_FIELD_DESCRIPTION) && vm->def->description &&
+        virTypedParamsAddString(&record->params, &record->nparams,
+                                &maxparams, "description",
+                                vm->def->description) < 0)
+        return -1;
+
+    if ((fields & VIR_DOMAIN_LIST_FIELD_MANAGEDSAVE) &&
+        virTypedParamsAddBoolean(&record->params, &record->nparams,
+                                 &maxparams, "managedsave",
+                                 vm->hasManagedSave) < 0)
+        return -1;
+
+    if ((fields & VIR_DOMAIN_LIST_FIELD_AUTOSTART) &&
+        virTypedParamsAddBoolean(&record->params, &record->nparams,
+                                 &maxparams, "autostart",
+                                 vm->autostart) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+/**
+ * virDomainObjListExportFields:
+ * @domlist: the list of domains
+ * @conn: connection the records are created for
+ * @fields: bitwise-OR of virDomainListFields
+ * @records: filled with the NULL terminated list of records, can be NULL
+ * @filter: ACL filter of the listed domains
+ * @flags: bitwise-OR of virConnectListAllDomainsFlags
+ *
+ * Like virDomainObjListExport, but every exported domain comes with the
+ * typed parameters described at virConnectListAllDomainsFields, read
+ * while the domain object is locked anyway.
+ *
+ * Returns the number of domains listed, -1 on error.
+ */
+int
+virDomainObjListExportFields(virDomainObjListPtr domlist,
+                             virConnectPtr conn,
+                             unsigned int fields,
+                             virDomainStatsRecordPtr **records,
+                             virDomainObjListACLFilter filter,
+                             unsigned int flags)
+{
+    virDomainObjPtr *vms = NULL;
+    virDomainStatsRecordPtr *tmp = NULL;
+    size_t nvms = 0;
+    size_t i;
+    bool load;
+    int ret = -1;
+
+    if (fields & ~VIR_DOMAIN_LIST_FIELDS_ALL) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
+                       _("unsupported domain list fields 0x%x"),
+                       fields & ~VIR_DOMAIN_LIST_FIELDS_ALL);
+        return -1;
+    }
+
+    load = !!(fields & (VIR_DOMAIN_LIST_FIELD_VCPUS |
+                        VIR_DOMAIN_LIST_FIELD_MEMORY |
+                        VIR_DOMAIN_LIST_FIELD_TITLE |
+                        VIR_DOMAIN_LIST_FIELD_DESCRIPTION));
+
+    if (virDomainObjListCollectInternal(domlist, conn, &vms, &nvms,
+                                        filter, flags, load) < 0)
+        return -1;
+
+    if (records) {
+        if (VIR_ALLOC_N(tmp, nvms + 1) < 0)
+            goto cleanup;
+
+        for (i = 0; i < nvms; i++) {
+            virDomainObjPtr vm = vms[i];
+            int rc = -1;
+
+            if (VIR_ALLOC(tmp[i]) < 0)
+                goto cleanup;
+
+            virObjectLock(vm);
+            if ((tmp[i]->dom = virGetDomain(conn, vm->def->name,
+                                            vm->def->uuid, vm->def->id)))
+                rc = virDomainObjListExportFieldsOne(vm, fields, tmp[i]);
+            virObjectUnlock(vm);
+
+            if (rc < 0)
+                goto cleanup;
+        }
+
+        *records = tmp;
+        tmp = NULL;
+    }
+
+    ret = nvms;
+
+ cleanup:
+    /* not virDomainStatsRecordListFree, which would reset the error */
+    for (i = 0; tmp && i < nvms && tmp[i]; i++) {
+        virTypedParamsFree(tmp[i]->params, tmp[i]->nparams);
+        virObjectUnref(tmp[i]->dom);
+        VIR_FREE(tmp[i]);
+    }
+    VIR_FREE(tmp);
+    virObjectListFreeCount(vms, nvms);
+    return ret;
+}
@@ -69,6 +69,9 @@ void virDomainObjListRemove(virDomainObjListPtr doms,
 void virDomainObjListRemoveLocked(virDomainObjListPtr doms,
                                   virDomainObjPtr dom);
 
+void virDomainObjListSetLazyLoad(virDomainObjListPtr doms,
+                                 size_t maxLoaded);
+
 int virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
                                    const char *configDir,
                                    const char *autostartDir,
@@ -135,6 +138,15 @@ int virDomainObjListForEach(virDomainObjListPtr doms,
                  VIR_CONNECT_LIST_DOMAINS_FILTERS_AUTOSTART   | \
                  VIR_CONNECT_LIST_DOMAINS_FILTERS_SNAPSHOT)
 
+# define VIR_DOMAIN_LIST_FIELDS_ALL              \
+                (VIR_DOMAIN_LIST_FIELD_STATE       | \
+                 VIR_DOMAIN_LIST_FIELD_VCPUS       | \
+                 VIR_DOMAIN_LIST_FIELD_MEMORY      | \
+                 VIR_DOMAIN_LIST_FIELD_TITLE       | \
+                 VIR_DOMAIN_LIST_FIELD_DESCRIPTION | \
+                 VIR_DOMAIN_LIST_FIELD_MANAGEDSAVE | \
+                 VIR_DOMAIN_LIST_FIELD_AUTOSTART)
+
 int virDomainObjListCollect(virDomainObjListPtr doms,
                             virConnectPtr conn,
                             virDomainObjPtr **vms,
@@ -146,6 +158,12 @@ int virDomainObjListExport(virDomainObjListPtr doms,
                            virDomainPtr **domains,
                            virDomainObjListACLFilter filter,
                            unsigned int flags);
+int virDomainObjListExportFields(virDomainObjListPtr doms,
+                                 virConnectPtr conn,
+                                 unsigned int fields,
+                                 virDomainStatsRecordPtr **records,
+                                 virDomainObjListACLFilter filter,
+                                 unsigned int flags);
 int virDomainObjListConvert(virDomainObjListPtr domlist,
                             virConnectPtr conn,
                             virDomainPtr *doms,
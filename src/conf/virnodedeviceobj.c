@@ -112,18 +112,13 @@ virNodeDeviceObjPtr
 virNodeDeviceObjFindBySysfsPath(virNodeDeviceObjListPtr devs,
                                 const char *sysfs_path)
 {
-    size_t i;
+    virNodeDeviceObjPtr obj = NULL;
 
-    for (i = 0; i < devs->count; i++) {
-        virNodeDeviceObjLock(devs->objs[i]);
-        if ((devs->objs[i]->def->sysfs_path != NULL) &&
-            (STREQ(devs->objs[i]->def->sysfs_path, sysfs_path))) {
-            return devs->objs[i];
-        }
-        virNodeDeviceObjUnlock(devs->objs[i]);
-    }
+    if (devs->sysfsPaths &&
+        (obj = virHashLookup(devs->sysfsPaths, sysfs_path)))
+        virNodeDeviceObjLock(obj);
 
-    return NULL;
+    return obj;
 }
 
 
@@ -131,16 +126,13 @@ virNodeDeviceObjPtr
 virNodeDeviceObjFindByName(virNodeDeviceObjListPtr devs,
                            const char *name)
 {
-    size_t i;
+    virNodeDeviceObjPtr obj = NULL;
 
-    for (i = 0; i < devs->count; i++) {
-        virNodeDeviceObjLock(devs->objs[i]);
-        if (STREQ(devs->objs[i]->def->name, name))
-            return devs->objs[i];
-        virNodeDeviceObjUnlock(devs->objs[i]);
-    }
+    if (devs->names &&
+        (obj = virHashLookup(devs->names, name)))
+        virNodeDeviceObjLock(obj);
 
-    return NULL;
+    return obj;
 }
 
 
@@ -225,6 +217,35 @@ virNodeDeviceObjListFree(virNodeDeviceObjListPtr devs)
         virNodeDeviceObjFree(devs->objs[i]);
     VIR_FREE(devs->objs);
     devs->count = 0;
+    virHashFree(devs->names);
+    virHashFree(devs->sysfsPaths);
+    devs->names = NULL;
+    devs->sysfsPaths = NULL;
+}
+
+
+/* Drop @def of @device from the indexes */
+static void
+virNodeDeviceObjListUnindex(virNodeDeviceObjListPtr devs,
+                            virNodeDeviceObjPtr device,
+                            virNodeDeviceDefPtr def)
+{
+    if (def->sysfs_path &&
+        virHashLookup(devs->sysfsPaths, def->sysfs_path) == device)
+        ignore_value(virHashRemoveEntry(devs->sysfsPaths, def->sysfs_path));
+}
+
+
+static int
+virNodeDeviceObjListIndex(virNodeDeviceObjListPtr devs,
+                          virNodeDeviceObjPtr device,
+                          virNodeDeviceDefPtr def)
+{
+    if (def->sysfs_path &&
+        virHashUpdateEntry(devs->sysfsPaths, def->sysfs_path, device) < 0)
+        return -1;
+
+    return 0;
 }
 
 
@@ -235,11 +256,25 @@ virNodeDeviceObjAssignDef(virNodeDeviceObjListPtr devs,
     virNodeDeviceObjPtr device;
 
     if ((device = virNodeDeviceObjFindByName(devs, def->name))) {
+        virNodeDeviceObjListUnindex(devs, device, device->def);
+        if (virNodeDeviceObjListIndex(devs, device, def) < 0) {
+            ignore_value(virNodeDeviceObjListIndex(devs, device, device->def));
+            virNodeDeviceObjUnlock(device);
+            return NULL;
+        }
         virNodeDeviceDefFree(device->def);
         device->def = def;
         return device;
     }
 
+    if (!devs->names &&
+        !(devs->names = virHashCreate(50, NULL)))
+        return NULL;
+
+    if (!devs->sysfsPaths &&
+        !(devs->sysfsPaths = virHashCreate(50, NULL)))
+        return NULL;
+
     if (VIR_ALLOC(device) < 0)
         return NULL;
 
@@ -251,7 +286,11 @@ virNodeDeviceObjAssignDef(virNodeDeviceObjListPtr devs,
     }
     virNodeDeviceObjLock(device);
 
-    if (VIR_APPEND_ELEMENT_COPY(devs->objs, devs->count, device) < 0) {
+    if (virHashAddEntry(devs->names, def->name, device) < 0 ||
+        virNodeDeviceObjListIndex(devs, device, def) < 0 ||
+        VIR_APPEND_ELEMENT_COPY(devs->objs, devs->count, device) < 0) {
+        ignore_value(virHashRemoveEntry(devs->names, def->name));
+        virNodeDeviceObjListUnindex(devs, device, def);
         virNodeDeviceObjUnlock(device);
         virNodeDeviceObjFree(device);
         return NULL;
@@ -274,6 +313,8 @@ virNodeDeviceObjRemove(virNodeDeviceObjListPtr devs,
     for (i = 0; i < devs->count; i++) {
         virNodeDeviceObjLock(*dev);
         if (devs->objs[i] == *dev) {
+            ignore_value(virHashRemoveEntry(devs->names, (*dev)->def->name));
+            virNodeDeviceObjListUnindex(devs, *dev, (*dev)->def);
             virNodeDeviceObjUnlock(*dev);
             virNodeDeviceObjFree(devs->objs[i]);
             *dev = NULL;
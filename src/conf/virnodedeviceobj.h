@@ -35,6 +35,11 @@ struct _virNodeDeviceDriverState {
     virNodeDeviceObjList devs;		/* currently-known devices */
     void *privateData;			/* driver-specific private data */
 
+    /* Whether the devices present at startup are still being
+     * enumerated, @enumerated is signalled once they are not */
+    bool enumerating;
+    virCond enumerated;
+
     /* Immutable pointer, self-locking APIs */
     virObjectEventStatePtr nodeDeviceEventState;
 };
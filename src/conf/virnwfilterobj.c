@@ -75,6 +75,7 @@ virNWFilterObjRemove(virNWFilterObjListPtr nwfilters,
             virNWFilterObjFree(nwfilters->objs[i]);
 
             VIR_DELETE_ELEMENT(nwfilters->objs, i, nwfilters->count);
+            nwfilters->generation++;
             break;
         }
         virNWFilterObjUnlock(nwfilters->objs[i]);
@@ -264,6 +265,7 @@ virNWFilterObjAssignDef(virNWFilterObjListPtr nwfilters,
         if (virNWFilterDefEqual(def, nwfilter->def, false)) {
             virNWFilterDefFree(nwfilter->def);
             nwfilter->def = def;
+            nwfilters->generation++;
             return nwfilter;
         }
 
@@ -278,6 +280,7 @@ virNWFilterObjAssignDef(virNWFilterObjListPtr nwfilters,
         virNWFilterDefFree(nwfilter->def);
         nwfilter->def = def;
         nwfilter->newDef = NULL;
+        nwfilters->generation++;
         return nwfilter;
     }
 
@@ -300,6 +303,7 @@ virNWFilterObjAssignDef(virNWFilterObjListPtr nwfilters,
         return NULL;
     }
     nwfilter->def = def;
+    nwfilters->generation++;
 
     return nwfilter;
 }
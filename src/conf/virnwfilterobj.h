@@ -42,6 +42,9 @@ typedef virNWFilterObjList *virNWFilterObjListPtr;
 struct _virNWFilterObjList {
     size_t count;
     virNWFilterObjPtr *objs;
+
+    /* bumped whenever a filter is added, replaced or removed */
+    unsigned int generation;
 };
 
 
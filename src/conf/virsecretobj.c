@@ -22,6 +22,9 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#if HAVE_MMAP
+# include <sys/mman.h>
+#endif
 
 #include "datatypes.h"
 #include "virsecretobj.h"
@@ -31,6 +34,8 @@
 #include "virhash.h"
 #include "virlog.h"
 #include "virstring.h"
+#include "virutil.h"
+#include "viratomic.h"
 #include "base64.h"
 
 #define VIR_FROM_THIS VIR_FROM_SECRET
@@ -42,7 +47,7 @@ struct _virSecretObj {
     char *configFile;
     char *base64File;
     virSecretDefPtr def;
-    unsigned char *value;       /* May be NULL */
+    unsigned char *value;       /* May be NULL, see virSecretObjValueAlloc */
     size_t value_size;
 };
 
@@ -133,17 +138,92 @@ virSecretObjListNew(void)
 }
 
 
+/* The decrypted value of a secret lives as long as the secret object or
+ * until it is replaced. It is kept in a private anonymous mapping which
+ * is locked in RAM, so it cannot be swapped out, and excluded from core
+ * dumps of the daemon. Copies handed out by virSecretObjGetValue are
+ * plain heap memory which the callers dispose of themselves. */
+static size_t
+virSecretObjValueMapSize(size_t value_size)
+{
+    long pagesize = virGetSystemPageSize();
+
+    if (pagesize <= 0)
+        pagesize = 4096;
+
+    return VIR_ROUND_UP(MAX(value_size, 1), pagesize);
+}
+
+
+#if HAVE_MMAP
+/* Once RLIMIT_MEMLOCK is exhausted every further secret fails to lock
+ * too, so only the first failure is worth a warning */
+static int virSecretObjValueLockFailed;
+#endif
+
+
+static unsigned char *
+virSecretObjValueAlloc(size_t value_size)
+{
+#if HAVE_MMAP
+    size_t len = virSecretObjValueMapSize(value_size);
+    void *value;
+
+    value = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (value == MAP_FAILED) {
+        virReportSystemError(errno, "%s",
+                             _("unable to allocate memory for secret value"));
+        return NULL;
+    }
+
+    /* Failing to lock is not fatal, RLIMIT_MEMLOCK may just be too low */
+    if (mlock(value, len) < 0) {
+        if (virAtomicIntInc(&virSecretObjValueLockFailed) == 1)
+            VIR_WARN("Unable to lock secret values in memory: %s",
+                     virStrerror(errno, NULL, 0));
+        else
+            VIR_DEBUG("Unable to lock secret value in memory: %s",
+                      virStrerror(errno, NULL, 0));
+    }
+# ifdef MADV_DONTDUMP
+    ignore_value(madvise(value, len, MADV_DONTDUMP));
+# endif
+
+    return value;
+#else /* !HAVE_MMAP */
+    unsigned char *value;
+
+    ignore_value(VIR_ALLOC_N(value, value_size));
+    return value;
+#endif /* !HAVE_MMAP */
+}
+
+
+static void
+virSecretObjValueFree(unsigned char *value,
+                      size_t value_size)
+{
+    if (!value)
+        return;
+
+    /* Wipe before free to ensure we don't leave a secret in memory */
+    memset(value, 0, value_size);
+#if HAVE_MMAP
+    munmap(value, virSecretObjValueMapSize(value_size));
+#else
+    VIR_FREE(value);
+#endif
+}
+
+
 static void
 virSecretObjDispose(void *obj)
 {
     virSecretObjPtr secret = obj;
 
     virSecretDefFree(secret->def);
-    if (secret->value) {
-        /* Wipe before free to ensure we don't leave a secret on the heap */
-        memset(secret->value, 0, secret->value_size);
-        VIR_FREE(secret->value);
-    }
+    virSecretObjValueFree(secret->value, secret->value_size);
     VIR_FREE(secret->configFile);
     VIR_FREE(secret->base64File);
 }
@@ -754,7 +834,7 @@ virSecretObjSetValue(virSecretObjPtr secret,
     unsigned char *old_value, *new_value;
     size_t old_value_size;
 
-    if (VIR_ALLOC_N(new_value, value_size) < 0)
+    if (!(new_value = virSecretObjValueAlloc(value_size)))
         return -1;
 
     old_value = secret->value;
@@ -768,10 +848,7 @@ virSecretObjSetValue(virSecretObjPtr secret,
         goto error;
 
     /* Saved successfully - drop old value */
-    if (old_value) {
-        memset(old_value, 0, old_value_size);
-        VIR_FREE(old_value);
-    }
+    virSecretObjValueFree(old_value, old_value_size);
 
     return 0;
 
@@ -779,8 +856,7 @@ virSecretObjSetValue(virSecretObjPtr secret,
     /* Error - restore previous state and free new value */
     secret->value = old_value;
     secret->value_size = old_value_size;
-    memset(new_value, 0, value_size);
-    VIR_FREE(new_value);
+    virSecretObjValueFree(new_value, value_size);
     return -1;
 }
 
@@ -792,14 +868,6 @@ virSecretObjGetValueSize(virSecretObjPtr secret)
 }
 
 
-void
-virSecretObjSetValueSize(virSecretObjPtr secret,
-                         size_t value_size)
-{
-    secret->value_size = value_size;
-}
-
-
 static int
 virSecretLoadValidateUUID(virSecretDefPtr def,
                           const char *file)
@@ -870,8 +938,9 @@ virSecretLoadValue(virSecretObjPtr secret)
     if (value == NULL)
         goto cleanup;
 
-    secret->value = (unsigned char *)value;
-    value = NULL;
+    if (!(secret->value = virSecretObjValueAlloc(value_size)))
+        goto cleanup;
+    memcpy(secret->value, value, value_size);
     secret->value_size = value_size;
 
     ret = 0;
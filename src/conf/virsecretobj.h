@@ -103,8 +103,6 @@ int virSecretObjSetValue(virSecretObjPtr secret,
 
 size_t virSecretObjGetValueSize(virSecretObjPtr secret);
 
-void virSecretObjSetValueSize(virSecretObjPtr secret, size_t value_size);
-
 int virSecretLoadAllConfigs(virSecretObjListPtr secrets,
                             const char *configDir);
 #endif /* __VIRSECRETOBJ_H__ */
@@ -460,6 +460,109 @@ virStoragePoolObjDeleteDef(virStoragePoolObjPtr pool)
 }
 
 
+/**
+ * virStoragePoolObjSaveVolumes:
+ * @pool: pool object, locked
+ * @path: file to save the volumes into
+ *
+ * Saves the volumes the last refresh of @pool found, so that they can
+ * be loaded back with virStoragePoolObjLoadVolumes.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virStoragePoolObjSaveVolumes(virStoragePoolObjPtr pool,
+                             const char *path)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *volxml = NULL;
+    char *xml = NULL;
+    size_t i;
+    int ret = -1;
+
+    virBufferAddLit(&buf, "<volumes>\n");
+    virBufferAdjustIndent(&buf, 2);
+
+    for (i = 0; i < pool->volumes.count; i++) {
+        if (!(volxml = virStorageVolDefFormat(pool->def,
+                                              pool->volumes.objs[i])))
+            goto cleanup;
+        virBufferAddStr(&buf, volxml);
+        VIR_FREE(volxml);
+    }
+
+    virBufferAdjustIndent(&buf, -2);
+    virBufferAddLit(&buf, "</volumes>\n");
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+
+    xml = virBufferContentAndReset(&buf);
+    if (virXMLSaveFile(path, NULL, NULL, xml) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(volxml);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+/**
+ * virStoragePoolObjLoadVolumes:
+ * @pool: pool object, locked, with no volumes
+ * @path: file written by virStoragePoolObjSaveVolumes
+ *
+ * Fills the volume list of @pool with the volumes saved in @path, as
+ * they were at the time. Nothing is checked against the storage itself.
+ *
+ * Returns 0 on success, -1 on error, in which case the volume list is
+ * left empty.
+ */
+int
+virStoragePoolObjLoadVolumes(virStoragePoolObjPtr pool,
+                             const char *path)
+{
+    xmlDocPtr xml = NULL;
+    xmlXPathContextPtr ctxt = NULL;
+    xmlNodePtr *nodes = NULL;
+    virStorageVolDefPtr vol = NULL;
+    size_t i;
+    int n;
+    int ret = -1;
+
+    if (!(xml = virXMLParseFileCtxt(path, &ctxt)))
+        goto cleanup;
+
+    if ((n = virXPathNodeSet("/volumes/volume", ctxt, &nodes)) < 0)
+        goto cleanup;
+
+    for (i = 0; i < n; i++) {
+        if (!(vol = virStorageVolDefParseNode(pool->def, xml, nodes[i],
+                                              VIR_VOL_XML_PARSE_STATE)))
+            goto cleanup;
+
+        if (VIR_APPEND_ELEMENT(pool->volumes.objs, pool->volumes.count,
+                               vol) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0)
+        virStoragePoolObjClearVols(pool);
+    virStorageVolDefFree(vol);
+    VIR_FREE(nodes);
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(xml);
+    return ret;
+}
+
+
 /*
  * virStoragePoolObjIsDuplicate:
  * @doms : virStoragePoolObjListPtr to search
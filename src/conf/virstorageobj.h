@@ -35,6 +35,7 @@ struct _virStoragePoolObj {
     bool active;
     int autostart;
     unsigned int asyncjobs;
+    int targetWatch; /* inotify watch on the target directory, 0 if none */
 
     virStoragePoolDefPtr def;
     virStoragePoolDefPtr newDef;
@@ -120,6 +121,14 @@ virStoragePoolObjSaveDef(virStorageDriverStatePtr driver,
 int
 virStoragePoolObjDeleteDef(virStoragePoolObjPtr pool);
 
+int
+virStoragePoolObjSaveVolumes(virStoragePoolObjPtr pool,
+                             const char *path);
+
+int
+virStoragePoolObjLoadVolumes(virStoragePoolObjPtr pool,
+                             const char *path);
+
 void
 virStoragePoolObjFree(virStoragePoolObjPtr pool);
 
@@ -580,6 +580,108 @@ cpuBaselineXML(const char **xmlCPUs,
 }
 
 
+/**
+ * virCPUCompareMatrixXML:
+ *
+ * @xmlCPUs: list of host CPU XML descriptions
+ * @ncpus: number of CPUs in @xmlCPUs
+ * @results: array of @ncpus * @ncpus comparison results to fill in
+ * @baseline: where to store the baseline CPU, or NULL
+ * @flags: bitwise-OR of virConnectBaselineCPUFlags, used for @baseline
+ *
+ * Compares each of the given host CPUs with all the others, parsing each of
+ * them only once. @results[i * @ncpus + j] is set to the result of comparing
+ * @xmlCPUs[j] with @xmlCPUs[i] taken as the host CPU, that is what
+ * virCPUCompareXML would return for @xmlCPUs[j] on that host. If @baseline
+ * is not NULL, it is set to the XML description of the baseline CPU of all
+ * of them, computed as by cpuBaselineXML with all models allowed.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virCPUCompareMatrixXML(const char **xmlCPUs,
+                       unsigned int ncpus,
+                       int *results,
+                       char **baseline,
+                       unsigned int flags)
+{
+    xmlDocPtr doc = NULL;
+    xmlXPathContextPtr ctxt = NULL;
+    virCPUDefPtr *cpus = NULL;
+    virCPUDefPtr cpu = NULL;
+    size_t i;
+    size_t j;
+    int ret = -1;
+
+    VIR_DEBUG("ncpus=%u, results=%p, baseline=%p, flags=%x",
+              ncpus, results, baseline, flags);
+
+    virCheckFlags(VIR_CONNECT_BASELINE_CPU_EXPAND_FEATURES |
+                  VIR_CONNECT_BASELINE_CPU_MIGRATABLE, -1);
+
+    if (ncpus < 1) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s", _("No CPUs given"));
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(cpus, ncpus) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ncpus; i++) {
+        VIR_DEBUG("xmlCPUs[%zu]=%s", i, NULLSTR(xmlCPUs[i]));
+
+        if (!(doc = virXMLParseStringCtxt(xmlCPUs[i], _("(CPU_definition)"),
+                                          &ctxt)))
+            goto cleanup;
+
+        if (!(cpus[i] = virCPUDefParseXML(ctxt->node, ctxt,
+                                          VIR_CPU_TYPE_HOST)))
+            goto cleanup;
+
+        xmlXPathFreeContext(ctxt);
+        xmlFreeDoc(doc);
+        ctxt = NULL;
+        doc = NULL;
+    }
+
+    for (i = 0; i < ncpus; i++) {
+        for (j = 0; j < ncpus; j++) {
+            int result = virCPUCompare(cpus[i]->arch, cpus[i], cpus[j], false);
+
+            if (result == VIR_CPU_COMPARE_ERROR)
+                goto cleanup;
+            results[i * ncpus + j] = result;
+        }
+    }
+
+    if (baseline) {
+        if (!(cpu = cpuBaseline(cpus, ncpus, NULL, 0,
+                                !!(flags & VIR_CONNECT_BASELINE_CPU_MIGRATABLE))))
+            goto cleanup;
+
+        if ((flags & VIR_CONNECT_BASELINE_CPU_EXPAND_FEATURES) &&
+            virCPUExpandFeatures(cpus[0]->arch, cpu) < 0)
+            goto cleanup;
+
+        if (!(*baseline = virCPUDefFormat(cpu, NULL, false)))
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (cpus) {
+        for (i = 0; i < ncpus; i++)
+            virCPUDefFree(cpus[i]);
+        VIR_FREE(cpus);
+    }
+    virCPUDefFree(cpu);
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+    return ret;
+}
+
+
 /**
  * cpuBaseline:
  *
@@ -200,6 +200,14 @@ cpuBaselineXML(const char **xmlCPUs,
                unsigned int nmodels,
                unsigned int flags);
 
+int
+virCPUCompareMatrixXML(const char **xmlCPUs,
+                       unsigned int ncpus,
+                       int *results,
+                       char **baseline,
+                       unsigned int flags)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3);
+
 virCPUDefPtr
 cpuBaseline (virCPUDefPtr *cpus,
              unsigned int ncpus,
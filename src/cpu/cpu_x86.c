@@ -32,7 +32,9 @@
 #include "cpu_x86.h"
 #include "virbuffer.h"
 #include "virendian.h"
+#include "virhash.h"
 #include "virstring.h"
+#include "virthread.h"
 
 #define VIR_FROM_THIS VIR_FROM_CPU
 
@@ -1817,6 +1819,150 @@ x86DataFilterTSX(virCPUx86Data *data,
 }
 
 
+/* Decoding walks all the models in the map, converting the CPUID data
+ * to features for each of them, and is done over and over with the same
+ * data: whenever the host CPU is probed, a host-model CPU is started or a
+ * guest CPU is compared or baselined. Since the map never changes once
+ * loaded, the results are remembered, keyed by everything x86Decode
+ * looks at. */
+#define X86_DECODE_CACHE_SIZE 64
+
+static virMutex x86DecodeCacheLock = VIR_MUTEX_INITIALIZER;
+static virHashTablePtr x86DecodeCache;
+
+
+static void
+x86DecodeCacheEntryFree(void *payload,
+                        const void *name ATTRIBUTE_UNUSED)
+{
+    virCPUDefFree(payload);
+}
+
+
+static char *
+x86DecodeCacheKey(const virCPUDef *cpu,
+                  const virCPUx86Data *data,
+                  const char **models,
+                  unsigned int nmodels,
+                  const char *preferred,
+                  bool migratable)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+
+    virBufferAsprintf(&buf, "%d %d %d %d:%s",
+                      cpu->type, cpu->fallback, migratable,
+                      !!preferred, preferred ? preferred : "");
+
+    virBufferAsprintf(&buf, " %u", models ? nmodels : 0);
+    for (i = 0; models && i < nmodels; i++)
+        virBufferAsprintf(&buf, " %zu:%s", strlen(models[i]), models[i]);
+
+    for (i = 0; i < data->len; i++) {
+        const virCPUx86CPUID *cpuid = &data->data[i];
+
+        virBufferAsprintf(&buf, " %08x.%08x:%08x.%08x.%08x.%08x",
+                          cpuid->eax_in, cpuid->ecx_in,
+                          cpuid->eax, cpuid->ebx, cpuid->ecx, cpuid->edx);
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+/* Copies the model and features x86Decode sets, as well as the vendor
+ * unless it wasn't detected */
+static int
+x86DecodeCopyResult(virCPUDefPtr dst,
+                    const virCPUDef *src)
+{
+    size_t i;
+
+    if ((src->vendor && VIR_STRDUP(dst->vendor, src->vendor) < 0) ||
+        VIR_STRDUP(dst->model, src->model) < 0 ||
+        VIR_ALLOC_N(dst->features, src->nfeatures) < 0)
+        return -1;
+    dst->nfeatures_max = src->nfeatures;
+
+    for (i = 0; i < src->nfeatures; i++) {
+        if (VIR_STRDUP(dst->features[i].name, src->features[i].name) < 0)
+            return -1;
+        dst->features[i].policy = src->features[i].policy;
+        dst->nfeatures++;
+    }
+
+    return 0;
+}
+
+
+/* Returns 1 if @cpu was filled in from the cache, 0 if @key is not cached
+ * and -1 on error. */
+static int
+x86DecodeCacheGet(virCPUDefPtr cpu,
+                  const char *key)
+{
+    virCPUDefPtr entry;
+    int ret = 0;
+
+    virMutexLock(&x86DecodeCacheLock);
+    if (x86DecodeCache && (entry = virHashLookup(x86DecodeCache, key))) {
+        VIR_DEBUG("Using cached CPU model %s", entry->model);
+        ret = x86DecodeCopyResult(cpu, entry) < 0 ? -1 : 1;
+    }
+    virMutexUnlock(&x86DecodeCacheLock);
+
+    return ret;
+}
+
+
+static void
+x86DecodeCacheAdd(const char *key,
+                  virCPUx86VendorPtr vendor,
+                  const virCPUDef *cpu)
+{
+    virCPUDefPtr entry = NULL;
+    virCPUDef result = {
+        .vendor = vendor ? vendor->name : NULL,
+        .model = cpu->model,
+        .nfeatures = cpu->nfeatures,
+        .features = cpu->features,
+    };
+
+    if (VIR_ALLOC(entry) < 0 ||
+        x86DecodeCopyResult(entry, &result) < 0)
+        goto error;
+
+    virMutexLock(&x86DecodeCacheLock);
+
+    if (!x86DecodeCache &&
+        !(x86DecodeCache = virHashCreate(X86_DECODE_CACHE_SIZE,
+                                         x86DecodeCacheEntryFree))) {
+        virMutexUnlock(&x86DecodeCacheLock);
+        goto error;
+    }
+
+    /* The number of CPUs a host sees is small, a full cache means
+     * something keeps decoding random data; just start over */
+    if (virHashSize(x86DecodeCache) >= X86_DECODE_CACHE_SIZE)
+        virHashRemoveAll(x86DecodeCache);
+
+    if (virHashUpdateEntry(x86DecodeCache, key, entry) < 0) {
+        virMutexUnlock(&x86DecodeCacheLock);
+        goto error;
+    }
+
+    virMutexUnlock(&x86DecodeCacheLock);
+    return;
+
+ error:
+    virCPUDefFree(entry);
+    virResetLastError();
+}
+
+
 static int
 x86Decode(virCPUDefPtr cpu,
           const virCPUx86Data *cpuData,
@@ -1838,10 +1984,23 @@ x86Decode(virCPUDefPtr cpu,
     uint32_t signature;
     ssize_t i;
     int rc;
+    char *key = NULL;
 
-    if (!cpuData || x86DataCopy(&data, cpuData) < 0)
+    if (!cpuData)
         return -1;
 
+    if (!(key = x86DecodeCacheKey(cpu, cpuData, models, nmodels,
+                                  preferred, migratable)))
+        return -1;
+
+    if ((rc = x86DecodeCacheGet(cpu, key)) != 0) {
+        VIR_FREE(key);
+        return rc < 0 ? -1 : 0;
+    }
+
+    if (x86DataCopy(&data, cpuData) < 0)
+        goto cleanup;
+
     if (!(map = virCPUx86GetMap()))
         goto cleanup;
 
@@ -1933,6 +2092,8 @@ x86Decode(virCPUDefPtr cpu,
     cpu->nfeatures_max = cpuModel->nfeatures_max;
     cpuModel->nfeatures_max = 0;
 
+    x86DecodeCacheAdd(key, vendor, cpu);
+
     ret = 0;
 
  cleanup:
@@ -1940,6 +2101,7 @@ x86Decode(virCPUDefPtr cpu,
     virCPUx86DataClear(&data);
     virCPUx86DataClear(&copy);
     virCPUx86DataClear(&features);
+    VIR_FREE(key);
     return ret;
 }
 
@@ -1263,6 +1263,68 @@ typedef int
                                  unsigned long long threshold,
                                  unsigned int flags);
 
+typedef int
+(*virDrvDomainSetStatsEvent)(virDomainPtr domain,
+                             unsigned int stats,
+                             unsigned int interval,
+                             unsigned int flags);
+
+typedef int
+(*virDrvConnectLookupDomainsByUUID)(virConnectPtr conn,
+                                    const unsigned char *uuids,
+                                    unsigned int nuuids,
+                                    virDomainPtr **doms,
+                                    unsigned int flags);
+
+typedef int
+(*virDrvConnectCompareCPUs)(virConnectPtr conn,
+                            const char **xmlCPUs,
+                            unsigned int ncpus,
+                            int *results,
+                            char **baseline,
+                            unsigned int flags);
+
+typedef int
+(*virDrvDomainAttachDevices)(virDomainPtr domain,
+                             const char **xmls,
+                             unsigned int ndevices,
+                             unsigned int flags);
+
+typedef int
+(*virDrvConnectListAllDomainsFields)(virConnectPtr conn,
+                                     unsigned int fields,
+                                     virDomainStatsRecordPtr **records,
+                                     unsigned int flags);
+
+typedef int
+(*virDrvDomainBackupBegin)(virDomainPtr domain,
+                           const char *backupXML,
+                           unsigned int flags);
+
+typedef char *
+(*virDrvDomainBackupGetXMLDesc)(virDomainPtr domain,
+                                unsigned int flags);
+
+typedef int
+(*virDrvDomainBackupEnd)(virDomainPtr domain,
+                         unsigned int flags);
+
+typedef int
+(*virDrvDomainBlockJobGroupStart)(virDomainPtr domain,
+                                  virTypedParameterPtr params,
+                                  int nparams,
+                                  unsigned int flags);
+
+typedef int
+(*virDrvDomainBlockJobGroupGetStats)(virDomainPtr domain,
+                                     virTypedParameterPtr *params,
+                                     int *nparams,
+                                     unsigned int flags);
+
+typedef int
+(*virDrvDomainBlockJobGroupAbort)(virDomainPtr domain,
+                                  unsigned int flags);
+
 
 typedef struct _virHypervisorDriver virHypervisorDriver;
 typedef virHypervisorDriver *virHypervisorDriverPtr;
@@ -1504,6 +1566,17 @@ struct _virHypervisorDriver {
     virDrvDomainSetGuestVcpus domainSetGuestVcpus;
     virDrvDomainSetVcpu domainSetVcpu;
     virDrvDomainSetBlockThreshold domainSetBlockThreshold;
+    virDrvDomainSetStatsEvent domainSetStatsEvent;
+    virDrvConnectLookupDomainsByUUID connectLookupDomainsByUUID;
+    virDrvConnectCompareCPUs connectCompareCPUs;
+    virDrvDomainAttachDevices domainAttachDevices;
+    virDrvConnectListAllDomainsFields connectListAllDomainsFields;
+    virDrvDomainBackupBegin domainBackupBegin;
+    virDrvDomainBackupGetXMLDesc domainBackupGetXMLDesc;
+    virDrvDomainBackupEnd domainBackupEnd;
+    virDrvDomainBlockJobGroupStart domainBlockJobGroupStart;
+    virDrvDomainBlockJobGroupGetStats domainBlockJobGroupGetStats;
+    virDrvDomainBlockJobGroupAbort domainBlockJobGroupAbort;
 };
 
 
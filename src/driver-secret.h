@@ -61,6 +61,17 @@ typedef unsigned char *
                         unsigned int flags,
                         unsigned int internalFlags);
 
+/* Internal only: looks up a secret by @uuid, or by @usageType and
+ * @usageID if @uuid is NULL, and returns a copy of its value without
+ * creating a virSecretPtr first. */
+typedef unsigned char *
+(*virDrvSecretLookupValue)(virConnectPtr conn,
+                           const unsigned char *uuid,
+                           int usageType,
+                           const char *usageID,
+                           size_t *value_size,
+                           unsigned int internalFlags);
+
 typedef int
 (*virDrvSecretUndefine)(virSecretPtr secret);
 
@@ -109,6 +120,7 @@ struct _virSecretDriver {
     virDrvSecretGetXMLDesc secretGetXMLDesc;
     virDrvSecretSetValue secretSetValue;
     virDrvSecretGetValue secretGetValue;
+    virDrvSecretLookupValue secretLookupValue;
     virDrvSecretUndefine secretUndefine;
     virDrvConnectSecretEventRegisterAny connectSecretEventRegisterAny;
     virDrvConnectSecretEventDeregisterAny connectSecretEventDeregisterAny;
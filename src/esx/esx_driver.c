@@ -1022,27 +1022,16 @@ static int
 esxConnectClose(virConnectPtr conn)
 {
     esxPrivate *priv = conn->privateData;
-    int result = 0;
 
-    if (priv->host) {
-        if (esxVI_EnsureSession(priv->host) < 0 ||
-            esxVI_Logout(priv->host) < 0) {
-            result = -1;
-        }
-    }
-
-    if (priv->vCenter) {
-        if (esxVI_EnsureSession(priv->vCenter) < 0 ||
-            esxVI_Logout(priv->vCenter) < 0) {
-            result = -1;
-        }
-    }
+    /* Keep the sessions for later connections, the pool logs them out */
+    esxVI_SessionPool_Put(&priv->host);
+    esxVI_SessionPool_Put(&priv->vCenter);
 
     esxFreePrivate(&priv);
 
     conn->privateData = NULL;
 
-    return result;
+    return 0;
 }
 
 
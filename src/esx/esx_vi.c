@@ -36,6 +36,8 @@
 #include "esx_vi_methods.h"
 #include "esx_util.h"
 #include "virstring.h"
+#include "virtime.h"
+#include "viratomic.h"
 
 #define VIR_FROM_THIS VIR_FROM_ESX
 
@@ -82,6 +84,43 @@ VIR_LOG_INIT("esx.esx_vi");
 
 
 
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Process-wide state
+ */
+
+typedef struct _esxVI_PooledContext esxVI_PooledContext;
+
+struct _esxVI_PooledContext {
+    esxVI_Context *ctx;
+    unsigned long long since; /* when it was put into the pool in ms */
+};
+
+static virMutex esxVI_GlobalLock; /* protects the members below */
+static esxVI_SharedCURL *esxVI_GlobalSharedCURL; /* DNS and TLS sessions */
+static esxVI_PooledContext *esxVI_SessionPool;
+static size_t esxVI_SessionPoolCount;
+
+static int
+esxVI_GlobalOnceInit(void)
+{
+    if (virMutexInit(&esxVI_GlobalLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Could not initialize session pool mutex"));
+        return -1;
+    }
+
+    if (esxVI_SharedCURL_Alloc(&esxVI_GlobalSharedCURL) < 0)
+        return -1;
+
+    esxVI_GlobalSharedCURL->separateCookies = true;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(esxVI_Global)
+
+
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * CURL
  */
@@ -95,7 +134,11 @@ ESX_VI__TEMPLATE__FREE(CURL,
     esxVI_SharedCURL *shared = item->shared;
     esxVI_MultiCURL *multi = item->multi;
 
-    if (shared) {
+    if (shared && shared == esxVI_GlobalSharedCURL) {
+        virMutexLock(&esxVI_GlobalLock);
+        esxVI_SharedCURL_Remove(shared, item);
+        virMutexUnlock(&esxVI_GlobalLock);
+    } else if (shared) {
         esxVI_SharedCURL_Remove(shared, item);
 
         if (shared->count == 0)
@@ -294,6 +337,8 @@ esxVI_CURL_Perform(esxVI_CURL *curl, const char *url)
 int
 esxVI_CURL_Connect(esxVI_CURL *curl, esxUtil_ParsedUri *parsedUri)
 {
+    int result;
+
     if (curl->handle) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("Invalid call"));
         return -1;
@@ -361,7 +406,15 @@ esxVI_CURL_Connect(esxVI_CURL *curl, esxUtil_ParsedUri *parsedUri)
         return -1;
     }
 
-    return 0;
+    /* Resolve names and do full TLS handshakes once per host and process */
+    if (esxVI_GlobalInitialize() < 0)
+        return -1;
+
+    virMutexLock(&esxVI_GlobalLock);
+    result = esxVI_SharedCURL_Add(esxVI_GlobalSharedCURL, curl);
+    virMutexUnlock(&esxVI_GlobalLock);
+
+    return result;
 }
 
 int
@@ -496,6 +549,10 @@ esxVI_SharedCURL_Lock(CURL *handle ATTRIBUTE_UNUSED, curl_lock_data data,
         i = 2;
         break;
 
+      case CURL_LOCK_DATA_SSL_SESSION:
+        i = 3;
+        break;
+
       default:
         VIR_ERROR(_("Trying to lock unknown SharedCURL lock %d"), (int)data);
         return;
@@ -524,6 +581,10 @@ esxVI_SharedCURL_Unlock(CURL *handle ATTRIBUTE_UNUSED, curl_lock_data data,
         i = 2;
         break;
 
+      case CURL_LOCK_DATA_SSL_SESSION:
+        i = 3;
+        break;
+
       default:
         VIR_ERROR(_("Trying to unlock unknown SharedCURL lock %d"), (int)data);
         return;
@@ -584,10 +645,14 @@ esxVI_SharedCURL_Add(esxVI_SharedCURL *shared, esxVI_CURL *curl)
         curl_share_setopt(shared->handle, CURLSHOPT_UNLOCKFUNC,
                           esxVI_SharedCURL_Unlock);
         curl_share_setopt(shared->handle, CURLSHOPT_USERDATA, shared);
-        curl_share_setopt(shared->handle, CURLSHOPT_SHARE,
-                          CURL_LOCK_DATA_COOKIE);
+        if (!shared->separateCookies) {
+            curl_share_setopt(shared->handle, CURLSHOPT_SHARE,
+                              CURL_LOCK_DATA_COOKIE);
+        }
         curl_share_setopt(shared->handle, CURLSHOPT_SHARE,
                           CURL_LOCK_DATA_DNS);
+        curl_share_setopt(shared->handle, CURLSHOPT_SHARE,
+                          CURL_LOCK_DATA_SSL_SESSION);
 
         for (i = 0; i < ARRAY_CARDINALITY(shared->locks); ++i) {
             if (virMutexInit(&shared->locks[i]) < 0) {
@@ -989,6 +1054,8 @@ ESX_VI__TEMPLATE__FREE(Context,
     esxVI_SelectionSpec_Free(&item->selectSet_computeResourceToHost);
     esxVI_SelectionSpec_Free(&item->selectSet_computeResourceToParentToParent);
     esxVI_SelectionSpec_Free(&item->selectSet_datacenterToNetwork);
+    esxVI_PropertyCache_Free(&item->propertyCache);
+    VIR_FREE(item->poolKey);
 })
 
 int
@@ -998,6 +1065,8 @@ esxVI_Context_Connect(esxVI_Context *ctx, const char *url,
 {
     int result = -1;
     char *escapedPassword = NULL;
+    char *poolKey = NULL;
+    esxVI_Context *pooled = NULL;
 
     if (!ctx || !url || !ipAddress || !username ||
         !password || ctx->url || ctx->service || ctx->curl) {
@@ -1005,6 +1074,27 @@ esxVI_Context_Connect(esxVI_Context *ctx, const char *url,
         return -1;
     }
 
+    if (!(poolKey = esxVI_SessionPool_Key(url, ipAddress, username,
+                                          parsedUri))) {
+        return -1;
+    }
+
+    /* Reuse the connection and session of an earlier context if possible */
+    if ((pooled = esxVI_SessionPool_Take(poolKey, password))) {
+        if (esxVI_EnsureSession(pooled) < 0) {
+            VIR_DEBUG("Cannot reuse pooled session: %s",
+                      virGetLastErrorMessage());
+            virResetLastError();
+            esxVI_Context_Free(&pooled);
+        } else {
+            *ctx = *pooled;
+            VIR_FREE(pooled);
+            VIR_FREE(poolKey);
+
+            return 0;
+        }
+    }
+
     escapedPassword = esxUtil_EscapeForXml(password);
 
     if (!escapedPassword) {
@@ -1119,6 +1209,12 @@ esxVI_Context_Connect(esxVI_Context *ctx, const char *url,
     if (ctx->productLine == esxVI_ProductLine_VPX)
         ctx->hasSessionIsActive = true;
 
+    /* WaitForUpdatesEx was added in VI API 4.1 */
+    if (ctx->apiVersion >= 1000000 * 4 + 1000 * 1 /* 4.1 */ &&
+        esxVI_PropertyCache_Alloc(&ctx->propertyCache) < 0) {
+        goto cleanup;
+    }
+
 
 
     if (esxVI_Login(ctx, username, escapedPassword, NULL, &ctx->session) < 0 ||
@@ -1126,10 +1222,14 @@ esxVI_Context_Connect(esxVI_Context *ctx, const char *url,
         goto cleanup;
     }
 
+    ctx->poolKey = poolKey;
+    poolKey = NULL;
+
     result = 0;
 
  cleanup:
     VIR_FREE(escapedPassword);
+    VIR_FREE(poolKey);
 
     return result;
 }
@@ -1409,6 +1509,21 @@ esxVI_Context_LookupManagedObjectsByHostSystemIp(esxVI_Context *ctx,
     return result;
 }
 
+/* Methods that don't change properties the PropertyCache may hold */
+static const char *esxVI_ReadOnlyMethods[] = {
+    "CreateFilter",
+    "CreatePropertyCollector",
+    "DestroyPropertyFilter",
+    "FindByIp",
+    "FindByUuid",
+    "QueryPerf",
+    "QueryPerfCounter",
+    "RetrieveProperties",
+    "SessionIsActive",
+    "WaitForUpdatesEx",
+    NULL
+};
+
 int
 esxVI_Context_Execute(esxVI_Context *ctx, const char *methodName,
                       const char *request, esxVI_Response **response,
@@ -1429,6 +1544,11 @@ esxVI_Context_Execute(esxVI_Context *ctx, const char *methodName,
     if (esxVI_Response_Alloc(response) < 0)
         return -1;
 
+    if (ctx->propertyCache &&
+        !virStringListHasString(esxVI_ReadOnlyMethods, methodName)) {
+        esxVI_PropertyCache_Invalidate(ctx->propertyCache);
+    }
+
     virMutexLock(&ctx->curl->lock);
 
     curl_easy_setopt(ctx->curl->handle, CURLOPT_URL, ctx->url);
@@ -1906,6 +2026,697 @@ esxVI_List_Deserialize(xmlNodePtr node, esxVI_List **list,
 
 
 
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * PropertyCache
+ */
+
+/* Poll at most this often in ms while nothing changed on this side */
+#define ESX_VI__PROPERTY_CACHE__MAX_AGE 1000
+
+int
+esxVI_PropertyCache_Alloc(esxVI_PropertyCache **cache)
+{
+    if (!cache || *cache) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("Invalid argument"));
+        return -1;
+    }
+
+    if (VIR_ALLOC(*cache) < 0)
+        return -1;
+
+    if (virMutexInit(&(*cache)->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Could not initialize property cache mutex"));
+        VIR_FREE(*cache);
+        return -1;
+    }
+
+    (*cache)->stale = 1;
+
+    return 0;
+}
+
+static void
+esxVI_PropertyCache_Reset(esxVI_PropertyCache *cache)
+{
+    esxVI_ManagedObjectReference_Free(&cache->propertyCollector);
+    esxVI_ManagedObjectReference_Free(&cache->propertyFilter);
+    esxVI_String_Free(&cache->propertyNameList);
+    VIR_FREE(cache->version);
+    esxVI_ObjectContent_Free(&cache->objectContentList);
+    virAtomicIntSet(&cache->stale, 1);
+}
+
+/* esxVI_PropertyCache_Free */
+ESX_VI__TEMPLATE__FREE(PropertyCache,
+{
+    esxVI_PropertyCache_Reset(item);
+    virMutexDestroy(&item->lock);
+})
+
+void
+esxVI_PropertyCache_Invalidate(esxVI_PropertyCache *cache)
+{
+    virAtomicIntSet(&cache->stale, 1);
+}
+
+/*
+ * Removes the property filter but keeps the property collector, it lives as
+ * long as the session does.
+ */
+static int
+esxVI_PropertyCache_Clear(esxVI_Context *ctx, esxVI_PropertyCache *cache)
+{
+    int result = 0;
+
+    virMutexLock(&cache->lock);
+
+    if (cache->propertyFilter &&
+        esxVI_DestroyPropertyFilter(ctx, cache->propertyFilter) < 0) {
+        result = -1;
+    }
+
+    esxVI_ManagedObjectReference_Free(&cache->propertyFilter);
+    esxVI_String_Free(&cache->propertyNameList);
+    VIR_FREE(cache->version);
+    esxVI_ObjectContent_Free(&cache->objectContentList);
+    virAtomicIntSet(&cache->stale, 1);
+
+    virMutexUnlock(&cache->lock);
+
+    return result;
+}
+
+/*
+ * Replaces the property filter by one that also covers propertyNameList.
+ * The new filter reports all objects again, so the cached ones are dropped.
+ */
+static int
+esxVI_PropertyCache_CreateFilter(esxVI_Context *ctx,
+                                 esxVI_PropertyCache *cache,
+                                 esxVI_String *propertyNameList)
+{
+    int result = -1;
+    esxVI_String *completePropertyNameList = NULL;
+    esxVI_String *propertyName;
+    esxVI_ObjectSpec *objectSpec = NULL;
+    bool objectSpec_isAppended = false;
+    esxVI_PropertySpec *propertySpec = NULL;
+    bool propertySpec_isAppended = false;
+    esxVI_PropertyFilterSpec *propertyFilterSpec = NULL;
+
+    if (esxVI_String_DeepCopyList(&completePropertyNameList,
+                                  cache->propertyNameList) < 0)
+        return -1;
+
+    for (propertyName = propertyNameList; propertyName;
+         propertyName = propertyName->_next) {
+        if (!esxVI_String_ListContainsValue(completePropertyNameList,
+                                            propertyName->value) &&
+            esxVI_String_AppendValueToList(&completePropertyNameList,
+                                           propertyName->value) < 0) {
+            goto cleanup;
+        }
+    }
+
+    if (!cache->propertyCollector &&
+        esxVI_CreatePropertyCollector(ctx, ctx->service->propertyCollector,
+                                      &cache->propertyCollector) < 0) {
+        goto cleanup;
+    }
+
+    if (cache->propertyFilter) {
+        if (esxVI_DestroyPropertyFilter(ctx, cache->propertyFilter) < 0)
+            goto cleanup;
+
+        esxVI_ManagedObjectReference_Free(&cache->propertyFilter);
+    }
+
+    if (esxVI_ObjectSpec_Alloc(&objectSpec) < 0)
+        goto cleanup;
+
+    objectSpec->obj = ctx->hostSystem->_reference;
+    objectSpec->skip = esxVI_Boolean_False;
+    objectSpec->selectSet = ctx->selectSet_hostSystemToVm;
+
+    if (esxVI_PropertySpec_Alloc(&propertySpec) < 0)
+        goto cleanup;
+
+    propertySpec->type = (char *)"VirtualMachine";
+    propertySpec->pathSet = completePropertyNameList;
+
+    if (esxVI_PropertyFilterSpec_Alloc(&propertyFilterSpec) < 0 ||
+        esxVI_PropertySpec_AppendToList(&propertyFilterSpec->propSet,
+                                        propertySpec) < 0) {
+        goto cleanup;
+    }
+
+    propertySpec_isAppended = true;
+
+    if (esxVI_ObjectSpec_AppendToList(&propertyFilterSpec->objectSet,
+                                      objectSpec) < 0) {
+        goto cleanup;
+    }
+
+    objectSpec_isAppended = true;
+
+    if (esxVI_CreateFilter(ctx, cache->propertyCollector, propertyFilterSpec,
+                           esxVI_Boolean_False, &cache->propertyFilter) < 0) {
+        goto cleanup;
+    }
+
+    esxVI_String_Free(&cache->propertyNameList);
+    cache->propertyNameList = completePropertyNameList;
+    completePropertyNameList = NULL;
+
+    VIR_FREE(cache->version);
+    esxVI_ObjectContent_Free(&cache->objectContentList);
+    virAtomicIntSet(&cache->stale, 1);
+
+    result = 0;
+
+ cleanup:
+    /* Remove borrowed values, see esxVI_LookupObjectContentByType() */
+    if (objectSpec) {
+        objectSpec->obj = NULL;
+        objectSpec->selectSet = NULL;
+    }
+
+    if (propertySpec) {
+        propertySpec->type = NULL;
+        propertySpec->pathSet = NULL;
+    }
+
+    if (!objectSpec_isAppended)
+        esxVI_ObjectSpec_Free(&objectSpec);
+
+    if (!propertySpec_isAppended)
+        esxVI_PropertySpec_Free(&propertySpec);
+
+    esxVI_PropertyFilterSpec_Free(&propertyFilterSpec);
+    esxVI_String_Free(&completePropertyNameList);
+
+    return result;
+}
+
+static int
+esxVI_PropertyCache_ApplyChange(esxVI_ObjectContent *objectContent,
+                                esxVI_PropertyChange *propertyChange)
+{
+    esxVI_DynamicProperty **next = &objectContent->propSet;
+    esxVI_DynamicProperty *dynamicProperty = NULL;
+
+    while (*next && STRNEQ((*next)->name, propertyChange->name))
+        next = &(*next)->_next;
+
+    if (*next) {
+        dynamicProperty = *next;
+        *next = dynamicProperty->_next;
+        dynamicProperty->_next = NULL;
+        esxVI_DynamicProperty_Free(&dynamicProperty);
+    }
+
+    if ((propertyChange->op != esxVI_PropertyChangeOp_Add &&
+         propertyChange->op != esxVI_PropertyChangeOp_Assign) ||
+        !propertyChange->val) {
+        return 0;
+    }
+
+    if (esxVI_DynamicProperty_Alloc(&dynamicProperty) < 0 ||
+        VIR_STRDUP(dynamicProperty->name, propertyChange->name) < 0 ||
+        esxVI_AnyType_DeepCopy(&dynamicProperty->val,
+                               propertyChange->val) < 0 ||
+        esxVI_DynamicProperty_AppendToList(&objectContent->propSet,
+                                           dynamicProperty) < 0) {
+        esxVI_DynamicProperty_Free(&dynamicProperty);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+esxVI_PropertyCache_ApplyUpdateSet(esxVI_PropertyCache *cache,
+                                   esxVI_UpdateSet *updateSet)
+{
+    esxVI_PropertyFilterUpdate *propertyFilterUpdate;
+    esxVI_ObjectUpdate *objectUpdate;
+    esxVI_PropertyChange *propertyChange;
+    esxVI_ObjectContent **next;
+    esxVI_ObjectContent *objectContent = NULL;
+
+    for (propertyFilterUpdate = updateSet->filterSet; propertyFilterUpdate;
+         propertyFilterUpdate = propertyFilterUpdate->_next) {
+        for (objectUpdate = propertyFilterUpdate->objectSet; objectUpdate;
+             objectUpdate = objectUpdate->_next) {
+            next = &cache->objectContentList;
+
+            while (*next && STRNEQ((*next)->obj->value,
+                                   objectUpdate->obj->value)) {
+                next = &(*next)->_next;
+            }
+
+            if (objectUpdate->kind == esxVI_ObjectUpdateKind_Leave) {
+                if (*next) {
+                    objectContent = *next;
+                    *next = objectContent->_next;
+                    objectContent->_next = NULL;
+                    esxVI_ObjectContent_Free(&objectContent);
+                }
+
+                continue;
+            }
+
+            if (!(*next)) {
+                if (esxVI_ObjectContent_Alloc(&objectContent) < 0 ||
+                    esxVI_ManagedObjectReference_DeepCopy
+                      (&objectContent->obj, objectUpdate->obj) < 0) {
+                    esxVI_ObjectContent_Free(&objectContent);
+                    return -1;
+                }
+
+                *next = objectContent;
+                objectContent = NULL;
+            }
+
+            for (propertyChange = objectUpdate->changeSet; propertyChange;
+                 propertyChange = propertyChange->_next) {
+                if (esxVI_PropertyCache_ApplyChange(*next,
+                                                    propertyChange) < 0) {
+                    return -1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Makes the cache cover propertyNameList and fetches the changes since the
+ * last call. Skips asking the server if it did so very recently and no call
+ * that may have changed something was made since then.
+ */
+static int
+esxVI_PropertyCache_Update(esxVI_Context *ctx, esxVI_PropertyCache *cache,
+                           esxVI_String *propertyNameList)
+{
+    int result = -1;
+    esxVI_String *propertyName;
+    esxVI_WaitOptions *waitOptions = NULL;
+    esxVI_UpdateSet *updateSet = NULL;
+    unsigned long long now;
+
+    for (propertyName = propertyNameList; propertyName;
+         propertyName = propertyName->_next) {
+        if (!esxVI_String_ListContainsValue(cache->propertyNameList,
+                                            propertyName->value))
+            break;
+    }
+
+    if ((propertyName || !cache->propertyFilter) &&
+        esxVI_PropertyCache_CreateFilter(ctx, cache, propertyNameList) < 0) {
+        return -1;
+    }
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    if (cache->version && !virAtomicIntGet(&cache->stale) &&
+        now < cache->updated + ESX_VI__PROPERTY_CACHE__MAX_AGE) {
+        return 0;
+    }
+
+    /* Clear it first so changes made during the poll aren't lost */
+    virAtomicIntSet(&cache->stale, 0);
+
+    if (esxVI_WaitOptions_Alloc(&waitOptions) < 0 ||
+        esxVI_Int_Alloc(&waitOptions->maxWaitSeconds) < 0) {
+        goto cleanup;
+    }
+
+    waitOptions->maxWaitSeconds->value = 0;
+
+    do {
+        esxVI_UpdateSet_Free(&updateSet);
+
+        if (esxVI_WaitForUpdatesEx(ctx, cache->propertyCollector,
+                                   cache->version, waitOptions,
+                                   &updateSet) < 0) {
+            goto cleanup;
+        }
+
+        /* Nothing changed since the last version */
+        if (!updateSet)
+            break;
+
+        if (esxVI_PropertyCache_ApplyUpdateSet(cache, updateSet) < 0)
+            goto cleanup;
+
+        VIR_FREE(cache->version);
+        if (VIR_STRDUP(cache->version, updateSet->version) < 0)
+            goto cleanup;
+    } while (updateSet->truncated == esxVI_Boolean_True);
+
+    cache->updated = now;
+    result = 0;
+
+ cleanup:
+    esxVI_WaitOptions_Free(&waitOptions);
+    esxVI_UpdateSet_Free(&updateSet);
+
+    return result;
+}
+
+static int
+esxVI_PropertyCache_Copy(esxVI_ObjectContent *candidate,
+                         esxVI_String *propertyNameList,
+                         esxVI_ObjectContent **objectContentList)
+{
+    esxVI_ObjectContent *objectContent = NULL;
+    esxVI_DynamicProperty *dynamicProperty;
+    esxVI_DynamicProperty *copy = NULL;
+
+    if (esxVI_ObjectContent_Alloc(&objectContent) < 0 ||
+        esxVI_ManagedObjectReference_DeepCopy(&objectContent->obj,
+                                              candidate->obj) < 0) {
+        goto failure;
+    }
+
+    for (dynamicProperty = candidate->propSet; dynamicProperty;
+         dynamicProperty = dynamicProperty->_next) {
+        if (!esxVI_String_ListContainsValue(propertyNameList,
+                                            dynamicProperty->name)) {
+            continue;
+        }
+
+        if (esxVI_DynamicProperty_DeepCopy(&copy, dynamicProperty) < 0 ||
+            esxVI_DynamicProperty_AppendToList(&objectContent->propSet,
+                                               copy) < 0) {
+            goto failure;
+        }
+
+        copy = NULL;
+    }
+
+    if (esxVI_ObjectContent_AppendToList(objectContentList,
+                                         objectContent) < 0) {
+        goto failure;
+    }
+
+    return 0;
+
+ failure:
+    esxVI_DynamicProperty_Free(&copy);
+    esxVI_ObjectContent_Free(&objectContent);
+
+    return -1;
+}
+
+/*
+ * Looks up the virtual machines of ctx->hostSystem, or a single one of them.
+ * Returns false without reporting an error if the lookup cannot be answered
+ * from the cache, the caller has to ask the server directly then.
+ */
+bool
+esxVI_PropertyCache_Lookup(esxVI_Context *ctx,
+                           esxVI_ManagedObjectReference *root,
+                           esxVI_String *propertyNameList,
+                           esxVI_ObjectContent **objectContentList)
+{
+    esxVI_PropertyCache *cache = ctx->propertyCache;
+    esxVI_ObjectContent *candidate;
+    bool isHostSystem;
+    bool found = false;
+
+    if (!cache || !ctx->hostSystem || *objectContentList)
+        return false;
+
+    isHostSystem = STREQ(root->type, "HostSystem");
+
+    if ((!isHostSystem && STRNEQ(root->type, "VirtualMachine")) ||
+        (isHostSystem &&
+         STRNEQ(root->value, ctx->hostSystem->_reference->value))) {
+        return false;
+    }
+
+    virMutexLock(&cache->lock);
+
+    if (esxVI_PropertyCache_Update(ctx, cache, propertyNameList) < 0) {
+        VIR_DEBUG("Dropping property cache: %s", virGetLastErrorMessage());
+        virResetLastError();
+        esxVI_PropertyCache_Reset(cache);
+        goto cleanup;
+    }
+
+    for (candidate = cache->objectContentList; candidate;
+         candidate = candidate->_next) {
+        if (!isHostSystem && STRNEQ(candidate->obj->value, root->value))
+            continue;
+
+        if (esxVI_PropertyCache_Copy(candidate, propertyNameList,
+                                     objectContentList) < 0) {
+            virResetLastError();
+            esxVI_ObjectContent_Free(objectContentList);
+            goto cleanup;
+        }
+
+        if (!isHostSystem)
+            break;
+    }
+
+    /* A virtual machine unknown to the cache might be on another host */
+    found = isHostSystem || *objectContentList != NULL;
+
+ cleanup:
+    virMutexUnlock(&cache->lock);
+
+    return found;
+}
+
+/*
+ * Like esxVI_PropertyCache_Lookup() but matches config.uuid, as FindByUuid
+ * would do.
+ */
+bool
+esxVI_PropertyCache_LookupByUuid(esxVI_Context *ctx,
+                                 const unsigned char *uuid,
+                                 esxVI_String *propertyNameList,
+                                 esxVI_ObjectContent **virtualMachine)
+{
+    esxVI_PropertyCache *cache = ctx->propertyCache;
+    esxVI_String *completePropertyNameList = NULL;
+    esxVI_ObjectContent *candidate;
+    esxVI_DynamicProperty *dynamicProperty;
+    unsigned char candidateUuid[VIR_UUID_BUFLEN];
+    bool found = false;
+
+    if (!cache || !ctx->hostSystem || *virtualMachine)
+        return false;
+
+    if (esxVI_String_DeepCopyList(&completePropertyNameList,
+                                  propertyNameList) < 0 ||
+        (!esxVI_String_ListContainsValue(completePropertyNameList,
+                                         "config.uuid") &&
+         esxVI_String_AppendValueToList(&completePropertyNameList,
+                                        "config.uuid") < 0)) {
+        virResetLastError();
+        esxVI_String_Free(&completePropertyNameList);
+        return false;
+    }
+
+    virMutexLock(&cache->lock);
+
+    if (esxVI_PropertyCache_Update(ctx, cache, completePropertyNameList) < 0) {
+        VIR_DEBUG("Dropping property cache: %s", virGetLastErrorMessage());
+        virResetLastError();
+        esxVI_PropertyCache_Reset(cache);
+        goto cleanup;
+    }
+
+    for (candidate = cache->objectContentList; candidate;
+         candidate = candidate->_next) {
+        for (dynamicProperty = candidate->propSet; dynamicProperty;
+             dynamicProperty = dynamicProperty->_next) {
+            if (STREQ(dynamicProperty->name, "config.uuid"))
+                break;
+        }
+
+        if (!dynamicProperty ||
+            dynamicProperty->val->type != esxVI_Type_String ||
+            virUUIDParse(dynamicProperty->val->string, candidateUuid) < 0 ||
+            memcmp(uuid, candidateUuid, VIR_UUID_BUFLEN) != 0) {
+            continue;
+        }
+
+        if (esxVI_PropertyCache_Copy(candidate, propertyNameList,
+                                     virtualMachine) < 0) {
+            virResetLastError();
+            goto cleanup;
+        }
+
+        found = true;
+        break;
+    }
+
+ cleanup:
+    virMutexUnlock(&cache->lock);
+    esxVI_String_Free(&completePropertyNameList);
+
+    return found;
+}
+
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * SessionPool
+ */
+
+/* Keep this many idle sessions per process for at most this many ms */
+#define ESX_VI__SESSION_POOL__SIZE 8
+#define ESX_VI__SESSION_POOL__MAX_IDLE (5 * 60 * 1000)
+
+char *
+esxVI_SessionPool_Key(const char *url, const char *ipAddress,
+                      const char *username, esxUtil_ParsedUri *parsedUri)
+{
+    char *key = NULL;
+
+    ignore_value(virAsprintf(&key, "%s %s %s %d %d %d %s %d", url, ipAddress,
+                             username, parsedUri->noVerify, parsedUri->proxy,
+                             parsedUri->proxy_type,
+                             NULLSTR(parsedUri->proxy_hostname),
+                             parsedUri->proxy_port));
+
+    return key;
+}
+
+static void
+esxVI_SessionPool_Discard(esxVI_Context **ctx)
+{
+    if (esxVI_Logout(*ctx) < 0) {
+        VIR_DEBUG("Logout of pooled session failed: %s",
+                  virGetLastErrorMessage());
+        virResetLastError();
+    }
+
+    esxVI_Context_Free(ctx);
+}
+
+/* Must be called with esxVI_GlobalLock held */
+static void
+esxVI_SessionPool_Expire(unsigned long long now, size_t keep,
+                         esxVI_Context **expired, size_t *nexpired)
+{
+    while (esxVI_SessionPoolCount > 0 &&
+           (esxVI_SessionPoolCount > keep ||
+            esxVI_SessionPool[0].since + ESX_VI__SESSION_POOL__MAX_IDLE < now)) {
+        expired[(*nexpired)++] = esxVI_SessionPool[0].ctx;
+        VIR_DELETE_ELEMENT(esxVI_SessionPool, 0, esxVI_SessionPoolCount);
+    }
+}
+
+/*
+ * Returns a logged in context for the same key and password that was put
+ * into the pool by esxVI_SessionPool_Put() before, or NULL.
+ */
+esxVI_Context *
+esxVI_SessionPool_Take(const char *key, const char *password)
+{
+    esxVI_Context *expired[ESX_VI__SESSION_POOL__SIZE];
+    size_t nexpired = 0;
+    esxVI_Context *ctx = NULL;
+    unsigned long long now;
+    size_t i;
+
+    if (esxVI_GlobalInitialize() < 0 || virTimeMillisNow(&now) < 0) {
+        virResetLastError();
+        return NULL;
+    }
+
+    virMutexLock(&esxVI_GlobalLock);
+
+    esxVI_SessionPool_Expire(now, ESX_VI__SESSION_POOL__SIZE,
+                             expired, &nexpired);
+
+    /* Prefer the most recently used session, it's the least likely to have
+     * timed out on the server */
+    for (i = esxVI_SessionPoolCount; i > 0; i--) {
+        if (STREQ(esxVI_SessionPool[i - 1].ctx->poolKey, key) &&
+            STREQ(esxVI_SessionPool[i - 1].ctx->password, password)) {
+            ctx = esxVI_SessionPool[i - 1].ctx;
+            VIR_DELETE_ELEMENT(esxVI_SessionPool, i - 1,
+                               esxVI_SessionPoolCount);
+            break;
+        }
+    }
+
+    virMutexUnlock(&esxVI_GlobalLock);
+
+    for (i = 0; i < nexpired; i++)
+        esxVI_SessionPool_Discard(&expired[i]);
+
+    return ctx;
+}
+
+/*
+ * Drops everything from ctx that is specific to the connection and keeps its
+ * session for reuse by a later connect with the same parameters. Sessions
+ * that cannot be reused are logged out. Frees ctx in any case.
+ */
+void
+esxVI_SessionPool_Put(esxVI_Context **ctx)
+{
+    esxVI_Context *expired[ESX_VI__SESSION_POOL__SIZE + 1];
+    size_t nexpired = 0;
+    esxVI_PooledContext pooled = { *ctx, 0 };
+    size_t i;
+
+    *ctx = NULL;
+
+    if (!pooled.ctx)
+        return;
+
+    if (!pooled.ctx->session) {
+        esxVI_Context_Free(&pooled.ctx);
+        return;
+    }
+
+    if (!pooled.ctx->poolKey || esxVI_GlobalInitialize() < 0 ||
+        virTimeMillisNow(&pooled.since) < 0 ||
+        (pooled.ctx->propertyCache &&
+         esxVI_PropertyCache_Clear(pooled.ctx, pooled.ctx->propertyCache) < 0)) {
+        virResetLastError();
+        esxVI_SessionPool_Discard(&pooled.ctx);
+        return;
+    }
+
+    esxVI_Datacenter_Free(&pooled.ctx->datacenter);
+    VIR_FREE(pooled.ctx->datacenterPath);
+    esxVI_ComputeResource_Free(&pooled.ctx->computeResource);
+    VIR_FREE(pooled.ctx->computeResourcePath);
+    esxVI_HostSystem_Free(&pooled.ctx->hostSystem);
+    VIR_FREE(pooled.ctx->hostSystemName);
+
+    virMutexLock(&esxVI_GlobalLock);
+
+    esxVI_SessionPool_Expire(pooled.since, ESX_VI__SESSION_POOL__SIZE - 1,
+                             expired, &nexpired);
+
+    if (VIR_APPEND_ELEMENT(esxVI_SessionPool, esxVI_SessionPoolCount,
+                           pooled) < 0) {
+        virResetLastError();
+        expired[nexpired++] = pooled.ctx;
+    }
+
+    virMutexUnlock(&esxVI_GlobalLock);
+
+    for (i = 0; i < nexpired; i++)
+        esxVI_SessionPool_Discard(&expired[i]);
+}
+
+
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * Utility and Convenience Functions
  *
@@ -2256,7 +3067,10 @@ esxVI_LookupObjectContentByType(esxVI_Context *ctx,
 
     objectSpec_isAppended = true;
 
-    if (esxVI_RetrieveProperties(ctx, propertyFilterSpec,
+    if (!(STREQ(type, "VirtualMachine") &&
+          esxVI_PropertyCache_Lookup(ctx, root, propertyNameList,
+                                     objectContentList)) &&
+        esxVI_RetrieveProperties(ctx, propertyFilterSpec,
                                  objectContentList) < 0) {
         goto cleanup;
     }
@@ -2919,6 +3733,11 @@ esxVI_LookupVirtualMachineByUuid(esxVI_Context *ctx, const unsigned char *uuid,
         return -1;
     }
 
+    if (esxVI_PropertyCache_LookupByUuid(ctx, uuid, propertyNameList,
+                                         virtualMachine)) {
+        return 0;
+    }
+
     virUUIDFormat(uuid, uuid_string);
 
     if (esxVI_FindByUuid(ctx, ctx->datacenter->_reference, uuid_string,
@@ -4541,7 +5360,8 @@ esxVI_WaitForTaskCompletion(esxVI_Context *ctx,
 
     objectSpec_isAppended = true;
 
-    if (esxVI_CreateFilter(ctx, propertyFilterSpec, esxVI_Boolean_True,
+    if (esxVI_CreateFilter(ctx, ctx->service->propertyCollector,
+                           propertyFilterSpec, esxVI_Boolean_True,
                            &propertyFilter) < 0) {
         goto cleanup;
     }
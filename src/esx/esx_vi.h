@@ -86,6 +86,7 @@ typedef struct _esxVI_Response esxVI_Response;
 typedef struct _esxVI_Enumeration esxVI_Enumeration;
 typedef struct _esxVI_EnumerationValue esxVI_EnumerationValue;
 typedef struct _esxVI_List esxVI_List;
+typedef struct _esxVI_PropertyCache esxVI_PropertyCache;
 
 
 
@@ -142,8 +143,10 @@ int esxVI_CURL_Upload(esxVI_CURL *curl, const char *url, const char *content);
 
 struct _esxVI_SharedCURL {
     CURLSH *handle;
-    virMutex locks[3]; /* share, cookie, dns */
+    virMutex locks[4]; /* share, cookie, dns, ssl session */
     size_t count; /* number of added easy handle */
+    bool separateCookies; /* set before the first add to keep VI sessions
+                           * of the easy handles apart */
 };
 
 int esxVI_SharedCURL_Alloc(esxVI_SharedCURL **shared);
@@ -210,6 +213,8 @@ struct _esxVI_Context {
     esxVI_SelectionSpec *selectSet_datacenterToNetwork;
     bool hasQueryVirtualDiskUuid;
     bool hasSessionIsActive;
+    esxVI_PropertyCache *propertyCache; /* optional, has its own mutex */
+    char *poolKey; /* connect parameters, see esxVI_SessionPool_Put */
 };
 
 int esxVI_Context_Alloc(esxVI_Context **ctx);
@@ -299,6 +304,56 @@ int esxVI_List_Deserialize(xmlNodePtr node, esxVI_List **list,
 
 
 
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * PropertyCache
+ *
+ * Keeps the properties of the virtual machines of ctx->hostSystem up to date
+ * through a property filter on a dedicated property collector, so lookups are
+ * answered locally and only the changes are fetched via WaitForUpdatesEx.
+ * Properties are added to the filter as lookups ask for them.
+ */
+
+struct _esxVI_PropertyCache {
+    virMutex lock;
+    esxVI_ManagedObjectReference *propertyCollector;
+    esxVI_ManagedObjectReference *propertyFilter;
+    esxVI_String *propertyNameList; /* properties covered by the filter */
+    char *version;
+    esxVI_ObjectContent *objectContentList;
+    unsigned long long updated; /* time of the last WaitForUpdatesEx in ms */
+    int stale; /* atomic, set by every call that may change properties */
+};
+
+int esxVI_PropertyCache_Alloc(esxVI_PropertyCache **cache);
+void esxVI_PropertyCache_Free(esxVI_PropertyCache **cache);
+void esxVI_PropertyCache_Invalidate(esxVI_PropertyCache *cache);
+bool esxVI_PropertyCache_Lookup(esxVI_Context *ctx,
+                                esxVI_ManagedObjectReference *root,
+                                esxVI_String *propertyNameList,
+                                esxVI_ObjectContent **objectContentList);
+bool esxVI_PropertyCache_LookupByUuid(esxVI_Context *ctx,
+                                      const unsigned char *uuid,
+                                      esxVI_String *propertyNameList,
+                                      esxVI_ObjectContent **virtualMachine);
+
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * SessionPool
+ *
+ * Closed contexts keep their CURL handle, with its open connection, and their
+ * session in a process-wide pool. esxVI_Context_Connect takes them from there
+ * for the same URL, IP address, username, password and CURL options, instead
+ * of doing another TLS handshake and login.
+ */
+
+char *esxVI_SessionPool_Key(const char *url, const char *ipAddress,
+                            const char *username, esxUtil_ParsedUri *parsedUri);
+esxVI_Context *esxVI_SessionPool_Take(const char *key, const char *password);
+void esxVI_SessionPool_Put(esxVI_Context **ctx);
+
+
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * Utility and Convenience Functions
  *
@@ -25,6 +25,8 @@
 
 # include "internal.h"
 # include "virerror.h"
+# include "virhash.h"
+# include "virthread.h"
 # include "hyperv_util.h"
 # include "openwsman.h"
 
@@ -39,6 +41,11 @@ struct _hypervPrivate {
     hypervParsedUri *parsedUri;
     WsManClient *client;
     hypervWmiVersion wmiVersion;
+
+    /* Recent enumeration results of the Msvm_* classes read on hot paths,
+     * see hypervEnumAndPull */
+    virMutex cacheLock;
+    virHashTablePtr cache;
 };
 
 #endif /* __HYPERV_PRIVATE_H__ */
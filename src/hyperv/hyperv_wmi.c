@@ -30,6 +30,8 @@
 #include "viralloc.h"
 #include "viruuid.h"
 #include "virbuffer.h"
+#include "virlog.h"
+#include "virtime.h"
 #include "hyperv_private.h"
 #include "hyperv_wmi.h"
 #include "virstring.h"
@@ -38,6 +40,77 @@
 
 #define VIR_FROM_THIS VIR_FROM_HYPERV
 
+VIR_LOG_INIT("hyperv.hyperv_wmi");
+
+/* Maximum number of items requested by a single pull */
+#define HYPERV_PULL_MAX_ELEMENTS 100
+
+/* Lifetime of the cached enumeration results, in milliseconds */
+#define HYPERV_CACHE_TTL 2000
+
+/* The pull responses of a cached query */
+typedef struct _hypervCacheEntry hypervCacheEntry;
+struct _hypervCacheEntry {
+    unsigned long long expires;
+    WsXmlDocH *responses;
+    size_t nresponses;
+};
+
+static void hypervFreeResponses(WsXmlDocH *responses, size_t nresponses);
+
+static void
+hypervCacheEntryFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    hypervCacheEntry *entry = payload;
+
+    if (entry == NULL)
+        return;
+
+    hypervFreeResponses(entry->responses, entry->nresponses);
+    VIR_FREE(entry);
+}
+
+int
+hypervCacheInit(hypervPrivate *priv)
+{
+    if (virMutexInit(&priv->cacheLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        return -1;
+    }
+
+    if (!(priv->cache = virHashCreate(32, hypervCacheEntryFree))) {
+        virMutexDestroy(&priv->cacheLock);
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+hypervCacheFree(hypervPrivate *priv)
+{
+    if (priv->cache == NULL)
+        return;
+
+    virHashFree(priv->cache);
+    priv->cache = NULL;
+    virMutexDestroy(&priv->cacheLock);
+}
+
+/* Drops all the cached results, to be called whenever a request may have
+ * changed the state of the host */
+void
+hypervCacheFlush(hypervPrivate *priv)
+{
+    if (priv->cache == NULL)
+        return;
+
+    virMutexLock(&priv->cacheLock);
+    virHashRemoveAll(priv->cache);
+    virMutexUnlock(&priv->cacheLock);
+}
+
 
 static int
 hypervGetWmiClassInfo(hypervPrivate *priv, hypervWmiClassInfoListPtr list,
@@ -77,12 +150,13 @@ hypervGetWmiClassInfo(hypervPrivate *priv, hypervWmiClassInfoListPtr list,
 
 static int
 hypervGetWmiClassList(hypervPrivate *priv, hypervWmiClassInfoListPtr wmiInfo,
-                      virBufferPtr query, hypervObject **wmiClass)
+                      virBufferPtr query, bool cache, hypervObject **wmiClass)
 {
     hypervWqlQuery wqlQuery = HYPERV_WQL_QUERY_INITIALIZER;
 
     wqlQuery.info = wmiInfo;
     wqlQuery.query = query;
+    wqlQuery.cache = cache;
 
     return hypervEnumAndPull(priv, &wqlQuery, wmiClass);
 }
@@ -147,42 +221,63 @@ hypervVerifyResponse(WsManClient *client, WsXmlDocH response,
  * Object
  */
 
-/* This function guarantees that wqlQuery->query is reset, even on failure */
-int
-hypervEnumAndPull(hypervPrivate *priv, hypervWqlQueryPtr wqlQuery,
-                  hypervObject **list)
+/* Looks up the items of a pull response, which were checked to be present
+ * when the response was received */
+static WsXmlNodeH
+hypervGetPullResponseItems(WsXmlDocH response)
 {
-    int result = -1;
-    WsSerializerContextH serializerContext;
-    client_opt_t *options = NULL;
-    char *query_string = NULL;
-    hypervWmiClassInfoPtr wmiInfo = NULL;
-    filter_t *filter = NULL;
-    WsXmlDocH response = NULL;
-    char *enumContext = NULL;
-    hypervObject *head = NULL;
-    hypervObject *tail = NULL;
-    WsXmlNodeH node = NULL;
-    XML_TYPE_PTR data = NULL;
-    hypervObject *object;
+    WsXmlNodeH node = ws_xml_get_soap_body(response);
 
-    if (virBufferCheckError(wqlQuery->query) < 0) {
-        virBufferFreeAndReset(wqlQuery->query);
-        return -1;
+    if (node == NULL) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Could not lookup SOAP body"));
+        return NULL;
     }
 
-    query_string = virBufferContentAndReset(wqlQuery->query);
+    node = ws_xml_get_child(node, 0, XML_NS_ENUMERATION, WSENUM_PULL_RESP);
 
-    if (list == NULL || *list != NULL) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("Invalid argument"));
-        VIR_FREE(query_string);
-        return -1;
+    if (node == NULL) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Could not lookup pull response"));
+        return NULL;
     }
 
-    if (hypervGetWmiClassInfo(priv, wqlQuery->info, &wmiInfo) < 0)
-        goto cleanup;
+    node = ws_xml_get_child(node, 0, XML_NS_ENUMERATION, WSENUM_ITEMS);
 
-    serializerContext = wsmc_get_serialization_context(priv->client);
+    if (node == NULL) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Could not lookup pull response items"));
+        return NULL;
+    }
+
+    return node;
+}
+
+static void
+hypervFreeResponses(WsXmlDocH *responses, size_t nresponses)
+{
+    size_t i;
+
+    for (i = 0; i < nresponses; i++)
+        ws_xml_destroy_doc(responses[i]);
+
+    VIR_FREE(responses);
+}
+
+/* Runs the Enumerate/Pull sequence of @query_string and collects the pull
+ * responses containing items. Every pull asks for up to
+ * HYPERV_PULL_MAX_ELEMENTS items, saving a round trip per object. */
+static int
+hypervPullResponses(hypervPrivate *priv, hypervWmiClassInfoPtr wmiInfo,
+                    const char *query_string, WsXmlDocH **responses,
+                    size_t *nresponses)
+{
+    int result = -1;
+    client_opt_t *options = NULL;
+    filter_t *filter = NULL;
+    WsXmlDocH response = NULL;
+    char *enumContext = NULL;
+    WsXmlNodeH node = NULL;
 
     options = wsmc_options_init();
 
@@ -192,6 +287,8 @@ hypervEnumAndPull(hypervPrivate *priv, hypervWqlQueryPtr wqlQuery,
         goto cleanup;
     }
 
+    options->max_elements = HYPERV_PULL_MAX_ELEMENTS;
+
     filter = filter_create_simple(WSM_WQL_FILTER_DIALECT, query_string);
 
     if (filter == NULL) {
@@ -218,64 +315,85 @@ hypervEnumAndPull(hypervPrivate *priv, hypervWqlQueryPtr wqlQuery,
         if (hypervVerifyResponse(priv->client, response, "pull") < 0)
             goto cleanup;
 
-        node = ws_xml_get_soap_body(response);
-
-        if (node == NULL) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("Could not lookup SOAP body"));
+        if (!(node = hypervGetPullResponseItems(response)))
             goto cleanup;
-        }
 
-        node = ws_xml_get_child(node, 0, XML_NS_ENUMERATION, WSENUM_PULL_RESP);
+        if (ws_xml_get_child(node, 0, wmiInfo->resourceUri,
+                             wmiInfo->name) == NULL)
+            break;
+
+        VIR_FREE(enumContext);
+        enumContext = wsmc_get_enum_context(response);
 
-        if (node == NULL) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("Could not lookup pull response"));
+        if (VIR_APPEND_ELEMENT(*responses, *nresponses, response) < 0)
             goto cleanup;
-        }
+    }
 
-        node = ws_xml_get_child(node, 0, XML_NS_ENUMERATION, WSENUM_ITEMS);
+    result = 0;
 
-        if (node == NULL) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("Could not lookup pull response items"));
-            goto cleanup;
-        }
+ cleanup:
+    if (options != NULL)
+        wsmc_options_destroy(options);
 
-        if (ws_xml_get_child(node, 0, wmiInfo->resourceUri,
-                             wmiInfo->name) == NULL)
-            break;
+    if (filter != NULL)
+        filter_destroy(filter);
 
-        data = ws_deserialize(serializerContext, node, wmiInfo->serializerInfo,
-                              wmiInfo->name, wmiInfo->resourceUri, NULL, 0, 0);
+    ws_xml_destroy_doc(response);
+    VIR_FREE(enumContext);
 
-        if (data == NULL) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("Could not deserialize pull response item"));
-            goto cleanup;
-        }
+    return result;
+}
 
-        if (VIR_ALLOC(object) < 0)
+/* Turns all the items of @responses into a list of objects */
+static int
+hypervDeserializeResponses(hypervPrivate *priv, hypervWmiClassInfoPtr wmiInfo,
+                           WsXmlDocH *responses, size_t nresponses,
+                           hypervObject **list)
+{
+    int result = -1;
+    WsSerializerContextH serializerContext;
+    hypervObject *head = NULL;
+    hypervObject *tail = NULL;
+    WsXmlNodeH node = NULL;
+    XML_TYPE_PTR data = NULL;
+    hypervObject *object;
+    size_t i;
+    int j;
+
+    serializerContext = wsmc_get_serialization_context(priv->client);
+
+    for (i = 0; i < nresponses; i++) {
+        if (!(node = hypervGetPullResponseItems(responses[i])))
             goto cleanup;
 
-        object->info = wmiInfo;
-        object->data.common = data;
+        for (j = 0; ws_xml_get_child(node, j, wmiInfo->resourceUri,
+                                     wmiInfo->name) != NULL; j++) {
+            data = ws_deserialize(serializerContext, node,
+                                  wmiInfo->serializerInfo, wmiInfo->name,
+                                  wmiInfo->resourceUri, NULL, j, 0);
+
+            if (data == NULL) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("Could not deserialize pull response item"));
+                goto cleanup;
+            }
 
-        data = NULL;
+            if (VIR_ALLOC(object) < 0)
+                goto cleanup;
 
-        if (head == NULL) {
-            head = object;
-        } else {
-            tail->next = object;
-        }
+            object->info = wmiInfo;
+            object->data.common = data;
 
-        tail = object;
+            data = NULL;
 
-        VIR_FREE(enumContext);
-        enumContext = wsmc_get_enum_context(response);
+            if (head == NULL) {
+                head = object;
+            } else {
+                tail->next = object;
+            }
 
-        ws_xml_destroy_doc(response);
-        response = NULL;
+            tail = object;
+        }
     }
 
     *list = head;
@@ -284,12 +402,6 @@ hypervEnumAndPull(hypervPrivate *priv, hypervWqlQueryPtr wqlQuery,
     result = 0;
 
  cleanup:
-    if (options != NULL)
-        wsmc_options_destroy(options);
-
-    if (filter != NULL)
-        filter_destroy(filter);
-
     if (data != NULL) {
 #if WS_SERIALIZER_FREE_MEM_WORKS
         /* FIXME: ws_serializer_free_mem is broken in openwsman <= 2.2.6,
@@ -301,14 +413,95 @@ hypervEnumAndPull(hypervPrivate *priv, hypervWqlQueryPtr wqlQuery,
 #endif
     }
 
-    VIR_FREE(query_string);
-    ws_xml_destroy_doc(response);
-    VIR_FREE(enumContext);
     hypervFreeObject(priv, head);
 
     return result;
 }
 
+/* This function guarantees that wqlQuery->query is reset, even on failure */
+int
+hypervEnumAndPull(hypervPrivate *priv, hypervWqlQueryPtr wqlQuery,
+                  hypervObject **list)
+{
+    int result = -1;
+    char *query_string = NULL;
+    char *key = NULL;
+    hypervWmiClassInfoPtr wmiInfo = NULL;
+    hypervCacheEntry *entry;
+    WsXmlDocH *responses = NULL;
+    size_t nresponses = 0;
+    unsigned long long now;
+
+    if (virBufferCheckError(wqlQuery->query) < 0) {
+        virBufferFreeAndReset(wqlQuery->query);
+        return -1;
+    }
+
+    query_string = virBufferContentAndReset(wqlQuery->query);
+
+    if (list == NULL || *list != NULL) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("Invalid argument"));
+        VIR_FREE(query_string);
+        return -1;
+    }
+
+    if (hypervGetWmiClassInfo(priv, wqlQuery->info, &wmiInfo) < 0)
+        goto cleanup;
+
+    if (wqlQuery->cache && priv->cache) {
+        if (virAsprintf(&key, "%s\n%s", wmiInfo->resourceUri,
+                        query_string) < 0 ||
+            virTimeMillisNow(&now) < 0)
+            goto cleanup;
+
+        virMutexLock(&priv->cacheLock);
+        if ((entry = virHashLookup(priv->cache, key))) {
+            if (entry->expires > now) {
+                VIR_DEBUG("Using cached result of '%s'", query_string);
+                result = hypervDeserializeResponses(priv, wmiInfo,
+                                                    entry->responses,
+                                                    entry->nresponses, list);
+                virMutexUnlock(&priv->cacheLock);
+                goto cleanup;
+            }
+            virHashRemoveEntry(priv->cache, key);
+        }
+        virMutexUnlock(&priv->cacheLock);
+    }
+
+    if (hypervPullResponses(priv, wmiInfo, query_string,
+                            &responses, &nresponses) < 0 ||
+        hypervDeserializeResponses(priv, wmiInfo,
+                                   responses, nresponses, list) < 0)
+        goto cleanup;
+
+    /* failing to cache the result is not fatal */
+    if (key && VIR_ALLOC_QUIET(entry) == 0) {
+        entry->expires = now + HYPERV_CACHE_TTL;
+        entry->responses = responses;
+        entry->nresponses = nresponses;
+
+        virMutexLock(&priv->cacheLock);
+        if (virHashUpdateEntry(priv->cache, key, entry) == 0) {
+            responses = NULL;
+            nresponses = 0;
+        } else {
+            virResetLastError();
+            VIR_FREE(entry);
+        }
+        virMutexUnlock(&priv->cacheLock);
+    }
+
+    result = 0;
+
+ cleanup:
+    VIR_FREE(query_string);
+    VIR_FREE(key);
+    hypervFreeResponses(responses, nresponses);
+
+    return result;
+}
+
 void
 hypervFreeObject(hypervPrivate *priv ATTRIBUTE_UNUSED, hypervObject *object)
 {
@@ -437,7 +630,7 @@ hypervGetMsvmComputerSystemList(hypervPrivate *priv, virBufferPtr query,
                                 Msvm_ComputerSystem **list)
 {
     return hypervGetWmiClassList(priv, Msvm_ComputerSystem_WmiInfo, query,
-                                 (hypervObject **) list);
+                                 true, (hypervObject **) list);
 }
 
 int
@@ -445,7 +638,7 @@ hypervGetMsvmConcreteJobList(hypervPrivate *priv, virBufferPtr query,
                              Msvm_ConcreteJob **list)
 {
     return hypervGetWmiClassList(priv, Msvm_ConcreteJob_WmiInfo, query,
-                                 (hypervObject **) list);
+                                 false, (hypervObject **) list);
 }
 
 int
@@ -453,7 +646,7 @@ hypervGetWin32ComputerSystemList(hypervPrivate *priv, virBufferPtr query,
                                  Win32_ComputerSystem **list)
 {
     return hypervGetWmiClassList(priv, Win32_ComputerSystem_WmiInfo, query,
-                                 (hypervObject **) list);
+                                 false, (hypervObject **) list);
 }
 
 int
@@ -461,7 +654,7 @@ hypervGetWin32ProcessorList(hypervPrivate *priv, virBufferPtr query,
                             Win32_Processor **list)
 {
     return hypervGetWmiClassList(priv, Win32_Processor_WmiInfo, query,
-                                 (hypervObject **) list);
+                                 false, (hypervObject **) list);
 }
 
 int
@@ -470,7 +663,7 @@ hypervGetMsvmVirtualSystemSettingDataList(hypervPrivate *priv,
                                           Msvm_VirtualSystemSettingData **list)
 {
     return hypervGetWmiClassList(priv, Msvm_VirtualSystemSettingData_WmiInfo, query,
-                                 (hypervObject **) list);
+                                 true, (hypervObject **) list);
 }
 
 int
@@ -479,7 +672,7 @@ hypervGetMsvmProcessorSettingDataList(hypervPrivate *priv,
                                       Msvm_ProcessorSettingData **list)
 {
     return hypervGetWmiClassList(priv, Msvm_ProcessorSettingData_WmiInfo, query,
-                                 (hypervObject **) list);
+                                 true, (hypervObject **) list);
 }
 
 int
@@ -487,7 +680,7 @@ hypervGetMsvmMemorySettingDataList(hypervPrivate *priv, virBufferPtr query,
                                    Msvm_MemorySettingData **list)
 {
     return hypervGetWmiClassList(priv, Msvm_MemorySettingData_WmiInfo, query,
-                                 (hypervObject **) list);
+                                 true, (hypervObject **) list);
 }
 
 
@@ -628,6 +821,9 @@ hypervInvokeMsvmComputerSystemRequestStateChange(virDomainPtr domain,
     result = 0;
 
  cleanup:
+    /* whatever happened, the cached state of the domain may be stale now */
+    hypervCacheFlush(priv);
+
     if (options != NULL)
         wsmc_options_destroy(options);
 
@@ -751,7 +947,6 @@ hypervMsvmComputerSystemFromDomain(virDomainPtr domain,
 {
     hypervPrivate *priv = domain->conn->privateData;
     char uuid_string[VIR_UUID_STRING_BUFLEN];
-    virBuffer query = VIR_BUFFER_INITIALIZER;
 
     if (computerSystem == NULL || *computerSystem != NULL) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("Invalid argument"));
@@ -760,12 +955,8 @@ hypervMsvmComputerSystemFromDomain(virDomainPtr domain,
 
     virUUIDFormat(domain->uuid, uuid_string);
 
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_SELECT);
-    virBufferAddLit(&query, "where ");
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_VIRTUAL);
-    virBufferAsprintf(&query, "and Name = \"%s\"", uuid_string);
-
-    if (hypervGetMsvmComputerSystemList(priv, &query, computerSystem) < 0)
+    if (hypervLookupMsvmComputerSystem(priv, uuid_string, NULL, -1,
+                                       computerSystem) < 0)
         return -1;
 
     if (*computerSystem == NULL) {
@@ -776,3 +967,57 @@ hypervMsvmComputerSystemFromDomain(virDomainPtr domain,
 
     return 0;
 }
+
+/*
+ * Looks up the virtual machine matching either @uuid, @name or the active one
+ * running as process @id. Instead of a query per lookup, this filters the list
+ * of all the virtual machines, which is shared with the other lookups and
+ * domain listings through the cache. Sets @computerSystem to NULL if there is
+ * no such virtual machine.
+ */
+int
+hypervLookupMsvmComputerSystem(hypervPrivate *priv, const char *uuid,
+                               const char *name, int id,
+                               Msvm_ComputerSystem **computerSystem)
+{
+    virBuffer query = VIR_BUFFER_INITIALIZER;
+    Msvm_ComputerSystem *list = NULL;
+    Msvm_ComputerSystem *prev = NULL;
+    Msvm_ComputerSystem *cur;
+
+    if (computerSystem == NULL || *computerSystem != NULL) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("Invalid argument"));
+        return -1;
+    }
+
+    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_SELECT);
+    virBufferAddLit(&query, "where ");
+    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_VIRTUAL);
+
+    if (hypervGetMsvmComputerSystemList(priv, &query, &list) < 0)
+        return -1;
+
+    /* WQL string comparisons are case insensitive */
+    for (cur = list; cur != NULL; prev = cur, cur = cur->next) {
+        if ((uuid && cur->data.common->Name &&
+             STRCASEEQ(cur->data.common->Name, uuid)) ||
+            (name && cur->data.common->ElementName &&
+             STRCASEEQ(cur->data.common->ElementName, name)) ||
+            (id >= 0 && hypervIsMsvmComputerSystemActive(cur, NULL) &&
+             cur->data.common->ProcessID == (unsigned int)id))
+            break;
+    }
+
+    if (cur != NULL) {
+        if (prev != NULL)
+            prev->next = cur->next;
+        else
+            list = cur->next;
+        cur->next = NULL;
+        *computerSystem = cur;
+    }
+
+    hypervFreeObject(priv, (hypervObject *)list);
+
+    return 0;
+}
@@ -31,7 +31,7 @@
 
 
 
-# define HYPERV_WQL_QUERY_INITIALIZER { NULL, NULL }
+# define HYPERV_WQL_QUERY_INITIALIZER { NULL, NULL, false }
 
 int hypervVerifyResponse(WsManClient *client, WsXmlDocH response,
                          const char *detail);
@@ -66,6 +66,7 @@ typedef hypervWqlQuery *hypervWqlQueryPtr;
 struct _hypervWqlQuery {
     virBufferPtr query;
     hypervWmiClassInfoListPtr info;
+    bool cache; /* the result may be served from and kept in the cache */
 };
 
 int hypervEnumAndPull(hypervPrivate *priv, hypervWqlQueryPtr wqlQuery,
@@ -73,6 +74,12 @@ int hypervEnumAndPull(hypervPrivate *priv, hypervWqlQueryPtr wqlQuery,
 
 void hypervFreeObject(hypervPrivate *priv, hypervObject *object);
 
+int hypervCacheInit(hypervPrivate *priv);
+
+void hypervCacheFree(hypervPrivate *priv);
+
+void hypervCacheFlush(hypervPrivate *priv);
+
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
@@ -160,4 +167,8 @@ int hypervMsvmComputerSystemToDomain(virConnectPtr conn,
 int hypervMsvmComputerSystemFromDomain(virDomainPtr domain,
                                        Msvm_ComputerSystem **computerSystem);
 
+int hypervLookupMsvmComputerSystem(hypervPrivate *priv, const char *uuid,
+                                   const char *name, int id,
+                                   Msvm_ComputerSystem **computerSystem);
+
 #endif /* __HYPERV_WMI_H__ */
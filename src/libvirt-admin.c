@@ -1013,7 +1013,10 @@ int virAdmClientClose(virAdmClientPtr client,
  *  - maximum number of clients connected to @srv,
  *  - current number of clients connected to @srv waiting for authentication,
  *  - maximum number of clients connected to @srv that can be wainting for
- *  authentication.
+ *  authentication,
+ *  - request rate and burst limits per client and per client identity,
+ *  - maximum number of requests in flight per client,
+ *  - keepalive interval and count for new clients.
  *
  * Returns 0 on success, allocating @params to size returned in @nparams, or
  * -1 in case of an error. Caller is responsible for deallocating @params.
@@ -1241,3 +1244,394 @@ virAdmConnectSetLoggingFilters(virAdmConnectPtr conn,
     virDispatchError(NULL);
     return -1;
 }
+
+/**
+ * virAdmConnectGetEventLoopStats:
+ * @conn: pointer to an active admin connection
+ * @params: pointer to a list of typed parameters which will be allocated
+ *          to store all returned parameters
+ * @nparams: pointer which will hold the number of params returned in @params
+ * @flags: bitwise-OR of virAdmConnectGetEventLoopStatsFlags
+ *
+ * Retrieves statistics about the timers of the daemon's event loop. Upon
+ * successful completion, @params will be allocated automatically to hold all
+ * returned data, setting @nparams accordingly.
+ * When extracting parameters from @params, following search keys are
+ * supported:
+ *      VIR_EVENT_LOOP_TIMERS
+ *      VIR_EVENT_LOOP_TIMERS_ARMED
+ *      VIR_EVENT_LOOP_TIMERS_FIRED
+ *      VIR_EVENT_LOOP_TIMERS_FIRED_RATE
+ *      VIR_EVENT_LOOP_TIMERS_LATE_TOTAL
+ *      VIR_EVENT_LOOP_TIMERS_LATE_MAX
+ *
+ * With VIR_ADMIN_EVENT_LOOP_STATS_CALLBACKS, the callback functions which
+ * spent the most time blocking the event loop since the daemon started
+ * timing them, as configured by event_loop_stall_threshold in libvirtd.conf,
+ * are reported too, longest first. The VIR_EVENT_LOOP_CALLBACKS_COUNT
+ * parameter holds their number, each of which is described by the following
+ * parameters, where <num> goes from 0 to the count minus one. All times are
+ * in microseconds.
+ *
+ *      "callback.<num>.name"      - symbol name of the function if known,
+ *                                   its address otherwise, as string
+ *      "callback.<num>.type"      - "handle" or "timer", as string
+ *      "callback.<num>.calls"     - number of calls, as ullong
+ *      "callback.<num>.timeTotal" - time spent in the calls, as ullong
+ *      "callback.<num>.timeMax"   - longest of the calls, as ullong
+ *      "callback.<num>.stalls"    - number of calls which took longer than
+ *                                   the configured threshold, as ullong
+ *
+ * Returns 0 on success, -1 in case of an error.
+ */
+int
+virAdmConnectGetEventLoopStats(virAdmConnectPtr conn,
+                               virTypedParameterPtr *params,
+                               int *nparams,
+                               unsigned int flags)
+{
+    int ret = -1;
+
+    VIR_DEBUG("conn=%p, params=%p, nparams=%p, flags=%x",
+              conn, params, nparams, flags);
+
+    virResetLastError();
+
+    virCheckAdmConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(params, error);
+    virCheckNonNullArgGoto(nparams, error);
+
+    if ((ret = remoteAdminConnectGetEventLoopStats(conn, params, nparams,
+                                                   flags)) < 0)
+        goto error;
+
+    return ret;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
+
+/**
+ * virAdmConnectGetEventLoopParameters:
+ * @conn: pointer to an active admin connection
+ * @params: pointer to a list of typed parameters which will be allocated
+ *          to store all returned parameters
+ * @nparams: pointer which will hold the number of params returned in @params
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Retrieves the tunables of the daemon's event loop. Upon successful
+ * completion, @params will be allocated automatically to hold all returned
+ * data, setting @nparams accordingly.
+ * When extracting parameters from @params, following search keys are
+ * supported:
+ *      VIR_EVENT_LOOP_THREADS
+ *      VIR_EVENT_LOOP_STALL_THRESHOLD
+ *
+ * Returns 0 on success, -1 in case of an error.
+ */
+int
+virAdmConnectGetEventLoopParameters(virAdmConnectPtr conn,
+                                    virTypedParameterPtr *params,
+                                    int *nparams,
+                                    unsigned int flags)
+{
+    int ret = -1;
+
+    VIR_DEBUG("conn=%p, params=%p, nparams=%p, flags=%x",
+              conn, params, nparams, flags);
+
+    virResetLastError();
+
+    virCheckAdmConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(params, error);
+    virCheckNonNullArgGoto(nparams, error);
+
+    if ((ret = remoteAdminConnectGetEventLoopParameters(conn, params, nparams,
+                                                        flags)) < 0)
+        goto error;
+
+    return ret;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
+
+/**
+ * virAdmConnectSetEventLoopParameters:
+ * @conn: pointer to an active admin connection
+ * @params: pointer to event loop parameters object
+ * @nparams: number of parameters in @params
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Change the tunables of the daemon's event loop while it keeps running.
+ * See 'Event loop parameters' in libvirt-admin.h for supported parameters
+ * in @params. The changes are not saved in the configuration file of the
+ * daemon.
+ *
+ * Returns 0 if the parameters have been changed successfully or -1 in case
+ * of an error.
+ */
+int
+virAdmConnectSetEventLoopParameters(virAdmConnectPtr conn,
+                                    virTypedParameterPtr params,
+                                    int nparams,
+                                    unsigned int flags)
+{
+    int ret = -1;
+
+    VIR_DEBUG("conn=%p, params=%p, nparams=%d, flags=%x",
+              conn, params, nparams, flags);
+    VIR_TYPED_PARAMS_DEBUG(params, nparams);
+
+    virResetLastError();
+
+    virCheckAdmConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(params, error);
+    virCheckNonNegativeArgGoto(nparams, error);
+
+    if ((ret = remoteAdminConnectSetEventLoopParameters(conn, params, nparams,
+                                                        flags)) < 0)
+        goto error;
+
+    return ret;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
+
+/**
+ * virAdmServerGetRPCStats:
+ * @srv: a valid server object reference
+ * @params: pointer to a list of typed parameters which will be allocated
+ *          to store all returned parameters
+ * @nparams: pointer which will hold the number of params returned in @params
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Retrieves statistics about the RPC procedures dispatched by @srv since the
+ * daemon started. Only procedures which were called at least once are
+ * reported. Upon successful completion, @params will be allocated
+ * automatically to hold all returned data, setting @nparams accordingly.
+ *
+ * The VIR_SERVER_RPC_STATS_COUNT parameter holds the number of procedures
+ * reported, each of which is described by the following parameters, where
+ * <num> goes from 0 to the count minus one. All times are in microseconds.
+ *
+ *      "rpc.<num>.program"           - number of the RPC program, as uint
+ *      "rpc.<num>.proc"              - number of the procedure within the
+ *                                      program, as int
+ *      "rpc.<num>.calls"             - number of calls, as ullong
+ *      "rpc.<num>.errors"            - number of calls which replied with
+ *                                      an error, as ullong
+ *      "rpc.<num>.queueTimeTotal"    - time calls spent between being read
+ *                                      and a worker picking them up, as
+ *                                      ullong
+ *      "rpc.<num>.queueTimeMax"      - longest of those times, as ullong
+ *      "rpc.<num>.dispatchTimeTotal" - time spent decoding the arguments and
+ *                                      running the procedure, as ullong
+ *      "rpc.<num>.dispatchTimeMax"   - longest of those times, as ullong
+ *      "rpc.<num>.encodeTimeTotal"   - time spent encoding replies, as ullong
+ *      "rpc.<num>.encodeTimeMax"     - longest of those times, as ullong
+ *      "rpc.<num>.dispatchUnder10us", "rpc.<num>.dispatchUnder100us",
+ *      "rpc.<num>.dispatchUnder1ms", "rpc.<num>.dispatchUnder10ms",
+ *      "rpc.<num>.dispatchUnder100ms", "rpc.<num>.dispatchUnder1s",
+ *      "rpc.<num>.dispatchOver1s"    - histogram of dispatch times, as the
+ *                                      number of calls in each range, as
+ *                                      ullong
+ *
+ * Returns 0 on success, -1 in case of an error. Caller is responsible for
+ * deallocating @params.
+ */
+int
+virAdmServerGetRPCStats(virAdmServerPtr srv,
+                        virTypedParameterPtr *params,
+                        int *nparams,
+                        unsigned int flags)
+{
+    int ret = -1;
+
+    VIR_DEBUG("srv=%p, params=%p, nparams=%p, flags=%x",
+              srv, params, nparams, flags);
+
+    virResetLastError();
+
+    virCheckAdmServerGoto(srv, error);
+    virCheckNonNullArgGoto(params, error);
+    virCheckNonNullArgGoto(nparams, error);
+
+    if ((ret = remoteAdminServerGetRPCStats(srv, params, nparams,
+                                            flags)) < 0)
+        goto error;
+
+    return ret;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
+
+/**
+ * virAdmConnectGetCommandBrokerStats:
+ * @conn: pointer to an active admin connection
+ * @params: pointer to a list of typed parameters which will be allocated
+ *          to store all returned parameters
+ * @nparams: pointer which will hold the number of params returned in @params
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Retrieves statistics about the commands the daemon had its command
+ * broker run, all zero if the broker is not enabled. Upon successful
+ * completion, @params will be allocated automatically to hold all returned
+ * data, setting @nparams accordingly.
+ * When extracting parameters from @params, following search keys are
+ * supported:
+ *      VIR_COMMAND_BROKER_COMMANDS
+ *      VIR_COMMAND_BROKER_FAILURES
+ *      VIR_COMMAND_BROKER_LATENCY_TOTAL
+ *      VIR_COMMAND_BROKER_LATENCY_MAX
+ *
+ * Returns 0 on success, -1 in case of an error.
+ */
+int
+virAdmConnectGetCommandBrokerStats(virAdmConnectPtr conn,
+                                   virTypedParameterPtr *params,
+                                   int *nparams,
+                                   unsigned int flags)
+{
+    int ret = -1;
+
+    VIR_DEBUG("conn=%p, params=%p, nparams=%p, flags=%x",
+              conn, params, nparams, flags);
+
+    virResetLastError();
+
+    virCheckAdmConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(params, error);
+    virCheckNonNullArgGoto(nparams, error);
+
+    if ((ret = remoteAdminConnectGetCommandBrokerStats(conn, params, nparams,
+                                                       flags)) < 0)
+        goto error;
+
+    return ret;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
+
+/**
+ * virAdmConnectGetMemoryStats:
+ * @conn: pointer to an active admin connection
+ * @params: pointer to a list of typed parameters which will be allocated
+ *          to store all returned parameters
+ * @nparams: pointer which will hold the number of params returned in @params
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Retrieves statistics about the memory the daemon uses: the size of its
+ * heap as a whole and what the objects kept for every domain account
+ * for. Upon successful completion, @params will be allocated
+ * automatically to hold all returned data, setting @nparams accordingly.
+ * When extracting parameters from @params, following search keys are
+ * supported:
+ *      VIR_MEMORY_STATS_HEAP_USED
+ *      VIR_MEMORY_STATS_HEAP_FREE
+ *      VIR_MEMORY_STATS_DOMAIN_OBJECTS
+ *      VIR_MEMORY_STATS_INTERN_STRINGS
+ *      VIR_MEMORY_STATS_INTERN_BYTES
+ *      VIR_MEMORY_STATS_INTERN_HITS
+ *
+ * Returns 0 on success, -1 in case of an error.
+ */
+int
+virAdmConnectGetMemoryStats(virAdmConnectPtr conn,
+                            virTypedParameterPtr *params,
+                            int *nparams,
+                            unsigned int flags)
+{
+    int ret = -1;
+
+    VIR_DEBUG("conn=%p, params=%p, nparams=%p, flags=%x",
+              conn, params, nparams, flags);
+
+    virResetLastError();
+
+    virCheckAdmConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(params, error);
+    virCheckNonNullArgGoto(nparams, error);
+
+    if ((ret = remoteAdminConnectGetMemoryStats(conn, params, nparams,
+                                                flags)) < 0)
+        goto error;
+
+    return ret;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
+
+/**
+ * virAdmConnectGetLockStats:
+ * @conn: pointer to an active admin connection
+ * @params: pointer to a list of typed parameters which will be allocated
+ *          to store all returned parameters
+ * @nparams: pointer which will hold the number of params returned in @params
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Retrieves statistics about the contention of the daemon's locks, as
+ * recorded while lock_profiling is enabled in libvirtd.conf. The locks of
+ * all the objects of a class, like every domain object, count as one kind
+ * of lock. Upon successful completion, @params will be allocated
+ * automatically to hold all returned data, setting @nparams accordingly.
+ * When extracting parameters from @params, following search keys are
+ * supported:
+ *      VIR_LOCK_STATS_PROFILING
+ *      VIR_LOCK_STATS_COUNT
+ *
+ * The kinds of locks threads waited for the longest in total come first.
+ * Each of them is described by the following parameters, where <num> goes
+ * from 0 to VIR_LOCK_STATS_COUNT minus one. All times are in
+ * microseconds.
+ *
+ *      "lock.<num>.name"         - name of the kind of lock, as string
+ *      "lock.<num>.contended"    - number of acquisitions which had to wait,
+ *                                  as ullong
+ *      "lock.<num>.waitTotal"    - time spent waiting, as ullong
+ *      "lock.<num>.waitMax"      - longest wait, as ullong
+ *      "lock.<num>.holder.count" - number of call sites reported as holding
+ *                                  the lock while others waited, as uint
+ *
+ * and for each of these call sites, where <site> goes from 0 to the count
+ * minus one:
+ *
+ *      "lock.<num>.holder.<site>.name"      - function and offset of the
+ *                                             call site, as string
+ *      "lock.<num>.holder.<site>.contended" - number of waits while it
+ *                                             held the lock, as ullong
+ *      "lock.<num>.holder.<site>.waitTotal" - time spent in those waits,
+ *                                             as ullong
+ *
+ * Returns 0 on success, -1 in case of an error.
+ */
+int
+virAdmConnectGetLockStats(virAdmConnectPtr conn,
+                          virTypedParameterPtr *params,
+                          int *nparams,
+                          unsigned int flags)
+{
+    int ret = -1;
+
+    VIR_DEBUG("conn=%p, params=%p, nparams=%p, flags=%x",
+              conn, params, nparams, flags);
+
+    virResetLastError();
+
+    virCheckAdmConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(params, error);
+    virCheckNonNullArgGoto(nparams, error);
+
+    if ((ret = remoteAdminConnectGetLockStats(conn, params, nparams,
+                                              flags)) < 0)
+        goto error;
+
+    return ret;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
@@ -360,6 +360,63 @@ virDomainLookupByUUID(virConnectPtr conn, const unsigned char *uuid)
 }
 
 
+/**
+ * virConnectLookupDomainsByUUID:
+ * @conn: pointer to the hypervisor connection
+ * @uuids: @nuuids raw UUIDs of VIR_UUID_BUFLEN bytes each, one after another
+ * @nuuids: number of UUIDs in @uuids
+ * @doms: pointer to a variable to store the array of domain objects in
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Try to lookup several domains on the given hypervisor based on their
+ * UUIDs at once. For remote connections all the lookups are sent to the
+ * server together, so that they cost a single round trip rather than one
+ * for each domain.
+ *
+ * On success @doms is set to an array of @nuuids entries, where each
+ * entry is the domain matching the UUID at the same position in @uuids,
+ * or NULL if no such domain exists. The caller is responsible for calling
+ * virDomainFree() on each non-NULL entry and then free() on @doms itself.
+ *
+ * Returns the number of domains found, or -1 in case of failure.
+ */
+int
+virConnectLookupDomainsByUUID(virConnectPtr conn,
+                              const unsigned char *uuids,
+                              unsigned int nuuids,
+                              virDomainPtr **doms,
+                              unsigned int flags)
+{
+    VIR_DEBUG("conn=%p, uuids=%p, nuuids=%u, doms=%p, flags=%x",
+              conn, uuids, nuuids, doms, flags);
+
+    virResetLastError();
+
+    if (doms)
+        *doms = NULL;
+
+    virCheckConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(uuids, error);
+    virCheckNonNullArgGoto(doms, error);
+    virCheckPositiveArgGoto(nuuids, error);
+
+    if (conn->driver->connectLookupDomainsByUUID) {
+        int ret;
+        ret = conn->driver->connectLookupDomainsByUUID(conn, uuids, nuuids,
+                                                       doms, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(conn);
+    return -1;
+}
+
+
 /**
  * virDomainLookupByUUIDString:
  * @conn: pointer to the hypervisor connection
@@ -8168,6 +8225,73 @@ virDomainAttachDeviceFlags(virDomainPtr domain,
 }
 
 
+/**
+ * virDomainAttachDevices:
+ * @domain: pointer to domain object
+ * @xmls: array of XML descriptions of one device each
+ * @ndevices: number of devices in @xmls
+ * @flags: bitwise-OR of virDomainDeviceModifyFlags
+ *
+ * Attach several virtual devices to a domain at once. The devices are
+ * attached in the order given, exactly as if virDomainAttachDeviceFlags()
+ * was called for each of them with the same @flags, but the domain is
+ * only locked for modification once and its status and configuration
+ * are saved once at the end rather than after every device. This is
+ * considerably cheaper when adding many disks or interfaces.
+ *
+ * All the descriptions are parsed before any device is attached, so an
+ * invalid one makes the call fail without any change. The persistent
+ * configuration is only updated if all the devices could be attached.
+ * However, live hotplug can't be undone reliably, therefore if attaching
+ * one of the devices to the running domain fails, the devices before it
+ * stay attached to the running domain and the rest are not attached.
+ *
+ * Returns 0 in case of success, -1 in case of failure.
+ */
+int
+virDomainAttachDevices(virDomainPtr domain,
+                       const char **xmls,
+                       unsigned int ndevices,
+                       unsigned int flags)
+{
+    virConnectPtr conn;
+    size_t i;
+
+    VIR_DOMAIN_DEBUG(domain, "xmls=%p, ndevices=%u, flags=%x",
+                     xmls, ndevices, flags);
+    if (xmls) {
+        for (i = 0; i < ndevices; i++)
+            VIR_DEBUG("xmls[%zu]=%s", i, NULLSTR(xmls[i]));
+    }
+
+    virResetLastError();
+
+    virCheckDomainReturn(domain, -1);
+    conn = domain->conn;
+
+    virCheckNonNullArgGoto(xmls, error);
+    virCheckNonZeroArgGoto(ndevices, error);
+    virCheckReadOnlyGoto(conn->flags, error);
+
+    for (i = 0; i < ndevices; i++)
+        virCheckNonNullArgGoto(xmls[i], error);
+
+    if (conn->driver->domainAttachDevices) {
+        int ret;
+        ret = conn->driver->domainAttachDevices(domain, xmls, ndevices, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(domain->conn);
+    return -1;
+}
+
+
 /**
  * virDomainDetachDevice:
  * @domain: pointer to domain object
@@ -9331,6 +9455,14 @@ virDomainManagedSaveRemove(virDomainPtr dom, unsigned int flags)
  * When passing @flags of 0 in order to support a wider range of server
  * versions, it is up to the client to ensure mutual exclusion.
  *
+ * With flag VIR_DOMAIN_CONSOLE_COALESCE, output of the console read by
+ * the libvirtd daemon in quick succession is gathered for a few
+ * milliseconds and sent in one stream message instead of one message per
+ * read.  An isolated piece of output, such as the echo of a keystroke,
+ * is still sent right away.  The flag concerns the transport between the
+ * daemon and a remote client only and is not passed down to the
+ * hypervisor driver.
+ *
  * Returns 0 if the console was opened, -1 on error
  */
 int
@@ -11152,6 +11284,16 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  *                          from virVcpuState enum.
  *     "vcpu.<num>.time" - virtual cpu time spent by virtual CPU <num>
  *                         as unsigned long long.
+ *     "vcpu.<num>.wait" - time the virtual CPU <num> wanted to run, but
+ *                         the host scheduler was running something else,
+ *                         as unsigned long long.
+ *     "vcpu.<num>.delay" - time the virtual CPU <num> thread spent queued
+ *                          waiting for a host CPU, which the guest sees as
+ *                          steal time, in nanoseconds as unsigned long long.
+ *                          Only present if the host kernel reports it.
+ *     "vcpu.<num>.halted" - virtual CPU <num> is halted as boolean; may
+ *                           indicate the processor is idle or even
+ *                           disabled, depending on the architecture.
  *
  * VIR_DOMAIN_STATS_INTERFACE:
  *     Return network interface statistics.
@@ -11282,6 +11424,144 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  *     "perf.emulation_faults" - The count of emulation faults as unsigned
  *                               long long. It is produced by the
  *                               emulation_faults perf event
+ *     "perf.<event>.rate" - how often the event happened per second over
+ *                           the last samples of its counter, as unsigned
+ *                           long long. Only reported for counters, not
+ *                           for "perf.cmt", and only if the daemon is
+ *                           configured to sample them periodically.
+ *
+ * VIR_DOMAIN_STATS_GUEST:
+ *     Return information reported by the guest agent, as
+ *     virDomainInterfaceAddresses with the agent source and
+ *     virDomainGetFSInfo do. The group is empty for domains without a
+ *     responsive agent. The typed parameter keys are in this format:
+ *
+ *     "guest.if.count" - number of guest network interfaces as unsigned int.
+ *     "guest.if.<num>.name" - name of the interface in the guest as string.
+ *     "guest.if.<num>.hwaddr" - hardware address of the interface as string,
+ *                               if known.
+ *     "guest.if.<num>.addr.count" - number of IP addresses of the interface
+ *                                   as unsigned int.
+ *     "guest.if.<num>.addr.<num>.type" - "ipv4" or "ipv6" as string.
+ *     "guest.if.<num>.addr.<num>.addr" - the IP address as string.
+ *     "guest.if.<num>.addr.<num>.prefix" - the prefix length as unsigned int.
+ *     "guest.fs.count" - number of mounted guest filesystems as unsigned int.
+ *     "guest.fs.<num>.mountpoint" - path to the mount point as string.
+ *     "guest.fs.<num>.name" - device name in the guest as string.
+ *     "guest.fs.<num>.fstype" - filesystem type as string.
+ *     "guest.fs.<num>.disk.count" - number of domain disks backing the
+ *                                   filesystem as unsigned int.
+ *
+ *     The domains are queried in parallel when the driver supports it and
+ *     each agent query is bounded by the default agent timeout, so a single
+ *     unresponsive guest doesn't stall the whole call.
+ *
+ * VIR_DOMAIN_STATS_PRESSURE:
+ *     Return the pressure stall information of the domain, i.e. the share
+ *     of time its tasks were waiting for a resource. It is only available
+ *     on hosts using the unified cgroup hierarchy with a kernel providing
+ *     it. The typed parameter keys are in this format:
+ *
+ *     "pressure.<resource>.some.avg10" - percentage of the last 10 seconds
+ *                                        some of the tasks were stalled on
+ *                                        <resource>, one of "cpu", "io"
+ *                                        and "memory", as double.
+ *     "pressure.<resource>.some.avg60" - the same over the last 60 seconds
+ *                                        as double.
+ *     "pressure.<resource>.some.avg300" - the same over the last 300
+ *                                         seconds as double.
+ *     "pressure.<resource>.some.total" - total time in microseconds some
+ *                                        of the tasks were stalled as
+ *                                        unsigned long long.
+ *     "pressure.<resource>.full.*" - like the fields above, for the time
+ *                                    all of the tasks were stalled at once.
+ *                                    They may be missing for "cpu".
+ *
+ * VIR_DOMAIN_STATS_JOB:
+ *     Return how long the APIs waited for the jobs of the domain, which
+ *     serialize the changes of its state, and how long they held them.
+ *     The fields are only present for the job types which were used. The
+ *     names of async jobs, such as migration, are prefixed with "async.",
+ *     e.g. "job.async.migration_out.count". The typed parameter keys are in
+ *     this format:
+ *
+ *     "job.<type>.count" - number of jobs acquired as unsigned long long.
+ *     "job.<type>.failed" - number of jobs which couldn't be acquired, e.g.
+ *                           because of a timeout, as unsigned long long.
+ *     "job.<type>.wait.total" - total time spent waiting for the jobs in
+ *                               milliseconds as unsigned long long.
+ *     "job.<type>.wait.max" - the longest wait in milliseconds as
+ *                             unsigned long long.
+ *     "job.<type>.hold.total" - total time the jobs were held in
+ *                               milliseconds as unsigned long long.
+ *     "job.<type>.hold.max" - the longest time a job was held in
+ *                             milliseconds as unsigned long long.
+ *     "job.<type>.hold.max.api" - name of the API which held the job the
+ *                                 longest as string, if known.
+ *     "job.<type>.wait.bucket.<num>" - number of waits shorter than
+ *                                      10^<num> milliseconds but not
+ *                                      shorter than the limit of the
+ *                                      previous bucket, as unsigned long
+ *                                      long. The last bucket counts all the
+ *                                      longer waits.
+ *     "job.<type>.hold.bucket.<num>" - the same for the times the jobs were
+ *                                      held.
+ *
+ *     The runs of the hook scripts, which happen outside of the jobs, are
+ *     reported for the hook operations which ran, e.g. "job.hook.started.*":
+ *
+ *     "job.hook.<op>.count" - number of runs as unsigned long long.
+ *     "job.hook.<op>.failed" - number of runs which failed or timed out as
+ *                              unsigned long long.
+ *     "job.hook.<op>.time.total" - total time the script ran in
+ *                                  milliseconds as unsigned long long.
+ *     "job.hook.<op>.time.max" - the longest run in milliseconds as
+ *                                unsigned long long.
+ *
+ * VIR_DOMAIN_STATS_MONITOR:
+ *     Return how long QEMU took to answer the commands sent to its monitor
+ *     since it was started, or since the daemon reconnected to it, and how
+ *     large the replies were. The fields are only present for the commands
+ *     which were used, e.g. "monitor.query-blockstats.count". The typed
+ *     parameter keys are in this format:
+ *
+ *     "monitor.<command>.count" - number of replies received as unsigned
+ *                                 long long.
+ *     "monitor.<command>.time.total" - total time between sending the
+ *                                      commands and receiving their replies
+ *                                      in microseconds as unsigned long
+ *                                      long.
+ *     "monitor.<command>.time.max" - the slowest reply in microseconds as
+ *                                    unsigned long long.
+ *     "monitor.<command>.time.p50" - median reply time in microseconds as
+ *                                    unsigned long long. The percentiles
+ *                                    are estimated as the nearest power of
+ *                                    two not below the exact value.
+ *     "monitor.<command>.time.p99" - 99th percentile of the reply times in
+ *                                    microseconds as unsigned long long.
+ *     "monitor.<command>.reply.bytes" - total length of the replies in bytes
+ *                                       as unsigned long long.
+ *     "monitor.<command>.reply.max" - the longest reply in bytes as
+ *                                     unsigned long long.
+ *
+ * VIR_DOMAIN_STATS_DIRTYRATE:
+ *     Return the rate at which the guest dirties its memory, as measured by
+ *     the hypervisor over a short period. Retrieving the group starts a new
+ *     measurement unless one is already running, so the values describe the
+ *     measurement which finished last and polling the group periodically,
+ *     e.g. with virDomainSetStatsEvent, keeps them up to date. The typed
+ *     parameter keys are in this format:
+ *
+ *     "dirtyrate.calc_status" - the status of the last measurement as int,
+ *                               0 if none was started yet, 1 while it is
+ *                               running and 2 once it finished.
+ *     "dirtyrate.calc_start_time" - the start time of the last measurement
+ *                                   in seconds since the epoch as long long.
+ *     "dirtyrate.calc_period" - the length of the measurement in seconds
+ *                               as int.
+ *     "dirtyrate.megabytes_per_second" - the dirty rate in MiB/s as long
+ *                                        long. Only present if a
+ *                                        measurement finished.
  *
  * Note that entire stats groups or individual stat fields may be missing from
  * the output in case they are not supported by the given hypervisor, are not
@@ -11289,7 +11569,10 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  * was not successful.
  *
  * Using 0 for @stats returns all stats groups supported by the given
- * hypervisor.
+ * hypervisor, except VIR_DOMAIN_STATS_GUEST which has to be requested
+ * explicitly as it involves the guest agents, and
+ * VIR_DOMAIN_STATS_DIRTYRATE which has to be requested explicitly as it
+ * tracks the writes of the guest for a while.
  *
  * Specifying VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS as @flags makes
  * the function return error in case some of the stat types in @stats were
@@ -11299,6 +11582,12 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  * fields for offline domains if the statistics are meaningful only for a
  * running domain.
  *
+ * Specifying VIR_CONNECT_GET_ALL_DOMAINS_STATS_CACHED allows the hypervisor
+ * to return statistics it gathered for an earlier call, as long as they
+ * were gathered for the same set of groups and flags and are not older
+ * than a driver specific limit. This makes frequent polling by several
+ * callers cheaper at the cost of the data being slightly out of date.
+ *
  * Similarly to virConnectListAllDomains, @flags can contain various flags to
  * filter the list of domains to provide stats for.
  *
@@ -11383,6 +11672,12 @@ virConnectGetAllDomainStats(virConnectPtr conn,
  * fields for offline domains if the statistics are meaningful only for a
  * running domain.
  *
+ * Specifying VIR_CONNECT_GET_ALL_DOMAINS_STATS_CACHED allows the hypervisor
+ * to return statistics it gathered for an earlier call, as long as they
+ * were gathered for the same set of groups and flags and are not older
+ * than a driver specific limit. This makes frequent polling by several
+ * callers cheaper at the cost of the data being slightly out of date.
+ *
  * Note that any of the domain list filtering flags in @flags may be rejected
  * by this function.
  *
@@ -11477,6 +11772,96 @@ virDomainStatsRecordListFree(virDomainStatsRecordPtr *stats)
 }
 
 
+/**
+ * virConnectListAllDomainsFields:
+ * @conn: pointer to the hypervisor connection
+ * @fields: bitwise-OR of virDomainListFields
+ * @records: Pointer to a variable to store the array containing the
+ *           records, or NULL to only count the domains
+ * @flags: extra flags; bitwise-OR of virConnectListAllDomainsFlags
+ *
+ * Lists the domains just like virConnectListAllDomains() does, along
+ * with a chosen set of their properties, all collected in a single call
+ * while the list of domains is held.  This saves a round trip per domain
+ * to clients which would otherwise query every listed domain for its
+ * state or title.
+ *
+ * Every record holds the domain, which provides its name, UUID and ID,
+ * and the typed parameters selected by @fields:
+ *
+ * VIR_DOMAIN_LIST_FIELD_STATE:
+ *     "state" - state of the domain as int, one of virDomainState
+ *     "state.reason" - reason of the state as int, one of the
+ *                      virDomain*Reason enums matching "state"
+ *
+ * VIR_DOMAIN_LIST_FIELD_VCPUS:
+ *     "vcpu.current" - number of vcpus the domain uses as unsigned int
+ *     "vcpu.maximum" - maximum number of vcpus as unsigned int
+ *
+ * VIR_DOMAIN_LIST_FIELD_MEMORY:
+ *     "memory.current" - memory currently assigned to the domain in KiB
+ *                        as unsigned long long, as last known to the
+ *                        hypervisor driver
+ *     "memory.maximum" - maximum memory of the domain in KiB as unsigned
+ *                        long long
+ *
+ * VIR_DOMAIN_LIST_FIELD_TITLE:
+ *     "title" - title of the domain as string, only present if set
+ *
+ * VIR_DOMAIN_LIST_FIELD_DESCRIPTION:
+ *     "description" - description of the domain as string, only present
+ *                     if set
+ *
+ * VIR_DOMAIN_LIST_FIELD_MANAGEDSAVE:
+ *     "managedsave" - whether the domain has a managed save image as
+ *                     boolean
+ *
+ * VIR_DOMAIN_LIST_FIELD_AUTOSTART:
+ *     "autostart" - whether the domain is started with the host as
+ *                   boolean
+ *
+ * Requesting a field the hypervisor doesn't know fails with
+ * VIR_ERR_ARGUMENT_UNSUPPORTED.  The @flags filter the listed domains
+ * exactly like they do for virConnectListAllDomains().
+ *
+ * Returns the count of returned records on success, or -1 on error.  The
+ * caller is responsible for freeing the array with
+ * virDomainStatsRecordListFree(); it has an extra NULL element at its
+ * end, not included in the count.
+ */
+int
+virConnectListAllDomainsFields(virConnectPtr conn,
+                               unsigned int fields,
+                               virDomainStatsRecordPtr **records,
+                               unsigned int flags)
+{
+    VIR_DEBUG("conn=%p, fields=0x%x, records=%p, flags=0x%x",
+              conn, fields, records, flags);
+
+    virResetLastError();
+
+    if (records)
+        *records = NULL;
+
+    virCheckConnectReturn(conn, -1);
+
+    if (conn->driver->connectListAllDomainsFields) {
+        int ret;
+        ret = conn->driver->connectListAllDomainsFields(conn, fields,
+                                                        records, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(conn);
+    return -1;
+}
+
+
 /**
  * virDomainGetFSInfo:
  * @dom: a domain object
@@ -11841,8 +12226,10 @@ virDomainSetVcpu(virDomainPtr domain,
  * Set the threshold level for delivering the
  * VIR_DOMAIN_EVENT_ID_BLOCK_THRESHOLD if the device or backing chain element
  * described by @dev is written beyond the set threshold level. The threshold
- * level is unset once the event fires. The event might not be delivered at all
- * if libvirtd was not running at the moment when the threshold was reached.
+ * level is unset once the event fires. If libvirtd was not running at the
+ * moment when the threshold was reached, the QEMU driver delivers the event
+ * once it reconnects to the domain, with an excess of 0 as the actual one is
+ * not known anymore.
  *
  * Hypervisors report the last written sector of an image in the bulk stats API
  * (virConnectGetAllDomainStats/virDomainListGetStats) as
@@ -11885,3 +12272,375 @@ virDomainSetBlockThreshold(virDomainPtr domain,
     virDispatchError(domain->conn);
     return -1;
 }
+
+
+/**
+ * virDomainSetStatsEvent:
+ * @domain: pointer to domain object
+ * @stats: stats groups to report, binary-OR of virDomainStatsTypes
+ * @interval: period of the event in seconds, 0 to stop reporting
+ * @flags: currently unused, callers should pass 0
+ *
+ * Make the hypervisor gather the statistics groups selected by @stats
+ * for a running @domain every @interval seconds and deliver them as
+ * VIR_DOMAIN_EVENT_ID_STATS events. Only the fields which changed
+ * since the previous event are delivered, so callers interested in
+ * the current value of every field need to keep the last value
+ * reported. Each call resets this state, thus the first event after a
+ * call carries all the fields. Using 0 for @stats selects all groups
+ * supported by the hypervisor; the groups are documented in
+ * virConnectGetAllDomainStats.
+ *
+ * The setting is shared by all connections to the hypervisor and is
+ * forgotten once the domain stops.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int
+virDomainSetStatsEvent(virDomainPtr domain,
+                       unsigned int stats,
+                       unsigned int interval,
+                       unsigned int flags)
+{
+    VIR_DOMAIN_DEBUG(domain, "stats=%x interval=%u flags=%x",
+                     stats, interval, flags);
+
+    virResetLastError();
+
+    virCheckDomainReturn(domain, -1);
+    virCheckReadOnlyGoto(domain->conn->flags, error);
+
+    if (domain->conn->driver->domainSetStatsEvent) {
+        int ret;
+        ret = domain->conn->driver->domainSetStatsEvent(domain, stats,
+                                                        interval, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(domain->conn);
+    return -1;
+}
+
+
+/**
+ * virDomainBackupBegin:
+ * @domain: pointer to domain object
+ * @backupXML: description of the requested backup
+ * @flags: currently unused, callers should pass 0
+ *
+ * Start a pull-mode backup job of the running @domain. The point-in-time
+ * content of the disks selected in @backupXML is exported read-only over
+ * NBD while the guest keeps running, each disk as an export named after
+ * its target. The original data of the clusters the guest overwrites is
+ * collected in a scratch file per disk until virDomainBackupEnd is called.
+ *
+ * If @backupXML names a checkpoint, a persistent dirty bitmap of that
+ * name is created in every backed up disk at the point in time of the
+ * backup, so that a later backup can be incremental to it. If
+ * @backupXML has an <incremental> element, the exports also carry a
+ * dirty bitmap named "backup-" followed by the disk target, describing
+ * the extents that changed since that checkpoint was created. Clients can
+ * query it with NBD block status and only read the changed data.
+ *
+ * The actual server address, including the automatically chosen port,
+ * is reported by virDomainBackupGetXMLDesc. Only one backup job can run
+ * per domain at a time, and disks taking part in it can't be used for
+ * other block jobs.
+ *
+ * Returns 0 if the backup job was started, -1 on failure.
+ */
+int
+virDomainBackupBegin(virDomainPtr domain,
+                     const char *backupXML,
+                     unsigned int flags)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(domain, "backupXML=%s flags=%x",
+                     NULLSTR(backupXML), flags);
+
+    virResetLastError();
+
+    virCheckDomainReturn(domain, -1);
+    conn = domain->conn;
+
+    virCheckNonNullArgGoto(backupXML, error);
+    virCheckReadOnlyGoto(conn->flags, error);
+
+    if (conn->driver->domainBackupBegin) {
+        int ret;
+        ret = conn->driver->domainBackupBegin(domain, backupXML, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(conn);
+    return -1;
+}
+
+
+/**
+ * virDomainBackupGetXMLDesc:
+ * @domain: pointer to domain object
+ * @flags: currently unused, callers should pass 0
+ *
+ * Query the backup job running for @domain. The returned description
+ * lists every disk of the domain together with whether it takes part in
+ * the backup, and the address of the NBD server exporting them.
+ *
+ * Returns a 0 terminated UTF-8 encoded XML instance, or NULL in case of
+ * error or if no backup job is running. The caller must free() the
+ * returned value.
+ */
+char *
+virDomainBackupGetXMLDesc(virDomainPtr domain,
+                          unsigned int flags)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(domain, "flags=%x", flags);
+
+    virResetLastError();
+
+    virCheckDomainReturn(domain, NULL);
+    conn = domain->conn;
+
+    if (conn->driver->domainBackupGetXMLDesc) {
+        char *ret;
+        ret = conn->driver->domainBackupGetXMLDesc(domain, flags);
+        if (!ret)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(conn);
+    return NULL;
+}
+
+
+/**
+ * virDomainBackupEnd:
+ * @domain: pointer to domain object
+ * @flags: bitwise-OR of virDomainBackupEndFlags
+ *
+ * Finish the backup job started by virDomainBackupBegin. The NBD server
+ * is stopped, disconnecting any client still reading from it, and the
+ * scratch files libvirt created are removed.
+ *
+ * A checkpoint created by the job is kept for a later incremental
+ * backup, unless VIR_DOMAIN_BACKUP_END_ABORT is used, typically because
+ * the client failed to copy the data. With
+ * VIR_DOMAIN_BACKUP_END_DROP_INCREMENTAL the checkpoint the backup was
+ * incremental to is deleted, as the new checkpoint supersedes it. The
+ * two flags are mutually exclusive.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int
+virDomainBackupEnd(virDomainPtr domain,
+                   unsigned int flags)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(domain, "flags=%x", flags);
+
+    virResetLastError();
+
+    virCheckDomainReturn(domain, -1);
+    conn = domain->conn;
+
+    virCheckReadOnlyGoto(conn->flags, error);
+
+    VIR_EXCLUSIVE_FLAGS_GOTO(VIR_DOMAIN_BACKUP_END_ABORT,
+                             VIR_DOMAIN_BACKUP_END_DROP_INCREMENTAL,
+                             error);
+
+    if (conn->driver->domainBackupEnd) {
+        int ret;
+        ret = conn->driver->domainBackupEnd(domain, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(conn);
+    return -1;
+}
+
+
+/**
+ * virDomainBlockJobGroupStart:
+ * @domain: pointer to domain object
+ * @params: parameters of the block job group
+ * @nparams: number of items in @params
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Start the same block job on several disks of a running domain, which
+ * are scheduled together: at most VIR_DOMAIN_BLOCK_JOB_GROUP_CONCURRENCY
+ * jobs run at a time and all of them share the
+ * VIR_DOMAIN_BLOCK_JOB_GROUP_BANDWIDTH limit. The disks are listed with
+ * repeated VIR_DOMAIN_BLOCK_JOB_GROUP_DISK parameters, and the job is
+ * selected by VIR_DOMAIN_BLOCK_JOB_GROUP_TYPE.
+ *
+ * The jobs of the group are ordinary block jobs, each one reporting its
+ * progress with virDomainGetBlockJobInfo() and its end with
+ * VIR_DOMAIN_EVENT_ID_BLOCK_JOB_2 events. The progress of the whole group
+ * is available from virDomainBlockJobGroupGetStats() and the
+ * VIR_DOMAIN_EVENT_ID_BLOCK_JOB_GROUP event. A failed job does not stop
+ * the others. A domain can run only one group at a time.
+ *
+ * Returns 0 if the group was started, -1 on failure.
+ */
+int
+virDomainBlockJobGroupStart(virDomainPtr domain,
+                            virTypedParameterPtr params,
+                            int nparams,
+                            unsigned int flags)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(domain, "params=%p, nparams=%d, flags=%x",
+                     params, nparams, flags);
+    VIR_TYPED_PARAMS_DEBUG(params, nparams);
+
+    virResetLastError();
+
+    virCheckDomainReturn(domain, -1);
+    conn = domain->conn;
+
+    virCheckReadOnlyGoto(conn->flags, error);
+    virCheckNonNullArgGoto(params, error);
+    virCheckPositiveArgGoto(nparams, error);
+
+    if (virTypedParameterValidateSet(conn, params, nparams) < 0)
+        goto error;
+
+    if (conn->driver->domainBlockJobGroupStart) {
+        int ret;
+        ret = conn->driver->domainBlockJobGroupStart(domain, params,
+                                                     nparams, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(conn);
+    return -1;
+}
+
+
+/**
+ * virDomainBlockJobGroupGetStats:
+ * @domain: pointer to domain object
+ * @params: where to store the statistics
+ * @nparams: number of items in @params
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Report the progress of the block job group started by
+ * virDomainBlockJobGroupStart(). Besides the parameters the group was
+ * started with, @params contain the VIR_DOMAIN_BLOCK_JOB_GROUP_* counters
+ * and the state of every disk of the group. The caller should free @params
+ * with virTypedParamsFree().
+ *
+ * A group is forgotten once all its jobs ended, the final statistics are
+ * sent with the last VIR_DOMAIN_EVENT_ID_BLOCK_JOB_GROUP event.
+ *
+ * Returns 0 on success, -1 on failure, including when no group is
+ * running.
+ */
+int
+virDomainBlockJobGroupGetStats(virDomainPtr domain,
+                               virTypedParameterPtr *params,
+                               int *nparams,
+                               unsigned int flags)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(domain, "params=%p, nparams=%p, flags=%x",
+                     params, nparams, flags);
+
+    virResetLastError();
+
+    virCheckDomainReturn(domain, -1);
+    virCheckNonNullArgGoto(params, error);
+    virCheckNonNullArgGoto(nparams, error);
+
+    conn = domain->conn;
+
+    if (conn->driver->domainBlockJobGroupGetStats) {
+        int ret;
+        ret = conn->driver->domainBlockJobGroupGetStats(domain, params,
+                                                        nparams, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(conn);
+    return -1;
+}
+
+
+/**
+ * virDomainBlockJobGroupAbort:
+ * @domain: pointer to domain object
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Cancel the block job group started by virDomainBlockJobGroupStart().
+ * The disks still waiting for their job are dropped and the running jobs
+ * are aborted, which finishes asynchronously. As with any group, the
+ * VIR_DOMAIN_EVENT_ID_BLOCK_JOB_GROUP event without pending or running
+ * disks marks its end.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int
+virDomainBlockJobGroupAbort(virDomainPtr domain,
+                            unsigned int flags)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(domain, "flags=%x", flags);
+
+    virResetLastError();
+
+    virCheckDomainReturn(domain, -1);
+    conn = domain->conn;
+
+    virCheckReadOnlyGoto(conn->flags, error);
+
+    if (conn->driver->domainBlockJobGroupAbort) {
+        int ret;
+        ret = conn->driver->domainBlockJobGroupAbort(domain, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(conn);
+    return -1;
+}
@@ -1098,6 +1098,83 @@ virConnectBaselineCPU(virConnectPtr conn,
 }
 
 
+/**
+ * virConnectCompareCPUs:
+ * @conn: virConnect connection
+ * @xmlCPUs: array of XML descriptions of host CPUs
+ * @ncpus: number of CPUs in xmlCPUs
+ * @results: array of @ncpus * @ncpus comparison results, allocated by
+ *           the caller
+ * @baseline: pointer to store the XML description of the baseline CPU,
+ *            or NULL if it isn't wanted
+ * @flags: bitwise-OR of virConnectBaselineCPUFlags, used for @baseline
+ *
+ * Compares each of the given host CPUs with all the others in a single
+ * call, for example to find out to which hosts a domain can be migrated.
+ * Each CPU is parsed just once, so this is much cheaper than calling
+ * virConnectCompareCPU on every host with each of the other CPUs.
+ *
+ * @results[i * @ncpus + j] is set to the comparison result according to
+ * enum virCPUCompareResult of @xmlCPUs[j] with @xmlCPUs[i] taken as the
+ * host CPU, that is the result virConnectCompareCPU would return on the
+ * host @xmlCPUs[i] comes from when given @xmlCPUs[j]. Thus a domain using
+ * the CPU of host j can run on host i unless the result is
+ * VIR_CPU_COMPARE_INCOMPATIBLE.
+ *
+ * If @baseline is not NULL, it is set to the same CPU description
+ * virConnectBaselineCPU would compute for @xmlCPUs and @flags. The caller
+ * must free it.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virConnectCompareCPUs(virConnectPtr conn,
+                      const char **xmlCPUs,
+                      unsigned int ncpus,
+                      int *results,
+                      char **baseline,
+                      unsigned int flags)
+{
+    size_t i;
+
+    VIR_DEBUG("conn=%p, xmlCPUs=%p, ncpus=%u, results=%p, baseline=%p, "
+              "flags=%x", conn, xmlCPUs, ncpus, results, baseline, flags);
+    if (xmlCPUs) {
+        for (i = 0; i < ncpus; i++)
+            VIR_DEBUG("xmlCPUs[%zu]=%s", i, NULLSTR(xmlCPUs[i]));
+    }
+
+    virResetLastError();
+
+    if (baseline)
+        *baseline = NULL;
+
+    virCheckConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(xmlCPUs, error);
+    virCheckNonZeroArgGoto(ncpus, error);
+    virCheckNonNullArgGoto(results, error);
+
+    for (i = 0; i < ncpus; i++)
+        virCheckNonNullArgGoto(xmlCPUs[i], error);
+
+    if (conn->driver->connectCompareCPUs) {
+        int ret;
+
+        ret = conn->driver->connectCompareCPUs(conn, xmlCPUs, ncpus,
+                                               results, baseline, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(conn);
+    return -1;
+}
+
+
 /**
  * virConnectSetKeepAlive:
  * @conn: pointer to a hypervisor connection
@@ -1325,7 +1402,7 @@ virNodeGetCPUMap(virConnectPtr conn,
  * @cellCount: maximum number of cells for which free pages
  *             information can be returned.
  * @counts: returned counts of free pages
- * @flags: extra flags; not used yet, so callers should always pass 0
+ * @flags: bitwise-OR of virNodeGetFreePagesFlags
  *
  * This calls queries the host system on free pages of
  * specified size. For the input, @pages is expected to be
@@ -1372,6 +1449,14 @@ virNodeGetCPUMap(virConnectPtr conn,
  *    Page size=2097152 count=20 bytes=41943040
  *    Page size=1073741824 count=0 bytes=0
  *
+ * A huge page pool can be promised to domains well before they take the
+ * pages from it. With the VIR_NODE_GET_FREE_PAGES_RESERVED flag, @counts
+ * is filled with the number of pages reserved for running and starting
+ * domains instead, where the hypervisor keeps track of these. Pages of
+ * domains whose memory is not bound to a single host NUMA node are only
+ * accounted to the host as a whole, which is queried by passing -1 as
+ * @startCell.
+ *
  * Returns: the number of entries filled in @counts or -1 in case of error.
  */
 int
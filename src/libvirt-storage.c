@@ -21,7 +21,10 @@
 #include <config.h>
 
 #include "datatypes.h"
+#include "viralloc.h"
 #include "virlog.h"
+#include "virthread.h"
+#include "rpc/virnetprotocol.h"
 
 VIR_LOG_INIT("libvirt.storage");
 
@@ -1549,12 +1552,17 @@ virStorageVolCreateXMLFrom(virStoragePoolPtr pool,
  * @stream: stream to use as output
  * @offset: position in @vol to start reading from
  * @length: limit on amount of data to download
- * @flags: extra flags; not used yet, so callers should always pass 0
+ * @flags: bitwise-OR of virStorageVolDownloadFlags
  *
  * Download the content of the volume as a stream. If @length
  * is zero, then the remaining contents of the volume after
  * @offset will be downloaded.
  *
+ * If VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM is set in @flags
+ * holes in the volume are not transferred as zeroes but
+ * announced as hole records, which the caller can read with
+ * virStreamRecvFlags() and virStreamRecvHole().
+ *
  * This call sets up an asynchronous stream; subsequent use of
  * stream APIs is necessary to transfer the actual data,
  * determine how much data is successfully transferred, and
@@ -1613,7 +1621,7 @@ virStorageVolDownload(virStorageVolPtr vol,
  * @stream: stream to use as input
  * @offset: position to start writing to
  * @length: limit on amount of data to upload
- * @flags: extra flags; not used yet, so callers should always pass 0
+ * @flags: bitwise-OR of virStorageVolUploadFlags
  *
  * Upload new content to the volume from a stream. This call
  * will fail if @offset + @length exceeds the size of the
@@ -1625,7 +1633,9 @@ virStorageVolDownload(virStorageVolPtr vol,
  * stream APIs is necessary to transfer the actual data,
  * determine how much data is successfully transferred, and
  * detect any errors. The results will be unpredictable if
- * another active stream is writing to the storage volume.
+ * another active stream is writing to the same range of the storage
+ * volume. Several streams uploading distinct ranges can be active at
+ * once, see virStorageVolUploadParallel().
  *
  * When the data stream is closed whether the upload is successful
  * or not the target storage pool will be refreshed to reflect pool
@@ -1635,6 +1645,11 @@ virStorageVolDownload(virStorageVolPtr vol,
  * characteristics from the source stream such as format type,
  * capacity, and allocation.
  *
+ * If VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM is set in @flags the
+ * caller may use virStreamSendHole() to skip over ranges of the
+ * volume; they are created as holes (or zeroed) on the target
+ * rather than being transferred as data.
+ *
  * Returns 0, or -1 upon error.
  */
 int
@@ -1681,6 +1696,396 @@ virStorageVolUpload(virStorageVolPtr vol,
 }
 
 
+/* Most streams a parallel transfer may open */
+#define VIR_STORAGE_VOL_PARALLEL_MAX 64
+
+/* Ranges are multiples of this size, so transfers stay aligned */
+#define VIR_STORAGE_VOL_PARALLEL_ALIGN (1024 * 1024)
+
+typedef struct _virStorageVolParallel virStorageVolParallel;
+typedef virStorageVolParallel *virStorageVolParallelPtr;
+struct _virStorageVolParallel {
+    virStorageVolPtr vol;
+    virStorageVolRangeSinkFunc sink;      /* for downloads */
+    virStorageVolRangeSourceFunc source;  /* for uploads */
+    void *opaque;
+
+    virMutex lock;
+    bool failed;        /* the other ranges should give up */
+    virErrorPtr error;  /* first error reported by a range */
+};
+
+typedef struct _virStorageVolParallelRange virStorageVolParallelRange;
+typedef virStorageVolParallelRange *virStorageVolParallelRangePtr;
+struct _virStorageVolParallelRange {
+    virStorageVolParallelPtr job;
+    unsigned long long offset;
+    unsigned long long length;
+    virThread thread;
+};
+
+
+static bool
+virStorageVolParallelFailed(virStorageVolParallelPtr job)
+{
+    bool failed;
+
+    virMutexLock(&job->lock);
+    failed = job->failed;
+    virMutexUnlock(&job->lock);
+
+    return failed;
+}
+
+
+/* Fails the whole transfer, remembering the error of the first range
+ * which failed. */
+static void
+virStorageVolParallelFail(virStorageVolParallelPtr job)
+{
+    virMutexLock(&job->lock);
+    if (!job->failed) {
+        job->failed = true;
+        job->error = virSaveLastError();
+    }
+    virMutexUnlock(&job->lock);
+}
+
+
+static int
+virStorageVolParallelDownloadRange(virStorageVolParallelRangePtr range,
+                                   virStreamPtr st,
+                                   char *buf,
+                                   bool *stopped)
+{
+    virStorageVolParallelPtr job = range->job;
+    unsigned long long offset = range->offset;
+
+    /* The daemon ends the stream after @length bytes */
+    for (;;) {
+        int got;
+        int done = 0;
+
+        if (virStorageVolParallelFailed(job)) {
+            *stopped = true;
+            return -1;
+        }
+
+        if ((got = virStreamRecv(st, buf,
+                                 VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX)) < 0)
+            return -1;
+        if (got == 0)
+            return 0;
+
+        while (done < got) {
+            int rc = (job->sink)(job->vol, offset + done, buf + done,
+                                 got - done, job->opaque);
+            if (rc < 0)
+                return -1;
+            done += rc;
+        }
+        offset += got;
+    }
+}
+
+
+static int
+virStorageVolParallelUploadRange(virStorageVolParallelRangePtr range,
+                                 virStreamPtr st,
+                                 char *buf,
+                                 bool *stopped)
+{
+    virStorageVolParallelPtr job = range->job;
+    unsigned long long done = 0;
+
+    while (done < range->length) {
+        size_t want = MIN(range->length - done,
+                          VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX);
+        int got;
+        int sent = 0;
+
+        if (virStorageVolParallelFailed(job)) {
+            *stopped = true;
+            return -1;
+        }
+
+        if ((got = (job->source)(job->vol, range->offset + done, buf, want,
+                                 job->opaque)) < 0)
+            return -1;
+        if (got == 0) {
+            virReportError(VIR_ERR_OPERATION_FAILED,
+                           _("no data to upload at offset %llu"),
+                           range->offset + done);
+            return -1;
+        }
+
+        while (sent < got) {
+            int rc = virStreamSend(st, buf + sent, got - sent);
+            if (rc < 0)
+                return -1;
+            sent += rc;
+        }
+        done += got;
+    }
+
+    return 0;
+}
+
+
+static void
+virStorageVolParallelWorker(void *opaque)
+{
+    virStorageVolParallelRangePtr range = opaque;
+    virStorageVolParallelPtr job = range->job;
+    virStreamPtr st = NULL;
+    char *buf = NULL;
+    bool stopped = false;
+    int rc = -1;
+
+    VIR_DEBUG("vol=%p, offset=%llu, length=%llu",
+              job->vol, range->offset, range->length);
+
+    if (VIR_ALLOC_N(buf, VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX) < 0 ||
+        !(st = virStreamNew(job->vol->conn, 0)))
+        goto cleanup;
+
+    if (job->sink) {
+        if (virStorageVolDownload(job->vol, st, range->offset,
+                                  range->length, 0) < 0)
+            goto cleanup;
+        rc = virStorageVolParallelDownloadRange(range, st, buf, &stopped);
+    } else {
+        if (virStorageVolUpload(job->vol, st, range->offset,
+                                range->length, 0) < 0)
+            goto cleanup;
+        rc = virStorageVolParallelUploadRange(range, st, buf, &stopped);
+    }
+
+    if (rc == 0)
+        rc = virStreamFinish(st);
+
+ cleanup:
+    if (rc < 0) {
+        if (!stopped)
+            virStorageVolParallelFail(job);
+        if (st)
+            virStreamAbort(st);
+    }
+    if (st)
+        virStreamFree(st);
+    VIR_FREE(buf);
+}
+
+
+/* Splits @length bytes from @offset into at most @nstreams ranges and
+ * transfers them in parallel threads. */
+static int
+virStorageVolParallelRun(virStorageVolParallelPtr job,
+                         unsigned long long offset,
+                         unsigned long long length,
+                         unsigned int nstreams)
+{
+    virStorageVolParallelRangePtr ranges = NULL;
+    unsigned long long chunk;
+    size_t nranges;
+    size_t started = 0;
+    size_t i;
+    int ret = -1;
+
+    if (nstreams > VIR_STORAGE_VOL_PARALLEL_MAX) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("at most %d streams can be used"),
+                       VIR_STORAGE_VOL_PARALLEL_MAX);
+        return -1;
+    }
+
+    /* avoid VIR_DIV_UP which could overflow for huge lengths */
+    chunk = length / nstreams + !!(length % nstreams);
+    chunk = VIR_ROUND_UP(chunk, VIR_STORAGE_VOL_PARALLEL_ALIGN);
+    nranges = length / chunk + !!(length % chunk);
+
+    if (virMutexInit(&job->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("unable to initialize mutex"));
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(ranges, nranges) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Transferring %llu bytes in %zu ranges of %llu bytes",
+              length, nranges, chunk);
+
+    for (i = 0; i < nranges; i++) {
+        ranges[i].job = job;
+        ranges[i].offset = offset + i * chunk;
+        ranges[i].length = MIN(chunk, length - i * chunk);
+
+        if (virThreadCreate(&ranges[i].thread, true,
+                            virStorageVolParallelWorker, &ranges[i]) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("unable to create transfer thread"));
+            virStorageVolParallelFail(job);
+            break;
+        }
+        started++;
+    }
+
+    for (i = 0; i < started; i++)
+        virThreadJoin(&ranges[i].thread);
+
+    if (job->failed) {
+        if (job->error && job->error->code != VIR_ERR_OK)
+            virSetError(job->error);
+        else
+            virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                           _("parallel volume transfer failed"));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virFreeError(job->error);
+    job->error = NULL;
+    virMutexDestroy(&job->lock);
+    VIR_FREE(ranges);
+    return ret;
+}
+
+
+/**
+ * virStorageVolDownloadParallel:
+ * @vol: pointer to volume to download from
+ * @offset: position in @vol to start reading from
+ * @length: limit on amount of data to download
+ * @nstreams: number of streams to transfer the data with
+ * @handler: callback storing the received data
+ * @opaque: application defined data passed to @handler
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Download the content of the volume split into up to @nstreams ranges
+ * which are transferred at the same time, each through its own stream
+ * created with virStorageVolDownload(). This helps with fast links,
+ * where a single stream cannot keep up. If @length is zero or reaches
+ * past the physical end of the volume, the data up to that end is
+ * downloaded.
+ *
+ * The call blocks until all ranges were transferred. @handler is called
+ * from several threads at once with the offset of every chunk of data,
+ * see virStorageVolRangeSinkFunc. When one of the ranges fails, the
+ * others are aborted and the error of the first failure is reported.
+ *
+ * Returns 0 on success, or -1 upon error.
+ */
+int
+virStorageVolDownloadParallel(virStorageVolPtr vol,
+                              unsigned long long offset,
+                              unsigned long long length,
+                              unsigned int nstreams,
+                              virStorageVolRangeSinkFunc handler,
+                              void *opaque,
+                              unsigned int flags)
+{
+    virStorageVolParallel job = { .vol = vol, .sink = handler,
+                                  .opaque = opaque };
+    virStorageVolInfo info;
+
+    VIR_DEBUG("vol=%p, offset=%llu, length=%llu, nstreams=%u, handler=%p, "
+              "opaque=%p, flags=%x",
+              vol, offset, length, nstreams, handler, opaque, flags);
+
+    virResetLastError();
+
+    virCheckStorageVolReturn(vol, -1);
+    virCheckReadOnlyGoto(vol->conn->flags, error);
+    virCheckPositiveArgGoto(nstreams, error);
+    virCheckNonNullArgGoto(handler, error);
+    virCheckFlagsGoto(0, error);
+
+    /* Each range is limited to its own extent, so the total length has
+     * to be clamped to the end of the volume up front. */
+    if (virStorageVolGetInfoFlags(vol, &info,
+                                  VIR_STORAGE_VOL_GET_PHYSICAL) < 0)
+        goto error;
+
+    if (info.allocation <= offset)
+        return 0;
+    if (length == 0 || length > info.allocation - offset)
+        length = info.allocation - offset;
+
+    if (virStorageVolParallelRun(&job, offset, length, nstreams) < 0)
+        goto error;
+
+    return 0;
+
+ error:
+    virDispatchError(vol->conn);
+    return -1;
+}
+
+
+/**
+ * virStorageVolUploadParallel:
+ * @vol: pointer to volume to upload to
+ * @offset: position in @vol to start writing to
+ * @length: amount of data to upload
+ * @nstreams: number of streams to transfer the data with
+ * @handler: callback providing the data to send
+ * @opaque: application defined data passed to @handler
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Upload @length bytes of new content to the volume split into up to
+ * @nstreams ranges which are transferred at the same time, each through
+ * its own stream created with virStorageVolUpload(). This helps with
+ * fast links, where a single stream cannot keep up. Unlike with
+ * virStorageVolUpload(), @length cannot be zero as it must be known
+ * how to split the data.
+ *
+ * The call blocks until all ranges were transferred. @handler is called
+ * from several threads at once with the offset of every chunk of data,
+ * see virStorageVolRangeSourceFunc. When one of the ranges fails, the
+ * others are aborted and the error of the first failure is reported; the
+ * content of the volume is then undefined.
+ *
+ * Returns 0 on success, or -1 upon error.
+ */
+int
+virStorageVolUploadParallel(virStorageVolPtr vol,
+                            unsigned long long offset,
+                            unsigned long long length,
+                            unsigned int nstreams,
+                            virStorageVolRangeSourceFunc handler,
+                            void *opaque,
+                            unsigned int flags)
+{
+    virStorageVolParallel job = { .vol = vol, .source = handler,
+                                  .opaque = opaque };
+
+    VIR_DEBUG("vol=%p, offset=%llu, length=%llu, nstreams=%u, handler=%p, "
+              "opaque=%p, flags=%x",
+              vol, offset, length, nstreams, handler, opaque, flags);
+
+    virResetLastError();
+
+    virCheckStorageVolReturn(vol, -1);
+    virCheckReadOnlyGoto(vol->conn->flags, error);
+    virCheckPositiveArgGoto(nstreams, error);
+    virCheckNonZeroArgGoto(length, error);
+    virCheckNonNullArgGoto(handler, error);
+    virCheckFlagsGoto(0, error);
+
+    if (virStorageVolParallelRun(&job, offset, length, nstreams) < 0)
+        goto error;
+
+    return 0;
+
+ error:
+    virDispatchError(vol->conn);
+    return -1;
+}
+
+
 /**
  * virStorageVolDelete:
  * @vol: pointer to storage volume
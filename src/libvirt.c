@@ -745,9 +745,9 @@ virRegisterStateDriver(virStateDriverPtr driver)
  * @callback: callback to invoke to inhibit shutdown of the daemon
  * @opaque: data to pass to @callback
  *
- * Initialize all virtualization drivers. Accomplished in two phases,
- * the first being state and structure initialization followed by any
- * auto start supported by the driver.  This is done to ensure dependencies
+ * Initialize the state and structures of all virtualization drivers, in
+ * the order they were registered. The auto start supported by the drivers
+ * is a separate phase, see virStateAutoStart, which ensures dependencies
  * that some drivers may have on another driver having been initialized
  * will exist, such as the storage driver's need to use the secret driver.
  *
@@ -777,6 +777,24 @@ virStateInitialize(bool privileged,
             }
         }
     }
+    return 0;
+}
+
+
+/**
+ * virStateAutoStart:
+ *
+ * Run the auto start of all virtualization drivers initialized by
+ * virStateInitialize. Since starting the autostart networks, storage
+ * pools and domains can take a long time, the daemon does this after it
+ * started serving clients. The drivers are still processed in the order
+ * they were registered, so the resources the domains depend on are
+ * started before the domains.
+ */
+void
+virStateAutoStart(void)
+{
+    size_t i;
 
     for (i = 0; i < virStateDriverTabCount; i++) {
         if (virStateDriverTab[i]->stateAutoStart) {
@@ -785,7 +803,6 @@ virStateInitialize(bool privileged,
             virStateDriverTab[i]->stateAutoStart();
         }
     }
-    return 0;
 }
 
 
@@ -33,6 +33,7 @@ typedef void (*virStateInhibitCallback)(bool inhibit,
 int virStateInitialize(bool privileged,
                        virStateInhibitCallback inhibit,
                        void *opaque);
+void virStateAutoStart(void);
 int virStateCleanup(void);
 int virStateReload(void);
 int virStateStop(void);
@@ -123,6 +124,17 @@ enum {
      * Support for driver close callback rpc
      */
     VIR_DRV_FEATURE_REMOTE_CLOSE_CALLBACK = 15,
+
+    /*
+     * Support for batches of calls in a single RPC message
+     */
+    VIR_DRV_FEATURE_REMOTE_CALL_BATCH = 16,
+
+    /*
+     * Support for stream data messages of up to
+     * VIR_NET_MESSAGE_STREAM_PAYLOAD_MAX bytes
+     */
+    VIR_DRV_FEATURE_REMOTE_STREAM_LARGE_FRAMES = 17,
 };
 
 
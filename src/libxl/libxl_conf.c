@@ -1528,6 +1528,8 @@ int libxlDriverConfigLoadFile(libxlDriverConfigPtr cfg,
     cfg->keepAliveInterval = 5;
     cfg->keepAliveCount = 5;
 
+    cfg->eventWorkers = 8;
+
     /* Check the file is readable before opening it, otherwise
      * libvirt emits an error.
      */
@@ -1552,6 +1554,15 @@ int libxlDriverConfigLoadFile(libxlDriverConfigPtr cfg,
     if (virConfGetValueUInt(conf, "keepalive_count", &cfg->keepAliveCount) < 0)
         goto cleanup;
 
+    if (virConfGetValueUInt(conf, "event_workers", &cfg->eventWorkers) < 0)
+        goto cleanup;
+
+    if (cfg->eventWorkers == 0) {
+        virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                       _("event_workers must be greater than 0"));
+        goto cleanup;
+    }
+
     ret = 0;
 
  cleanup:
@@ -38,6 +38,7 @@
 # include "virobject.h"
 # include "virchrdev.h"
 # include "virhostdev.h"
+# include "virthreadpool.h"
 # include "locking/lock_manager.h"
 # include "virfirmware.h"
 # include "libxl_capabilities.h"
@@ -88,6 +89,8 @@ struct _libxlDriverConfig {
     int keepAliveInterval;
     unsigned int keepAliveCount;
 
+    unsigned int eventWorkers;
+
     /* Once created, caps are immutable */
     virCapsPtr caps;
 
@@ -141,6 +144,17 @@ struct _libxlDriverPrivate {
 
     /* Immutable pointer. lockless access */
     virLockManagerPluginPtr lockManager;
+
+    /* Immutable pointer, self-locking APIs */
+    virThreadPoolPtr eventPool;
+
+    /* Require lock. Domain events received from libxl and not processed
+     * yet, in the order they arrived, and the IDs of the domains whose
+     * events are being processed by a worker of eventPool */
+    libxl_event **events;
+    size_t nevents;
+    int *eventDomids;
+    size_t neventDomids;
 };
 
 # define LIBXL_SAVE_MAGIC "libvirt-xml\n \0 \r"
@@ -431,20 +431,11 @@ virDomainDefParserConfig libxlDomainDefParserConfig = {
 };
 
 
-struct libxlShutdownThreadInfo
-{
-    libxlDriverPrivatePtr driver;
-    libxl_event *event;
-};
-
-
 static void
-libxlDomainShutdownThread(void *opaque)
+libxlDomainShutdownHandle(libxlDriverPrivatePtr driver,
+                          libxl_event *ev)
 {
-    struct libxlShutdownThreadInfo *shutdown_info = opaque;
     virDomainObjPtr vm = NULL;
-    libxl_event *ev = shutdown_info->event;
-    libxlDriverPrivatePtr driver = shutdown_info->driver;
     virObjectEventPtr dom_event = NULL;
     libxl_shutdown_reason xl_reason = ev->u.domain_shutdown.shutdown_reason;
     libxlDriverConfigPtr cfg;
@@ -554,10 +545,62 @@ libxlDomainShutdownThread(void *opaque)
     if (dom_event)
         libxlDomainEventQueue(driver, dom_event);
     libxl_event_free(cfg->ctx, ev);
-    VIR_FREE(shutdown_info);
     virObjectUnref(cfg);
 }
 
+
+/* Returns the oldest queued event of @domid, or NULL once there are
+ * none left, in which case the caller stops processing @domid events */
+static libxl_event *
+libxlDomainEventDequeue(libxlDriverPrivatePtr driver,
+                        int domid)
+{
+    libxl_event *ev = NULL;
+    size_t i;
+
+    libxlDriverLock(driver);
+
+    for (i = 0; i < driver->nevents; i++) {
+        if (driver->events[i]->domid == domid) {
+            ev = driver->events[i];
+            VIR_DELETE_ELEMENT(driver->events, i, driver->nevents);
+            break;
+        }
+    }
+
+    if (!ev) {
+        for (i = 0; i < driver->neventDomids; i++) {
+            if (driver->eventDomids[i] == domid) {
+                VIR_DELETE_ELEMENT(driver->eventDomids, i,
+                                   driver->neventDomids);
+                break;
+            }
+        }
+    }
+
+    libxlDriverUnlock(driver);
+    return ev;
+}
+
+
+/*
+ * Worker of driver->eventPool processing all the events of one domain
+ * in order. At most one worker handles the events of a given domain,
+ * while the events of other domains are processed in parallel.
+ */
+void
+libxlDomainEventWorker(void *data, void *opaque)
+{
+    libxlDriverPrivatePtr driver = opaque;
+    int *domid = data;
+    libxl_event *ev;
+
+    while ((ev = libxlDomainEventDequeue(driver, *domid)))
+        libxlDomainShutdownHandle(driver, ev);
+
+    VIR_FREE(domid);
+}
+
 /*
  * Handle previously registered domain event notification from libxenlight.
  */
@@ -566,8 +609,10 @@ libxlDomainEventHandler(void *data, VIR_LIBXL_EVENT_CONST libxl_event *event)
 {
     libxlDriverPrivatePtr driver = data;
     libxl_shutdown_reason xl_reason = event->u.domain_shutdown.shutdown_reason;
-    struct libxlShutdownThreadInfo *shutdown_info = NULL;
-    virThread thread;
+    libxl_event *ev = (libxl_event *)event; /* Cast away any const */
+    int *domid = NULL;
+    bool busy = false;
+    size_t i;
     libxlDriverConfigPtr cfg;
 
     if (event->type != LIBXL_EVENT_TYPE_DOMAIN_SHUTDOWN) {
@@ -583,34 +628,82 @@ libxlDomainEventHandler(void *data, VIR_LIBXL_EVENT_CONST libxl_event *event)
         goto error;
 
     /*
-     * Start a thread to handle shutdown.  We don't want to be tying up
-     * libxl's event machinery by doing a potentially lengthy shutdown.
+     * Queue the event for the worker pool.  We don't want to be tying up
+     * libxl's event machinery by doing a potentially lengthy shutdown, nor
+     * to look at the domain object here as its lock may be held while
+     * waiting for libxl.  Events of a domain are processed in order by a
+     * single worker, events of other domains by other workers.
      */
-    if (VIR_ALLOC(shutdown_info) < 0)
+    if (!driver->eventPool || VIR_ALLOC(domid) < 0)
         goto error;
+    *domid = event->domid;
 
-    shutdown_info->driver = driver;
-    shutdown_info->event = (libxl_event *)event;
-    if (virThreadCreate(&thread, false, libxlDomainShutdownThread,
-                        shutdown_info) < 0) {
+    libxlDriverLock(driver);
+
+    if (VIR_APPEND_ELEMENT_COPY(driver->events, driver->nevents, ev) < 0) {
+        libxlDriverUnlock(driver);
+        goto error;
+    }
+
+    for (i = 0; i < driver->neventDomids; i++) {
+        if (driver->eventDomids[i] == *domid) {
+            busy = true;
+            break;
+        }
+    }
+
+    if (!busy &&
+        (VIR_APPEND_ELEMENT_COPY(driver->eventDomids,
+                                 driver->neventDomids, *domid) < 0 ||
+         virThreadPoolSendJob(driver->eventPool, 0, domid) < 0)) {
         /*
          * Not much we can do on error here except log it.
          */
-        VIR_ERROR(_("Failed to create thread to handle domain shutdown"));
+        VIR_ERROR(_("Failed to queue domain shutdown event"));
+        for (i = 0; i < driver->neventDomids; i++) {
+            if (driver->eventDomids[i] == *domid) {
+                VIR_DELETE_ELEMENT(driver->eventDomids, i,
+                                   driver->neventDomids);
+                break;
+            }
+        }
+        VIR_DELETE_ELEMENT(driver->events, driver->nevents - 1,
+                           driver->nevents);
+        libxlDriverUnlock(driver);
         goto error;
     }
 
+    libxlDriverUnlock(driver);
+
     /*
-     * libxlShutdownThreadInfo and libxl_event are freed in shutdown thread
+     * The event is freed once processed, @domid by the worker that got it
      */
+    if (busy)
+        VIR_FREE(domid);
     return;
 
  error:
     cfg = libxlDriverConfigGet(driver);
-    /* Cast away any const */
-    libxl_event_free(cfg->ctx, (libxl_event *)event);
+    libxl_event_free(cfg->ctx, ev);
     virObjectUnref(cfg);
-    VIR_FREE(shutdown_info);
+    VIR_FREE(domid);
+}
+
+
+/*
+ * Frees the events left unprocessed after driver->eventPool was freed.
+ */
+void
+libxlDomainEventsFree(libxlDriverPrivatePtr driver)
+{
+    size_t i;
+
+    for (i = 0; i < driver->nevents; i++)
+        libxl_event_free(driver->config->ctx, driver->events[i]);
+    VIR_FREE(driver->events);
+    driver->nevents = 0;
+    VIR_FREE(driver->eventDomids);
+    driver->neventDomids = 0;
 }
 
 void
@@ -134,6 +134,12 @@ void
 libxlDomainEventHandler(void *data,
                         VIR_LIBXL_EVENT_CONST libxl_event *event);
 
+void
+libxlDomainEventWorker(void *data, void *opaque);
+
+void
+libxlDomainEventsFree(libxlDriverPrivatePtr driver);
+
 int
 libxlDomainAutoCoreDump(libxlDriverPrivatePtr driver,
                         virDomainObjPtr vm);
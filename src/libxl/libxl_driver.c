@@ -473,6 +473,11 @@ libxlStateCleanup(void)
     if (!libxl_driver)
         return -1;
 
+    virThreadPoolFree(libxl_driver->eventPool);
+    libxl_driver->eventPool = NULL;
+    if (libxl_driver->config)
+        libxlDomainEventsFree(libxl_driver);
+
     virObjectUnref(libxl_driver->hostdevMgr);
     virObjectUnref(libxl_driver->config);
     virObjectUnref(libxl_driver->xmlopt);
@@ -685,6 +690,11 @@ libxlStateInitialize(bool privileged,
         goto error;
     VIR_FREE(driverConf);
 
+    if (!(libxl_driver->eventPool = virThreadPoolNew(0, cfg->eventWorkers, 0,
+                                                     libxlDomainEventWorker,
+                                                     libxl_driver)))
+        goto error;
+
     /* Register the callbacks providing access to libvirt's event loop */
     libxl_osevent_register_hooks(cfg->ctx, &libxl_osevent_callbacks, cfg->ctx);
 
@@ -72,6 +72,7 @@ virLockDaemonConfigNew(bool privileged ATTRIBUTE_UNUSED)
         return NULL;
 
     data->max_clients = 1024;
+    data->max_workers = 1;
 
     return data;
 }
@@ -100,6 +101,14 @@ virLockDaemonConfigLoadOptions(virLockDaemonConfigPtr data,
         return -1;
     if (virConfGetValueUInt(conf, "max_clients", &data->max_clients) < 0)
         return -1;
+    if (virConfGetValueUInt(conf, "max_workers", &data->max_workers) < 0)
+        return -1;
+
+    if (data->max_workers == 0) {
+        virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                       _("max_workers must be greater than 0"));
+        return -1;
+    }
 
     return 0;
 }
@@ -24,12 +24,14 @@
 
 #include "rpc/virnetdaemon.h"
 #include "rpc/virnetserverclient.h"
+#include "viralloc.h"
 #include "virlog.h"
 #include "virstring.h"
 #include "lock_daemon.h"
 #include "lock_protocol.h"
 #include "virerror.h"
 #include "virthreadjob.h"
+#include "virtrace.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
@@ -97,6 +99,97 @@ virLockSpaceProtocolDispatchAcquireResource(virNetServerPtr server ATTRIBUTE_UNU
 }
 
 
+static int
+virLockSpaceProtocolDispatchAcquireResources(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                             virNetServerClientPtr client,
+                                             virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                             virNetMessageErrorPtr rerr,
+                                             virLockSpaceProtocolAcquireResourcesArgs *args)
+{
+    int rv = -1;
+    unsigned int flags = args->flags;
+    virLockDaemonClientPtr priv =
+        virNetServerClientGetPrivateData(client);
+    virLockSpaceProtocolAcquireResourceArgs *resources =
+        args->resources.resources_val;
+    virLockSpacePtr *lockspaces = NULL;
+    size_t nacquired = 0;
+    size_t i;
+
+    virMutexLock(&priv->lock);
+
+    virCheckFlagsGoto(0, cleanup);
+
+    if (priv->restricted) {
+        virReportError(VIR_ERR_OPERATION_DENIED, "%s",
+                       _("lock manager connection has been restricted"));
+        goto cleanup;
+    }
+
+    if (!priv->ownerId) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("lock owner details have not been registered"));
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(lockspaces, args->resources.resources_len) < 0)
+        goto cleanup;
+
+    for (i = 0; i < args->resources.resources_len; i++) {
+        unsigned int newFlags = 0;
+
+        if (resources[i].flags &
+            ~(VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_SHARED |
+              VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_AUTOCREATE)) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("unsupported flags (0x%x) for resource %s"),
+                           resources[i].flags, resources[i].name);
+            goto cleanup;
+        }
+
+        if (!(lockspaces[i] = virLockDaemonFindLockSpace(lockDaemon,
+                                                         resources[i].path))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Lockspace for path %s does not exist"),
+                           resources[i].path);
+            goto cleanup;
+        }
+
+        if (resources[i].flags & VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_SHARED)
+            newFlags |= VIR_LOCK_SPACE_ACQUIRE_SHARED;
+        if (resources[i].flags & VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_AUTOCREATE)
+            newFlags |= VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE;
+
+        if (virLockSpaceAcquireResource(lockspaces[i],
+                                        resources[i].name,
+                                        priv->ownerPid,
+                                        newFlags) < 0)
+            goto cleanup;
+        nacquired++;
+    }
+
+    rv = 0;
+
+ cleanup:
+    if (rv < 0) {
+        virErrorPtr saved = virSaveLastError();
+
+        /* Either all the resources are acquired, or none */
+        for (i = nacquired; i > 0; i--)
+            ignore_value(virLockSpaceReleaseResource(lockspaces[i - 1],
+                                                     resources[i - 1].name,
+                                                     priv->ownerPid));
+
+        virSetError(saved);
+        virFreeError(saved);
+        virNetMessageSaveError(rerr);
+    }
+    VIR_FREE(lockspaces);
+    virMutexUnlock(&priv->lock);
+    return rv;
+}
+
+
 static int
 virLockSpaceProtocolDispatchCreateResource(virNetServerPtr server ATTRIBUTE_UNUSED,
                                            virNetServerClientPtr client,
@@ -642,27 +642,37 @@ static int virLockManagerLockDaemonAcquire(virLockManagerPtr lock,
         (*fd = virNetClientDupFD(client, false)) < 0)
         goto cleanup;
 
-    if (!(flags & VIR_LOCK_MANAGER_ACQUIRE_REGISTER_ONLY)) {
+    /* All the leases are acquired in a single call, which either gets
+     * all of them or none */
+    if (!(flags & VIR_LOCK_MANAGER_ACQUIRE_REGISTER_ONLY) &&
+        priv->nresources) {
+        virLockSpaceProtocolAcquireResourcesArgs args;
         size_t i;
-        for (i = 0; i < priv->nresources; i++) {
-            virLockSpaceProtocolAcquireResourceArgs args;
 
-            memset(&args, 0, sizeof(args));
+        memset(&args, 0, sizeof(args));
+
+        if (VIR_ALLOC_N(args.resources.resources_val, priv->nresources) < 0)
+            goto cleanup;
+        args.resources.resources_len = priv->nresources;
 
+        for (i = 0; i < priv->nresources; i++) {
             if (priv->resources[i].lockspace)
-                args.path = priv->resources[i].lockspace;
-            args.name = priv->resources[i].name;
-            args.flags = priv->resources[i].flags;
-
-            if (virNetClientProgramCall(program,
-                                        client,
-                                        counter++,
-                                        VIR_LOCK_SPACE_PROTOCOL_PROC_ACQUIRE_RESOURCE,
-                                        0, NULL, NULL, NULL,
-                                        (xdrproc_t)xdr_virLockSpaceProtocolAcquireResourceArgs, &args,
-                                        (xdrproc_t)xdr_void, NULL) < 0)
-                goto cleanup;
+                args.resources.resources_val[i].path = priv->resources[i].lockspace;
+            args.resources.resources_val[i].name = priv->resources[i].name;
+            args.resources.resources_val[i].flags = priv->resources[i].flags;
+        }
+
+        if (virNetClientProgramCall(program,
+                                    client,
+                                    counter++,
+                                    VIR_LOCK_SPACE_PROTOCOL_PROC_ACQUIRE_RESOURCES,
+                                    0, NULL, NULL, NULL,
+                                    (xdrproc_t)xdr_virLockSpaceProtocolAcquireResourcesArgs, &args,
+                                    (xdrproc_t)xdr_void, NULL) < 0) {
+            VIR_FREE(args.resources.resources_val);
+            goto cleanup;
         }
+        VIR_FREE(args.resources.resources_val);
     }
 
     if ((flags & VIR_LOCK_MANAGER_ACQUIRE_RESTRICT) &&
@@ -167,6 +167,8 @@ virLogDaemonNew(virLogDaemonConfigPtr config, bool privileged)
     if (!(logd->handler = virLogHandlerNew(privileged,
                                            config->max_size,
                                            config->max_backups,
+                                           config->flush_interval,
+                                           config->max_rate,
                                            virLogDaemonInhibitor,
                                            logd)))
         goto error;
@@ -231,6 +233,8 @@ virLogDaemonNewPostExecRestart(virJSONValuePtr object, bool privileged,
                                                           privileged,
                                                           config->max_size,
                                                           config->max_backups,
+                                                          config->flush_interval,
+                                                          config->max_rate,
                                                           virLogDaemonInhibitor,
                                                           logd)))
         goto error;
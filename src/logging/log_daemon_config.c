@@ -107,6 +107,10 @@ virLogDaemonConfigLoadOptions(virLogDaemonConfigPtr data,
         return -1;
     if (virConfGetValueSizeT(conf, "max_backups", &data->max_backups) < 0)
         return -1;
+    if (virConfGetValueUInt(conf, "flush_interval", &data->flush_interval) < 0)
+        return -1;
+    if (virConfGetValueSizeT(conf, "max_rate", &data->max_rate) < 0)
+        return -1;
 
     return 0;
 }
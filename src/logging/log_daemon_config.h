@@ -37,6 +37,9 @@ struct _virLogDaemonConfig {
 
     size_t max_backups;
     size_t max_size;
+
+    unsigned int flush_interval;
+    size_t max_rate;
 };
 
 
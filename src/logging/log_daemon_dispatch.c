@@ -30,6 +30,7 @@
 #include "log_protocol.h"
 #include "virerror.h"
 #include "virthreadjob.h"
+#include "virtrace.h"
 #include "virfile.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
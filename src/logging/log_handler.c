@@ -30,6 +30,7 @@
 #include "virstring.h"
 #include "virlog.h"
 #include "virrotatingfile.h"
+#include "virtime.h"
 #include "viruuid.h"
 
 #include <unistd.h>
@@ -43,6 +44,10 @@ VIR_LOG_INIT("logging.log_handler");
 
 #define DEFAULT_MODE 0600
 
+/* Size of the buffer collecting the output of each domain when the
+ * writes are delayed by flush_interval */
+#define BUFFER_SIZE (64 * 1024)
+
 typedef struct _virLogHandlerLogFile virLogHandlerLogFile;
 typedef virLogHandlerLogFile *virLogHandlerLogFilePtr;
 
@@ -54,6 +59,12 @@ struct _virLogHandlerLogFile {
     char *driver;
     unsigned char domuuid[VIR_UUID_BUFLEN];
     char *domname;
+
+    /* Rate limiting of the output read from QEMU, a token bucket
+     * holding up to one second worth of max_rate bytes */
+    unsigned long long credit;
+    unsigned long long lastRefill; /* in milliseconds */
+    unsigned long long dropped;
 };
 
 struct _virLogHandler {
@@ -62,6 +73,9 @@ struct _virLogHandler {
     bool privileged;
     size_t max_size;
     size_t max_backups;
+    unsigned int flush_interval;
+    size_t max_rate;
+    int flushTimer;
 
     virLogHandlerLogFilePtr *files;
     size_t nfiles;
@@ -122,6 +136,106 @@ virLogHandlerLogFileClose(virLogHandlerPtr handler,
 }
 
 
+static virRotatingFileWriterPtr
+virLogHandlerNewWriter(virLogHandlerPtr handler,
+                       const char *path,
+                       bool trunc)
+{
+    virRotatingFileWriterPtr writer;
+
+    if (!(writer = virRotatingFileWriterNew(path,
+                                            handler->max_size,
+                                            handler->max_backups,
+                                            trunc,
+                                            DEFAULT_MODE)))
+        return NULL;
+
+    if (handler->flush_interval &&
+        virRotatingFileWriterSetBufferSize(writer, BUFFER_SIZE) < 0) {
+        virRotatingFileWriterFree(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+
+static void
+virLogHandlerFlushTimer(int timer ATTRIBUTE_UNUSED,
+                        void *opaque)
+{
+    virLogHandlerPtr handler = opaque;
+    size_t i;
+
+    virObjectLock(handler);
+    for (i = 0; i < handler->nfiles; i++) {
+        if (virRotatingFileWriterFlush(handler->files[i]->file) < 0) {
+            VIR_WARN("Unable to flush log file %s: %s",
+                     virRotatingFileWriterGetPath(handler->files[i]->file),
+                     virGetLastErrorMessage());
+            virResetLastError();
+        }
+    }
+    virObjectUnlock(handler);
+}
+
+
+static void
+virLogHandlerFlushAll(virLogHandlerPtr handler)
+{
+    size_t i;
+
+    for (i = 0; i < handler->nfiles; i++) {
+        if (virRotatingFileWriterFlush(handler->files[i]->file) < 0)
+            virResetLastError();
+    }
+}
+
+
+/*
+ * Check whether @len more bytes from QEMU may be written to @logfile,
+ * counting them as dropped if not.
+ */
+static bool
+virLogHandlerLogFileCharge(virLogHandlerPtr handler,
+                           virLogHandlerLogFilePtr logfile,
+                           size_t len)
+{
+    unsigned long long now;
+
+    if (!handler->max_rate)
+        return true;
+
+    if (virTimeMillisNowRaw(&now) < 0)
+        return true;
+
+    if (now > logfile->lastRefill) {
+        logfile->credit += (now - logfile->lastRefill) * handler->max_rate / 1000;
+        if (logfile->credit > handler->max_rate)
+            logfile->credit = handler->max_rate;
+        logfile->lastRefill = now;
+    }
+
+    if (len > logfile->credit) {
+        logfile->dropped += len;
+        return false;
+    }
+
+    logfile->credit -= len;
+    return true;
+}
+
+
+static void
+virLogHandlerLogFileInitRate(virLogHandlerPtr handler,
+                             virLogHandlerLogFilePtr logfile)
+{
+    logfile->credit = handler->max_rate;
+    if (virTimeMillisNowRaw(&logfile->lastRefill) < 0)
+        logfile->lastRefill = 0;
+}
+
+
 static virLogHandlerLogFilePtr
 virLogHandlerGetLogFileFromWatch(virLogHandlerPtr handler,
                                  int watch)
@@ -167,8 +281,27 @@ virLogHandlerDomainLogFileEvent(int watch,
         goto error;
     }
 
-    if (virRotatingFileWriterAppend(logfile->file, buf, len) != len)
-        goto error;
+    if (virLogHandlerLogFileCharge(handler, logfile, len)) {
+        if (logfile->dropped) {
+            char *msg = NULL;
+
+            if (virAsprintf(&msg, "virtlogd: dropped %llu bytes of output "
+                            "exceeding the rate limit\n",
+                            logfile->dropped) < 0)
+                goto error;
+            logfile->dropped = 0;
+
+            if (virRotatingFileWriterAppend(logfile->file,
+                                            msg, strlen(msg)) < 0) {
+                VIR_FREE(msg);
+                goto error;
+            }
+            VIR_FREE(msg);
+        }
+
+        if (virRotatingFileWriterAppend(logfile->file, buf, len) != len)
+            goto error;
+    }
 
     if (events & VIR_EVENT_HANDLE_HANGUP)
         goto error;
@@ -187,6 +320,8 @@ virLogHandlerPtr
 virLogHandlerNew(bool privileged,
                  size_t max_size,
                  size_t max_backups,
+                 unsigned int flush_interval,
+                 size_t max_rate,
                  virLogHandlerShutdownInhibitor inhibitor,
                  void *opaque)
 {
@@ -201,9 +336,20 @@ virLogHandlerNew(bool privileged,
     handler->privileged = privileged;
     handler->max_size = max_size;
     handler->max_backups = max_backups;
+    handler->flush_interval = flush_interval;
+    handler->max_rate = max_rate;
+    handler->flushTimer = -1;
     handler->inhibitor = inhibitor;
     handler->opaque = opaque;
 
+    if (flush_interval &&
+        (handler->flushTimer = virEventAddTimeout(flush_interval,
+                                                  virLogHandlerFlushTimer,
+                                                  handler, NULL)) < 0) {
+        virObjectUnref(handler);
+        goto error;
+    }
+
     return handler;
 
  error:
@@ -258,12 +404,9 @@ virLogHandlerLogFilePostExecRestart(virLogHandlerPtr handler,
         goto error;
     }
 
-    if ((file->file = virRotatingFileWriterNew(path,
-                                               handler->max_size,
-                                               handler->max_backups,
-                                               false,
-                                               DEFAULT_MODE)) == NULL)
+    if ((file->file = virLogHandlerNewWriter(handler, path, false)) == NULL)
         goto error;
+    virLogHandlerLogFileInitRate(handler, file);
 
     if (virJSONValueObjectGetNumberInt(object, "pipefd", &file->pipefd) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -290,6 +433,8 @@ virLogHandlerNewPostExecRestart(virJSONValuePtr object,
                                 bool privileged,
                                 size_t max_size,
                                 size_t max_backups,
+                                unsigned int flush_interval,
+                                size_t max_rate,
                                 virLogHandlerShutdownInhibitor inhibitor,
                                 void *opaque)
 {
@@ -301,6 +446,8 @@ virLogHandlerNewPostExecRestart(virJSONValuePtr object,
     if (!(handler = virLogHandlerNew(privileged,
                                      max_size,
                                      max_backups,
+                                     flush_interval,
+                                     max_rate,
                                      inhibitor,
                                      opaque)))
         return NULL;
@@ -352,6 +499,9 @@ virLogHandlerDispose(void *obj)
     virLogHandlerPtr handler = obj;
     size_t i;
 
+    if (handler->flushTimer != -1)
+        virEventRemoveTimeout(handler->flushTimer);
+
     for (i = 0; i < handler->nfiles; i++) {
         handler->inhibitor(false, handler->opaque);
         virLogHandlerLogFileFree(handler->files[i]);
@@ -404,12 +554,9 @@ virLogHandlerDomainOpenLogFile(virLogHandlerPtr handler,
         VIR_STRDUP(file->domname, domname) < 0)
         goto error;
 
-    if ((file->file = virRotatingFileWriterNew(path,
-                                               handler->max_size,
-                                               handler->max_backups,
-                                               trunc,
-                                               DEFAULT_MODE)) == NULL)
+    if ((file->file = virLogHandlerNewWriter(handler, path, trunc)) == NULL)
         goto error;
+    virLogHandlerLogFileInitRate(handler, file);
 
     if (VIR_APPEND_ELEMENT_COPY(handler->files, handler->nfiles, file) < 0)
         goto error;
@@ -491,11 +638,22 @@ virLogHandlerDomainReadLogFile(virLogHandlerPtr handler,
     virRotatingFileReaderPtr file = NULL;
     char *data = NULL;
     ssize_t got;
+    size_t i;
 
     virCheckFlags(0, NULL);
 
     virObjectLock(handler);
 
+    /* Make sure the reader sees everything written so far */
+    for (i = 0; i < handler->nfiles; i++) {
+        if (STREQ(virRotatingFileWriterGetPath(handler->files[i]->file),
+                  path)) {
+            if (virRotatingFileWriterFlush(handler->files[i]->file) < 0)
+                goto error;
+            break;
+        }
+    }
+
     if (!(file = virRotatingFileReaderNew(path, handler->max_backups)))
         goto error;
 
@@ -583,6 +741,9 @@ virLogHandlerPreExecRestart(virLogHandlerPtr handler)
     if (!ret)
         return NULL;
 
+    /* The buffers don't survive the re-exec */
+    virLogHandlerFlushAll(handler);
+
     if (!(files = virJSONValueNewArray()))
         goto error;
 
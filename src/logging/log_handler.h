@@ -36,12 +36,16 @@ typedef void (*virLogHandlerShutdownInhibitor)(bool inhibit,
 virLogHandlerPtr virLogHandlerNew(bool privileged,
                                   size_t max_size,
                                   size_t max_backups,
+                                  unsigned int flush_interval,
+                                  size_t max_rate,
                                   virLogHandlerShutdownInhibitor inhibitor,
                                   void *opaque);
 virLogHandlerPtr virLogHandlerNewPostExecRestart(virJSONValuePtr child,
                                                  bool privileged,
                                                  size_t max_size,
                                                  size_t max_backups,
+                                                 unsigned int flush_interval,
+                                                 size_t max_rate,
                                                  virLogHandlerShutdownInhibitor inhibitor,
                                                  void *opaque);
 
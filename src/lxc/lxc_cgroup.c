@@ -29,6 +29,7 @@
 #include "viralloc.h"
 #include "vircgroup.h"
 #include "virstring.h"
+#include "virhostcpu.h"
 #include "virsystemd.h"
 
 #define VIR_FROM_THIS VIR_FROM_LXC
@@ -311,6 +312,194 @@ int virLXCCgroupGetMeminfo(virLXCMeminfoPtr meminfo)
 }
 
 
+static int virLXCCgroupGetCpus(virCgroupPtr cgroup,
+                               virLXCCpuinfoPtr cpuinfo)
+{
+    char *str = NULL;
+    long long quota;
+    unsigned long long period;
+    ssize_t cpu = -1;
+    size_t ncpus = 0;
+    size_t maxcpus;
+    int ret = -1;
+
+    if (virCgroupHasController(cgroup, VIR_CGROUP_CONTROLLER_CPUSET) &&
+        virCgroupGetCpusetCpus(cgroup, &str) < 0)
+        goto cleanup;
+
+    if (str && *str) {
+        if (virBitmapParse(str, &cpuinfo->cpus, VIR_DOMAIN_CPUMASK_LEN) < 0)
+            goto cleanup;
+    } else if (!(cpuinfo->cpus = virHostCPUGetOnlineBitmap())) {
+        goto cleanup;
+    }
+
+    /* A quota of N periods can keep no more than N CPUs busy. The
+     * cpu.cfs_* files don't exist with the unified hierarchy. */
+    if (!virCgroupHasController(cgroup, VIR_CGROUP_CONTROLLER_CPU) ||
+        virCgroupGetCpuCfsQuota(cgroup, &quota) < 0 ||
+        virCgroupGetCpuCfsPeriod(cgroup, &period) < 0) {
+        virResetLastError();
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (quota > 0 && period > 0) {
+        maxcpus = MAX(1, (quota + period - 1) / period);
+        while ((cpu = virBitmapNextSetBit(cpuinfo->cpus, cpu)) >= 0) {
+            if (++ncpus > maxcpus)
+                ignore_value(virBitmapClearBit(cpuinfo->cpus, cpu));
+        }
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(str);
+    return ret;
+}
+
+
+static int virLXCCgroupGetCpuUsage(virCgroupPtr cgroup,
+                                   virLXCCpuinfoPtr cpuinfo)
+{
+    char *str = NULL;
+    const char *cur;
+    char *end;
+    unsigned long long usage;
+    int ret = -1;
+
+    if (virCgroupGetCpuacctStat(cgroup, &cpuinfo->user, &cpuinfo->sys) < 0)
+        return -1;
+
+    /* Not available with the unified hierarchy, the callers spread the
+     * total usage over the CPUs then */
+    if (virCgroupGetCpuacctPercpuUsage(cgroup, &str) < 0) {
+        virResetLastError();
+        return 0;
+    }
+
+    cur = str;
+    while (*cur) {
+        if (virStrToLong_ull(cur, &end, 10, &usage) < 0 || end == cur) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Malformed per-CPU usage '%s'"), str);
+            goto cleanup;
+        }
+
+        if (VIR_APPEND_ELEMENT(cpuinfo->usage, cpuinfo->nusage, usage) < 0)
+            goto cleanup;
+
+        cur = end;
+        virSkipSpaces(&cur);
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(str);
+    return ret;
+}
+
+
+int virLXCCgroupGetCpuinfo(virLXCCpuinfoPtr cpuinfo)
+{
+    int ret = -1;
+    virCgroupPtr cgroup;
+
+    memset(cpuinfo, 0, sizeof(*cpuinfo));
+
+    if (virCgroupNewSelf(&cgroup) < 0)
+        return -1;
+
+    if (virLXCCgroupGetCpus(cgroup, cpuinfo) < 0)
+        goto cleanup;
+
+    if (virLXCCgroupGetCpuUsage(cgroup, cpuinfo) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    if (ret < 0)
+        virLXCCgroupCpuinfoClear(cpuinfo);
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
+
+void virLXCCgroupCpuinfoClear(virLXCCpuinfoPtr cpuinfo)
+{
+    virBitmapFree(cpuinfo->cpus);
+    cpuinfo->cpus = NULL;
+    VIR_FREE(cpuinfo->usage);
+    cpuinfo->nusage = 0;
+}
+
+
+/*
+ * Counts the threads in the container's cgroup by state, leaving out
+ * the ones of the controller, which lives in the cgroup too
+ */
+int virLXCCgroupGetTaskStates(size_t *running,
+                              size_t *blocked,
+                              size_t *total)
+{
+    int ret = -1;
+    virCgroupPtr cgroup;
+    pid_t *tids = NULL;
+    size_t ntids = 0;
+    char *path = NULL;
+    char *stat = NULL;
+    const char *state;
+    size_t i;
+
+    *running = *blocked = *total = 0;
+
+    if (virCgroupNewSelf(&cgroup) < 0)
+        return -1;
+
+    if (virCgroupGetThreads(cgroup, &tids, &ntids) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ntids; i++) {
+        if (virAsprintf(&path, "/proc/self/task/%d", (int) tids[i]) < 0)
+            goto cleanup;
+        if (virFileExists(path)) {
+            VIR_FREE(path);
+            continue;
+        }
+        VIR_FREE(path);
+
+        if (virAsprintf(&path, "/proc/%d/stat", (int) tids[i]) < 0)
+            goto cleanup;
+
+        /* The thread may have exited in the meantime */
+        if (virFileReadAllQuiet(path, 1024, &stat) < 0) {
+            VIR_FREE(path);
+            continue;
+        }
+        VIR_FREE(path);
+
+        /* The state follows the command name, which may contain
+         * spaces and parentheses itself */
+        if ((state = strrchr(stat, ')')) && state[1] == ' ') {
+            if (state[2] == 'R')
+                (*running)++;
+            else if (state[2] == 'D')
+                (*blocked)++;
+        }
+        (*total)++;
+        VIR_FREE(stat);
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(stat);
+    VIR_FREE(path);
+    VIR_FREE(tids);
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
+
 
 typedef struct _virLXCCgroupDevicePolicy virLXCCgroupDevicePolicy;
 typedef virLXCCgroupDevicePolicy *virLXCCgroupDevicePolicyPtr;
@@ -357,7 +546,8 @@ virLXCTeardownHostUSBDeviceCgroup(virUSBDevicePtr dev ATTRIBUTE_UNUSED,
 static int virLXCCgroupSetupDeviceACL(virDomainDefPtr def,
                                       virCgroupPtr cgroup)
 {
-    int capMknod = def->caps_features[VIR_DOMAIN_CAPS_FEATURE_MKNOD];
+    int capMknod = virDomainDefGetCapsFeature(def,
+                                              VIR_DOMAIN_CAPS_FEATURE_MKNOD);
     int ret = -1;
     size_t i;
     static virLXCCgroupDevicePolicy devices[] = {
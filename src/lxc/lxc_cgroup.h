@@ -37,6 +37,11 @@ int virLXCCgroupSetup(virDomainDefPtr def,
                       virBitmapPtr nodemask);
 
 int virLXCCgroupGetMeminfo(virLXCMeminfoPtr meminfo);
+int virLXCCgroupGetCpuinfo(virLXCCpuinfoPtr cpuinfo);
+void virLXCCgroupCpuinfoClear(virLXCCpuinfoPtr cpuinfo);
+int virLXCCgroupGetTaskStates(size_t *running,
+                              size_t *blocked,
+                              size_t *total);
 
 int
 virLXCSetupHostUSBDeviceCgroup(virUSBDevicePtr dev,
@@ -59,6 +59,7 @@
 #include "virerror.h"
 #include "virlog.h"
 #include "lxc_container.h"
+#include "lxc_fuse.h"
 #include "viralloc.h"
 #include "virnetdevveth.h"
 #include "viruuid.h"
@@ -557,49 +558,39 @@ extern int pivot_root(const char * new_root, const char * put_old);
 #endif
 
 
-static int lxcContainerUnmountSubtree(const char *prefix,
-                                      bool isOldRootFS)
+static int lxcContainerUnmountSubtrees(const char *const *prefixes,
+                                       size_t nprefixes)
 {
     char **mounts = NULL;
     size_t nmounts = 0;
     size_t i;
-    int saveErrno;
-    const char *failedUmount = NULL;
     int ret = -1;
 
-    VIR_DEBUG("Unmount subtreee from %s", prefix);
+    for (i = 0; i < nprefixes; i++)
+        VIR_DEBUG("Unmount subtree from %s", prefixes[i]);
 
-    if (virFileGetMountReverseSubtree("/proc/mounts", prefix,
-                                      &mounts, &nmounts) < 0)
+    /* A single pass over the mount table, which is long while the
+     * host's mounts are still around */
+    if (virFileGetMountReverseSubtrees("/proc/mounts", prefixes, nprefixes,
+                                       &mounts, &nmounts) < 0)
         goto cleanup;
     for (i = 0; i < nmounts; i++) {
         VIR_DEBUG("Umount %s", mounts[i]);
         if (umount(mounts[i]) < 0) {
             char ebuf[1024];
-            failedUmount = mounts[i];
-            saveErrno = errno;
-            VIR_WARN("Failed to unmount '%s', trying to detach subtree '%s': %s",
-                     failedUmount, mounts[nmounts-1],
-                     virStrerror(errno, ebuf, sizeof(ebuf)));
-            break;
-        }
-    }
+            int saveErrno = errno;
 
-    if (failedUmount) {
-        /* This detaches the subtree */
-        if (umount2(mounts[nmounts-1], MNT_DETACH) < 0) {
-            virReportSystemError(saveErrno,
-                                 _("Failed to unmount '%s' and could not detach subtree '%s'"),
-                                 failedUmount, mounts[nmounts-1]);
-            goto cleanup;
-        }
-        /* This unmounts the tmpfs on which the old root filesystem was hosted */
-        if (isOldRootFS &&
-            umount(mounts[nmounts-1]) < 0) {
-            virReportSystemError(saveErrno,
-                                 _("Failed to unmount '%s' and could not unmount old root '%s'"),
-                                 failedUmount, mounts[nmounts-1]);
-            goto cleanup;
+            VIR_WARN("Failed to unmount '%s', trying to detach it: %s",
+                     mounts[i], virStrerror(errno, ebuf, sizeof(ebuf)));
+
+            /* Everything below it is gone already, so this detaches
+             * just the one mount */
+            if (umount2(mounts[i], MNT_DETACH) < 0) {
+                virReportSystemError(saveErrno,
+                                     _("Failed to unmount '%s' and could not detach it"),
+                                     mounts[i]);
+                goto cleanup;
+            }
         }
     }
 
@@ -611,6 +602,34 @@ static int lxcContainerUnmountSubtree(const char *prefix,
     return ret;
 }
 
+static int lxcContainerUnmountSubtree(const char *prefix)
+{
+    return lxcContainerUnmountSubtrees(&prefix, 1);
+}
+
+/* Root was made private before pivoting, so detaching /.oldroot takes
+ * all the host's mounts along in one go, rather than unmounting them
+ * one by one */
+static int lxcContainerUnmountOldRoot(void)
+{
+    VIR_DEBUG("Detach old root /.oldroot");
+
+    if (umount2("/.oldroot", MNT_DETACH) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Failed to detach old root '/.oldroot'"));
+        return -1;
+    }
+
+    /* This unmounts the tmpfs on which the old root filesystem was hosted */
+    if (umount("/.oldroot") < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Failed to unmount tmpfs of old root '/.oldroot'"));
+        return -1;
+    }
+
+    return 0;
+}
+
 static int lxcContainerResolveSymlinks(virDomainFSDefPtr fs, bool gentle)
 {
     char *newroot;
@@ -1011,25 +1030,37 @@ static int lxcContainerMountBasicFS(bool userns_enabled,
 static int lxcContainerMountProcFuse(virDomainDefPtr def,
                                      const char *stateDir)
 {
-    int ret;
-    char *meminfo_path = NULL;
+    int ret = 0;
+    char *src_path = NULL;
+    char *dst_path = NULL;
+    size_t i;
 
-    VIR_DEBUG("Mount /proc/meminfo stateDir=%s", stateDir);
+    for (i = 0; i < VIR_LXC_FUSE_FILE_LAST && ret == 0; i++) {
+        const char *name = virLXCFuseFileTypeToString(i);
 
-    if ((ret = virAsprintf(&meminfo_path,
-                           "/.oldroot/%s/%s.fuse/meminfo",
-                           stateDir,
-                           def->name)) < 0)
-        return ret;
+        VIR_DEBUG("Mount /proc/%s stateDir=%s", name, stateDir);
 
-    if ((ret = mount(meminfo_path, "/proc/meminfo",
-                     NULL, MS_BIND, NULL)) < 0) {
-        virReportSystemError(errno,
-                             _("Failed to mount %s on /proc/meminfo"),
-                             meminfo_path);
+        if ((ret = virAsprintf(&src_path,
+                               "/.oldroot/%s/%s.fuse/%s",
+                               stateDir,
+                               def->name,
+                               name)) < 0 ||
+            (ret = virAsprintf(&dst_path, "/proc/%s", name)) < 0)
+            break;
+
+        if ((ret = mount(src_path, dst_path,
+                         NULL, MS_BIND, NULL)) < 0) {
+            virReportSystemError(errno,
+                                 _("Failed to mount %s on %s"),
+                                 src_path, dst_path);
+        }
+
+        VIR_FREE(src_path);
+        VIR_FREE(dst_path);
     }
 
-    VIR_FREE(meminfo_path);
+    VIR_FREE(src_path);
+    VIR_FREE(dst_path);
     return ret;
 }
 #else
@@ -1614,7 +1645,7 @@ static int lxcContainerMountAllFS(virDomainDefPtr vmDef,
 
         if (!(vmDef->fss[i]->src && vmDef->fss[i]->src->path &&
               STRPREFIX(vmDef->fss[i]->src->path, vmDef->fss[i]->dst)) &&
-            lxcContainerUnmountSubtree(vmDef->fss[i]->dst, false) < 0)
+            lxcContainerUnmountSubtree(vmDef->fss[i]->dst) < 0)
             return -1;
 
         if (lxcContainerMountFS(vmDef->fss[i], sec_mount_options) < 0)
@@ -1656,52 +1687,51 @@ static int lxcContainerUnmountForSharedRoot(const char *stateDir,
                                             const char *domain)
 {
     int ret = -1;
-    char *tmp = NULL;
+    char *dev = NULL;
+    char *devpts = NULL;
+    char *fuse = NULL;
+    const char *prefixes[7];
+    size_t nprefixes = 0;
 
 #if WITH_SELINUX
     /* Some versions of Linux kernel don't let you overmount
      * the selinux filesystem, so make sure we kill it first
      */
-    /* Filed coverity bug for false positive 'USE_AFTER_FREE' due to swap
-     * of root->src with root->dst and the VIR_FREE(root->src) prior to the
-     * reset of root->src in lxcContainerPrepareRoot()
-     */
-    /* coverity[deref_arg] */
-    if (lxcContainerUnmountSubtree(SELINUX_MOUNT, false) < 0)
-        goto cleanup;
+    prefixes[nprefixes++] = SELINUX_MOUNT;
 #endif
 
     /* These filesystems are created by libvirt temporarily, they
      * shouldn't appear in container. */
-    if (virAsprintf(&tmp, "%s/%s.dev", stateDir, domain) < 0 ||
-        lxcContainerUnmountSubtree(tmp, false) < 0)
-        goto cleanup;
-
-    VIR_FREE(tmp);
-    if (virAsprintf(&tmp, "%s/%s.devpts", stateDir, domain) < 0 ||
-        lxcContainerUnmountSubtree(tmp, false) < 0)
+    if (virAsprintf(&dev, "%s/%s.dev", stateDir, domain) < 0 ||
+        virAsprintf(&devpts, "%s/%s.devpts", stateDir, domain) < 0)
         goto cleanup;
+    prefixes[nprefixes++] = dev;
+    prefixes[nprefixes++] = devpts;
 
 #if WITH_FUSE
-    VIR_FREE(tmp);
-    if (virAsprintf(&tmp, "%s/%s.fuse", stateDir, domain) < 0 ||
-        lxcContainerUnmountSubtree(tmp, false) < 0)
+    if (virAsprintf(&fuse, "%s/%s.fuse", stateDir, domain) < 0)
         goto cleanup;
+    prefixes[nprefixes++] = fuse;
 #endif
 
     /* If we have the root source being '/', then we need to
      * get rid of any existing stuff under /proc, /sys & /tmp.
-     * We need new namespace aware versions of those. We must
-     * do /proc last otherwise we won't find /proc/mounts :-) */
-    if (lxcContainerUnmountSubtree("/sys", false) < 0 ||
-        lxcContainerUnmountSubtree("/dev", false) < 0 ||
-        lxcContainerUnmountSubtree("/proc", false) < 0)
+     * We need new namespace aware versions of those. The
+     * mount table is read before unmounting anything, so /proc
+     * can go along with the rest. */
+    prefixes[nprefixes++] = "/sys";
+    prefixes[nprefixes++] = "/dev";
+    prefixes[nprefixes++] = "/proc";
+
+    if (lxcContainerUnmountSubtrees(prefixes, nprefixes) < 0)
         goto cleanup;
 
     ret = 0;
 
  cleanup:
-    VIR_FREE(tmp);
+    VIR_FREE(dev);
+    VIR_FREE(devpts);
+    VIR_FREE(fuse);
     return ret;
 }
 
@@ -1775,7 +1805,7 @@ static int lxcContainerSetupPivotRoot(virDomainDefPtr vmDef,
         lxcContainerSetReadOnly() < 0)
         goto cleanup;
 
-    /* Mounts /proc/meminfo etc sysinfo */
+    /* Mounts /proc/meminfo, /proc/cpuinfo etc sysinfo */
     if (lxcContainerMountProcFuse(vmDef, stateDir) < 0)
         goto cleanup;
 
@@ -1801,7 +1831,7 @@ static int lxcContainerSetupPivotRoot(virDomainDefPtr vmDef,
         goto cleanup;
 
    /* Gets rid of all remaining mounts from host OS, including /.oldroot itself */
-    if (lxcContainerUnmountSubtree("/.oldroot", true) < 0)
+    if (lxcContainerUnmountOldRoot() < 0)
         goto cleanup;
 
     ret = 0;
@@ -2007,7 +2037,7 @@ static int lxcContainerDropCapabilities(virDomainDefPtr def,
     /* Apply all single capabilities changes */
     for (i = 0; i < VIR_DOMAIN_CAPS_FEATURE_LAST; i++) {
         bool toDrop = false;
-        int state = def->caps_features[i];
+        int state = virDomainDefGetCapsFeature(def, i);
 
         if (!cap_valid(capsMapping[i]))
             continue;
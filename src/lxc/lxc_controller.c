@@ -78,6 +78,26 @@
 
 VIR_LOG_INIT("lxc.lxc_controller");
 
+/* Buffer sizes of consoles which can't use splice() */
+#define VIR_LXC_CONSOLE_BUF_MIN 1024
+#define VIR_LXC_CONSOLE_BUF_MAX (64 * 1024)
+
+/* Largest pipe a splicing console grows to */
+#define VIR_LXC_CONSOLE_PIPE_MAX (1024 * 1024)
+
+/* Data read from one side of a console, waiting to be written to the
+ * other side. It is kept in a pipe when the console relays with splice()
+ * so that it never leaves the kernel, in a buffer otherwise. */
+typedef struct _virLXCControllerConsoleQueue virLXCControllerConsoleQueue;
+typedef virLXCControllerConsoleQueue *virLXCControllerConsoleQueuePtr;
+struct _virLXCControllerConsoleQueue {
+    size_t len;
+    size_t size;
+    bool full; /* the pipe ran out of slots before size was reached */
+    char *buf;
+    int pipe[2];
+};
+
 typedef struct _virLXCControllerConsole virLXCControllerConsole;
 typedef virLXCControllerConsole *virLXCControllerConsolePtr;
 struct _virLXCControllerConsole {
@@ -94,10 +114,9 @@ struct _virLXCControllerConsole {
     int epollWatch;
     int epollFd; /* epoll FD for dealing with EOF */
 
-    size_t fromHostLen;
-    char fromHostBuf[1024];
-    size_t fromContLen;
-    char fromContBuf[1024];
+    bool splice;
+    virLXCControllerConsoleQueue fromHost;
+    virLXCControllerConsoleQueue fromCont;
 
     virNetDaemonPtr daemon;
 };
@@ -248,6 +267,13 @@ static void virLXCControllerConsoleClose(virLXCControllerConsolePtr console)
     if (console->epollWatch != -1)
         virEventRemoveHandle(console->epollWatch);
     VIR_FORCE_CLOSE(console->epollFd);
+
+    VIR_FORCE_CLOSE(console->fromHost.pipe[0]);
+    VIR_FORCE_CLOSE(console->fromHost.pipe[1]);
+    VIR_FREE(console->fromHost.buf);
+    VIR_FORCE_CLOSE(console->fromCont.pipe[0]);
+    VIR_FORCE_CLOSE(console->fromCont.pipe[1]);
+    VIR_FREE(console->fromCont.buf);
 }
 
 
@@ -318,6 +344,11 @@ static int virLXCControllerAddConsole(virLXCControllerPtr ctrl,
 
     ctrl->consoles[ctrl->nconsoles-1].epollFd = -1;
     ctrl->consoles[ctrl->nconsoles-1].epollWatch = -1;
+
+    ctrl->consoles[ctrl->nconsoles-1].fromHost.pipe[0] = -1;
+    ctrl->consoles[ctrl->nconsoles-1].fromHost.pipe[1] = -1;
+    ctrl->consoles[ctrl->nconsoles-1].fromCont.pipe[0] = -1;
+    ctrl->consoles[ctrl->nconsoles-1].fromCont.pipe[1] = -1;
     return 0;
 }
 
@@ -1036,6 +1067,217 @@ static void virLXCControllerSignalChildIO(virNetDaemonPtr dmn,
 }
 
 
+static bool
+virLXCControllerConsoleQueueHasRoom(virLXCControllerConsoleQueuePtr queue)
+{
+    return !queue->full && queue->len < queue->size;
+}
+
+
+/*
+ * Prefer relaying the console through pipes with splice(), falling back
+ * to buffers if pipes can't be set up.
+ */
+static int
+virLXCControllerConsoleSetupQueues(virLXCControllerConsolePtr console)
+{
+    virLXCControllerConsoleQueuePtr queues[] = {
+        &console->fromHost, &console->fromCont
+    };
+    size_t i;
+    int size;
+
+    console->splice = true;
+    for (i = 0; i < ARRAY_CARDINALITY(queues); i++) {
+        if (pipe2(queues[i]->pipe, O_CLOEXEC | O_NONBLOCK) < 0 ||
+            (size = fcntl(queues[i]->pipe[1], F_GETPIPE_SZ)) < 0) {
+            VIR_DEBUG("Unable to set up console pipe: %s",
+                      virStrerror(errno, NULL, 0));
+            console->splice = false;
+            break;
+        }
+        queues[i]->size = size;
+    }
+
+    if (console->splice)
+        return 0;
+
+    for (i = 0; i < ARRAY_CARDINALITY(queues); i++) {
+        VIR_FORCE_CLOSE(queues[i]->pipe[0]);
+        VIR_FORCE_CLOSE(queues[i]->pipe[1]);
+        if (VIR_ALLOC_N(queues[i]->buf, VIR_LXC_CONSOLE_BUF_MIN) < 0)
+            return -1;
+        queues[i]->size = VIR_LXC_CONSOLE_BUF_MIN;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Moves whatever the pipes hold to buffers, for PTYs which turn out
+ * not to support splice()
+ */
+static int
+virLXCControllerConsoleStopSplice(virLXCControllerConsolePtr console)
+{
+    virLXCControllerConsoleQueuePtr queues[] = {
+        &console->fromHost, &console->fromCont
+    };
+    size_t i;
+
+    VIR_DEBUG("Console PTYs don't support splice, using buffers");
+
+    for (i = 0; i < ARRAY_CARDINALITY(queues); i++) {
+        virLXCControllerConsoleQueuePtr queue = queues[i];
+        size_t size = MAX(queue->len, VIR_LXC_CONSOLE_BUF_MIN);
+
+        if (VIR_ALLOC_N(queue->buf, size) < 0)
+            return -1;
+
+        if (queue->len &&
+            saferead(queue->pipe[0], queue->buf, queue->len) != queue->len) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to read console pipe"));
+            return -1;
+        }
+
+        VIR_FORCE_CLOSE(queue->pipe[0]);
+        VIR_FORCE_CLOSE(queue->pipe[1]);
+        queue->size = size;
+        queue->full = false;
+    }
+
+    console->splice = false;
+    return 0;
+}
+
+
+/*
+ * Called when @queue filled up, doubles its size so that a console
+ * with lots of traffic needs fewer syscalls
+ */
+static void
+virLXCControllerConsoleQueueGrow(virLXCControllerConsolePtr console,
+                                 virLXCControllerConsoleQueuePtr queue)
+{
+    int size;
+
+    if (console->splice) {
+        if (queue->size >= VIR_LXC_CONSOLE_PIPE_MAX)
+            return;
+
+        /* Fails beyond /proc/sys/fs/pipe-max-size, which is fine */
+        if ((size = fcntl(queue->pipe[1], F_SETPIPE_SZ, queue->size * 2)) < 0) {
+            VIR_DEBUG("Unable to grow console pipe: %s",
+                      virStrerror(errno, NULL, 0));
+            return;
+        }
+        queue->size = size;
+        queue->full = false;
+    } else {
+        if (queue->size >= VIR_LXC_CONSOLE_BUF_MAX ||
+            VIR_REALLOC_N_QUIET(queue->buf, queue->size * 2) < 0)
+            return;
+        queue->size *= 2;
+    }
+}
+
+
+static int
+virLXCControllerConsoleQueueFill(virLXCControllerConsolePtr console,
+                                 virLXCControllerConsoleQueuePtr queue,
+                                 int fd)
+{
+    ssize_t done = -1;
+
+    if (console->splice) {
+     resplice:
+        done = splice(fd, NULL, queue->pipe[1], NULL,
+                      queue->size - queue->len,
+                      SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (done == -1 && errno == EINTR)
+            goto resplice;
+        if (done == -1 && errno == EINVAL &&
+            virLXCControllerConsoleStopSplice(console) < 0)
+            return -1;
+        /* The PTY is readable, so the pipe ran out of slots. Each one
+         * can hold as little as the few bytes of a small read. */
+        if (done == -1 && errno == EAGAIN) {
+            queue->full = true;
+            virLXCControllerConsoleQueueGrow(console, queue);
+        }
+    }
+
+    if (!console->splice) {
+     reread:
+        done = read(fd, queue->buf + queue->len, queue->size - queue->len);
+        if (done == -1 && errno == EINTR)
+            goto reread;
+    }
+
+    if (done == -1 && errno != EAGAIN) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to read container pty"));
+        return -1;
+    }
+
+    if (done > 0) {
+        queue->len += done;
+        if (queue->len == queue->size)
+            virLXCControllerConsoleQueueGrow(console, queue);
+    } else {
+        VIR_DEBUG("Read fd %d done %d errno %d", fd, (int)done, errno);
+    }
+
+    return 0;
+}
+
+
+static int
+virLXCControllerConsoleQueueDrain(virLXCControllerConsolePtr console,
+                                  virLXCControllerConsoleQueuePtr queue,
+                                  int fd)
+{
+    ssize_t done = -1;
+
+    if (console->splice) {
+     resplice:
+        done = splice(queue->pipe[0], NULL, fd, NULL, queue->len,
+                      SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (done == -1 && errno == EINTR)
+            goto resplice;
+        if (done == -1 && errno == EINVAL &&
+            virLXCControllerConsoleStopSplice(console) < 0)
+            return -1;
+    }
+
+    if (!console->splice) {
+     rewrite:
+        done = write(fd, queue->buf, queue->len);
+        if (done == -1 && errno == EINTR)
+            goto rewrite;
+        if (done > 0)
+            memmove(queue->buf, queue->buf + done, queue->len - done);
+    }
+
+    if (done == -1 && errno != EAGAIN) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to write to container pty"));
+        return -1;
+    }
+
+    if (done > 0) {
+        queue->len -= done;
+        queue->full = false;
+    } else {
+        VIR_DEBUG("Write fd %d done %d errno %d", fd, (int)done, errno);
+    }
+
+    return 0;
+}
+
+
 static void virLXCControllerConsoleUpdateWatch(virLXCControllerConsolePtr console)
 {
     int hostEvents = 0;
@@ -1043,17 +1285,17 @@ static void virLXCControllerConsoleUpdateWatch(virLXCControllerConsolePtr consol
 
     /* If host console is open, then we can look to read/write */
     if (!console->hostClosed) {
-        if (console->fromHostLen < sizeof(console->fromHostBuf))
+        if (virLXCControllerConsoleQueueHasRoom(&console->fromHost))
             hostEvents |= VIR_EVENT_HANDLE_READABLE;
-        if (console->fromContLen)
+        if (console->fromCont.len)
             hostEvents |= VIR_EVENT_HANDLE_WRITABLE;
     }
 
     /* If cont console is open, then we can look to read/write */
     if (!console->contClosed) {
-        if (console->fromContLen < sizeof(console->fromContBuf))
+        if (virLXCControllerConsoleQueueHasRoom(&console->fromCont))
             contEvents |= VIR_EVENT_HANDLE_READABLE;
-        if (console->fromHostLen)
+        if (console->fromHost.len)
             contEvents |= VIR_EVENT_HANDLE_WRITABLE;
     }
 
@@ -1066,7 +1308,7 @@ static void virLXCControllerConsoleUpdateWatch(virLXCControllerConsolePtr consol
     if (console->hostClosed) {
         /* Must setup an epoll to detect when host becomes accessible again */
         int events = EPOLLIN | EPOLLET;
-        if (console->fromContLen)
+        if (console->fromCont.len)
             events |= EPOLLOUT;
 
         if (events != console->hostEpoll) {
@@ -1104,7 +1346,7 @@ static void virLXCControllerConsoleUpdateWatch(virLXCControllerConsolePtr consol
     if (console->contClosed) {
         /* Must setup an epoll to detect when guest becomes accessible again */
         int events = EPOLLIN | EPOLLET;
-        if (console->fromHostLen)
+        if (console->fromHost.len)
             events |= EPOLLOUT;
 
         if (events != console->contEpoll) {
@@ -1150,8 +1392,8 @@ static void virLXCControllerConsoleEPoll(int watch, int fd, int events, void *op
     virMutexLock(&lock);
     VIR_DEBUG("IO event watch=%d fd=%d events=%d fromHost=%zu fromcont=%zu",
               watch, fd, events,
-              console->fromHostLen,
-              console->fromContLen);
+              console->fromHost.len,
+              console->fromCont.len);
 
     while (1) {
         struct epoll_event event;
@@ -1197,65 +1439,28 @@ static void virLXCControllerConsoleIO(int watch, int fd, int events, void *opaqu
     virMutexLock(&lock);
     VIR_DEBUG("IO event watch=%d fd=%d events=%d fromHost=%zu fromcont=%zu",
               watch, fd, events,
-              console->fromHostLen,
-              console->fromContLen);
+              console->fromHost.len,
+              console->fromCont.len);
     if (events & VIR_EVENT_HANDLE_READABLE) {
-        char *buf;
-        size_t *len;
-        size_t avail;
-        ssize_t done;
-        if (watch == console->hostWatch) {
-            buf = console->fromHostBuf;
-            len = &console->fromHostLen;
-            avail = sizeof(console->fromHostBuf) - *len;
-        } else {
-            buf = console->fromContBuf;
-            len = &console->fromContLen;
-            avail = sizeof(console->fromContBuf) - *len;
-        }
-     reread:
-        done = read(fd, buf + *len, avail);
-        if (done == -1 && errno == EINTR)
-            goto reread;
-        if (done == -1 && errno != EAGAIN) {
-            virReportSystemError(errno, "%s",
-                                 _("Unable to read container pty"));
+        virLXCControllerConsoleQueuePtr queue;
+        if (watch == console->hostWatch)
+            queue = &console->fromHost;
+        else
+            queue = &console->fromCont;
+
+        if (virLXCControllerConsoleQueueFill(console, queue, fd) < 0)
             goto error;
-        }
-        if (done > 0) {
-            *len += done;
-        } else {
-            VIR_DEBUG("Read fd %d done %d errno %d", fd, (int)done, errno);
-        }
     }
 
     if (events & VIR_EVENT_HANDLE_WRITABLE) {
-        char *buf;
-        size_t *len;
-        ssize_t done;
-        if (watch == console->hostWatch) {
-            buf = console->fromContBuf;
-            len = &console->fromContLen;
-        } else {
-            buf = console->fromHostBuf;
-            len = &console->fromHostLen;
-        }
+        virLXCControllerConsoleQueuePtr queue;
+        if (watch == console->hostWatch)
+            queue = &console->fromCont;
+        else
+            queue = &console->fromHost;
 
-     rewrite:
-        done = write(fd, buf, *len);
-        if (done == -1 && errno == EINTR)
-            goto rewrite;
-        if (done == -1 && errno != EAGAIN) {
-            virReportSystemError(errno, "%s",
-                                 _("Unable to write to container pty"));
+        if (virLXCControllerConsoleQueueDrain(console, queue, fd) < 0)
             goto error;
-        }
-        if (done > 0) {
-            memmove(buf, buf + done, (*len - done));
-            *len -= done;
-        } else {
-            VIR_DEBUG("Write fd %d done %d errno %d", fd, (int)done, errno);
-        }
     }
 
     if (events & VIR_EVENT_HANDLE_HANGUP) {
@@ -1304,6 +1509,9 @@ static int virLXCControllerMain(virLXCControllerPtr ctrl)
     virResetLastError();
 
     for (i = 0; i < ctrl->nconsoles; i++) {
+        if (virLXCControllerConsoleSetupQueues(&ctrl->consoles[i]) < 0)
+            goto cleanup;
+
         if ((ctrl->consoles[i].epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
             virReportSystemError(errno, "%s",
                                  _("Unable to create epoll fd"));
@@ -1956,10 +2164,8 @@ static int virLXCControllerMoveInterfaces(virLXCControllerPtr ctrl)
     size_t i;
     virDomainDefPtr def = ctrl->def;
 
-    for (i = 0; i < ctrl->nveths; i++) {
-        if (virNetDevSetNamespace(ctrl->veths[i], ctrl->initpid) < 0)
-            return -1;
-    }
+    if (virNetDevSetNamespaces(ctrl->veths, ctrl->nveths, ctrl->initpid) < 0)
+        return -1;
 
     for (i = 0; i < def->nhostdevs; i ++) {
         virDomainHostdevDefPtr hdev = def->hostdevs[i];
@@ -36,12 +36,38 @@
 #include "virfile.h"
 #include "virbuffer.h"
 #include "virstring.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_LXC
 
+VIR_ENUM_IMPL(virLXCFuseFile, VIR_LXC_FUSE_FILE_LAST,
+              "meminfo",
+              "cpuinfo",
+              "stat",
+              "loadavg")
+
 #if WITH_FUSE
 
-static const char *fuse_meminfo_path = "/meminfo";
+/* Fixed point load average computation, the way the kernel does it */
+# define LXC_LOAD_FSHIFT 11
+# define LXC_LOAD_FIXED_1 (1UL << LXC_LOAD_FSHIFT)
+# define LXC_LOAD_FREQ 5000 /* milliseconds between samples */
+# define LXC_LOAD_MAX_PERIODS (3600 * 1000 / LXC_LOAD_FREQ)
+
+/* 1/exp(5s/1min), 1/exp(5s/5min) and 1/exp(5s/15min) in fixed point */
+static const unsigned long lxcLoadExp[] = { 1884, 2014, 2037 };
+
+typedef int (*lxcProcGenerateFunc)(virLXCFusePtr fuse,
+                                   const char *hostpath,
+                                   virBufferPtr buf);
+
+static int lxcProcFileType(const char *path)
+{
+    if (path[0] != '/')
+        return -1;
+
+    return virLXCFuseFileTypeFromString(path + 1);
+}
 
 static int lxcProcGetattr(const char *path, struct stat *stbuf)
 {
@@ -49,7 +75,8 @@ static int lxcProcGetattr(const char *path, struct stat *stbuf)
     char *mempath = NULL;
     struct stat sb;
     struct fuse_context *context = fuse_get_context();
-    virDomainDefPtr def = (virDomainDefPtr)context->private_data;
+    virLXCFusePtr fuse = (virLXCFusePtr)context->private_data;
+    virDomainDefPtr def = fuse->def;
 
     memset(stbuf, 0, sizeof(struct stat));
     if (virAsprintf(&mempath, "/proc/%s", path) < 0)
@@ -60,7 +87,7 @@ static int lxcProcGetattr(const char *path, struct stat *stbuf)
     if (STREQ(path, "/")) {
         stbuf->st_mode = S_IFDIR | 0755;
         stbuf->st_nlink = 2;
-    } else if (STREQ(path, fuse_meminfo_path)) {
+    } else if (lxcProcFileType(path) >= 0) {
         if (stat(mempath, &sb) < 0) {
             res = -errno;
             goto cleanup;
@@ -90,12 +117,15 @@ static int lxcProcReaddir(const char *path, void *buf,
                           off_t offset ATTRIBUTE_UNUSED,
                           struct fuse_file_info *fi ATTRIBUTE_UNUSED)
 {
+    size_t i;
+
     if (STRNEQ(path, "/"))
         return -ENOENT;
 
     filler(buf, ".", NULL, 0);
     filler(buf, "..", NULL, 0);
-    filler(buf, fuse_meminfo_path + 1, NULL, 0);
+    for (i = 0; i < VIR_LXC_FUSE_FILE_LAST; i++)
+        filler(buf, virLXCFuseFileTypeToString(i), NULL, 0);
 
     return 0;
 }
@@ -103,7 +133,7 @@ static int lxcProcReaddir(const char *path, void *buf,
 static int lxcProcOpen(const char *path ATTRIBUTE_UNUSED,
                        struct fuse_file_info *fi ATTRIBUTE_UNUSED)
 {
-    if (STRNEQ(path, fuse_meminfo_path))
+    if (lxcProcFileType(path) < 0)
         return -ENOENT;
 
     if ((fi->flags & 3) != O_RDONLY)
@@ -128,36 +158,26 @@ static int lxcProcHostRead(char *path, char *buf, size_t size, off_t offset)
     return res;
 }
 
-static int lxcProcReadMeminfo(char *hostpath, virDomainDefPtr def,
-                              char *buf, size_t size, off_t offset)
+static int lxcProcGenerateMeminfo(virLXCFusePtr fuse,
+                                  const char *hostpath,
+                                  virBufferPtr new_meminfo)
 {
-    int res;
+    int res = -1;
     FILE *fd = NULL;
     char *line = NULL;
     size_t n;
     struct virLXCMeminfo meminfo;
-    virBuffer buffer = VIR_BUFFER_INITIALIZER;
-    virBufferPtr new_meminfo = &buffer;
+    virDomainDefPtr def = fuse->def;
 
-    if (virLXCCgroupGetMeminfo(&meminfo) < 0) {
-        virErrorSetErrnoFromLastError();
-        return -errno;
-    }
+    if (virLXCCgroupGetMeminfo(&meminfo) < 0)
+        return -1;
 
     fd = fopen(hostpath, "r");
     if (fd == NULL) {
         virReportSystemError(errno, _("Cannot open %s"), hostpath);
-        res = -errno;
-        goto cleanup;
-    }
-
-    if (fseek(fd, offset, SEEK_SET) < 0) {
-        virReportSystemError(errno, "%s", _("fseek failed"));
-        res = -errno;
         goto cleanup;
     }
 
-    res = -1;
     while (getline(&line, &n, fd) > 0) {
         char *ptr = strchr(line, ':');
         if (!ptr)
@@ -227,46 +247,324 @@ static int lxcProcReadMeminfo(char *hostpath, virDomainDefPtr def,
             *ptr = ':';
             virBufferAdd(new_meminfo, line, -1);
         }
+    }
 
-        if (virBufferCheckError(new_meminfo) < 0) {
-            res = -errno;
-            goto cleanup;
+    res = 0;
+
+ cleanup:
+    VIR_FREE(line);
+    VIR_FORCE_FCLOSE(fd);
+    return res;
+}
+
+/*
+ * Shows the host's entries of the CPUs in the container's cpuset,
+ * renumbered from 0, up to as many as the CFS quota can keep busy
+ */
+static int lxcProcGenerateCpuinfo(virLXCFusePtr fuse ATTRIBUTE_UNUSED,
+                                  const char *hostpath,
+                                  virBufferPtr buf)
+{
+    int res = -1;
+    FILE *fd = NULL;
+    char *line = NULL;
+    size_t n;
+    struct virLXCCpuinfo cpuinfo;
+    size_t ncpus = 0;
+    bool show = true;
+
+    if (virLXCCgroupGetCpuinfo(&cpuinfo) < 0)
+        return -1;
+
+    fd = fopen(hostpath, "r");
+    if (fd == NULL) {
+        virReportSystemError(errno, _("Cannot open %s"), hostpath);
+        goto cleanup;
+    }
+
+    while (getline(&line, &n, fd) > 0) {
+        char *value;
+        char *end;
+        unsigned int cpu;
+
+        if (STRPREFIX(line, "processor") &&
+            (value = strchr(line, ':')) &&
+            virStrToLong_ui(value + 1, &end, 10, &cpu) == 0 &&
+            *end == '\n') {
+            show = virBitmapIsBitSet(cpuinfo.cpus, cpu);
+            if (show)
+                virBufferAsprintf(buf, "processor\t: %zu\n", ncpus++);
+            continue;
         }
+
+        /* Entries end with an empty line */
+        if (show)
+            virBufferAdd(buf, line, -1);
+        if (*line == '\n')
+            show = true;
     }
-    res = strlen(virBufferCurrentContent(new_meminfo));
-    if (res > size)
-        res = size;
-    memcpy(buf, virBufferCurrentContent(new_meminfo), res);
+
+    res = 0;
 
  cleanup:
     VIR_FREE(line);
-    virBufferFreeAndReset(new_meminfo);
     VIR_FORCE_FCLOSE(fd);
+    virLXCCgroupCpuinfoClear(&cpuinfo);
+    return res;
+}
+
+/*
+ * Replaces the host's cpu lines with ones for the container's CPUs,
+ * accounting the time the container didn't use them as idle
+ */
+static int lxcProcGenerateStat(virLXCFusePtr fuse ATTRIBUTE_UNUSED,
+                               const char *hostpath,
+                               virBufferPtr buf)
+{
+    int res = -1;
+    char *host = NULL;
+    char **lines = NULL;
+    struct virLXCCpuinfo cpuinfo;
+    unsigned long long *hostTicks = NULL;
+    size_t nhostTicks;
+    unsigned long long nsPerTick;
+    unsigned long long total;
+    unsigned long long sumUser = 0, sumSys = 0, sumIdle = 0;
+    virBuffer cpus = VIR_BUFFER_INITIALIZER;
+    ssize_t cpu = -1;
+    size_t ncpus = 0;
+    size_t i, j;
+    long hz;
+
+    if ((hz = sysconf(_SC_CLK_TCK)) <= 0) {
+        virReportSystemError(errno, "%s", _("Unable to get clock ticks"));
+        return -1;
+    }
+    nsPerTick = 1000ull * 1000 * 1000 / hz;
+
+    if (virLXCCgroupGetCpuinfo(&cpuinfo) < 0)
+        return -1;
+
+    if (virFileReadAll(hostpath, 1024 * 1024, &host) < 0 ||
+        !(lines = virStringSplit(host, "\n", 0)))
+        goto cleanup;
+
+    nhostTicks = virBitmapSize(cpuinfo.cpus);
+    if (VIR_ALLOC_N(hostTicks, nhostTicks) < 0)
+        goto cleanup;
+
+    /* How much time each host CPU has accounted so far, the sum of the
+     * user to steal fields */
+    for (i = 0; lines[i]; i++) {
+        char *end;
+        unsigned int hostcpu;
+        unsigned long long value;
+
+        if (!STRPREFIX(lines[i], "cpu") ||
+            virStrToLong_ui(lines[i] + 3, &end, 10, &hostcpu) < 0 ||
+            end == lines[i] + 3 || hostcpu >= nhostTicks)
+            continue;
+
+        for (j = 0; j < 8; j++) {
+            if (virStrToLong_ull(end, &end, 10, &value) < 0)
+                break;
+            hostTicks[hostcpu] += value;
+        }
+    }
+
+    total = (cpuinfo.user + cpuinfo.sys) / nsPerTick;
+    ncpus = virBitmapCountBits(cpuinfo.cpus);
+
+    for (i = 0; (cpu = virBitmapNextSetBit(cpuinfo.cpus, cpu)) >= 0; i++) {
+        unsigned long long used;
+        unsigned long long user;
+        unsigned long long idle;
+
+        if (cpuinfo.usage)
+            used = cpu < cpuinfo.nusage ? cpuinfo.usage[cpu] / nsPerTick : 0;
+        else
+            used = total / ncpus;
+
+        user = cpuinfo.user + cpuinfo.sys ?
+            used * ((double) cpuinfo.user / (cpuinfo.user + cpuinfo.sys)) : 0;
+        idle = hostTicks[cpu] > used ? hostTicks[cpu] - used : 0;
+
+        virBufferAsprintf(&cpus, "cpu%zu %llu 0 %llu %llu 0 0 0 0 0 0\n",
+                          i, user, used - user, idle);
+        sumUser += user;
+        sumSys += used - user;
+        sumIdle += idle;
+    }
+
+    if (virBufferCheckError(&cpus) < 0)
+        goto cleanup;
+
+    for (i = 0; lines[i]; i++) {
+        if (STRPREFIX(lines[i], "cpu")) {
+            /* The host's cpu lines all come first */
+            if (i == 0) {
+                virBufferAsprintf(buf, "cpu  %llu 0 %llu %llu 0 0 0 0 0 0\n",
+                                  sumUser, sumSys, sumIdle);
+                virBufferAdd(buf, virBufferCurrentContent(&cpus), -1);
+            }
+            continue;
+        }
+
+        if (*lines[i])
+            virBufferAsprintf(buf, "%s\n", lines[i]);
+    }
+
+    res = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&cpus);
+    VIR_FREE(hostTicks);
+    virStringListFree(lines);
+    VIR_FREE(host);
+    virLXCCgroupCpuinfoClear(&cpuinfo);
+    return res;
+}
+
+static unsigned long lxcProcCalcLoad(unsigned long load,
+                                     unsigned long exp,
+                                     unsigned long active)
+{
+    unsigned long newload = load * exp + active * (LXC_LOAD_FIXED_1 - exp);
+
+    if (active >= load)
+        newload += LXC_LOAD_FIXED_1 - 1;
+
+    return newload / LXC_LOAD_FIXED_1;
+}
+
+/*
+ * Samples the container's runnable and blocked threads every 5
+ * seconds like the kernel does for the host, though only while the
+ * file gets read. A sample then stands in for all the periods missed.
+ */
+static int lxcProcGenerateLoadavg(virLXCFusePtr fuse,
+                                  const char *hostpath,
+                                  virBufferPtr buf)
+{
+    int res = -1;
+    char *host = NULL;
+    const char *lastpid;
+    size_t running, blocked, total;
+    unsigned long long now;
+    unsigned long long periods;
+    unsigned long active;
+    size_t i, j;
+
+    if (virLXCCgroupGetTaskStates(&running, &blocked, &total) < 0 ||
+        virTimeMillisNow(&now) < 0)
+        return -1;
+
+    periods = now > fuse->loadstamp ?
+        (now - fuse->loadstamp) / LXC_LOAD_FREQ : 0;
+    active = (running + blocked) * LXC_LOAD_FIXED_1;
+
+    for (i = 0; i < MIN(periods, LXC_LOAD_MAX_PERIODS); i++) {
+        for (j = 0; j < ARRAY_CARDINALITY(lxcLoadExp); j++)
+            fuse->loadavg[j] = lxcProcCalcLoad(fuse->loadavg[j],
+                                               lxcLoadExp[j], active);
+    }
+    fuse->loadstamp += periods * LXC_LOAD_FREQ;
+
+    /* The last PID is the host's, the kernel has nothing else */
+    if (virFileReadAll(hostpath, 1024, &host) < 0)
+        goto cleanup;
+
+    if (!(lastpid = strrchr(host, ' '))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Malformed %s: %s"), hostpath, host);
+        goto cleanup;
+    }
+
+    for (j = 0; j < ARRAY_CARDINALITY(lxcLoadExp); j++) {
+        unsigned long load = fuse->loadavg[j] + LXC_LOAD_FIXED_1 / 200;
+
+        virBufferAsprintf(buf, "%lu.%02lu ", load >> LXC_LOAD_FSHIFT,
+                          ((load & (LXC_LOAD_FIXED_1 - 1)) * 100) >>
+                          LXC_LOAD_FSHIFT);
+    }
+    virBufferAsprintf(buf, "%zu/%zu %s", running, total, lastpid + 1);
+
+    res = 0;
+
+ cleanup:
+    VIR_FREE(host);
     return res;
 }
 
-static int lxcProcRead(const char *path ATTRIBUTE_UNUSED,
-                       char *buf ATTRIBUTE_UNUSED,
-                       size_t size ATTRIBUTE_UNUSED,
-                       off_t offset ATTRIBUTE_UNUSED,
+static lxcProcGenerateFunc lxcProcGenerators[VIR_LXC_FUSE_FILE_LAST] = {
+    [VIR_LXC_FUSE_FILE_MEMINFO] = lxcProcGenerateMeminfo,
+    [VIR_LXC_FUSE_FILE_CPUINFO] = lxcProcGenerateCpuinfo,
+    [VIR_LXC_FUSE_FILE_STAT] = lxcProcGenerateStat,
+    [VIR_LXC_FUSE_FILE_LOADAVG] = lxcProcGenerateLoadavg,
+};
+
+/*
+ * The files are generated whole and served from the cache for
+ * VIR_LXC_FUSE_CACHE_TTL, so that agents polling them don't cost cgroup
+ * reads every time, and reads of later chunks match the first one
+ */
+static int lxcProcRead(const char *path,
+                       char *buf,
+                       size_t size,
+                       off_t offset,
                        struct fuse_file_info *fi ATTRIBUTE_UNUSED)
 {
-    int res = -ENOENT;
+    int res;
+    int type;
     char *hostpath = NULL;
     struct fuse_context *context = NULL;
-    virDomainDefPtr def = NULL;
+    virLXCFusePtr fuse = NULL;
+    struct virLXCFuseCache *cache;
+    virBuffer data = VIR_BUFFER_INITIALIZER;
+    unsigned long long now;
+
+    if ((type = lxcProcFileType(path)) < 0)
+        return -ENOENT;
 
     if (virAsprintf(&hostpath, "/proc/%s", path) < 0)
         return -errno;
 
     context = fuse_get_context();
-    def = (virDomainDefPtr)context->private_data;
+    fuse = (virLXCFusePtr)context->private_data;
+    cache = &fuse->cache[type];
 
-    if (STREQ(path, fuse_meminfo_path)) {
-        if ((res = lxcProcReadMeminfo(hostpath, def, buf, size, offset)) < 0)
+    if (virTimeMillisNow(&now) < 0) {
+        res = -errno;
+        goto cleanup;
+    }
+
+    /* Reads past the start continue an earlier one, keep serving its
+     * snapshot even if it expired in the meantime */
+    if (!cache->data ||
+        (offset == 0 && now - cache->stamp >= VIR_LXC_FUSE_CACHE_TTL)) {
+        VIR_FREE(cache->data);
+        cache->len = 0;
+
+        if (lxcProcGenerators[type](fuse, hostpath, &data) < 0 ||
+            virBufferCheckError(&data) < 0) {
+            virBufferFreeAndReset(&data);
             res = lxcProcHostRead(hostpath, buf, size, offset);
+            goto cleanup;
+        }
+
+        cache->len = virBufferUse(&data);
+        cache->data = virBufferContentAndReset(&data);
+        cache->stamp = now;
+    }
+
+    if (offset >= cache->len) {
+        res = 0;
+    } else {
+        res = MIN(size, cache->len - offset);
+        memcpy(buf, cache->data + offset, res);
     }
 
+ cleanup:
     VIR_FREE(hostpath);
     return res;
 }
@@ -309,6 +607,9 @@ int lxcSetupFuse(virLXCFusePtr *f, virDomainDefPtr def)
 
     fuse->def = def;
 
+    if (virTimeMillisNow(&fuse->loadstamp) < 0)
+        goto cleanup2;
+
     if (virMutexInit(&fuse->lock) < 0)
         goto cleanup2;
 
@@ -334,7 +635,7 @@ int lxcSetupFuse(virLXCFusePtr *f, virDomainDefPtr def)
         goto cleanup1;
 
     fuse->fuse = fuse_new(fuse->ch, &args, &lxcProcOper,
-                          sizeof(lxcProcOper), fuse->def);
+                          sizeof(lxcProcOper), fuse);
     if (fuse->fuse == NULL) {
         fuse_unmount(fuse->mountpoint, fuse->ch);
         goto cleanup1;
@@ -367,6 +668,8 @@ int lxcStartFuse(virLXCFusePtr fuse)
 void lxcFreeFuse(virLXCFusePtr *f)
 {
     virLXCFusePtr fuse = *f;
+    size_t i;
+
     /* lxcFuseRun thread create success */
     if (fuse) {
         /* exit fuse_loop, lxcFuseRun thread may try to destroy
@@ -376,6 +679,8 @@ void lxcFreeFuse(virLXCFusePtr *f)
             fuse_exit(fuse->fuse);
         virMutexUnlock(&fuse->lock);
 
+        for (i = 0; i < VIR_LXC_FUSE_FILE_LAST; i++)
+            VIR_FREE(fuse->cache[i].data);
         VIR_FREE(fuse->mountpoint);
         VIR_FREE(*f);
     }
@@ -47,6 +47,36 @@ struct virLXCMeminfo {
 };
 typedef struct virLXCMeminfo *virLXCMeminfoPtr;
 
+struct virLXCCpuinfo {
+    virBitmapPtr cpus;          /* host CPUs the container can keep busy */
+    unsigned long long *usage;  /* nanoseconds spent on each host CPU */
+    size_t nusage;
+    unsigned long long user;    /* nanoseconds spent in user mode */
+    unsigned long long sys;     /* nanoseconds spent in kernel mode */
+};
+typedef struct virLXCCpuinfo *virLXCCpuinfoPtr;
+
+/* The /proc files the container gets emulated versions of */
+typedef enum {
+    VIR_LXC_FUSE_FILE_MEMINFO,
+    VIR_LXC_FUSE_FILE_CPUINFO,
+    VIR_LXC_FUSE_FILE_STAT,
+    VIR_LXC_FUSE_FILE_LOADAVG,
+
+    VIR_LXC_FUSE_FILE_LAST
+} virLXCFuseFile;
+
+VIR_ENUM_DECL(virLXCFuseFile)
+
+/* How long a generated file is served to readers, in milliseconds */
+# define VIR_LXC_FUSE_CACHE_TTL 500
+
+struct virLXCFuseCache {
+    char *data;
+    size_t len;
+    unsigned long long stamp;
+};
+
 struct virLXCFuse {
     virDomainDefPtr def;
     virThread thread;
@@ -54,6 +84,12 @@ struct virLXCFuse {
     struct fuse *fuse;
     struct fuse_chan *ch;
     virMutex lock;
+
+    /* Only touched by the fuse_loop thread, which serves one request
+     * at a time */
+    struct virLXCFuseCache cache[VIR_LXC_FUSE_FILE_LAST];
+    unsigned long loadavg[3];
+    unsigned long long loadstamp;
 };
 typedef struct virLXCFuse *virLXCFusePtr;
 
@@ -968,13 +968,14 @@ lxcSetBlkioTune(virDomainDefPtr def, virConfPtr properties)
     return 0;
 }
 
-static void
+static int
 lxcSetCapDrop(virDomainDefPtr def, virConfPtr properties)
 {
     virConfValuePtr value;
     char **toDrop = NULL;
     const char *capString;
     size_t i;
+    int ret = -1;
 
     if ((value = virConfGetValue(properties, "lxc.cap.drop")) && value->str)
         toDrop = virStringSplit(value->str, " ", 0);
@@ -982,13 +983,17 @@ lxcSetCapDrop(virDomainDefPtr def, virConfPtr properties)
     for (i = 0; i < VIR_DOMAIN_CAPS_FEATURE_LAST; i++) {
         capString = virDomainCapsFeatureTypeToString(i);
         if (toDrop != NULL &&
-            virStringListHasString((const char **) toDrop, capString))
-            def->caps_features[i] = VIR_TRISTATE_SWITCH_OFF;
+            virStringListHasString((const char **) toDrop, capString) &&
+            virDomainDefSetCapsFeature(def, i, VIR_TRISTATE_SWITCH_OFF) < 0)
+            goto cleanup;
     }
 
     def->features[VIR_DOMAIN_FEATURE_CAPABILITIES] = VIR_DOMAIN_CAPABILITIES_POLICY_ALLOW;
+    ret = 0;
 
+ cleanup:
     virStringListFree(toDrop);
+    return ret;
 }
 
 virDomainDefPtr
@@ -1092,7 +1097,8 @@ lxcParseConfigString(const char *config,
         goto error;
 
     /* lxc.cap.drop */
-    lxcSetCapDrop(vmdef, properties);
+    if (lxcSetCapDrop(vmdef, properties) < 0)
+        goto error;
 
     if (virDomainDefPostParse(vmdef, caps, VIR_DOMAIN_DEF_PARSE_ABI_UPDATE,
                               xmlopt, NULL) < 0)
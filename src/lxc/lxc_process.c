@@ -275,16 +275,14 @@ virLXCProcessSetupInterfaceTap(virDomainDefPtr vm,
 
     VIR_DEBUG("calling vethCreate()");
     parentVeth = net->ifname;
-    if (virNetDevVethCreate(&parentVeth, &containerVeth) < 0)
+    if (virNetDevVethCreate(&parentVeth, &containerVeth,
+                            &net->mac, net->mtu) < 0)
         goto cleanup;
     VIR_DEBUG("parentVeth: %s, containerVeth: %s", parentVeth, containerVeth);
 
     if (net->ifname == NULL)
         net->ifname = parentVeth;
 
-    if (virNetDevSetMAC(containerVeth, &net->mac) < 0)
-        goto cleanup;
-
     if (brname) {
         if (vport && vport->virtPortType == VIR_NETDEV_VPORT_PROFILE_OPENVSWITCH) {
             if (virNetDevOpenvswitchAddPort(brname, parentVeth, &net->mac, vm->uuid,
@@ -857,7 +855,7 @@ int virLXCProcessStop(virLXCDriverPtr driver,
     /* Clear out dynamically assigned labels */
     if (vm->def->nseclabels &&
         vm->def->seclabels[0]->type == VIR_DOMAIN_SECLABEL_DYNAMIC) {
-        VIR_FREE(vm->def->seclabels[0]->model);
+        vm->def->seclabels[0]->model = NULL;
         VIR_FREE(vm->def->seclabels[0]->label);
         VIR_FREE(vm->def->seclabels[0]->imagelabel);
     }
@@ -1522,6 +1520,9 @@ int virLXCProcessStart(virConnectPtr conn,
         goto cleanup;
     }
 
+    if (virCgroupEnableStatCache(priv->cgroup) < 0)
+        goto cleanup;
+
     /* Get the machine name so we can properly delete it through
      * systemd later */
     if (!(priv->machineName = virSystemdGetMachineNameByPID(vm->pid)))
@@ -1584,7 +1585,7 @@ int virLXCProcessStart(virConnectPtr conn,
             if (vm->def->nseclabels &&
                 (vm->def->seclabels[0]->type == VIR_DOMAIN_SECLABEL_DYNAMIC ||
                 clearSeclabel)) {
-                VIR_FREE(vm->def->seclabels[0]->model);
+                vm->def->seclabels[0]->model = NULL;
                 VIR_FREE(vm->def->seclabels[0]->label);
                 VIR_FREE(vm->def->seclabels[0]->imagelabel);
                 VIR_DELETE_ELEMENT(vm->def->seclabels, 0, vm->def->nseclabels);
@@ -1705,6 +1706,9 @@ virLXCProcessReconnectDomain(virDomainObjPtr vm,
             goto error;
         }
 
+        if (virCgroupEnableStatCache(priv->cgroup) < 0)
+            goto error;
+
         if (!(priv->machineName = virSystemdGetMachineNameByPID(vm->pid)))
             virResetLastError();
 
@@ -60,6 +60,7 @@
 #include "viriptables.h"
 #include "virlog.h"
 #include "virdnsmasq.h"
+#include "virlease.h"
 #include "configmake.h"
 #include "virnetlink.h"
 #include "virnetdev.h"
@@ -74,7 +75,9 @@
 #include "viraccessapicheck.h"
 #include "network_event.h"
 #include "virhook.h"
+#include "virhash.h"
 #include "virjson.h"
+#include "virthreadpool.h"
 
 #define VIR_FROM_THIS VIR_FROM_NETWORK
 #define MAX_BRIDGE_ID 256
@@ -260,6 +263,17 @@ networkDnsmasqLeaseFileNameCustom(virNetworkDriverStatePtr driver,
     return leasefile;
 }
 
+static char *
+networkDnsmasqLeaseDBFileName(virNetworkDriverStatePtr driver,
+                              const char *bridge)
+{
+    char *leasefile;
+
+    ignore_value(virAsprintf(&leasefile, "%s/%s" VIR_LEASE_DB_SUFFIX,
+                             driver->dnsmasqStateDir, bridge));
+    return leasefile;
+}
+
 static char *
 networkDnsmasqConfigFileName(virNetworkDriverStatePtr driver,
                              const char *netname)
@@ -310,11 +324,13 @@ networkRemoveInactive(virNetworkDriverStatePtr driver,
 {
     char *leasefile = NULL;
     char *customleasefile = NULL;
+    char *leasedbfile = NULL;
     char *radvdconfigfile = NULL;
     char *configfile = NULL;
     char *radvdpidbase = NULL;
     char *statusfile = NULL;
     char *macMapFile = NULL;
+    char *macMapLogFile = NULL;
     dnsmasqContext *dctx = NULL;
     virNetworkDefPtr def = virNetworkObjGetPersistentDef(net);
 
@@ -332,6 +348,9 @@ networkRemoveInactive(virNetworkDriverStatePtr driver,
     if (!(customleasefile = networkDnsmasqLeaseFileNameCustom(driver, def->bridge)))
         goto cleanup;
 
+    if (!(leasedbfile = networkDnsmasqLeaseDBFileName(driver, def->bridge)))
+        goto cleanup;
+
     if (!(radvdconfigfile = networkRadvdConfigFileName(driver, def->name)))
         goto cleanup;
 
@@ -347,14 +366,20 @@ networkRemoveInactive(virNetworkDriverStatePtr driver,
     if (!(macMapFile = networkMacMgrFileName(driver, def->bridge)))
         goto cleanup;
 
+    if (virAsprintf(&macMapLogFile, "%s" VIR_MAC_MAP_LOG_SUFFIX,
+                    macMapFile) < 0)
+        goto cleanup;
+
     /* dnsmasq */
     dnsmasqDelete(dctx);
     unlink(leasefile);
     unlink(customleasefile);
+    unlink(leasedbfile);
     unlink(configfile);
 
     /* MAC map manager */
     unlink(macMapFile);
+    unlink(macMapLogFile);
 
     /* radvd */
     unlink(radvdconfigfile);
@@ -372,10 +397,12 @@ networkRemoveInactive(virNetworkDriverStatePtr driver,
     VIR_FREE(leasefile);
     VIR_FREE(configfile);
     VIR_FREE(customleasefile);
+    VIR_FREE(leasedbfile);
     VIR_FREE(radvdconfigfile);
     VIR_FREE(radvdpidbase);
     VIR_FREE(statusfile);
     VIR_FREE(macMapFile);
+    VIR_FREE(macMapLogFile);
     dnsmasqContextFree(dctx);
     return ret;
 }
@@ -1446,10 +1473,18 @@ networkDnsmasqConfContents(virNetworkObjPtr network,
      * listening for DHCP, we should write a 0-length hosts
      * file to allow for runtime additions.
      */
-    if (ipv4def || ipv6def)
+    if (ipv4def || ipv6def) {
         virBufferAsprintf(&configbuf, "dhcp-hostsfile=%s\n",
                           dctx->hostsfile->path);
 
+        /* Hosts added at runtime are dropped into this directory one
+         * file each, which dnsmasq picks up without a SIGHUP.
+         */
+        if (dnsmasqCapsGet(caps, DNSMASQ_CAPS_DHCP_HOSTSDIR))
+            virBufferAsprintf(&configbuf, "dhcp-hostsdir=%s\n",
+                              dctx->hostsdir);
+    }
+
     /* Likewise, always create this file and put it on the
      * commandline, to allow for runtime additions.
      */
@@ -1638,6 +1673,46 @@ networkStartDhcpDaemon(virNetworkDriverStatePtr driver,
     return ret;
 }
 
+/* networkBuildDnsmasqDhcpHosts:
+ *  Fill @dctx with the dhcp-host entries of @def, the same way for
+ *  the full refresh and the incremental update paths.
+ */
+static int
+networkBuildDnsmasqDhcpHosts(dnsmasqContext *dctx,
+                             virNetworkDefPtr def)
+{
+    size_t i;
+    virNetworkIPDefPtr ipdef, ipv4def, ipv6def;
+
+    /* Look for first IPv4 address that has dhcp defined.
+     * We only support dhcp-host config on one IPv4 subnetwork
+     * and on one IPv6 subnetwork.
+     */
+    ipv4def = NULL;
+    for (i = 0;
+         (ipdef = virNetworkDefGetIPByIndex(def, AF_INET, i));
+         i++) {
+        if (!ipv4def && (ipdef->nranges || ipdef->nhosts))
+            ipv4def = ipdef;
+    }
+
+    ipv6def = NULL;
+    for (i = 0;
+         (ipdef = virNetworkDefGetIPByIndex(def, AF_INET6, i));
+         i++) {
+        if (!ipv6def && (ipdef->nranges || ipdef->nhosts))
+            ipv6def = ipdef;
+    }
+
+    if (ipv4def && (networkBuildDnsmasqDhcpHostsList(dctx, ipv4def) < 0))
+        return -1;
+
+    if (ipv6def && (networkBuildDnsmasqDhcpHostsList(dctx, ipv6def) < 0))
+        return -1;
+
+    return 0;
+}
+
 /* networkRefreshDhcpDaemon:
  *  Update dnsmasq config files, then send a SIGHUP so that it rereads
  *  them.   This only works for the dhcp-hostsfile and the
@@ -1650,8 +1725,6 @@ networkRefreshDhcpDaemon(virNetworkDriverStatePtr driver,
                          virNetworkObjPtr network)
 {
     int ret = -1;
-    size_t i;
-    virNetworkIPDefPtr ipdef, ipv4def, ipv6def;
     dnsmasqContext *dctx = NULL;
 
     /* if no IP addresses specified, nothing to do */
@@ -1668,41 +1741,113 @@ networkRefreshDhcpDaemon(virNetworkDriverStatePtr driver,
         goto cleanup;
     }
 
-    /* Look for first IPv4 address that has dhcp defined.
-     * We only support dhcp-host config on one IPv4 subnetwork
-     * and on one IPv6 subnetwork.
-     */
-    ipv4def = NULL;
-    for (i = 0;
-         (ipdef = virNetworkDefGetIPByIndex(network->def, AF_INET, i));
-         i++) {
-        if (!ipv4def && (ipdef->nranges || ipdef->nhosts))
-            ipv4def = ipdef;
+    if (networkBuildDnsmasqDhcpHosts(dctx, network->def) < 0)
+        goto cleanup;
+
+    if (networkBuildDnsmasqHostsList(dctx, &network->def->dns) < 0)
+        goto cleanup;
+
+    if ((ret = dnsmasqSave(dctx)) < 0)
+        goto cleanup;
+
+    ret = kill(network->dnsmasqPid, SIGHUP);
+ cleanup:
+    dnsmasqContextFree(dctx);
+    return ret;
+}
+
+/* networkAddDhcpDaemonHosts:
+ *  Hand the dhcp-host entries that are present in the network's
+ *  current definition but not in @olddctx to the running dnsmasq,
+ *  by writing each of them to the dhcp-hostsdir it watches.  Neither
+ *  a restart nor a SIGHUP is needed, and the (possibly large)
+ *  hostsfile is left alone.  dnsmasq cannot forget entries read from
+ *  that directory though, so anything else than pure additions must
+ *  go through networkRefreshDhcpDaemon().
+ *
+ *  Returns 1 if the hosts have been added, 0 if a full refresh is
+ *  needed instead, -1 on failure.
+ */
+static int
+networkAddDhcpDaemonHosts(virNetworkDriverStatePtr driver,
+                          virNetworkObjPtr network,
+                          dnsmasqContext *olddctx)
+{
+    dnsmasqCapsPtr dnsmasq_caps = networkGetDnsmasqCaps(driver);
+    dnsmasqContext *dctx = NULL;
+    virHashTablePtr oldhosts = NULL;
+    char *configfile = NULL;
+    char *config = NULL;
+    size_t i;
+    size_t nkept = 0;
+    int ret = -1;
+
+    if (!olddctx ||
+        !dnsmasqCapsGet(dnsmasq_caps, DNSMASQ_CAPS_DHCP_HOSTSDIR) ||
+        network->dnsmasqPid <= 0 || (kill(network->dnsmasqPid, 0) < 0)) {
+        ret = 0;
+        goto cleanup;
     }
 
-    ipv6def = NULL;
-    for (i = 0;
-         (ipdef = virNetworkDefGetIPByIndex(network->def, AF_INET6, i));
-         i++) {
-        if (!ipv6def && (ipdef->nranges || ipdef->nhosts))
-            ipv6def = ipdef;
+    /* the running dnsmasq may predate dhcp-hostsdir support, in which
+     * case it was not told to watch the directory
+     */
+    if (!(configfile = networkDnsmasqConfigFileName(driver,
+                                                    network->def->name)))
+        goto cleanup;
+
+    if (virFileReadAllQuiet(configfile, 1024 * 1024, &config) < 0 ||
+        !strstr(config, "\ndhcp-hostsdir=")) {
+        ret = 0;
+        goto cleanup;
     }
 
-    if (ipv4def && (networkBuildDnsmasqDhcpHostsList(dctx, ipv4def) < 0))
+    if (!(dctx = dnsmasqContextNew(network->def->name,
+                                   driver->dnsmasqStateDir)))
         goto cleanup;
 
-    if (ipv6def && (networkBuildDnsmasqDhcpHostsList(dctx, ipv6def) < 0))
+    if (networkBuildDnsmasqDhcpHosts(dctx, network->def) < 0)
         goto cleanup;
 
-    if (networkBuildDnsmasqHostsList(dctx, &network->def->dns) < 0)
+    if (!(oldhosts = virHashCreate(olddctx->hostsfile->nhosts + 1, NULL)))
         goto cleanup;
 
-    if ((ret = dnsmasqSave(dctx)) < 0)
+    for (i = 0; i < olddctx->hostsfile->nhosts; i++) {
+        if (virHashUpdateEntry(oldhosts, olddctx->hostsfile->hosts[i].host,
+                               (void *) 1) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < dctx->hostsfile->nhosts; i++) {
+        if (virHashLookup(oldhosts, dctx->hostsfile->hosts[i].host))
+            nkept++;
+    }
+
+    /* an entry was removed or changed */
+    if (nkept < (size_t) virHashSize(oldhosts)) {
+        ret = 0;
         goto cleanup;
+    }
+
+    VIR_INFO("Adding %zu dhcp-host entries to dnsmasq for network %s",
+             dctx->hostsfile->nhosts - nkept, network->def->bridge);
+
+    for (i = 0; i < dctx->hostsfile->nhosts; i++) {
+        const char *host = dctx->hostsfile->hosts[i].host;
+
+        if (!virHashLookup(oldhosts, host) &&
+            dnsmasqSaveDhcpHostsdirEntry(dctx, host) < 0)
+            goto cleanup;
+    }
+
+    ret = 1;
 
-    ret = kill(network->dnsmasqPid, SIGHUP);
  cleanup:
+    virHashFree(oldhosts);
     dnsmasqContextFree(dctx);
+    VIR_FREE(config);
+    VIR_FREE(configfile);
+    virObjectUnref(dnsmasq_caps);
     return ret;
 }
 
@@ -2032,16 +2177,137 @@ networkRefreshDaemonsHelper(virNetworkObjPtr net,
     return 0;
 }
 
+/* Upper bound of the threads refreshing the daemons of the networks
+ * in networkRefreshDaemons */
+#define NETWORK_REFRESH_MAX_WORKERS 8
+
+struct networkRefreshDaemonsData {
+    virNetworkDriverStatePtr driver;
+    virNetworkObjPtr *nets;
+    size_t nnets;
+
+    virMutex lock;
+    virCond cond;
+    size_t pending;
+};
+
+static int
+networkRefreshDaemonsCollect(virNetworkObjPtr net,
+                             void *opaque)
+{
+    struct networkRefreshDaemonsData *data = opaque;
+
+    if (VIR_APPEND_ELEMENT_COPY(data->nets, data->nnets, net) < 0)
+        return -1;
+
+    virObjectRef(net);
+    return 0;
+}
+
+static void
+networkRefreshDaemonsWorker(void *jobdata,
+                            void *opaque)
+{
+    virNetworkObjPtr net = jobdata;
+    struct networkRefreshDaemonsData *data = opaque;
+
+    networkRefreshDaemonsHelper(net, data->driver);
+    virResetLastError();
+
+    virMutexLock(&data->lock);
+    if (--data->pending == 0)
+        virCondSignal(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+static int
+networkRefreshDaemonsPool(struct networkRefreshDaemonsData *data,
+                          size_t nworkers)
+{
+    virThreadPoolPtr pool = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (virMutexInit(&data->lock) < 0)
+        return -1;
+    if (virCondInit(&data->cond) < 0) {
+        virMutexDestroy(&data->lock);
+        return -1;
+    }
+
+    if (!(pool = virThreadPoolNew(0, nworkers, 0,
+                                  networkRefreshDaemonsWorker, data)))
+        goto cleanup;
+
+    virMutexLock(&data->lock);
+    for (i = 0; i < data->nnets; i++) {
+        data->pending++;
+
+        if (virThreadPoolSendJob(pool, 0, data->nets[i]) < 0) {
+            /* Refresh this one ourselves rather than skipping it */
+            data->pending--;
+            virResetLastError();
+            virMutexUnlock(&data->lock);
+            networkRefreshDaemonsHelper(data->nets[i], data->driver);
+            virMutexLock(&data->lock);
+        }
+    }
+
+    /* @data, its lock and condition live until networkRefreshDaemons
+     * returns, and every job touches them when done with its network.
+     * Freeing the pool first would drop the jobs not started yet, so
+     * wait for the last one to report back even if waiting fails. */
+    while (data->pending) {
+        if (virCondWait(&data->cond, &data->lock) < 0)
+            VIR_WARN("cannot wait on condition");
+    }
+    virMutexUnlock(&data->lock);
+
+    ret = 0;
+
+ cleanup:
+    virThreadPoolFree(pool);
+    virCondDestroy(&data->cond);
+    virMutexDestroy(&data->lock);
+    return ret;
+}
+
 /* SIGHUP/restart any dnsmasq or radvd daemons.
  * This should be called when libvirtd is restarted.
+ *
+ * Networks are independent of each other and most of the time goes to
+ * waiting for the daemons, so they are refreshed on a pool of up to
+ * NETWORK_REFRESH_MAX_WORKERS threads.
  */
 static void
 networkRefreshDaemons(virNetworkDriverStatePtr driver)
 {
+    struct networkRefreshDaemonsData data = { .driver = driver };
+    size_t nworkers;
+    size_t i;
+
     VIR_INFO("Refreshing network daemons");
-    virNetworkObjListForEach(driver->networks,
-                             networkRefreshDaemonsHelper,
-                             driver);
+
+    /* Don't keep the list locked, and every other network API waiting,
+     * while the daemons are refreshed */
+    if (virNetworkObjListForEach(driver->networks,
+                                 networkRefreshDaemonsCollect,
+                                 &data) < 0)
+        VIR_WARN("Not refreshing the daemons of all networks: %s",
+                 virGetLastErrorMessage());
+
+    nworkers = MIN(data.nnets, NETWORK_REFRESH_MAX_WORKERS);
+
+    if (nworkers < 2 ||
+        networkRefreshDaemonsPool(&data, nworkers) < 0) {
+        virResetLastError();
+        for (i = 0; i < data.nnets; i++)
+            networkRefreshDaemonsHelper(data.nets[i], driver);
+    }
+
+    for (i = 0; i < data.nnets; i++)
+        virObjectUnref(data.nets[i]);
+    VIR_FREE(data.nets);
 }
 
 static int
@@ -2059,8 +2325,7 @@ networkReloadFirewallRulesHelper(virNetworkObjPtr net,
          * network type, forward='open', doesn't need this because it
          * has no iptables rules.
          */
-        networkRemoveFirewallRules(net->def);
-        if (networkAddFirewallRules(net->def) < 0) {
+        if (networkReplaceFirewallRules(net->def) < 0) {
             /* failed to add but already logged */
         }
     }
@@ -3582,6 +3847,7 @@ networkUpdate(virNetworkPtr net,
     virNetworkIPDefPtr ipdef;
     bool oldDhcpActive = false;
     bool needFirewallRefresh = false;
+    dnsmasqContext *olddctx = NULL;
 
 
     virCheckFlags(VIR_NETWORK_UPDATE_AFFECT_LIVE |
@@ -3643,6 +3909,16 @@ networkUpdate(virNetworkPtr net,
                 break;
             }
         }
+
+        /* remember the current dhcp-host entries, so that additions
+         * can be handed to dnsmasq incrementally afterwards
+         */
+        if (section == VIR_NETWORK_SECTION_IP_DHCP_HOST) {
+            if (!(olddctx = dnsmasqContextNew(network->def->name,
+                                              driver->dnsmasqStateDir)) ||
+                networkBuildDnsmasqDhcpHosts(olddctx, network->def) < 0)
+                goto cleanup;
+        }
     }
 
     /* update the network config in memory/on disk */
@@ -3688,9 +3964,11 @@ networkUpdate(virNetworkPtr net,
             /* if we previously weren't listening for dhcp and now we
              * are (or vice-versa) then we need to do a restart,
              * otherwise we just need to do a refresh (redo the config
-             * files and send SIGHUP)
+             * files and send SIGHUP), unless hosts were only added and
+             * dnsmasq can pick them up from its dhcp-hostsdir
              */
             bool newDhcpActive = false;
+            int added = 0;
 
             for (i = 0;
                  (ipdef = virNetworkDefGetIPByIndex(network->def, AF_INET, i));
@@ -3701,12 +3979,17 @@ networkUpdate(virNetworkPtr net,
                 }
             }
 
-            if ((newDhcpActive != oldDhcpActive &&
-                 networkRestartDhcpDaemon(driver, network) < 0) ||
-                networkRefreshDhcpDaemon(driver, network) < 0) {
+            if (newDhcpActive != oldDhcpActive) {
+                if (networkRestartDhcpDaemon(driver, network) < 0)
+                    goto cleanup;
+            } else if ((added = networkAddDhcpDaemonHosts(driver, network,
+                                                          olddctx)) < 0) {
                 goto cleanup;
             }
 
+            if (!added && networkRefreshDhcpDaemon(driver, network) < 0)
+                goto cleanup;
+
         } else if (section == VIR_NETWORK_SECTION_DNS_HOST) {
             /* this section only changes data in an external file
              * (not the .conf file) so we can just update the config
@@ -3739,6 +4022,7 @@ networkUpdate(virNetworkPtr net,
 
     ret = 0;
  cleanup:
+    dnsmasqContextFree(olddctx);
     virNetworkObjEndAPI(&network);
     return ret;
 }
@@ -3959,11 +4243,14 @@ networkGetDHCPLeases(virNetworkPtr network,
     ssize_t size = 0;
     int custom_lease_file_len = 0;
     bool need_results = !!leases;
+    int rc;
     long long currtime = 0;
     long long expirytime_tmp = -1;
     bool ipv6 = false;
     char *lease_entries = NULL;
     char *custom_lease_file = NULL;
+    char *lease_db_file = NULL;
+    virLeaseDBPtr lease_db = NULL;
     const char *ip_tmp = NULL;
     const char *mac_tmp = NULL;
     virJSONValuePtr lease_tmp = NULL;
@@ -3988,31 +4275,52 @@ networkGetDHCPLeases(virNetworkPtr network,
     if (virNetworkGetDHCPLeasesEnsureACL(network->conn, obj->def) < 0)
         goto cleanup;
 
-    /* Retrieve custom leases file location */
-    custom_lease_file = networkDnsmasqLeaseFileNameCustom(driver, obj->def->bridge);
+    if (!(lease_db_file = networkDnsmasqLeaseDBFileName(driver,
+                                                        obj->def->bridge)))
+        goto cleanup;
 
-    /* Read entire contents */
-    if ((custom_lease_file_len = virFileReadAll(custom_lease_file,
-                                                VIR_NETWORK_DHCP_LEASE_FILE_SIZE_MAX,
-                                                &lease_entries)) < 0) {
-        /* Even though src/network/leaseshelper.c guarantees the existence of
-         * leases file (even if no leases are present), and the control reaches
-         * here, instead of reporting error, return 0 leases */
-        rv = 0;
+    /* The lease database maintained by leaseshelper takes precedence
+     * over the custom leases file written by older versions of it */
+    if ((rc = virLeaseDBOpen(&lease_db, lease_db_file, 0)) < 0)
         goto error;
-    }
 
-    if (custom_lease_file_len) {
-        if (!(leases_array = virJSONValueFromString(lease_entries))) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("invalid json in file: %s"), custom_lease_file);
+    if (rc > 0) {
+        if (!(leases_array = virJSONValueNewArray()))
             goto error;
-        }
 
-        if ((size = virJSONValueArraySize(leases_array)) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("couldn't fetch array of leases"));
+        if (virLeaseReadLeaseDB(leases_array, lease_db, NULL) < 0)
             goto error;
+
+        size = virJSONValueArraySize(leases_array);
+    } else {
+        /* Retrieve custom leases file location */
+        custom_lease_file = networkDnsmasqLeaseFileNameCustom(driver,
+                                                              obj->def->bridge);
+
+        /* Read entire contents */
+        if ((custom_lease_file_len = virFileReadAll(custom_lease_file,
+                                                    VIR_NETWORK_DHCP_LEASE_FILE_SIZE_MAX,
+                                                    &lease_entries)) < 0) {
+            /* Neither file exists until leaseshelper runs for the
+             * first time, so instead of reporting error, return 0
+             * leases */
+            rv = 0;
+            goto error;
+        }
+
+        if (custom_lease_file_len) {
+            if (!(leases_array = virJSONValueFromString(lease_entries))) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("invalid json in file: %s"),
+                               custom_lease_file);
+                goto error;
+            }
+
+            if ((size = virJSONValueArraySize(leases_array)) < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("couldn't fetch array of leases"));
+                goto error;
+            }
         }
     }
 
@@ -4119,6 +4427,8 @@ networkGetDHCPLeases(virNetworkPtr network,
     VIR_FREE(lease);
     VIR_FREE(lease_entries);
     VIR_FREE(custom_lease_file);
+    VIR_FREE(lease_db_file);
+    virLeaseDBFree(lease_db);
     virJSONValueFree(leases_array);
 
     virNetworkObjEndAPI(&obj);
@@ -34,3 +34,8 @@ int networkAddFirewallRules(virNetworkDefPtr def ATTRIBUTE_UNUSED)
 void networkRemoveFirewallRules(virNetworkDefPtr def ATTRIBUTE_UNUSED)
 {
 }
+
+int networkReplaceFirewallRules(virNetworkDefPtr def ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
@@ -63,4 +63,6 @@ int networkAddFirewallRules(virNetworkDefPtr def);
 
 void networkRemoveFirewallRules(virNetworkDefPtr def);
 
+int networkReplaceFirewallRules(virNetworkDefPtr def);
+
 #endif /* __VIR_BRIDGE_DRIVER_PLATFORM_H__ */
@@ -36,6 +36,7 @@
 #include "viralloc.h"
 #include "virjson.h"
 #include "virlease.h"
+#include "virleasedb.h"
 #include "configmake.h"
 #include "virgettext.h"
 
@@ -79,14 +80,61 @@ VIR_ENUM_DECL(virLeaseAction);
 VIR_ENUM_IMPL(virLeaseAction, VIR_LEASE_ACTION_LAST,
               "add", "old", "del", "init");
 
+
+/* Move the leases of a custom lease file written by an older
+ * leaseshelper into the lease database, once.
+ */
+static int
+helperImportCustomLeaseFile(virLeaseDBPtr db,
+                            const char *custom_lease_file,
+                            char **server_duid)
+{
+    virJSONValuePtr leases_array = NULL;
+    virLeaseDBEntry entry;
+    ssize_t i;
+    int ret = -1;
+
+    if (!virLeaseDBIsEmpty(db) || !virFileExists(custom_lease_file))
+        return 0;
+
+    if (!(leases_array = virJSONValueNewArray())) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("failed to create json"));
+        goto cleanup;
+    }
+
+    if (virLeaseReadCustomLeaseFile(leases_array, custom_lease_file,
+                                    NULL, server_duid) < 0)
+        goto cleanup;
+
+    for (i = 0; i < virJSONValueArraySize(leases_array); i++) {
+        if (virLeaseToDBEntry(virJSONValueArrayGet(leases_array, i),
+                              &entry) < 0 ||
+            virLeaseDBAdd(db, &entry) < 0)
+            goto cleanup;
+    }
+
+    if (unlink(custom_lease_file) < 0 && errno != ENOENT) {
+        virReportSystemError(errno, _("cannot remove file '%s'"),
+                             custom_lease_file);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virJSONValueFree(leases_array);
+    return ret;
+}
+
 int
 main(int argc, char **argv)
 {
     char *pid_file = NULL;
     char *custom_lease_file = NULL;
+    char *lease_db_file = NULL;
     const char *ip = NULL;
     const char *mac = NULL;
-    const char *leases_str = NULL;
     const char *iaid = virGetEnvAllowSUID("DNSMASQ_IAID");
     const char *clientid = virGetEnvAllowSUID("DNSMASQ_CLIENT_ID");
     const char *interface = virGetEnvAllowSUID("DNSMASQ_INTERFACE");
@@ -95,7 +143,8 @@ main(int argc, char **argv)
     int action = -1;
     int pid_file_fd = -1;
     int rv = EXIT_FAILURE;
-    bool delete = false;
+    virLeaseDBPtr db = NULL;
+    virLeaseDBEntry entry;
     virJSONValuePtr lease_new = NULL;
     virJSONValuePtr leases_array_new = NULL;
 
@@ -161,6 +210,11 @@ main(int argc, char **argv)
                     interface) < 0)
         goto cleanup;
 
+    if (virAsprintf(&lease_db_file,
+                    LOCALSTATEDIR "/lib/libvirt/dnsmasq/%s" VIR_LEASE_DB_SUFFIX,
+                    interface) < 0)
+        goto cleanup;
+
     if (VIR_STRDUP(pid_file, LOCALSTATEDIR "/run/leaseshelper.pid") < 0)
         goto cleanup;
 
@@ -168,9 +222,13 @@ main(int argc, char **argv)
     if ((pid_file_fd = virPidFileAcquirePath(pid_file, true, getpid())) < 0)
         goto cleanup;
 
-    /* Since interfaces can be hot plugged, we need to make sure that the
-     * corresponding custom lease file exists. If not, 'touch' it */
-    if (virFileTouch(custom_lease_file, 0644) < 0)
+    /* Since interfaces can be hot plugged, the lease database is
+     * created here if it doesn't exist yet. Only the affected lease is
+     * written, the database is not read or rewritten as a whole. */
+    if (virLeaseDBOpen(&db, lease_db_file, VIR_LEASE_DB_OPEN_WRITE) < 0)
+        goto cleanup;
+
+    if (helperImportCustomLeaseFile(db, custom_lease_file, &server_duid) < 0)
         goto cleanup;
 
     switch ((enum virLeaseActionFlags) action) {
@@ -180,7 +238,7 @@ main(int argc, char **argv)
         if (virLeaseNew(&lease_new, mac, clientid, ip, hostname, iaid, server_duid) < 0)
             goto cleanup;
         /* Custom ipv6 leases *will not* be created if the env-var DNSMASQ_MAC
-         * is not set. In the special case, when the $(interface).status file
+         * is not set. In the special case, when the lease database
          * is not already present and dnsmasq is (re)started, the corresponding
          * ipv6 custom lease will be created only when the guest sends the
          * 'old' action for its existing ipv6 interfaces.
@@ -195,53 +253,27 @@ main(int argc, char **argv)
         if (!lease_new)
             break;
 
-        /* fallthrough */
-    case VIR_LEASE_ACTION_DEL:
-        /* Delete the corresponding lease, if it already exists */
-        delete = true;
-        break;
-
-    case VIR_LEASE_ACTION_INIT:
-    case VIR_LEASE_ACTION_LAST:
+        /* Replaces the corresponding lease, if it already exists */
+        if (virLeaseToDBEntry(lease_new, &entry) < 0 ||
+            virLeaseDBAdd(db, &entry) < 0)
+            goto cleanup;
         break;
-    }
-
-    if (!(leases_array_new = virJSONValueNewArray())) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("failed to create json"));
-        goto cleanup;
-    }
-
-    if (virLeaseReadCustomLeaseFile(leases_array_new, custom_lease_file,
-                                    delete ? ip : NULL, &server_duid) < 0)
-        goto cleanup;
 
-    switch ((enum virLeaseActionFlags) action) {
-    case VIR_LEASE_ACTION_INIT:
-        if (virLeasePrintLeases(leases_array_new, server_duid) < 0)
+    case VIR_LEASE_ACTION_DEL:
+        /* Delete the corresponding lease, if it already exists */
+        if (virLeaseDBRemove(db, ip) < 0)
             goto cleanup;
-
         break;
 
-    case VIR_LEASE_ACTION_OLD:
-    case VIR_LEASE_ACTION_ADD:
-        if (lease_new && virJSONValueArrayAppend(leases_array_new, lease_new) < 0) {
+    case VIR_LEASE_ACTION_INIT:
+        if (!(leases_array_new = virJSONValueNewArray())) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("failed to create json"));
             goto cleanup;
         }
-        lease_new = NULL;
 
-        /* fallthrough */
-    case VIR_LEASE_ACTION_DEL:
-        if (!(leases_str = virJSONValueToString(leases_array_new, true))) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("empty json array"));
-            goto cleanup;
-        }
-
-        /* Write to file */
-        if (virFileRewriteStr(custom_lease_file, 0644, leases_str) < 0)
+        if (virLeaseReadLeaseDB(leases_array_new, db, &server_duid) < 0 ||
+            virLeasePrintLeases(leases_array_new, server_duid) < 0)
             goto cleanup;
         break;
 
@@ -252,12 +284,15 @@ main(int argc, char **argv)
     rv = EXIT_SUCCESS;
 
  cleanup:
+    virLeaseDBFree(db);
+
     if (pid_file_fd != -1)
         virPidFileReleasePath(pid_file, pid_file_fd);
 
     VIR_FREE(pid_file);
     VIR_FREE(server_duid);
     VIR_FREE(custom_lease_file);
+    VIR_FREE(lease_db_file);
     virJSONValueFree(lease_new);
     virJSONValueFree(leases_array_new);
 
@@ -154,6 +154,18 @@ void nodeDeviceUnlock(void)
     virMutexUnlock(&driver->lock);
 }
 
+/* Devices present when the driver started may still be enumerated in
+ * the background, API calls wait for that to finish so that they don't
+ * see only some of them */
+static void nodeDeviceLockEnumerated(void)
+{
+    nodeDeviceLock();
+    while (driver->enumerating) {
+        if (virCondWait(&driver->enumerated, &driver->lock) < 0)
+            break;
+    }
+}
+
 int
 nodeNumOfDevices(virConnectPtr conn,
                  const char *cap,
@@ -167,7 +179,7 @@ nodeNumOfDevices(virConnectPtr conn,
 
     virCheckFlags(0, -1);
 
-    nodeDeviceLock();
+    nodeDeviceLockEnumerated();
     for (i = 0; i < driver->devs.count; i++) {
         virNodeDeviceObjPtr obj = driver->devs.objs[i];
         virNodeDeviceObjLock(obj);
@@ -196,7 +208,7 @@ nodeListDevices(virConnectPtr conn,
 
     virCheckFlags(0, -1);
 
-    nodeDeviceLock();
+    nodeDeviceLockEnumerated();
     for (i = 0; i < driver->devs.count && ndevs < maxnames; i++) {
         virNodeDeviceObjPtr obj = driver->devs.objs[i];
         virNodeDeviceObjLock(obj);
@@ -234,7 +246,7 @@ nodeConnectListAllNodeDevices(virConnectPtr conn,
     if (virConnectListAllNodeDevicesEnsureACL(conn) < 0)
         return -1;
 
-    nodeDeviceLock();
+    nodeDeviceLockEnumerated();
     ret = virNodeDeviceObjListExport(conn, driver->devs, devices,
                                      virConnectListAllNodeDevicesCheckACL,
                                      flags);
@@ -248,7 +260,7 @@ nodeDeviceLookupByName(virConnectPtr conn, const char *name)
     virNodeDeviceObjPtr obj;
     virNodeDevicePtr ret = NULL;
 
-    nodeDeviceLock();
+    nodeDeviceLockEnumerated();
     obj = virNodeDeviceObjFindByName(&driver->devs, name);
     nodeDeviceUnlock();
 
@@ -288,7 +300,7 @@ nodeDeviceLookupSCSIHostByWWN(virConnectPtr conn,
 
     virCheckFlags(0, NULL);
 
-    nodeDeviceLock();
+    nodeDeviceLockEnumerated();
 
     for (i = 0; i < devs->count; i++) {
         obj = devs->objs[i];
@@ -336,7 +348,7 @@ nodeDeviceGetXMLDesc(virNodeDevicePtr dev,
 
     virCheckFlags(0, NULL);
 
-    nodeDeviceLock();
+    nodeDeviceLockEnumerated();
     obj = virNodeDeviceObjFindByName(&driver->devs, dev->name);
     nodeDeviceUnlock();
 
@@ -369,7 +381,7 @@ nodeDeviceGetParent(virNodeDevicePtr dev)
     virNodeDeviceObjPtr obj;
     char *ret = NULL;
 
-    nodeDeviceLock();
+    nodeDeviceLockEnumerated();
     obj = virNodeDeviceObjFindByName(&driver->devs, dev->name);
     nodeDeviceUnlock();
 
@@ -406,7 +418,7 @@ nodeDeviceNumOfCaps(virNodeDevicePtr dev)
     int ncaps = 0;
     int ret = -1;
 
-    nodeDeviceLock();
+    nodeDeviceLockEnumerated();
     obj = virNodeDeviceObjFindByName(&driver->devs, dev->name);
     nodeDeviceUnlock();
 
@@ -451,7 +463,7 @@ nodeDeviceListCaps(virNodeDevicePtr dev, char **const names, int maxnames)
     int ncaps = 0;
     int ret = -1;
 
-    nodeDeviceLock();
+    nodeDeviceLockEnumerated();
     obj = virNodeDeviceObjFindByName(&driver->devs, dev->name);
     nodeDeviceUnlock();
 
@@ -579,7 +591,7 @@ nodeDeviceCreateXML(virConnectPtr conn,
     virCheckFlags(0, NULL);
     virt_type  = virConnectGetType(conn);
 
-    nodeDeviceLock();
+    nodeDeviceLockEnumerated();
 
     if (!(def = virNodeDeviceDefParseString(xmlDesc, CREATE_DEVICE, virt_type)))
         goto cleanup;
@@ -624,7 +636,7 @@ nodeDeviceDestroy(virNodeDevicePtr dev)
     char *wwnn = NULL, *wwpn = NULL;
     int parent_host = -1;
 
-    nodeDeviceLock();
+    nodeDeviceLockEnumerated();
     if (!(obj = virNodeDeviceObjFindByName(&driver->devs, dev->name))) {
         virReportError(VIR_ERR_NO_NODE_DEVICE,
                        _("no node device with matching name '%s'"),
@@ -40,6 +40,7 @@
 #include "viruuid.h"
 #include "virbuffer.h"
 #include "virfile.h"
+#include "virhosttopology.h"
 #include "virpci.h"
 #include "virstring.h"
 #include "virnetdev.h"
@@ -56,6 +57,11 @@ struct _udevPrivate {
     struct udev_monitor *udev_monitor;
     int watch;
     bool privileged;
+
+    /* enumerating the devices present at startup */
+    virThread enumThread;
+    bool enumThreadRunning;
+    bool enumQuit;
 };
 
 
@@ -1251,10 +1257,12 @@ static int udevProcessDeviceListEntry(struct udev *udev,
     device = udev_device_new_from_syspath(udev, name);
 
     if (device != NULL) {
+        nodeDeviceLock();
         if (udevAddOneDevice(device) != 0) {
             VIR_DEBUG("Failed to create node device for udev device '%s'",
                       name);
         }
+        nodeDeviceUnlock();
         ret = 0;
     }
 
@@ -1307,6 +1315,14 @@ static int udevEnumerateDevices(struct udev *udev)
 
     udev_list_entry_foreach(list_entry,
                             udev_enumerate_get_list_entry(udev_enumerate)) {
+        bool quit;
+
+        nodeDeviceLock();
+        quit = ((udevPrivate *) driver->privateData)->enumQuit;
+        nodeDeviceUnlock();
+
+        if (quit)
+            break;
 
         udevProcessDeviceListEntry(udev, list_entry);
     }
@@ -1317,6 +1333,34 @@ static int udevEnumerateDevices(struct udev *udev)
 }
 
 
+/* The devices are added one by one with the driver lock held only for
+ * each of them, so that udev events and the daemon startup don't have
+ * to wait for all of them. libudev contexts must not be shared between
+ * threads, so the enumeration uses one of its own. */
+static void udevEnumerateDevicesThread(void *opaque ATTRIBUTE_UNUSED)
+{
+    struct udev *udev = udev_new();
+
+    if (!udev) {
+        VIR_ERROR(_("failed to create udev context"));
+    } else {
+#if HAVE_UDEV_LOGGING
+        /* cast to get rid of missing-format-attribute warning */
+        udev_set_log_fn(udev, (udevLogFunctionPtr) udevLogFunction);
+#endif
+        if (udevEnumerateDevices(udev) != 0)
+            VIR_ERROR(_("Failed to enumerate node devices: %s"),
+                      virGetLastErrorMessage());
+        udev_unref(udev);
+    }
+
+    nodeDeviceLock();
+    driver->enumerating = false;
+    virCondBroadcast(&driver->enumerated);
+    nodeDeviceUnlock();
+}
+
+
 static void udevPCITranslateDeinit(void)
 {
 #if defined __s390__ || defined __s390x_
@@ -1338,12 +1382,19 @@ static int nodeStateCleanup(void)
     if (!driver)
         return -1;
 
+    priv = driver->privateData;
+
+    if (priv && priv->enumThreadRunning) {
+        nodeDeviceLock();
+        priv->enumQuit = true;
+        nodeDeviceUnlock();
+        virThreadJoin(&priv->enumThread);
+    }
+
     nodeDeviceLock();
 
     virObjectUnref(driver->nodeDeviceEventState);
 
-    priv = driver->privateData;
-
     if (priv) {
         if (priv->watch != -1)
             virEventRemoveHandle(priv->watch);
@@ -1361,6 +1412,7 @@ static int nodeStateCleanup(void)
 
     virNodeDeviceObjListFree(&driver->devs);
     nodeDeviceUnlock();
+    virCondDestroy(&driver->enumerated);
     virMutexDestroy(&driver->lock);
     VIR_FREE(driver);
     VIR_FREE(priv);
@@ -1378,6 +1430,7 @@ static void udevEventHandleCallback(int watch ATTRIBUTE_UNUSED,
     struct udev_device *device = NULL;
     struct udev_monitor *udev_monitor = DRV_STATE_UDEV_MONITOR(driver);
     const char *action = NULL;
+    const char *subsystem = NULL;
     int udev_fd = -1;
 
     nodeDeviceLock();
@@ -1400,6 +1453,17 @@ static void udevEventHandleCallback(int watch ATTRIBUTE_UNUSED,
     action = udev_device_get_action(device);
     VIR_DEBUG("udev action: '%s'", action);
 
+    /* CPU and memory hotplug, including onlining and offlining, changes
+     * the host topology */
+    subsystem = udev_device_get_subsystem(device);
+    if (STREQ_NULLABLE(subsystem, "cpu") ||
+        STREQ_NULLABLE(subsystem, "memory"))
+        virHostTopologyInvalidate();
+
+    /* PCI devices (dis)appearing changes buses and IOMMU groups */
+    if (STREQ_NULLABLE(subsystem, "pci") && STRNEQ(action, "change"))
+        virPCITopologyInvalidate();
+
     if (STREQ(action, "add") || STREQ(action, "change")) {
         udevAddOneDevice(device);
         goto cleanup;
@@ -1557,6 +1621,15 @@ static int nodeStateInitialize(bool privileged,
         return -1;
     }
 
+    if (virCondInit(&driver->enumerated) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize condition variable"));
+        virMutexDestroy(&driver->lock);
+        VIR_FREE(priv);
+        VIR_FREE(driver);
+        return -1;
+    }
+
     driver->privateData = priv;
     nodeDeviceLock();
     driver->nodeDeviceEventState = virObjectEventStateNew();
@@ -1602,10 +1675,17 @@ static int nodeStateInitialize(bool privileged,
     if (udevSetupSystemDev() != 0)
         goto cleanup;
 
-    /* Populate with known devices */
-
-    if (udevEnumerateDevices(udev) != 0)
+    /* Populate with known devices in the background, the node device
+     * APIs wait for it to finish */
+    driver->enumerating = true;
+    if (virThreadCreate(&priv->enumThread, true,
+                        udevEnumerateDevicesThread, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("failed to create thread to enumerate devices"));
+        driver->enumerating = false;
         goto cleanup;
+    }
+    priv->enumThreadRunning = true;
 
     ret = 0;
 
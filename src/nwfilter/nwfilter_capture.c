@@ -0,0 +1,793 @@
+/*
+ * nwfilter_capture.c: shared packet capture for DHCP snooping and
+ *                     IP address learning
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Rather than opening capture handles per interface and reading them
+ * from a thread each, all interfaces share one AF_PACKET socket per
+ * kind of traffic. Each socket has a TPACKET_V3 receive ring mapped
+ * into the daemon and a classic BPF program attached, so the kernel
+ * only hands over the frames somebody asked for, in blocks. The rings
+ * are read from the event loop and the frames are demultiplexed to the
+ * watches by the index of the interface they were seen on.
+ */
+
+#include <config.h>
+
+#include "nwfilter_capture.h"
+
+#ifdef WITH_NWFILTER_CAPTURE
+# include <sys/mman.h>
+# include <sys/socket.h>
+# include <arpa/inet.h>
+# include <net/ethernet.h>
+# include <linux/if_packet.h>
+# include <linux/filter.h>
+#endif
+
+#include "viralloc.h"
+#include "virerror.h"
+#include "virevent.h"
+#include "virfile.h"
+#include "virlog.h"
+#include "virnetdev.h"
+#include "virstring.h"
+#include "virthread.h"
+
+#define VIR_FROM_THIS VIR_FROM_NWFILTER
+
+VIR_LOG_INIT("nwfilter.nwfilter_capture");
+
+#ifdef WITH_NWFILTER_CAPTURE
+
+# define CAPTURE_BLOCK_SIZE         (64 * 1024)
+# define CAPTURE_FRAME_SIZE         2048
+# define CAPTURE_BLOCK_TIMEOUT_MS   20
+/* how often to check whether the watched interfaces still exist */
+# define CAPTURE_CHECK_INTERVAL_MS  (2 * 1000)
+
+typedef struct _virNWFilterCaptureRingConf virNWFilterCaptureRingConf;
+struct _virNWFilterCaptureRingConf {
+    const char *name;
+    unsigned int snaplen;
+    unsigned int blockNr;
+};
+
+static const virNWFilterCaptureRingConf
+virNWFilterCaptureRingConfs[VIR_NWFILTER_CAPTURE_LAST] = {
+    /* >= IP/UDP/DHCP headers and the options we look at */
+    [VIR_NWFILTER_CAPTURE_DHCP] = { "DHCP", 576, 8 },
+    /* >= IP or ARP headers */
+    [VIR_NWFILTER_CAPTURE_MAC] = { "MAC", 128, 16 },
+};
+
+typedef struct _virNWFilterCaptureRing virNWFilterCaptureRing;
+typedef virNWFilterCaptureRing *virNWFilterCaptureRingPtr;
+struct _virNWFilterCaptureRing {
+    virNWFilterCaptureType type;
+    int fd;
+    int watch;                  /* event loop handle of @fd */
+    char *map;
+    size_t mapLen;
+    unsigned int curBlock;      /* next block to hand back to the kernel */
+};
+
+typedef struct _virNWFilterCaptureWatch virNWFilterCaptureWatch;
+typedef virNWFilterCaptureWatch *virNWFilterCaptureWatchPtr;
+struct _virNWFilterCaptureWatch {
+    int watch;
+    virNWFilterCaptureType type;
+    char *ifname;
+    int ifindex;
+    virMacAddr macaddr;
+    virNWFilterCaptureCallback cb;
+    void *opaque;
+    virFreeCallback ff;
+    bool gone;                  /* interface disappeared, don't deliver */
+    bool deleted;               /* removed, to be freed */
+    virNWFilterCaptureWatchPtr next;
+};
+
+struct virNWFilterCaptureState {
+    bool initialized;
+    virMutex lock;
+    virNWFilterCaptureRing rings[VIR_NWFILTER_CAPTURE_LAST];
+    virNWFilterCaptureWatchPtr *watches;
+    size_t nwatches;
+    int nextWatch;
+    int timer;
+    /* true while callbacks are being run from the event loop; watches
+     * removed meanwhile are only freed once they are done */
+    bool dispatching;
+};
+
+static struct virNWFilterCaptureState virNWFilterCaptureState;
+
+# define virNWFilterCaptureLock() \
+    do { \
+        virMutexLock(&virNWFilterCaptureState.lock); \
+    } while (0)
+# define virNWFilterCaptureUnlock() \
+    do { \
+        virMutexUnlock(&virNWFilterCaptureState.lock); \
+    } while (0)
+
+
+/*
+ * IPv4 UDP datagrams that are not fragments, between the DHCP server
+ * and client ports in either direction
+ */
+static struct sock_filter virNWFilterCaptureDHCPProgram[] = {
+    BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ETHERTYPE_IP, 0, 13),
+    BPF_STMT(BPF_LD + BPF_B + BPF_ABS, 23),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_UDP, 0, 11),
+    BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 20),
+    BPF_JUMP(BPF_JMP + BPF_JSET + BPF_K, 0x1fff, 9, 0),
+    BPF_STMT(BPF_LDX + BPF_B + BPF_MSH, 14),
+    BPF_STMT(BPF_LD + BPF_H + BPF_IND, 14),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 67, 0, 2),
+    BPF_STMT(BPF_LD + BPF_H + BPF_IND, 16),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 68, 3, 4),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 68, 0, 3),
+    BPF_STMT(BPF_LD + BPF_H + BPF_IND, 16),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 67, 0, 1),
+    BPF_STMT(BPF_RET + BPF_K, 0), /* snaplen, filled in when attached */
+    BPF_STMT(BPF_RET + BPF_K, 0),
+};
+
+# define CAPTURE_MAC_INSNS 5
+
+
+/*
+ * Attach the BPF program matching the watches of the ring's type.
+ * Called with the lock held.
+ */
+static int
+virNWFilterCaptureRingSetFilter(virNWFilterCaptureRingPtr ring)
+{
+    unsigned int snaplen = virNWFilterCaptureRingConfs[ring->type].snaplen;
+    struct sock_filter *insns = NULL;
+    struct sock_fprog prog;
+    size_t ninsns = 0;
+    size_t nmacs = 0;
+    size_t i;
+    int ret = -1;
+
+    if (ring->type == VIR_NWFILTER_CAPTURE_DHCP) {
+        ninsns = ARRAY_CARDINALITY(virNWFilterCaptureDHCPProgram);
+        if (VIR_ALLOC_N(insns, ninsns) < 0)
+            return -1;
+        memcpy(insns, virNWFilterCaptureDHCPProgram, sizeof(*insns) * ninsns);
+        insns[ninsns - 2].k = snaplen;
+        goto attach;
+    }
+
+    for (i = 0; i < virNWFilterCaptureState.nwatches; i++) {
+        virNWFilterCaptureWatchPtr w = virNWFilterCaptureState.watches[i];
+
+        if (w->type == ring->type && !w->deleted)
+            nmacs++;
+    }
+
+    if (nmacs * CAPTURE_MAC_INSNS + 1 > BPF_MAXINSNS) {
+        /* too many to check in the kernel, leave it to the dispatcher */
+        if (VIR_ALLOC_N(insns, 1) < 0)
+            return -1;
+        insns[ninsns++] = (struct sock_filter)
+            BPF_STMT(BPF_RET + BPF_K, snaplen);
+        goto attach;
+    }
+
+    if (VIR_ALLOC_N(insns, nmacs * CAPTURE_MAC_INSNS + 1) < 0)
+        return -1;
+
+    /* one block per source MAC address, each jumping to the next one
+     * on a mismatch, so that the jump offsets stay small */
+    for (i = 0; i < virNWFilterCaptureState.nwatches; i++) {
+        virNWFilterCaptureWatchPtr w = virNWFilterCaptureState.watches[i];
+        const unsigned char *mac = w->macaddr.addr;
+
+        if (w->type != ring->type || w->deleted)
+            continue;
+
+        insns[ninsns++] = (struct sock_filter)
+            BPF_STMT(BPF_LD + BPF_W + BPF_ABS, ETH_ALEN);
+        insns[ninsns++] = (struct sock_filter)
+            BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,
+                     ((uint32_t) mac[0] << 24) | (mac[1] << 16) |
+                     (mac[2] << 8) | mac[3], 0, 3);
+        insns[ninsns++] = (struct sock_filter)
+            BPF_STMT(BPF_LD + BPF_H + BPF_ABS, ETH_ALEN + 4);
+        insns[ninsns++] = (struct sock_filter)
+            BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,
+                     (mac[4] << 8) | mac[5], 0, 1);
+        insns[ninsns++] = (struct sock_filter)
+            BPF_STMT(BPF_RET + BPF_K, snaplen);
+    }
+    insns[ninsns++] = (struct sock_filter) BPF_STMT(BPF_RET + BPF_K, 0);
+
+ attach:
+    prog.len = ninsns;
+    prog.filter = insns;
+
+    if (setsockopt(ring->fd, SOL_SOCKET, SO_ATTACH_FILTER,
+                   &prog, sizeof(prog)) < 0) {
+        virReportSystemError(errno,
+                             _("cannot attach filter to %s capture socket"),
+                             virNWFilterCaptureRingConfs[ring->type].name);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(insns);
+    return ret;
+}
+
+
+/*
+ * Deliver a frame to the watches interested in it. Called with the
+ * lock held, which is dropped while running the callbacks.
+ */
+static void
+virNWFilterCaptureDispatch(virNWFilterCaptureType type,
+                           int ifindex,
+                           const unsigned char *packet,
+                           size_t len,
+                           bool outgoing)
+{
+    size_t i;
+
+    /* watches added by the callbacks are appended, removed ones are
+     * only marked, so the index stays valid across the callbacks */
+    for (i = 0; i < virNWFilterCaptureState.nwatches; i++) {
+        virNWFilterCaptureWatchPtr w = virNWFilterCaptureState.watches[i];
+        virNWFilterCaptureCallback cb = w->cb;
+        void *opaque = w->opaque;
+        int watch = w->watch;
+
+        if (w->deleted || w->gone || w->type != type ||
+            w->ifindex != ifindex)
+            continue;
+
+        /* the kernel filter may let through more than this watch's
+         * frames, if it is shared or it has too many addresses */
+        if (type == VIR_NWFILTER_CAPTURE_MAC &&
+            (len < 2 * ETH_ALEN ||
+             virMacAddrCmpRaw(&w->macaddr, packet + ETH_ALEN) != 0))
+            continue;
+
+        virNWFilterCaptureUnlock();
+        (cb)(watch, packet, len, outgoing, opaque);
+        virNWFilterCaptureLock();
+    }
+}
+
+
+/*
+ * Free the removed watches. Called with the lock held, which is
+ * released before running the free callbacks.
+ */
+static void
+virNWFilterCapturePurgeUnlock(void)
+{
+    virNWFilterCaptureWatchPtr purge = NULL;
+    virNWFilterCaptureWatchPtr w;
+    size_t i = 0;
+
+    while (i < virNWFilterCaptureState.nwatches) {
+        w = virNWFilterCaptureState.watches[i];
+        if (!w->deleted) {
+            i++;
+            continue;
+        }
+        VIR_DELETE_ELEMENT(virNWFilterCaptureState.watches, i,
+                           virNWFilterCaptureState.nwatches);
+        w->next = purge;
+        purge = w;
+    }
+
+    /* nothing to check while idle */
+    if (virNWFilterCaptureState.nwatches == 0 &&
+        virNWFilterCaptureState.timer >= 0)
+        virEventUpdateTimeout(virNWFilterCaptureState.timer, -1);
+
+    virNWFilterCaptureUnlock();
+
+    while ((w = purge)) {
+        purge = w->next;
+        if (w->ff)
+            (w->ff)(w->opaque);
+        VIR_FREE(w->ifname);
+        VIR_FREE(w);
+    }
+}
+
+
+static void
+virNWFilterCaptureRingEvent(int handle ATTRIBUTE_UNUSED,
+                            int fd,
+                            int events,
+                            void *opaque)
+{
+    virNWFilterCaptureRingPtr ring = opaque;
+    unsigned int blockNr = virNWFilterCaptureRingConfs[ring->type].blockNr;
+
+    if (events & (VIR_EVENT_HANDLE_ERROR | VIR_EVENT_HANDLE_HANGUP)) {
+        char ebuf[1024];
+        int err = 0;
+        socklen_t errlen = sizeof(err);
+
+        /* reading the error clears it */
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == 0 && err)
+            VIR_WARN("Error on %s capture socket: %s",
+                     virNWFilterCaptureRingConfs[ring->type].name,
+                     virStrerror(err, ebuf, sizeof(ebuf)));
+    }
+
+    virNWFilterCaptureLock();
+    virNWFilterCaptureState.dispatching = true;
+
+    while (ring->map) {
+        struct tpacket_block_desc *block;
+        struct tpacket3_hdr *hdr;
+        uint32_t i;
+
+        VIR_WARNINGS_NO_CAST_ALIGN
+        block = (struct tpacket_block_desc *)
+            (ring->map + (size_t) ring->curBlock * CAPTURE_BLOCK_SIZE);
+        VIR_WARNINGS_RESET
+
+        if (!(block->hdr.bh1.block_status & TP_STATUS_USER))
+            break;
+        __sync_synchronize();
+
+        VIR_WARNINGS_NO_CAST_ALIGN
+        hdr = (struct tpacket3_hdr *)
+            ((char *) block + block->hdr.bh1.offset_to_first_pkt);
+        VIR_WARNINGS_RESET
+
+        for (i = 0; i < block->hdr.bh1.num_pkts; i++) {
+            VIR_WARNINGS_NO_CAST_ALIGN
+            const struct sockaddr_ll *sll = (const struct sockaddr_ll *)
+                ((char *) hdr + TPACKET_ALIGN(sizeof(*hdr)));
+            VIR_WARNINGS_RESET
+
+            virNWFilterCaptureDispatch(ring->type, sll->sll_ifindex,
+                                       (unsigned char *) hdr + hdr->tp_mac,
+                                       hdr->tp_snaplen,
+                                       sll->sll_pkttype == PACKET_OUTGOING);
+
+            VIR_WARNINGS_NO_CAST_ALIGN
+            hdr = (struct tpacket3_hdr *) ((char *) hdr + hdr->tp_next_offset);
+            VIR_WARNINGS_RESET
+        }
+
+        /* hand the block back to the kernel */
+        __sync_synchronize();
+        block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+        ring->curBlock = (ring->curBlock + 1) % blockNr;
+    }
+
+    virNWFilterCaptureState.dispatching = false;
+    virNWFilterCapturePurgeUnlock();
+}
+
+
+static void
+virNWFilterCaptureRingClose(virNWFilterCaptureRingPtr ring)
+{
+    if (ring->watch >= 0) {
+        virEventRemoveHandle(ring->watch);
+        ring->watch = -1;
+    }
+    if (ring->map) {
+        munmap(ring->map, ring->mapLen);
+        ring->map = NULL;
+    }
+    VIR_FORCE_CLOSE(ring->fd);
+}
+
+
+/*
+ * Open the socket and map the receive ring of the given type.
+ * Called with the lock held.
+ */
+static int
+virNWFilterCaptureRingOpen(virNWFilterCaptureRingPtr ring)
+{
+    const virNWFilterCaptureRingConf *conf =
+        &virNWFilterCaptureRingConfs[ring->type];
+    int version = TPACKET_V3;
+    struct tpacket_req3 req;
+    struct sockaddr_ll sll;
+    void *map;
+
+    /* don't receive anything before the filter is in place */
+    if ((ring->fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0)) < 0) {
+        virReportSystemError(errno,
+                             _("cannot create %s capture socket"),
+                             conf->name);
+        return -1;
+    }
+
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION,
+                   &version, sizeof(version)) < 0) {
+        virReportSystemError(errno,
+                             _("cannot use TPACKET_V3 on %s capture socket"),
+                             conf->name);
+        goto error;
+    }
+
+    if (virNWFilterCaptureRingSetFilter(ring) < 0)
+        goto error;
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = CAPTURE_BLOCK_SIZE;
+    req.tp_block_nr = conf->blockNr;
+    req.tp_frame_size = CAPTURE_FRAME_SIZE;
+    req.tp_frame_nr = CAPTURE_BLOCK_SIZE / CAPTURE_FRAME_SIZE * conf->blockNr;
+    req.tp_retire_blk_tov = CAPTURE_BLOCK_TIMEOUT_MS;
+
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING,
+                   &req, sizeof(req)) < 0) {
+        virReportSystemError(errno,
+                             _("cannot set up receive ring of %s capture "
+                               "socket"),
+                             conf->name);
+        goto error;
+    }
+
+    ring->mapLen = (size_t) CAPTURE_BLOCK_SIZE * conf->blockNr;
+    map = mmap(NULL, ring->mapLen, PROT_READ | PROT_WRITE, MAP_SHARED,
+               ring->fd, 0);
+    if (map == MAP_FAILED) {
+        virReportSystemError(errno,
+                             _("cannot map receive ring of %s capture "
+                               "socket"),
+                             conf->name);
+        goto error;
+    }
+    ring->map = map;
+    ring->curBlock = 0;
+
+    /* all interfaces */
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = 0;
+
+    if (bind(ring->fd, (struct sockaddr *) &sll, sizeof(sll)) < 0) {
+        virReportSystemError(errno,
+                             _("cannot bind %s capture socket"),
+                             conf->name);
+        goto error;
+    }
+
+    if ((ring->watch = virEventAddHandle(ring->fd,
+                                         VIR_EVENT_HANDLE_READABLE,
+                                         virNWFilterCaptureRingEvent,
+                                         ring, NULL)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot watch %s capture socket"), conf->name);
+        goto error;
+    }
+
+    VIR_DEBUG("Opened %s capture ring fd=%d, %u blocks of %u bytes",
+              conf->name, ring->fd, conf->blockNr, CAPTURE_BLOCK_SIZE);
+
+    return 0;
+
+ error:
+    virNWFilterCaptureRingClose(ring);
+    return -1;
+}
+
+
+/*
+ * Tell the watches whose interface went away, the shared sockets
+ * don't get to know about it.
+ */
+static void
+virNWFilterCaptureCheckInterfaces(int timer ATTRIBUTE_UNUSED,
+                                  void *opaque ATTRIBUTE_UNUSED)
+{
+    size_t i;
+
+    virNWFilterCaptureLock();
+    virNWFilterCaptureState.dispatching = true;
+
+    for (i = 0; i < virNWFilterCaptureState.nwatches; i++) {
+        virNWFilterCaptureWatchPtr w = virNWFilterCaptureState.watches[i];
+        virNWFilterCaptureCallback cb = w->cb;
+        void *opaque = w->opaque;
+        int watch = w->watch;
+
+        if (w->deleted || w->gone)
+            continue;
+
+        if (virNetDevValidateConfig(w->ifname, NULL, w->ifindex) > 0)
+            continue;
+        virResetLastError();
+
+        VIR_DEBUG("Interface %s index %d of capture watch %d is gone",
+                  w->ifname, w->ifindex, watch);
+        w->gone = true;
+
+        virNWFilterCaptureUnlock();
+        (cb)(watch, NULL, 0, false, opaque);
+        virNWFilterCaptureLock();
+    }
+
+    virNWFilterCaptureState.dispatching = false;
+    virNWFilterCapturePurgeUnlock();
+}
+
+
+/**
+ * virNWFilterCaptureAdd:
+ * @type: the kind of traffic to capture
+ * @ifname: the name of the interface to capture on
+ * @ifindex: the index of the interface
+ * @macaddr: the source MAC address of frames to capture for
+ *           VIR_NWFILTER_CAPTURE_MAC, unused otherwise
+ * @cb: callback to run for each captured frame
+ * @opaque: user data to pass to @cb
+ * @ff: callback to free @opaque once the watch is gone, or NULL
+ *
+ * Start capturing traffic of @type on the interface. The frames are
+ * passed to @cb from the event loop until the watch is removed with
+ * virNWFilterCaptureRemove. If the interface disappears, @cb is called
+ * one last time with a NULL packet.
+ *
+ * Returns the watch number or -1 on error.
+ */
+int
+virNWFilterCaptureAdd(virNWFilterCaptureType type,
+                      const char *ifname,
+                      int ifindex,
+                      const virMacAddr *macaddr,
+                      virNWFilterCaptureCallback cb,
+                      void *opaque,
+                      virFreeCallback ff)
+{
+    virNWFilterCaptureRingPtr ring = &virNWFilterCaptureState.rings[type];
+    virNWFilterCaptureWatchPtr w = NULL;
+    int ret = -1;
+
+    virNWFilterCaptureLock();
+
+    if (!virNWFilterCaptureState.initialized) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("packet capture is not initialized"));
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC(w) < 0 ||
+        VIR_STRDUP(w->ifname, ifname) < 0)
+        goto cleanup;
+
+    w->watch = virNWFilterCaptureState.nextWatch++;
+    w->type = type;
+    w->ifindex = ifindex;
+    if (macaddr)
+        virMacAddrSet(&w->macaddr, macaddr);
+    w->cb = cb;
+    w->opaque = opaque;
+    w->ff = ff;
+
+    if (VIR_APPEND_ELEMENT_COPY(virNWFilterCaptureState.watches,
+                                virNWFilterCaptureState.nwatches, w) < 0)
+        goto cleanup;
+
+    if (ring->fd < 0) {
+        if (virNWFilterCaptureRingOpen(ring) < 0)
+            goto error;
+    } else if (type == VIR_NWFILTER_CAPTURE_MAC &&
+               virNWFilterCaptureRingSetFilter(ring) < 0) {
+        goto error;
+    }
+
+    if (virNWFilterCaptureState.timer < 0) {
+        if ((virNWFilterCaptureState.timer =
+             virEventAddTimeout(CAPTURE_CHECK_INTERVAL_MS,
+                                virNWFilterCaptureCheckInterfaces,
+                                NULL, NULL)) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("cannot add capture interface check timer"));
+            goto error;
+        }
+    } else {
+        virEventUpdateTimeout(virNWFilterCaptureState.timer,
+                              CAPTURE_CHECK_INTERVAL_MS);
+    }
+
+    VIR_DEBUG("Added %s capture watch %d on %s index %d",
+              virNWFilterCaptureRingConfs[type].name, w->watch,
+              ifname, ifindex);
+
+    ret = w->watch;
+    w = NULL;
+
+ cleanup:
+    virNWFilterCaptureUnlock();
+    if (w)
+        VIR_FREE(w->ifname);
+    VIR_FREE(w);
+    return ret;
+
+ error:
+    /* nobody else got to see the watch, it is still the last one */
+    VIR_DELETE_ELEMENT(virNWFilterCaptureState.watches,
+                       virNWFilterCaptureState.nwatches - 1,
+                       virNWFilterCaptureState.nwatches);
+    goto cleanup;
+}
+
+
+/**
+ * virNWFilterCaptureRemove:
+ * @watch: the watch to remove
+ *
+ * Stop capturing for the watch. It is safe to call this from the
+ * watch's callback, its free callback runs once the callback is done.
+ *
+ * Returns 0 on success, -1 if there is no such watch.
+ */
+int
+virNWFilterCaptureRemove(int watch)
+{
+    virNWFilterCaptureWatchPtr w = NULL;
+    virNWFilterCaptureRingPtr ring;
+    size_t i;
+
+    virNWFilterCaptureLock();
+
+    for (i = 0; i < virNWFilterCaptureState.nwatches; i++) {
+        if (virNWFilterCaptureState.watches[i]->watch == watch &&
+            !virNWFilterCaptureState.watches[i]->deleted) {
+            w = virNWFilterCaptureState.watches[i];
+            break;
+        }
+    }
+
+    if (!w) {
+        virNWFilterCaptureUnlock();
+        VIR_DEBUG("No capture watch %d", watch);
+        return -1;
+    }
+
+    VIR_DEBUG("Removing %s capture watch %d",
+              virNWFilterCaptureRingConfs[w->type].name, watch);
+
+    w->deleted = true;
+
+    /* a stale filter only lets through frames the dispatcher drops */
+    ring = &virNWFilterCaptureState.rings[w->type];
+    if (w->type == VIR_NWFILTER_CAPTURE_MAC && ring->fd >= 0 &&
+        virNWFilterCaptureRingSetFilter(ring) < 0)
+        virResetLastError();
+
+    if (virNWFilterCaptureState.dispatching) {
+        virNWFilterCaptureUnlock();
+        return 0;
+    }
+
+    virNWFilterCapturePurgeUnlock();
+    return 0;
+}
+
+
+int
+virNWFilterCaptureInit(void)
+{
+    size_t i;
+
+    if (virNWFilterCaptureState.initialized)
+        return 0;
+
+    VIR_DEBUG("Initializing shared packet capture");
+
+    if (virMutexInit(&virNWFilterCaptureState.lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize capture mutex"));
+        return -1;
+    }
+
+    for (i = 0; i < VIR_NWFILTER_CAPTURE_LAST; i++) {
+        virNWFilterCaptureState.rings[i].type = i;
+        virNWFilterCaptureState.rings[i].fd = -1;
+        virNWFilterCaptureState.rings[i].watch = -1;
+    }
+    virNWFilterCaptureState.nextWatch = 1;
+    virNWFilterCaptureState.timer = -1;
+    virNWFilterCaptureState.initialized = true;
+
+    return 0;
+}
+
+
+void
+virNWFilterCaptureShutdown(void)
+{
+    size_t i;
+
+    if (!virNWFilterCaptureState.initialized)
+        return;
+
+    virNWFilterCaptureLock();
+
+    for (i = 0; i < VIR_NWFILTER_CAPTURE_LAST; i++)
+        virNWFilterCaptureRingClose(&virNWFilterCaptureState.rings[i]);
+
+    if (virNWFilterCaptureState.timer >= 0) {
+        virEventRemoveTimeout(virNWFilterCaptureState.timer);
+        virNWFilterCaptureState.timer = -1;
+    }
+
+    for (i = 0; i < virNWFilterCaptureState.nwatches; i++)
+        virNWFilterCaptureState.watches[i]->deleted = true;
+
+    virNWFilterCaptureState.initialized = false;
+    virNWFilterCapturePurgeUnlock();
+
+    VIR_FREE(virNWFilterCaptureState.watches);
+    virMutexDestroy(&virNWFilterCaptureState.lock);
+}
+
+#else /* WITH_NWFILTER_CAPTURE */
+
+int
+virNWFilterCaptureInit(void)
+{
+    VIR_DEBUG("No packet capture support available");
+    return 0;
+}
+
+
+void
+virNWFilterCaptureShutdown(void)
+{
+    return;
+}
+
+
+int
+virNWFilterCaptureAdd(virNWFilterCaptureType type ATTRIBUTE_UNUSED,
+                      const char *ifname ATTRIBUTE_UNUSED,
+                      int ifindex ATTRIBUTE_UNUSED,
+                      const virMacAddr *macaddr ATTRIBUTE_UNUSED,
+                      virNWFilterCaptureCallback cb ATTRIBUTE_UNUSED,
+                      void *opaque ATTRIBUTE_UNUSED,
+                      virFreeCallback ff ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                   _("packet capture is not supported on this platform"));
+    return -1;
+}
+
+
+int
+virNWFilterCaptureRemove(int watch ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+#endif /* WITH_NWFILTER_CAPTURE */
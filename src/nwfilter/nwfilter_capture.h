@@ -0,0 +1,72 @@
+/*
+ * nwfilter_capture.h: shared packet capture for DHCP snooping and
+ *                     IP address learning
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NWFILTER_CAPTURE_H
+# define __NWFILTER_CAPTURE_H
+
+# include "internal.h"
+# include "virmacaddr.h"
+
+# if defined(__linux__) && HAVE_DECL_TPACKET_V3
+#  define WITH_NWFILTER_CAPTURE 1
+# endif
+
+typedef enum {
+    /* DHCP traffic between UDP ports 67 and 68, both directions */
+    VIR_NWFILTER_CAPTURE_DHCP,
+    /* all frames sent by a given MAC address */
+    VIR_NWFILTER_CAPTURE_MAC,
+
+    VIR_NWFILTER_CAPTURE_LAST
+} virNWFilterCaptureType;
+
+/**
+ * virNWFilterCaptureCallback:
+ * @watch: the watch the packet was captured for
+ * @packet: the captured frame starting with its ethernet header, or
+ *          NULL if the interface went away
+ * @len: the captured length of @packet
+ * @outgoing: whether the frame was sent out of the interface, that is
+ *            towards the VM for a tap device
+ * @opaque: user data registered with the watch
+ *
+ * Called from the event loop thread, so it must not block. The
+ * packet is only valid for the duration of the call.
+ */
+typedef void (*virNWFilterCaptureCallback)(int watch,
+                                           const unsigned char *packet,
+                                           size_t len,
+                                           bool outgoing,
+                                           void *opaque);
+
+int virNWFilterCaptureInit(void);
+void virNWFilterCaptureShutdown(void);
+
+int virNWFilterCaptureAdd(virNWFilterCaptureType type,
+                          const char *ifname,
+                          int ifindex,
+                          const virMacAddr *macaddr,
+                          virNWFilterCaptureCallback cb,
+                          void *opaque,
+                          virFreeCallback ff);
+int virNWFilterCaptureRemove(int watch);
+
+#endif /* __NWFILTER_CAPTURE_H */
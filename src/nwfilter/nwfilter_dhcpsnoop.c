@@ -42,12 +42,7 @@
  */
 #include <config.h>
 
-#ifdef HAVE_LIBPCAP
-# include <pcap.h>
-#endif
-
 #include <fcntl.h>
-#include <poll.h>
 
 #include <arpa/inet.h>
 #include <netinet/ip.h>
@@ -58,10 +53,12 @@
 #include "virlog.h"
 #include "datatypes.h"
 #include "virerror.h"
+#include "virevent.h"
 #include "conf/domain_conf.h"
 #include "nwfilter_gentech_driver.h"
 #include "nwfilter_dhcpsnoop.h"
 #include "nwfilter_ipaddrmap.h"
+#include "nwfilter_capture.h"
 #include "virnetdev.h"
 #include "virfile.h"
 #include "viratomic.h"
@@ -74,7 +71,7 @@
 
 VIR_LOG_INIT("nwfilter.nwfilter_dhcpsnoop");
 
-#ifdef HAVE_LIBPCAP
+#ifdef WITH_NWFILTER_CAPTURE
 
 # define LEASEFILE_DIR LOCALSTATEDIR "/run/libvirt/network/"
 # define LEASEFILE LEASEFILE_DIR "nwfilter.leases"
@@ -85,13 +82,14 @@ struct virNWFilterSnoopState {
     int                  leaseFD;
     int                  nLeases; /* number of active leases */
     int                  wLeases; /* number of written leases */
-    int                  nThreads; /* number of running threads */
-    /* thread management */
+    /* request management */
     virHashTablePtr      snoopReqs;
     virHashTablePtr      ifnameToKey;
     virMutex             snoopLock;  /* protects SnoopReqs and IfNameToKey */
-    virHashTablePtr      active;
-    virMutex             activeLock; /* protects Active */
+    /* decodes the packets of all requests, one flow per request */
+    virThreadPoolPtr     decodePool;
+    int                  leaseTimer;
+    int                  expiryQueued;
 };
 
 # define virNWFilterSnoopLock() \
@@ -102,14 +100,6 @@ struct virNWFilterSnoopState {
     do { \
         virMutexUnlock(&virNWFilterSnoopState.snoopLock); \
     } while (0)
-# define virNWFilterSnoopActiveLock() \
-    do { \
-        virMutexLock(&virNWFilterSnoopState.activeLock); \
-    } while (0)
-# define virNWFilterSnoopActiveUnlock() \
-    do { \
-        virMutexUnlock(&virNWFilterSnoopState.activeLock); \
-    } while (0)
 
 # define VIR_IFKEY_LEN   ((VIR_UUID_STRING_BUFLEN) + (VIR_MAC_STRING_BUFLEN))
 
@@ -119,11 +109,30 @@ typedef virNWFilterSnoopReq *virNWFilterSnoopReqPtr;
 typedef struct _virNWFilterSnoopIPLease virNWFilterSnoopIPLease;
 typedef virNWFilterSnoopIPLease *virNWFilterSnoopIPLeasePtr;
 
-typedef enum {
-    THREAD_STATUS_NONE,
-    THREAD_STATUS_OK,
-    THREAD_STATUS_FAIL,
-} virNWFilterSnoopThreadStatus;
+typedef struct _virNWFilterSnoopRateLimitConf virNWFilterSnoopRateLimitConf;
+typedef virNWFilterSnoopRateLimitConf *virNWFilterSnoopRateLimitConfPtr;
+
+struct _virNWFilterSnoopRateLimitConf {
+    time_t prev;
+    unsigned int pkt_ctr;
+    time_t burst;
+    unsigned int rate;
+    unsigned int burstRate;
+    unsigned int burstInterval;
+};
+
+typedef struct _virNWFilterSnoopDirConf virNWFilterSnoopDirConf;
+typedef virNWFilterSnoopDirConf *virNWFilterSnoopDirConfPtr;
+
+struct _virNWFilterSnoopDirConf {
+    virNWFilterSnoopRateLimitConf rateLimit; /* indep. rate limiters */
+    int qCtr; /* number of jobs in the worker's queue */
+    unsigned int maxQSize;
+    unsigned long long penaltyTimeoutAbs;
+};
+
+# define SNOOP_DIR_FROM_VM  0
+# define SNOOP_DIR_TO_VM    1
 
 struct _virNWFilterSnoopReq {
     /*
@@ -145,23 +154,28 @@ struct _virNWFilterSnoopReq {
     /* start and end of lease list, ordered by lease time */
     virNWFilterSnoopIPLeasePtr           start;
     virNWFilterSnoopIPLeasePtr           end;
-    char                                *threadkey;
+    /* capture watch while snooping, holds a reference; -1 otherwise */
+    int                                  watch;
 
-    virNWFilterSnoopThreadStatus         threadStatus;
-    virCond                              threadStatusCond;
+    /*
+     * only used by the capture callback in the event loop thread,
+     * except for the queue counters decremented by the worker
+     */
+    virNWFilterSnoopDirConf              dirConf[2];
+    char                                 watchIfname[IF_NAMESIZE];
+    time_t                               last_displayed;
+    time_t                               last_displayed_queue;
 
     int                                  jobCompletionStatus;
-    /* the number of submitted jobs in the worker's queue */
     /*
      * protect those members that can change while the
      * req is on the public SnoopReq hash and
      * at least one reference is held:
      * - ifname
-     * - threadkey
+     * - watch
      * - start
      * - end
      * - a lease while it is on the list
-     * - threadStatus
      * (for refctr, see above)
      */
     virMutex                             lock;
@@ -233,15 +247,23 @@ struct _virNWFilterSnoopDHCPHdr {
      sizeof(struct udphdr) + \
      offsetof(virNWFilterSnoopDHCPHdr, d_opts))
 
-# define PCAP_PBUFSIZE              576 /* >= IP/TCP/DHCP headers */
-# define PCAP_READ_MAXERRS          25 /* retries on failing device */
-# define PCAP_FLOOD_TIMEOUT_MS      10 /* ms */
+# define SNOOP_PBUFSIZE             576 /* >= IP/TCP/DHCP headers */
+# define SNOOP_FLOOD_TIMEOUT_MS     10 /* ms */
+
+typedef enum {
+    DHCP_JOB_DECODE,    /* decode a packet */
+    DHCP_JOB_STOP,      /* stop snooping, the interface is gone */
+    DHCP_JOB_EXPIRE,    /* run the lease timers of all requests */
+} virNWFilterDHCPJobType;
 
 typedef struct _virNWFilterDHCPDecodeJob virNWFilterDHCPDecodeJob;
 typedef virNWFilterDHCPDecodeJob *virNWFilterDHCPDecodeJobPtr;
 
 struct _virNWFilterDHCPDecodeJob {
-    unsigned char packet[PCAP_PBUFSIZE];
+    virNWFilterDHCPJobType type;
+    virNWFilterSnoopReqPtr req; /* holds a reference; NULL for expiry */
+    int watch; /* the capture watch that queued the job */
+    unsigned char packet[SNOOP_PBUFSIZE];
     int caplen;
     bool fromVM;
     int *qCtr;
@@ -251,39 +273,9 @@ struct _virNWFilterDHCPDecodeJob {
 # define DHCP_PKT_BURST         50 /* pkts/sec */
 # define DHCP_BURST_INTERVAL_S  10 /* sec */
 
-/*
- * libpcap 1.5 requires a 128kb buffer
- * 128 kb is bigger than (DHCP_PKT_BURST * PCAP_PBUFSIZE / 2)
- */
-# define PCAP_BUFFERSIZE        (128 * 1024)
-
 # define MAX_QUEUED_JOBS        (DHCP_PKT_BURST + 2 * DHCP_PKT_RATE)
 
-typedef struct _virNWFilterSnoopRateLimitConf virNWFilterSnoopRateLimitConf;
-typedef virNWFilterSnoopRateLimitConf *virNWFilterSnoopRateLimitConfPtr;
-
-struct _virNWFilterSnoopRateLimitConf {
-    time_t prev;
-    unsigned int pkt_ctr;
-    time_t burst;
-    const unsigned int rate;
-    const unsigned int burstRate;
-    const unsigned int burstInterval;
-};
-# define SNOOP_POLL_MAX_TIMEOUT_MS  (10 * 1000) /* milliseconds */
-
-typedef struct _virNWFilterSnoopPcapConf virNWFilterSnoopPcapConf;
-typedef virNWFilterSnoopPcapConf *virNWFilterSnoopPcapConfPtr;
-
-struct _virNWFilterSnoopPcapConf {
-    pcap_t *handle;
-    const pcap_direction_t dir;
-    const char *filter;
-    virNWFilterSnoopRateLimitConf rateLimit; /* indep. rate limiters */
-    int qCtr; /* number of jobs in the worker's queue */
-    const unsigned int maxQSize;
-    unsigned long long penaltyTimeoutAbs;
-};
+# define SNOOP_LEASE_TIMER_MS   (10 * 1000) /* milliseconds */
 
 /* local function prototypes */
 static int virNWFilterSnoopReqLeaseDel(virNWFilterSnoopReqPtr req,
@@ -305,53 +297,21 @@ static struct virNWFilterSnoopState virNWFilterSnoopState = {
 static const unsigned char dhcp_magic[4] = { 99, 130, 83, 99 };
 
 
-static char *
-virNWFilterSnoopActivate(virNWFilterSnoopReqPtr req)
-{
-    char *key;
-
-    if (virAsprintf(&key, "%p-%d", req, req->ifindex) < 0)
-        return NULL;
-
-    virNWFilterSnoopActiveLock();
-
-    if (virHashAddEntry(virNWFilterSnoopState.active, key, (void *)0x1) < 0)
-        VIR_FREE(key);
-
-    virNWFilterSnoopActiveUnlock();
-
-    return key;
-}
-
+/*
+ * Stop capturing packets for the request. The capture watch drops its
+ * reference to the req when it goes away, which may be right away.
+ * Call this function with the req's lock held.
+ */
 static void
-virNWFilterSnoopCancel(char **threadKey)
-{
-    if (*threadKey == NULL)
-        return;
-
-    virNWFilterSnoopActiveLock();
-
-    ignore_value(virHashRemoveEntry(virNWFilterSnoopState.active, *threadKey));
-    VIR_FREE(*threadKey);
-
-    virNWFilterSnoopActiveUnlock();
-}
-
-static bool
-virNWFilterSnoopIsActive(char *threadKey)
+virNWFilterSnoopCancel(virNWFilterSnoopReqPtr req)
 {
-    void *entry;
-
-    if (threadKey == NULL)
-        return 0;
-
-    virNWFilterSnoopActiveLock();
+    int watch = req->watch;
 
-    entry = virHashLookup(virNWFilterSnoopState.active, threadKey);
-
-    virNWFilterSnoopActiveUnlock();
+    if (watch < 0)
+        return;
 
-    return entry != NULL;
+    req->watch = -1;
+    ignore_value(virNWFilterCaptureRemove(watch));
 }
 
 /*
@@ -589,22 +549,16 @@ virNWFilterSnoopReqNew(const char *ifkey)
     if (VIR_ALLOC(req) < 0)
         return NULL;
 
-    req->threadStatus = THREAD_STATUS_NONE;
+    req->watch = -1;
 
     if (virStrcpyStatic(req->ifkey, ifkey) == NULL ||
         virMutexInitRecursive(&req->lock) < 0)
         goto err_free_req;
 
-    if (virCondInit(&req->threadStatusCond) < 0)
-        goto err_destroy_mutex;
-
     virNWFilterSnoopReqGet(req);
 
     return req;
 
- err_destroy_mutex:
-    virMutexDestroy(&req->lock);
-
  err_free_req:
     VIR_FREE(req);
 
@@ -638,7 +592,6 @@ virNWFilterSnoopReqFree(virNWFilterSnoopReqPtr req)
     virNWFilterHashTableFree(req->vars);
 
     virMutexDestroy(&req->lock);
-    virCondDestroy(&req->threadStatusCond);
 
     VIR_FREE(req);
 }
@@ -672,14 +625,21 @@ virNWFilterSnoopReqRelease(void *req0, const void *name ATTRIBUTE_UNUSED)
     if (!req)
         return;
 
-    /* protect req->threadkey */
+    /*
+     * removing the capture watch drops the reference it holds; keep
+     * one so that doesn't free the req from under us
+     */
+    virNWFilterSnoopReqGet(req);
+
+    /* protect req->watch */
     virNWFilterSnoopReqLock(req);
 
-    if (req->threadkey)
-        virNWFilterSnoopCancel(&req->threadkey);
+    virNWFilterSnoopCancel(req);
 
     virNWFilterSnoopReqUnlock(req);
 
+    ignore_value(virAtomicIntDecAndTest(&req->refctr));
+
     virNWFilterSnoopReqFree(req);
 }
 
@@ -767,10 +727,10 @@ virNWFilterSnoopReqLeaseAdd(virNWFilterSnoopReqPtr req,
         return -1;
     *pl = *plnew;
 
-    /* protect req->threadkey */
+    /* protect req->watch */
     virNWFilterSnoopReqLock(req);
 
-    if (req->threadkey && virNWFilterSnoopIPLeaseInstallRule(pl, true) < 0) {
+    if (req->watch >= 0 && virNWFilterSnoopIPLeaseInstallRule(pl, true) < 0) {
         virNWFilterSnoopReqUnlock(req);
         VIR_FREE(pl);
         return -1;
@@ -867,7 +827,7 @@ virNWFilterSnoopReqLeaseDel(virNWFilterSnoopReqPtr req,
 
     ipAddrLeft = virNWFilterIPAddrMapDelIPAddr(req->ifname, ipstr);
 
-    if (!req->threadkey || !instantiate)
+    if (req->watch < 0 || !instantiate)
         goto skip_instantiate;
 
     if (ipAddrLeft) {
@@ -1069,143 +1029,179 @@ virNWFilterSnoopDHCPDecode(virNWFilterSnoopReqPtr req,
     return 0;
 }
 
-static pcap_t *
-virNWFilterSnoopDHCPOpen(const char *ifname, virMacAddr *mac,
-                         const char *filter, pcap_direction_t dir)
+/*
+ * Stop snooping on the request's interface, unless a new capture watch
+ * was started meanwhile; the request is kept with its leases.
+ */
+static void
+virNWFilterSnoopReqStop(virNWFilterSnoopReqPtr req, int watch)
 {
-    pcap_t *handle = NULL;
-    struct bpf_program fp;
-    char pcap_errbuf[PCAP_ERRBUF_SIZE];
-    char *ext_filter = NULL;
-    char macaddr[VIR_MAC_STRING_BUFLEN];
+    /* protect IfNameToKey */
+    virNWFilterSnoopLock();
 
-    virMacAddrFormat(mac, macaddr);
+    /* protect req->ifname & req->watch */
+    virNWFilterSnoopReqLock(req);
 
-    if (dir == PCAP_D_IN /* from VM */) {
-        /*
-         * don't want to hear about another VM's DHCP requests
-         *
-         * extend the filter with the macaddr of the VM; filter the
-         * more unlikely parameters first, then go for the MAC
-         */
-        if (virAsprintf(&ext_filter,
-                        "%s and ether src %s", filter, macaddr) < 0)
-            return NULL;
-    } else {
-        /*
-         * Some DHCP servers respond via MAC broadcast; we rely on later
-         * filtering of responses by comparing the MAC address inside the
-         * DHCP response against the one of the VM. Assuming that the
-         * bridge learns the VM's MAC address quickly this should not
-         * generate much more traffic than if we filtered by VM and
-         * braodcast MAC as well
-         */
-        if (VIR_STRDUP(ext_filter, filter) < 0)
-            return NULL;
-    }
+    if (req->watch >= 0 && req->watch == watch) {
+        virNWFilterSnoopCancel(req);
 
-    handle = pcap_create(ifname, pcap_errbuf);
+        ignore_value(virHashRemoveEntry(virNWFilterSnoopState.ifnameToKey,
+                                        req->ifname));
 
-    if (handle == NULL) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("pcap_create failed"));
-        goto cleanup_nohandle;
+        VIR_FREE(req->ifname);
     }
 
-    if (pcap_set_snaplen(handle, PCAP_PBUFSIZE) < 0 ||
-        pcap_set_buffer_size(handle, PCAP_BUFFERSIZE) < 0 ||
-        pcap_activate(handle) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("setup of pcap handle failed: %s"),
-                       pcap_geterr(handle));
-        goto cleanup;
-    }
+    virNWFilterSnoopReqUnlock(req);
+    virNWFilterSnoopUnlock();
+}
 
-    if (pcap_compile(handle, &fp, ext_filter, 1, PCAP_NETMASK_UNKNOWN) != 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("pcap_compile: %s"), pcap_geterr(handle));
-        goto cleanup;
-    }
+static int
+virNWFilterSnoopExpireIter(void *payload,
+                           const void *name ATTRIBUTE_UNUSED,
+                           void *data)
+{
+    virNWFilterSnoopReqPtr req = payload;
+    virNWFilterSnoopReqPtr **next = data;
+    bool expired;
 
-    if (pcap_setfilter(handle, &fp) != 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("pcap_setfilter: %s"), pcap_geterr(handle));
-        goto cleanup_freecode;
+    /* protect req->watch & req->start */
+    virNWFilterSnoopReqLock(req);
+
+    /* the leases of the other requests are pruned with the lease file */
+    expired = req->watch >= 0 && req->start && req->start->timeout <= time(0);
+
+    virNWFilterSnoopReqUnlock(req);
+
+    if (expired) {
+        virNWFilterSnoopReqGet(req);
+        *(*next)++ = req;
     }
 
-    if (pcap_setdirection(handle, dir) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("pcap_setdirection: %s"),
-                       pcap_geterr(handle));
-        goto cleanup_freecode;
+    return 0;
+}
+
+/*
+ * Remove the expired leases of the requests being snooped on. The
+ * rules are re-instantiated without holding the SnoopLock.
+ */
+static void
+virNWFilterSnoopExpireLeases(void)
+{
+    virNWFilterSnoopReqPtr *reqs = NULL;
+    virNWFilterSnoopReqPtr *next;
+    size_t nreqs;
+    size_t i;
+
+    virAtomicIntSet(&virNWFilterSnoopState.expiryQueued, 0);
+
+    virNWFilterSnoopLock();
+
+    nreqs = virHashSize(virNWFilterSnoopState.snoopReqs);
+    if (nreqs == 0 || VIR_ALLOC_N(reqs, nreqs) < 0) {
+        virNWFilterSnoopUnlock();
+        return;
     }
 
-    pcap_freecode(&fp);
-    VIR_FREE(ext_filter);
+    next = reqs;
+    virHashForEach(virNWFilterSnoopState.snoopReqs,
+                   virNWFilterSnoopExpireIter, &next);
+    nreqs = next - reqs;
 
-    return handle;
+    virNWFilterSnoopUnlock();
 
- cleanup_freecode:
-    pcap_freecode(&fp);
- cleanup:
-    pcap_close(handle);
- cleanup_nohandle:
-    VIR_FREE(ext_filter);
+    for (i = 0; i < nreqs; i++) {
+        virNWFilterSnoopReqLeaseTimerRun(reqs[i]);
+        virNWFilterSnoopReqPut(reqs[i]);
+    }
 
-    return NULL;
+    VIR_FREE(reqs);
 }
 
 /*
  * Worker function to decode the DHCP message and with that
  * also do the time-consuming work of instantiating the filters
  */
-static void virNWFilterDHCPDecodeWorker(void *jobdata, void *opaque)
+static void virNWFilterDHCPDecodeWorker(void *jobdata,
+                                        void *opaque ATTRIBUTE_UNUSED)
 {
-    virNWFilterSnoopReqPtr req = opaque;
     virNWFilterDHCPDecodeJobPtr job = jobdata;
+    virNWFilterSnoopReqPtr req = job->req;
     virNWFilterSnoopEthHdrPtr packet = (virNWFilterSnoopEthHdrPtr)job->packet;
 
-    if (virNWFilterSnoopDHCPDecode(req, packet,
-                                   job->caplen, job->fromVM) == -1) {
-        req->jobCompletionStatus = -1;
+    switch (job->type) {
+    case DHCP_JOB_DECODE:
+        if (virNWFilterSnoopDHCPDecode(req, packet,
+                                       job->caplen, job->fromVM) == -1) {
+            virAtomicIntSet(&req->jobCompletionStatus, -1);
 
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Instantiation of rules failed on "
-                         "interface '%s'"), req->ifname);
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Instantiation of rules failed on "
+                             "interface '%s'"), req->watchIfname);
+
+            virNWFilterSnoopReqStop(req, job->watch);
+        }
+        virAtomicIntDecAndTest(job->qCtr);
+        break;
+    case DHCP_JOB_STOP:
+        virNWFilterSnoopReqStop(req, job->watch);
+        break;
+    case DHCP_JOB_EXPIRE:
+        virNWFilterSnoopExpireLeases();
+        break;
     }
-    virAtomicIntDecAndTest(job->qCtr);
+
+    virNWFilterSnoopReqPut(req);
     VIR_FREE(job);
 }
 
 /*
  * Submit a job to the worker thread doing the time-consuming work...
+ *
+ * The jobs of a request are queued on its own flow, so they are run in
+ * order and one request receiving many packets doesn't hold up the
+ * others.
  */
 static int
-virNWFilterSnoopDHCPDecodeJobSubmit(virThreadPoolPtr pool,
-                                    virNWFilterSnoopEthHdrPtr pep,
-                                    int len, pcap_direction_t dir,
-                                    int *qCtr)
+virNWFilterSnoopJobSubmit(virNWFilterDHCPJobType type,
+                          virNWFilterSnoopReqPtr req,
+                          int watch,
+                          const unsigned char *pep,
+                          int len, bool fromVM,
+                          int *qCtr)
 {
     virNWFilterDHCPDecodeJobPtr job;
     int ret;
 
-    if (len <= MIN_VALID_DHCP_PKT_SIZE || len > sizeof(job->packet))
+    if (type == DHCP_JOB_DECODE &&
+        (len <= MIN_VALID_DHCP_PKT_SIZE || len > sizeof(job->packet)))
         return 0;
 
     if (VIR_ALLOC(job) < 0)
         return -1;
 
-    memcpy(job->packet, pep, len);
-    job->caplen = len;
-    job->fromVM = (dir == PCAP_D_IN);
-    job->qCtr = qCtr;
+    job->type = type;
+    job->req = req;
+    job->watch = watch;
+    if (type == DHCP_JOB_DECODE) {
+        memcpy(job->packet, pep, len);
+        job->caplen = len;
+        job->fromVM = fromVM;
+        job->qCtr = qCtr;
+    }
 
-    ret = virThreadPoolSendJob(pool, 0, job);
+    if (req)
+        virNWFilterSnoopReqGet(req);
 
-    if (ret == 0)
-        virAtomicIntInc(qCtr);
-    else
+    ret = virThreadPoolSendFlowJob(virNWFilterSnoopState.decodePool, 0,
+                                   req, job);
+
+    if (ret == 0) {
+        if (qCtr)
+            virAtomicIntInc(qCtr);
+    } else {
+        virNWFilterSnoopReqPut(req);
         VIR_FREE(job);
+    }
 
     return ret;
 }
@@ -1259,320 +1255,220 @@ virNWFilterSnoopRateLimit(virNWFilterSnoopRateLimitConfPtr rl)
 /*
  * virNWFilterSnoopRatePenalty
  *
- * @pc: pointer to the virNWFilterSnoopPcapConf
+ * @dc: pointer to the virNWFilterSnoopDirConf
  * @diff: the amount of pkts beyond the rate, i.e., if the rate is 10
  *        and 13 pkts have been received now in one seconds, then
  *        this should be 3.
  *
- * Adjusts the timeout the virNWFilterSnooPcapConf will be penalized for
+ * Adjusts the timeout the virNWFilterSnoopDirConf will be penalized for
  * sending too many packets.
  */
 static void
-virNWFilterSnoopRatePenalty(virNWFilterSnoopPcapConfPtr pc,
+virNWFilterSnoopRatePenalty(virNWFilterSnoopDirConfPtr dc,
                             unsigned int diff, unsigned int limit)
 {
     if (diff > limit) {
         unsigned long long now;
 
         if (virTimeMillisNowRaw(&now) < 0) {
-            usleep(PCAP_FLOOD_TIMEOUT_MS); /* 1 ms */
-            pc->penaltyTimeoutAbs = 0;
+            dc->penaltyTimeoutAbs = 0;
         } else {
-            /* don't listen to the fd for 1 ms */
-            pc->penaltyTimeoutAbs = now + PCAP_FLOOD_TIMEOUT_MS;
+            /* drop the packets of this direction for 10 ms */
+            dc->penaltyTimeoutAbs = now + SNOOP_FLOOD_TIMEOUT_MS;
         }
     }
 }
 
-static int
-virNWFilterSnoopAdjustPoll(virNWFilterSnoopPcapConfPtr pc,
-                           size_t nPc, struct pollfd *pfd,
-                           int *pollTo)
+/*
+ * Check whether the direction is still serving its penalty
+ */
+static bool
+virNWFilterSnoopInPenalty(virNWFilterSnoopDirConfPtr dc)
 {
-    int ret = 0;
-    size_t i;
-    int tmp;
-    unsigned long long now = 0;
+    unsigned long long now;
 
-    *pollTo = -1;
+    if (dc->penaltyTimeoutAbs == 0)
+        return false;
 
-    for (i = 0; i < nPc; i++) {
-        if (pc[i].penaltyTimeoutAbs != 0) {
-            if (now == 0) {
-                if (virTimeMillisNow(&now) < 0) {
-                    ret = -1;
-                    break;
-                }
-            }
+    if (virTimeMillisNowRaw(&now) == 0 && now < dc->penaltyTimeoutAbs)
+        return true;
 
-            if (now < pc[i].penaltyTimeoutAbs) {
-                /* don't listen to incoming data on the fd for some time */
-                pfd[i].events &= ~POLLIN;
-                /*
-                 * calc the max. time to spend in poll() until adjustments
-                 * to the pollfd array are needed again.
-                 */
-                tmp = pc[i].penaltyTimeoutAbs - now;
-                if (*pollTo == -1 || tmp < *pollTo)
-                    *pollTo = tmp;
-            } else {
-                /* listen again to the fd */
-                pfd[i].events |= POLLIN;
-
-                pc[i].penaltyTimeoutAbs = 0;
-            }
-        }
-    }
-
-    return ret;
+    dc->penaltyTimeoutAbs = 0;
+    return false;
 }
 
 /*
- * The DHCP snooping thread. It spends most of its time in the pcap
- * library and if it gets suitable packets, it submits them to the worker
- * thread for processing.
+ * Get the UDP ports of a captured DHCP packet
  */
-static void
-virNWFilterDHCPSnoopThread(void *req0)
+static int
+virNWFilterSnoopDHCPGetPorts(const unsigned char *packet, size_t len,
+                             uint16_t *sport, uint16_t *dport)
 {
-    virNWFilterSnoopReqPtr req = req0;
-    struct pcap_pkthdr *hdr;
-    virNWFilterSnoopEthHdrPtr packet;
-    int ifindex = 0;
-    int errcount = 0;
-    int tmp = -1, rv, n, pollTo;
-    size_t i;
-    char *threadkey = NULL;
-    virThreadPoolPtr worker = NULL;
-    time_t last_displayed = 0, last_displayed_queue = 0;
-    virNWFilterSnoopPcapConf pcapConf[] = {
-        {
-            .dir = PCAP_D_IN, /* from VM */
-            .filter = "dst port 67 and src port 68",
-            .rateLimit = {
-                .prev = time(0),
-                .rate = DHCP_PKT_RATE,
-                .burstRate = DHCP_PKT_BURST,
-                .burstInterval = DHCP_BURST_INTERVAL_S,
-            },
-            .maxQSize = MAX_QUEUED_JOBS,
-        }, {
-            .dir = PCAP_D_OUT, /* to VM */
-            .filter = "src port 67 and dst port 68",
-            .rateLimit = {
-                .prev = time(0),
-                .rate = DHCP_PKT_RATE,
-                .burstRate = DHCP_PKT_BURST,
-                .burstInterval = DHCP_BURST_INTERVAL_S,
-            },
-            .maxQSize = MAX_QUEUED_JOBS,
-        },
-    };
-    struct pollfd fds[] = {
-        {
-            /* get a POLLERR if interface goes down or disappears */
-            .events = POLLIN | POLLERR,
-        }, {
-            .events = POLLIN | POLLERR,
-        },
-    };
-    bool error = false;
-
-    /* whoever started us increased the reference counter for the req for us */
-
-    /* protect req->ifname & req->threadkey */
-    virNWFilterSnoopReqLock(req);
-
-    if (req->ifname && req->threadkey) {
-        for (i = 0; i < ARRAY_CARDINALITY(pcapConf); i++) {
-            pcapConf[i].handle =
-                virNWFilterSnoopDHCPOpen(req->ifname, &req->macaddr,
-                                         pcapConf[i].filter,
-                                         pcapConf[i].dir);
-            if (!pcapConf[i].handle) {
-                error = true;
-                break;
-            }
-            fds[i].fd = pcap_fileno(pcapConf[i].handle);
-        }
-        tmp = virNetDevGetIndex(req->ifname, &ifindex);
-        ignore_value(VIR_STRDUP(threadkey, req->threadkey));
-        worker = virThreadPoolNew(1, 1, 0,
-                                  virNWFilterDHCPDecodeWorker,
-                                  req);
-    }
-
-    /* let creator know how well we initialized */
-    if (error || !threadkey || tmp < 0 || !worker ||
-        ifindex != req->ifindex)
-        req->threadStatus = THREAD_STATUS_FAIL;
-    else
-        req->threadStatus = THREAD_STATUS_OK;
+    size_t iphlen;
+    struct udphdr udp;
 
-    virCondSignal(&req->threadStatusCond);
+    if (len <= MIN_VALID_DHCP_PKT_SIZE)
+        return -1;
 
-    virNWFilterSnoopReqUnlock(req);
+    iphlen = (packet[offsetof(virNWFilterSnoopEthHdr, eh_data)] & 0xf) << 2;
+    if (len < offsetof(virNWFilterSnoopEthHdr, eh_data) + iphlen + sizeof(udp))
+        return -1;
 
-    if (req->threadStatus != THREAD_STATUS_OK)
-        goto exit;
+    memcpy(&udp, packet + offsetof(virNWFilterSnoopEthHdr, eh_data) + iphlen,
+           sizeof(udp));
+    *sport = ntohs(udp.source);
+    *dport = ntohs(udp.dest);
 
-    while (!error) {
-        if (virNWFilterSnoopAdjustPoll(pcapConf,
-                                       ARRAY_CARDINALITY(pcapConf),
-                                       fds, &pollTo) < 0) {
-            break;
-        }
-
-        /* cap pollTo so we don't hold up the join for too long */
-        if (pollTo < 0 || pollTo > SNOOP_POLL_MAX_TIMEOUT_MS)
-            pollTo = SNOOP_POLL_MAX_TIMEOUT_MS;
+    return 0;
+}
 
-        n = poll(fds, ARRAY_CARDINALITY(fds), pollTo);
+/*
+ * Called from the event loop for the DHCP packets seen on the interface
+ * of the request. Once they have passed the rate limiting they are
+ * submitted to the worker thread for processing.
+ */
+static void
+virNWFilterSnoopCaptureCallback(int watch,
+                                const unsigned char *packet,
+                                size_t len,
+                                bool outgoing,
+                                void *opaque)
+{
+    virNWFilterSnoopReqPtr req = opaque;
+    virNWFilterSnoopDirConfPtr dc;
+    bool fromVM = !outgoing;
+    uint16_t sport, dport;
+    unsigned int diff;
+
+    if (!packet) {
+        /* the interface went away; don't touch the req from here */
+        if (virNWFilterSnoopJobSubmit(DHCP_JOB_STOP, req, watch,
+                                      NULL, 0, false, NULL) < 0)
+            VIR_WARN("Cannot stop snooping on interface '%s'",
+                     req->watchIfname);
+        return;
+    }
 
-        if (n < 0) {
-            if (errno != EAGAIN && errno != EINTR)
-                error = true;
-        }
+    /* a previously submitted job failed, snooping is being stopped */
+    if (virAtomicIntGet(&req->jobCompletionStatus) != 0)
+        return;
 
-        virNWFilterSnoopReqLeaseTimerRun(req);
+    if (virNWFilterSnoopDHCPGetPorts(packet, len, &sport, &dport) < 0)
+        return;
 
+    if (fromVM) {
         /*
-         * Check whether we were cancelled or whether
-         * a previously submitted job failed.
+         * don't want to hear about another VM's DHCP requests; filter
+         * the more unlikely parameters first, then go for the MAC
          */
-        if (!virNWFilterSnoopIsActive(threadkey) ||
-            req->jobCompletionStatus != 0)
-            goto exit;
-
-        for (i = 0; n > 0 && i < ARRAY_CARDINALITY(fds); i++) {
-            if (!fds[i].revents)
-                continue;
-
-            fds[i].revents = 0;
-            n--;
-
-            rv = pcap_next_ex(pcapConf[i].handle, &hdr,
-                              (const u_char **)&packet);
-
-            if (rv < 0) {
-                /* error reading from socket */
-                tmp = -1;
-
-                /* protect req->ifname */
-                virNWFilterSnoopReqLock(req);
-
-                if (req->ifname)
-                    tmp = virNetDevValidateConfig(req->ifname, NULL, ifindex);
-
-                virNWFilterSnoopReqUnlock(req);
-
-                if (tmp <= 0) {
-                    error = true;
-                    break;
-                }
-
-                if (++errcount > PCAP_READ_MAXERRS) {
-                    pcap_close(pcapConf[i].handle);
-                    pcapConf[i].handle = NULL;
-
-                    /* protect req->ifname */
-                    virNWFilterSnoopReqLock(req);
-
-                    virReportError(VIR_ERR_INTERNAL_ERROR,
-                                   _("interface '%s' failing; "
-                                     "reopening"),
-                                   req->ifname);
-                    if (req->ifname)
-                        pcapConf[i].handle =
-                            virNWFilterSnoopDHCPOpen(req->ifname, &req->macaddr,
-                                                     pcapConf[i].filter,
-                                                     pcapConf[i].dir);
-
-                    virNWFilterSnoopReqUnlock(req);
-
-                    if (!pcapConf[i].handle) {
-                        error = true;
-                        break;
-                    }
-                }
-                continue;
-            }
-
-            errcount = 0;
-
-            if (rv) {
-                unsigned int diff;
-
-                /* submit packet to worker thread */
-                if (virAtomicIntGet(&pcapConf[i].qCtr) >
-                    pcapConf[i].maxQSize) {
-                    if (last_displayed_queue - time(0) > 10) {
-                        last_displayed_queue = time(0);
-                        VIR_WARN("Worker thread for interface '%s' has a "
-                                 "job queue that is too long",
-                                 req->ifname);
-                    }
-                    continue;
-                }
-
-                diff = virNWFilterSnoopRateLimit(&pcapConf[i].rateLimit);
-                if (diff > 0) {
-                    virNWFilterSnoopRatePenalty(&pcapConf[i], diff,
-                                                DHCP_PKT_RATE);
-                    /* rate-limited warnings */
-                    if (time(0) - last_displayed > 10) {
-                         last_displayed = time(0);
-                         VIR_WARN("Too many DHCP packets on interface '%s'",
-                                  req->ifname);
-                    }
-                    continue;
-                }
-
-                if (virNWFilterSnoopDHCPDecodeJobSubmit(worker, packet,
-                                                      hdr->caplen,
-                                                      pcapConf[i].dir,
-                                                      &pcapConf[i].qCtr) < 0) {
-                    virReportError(VIR_ERR_INTERNAL_ERROR,
-                                   _("Job submission failed on "
-                                     "interface '%s'"), req->ifname);
-                    error = true;
-                    break;
-                }
-            }
-        } /* for all fds */
-    } /* while (!error) */
-
-    /* protect IfNameToKey */
-    virNWFilterSnoopLock();
+        if (sport != 68 || dport != 67 ||
+            virMacAddrCmpRaw(&req->macaddr,
+                             packet + offsetof(virNWFilterSnoopEthHdr,
+                                               eh_src)) != 0)
+            return;
+        dc = &req->dirConf[SNOOP_DIR_FROM_VM];
+    } else {
+        /*
+         * Some DHCP servers respond via MAC broadcast; we rely on later
+         * filtering of responses by comparing the MAC address inside the
+         * DHCP response against the one of the VM.
+         */
+        if (sport != 67 || dport != 68)
+            return;
+        dc = &req->dirConf[SNOOP_DIR_TO_VM];
+    }
 
-    /* protect req->ifname & req->threadkey */
-    virNWFilterSnoopReqLock(req);
+    if (virNWFilterSnoopInPenalty(dc))
+        return;
 
-    virNWFilterSnoopCancel(&req->threadkey);
+    if (virAtomicIntGet(&dc->qCtr) > dc->maxQSize) {
+        if (time(0) - req->last_displayed_queue > 10) {
+            req->last_displayed_queue = time(0);
+            VIR_WARN("Worker thread for interface '%s' has a "
+                     "job queue that is too long",
+                     req->watchIfname);
+        }
+        return;
+    }
 
-    ignore_value(virHashRemoveEntry(virNWFilterSnoopState.ifnameToKey,
-                                    req->ifname));
+    diff = virNWFilterSnoopRateLimit(&dc->rateLimit);
+    if (diff > 0) {
+        virNWFilterSnoopRatePenalty(dc, diff, DHCP_PKT_RATE);
+        /* rate-limited warnings */
+        if (time(0) - req->last_displayed > 10) {
+             req->last_displayed = time(0);
+             VIR_WARN("Too many DHCP packets on interface '%s'",
+                      req->watchIfname);
+        }
+        return;
+    }
 
-    VIR_FREE(req->ifname);
+    if (len > SNOOP_PBUFSIZE)
+        len = SNOOP_PBUFSIZE;
 
-    virNWFilterSnoopReqUnlock(req);
-    virNWFilterSnoopUnlock();
+    if (virNWFilterSnoopJobSubmit(DHCP_JOB_DECODE, req, watch,
+                                  packet, len, fromVM, &dc->qCtr) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Job submission failed on "
+                         "interface '%s'"), req->watchIfname);
+        virAtomicIntSet(&req->jobCompletionStatus, -1);
+        ignore_value(virNWFilterSnoopJobSubmit(DHCP_JOB_STOP, req, watch,
+                                               NULL, 0, false, NULL));
+    }
+}
 
- exit:
-    virThreadPoolFree(worker);
+/*
+ * Free callback of the capture watch, drops the reference the watch
+ * holds to the req
+ */
+static void
+virNWFilterSnoopCaptureFree(void *opaque)
+{
+    virNWFilterSnoopReqPtr req = opaque;
 
     virNWFilterSnoopReqPut(req);
+}
+
+/*
+ * Set up the per-direction rate limiters for a new capture watch
+ */
+static void
+virNWFilterSnoopReqResetLimits(virNWFilterSnoopReqPtr req)
+{
+    size_t i;
 
-    VIR_FREE(threadkey);
+    for (i = 0; i < ARRAY_CARDINALITY(req->dirConf); i++) {
+        virNWFilterSnoopDirConfPtr dc = &req->dirConf[i];
 
-    for (i = 0; i < ARRAY_CARDINALITY(pcapConf); i++) {
-        if (pcapConf[i].handle)
-            pcap_close(pcapConf[i].handle);
+        memset(&dc->rateLimit, 0, sizeof(dc->rateLimit));
+        dc->rateLimit.prev = time(0);
+        dc->rateLimit.rate = DHCP_PKT_RATE;
+        dc->rateLimit.burstRate = DHCP_PKT_BURST;
+        dc->rateLimit.burstInterval = DHCP_BURST_INTERVAL_S;
+        dc->maxQSize = MAX_QUEUED_JOBS;
+        dc->penaltyTimeoutAbs = 0;
     }
 
-    virAtomicIntDecAndTest(&virNWFilterSnoopState.nThreads);
+    req->last_displayed = 0;
+    req->last_displayed_queue = 0;
+    virAtomicIntSet(&req->jobCompletionStatus, 0);
+}
 
-    return;
+/*
+ * Periodically have the expired leases removed
+ */
+static void
+virNWFilterSnoopLeaseTimer(int timer ATTRIBUTE_UNUSED,
+                           void *opaque ATTRIBUTE_UNUSED)
+{
+    /* one is enough while the worker is busy */
+    if (virAtomicIntGet(&virNWFilterSnoopState.expiryQueued))
+        return;
+
+    virAtomicIntSet(&virNWFilterSnoopState.expiryQueued, 1);
+    if (virNWFilterSnoopJobSubmit(DHCP_JOB_EXPIRE, NULL, -1,
+                                  NULL, 0, false, NULL) < 0)
+        virAtomicIntSet(&virNWFilterSnoopState.expiryQueued, 0);
 }
 
 static void
@@ -1598,16 +1494,14 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver,
     bool isnewreq;
     char ifkey[VIR_IFKEY_LEN];
     int tmp;
-    virThread thread;
     virNWFilterVarValuePtr dhcpsrvrs;
-    bool threadPuts = false;
 
     virNWFilterSnoopIFKeyFMT(ifkey, vmuuid, macaddr);
 
     req = virNWFilterSnoopReqGetByIFKey(ifkey);
     isnewreq = (req == NULL);
     if (!isnewreq) {
-        if (req->threadkey) {
+        if (req->watch >= 0) {
             virNWFilterSnoopReqPut(req);
             return 0;
         }
@@ -1682,28 +1576,24 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver,
         goto exit_rem_ifnametokey;
     }
 
-    /* prevent thread from holding req */
+    /* protect req->watch */
     virNWFilterSnoopReqLock(req);
 
-    if (virThreadCreate(&thread, false, virNWFilterDHCPSnoopThread,
-                        req) != 0) {
+    if (virStrcpyStatic(req->watchIfname, ifname) == NULL) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("virNWFilterDHCPSnoopReq virThreadCreate "
-                         "failed on interface '%s'"), ifname);
+                       _("interface name '%s' too long"), ifname);
         goto exit_snoopreq_unlock;
     }
 
-    threadPuts = true;
-
-    virAtomicIntInc(&virNWFilterSnoopState.nThreads);
+    virNWFilterSnoopReqResetLimits(req);
 
-    req->threadkey = virNWFilterSnoopActivate(req);
-    if (!req->threadkey) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Activation of snoop request failed on "
-                         "interface '%s'"), req->ifname);
+    /* the watch takes over our reference */
+    req->watch = virNWFilterCaptureAdd(VIR_NWFILTER_CAPTURE_DHCP,
+                                       ifname, req->ifindex, NULL,
+                                       virNWFilterSnoopCaptureCallback,
+                                       req, virNWFilterSnoopCaptureFree);
+    if (req->watch < 0)
         goto exit_snoopreq_unlock;
-    }
 
     if (virNWFilterSnoopReqRestore(req) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -1712,21 +1602,18 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver,
         goto exit_snoop_cancel;
     }
 
-    /* sync with thread */
-    if (virCondWait(&req->threadStatusCond, &req->lock) < 0 ||
-        req->threadStatus != THREAD_STATUS_OK)
-        goto exit_snoop_cancel;
-
     virNWFilterSnoopReqUnlock(req);
 
     virNWFilterSnoopUnlock();
 
-    /* do not 'put' the req -- the thread will do this */
+    /* do not 'put' the req -- the capture watch will do this */
 
     return 0;
 
  exit_snoop_cancel:
-    virNWFilterSnoopCancel(&req->threadkey);
+    /* get back the reference the watch drops */
+    virNWFilterSnoopReqGet(req);
+    virNWFilterSnoopCancel(req);
  exit_snoopreq_unlock:
     virNWFilterSnoopReqUnlock(req);
  exit_rem_ifnametokey:
@@ -1734,8 +1621,7 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver,
  exit_snoopunlock:
     virNWFilterSnoopUnlock();
  exit_snoopreqput:
-    if (!threadPuts)
-        virNWFilterSnoopReqPut(req);
+    virNWFilterSnoopReqPut(req);
 
     return -1;
 }
@@ -1844,10 +1730,10 @@ virNWFilterSnoopPruneIter(const void *payload,
 
     /* clean up orphaned, expired leases */
 
-    /* protect req->threadkey */
+    /* protect req->watch */
     virNWFilterSnoopReqLock(req);
 
-    if (!req->threadkey)
+    if (req->watch < 0)
         virNWFilterSnoopReqLeaseTimerRun(req);
 
     /*
@@ -2011,19 +1897,6 @@ virNWFilterSnoopLeaseFileLoad(void)
     virNWFilterSnoopUnlock();
 }
 
-/*
- * Wait until all threads have ended.
- */
-static void
-virNWFilterSnoopJoinThreads(void)
-{
-    while (virAtomicIntGet(&virNWFilterSnoopState.nThreads) != 0) {
-        VIR_WARN("Waiting for snooping threads to terminate: %u",
-                 virAtomicIntGet(&virNWFilterSnoopState.nThreads));
-        usleep(1000 * 1000);
-    }
-}
-
 /*
  * Iterator to remove a request, repeatedly called on one
  * request after another.
@@ -2047,7 +1920,7 @@ virNWFilterSnoopRemAllReqIter(const void *payload,
 
         /*
          * Remove all IP addresses known to be associated with this
-         * interface so that a new thread will be started on this
+         * interface so that snooping will be started again on this
          * interface
          */
         virNWFilterIPAddrMapDelIPAddr(req->ifname, NULL);
@@ -2063,10 +1936,10 @@ virNWFilterSnoopRemAllReqIter(const void *payload,
 
 
 /*
- * Terminate all threads; keep the SnoopReqs hash allocated
+ * Stop snooping on all interfaces; keep the SnoopReqs hash allocated
  */
 static void
-virNWFilterSnoopEndThreads(void)
+virNWFilterSnoopStopAll(void)
 {
     virNWFilterSnoopLock();
     virHashRemoveSet(virNWFilterSnoopState.snoopReqs,
@@ -2083,46 +1956,60 @@ virNWFilterDHCPSnoopInit(void)
 
     VIR_DEBUG("Initializing DHCP snooping");
 
-    if (virMutexInitRecursive(&virNWFilterSnoopState.snoopLock) < 0 ||
-        virMutexInit(&virNWFilterSnoopState.activeLock) < 0)
+    if (virMutexInitRecursive(&virNWFilterSnoopState.snoopLock) < 0)
         return -1;
 
+    virNWFilterSnoopState.leaseTimer = -1;
     virNWFilterSnoopState.ifnameToKey = virHashCreate(0, NULL);
-    virNWFilterSnoopState.active = virHashCreate(0, NULL);
     virNWFilterSnoopState.snoopReqs =
         virHashCreate(0, virNWFilterSnoopReqRelease);
 
     if (!virNWFilterSnoopState.ifnameToKey ||
-        !virNWFilterSnoopState.snoopReqs ||
-        !virNWFilterSnoopState.active)
+        !virNWFilterSnoopState.snoopReqs)
+        goto err_exit;
+
+    /*
+     * a single worker keeps the jobs of each request in order, the
+     * jobs of different requests take turns
+     */
+    virNWFilterSnoopState.decodePool =
+        virThreadPoolNew(1, 1, 0, virNWFilterDHCPDecodeWorker, NULL);
+    if (!virNWFilterSnoopState.decodePool)
         goto err_exit;
 
+    if ((virNWFilterSnoopState.leaseTimer =
+         virEventAddTimeout(SNOOP_LEASE_TIMER_MS, virNWFilterSnoopLeaseTimer,
+                            NULL, NULL)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot add DHCP lease timer"));
+        goto err_exit;
+    }
+
     virNWFilterSnoopLeaseFileLoad();
     virNWFilterSnoopLeaseFileOpen();
 
     return 0;
 
  err_exit:
+    virThreadPoolFree(virNWFilterSnoopState.decodePool);
+    virNWFilterSnoopState.decodePool = NULL;
+
     virHashFree(virNWFilterSnoopState.ifnameToKey);
     virNWFilterSnoopState.ifnameToKey = NULL;
 
     virHashFree(virNWFilterSnoopState.snoopReqs);
     virNWFilterSnoopState.snoopReqs = NULL;
 
-    virHashFree(virNWFilterSnoopState.active);
-    virNWFilterSnoopState.active = NULL;
-
     return -1;
 }
 
 /**
- * End a DHCP snoop thread on the given interface or end all
- * DHCP snoop threads.
+ * End DHCP snooping on the given interface or on all interfaces.
  *
- * @ifname: Name of an interface or NULL to stop all snoop threads
+ * @ifname: Name of an interface or NULL to stop all snooping
  *
  * It is not an error to call this function with an interface name
- * for which no thread is snooping traffic. In this case the call will
+ * on which no traffic is snooped. In this case the call will
  * be a no-op.
  */
 void
@@ -2155,11 +2042,11 @@ virNWFilterDHCPSnoopEnd(const char *ifname)
             goto cleanup;
         }
 
-        /* protect req->ifname & req->threadkey */
+        /* protect req->ifname & req->watch */
         virNWFilterSnoopReqLock(req);
 
         /* keep valid lease req; drop interface association */
-        virNWFilterSnoopCancel(&req->threadkey);
+        virNWFilterSnoopCancel(req);
 
         VIR_FREE(req->ifname);
 
@@ -2171,8 +2058,8 @@ virNWFilterDHCPSnoopEnd(const char *ifname)
 
         virHashRemoveAll(virNWFilterSnoopState.ifnameToKey);
 
-        /* tell the threads to terminate */
-        virNWFilterSnoopEndThreads();
+        /* stop snooping everywhere */
+        virNWFilterSnoopStopAll();
 
         virNWFilterSnoopLeaseFileLoad();
     }
@@ -2184,23 +2071,32 @@ virNWFilterDHCPSnoopEnd(const char *ifname)
 void
 virNWFilterDHCPSnoopShutdown(void)
 {
-    virNWFilterSnoopEndThreads();
-    virNWFilterSnoopJoinThreads();
+    if (!virNWFilterSnoopState.snoopReqs)
+        return;
+
+    if (virNWFilterSnoopState.leaseTimer >= 0) {
+        virEventRemoveTimeout(virNWFilterSnoopState.leaseTimer);
+        virNWFilterSnoopState.leaseTimer = -1;
+    }
+
+    virNWFilterSnoopStopAll();
+
+    /* wait for the job being worked on */
+    virThreadPoolFree(virNWFilterSnoopState.decodePool);
+    virNWFilterSnoopState.decodePool = NULL;
 
     virNWFilterSnoopLock();
 
     virNWFilterSnoopLeaseFileClose();
     virHashFree(virNWFilterSnoopState.ifnameToKey);
+    virNWFilterSnoopState.ifnameToKey = NULL;
     virHashFree(virNWFilterSnoopState.snoopReqs);
+    virNWFilterSnoopState.snoopReqs = NULL;
 
     virNWFilterSnoopUnlock();
-
-    virNWFilterSnoopActiveLock();
-    virHashFree(virNWFilterSnoopState.active);
-    virNWFilterSnoopActiveUnlock();
 }
 
-#else /* HAVE_LIBPCAP */
+#else /* WITH_NWFILTER_CAPTURE */
 
 int
 virNWFilterDHCPSnoopInit(void)
@@ -2232,9 +2128,9 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver ATTRIBUTE_UNUSED,
                         virNWFilterDriverStatePtr driver ATTRIBUTE_UNUSED)
 {
     virReportError(VIR_ERR_INTERNAL_ERROR,
-                   _("libvirt was not compiled with libpcap and \""
-                     NWFILTER_VARNAME_CTRL_IP_LEARNING
+                   _("packet capture is not supported on this platform "
+                     "and \"" NWFILTER_VARNAME_CTRL_IP_LEARNING
                      "='dhcp'\" requires it."));
     return -1;
 }
-#endif /* HAVE_LIBPCAP */
+#endif /* WITH_NWFILTER_CAPTURE */
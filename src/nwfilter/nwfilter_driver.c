@@ -46,6 +46,7 @@
 #include "nwfilter_ipaddrmap.h"
 #include "nwfilter_dhcpsnoop.h"
 #include "nwfilter_learnipaddr.h"
+#include "nwfilter_capture.h"
 
 #define VIR_FROM_THIS VIR_FROM_NWFILTER
 
@@ -196,8 +197,10 @@ nwfilterStateInitialize(bool privileged,
 
     if (virNWFilterIPAddrMapInit() < 0)
         goto err_free_driverstate;
-    if (virNWFilterLearnInit() < 0)
+    if (virNWFilterCaptureInit() < 0)
         goto err_exit_ipaddrmapshutdown;
+    if (virNWFilterLearnInit() < 0)
+        goto err_exit_captureshutdown;
     if (virNWFilterDHCPSnoopInit() < 0)
         goto err_exit_learnshutdown;
 
@@ -257,6 +260,8 @@ nwfilterStateInitialize(bool privileged,
     virNWFilterDHCPSnoopShutdown();
  err_exit_learnshutdown:
     virNWFilterLearnShutdown();
+ err_exit_captureshutdown:
+    virNWFilterCaptureShutdown();
  err_exit_ipaddrmapshutdown:
     virNWFilterIPAddrMapShutdown();
 
@@ -332,6 +337,7 @@ nwfilterStateCleanup(void)
         virNWFilterConfLayerShutdown();
         virNWFilterDHCPSnoopShutdown();
         virNWFilterLearnShutdown();
+        virNWFilterCaptureShutdown();
         virNWFilterIPAddrMapShutdown();
         virNWFilterTechDriversShutdown();
 
@@ -32,12 +32,15 @@
 #include "virerror.h"
 #include "nwfilter_gentech_driver.h"
 #include "nwfilter_ebiptables_driver.h"
+#include "nwfilter_nftables_driver.h"
 #include "nwfilter_dhcpsnoop.h"
 #include "nwfilter_ipaddrmap.h"
 #include "nwfilter_learnipaddr.h"
 #include "virnetdev.h"
 #include "datatypes.h"
 #include "virstring.h"
+#include "vircrypto.h"
+#include "virhash.h"
 
 #define VIR_FROM_THIS VIR_FROM_NWFILTER
 
@@ -51,8 +54,10 @@ VIR_LOG_INIT("nwfilter.nwfilter_gentech_driver");
 static int _virNWFilterTeardownFilter(const char *ifname);
 
 
+/* in order of preference */
 static virNWFilterTechDriverPtr filter_tech_drivers[] = {
     &ebiptables_driver,
+    &nftables_driver,
     NULL
 };
 
@@ -72,6 +77,86 @@ static virNWFilterTechDriverPtr filter_tech_drivers[] = {
  */
 static virMutex updateMutex;
 
+/* Digests of the rules instantiated on each interface, keyed by the
+ * interface name. A filter update whose effective rules on an interface
+ * are the same as the ones already active there leaves that interface
+ * alone rather than rebuilding all of its chains.
+ */
+typedef struct _virNWFilterIfaceRules virNWFilterIfaceRules;
+typedef virNWFilterIfaceRules *virNWFilterIfaceRulesPtr;
+struct _virNWFilterIfaceRules {
+    char *active;  /* digest of the rules in effect */
+    char *pending; /* digest of new rules not yet switched over to */
+};
+
+static virMutex ifaceRulesLock;
+static virHashTablePtr ifaceRules;
+
+static void
+virNWFilterIfaceRulesFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    virNWFilterIfaceRulesPtr rules = payload;
+
+    if (!rules)
+        return;
+
+    VIR_FREE(rules->active);
+    VIR_FREE(rules->pending);
+    VIR_FREE(rules);
+}
+
+/*
+ * The part of instantiating a filter tree that does not depend on the
+ * interface: the filters and rules it expands to, and the values that
+ * the filterref parameters along the way give to each rule's variables.
+ * These are cached per top-level filter for as long as the list of
+ * filters does not change, so that instantiating a filter on another
+ * interface only needs to substitute the interface's own variables.
+ */
+typedef struct _virNWFilterInstTmplRule virNWFilterInstTmplRule;
+typedef virNWFilterInstTmplRule *virNWFilterInstTmplRulePtr;
+struct _virNWFilterInstTmplRule {
+    virNWFilterDefPtr def;
+    virNWFilterRuleDefPtr rule;
+    virNWFilterHashTablePtr params; /* owned by the template */
+};
+
+typedef struct _virNWFilterInstTmpl virNWFilterInstTmpl;
+typedef virNWFilterInstTmpl *virNWFilterInstTmplPtr;
+struct _virNWFilterInstTmpl {
+    unsigned int generation;
+    virNWFilterDefPtr def;
+
+    virNWFilterObjPtr *filters; /* included filters, in traversal order */
+    size_t nfilters;
+    virNWFilterHashTablePtr *params;
+    size_t nparams;
+    virNWFilterInstTmplRulePtr rules;
+    size_t nrules;
+};
+
+/* protected by updateMutex */
+static virHashTablePtr instTmpls;
+
+
+static void
+virNWFilterInstTmplFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    virNWFilterInstTmplPtr tmpl = payload;
+    size_t i;
+
+    if (!tmpl)
+        return;
+
+    for (i = 0; i < tmpl->nparams; i++)
+        virNWFilterHashTableFree(tmpl->params[i]);
+    VIR_FREE(tmpl->params);
+    VIR_FREE(tmpl->filters);
+    VIR_FREE(tmpl->rules);
+    VIR_FREE(tmpl);
+}
+
+
 int virNWFilterTechDriversInit(bool privileged)
 {
     size_t i = 0;
@@ -79,6 +164,20 @@ int virNWFilterTechDriversInit(bool privileged)
     if (virMutexInitRecursive(&updateMutex) < 0)
         return -1;
 
+    if (virMutexInit(&ifaceRulesLock) < 0) {
+        virMutexDestroy(&updateMutex);
+        return -1;
+    }
+
+    if (!(ifaceRules = virHashCreate(0, virNWFilterIfaceRulesFree)) ||
+        !(instTmpls = virHashCreate(0, virNWFilterInstTmplFree))) {
+        virHashFree(ifaceRules);
+        ifaceRules = NULL;
+        virMutexDestroy(&ifaceRulesLock);
+        virMutexDestroy(&updateMutex);
+        return -1;
+    }
+
     while (filter_tech_drivers[i]) {
         if (!(filter_tech_drivers[i]->flags & TECHDRV_FLAG_INITIALIZED))
             filter_tech_drivers[i]->init(privileged);
@@ -96,10 +195,32 @@ void virNWFilterTechDriversShutdown(void)
             filter_tech_drivers[i]->shutdown();
         i++;
     }
+    virHashFree(instTmpls);
+    instTmpls = NULL;
+    virHashFree(ifaceRules);
+    ifaceRules = NULL;
+    virMutexDestroy(&ifaceRulesLock);
     virMutexDestroy(&updateMutex);
 }
 
 
+/*
+ * Returns the name of the first technology driver that could be
+ * initialized; ebiptables if none could be, so that errors name it.
+ */
+static const char *
+virNWFilterTechDriverDefaultName(void)
+{
+    size_t i = 0;
+    while (filter_tech_drivers[i]) {
+        if ((filter_tech_drivers[i]->flags & TECHDRV_FLAG_INITIALIZED))
+            return filter_tech_drivers[i]->name;
+        i++;
+    }
+    return EBIPTABLES_DRIVER_ID;
+}
+
+
 virNWFilterTechDriverPtr
 virNWFilterTechDriverForName(const char *name)
 {
@@ -334,10 +455,50 @@ virNWFilterDefToInst(virNWFilterDriverStatePtr driver,
                      bool *foundNewFilter,
                      virNWFilterInstPtr inst);
 
+/*
+ * Copy the variables accessed by @rule into @dest, taking their values
+ * from @vars or, for those not found there, from @defaults if given.
+ * The technology drivers never look at any other variable of a rule,
+ * so there is no point in copying the whole of @vars for every rule.
+ */
+static int
+virNWFilterRuleDefCopyVars(virNWFilterRuleDefPtr rule,
+                           virNWFilterHashTablePtr vars,
+                           virNWFilterHashTablePtr defaults,
+                           virNWFilterHashTablePtr dest)
+{
+    size_t i;
+
+    for (i = 0; i < rule->nVarAccess; i++) {
+        const char *name = virNWFilterVarAccessGetVarName(rule->varAccess[i]);
+        virNWFilterVarValuePtr val;
+
+        if (virHashLookup(dest->hashTable, name))
+            continue;
+
+        if (!(val = virHashLookup(vars->hashTable, name)) && defaults)
+            val = virHashLookup(defaults->hashTable, name);
+        if (!val)
+            continue;
+
+        if (!(val = virNWFilterVarValueCopy(val)))
+            return -1;
+
+        if (virNWFilterHashTablePut(dest, name, val) < 0) {
+            virNWFilterVarValueFree(val);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
 static int
 virNWFilterRuleDefToRuleInst(virNWFilterDefPtr def,
                              virNWFilterRuleDefPtr rule,
                              virNWFilterHashTablePtr vars,
+                             virNWFilterHashTablePtr defaults,
                              virNWFilterInstPtr inst)
 {
     virNWFilterRuleInstPtr ruleinst;
@@ -352,7 +513,7 @@ virNWFilterRuleDefToRuleInst(virNWFilterDefPtr def,
     ruleinst->priority = rule->priority;
     if (!(ruleinst->vars = virNWFilterHashTableCreate(0)))
         goto cleanup;
-    if (virNWFilterHashTablePutAll(vars, ruleinst->vars) < 0)
+    if (virNWFilterRuleDefCopyVars(rule, vars, defaults, ruleinst->vars) < 0)
         goto cleanup;
 
     if (VIR_APPEND_ELEMENT(inst->rules,
@@ -473,7 +634,7 @@ virNWFilterDefToInst(virNWFilterDriverStatePtr driver,
         if (def->filterEntries[i]->rule) {
             if (virNWFilterRuleDefToRuleInst(def,
                                              def->filterEntries[i]->rule,
-                                             vars,
+                                             vars, NULL,
                                              inst) < 0)
                 goto cleanup;
         } else if (def->filterEntries[i]->include) {
@@ -494,6 +655,189 @@ virNWFilterDefToInst(virNWFilterDriverStatePtr driver,
 }
 
 
+/*
+ * Expand @def with the filterref parameters @params into @tmpl. The
+ * included filters are left locked and added to @inst, just like
+ * virNWFilterDefToInst does.
+ */
+static int
+virNWFilterInstTmplExpand(virNWFilterDriverStatePtr driver,
+                          virNWFilterInstTmplPtr tmpl,
+                          virNWFilterDefPtr def,
+                          virNWFilterHashTablePtr params,
+                          virNWFilterInstPtr inst)
+{
+    size_t i;
+
+    for (i = 0; i < def->nentries; i++) {
+        virNWFilterIncludeDefPtr inc = def->filterEntries[i]->include;
+        virNWFilterHashTablePtr childparams;
+        virNWFilterObjPtr obj;
+
+        if (def->filterEntries[i]->rule) {
+            virNWFilterInstTmplRule rule = {
+                .def = def,
+                .rule = def->filterEntries[i]->rule,
+                .params = params,
+            };
+
+            if (VIR_APPEND_ELEMENT(tmpl->rules, tmpl->nrules, rule) < 0)
+                return -1;
+            continue;
+        }
+
+        if (!inc)
+            continue;
+
+        VIR_DEBUG("Expanding filter %s", inc->filterref);
+        if (!(obj = virNWFilterObjFindByName(&driver->nwfilters,
+                                             inc->filterref))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("referenced filter '%s' is missing"),
+                           inc->filterref);
+            return -1;
+        }
+        if (obj->wantRemoved) {
+            virReportError(VIR_ERR_NO_NWFILTER,
+                           _("Filter '%s' is in use."),
+                           inc->filterref);
+            virNWFilterObjUnlock(obj);
+            return -1;
+        }
+
+        if (VIR_APPEND_ELEMENT_COPY(tmpl->filters, tmpl->nfilters, obj) < 0 ||
+            VIR_APPEND_ELEMENT_COPY(inst->filters, inst->nfilters, obj) < 0) {
+            virNWFilterObjUnlock(obj);
+            return -1;
+        }
+
+        /* values passed down from the including filter take precedence */
+        if (!(childparams = virNWFilterCreateVarsFrom(inc->params, params)))
+            return -1;
+        if (VIR_APPEND_ELEMENT(tmpl->params, tmpl->nparams, childparams) < 0) {
+            virNWFilterHashTableFree(childparams);
+            return -1;
+        }
+
+        if (virNWFilterInstTmplExpand(driver, tmpl, obj->def,
+                                      tmpl->params[tmpl->nparams - 1],
+                                      inst) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virNWFilterInstTmplToInst:
+ * @driver: the driver state pointer
+ * @def: The filter to instantiate
+ * @vars: The variables of the interface
+ * @inst: The instance to fill in
+ *
+ * Expand @def into a flat list of rule instances like virNWFilterDefToInst
+ * does with INSTANTIATE_ALWAYS, using the cached template of @def if it
+ * is still current.
+ *
+ * Call this function while holding the NWFilter filter update lock
+ *
+ * Returns 0 on success, -1 on error
+ */
+static int
+virNWFilterInstTmplToInst(virNWFilterDriverStatePtr driver,
+                          virNWFilterDefPtr def,
+                          virNWFilterHashTablePtr vars,
+                          virNWFilterInstPtr inst)
+{
+    virNWFilterInstTmplPtr tmpl;
+    size_t i;
+
+    tmpl = virHashLookup(instTmpls, def->name);
+    if (tmpl &&
+        tmpl->def == def &&
+        tmpl->generation == driver->nwfilters.generation) {
+        for (i = 0; i < tmpl->nfilters; i++) {
+            virNWFilterObjPtr obj = tmpl->filters[i];
+
+            virNWFilterObjLock(obj);
+            if (VIR_APPEND_ELEMENT_COPY(inst->filters, inst->nfilters, obj) < 0) {
+                virNWFilterObjUnlock(obj);
+                goto error;
+            }
+            if (obj->wantRemoved) {
+                virReportError(VIR_ERR_NO_NWFILTER,
+                               _("Filter '%s' is in use."),
+                               obj->def->name);
+                goto error;
+            }
+        }
+    } else {
+        VIR_DEBUG("Expanding filter tree of %s", def->name);
+        virHashRemoveEntry(instTmpls, def->name);
+
+        if (VIR_ALLOC(tmpl) < 0 ||
+            VIR_ALLOC_N(tmpl->params, 1) < 0 ||
+            !(tmpl->params[0] = virNWFilterHashTableCreate(0))) {
+            virNWFilterInstTmplFree(tmpl, NULL);
+            goto error;
+        }
+        tmpl->nparams = 1;
+        tmpl->def = def;
+        tmpl->generation = driver->nwfilters.generation;
+
+        if (virNWFilterInstTmplExpand(driver, tmpl, def,
+                                      tmpl->params[0], inst) < 0 ||
+            virHashAddEntry(instTmpls, def->name, tmpl) < 0) {
+            virNWFilterInstTmplFree(tmpl, NULL);
+            goto error;
+        }
+    }
+
+    for (i = 0; i < tmpl->nrules; i++) {
+        if (virNWFilterRuleDefToRuleInst(tmpl->rules[i].def,
+                                         tmpl->rules[i].rule,
+                                         vars, tmpl->rules[i].params,
+                                         inst) < 0)
+            goto error;
+    }
+
+    return 0;
+
+ error:
+    virNWFilterInstReset(inst);
+    return -1;
+}
+
+
+static int
+virNWFilterAddMissingVar(virNWFilterVarAccessPtr varAccess,
+                         virNWFilterHashTablePtr missing_vars)
+{
+    char *name;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virNWFilterVarValuePtr val;
+
+    virNWFilterVarAccessPrint(varAccess, &buf);
+    if (virBufferError(&buf)) {
+        virReportOOMError();
+        return -1;
+    }
+
+    val = virNWFilterVarValueCreateSimpleCopyValue("1");
+    if (!val) {
+        virBufferFreeAndReset(&buf);
+        return -1;
+    }
+
+    name = virBufferContentAndReset(&buf);
+    virNWFilterHashTablePut(missing_vars, name, val);
+    VIR_FREE(name);
+
+    return 0;
+}
+
+
 static int
 virNWFilterDetermineMissingVarsRec(virNWFilterDefPtr filter,
                                    virNWFilterHashTablePtr vars,
@@ -505,7 +849,6 @@ virNWFilterDetermineMissingVarsRec(virNWFilterDefPtr filter,
     int rc = 0;
     size_t i, j;
     virNWFilterDefPtr next_filter;
-    virNWFilterVarValuePtr val;
 
     for (i = 0; i < filter->nentries; i++) {
         virNWFilterRuleDefPtr    rule = filter->filterEntries[i]->rule;
@@ -514,28 +857,11 @@ virNWFilterDetermineMissingVarsRec(virNWFilterDefPtr filter,
             /* check all variables of this rule */
             for (j = 0; j < rule->nVarAccess; j++) {
                 if (!virNWFilterVarAccessIsAvailable(rule->varAccess[j],
-                                                     vars)) {
-                    char *varAccess;
-                    virBuffer buf = VIR_BUFFER_INITIALIZER;
-
-                    virNWFilterVarAccessPrint(rule->varAccess[j], &buf);
-                    if (virBufferError(&buf)) {
-                        virReportOOMError();
-                        rc = -1;
-                        break;
-                    }
-
-                    val = virNWFilterVarValueCreateSimpleCopyValue("1");
-                    if (!val) {
-                        virBufferFreeAndReset(&buf);
-                        rc = -1;
-                        break;
-                    }
-
-                    varAccess = virBufferContentAndReset(&buf);
-                    virNWFilterHashTablePut(missing_vars, varAccess,
-                                            val);
-                    VIR_FREE(varAccess);
+                                                     vars) &&
+                    virNWFilterAddMissingVar(rule->varAccess[j],
+                                             missing_vars) < 0) {
+                    rc = -1;
+                    break;
                 }
             }
             if (rc)
@@ -599,6 +925,193 @@ virNWFilterDetermineMissingVarsRec(virNWFilterDefPtr filter,
 }
 
 
+/*
+ * Determine the variables accessed by the rules of @inst that have no
+ * value, like virNWFilterDetermineMissingVarsRec does for a filter tree.
+ */
+static int
+virNWFilterInstDetermineMissingVars(virNWFilterInstPtr inst,
+                                    virNWFilterHashTablePtr missing_vars)
+{
+    size_t i, j;
+
+    for (i = 0; i < inst->nrules; i++) {
+        virNWFilterRuleInstPtr ruleinst = inst->rules[i];
+        virNWFilterRuleDefPtr rule = ruleinst->def;
+
+        for (j = 0; j < rule->nVarAccess; j++) {
+            if (!virNWFilterVarAccessIsAvailable(rule->varAccess[j],
+                                                 ruleinst->vars) &&
+                virNWFilterAddMissingVar(rule->varAccess[j],
+                                         missing_vars) < 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+virNWFilterVarNameSorter(const virHashKeyValuePair *a,
+                         const virHashKeyValuePair *b)
+{
+    return strcmp(a->key, b->key);
+}
+
+
+/**
+ * virNWFilterInstDigest:
+ * @techdriver: The driver the rules are instantiated with
+ * @inst: The instantiated rules
+ *
+ * Returns a digest identifying the firewall rules that instantiating
+ * @inst results in, or NULL on error with error reported.
+ */
+static char *
+virNWFilterInstDigest(virNWFilterTechDriverPtr techdriver,
+                      virNWFilterInstPtr inst)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virHashKeyValuePairPtr items = NULL;
+    char *content = NULL;
+    char *digest = NULL;
+    size_t i, j, k;
+
+    virBufferAsprintf(&buf, "%s\n", techdriver->name);
+
+    for (i = 0; i < inst->nrules; i++) {
+        virNWFilterRuleInstPtr rule = inst->rules[i];
+
+        virBufferAsprintf(&buf, "%s %d %d\n",
+                          rule->chainSuffix, rule->chainPriority,
+                          rule->priority);
+        if (virNWFilterRuleDefFormat(&buf, rule->def) < 0)
+            goto cleanup;
+
+        if (!(items = virHashGetItems(rule->vars->hashTable,
+                                      virNWFilterVarNameSorter)))
+            goto cleanup;
+
+        for (j = 0; items[j].key; j++) {
+            const virNWFilterVarValue *value = items[j].value;
+            unsigned int card = virNWFilterVarValueGetCardinality(value);
+
+            virBufferAsprintf(&buf, "%s=", (const char *)items[j].key);
+            for (k = 0; k < card; k++)
+                virBufferAsprintf(&buf, "%s%s", k ? "," : "",
+                                  virNWFilterVarValueGetNthValue(value, k));
+            virBufferAddLit(&buf, "\n");
+        }
+        VIR_FREE(items);
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+
+    content = virBufferContentAndReset(&buf);
+    if (virCryptoHashString(VIR_CRYPTO_HASH_SHA256, content, &digest) < 0)
+        goto cleanup;
+
+ cleanup:
+    VIR_FREE(items);
+    VIR_FREE(content);
+    virBufferFreeAndReset(&buf);
+    return digest;
+}
+
+
+/*
+ * Returns true if @digest identifies the rules already active on
+ * @ifname.
+ */
+static bool
+virNWFilterIfaceRulesUnchanged(const char *ifname,
+                               const char *digest)
+{
+    virNWFilterIfaceRulesPtr rules;
+    bool ret = false;
+
+    virMutexLock(&ifaceRulesLock);
+    if ((rules = virHashLookup(ifaceRules, ifname)) &&
+        STREQ_NULLABLE(rules->active, digest))
+        ret = true;
+    virMutexUnlock(&ifaceRulesLock);
+
+    return ret;
+}
+
+
+/*
+ * Record that the rules identified by @digest were applied to @ifname;
+ * they take effect right away if @active is true, otherwise only once
+ * virNWFilterIfaceRulesSwitchOver is called. On error the interface
+ * is forgotten about so that it will not be skipped on updates.
+ */
+static void
+virNWFilterIfaceRulesSet(const char *ifname,
+                         char **digest,
+                         bool active)
+{
+    virNWFilterIfaceRulesPtr rules;
+
+    virMutexLock(&ifaceRulesLock);
+
+    if (!(rules = virHashLookup(ifaceRules, ifname))) {
+        if (VIR_ALLOC(rules) < 0 ||
+            virHashAddEntry(ifaceRules, ifname, rules) < 0) {
+            virNWFilterIfaceRulesFree(rules, NULL);
+            virResetLastError();
+            goto cleanup;
+        }
+    }
+
+    if (active) {
+        VIR_FREE(rules->pending);
+        VIR_FREE(rules->active);
+        VIR_STEAL_PTR(rules->active, *digest);
+    } else {
+        VIR_FREE(rules->pending);
+        VIR_STEAL_PTR(rules->pending, *digest);
+    }
+
+ cleanup:
+    virMutexUnlock(&ifaceRulesLock);
+}
+
+
+/*
+ * Make the pending rules of @ifname the active ones if @commit is true,
+ * otherwise drop them.
+ */
+static void
+virNWFilterIfaceRulesSwitchOver(const char *ifname,
+                                bool commit)
+{
+    virNWFilterIfaceRulesPtr rules;
+
+    virMutexLock(&ifaceRulesLock);
+    if ((rules = virHashLookup(ifaceRules, ifname)) && rules->pending) {
+        if (commit) {
+            VIR_FREE(rules->active);
+            VIR_STEAL_PTR(rules->active, rules->pending);
+        } else {
+            VIR_FREE(rules->pending);
+        }
+    }
+    virMutexUnlock(&ifaceRulesLock);
+}
+
+
+static void
+virNWFilterIfaceRulesRemove(const char *ifname)
+{
+    virMutexLock(&ifaceRulesLock);
+    virHashRemoveEntry(ifaceRules, ifname);
+    virMutexUnlock(&ifaceRulesLock);
+}
+
+
 /**
  * virNWFilterInstantiate:
  * @vmuuid: The UUID of the VM
@@ -637,6 +1150,7 @@ virNWFilterInstantiate(const unsigned char *vmuuid ATTRIBUTE_UNUSED,
     virNWFilterInst inst;
     bool instantiate = true;
     char *buf;
+    char *digest = NULL;
     virNWFilterVarValuePtr lv;
     const char *learning;
     bool reportIP = false;
@@ -650,11 +1164,20 @@ virNWFilterInstantiate(const unsigned char *vmuuid ATTRIBUTE_UNUSED,
         goto err_exit;
     }
 
-    rc = virNWFilterDetermineMissingVarsRec(filter,
-                                            vars,
-                                            missing_vars,
-                                            useNewFilter,
-                                            driver);
+    switch (useNewFilter) {
+    case INSTANTIATE_FOLLOW_NEWFILTER:
+        rc = virNWFilterDetermineMissingVarsRec(filter,
+                                                vars,
+                                                missing_vars,
+                                                useNewFilter,
+                                                driver);
+        break;
+    case INSTANTIATE_ALWAYS:
+        rc = virNWFilterInstTmplToInst(driver, filter, vars, &inst);
+        if (rc == 0)
+            rc = virNWFilterInstDetermineMissingVars(&inst, missing_vars);
+        break;
+    }
     if (rc < 0)
         goto err_exit;
 
@@ -670,6 +1193,8 @@ virNWFilterInstantiate(const unsigned char *vmuuid ATTRIBUTE_UNUSED,
     if (virHashSize(missing_vars->hashTable) == 1) {
         if (virHashLookup(missing_vars->hashTable,
                           NWFILTER_STD_VAR_IP) != NULL) {
+            /* the rules of the interface are now up to address learning */
+            virNWFilterIfaceRulesRemove(ifname);
             if (STRCASEEQ(learning, "none")) {        /* no learning */
                 reportIP = true;
                 goto err_unresolvable_vars;
@@ -709,24 +1234,40 @@ virNWFilterInstantiate(const unsigned char *vmuuid ATTRIBUTE_UNUSED,
         goto err_exit;
     }
 
-    rc = virNWFilterDefToInst(driver,
-                              filter,
-                              vars,
-                              useNewFilter, foundNewFilter,
-                              &inst);
-
-    if (rc < 0)
-        goto err_exit;
-
     switch (useNewFilter) {
     case INSTANTIATE_FOLLOW_NEWFILTER:
+        rc = virNWFilterDefToInst(driver,
+                                  filter,
+                                  vars,
+                                  useNewFilter, foundNewFilter,
+                                  &inst);
         instantiate = *foundNewFilter;
         break;
     case INSTANTIATE_ALWAYS:
+        /* already expanded along with the missing variables */
         instantiate = true;
         break;
     }
 
+    if (rc < 0)
+        goto err_exit;
+
+    if (instantiate) {
+        if (!(digest = virNWFilterInstDigest(techdriver, &inst))) {
+            rc = -1;
+            goto err_exit;
+        }
+
+        if (useNewFilter == INSTANTIATE_FOLLOW_NEWFILTER &&
+            virNWFilterIfaceRulesUnchanged(ifname, digest)) {
+            VIR_DEBUG("Rules on interface %s unaffected by filter update",
+                      ifname);
+            /* have the caller skip this interface when switching over */
+            *foundNewFilter = false;
+            instantiate = false;
+        }
+    }
+
     if (instantiate) {
         if (virNWFilterLockIface(ifname) < 0)
             goto err_exit;
@@ -743,10 +1284,16 @@ virNWFilterInstantiate(const unsigned char *vmuuid ATTRIBUTE_UNUSED,
             rc = -1;
         }
 
+        if (rc == 0)
+            virNWFilterIfaceRulesSet(ifname, &digest, teardownOld);
+        else
+            virNWFilterIfaceRulesRemove(ifname);
+
         virNWFilterUnlockIface(ifname);
     }
 
  err_exit:
+    VIR_FREE(digest);
     virNWFilterInstReset(&inst);
     virNWFilterHashTableFree(missing_vars);
 
@@ -785,7 +1332,7 @@ __virNWFilterInstantiateFilter(virNWFilterDriverStatePtr driver,
                                bool *foundNewFilter)
 {
     int rc;
-    const char *drvname = EBIPTABLES_DRIVER_ID;
+    const char *drvname = virNWFilterTechDriverDefaultName();
     virNWFilterTechDriverPtr techdriver;
     virNWFilterObjPtr obj;
     virNWFilterHashTablePtr vars, vars1;
@@ -1016,7 +1563,7 @@ virNWFilterUpdateInstantiateFilter(virNWFilterDriverStatePtr driver,
 static int
 virNWFilterRollbackUpdateFilter(const virDomainNetDef *net)
 {
-    const char *drvname = EBIPTABLES_DRIVER_ID;
+    const char *drvname = virNWFilterTechDriverDefaultName();
     int ifindex;
     virNWFilterTechDriverPtr techdriver;
 
@@ -1035,6 +1582,8 @@ virNWFilterRollbackUpdateFilter(const virDomainNetDef *net)
     else if (virNWFilterLookupLearnReq(ifindex) != NULL)
         return 0;
 
+    virNWFilterIfaceRulesSwitchOver(net->ifname, false);
+
     return techdriver->tearNewRules(net->ifname);
 }
 
@@ -1042,7 +1591,7 @@ virNWFilterRollbackUpdateFilter(const virDomainNetDef *net)
 static int
 virNWFilterTearOldFilter(virDomainNetDefPtr net)
 {
-    const char *drvname = EBIPTABLES_DRIVER_ID;
+    const char *drvname = virNWFilterTechDriverDefaultName();
     int ifindex;
     virNWFilterTechDriverPtr techdriver;
 
@@ -1061,6 +1610,8 @@ virNWFilterTearOldFilter(virDomainNetDefPtr net)
     else if (virNWFilterLookupLearnReq(ifindex) != NULL)
         return 0;
 
+    virNWFilterIfaceRulesSwitchOver(net->ifname, true);
+
     return techdriver->tearOldRules(net->ifname);
 }
 
@@ -1068,7 +1619,7 @@ virNWFilterTearOldFilter(virDomainNetDefPtr net)
 static int
 _virNWFilterTeardownFilter(const char *ifname)
 {
-    const char *drvname = EBIPTABLES_DRIVER_ID;
+    const char *drvname = virNWFilterTechDriverDefaultName();
     virNWFilterTechDriverPtr techdriver;
     techdriver = virNWFilterTechDriverForName(drvname);
 
@@ -1089,6 +1640,8 @@ _virNWFilterTeardownFilter(const char *ifname)
 
     techdriver->allTeardown(ifname);
 
+    virNWFilterIfaceRulesRemove(ifname);
+
     virNWFilterIPAddrMapDelIPAddr(ifname, NULL);
 
     virNWFilterUnlockIface(ifname);
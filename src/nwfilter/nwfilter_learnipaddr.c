@@ -25,10 +25,6 @@
 
 #include <config.h>
 
-#ifdef HAVE_LIBPCAP
-# include <pcap.h>
-#endif
-
 #include <fcntl.h>
 #include <sys/ioctl.h>
 
@@ -48,12 +44,14 @@
 #include "virnetdev.h"
 #include "virerror.h"
 #include "virthread.h"
+#include "virthreadpool.h"
 #include "conf/nwfilter_params.h"
 #include "conf/domain_conf.h"
 #include "nwfilter_gentech_driver.h"
 #include "nwfilter_ebiptables_driver.h"
 #include "nwfilter_ipaddrmap.h"
 #include "nwfilter_learnipaddr.h"
+#include "nwfilter_capture.h"
 #include "virstring.h"
 
 #define VIR_FROM_THIS VIR_FROM_NWFILTER
@@ -64,7 +62,8 @@ VIR_LOG_INIT("nwfilter.nwfilter_learnipaddr");
     char VARNAME[INT_BUFSIZE_BOUND(ifindex)]; \
     snprintf(VARNAME, sizeof(VARNAME), "%d", ifindex);
 
-#define PKT_TIMEOUT_MS 500 /* ms */
+#define LEARN_TERMINATE_WAIT_MS 100 /* ms */
+#define LEARN_MAX_WORKERS 4
 
 /* structure of an ARP request/reply message */
 struct f_arphdr {
@@ -119,8 +118,13 @@ struct ether_vlan_header
 } ATTRIBUTE_PACKED;
 
 
+/* protects pendingLearnReq, nLearnReqs, threadsTerminate and the refs,
+ * dhcpWatch, staticWatch, finished, status, vmaddr and showError
+ * members of the requests */
 static virMutex pendingLearnReqLock = VIR_MUTEX_INITIALIZER;
 static virHashTablePtr pendingLearnReq;
+/* requests that have been registered and not freed yet */
+static size_t nLearnReqs;
 
 static virMutex ifaceMapLock = VIR_MUTEX_INITIALIZER;
 static virHashTablePtr ifaceLockMap;
@@ -136,6 +140,22 @@ struct _virNWFilterIfaceLock {
 
 static bool threadsTerminate;
 
+#ifdef WITH_NWFILTER_CAPTURE
+static virThreadPoolPtr learnPool;
+
+typedef enum {
+    LEARN_JOB_START,
+    LEARN_JOB_FINISH,
+} virNWFilterLearnJobType;
+
+typedef struct _virNWFilterLearnJob virNWFilterLearnJob;
+typedef virNWFilterLearnJob *virNWFilterLearnJobPtr;
+struct _virNWFilterLearnJob {
+    virNWFilterLearnJobType type;
+    virNWFilterIPAddrLearnReqPtr req; /* holds a reference */
+};
+#endif
+
 
 int
 virNWFilterLockIface(const char *ifname)
@@ -222,7 +242,24 @@ virNWFilterIPAddrLearnReqFree(virNWFilterIPAddrLearnReqPtr req)
 }
 
 
-#if HAVE_LIBPCAP
+
+static void
+virNWFilterIPAddrLearnReqUnref(virNWFilterIPAddrLearnReqPtr req)
+{
+    bool last;
+
+    virMutexLock(&pendingLearnReqLock);
+    last = --req->refs == 0;
+    if (last)
+        nLearnReqs--;
+    virMutexUnlock(&pendingLearnReqLock);
+
+    if (last)
+        virNWFilterIPAddrLearnReqFree(req);
+}
+
+
+#ifdef WITH_NWFILTER_CAPTURE
 
 static int
 virNWFilterRegisterLearnReq(virNWFilterIPAddrLearnReqPtr req)
@@ -235,6 +272,9 @@ virNWFilterRegisterLearnReq(virNWFilterIPAddrLearnReqPtr req)
     if (!virHashLookup(pendingLearnReq, ifindex_str))
         res = virHashAddEntry(pendingLearnReq, ifindex_str, req);
 
+    if (res == 0)
+        nLearnReqs++;
+
     virMutexUnlock(&pendingLearnReqLock);
 
     return res;
@@ -243,6 +283,72 @@ virNWFilterRegisterLearnReq(virNWFilterIPAddrLearnReqPtr req)
 
 #endif
 
+/*
+ * Remove the request from the pending ones and drop the reference the
+ * hash table held; a no-op if it was removed already.
+ */
+static void
+virNWFilterDeregisterLearnReq(virNWFilterIPAddrLearnReqPtr req)
+{
+    bool found;
+    IFINDEX2STR(ifindex_str, req->ifindex);
+
+    virMutexLock(&pendingLearnReqLock);
+
+    found = virHashLookup(pendingLearnReq, ifindex_str) == req;
+    if (found)
+        virHashSteal(pendingLearnReq, ifindex_str);
+
+    virMutexUnlock(&pendingLearnReqLock);
+
+    if (found)
+        virNWFilterIPAddrLearnReqUnref(req);
+}
+
+
+/*
+ * Stop learning on the interface of the request unless an address
+ * was already found or learning failed. Drops all traffic on the
+ * interface before returning, the way it used to be when learning
+ * was cancelled.
+ */
+static void
+virNWFilterIPAddrLearnReqCancel(virNWFilterIPAddrLearnReqPtr req)
+{
+    int dhcpWatch, staticWatch;
+
+    virMutexLock(&pendingLearnReqLock);
+
+    if (req->finished) {
+        /* the finishing job takes care of the request */
+        virMutexUnlock(&pendingLearnReqLock);
+        return;
+    }
+
+    req->finished = true;
+    req->status = ECANCELED;
+    dhcpWatch = req->dhcpWatch;
+    staticWatch = req->staticWatch;
+    req->dhcpWatch = req->staticWatch = -1;
+
+    virMutexUnlock(&pendingLearnReqLock);
+
+    if (dhcpWatch >= 0)
+        virNWFilterCaptureRemove(dhcpWatch);
+    if (staticWatch >= 0)
+        virNWFilterCaptureRemove(staticWatch);
+
+    if (virNWFilterLockIface(req->ifname) == 0) {
+        req->techdriver->applyDropAllRules(req->ifname);
+        virNWFilterUnlockIface(req->ifname);
+    }
+
+    VIR_DEBUG("IP address learning cancelled for interface %s", req->ifname);
+
+    virNWFilterDeregisterLearnReq(req);
+}
+
+
 int
 virNWFilterTerminateLearnReq(const char *ifname)
 {
@@ -251,7 +357,7 @@ virNWFilterTerminateLearnReq(const char *ifname)
     virNWFilterIPAddrLearnReqPtr req;
 
     /* It's possible that it's already been removed as a result of
-     * virNWFilterDeregisterLearnReq during learnIPAddressThread() exit
+     * virNWFilterDeregisterLearnReq once learning was done
      */
     if (virNetDevExists(ifname) != 1) {
         virResetLastError();
@@ -270,11 +376,16 @@ virNWFilterTerminateLearnReq(const char *ifname)
     req = virHashLookup(pendingLearnReq, ifindex_str);
     if (req) {
         rc = 0;
-        req->terminate = true;
+        req->refs++;
     }
 
     virMutexUnlock(&pendingLearnReqLock);
 
+    if (req) {
+        virNWFilterIPAddrLearnReqCancel(req);
+        virNWFilterIPAddrLearnReqUnref(req);
+    }
+
     return rc;
 }
 
@@ -295,33 +406,7 @@ virNWFilterLookupLearnReq(int ifindex)
 }
 
 
-static void
-freeLearnReqEntry(void *payload, const void *name ATTRIBUTE_UNUSED)
-{
-    virNWFilterIPAddrLearnReqFree(payload);
-}
-
-
-#ifdef HAVE_LIBPCAP
-
-static virNWFilterIPAddrLearnReqPtr
-virNWFilterDeregisterLearnReq(int ifindex)
-{
-    virNWFilterIPAddrLearnReqPtr res;
-    IFINDEX2STR(ifindex_str, ifindex);
-
-    virMutexLock(&pendingLearnReqLock);
-
-    res = virHashSteal(pendingLearnReq, ifindex_str);
-
-    virMutexUnlock(&pendingLearnReqLock);
-
-    return res;
-}
-
-#endif
-
-#ifdef HAVE_LIBPCAP
+#ifdef WITH_NWFILTER_CAPTURE
 
 static void
 procDHCPOpts(struct dhcp *dhcp, int dhcp_opts_len,
@@ -362,264 +447,383 @@ procDHCPOpts(struct dhcp *dhcp, int dhcp_opts_len,
 
 
 /**
- * learnIPAddressThread
- * arg: pointer to virNWFilterIPAddrLearnReq structure
+ * learnIPAddressFromPacket
+ * @req: the learning request
+ * @packet: the captured frame
+ * @len: the captured length of the frame
  *
- * Learn the IP address being used on an interface. Use ARP Request and
- * Reply messages, DHCP offers and the first IP packet being sent from
- * the VM to detect the IP address it is using. Detects only one IP address
- * per interface (IP aliasing not supported). The method on how the
- * IP address is detected can be chosen through flags. DETECT_DHCP will
- * require that the IP address is detected from a DHCP OFFER, DETECT_STATIC
- * will require that the IP address was taken from an ARP packet or an IPv4
- * packet. Both flags can be set at the same time.
+ * Use ARP Request and Reply messages, DHCP offers and the first IP packet
+ * being sent from the VM to detect the IP address it is using. The method
+ * on how the IP address is detected can be chosen through flags.
+ * DETECT_DHCP will require that the IP address is detected from a DHCP
+ * OFFER, DETECT_STATIC will require that the IP address was taken from an
+ * ARP packet or an IPv4 packet. Both flags can be set at the same time.
+ *
+ * Returns the detected address in network byte order or 0 if the frame
+ * did not reveal it.
  */
-static void
-learnIPAddressThread(void *arg)
+static uint32_t
+learnIPAddressFromPacket(virNWFilterIPAddrLearnReqPtr req,
+                         const unsigned char *packet,
+                         size_t len)
 {
-    char errbuf[PCAP_ERRBUF_SIZE] = {0};
-    pcap_t *handle = NULL;
-    struct bpf_program fp;
-    struct pcap_pkthdr header;
-    const u_char *packet;
     struct ether_header *ether_hdr;
     struct ether_vlan_header *vlan_hdr;
-    virNWFilterIPAddrLearnReqPtr req = arg;
     uint32_t vmaddr = 0, bcastaddr = 0;
     unsigned int ethHdrSize;
-    char *listen_if = (strlen(req->linkdev) != 0) ? req->linkdev
-                                                  : req->ifname;
     int dhcp_opts_len;
-    char macaddr[VIR_MAC_STRING_BUFLEN];
-    virBuffer buf = VIR_BUFFER_INITIALIZER;
-    char *filter = NULL;
     uint16_t etherType;
-    bool showError = true;
     enum howDetect howDetected = 0;
-    virNWFilterTechDriverPtr techdriver = req->techdriver;
 
-    if (virNWFilterLockIface(req->ifname) < 0)
-       goto err_no_lock;
+    if (len < sizeof(struct ether_header))
+        return 0;
+
+    ether_hdr = (struct ether_header*)packet;
 
-    req->status = 0;
+    switch (ntohs(ether_hdr->ether_type)) {
 
-    /* anything change to the VM's interface -- check at least once */
-    if (virNetDevValidateConfig(req->ifname, NULL, req->ifindex) <= 0) {
-        virResetLastError();
-        req->status = ENODEV;
-        goto done;
-    }
+    case ETHERTYPE_IP:
+        ethHdrSize = sizeof(struct ether_header);
+        etherType = ntohs(ether_hdr->ether_type);
+        break;
 
-    handle = pcap_open_live(listen_if, BUFSIZ, 0, PKT_TIMEOUT_MS, errbuf);
+    case ETHERTYPE_VLAN:
+        ethHdrSize = sizeof(struct ether_vlan_header);
+        vlan_hdr = (struct ether_vlan_header *)packet;
+        if (ntohs(vlan_hdr->ether_type) != ETHERTYPE_IP ||
+            len < ethHdrSize)
+            return 0;
+        etherType = ntohs(vlan_hdr->ether_type);
+        break;
 
-    if (handle == NULL) {
-        VIR_DEBUG("Couldn't open device %s: %s", listen_if, errbuf);
-        req->status = ENODEV;
-        goto done;
+    default:
+        return 0;
     }
 
-    virMacAddrFormat(&req->macaddr, macaddr);
-
-    switch (req->howDetect) {
-    case DETECT_DHCP:
-        if (techdriver->applyDHCPOnlyRules(req->ifname,
-                                           &req->macaddr,
-                                           NULL, false) < 0) {
-            req->status = EINVAL;
-            goto done;
+    if (virMacAddrCmpRaw(&req->macaddr, ether_hdr->ether_shost) == 0) {
+        /* packets from the VM */
+
+        if (etherType == ETHERTYPE_IP &&
+            (len >= ethHdrSize + sizeof(struct iphdr))) {
+            VIR_WARNINGS_NO_CAST_ALIGN
+            struct iphdr *iphdr = (struct iphdr*)(packet + ethHdrSize);
+            VIR_WARNINGS_RESET
+            vmaddr = iphdr->saddr;
+            /* skip mcast addresses (224.0.0.0 - 239.255.255.255),
+             * class E (240.0.0.0 - 255.255.255.255, includes eth.
+             * bcast) and zero address in DHCP Requests */
+            if ((ntohl(vmaddr) & 0xe0000000) == 0xe0000000 ||
+                vmaddr == 0)
+                return 0;
+
+            howDetected = DETECT_STATIC;
+        } else if (etherType == ETHERTYPE_ARP &&
+                   (len >= ethHdrSize + sizeof(struct f_arphdr))) {
+            VIR_WARNINGS_NO_CAST_ALIGN
+            struct f_arphdr *arphdr = (struct f_arphdr*)(packet +
+                                                         ethHdrSize);
+            VIR_WARNINGS_RESET
+            switch (ntohs(arphdr->arphdr.ar_op)) {
+            case ARPOP_REPLY:
+                vmaddr = arphdr->ar_sip;
+                howDetected = DETECT_STATIC;
+            break;
+            case ARPOP_REQUEST:
+                vmaddr = arphdr->ar_tip;
+                howDetected = DETECT_STATIC;
+            break;
+            }
         }
-        virBufferAddLit(&buf, "src port 67 and dst port 68");
-        break;
-    default:
-        if (techdriver->applyBasicRules(req->ifname,
-                                        &req->macaddr) < 0) {
-            req->status = EINVAL;
-            goto done;
+    } else if (virMacAddrCmpRaw(&req->macaddr,
+                                ether_hdr->ether_dhost) == 0 ||
+               /* allow Broadcast replies from DHCP server */
+               virMacAddrIsBroadcastRaw(ether_hdr->ether_dhost)) {
+        /* packets to the VM */
+        if (etherType == ETHERTYPE_IP &&
+            (len >= ethHdrSize + sizeof(struct iphdr))) {
+            VIR_WARNINGS_NO_CAST_ALIGN
+            struct iphdr *iphdr = (struct iphdr*)(packet + ethHdrSize);
+            VIR_WARNINGS_RESET
+            if ((iphdr->protocol == IPPROTO_UDP) &&
+                (len >= ethHdrSize +
+                        iphdr->ihl * 4 +
+                        sizeof(struct udphdr))) {
+                VIR_WARNINGS_NO_CAST_ALIGN
+                struct udphdr *udphdr = (struct udphdr *)
+                                  ((char *)iphdr + iphdr->ihl * 4);
+                VIR_WARNINGS_RESET
+                if (ntohs(udphdr->source) == 67 &&
+                    ntohs(udphdr->dest)   == 68 &&
+                    len >= ethHdrSize +
+                           iphdr->ihl * 4 +
+                           sizeof(struct udphdr) +
+                           sizeof(struct dhcp)) {
+                    struct dhcp *dhcp = (struct dhcp *)
+                                ((char *)udphdr + sizeof(udphdr));
+                    if (dhcp->op == 2 /* BOOTREPLY */ &&
+                        virMacAddrCmpRaw(&req->macaddr,
+                                         &dhcp->chaddr[0]) == 0) {
+                        dhcp_opts_len = len -
+                            (ethHdrSize + iphdr->ihl * 4 +
+                             sizeof(struct udphdr) +
+                             sizeof(struct dhcp));
+                        procDHCPOpts(dhcp, dhcp_opts_len,
+                                     &vmaddr,
+                                     &bcastaddr,
+                                     &howDetected);
+                    }
+                }
+            }
         }
-        virBufferAsprintf(&buf, "ether host %s or ether dst ff:ff:ff:ff:ff:ff",
-                          macaddr);
     }
 
-    if (virBufferError(&buf)) {
-        req->status = ENOMEM;
-        goto done;
+    if ((req->howDetect & howDetected) == 0)
+        return 0;
+
+    return vmaddr;
+}
+
+
+static int
+learnIPAddressJobSubmit(virNWFilterLearnJobType type,
+                        virNWFilterIPAddrLearnReqPtr req)
+{
+    virNWFilterLearnJobPtr job;
+
+    if (VIR_ALLOC(job) < 0)
+        return -1;
+
+    job->type = type;
+    job->req = req;
+
+    virMutexLock(&pendingLearnReqLock);
+    req->refs++;
+    virMutexUnlock(&pendingLearnReqLock);
+
+    if (virThreadPoolSendJob(learnPool, 0, job) < 0) {
+        virNWFilterIPAddrLearnReqUnref(req);
+        VIR_FREE(job);
+        return -1;
     }
 
-    filter = virBufferContentAndReset(&buf);
+    return 0;
+}
 
-    if (pcap_compile(handle, &fp, filter, 1, 0) != 0) {
-        VIR_DEBUG("Couldn't compile filter '%s'", filter);
-        req->status = EINVAL;
-        goto done;
+
+/*
+ * Record the outcome of learning, stop capturing and have a worker
+ * apply the rules. Only the first outcome counts.
+ */
+static void
+learnIPAddressDone(virNWFilterIPAddrLearnReqPtr req,
+                   int status,
+                   uint32_t vmaddr,
+                   bool showError)
+{
+    int dhcpWatch, staticWatch;
+
+    virMutexLock(&pendingLearnReqLock);
+
+    if (req->finished) {
+        virMutexUnlock(&pendingLearnReqLock);
+        return;
     }
 
-    if (pcap_setfilter(handle, &fp) != 0) {
-        VIR_DEBUG("Couldn't set filter '%s'", filter);
-        req->status = EINVAL;
-        pcap_freecode(&fp);
-        goto done;
+    req->finished = true;
+    req->status = status;
+    req->vmaddr = vmaddr;
+    req->showError = showError;
+    dhcpWatch = req->dhcpWatch;
+    staticWatch = req->staticWatch;
+    req->dhcpWatch = req->staticWatch = -1;
+
+    virMutexUnlock(&pendingLearnReqLock);
+
+    if (dhcpWatch >= 0)
+        virNWFilterCaptureRemove(dhcpWatch);
+    if (staticWatch >= 0)
+        virNWFilterCaptureRemove(staticWatch);
+
+    if (learnIPAddressJobSubmit(LEARN_JOB_FINISH, req) < 0)
+        virNWFilterDeregisterLearnReq(req);
+}
+
+
+static void
+learnIPAddressCapture(int watch ATTRIBUTE_UNUSED,
+                      const unsigned char *packet,
+                      size_t len,
+                      bool outgoing ATTRIBUTE_UNUSED,
+                      void *opaque)
+{
+    virNWFilterIPAddrLearnReqPtr req = opaque;
+    uint32_t vmaddr;
+
+    /* VM's dev is gone */
+    if (!packet) {
+        learnIPAddressDone(req, ENODEV, 0, false);
+        return;
     }
 
-    pcap_freecode(&fp);
+    if ((vmaddr = learnIPAddressFromPacket(req, packet, len)) == 0)
+        return;
 
-    while (req->status == 0 && vmaddr == 0) {
-        packet = pcap_next(handle, &header);
+    learnIPAddressDone(req, 0, vmaddr, true);
+}
 
-        if (!packet) {
 
-            if (threadsTerminate || req->terminate) {
-                req->status = ECANCELED;
-                showError = false;
-                break;
-            }
+static void
+learnIPAddressCaptureFree(void *opaque)
+{
+    virNWFilterIPAddrLearnReqUnref(opaque);
+}
 
-            /* check whether VM's dev is still there */
-            if (virNetDevValidateConfig(req->ifname, NULL, req->ifindex) <= 0) {
-                virResetLastError();
-                req->status = ENODEV;
-                showError = false;
-                break;
-            }
-            continue;
-        }
 
-        if (header.len >= sizeof(struct ether_header)) {
-            ether_hdr = (struct ether_header*)packet;
+static int
+learnIPAddressWatch(virNWFilterIPAddrLearnReqPtr req,
+                    virNWFilterCaptureType type,
+                    const char *listen_if,
+                    int listen_ifindex)
+{
+    int watch;
 
-            switch (ntohs(ether_hdr->ether_type)) {
+    virMutexLock(&pendingLearnReqLock);
+    req->refs++;
+    virMutexUnlock(&pendingLearnReqLock);
 
-            case ETHERTYPE_IP:
-                ethHdrSize = sizeof(struct ether_header);
-                etherType = ntohs(ether_hdr->ether_type);
-                break;
+    watch = virNWFilterCaptureAdd(type, listen_if, listen_ifindex,
+                                  type == VIR_NWFILTER_CAPTURE_MAC ?
+                                  &req->macaddr : NULL,
+                                  learnIPAddressCapture, req,
+                                  learnIPAddressCaptureFree);
+    if (watch < 0)
+        virNWFilterIPAddrLearnReqUnref(req);
 
-            case ETHERTYPE_VLAN:
-                ethHdrSize = sizeof(struct ether_vlan_header);
-                vlan_hdr = (struct ether_vlan_header *)packet;
-                if (ntohs(vlan_hdr->ether_type) != ETHERTYPE_IP ||
-                    header.len < ethHdrSize)
-                    continue;
-                etherType = ntohs(vlan_hdr->ether_type);
-                break;
+    return watch;
+}
 
-            default:
-                continue;
-            }
 
-            if (virMacAddrCmpRaw(&req->macaddr, ether_hdr->ether_shost) == 0) {
-                /* packets from the VM */
-
-                if (etherType == ETHERTYPE_IP &&
-                    (header.len >= ethHdrSize +
-                                   sizeof(struct iphdr))) {
-                    VIR_WARNINGS_NO_CAST_ALIGN
-                    struct iphdr *iphdr = (struct iphdr*)(packet +
-                                                          ethHdrSize);
-                    VIR_WARNINGS_RESET
-                    vmaddr = iphdr->saddr;
-                    /* skip mcast addresses (224.0.0.0 - 239.255.255.255),
-                     * class E (240.0.0.0 - 255.255.255.255, includes eth.
-                     * bcast) and zero address in DHCP Requests */
-                    if ((ntohl(vmaddr) & 0xe0000000) == 0xe0000000 ||
-                        vmaddr == 0) {
-                        vmaddr = 0;
-                        continue;
-                    }
+/*
+ * Apply the rules that let the traffic needed for learning through and
+ * start capturing it on the interface (or link device).
+ */
+static void
+learnIPAddressStart(virNWFilterIPAddrLearnReqPtr req)
+{
+    const char *listen_if = (strlen(req->linkdev) != 0) ? req->linkdev
+                                                        : req->ifname;
+    int listen_ifindex = req->ifindex;
+    int dhcpWatch = -1, staticWatch = -1;
+    int status = 0;
+    bool finished, terminate;
+    virNWFilterTechDriverPtr techdriver = req->techdriver;
 
-                    howDetected = DETECT_STATIC;
-                } else if (etherType == ETHERTYPE_ARP &&
-                           (header.len >= ethHdrSize +
-                                          sizeof(struct f_arphdr))) {
-                    VIR_WARNINGS_NO_CAST_ALIGN
-                    struct f_arphdr *arphdr = (struct f_arphdr*)(packet +
-                                                         ethHdrSize);
-                    VIR_WARNINGS_RESET
-                    switch (ntohs(arphdr->arphdr.ar_op)) {
-                    case ARPOP_REPLY:
-                        vmaddr = arphdr->ar_sip;
-                        howDetected = DETECT_STATIC;
-                    break;
-                    case ARPOP_REQUEST:
-                        vmaddr = arphdr->ar_tip;
-                        howDetected = DETECT_STATIC;
-                    break;
-                    }
-                }
-            } else if (virMacAddrCmpRaw(&req->macaddr,
-                                        ether_hdr->ether_dhost) == 0 ||
-                       /* allow Broadcast replies from DHCP server */
-                       virMacAddrIsBroadcastRaw(ether_hdr->ether_dhost)) {
-                /* packets to the VM */
-                if (etherType == ETHERTYPE_IP &&
-                    (header.len >= ethHdrSize +
-                                   sizeof(struct iphdr))) {
-                    VIR_WARNINGS_NO_CAST_ALIGN
-                    struct iphdr *iphdr = (struct iphdr*)(packet +
-                                                          ethHdrSize);
-                    VIR_WARNINGS_RESET
-                    if ((iphdr->protocol == IPPROTO_UDP) &&
-                        (header.len >= ethHdrSize +
-                                       iphdr->ihl * 4 +
-                                       sizeof(struct udphdr))) {
-                        VIR_WARNINGS_NO_CAST_ALIGN
-                        struct udphdr *udphdr = (struct udphdr *)
-                                          ((char *)iphdr + iphdr->ihl * 4);
-                        VIR_WARNINGS_RESET
-                        if (ntohs(udphdr->source) == 67 &&
-                            ntohs(udphdr->dest)   == 68 &&
-                            header.len >= ethHdrSize +
-                                          iphdr->ihl * 4 +
-                                          sizeof(struct udphdr) +
-                                          sizeof(struct dhcp)) {
-                            struct dhcp *dhcp = (struct dhcp *)
-                                        ((char *)udphdr + sizeof(udphdr));
-                            if (dhcp->op == 2 /* BOOTREPLY */ &&
-                                virMacAddrCmpRaw(
-                                        &req->macaddr,
-                                        &dhcp->chaddr[0]) == 0) {
-                                dhcp_opts_len = header.len -
-                                    (ethHdrSize + iphdr->ihl * 4 +
-                                     sizeof(struct udphdr) +
-                                     sizeof(struct dhcp));
-                                procDHCPOpts(dhcp, dhcp_opts_len,
-                                             &vmaddr,
-                                             &bcastaddr,
-                                             &howDetected);
-                            }
-                        }
-                    }
-                }
-            }
+    if (virNWFilterLockIface(req->ifname) < 0) {
+        learnIPAddressDone(req, ENOMEM, 0, true);
+        return;
+    }
+
+    virMutexLock(&pendingLearnReqLock);
+    finished = req->finished;
+    terminate = threadsTerminate;
+    virMutexUnlock(&pendingLearnReqLock);
+
+    if (finished)
+        goto cleanup;
+
+    /* registered after virNWFilterLearnThreadsTerminate looked */
+    if (terminate) {
+        virNWFilterUnlockIface(req->ifname);
+        learnIPAddressDone(req, ECANCELED, 0, false);
+        return;
+    }
+
+    /* anything change to the VM's interface -- check at least once */
+    if (virNetDevValidateConfig(req->ifname, NULL, req->ifindex) <= 0 ||
+        (listen_if == req->linkdev &&
+         virNetDevGetIndex(listen_if, &listen_ifindex) < 0)) {
+        virResetLastError();
+        status = ENODEV;
+        goto cleanup;
+    }
+
+    switch (req->howDetect) {
+    case DETECT_DHCP:
+        if (techdriver->applyDHCPOnlyRules(req->ifname,
+                                           &req->macaddr,
+                                           NULL, false) < 0) {
+            status = EINVAL;
+            goto cleanup;
         }
-        if (vmaddr && (req->howDetect & howDetected) == 0) {
-            vmaddr = 0;
-            howDetected = 0;
+        break;
+    default:
+        if (techdriver->applyBasicRules(req->ifname,
+                                        &req->macaddr) < 0) {
+            status = EINVAL;
+            goto cleanup;
         }
-    } /* while */
+    }
+
+    /* offers and acks of DHCP servers and the VM's own frames */
+    if ((req->howDetect & DETECT_DHCP) &&
+        (dhcpWatch = learnIPAddressWatch(req, VIR_NWFILTER_CAPTURE_DHCP,
+                                         listen_if, listen_ifindex)) < 0) {
+        virResetLastError();
+        status = ENODEV;
+        goto cleanup;
+    }
+
+    if ((req->howDetect & DETECT_STATIC) &&
+        (staticWatch = learnIPAddressWatch(req, VIR_NWFILTER_CAPTURE_MAC,
+                                           listen_if, listen_ifindex)) < 0) {
+        virResetLastError();
+        status = ENODEV;
+        goto cleanup;
+    }
 
- done:
-    VIR_FREE(filter);
+    virMutexLock(&pendingLearnReqLock);
+    if (!req->finished) {
+        req->dhcpWatch = dhcpWatch;
+        req->staticWatch = staticWatch;
+        dhcpWatch = staticWatch = -1;
+    }
+    virMutexUnlock(&pendingLearnReqLock);
 
-    if (handle)
-        pcap_close(handle);
+ cleanup:
+    virNWFilterUnlockIface(req->ifname);
+
+    /* learning was done before we got here */
+    if (dhcpWatch >= 0)
+        virNWFilterCaptureRemove(dhcpWatch);
+    if (staticWatch >= 0)
+        virNWFilterCaptureRemove(staticWatch);
+
+    if (status != 0)
+        learnIPAddressDone(req, status, 0, true);
+}
+
+
+static void
+learnIPAddressFinish(virNWFilterIPAddrLearnReqPtr req)
+{
+    virNWFilterTechDriverPtr techdriver = req->techdriver;
 
     if (req->status == 0) {
         int ret;
         virSocketAddr sa;
         sa.len = sizeof(sa.data.inet4);
         sa.data.inet4.sin_family = AF_INET;
-        sa.data.inet4.sin_addr.s_addr = vmaddr;
+        sa.data.inet4.sin_addr.s_addr = req->vmaddr;
         char *inetaddr;
 
-        /* It is necessary to unlock interface here to avoid updateMutex and
+        /* The interface is not locked here to avoid updateMutex and
          * interface ordering deadlocks. Otherwise we are going to
          * instantiate the filter, which will try to lock updateMutex, and
          * some other thread instantiating a filter in parallel is holding
          * updateMutex and is trying to lock interface, both will deadlock.
-         * Also it is safe to unlock interface here because we stopped
+         * Also it is safe not to lock the interface here because we stopped
          * capturing and applied necessary rules on the interface, while
          * instantiating a new filter doesn't require a locked interface.*/
-        virNWFilterUnlockIface(req->ifname);
 
         if ((inetaddr = virSocketAddrFormat(&sa)) != NULL) {
             if (virNWFilterIPAddrMapAddIPAddr(req->ifname, inetaddr) < 0) {
@@ -639,23 +843,40 @@ learnIPAddressThread(void *arg)
                       "%s with IP addr %s : %d", req->ifname, inetaddr, ret);
         }
     } else {
-        if (showError)
+        if (req->showError)
             virReportSystemError(req->status,
                                  _("encountered an error on interface %s "
                                    "index %d"),
                                  req->ifname, req->ifindex);
 
-        techdriver->applyDropAllRules(req->ifname);
-        virNWFilterUnlockIface(req->ifname);
+        if (virNWFilterLockIface(req->ifname) == 0) {
+            techdriver->applyDropAllRules(req->ifname);
+            virNWFilterUnlockIface(req->ifname);
+        }
     }
 
-    VIR_DEBUG("pcap thread terminating for interface %s", req->ifname);
+    VIR_DEBUG("IP address learning done for interface %s", req->ifname);
 
+    virNWFilterDeregisterLearnReq(req);
+}
 
- err_no_lock:
-    virNWFilterDeregisterLearnReq(req->ifindex);
 
-    virNWFilterIPAddrLearnReqFree(req);
+static void
+learnIPAddressWorker(void *jobdata, void *opaque ATTRIBUTE_UNUSED)
+{
+    virNWFilterLearnJobPtr job = jobdata;
+
+    switch (job->type) {
+    case LEARN_JOB_START:
+        learnIPAddressStart(job->req);
+        break;
+    case LEARN_JOB_FINISH:
+        learnIPAddressFinish(job->req);
+        break;
+    }
+
+    virNWFilterIPAddrLearnReqUnref(job->req);
+    VIR_FREE(job);
 }
 
 
@@ -670,15 +891,15 @@ learnIPAddressThread(void *arg)
  * @filtername : the name of the top-level filter to apply to the interface
  *               once its IP address has been detected
  * @driver : the network filter driver
- * @howDetect : the method on how the thread is supposed to detect the
- *              IP address; must choose any of the available flags
+ * @howDetect : the method on how to detect the IP address; must choose
+ *              any of the available flags
  *
  * Instruct to learn the IP address being used on a given interface (ifname).
- * Unless there already is a thread attempting to learn the IP address
- * being used on the interface, a thread is started that will listen on
- * the traffic being sent on the interface (or link device) with the
- * MAC address that is provided. Will then launch the application of the
- * firewall rules on the interface.
+ * Unless the IP address being used on the interface is already being
+ * learned, the traffic being sent on the interface (or link device) with
+ * the MAC address that is provided is captured until it reveals the
+ * address. Will then launch the application of the firewall rules on the
+ * interface.
  */
 int
 virNWFilterLearnIPAddress(virNWFilterTechDriverPtr techdriver,
@@ -692,7 +913,6 @@ virNWFilterLearnIPAddress(virNWFilterTechDriverPtr techdriver,
                           enum howDetect howDetect)
 {
     int rc;
-    virThread thread;
     virNWFilterIPAddrLearnReqPtr req = NULL;
     virNWFilterHashTablePtr ht = NULL;
 
@@ -743,22 +963,25 @@ virNWFilterLearnIPAddress(virNWFilterTechDriverPtr techdriver,
     ht = NULL;
     req->howDetect = howDetect;
     req->techdriver = techdriver;
+    req->dhcpWatch = -1;
+    req->staticWatch = -1;
+    /* the reference of the pendingLearnReq hash table */
+    req->refs = 1;
 
     rc = virNWFilterRegisterLearnReq(req);
 
     if (rc < 0)
         goto err_free_req;
 
-    if (virThreadCreate(&thread,
-                        false,
-                        learnIPAddressThread,
-                        req) != 0)
+    if (learnIPAddressJobSubmit(LEARN_JOB_START, req) < 0)
         goto err_dereg_req;
 
     return 0;
 
  err_dereg_req:
-    virNWFilterDeregisterLearnReq(ifindex);
+    /* frees the request */
+    virNWFilterDeregisterLearnReq(req);
+    return -1;
  err_free_ht:
     virNWFilterHashTableFree(ht);
  err_free_req:
@@ -782,11 +1005,11 @@ virNWFilterLearnIPAddress(virNWFilterTechDriverPtr techdriver ATTRIBUTE_UNUSED,
 {
     virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                    _("IP parameter must be given since libvirt "
-                     "was not compiled with IP address learning "
+                     "was not built with IP address learning "
                      "support"));
     return -1;
 }
-#endif /* HAVE_LIBPCAP */
+#endif /* WITH_NWFILTER_CAPTURE */
 
 
 /**
@@ -803,7 +1026,7 @@ virNWFilterLearnInit(void)
     VIR_DEBUG("Initializing IP address learning");
     threadsTerminate = false;
 
-    pendingLearnReq = virHashCreate(0, freeLearnReqEntry);
+    pendingLearnReq = virHashCreate(0, NULL);
     if (!pendingLearnReq)
         return -1;
 
@@ -813,6 +1036,31 @@ virNWFilterLearnInit(void)
         return -1;
     }
 
+#ifdef WITH_NWFILTER_CAPTURE
+    learnPool = virThreadPoolNew(1, LEARN_MAX_WORKERS, 0,
+                                 learnIPAddressWorker, NULL);
+    if (!learnPool) {
+        virNWFilterLearnShutdown();
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+
+static int
+virNWFilterLearnReqCollect(void *payload,
+                           const void *name ATTRIBUTE_UNUSED,
+                           void *data)
+{
+    virNWFilterIPAddrLearnReqPtr req = payload;
+    virNWFilterIPAddrLearnReqPtr **reqs = data;
+
+    req->refs++;
+    **reqs = req;
+    (*reqs)++;
+
     return 0;
 }
 
@@ -820,13 +1068,43 @@ virNWFilterLearnInit(void)
 void
 virNWFilterLearnThreadsTerminate(bool allowNewThreads)
 {
+    virNWFilterIPAddrLearnReqPtr *reqs = NULL;
+    virNWFilterIPAddrLearnReqPtr *next;
+    size_t nreqs = 0;
+    size_t i;
+
+    virMutexLock(&pendingLearnReqLock);
     threadsTerminate = true;
+    if (VIR_ALLOC_N_QUIET(reqs, virHashSize(pendingLearnReq)) == 0) {
+        next = reqs;
+        virHashForEach(pendingLearnReq, virNWFilterLearnReqCollect, &next);
+        nreqs = next - reqs;
+    }
+    virMutexUnlock(&pendingLearnReqLock);
 
-    while (virHashSize(pendingLearnReq) != 0)
-        usleep((PKT_TIMEOUT_MS * 1000) / 3);
+    for (i = 0; i < nreqs; i++) {
+        virNWFilterIPAddrLearnReqCancel(reqs[i]);
+        virNWFilterIPAddrLearnReqUnref(reqs[i]);
+    }
+    VIR_FREE(reqs);
 
-    if (allowNewThreads)
+    /* wait for the jobs still working on the requests */
+    for (;;) {
+        virMutexLock(&pendingLearnReqLock);
+        i = nLearnReqs;
+        virMutexUnlock(&pendingLearnReqLock);
+
+        if (i == 0)
+            break;
+
+        usleep(LEARN_TERMINATE_WAIT_MS * 1000);
+    }
+
+    if (allowNewThreads) {
+        virMutexLock(&pendingLearnReqLock);
         threadsTerminate = false;
+        virMutexUnlock(&pendingLearnReqLock);
+    }
 }
 
 /**
@@ -841,6 +1119,11 @@ virNWFilterLearnShutdown(void)
 
     virNWFilterLearnThreadsTerminate(false);
 
+#ifdef WITH_NWFILTER_CAPTURE
+    virThreadPoolFree(learnPool);
+    learnPool = NULL;
+#endif
+
     virHashFree(pendingLearnReq);
     pendingLearnReq = NULL;
 
@@ -48,8 +48,13 @@ struct _virNWFilterIPAddrLearnReq {
     virNWFilterDriverStatePtr driver;
     enum howDetect howDetect;
 
+    int refs;
+    int dhcpWatch;
+    int staticWatch;
+    bool finished;
+    bool showError;
+    uint32_t vmaddr;
     int status;
-    volatile bool terminate;
 };
 
 int virNWFilterLearnIPAddress(virNWFilterTechDriverPtr techdriver,
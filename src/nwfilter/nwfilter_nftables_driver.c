@@ -0,0 +1,2552 @@
+/*
+ * nwfilter_nftables_driver.c: driver for nftables on tap devices
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * All rules of an interface live in a single table of the 'bridge'
+ * family, which is replaced atomically by a single 'nft -f' run:
+ *
+ *  - chain 'I' holds the layer 2 rules for traffic coming from the VM,
+ *    chain 'O' those for traffic going to the VM; protocol specific
+ *    sub-chains are called 'I-<filtername>' and 'O-<filtername>' as
+ *    the corresponding ebtables chains
+ *  - chains 'FI', 'FO' and 'HI' hold the layer 3 rules and correspond
+ *    to the per-interface iptables chains of the ebiptables driver
+ *
+ * New rules are placed into the table 'libvirt-nwft-<ifname>' first,
+ * tearing down the old rules moves them to 'libvirt-nwf-<ifname>'.
+ * Since nftables cannot rename tables the body of the temporary table
+ * is remembered until then.
+ *
+ * Rules whose variables have multiple values are instantiated once per
+ * combination of values like the other drivers do; combinations that
+ * only differ in the values of some fields are collapsed into a single
+ * rule matching against an anonymous set.
+ */
+
+#include <config.h>
+
+#include "internal.h"
+
+#include "c-ctype.h"
+
+#include "virbuffer.h"
+#include "viralloc.h"
+#include "virlog.h"
+#include "virerror.h"
+#include "virhash.h"
+#include "virthread.h"
+#include "virfile.h"
+#include "vircommand.h"
+#include "virstring.h"
+#include "intprops.h"
+#include "nwfilter_conf.h"
+#include "nwfilter_nftables_driver.h"
+
+#define VIR_FROM_THIS VIR_FROM_NWFILTER
+
+VIR_LOG_INIT("nwfilter.nwfilter_nftables_driver");
+
+#define NFTABLES_TABLE_FAMILY "bridge"
+#define NFTABLES_TABLE_PREFIX "libvirt-nwf-"
+#define NFTABLES_TABLE_PREFIX_TEMP "libvirt-nwft-"
+
+#define NFTABLES_CHAIN_IN      "I"
+#define NFTABLES_CHAIN_OUT     "O"
+#define NFTABLES_CHAIN_FWD_IN  "FI"
+#define NFTABLES_CHAIN_FWD_OUT "FO"
+#define NFTABLES_CHAIN_HOST_IN "HI"
+
+/* nftables limits comments to 128 bytes including the terminating NUL */
+#define NFTABLES_COMMENT_LENGTH 128
+
+#define NFTABLES_CHAINNAME_LENGTH 32
+
+static int nftablesDriverInit(bool privileged);
+static void nftablesDriverShutdown(void);
+static int nftablesAllTeardown(const char *ifname);
+
+static virMutex nftablesLock;
+/* ifname -> body of the temporary table awaiting tearOldRules */
+static virHashTablePtr nftablesPending;
+
+static int
+nftablesOnceInit(void)
+{
+    if (virMutexInit(&nftablesLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+
+    if (!(nftablesPending = virHashCreate(10, virHashValueFree)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(nftables)
+
+
+typedef struct _nftablesMatch nftablesMatch;
+typedef nftablesMatch *nftablesMatchPtr;
+struct _nftablesMatch {
+    char *key;
+    char *value; /* NULL for statements such as verdicts */
+    bool neg;
+};
+
+typedef struct _nftablesRule nftablesRule;
+typedef nftablesRule *nftablesRulePtr;
+struct _nftablesRule {
+    nftablesMatchPtr matches;
+    size_t nmatches;
+};
+
+typedef struct _nftablesChain nftablesChain;
+typedef nftablesChain *nftablesChainPtr;
+struct _nftablesChain {
+    char *name;
+    virBuffer buf;
+};
+
+typedef struct _nftablesTable nftablesTable;
+typedef nftablesTable *nftablesTablePtr;
+struct _nftablesTable {
+    nftablesChainPtr *chains;
+    size_t nchains;
+};
+
+/* describes one of the layer 3 chains a rule is instantiated into */
+typedef struct _nftablesL3Chain nftablesL3Chain;
+typedef nftablesL3Chain *nftablesL3ChainPtr;
+struct _nftablesL3Chain {
+    const char *name;
+    bool directionIn;
+    bool maySkipICMP;
+    bool defMatch;
+    char match[64]; /* connection state to match; empty for none */
+};
+
+/* the jump from a root chain into a protocol specific sub-chain */
+typedef struct _nftablesSubChain nftablesSubChain;
+typedef nftablesSubChain *nftablesSubChainPtr;
+struct _nftablesSubChain {
+    virNWFilterChainPriority priority;
+    bool incoming;
+    const char *filtername;
+    const char *ethertype; /* NULL for unconditional jumps */
+    const char *daddr;     /* destination MAC to match, or NULL */
+};
+
+struct nftablesSubChainProto {
+    const char *prefix;
+    const char *ethertype;
+    const char *daddr;
+};
+
+/* Sub-chains are assigned to protocols by the prefix of the filter
+ * name in the same way the ebiptables driver does. */
+static const struct nftablesSubChainProto nftablesSubChainProtos[] = {
+    { "ipv4", "ip", NULL },
+    { "ipv6", "ip6", NULL },
+    { "arp", "arp", NULL },
+    { "rarp", "0x8035", NULL },
+    { "vlan", "vlan", NULL },
+    { "stp", NULL, NWFILTER_MAC_BGA },
+    { "mac", NULL, NULL },
+    { NULL, NULL, NULL },
+};
+
+
+static void
+nftablesRuleClear(nftablesRulePtr rule)
+{
+    size_t i;
+
+    for (i = 0; i < rule->nmatches; i++) {
+        VIR_FREE(rule->matches[i].key);
+        VIR_FREE(rule->matches[i].value);
+    }
+    VIR_FREE(rule->matches);
+    rule->nmatches = 0;
+}
+
+
+static void
+nftablesRuleListFree(nftablesRulePtr rules, size_t nrules)
+{
+    size_t i;
+
+    for (i = 0; i < nrules; i++)
+        nftablesRuleClear(&rules[i]);
+    VIR_FREE(rules);
+}
+
+
+static int
+nftablesRuleAddMatch(nftablesRulePtr rule,
+                     const char *key,
+                     bool neg,
+                     const char *value)
+{
+    nftablesMatch match = { NULL, NULL, neg };
+
+    if (VIR_STRDUP(match.key, key) < 0 ||
+        VIR_STRDUP(match.value, value) < 0)
+        goto error;
+
+    if (VIR_APPEND_ELEMENT(rule->matches, rule->nmatches, match) < 0)
+        goto error;
+
+    return 0;
+
+ error:
+    VIR_FREE(match.key);
+    VIR_FREE(match.value);
+    return -1;
+}
+
+
+static int
+nftablesRuleAddStatement(nftablesRulePtr rule,
+                         const char *statement)
+{
+    return nftablesRuleAddMatch(rule, statement, false, NULL);
+}
+
+
+static void
+nftablesTableClear(nftablesTablePtr table)
+{
+    size_t i;
+
+    for (i = 0; i < table->nchains; i++) {
+        VIR_FREE(table->chains[i]->name);
+        virBufferFreeAndReset(&table->chains[i]->buf);
+        VIR_FREE(table->chains[i]);
+    }
+    VIR_FREE(table->chains);
+    table->nchains = 0;
+}
+
+
+static nftablesChainPtr
+nftablesTableGetChain(nftablesTablePtr table,
+                      const char *name)
+{
+    nftablesChainPtr chain;
+    size_t i;
+
+    for (i = 0; i < table->nchains; i++) {
+        if (STREQ(table->chains[i]->name, name))
+            return table->chains[i];
+    }
+
+    if (VIR_ALLOC(chain) < 0)
+        return NULL;
+
+    if (VIR_STRDUP(chain->name, name) < 0 ||
+        VIR_APPEND_ELEMENT_COPY(table->chains, table->nchains, chain) < 0) {
+        VIR_FREE(chain->name);
+        VIR_FREE(chain);
+        return NULL;
+    }
+
+    return chain;
+}
+
+
+static bool
+nftablesTableHasChain(nftablesTablePtr table,
+                      const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < table->nchains; i++) {
+        if (STREQ(table->chains[i]->name, name))
+            return true;
+    }
+    return false;
+}
+
+
+static bool
+nftablesIsRootChain(const char *name)
+{
+    return STREQ(name, NFTABLES_CHAIN_IN) ||
+           STREQ(name, NFTABLES_CHAIN_OUT) ||
+           STREQ(name, NFTABLES_CHAIN_FWD_IN) ||
+           STREQ(name, NFTABLES_CHAIN_FWD_OUT) ||
+           STREQ(name, NFTABLES_CHAIN_HOST_IN);
+}
+
+
+static int
+nftablesPrintDataType(virNWFilterVarCombIterPtr vars,
+                      char *buf, int bufsize,
+                      nwItemDescPtr item,
+                      bool asHex)
+{
+    char *data;
+
+    if ((item->flags & NWFILTER_ENTRY_ITEM_FLAG_HAS_VAR)) {
+        const char *val;
+
+        if (!(val = virNWFilterVarCombIterGetVarValue(vars, item->varAccess)))
+            return -1;
+
+        if (!virStrcpy(buf, val, bufsize)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Buffer too small to print variable "
+                             "'%s' into"),
+                           virNWFilterVarAccessGetVarName(item->varAccess));
+            return -1;
+        }
+        return 0;
+    }
+
+    switch (item->datatype) {
+    case DATATYPE_IPADDR:
+    case DATATYPE_IPV6ADDR:
+        if (!(data = virSocketAddrFormat(&item->u.ipaddr)))
+            return -1;
+        if (!virStrcpy(buf, data, bufsize)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("buffer too small for IP address"));
+            VIR_FREE(data);
+            return -1;
+        }
+        VIR_FREE(data);
+        break;
+
+    case DATATYPE_MACADDR:
+    case DATATYPE_MACMASK:
+        if (bufsize < VIR_MAC_STRING_BUFLEN) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Buffer too small for MAC address"));
+            return -1;
+        }
+        virMacAddrFormat(&item->u.macaddr, buf);
+        break;
+
+    case DATATYPE_IPV6MASK:
+    case DATATYPE_IPMASK:
+    case DATATYPE_UINT8:
+    case DATATYPE_UINT8_HEX:
+        if (snprintf(buf, bufsize, asHex ? "0x%x" : "%u",
+                     item->u.u8) >= bufsize) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Buffer too small for uint8 type"));
+            return -1;
+        }
+        break;
+
+    case DATATYPE_UINT16:
+    case DATATYPE_UINT16_HEX:
+        if (snprintf(buf, bufsize, asHex ? "0x%x" : "%u",
+                     item->u.u16) >= bufsize) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Buffer too small for uint16 type"));
+            return -1;
+        }
+        break;
+
+    case DATATYPE_UINT32:
+    case DATATYPE_UINT32_HEX:
+        if (snprintf(buf, bufsize, asHex ? "0x%x" : "%u",
+                     item->u.u32) >= bufsize) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Buffer too small for uint32 type"));
+            return -1;
+        }
+        break;
+
+    default:
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unhandled datatype %x"), item->datatype);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * nftablesAddItem:
+ * @rule: the rule to add the match to
+ * @vars: the variable values to use
+ * @key: the nftables expression to match against
+ * @item: the value to match
+ * @itemHi: optional upper end of a range or prefix length
+ * @sep: separator to put between @item and @itemHi
+ * @asHex: whether to print numbers in hex
+ *
+ * Adds a match for @item if it is set, in the form 'key value',
+ * 'key value-hi' or 'key value/prefix'.
+ */
+static int
+nftablesAddItem(nftablesRulePtr rule,
+                virNWFilterVarCombIterPtr vars,
+                const char *key,
+                nwItemDescPtr item,
+                nwItemDescPtr itemHi,
+                char sep,
+                bool asHex)
+{
+    char lo[MAX(INET6_ADDRSTRLEN, INT_BUFSIZE_BOUND(uint32_t) + 2)];
+    char hi[MAX(INET6_ADDRSTRLEN, INT_BUFSIZE_BOUND(uint32_t) + 2)];
+    char value[sizeof(lo) + sizeof(hi) + 1];
+
+    if (!HAS_ENTRY_ITEM(item))
+        return 0;
+
+    if (nftablesPrintDataType(vars, lo, sizeof(lo), item, asHex) < 0)
+        return -1;
+
+    if (itemHi && HAS_ENTRY_ITEM(itemHi)) {
+        if (nftablesPrintDataType(vars, hi, sizeof(hi), itemHi, asHex) < 0)
+            return -1;
+        snprintf(value, sizeof(value), "%s%c%s", lo, sep, hi);
+    } else {
+        ignore_value(virStrcpyStatic(value, lo));
+    }
+
+    return nftablesRuleAddMatch(rule, key, ENTRY_WANT_NEG_SIGN(item), value);
+}
+
+
+static int
+nftablesAddMACItem(nftablesRulePtr rule,
+                   virNWFilterVarCombIterPtr vars,
+                   const char *key,
+                   nwItemDescPtr item,
+                   nwItemDescPtr mask)
+{
+    char macaddr[VIR_MAC_STRING_BUFLEN];
+    char macmask[VIR_MAC_STRING_BUFLEN];
+    char maskkey[64];
+    virMacAddr addr, netmask;
+    bool full = true;
+    size_t i;
+
+    if (!HAS_ENTRY_ITEM(item))
+        return 0;
+
+    if (!mask || !HAS_ENTRY_ITEM(mask))
+        return nftablesAddItem(rule, vars, key, item, NULL, 0, false);
+
+    if (nftablesPrintDataType(vars, macaddr, sizeof(macaddr), item, false) < 0 ||
+        nftablesPrintDataType(vars, macmask, sizeof(macmask), mask, false) < 0)
+        return -1;
+
+    if (virMacAddrParse(macaddr, &addr) < 0 ||
+        virMacAddrParse(macmask, &netmask) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Invalid MAC address or mask '%s/%s'"),
+                       macaddr, macmask);
+        return -1;
+    }
+
+    for (i = 0; i < VIR_MAC_BUFLEN; i++) {
+        /* nftables compares the masked field against the value as is */
+        addr.addr[i] &= netmask.addr[i];
+        if (netmask.addr[i] != 0xff)
+            full = false;
+    }
+
+    virMacAddrFormat(&addr, macaddr);
+    if (full)
+        return nftablesRuleAddMatch(rule, key,
+                                    ENTRY_WANT_NEG_SIGN(item), macaddr);
+
+    virMacAddrFormat(&netmask, macmask);
+    snprintf(maskkey, sizeof(maskkey), "%s & %s", key, macmask);
+
+    return nftablesRuleAddMatch(rule, maskkey,
+                                ENTRY_WANT_NEG_SIGN(item), macaddr);
+}
+
+
+static int
+nftablesHandleEthHdr(nftablesRulePtr rule,
+                     virNWFilterVarCombIterPtr vars,
+                     ethHdrDataDefPtr ethHdr,
+                     bool reverse)
+{
+    if (nftablesAddMACItem(rule, vars,
+                           reverse ? "ether daddr" : "ether saddr",
+                           &ethHdr->dataSrcMACAddr,
+                           &ethHdr->dataSrcMACMask) < 0 ||
+        nftablesAddMACItem(rule, vars,
+                           reverse ? "ether saddr" : "ether daddr",
+                           &ethHdr->dataDstMACAddr,
+                           &ethHdr->dataDstMACMask) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+/*
+ * nftables has no RARP expressions, so RARP fields are matched via raw
+ * payload expressions relative to the network header, which need
+ * plain integers.
+ */
+static int
+nftablesAddRawMAC(nftablesRulePtr rule,
+                  virNWFilterVarCombIterPtr vars,
+                  unsigned int offset,
+                  nwItemDescPtr item)
+{
+    char macaddr[VIR_MAC_STRING_BUFLEN];
+    char key[32];
+    char value[2 + 2 * VIR_MAC_BUFLEN + 1];
+    virMacAddr addr;
+    size_t i;
+
+    if (!HAS_ENTRY_ITEM(item))
+        return 0;
+
+    if (nftablesPrintDataType(vars, macaddr, sizeof(macaddr), item, false) < 0)
+        return -1;
+
+    if (virMacAddrParse(macaddr, &addr) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Invalid MAC address '%s'"), macaddr);
+        return -1;
+    }
+
+    snprintf(value, sizeof(value), "0x");
+    for (i = 0; i < VIR_MAC_BUFLEN; i++)
+        snprintf(value + 2 + 2 * i, 3, "%02x", addr.addr[i]);
+
+    snprintf(key, sizeof(key), "@nh,%u,48", offset);
+
+    return nftablesRuleAddMatch(rule, key, ENTRY_WANT_NEG_SIGN(item), value);
+}
+
+
+static int
+nftablesAddRawIPv4(nftablesRulePtr rule,
+                   virNWFilterVarCombIterPtr vars,
+                   unsigned int offset,
+                   nwItemDescPtr item,
+                   nwItemDescPtr mask)
+{
+    char ipaddr[INET_ADDRSTRLEN];
+    char prefix[INT_BUFSIZE_BOUND(uint32_t) + 2];
+    char key[48];
+    char value[16];
+    virSocketAddr addr;
+    uint32_t ip, netmask = 0xffffffff;
+    unsigned int len;
+
+    if (!HAS_ENTRY_ITEM(item))
+        return 0;
+
+    if (nftablesPrintDataType(vars, ipaddr, sizeof(ipaddr), item, false) < 0)
+        return -1;
+
+    if (virSocketAddrParseIPv4(&addr, ipaddr) < 0)
+        return -1;
+    ip = ntohl(addr.data.inet4.sin_addr.s_addr);
+
+    if (mask && HAS_ENTRY_ITEM(mask)) {
+        if (nftablesPrintDataType(vars, prefix, sizeof(prefix), mask, false) < 0)
+            return -1;
+        if (virStrToLong_ui(prefix, NULL, 10, &len) < 0 || len > 32) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Invalid IPv4 prefix length '%s'"), prefix);
+            return -1;
+        }
+        netmask = len ? 0xffffffff << (32 - len) : 0;
+    }
+
+    if (netmask != 0xffffffff)
+        snprintf(key, sizeof(key), "@nh,%u,32 & 0x%08x", offset, netmask);
+    else
+        snprintf(key, sizeof(key), "@nh,%u,32", offset);
+    snprintf(value, sizeof(value), "0x%08x", ip & netmask);
+
+    return nftablesRuleAddMatch(rule, key, ENTRY_WANT_NEG_SIGN(item), value);
+}
+
+
+static int
+nftablesAddRawNumber(nftablesRulePtr rule,
+                     virNWFilterVarCombIterPtr vars,
+                     unsigned int offset,
+                     unsigned int len,
+                     nwItemDescPtr item)
+{
+    char key[32];
+
+    snprintf(key, sizeof(key), "@nh,%u,%u", offset, len);
+
+    return nftablesAddItem(rule, vars, key, item, NULL, 0, true);
+}
+
+
+static int
+nftablesHandleARPHdr(nftablesRulePtr rule,
+                     virNWFilterVarCombIterPtr vars,
+                     arpHdrFilterDefPtr arpHdr,
+                     bool reverse)
+{
+    if (nftablesAddItem(rule, vars, "arp htype",
+                        &arpHdr->dataHWType, NULL, 0, false) < 0 ||
+        nftablesAddItem(rule, vars, "arp operation",
+                        &arpHdr->dataOpcode, NULL, 0, false) < 0 ||
+        nftablesAddItem(rule, vars, "arp ptype",
+                        &arpHdr->dataProtocolType, NULL, 0, true) < 0 ||
+        nftablesAddItem(rule, vars,
+                        reverse ? "arp daddr ip" : "arp saddr ip",
+                        &arpHdr->dataARPSrcIPAddr,
+                        &arpHdr->dataARPSrcIPMask, '/', false) < 0 ||
+        nftablesAddItem(rule, vars,
+                        reverse ? "arp saddr ip" : "arp daddr ip",
+                        &arpHdr->dataARPDstIPAddr,
+                        &arpHdr->dataARPDstIPMask, '/', false) < 0 ||
+        nftablesAddItem(rule, vars,
+                        reverse ? "arp daddr ether" : "arp saddr ether",
+                        &arpHdr->dataARPSrcMACAddr, NULL, 0, false) < 0 ||
+        nftablesAddItem(rule, vars,
+                        reverse ? "arp saddr ether" : "arp daddr ether",
+                        &arpHdr->dataARPDstMACAddr, NULL, 0, false) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+nftablesHandleRARPHdr(nftablesRulePtr rule,
+                      virNWFilterVarCombIterPtr vars,
+                      arpHdrFilterDefPtr arpHdr,
+                      bool reverse)
+{
+    /* offsets into an ARP header with 6 byte MAC and 4 byte IP addresses */
+    if (nftablesAddRawNumber(rule, vars, 0, 16, &arpHdr->dataHWType) < 0 ||
+        nftablesAddRawNumber(rule, vars, 48, 16, &arpHdr->dataOpcode) < 0 ||
+        nftablesAddRawNumber(rule, vars, 16, 16,
+                             &arpHdr->dataProtocolType) < 0 ||
+        nftablesAddRawIPv4(rule, vars, reverse ? 192 : 112,
+                           &arpHdr->dataARPSrcIPAddr,
+                           &arpHdr->dataARPSrcIPMask) < 0 ||
+        nftablesAddRawIPv4(rule, vars, reverse ? 112 : 192,
+                           &arpHdr->dataARPDstIPAddr,
+                           &arpHdr->dataARPDstIPMask) < 0 ||
+        nftablesAddRawMAC(rule, vars, reverse ? 144 : 64,
+                          &arpHdr->dataARPSrcMACAddr) < 0 ||
+        nftablesAddRawMAC(rule, vars, reverse ? 64 : 144,
+                          &arpHdr->dataARPDstMACAddr) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+nftablesHandleICMPv6Range(nftablesRulePtr rule,
+                          virNWFilterVarCombIterPtr vars,
+                          const char *key,
+                          nwItemDescPtr start,
+                          nwItemDescPtr end,
+                          bool neg)
+{
+    char lo[INT_BUFSIZE_BOUND(uint32_t) + 2];
+    char hi[INT_BUFSIZE_BOUND(uint32_t) + 2];
+    char value[sizeof(lo) + sizeof(hi) + 1];
+
+    if (!HAS_ENTRY_ITEM(start) && !HAS_ENTRY_ITEM(end))
+        return 0;
+
+    if (HAS_ENTRY_ITEM(start)) {
+        if (nftablesPrintDataType(vars, lo, sizeof(lo), start, false) < 0)
+            return -1;
+    } else {
+        ignore_value(virStrcpyStatic(lo, "0"));
+    }
+
+    if (HAS_ENTRY_ITEM(end)) {
+        if (nftablesPrintDataType(vars, hi, sizeof(hi), end, false) < 0)
+            return -1;
+    } else {
+        ignore_value(virStrcpyStatic(hi, HAS_ENTRY_ITEM(start) ? lo : "255"));
+    }
+
+    if (STREQ(lo, hi))
+        ignore_value(virStrcpyStatic(value, lo));
+    else
+        snprintf(value, sizeof(value), "%s-%s", lo, hi);
+
+    return nftablesRuleAddMatch(rule, key, neg, value);
+}
+
+
+static const char *
+nftablesVerdict(virNWFilterRuleDefPtr rule,
+                bool layer2)
+{
+    /* REJECT is not supported on layer 2, the same as with ebtables */
+    if (layer2 && rule->action == VIR_NWFILTER_RULE_ACTION_REJECT)
+        return virNWFilterRuleActionTypeToString(VIR_NWFILTER_RULE_ACTION_DROP);
+
+    return virNWFilterRuleActionTypeToString(rule->action);
+}
+
+
+/*
+ * nftablesCreateL2Rule:
+ * @rule: The rule of the filter to convert
+ * @vars: A map containing the variables to resolve
+ * @reverse: Whether to reverse src and dst attributes
+ * @nrule: The rule to fill in
+ *
+ * Convert a single layer 2 rule into its nftables representation
+ *
+ * Returns 0 in case of success, -1 otherwise
+ */
+static int
+nftablesCreateL2Rule(virNWFilterRuleDefPtr rule,
+                     virNWFilterVarCombIterPtr vars,
+                     bool reverse,
+                     nftablesRulePtr nrule)
+{
+    ipHdrDataDefPtr ipHdr;
+    const char *family;
+
+    switch (rule->prtclType) {
+    case VIR_NWFILTER_RULE_PROTOCOL_MAC:
+        if (nftablesHandleEthHdr(nrule, vars,
+                                 &rule->p.ethHdrFilter.ethHdr, reverse) < 0 ||
+            nftablesAddItem(nrule, vars, "ether type",
+                            &rule->p.ethHdrFilter.dataProtocolID,
+                            NULL, 0, true) < 0)
+            return -1;
+        break;
+
+    case VIR_NWFILTER_RULE_PROTOCOL_VLAN:
+        if (nftablesHandleEthHdr(nrule, vars,
+                                 &rule->p.vlanHdrFilter.ethHdr, reverse) < 0 ||
+            nftablesRuleAddMatch(nrule, "ether type", false, "vlan") < 0 ||
+            nftablesAddItem(nrule, vars, "vlan id",
+                            &rule->p.vlanHdrFilter.dataVlanID,
+                            NULL, 0, false) < 0 ||
+            nftablesAddItem(nrule, vars, "vlan type",
+                            &rule->p.vlanHdrFilter.dataVlanEncap,
+                            NULL, 0, true) < 0)
+            return -1;
+        break;
+
+    case VIR_NWFILTER_RULE_PROTOCOL_STP: {
+        stpHdrFilterDefPtr stpHdr = &rule->p.stpHdrFilter;
+
+        /* cannot handle inout direction with srcmask set in reverse dir.
+           since this clashes with the destination address below... */
+        if (reverse && HAS_ENTRY_ITEM(&stpHdr->ethHdr.dataSrcMACAddr)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("STP filtering in %s direction with "
+                             "source MAC address set is not supported"),
+                           virNWFilterRuleDirectionTypeToString(
+                               VIR_NWFILTER_RULE_DIRECTION_INOUT));
+            return -1;
+        }
+
+        if (HAS_ENTRY_ITEM(&stpHdr->dataType) ||
+            HAS_ENTRY_ITEM(&stpHdr->dataFlags) ||
+            HAS_ENTRY_ITEM(&stpHdr->dataRootPri) ||
+            HAS_ENTRY_ITEM(&stpHdr->dataRootAddr) ||
+            HAS_ENTRY_ITEM(&stpHdr->dataRootCost) ||
+            HAS_ENTRY_ITEM(&stpHdr->dataSndrPrio) ||
+            HAS_ENTRY_ITEM(&stpHdr->dataSndrAddr) ||
+            HAS_ENTRY_ITEM(&stpHdr->dataPort) ||
+            HAS_ENTRY_ITEM(&stpHdr->dataAge) ||
+            HAS_ENTRY_ITEM(&stpHdr->dataMaxAge) ||
+            HAS_ENTRY_ITEM(&stpHdr->dataHelloTime) ||
+            HAS_ENTRY_ITEM(&stpHdr->dataFwdDelay)) {
+            virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                           _("matching STP BPDU fields is not supported "
+                             "by the nftables driver"));
+            return -1;
+        }
+
+        if (nftablesHandleEthHdr(nrule, vars, &stpHdr->ethHdr, reverse) < 0 ||
+            nftablesRuleAddMatch(nrule, "ether daddr", false,
+                                 NWFILTER_MAC_BGA) < 0)
+            return -1;
+        break;
+    }
+
+    case VIR_NWFILTER_RULE_PROTOCOL_ARP:
+    case VIR_NWFILTER_RULE_PROTOCOL_RARP:
+        if (HAS_ENTRY_ITEM(&rule->p.arpHdrFilter.dataGratuitousARP) &&
+            rule->p.arpHdrFilter.dataGratuitousARP.u.boolean) {
+            virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                           _("matching gratuitous ARP packets is not "
+                             "supported by the nftables driver"));
+            return -1;
+        }
+
+        if (nftablesHandleEthHdr(nrule, vars,
+                                 &rule->p.arpHdrFilter.ethHdr, reverse) < 0)
+            return -1;
+
+        if (rule->prtclType == VIR_NWFILTER_RULE_PROTOCOL_ARP) {
+            if (nftablesRuleAddMatch(nrule, "ether type", false, "arp") < 0 ||
+                nftablesHandleARPHdr(nrule, vars,
+                                     &rule->p.arpHdrFilter, reverse) < 0)
+                return -1;
+        } else {
+            if (nftablesRuleAddMatch(nrule, "ether type", false, "0x8035") < 0 ||
+                nftablesHandleRARPHdr(nrule, vars,
+                                      &rule->p.arpHdrFilter, reverse) < 0)
+                return -1;
+        }
+        break;
+
+    case VIR_NWFILTER_RULE_PROTOCOL_IP:
+    case VIR_NWFILTER_RULE_PROTOCOL_IPV6:
+        if (rule->prtclType == VIR_NWFILTER_RULE_PROTOCOL_IP) {
+            ipHdr = &rule->p.ipHdrFilter.ipHdr;
+            family = "ip";
+            if (nftablesHandleEthHdr(nrule, vars,
+                                     &rule->p.ipHdrFilter.ethHdr, reverse) < 0)
+                return -1;
+        } else {
+            ipHdr = &rule->p.ipv6HdrFilter.ipHdr;
+            family = "ip6";
+            if (nftablesHandleEthHdr(nrule, vars,
+                                     &rule->p.ipv6HdrFilter.ethHdr, reverse) < 0)
+                return -1;
+        }
+
+        if (nftablesRuleAddMatch(nrule, "ether type", false, family) < 0)
+            return -1;
+
+        if (rule->prtclType == VIR_NWFILTER_RULE_PROTOCOL_IP) {
+            if (nftablesAddItem(nrule, vars,
+                                reverse ? "ip daddr" : "ip saddr",
+                                &ipHdr->dataSrcIPAddr,
+                                &ipHdr->dataSrcIPMask, '/', false) < 0 ||
+                nftablesAddItem(nrule, vars,
+                                reverse ? "ip saddr" : "ip daddr",
+                                &ipHdr->dataDstIPAddr,
+                                &ipHdr->dataDstIPMask, '/', false) < 0 ||
+                nftablesAddItem(nrule, vars, "ip protocol",
+                                &ipHdr->dataProtocolID, NULL, 0, false) < 0)
+                return -1;
+        } else {
+            if (nftablesAddItem(nrule, vars,
+                                reverse ? "ip6 daddr" : "ip6 saddr",
+                                &ipHdr->dataSrcIPAddr,
+                                &ipHdr->dataSrcIPMask, '/', false) < 0 ||
+                nftablesAddItem(nrule, vars,
+                                reverse ? "ip6 saddr" : "ip6 daddr",
+                                &ipHdr->dataDstIPAddr,
+                                &ipHdr->dataDstIPMask, '/', false) < 0 ||
+                nftablesAddItem(nrule, vars, "ip6 nexthdr",
+                                &ipHdr->dataProtocolID, NULL, 0, false) < 0)
+                return -1;
+        }
+
+        if (nftablesAddItem(nrule, vars,
+                            reverse ? "th dport" : "th sport",
+                            &rule->p.ipHdrFilter.portData.dataSrcPortStart,
+                            &rule->p.ipHdrFilter.portData.dataSrcPortEnd,
+                            '-', false) < 0 ||
+            nftablesAddItem(nrule, vars,
+                            reverse ? "th sport" : "th dport",
+                            &rule->p.ipHdrFilter.portData.dataDstPortStart,
+                            &rule->p.ipHdrFilter.portData.dataDstPortEnd,
+                            '-', false) < 0)
+            return -1;
+
+        if (rule->prtclType == VIR_NWFILTER_RULE_PROTOCOL_IP) {
+            if (nftablesAddItem(nrule, vars, "ip dscp",
+                                &ipHdr->dataDSCP, NULL, 0, false) < 0)
+                return -1;
+        } else {
+            ipv6HdrFilterDefPtr ipv6Hdr = &rule->p.ipv6HdrFilter;
+            bool neg = ENTRY_WANT_NEG_SIGN(&ipv6Hdr->dataICMPTypeStart);
+            bool hasType = HAS_ENTRY_ITEM(&ipv6Hdr->dataICMPTypeStart) ||
+                           HAS_ENTRY_ITEM(&ipv6Hdr->dataICMPTypeEnd);
+            bool hasCode = HAS_ENTRY_ITEM(&ipv6Hdr->dataICMPCodeStart) ||
+                           HAS_ENTRY_ITEM(&ipv6Hdr->dataICMPCodeEnd);
+
+            if (neg && hasType && hasCode) {
+                virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                               _("negating a combined ICMPv6 type and code "
+                                 "match is not supported by the nftables "
+                                 "driver"));
+                return -1;
+            }
+
+            if (nftablesHandleICMPv6Range(nrule, vars, "icmpv6 type",
+                                          &ipv6Hdr->dataICMPTypeStart,
+                                          &ipv6Hdr->dataICMPTypeEnd,
+                                          neg) < 0 ||
+                nftablesHandleICMPv6Range(nrule, vars, "icmpv6 code",
+                                          &ipv6Hdr->dataICMPCodeStart,
+                                          &ipv6Hdr->dataICMPCodeEnd,
+                                          neg && !hasType) < 0)
+                return -1;
+        }
+        break;
+
+    case VIR_NWFILTER_RULE_PROTOCOL_NONE:
+        break;
+
+    default:
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unexpected rule protocol %d"),
+                       rule->prtclType);
+        return -1;
+    }
+
+    return nftablesRuleAddStatement(nrule, nftablesVerdict(rule, true));
+}
+
+
+static void
+nftablesPrintStateFlags(char *buf, size_t bufsize, int32_t flags)
+{
+    static const struct {
+        int32_t flag;
+        const char *name;
+    } states[] = {
+        { RULE_FLAG_STATE_NEW, "new" },
+        { RULE_FLAG_STATE_ESTABLISHED, "established" },
+        { RULE_FLAG_STATE_RELATED, "related" },
+        { RULE_FLAG_STATE_INVALID, "invalid" },
+    };
+    size_t i, len = 0;
+
+    buf[0] = '\0';
+
+    /* 'NONE' cannot be combined with other states */
+    if (flags & RULE_FLAG_STATE_NONE)
+        return;
+
+    for (i = 0; i < ARRAY_CARDINALITY(states) && len < bufsize; i++) {
+        if (!(flags & states[i].flag))
+            continue;
+        len += snprintf(buf + len, bufsize - len, "%s%s",
+                        len ? "," : "", states[i].name);
+    }
+}
+
+
+/*
+ * nftablesGetL3Chains:
+ * @rule: The layer 3 rule
+ * @chains: Array of 3 elements to fill in
+ *
+ * Determine the chains a layer 3 rule needs to be instantiated into
+ * along with the connection state to match, following the logic of
+ * iptablesCreateRuleInstance() and iptablesCreateRuleInstanceStateCtrl()
+ *
+ * Returns the number of chains filled in
+ */
+static size_t
+nftablesGetL3Chains(virNWFilterRuleDefPtr rule,
+                    nftablesL3Chain chains[3])
+{
+    bool directionIn = false;
+    bool inout = false;
+    bool needState = true;
+    size_t n = 0;
+
+    memset(chains, 0, sizeof(*chains) * 3);
+
+    if (rule->tt == VIR_NWFILTER_RULE_DIRECTION_IN ||
+        rule->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT) {
+        directionIn = true;
+        inout = (rule->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT);
+    }
+
+    if (!(rule->flags & RULE_FLAG_NO_STATEMATCH) &&
+        (rule->flags & IPTABLES_STATE_FLAGS)) {
+        if (!directionIn || inout) {
+            chains[n].name = NFTABLES_CHAIN_FWD_IN;
+            chains[n].directionIn = directionIn;
+            chains[n].maySkipICMP = directionIn || inout;
+            nftablesPrintStateFlags(chains[n].match,
+                                    sizeof(chains[n].match), rule->flags);
+            n++;
+        }
+
+        if (directionIn) {
+            chains[n].name = NFTABLES_CHAIN_FWD_OUT;
+            chains[n].directionIn = !directionIn;
+            chains[n].maySkipICMP = !directionIn || inout;
+            nftablesPrintStateFlags(chains[n].match,
+                                    sizeof(chains[n].match), rule->flags);
+            n++;
+        }
+
+        if (!directionIn || inout) {
+            chains[n].name = NFTABLES_CHAIN_HOST_IN;
+            chains[n].directionIn = directionIn;
+            chains[n].maySkipICMP = directionIn;
+            nftablesPrintStateFlags(chains[n].match,
+                                    sizeof(chains[n].match), rule->flags);
+            n++;
+        }
+
+        return n;
+    }
+
+    if (inout || (rule->flags & RULE_FLAG_NO_STATEMATCH))
+        needState = false;
+
+    chains[n].name = NFTABLES_CHAIN_FWD_IN;
+    chains[n].directionIn = directionIn;
+    chains[n].maySkipICMP = directionIn || inout;
+    chains[n].defMatch = true;
+    if (needState)
+        ignore_value(virStrcpyStatic(chains[n].match,
+                                     directionIn ? "established"
+                                                 : "new,established"));
+    n++;
+
+    chains[n].name = NFTABLES_CHAIN_FWD_OUT;
+    chains[n].directionIn = !directionIn;
+    chains[n].maySkipICMP = !directionIn || inout;
+    chains[n].defMatch = true;
+    if (needState)
+        ignore_value(virStrcpyStatic(chains[n].match,
+                                     directionIn ? "new,established"
+                                                 : "established"));
+    n++;
+
+    chains[n].name = NFTABLES_CHAIN_HOST_IN;
+    chains[n].directionIn = directionIn;
+    chains[n].maySkipICMP = directionIn;
+    chains[n].defMatch = true;
+    if (needState)
+        ignore_value(virStrcpyStatic(chains[n].match,
+                                     directionIn ? "established"
+                                                 : "new,established"));
+    n++;
+
+    return n;
+}
+
+
+static int
+nftablesAddComment(nftablesRulePtr rule,
+                   const char *comment)
+{
+    char value[NFTABLES_COMMENT_LENGTH + 2];
+    size_t i, j;
+
+    value[0] = '"';
+    for (i = 0, j = 1; comment[i] && j < NFTABLES_COMMENT_LENGTH; i++, j++) {
+        if (comment[i] == '"' || comment[i] == '\\')
+            value[j] = '\'';
+        else if (c_iscntrl(comment[i]))
+            value[j] = ' ';
+        else
+            value[j] = comment[i];
+    }
+    value[j++] = '"';
+    value[j] = '\0';
+
+    return nftablesRuleAddMatch(rule, "comment", false, value);
+}
+
+
+/*
+ * nftablesCreateL3Rule:
+ * @rule: The rule of the filter to convert
+ * @vars: A map containing the variables to resolve
+ * @chain: The layer 3 chain the rule is created for
+ * @nrule: The rule to fill in
+ * @skip: Set to true if no rule is needed in this chain
+ *
+ * Convert a single layer 3 rule into its nftables representation
+ *
+ * Returns 0 in case of success, -1 otherwise
+ */
+static int
+nftablesCreateL3Rule(virNWFilterRuleDefPtr rule,
+                     virNWFilterVarCombIterPtr vars,
+                     nftablesL3ChainPtr chain,
+                     nftablesRulePtr nrule,
+                     bool *skip)
+{
+    ipHdrDataDefPtr ipHdr = &rule->p.allHdrFilter.ipHdr;
+    bool ipv6 = virNWFilterRuleIsProtocolIPv6(rule);
+    const char *family = ipv6 ? "ip6" : "ip";
+    bool directionIn = chain->directionIn;
+    const char *l4proto = NULL;
+    portDataDefPtr portData = NULL;
+    bool srcMacSkipped = false;
+    bool skipRule = false;
+    bool skipMatch = false;
+    bool hasICMPType = false;
+    char src[16], dst[16], key[32];
+    size_t nmatches;
+
+    *skip = false;
+
+    switch (rule->prtclType) {
+    case VIR_NWFILTER_RULE_PROTOCOL_TCP:
+    case VIR_NWFILTER_RULE_PROTOCOL_TCPoIPV6:
+        l4proto = "tcp";
+        portData = &rule->p.tcpHdrFilter.portData;
+        break;
+    case VIR_NWFILTER_RULE_PROTOCOL_UDP:
+    case VIR_NWFILTER_RULE_PROTOCOL_UDPoIPV6:
+        l4proto = "udp";
+        portData = &rule->p.udpHdrFilter.portData;
+        break;
+    case VIR_NWFILTER_RULE_PROTOCOL_UDPLITE:
+    case VIR_NWFILTER_RULE_PROTOCOL_UDPLITEoIPV6:
+        l4proto = "udplite";
+        break;
+    case VIR_NWFILTER_RULE_PROTOCOL_ESP:
+    case VIR_NWFILTER_RULE_PROTOCOL_ESPoIPV6:
+        l4proto = "esp";
+        break;
+    case VIR_NWFILTER_RULE_PROTOCOL_AH:
+    case VIR_NWFILTER_RULE_PROTOCOL_AHoIPV6:
+        l4proto = "ah";
+        break;
+    case VIR_NWFILTER_RULE_PROTOCOL_SCTP:
+    case VIR_NWFILTER_RULE_PROTOCOL_SCTPoIPV6:
+        l4proto = "sctp";
+        portData = &rule->p.sctpHdrFilter.portData;
+        break;
+    case VIR_NWFILTER_RULE_PROTOCOL_ICMP:
+        l4proto = "icmp";
+        break;
+    case VIR_NWFILTER_RULE_PROTOCOL_ICMPV6:
+        l4proto = "ipv6-icmp";
+        break;
+    case VIR_NWFILTER_RULE_PROTOCOL_IGMP:
+        l4proto = "igmp";
+        break;
+    case VIR_NWFILTER_RULE_PROTOCOL_ALL:
+    case VIR_NWFILTER_RULE_PROTOCOL_ALLoIPV6:
+        break;
+    default:
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unexpected protocol %d"),
+                       rule->prtclType);
+        return -1;
+    }
+
+    if (nftablesRuleAddMatch(nrule, "ether type", false, family) < 0)
+        return -1;
+    if (l4proto &&
+        nftablesRuleAddMatch(nrule, "meta l4proto", false, l4proto) < 0)
+        return -1;
+
+    nmatches = nrule->nmatches;
+
+    if (HAS_ENTRY_ITEM(&rule->p.allHdrFilter.dataSrcMACAddr)) {
+        if (directionIn) {
+            srcMacSkipped = true;
+        } else if (nftablesAddItem(nrule, vars, "ether saddr",
+                                   &rule->p.allHdrFilter.dataSrcMACAddr,
+                                   NULL, 0, false) < 0) {
+            return -1;
+        }
+    }
+
+    snprintf(src, sizeof(src), "%s %s", family,
+             directionIn ? "daddr" : "saddr");
+    snprintf(dst, sizeof(dst), "%s %s", family,
+             directionIn ? "saddr" : "daddr");
+
+    if (HAS_ENTRY_ITEM(&ipHdr->dataSrcIPAddr)) {
+        if (nftablesAddItem(nrule, vars, src, &ipHdr->dataSrcIPAddr,
+                            &ipHdr->dataSrcIPMask, '/', false) < 0)
+            return -1;
+    } else if (nftablesAddItem(nrule, vars, src, &ipHdr->dataSrcIPFrom,
+                               &ipHdr->dataSrcIPTo, '-', false) < 0) {
+        return -1;
+    }
+
+    if (HAS_ENTRY_ITEM(&ipHdr->dataDstIPAddr)) {
+        if (nftablesAddItem(nrule, vars, dst, &ipHdr->dataDstIPAddr,
+                            &ipHdr->dataDstIPMask, '/', false) < 0)
+            return -1;
+    } else if (nftablesAddItem(nrule, vars, dst, &ipHdr->dataDstIPFrom,
+                               &ipHdr->dataDstIPTo, '-', false) < 0) {
+        return -1;
+    }
+
+    snprintf(key, sizeof(key), "%s dscp", family);
+    if (nftablesAddItem(nrule, vars, key, &ipHdr->dataDSCP,
+                        NULL, 0, false) < 0)
+        return -1;
+
+    if (HAS_ENTRY_ITEM(&ipHdr->dataConnlimitAbove)) {
+        if (directionIn) {
+            /* only support for limit in outgoing dir. */
+            skipRule = true;
+        } else {
+            skipMatch = true;
+        }
+    }
+
+    if (rule->prtclType == VIR_NWFILTER_RULE_PROTOCOL_TCP ||
+        rule->prtclType == VIR_NWFILTER_RULE_PROTOCOL_TCPoIPV6) {
+        tcpHdrFilterDefPtr tcpHdr = &rule->p.tcpHdrFilter;
+
+        if (HAS_ENTRY_ITEM(&tcpHdr->dataTCPFlags)) {
+            char value[8];
+
+            snprintf(key, sizeof(key), "tcp flags & 0x%x",
+                     tcpHdr->dataTCPFlags.u.tcpFlags.mask);
+            snprintf(value, sizeof(value), "0x%x",
+                     tcpHdr->dataTCPFlags.u.tcpFlags.flags);
+            if (nftablesRuleAddMatch(nrule, key,
+                                     ENTRY_WANT_NEG_SIGN(&tcpHdr->dataTCPFlags),
+                                     value) < 0)
+                return -1;
+        }
+
+        if (HAS_ENTRY_ITEM(&tcpHdr->dataTCPOption)) {
+            virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                           _("matching TCP options is not supported "
+                             "by the nftables driver"));
+            return -1;
+        }
+    }
+
+    if (portData) {
+        snprintf(src, sizeof(src), "%s %s", l4proto,
+                 directionIn ? "dport" : "sport");
+        snprintf(dst, sizeof(dst), "%s %s", l4proto,
+                 directionIn ? "sport" : "dport");
+
+        if (nftablesAddItem(nrule, vars, src, &portData->dataSrcPortStart,
+                            &portData->dataSrcPortEnd, '-', false) < 0 ||
+            nftablesAddItem(nrule, vars, dst, &portData->dataDstPortStart,
+                            &portData->dataDstPortEnd, '-', false) < 0)
+            return -1;
+    }
+
+    if (rule->prtclType == VIR_NWFILTER_RULE_PROTOCOL_ICMP ||
+        rule->prtclType == VIR_NWFILTER_RULE_PROTOCOL_ICMPV6) {
+        icmpHdrFilterDefPtr icmpHdr = &rule->p.icmpHdrFilter;
+        const char *icmp = ipv6 ? "icmpv6" : "icmp";
+
+        if (HAS_ENTRY_ITEM(&icmpHdr->dataICMPType)) {
+            hasICMPType = true;
+
+            if (chain->maySkipICMP) {
+                *skip = true;
+                return 0;
+            }
+
+            if (ENTRY_WANT_NEG_SIGN(&icmpHdr->dataICMPType) &&
+                HAS_ENTRY_ITEM(&icmpHdr->dataICMPCode)) {
+                virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                               _("negating a combined ICMP type and code "
+                                 "match is not supported by the nftables "
+                                 "driver"));
+                return -1;
+            }
+
+            snprintf(key, sizeof(key), "%s type", icmp);
+            if (nftablesAddItem(nrule, vars, key, &icmpHdr->dataICMPType,
+                                NULL, 0, false) < 0)
+                return -1;
+
+            snprintf(key, sizeof(key), "%s code", icmp);
+            if (nftablesAddItem(nrule, vars, key, &icmpHdr->dataICMPCode,
+                                NULL, 0, false) < 0)
+                return -1;
+        }
+    }
+
+    if ((srcMacSkipped && nmatches == nrule->nmatches) || skipRule) {
+        *skip = true;
+        return 0;
+    }
+
+    if (rule->action != VIR_NWFILTER_RULE_ACTION_ACCEPT)
+        skipMatch = chain->defMatch;
+
+    if (chain->match[0] && !skipMatch) {
+        if (nftablesRuleAddMatch(nrule, "ct state", false, chain->match) < 0)
+            return -1;
+
+        /* the reply direction of a connection going to the VM is the
+         * direction in which traffic is sent by the VM */
+        if (chain->defMatch && !hasICMPType &&
+            rule->tt != VIR_NWFILTER_RULE_DIRECTION_INOUT &&
+            nftablesRuleAddMatch(nrule, "ct direction", false,
+                                 directionIn ? "reply" : "original") < 0)
+            return -1;
+    }
+
+    if (HAS_ENTRY_ITEM(&ipHdr->dataIPSet) &&
+        HAS_ENTRY_ITEM(&ipHdr->dataIPSetFlags)) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("matching against ipsets is not supported "
+                         "by the nftables driver"));
+        return -1;
+    }
+
+    if (HAS_ENTRY_ITEM(&ipHdr->dataConnlimitAbove) && !directionIn) {
+        /* 'ct count N' matches when the limit is not exceeded */
+        if (nftablesAddItem(nrule, vars,
+                            ENTRY_WANT_NEG_SIGN(&ipHdr->dataConnlimitAbove)
+                            ? "ct count" : "ct count over",
+                            &ipHdr->dataConnlimitAbove, NULL, 0, false) < 0)
+            return -1;
+        nrule->matches[nrule->nmatches - 1].neg = false;
+    }
+
+    if (nftablesRuleAddStatement(nrule, nftablesVerdict(rule, false)) < 0)
+        return -1;
+
+    /* keep comments behind everything else */
+    if (HAS_ENTRY_ITEM(&ipHdr->dataComment) &&
+        nftablesAddComment(nrule, ipHdr->dataComment.u.string) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static void
+nftablesFormatMatch(virBufferPtr buf,
+                    nftablesMatchPtr match)
+{
+    if (!match->value)
+        virBufferAdd(buf, match->key, -1);
+    else
+        virBufferAsprintf(buf, "%s %s%s", match->key,
+                          match->neg ? "!= " : "", match->value);
+}
+
+
+static char *
+nftablesFormatRule(nftablesRulePtr rule)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+
+    for (i = 0; i < rule->nmatches; i++) {
+        if (i > 0)
+            virBufferAddLit(&buf, " ");
+        nftablesFormatMatch(&buf, &rule->matches[i]);
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+/*
+ * Adds @line to @chain unless it is already present in @seen, which
+ * records the lines added so far. Consumes @line.
+ */
+static int
+nftablesChainAddLine(nftablesChainPtr chain,
+                     virHashTablePtr seen,
+                     char *line)
+{
+    int ret = 0;
+
+    if (!virHashLookup(seen, line)) {
+        virBufferAsprintf(&chain->buf, "        %s\n", line);
+        ret = virHashAddEntry(seen, line, chain);
+    }
+
+    VIR_FREE(line);
+    return ret;
+}
+
+
+/*
+ * Find the columns in which the instantiations of a rule differ. Returns
+ * false if the instantiations don't have the same structure so that they
+ * cannot be merged.
+ */
+static bool
+nftablesRulesGetVarColumns(nftablesRulePtr rules,
+                           size_t nrules,
+                           bool *varcols,
+                           size_t *nvarcols)
+{
+    size_t i, j;
+
+    *nvarcols = 0;
+
+    for (i = 1; i < nrules; i++) {
+        if (rules[i].nmatches != rules[0].nmatches)
+            return false;
+    }
+
+    for (j = 0; j < rules[0].nmatches; j++) {
+        nftablesMatchPtr first = &rules[0].matches[j];
+
+        varcols[j] = false;
+        for (i = 1; i < nrules; i++) {
+            nftablesMatchPtr match = &rules[i].matches[j];
+
+            if (STRNEQ(match->key, first->key) ||
+                match->neg != first->neg ||
+                !match->value != !first->value)
+                return false;
+
+            if (match->value && STRNEQ(match->value, first->value))
+                varcols[j] = true;
+        }
+        if (varcols[j])
+            (*nvarcols)++;
+    }
+
+    return true;
+}
+
+
+/*
+ * Sets can only be used for positive matches; intervals and masked
+ * keys are left to individual rules, so that overlapping elements
+ * cannot make nft reject the set.
+ */
+static bool
+nftablesRulesCanMerge(nftablesRulePtr rules,
+                      size_t nrules,
+                      bool *varcols,
+                      size_t nvarcols)
+{
+    size_t i, j;
+
+    for (j = 0; j < rules[0].nmatches; j++) {
+        if (!varcols[j])
+            continue;
+
+        if (rules[0].matches[j].neg)
+            return false;
+
+        if (nvarcols > 1 && strchr(rules[0].matches[j].key, '&'))
+            return false;
+
+        for (i = 0; i < nrules; i++) {
+            if (strpbrk(rules[i].matches[j].value, "/-"))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*
+ * nftablesChainAddRules:
+ * @chain: The chain to add the rules to
+ * @rules: The instantiations of one rule for all combinations of its
+ *         variables' values
+ * @nrules: The number of instantiations
+ *
+ * Merge the instantiations of a rule into a single rule matching
+ * against a set where possible and add the result to @chain.
+ *
+ * Returns 0 in case of success, -1 otherwise
+ */
+static int
+nftablesChainAddRules(nftablesChainPtr chain,
+                      nftablesRulePtr rules,
+                      size_t nrules)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    bool *varcols = NULL;
+    size_t nvarcols;
+    virHashTablePtr seen = NULL;
+    virHashTablePtr elems = NULL;
+    char *line;
+    bool setDone = false;
+    size_t i, j;
+    int ret = -1;
+
+    if (nrules == 0)
+        return 0;
+
+    if (VIR_ALLOC_N(varcols, rules[0].nmatches) < 0 ||
+        !(seen = virHashCreate(nrules, NULL)))
+        goto cleanup;
+
+    if (!nftablesRulesGetVarColumns(rules, nrules, varcols, &nvarcols) ||
+        (nvarcols > 0 &&
+         !nftablesRulesCanMerge(rules, nrules, varcols, nvarcols))) {
+        for (i = 0; i < nrules; i++) {
+            if (!(line = nftablesFormatRule(&rules[i])) ||
+                nftablesChainAddLine(chain, seen, line) < 0)
+                goto cleanup;
+        }
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (nvarcols == 0) {
+        if (!(line = nftablesFormatRule(&rules[0])) ||
+            nftablesChainAddLine(chain, seen, line) < 0)
+            goto cleanup;
+        ret = 0;
+        goto cleanup;
+    }
+
+    for (j = 0; j < rules[0].nmatches; j++) {
+        bool first = true;
+
+        if (varcols[j] && setDone)
+            continue;
+
+        if (j > 0)
+            virBufferAddLit(&buf, " ");
+
+        if (!varcols[j]) {
+            nftablesFormatMatch(&buf, &rules[0].matches[j]);
+            continue;
+        }
+
+        /* all differing columns are combined into a single
+         * (concatenated) set at the position of the first one */
+        for (i = j; i < rules[0].nmatches; i++) {
+            if (!varcols[i])
+                continue;
+            if (!first)
+                virBufferAddLit(&buf, " . ");
+            virBufferAdd(&buf, rules[0].matches[i].key, -1);
+            first = false;
+        }
+        virBufferAddLit(&buf, " { ");
+
+        if (!(elems = virHashCreate(nrules, NULL)))
+            goto cleanup;
+
+        for (i = 0; i < nrules; i++) {
+            virBuffer elem = VIR_BUFFER_INITIALIZER;
+            size_t k;
+            char *str;
+
+            first = true;
+            for (k = j; k < rules[i].nmatches; k++) {
+                if (!varcols[k])
+                    continue;
+                if (!first)
+                    virBufferAddLit(&elem, " . ");
+                virBufferAdd(&elem, rules[i].matches[k].value, -1);
+                first = false;
+            }
+
+            if (virBufferCheckError(&elem) < 0)
+                goto cleanup;
+            str = virBufferContentAndReset(&elem);
+
+            if (!virHashLookup(elems, str)) {
+                if (virHashSize(elems) > 0)
+                    virBufferAddLit(&buf, ", ");
+                virBufferAdd(&buf, str, -1);
+                if (virHashAddEntry(elems, str, chain) < 0) {
+                    VIR_FREE(str);
+                    goto cleanup;
+                }
+            }
+            VIR_FREE(str);
+        }
+
+        virBufferAddLit(&buf, " }");
+        setDone = true;
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+
+    line = virBufferContentAndReset(&buf);
+    if (nftablesChainAddLine(chain, seen, line) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    virHashFree(elems);
+    virHashFree(seen);
+    VIR_FREE(varcols);
+    return ret;
+}
+
+
+/*
+ * nftablesRuleInstCommand:
+ * @table: The table to add the rules to
+ * @rule: The rule instance to convert
+ *
+ * Instantiate the rule for all combinations of the values of the
+ * variables it accesses and add the results to the chains of @table
+ *
+ * Returns 0 in case of success, -1 otherwise
+ */
+static int
+nftablesRuleInstCommand(nftablesTablePtr table,
+                        virNWFilterRuleInstPtr rule)
+{
+    virNWFilterVarCombIterPtr vciter, tmp;
+    nftablesL3Chain l3chains[3];
+    char chainnames[3][NFTABLES_CHAINNAME_LENGTH];
+    nftablesRulePtr rules[3] = { NULL, NULL, NULL };
+    size_t nrules[3] = { 0, 0, 0 };
+    size_t nchains = 0;
+    bool layer2 = virNWFilterRuleIsProtocolEthernet(rule->def);
+    bool root = STREQ(rule->chainSuffix,
+                      virNWFilterChainSuffixTypeToString(
+                          VIR_NWFILTER_CHAINSUFFIX_ROOT));
+    bool reverse[2];
+    size_t i;
+    int ret = -1;
+
+    if (layer2) {
+        if (rule->def->tt == VIR_NWFILTER_RULE_DIRECTION_OUT ||
+            rule->def->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT) {
+            if (root)
+                snprintf(chainnames[nchains], sizeof(chainnames[0]),
+                         "%s", NFTABLES_CHAIN_IN);
+            else
+                snprintf(chainnames[nchains], sizeof(chainnames[0]),
+                         "%s-%s", NFTABLES_CHAIN_IN, rule->chainSuffix);
+            reverse[nchains] =
+                rule->def->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT;
+            nchains++;
+        }
+
+        if (rule->def->tt == VIR_NWFILTER_RULE_DIRECTION_IN ||
+            rule->def->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT) {
+            if (root)
+                snprintf(chainnames[nchains], sizeof(chainnames[0]),
+                         "%s", NFTABLES_CHAIN_OUT);
+            else
+                snprintf(chainnames[nchains], sizeof(chainnames[0]),
+                         "%s-%s", NFTABLES_CHAIN_OUT, rule->chainSuffix);
+            reverse[nchains] = false;
+            nchains++;
+        }
+    } else {
+        nchains = nftablesGetL3Chains(rule->def, l3chains);
+        for (i = 0; i < nchains; i++)
+            ignore_value(virStrcpyStatic(chainnames[i], l3chains[i].name));
+    }
+
+    /* rule->vars holds all the variables names that this rule will access.
+     * iterate over all combinations of the variables' values and instantiate
+     * the filtering rule with each combination.
+     */
+    tmp = vciter = virNWFilterVarCombIterCreate(rule->vars,
+                                                rule->def->varAccess,
+                                                rule->def->nVarAccess);
+    if (!vciter)
+        return -1;
+
+    do {
+        for (i = 0; i < nchains; i++) {
+            nftablesRule nrule = { NULL, 0 };
+            bool skip = false;
+            int rc;
+
+            if (layer2)
+                rc = nftablesCreateL2Rule(rule->def, tmp, reverse[i], &nrule);
+            else
+                rc = nftablesCreateL3Rule(rule->def, tmp, &l3chains[i],
+                                          &nrule, &skip);
+
+            if (rc < 0) {
+                nftablesRuleClear(&nrule);
+                goto cleanup;
+            }
+
+            if (skip) {
+                nftablesRuleClear(&nrule);
+                continue;
+            }
+
+            if (VIR_APPEND_ELEMENT(rules[i], nrules[i], nrule) < 0) {
+                nftablesRuleClear(&nrule);
+                goto cleanup;
+            }
+        }
+        tmp = virNWFilterVarCombIterNext(tmp);
+    } while (tmp != NULL);
+
+    for (i = 0; i < nchains; i++) {
+        nftablesChainPtr chain;
+
+        if (!(chain = nftablesTableGetChain(table, chainnames[i])) ||
+            nftablesChainAddRules(chain, rules[i], nrules[i]) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    for (i = 0; i < nchains; i++)
+        nftablesRuleListFree(rules[i], nrules[i]);
+    virNWFilterVarCombIterFree(vciter);
+    return ret;
+}
+
+
+/*
+ * Add the jumps into the sub-chains accumulated for a root chain. Jumps
+ * selected by consecutive distinct ethertypes are combined into a single
+ * verdict map lookup.
+ */
+static int
+nftablesFlushSubChainJumps(nftablesTablePtr table,
+                           bool incoming,
+                           nftablesSubChainPtr *jumps,
+                           size_t *njumps)
+{
+    const char *prefix = incoming ? NFTABLES_CHAIN_IN : NFTABLES_CHAIN_OUT;
+    nftablesChainPtr root;
+    size_t i, j, k;
+
+    if (*njumps == 0)
+        return 0;
+
+    if (!(root = nftablesTableGetChain(table, prefix)))
+        return -1;
+
+    for (i = 0; i < *njumps; i = j) {
+        nftablesSubChainPtr jump = jumps[i];
+
+        if (!jump->ethertype) {
+            virBufferAddLit(&root->buf, "        ");
+            if (jump->daddr)
+                virBufferAsprintf(&root->buf, "ether daddr %s ", jump->daddr);
+            virBufferAsprintf(&root->buf, "jump %s-%s\n",
+                              prefix, jump->filtername);
+            j = i + 1;
+            continue;
+        }
+
+        for (j = i + 1; j < *njumps && jumps[j]->ethertype; j++) {
+            for (k = i; k < j; k++) {
+                if (STREQ(jumps[k]->ethertype, jumps[j]->ethertype))
+                    break;
+            }
+            if (k < j)
+                break;
+        }
+
+        if (j == i + 1) {
+            virBufferAsprintf(&root->buf, "        ether type %s jump %s-%s\n",
+                              jump->ethertype, prefix, jump->filtername);
+            continue;
+        }
+
+        virBufferAddLit(&root->buf, "        ether type vmap { ");
+        for (k = i; k < j; k++)
+            virBufferAsprintf(&root->buf, "%s%s : jump %s-%s",
+                              k > i ? ", " : "", jumps[k]->ethertype,
+                              prefix, jumps[k]->filtername);
+        virBufferAddLit(&root->buf, " }\n");
+    }
+
+    *njumps = 0;
+    return 0;
+}
+
+
+static int
+nftablesGetSubChains(virHashTablePtr chains,
+                     bool incoming,
+                     nftablesSubChainPtr *subchains,
+                     size_t *nsubchains)
+{
+    const char *root = virNWFilterChainSuffixTypeToString(
+                           VIR_NWFILTER_CHAINSUFFIX_ROOT);
+    virHashKeyValuePairPtr filter_names;
+    size_t i, j;
+
+    if (!(filter_names = virHashGetItems(chains, NULL)))
+        return -1;
+
+    for (i = 0; filter_names[i].key; i++) {
+        nftablesSubChain subchain;
+
+        if (STREQ(filter_names[i].key, root))
+            continue;
+
+        for (j = 0; nftablesSubChainProtos[j].prefix; j++) {
+            if (STRPREFIX(filter_names[i].key, nftablesSubChainProtos[j].prefix))
+                break;
+        }
+        if (!nftablesSubChainProtos[j].prefix)
+            continue;
+
+        subchain.priority = *(const virNWFilterChainPriority *)filter_names[i].value;
+        subchain.incoming = incoming;
+        subchain.filtername = filter_names[i].key;
+        subchain.ethertype = nftablesSubChainProtos[j].ethertype;
+        subchain.daddr = nftablesSubChainProtos[j].daddr;
+
+        if (VIR_APPEND_ELEMENT(*subchains, *nsubchains, subchain) < 0) {
+            VIR_FREE(filter_names);
+            return -1;
+        }
+    }
+
+    VIR_FREE(filter_names);
+    return 0;
+}
+
+
+static int
+nftablesSubChainSort(const void *a, const void *b)
+{
+    const nftablesSubChain *insta = a;
+    const nftablesSubChain *instb = b;
+
+    /* priorities are limited to range [-1000, 1000] */
+    return insta->priority - instb->priority;
+}
+
+
+static int
+nftablesRuleInstSort(const void *a, const void *b)
+{
+    const virNWFilterRuleInst *insta = *(virNWFilterRuleInst * const *)a;
+    const virNWFilterRuleInst *instb = *(virNWFilterRuleInst * const *)b;
+    const char *root = virNWFilterChainSuffixTypeToString(
+                                     VIR_NWFILTER_CHAINSUFFIX_ROOT);
+    bool root_a = STREQ(insta->chainSuffix, root);
+    bool root_b = STREQ(instb->chainSuffix, root);
+
+    /* the same order as used by the ebiptables driver */
+    if (root_a != root_b)
+        return root_a ? -1 : 1;
+
+    /* priorities are limited to range [-1000, 1000] */
+    return insta->priority - instb->priority;
+}
+
+
+/*
+ * Format the chains of @table followed by the base chains hooking them
+ * up for traffic from and to @ifname.
+ */
+static char *
+nftablesTableFormat(nftablesTablePtr table,
+                    const char *ifname)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    const char *roots[] = {
+        NFTABLES_CHAIN_IN, NFTABLES_CHAIN_OUT,
+        NFTABLES_CHAIN_FWD_IN, NFTABLES_CHAIN_FWD_OUT,
+        NFTABLES_CHAIN_HOST_IN,
+    };
+    size_t i, j;
+
+    /* chains need to be declared before they are jumped to */
+    for (i = 0; i < table->nchains; i++) {
+        if (nftablesIsRootChain(table->chains[i]->name))
+            continue;
+        virBufferAsprintf(&buf, "    chain %s {\n", table->chains[i]->name);
+        virBufferAddBuffer(&buf, &table->chains[i]->buf);
+        virBufferAddLit(&buf, "    }\n");
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(roots); i++) {
+        for (j = 0; j < table->nchains; j++) {
+            if (STRNEQ(table->chains[j]->name, roots[i]))
+                continue;
+            virBufferAsprintf(&buf, "    chain %s {\n", roots[i]);
+            virBufferAddBuffer(&buf, &table->chains[j]->buf);
+            virBufferAddLit(&buf, "    }\n");
+        }
+    }
+
+    if (nftablesTableHasChain(table, NFTABLES_CHAIN_IN)) {
+        virBufferAddLit(&buf, "    chain prerouting {\n");
+        virBufferAddLit(&buf, "        type filter hook prerouting "
+                              "priority -300; policy accept;\n");
+        virBufferAsprintf(&buf, "        iifname \"%s\" jump %s\n",
+                          ifname, NFTABLES_CHAIN_IN);
+        virBufferAddLit(&buf, "    }\n");
+    }
+
+    if (nftablesTableHasChain(table, NFTABLES_CHAIN_OUT)) {
+        virBufferAddLit(&buf, "    chain postrouting {\n");
+        virBufferAddLit(&buf, "        type filter hook postrouting "
+                              "priority 300; policy accept;\n");
+        virBufferAsprintf(&buf, "        oifname \"%s\" jump %s\n",
+                          ifname, NFTABLES_CHAIN_OUT);
+        virBufferAddLit(&buf, "    }\n");
+    }
+
+    if (nftablesTableHasChain(table, NFTABLES_CHAIN_FWD_IN)) {
+        virBufferAddLit(&buf, "    chain forward {\n");
+        virBufferAddLit(&buf, "        type filter hook forward "
+                              "priority 0; policy accept;\n");
+        virBufferAsprintf(&buf, "        iifname \"%s\" jump %s\n",
+                          ifname, NFTABLES_CHAIN_FWD_IN);
+        virBufferAsprintf(&buf, "        oifname \"%s\" jump %s\n",
+                          ifname, NFTABLES_CHAIN_FWD_OUT);
+        virBufferAddLit(&buf, "    }\n");
+    }
+
+    if (nftablesTableHasChain(table, NFTABLES_CHAIN_HOST_IN)) {
+        virBufferAddLit(&buf, "    chain input {\n");
+        virBufferAddLit(&buf, "        type filter hook input "
+                              "priority 0; policy accept;\n");
+        virBufferAsprintf(&buf, "        iifname \"%s\" jump %s\n",
+                          ifname, NFTABLES_CHAIN_HOST_IN);
+        virBufferAddLit(&buf, "    }\n");
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+static void
+nftablesFormatDeleteTable(virBufferPtr buf,
+                          const char *prefix,
+                          const char *ifname)
+{
+    /* adding the table first makes deleting it succeed in any case */
+    virBufferAsprintf(buf, "add table %s %s%s\n",
+                      NFTABLES_TABLE_FAMILY, prefix, ifname);
+    virBufferAsprintf(buf, "delete table %s %s%s\n",
+                      NFTABLES_TABLE_FAMILY, prefix, ifname);
+}
+
+
+static void
+nftablesFormatReplaceTable(virBufferPtr buf,
+                           const char *prefix,
+                           const char *ifname,
+                           const char *body)
+{
+    nftablesFormatDeleteTable(buf, prefix, ifname);
+    virBufferAsprintf(buf, "table %s %s%s {\n",
+                      NFTABLES_TABLE_FAMILY, prefix, ifname);
+    virBufferAdd(buf, body, -1);
+    virBufferAddLit(buf, "}\n");
+}
+
+
+/*
+ * nftablesRunScript:
+ * @ifname: The interface the rules are for
+ * @buf: The script to run
+ *
+ * Run the script with nft, which applies it as a single transaction.
+ *
+ * Returns 0 in case of success, -1 otherwise
+ */
+static int
+nftablesRunScript(const char *ifname,
+                  virBufferPtr buf)
+{
+    virCommandPtr cmd = NULL;
+    char *script = NULL;
+    char *errbuf = NULL;
+    int status;
+    int ret = -1;
+
+    if (virBufferCheckError(buf) < 0)
+        goto cleanup;
+
+    script = virBufferContentAndReset(buf);
+
+    VIR_DEBUG("Applying rules for %s: %s", ifname, script);
+
+    cmd = virCommandNewArgList(NFT_PATH, "-f", "-", NULL);
+    virCommandSetInputBuffer(cmd, script);
+    virCommandSetErrorBuffer(cmd, &errbuf);
+
+    if (virCommandRun(cmd, &status) < 0)
+        goto cleanup;
+
+    if (status != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Failed to apply nftables rules for "
+                         "interface %s: %s"),
+                       ifname, NULLSTR(errbuf));
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virCommandFree(cmd);
+    VIR_FREE(script);
+    VIR_FREE(errbuf);
+    return ret;
+}
+
+
+static int
+nftablesSetPending(const char *ifname,
+                   char *body)
+{
+    int ret;
+
+    virMutexLock(&nftablesLock);
+    if (body)
+        ret = virHashUpdateEntry(nftablesPending, ifname, body);
+    else
+        ret = virHashRemoveEntry(nftablesPending, ifname);
+    virMutexUnlock(&nftablesLock);
+
+    return ret;
+}
+
+
+static char *
+nftablesStealPending(const char *ifname)
+{
+    char *body;
+
+    virMutexLock(&nftablesLock);
+    body = virHashSteal(nftablesPending, ifname);
+    virMutexUnlock(&nftablesLock);
+
+    return body;
+}
+
+
+static int
+nftablesApplyNewRules(const char *ifname,
+                      virNWFilterRuleInstPtr *rules,
+                      size_t nrules)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    nftablesTable table = { NULL, 0 };
+    virHashTablePtr chains_in_set = NULL;
+    virHashTablePtr chains_out_set = NULL;
+    nftablesSubChainPtr subchains = NULL;
+    size_t nsubchains = 0;
+    nftablesSubChainPtr *jumps[2] = { NULL, NULL };
+    size_t njumps[2] = { 0, 0 };
+    char *body = NULL;
+    size_t i, j;
+    int ret = -1;
+
+    if (nftablesInitialize() < 0)
+        return -1;
+
+    if (!(chains_in_set = virHashCreate(10, NULL)) ||
+        !(chains_out_set = virHashCreate(10, NULL)))
+        goto cleanup;
+
+    if (nrules)
+        qsort(rules, nrules, sizeof(rules[0]), nftablesRuleInstSort);
+
+    /* raise the priority of rules below that of their chain so that
+     * the jump into the chain precedes them, as done by ebiptables */
+    for (i = 0; i < nrules; i++) {
+        if (rules[i]->chainPriority > rules[i]->priority &&
+            !strstr("root", rules[i]->chainSuffix))
+             rules[i]->priority = rules[i]->chainPriority;
+    }
+
+    for (i = 0; i < nrules; i++) {
+        const char *name = rules[i]->chainSuffix;
+
+        if (!virNWFilterRuleIsProtocolEthernet(rules[i]->def))
+            continue;
+
+        if (rules[i]->def->tt == VIR_NWFILTER_RULE_DIRECTION_OUT ||
+            rules[i]->def->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT) {
+            if (virHashUpdateEntry(chains_in_set, name,
+                                   &rules[i]->chainPriority) < 0)
+                goto cleanup;
+        }
+        if (rules[i]->def->tt == VIR_NWFILTER_RULE_DIRECTION_IN ||
+            rules[i]->def->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT) {
+            if (virHashUpdateEntry(chains_out_set, name,
+                                   &rules[i]->chainPriority) < 0)
+                goto cleanup;
+        }
+    }
+
+    /* the root chains are created even if they remain empty */
+    if (virHashSize(chains_in_set) > 0 &&
+        (!nftablesTableGetChain(&table, NFTABLES_CHAIN_IN) ||
+         nftablesGetSubChains(chains_in_set, true,
+                              &subchains, &nsubchains) < 0))
+        goto cleanup;
+    if (virHashSize(chains_out_set) > 0 &&
+        (!nftablesTableGetChain(&table, NFTABLES_CHAIN_OUT) ||
+         nftablesGetSubChains(chains_out_set, false,
+                              &subchains, &nsubchains) < 0))
+        goto cleanup;
+
+    if (nsubchains > 0)
+        qsort(subchains, nsubchains, sizeof(subchains[0]),
+              nftablesSubChainSort);
+
+    for (i = 0, j = 0; i < nrules; i++) {
+        virNWFilterRuleDefPtr def = rules[i]->def;
+
+        if (!virNWFilterRuleIsProtocolEthernet(def))
+            continue;
+
+        while (j < nsubchains &&
+               subchains[j].priority <= rules[i]->priority) {
+            nftablesSubChainPtr subchain = &subchains[j];
+            size_t idx = subchain->incoming ? 0 : 1;
+            char name[NFTABLES_CHAINNAME_LENGTH];
+
+            snprintf(name, sizeof(name), "%s-%s",
+                     subchain->incoming ? NFTABLES_CHAIN_IN
+                                        : NFTABLES_CHAIN_OUT,
+                     subchain->filtername);
+            if (!nftablesTableGetChain(&table, name) ||
+                VIR_APPEND_ELEMENT(jumps[idx], njumps[idx], subchain) < 0)
+                goto cleanup;
+            j++;
+        }
+
+        /* pending jumps need to be placed before rules of the root
+         * chains they go into */
+        if (STREQ(rules[i]->chainSuffix,
+                  virNWFilterChainSuffixTypeToString(
+                      VIR_NWFILTER_CHAINSUFFIX_ROOT))) {
+            if ((def->tt == VIR_NWFILTER_RULE_DIRECTION_OUT ||
+                 def->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT) &&
+                nftablesFlushSubChainJumps(&table, true,
+                                           jumps[0], &njumps[0]) < 0)
+                goto cleanup;
+            if ((def->tt == VIR_NWFILTER_RULE_DIRECTION_IN ||
+                 def->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT) &&
+                nftablesFlushSubChainJumps(&table, false,
+                                           jumps[1], &njumps[1]) < 0)
+                goto cleanup;
+        }
+
+        if (nftablesRuleInstCommand(&table, rules[i]) < 0)
+            goto cleanup;
+    }
+
+    while (j < nsubchains) {
+        nftablesSubChainPtr subchain = &subchains[j];
+        size_t idx = subchain->incoming ? 0 : 1;
+        char name[NFTABLES_CHAINNAME_LENGTH];
+
+        snprintf(name, sizeof(name), "%s-%s",
+                 subchain->incoming ? NFTABLES_CHAIN_IN : NFTABLES_CHAIN_OUT,
+                 subchain->filtername);
+        if (!nftablesTableGetChain(&table, name) ||
+            VIR_APPEND_ELEMENT(jumps[idx], njumps[idx], subchain) < 0)
+            goto cleanup;
+        j++;
+    }
+
+    if (nftablesFlushSubChainJumps(&table, true, jumps[0], &njumps[0]) < 0 ||
+        nftablesFlushSubChainJumps(&table, false, jumps[1], &njumps[1]) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nrules; i++) {
+        if (virNWFilterRuleIsProtocolEthernet(rules[i]->def))
+            continue;
+
+        if (!nftablesTableGetChain(&table, NFTABLES_CHAIN_FWD_IN) ||
+            !nftablesTableGetChain(&table, NFTABLES_CHAIN_FWD_OUT) ||
+            !nftablesTableGetChain(&table, NFTABLES_CHAIN_HOST_IN) ||
+            nftablesRuleInstCommand(&table, rules[i]) < 0)
+            goto cleanup;
+    }
+
+    if (!(body = nftablesTableFormat(&table, ifname)))
+        goto cleanup;
+
+    nftablesFormatReplaceTable(&buf, NFTABLES_TABLE_PREFIX_TEMP, ifname, body);
+
+    if (nftablesRunScript(ifname, &buf) < 0)
+        goto cleanup;
+
+    if (nftablesSetPending(ifname, body) < 0)
+        goto cleanup;
+    body = NULL;
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(body);
+    VIR_FREE(jumps[0]);
+    VIR_FREE(jumps[1]);
+    VIR_FREE(subchains);
+    nftablesTableClear(&table);
+    virHashFree(chains_in_set);
+    virHashFree(chains_out_set);
+    return ret;
+}
+
+
+static int
+nftablesTearNewRules(const char *ifname)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+
+    if (nftablesInitialize() < 0 ||
+        nftablesSetPending(ifname, NULL) < 0)
+        return -1;
+
+    nftablesFormatDeleteTable(&buf, NFTABLES_TABLE_PREFIX_TEMP, ifname);
+
+    return nftablesRunScript(ifname, &buf);
+}
+
+
+static int
+nftablesTearOldRules(const char *ifname)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *body;
+    int ret;
+
+    if (nftablesInitialize() < 0)
+        return -1;
+
+    body = nftablesStealPending(ifname);
+
+    /* replace the old rules by the new ones in a single transaction */
+    nftablesFormatDeleteTable(&buf, NFTABLES_TABLE_PREFIX_TEMP, ifname);
+    if (body)
+        nftablesFormatReplaceTable(&buf, NFTABLES_TABLE_PREFIX, ifname, body);
+    else
+        nftablesFormatDeleteTable(&buf, NFTABLES_TABLE_PREFIX, ifname);
+
+    ret = nftablesRunScript(ifname, &buf);
+
+    VIR_FREE(body);
+    return ret;
+}
+
+
+/**
+ * nftablesAllTeardown:
+ * @ifname : the name of the interface to which the rules apply
+ *
+ * Unconditionally remove all tables that were created for the given
+ * interface (ifname).
+ *
+ * Returns 0 on success, -1 on failure
+ */
+static int
+nftablesAllTeardown(const char *ifname)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+
+    if (nftablesInitialize() < 0 ||
+        nftablesSetPending(ifname, NULL) < 0)
+        return -1;
+
+    nftablesFormatDeleteTable(&buf, NFTABLES_TABLE_PREFIX_TEMP, ifname);
+    nftablesFormatDeleteTable(&buf, NFTABLES_TABLE_PREFIX, ifname);
+
+    return nftablesRunScript(ifname, &buf);
+}
+
+
+/*
+ * nftablesApplyBasicTable:
+ * @ifname: name of the backend-interface to which to apply the rules
+ * @in: the rules of the 'I' chain
+ * @out: the rules of the 'O' chain, may be NULL
+ * @leaveTemporary: whether to put the rules into the temporary table
+ *
+ * Replace all rules of the interface by the given ones.
+ *
+ * Returns 0 on success, -1 on failure with the rules removed
+ */
+static int
+nftablesApplyBasicTable(const char *ifname,
+                        virBufferPtr in,
+                        virBufferPtr out,
+                        bool leaveTemporary)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    nftablesTable table = { NULL, 0 };
+    nftablesChainPtr chain;
+    char *body = NULL;
+    int ret = -1;
+
+    if (nftablesAllTeardown(ifname) < 0)
+        goto cleanup;
+
+    if (!(chain = nftablesTableGetChain(&table, NFTABLES_CHAIN_IN)))
+        goto cleanup;
+    virBufferAddBuffer(&chain->buf, in);
+
+    if (out) {
+        if (!(chain = nftablesTableGetChain(&table, NFTABLES_CHAIN_OUT)))
+            goto cleanup;
+        virBufferAddBuffer(&chain->buf, out);
+    }
+
+    if (!(body = nftablesTableFormat(&table, ifname)))
+        goto cleanup;
+
+    nftablesFormatReplaceTable(&buf,
+                               leaveTemporary ? NFTABLES_TABLE_PREFIX_TEMP
+                                              : NFTABLES_TABLE_PREFIX,
+                               ifname, body);
+
+    if (nftablesRunScript(ifname, &buf) < 0) {
+        nftablesAllTeardown(ifname);
+        goto cleanup;
+    }
+
+    if (leaveTemporary) {
+        if (nftablesSetPending(ifname, body) < 0)
+            goto cleanup;
+        body = NULL;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    virBufferFreeAndReset(in);
+    if (out)
+        virBufferFreeAndReset(out);
+    nftablesTableClear(&table);
+    VIR_FREE(body);
+    return ret;
+}
+
+
+static int
+nftablesCanApplyBasicRules(void)
+{
+    return true;
+}
+
+
+/**
+ * nftablesApplyBasicRules
+ *
+ * @ifname: name of the backend-interface to which to apply the rules
+ * @macaddr: MAC address the VM is using in packets sent through the
+ *    interface
+ *
+ * Returns 0 on success, -1 on failure with the rules removed
+ *
+ * Apply basic filtering rules on the given interface
+ * - filtering for MAC address spoofing
+ * - allowing IPv4 & ARP traffic
+ */
+static int
+nftablesApplyBasicRules(const char *ifname,
+                        const virMacAddr *macaddr)
+{
+    virBuffer in = VIR_BUFFER_INITIALIZER;
+    char macaddr_str[VIR_MAC_STRING_BUFLEN];
+
+    virMacAddrFormat(macaddr, macaddr_str);
+
+    virBufferAsprintf(&in, "        ether saddr != %s drop\n", macaddr_str);
+    virBufferAddLit(&in, "        ether type vmap { ip : accept, arp : accept }\n");
+    virBufferAddLit(&in, "        drop\n");
+
+    return nftablesApplyBasicTable(ifname, &in, NULL, false);
+}
+
+
+/**
+ * nftablesApplyDHCPOnlyRules
+ *
+ * @ifname: name of the backend-interface to which to apply the rules
+ * @macaddr: MAC address the VM is using in packets sent through the
+ *    interface
+ * @dhcpsrvrs: The DHCP server(s) from which the VM may receive traffic
+ *    from; may be NULL
+ * @leaveTemporary: Whether to leave the rules in the temporary table
+ *    (true) or to make them the final ones as part of this call (false)
+ *
+ * Returns 0 on success, -1 on failure with the rules removed
+ *
+ * Apply filtering rules so that the VM can only send and receive
+ * DHCP traffic and nothing else.
+ */
+static int
+nftablesApplyDHCPOnlyRules(const char *ifname,
+                           const virMacAddr *macaddr,
+                           virNWFilterVarValuePtr dhcpsrvrs,
+                           bool leaveTemporary)
+{
+    virBuffer in = VIR_BUFFER_INITIALIZER;
+    virBuffer out = VIR_BUFFER_INITIALIZER;
+    char macaddr_str[VIR_MAC_STRING_BUFLEN];
+    unsigned int num_dhcpsrvrs;
+    size_t i;
+
+    virMacAddrFormat(macaddr, macaddr_str);
+
+    virBufferAsprintf(&in,
+                      "        ether saddr %s ether type ip "
+                      "udp sport 68 udp dport 67 accept\n",
+                      macaddr_str);
+    virBufferAddLit(&in, "        drop\n");
+
+    num_dhcpsrvrs = (dhcpsrvrs != NULL)
+                    ? virNWFilterVarValueGetCardinality(dhcpsrvrs)
+                    : 0;
+
+    /* allow responses to the MAC address of the VM or to the broadcast
+     * MAC address, optionally only from the given servers */
+    virBufferAsprintf(&out,
+                      "        ether daddr { %s, ff:ff:ff:ff:ff:ff } "
+                      "ether type ip ",
+                      macaddr_str);
+    if (num_dhcpsrvrs > 0) {
+        virBufferAddLit(&out, "ip saddr { ");
+        for (i = 0; i < num_dhcpsrvrs; i++)
+            virBufferAsprintf(&out, "%s%s", i > 0 ? ", " : "",
+                              virNWFilterVarValueGetNthValue(dhcpsrvrs, i));
+        virBufferAddLit(&out, " } ");
+    }
+    virBufferAddLit(&out, "udp sport 67 udp dport 68 accept\n");
+    virBufferAddLit(&out, "        drop\n");
+
+    return nftablesApplyBasicTable(ifname, &in, &out, leaveTemporary);
+}
+
+
+/**
+ * nftablesApplyDropAllRules
+ *
+ * @ifname: name of the backend-interface to which to apply the rules
+ *
+ * Returns 0 on success, -1 on failure with the rules removed
+ *
+ * Apply filtering rules so that the VM cannot receive or send traffic.
+ */
+static int
+nftablesApplyDropAllRules(const char *ifname)
+{
+    virBuffer in = VIR_BUFFER_INITIALIZER;
+    virBuffer out = VIR_BUFFER_INITIALIZER;
+
+    virBufferAddLit(&in, "        drop\n");
+    virBufferAddLit(&out, "        drop\n");
+
+    return nftablesApplyBasicTable(ifname, &in, &out, false);
+}
+
+
+static int
+nftablesRemoveBasicRules(const char *ifname)
+{
+    return nftablesAllTeardown(ifname);
+}
+
+
+virNWFilterTechDriver nftables_driver = {
+    .name = NFTABLES_DRIVER_ID,
+    .flags = 0,
+
+    .init     = nftablesDriverInit,
+    .shutdown = nftablesDriverShutdown,
+
+    .applyNewRules       = nftablesApplyNewRules,
+    .tearNewRules        = nftablesTearNewRules,
+    .tearOldRules        = nftablesTearOldRules,
+    .allTeardown         = nftablesAllTeardown,
+
+    .canApplyBasicRules  = nftablesCanApplyBasicRules,
+    .applyBasicRules     = nftablesApplyBasicRules,
+    .applyDHCPOnlyRules  = nftablesApplyDHCPOnlyRules,
+    .applyDropAllRules   = nftablesApplyDropAllRules,
+    .removeBasicRules    = nftablesRemoveBasicRules,
+};
+
+
+/*
+ * Check that nft is usable and that the kernel supports connection
+ * tracking in the bridge family, which the layer 3 rules depend on.
+ */
+static int
+nftablesDriverProbe(void)
+{
+    virCommandPtr cmd = NULL;
+    char *errbuf = NULL;
+    int status;
+    int ret = -1;
+
+    if (!virFileIsExecutable(NFT_PATH)) {
+        VIR_INFO("nft not found at %s", NFT_PATH);
+        return -1;
+    }
+
+    cmd = virCommandNewArgList(NFT_PATH, "-c", "-f", "-", NULL);
+    virCommandSetInputBuffer(cmd,
+                             "add table bridge libvirt-nwf-probe\n"
+                             "add chain bridge libvirt-nwf-probe probe\n"
+                             "add rule bridge libvirt-nwf-probe probe "
+                             "ct state established accept\n");
+    virCommandSetErrorBuffer(cmd, &errbuf);
+
+    if (virCommandRun(cmd, &status) < 0)
+        goto cleanup;
+
+    if (status != 0) {
+        VIR_INFO("nftables cannot be used for filtering: %s",
+                 NULLSTR(errbuf));
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virCommandFree(cmd);
+    VIR_FREE(errbuf);
+    return ret;
+}
+
+
+static int
+nftablesDriverInit(bool privileged)
+{
+    if (!privileged)
+        return 0;
+
+    if (nftablesInitialize() < 0)
+        return -1;
+
+    if (nftablesDriverProbe() < 0)
+        return -1;
+
+    nftables_driver.flags = TECHDRV_FLAG_INITIALIZED;
+
+    return 0;
+}
+
+
+static void
+nftablesDriverShutdown(void)
+{
+    nftables_driver.flags = 0;
+}
@@ -89,6 +89,16 @@ struct _qemuAgentMessage {
 };
 
 
+#define QEMU_AGENT_CACHE_TTL 5000 /* ms */
+
+typedef struct _qemuAgentCacheEntry qemuAgentCacheEntry;
+typedef qemuAgentCacheEntry *qemuAgentCacheEntryPtr;
+struct _qemuAgentCacheEntry {
+    char *cmd;
+    virJSONValuePtr reply;
+    unsigned long long expires;
+};
+
 struct _qemuAgent {
     virObjectLockable parent;
 
@@ -122,6 +132,16 @@ struct _qemuAgent {
      * but fire up an event on qemu monitor instead.
      * Take that as indication of successful completion */
     qemuAgentEvent await_event;
+
+    /* Set after a successful guest-sync and cleared whenever a reply
+     * may still be in flight or the agent in the guest was restarted,
+     * so that the handshake is repeated only when necessary */
+    bool inSync;
+
+    /* Replies to read-only queries which can be reused for
+     * QEMU_AGENT_CACHE_TTL milliseconds */
+    qemuAgentCacheEntryPtr cache;
+    size_t ncache;
 };
 
 static virClassPtr qemuAgentClass;
@@ -162,6 +182,19 @@ qemuAgentEscapeNonPrintable(const char *text)
 #endif
 
 
+static void
+qemuAgentCacheFlush(qemuAgentPtr mon)
+{
+    size_t i;
+
+    for (i = 0; i < mon->ncache; i++) {
+        VIR_FREE(mon->cache[i].cmd);
+        virJSONValueFree(mon->cache[i].reply);
+    }
+    VIR_FREE(mon->cache);
+    mon->ncache = 0;
+}
+
 static void qemuAgentDispose(void *obj)
 {
     qemuAgentPtr mon = obj;
@@ -169,6 +202,7 @@ static void qemuAgentDispose(void *obj)
     if (mon->cb && mon->cb->destroy)
         (mon->cb->destroy)(mon, mon->vm);
     virCondDestroy(&mon->notify);
+    qemuAgentCacheFlush(mon);
     VIR_FREE(mon->buffer);
     virResetError(&mon->lastError);
 }
@@ -364,6 +398,7 @@ qemuAgentIOProcessLine(qemuAgentPtr mon,
         } else {
             /* we are out of sync */
             VIR_DEBUG("Ignoring delayed reply");
+            mon->inSync = false;
         }
         ret = 0;
     } else {
@@ -1002,6 +1037,7 @@ qemuAgentGuestSync(qemuAgentPtr mon)
         }
     }
 
+    mon->inSync = true;
     ret = 0;
 
  cleanup:
@@ -1120,11 +1156,11 @@ qemuAgentCheckError(virJSONValuePtr cmd,
 }
 
 static int
-qemuAgentCommand(qemuAgentPtr mon,
-                 virJSONValuePtr cmd,
-                 virJSONValuePtr *reply,
-                 bool needReply,
-                 int seconds)
+qemuAgentCommandRun(qemuAgentPtr mon,
+                    virJSONValuePtr cmd,
+                    virJSONValuePtr *reply,
+                    bool needReply,
+                    int seconds)
 {
     int ret = -1;
     qemuAgentMessage msg;
@@ -1139,7 +1175,8 @@ qemuAgentCommand(qemuAgentPtr mon,
         return -1;
     }
 
-    if (qemuAgentGuestSync(mon) < 0)
+    if (!mon->inSync &&
+        qemuAgentGuestSync(mon) < 0)
         return -1;
 
     memset(&msg, 0, sizeof(msg));
@@ -1157,6 +1194,11 @@ qemuAgentCommand(qemuAgentPtr mon,
     VIR_DEBUG("Receive command reply ret=%d rxObject=%p",
               ret, msg.rxObject);
 
+    /* Without a reply we don't know whether the agent will still send
+     * one later, so the next command has to sync again */
+    if (ret < 0 || !msg.rxObject)
+        mon->inSync = false;
+
     if (ret == 0) {
         /* If we haven't obtained any reply but we wait for an
          * event, then don't report this as error */
@@ -1185,6 +1227,83 @@ qemuAgentCommand(qemuAgentPtr mon,
     return ret;
 }
 
+static int
+qemuAgentCommand(qemuAgentPtr mon,
+                 virJSONValuePtr cmd,
+                 virJSONValuePtr *reply,
+                 bool needReply,
+                 int seconds)
+{
+    /* the command may change what the cached queries return */
+    qemuAgentCacheFlush(mon);
+
+    return qemuAgentCommandRun(mon, cmd, reply, needReply, seconds);
+}
+
+/**
+ * qemuAgentCommandCached:
+ * @mon: Agent
+ * @cmd: command to execute, it must not have side effects in the guest
+ * @reply: filled with a copy of the reply on success
+ * @seconds: timeout as accepted by qemuAgentCommand
+ *
+ * Like qemuAgentCommand but reuses the reply of an identical query that
+ * succeeded in the last QEMU_AGENT_CACHE_TTL milliseconds. Any other
+ * command issued in the meantime flushes the cache.
+ *
+ * Returns 0 on success, -1 or -2 on error as qemuAgentCommand does.
+ */
+static int
+qemuAgentCommandCached(qemuAgentPtr mon,
+                       virJSONValuePtr cmd,
+                       virJSONValuePtr *reply,
+                       int seconds)
+{
+    qemuAgentCacheEntry entry = { NULL, NULL, 0 };
+    unsigned long long now;
+    size_t i;
+    int ret = -1;
+
+    *reply = NULL;
+
+    if (virTimeMillisNow(&now) < 0 ||
+        !(entry.cmd = virJSONValueToString(cmd, false)))
+        return -1;
+
+    for (i = 0; i < mon->ncache; i++) {
+        if (STRNEQ(mon->cache[i].cmd, entry.cmd))
+            continue;
+
+        if (mon->cache[i].expires > now) {
+            VIR_DEBUG("Reusing cached reply for '%s'", entry.cmd);
+            if ((*reply = virJSONValueCopy(mon->cache[i].reply)))
+                ret = 0;
+            goto cleanup;
+        }
+
+        VIR_FREE(mon->cache[i].cmd);
+        virJSONValueFree(mon->cache[i].reply);
+        VIR_DELETE_ELEMENT(mon->cache, i, mon->ncache);
+        break;
+    }
+
+    if ((ret = qemuAgentCommandRun(mon, cmd, reply, true, seconds)) < 0)
+        goto cleanup;
+
+    /* failing to cache the reply is not fatal */
+    if (!(entry.reply = virJSONValueCopy(*reply)))
+        goto cleanup;
+    entry.expires = now + QEMU_AGENT_CACHE_TTL;
+
+    if (VIR_APPEND_ELEMENT_QUIET(mon->cache, mon->ncache, entry) < 0)
+        VIR_DEBUG("Unable to cache reply for '%s'", entry.cmd);
+
+ cleanup:
+    VIR_FREE(entry.cmd);
+    virJSONValueFree(entry.reply);
+    return ret;
+}
+
 static virJSONValuePtr ATTRIBUTE_SENTINEL
 qemuAgentMakeCommand(const char *cmdname,
                      ...)
@@ -1251,6 +1370,13 @@ void qemuAgentNotifyEvent(qemuAgentPtr mon,
     virObjectLock(mon);
 
     VIR_DEBUG("mon=%p event=%d await_event=%d", mon, event, mon->await_event);
+
+    /* the agent in the guest is going to be restarted */
+    if (event == QEMU_AGENT_EVENT_RESET ||
+        event == QEMU_AGENT_EVENT_SHUTDOWN) {
+        mon->inSync = false;
+        qemuAgentCacheFlush(mon);
+    }
     if (mon->await_event == event) {
         mon->await_event = QEMU_AGENT_EVENT_NONE;
         /* somebody waiting for this event, wake him up. */
@@ -1840,7 +1966,7 @@ qemuAgentSetTime(qemuAgentPtr mon,
 
 int
 qemuAgentGetFSInfo(qemuAgentPtr mon, virDomainFSInfoPtr **info,
-                   virDomainDefPtr vmdef)
+                   virDomainDefPtr vmdef, int seconds)
 {
     size_t i, j, k;
     int ret = -1;
@@ -1856,8 +1982,7 @@ qemuAgentGetFSInfo(qemuAgentPtr mon, virDomainFSInfoPtr **info,
     if (!cmd)
         return ret;
 
-    if (qemuAgentCommand(mon, cmd, &reply, true,
-                         VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK) < 0)
+    if (qemuAgentCommand(mon, cmd, &reply, true, seconds) < 0)
         goto cleanup;
 
     if (!(data = virJSONValueObjectGet(reply, "return"))) {
@@ -2019,6 +2144,7 @@ qemuAgentGetFSInfo(qemuAgentPtr mon, virDomainFSInfoPtr **info,
  * qemuAgentGetInterfaces:
  * @mon: Agent monitor
  * @ifaces: pointer to an array of pointers pointing to interface objects
+ * @seconds: how long to wait for the reply, see qemuAgentSend
  *
  * Issue guest-network-get-interfaces to guest agent, which returns a
  * list of interfaces of a running domain along with their IP and MAC
@@ -2028,7 +2154,8 @@ qemuAgentGetFSInfo(qemuAgentPtr mon, virDomainFSInfoPtr **info,
  */
 int
 qemuAgentGetInterfaces(qemuAgentPtr mon,
-                       virDomainInterfacePtr **ifaces)
+                       virDomainInterfacePtr **ifaces,
+                       int seconds)
 {
     int ret = -1;
     size_t i, j;
@@ -2051,10 +2178,8 @@ qemuAgentGetInterfaces(qemuAgentPtr mon,
     if (!(cmd = qemuAgentMakeCommand("guest-network-get-interfaces", NULL)))
         goto cleanup;
 
-    if (qemuAgentCommand(mon, cmd, &reply, false, VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK) < 0 ||
-        qemuAgentCheckError(cmd, reply) < 0) {
+    if (qemuAgentCommandCached(mon, cmd, &reply, seconds) < 0)
         goto cleanup;
-    }
 
     if (!(ret_array = virJSONValueObjectGet(reply, "return"))) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
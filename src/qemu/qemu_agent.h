@@ -76,7 +76,7 @@ int qemuAgentFSFreeze(qemuAgentPtr mon,
                       const char **mountpoints, unsigned int nmountpoints);
 int qemuAgentFSThaw(qemuAgentPtr mon);
 int qemuAgentGetFSInfo(qemuAgentPtr mon, virDomainFSInfoPtr **info,
-                       virDomainDefPtr vmdef);
+                       virDomainDefPtr vmdef, int seconds);
 
 int qemuAgentSuspend(qemuAgentPtr mon,
                      unsigned int target);
@@ -114,7 +114,8 @@ int qemuAgentSetTime(qemuAgentPtr mon,
                      bool sync);
 
 int qemuAgentGetInterfaces(qemuAgentPtr mon,
-                           virDomainInterfacePtr **ifaces);
+                           virDomainInterfacePtr **ifaces,
+                           int seconds);
 
 int qemuAgentSetUserPassword(qemuAgentPtr mon,
                              const char *user,
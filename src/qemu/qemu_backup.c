@@ -0,0 +1,879 @@
+/*
+ * qemu_backup.c: pull-mode backup jobs exported over NBD
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <unistd.h>
+
+#include "backup_conf.h"
+#include "viralloc.h"
+#include "vircommand.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virhash.h"
+#include "virjson.h"
+#include "virlog.h"
+#include "virportallocator.h"
+#include "virstring.h"
+#include "virtime.h"
+
+#include "qemu_alias.h"
+#include "qemu_backup.h"
+#include "qemu_block.h"
+#include "qemu_domain.h"
+#include "qemu_monitor.h"
+
+#define VIR_FROM_THIS VIR_FROM_QEMU
+
+VIR_LOG_INIT("qemu.qemu_backup");
+
+/*
+ * Each disk taking part in a backup gets a qcow2 scratch node layered
+ * over its format node (image fleecing). A blockdev-backup job with
+ * sync=none copies the old content of every cluster the guest is about
+ * to overwrite into the scratch node, so reading from the scratch node
+ * returns the disk as it was when the job started. The scratch node is
+ * what the NBD server exports.
+ *
+ * The scratch node, the backup job and the temporary bitmap describing
+ * the changes since the incremental checkpoint all share the name
+ * QEMU_BACKUP_PREFIX<target>. Checkpoints are persistent dirty bitmaps
+ * stored in the qcow2 image of the disk under the checkpoint name.
+ */
+#define QEMU_BACKUP_PREFIX "backup-"
+
+/* How long virDomainBackupEnd waits for the cancelled jobs to go away */
+#define QEMU_BACKUP_CANCEL_TIMEOUT (10 * 1000)
+
+
+static char *
+qemuBackupDiskName(virDomainBackupDiskDefPtr disk)
+{
+    char *ret;
+
+    ignore_value(virAsprintf(&ret, QEMU_BACKUP_PREFIX "%s", disk->name));
+    return ret;
+}
+
+
+/**
+ * qemuBackupIsJob:
+ * @device: device or job name reported by a block job event
+ *
+ * Returns true if @device names a job started by a backup.
+ */
+bool
+qemuBackupIsJob(const char *device)
+{
+    return STRPREFIX(device, QEMU_BACKUP_PREFIX);
+}
+
+
+static int
+qemuBackupCheckCaps(virQEMUCapsPtr qemuCaps,
+                    virDomainBackupDefPtr def)
+{
+    if (!virQEMUCapsGet(qemuCaps, QEMU_CAPS_BLOCKDEV_BACKUP) ||
+        !virQEMUCapsGet(qemuCaps, QEMU_CAPS_BLOCKDEV_DEL) ||
+        !virQEMUCapsGet(qemuCaps, QEMU_CAPS_QUERY_NAMED_BLOCK_NODES) ||
+        !virQEMUCapsGet(qemuCaps, QEMU_CAPS_NBD_SERVER) ||
+        !virQEMUCapsGet(qemuCaps, QEMU_CAPS_NBD_NAME)) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("backup jobs are not supported with this QEMU binary"));
+        return -1;
+    }
+
+    if (def->checkpoint &&
+        !virQEMUCapsGet(qemuCaps, QEMU_CAPS_BITMAP_PERSISTENT)) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("checkpoints are not supported with this QEMU binary"));
+        return -1;
+    }
+
+    if (def->incremental &&
+        (!virQEMUCapsGet(qemuCaps, QEMU_CAPS_BITMAP_MERGE) ||
+         !virQEMUCapsGet(qemuCaps, QEMU_CAPS_NBD_BITMAP))) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("incremental backups are not supported with this "
+                         "QEMU binary"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static virStorageSourcePtr
+qemuBackupScratchSource(virDomainBackupDiskDefPtr disk)
+{
+    virStorageSourcePtr src;
+
+    if (VIR_ALLOC(src) < 0)
+        return NULL;
+
+    src->type = VIR_STORAGE_TYPE_FILE;
+    src->format = VIR_STORAGE_FILE_QCOW2;
+    if (VIR_STRDUP(src->path, disk->scratch) < 0) {
+        virStorageSourceFree(src);
+        return NULL;
+    }
+
+    return src;
+}
+
+
+/* Revokes the access of the domain to the scratch file of @disk and
+ * removes the file if it was created by libvirt. */
+static void
+qemuBackupDiskCleanup(virQEMUDriverPtr driver,
+                      virDomainObjPtr vm,
+                      virDomainBackupDiskDefPtr disk)
+{
+    virStorageSourcePtr src;
+
+    if (!disk->scratch)
+        return;
+
+    if ((src = qemuBackupScratchSource(disk))) {
+        qemuDomainDiskChainElementRevoke(driver, vm, src);
+        virStorageSourceFree(src);
+    }
+
+    if (disk->scratchCreated) {
+        if (unlink(disk->scratch) < 0 && errno != ENOENT)
+            VIR_WARN("Unable to remove scratch file %s", disk->scratch);
+        disk->scratchCreated = false;
+    }
+}
+
+
+static void
+qemuBackupCleanupDisks(virQEMUDriverPtr driver,
+                       virDomainObjPtr vm,
+                       virDomainBackupDefPtr def,
+                       size_t ndisks)
+{
+    size_t i;
+
+    for (i = 0; i < ndisks && i < def->ndisks; i++) {
+        if (def->disks[i].backup == VIR_TRISTATE_BOOL_YES)
+            qemuBackupDiskCleanup(driver, vm, &def->disks[i]);
+    }
+}
+
+
+static int
+qemuBackupCreateScratch(virQEMUDriverPtr driver,
+                        virDomainBackupDiskDefPtr disk,
+                        unsigned long long capacity)
+{
+    virCommandPtr cmd = NULL;
+    const char *qemuImgPath;
+    int ret = -1;
+
+    if (!(qemuImgPath = qemuFindQemuImgBinary(driver)))
+        return -1;
+
+    cmd = virCommandNewArgList(qemuImgPath, "create", "-f", "qcow2",
+                               disk->scratch, NULL);
+    virCommandAddArgFormat(cmd, "%llu", capacity);
+
+    /* From here on the file has to be removed on failure */
+    disk->scratchCreated = true;
+
+    if (virCommandRun(cmd, NULL) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virCommandFree(cmd);
+    return ret;
+}
+
+
+/*
+ * Checks that the selected disks can be backed up and creates and labels
+ * their scratch files. On failure nothing is left behind.
+ */
+static int
+qemuBackupPrepareDisks(virQEMUDriverPtr driver,
+                       virDomainObjPtr vm,
+                       virDomainBackupDefPtr def)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virHashTablePtr blockstats = NULL;
+    qemuBlockStatsPtr stats;
+    size_t nbackup = 0;
+    size_t i;
+    int rc;
+    int ret = -1;
+
+    for (i = 0; i < def->ndisks; i++) {
+        virDomainBackupDiskDefPtr disk = &def->disks[i];
+        virDomainDiskDefPtr domdisk = vm->def->disks[disk->idx];
+
+        if (disk->backup != VIR_TRISTATE_BOOL_YES)
+            continue;
+
+        if (qemuDomainDiskBlockJobIsActive(domdisk))
+            return -1;
+
+        if (!domdisk->src->nodeformat) {
+            virReportError(VIR_ERR_OPERATION_UNSUPPORTED,
+                           _("unable to find the block node of disk '%s'"),
+                           disk->name);
+            return -1;
+        }
+
+        if ((def->checkpoint || def->incremental) &&
+            domdisk->src->format != VIR_STORAGE_FILE_QCOW2) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                           _("checkpoints of disk '%s' require the qcow2 "
+                             "format"), disk->name);
+            return -1;
+        }
+
+        if (!disk->scratch &&
+            virAsprintf(&disk->scratch, "%s/" QEMU_BACKUP_PREFIX "%s.qcow2",
+                        priv->libDir, disk->name) < 0)
+            return -1;
+
+        nbackup++;
+    }
+
+    if (!nbackup) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("no disk selected for the backup"));
+        return -1;
+    }
+
+    /* the scratch files must have the size of the disks */
+    qemuDomainObjEnterMonitor(driver, vm);
+    rc = qemuMonitorGetAllBlockStatsInfo(priv->mon, &blockstats, false);
+    if (rc >= 0)
+        rc = qemuMonitorBlockStatsUpdateCapacity(priv->mon, blockstats, false);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
+        goto cleanup;
+
+    for (i = 0; i < def->ndisks; i++) {
+        virDomainBackupDiskDefPtr disk = &def->disks[i];
+        virDomainDiskDefPtr domdisk = vm->def->disks[disk->idx];
+        virStorageSourcePtr src;
+
+        if (disk->backup != VIR_TRISTATE_BOOL_YES)
+            continue;
+
+        if (!virFileExists(disk->scratch)) {
+            if (!(stats = virHashLookup(blockstats, domdisk->info.alias)) ||
+                !stats->capacity) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("unable to find the size of disk '%s'"),
+                               disk->name);
+                goto error;
+            }
+
+            if (qemuBackupCreateScratch(driver, disk, stats->capacity) < 0)
+                goto error;
+        }
+
+        if (!(src = qemuBackupScratchSource(disk)))
+            goto error;
+        rc = qemuDomainDiskChainElementPrepare(driver, vm, src, false);
+        virStorageSourceFree(src);
+        if (rc < 0)
+            goto error;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(blockstats);
+    return ret;
+
+ error:
+    qemuBackupCleanupDisks(driver, vm, def, i + 1);
+    goto cleanup;
+}
+
+
+static virJSONValuePtr
+qemuBackupScratchProps(virDomainBackupDiskDefPtr disk,
+                       virDomainDiskDefPtr domdisk,
+                       const char *nodename)
+{
+    virJSONValuePtr file = NULL;
+    virJSONValuePtr ret = NULL;
+
+    if (virJSONValueObjectCreate(&file,
+                                 "s:driver", "file",
+                                 "s:filename", disk->scratch,
+                                 NULL) < 0)
+        return NULL;
+
+    if (virJSONValueObjectCreate(&ret,
+                                 "s:driver", "qcow2",
+                                 "s:node-name", nodename,
+                                 "a:file", file,
+                                 "s:backing", domdisk->src->nodeformat,
+                                 NULL) < 0) {
+        virJSONValueFree(file);
+        return NULL;
+    }
+
+    return ret;
+}
+
+
+/*
+ * The bitmaps and backup jobs of all disks are started in a single
+ * transaction, which makes them consistent with each other.
+ */
+static virJSONValuePtr
+qemuBackupBuildActions(virDomainObjPtr vm,
+                       virDomainBackupDefPtr def)
+{
+    virJSONValuePtr actions = NULL;
+    char *name = NULL;
+    size_t i;
+
+    if (!(actions = virJSONValueNewArray()))
+        return NULL;
+
+    for (i = 0; i < def->ndisks; i++) {
+        virDomainBackupDiskDefPtr disk = &def->disks[i];
+        virDomainDiskDefPtr domdisk = vm->def->disks[disk->idx];
+        const char *node = domdisk->src->nodeformat;
+        char *device;
+        int rc;
+
+        if (disk->backup != VIR_TRISTATE_BOOL_YES)
+            continue;
+
+        if (!(name = qemuBackupDiskName(disk)))
+            goto error;
+
+        if (def->checkpoint &&
+            qemuMonitorTransactionBitmapAdd(actions, node, def->checkpoint,
+                                            true, false) < 0)
+            goto error;
+
+        /* freeze the changes since the incremental checkpoint; the
+         * checkpoint bitmap itself keeps tracking new writes */
+        if (def->incremental &&
+            (qemuMonitorTransactionBitmapAdd(actions, node, name,
+                                             false, true) < 0 ||
+             qemuMonitorTransactionBitmapMerge(actions, node, name,
+                                               def->incremental) < 0))
+            goto error;
+
+        if (!(device = qemuAliasFromDisk(domdisk)))
+            goto error;
+        rc = qemuMonitorTransactionBackup(actions, device, name, name, "none");
+        VIR_FREE(device);
+        if (rc < 0)
+            goto error;
+
+        VIR_FREE(name);
+    }
+
+    return actions;
+
+ error:
+    VIR_FREE(name);
+    virJSONValueFree(actions);
+    return NULL;
+}
+
+
+/* Waits until the backup jobs of @def are gone after being cancelled */
+static int
+qemuBackupWaitJobs(virQEMUDriverPtr driver,
+                   virDomainObjPtr vm,
+                   virDomainBackupDefPtr def)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virHashTablePtr jobs = NULL;
+    unsigned long long now;
+    unsigned long long deadline;
+    size_t i;
+    int ret = -1;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+    deadline = now + QEMU_BACKUP_CANCEL_TIMEOUT;
+
+    while (true) {
+        bool running = false;
+
+        qemuDomainObjEnterMonitor(driver, vm);
+        jobs = qemuMonitorGetAllBlockJobInfo(priv->mon);
+        if (qemuDomainObjExitMonitor(driver, vm) < 0 || !jobs)
+            goto cleanup;
+
+        for (i = 0; i < def->ndisks && !running; i++) {
+            char *name;
+
+            if (def->disks[i].backup != VIR_TRISTATE_BOOL_YES)
+                continue;
+
+            if (!(name = qemuBackupDiskName(&def->disks[i])))
+                goto cleanup;
+            running = !!virHashLookup(jobs, name);
+            VIR_FREE(name);
+        }
+        virHashFree(jobs);
+        jobs = NULL;
+
+        if (!running)
+            break;
+
+        if (virTimeMillisNow(&now) < 0)
+            goto cleanup;
+        if (now >= deadline) {
+            virReportError(VIR_ERR_OPERATION_TIMEOUT, "%s",
+                           _("timed out waiting for the backup jobs "
+                             "to be cancelled"));
+            goto cleanup;
+        }
+
+        /* block job events of the backup jobs wake us up */
+        if (virDomainObjWaitUntil(vm, MIN(now + 100, deadline)) < 0)
+            goto cleanup;
+
+        if (!virDomainObjIsActive(vm)) {
+            virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                           _("domain is not running"));
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(jobs);
+    return ret;
+}
+
+
+/*
+ * Undoes what qemuBackupStart set up for @def: the NBD server, the
+ * first @nnodes scratch nodes and, if @jobs is true, the backup jobs and
+ * the temporary bitmaps. @flags are the virDomainBackupEndFlags deciding
+ * what happens with the checkpoints. Errors are only logged, so that as
+ * much as possible is cleaned up.
+ *
+ * Returns -1 if the domain died meanwhile, 0 otherwise.
+ */
+static int
+qemuBackupTeardown(virQEMUDriverPtr driver,
+                   virDomainObjPtr vm,
+                   virDomainBackupDefPtr def,
+                   size_t nnodes,
+                   bool jobs,
+                   bool nbd,
+                   unsigned int flags)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virErrorPtr orig_err = virSaveLastError();
+    char *name = NULL;
+    size_t i;
+    size_t n;
+    int ret = -1;
+
+    qemuDomainObjEnterMonitor(driver, vm);
+
+    if (nbd && qemuMonitorNBDServerStop(priv->mon) < 0)
+        VIR_WARN("Unable to stop the NBD server of the backup");
+
+    for (i = 0; jobs && i < def->ndisks; i++) {
+        if (def->disks[i].backup != VIR_TRISTATE_BOOL_YES)
+            continue;
+
+        if (!(name = qemuBackupDiskName(&def->disks[i])))
+            break;
+        if (qemuMonitorBlockJobCancel(priv->mon, name, true) < 0)
+            VIR_WARN("Unable to cancel backup job %s", name);
+        VIR_FREE(name);
+    }
+
+    if (qemuDomainObjExitMonitor(driver, vm) < 0)
+        goto cleanup;
+
+    /* the scratch nodes can't be deleted while the jobs use them */
+    if (jobs && qemuBackupWaitJobs(driver, vm, def) < 0) {
+        if (!virDomainObjIsActive(vm))
+            goto cleanup;
+        VIR_WARN("Backup jobs of domain %s are still running",
+                 vm->def->name);
+    }
+
+    qemuDomainObjEnterMonitor(driver, vm);
+
+    for (i = 0, n = 0; i < def->ndisks && n < nnodes; i++) {
+        virDomainBackupDiskDefPtr disk = &def->disks[i];
+        const char *node = vm->def->disks[disk->idx]->src->nodeformat;
+
+        if (disk->backup != VIR_TRISTATE_BOOL_YES)
+            continue;
+        n++;
+
+        if (!(name = qemuBackupDiskName(disk)))
+            break;
+
+        if (jobs && node) {
+            if (def->incremental)
+                ignore_value(qemuMonitorBitmapRemove(priv->mon, node, name));
+
+            if (def->checkpoint && (flags & VIR_DOMAIN_BACKUP_END_ABORT))
+                ignore_value(qemuMonitorBitmapRemove(priv->mon, node,
+                                                     def->checkpoint));
+
+            if (def->incremental &&
+                (flags & VIR_DOMAIN_BACKUP_END_DROP_INCREMENTAL))
+                ignore_value(qemuMonitorBitmapRemove(priv->mon, node,
+                                                     def->incremental));
+        }
+
+        if (qemuMonitorBlockdevDel(priv->mon, name) < 0)
+            VIR_WARN("Unable to delete backup scratch node %s", name);
+        VIR_FREE(name);
+    }
+
+    if (qemuDomainObjExitMonitor(driver, vm) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(name);
+    if (def->portAllocated) {
+        virPortAllocatorRelease(driver->migrationPorts, def->port);
+        def->portAllocated = false;
+    }
+    qemuBackupCleanupDisks(driver, vm, def, def->ndisks);
+    if (orig_err) {
+        virSetError(orig_err);
+        virFreeError(orig_err);
+    }
+    return ret;
+}
+
+
+static int
+qemuBackupStart(virQEMUDriverPtr driver,
+                virDomainObjPtr vm,
+                virDomainBackupDefPtr def)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virJSONValuePtr actions = NULL;
+    virJSONValuePtr props;
+    char *name = NULL;
+    size_t nnodes = 0;
+    bool jobs = false;
+    bool nbd = false;
+    size_t i;
+    int ret = -1;
+
+    if (!def->host && VIR_STRDUP(def->host, "localhost") < 0)
+        goto error;
+
+    if (!def->port) {
+        unsigned short port;
+
+        if (virPortAllocatorAcquire(driver->migrationPorts, &port) < 0)
+            goto error;
+        def->port = port;
+        def->portAllocated = true;
+    }
+
+    if (!(actions = qemuBackupBuildActions(vm, def)))
+        goto error;
+
+    qemuDomainObjEnterMonitor(driver, vm);
+
+    for (i = 0; i < def->ndisks; i++) {
+        virDomainBackupDiskDefPtr disk = &def->disks[i];
+
+        if (disk->backup != VIR_TRISTATE_BOOL_YES)
+            continue;
+
+        if (!(name = qemuBackupDiskName(disk)) ||
+            !(props = qemuBackupScratchProps(disk, vm->def->disks[disk->idx],
+                                             name)) ||
+            qemuMonitorBlockdevAdd(priv->mon, props) < 0)
+            goto exit_monitor;
+        nnodes++;
+        VIR_FREE(name);
+    }
+
+    if (qemuMonitorTransaction(priv->mon, actions) < 0)
+        goto exit_monitor;
+    jobs = true;
+
+    if (qemuMonitorNBDServerStart(priv->mon, def->host, def->port) < 0)
+        goto exit_monitor;
+    nbd = true;
+
+    for (i = 0; i < def->ndisks; i++) {
+        virDomainBackupDiskDefPtr disk = &def->disks[i];
+
+        if (disk->backup != VIR_TRISTATE_BOOL_YES)
+            continue;
+
+        if (!(name = qemuBackupDiskName(disk)) ||
+            qemuMonitorNBDServerAdd(priv->mon, name, disk->name, false,
+                                    def->incremental ? name : NULL) < 0)
+            goto exit_monitor;
+        VIR_FREE(name);
+    }
+
+    ret = 0;
+
+ exit_monitor:
+    if (qemuDomainObjExitMonitor(driver, vm) < 0)
+        ret = -1;
+    if (ret < 0 && virDomainObjIsActive(vm))
+        goto error;
+
+ cleanup:
+    VIR_FREE(name);
+    virJSONValueFree(actions);
+    return ret;
+
+ error:
+    ignore_value(qemuBackupTeardown(driver, vm, def, nnodes, jobs, nbd,
+                                    VIR_DOMAIN_BACKUP_END_ABORT));
+    goto cleanup;
+}
+
+
+static void
+qemuBackupMarkDisks(virDomainObjPtr vm,
+                    virDomainBackupDefPtr def,
+                    bool backup)
+{
+    size_t i;
+
+    for (i = 0; i < def->ndisks; i++) {
+        virDomainDiskDefPtr domdisk;
+
+        if (def->disks[i].backup != VIR_TRISTATE_BOOL_YES ||
+            def->disks[i].idx >= vm->def->ndisks)
+            continue;
+
+        domdisk = vm->def->disks[def->disks[i].idx];
+        QEMU_DOMAIN_DISK_PRIVATE(domdisk)->backup = backup;
+    }
+}
+
+
+int
+qemuBackupBegin(virQEMUDriverPtr driver,
+                virDomainObjPtr vm,
+                const char *backupXML,
+                unsigned int flags)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virDomainBackupDefPtr def = NULL;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!(def = virDomainBackupDefParseString(backupXML, 0)))
+        return -1;
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("domain is not running"));
+        goto endjob;
+    }
+
+    if (priv->backup) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("another backup job is already running"));
+        goto endjob;
+    }
+
+    if (qemuBackupCheckCaps(priv->qemuCaps, def) < 0 ||
+        virDomainBackupAlignDisks(def, vm->def) < 0 ||
+        qemuBlockNodeNamesDetect(driver, vm) < 0)
+        goto endjob;
+
+    if (qemuBackupPrepareDisks(driver, vm, def) < 0)
+        goto endjob;
+
+    if (qemuBackupStart(driver, vm, def) < 0)
+        goto endjob;
+
+    qemuBackupMarkDisks(vm, def, true);
+    priv->backup = def;
+    def = NULL;
+
+    if (qemuDomainSaveStatus(driver, vm) < 0)
+        VIR_WARN("Unable to save status on vm %s after starting backup",
+                 vm->def->name);
+
+    ret = 0;
+
+ endjob:
+    qemuDomainObjEndJob(driver, vm);
+
+ cleanup:
+    virDomainBackupDefFree(def);
+    return ret;
+}
+
+
+char *
+qemuBackupGetXMLDesc(virDomainObjPtr vm,
+                     unsigned int flags)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    virCheckFlags(0, NULL);
+
+    if (!priv->backup) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("no backup job is running"));
+        return NULL;
+    }
+
+    return virDomainBackupDefFormat(priv->backup, 0);
+}
+
+
+int
+qemuBackupEnd(virQEMUDriverPtr driver,
+              virDomainObjPtr vm,
+              unsigned int flags)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virDomainBackupDefPtr def;
+    int ret = -1;
+
+    virCheckFlags(VIR_DOMAIN_BACKUP_END_ABORT |
+                  VIR_DOMAIN_BACKUP_END_DROP_INCREMENTAL, -1);
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+        return -1;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("domain is not running"));
+        goto endjob;
+    }
+
+    if (!(def = priv->backup)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("no backup job is running"));
+        goto endjob;
+    }
+
+    if (qemuBackupTeardown(driver, vm, def, def->ndisks, true, true,
+                           flags) < 0) {
+        virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                       _("domain died while finishing the backup"));
+        goto endjob;
+    }
+
+    qemuBackupMarkDisks(vm, def, false);
+    virDomainBackupDefFree(def);
+    priv->backup = NULL;
+
+    if (qemuDomainSaveStatus(driver, vm) < 0)
+        VIR_WARN("Unable to save status on vm %s after ending backup",
+                 vm->def->name);
+
+    ret = 0;
+
+ endjob:
+    qemuDomainObjEndJob(driver, vm);
+    return ret;
+}
+
+
+/**
+ * qemuBackupReconnect:
+ * @driver: qemu driver
+ * @vm: domain object
+ *
+ * Picks up the backup job recorded in the status XML of @vm after the
+ * daemon restarted. Must be called once the node names of the disks are
+ * known again.
+ */
+void
+qemuBackupReconnect(virQEMUDriverPtr driver,
+                    virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virDomainBackupDefPtr def = priv->backup;
+
+    if (!def)
+        return;
+
+    if (virDomainBackupAlignDisks(def, vm->def) < 0) {
+        VIR_WARN("Dropping the backup job of domain %s: %s",
+                 vm->def->name, virGetLastErrorMessage());
+        virResetLastError();
+        virDomainBackupDefFree(def);
+        priv->backup = NULL;
+        return;
+    }
+
+    if (def->portAllocated &&
+        virPortAllocatorSetUsed(driver->migrationPorts, def->port, true) < 0) {
+        VIR_WARN("Unable to mark port %u of the backup of domain %s as used",
+                 def->port, vm->def->name);
+        def->portAllocated = false;
+    }
+
+    qemuBackupMarkDisks(vm, def, true);
+}
+
+
+/**
+ * qemuBackupProcessStop:
+ * @driver: qemu driver
+ * @vm: domain object
+ *
+ * Drops the backup job of @vm once its QEMU process is gone: the port
+ * is released and the scratch files created by libvirt are removed.
+ */
+void
+qemuBackupProcessStop(virQEMUDriverPtr driver,
+                      virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virDomainBackupDefPtr def = priv->backup;
+
+    if (!def)
+        return;
+
+    if (def->portAllocated)
+        virPortAllocatorRelease(driver->migrationPorts, def->port);
+    qemuBackupCleanupDisks(driver, vm, def, def->ndisks);
+    qemuBackupMarkDisks(vm, def, false);
+
+    virDomainBackupDefFree(def);
+    priv->backup = NULL;
+}
@@ -0,0 +1,47 @@
+/*
+ * qemu_backup.h: pull-mode backup jobs exported over NBD
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __QEMU_BACKUP_H__
+# define __QEMU_BACKUP_H__
+
+# include "qemu_conf.h"
+# include "domain_conf.h"
+
+int qemuBackupBegin(virQEMUDriverPtr driver,
+                    virDomainObjPtr vm,
+                    const char *backupXML,
+                    unsigned int flags);
+
+char *qemuBackupGetXMLDesc(virDomainObjPtr vm,
+                           unsigned int flags);
+
+int qemuBackupEnd(virQEMUDriverPtr driver,
+                  virDomainObjPtr vm,
+                  unsigned int flags);
+
+bool qemuBackupIsJob(const char *device);
+
+void qemuBackupReconnect(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm);
+
+void qemuBackupProcessStop(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm);
+
+#endif /* __QEMU_BACKUP_H__ */
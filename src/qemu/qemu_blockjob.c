@@ -26,14 +26,18 @@
 #include "qemu_blockjob.h"
 #include "qemu_block.h"
 #include "qemu_domain.h"
+#include "qemu_alias.h"
 
 #include "conf/domain_conf.h"
 #include "conf/domain_event.h"
 
+#include "viralloc.h"
 #include "virlog.h"
 #include "virstoragefile.h"
+#include "virstring.h"
 #include "virthread.h"
 #include "virtime.h"
+#include "virtypedparam.h"
 #include "locking/domain_lock.h"
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
@@ -194,7 +198,7 @@ qemuBlockJobEventProcess(virQEMUDriverPtr driver,
     }
 
     if (save) {
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
             VIR_WARN("Unable to save status on vm %s after block job",
                      vm->def->name);
         if (persistDisk && virDomainSaveConfig(cfg->configDir,
@@ -207,6 +211,9 @@ qemuBlockJobEventProcess(virQEMUDriverPtr driver,
     qemuDomainEventQueue(driver, event);
     qemuDomainEventQueue(driver, event2);
 
+    if (status != VIR_DOMAIN_BLOCK_JOB_READY)
+        qemuBlockJobGroupJobEnded(driver, vm, disk, status);
+
     virObjectUnref(cfg);
 }
 
@@ -253,3 +260,712 @@ qemuBlockJobSyncEnd(virQEMUDriverPtr driver,
     qemuBlockJobUpdate(driver, vm, disk);
     QEMU_DOMAIN_DISK_PRIVATE(disk)->blockJobSync = false;
 }
+
+
+/**
+ * qemuBlockJobGroupFindDisk:
+ * @group: block job group
+ * @dst: target of the disk
+ *
+ * Returns the entry of @dst in @group or NULL if it is not part of the
+ * group.
+ */
+static qemuDomainBlockJobGroupDiskPtr
+qemuBlockJobGroupFindDisk(qemuDomainBlockJobGroupPtr group,
+                          const char *dst)
+{
+    size_t i;
+
+    for (i = 0; i < group->ndisks; i++) {
+        if (STREQ(group->disks[i].dst, dst))
+            return &group->disks[i];
+    }
+
+    return NULL;
+}
+
+
+static void
+qemuBlockJobGroupCount(qemuDomainBlockJobGroupPtr group,
+                       unsigned int *counts)
+{
+    size_t i;
+
+    memset(counts, 0, sizeof(*counts) * VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_LAST);
+    for (i = 0; i < group->ndisks; i++)
+        counts[group->disks[i].state]++;
+}
+
+
+/**
+ * qemuBlockJobGroupStats:
+ * @group: block job group
+ * @params: where to store the statistics
+ * @nparams: number of items in @params
+ *
+ * Formats the parameters and the progress of @group as documented for
+ * virDomainBlockJobGroupGetStats.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuBlockJobGroupStats(qemuDomainBlockJobGroupPtr group,
+                       virTypedParameterPtr *params,
+                       int *nparams)
+{
+    virTypedParameterPtr par = NULL;
+    int npar = 0;
+    int maxpar = 0;
+    unsigned int counts[VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_LAST];
+    unsigned long long cur = 0;
+    unsigned long long end = 0;
+    unsigned long long now;
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    size_t i;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    qemuBlockJobGroupCount(group, counts);
+    for (i = 0; i < group->ndisks; i++) {
+        cur += group->disks[i].cur;
+        end += group->disks[i].end;
+    }
+
+    if (virTypedParamsAddInt(&par, &npar, &maxpar,
+                             VIR_DOMAIN_BLOCK_JOB_GROUP_TYPE,
+                             group->type) < 0 ||
+        virTypedParamsAddULLong(&par, &npar, &maxpar,
+                                VIR_DOMAIN_BLOCK_JOB_GROUP_BANDWIDTH,
+                                group->bandwidth) < 0 ||
+        virTypedParamsAddUInt(&par, &npar, &maxpar,
+                              VIR_DOMAIN_BLOCK_JOB_GROUP_CONCURRENCY,
+                              group->concurrency) < 0 ||
+        virTypedParamsAddUInt(&par, &npar, &maxpar,
+                              VIR_DOMAIN_BLOCK_JOB_GROUP_DISKS,
+                              group->ndisks) < 0 ||
+        virTypedParamsAddUInt(&par, &npar, &maxpar,
+                              VIR_DOMAIN_BLOCK_JOB_GROUP_PENDING,
+                              counts[VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_PENDING]) < 0 ||
+        virTypedParamsAddUInt(&par, &npar, &maxpar,
+                              VIR_DOMAIN_BLOCK_JOB_GROUP_RUNNING,
+                              counts[VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_RUNNING]) < 0 ||
+        virTypedParamsAddUInt(&par, &npar, &maxpar,
+                              VIR_DOMAIN_BLOCK_JOB_GROUP_COMPLETED,
+                              counts[VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_COMPLETED]) < 0 ||
+        virTypedParamsAddUInt(&par, &npar, &maxpar,
+                              VIR_DOMAIN_BLOCK_JOB_GROUP_FAILED,
+                              counts[VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_FAILED]) < 0 ||
+        virTypedParamsAddUInt(&par, &npar, &maxpar,
+                              VIR_DOMAIN_BLOCK_JOB_GROUP_CANCELED,
+                              counts[VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_CANCELED]) < 0 ||
+        virTypedParamsAddULLong(&par, &npar, &maxpar,
+                                VIR_DOMAIN_BLOCK_JOB_GROUP_CUR, cur) < 0 ||
+        virTypedParamsAddULLong(&par, &npar, &maxpar,
+                                VIR_DOMAIN_BLOCK_JOB_GROUP_END, end) < 0 ||
+        virTypedParamsAddULLong(&par, &npar, &maxpar,
+                                VIR_DOMAIN_BLOCK_JOB_GROUP_ELAPSED,
+                                now > group->started ?
+                                now - group->started : 0) < 0)
+        goto error;
+
+    for (i = 0; i < group->ndisks; i++) {
+        snprintf(field, sizeof(field), "%s%zu%s",
+                 VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_PREFIX, i,
+                 VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_SUFFIX_NAME);
+        if (virTypedParamsAddString(&par, &npar, &maxpar, field,
+                                    group->disks[i].dst) < 0)
+            goto error;
+
+        snprintf(field, sizeof(field), "%s%zu%s",
+                 VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_PREFIX, i,
+                 VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_SUFFIX_STATE);
+        if (virTypedParamsAddInt(&par, &npar, &maxpar, field,
+                                 group->disks[i].state) < 0)
+            goto error;
+    }
+
+    *params = par;
+    *nparams = npar;
+    return 0;
+
+ error:
+    virTypedParamsFree(par, npar);
+    return -1;
+}
+
+
+static void
+qemuBlockJobGroupEmitEvent(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm,
+                           qemuDomainBlockJobGroupPtr group)
+{
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+
+    if (qemuBlockJobGroupStats(group, &params, &nparams) < 0) {
+        VIR_WARN("Unable to report the block job group progress of "
+                 "domain %s", vm->def->name);
+        return;
+    }
+
+    qemuDomainEventQueue(driver,
+                         virDomainEventBlockJobGroupNewFromObj(vm, params,
+                                                               nparams));
+}
+
+
+/* Starts the job of @gdisk, the caller must hold a modify job. */
+static int
+qemuBlockJobGroupStartDisk(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm,
+                           qemuDomainBlockJobGroupPtr group,
+                           qemuDomainBlockJobGroupDiskPtr gdisk)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virDomainDiskDefPtr disk;
+    virStorageSourcePtr baseSource = NULL;
+    char *device = NULL;
+    char *topPath = NULL;
+    char *basePath = NULL;
+    int ret = -1;
+
+    if (!(disk = virDomainDiskByName(vm->def, gdisk->dst, false))) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("disk '%s' not found in domain"), gdisk->dst);
+        return -1;
+    }
+
+    if (qemuDomainDiskBlockJobIsActive(disk) ||
+        !(device = qemuAliasFromDisk(disk)))
+        return -1;
+
+    if (group->type == VIR_DOMAIN_BLOCK_JOB_TYPE_COMMIT) {
+        virStorageSourcePtr topSource = disk->src->backingStore;
+
+        if (!topSource || !topSource->backingStore) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("disk '%s' has no intermediate image to commit"),
+                           disk->dst);
+            goto cleanup;
+        }
+
+        for (baseSource = topSource->backingStore; baseSource->backingStore;
+             baseSource = baseSource->backingStore)
+            ;
+
+        if (qemuDomainDiskChainElementPrepare(driver, vm, baseSource,
+                                              false) < 0) {
+            baseSource = NULL;
+            goto cleanup;
+        }
+
+        qemuDomainObjEnterMonitor(driver, vm);
+        basePath = qemuMonitorDiskNameLookup(priv->mon, device, disk->src,
+                                             baseSource);
+        topPath = qemuMonitorDiskNameLookup(priv->mon, device, disk->src,
+                                            topSource);
+        if (basePath && topPath)
+            ret = qemuMonitorBlockCommit(priv->mon, device, topPath, basePath,
+                                         NULL, 0);
+    } else {
+        qemuDomainObjEnterMonitor(driver, vm);
+        ret = qemuMonitorBlockStream(priv->mon, device, NULL, NULL, 0, true);
+    }
+    if (qemuDomainObjExitMonitor(driver, vm) < 0)
+        ret = -1;
+
+    if (ret == 0)
+        QEMU_DOMAIN_DISK_PRIVATE(disk)->blockjob = true;
+
+ cleanup:
+    /* Revert access to read-only, if possible.  */
+    if (ret < 0 && baseSource && virDomainObjIsActive(vm))
+        qemuDomainDiskChainElementPrepare(driver, vm, baseSource, true);
+    VIR_FREE(topPath);
+    VIR_FREE(basePath);
+    VIR_FREE(device);
+    return ret;
+}
+
+
+/* Splits the bandwidth of @group among its running jobs. */
+static void
+qemuBlockJobGroupBalance(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm,
+                         qemuDomainBlockJobGroupPtr group,
+                         unsigned int running)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long speed;
+    size_t i;
+
+    if (!group->bandwidth || !running)
+        return;
+
+    /* 0 would lift the limit */
+    if (!(speed = group->bandwidth / running))
+        speed = 1;
+
+    for (i = 0; i < group->ndisks; i++) {
+        virDomainDiskDefPtr disk;
+        char *device = NULL;
+        int rc;
+
+        if (group->disks[i].state != VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_RUNNING ||
+            !(disk = virDomainDiskByName(vm->def, group->disks[i].dst, false)) ||
+            !(device = qemuAliasFromDisk(disk)))
+            continue;
+
+        qemuDomainObjEnterMonitor(driver, vm);
+        rc = qemuMonitorBlockJobSetSpeed(priv->mon, device, speed, true);
+        if (qemuDomainObjExitMonitor(driver, vm) < 0)
+            rc = -1;
+        VIR_FREE(device);
+
+        if (rc < 0) {
+            VIR_WARN("Unable to set the speed of the block job of disk %s: %s",
+                     group->disks[i].dst, virGetLastErrorMessage());
+            virResetLastError();
+        }
+
+        if (!virDomainObjIsActive(vm))
+            return;
+    }
+}
+
+
+/**
+ * qemuBlockJobGroupSchedule:
+ * @driver: qemu driver
+ * @vm: domain
+ *
+ * Starts the jobs of the pending disks of the block job group of @vm
+ * within its concurrency limit, splits its bandwidth among the running
+ * jobs and reports the progress with a VIR_DOMAIN_EVENT_ID_BLOCK_JOB_GROUP
+ * event. The group is dropped once all its jobs ended. A disk whose job
+ * cannot be started is marked as failed, the rest of the group goes on.
+ *
+ * The caller must hold a modify job.
+ */
+void
+qemuBlockJobGroupSchedule(virQEMUDriverPtr driver,
+                          virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainBlockJobGroupPtr group = priv->blockJobGroup;
+    unsigned int counts[VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_LAST];
+    unsigned int *running = &counts[VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_RUNNING];
+    size_t i;
+    int rc;
+
+    if (!group)
+        return;
+
+    qemuBlockJobGroupCount(group, counts);
+
+    for (i = 0; i < group->ndisks; i++) {
+        qemuDomainBlockJobGroupDiskPtr gdisk = &group->disks[i];
+
+        if (group->concurrency && *running >= group->concurrency)
+            break;
+
+        if (gdisk->state != VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_PENDING)
+            continue;
+
+        VIR_DEBUG("Starting block job group job on disk %s", gdisk->dst);
+        rc = qemuBlockJobGroupStartDisk(driver, vm, group, gdisk);
+        if (!virDomainObjIsActive(vm))
+            return;
+
+        if (rc < 0) {
+            VIR_WARN("Unable to start the block job of disk %s: %s",
+                     gdisk->dst, virGetLastErrorMessage());
+            virResetLastError();
+            gdisk->state = VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_FAILED;
+        } else {
+            gdisk->state = VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_RUNNING;
+            (*running)++;
+        }
+    }
+
+    if (!virDomainObjIsActive(vm))
+        return;
+
+    qemuBlockJobGroupBalance(driver, vm, group, *running);
+    qemuBlockJobGroupEmitEvent(driver, vm, group);
+
+    qemuBlockJobGroupCount(group, counts);
+    if (!counts[VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_PENDING] &&
+        !counts[VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_RUNNING]) {
+        VIR_DEBUG("Block job group of domain %s finished", vm->def->name);
+        qemuDomainBlockJobGroupFree(group);
+        priv->blockJobGroup = NULL;
+    }
+
+    if (qemuDomainSaveStatus(driver, vm) < 0)
+        VIR_WARN("Unable to save status on vm %s after block job group "
+                 "update", vm->def->name);
+}
+
+
+/**
+ * qemuBlockJobGroupJobEnded:
+ * @driver: qemu driver
+ * @vm: domain
+ * @disk: domain disk
+ * @status: virConnectDomainEventBlockJobStatus the job ended with
+ *
+ * Records the end of the block job of @disk if it belongs to the block job
+ * group of @vm and schedules the jobs waiting for a free slot.
+ */
+void
+qemuBlockJobGroupJobEnded(virQEMUDriverPtr driver,
+                          virDomainObjPtr vm,
+                          virDomainDiskDefPtr disk,
+                          int status)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainBlockJobGroupDiskPtr gdisk;
+
+    if (!priv->blockJobGroup ||
+        !(gdisk = qemuBlockJobGroupFindDisk(priv->blockJobGroup, disk->dst)) ||
+        gdisk->state != VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_RUNNING)
+        return;
+
+    switch ((virConnectDomainEventBlockJobStatus) status) {
+    case VIR_DOMAIN_BLOCK_JOB_COMPLETED:
+        gdisk->state = VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_COMPLETED;
+        gdisk->cur = gdisk->end;
+        break;
+    case VIR_DOMAIN_BLOCK_JOB_FAILED:
+        gdisk->state = VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_FAILED;
+        break;
+    case VIR_DOMAIN_BLOCK_JOB_CANCELED:
+        gdisk->state = VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_CANCELED;
+        break;
+    case VIR_DOMAIN_BLOCK_JOB_READY:
+    case VIR_DOMAIN_BLOCK_JOB_LAST:
+        return;
+    }
+
+    qemuBlockJobGroupSchedule(driver, vm);
+}
+
+
+/**
+ * qemuBlockJobGroupRefresh:
+ * @driver: qemu driver
+ * @vm: domain
+ *
+ * Updates the progress of the running jobs of the block job group of @vm
+ * from QEMU. The caller must hold a job.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuBlockJobGroupRefresh(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainBlockJobGroupPtr group = priv->blockJobGroup;
+    virHashTablePtr jobs;
+    size_t i;
+
+    if (!group)
+        return 0;
+
+    qemuDomainObjEnterMonitor(driver, vm);
+    jobs = qemuMonitorGetAllBlockJobInfo(priv->mon);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || !jobs) {
+        virHashFree(jobs);
+        return -1;
+    }
+
+    /* the group might have been dropped while the monitor was entered */
+    group = priv->blockJobGroup;
+    for (i = 0; group && i < group->ndisks; i++) {
+        qemuDomainBlockJobGroupDiskPtr gdisk = &group->disks[i];
+        qemuMonitorBlockJobInfoPtr info;
+        virDomainDiskDefPtr disk;
+        char *device;
+
+        if (gdisk->state != VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_RUNNING ||
+            !(disk = virDomainDiskByName(vm->def, gdisk->dst, false)))
+            continue;
+
+        if (!(device = qemuAliasFromDisk(disk))) {
+            virHashFree(jobs);
+            return -1;
+        }
+
+        if ((info = virHashLookup(jobs, device))) {
+            gdisk->cur = info->cur;
+            gdisk->end = info->end;
+        }
+        VIR_FREE(device);
+    }
+
+    virHashFree(jobs);
+    return 0;
+}
+
+
+/**
+ * qemuBlockJobGroupStart:
+ * @driver: qemu driver
+ * @vm: domain
+ * @params: parameters as documented for virDomainBlockJobGroupStart
+ * @nparams: number of items in @params
+ *
+ * Sets up a block job group on the running domain @vm and starts its
+ * first jobs. The caller must hold a modify job.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuBlockJobGroupStart(virQEMUDriverPtr driver,
+                       virDomainObjPtr vm,
+                       virTypedParameterPtr params,
+                       int nparams)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainBlockJobGroupPtr group = NULL;
+    const char **disks = NULL;
+    int ndisks;
+    bool modern;
+    size_t i, j;
+    int ret = -1;
+
+    if (priv->blockJobGroup) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("another block job group is running"));
+        return -1;
+    }
+
+    if (VIR_ALLOC(group) < 0)
+        return -1;
+
+    group->type = VIR_DOMAIN_BLOCK_JOB_TYPE_PULL;
+    if (virTypedParamsGetInt(params, nparams, VIR_DOMAIN_BLOCK_JOB_GROUP_TYPE,
+                             &group->type) < 0 ||
+        virTypedParamsGetULLong(params, nparams,
+                                VIR_DOMAIN_BLOCK_JOB_GROUP_BANDWIDTH,
+                                &group->bandwidth) < 0 ||
+        virTypedParamsGetUInt(params, nparams,
+                              VIR_DOMAIN_BLOCK_JOB_GROUP_CONCURRENCY,
+                              &group->concurrency) < 0)
+        goto cleanup;
+
+    switch (group->type) {
+    case VIR_DOMAIN_BLOCK_JOB_TYPE_PULL:
+        if (qemuDomainSupportsBlockJobs(vm, &modern) < 0)
+            goto cleanup;
+        if (!modern) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                           _("block job groups are not supported with this "
+                             "QEMU binary"));
+            goto cleanup;
+        }
+        break;
+
+    case VIR_DOMAIN_BLOCK_JOB_TYPE_COMMIT:
+        if (!(virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_BLOCK_COMMIT) &&
+              virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_BLOCKJOB_ASYNC))) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                           _("online commit not supported with this QEMU binary"));
+            goto cleanup;
+        }
+        break;
+
+    default:
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("unsupported block job group type %d"), group->type);
+        goto cleanup;
+    }
+
+    if ((ndisks = virTypedParamsGetStringList(params, nparams,
+                                              VIR_DOMAIN_BLOCK_JOB_GROUP_DISK,
+                                              &disks)) < 0)
+        goto cleanup;
+
+    if (!ndisks) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("no disk given for the block job group"));
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(group->disks, ndisks) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ndisks; i++) {
+        virDomainDiskDefPtr disk;
+
+        if (!(disk = qemuDomainDiskByName(vm->def, disks[i])))
+            goto cleanup;
+
+        for (j = 0; j < group->ndisks; j++) {
+            if (STREQ(group->disks[j].dst, disk->dst)) {
+                virReportError(VIR_ERR_INVALID_ARG,
+                               _("disk '%s' given more than once"), disk->dst);
+                goto cleanup;
+            }
+        }
+
+        if (qemuDomainDiskBlockJobIsActive(disk))
+            goto cleanup;
+
+        if (group->type == VIR_DOMAIN_BLOCK_JOB_TYPE_COMMIT &&
+            !(disk->src->backingStore && disk->src->backingStore->backingStore)) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("disk '%s' has no intermediate image to commit"),
+                           disk->dst);
+            goto cleanup;
+        }
+
+        if (VIR_STRDUP(group->disks[group->ndisks].dst, disk->dst) < 0)
+            goto cleanup;
+        group->disks[group->ndisks++].state =
+            VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_PENDING;
+    }
+
+    if (virTimeMillisNow(&group->started) < 0)
+        goto cleanup;
+
+    priv->blockJobGroup = group;
+    group = NULL;
+
+    qemuBlockJobGroupSchedule(driver, vm);
+    ret = 0;
+
+ cleanup:
+    qemuDomainBlockJobGroupFree(group);
+    VIR_FREE(disks);
+    return ret;
+}
+
+
+/**
+ * qemuBlockJobGroupAbort:
+ * @driver: qemu driver
+ * @vm: domain
+ *
+ * Cancels the block job group of @vm: the pending disks are dropped and the
+ * running jobs are aborted, the group ends once QEMU reported the end of
+ * all of them. The caller must hold a modify job.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuBlockJobGroupAbort(virQEMUDriverPtr driver,
+                       virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainBlockJobGroupPtr group = priv->blockJobGroup;
+    size_t i;
+    int ret = 0;
+
+    if (!group) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("no block job group is running"));
+        return -1;
+    }
+
+    for (i = 0; i < group->ndisks; i++) {
+        if (group->disks[i].state == VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_PENDING)
+            group->disks[i].state = VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_CANCELED;
+    }
+
+    for (i = 0; i < group->ndisks; i++) {
+        virDomainDiskDefPtr disk;
+        char *device;
+        int rc;
+
+        if (group->disks[i].state != VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_RUNNING ||
+            !(disk = virDomainDiskByName(vm->def, group->disks[i].dst, false)))
+            continue;
+
+        if (!(device = qemuAliasFromDisk(disk))) {
+            ret = -1;
+            continue;
+        }
+
+        qemuDomainObjEnterMonitor(driver, vm);
+        rc = qemuMonitorBlockJobCancel(priv->mon, device, true);
+        if (qemuDomainObjExitMonitor(driver, vm) < 0)
+            rc = -1;
+        VIR_FREE(device);
+
+        if (rc < 0)
+            ret = -1;
+
+        if (!virDomainObjIsActive(vm))
+            return -1;
+    }
+
+    /* Nothing might be running any more */
+    qemuBlockJobGroupSchedule(driver, vm);
+
+    return ret;
+}
+
+
+/**
+ * qemuBlockJobGroupReconnect:
+ * @driver: qemu driver
+ * @vm: domain
+ *
+ * Picks up the block job group recorded in the status XML of @vm after
+ * the daemon restarted. The jobs which ended meanwhile are considered
+ * completed. The caller must hold a modify job.
+ */
+void
+qemuBlockJobGroupReconnect(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainBlockJobGroupPtr group = priv->blockJobGroup;
+    virHashTablePtr jobs;
+    size_t i;
+
+    if (!group)
+        return;
+
+    qemuDomainObjEnterMonitor(driver, vm);
+    jobs = qemuMonitorGetAllBlockJobInfo(priv->mon);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || !jobs) {
+        VIR_WARN("Unable to query the block jobs of domain %s",
+                 vm->def->name);
+        virHashFree(jobs);
+        return;
+    }
+
+    for (i = 0; i < group->ndisks; i++) {
+        qemuDomainBlockJobGroupDiskPtr gdisk = &group->disks[i];
+        virDomainDiskDefPtr disk;
+        char *device = NULL;
+
+        if (gdisk->state != VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_RUNNING)
+            continue;
+
+        if (!(disk = virDomainDiskByName(vm->def, gdisk->dst, false)) ||
+            !(device = qemuAliasFromDisk(disk))) {
+            gdisk->state = VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_FAILED;
+            continue;
+        }
+
+        if (virHashLookup(jobs, device)) {
+            QEMU_DOMAIN_DISK_PRIVATE(disk)->blockjob = true;
+        } else {
+            gdisk->state = VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_COMPLETED;
+            gdisk->cur = gdisk->end;
+            ignore_value(qemuDomainDetermineDiskChain(driver, vm, disk,
+                                                      true, true));
+        }
+        VIR_FREE(device);
+    }
+
+    virHashFree(jobs);
+
+    qemuBlockJobGroupSchedule(driver, vm);
+}
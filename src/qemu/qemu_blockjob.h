@@ -24,6 +24,7 @@
 
 # include "internal.h"
 # include "qemu_conf.h"
+# include "qemu_domain.h"
 
 int qemuBlockJobUpdate(virQEMUDriverPtr driver,
                        virDomainObjPtr vm,
@@ -39,4 +40,24 @@ void qemuBlockJobSyncEnd(virQEMUDriverPtr driver,
                          virDomainObjPtr vm,
                          virDomainDiskDefPtr disk);
 
+int qemuBlockJobGroupStart(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm,
+                           virTypedParameterPtr params,
+                           int nparams);
+int qemuBlockJobGroupAbort(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm);
+int qemuBlockJobGroupRefresh(virQEMUDriverPtr driver,
+                             virDomainObjPtr vm);
+int qemuBlockJobGroupStats(qemuDomainBlockJobGroupPtr group,
+                           virTypedParameterPtr *params,
+                           int *nparams);
+void qemuBlockJobGroupSchedule(virQEMUDriverPtr driver,
+                               virDomainObjPtr vm);
+void qemuBlockJobGroupJobEnded(virQEMUDriverPtr driver,
+                               virDomainObjPtr vm,
+                               virDomainDiskDefPtr disk,
+                               int status);
+void qemuBlockJobGroupReconnect(virQEMUDriverPtr driver,
+                                virDomainObjPtr vm);
+
 #endif /* __QEMU_BLOCKJOB_H__ */
@@ -25,6 +25,7 @@
 
 #include "qemu_capabilities.h"
 #include "viralloc.h"
+#include "viratomic.h"
 #include "vircrypto.h"
 #include "virlog.h"
 #include "virerror.h"
@@ -56,6 +57,9 @@
 
 VIR_LOG_INIT("qemu.qemu_capabilities");
 
+/* Recent QEMU releases have a QMP schema of about 200 kB */
+#define QEMU_CAPS_QMP_SCHEMA_MAX_LEN (16 * 1024 * 1024)
+
 /* While not public, these strings must not change. They
  * are used in domain status files which are read on
  * daemon restarts
@@ -364,6 +368,18 @@ VIR_ENUM_IMPL(virQEMUCaps, QEMU_CAPS_LAST,
               "query-cpu-definitions", /* 250 */
               "block-write-threshold",
               "query-named-block-nodes",
+              "query-cpus-fast",
+              "dump-completed",
+
+              "memory-backend.prealloc-threads", /* 255 */
+              "blockdev-backup",
+              "blockdev-del",
+              "nbd-server.name",
+              "nbd-server.bitmap",
+
+              "block-dirty-bitmap.persistent", /* 260 */
+              "block-dirty-bitmap-merge",
+              "calc-dirty-rate",
     );
 
 
@@ -410,12 +426,28 @@ struct _virQEMUCaps {
     qemuMonitorCPUModelInfoPtr kvmCPUModelInfo;
     qemuMonitorCPUModelInfoPtr tcgCPUModelInfo;
 
+    /* formatted domain capabilities, see virQEMUCapsGetDomainCapsXML */
+    virMutex domCapsLock;
+    virHashTablePtr domCaps;
+    /* copies filtered for the machine types that need it, see
+     * virQEMUCapsCacheLookupMachine; protected by domCapsLock */
+    virHashTablePtr machineCaps;
+
+    /* handed out to domains by virQEMUCapsCacheLookupMachine, which
+     * means others may be using it too and it must not be changed */
+    bool shared;
+
     /* Anything below is not stored in the cache since the values are
      * re-computed from the other fields or external data sources every
      * time we probe QEMU or load the results from the cache.
      */
     virCPUDefPtr kvmCPUModel;
     virCPUDefPtr tcgCPUModel;
+
+    /* The "return" array of query-qmp-schema, only kept while probing,
+     * see virQEMUCapsLoadQMPSchema */
+    virJSONValuePtr qmpSchema;
+    bool qmpSchemaCached;
 };
 
 struct virQEMUCapsSearchData {
@@ -1090,6 +1122,112 @@ virQEMUCapsProbeHostCPUForEmulator(virCapsPtr caps,
 }
 
 
+struct virQEMUCapsWarmUpData {
+    virCapsPtr caps;
+    virQEMUCapsCachePtr cache;
+    char **binaries;
+    size_t nbinaries;
+    size_t next;
+    virMutex lock;
+};
+
+
+static void
+virQEMUCapsWarmUpWorker(void *opaque)
+{
+    struct virQEMUCapsWarmUpData *data = opaque;
+    virQEMUCapsPtr qemuCaps;
+    const char *binary;
+
+    for (;;) {
+        virMutexLock(&data->lock);
+        binary = NULL;
+        if (data->next < data->nbinaries)
+            binary = data->binaries[data->next++];
+        virMutexUnlock(&data->lock);
+
+        if (!binary)
+            break;
+
+        /* Failures are reported again by virQEMUCapsInitGuest */
+        if (!(qemuCaps = virQEMUCapsCacheLookup(data->caps, data->cache,
+                                                binary)))
+            virResetLastError();
+        virObjectUnref(qemuCaps);
+    }
+}
+
+
+/*
+ * Probe the emulator binaries of all guest architectures in parallel
+ * so that the sequential virQEMUCapsInitGuest loop only has to look
+ * them up in the cache. The calling thread takes part in the probing,
+ * so failing to create helper threads only makes this slower.
+ */
+static void
+virQEMUCapsCacheWarmUp(virCapsPtr caps,
+                       virQEMUCapsCachePtr cache,
+                       virArch hostarch)
+{
+    struct virQEMUCapsWarmUpData data = { .caps = caps, .cache = cache };
+    virThreadPtr threads = NULL;
+    size_t nthreads = 0;
+    size_t i, j;
+    int ncpus;
+    char *binary;
+
+    for (i = 0; i < VIR_ARCH_LAST; i++) {
+        if (!(binary = virQEMUCapsFindBinaryForArch(hostarch, i)))
+            continue;
+
+        for (j = 0; j < data.nbinaries; j++) {
+            if (STREQ(data.binaries[j], binary))
+                break;
+        }
+
+        if (j < data.nbinaries ||
+            VIR_APPEND_ELEMENT(data.binaries, data.nbinaries, binary) < 0)
+            VIR_FREE(binary);
+    }
+
+    if (data.nbinaries < 2)
+        goto cleanup;
+
+    if (virMutexInit(&data.lock) < 0)
+        goto cleanup;
+
+    if ((ncpus = virHostCPUGetCount()) < 1)
+        ncpus = 1;
+    if ((size_t) ncpus > data.nbinaries)
+        ncpus = data.nbinaries;
+
+    VIR_DEBUG("Probing %zu emulator binaries with %d threads",
+              data.nbinaries, ncpus);
+
+    if (ncpus > 1 && VIR_ALLOC_N_QUIET(threads, ncpus - 1) == 0) {
+        for (nthreads = 0; nthreads < (size_t) ncpus - 1; nthreads++) {
+            if (virThreadCreate(&threads[nthreads], true,
+                                virQEMUCapsWarmUpWorker, &data) < 0) {
+                virResetLastError();
+                break;
+            }
+        }
+    }
+
+    virQEMUCapsWarmUpWorker(&data);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    VIR_FREE(threads);
+    virMutexDestroy(&data.lock);
+
+ cleanup:
+    virResetLastError();
+    virStringListFreeCount(data.binaries, data.nbinaries);
+}
+
+
 virCapsPtr virQEMUCapsInit(virQEMUCapsCachePtr cache)
 {
     virCapsPtr caps;
@@ -1128,6 +1266,8 @@ virCapsPtr virQEMUCapsInit(virQEMUCapsCachePtr cache)
      * so just probe for them all - we gracefully fail
      * if a qemu-system-$ARCH binary can't be found
      */
+    virQEMUCapsCacheWarmUp(caps, cache, hostarch);
+
     for (i = 0; i < VIR_ARCH_LAST; i++)
         if (virQEMUCapsInitGuest(caps, cache,
                                  hostarch,
@@ -1142,6 +1282,92 @@ virCapsPtr virQEMUCapsInit(virQEMUCapsCachePtr cache)
 }
 
 
+static void
+virQEMUCapsHostStampFile(virBufferPtr buf,
+                         const char *path)
+{
+    struct stat sb;
+
+    if (path && stat(path, &sb) == 0)
+        virBufferAsprintf(buf, "%s %lld\n", path, (long long) sb.st_ctime);
+}
+
+
+/**
+ * virQEMUCapsHostStamp:
+ *
+ * Summarizes the parts of the host virQEMUCapsInit looks at which can
+ * change while libvirtd is running and are cheap to check: online CPUs
+ * and NUMA nodes, huge page pools, KVM availability and the QEMU binaries
+ * found for each architecture along with their change times. Capabilities
+ * returned by virQEMUCapsInit only need to be rebuilt if this changes.
+ *
+ * Returns the summary or NULL on error.
+ */
+char *
+virQEMUCapsHostStamp(void)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virArch hostarch = virArchFromHost();
+    const char *kvmbins[] = {
+        "/usr/libexec/qemu-kvm",
+        "qemu-kvm",
+        "kvm",
+    };
+    const char *hugepages = "/sys/kernel/mm/hugepages";
+    virBitmapPtr cpus;
+    DIR *dir = NULL;
+    struct dirent *ent;
+    char *str = NULL;
+    char *path = NULL;
+    size_t i;
+
+    if ((cpus = virHostCPUGetOnlineBitmap()) &&
+        (str = virBitmapFormat(cpus)))
+        virBufferAsprintf(&buf, "cpus %s\n", str);
+    virBitmapFree(cpus);
+    VIR_FREE(str);
+
+    if (virFileReadAllQuiet("/sys/devices/system/node/online", 1024, &str) >= 0)
+        virBufferAsprintf(&buf, "nodes %s", str);
+    VIR_FREE(str);
+
+    if (virDirOpenQuiet(&dir, hugepages) > 0) {
+        while (virDirRead(dir, &ent, NULL) > 0) {
+            if (virAsprintf(&path, "%s/%s/nr_hugepages",
+                            hugepages, ent->d_name) < 0)
+                break;
+            if (virFileReadAllQuiet(path, 64, &str) >= 0)
+                virBufferAsprintf(&buf, "%s %s", ent->d_name, str);
+            VIR_FREE(str);
+            VIR_FREE(path);
+        }
+        VIR_DIR_CLOSE(dir);
+    }
+
+    virBufferAsprintf(&buf, "kvm %d\n", access("/dev/kvm", F_OK) == 0);
+
+    for (i = VIR_ARCH_NONE + 1; i < VIR_ARCH_LAST; i++) {
+        str = virQEMUCapsFindBinaryForArch(hostarch, i);
+        virQEMUCapsHostStampFile(&buf, str);
+        VIR_FREE(str);
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(kvmbins); i++) {
+        str = virFindFileInPath(kvmbins[i]);
+        virQEMUCapsHostStampFile(&buf, str);
+        VIR_FREE(str);
+    }
+
+    virResetLastError();
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+
 static int
 virQEMUCapsComputeCmdFlags(const char *help,
                            unsigned int version,
@@ -1490,7 +1716,12 @@ struct virQEMUCapsStringFlags virQEMUCapsCommands[] = {
     { "query-qmp-schema", QEMU_CAPS_QUERY_QMP_SCHEMA },
     { "query-cpu-model-expansion", QEMU_CAPS_QUERY_CPU_MODEL_EXPANSION},
     { "query-cpu-definitions", QEMU_CAPS_QUERY_CPU_DEFINITIONS},
-    { "query-named-block-nodes", QEMU_CAPS_QUERY_NAMED_BLOCK_NODES}
+    { "query-named-block-nodes", QEMU_CAPS_QUERY_NAMED_BLOCK_NODES},
+    { "query-cpus-fast", QEMU_CAPS_QUERY_CPUS_FAST },
+    { "blockdev-backup", QEMU_CAPS_BLOCKDEV_BACKUP },
+    { "blockdev-del", QEMU_CAPS_BLOCKDEV_DEL },
+    { "block-dirty-bitmap-merge", QEMU_CAPS_BITMAP_MERGE },
+    { "calc-dirty-rate", QEMU_CAPS_CALC_DIRTY_RATE },
 };
 
 struct virQEMUCapsStringFlags virQEMUCapsMigration[] = {
@@ -1505,6 +1736,7 @@ struct virQEMUCapsStringFlags virQEMUCapsEvents[] = {
     { "VSERPORT_CHANGE", QEMU_CAPS_VSERPORT_CHANGE },
     { "DEVICE_TRAY_MOVED", QEMU_CAPS_DEVICE_TRAY_MOVED },
     { "BLOCK_WRITE_THRESHOLD", QEMU_CAPS_BLOCK_WRITE_THRESHOLD },
+    { "DUMP_COMPLETED", QEMU_CAPS_DUMP_COMPLETED },
 };
 
 struct virQEMUCapsStringFlags virQEMUCapsObjectTypes[] = {
@@ -1706,6 +1938,9 @@ static struct virQEMUCapsStringFlags virQEMUCapsObjectPropsUSBNECXHCI[] = {
 static struct virQEMUCapsStringFlags virQEMUCapsQMPSchemaQueries[] = {
     { "blockdev-add/arg-type/options/+gluster/debug-level", QEMU_CAPS_GLUSTER_DEBUG_LEVEL},
     { "blockdev-add/arg-type/+gluster/debug", QEMU_CAPS_GLUSTER_DEBUG_LEVEL},
+    { "nbd-server-add/arg-type/name", QEMU_CAPS_NBD_NAME },
+    { "nbd-server-add/arg-type/bitmap", QEMU_CAPS_NBD_BITMAP },
+    { "block-dirty-bitmap-add/arg-type/persistent", QEMU_CAPS_BITMAP_PERSISTENT },
 };
 
 struct virQEMUCapsObjectTypeProps {
@@ -2075,9 +2310,19 @@ virQEMUCapsNew(void)
     if (!(qemuCaps = virObjectNew(virQEMUCapsClass)))
         return NULL;
 
+    if (virMutexInit(&qemuCaps->domCapsLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize mutex"));
+        virObjectUnref(qemuCaps);
+        return NULL;
+    }
+
     if (!(qemuCaps->flags = virBitmapNew(QEMU_CAPS_LAST)))
         goto error;
 
+    if (!(qemuCaps->domCaps = virHashCreate(5, virHashValueFree)))
+        goto error;
+
     return qemuCaps;
 
  error:
@@ -2189,6 +2434,11 @@ void virQEMUCapsDispose(void *obj)
     qemuMonitorCPUModelInfoFree(qemuCaps->tcgCPUModelInfo);
     virCPUDefFree(qemuCaps->kvmCPUModel);
     virCPUDefFree(qemuCaps->tcgCPUModel);
+
+    virHashFree(qemuCaps->domCaps);
+    virHashFree(qemuCaps->machineCaps);
+    virMutexDestroy(&qemuCaps->domCapsLock);
+    virJSONValueFree(qemuCaps->qmpSchema);
 }
 
 void
@@ -2330,6 +2580,12 @@ unsigned int virQEMUCapsGetKVMVersion(virQEMUCapsPtr qemuCaps)
 }
 
 
+time_t virQEMUCapsGetCtime(virQEMUCapsPtr qemuCaps)
+{
+    return qemuCaps->ctime;
+}
+
+
 const char *virQEMUCapsGetPackage(virQEMUCapsPtr qemuCaps)
 {
     return qemuCaps->package;
@@ -2651,64 +2907,62 @@ virQEMUCapsProbeQMPCommands(virQEMUCapsPtr qemuCaps,
 }
 
 
+/*
+ * Fetches everything needed by virQEMUCapsProbeQMPEvents and
+ * virQEMUCapsProbeQMPObjects in a single round trip to QEMU.
+ */
 static int
-virQEMUCapsProbeQMPEvents(virQEMUCapsPtr qemuCaps,
-                          qemuMonitorPtr mon)
+virQEMUCapsProbeQMPInfo(qemuMonitorPtr mon,
+                        qemuMonitorProbeInfoPtr info)
 {
-    char **events = NULL;
-    int nevents;
+    const char *types[ARRAY_CARDINALITY(virQEMUCapsObjectProps)];
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(virQEMUCapsObjectProps); i++)
+        types[i] = virQEMUCapsObjectProps[i].type;
+
+    return qemuMonitorGetProbeInfo(mon, types, ARRAY_CARDINALITY(types), info);
+}
 
-    if ((nevents = qemuMonitorGetEvents(mon, &events)) < 0)
-        return -1;
 
+static void
+virQEMUCapsProbeQMPEvents(virQEMUCapsPtr qemuCaps,
+                          qemuMonitorProbeInfoPtr info)
+{
     virQEMUCapsProcessStringFlags(qemuCaps,
                                   ARRAY_CARDINALITY(virQEMUCapsEvents),
                                   virQEMUCapsEvents,
-                                  nevents, events);
-    virStringListFreeCount(events, nevents);
-
-    return 0;
+                                  info->nevents, info->events);
 }
 
 
-static int
+static void
 virQEMUCapsProbeQMPObjects(virQEMUCapsPtr qemuCaps,
-                           qemuMonitorPtr mon)
+                           qemuMonitorProbeInfoPtr info)
 {
-    int nvalues;
-    char **values;
     size_t i;
 
-    if ((nvalues = qemuMonitorGetObjectTypes(mon, &values)) < 0)
-        return -1;
     virQEMUCapsProcessStringFlags(qemuCaps,
                                   ARRAY_CARDINALITY(virQEMUCapsObjectTypes),
                                   virQEMUCapsObjectTypes,
-                                  nvalues, values);
-    virStringListFreeCount(values, nvalues);
+                                  info->nobjectTypes, info->objectTypes);
 
     for (i = 0; i < ARRAY_CARDINALITY(virQEMUCapsObjectProps); i++) {
         const char *type = virQEMUCapsObjectProps[i].type;
-        if ((nvalues = qemuMonitorGetObjectProps(mon,
-                                                 type,
-                                                 &values)) < 0)
-            return -1;
+
         virQEMUCapsProcessStringFlags(qemuCaps,
                                       virQEMUCapsObjectProps[i].nprops,
                                       virQEMUCapsObjectProps[i].props,
-                                      nvalues, values);
+                                      info->nprops[i], info->props[i]);
         virQEMUCapsProcessProps(qemuCaps,
                                 ARRAY_CARDINALITY(virQEMUCapsPropObjects),
                                 virQEMUCapsPropObjects, type,
-                                nvalues, values);
-        virStringListFreeCount(values, nvalues);
+                                info->nprops[i], info->props[i]);
     }
 
     /* Prefer -chardev spicevmc (detected earlier) over -device spicevmc */
     if (virQEMUCapsGet(qemuCaps, QEMU_CAPS_CHARDEV_SPICEVMC))
         virQEMUCapsClear(qemuCaps, QEMU_CAPS_DEVICE_SPICEVMC);
-
-    return 0;
 }
 
 
@@ -3764,6 +4018,36 @@ virQEMUCapsLoadCache(virCapsPtr caps,
     }
     VIR_FREE(nodes);
 
+    if ((n = virXPathNodeSet("./domCaps", ctxt, &nodes)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("failed to parse domain capabilities "
+                         "in QEMU capabilities cache"));
+        goto cleanup;
+    }
+    for (i = 0; i < n; i++) {
+        char *key;
+        xmlChar *content;
+
+        if (!(key = virXMLPropString(nodes[i], "key"))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("missing key of domain capabilities "
+                             "in QEMU capabilities cache"));
+            goto cleanup;
+        }
+
+        content = xmlNodeGetContent(nodes[i]);
+        if (VIR_STRDUP(str, (const char *) content) < 0 ||
+            virHashUpdateEntry(qemuCaps->domCaps, key, str) < 0) {
+            xmlFree(content);
+            VIR_FREE(key);
+            goto cleanup;
+        }
+        str = NULL;
+        xmlFree(content);
+        VIR_FREE(key);
+    }
+    VIR_FREE(nodes);
+
     virQEMUCapsInitHostCPUModel(qemuCaps, caps, VIR_DOMAIN_VIRT_KVM);
     virQEMUCapsInitHostCPUModel(qemuCaps, caps, VIR_DOMAIN_VIRT_QEMU);
 
@@ -3874,14 +4158,28 @@ virQEMUCapsFormatCPUModels(virQEMUCapsPtr qemuCaps,
 }
 
 
+static int
+virQEMUCapsDomCapsCompare(const virHashKeyValuePair *a,
+                          const virHashKeyValuePair *b)
+{
+    return strcmp(a->key, b->key);
+}
+
+
+/*
+ * The domain capabilities are formatted as well, so if @qemuCaps may be
+ * used by other threads, the caller has to hold its domCapsLock.
+ */
 char *
 virQEMUCapsFormatCache(virQEMUCapsPtr qemuCaps,
                        time_t selfCTime,
                        unsigned long selfVersion)
 {
     virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virHashKeyValuePairPtr domCaps = NULL;
     char *ret = NULL;
     size_t i;
+    int indent;
 
     virBufferAddLit(&buf, "<qemuCaps>\n");
     virBufferAdjustIndent(&buf, 2);
@@ -3950,12 +4248,31 @@ virQEMUCapsFormatCache(virQEMUCapsPtr qemuCaps,
                           emulated ? "yes" : "no");
     }
 
+    if (!(domCaps = virHashGetItems(qemuCaps->domCaps,
+                                    virQEMUCapsDomCapsCompare)))
+        goto cleanup;
+
+    /* The formatted domain capabilities are stored as text, the indentation
+     * must not become part of it */
+    indent = virBufferGetIndent(&buf, false);
+    for (i = 0; domCaps[i].key; i++) {
+        virBufferEscapeString(&buf, "<domCaps key='%s'>",
+                              domCaps[i].key);
+        virBufferSetIndent(&buf, 0);
+        virBufferEscapeString(&buf, "%s", domCaps[i].value);
+        virBufferAddLit(&buf, "</domCaps>\n");
+        virBufferSetIndent(&buf, indent);
+    }
+
     virBufferAdjustIndent(&buf, -2);
     virBufferAddLit(&buf, "</qemuCaps>\n");
 
     if (virBufferCheckError(&buf) == 0)
         ret = virBufferContentAndReset(&buf);
 
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(domCaps);
     return ret;
 }
 
@@ -4026,6 +4343,117 @@ virQEMUCapsRememberCached(virQEMUCapsPtr qemuCaps, const char *cacheDir)
 }
 
 
+static char *
+virQEMUCapsQMPSchemaFile(virQEMUCapsPtr qemuCaps,
+                         const char *cacheDir)
+{
+    char *binaryhash = NULL;
+    char *ret = NULL;
+
+    if (virCryptoHashString(VIR_CRYPTO_HASH_SHA256,
+                            qemuCaps->binary,
+                            &binaryhash) < 0)
+        return NULL;
+
+    ignore_value(virAsprintf(&ret, "%s/capabilities/%s.schema",
+                             cacheDir, binaryhash));
+    VIR_FREE(binaryhash);
+    return ret;
+}
+
+
+/*
+ * The QMP schema is by far the largest reply received while probing,
+ * while it depends on nothing but the QEMU binary. Unlike the rest of
+ * the cached capabilities it is kept on a libvirt upgrade or a change
+ * of the host, see virQEMUCapsIsValid, as long as the binary stays the
+ * same. A missing or outdated copy is not an error, the schema is then
+ * queried from QEMU.
+ */
+static void
+virQEMUCapsLoadQMPSchema(virQEMUCapsPtr qemuCaps,
+                         const char *cacheDir)
+{
+    char *file = NULL;
+    char *json = NULL;
+    virJSONValuePtr obj = NULL;
+    const char *binary;
+    long long binctime;
+
+    if (!(file = virQEMUCapsQMPSchemaFile(qemuCaps, cacheDir)) ||
+        !virFileExists(file))
+        goto cleanup;
+
+    if (virFileReadAll(file, QEMU_CAPS_QMP_SCHEMA_MAX_LEN, &json) < 0 ||
+        !(obj = virJSONValueFromString(json)) ||
+        !(binary = virJSONValueObjectGetString(obj, "binary")) ||
+        virJSONValueObjectGetNumberLong(obj, "ctime", &binctime) < 0 ||
+        !virJSONValueObjectGetArray(obj, "schema")) {
+        VIR_WARN("Failed to load cached QMP schema from '%s' for '%s': %s",
+                 file, qemuCaps->binary, virGetLastErrorMessage());
+        goto cleanup;
+    }
+
+    if (STRNEQ(binary, qemuCaps->binary) || binctime != qemuCaps->ctime) {
+        VIR_DEBUG("Outdated QMP schema '%s' for '%s'",
+                  file, qemuCaps->binary);
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Loaded QMP schema '%s' for '%s'", file, qemuCaps->binary);
+    qemuCaps->qmpSchema = virJSONValueObjectStealArray(obj, "schema");
+    qemuCaps->qmpSchemaCached = true;
+
+ cleanup:
+    virResetLastError();
+    virJSONValueFree(obj);
+    VIR_FREE(json);
+    VIR_FREE(file);
+}
+
+
+static void
+virQEMUCapsSaveQMPSchema(virQEMUCapsPtr qemuCaps,
+                         const char *cacheDir)
+{
+    char *file = NULL;
+    char *json = NULL;
+    virJSONValuePtr obj = NULL;
+
+    if (!qemuCaps->qmpSchema || qemuCaps->qmpSchemaCached)
+        return;
+
+    if (!(file = virQEMUCapsQMPSchemaFile(qemuCaps, cacheDir)) ||
+        !(obj = virJSONValueNewObject()) ||
+        virJSONValueObjectAppendString(obj, "binary", qemuCaps->binary) < 0 ||
+        virJSONValueObjectAppendNumberLong(obj, "ctime", qemuCaps->ctime) < 0 ||
+        virJSONValueObjectAppend(obj, "schema", qemuCaps->qmpSchema) < 0)
+        goto cleanup;
+    qemuCaps->qmpSchema = NULL;
+
+    if (!(json = virJSONValueToString(obj, false)))
+        goto cleanup;
+
+    if (virFileWriteStr(file, json, 0600) < 0) {
+        virReportSystemError(errno, _("Failed to save '%s' for '%s'"),
+                             file, qemuCaps->binary);
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Saved QMP schema '%s' for '%s'", file, qemuCaps->binary);
+
+ cleanup:
+    if (virGetLastError()) {
+        VIR_WARN("Failed to cache QMP schema for '%s': %s",
+                 qemuCaps->binary, virGetLastErrorMessage());
+        virResetLastError();
+    }
+    virJSONValueFree(obj);
+    VIR_FREE(json);
+    VIR_FREE(file);
+}
+
+
 static void
 virQEMUCapsReset(virQEMUCapsPtr qemuCaps)
 {
@@ -4061,6 +4489,8 @@ virQEMUCapsReset(virQEMUCapsPtr qemuCaps)
     virCPUDefFree(qemuCaps->tcgCPUModel);
     qemuCaps->kvmCPUModel = NULL;
     qemuCaps->tcgCPUModel = NULL;
+
+    virHashRemoveAll(qemuCaps->domCaps);
 }
 
 
@@ -4493,6 +4923,41 @@ virQEMUCapsQMPSchemaQueryPath(const char *query,
 }
 
 
+/* Indexes the entries of @schema by their name, the entries stay owned
+ * by @schema */
+static virHashTablePtr
+virQEMUCapsQMPSchemaHash(virJSONValuePtr schema)
+{
+    virHashTablePtr ret;
+    virJSONValuePtr item;
+    const char *name;
+    ssize_t n = virJSONValueArraySize(schema);
+    size_t i;
+
+    if (!(ret = virHashCreate(512, NULL)))
+        return NULL;
+
+    for (i = 0; i < n; i++) {
+        item = virJSONValueArrayGet(schema, i);
+
+        if (!(name = virJSONValueObjectGetString(item, "name"))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("malformed QMP schema"));
+            goto error;
+        }
+
+        if (virHashAddEntry(ret, name, item) < 0)
+            goto error;
+    }
+
+    return ret;
+
+ error:
+    virHashFree(ret);
+    return NULL;
+}
+
+
 static int
 virQEMUCapsProbeQMPSchemaCapabilities(virQEMUCapsPtr qemuCaps,
                                       qemuMonitorPtr mon)
@@ -4501,7 +4966,11 @@ virQEMUCapsProbeQMPSchemaCapabilities(virQEMUCapsPtr qemuCaps,
     virHashTablePtr schema;
     size_t i;
 
-    if (!(schema = qemuMonitorQueryQMPSchema(mon)))
+    if (!qemuCaps->qmpSchema &&
+        !(qemuCaps->qmpSchema = qemuMonitorQueryQMPSchema(mon)))
+        return -1;
+
+    if (!(schema = virQEMUCapsQMPSchemaHash(qemuCaps->qmpSchema)))
         return -1;
 
     for (i = 0; i < ARRAY_CARDINALITY(virQEMUCapsQMPSchemaQueries); i++) {
@@ -4523,6 +4992,9 @@ virQEMUCapsInitQMPMonitor(virQEMUCapsPtr qemuCaps,
     int ret = -1;
     int major, minor, micro;
     char *package = NULL;
+    qemuMonitorProbeInfo info;
+
+    memset(&info, 0, sizeof(info));
 
     /* @mon is supposed to be locked by callee */
 
@@ -4602,6 +5074,11 @@ virQEMUCapsInitQMPMonitor(virQEMUCapsPtr qemuCaps,
     if (qemuCaps->version >= 2004050)
         virQEMUCapsSet(qemuCaps, QEMU_CAPS_MACH_VIRT_GIC_VERSION);
 
+    /* prealloc-threads of the memory backends is supported from v5.0.0,
+     * device-list-properties can't introspect objects that aren't devices */
+    if (qemuCaps->version >= 5000000)
+        virQEMUCapsSet(qemuCaps, QEMU_CAPS_OBJECT_MEMORY_PREALLOC_THREADS);
+
     if (virQEMUCapsProbeQMPCommands(qemuCaps, mon) < 0)
         goto cleanup;
 
@@ -4609,10 +5086,11 @@ virQEMUCapsInitQMPMonitor(virQEMUCapsPtr qemuCaps,
     if (virQEMUCapsProbeQMPKVMState(qemuCaps, mon) < 0)
         goto cleanup;
 
-    if (virQEMUCapsProbeQMPEvents(qemuCaps, mon) < 0)
-        goto cleanup;
-    if (virQEMUCapsProbeQMPObjects(qemuCaps, mon) < 0)
+    if (virQEMUCapsProbeQMPInfo(mon, &info) < 0)
         goto cleanup;
+    virQEMUCapsProbeQMPEvents(qemuCaps, &info);
+    virQEMUCapsProbeQMPObjects(qemuCaps, &info);
+
     if (virQEMUCapsProbeQMPMachineTypes(qemuCaps, mon) < 0)
         goto cleanup;
     if (virQEMUCapsProbeQMPCPUDefinitions(qemuCaps, mon, false) < 0)
@@ -4655,6 +5133,7 @@ virQEMUCapsInitQMPMonitor(virQEMUCapsPtr qemuCaps,
 
     ret = 0;
  cleanup:
+    qemuMonitorProbeInfoClear(&info);
     return ret;
 }
 
@@ -4751,6 +5230,8 @@ virQEMUCapsInitQMPCommandFree(virQEMUCapsInitQMPCommandPtr cmd)
 }
 
 
+static int virQEMUCapsProbeCounter;
+
 static virQEMUCapsInitQMPCommandPtr
 virQEMUCapsInitQMPCommandNew(char *binary,
                              const char *libDir,
@@ -4759,6 +5240,7 @@ virQEMUCapsInitQMPCommandNew(char *binary,
                              char **qmperr)
 {
     virQEMUCapsInitQMPCommandPtr cmd = NULL;
+    int probe;
 
     if (VIR_ALLOC(cmd) < 0)
         goto error;
@@ -4770,11 +5252,16 @@ virQEMUCapsInitQMPCommandNew(char *binary,
     cmd->runGid = runGid;
     cmd->qmperr = qmperr;
 
+    /* Several binaries may be probed at once, so each probe gets its own
+     * socket and pidfile.
+     */
+    probe = virAtomicIntInc(&virQEMUCapsProbeCounter) - 1;
+
     /* the ".sock" sufix is important to avoid a possible clash with a qemu
      * domain called "capabilities"
      */
-    if (virAsprintf(&cmd->monpath, "%s/%s", libDir,
-                    "capabilities.monitor.sock") < 0)
+    if (virAsprintf(&cmd->monpath, "%s/capabilities-%d.monitor.sock",
+                    libDir, probe) < 0)
         goto error;
     if (virAsprintf(&cmd->monarg, "unix:%s,server,nowait", cmd->monpath) < 0)
         goto error;
@@ -4785,7 +5272,8 @@ virQEMUCapsInitQMPCommandNew(char *binary,
      * -daemonize we need QEMU to be allowed to create them, rather
      * than libvirtd. So we're using libDir which QEMU can write to
      */
-    if (virAsprintf(&cmd->pidfile, "%s/%s", libDir, "capabilities.pidfile") < 0)
+    if (virAsprintf(&cmd->pidfile, "%s/capabilities-%d.pidfile",
+                    libDir, probe) < 0)
         goto error;
 
     virPidFileForceCleanupPath(cmd->pidfile);
@@ -4999,6 +5487,9 @@ virQEMUCapsNewForBinaryInternal(virCapsPtr caps,
         goto error;
 
     if (rv == 0) {
+        if (cacheDir)
+            virQEMUCapsLoadQMPSchema(qemuCaps, cacheDir);
+
         if (virQEMUCapsInitQMP(qemuCaps, libDir, runUid, runGid, &qmperr) < 0) {
             virQEMUCapsLogProbeFailure(binary);
             goto error;
@@ -5022,6 +5513,11 @@ virQEMUCapsNewForBinaryInternal(virCapsPtr caps,
             virQEMUCapsRememberCached(qemuCaps, cacheDir) < 0)
             goto error;
 
+        if (cacheDir)
+            virQEMUCapsSaveQMPSchema(qemuCaps, cacheDir);
+        virJSONValueFree(qemuCaps->qmpSchema);
+        qemuCaps->qmpSchema = NULL;
+
         virQEMUCapsInitHostCPUModel(qemuCaps, caps, VIR_DOMAIN_VIRT_KVM);
         virQEMUCapsInitHostCPUModel(qemuCaps, caps, VIR_DOMAIN_VIRT_QEMU);
     }
@@ -5161,8 +5657,18 @@ virQEMUCapsCacheNew(const char *libDir,
         return NULL;
     }
 
+    if (virCondInit(&cache->probeCond) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize condition variable"));
+        virMutexDestroy(&cache->lock);
+        VIR_FREE(cache);
+        return NULL;
+    }
+
     if (!(cache->binaries = virHashCreate(10, virObjectFreeHashData)))
         goto error;
+    if (!(cache->probing = virHashCreate(10, NULL)))
+        goto error;
     if (VIR_STRDUP(cache->libDir, libDir) < 0)
         goto error;
     if (VIR_STRDUP(cache->cacheDir, cacheDir) < 0)
@@ -5179,12 +5685,19 @@ virQEMUCapsCacheNew(const char *libDir,
 }
 
 
+/*
+ * Must be called with cache->lock held. The lock is released while
+ * the binary is being probed so that lookups of other binaries are
+ * not blocked; concurrent lookups of the same binary wait for the
+ * probe to finish and then use its result.
+ */
 static void ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3)
 virQEMUCapsCacheValidate(virQEMUCapsCachePtr cache,
                          const char *binary,
                          virCapsPtr caps,
                          virQEMUCapsPtr *qemuCaps)
 {
+ retry:
     if (*qemuCaps &&
         !virQEMUCapsIsValid(*qemuCaps, 0, cache->runUid, cache->runGid)) {
         VIR_DEBUG("Cached capabilities %p no longer valid for %s",
@@ -5193,17 +5706,38 @@ virQEMUCapsCacheValidate(virQEMUCapsCachePtr cache,
         *qemuCaps = NULL;
     }
 
-    if (!*qemuCaps) {
-        VIR_DEBUG("Creating capabilities for %s", binary);
-        *qemuCaps = virQEMUCapsNewForBinary(caps, binary,
-                                            cache->libDir, cache->cacheDir,
-                                            cache->runUid, cache->runGid);
-        if (*qemuCaps) {
-            VIR_DEBUG("Caching capabilities %p for %s", *qemuCaps, binary);
-            if (virHashAddEntry(cache->binaries, binary, *qemuCaps) < 0) {
-                virObjectUnref(*qemuCaps);
-                *qemuCaps = NULL;
-            }
+    if (*qemuCaps)
+        return;
+
+    if (virHashLookup(cache->probing, binary)) {
+        VIR_DEBUG("Waiting for capabilities of %s to be probed", binary);
+        if (virCondWait(&cache->probeCond, &cache->lock) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to wait for capabilities probe"));
+            return;
+        }
+        *qemuCaps = virHashLookup(cache->binaries, binary);
+        goto retry;
+    }
+
+    if (virHashAddEntry(cache->probing, binary, (void *) binary) < 0)
+        return;
+
+    VIR_DEBUG("Creating capabilities for %s", binary);
+    virMutexUnlock(&cache->lock);
+    *qemuCaps = virQEMUCapsNewForBinary(caps, binary,
+                                        cache->libDir, cache->cacheDir,
+                                        cache->runUid, cache->runGid);
+    virMutexLock(&cache->lock);
+
+    virHashRemoveEntry(cache->probing, binary);
+    virCondBroadcast(&cache->probeCond);
+
+    if (*qemuCaps) {
+        VIR_DEBUG("Caching capabilities %p for %s", *qemuCaps, binary);
+        if (virHashAddEntry(cache->binaries, binary, *qemuCaps) < 0) {
+            virObjectUnref(*qemuCaps);
+            *qemuCaps = NULL;
         }
     }
 }
@@ -5235,29 +5769,121 @@ virQEMUCapsCacheLookup(virCapsPtr caps,
 }
 
 
+/* Whether virQEMUCapsFilterByMachineType would change anything */
+static bool
+virQEMUCapsNeedFilterByMachineType(virQEMUCapsPtr qemuCaps,
+                                   const char *machineType)
+{
+    size_t i;
+
+    if (!machineType)
+        return false;
+
+    for (i = 0; i < ARRAY_CARDINALITY(virQEMUCapsMachineFilter); i++) {
+        const struct virQEMUCapsMachineTypeFilter *filter = &virQEMUCapsMachineFilter[i];
+        size_t j;
+
+        if (STRNEQ(filter->machineType, machineType))
+            continue;
+
+        for (j = 0; j < filter->nflags; j++) {
+            if (virQEMUCapsGet(qemuCaps, filter->flags[j]))
+                return true;
+        }
+    }
+
+    return virQEMUCapsGet(qemuCaps, QEMU_CAPS_QUERY_HOTPLUGGABLE_CPUS) &&
+           !virQEMUCapsGetMachineHotplugCpus(qemuCaps, machineType);
+}
+
+
+/**
+ * virQEMUCapsCacheLookupMachine:
+ * @caps: host capabilities
+ * @cache: QEMU capabilities cache
+ * @binary: QEMU binary
+ * @machineType: machine type of the domain or NULL
+ *
+ * Looks up the capabilities of @binary as they apply to domains using
+ * @machineType. Instead of a copy, a reference to an object shared with
+ * the cache and all other domains using the same binary and machine type
+ * is returned. It must not be modified, see virQEMUCapsMakeWritable.
+ *
+ * Returns the capabilities or NULL on error.
+ */
 virQEMUCapsPtr
-virQEMUCapsCacheLookupCopy(virCapsPtr caps,
-                           virQEMUCapsCachePtr cache,
-                           const char *binary,
-                           const char *machineType)
+virQEMUCapsCacheLookupMachine(virCapsPtr caps,
+                              virQEMUCapsCachePtr cache,
+                              const char *binary,
+                              const char *machineType)
 {
     virQEMUCapsPtr qemuCaps = virQEMUCapsCacheLookup(caps, cache, binary);
-    virQEMUCapsPtr ret;
+    virQEMUCapsPtr ret = NULL;
 
     if (!qemuCaps)
         return NULL;
 
-    ret = virQEMUCapsNewCopy(qemuCaps);
-    virObjectUnref(qemuCaps);
+    virMutexLock(&qemuCaps->domCapsLock);
 
-    if (!ret)
-        return NULL;
+    if (!virQEMUCapsNeedFilterByMachineType(qemuCaps, machineType)) {
+        qemuCaps->shared = true;
+        ret = virObjectRef(qemuCaps);
+        goto cleanup;
+    }
+
+    if (!qemuCaps->machineCaps &&
+        !(qemuCaps->machineCaps = virHashCreate(5, virObjectFreeHashData)))
+        goto cleanup;
+
+    if (!(ret = virHashLookup(qemuCaps->machineCaps, machineType))) {
+        if (!(ret = virQEMUCapsNewCopy(qemuCaps)))
+            goto cleanup;
+
+        virQEMUCapsFilterByMachineType(ret, machineType);
+        ret->shared = true;
+
+        if (virHashAddEntry(qemuCaps->machineCaps, machineType, ret) < 0) {
+            virObjectUnref(ret);
+            ret = NULL;
+            goto cleanup;
+        }
+    }
 
-    virQEMUCapsFilterByMachineType(ret, machineType);
+    virObjectRef(ret);
+
+ cleanup:
+    virMutexUnlock(&qemuCaps->domCapsLock);
+    virObjectUnref(qemuCaps);
     return ret;
 }
 
 
+/**
+ * virQEMUCapsMakeWritable:
+ * @qemuCaps: pointer to the capabilities of a domain
+ *
+ * Replaces @qemuCaps with a private copy unless it is private already,
+ * so that the caller may modify it without affecting other domains.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virQEMUCapsMakeWritable(virQEMUCapsPtr *qemuCaps)
+{
+    virQEMUCapsPtr copy;
+
+    if (!(*qemuCaps)->shared)
+        return 0;
+
+    if (!(copy = virQEMUCapsNewCopy(*qemuCaps)))
+        return -1;
+
+    virObjectUnref(*qemuCaps);
+    *qemuCaps = copy;
+    return 0;
+}
+
+
 static int
 virQEMUCapsCompareArch(const void *payload,
                        const void *name ATTRIBUTE_UNUSED,
@@ -5324,6 +5950,8 @@ virQEMUCapsCacheFree(virQEMUCapsCachePtr cache)
     VIR_FREE(cache->libDir);
     VIR_FREE(cache->cacheDir);
     virHashFree(cache->binaries);
+    virHashFree(cache->probing);
+    virCondDestroy(&cache->probeCond);
     virMutexDestroy(&cache->lock);
     VIR_FREE(cache);
 }
@@ -5745,3 +6373,126 @@ virQEMUCapsFillDomainCaps(virCapsPtr caps,
         return -1;
     return 0;
 }
+
+
+/* Describes everything the domain capabilities are computed from apart from
+ * @qemuCaps itself, including the state of the host they depend on. */
+static char *
+virQEMUCapsDomainCapsKey(virCapsPtr caps,
+                         const char *emulatorbin,
+                         const char *machine,
+                         virArch arch,
+                         virDomainVirtType virttype,
+                         virFirmwarePtr *firmwares,
+                         size_t nfirmwares)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+
+    virBufferAsprintf(&buf, "%s %s %s %s",
+                      emulatorbin, NULLSTR(machine), virArchToString(arch),
+                      virDomainVirtTypeToString(virttype));
+
+    if (caps->host.cpu && caps->host.cpu->model)
+        virBufferAsprintf(&buf, " cpu=%s", caps->host.cpu->model);
+
+    if (virttype == VIR_DOMAIN_VIRT_KVM) {
+        int hostmaxvcpus;
+
+        if ((hostmaxvcpus = virHostCPUGetKVMMaxVCPUs()) < 0) {
+            virBufferFreeAndReset(&buf);
+            return NULL;
+        }
+        virBufferAsprintf(&buf, " maxvcpus=%d", hostmaxvcpus);
+    }
+
+    virBufferAsprintf(&buf, " passthrough=%d%d",
+                      qemuHostdevHostSupportsPassthroughLegacy(),
+                      qemuHostdevHostSupportsPassthroughVFIO());
+
+    for (i = 0; i < nfirmwares; i++) {
+        virBufferAsprintf(&buf, " fw=%s:%s:%d",
+                          firmwares[i]->name, firmwares[i]->nvram,
+                          virFileExists(firmwares[i]->name));
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+/**
+ * virQEMUCapsGetDomainCapsXML:
+ * @caps: host capabilities
+ * @cache: QEMU capabilities cache @qemuCaps comes from or NULL
+ * @qemuCaps: capabilities of @emulatorbin
+ * @emulatorbin: the emulator
+ * @machine: canonical machine type
+ * @arch: guest architecture
+ * @virttype: virtualization type
+ * @firmwares: firmwares known to the driver
+ * @nfirmwares: number of @firmwares
+ *
+ * Formats the domain capabilities for the given combination. The result is
+ * remembered in @qemuCaps and stored together with its cached data in the
+ * cache directory of @cache, so that it is dropped along with it once the
+ * emulator or libvirtd changes.
+ *
+ * Returns the XML or NULL on error.
+ */
+char *
+virQEMUCapsGetDomainCapsXML(virCapsPtr caps,
+                            virQEMUCapsCachePtr cache,
+                            virQEMUCapsPtr qemuCaps,
+                            const char *emulatorbin,
+                            const char *machine,
+                            virArch arch,
+                            virDomainVirtType virttype,
+                            virFirmwarePtr *firmwares,
+                            size_t nfirmwares)
+{
+    virDomainCapsPtr domCaps = NULL;
+    char *key = NULL;
+    char *copy = NULL;
+    char *ret = NULL;
+
+    if (!(key = virQEMUCapsDomainCapsKey(caps, emulatorbin, machine, arch,
+                                         virttype, firmwares, nfirmwares)))
+        return NULL;
+
+    virMutexLock(&qemuCaps->domCapsLock);
+    ignore_value(VIR_STRDUP(ret, virHashLookup(qemuCaps->domCaps, key)));
+    virMutexUnlock(&qemuCaps->domCapsLock);
+
+    if (ret)
+        goto cleanup;
+
+    if (!(domCaps = virDomainCapsNew(emulatorbin, machine, arch, virttype)))
+        goto cleanup;
+
+    if (virQEMUCapsFillDomainCaps(caps, domCaps, qemuCaps,
+                                  firmwares, nfirmwares) < 0)
+        goto cleanup;
+
+    if (!(ret = virDomainCapsFormat(domCaps)) ||
+        VIR_STRDUP_QUIET(copy, ret) < 0)
+        goto cleanup;
+
+    virMutexLock(&qemuCaps->domCapsLock);
+    if (virHashUpdateEntry(qemuCaps->domCaps, key, copy) < 0) {
+        VIR_FREE(copy);
+    } else if (cache && cache->cacheDir &&
+               virQEMUCapsRememberCached(qemuCaps, cache->cacheDir) < 0) {
+        VIR_WARN("Failed to store domain capabilities of '%s': %s",
+                 qemuCaps->binary, virGetLastErrorMessage());
+    }
+    virMutexUnlock(&qemuCaps->domCapsLock);
+    virResetLastError();
+
+ cleanup:
+    virObjectUnref(domCaps);
+    VIR_FREE(key);
+    return ret;
+}
@@ -401,6 +401,18 @@ typedef enum {
     QEMU_CAPS_QUERY_CPU_DEFINITIONS, /* qmp query-cpu-definitions */
     QEMU_CAPS_BLOCK_WRITE_THRESHOLD, /* BLOCK_WRITE_THRESHOLD event */
     QEMU_CAPS_QUERY_NAMED_BLOCK_NODES, /* qmp query-named-block-nodes */
+    QEMU_CAPS_QUERY_CPUS_FAST, /* qmp query-cpus-fast */
+    QEMU_CAPS_DUMP_COMPLETED, /* DUMP_COMPLETED event */
+    QEMU_CAPS_OBJECT_MEMORY_PREALLOC_THREADS, /* memory-backend-*.prealloc-threads */
+    QEMU_CAPS_BLOCKDEV_BACKUP, /* qmp blockdev-backup */
+    QEMU_CAPS_BLOCKDEV_DEL, /* qmp blockdev-del */
+    QEMU_CAPS_NBD_NAME, /* nbd-server-add accepts an export name */
+    QEMU_CAPS_NBD_BITMAP, /* nbd-server-add can export a dirty bitmap */
+
+    /* 260 */
+    QEMU_CAPS_BITMAP_PERSISTENT, /* block-dirty-bitmap-add.persistent */
+    QEMU_CAPS_BITMAP_MERGE, /* qmp block-dirty-bitmap-merge */
+    QEMU_CAPS_CALC_DIRTY_RATE, /* qmp calc-dirty-rate and query-dirty-rate */
 
     QEMU_CAPS_LAST /* this must always be the last item */
 } virQEMUCapsFlags;
@@ -440,6 +452,7 @@ virArch virQEMUCapsGetArch(virQEMUCapsPtr qemuCaps);
 unsigned int virQEMUCapsGetVersion(virQEMUCapsPtr qemuCaps);
 const char *virQEMUCapsGetPackage(virQEMUCapsPtr qemuCaps);
 unsigned int virQEMUCapsGetKVMVersion(virQEMUCapsPtr qemuCaps);
+time_t virQEMUCapsGetCtime(virQEMUCapsPtr qemuCaps);
 int virQEMUCapsAddCPUDefinitions(virQEMUCapsPtr qemuCaps,
                                  virDomainVirtType type,
                                  const char **name,
@@ -479,16 +492,18 @@ virQEMUCapsCachePtr virQEMUCapsCacheNew(const char *libDir,
 virQEMUCapsPtr virQEMUCapsCacheLookup(virCapsPtr caps,
                                       virQEMUCapsCachePtr cache,
                                       const char *binary);
-virQEMUCapsPtr virQEMUCapsCacheLookupCopy(virCapsPtr caps,
-                                          virQEMUCapsCachePtr cache,
-                                          const char *binary,
-                                          const char *machineType);
+virQEMUCapsPtr virQEMUCapsCacheLookupMachine(virCapsPtr caps,
+                                             virQEMUCapsCachePtr cache,
+                                             const char *binary,
+                                             const char *machineType);
+int virQEMUCapsMakeWritable(virQEMUCapsPtr *qemuCaps);
 virQEMUCapsPtr virQEMUCapsCacheLookupByArch(virCapsPtr caps,
                                             virQEMUCapsCachePtr cache,
                                             virArch arch);
 void virQEMUCapsCacheFree(virQEMUCapsCachePtr cache);
 
 virCapsPtr virQEMUCapsInit(virQEMUCapsCachePtr cache);
+char *virQEMUCapsHostStamp(void);
 
 int virQEMUCapsGetDefaultVersion(virCapsPtr caps,
                                  virQEMUCapsCachePtr capsCache,
@@ -522,4 +537,14 @@ int virQEMUCapsFillDomainCaps(virCapsPtr caps,
                               virFirmwarePtr *firmwares,
                               size_t nfirmwares);
 
+char *virQEMUCapsGetDomainCapsXML(virCapsPtr caps,
+                                  virQEMUCapsCachePtr cache,
+                                  virQEMUCapsPtr qemuCaps,
+                                  const char *emulatorbin,
+                                  const char *machine,
+                                  virArch arch,
+                                  virDomainVirtType virttype,
+                                  virFirmwarePtr *firmwares,
+                                  size_t nfirmwares);
+
 #endif /* __QEMU_CAPABILITIES_H__*/
@@ -31,6 +31,9 @@
 struct _virQEMUCapsCache {
     virMutex lock;
     virHashTablePtr binaries;
+    /* binaries currently being probed with @lock released */
+    virHashTablePtr probing;
+    virCond probeCond;
     char *libDir;
     char *cacheDir;
     uid_t runUid;
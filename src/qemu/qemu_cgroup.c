@@ -879,6 +879,10 @@ qemuInitCgroup(virQEMUDriverPtr driver,
         goto cleanup;
     }
 
+    if (priv->cgroup &&
+        virCgroupEnableStatCache(priv->cgroup) < 0)
+        goto cleanup;
+
  done:
     ret = 0;
  cleanup:
@@ -989,6 +993,10 @@ qemuConnectCgroup(virQEMUDriverPtr driver,
                                   &priv->cgroup) < 0)
         goto cleanup;
 
+    if (priv->cgroup &&
+        virCgroupEnableStatCache(priv->cgroup) < 0)
+        goto cleanup;
+
     priv->machineName = virSystemdGetMachineNameByPID(vm->pid);
     if (!priv->machineName)
         virResetLastError();
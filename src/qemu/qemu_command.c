@@ -57,6 +57,7 @@
 #include "virtpm.h"
 #include "virscsi.h"
 #include "virnuma.h"
+#include "virhostcpu.h"
 #include "virgic.h"
 #include "virmdev.h"
 #if defined(__linux__)
@@ -302,27 +303,32 @@ qemuBuildDeviceAddressStr(virBufferPtr buf,
     const char *contAlias = NULL;
 
     if (info->type == VIR_DOMAIN_DEVICE_ADDRESS_TYPE_PCI) {
+        virDomainControllerDefPtr cont = NULL;
         size_t i;
 
-        if (!(devStr = virDomainPCIAddressAsString(&info->addr.pci)))
-            goto cleanup;
         for (i = 0; i < domainDef->ncontrollers; i++) {
-            virDomainControllerDefPtr cont = domainDef->controllers[i];
-
-            if (cont->type == VIR_DOMAIN_CONTROLLER_TYPE_PCI &&
-                cont->idx == info->addr.pci.bus) {
+            if (domainDef->controllers[i]->type == VIR_DOMAIN_CONTROLLER_TYPE_PCI &&
+                domainDef->controllers[i]->idx == info->addr.pci.bus) {
+                cont = domainDef->controllers[i];
                 contAlias = cont->info.alias;
-                if (!contAlias) {
-                    virReportError(VIR_ERR_INTERNAL_ERROR,
-                                   _("Device alias was not set for PCI "
-                                     "controller with index %u required "
-                                     "for device at address %s"),
-                                   info->addr.pci.bus, devStr);
-                    goto cleanup;
-                }
                 break;
             }
         }
+
+        /* The address string is only needed for error messages, so
+         * don't format it for every device on the command line. */
+        if (!contAlias &&
+            !(devStr = virDomainPCIAddressAsString(&info->addr.pci)))
+            goto cleanup;
+
+        if (cont && !contAlias) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Device alias was not set for PCI "
+                             "controller with index %u required "
+                             "for device at address %s"),
+                           info->addr.pci.bus, devStr);
+            goto cleanup;
+        }
         if (!contAlias) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("Could not find PCI "
@@ -2251,6 +2257,20 @@ qemuBuildDriveDevStr(const virDomainDef *def,
 }
 
 
+/*
+ * do not use boot=on for drives when not using KVM since this
+ * is not supported at all in upstream QEmu.
+ */
+static bool
+qemuBuildDriveBootAllowed(const virDomainDef *def,
+                          virQEMUCapsPtr qemuCaps)
+{
+    return virQEMUCapsGet(qemuCaps, QEMU_CAPS_DRIVE_BOOT) &&
+           !(virQEMUCapsGet(qemuCaps, QEMU_CAPS_KVM) &&
+             def->virtType == VIR_DOMAIN_VIRT_QEMU);
+}
+
+
 static int
 qemuBuildDiskDriveCommandLine(virCommandPtr cmd,
                               virQEMUDriverConfigPtr cfg,
@@ -2263,8 +2283,9 @@ qemuBuildDiskDriveCommandLine(virCommandPtr cmd,
     unsigned int bootDisk = 0;
     virBuffer fdc_opts = VIR_BUFFER_INITIALIZER;
     char *fdc_opts_str = NULL;
+    bool driveBootAllowed = qemuBuildDriveBootAllowed(def, qemuCaps);
 
-    if (virQEMUCapsGet(qemuCaps, QEMU_CAPS_DRIVE_BOOT) ||
+    if (driveBootAllowed ||
         virQEMUCapsGet(qemuCaps, QEMU_CAPS_BOOTINDEX)) {
         /* bootDevs will get translated into either bootindex=N or boot=on
          * depending on what qemu supports */
@@ -2319,7 +2340,7 @@ qemuBuildDiskDriveCommandLine(virCommandPtr cmd,
                 break;
             }
             if (!virQEMUCapsGet(qemuCaps, QEMU_CAPS_BOOTINDEX)) {
-                driveBoot = !!bootindex;
+                driveBoot = driveBootAllowed && bootindex;
                 bootindex = 0;
             }
         }
@@ -3231,6 +3252,58 @@ qemuBuildControllerDevCommandLine(virCommandPtr cmd,
 }
 
 
+/* Upper limit on the threads preallocating guest memory if the domain
+ * XML doesn't set it, the page faults hardly scale beyond that */
+#define QEMU_PREALLOC_THREADS_MAX 16
+
+/**
+ * qemuBuildMemoryPreallocThreads:
+ * @def: domain definition object
+ * @autoNodeset: fallback nodeset in case of automatic NUMA placement
+ *
+ * Returns the number of threads QEMU should preallocate the guest memory
+ * with: the value from the domain XML or one per host CPU the emulator
+ * is allowed to run on up to QEMU_PREALLOC_THREADS_MAX.
+ */
+static unsigned int
+qemuBuildMemoryPreallocThreads(const virDomainDef *def,
+                               virBitmapPtr autoNodeset)
+{
+    virBitmapPtr cpus = NULL;
+    ssize_t node = -1;
+    int ncpus = 0;
+
+    if (def->mem.allocation_threads)
+        return def->mem.allocation_threads;
+
+    if (autoNodeset &&
+        def->placement_mode == VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO) {
+        while ((node = virBitmapNextSetBit(autoNodeset, node)) >= 0) {
+            int rc = virNumaGetNodeCPUs(node, &cpus);
+
+            virBitmapFree(cpus);
+            if (rc < 0) {
+                ncpus = 0;
+                break;
+            }
+            ncpus += rc;
+        }
+    } else if (def->cpumask) {
+        ncpus = virBitmapCountBits(def->cpumask);
+    } else {
+        ncpus = virHostCPUGetCount();
+    }
+
+    if (ncpus <= 0) {
+        /* a single thread is what QEMU would use anyway */
+        virResetLastError();
+        return 1;
+    }
+
+    return MIN(ncpus, QEMU_PREALLOC_THREADS_MAX);
+}
+
+
 /**
  * qemuBuildMemoryBackendStr:
  * @backendProps: [out] constructed object
@@ -3253,6 +3326,9 @@ qemuBuildControllerDevCommandLine(virCommandPtr cmd,
  * Then, if one of the two memory-backend-* should be used, the @qemuCaps is
  * consulted to check if qemu does support it.
  *
+ * Memory which gets preallocated is faulted in by as many threads as
+ * qemuBuildMemoryPreallocThreads picks, if qemu supports that.
+ *
  * Returns: 0 on success,
  *          1 on success and if there's no need to use memory-backend-*
  *         -1 on error.
@@ -3281,6 +3357,7 @@ qemuBuildMemoryBackendStr(virJSONValuePtr *backendProps,
     bool nodeSpecified = virDomainNumatuneNodeSpecified(def->numa, mem->targetNode);
     unsigned long long pagesize = mem->pagesize;
     bool needHugepage = !!pagesize;
+    unsigned int preallocThreads = 0;
 
     *backendProps = NULL;
     *backendType = NULL;
@@ -3413,7 +3490,22 @@ qemuBuildMemoryBackendStr(virJSONValuePtr *backendProps,
         *backendType = "memory-backend-ram";
     }
 
-    if (virJSONValueObjectAdd(props, "U:size", mem->size * 1024, NULL) < 0)
+    if (prealloc ||
+        def->mem.allocation == VIR_DOMAIN_MEMORY_ALLOCATION_IMMEDIATE) {
+        if (virQEMUCapsGet(qemuCaps, QEMU_CAPS_OBJECT_MEMORY_PREALLOC_THREADS)) {
+            preallocThreads = qemuBuildMemoryPreallocThreads(def, autoNodeset);
+        } else if (def->mem.allocation_threads) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                           _("memory preallocation threads are not "
+                             "supported by this QEMU"));
+            goto cleanup;
+        }
+    }
+
+    if (virJSONValueObjectAdd(props,
+                              "U:size", mem->size * 1024,
+                              "p:prealloc-threads", preallocThreads,
+                              NULL) < 0)
         goto cleanup;
 
     if (mem->sourceNodes) {
@@ -9790,14 +9882,6 @@ qemuBuildCommandLine(virQEMUDriverPtr driver,
     if (qemuBuildCommandLineValidate(driver, def) < 0)
         goto error;
 
-    /*
-     * do not use boot=on for drives when not using KVM since this
-     * is not supported at all in upstream QEmu.
-     */
-    if (virQEMUCapsGet(qemuCaps, QEMU_CAPS_KVM) &&
-        (def->virtType == VIR_DOMAIN_VIRT_QEMU))
-        virQEMUCapsClear(qemuCaps, QEMU_CAPS_DRIVE_BOOT);
-
     cmd = virCommandNew(def->emulator);
 
     virCommandAddEnvPassCommon(cmd);
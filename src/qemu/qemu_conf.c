@@ -53,6 +53,7 @@
 #include "viratomic.h"
 #include "storage_conf.h"
 #include "configmake.h"
+#include "virhook.h"
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
 
@@ -74,6 +75,10 @@ VIR_LOG_INIT("qemu.qemu_conf");
 #define QEMU_MIGRATION_PORT_MIN 49152
 #define QEMU_MIGRATION_PORT_MAX 49215
 
+/* Upper bounds of the buffering used by the I/O helper for save images */
+#define QEMU_SAVE_BUFFER_SIZE_MAX (256 * 1024) /* KiB */
+#define QEMU_SAVE_BUFFERS_MAX 64
+
 static virClassPtr virQEMUDriverConfigClass;
 static void virQEMUDriverConfigDispose(void *obj);
 
@@ -313,11 +318,23 @@ virQEMUDriverConfigPtr virQEMUDriverConfigNew(bool privileged)
 
     cfg->keepAliveInterval = 5;
     cfg->keepAliveCount = 5;
+
+    cfg->saveBufferSize = 1024;
+    cfg->saveBuffers = 2;
+
+    cfg->autoStartParallel = 1;
+
+    cfg->statsWorkers = 1;
+    cfg->reconnectWorkers = 8;
+    cfg->statsCacheMaxAge = 5000;
+    cfg->processCleanupWorkers = 4;
+
     cfg->seccompSandbox = -1;
 
     cfg->logTimestamp = true;
     cfg->glusterDebugLevel = 4;
     cfg->stdioLogD = true;
+    cfg->hookAsyncMaxWorkers = 4;
 
     if (!(cfg->namespaces = virBitmapNew(QEMU_DOMAIN_NS_LAST)))
         goto error;
@@ -365,6 +382,7 @@ static void virQEMUDriverConfigDispose(void *obj)
     virBitmapFree(cfg->namespaces);
 
     virStringListFree(cfg->cgroupDeviceACL);
+    VIR_FREE(cfg->hostdevVFIOPool);
 
     VIR_FREE(cfg->configBaseDir);
     VIR_FREE(cfg->configDir);
@@ -454,6 +472,8 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     char **nvram = NULL;
     char *corestr = NULL;
     char **namespaces = NULL;
+    char **vfioPool = NULL;
+    char **hookAsync = NULL;
 
     /* Just check the file is readable before opening it, otherwise
      * libvirt emits an error.
@@ -645,6 +665,13 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
         goto cleanup;
     }
 
+    if (virConfGetValueUInt(conf, "migration_auto_tune_target",
+                            &cfg->migrationAutoTuneTarget) < 0)
+        goto cleanup;
+    if (virConfGetValueUInt(conf, "migration_max_parallel_mirrors",
+                            &cfg->migrationMaxParallelMirrors) < 0)
+        goto cleanup;
+
     if (virConfGetValueString(conf, "user", &user) < 0)
         goto cleanup;
     if (user && virGetUserID(user, &cfg->user) < 0)
@@ -658,6 +685,10 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     if (virConfGetValueBool(conf, "dynamic_ownership", &cfg->dynamicOwnership) < 0)
         goto cleanup;
 
+    if (virConfGetValueBool(conf, "shared_backing_images",
+                            &cfg->sharedBackingImages) < 0)
+        goto cleanup;
+
     if (virConfGetValueStringList(conf,  "cgroup_controllers", false,
                                   &controllers) < 0)
         goto cleanup;
@@ -687,12 +718,37 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     if (virConfGetValueString(conf, "snapshot_image_format", &cfg->snapshotImageFormat) < 0)
         goto cleanup;
 
+    if (virConfGetValueUInt(conf, "save_buffer_size", &cfg->saveBufferSize) < 0)
+        goto cleanup;
+    if (cfg->saveBufferSize == 0 ||
+        cfg->saveBufferSize > QEMU_SAVE_BUFFER_SIZE_MAX) {
+        virReportError(VIR_ERR_CONF_SYNTAX,
+                       _("%s: save_buffer_size: size must be between "
+                         "1 and %d KiB"),
+                       filename, QEMU_SAVE_BUFFER_SIZE_MAX);
+        goto cleanup;
+    }
+    if (virConfGetValueUInt(conf, "save_buffers", &cfg->saveBuffers) < 0)
+        goto cleanup;
+    if (cfg->saveBuffers == 0 ||
+        cfg->saveBuffers > QEMU_SAVE_BUFFERS_MAX) {
+        virReportError(VIR_ERR_CONF_SYNTAX,
+                       _("%s: save_buffers: number must be between "
+                         "1 and %d"),
+                       filename, QEMU_SAVE_BUFFERS_MAX);
+        goto cleanup;
+    }
+
     if (virConfGetValueString(conf, "auto_dump_path", &cfg->autoDumpPath) < 0)
         goto cleanup;
     if (virConfGetValueBool(conf, "auto_dump_bypass_cache", &cfg->autoDumpBypassCache) < 0)
         goto cleanup;
     if (virConfGetValueBool(conf, "auto_start_bypass_cache", &cfg->autoStartBypassCache) < 0)
         goto cleanup;
+    if (virConfGetValueUInt(conf, "auto_start_parallel", &cfg->autoStartParallel) < 0)
+        goto cleanup;
+    if (virConfGetValueUInt(conf, "auto_start_max_load", &cfg->autoStartMaxLoad) < 0)
+        goto cleanup;
 
     if (virConfGetValueStringList(conf, "hugetlbfs_mount", true,
                                   &hugetlbfs) < 0)
@@ -776,6 +832,21 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     if (virConfGetValueUInt(conf, "max_queued", &cfg->maxQueuedJobs) < 0)
         goto cleanup;
 
+    if (virConfGetValueUInt(conf, "stats_workers", &cfg->statsWorkers) < 0)
+        goto cleanup;
+    if (virConfGetValueBool(conf, "stats_workers_numa", &cfg->statsWorkersNuma) < 0)
+        goto cleanup;
+    if (virConfGetValueUInt(conf, "stats_job_timeout", &cfg->statsJobTimeout) < 0)
+        goto cleanup;
+
+    if (virConfGetValueUInt(conf, "reconnect_workers", &cfg->reconnectWorkers) < 0)
+        goto cleanup;
+    if (virConfGetValueUInt(conf, "stats_cache_max_age", &cfg->statsCacheMaxAge) < 0)
+        goto cleanup;
+    if (virConfGetValueUInt(conf, "process_cleanup_workers",
+                            &cfg->processCleanupWorkers) < 0)
+        goto cleanup;
+
     if (virConfGetValueInt(conf, "keepalive_interval", &cfg->keepAliveInterval) < 0)
         goto cleanup;
     if (virConfGetValueUInt(conf, "keepalive_count", &cfg->keepAliveCount) < 0)
@@ -873,9 +944,83 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     if (virConfGetValueString(conf, "memory_backing_dir", &cfg->memoryBackingDir) < 0)
         goto cleanup;
 
+    if (virConfGetValueUInt(conf, "numa_rebalance_interval",
+                            &cfg->numaRebalanceInterval) < 0)
+        goto cleanup;
+
+    if (virConfGetValueUInt(conf, "perf_sample_interval",
+                            &cfg->perfSampleInterval) < 0)
+        goto cleanup;
+
+    if (virConfGetValueStringList(conf, "hook_async", false, &hookAsync) < 0)
+        goto cleanup;
+
+    if (hookAsync) {
+        cfg->hookAsync = 0;
+
+        for (i = 0; hookAsync[i]; i++) {
+            int op = virHookQemuOpTypeFromString(hookAsync[i]);
+
+            if (op != VIR_HOOK_QEMU_OP_STARTED &&
+                op != VIR_HOOK_QEMU_OP_STOPPED &&
+                op != VIR_HOOK_QEMU_OP_RELEASE) {
+                virReportError(VIR_ERR_CONF_SYNTAX,
+                               _("Hook operation '%s' can't be run "
+                                 "asynchronously"), hookAsync[i]);
+                goto cleanup;
+            }
+
+            cfg->hookAsync |= 1 << op;
+        }
+    }
+
+    if (virConfGetValueUInt(conf, "hook_async_timeout",
+                            &cfg->hookAsyncTimeout) < 0)
+        goto cleanup;
+
+    if (virConfGetValueUInt(conf, "hook_async_max_workers",
+                            &cfg->hookAsyncMaxWorkers) < 0)
+        goto cleanup;
+
+    if (cfg->hookAsyncMaxWorkers == 0) {
+        virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                       _("hook_async_max_workers must be greater than 0"));
+        goto cleanup;
+    }
+
+    if (virConfGetValueUInt(conf, "lazy_inactive_defs",
+                            &cfg->lazyInactiveDefs) < 0)
+        goto cleanup;
+
+    if (virConfGetValueStringList(conf, "hostdev_vfio_pool", false,
+                                  &vfioPool) < 0)
+        goto cleanup;
+
+    if (vfioPool) {
+        VIR_FREE(cfg->hostdevVFIOPool);
+        cfg->nhostdevVFIOPool = 0;
+
+        if (VIR_ALLOC_N(cfg->hostdevVFIOPool,
+                        virStringListLength((const char *const *)vfioPool)) < 0)
+            goto cleanup;
+
+        for (i = 0; vfioPool[i]; i++) {
+            if (virPCIDeviceAddressParse(vfioPool[i],
+                                         &cfg->hostdevVFIOPool[i]) < 0) {
+                virReportError(VIR_ERR_CONF_SYNTAX,
+                               _("Invalid PCI address in hostdev_vfio_pool: %s"),
+                               vfioPool[i]);
+                goto cleanup;
+            }
+            cfg->nhostdevVFIOPool++;
+        }
+    }
+
     ret = 0;
 
  cleanup:
+    virStringListFree(hookAsync);
+    virStringListFree(vfioPool);
     virStringListFree(controllers);
     virStringListFree(hugetlbfs);
     virStringListFree(nvram);
@@ -981,7 +1126,8 @@ virCapsPtr virQEMUDriverCreateCapabilities(virQEMUDriverPtr driver)
  *
  * Get a reference to the virCapsPtr instance for the
  * driver. If @refresh is true, the capabilities will be
- * rebuilt first
+ * rebuilt first unless the host didn't change since they
+ * were built last time, see virQEMUCapsHostStamp
  *
  * The caller must release the reference with virObjetUnref
  *
@@ -991,14 +1137,32 @@ virCapsPtr virQEMUDriverGetCapabilities(virQEMUDriverPtr driver,
                                         bool refresh)
 {
     virCapsPtr ret = NULL;
+    char *stamp = NULL;
+
+    if (refresh && (stamp = virQEMUCapsHostStamp())) {
+        qemuDriverLock(driver);
+        if (driver->caps && driver->caps->nguests > 0 &&
+            STREQ_NULLABLE(driver->capsStamp, stamp))
+            refresh = false;
+        qemuDriverUnlock(driver);
+
+        if (!refresh)
+            VIR_FREE(stamp);
+    }
+
     if (refresh) {
         virCapsPtr caps = NULL;
-        if ((caps = virQEMUDriverCreateCapabilities(driver)) == NULL)
+        if ((caps = virQEMUDriverCreateCapabilities(driver)) == NULL) {
+            VIR_FREE(stamp);
             return NULL;
+        }
 
         qemuDriverLock(driver);
         virObjectUnref(driver->caps);
         driver->caps = caps;
+        VIR_FREE(driver->capsStamp);
+        driver->capsStamp = stamp;
+        VIR_FREE(driver->capsXML);
     } else {
         qemuDriverLock(driver);
     }
@@ -1015,11 +1179,57 @@ virCapsPtr virQEMUDriverGetCapabilities(virQEMUDriverPtr driver,
     return ret;
 }
 
+
+/**
+ * virQEMUDriverGetCapabilitiesXML:
+ *
+ * Refreshes the capabilities of the driver like
+ * virQEMUDriverGetCapabilities does and formats them. The
+ * XML is kept until the capabilities are rebuilt.
+ *
+ * Returns: the XML the caller must free or NULL
+ */
+char *virQEMUDriverGetCapabilitiesXML(virQEMUDriverPtr driver)
+{
+    virCapsPtr caps;
+    char *xml = NULL;
+
+    if (!(caps = virQEMUDriverGetCapabilities(driver, true)))
+        return NULL;
+
+    qemuDriverLock(driver);
+    if (driver->caps == caps && driver->capsXML) {
+        ignore_value(VIR_STRDUP(xml, driver->capsXML));
+        qemuDriverUnlock(driver);
+        goto cleanup;
+    }
+    qemuDriverUnlock(driver);
+
+    if (!(xml = virCapabilitiesFormatXML(caps)))
+        goto cleanup;
+
+    qemuDriverLock(driver);
+    if (driver->caps == caps && !driver->capsXML)
+        ignore_value(VIR_STRDUP_QUIET(driver->capsXML, xml));
+    qemuDriverUnlock(driver);
+
+ cleanup:
+    virObjectUnref(caps);
+    return xml;
+}
+
 struct _qemuSharedDeviceEntry {
     size_t ref;
     char **domains; /* array of domain names */
 };
 
+typedef struct _qemuSharedDeviceEntryData qemuSharedDeviceEntryData;
+typedef qemuSharedDeviceEntryData *qemuSharedDeviceEntryDataPtr;
+struct _qemuSharedDeviceEntryData {
+    const char *name;               /* the domain name */
+    virDomainDiskDefPtr disk;       /* NULL for host devices */
+};
+
 /* Construct the hash key for sharedDevices as "major:minor" */
 char *
 qemuGetSharedDeviceKey(const char *device_path)
@@ -1043,7 +1253,8 @@ qemuGetSharedDeviceKey(const char *device_path)
 
 /*
  * Make necessary checks for the need to check and for the current setting
- * of the 'unpriv_sgio' value for the device_path passed.
+ * of the 'unpriv_sgio' value for the device_path passed, which is shared
+ * with other domains.
  *
  * Returns:
  *  0 - Success
@@ -1053,12 +1264,10 @@ qemuGetSharedDeviceKey(const char *device_path)
  *      being used and in the future the hostdev information.
  */
 static int
-qemuCheckUnprivSGIO(virHashTablePtr sharedDevices,
-                    const char *device_path,
+qemuCheckUnprivSGIO(const char *device_path,
                     int sgio)
 {
     char *sysfs_path = NULL;
-    char *key = NULL;
     int val;
     int ret = -1;
 
@@ -1071,15 +1280,6 @@ qemuCheckUnprivSGIO(virHashTablePtr sharedDevices,
         goto cleanup;
     }
 
-    if (!(key = qemuGetSharedDeviceKey(device_path)))
-        goto cleanup;
-
-    /* It can't be conflict if no other domain is sharing it. */
-    if (!(virHashLookup(sharedDevices, key))) {
-        ret = 0;
-        goto cleanup;
-    }
-
     if (virGetDeviceUnprivSGIO(device_path, NULL, &val) < 0)
         goto cleanup;
 
@@ -1099,7 +1299,6 @@ qemuCheckUnprivSGIO(virHashTablePtr sharedDevices,
 
  cleanup:
     VIR_FREE(sysfs_path);
-    VIR_FREE(key);
     return ret;
 }
 
@@ -1112,16 +1311,14 @@ qemuCheckUnprivSGIO(virHashTablePtr sharedDevices,
  * Returns 0 if no conflicts, otherwise returns -1.
  */
 static int
-qemuCheckSharedDisk(virHashTablePtr sharedDevices,
-                    virDomainDiskDefPtr disk)
+qemuCheckSharedDisk(virDomainDiskDefPtr disk)
 {
     int ret;
 
     if (disk->device != VIR_DOMAIN_DISK_DEVICE_LUN)
         return 0;
 
-    if ((ret = qemuCheckUnprivSGIO(sharedDevices, disk->src->path,
-                                   disk->sgio)) < 0) {
+    if ((ret = qemuCheckUnprivSGIO(disk->src->path, disk->sgio)) < 0) {
         if (ret == -2) {
             if (virDomainDiskGetType(disk) == VIR_STORAGE_TYPE_VOLUME) {
                 virReportError(VIR_ERR_OPERATION_INVALID,
@@ -1177,35 +1374,36 @@ qemuSharedDeviceEntryFree(void *payload, const void *name ATTRIBUTE_UNUSED)
 }
 
 
+/* Called by virHashAtomicModify with the shared device locked */
 static int
-qemuSharedDeviceEntryInsert(virQEMUDriverPtr driver,
-                            const char *key,
-                            const char *name)
+qemuSharedDeviceEntryInsert(void **payload,
+                            const void *key ATTRIBUTE_UNUSED,
+                            void *opaque)
 {
-    qemuSharedDeviceEntry *entry = NULL;
+    qemuSharedDeviceEntryDataPtr data = opaque;
+    qemuSharedDeviceEntryPtr entry = *payload;
+
+    if (entry) {
+        /* It can't be conflict if no other domain is sharing it. */
+        if (data->disk && qemuCheckSharedDisk(data->disk) < 0)
+            return -1;
 
-    if ((entry = virHashLookup(driver->sharedDevices, key))) {
         /* Nothing to do if the shared scsi host device is already
          * recorded in the table.
          */
-        if (!qemuSharedDeviceEntryDomainExists(entry, name, NULL)) {
+        if (!qemuSharedDeviceEntryDomainExists(entry, data->name, NULL)) {
             if (VIR_EXPAND_N(entry->domains, entry->ref, 1) < 0 ||
-                VIR_STRDUP(entry->domains[entry->ref - 1], name) < 0) {
-                /* entry is owned by the hash table here */
-                entry = NULL;
-                goto error;
-            }
+                VIR_STRDUP(entry->domains[entry->ref - 1], data->name) < 0)
+                return -1;
         }
     } else {
         if (VIR_ALLOC(entry) < 0 ||
             VIR_ALLOC_N(entry->domains, 1) < 0 ||
-            VIR_STRDUP(entry->domains[0], name) < 0)
+            VIR_STRDUP(entry->domains[0], data->name) < 0)
             goto error;
 
         entry->ref = 1;
-
-        if (virHashAddEntry(driver->sharedDevices, key, entry))
-            goto error;
+        *payload = entry;
     }
 
     return 0;
@@ -1230,6 +1428,7 @@ qemuAddSharedDisk(virQEMUDriverPtr driver,
                   virDomainDiskDefPtr disk,
                   const char *name)
 {
+    qemuSharedDeviceEntryData data = { name, disk };
     char *key = NULL;
     int ret = -1;
 
@@ -1238,21 +1437,16 @@ qemuAddSharedDisk(virQEMUDriverPtr driver,
         !virStorageSourceIsBlockLocal(disk->src))
         return 0;
 
-    qemuDriverLock(driver);
-
-    if (qemuCheckSharedDisk(driver->sharedDevices, disk) < 0)
-        goto cleanup;
-
     if (!(key = qemuGetSharedDeviceKey(virDomainDiskGetSource(disk))))
         goto cleanup;
 
-    if (qemuSharedDeviceEntryInsert(driver, key, name) < 0)
+    if (virHashAtomicModify(driver->sharedDevices, key,
+                            qemuSharedDeviceEntryInsert, &data) < 0)
         goto cleanup;
 
     ret = 0;
 
  cleanup:
-    qemuDriverUnlock(driver);
     VIR_FREE(key);
     return ret;
 }
@@ -1296,6 +1490,7 @@ qemuAddSharedHostdev(virQEMUDriverPtr driver,
                      virDomainHostdevDefPtr hostdev,
                      const char *name)
 {
+    qemuSharedDeviceEntryData data = { name, NULL };
     char *dev_path = NULL;
     char *key = NULL;
     int ret = -1;
@@ -1309,9 +1504,8 @@ qemuAddSharedHostdev(virQEMUDriverPtr driver,
     if (!(key = qemuGetSharedDeviceKey(dev_path)))
         goto cleanup;
 
-    qemuDriverLock(driver);
-    ret = qemuSharedDeviceEntryInsert(driver, key, name);
-    qemuDriverUnlock(driver);
+    ret = virHashAtomicModify(driver->sharedDevices, key,
+                              qemuSharedDeviceEntryInsert, &data);
 
  cleanup:
     VIR_FREE(dev_path);
@@ -1320,15 +1514,17 @@ qemuAddSharedHostdev(virQEMUDriverPtr driver,
 }
 
 
+/* Called by virHashAtomicModify with the shared device locked */
 static int
-qemuSharedDeviceEntryRemove(virQEMUDriverPtr driver,
-                            const char *key,
-                            const char *name)
+qemuSharedDeviceEntryRemove(void **payload,
+                            const void *key ATTRIBUTE_UNUSED,
+                            void *opaque)
 {
-    qemuSharedDeviceEntryPtr entry = NULL;
+    qemuSharedDeviceEntryPtr entry = *payload;
+    const char *name = opaque;
     int idx;
 
-    if (!(entry = virHashLookup(driver->sharedDevices, key)))
+    if (!entry)
         return -1;
 
     /* Nothing to do if the shared disk is not recored in the table. */
@@ -1338,7 +1534,7 @@ qemuSharedDeviceEntryRemove(virQEMUDriverPtr driver,
     if (entry->ref != 1)
         VIR_DELETE_ELEMENT(entry->domains, idx, entry->ref);
     else
-        ignore_value(virHashRemoveEntry(driver->sharedDevices, key));
+        *payload = NULL;
 
     return 0;
 }
@@ -1384,17 +1580,15 @@ qemuRemoveSharedDisk(virQEMUDriverPtr driver,
         !virStorageSourceIsBlockLocal(disk->src))
         return 0;
 
-    qemuDriverLock(driver);
-
     if (!(key = qemuGetSharedDeviceKey(virDomainDiskGetSource(disk))))
         goto cleanup;
 
-    if (qemuSharedDeviceEntryRemove(driver, key, name) < 0)
+    if (virHashAtomicModify(driver->sharedDevices, key,
+                            qemuSharedDeviceEntryRemove, (void *) name) < 0)
         goto cleanup;
 
     ret = 0;
  cleanup:
-    qemuDriverUnlock(driver);
     VIR_FREE(key);
     return ret;
 }
@@ -1418,9 +1612,8 @@ qemuRemoveSharedHostdev(virQEMUDriverPtr driver,
     if (!(key = qemuGetSharedDeviceKey(dev_path)))
         goto cleanup;
 
-    qemuDriverLock(driver);
-    ret = qemuSharedDeviceEntryRemove(driver, key, name);
-    qemuDriverUnlock(driver);
+    ret = virHashAtomicModify(driver->sharedDevices, key,
+                              qemuSharedDeviceEntryRemove, (void *) name);
 
  cleanup:
     VIR_FREE(dev_path);
@@ -49,6 +49,7 @@
 # include "virhostdev.h"
 # include "virfile.h"
 # include "virfirmware.h"
+# include "virnuma.h"
 
 # ifdef CPU_SETSIZE /* Linux */
 #  define QEMUD_CPUMASK_LEN CPU_SETSIZE
@@ -66,6 +67,14 @@ typedef virQEMUDriver *virQEMUDriverPtr;
 typedef struct _virQEMUDriverConfig virQEMUDriverConfig;
 typedef virQEMUDriverConfig *virQEMUDriverConfigPtr;
 
+/* See qemu_placement.h */
+typedef struct _qemuPlacement qemuPlacement;
+typedef qemuPlacement *qemuPlacementPtr;
+
+/* See qemu_process.c */
+typedef struct _qemuProcessStopCleanup qemuProcessStopCleanup;
+typedef qemuProcessStopCleanup *qemuProcessStopCleanupPtr;
+
 /* Main driver config. The data in these object
  * instances is immutable, so can be accessed
  * without locking. Threads must, however, hold
@@ -89,6 +98,7 @@ struct _virQEMUDriverConfig {
     uid_t user;
     gid_t group;
     bool dynamicOwnership;
+    bool sharedBackingImages;
 
     virBitmapPtr namespaces;
 
@@ -168,6 +178,14 @@ struct _virQEMUDriverConfig {
 
     unsigned int maxQueuedJobs;
 
+    unsigned int statsWorkers;
+    bool statsWorkersNuma;
+    unsigned int statsJobTimeout;
+
+    unsigned int reconnectWorkers;
+    unsigned int statsCacheMaxAge;
+    unsigned int processCleanupWorkers;
+
     char **securityDriverNames;
     bool securityDefaultConfined;
     bool securityRequireConfined;
@@ -175,10 +193,14 @@ struct _virQEMUDriverConfig {
     char *saveImageFormat;
     char *dumpImageFormat;
     char *snapshotImageFormat;
+    unsigned int saveBufferSize; /* in KiB */
+    unsigned int saveBuffers;
 
     char *autoDumpPath;
     bool autoDumpBypassCache;
     bool autoStartBypassCache;
+    unsigned int autoStartParallel;
+    unsigned int autoStartMaxLoad; /* in percent of the host CPUs */
 
     char *lockManagerName;
 
@@ -192,6 +214,8 @@ struct _virQEMUDriverConfig {
     char *migrationAddress;
     unsigned int migrationPortMin;
     unsigned int migrationPortMax;
+    unsigned int migrationAutoTuneTarget;
+    unsigned int migrationMaxParallelMirrors;
 
     bool logTimestamp;
     bool stdioLogD;
@@ -201,6 +225,19 @@ struct _virQEMUDriverConfig {
     unsigned int glusterDebugLevel;
 
     char *memoryBackingDir;
+
+    unsigned int numaRebalanceInterval;
+
+    virPCIDeviceAddressPtr hostdevVFIOPool;
+    size_t nhostdevVFIOPool;
+
+    unsigned int perfSampleInterval;
+
+    unsigned int hookAsync; /* bitmask of virHookQemuOpType */
+    unsigned int hookAsyncTimeout;
+    unsigned int hookAsyncMaxWorkers;
+
+    unsigned int lazyInactiveDefs;
 };
 
 /* Main driver state */
@@ -214,6 +251,29 @@ struct _virQEMUDriver {
     /* Immutable pointer, self-locking APIs */
     virThreadPoolPtr workerPool;
 
+    /* Immutable pointer, self-locking APIs. NULL unless
+     * stats_workers is larger than 1 and stats_workers_numa is off */
+    virThreadPoolPtr statsPool;
+
+    /* Immutable pointer, self-locking APIs. Replaces statsPool if
+     * stats_workers_numa is on */
+    virThreadPoolNumaPtr statsNumaPools;
+
+    /* Immutable pointer, self-locking APIs. NULL if
+     * reconnect_workers is 0 */
+    virThreadPoolPtr reconnectPool;
+
+    /* Immutable pointer, self-locking APIs. NULL if
+     * process_cleanup_workers is 0 */
+    virThreadPoolPtr cleanupPool;
+
+    /* Require cleanupLock. Cleanups of stopped domains left to the
+     * workers of cleanupPool, signalled on cleanupCond when done */
+    virMutex cleanupLock;
+    virCond cleanupCond;
+    qemuProcessStopCleanupPtr *cleanups;
+    size_t ncleanups;
+
     /* Atomic increment only */
     int lastvmid;
 
@@ -241,6 +301,11 @@ struct _virQEMUDriver {
      */
     virCapsPtr caps;
 
+    /* Require lock. The host state caps were built for, see
+     * virQEMUCapsHostStamp, and caps formatted as XML, or NULL */
+    char *capsStamp;
+    char *capsXML;
+
     /* Immutable pointer, Immutable object */
     virDomainXMLOptionPtr xmlopt;
 
@@ -255,8 +320,8 @@ struct _virQEMUDriver {
 
     virHostdevManagerPtr hostdevMgr;
 
-    /* Immutable pointer. Unsafe APIs. XXX */
-    virHashTablePtr sharedDevices;
+    /* Immutable pointer, self-locking APIs */
+    virHashAtomicPtr sharedDevices;
 
     /* Immutable pointer, self-locking APIs */
     virPortAllocatorPtr remotePorts;
@@ -278,6 +343,15 @@ struct _virQEMUDriver {
 
     /* Immutable pointer, self-locking APIs */
     virHashAtomicPtr migrationErrors;
+
+    /* Immutable pointer. NULL unless numa_rebalance_interval is set */
+    qemuPlacementPtr placement;
+
+    /* Immutable pointer, self-locking APIs */
+    virNumaPageLedgerPtr hugepageLedger;
+
+    /* Immutable value. -1 unless perf_sample_interval is set */
+    int perfSampleTimer;
 };
 
 typedef struct _qemuDomainCmdlineDef qemuDomainCmdlineDef;
@@ -307,6 +381,7 @@ bool virQEMUDriverIsPrivileged(virQEMUDriverPtr driver);
 virCapsPtr virQEMUDriverCreateCapabilities(virQEMUDriverPtr driver);
 virCapsPtr virQEMUDriverGetCapabilities(virQEMUDriverPtr driver,
                                         bool refresh);
+char *virQEMUDriverGetCapabilitiesXML(virQEMUDriverPtr driver);
 
 typedef struct _qemuSharedDeviceEntry qemuSharedDeviceEntry;
 typedef qemuSharedDeviceEntry *qemuSharedDeviceEntryPtr;
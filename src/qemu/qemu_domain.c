@@ -46,6 +46,7 @@
 #include "virstoragefile.h"
 #include "virstring.h"
 #include "virthreadjob.h"
+#include "virtrace.h"
 #include "viratomic.h"
 #include "virprocess.h"
 #include "vircrypto.h"
@@ -104,6 +105,16 @@ VIR_ENUM_IMPL(qemuDomainNamespace, QEMU_DOMAIN_NS_LAST,
               "mount",
 );
 
+VIR_ENUM_DECL(qemuDomainBlockJobGroupDiskState)
+VIR_ENUM_IMPL(qemuDomainBlockJobGroupDiskState,
+              VIR_DOMAIN_BLOCK_JOB_GROUP_DISK_LAST,
+              "pending",
+              "running",
+              "completed",
+              "failed",
+              "canceled",
+);
+
 
 #define PROC_MOUNTS "/proc/mounts"
 #define DEVPREFIX "/dev/"
@@ -274,6 +285,7 @@ qemuDomainObjResetJob(qemuDomainObjPrivatePtr priv)
     job->owner = 0;
     job->ownerAPI = NULL;
     job->started = 0;
+    job->nshared = 0;
 }
 
 static void
@@ -292,6 +304,8 @@ qemuDomainObjResetAsyncJob(qemuDomainObjPrivatePtr priv)
     job->spiceMigration = false;
     job->spiceMigrated = false;
     job->postcopyEnabled = false;
+    job->dumpCompleted = false;
+    VIR_FREE(job->dumpError);
     VIR_FREE(job->current);
 }
 
@@ -317,6 +331,7 @@ qemuDomainObjFreeJob(qemuDomainObjPrivatePtr priv)
 {
     VIR_FREE(priv->job.current);
     VIR_FREE(priv->job.completed);
+    VIR_FREE(priv->job.dumpError);
     virCondDestroy(&priv->job.cond);
     virCondDestroy(&priv->job.asyncCond);
 }
@@ -537,6 +552,15 @@ qemuDomainJobInfoToParams(qemuDomainJobInfoPtr jobInfo,
                              stats->cpu_throttle_percentage) < 0)
         goto error;
 
+    if (jobInfo->autoTuneAdjustments &&
+        (virTypedParamsAddUInt(&par, &npar, &maxpar,
+                               VIR_DOMAIN_JOB_AUTO_TUNE_ADJUSTMENTS,
+                               jobInfo->autoTuneAdjustments) < 0 ||
+         virTypedParamsAddULLong(&par, &npar, &maxpar,
+                                 VIR_DOMAIN_JOB_AUTO_TUNE_DOWNTIME,
+                                 jobInfo->downtimeLimit) < 0))
+        goto error;
+
     *type = jobInfo->type;
     *params = par;
     *nparams = npar;
@@ -1634,6 +1658,9 @@ qemuDomainObjPrivateAlloc(void)
         goto error;
 
     priv->migMaxBandwidth = QEMU_DOMAIN_MIG_BANDWIDTH_MAX;
+    priv->statsEventTimer = -1;
+    priv->balloonStatsTimer = -1;
+    priv->nballoonStats = -1;
 
     return priv;
 
@@ -1681,11 +1708,156 @@ qemuDomainObjPrivateFree(void *data)
     qemuDomainSecretInfoFree(&priv->migSecinfo);
     VIR_FREE(priv->migTLSAlias);
     qemuDomainMasterKeyFree(priv);
+    qemuDomainStatsCacheClear(priv);
+    qemuDomainStatsEventClear(priv);
+    qemuDomainBalloonStatsClear(priv);
+    qemuDomainBlockThresholdsClear(priv);
+    virDomainBackupDefFree(priv->backup);
+    qemuDomainBlockJobGroupFree(priv->blockJobGroup);
 
     VIR_FREE(priv);
 }
 
 
+/**
+ * qemuDomainStatsCacheClear:
+ * @priv: domain private data
+ *
+ * Drops the statistics cached for VIR_CONNECT_GET_ALL_DOMAINS_STATS_CACHED.
+ */
+void
+qemuDomainStatsCacheClear(qemuDomainObjPrivatePtr priv)
+{
+    virTypedParamsFree(priv->statsCache, priv->nstatsCache);
+    priv->statsCache = NULL;
+    priv->nstatsCache = 0;
+    priv->statsCacheTypes = 0;
+    priv->statsCacheFlags = 0;
+    priv->statsCacheTime = 0;
+}
+
+
+/**
+ * qemuDomainStatsEventClear:
+ * @priv: domain private data
+ *
+ * Stops the periodic statistics event set up by virDomainSetStatsEvent
+ * and forgets the values reported so far.
+ */
+void
+qemuDomainStatsEventClear(qemuDomainObjPrivatePtr priv)
+{
+    if (priv->statsEventTimer != -1) {
+        virEventRemoveTimeout(priv->statsEventTimer);
+        priv->statsEventTimer = -1;
+    }
+    priv->statsEventTypes = 0;
+    virTypedParamsFree(priv->statsEventLast, priv->nstatsEventLast);
+    priv->statsEventLast = NULL;
+    priv->nstatsEventLast = 0;
+}
+
+
+/**
+ * qemuDomainBalloonStatsClear:
+ * @priv: domain private data
+ *
+ * Stops refreshing the guest memory statistics of the balloon and drops
+ * the cached ones.
+ */
+void
+qemuDomainBalloonStatsClear(qemuDomainObjPrivatePtr priv)
+{
+    if (priv->balloonStatsTimer != -1) {
+        virEventRemoveTimeout(priv->balloonStatsTimer);
+        priv->balloonStatsTimer = -1;
+    }
+    priv->nballoonStats = -1;
+}
+
+
+/**
+ * qemuDomainBlockThresholdSet:
+ * @priv: domain private data
+ * @nodename: block node the threshold was armed for
+ * @threshold: the threshold, 0 if it was disarmed or fired
+ *
+ * Records the write threshold of @nodename, see the blockThresholds
+ * member of the private data.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuDomainBlockThresholdSet(qemuDomainObjPrivatePtr priv,
+                            const char *nodename,
+                            unsigned long long threshold)
+{
+    qemuDomainBlockThreshold entry = { NULL, threshold };
+    size_t i;
+
+    for (i = 0; i < priv->nblockThresholds; i++) {
+        if (STREQ(priv->blockThresholds[i].nodename, nodename))
+            break;
+    }
+
+    if (i < priv->nblockThresholds) {
+        if (threshold) {
+            priv->blockThresholds[i].threshold = threshold;
+        } else {
+            VIR_FREE(priv->blockThresholds[i].nodename);
+            VIR_DELETE_ELEMENT(priv->blockThresholds, i,
+                               priv->nblockThresholds);
+        }
+        return 0;
+    }
+
+    if (!threshold)
+        return 0;
+
+    if (VIR_STRDUP(entry.nodename, nodename) < 0 ||
+        VIR_APPEND_ELEMENT(priv->blockThresholds, priv->nblockThresholds,
+                           entry) < 0) {
+        VIR_FREE(entry.nodename);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * qemuDomainBlockThresholdsClear:
+ * @priv: domain private data
+ *
+ * Forgets the write thresholds recorded by qemuDomainBlockThresholdSet.
+ */
+void
+qemuDomainBlockThresholdsClear(qemuDomainObjPrivatePtr priv)
+{
+    size_t i;
+
+    for (i = 0; i < priv->nblockThresholds; i++)
+        VIR_FREE(priv->blockThresholds[i].nodename);
+    VIR_FREE(priv->blockThresholds);
+    priv->nblockThresholds = 0;
+}
+
+
+void
+qemuDomainBlockJobGroupFree(qemuDomainBlockJobGroupPtr group)
+{
+    size_t i;
+
+    if (!group)
+        return;
+
+    for (i = 0; i < group->ndisks; i++)
+        VIR_FREE(group->disks[i].dst);
+    VIR_FREE(group->disks);
+    VIR_FREE(group);
+}
+
+
 static void
 qemuDomainObjPrivateXMLFormatVcpus(virBufferPtr buf,
                                    virDomainDefPtr def)
@@ -1713,13 +1885,84 @@ qemuDomainObjPrivateXMLFormatVcpus(virBufferPtr buf,
 }
 
 
+static void
+qemuDomainObjPrivateXMLFormatJob(virBufferPtr buf,
+                                 virDomainObjPtr vm,
+                                 bool always)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainJob job;
+
+    job = priv->job.active;
+    if (!qemuDomainTrackJob(job))
+        priv->job.active = QEMU_JOB_NONE;
+
+    if (always || priv->job.active || priv->job.asyncJob) {
+        virBufferAsprintf(buf, "<job type='%s' async='%s'",
+                          qemuDomainJobTypeToString(priv->job.active),
+                          qemuDomainAsyncJobTypeToString(priv->job.asyncJob));
+        if (priv->job.phase) {
+            virBufferAsprintf(buf, " phase='%s'",
+                              qemuDomainAsyncJobPhaseToString(
+                                    priv->job.asyncJob, priv->job.phase));
+        }
+        if (priv->job.asyncJob != QEMU_ASYNC_JOB_MIGRATION_OUT) {
+            virBufferAddLit(buf, "/>\n");
+        } else {
+            size_t i;
+            virDomainDiskDefPtr disk;
+            qemuDomainDiskPrivatePtr diskPriv;
+
+            virBufferAddLit(buf, ">\n");
+            virBufferAdjustIndent(buf, 2);
+
+            for (i = 0; i < vm->def->ndisks; i++) {
+                disk = vm->def->disks[i];
+                diskPriv = QEMU_DOMAIN_DISK_PRIVATE(disk);
+                virBufferAsprintf(buf, "<disk dev='%s' migrating='%s'/>\n",
+                                  disk->dst,
+                                  diskPriv->migrating ? "yes" : "no");
+            }
+
+            virBufferAdjustIndent(buf, -2);
+            virBufferAddLit(buf, "</job>\n");
+        }
+    }
+    priv->job.active = job;
+}
+
+
+static void
+qemuDomainObjPrivateXMLFormatBlockJobGroup(virBufferPtr buf,
+                                           qemuDomainBlockJobGroupPtr group)
+{
+    size_t i;
+
+    virBufferAsprintf(buf, "<blockJobGroup type='%s' bandwidth='%llu' "
+                      "concurrency='%u' started='%llu'>\n",
+                      group->type == VIR_DOMAIN_BLOCK_JOB_TYPE_COMMIT ?
+                      "commit" : "pull",
+                      group->bandwidth, group->concurrency, group->started);
+    virBufferAdjustIndent(buf, 2);
+    for (i = 0; i < group->ndisks; i++) {
+        qemuDomainBlockJobGroupDiskPtr disk = &group->disks[i];
+
+        virBufferEscapeString(buf, "<disk dst='%s'", disk->dst);
+        virBufferAsprintf(buf, " state='%s' cur='%llu' end='%llu'/>\n",
+                          qemuDomainBlockJobGroupDiskStateTypeToString(disk->state),
+                          disk->cur, disk->end);
+    }
+    virBufferAdjustIndent(buf, -2);
+    virBufferAddLit(buf, "</blockJobGroup>\n");
+}
+
+
 static int
 qemuDomainObjPrivateXMLFormat(virBufferPtr buf,
                               virDomainObjPtr vm)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
     const char *monitorpath;
-    qemuDomainJob job;
 
     /* priv->monitor_chr is set only for qemu */
     if (priv->monConfig) {
@@ -1770,42 +2013,7 @@ qemuDomainObjPrivateXMLFormat(virBufferPtr buf,
     if (priv->lockState)
         virBufferAsprintf(buf, "<lockstate>%s</lockstate>\n", priv->lockState);
 
-    job = priv->job.active;
-    if (!qemuDomainTrackJob(job))
-        priv->job.active = QEMU_JOB_NONE;
-
-    if (priv->job.active || priv->job.asyncJob) {
-        virBufferAsprintf(buf, "<job type='%s' async='%s'",
-                          qemuDomainJobTypeToString(priv->job.active),
-                          qemuDomainAsyncJobTypeToString(priv->job.asyncJob));
-        if (priv->job.phase) {
-            virBufferAsprintf(buf, " phase='%s'",
-                              qemuDomainAsyncJobPhaseToString(
-                                    priv->job.asyncJob, priv->job.phase));
-        }
-        if (priv->job.asyncJob != QEMU_ASYNC_JOB_MIGRATION_OUT) {
-            virBufferAddLit(buf, "/>\n");
-        } else {
-            size_t i;
-            virDomainDiskDefPtr disk;
-            qemuDomainDiskPrivatePtr diskPriv;
-
-            virBufferAddLit(buf, ">\n");
-            virBufferAdjustIndent(buf, 2);
-
-            for (i = 0; i < vm->def->ndisks; i++) {
-                disk = vm->def->disks[i];
-                diskPriv = QEMU_DOMAIN_DISK_PRIVATE(disk);
-                virBufferAsprintf(buf, "<disk dev='%s' migrating='%s'/>\n",
-                                  disk->dst,
-                                  diskPriv->migrating ? "yes" : "no");
-            }
-
-            virBufferAdjustIndent(buf, -2);
-            virBufferAddLit(buf, "</job>\n");
-        }
-    }
-    priv->job.active = job;
+    qemuDomainObjPrivateXMLFormatJob(buf, vm, false);
 
     if (priv->fakeReboot)
         virBufferAddLit(buf, "<fakereboot/>\n");
@@ -1832,11 +2040,36 @@ qemuDomainObjPrivateXMLFormat(virBufferPtr buf,
         VIR_FREE(nodeset);
     }
 
+    if (priv->nblockThresholds) {
+        size_t i;
+
+        virBufferAddLit(buf, "<blockThresholds>\n");
+        virBufferAdjustIndent(buf, 2);
+        for (i = 0; i < priv->nblockThresholds; i++) {
+            virBufferEscapeString(buf, "<node name='%s'",
+                                  priv->blockThresholds[i].nodename);
+            virBufferAsprintf(buf, " threshold='%llu'/>\n",
+                              priv->blockThresholds[i].threshold);
+        }
+        virBufferAdjustIndent(buf, -2);
+        virBufferAddLit(buf, "</blockThresholds>\n");
+    }
+
+    if (priv->backup &&
+        virDomainBackupDefFormatBuf(buf, priv->backup,
+                                    VIR_DOMAIN_BACKUP_FORMAT_INTERNAL) < 0)
+        return -1;
+
+    if (priv->blockJobGroup)
+        qemuDomainObjPrivateXMLFormatBlockJobGroup(buf, priv->blockJobGroup);
+
     /* Various per-domain paths */
     virBufferEscapeString(buf, "<libDir path='%s'/>\n", priv->libDir);
     virBufferEscapeString(buf, "<channelTargetDir path='%s'/>\n",
                           priv->channelTargetDir);
 
+    virBufferAsprintf(buf, "<journal generation='%u'/>\n", priv->journalGen);
+
     return 0;
 }
 
@@ -1884,62 +2117,217 @@ qemuDomainObjPrivateXMLParseVcpu(xmlNodePtr node,
 
 
 static int
-qemuDomainObjPrivateXMLParse(xmlXPathContextPtr ctxt,
-                             virDomainObjPtr vm,
-                             virDomainDefParserConfigPtr config)
+qemuDomainObjPrivateXMLParseJob(virDomainObjPtr vm,
+                                qemuDomainObjPrivatePtr priv,
+                                xmlXPathContextPtr ctxt)
 {
-    qemuDomainObjPrivatePtr priv = vm->privateData;
-    virQEMUDriverPtr driver = config->priv;
-    char *monitorpath;
-    char *tmp = NULL;
-    int n;
-    size_t i;
     xmlNodePtr *nodes = NULL;
-    xmlNodePtr node = NULL;
-    virQEMUCapsPtr qemuCaps = NULL;
-    virCapsPtr caps = NULL;
+    size_t i;
+    int n;
+    char *tmp = NULL;
+    int ret = -1;
 
-    if (VIR_ALLOC(priv->monConfig) < 0)
-        goto error;
+    if ((tmp = virXPathString("string(./job[1]/@type)", ctxt))) {
+        int type;
 
-    if (!(monitorpath =
-          virXPathString("string(./monitor[1]/@path)", ctxt))) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       "%s", _("no monitor path"));
-        goto error;
+        if ((type = qemuDomainJobTypeFromString(tmp)) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Unknown job type %s"), tmp);
+            VIR_FREE(tmp);
+            goto cleanup;
+        }
+        VIR_FREE(tmp);
+        priv->job.active = type;
     }
 
-    tmp = virXPathString("string(./monitor[1]/@type)", ctxt);
-    if (tmp)
-        priv->monConfig->type = virDomainChrTypeFromString(tmp);
-    else
-        priv->monConfig->type = VIR_DOMAIN_CHR_TYPE_PTY;
-    VIR_FREE(tmp);
+    if ((tmp = virXPathString("string(./job[1]/@async)", ctxt))) {
+        int async;
 
-    priv->monJSON = virXPathBoolean("count(./monitor[@json = '1']) > 0",
-                                    ctxt) > 0;
+        if ((async = qemuDomainAsyncJobTypeFromString(tmp)) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Unknown async job type %s"), tmp);
+            VIR_FREE(tmp);
+            goto cleanup;
+        }
+        VIR_FREE(tmp);
+        priv->job.asyncJob = async;
 
-    switch (priv->monConfig->type) {
-    case VIR_DOMAIN_CHR_TYPE_PTY:
-        priv->monConfig->data.file.path = monitorpath;
-        break;
-    case VIR_DOMAIN_CHR_TYPE_UNIX:
-        priv->monConfig->data.nix.path = monitorpath;
-        break;
-    default:
-        VIR_FREE(monitorpath);
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("unsupported monitor type '%s'"),
-                       virDomainChrTypeToString(priv->monConfig->type));
-        goto error;
+        if ((tmp = virXPathString("string(./job[1]/@phase)", ctxt))) {
+            priv->job.phase = qemuDomainAsyncJobPhaseFromString(async, tmp);
+            if (priv->job.phase < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("Unknown job phase %s"), tmp);
+                VIR_FREE(tmp);
+                goto cleanup;
+            }
+            VIR_FREE(tmp);
+        }
     }
 
-    if ((node = virXPathNode("./namespaces", ctxt))) {
-        xmlNodePtr next;
-
-        for (next = node->children; next; next = next->next) {
-            int ns = qemuDomainNamespaceTypeFromString((const char *) next->name);
-
+    if ((n = virXPathNodeSet("./job[1]/disk[@migrating='yes']",
+                             ctxt, &nodes)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("failed to parse list of disks marked for migration"));
+        goto cleanup;
+    }
+    if (n > 0) {
+        if (priv->job.asyncJob != QEMU_ASYNC_JOB_MIGRATION_OUT) {
+            VIR_WARN("Found disks marked for migration but we were not "
+                     "migrating");
+            n = 0;
+        }
+        for (i = 0; i < n; i++) {
+            char *dst = virXMLPropString(nodes[i], "dev");
+            virDomainDiskDefPtr disk;
+
+            if (dst && (disk = virDomainDiskByName(vm->def, dst, false)))
+                QEMU_DOMAIN_DISK_PRIVATE(disk)->migrating = true;
+            VIR_FREE(dst);
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(nodes);
+    return ret;
+}
+
+
+static qemuDomainBlockJobGroupPtr
+qemuDomainObjPrivateXMLParseBlockJobGroup(xmlNodePtr node,
+                                          xmlXPathContextPtr ctxt)
+{
+    qemuDomainBlockJobGroupPtr group = NULL;
+    xmlNodePtr saveNode = ctxt->node;
+    xmlNodePtr *nodes = NULL;
+    char *type = NULL;
+    char *state = NULL;
+    size_t i;
+    int n;
+
+    ctxt->node = node;
+
+    if (VIR_ALLOC(group) < 0)
+        goto error;
+
+    type = virXMLPropString(node, "type");
+    if (STREQ_NULLABLE(type, "pull")) {
+        group->type = VIR_DOMAIN_BLOCK_JOB_TYPE_PULL;
+    } else if (STREQ_NULLABLE(type, "commit")) {
+        group->type = VIR_DOMAIN_BLOCK_JOB_TYPE_COMMIT;
+    } else {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unknown block job group type '%s'"),
+                       NULLSTR(type));
+        goto error;
+    }
+
+    if (virXPathULongLong("string(./@bandwidth)", ctxt,
+                          &group->bandwidth) < 0 ||
+        virXPathUInt("string(./@concurrency)", ctxt,
+                     &group->concurrency) < 0 ||
+        virXPathULongLong("string(./@started)", ctxt, &group->started) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed block job group in status XML"));
+        goto error;
+    }
+
+    if ((n = virXPathNodeSet("./disk", ctxt, &nodes)) < 0)
+        goto error;
+    if (n && VIR_ALLOC_N(group->disks, n) < 0)
+        goto error;
+    group->ndisks = n;
+
+    for (i = 0; i < n; i++) {
+        qemuDomainBlockJobGroupDiskPtr disk = &group->disks[i];
+
+        ctxt->node = nodes[i];
+        disk->dst = virXMLPropString(nodes[i], "dst");
+        state = virXMLPropString(nodes[i], "state");
+        if (!disk->dst || !state ||
+            (disk->state = qemuDomainBlockJobGroupDiskStateTypeFromString(state)) < 0 ||
+            virXPathULongLong("string(./@cur)", ctxt, &disk->cur) < 0 ||
+            virXPathULongLong("string(./@end)", ctxt, &disk->end) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("malformed block job group disk in status XML"));
+            goto error;
+        }
+        VIR_FREE(state);
+    }
+
+    ctxt->node = saveNode;
+    VIR_FREE(nodes);
+    VIR_FREE(type);
+    return group;
+
+ error:
+    ctxt->node = saveNode;
+    VIR_FREE(nodes);
+    VIR_FREE(type);
+    VIR_FREE(state);
+    qemuDomainBlockJobGroupFree(group);
+    return NULL;
+}
+
+
+static int
+qemuDomainObjPrivateXMLParse(xmlXPathContextPtr ctxt,
+                             virDomainObjPtr vm,
+                             virDomainDefParserConfigPtr config)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverPtr driver = config->priv;
+    char *monitorpath;
+    char *tmp = NULL;
+    int n;
+    size_t i;
+    xmlNodePtr *nodes = NULL;
+    xmlNodePtr node = NULL;
+    virQEMUCapsPtr qemuCaps = NULL;
+    virCapsPtr caps = NULL;
+
+    if (VIR_ALLOC(priv->monConfig) < 0)
+        goto error;
+
+    if (!(monitorpath =
+          virXPathString("string(./monitor[1]/@path)", ctxt))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("no monitor path"));
+        goto error;
+    }
+
+    tmp = virXPathString("string(./monitor[1]/@type)", ctxt);
+    if (tmp)
+        priv->monConfig->type = virDomainChrTypeFromString(tmp);
+    else
+        priv->monConfig->type = VIR_DOMAIN_CHR_TYPE_PTY;
+    VIR_FREE(tmp);
+
+    priv->monJSON = virXPathBoolean("count(./monitor[@json = '1']) > 0",
+                                    ctxt) > 0;
+
+    switch (priv->monConfig->type) {
+    case VIR_DOMAIN_CHR_TYPE_PTY:
+        priv->monConfig->data.file.path = monitorpath;
+        break;
+    case VIR_DOMAIN_CHR_TYPE_UNIX:
+        priv->monConfig->data.nix.path = monitorpath;
+        break;
+    default:
+        VIR_FREE(monitorpath);
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unsupported monitor type '%s'"),
+                       virDomainChrTypeToString(priv->monConfig->type));
+        goto error;
+    }
+
+    if ((node = virXPathNode("./namespaces", ctxt))) {
+        xmlNodePtr next;
+
+        for (next = node->children; next; next = next->next) {
+            int ns = qemuDomainNamespaceTypeFromString((const char *) next->name);
+
             if (ns < 0) {
                 virReportError(VIR_ERR_INTERNAL_ERROR,
                                _("malformed namespace name: %s"),
@@ -1998,65 +2386,8 @@ qemuDomainObjPrivateXMLParse(xmlXPathContextPtr ctxt,
 
     priv->lockState = virXPathString("string(./lockstate)", ctxt);
 
-    if ((tmp = virXPathString("string(./job[1]/@type)", ctxt))) {
-        int type;
-
-        if ((type = qemuDomainJobTypeFromString(tmp)) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("Unknown job type %s"), tmp);
-            VIR_FREE(tmp);
-            goto error;
-        }
-        VIR_FREE(tmp);
-        priv->job.active = type;
-    }
-
-    if ((tmp = virXPathString("string(./job[1]/@async)", ctxt))) {
-        int async;
-
-        if ((async = qemuDomainAsyncJobTypeFromString(tmp)) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("Unknown async job type %s"), tmp);
-            VIR_FREE(tmp);
-            goto error;
-        }
-        VIR_FREE(tmp);
-        priv->job.asyncJob = async;
-
-        if ((tmp = virXPathString("string(./job[1]/@phase)", ctxt))) {
-            priv->job.phase = qemuDomainAsyncJobPhaseFromString(async, tmp);
-            if (priv->job.phase < 0) {
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("Unknown job phase %s"), tmp);
-                VIR_FREE(tmp);
-                goto error;
-            }
-            VIR_FREE(tmp);
-        }
-    }
-
-    if ((n = virXPathNodeSet("./job[1]/disk[@migrating='yes']",
-                             ctxt, &nodes)) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("failed to parse list of disks marked for migration"));
+    if (qemuDomainObjPrivateXMLParseJob(vm, priv, ctxt) < 0)
         goto error;
-    }
-    if (n > 0) {
-        if (priv->job.asyncJob != QEMU_ASYNC_JOB_MIGRATION_OUT) {
-            VIR_WARN("Found disks marked for migration but we were not "
-                     "migrating");
-            n = 0;
-        }
-        for (i = 0; i < n; i++) {
-            char *dst = virXMLPropString(nodes[i], "dev");
-            virDomainDiskDefPtr disk;
-
-            if (dst && (disk = virDomainDiskByName(vm->def, dst, false)))
-                QEMU_DOMAIN_DISK_PRIVATE(disk)->migrating = true;
-            VIR_FREE(dst);
-        }
-    }
-    VIR_FREE(nodes);
 
     priv->fakeReboot = virXPathBoolean("boolean(./fakereboot)", ctxt) == 1;
 
@@ -2096,12 +2427,56 @@ qemuDomainObjPrivateXMLParse(xmlXPathContextPtr ctxt,
     virObjectUnref(caps);
     VIR_FREE(tmp);
 
+    if ((n = virXPathNodeSet("./blockThresholds/node", ctxt, &nodes)) < 0)
+        goto error;
+    for (i = 0; i < n; i++) {
+        char *nodename = virXMLPropString(nodes[i], "name");
+        char *threshold = virXMLPropString(nodes[i], "threshold");
+        unsigned long long val;
+        int rc = -1;
+
+        if (!nodename || !threshold ||
+            virStrToLong_ullp(threshold, NULL, 10, &val) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("malformed block threshold in status XML"));
+        } else {
+            rc = qemuDomainBlockThresholdSet(priv, nodename, val);
+        }
+
+        VIR_FREE(nodename);
+        VIR_FREE(threshold);
+        if (rc < 0)
+            goto error;
+    }
+    VIR_FREE(nodes);
+
+    if ((node = virXPathNode("./blockJobGroup", ctxt)) &&
+        !(priv->blockJobGroup =
+          qemuDomainObjPrivateXMLParseBlockJobGroup(node, ctxt)))
+        goto error;
+
+    if ((node = virXPathNode("./domainbackup", ctxt))) {
+        unsigned int backupFlags = VIR_DOMAIN_BACKUP_PARSE_INTERNAL;
+
+        if (!(priv->backup = virDomainBackupDefParseNode(ctxt->doc, node,
+                                                         backupFlags)))
+            goto error;
+    }
+
     if ((tmp = virXPathString("string(./libDir/@path)", ctxt)))
         priv->libDir = tmp;
     if ((tmp = virXPathString("string(./channelTargetDir/@path)", ctxt)))
         priv->channelTargetDir = tmp;
     tmp = NULL;
 
+    /* status XML written by older daemons has no journal */
+    if (virXPathUInt("string(./journal/@generation)", ctxt,
+                     &priv->journalGen) == -2) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("invalid status journal generation"));
+        goto error;
+    }
+
     if (qemuDomainSetPrivatePathsOld(driver, vm) < 0)
         goto error;
 
@@ -3386,63 +3761,424 @@ qemuDomainDefAssignAddresses(virDomainDef *def,
 }
 
 
+/* The post parse callbacks canonicalize the machine type and add default
+ * devices according to the emulator's capabilities, which are replaced
+ * once the binary changes, and put NVRAM files into nvramDir. */
+static char *
+qemuDomainDefParseCacheStamp(const virDomainDef *def,
+                             virCapsPtr caps,
+                             void *opaque)
+{
+    virQEMUDriverPtr driver = opaque;
+    virQEMUDriverConfigPtr cfg = NULL;
+    virQEMUCapsPtr qemuCaps = NULL;
+    char *ret = NULL;
+
+    if (!(qemuCaps = virQEMUCapsCacheLookup(caps, driver->qemuCapsCache,
+                                            def->emulator)))
+        return NULL;
+
+    cfg = virQEMUDriverGetConfig(driver);
+    ignore_value(virAsprintf(&ret, "%p %s %lld %s",
+                             qemuCaps, virQEMUCapsGetBinary(qemuCaps),
+                             (long long) virQEMUCapsGetCtime(qemuCaps),
+                             cfg->nvramDir));
+
+    virObjectUnref(cfg);
+    virObjectUnref(qemuCaps);
+    return ret;
+}
+
+
 virDomainDefParserConfig virQEMUDriverDomainDefParserConfig = {
     .devicesPostParseCallback = qemuDomainDeviceDefPostParse,
     .domainPostParseCallback = qemuDomainDefPostParse,
     .assignAddressesCallback = qemuDomainDefAssignAddresses,
     .domainValidateCallback = qemuDomainDefValidate,
     .deviceValidateCallback = qemuDomainDeviceDefValidate,
+    .parseCacheStampCallback = qemuDomainDefParseCacheStamp,
 
     .features = VIR_DOMAIN_DEF_FEATURE_MEMORY_HOTPLUG |
                 VIR_DOMAIN_DEF_FEATURE_OFFLINE_VCPUPIN |
                 VIR_DOMAIN_DEF_FEATURE_INDIVIDUAL_VCPUS,
+
+    /* define and create are often called with the same XML */
+    .parseCacheSize = 64,
 };
 
 
-static void
-qemuDomainObjSaveJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
-{
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+/* Number of records after which the journal is folded into a full
+ * status XML */
+#define QEMU_DOMAIN_JOURNAL_MAX_RECORDS 64
 
-    if (virDomainObjIsActive(obj)) {
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, obj, driver->caps) < 0)
-            VIR_WARN("Failed to save status on vm %s", obj->def->name);
-    }
+static char *
+qemuDomainJournalPath(virQEMUDriverConfigPtr cfg,
+                      virDomainObjPtr vm)
+{
+    char *ret = NULL;
 
-    virObjectUnref(cfg);
+    ignore_value(virAsprintf(&ret, "%s/%s.journal",
+                             cfg->stateDir, vm->def->name));
+    return ret;
 }
 
+
+/**
+ * qemuDomainRemoveStatusJournal:
+ * @cfg: qemu driver config
+ * @vm: domain object
+ *
+ * Removes the status journal of @vm, if any.
+ */
 void
-qemuDomainObjSetJobPhase(virQEMUDriverPtr driver,
-                         virDomainObjPtr obj,
-                         int phase)
+qemuDomainRemoveStatusJournal(virQEMUDriverConfigPtr cfg,
+                              virDomainObjPtr vm)
 {
-    qemuDomainObjPrivatePtr priv = obj->privateData;
-    unsigned long long me = virThreadSelfID();
+    char ebuf[1024];
+    char *path;
 
-    if (!priv->job.asyncJob)
+    if (!(path = qemuDomainJournalPath(cfg, vm)))
         return;
 
-    VIR_DEBUG("Setting '%s' phase to '%s'",
-              qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
-              qemuDomainAsyncJobPhaseToString(priv->job.asyncJob, phase));
-
-    if (priv->job.asyncOwner && me != priv->job.asyncOwner) {
-        VIR_WARN("'%s' async job is owned by thread %llu",
-                 qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
-                 priv->job.asyncOwner);
-    }
+    if (unlink(path) < 0 && errno != ENOENT)
+        VIR_WARN("Failed to remove status journal '%s': %s",
+                 path, virStrerror(errno, ebuf, sizeof(ebuf)));
 
-    priv->job.phase = phase;
-    priv->job.asyncOwner = me;
-    qemuDomainObjSaveJob(driver, obj);
+    VIR_FREE(path);
 }
 
-void
-qemuDomainObjSetAsyncJobMask(virDomainObjPtr obj,
-                             unsigned long long allowedJobs)
-{
-    qemuDomainObjPrivatePtr priv = obj->privateData;
+
+/**
+ * qemuDomainSaveStatus:
+ * @driver: qemu driver data
+ * @vm: domain object
+ *
+ * Saves the full status XML of @vm. The records journaled by
+ * qemuDomainSaveStatusRecord since the last save are covered by the new
+ * status XML, so the journal is started over.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int
+qemuDomainSaveStatus(virQEMUDriverPtr driver,
+                     virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    int ret = -1;
+
+    /* The records carry the generation of the status XML they apply to,
+     * so a journal which outlives the save because of a crash before it
+     * is removed is ignored on replay */
+    priv->journalGen++;
+    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm,
+                            driver->caps) < 0) {
+        priv->journalGen--;
+        goto cleanup;
+    }
+
+    priv->journalRecords = 0;
+    qemuDomainRemoveStatusJournal(cfg, vm);
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
+static int
+qemuDomainJournalAppend(virQEMUDriverConfigPtr cfg,
+                        virDomainObjPtr vm,
+                        virBufferPtr record)
+{
+    char *path = NULL;
+    char *str = NULL;
+    char *line = NULL;
+    char *tmp;
+    size_t len;
+    int fd = -1;
+    int ret = -1;
+
+    if (virBufferCheckError(record) < 0)
+        goto cleanup;
+
+    /* One record per line, a torn last line is skipped on replay */
+    str = virBufferContentAndReset(record);
+    for (tmp = str; (tmp = strchr(tmp, '\n')); tmp++)
+        *tmp = ' ';
+    if (virAsprintf(&line, "%s\n", str) < 0)
+        goto cleanup;
+    len = strlen(line);
+
+    if (!(path = qemuDomainJournalPath(cfg, vm)))
+        goto cleanup;
+
+    if ((fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                   S_IRUSR | S_IWUSR)) < 0) {
+        virReportSystemError(errno, _("cannot open status journal '%s'"),
+                             path);
+        goto cleanup;
+    }
+
+    if (safewrite(fd, line, len) != len) {
+        virReportSystemError(errno, _("cannot write status journal '%s'"),
+                             path);
+        goto cleanup;
+    }
+
+    if (fsync(fd) < 0) {
+        virReportSystemError(errno, _("cannot sync status journal '%s'"),
+                             path);
+        goto cleanup;
+    }
+
+    if (VIR_CLOSE(fd) < 0) {
+        virReportSystemError(errno, _("cannot save status journal '%s'"),
+                             path);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(path);
+    VIR_FREE(str);
+    VIR_FREE(line);
+    return ret;
+}
+
+
+/**
+ * qemuDomainSaveStatusRecord:
+ * @driver: qemu driver data
+ * @vm: domain object
+ * @record: XML of the state to record
+ *
+ * Persists a change of the job or runtime state of @vm without rewriting
+ * the whole status XML. The record is appended to the journal of @vm,
+ * which qemuDomainReplayStatusJournal applies when the daemon reconnects
+ * to the domain. Once the journal grows too long or can't be written the
+ * full status XML is saved instead.
+ */
+static void
+qemuDomainSaveStatusRecord(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm,
+                           virBufferPtr record)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *content = NULL;
+
+    if (!virDomainObjIsActive(vm))
+        goto cleanup;
+
+    if (priv->journalRecords < QEMU_DOMAIN_JOURNAL_MAX_RECORDS) {
+        if (virBufferCheckError(record) < 0)
+            goto save;
+
+        content = virBufferContentAndReset(record);
+        virBufferAsprintf(&buf, "<record generation='%u'>", priv->journalGen);
+        virBufferAdd(&buf, content, -1);
+        virBufferAddLit(&buf, "</record>");
+
+        if (qemuDomainJournalAppend(cfg, vm, &buf) == 0) {
+            priv->journalRecords++;
+            goto cleanup;
+        }
+
+        VIR_WARN("Failed to journal status of vm %s: %s",
+                 vm->def->name, virGetLastErrorMessage());
+        virResetLastError();
+    }
+
+ save:
+    if (qemuDomainSaveStatus(driver, vm) < 0)
+        VIR_WARN("Failed to save status on vm %s", vm->def->name);
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    virBufferFreeAndReset(record);
+    VIR_FREE(content);
+    virObjectUnref(cfg);
+}
+
+
+/**
+ * qemuDomainSaveStatusBalloon:
+ * @driver: qemu driver data
+ * @vm: domain object
+ *
+ * Records the current balloon size of @vm in its status.
+ */
+void
+qemuDomainSaveStatusBalloon(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+
+    virBufferAsprintf(&buf, "<balloon current='%llu'/>",
+                      vm->def->mem.cur_balloon);
+    qemuDomainSaveStatusRecord(driver, vm, &buf);
+}
+
+
+static int
+qemuDomainReplayStatusRecord(virDomainObjPtr vm,
+                             const char *line)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    xmlDocPtr xml = NULL;
+    xmlXPathContextPtr ctxt = NULL;
+    unsigned int gen;
+    unsigned long long balloon;
+    size_t i;
+    int ret = -1;
+
+    if (!(xml = virXMLParseStringCtxt(line, _("(domain_status_journal)"),
+                                      &ctxt)))
+        goto cleanup;
+
+    if (virXPathUInt("string(./@generation)", ctxt, &gen) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("missing status journal record generation"));
+        goto cleanup;
+    }
+
+    /* left over from an older status XML */
+    if (gen != priv->journalGen) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    /* each record carries the complete job state */
+    if (virXPathBoolean("boolean(./job)", ctxt) == 1) {
+        priv->job.active = QEMU_JOB_NONE;
+        priv->job.asyncJob = QEMU_ASYNC_JOB_NONE;
+        priv->job.phase = 0;
+        for (i = 0; i < vm->def->ndisks; i++)
+            QEMU_DOMAIN_DISK_PRIVATE(vm->def->disks[i])->migrating = false;
+
+        if (qemuDomainObjPrivateXMLParseJob(vm, priv, ctxt) < 0)
+            goto cleanup;
+    }
+
+    if (virXPathULongLong("string(./balloon/@current)", ctxt,
+                          &balloon) == 0)
+        vm->def->mem.cur_balloon = balloon;
+
+    ret = 0;
+
+ cleanup:
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(xml);
+    return ret;
+}
+
+
+/**
+ * qemuDomainReplayStatusJournal:
+ * @driver: qemu driver data
+ * @vm: domain object
+ *
+ * Applies the state journaled by qemuDomainSaveStatusRecord on top of the
+ * status XML @vm was loaded from. The journal is removed once the status
+ * XML is saved again.
+ */
+void
+qemuDomainReplayStatusJournal(virQEMUDriverPtr driver,
+                              virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    char *path = NULL;
+    char *content = NULL;
+    char **lines = NULL;
+    size_t nlines = 0;
+    size_t nrecords;
+    size_t i;
+
+    if (!(path = qemuDomainJournalPath(cfg, vm)))
+        goto cleanup;
+
+    if (!virFileExists(path))
+        goto cleanup;
+
+    if (virFileReadAll(path, 1024 * 1024, &content) < 0 ||
+        !(lines = virStringSplitCount(content, "\n", 0, &nlines)))
+        goto error;
+
+    /* the last item is either empty or a record torn by a crash */
+    nrecords = nlines > 0 ? nlines - 1 : 0;
+    for (i = 0; i < nrecords; i++) {
+        if (qemuDomainReplayStatusRecord(vm, lines[i]) < 0)
+            goto error;
+    }
+
+    VIR_DEBUG("Replayed %zu status journal records of vm %s",
+              nrecords, vm->def->name);
+    priv->journalRecords = nrecords;
+
+ cleanup:
+    virStringListFree(lines);
+    VIR_FREE(content);
+    VIR_FREE(path);
+    virObjectUnref(cfg);
+    return;
+
+ error:
+    VIR_WARN("Failed to replay status journal of vm %s: %s",
+             vm->def->name, virGetLastErrorMessage());
+    virResetLastError();
+    goto cleanup;
+}
+
+
+static void
+qemuDomainObjSaveJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+
+    if (!virDomainObjIsActive(obj))
+        return;
+
+    qemuDomainObjPrivateXMLFormatJob(&buf, obj, true);
+    qemuDomainSaveStatusRecord(driver, obj, &buf);
+}
+
+void
+qemuDomainObjSetJobPhase(virQEMUDriverPtr driver,
+                         virDomainObjPtr obj,
+                         int phase)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+    unsigned long long me = virThreadSelfID();
+
+    if (!priv->job.asyncJob)
+        return;
+
+    VIR_DEBUG("Setting '%s' phase to '%s'",
+              qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
+              qemuDomainAsyncJobPhaseToString(priv->job.asyncJob, phase));
+
+    if (priv->job.asyncOwner && me != priv->job.asyncOwner) {
+        VIR_WARN("'%s' async job is owned by thread %llu",
+                 qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
+                 priv->job.asyncOwner);
+    }
+
+    priv->job.phase = phase;
+    priv->job.asyncOwner = me;
+    qemuDomainObjSaveJob(driver, obj);
+}
+
+void
+qemuDomainObjSetAsyncJobMask(virDomainObjPtr obj,
+                             unsigned long long allowedJobs)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
 
     if (!priv->job.asyncJob)
         return;
@@ -3492,18 +4228,108 @@ qemuDomainJobAllowed(qemuDomainObjPrivatePtr priv, qemuDomainJob job)
 /* Give up waiting for mutex after 30 seconds */
 #define QEMU_JOB_WAIT_TIME (1000ull * 30)
 
+static qemuDomainJobStatsPtr
+qemuDomainObjGetJobStats(qemuDomainObjPrivatePtr priv,
+                         qemuDomainJob job,
+                         qemuDomainAsyncJob asyncJob)
+{
+    if (job == QEMU_JOB_ASYNC)
+        return &priv->job.asyncStats[asyncJob];
+    return &priv->job.stats[job];
+}
+
+static size_t
+qemuDomainJobStatsBucket(unsigned long long duration)
+{
+    unsigned long long limit = 1;
+    size_t i;
+
+    for (i = 0; i < QEMU_DOMAIN_JOB_STATS_BUCKETS - 1; i++) {
+        if (duration < limit)
+            break;
+        limit *= 10;
+    }
+
+    return i;
+}
+
+static void
+qemuDomainJobStatsAddWait(qemuDomainJobStatsPtr stats,
+                          unsigned long long queued,
+                          unsigned long long now)
+{
+    unsigned long long wait = now > queued ? now - queued : 0;
+
+    stats->started++;
+    stats->waitTotal += wait;
+    if (wait > stats->waitMax)
+        stats->waitMax = wait;
+    stats->waitBuckets[qemuDomainJobStatsBucket(wait)]++;
+}
+
+static void
+qemuDomainJobStatsAddHold(qemuDomainJobStatsPtr stats,
+                          unsigned long long started,
+                          const char *ownerAPI)
+{
+    unsigned long long now;
+    unsigned long long hold = 0;
+
+    if (!started || virTimeMillisNow(&now) < 0)
+        return;
+
+    if (now > started)
+        hold = now - started;
+
+    stats->holdTotal += hold;
+    if (hold >= stats->holdMax) {
+        stats->holdMax = hold;
+        stats->holdMaxAPI = ownerAPI;
+    }
+    stats->holdBuckets[qemuDomainJobStatsBucket(hold)]++;
+}
+
+/* Records the wait for a job in the trace of the current request */
+static void
+qemuDomainObjTraceJobWait(virDomainObjPtr obj,
+                          const char *jobStr,
+                          unsigned long long queued,
+                          unsigned long long now,
+                          bool failed)
+{
+    int span;
+
+    if (!virTraceEnabled())
+        return;
+
+    span = virTraceSpanAdd("qemuDomainObjBeginJob",
+                           queued * 1000, now * 1000);
+    virTraceSpanTag(span, "domain", "%s", obj->def->name);
+    virTraceSpanTag(span, "job", "%s", jobStr);
+    if (failed)
+        virTraceSpanTag(span, "error", "true");
+}
+
 /*
  * obj must be locked before calling
+ *
+ * @timeout: how long to wait for the job in milliseconds, 0 meaning
+ *           the default of QEMU_JOB_WAIT_TIME
+ * @shared: whether a QEMU_JOB_QUERY job may run alongside other shared
+ *          query jobs
  */
 static int ATTRIBUTE_NONNULL(1)
 qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
                               virDomainObjPtr obj,
                               qemuDomainJob job,
-                              qemuDomainAsyncJob asyncJob)
+                              qemuDomainAsyncJob asyncJob,
+                              unsigned long long timeout,
+                              bool shared)
 {
     qemuDomainObjPrivatePtr priv = obj->privateData;
     unsigned long long now;
     unsigned long long then;
+    unsigned long long queued;
     bool nested = job == QEMU_JOB_ASYNC_NESTED;
     bool async = job == QEMU_JOB_ASYNC;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
@@ -3512,6 +4338,7 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
     unsigned long long duration = 0;
     unsigned long long asyncDuration = 0;
     const char *jobStr;
+    bool waiting = false;
 
     if (async)
         jobStr = qemuDomainAsyncJobTypeToString(asyncJob);
@@ -3529,7 +4356,8 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
     }
 
     priv->jobs_queued++;
-    then = now + QEMU_JOB_WAIT_TIME;
+    queued = now;
+    then = now + (timeout ? timeout : QEMU_JOB_WAIT_TIME);
 
  retry:
     if (cfg->maxQueuedJobs &&
@@ -3543,20 +4371,47 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
             goto error;
     }
 
-    while (priv->job.active) {
+    if (!shared) {
+        priv->job.exclusiveWaiters++;
+        waiting = true;
+    }
+
+    while ((priv->job.active &&
+            !(shared && priv->job.nshared &&
+              !priv->job.exclusiveWaiters)) ||
+           priv->reconnecting) {
         VIR_DEBUG("Waiting for job (vm=%p name=%s)", obj, obj->def->name);
         if (virCondWaitUntil(&priv->job.cond, &obj->parent.lock, then) < 0)
             goto error;
     }
 
+    if (waiting) {
+        priv->job.exclusiveWaiters--;
+        waiting = false;
+    }
+
     /* No job is active but a new async job could have been started while obj
      * was unlocked, so we need to recheck it. */
     if (!nested && !qemuDomainNestedJobAllowed(priv, job))
         goto retry;
 
+    ignore_value(virTimeMillisNow(&now));
+    qemuDomainObjTraceJobWait(obj, jobStr, queued, now, false);
+
+    if (priv->job.nshared) {
+        VIR_DEBUG("Joined shared job: %s (vm=%p name=%s, sharers=%u)",
+                  qemuDomainJobTypeToString(job), obj, obj->def->name,
+                  priv->job.nshared);
+        priv->job.nshared++;
+        qemuDomainJobStatsAddWait(&priv->job.stats[job], queued, now);
+        virObjectUnref(cfg);
+        return 0;
+    }
+
     qemuDomainObjResetJob(priv);
 
-    ignore_value(virTimeMillisNow(&now));
+    qemuDomainJobStatsAddWait(qemuDomainObjGetJobStats(priv, job, asyncJob),
+                              queued, now);
 
     if (job != QEMU_JOB_ASYNC) {
         VIR_DEBUG("Started job: %s (async=%s vm=%p name=%s)",
@@ -3567,6 +4422,11 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
         priv->job.owner = virThreadSelfID();
         priv->job.ownerAPI = virThreadJobGet();
         priv->job.started = now;
+        if (shared) {
+            priv->job.nshared = 1;
+            /* let other queries waiting for the job join this one */
+            virCondBroadcast(&priv->job.cond);
+        }
     } else {
         VIR_DEBUG("Started async job: %s (vm=%p name=%s)",
                   qemuDomainAsyncJobTypeToString(asyncJob),
@@ -3588,7 +4448,11 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
     return 0;
 
  error:
+    if (waiting)
+        priv->job.exclusiveWaiters--;
+    qemuDomainObjGetJobStats(priv, job, asyncJob)->failed++;
     ignore_value(virTimeMillisNow(&now));
+    qemuDomainObjTraceJobWait(obj, jobStr, queued, now, true);
     if (priv->job.active && priv->job.started)
         duration = now - priv->job.started;
     if (priv->job.asyncJob && priv->job.asyncStarted)
@@ -3606,7 +4470,9 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
              priv->job.asyncOwner, NULLSTR(priv->job.asyncOwnerAPI),
              duration / 1000, asyncDuration / 1000);
 
-    if (nested || qemuDomainNestedJobAllowed(priv, job))
+    if (priv->reconnecting && !priv->job.active)
+        blocker = "qemuProcessReconnect";
+    else if (nested || qemuDomainNestedJobAllowed(priv, job))
         blocker = priv->job.ownerAPI;
     else
         blocker = priv->job.asyncOwnerAPI;
@@ -3658,18 +4524,56 @@ int qemuDomainObjBeginJob(virQEMUDriverPtr driver,
                           qemuDomainJob job)
 {
     if (qemuDomainObjBeginJobInternal(driver, obj, job,
-                                      QEMU_ASYNC_JOB_NONE) < 0)
+                                      QEMU_ASYNC_JOB_NONE, 0, false) < 0)
         return -1;
     else
         return 0;
 }
 
-int qemuDomainObjBeginAsyncJob(virQEMUDriverPtr driver,
-                               virDomainObjPtr obj,
-                               qemuDomainAsyncJob asyncJob)
+/*
+ * Same as qemuDomainObjBeginJob, but gives up after waiting
+ * @timeout milliseconds for the current job to finish.
+ */
+int qemuDomainObjBeginJobWithTimeout(virQEMUDriverPtr driver,
+                                     virDomainObjPtr obj,
+                                     qemuDomainJob job,
+                                     unsigned long long timeout)
+{
+    if (qemuDomainObjBeginJobInternal(driver, obj, job,
+                                      QEMU_ASYNC_JOB_NONE, timeout,
+                                      false) < 0)
+        return -1;
+    else
+        return 0;
+}
+
+/*
+ * Same as qemuDomainObjBeginJobWithTimeout with QEMU_JOB_QUERY, except
+ * that the job may be shared with other threads which started it with
+ * this function. Meant for APIs which only read the domain state and
+ * query the monitor, such as statistics; they don't wait for each other
+ * then, while any other job still excludes them all. Each of the
+ * sharers must call qemuDomainObjEndJob and mustn't rely on being alone
+ * when the domain object is unlocked, e.g. in the monitor.
+ */
+int qemuDomainObjBeginSharedJob(virQEMUDriverPtr driver,
+                                virDomainObjPtr obj,
+                                unsigned long long timeout)
+{
+    if (qemuDomainObjBeginJobInternal(driver, obj, QEMU_JOB_QUERY,
+                                      QEMU_ASYNC_JOB_NONE, timeout,
+                                      true) < 0)
+        return -1;
+    else
+        return 0;
+}
+
+int qemuDomainObjBeginAsyncJob(virQEMUDriverPtr driver,
+                               virDomainObjPtr obj,
+                               qemuDomainAsyncJob asyncJob)
 {
     if (qemuDomainObjBeginJobInternal(driver, obj, QEMU_JOB_ASYNC,
-                                      asyncJob) < 0)
+                                      asyncJob, 0, false) < 0)
         return -1;
     else
         return 0;
@@ -3695,7 +4599,8 @@ qemuDomainObjBeginNestedJob(virQEMUDriverPtr driver,
 
     return qemuDomainObjBeginJobInternal(driver, obj,
                                          QEMU_JOB_ASYNC_NESTED,
-                                         QEMU_ASYNC_JOB_NONE);
+                                         QEMU_ASYNC_JOB_NONE,
+                                         0, false);
 }
 
 
@@ -3711,17 +4616,35 @@ qemuDomainObjEndJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
     qemuDomainObjPrivatePtr priv = obj->privateData;
     qemuDomainJob job = priv->job.active;
 
+    bool shared = priv->job.nshared > 0;
+
     priv->jobs_queued--;
 
+    if (priv->job.nshared > 1) {
+        priv->job.nshared--;
+        VIR_DEBUG("Leaving shared job: %s (vm=%p name=%s, sharers=%u)",
+                  qemuDomainJobTypeToString(job), obj, obj->def->name,
+                  priv->job.nshared);
+        return;
+    }
+
     VIR_DEBUG("Stopping job: %s (async=%s vm=%p name=%s)",
               qemuDomainJobTypeToString(job),
               qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
               obj, obj->def->name);
 
+    qemuDomainJobStatsAddHold(&priv->job.stats[job], priv->job.started,
+                              priv->job.ownerAPI);
+
     qemuDomainObjResetJob(priv);
     if (qemuDomainTrackJob(job))
         qemuDomainObjSaveJob(driver, obj);
-    virCondSignal(&priv->job.cond);
+    /* there may be both exclusive and shared jobs waiting after a
+     * shared one, wake them all to let them sort it out */
+    if (shared)
+        virCondBroadcast(&priv->job.cond);
+    else
+        virCondSignal(&priv->job.cond);
 }
 
 void
@@ -3735,11 +4658,38 @@ qemuDomainObjEndAsyncJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
               qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
               obj, obj->def->name);
 
+    qemuDomainJobStatsAddHold(&priv->job.asyncStats[priv->job.asyncJob],
+                              priv->job.asyncStarted,
+                              priv->job.asyncOwnerAPI);
+
     qemuDomainObjResetAsyncJob(priv);
     qemuDomainObjSaveJob(driver, obj);
     virCondBroadcast(&priv->job.asyncCond);
 }
 
+/*
+ * obj must be locked before calling
+ *
+ * Accounts for a run of the @op hook script which took @duration
+ * milliseconds and returned @ret
+ */
+void
+qemuDomainHookStatsAdd(virDomainObjPtr obj,
+                       virHookQemuOpType op,
+                       int ret,
+                       unsigned long long duration)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+    qemuDomainHookStatsPtr stats = &priv->job.hookStats[op];
+
+    stats->count++;
+    if (ret < 0)
+        stats->failed++;
+    stats->total += duration;
+    if (duration > stats->max)
+        stats->max = duration;
+}
+
 void
 qemuDomainObjAbortAsyncJob(virDomainObjPtr obj)
 {
@@ -4594,10 +5544,31 @@ qemuFindQemuImgBinary(virQEMUDriverPtr driver)
     return driver->qemuImgBinary;
 }
 
+/* Parses the domain definition of a snapshot loaded with
+ * VIR_DOMAIN_SNAPSHOT_PARSE_LAZY, if it wasn't parsed yet */
+int
+qemuDomainSnapshotLoadDom(virQEMUDriverPtr driver,
+                          virDomainSnapshotObjPtr snapshot)
+{
+    virCapsPtr caps = NULL;
+    int ret;
+
+    if (snapshot->def->dom || !snapshot->def->domxml)
+        return 0;
+
+    if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
+        return -1;
+
+    ret = virDomainSnapshotDefLoadDom(snapshot->def, caps, driver->xmlopt);
+    virObjectUnref(caps);
+    return ret;
+}
+
 int
 qemuDomainSnapshotWriteMetadata(virDomainObjPtr vm,
                                 virDomainSnapshotObjPtr snapshot,
                                 virCapsPtr caps,
+                                virDomainXMLOptionPtr xmlopt,
                                 char *snapshotDir)
 {
     char *newxml = NULL;
@@ -4606,6 +5577,9 @@ qemuDomainSnapshotWriteMetadata(virDomainObjPtr vm,
     char *snapFile = NULL;
     char uuidstr[VIR_UUID_STRING_BUFLEN];
 
+    if (virDomainSnapshotDefLoadDom(snapshot->def, caps, xmlopt) < 0)
+        return -1;
+
     virUUIDFormat(vm->def->uuid, uuidstr);
     newxml = virDomainSnapshotDefFormat(
         uuidstr, snapshot->def, caps,
@@ -4718,9 +5692,12 @@ qemuDomainSnapshotForEachQcow2(virQEMUDriverPtr driver,
     /* Prefer action on the disks in use at the time the snapshot was
      * created; but fall back to current definition if dealing with a
      * snapshot created prior to libvirt 0.9.5.  */
-    virDomainDefPtr def = snap->def->dom;
+    virDomainDefPtr def;
+
+    if (qemuDomainSnapshotLoadDom(driver, snap) < 0)
+        return -1;
 
-    if (!def)
+    if (!(def = snap->def->dom))
         def = vm->def;
     return qemuDomainSnapshotForEachQcow2Raw(driver, def, snap->def->name,
                                              op, try_all, def->ndisks);
@@ -4769,6 +5746,7 @@ qemuDomainSnapshotDiscard(virQEMUDriverPtr driver,
             } else {
                 parentsnap->def->current = true;
                 if (qemuDomainSnapshotWriteMetadata(vm, parentsnap, driver->caps,
+                                                    driver->xmlopt,
                                                     cfg->snapshotDir) < 0) {
                     VIR_WARN("failed to set parent snapshot '%s' as current",
                              snap->def->parent);
@@ -4892,18 +5870,16 @@ qemuDomainSetFakeReboot(virQEMUDriverPtr driver,
                         bool value)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     if (priv->fakeReboot == value)
         goto cleanup;
 
     priv->fakeReboot = value;
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         VIR_WARN("Failed to save status on vm %s", vm->def->name);
 
  cleanup:
-    virObjectUnref(cfg);
 }
 
 static void
@@ -5489,6 +6465,13 @@ qemuDomainDiskBlockJobIsActive(virDomainDiskDefPtr disk)
         return true;
     }
 
+    if (diskPriv->backup) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED,
+                       _("disk '%s' is being backed up"),
+                       disk->dst);
+        return true;
+    }
+
     return false;
 }
 
@@ -5511,7 +6494,7 @@ qemuDomainHasBlockjob(virDomainObjPtr vm,
         virDomainDiskDefPtr disk = vm->def->disks[i];
         qemuDomainDiskPrivatePtr diskPriv = QEMU_DOMAIN_DISK_PRIVATE(disk);
 
-        if (!copy_only && diskPriv->blockjob)
+        if (!copy_only && (diskPriv->blockjob || diskPriv->backup))
             return true;
 
         if (disk->mirror && disk->mirrorJob == VIR_DOMAIN_BLOCK_JOB_TYPE_COPY)
@@ -6435,6 +7418,29 @@ qemuDomainHasVcpuPids(virDomainObjPtr vm)
 }
 
 
+/**
+ * qemuDomainGetHomeNode:
+ * @vm: domain object
+ *
+ * Returns the first host NUMA node the memory of the running @vm is bound
+ * to, which is where its vcpus should run too, or -1 if it isn't bound to
+ * any. Must be called with @vm locked.
+ */
+int
+qemuDomainGetHomeNode(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virBitmapPtr nodeset;
+
+    if (!virDomainObjIsActive(vm) ||
+        !(nodeset = virDomainNumatuneGetNodeset(vm->def->numa,
+                                                priv->autoNodeset, -1)))
+        return -1;
+
+    return virBitmapNextSetBit(nodeset, -1);
+}
+
+
 /**
  * qemuDomainGetVcpuPid:
  * @vm: domain object
@@ -6536,7 +7542,10 @@ qemuDomainRefreshVcpuInfo(virQEMUDriverPtr driver,
     if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
         return -1;
 
-    rc = qemuMonitorGetCPUInfo(qemuDomainGetMonitor(vm), &info, maxvcpus, hotplug);
+    rc = qemuMonitorGetCPUInfo(qemuDomainGetMonitor(vm), &info, maxvcpus,
+                               hotplug,
+                               virQEMUCapsGet(QEMU_DOMAIN_PRIVATE(vm)->qemuCaps,
+                                              QEMU_CAPS_QUERY_CPUS_FAST));
 
     if (qemuDomainObjExitMonitor(driver, vm) < 0)
         goto cleanup;
@@ -6621,6 +7630,30 @@ qemuDomainGetVcpuHalted(virDomainObjPtr vm,
     return QEMU_DOMAIN_VCPU_PRIVATE(vcpu)->halted;
 }
 
+/**
+ * qemuDomainUpdateVcpuHalted:
+ * @vm: domain object
+ * @haltedmap: bitmap of halted vCPUs indexed by their qemu id
+ *
+ * Updates vCPU halted state in the private data of @vm from @haltedmap as
+ * returned by qemuMonitorGetCpuHalted or qemuMonitorGetStats.
+ */
+void
+qemuDomainUpdateVcpuHalted(virDomainObjPtr vm,
+                           virBitmapPtr haltedmap)
+{
+    virDomainVcpuDefPtr vcpu;
+    qemuDomainVcpuPrivatePtr vcpupriv;
+    size_t maxvcpus = virDomainDefGetVcpusMax(vm->def);
+    size_t i;
+
+    for (i = 0; i < maxvcpus; i++) {
+        vcpu = virDomainDefGetVcpu(vm->def, i);
+        vcpupriv = QEMU_DOMAIN_VCPU_PRIVATE(vcpu);
+        vcpupriv->halted = virBitmapIsBitSet(haltedmap, vcpupriv->qemu_id);
+    }
+}
+
 /**
  * qemuDomainRefreshVcpuHalted:
  * @driver: qemu driver data
@@ -6636,11 +7669,8 @@ qemuDomainRefreshVcpuHalted(virQEMUDriverPtr driver,
                             virDomainObjPtr vm,
                             int asyncJob)
 {
-    virDomainVcpuDefPtr vcpu;
-    qemuDomainVcpuPrivatePtr vcpupriv;
     size_t maxvcpus = virDomainDefGetVcpusMax(vm->def);
     virBitmapPtr haltedmap = NULL;
-    size_t i;
     int ret = -1;
 
     /* Not supported currently for TCG, see qemuDomainRefreshVcpuInfo */
@@ -6655,12 +7685,7 @@ qemuDomainRefreshVcpuHalted(virQEMUDriverPtr driver,
     if (qemuDomainObjExitMonitor(driver, vm) < 0 || !haltedmap)
         goto cleanup;
 
-    for (i = 0; i < maxvcpus; i++) {
-        vcpu = virDomainDefGetVcpu(vm->def, i);
-        vcpupriv = QEMU_DOMAIN_VCPU_PRIVATE(vcpu);
-        vcpupriv->halted = virBitmapIsBitSet(haltedmap, vcpupriv->qemu_id);
-    }
-
+    qemuDomainUpdateVcpuHalted(vm, haltedmap);
     ret = 0;
 
  cleanup:
@@ -8634,3 +9659,626 @@ qemuDomainGetStorageSourceByDevstr(const char *devstr,
     VIR_FREE(target);
     return src;
 }
+
+
+/* Returns the huge page size in KiB backing @pagesize KiB pages (if
+ * not 0), or the memory of guest NUMA node @cell according to the
+ * <hugepages/> of @def otherwise. -1 stands for the whole memory of a
+ * guest without NUMA nodes. Returns 0 if no huge pages are used. */
+static unsigned long long
+qemuDomainGetHugepageSize(virQEMUDriverConfigPtr cfg,
+                          virDomainDefPtr def,
+                          unsigned long long pagesize,
+                          int cell)
+{
+    virDomainHugePagePtr hugepage = NULL;
+    size_t i;
+
+    if (!pagesize) {
+        if (cell < 0) {
+            /* this is what -mem-path is set up from */
+            if (def->mem.nhugepages)
+                hugepage = &def->mem.hugepages[0];
+        } else {
+            for (i = 0; i < def->mem.nhugepages; i++) {
+                virDomainHugePagePtr tmp = &def->mem.hugepages[i];
+                bool thisHugepage = false;
+
+                /* the generic setting, unless there's a specific one */
+                if (!tmp->nodemask) {
+                    if (!hugepage)
+                        hugepage = tmp;
+                    continue;
+                }
+
+                if (virBitmapGetBit(tmp->nodemask, cell, &thisHugepage) == 0 &&
+                    thisHugepage) {
+                    hugepage = tmp;
+                    break;
+                }
+            }
+        }
+
+        if (!hugepage)
+            return 0;
+
+        /* the default huge page size, see qemuGetDomainDefaultHugepath */
+        if (!(pagesize = hugepage->size) && cfg->nhugetlbfs) {
+            for (i = 0; i < cfg->nhugetlbfs; i++) {
+                if (cfg->hugetlbfs[i].deflt)
+                    break;
+            }
+
+            pagesize = cfg->hugetlbfs[i == cfg->nhugetlbfs ? 0 : i].size;
+        }
+    }
+
+    /* huge pages of the regular page size are no huge pages */
+    if (pagesize == virGetSystemPageSizeKB())
+        return 0;
+
+    return pagesize;
+}
+
+
+/* Returns the host NUMA node the memory of guest NUMA node @cell (or
+ * the whole memory if @cell is -1) is taken from, or -1 if that isn't
+ * a single node. @nodeset overrides <numatune/> if not NULL. */
+static int
+qemuDomainGetHugepageHostNode(virDomainDefPtr def,
+                              virBitmapPtr autoNodeset,
+                              virBitmapPtr nodeset,
+                              int cell)
+{
+    virDomainNumatuneMemMode mode;
+
+    if (virDomainNumatuneGetMode(def->numa, cell, &mode) < 0 &&
+        virDomainNumatuneGetMode(def->numa, -1, &mode) < 0)
+        mode = VIR_DOMAIN_NUMATUNE_MEM_STRICT;
+
+    /* the kernel falls back to other nodes in any other mode */
+    if (mode != VIR_DOMAIN_NUMATUNE_MEM_STRICT)
+        return -1;
+
+    /* the advice from numad might not be known yet */
+    if (!nodeset &&
+        virDomainNumatuneMaybeGetNodeset(def->numa, autoNodeset,
+                                         &nodeset, cell) < 0) {
+        virResetLastError();
+        return -1;
+    }
+
+    if (!nodeset || virBitmapCountBits(nodeset) != 1)
+        return -1;
+
+    return virBitmapNextSetBit(nodeset, -1);
+}
+
+
+static int
+qemuDomainAddHugepageReservation(virNumaPageReservationPtr *res,
+                                 size_t *nres,
+                                 int node,
+                                 unsigned long long pagesize,
+                                 unsigned long long size)
+{
+    virNumaPageReservation tmp = {
+        .node = node,
+        .page_size = pagesize,
+        .npages = VIR_DIV_UP(size, pagesize),
+    };
+    size_t i;
+
+    for (i = 0; i < *nres; i++) {
+        if ((*res)[i].node == node && (*res)[i].page_size == pagesize) {
+            (*res)[i].npages += tmp.npages;
+            return 0;
+        }
+    }
+
+    return VIR_APPEND_ELEMENT(*res, *nres, tmp);
+}
+
+
+/**
+ * qemuDomainReserveHugepages:
+ * @driver: qemu driver data
+ * @vm: domain object
+ * @force: don't check there are enough huge pages left
+ *
+ * Reserve the huge pages backing the memory of @vm, replacing whatever
+ * was reserved for it before. Unless @force is true, this fails if the
+ * huge page pools don't have enough pages left for @vm, without having
+ * to wait for QEMU to fail allocating them.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuDomainReserveHugepages(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm,
+                           bool force)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    virDomainDefPtr def = vm->def;
+    size_t ncells = virDomainNumaGetNodeCount(def->numa);
+    virNumaPageReservationPtr res = NULL;
+    size_t nres = 0;
+    unsigned long long pagesize;
+    int node;
+    size_t i;
+    int ret = -1;
+
+    /* file backed memory doesn't come from the huge page pools */
+    if (def->mem.source == VIR_DOMAIN_MEMORY_SOURCE_FILE)
+        goto done;
+
+    if (ncells == 0 &&
+        (pagesize = qemuDomainGetHugepageSize(cfg, def, 0, -1))) {
+        node = qemuDomainGetHugepageHostNode(def, priv->autoNodeset, NULL, -1);
+        if (qemuDomainAddHugepageReservation(&res, &nres, node, pagesize,
+                                             virDomainDefGetMemoryInitial(def)) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < ncells; i++) {
+        if (!(pagesize = qemuDomainGetHugepageSize(cfg, def, 0, i)))
+            continue;
+
+        node = qemuDomainGetHugepageHostNode(def, priv->autoNodeset, NULL, i);
+        if (qemuDomainAddHugepageReservation(&res, &nres, node, pagesize,
+                                             virDomainNumaGetNodeMemorySize(def->numa, i)) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < def->nmems; i++) {
+        virDomainMemoryDefPtr mem = def->mems[i];
+
+        if (mem->model != VIR_DOMAIN_MEMORY_MODEL_DIMM ||
+            !(pagesize = qemuDomainGetHugepageSize(cfg, def, mem->pagesize,
+                                                   mem->targetNode)))
+            continue;
+
+        node = qemuDomainGetHugepageHostNode(def, priv->autoNodeset,
+                                             mem->sourceNodes, mem->targetNode);
+        if (qemuDomainAddHugepageReservation(&res, &nres, node, pagesize,
+                                             mem->size) < 0)
+            goto cleanup;
+    }
+
+ done:
+    if (nres == 0) {
+        virNumaPageLedgerRelease(driver->hugepageLedger, def->name);
+    } else if (virNumaPageLedgerReserve(driver->hugepageLedger, def->name,
+                                        res, nres, force) < 0) {
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(res);
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
+/**
+ * qemuDomainReleaseHugepages:
+ * @driver: qemu driver data
+ * @vm: domain object
+ *
+ * Give back the huge pages reserved by qemuDomainReserveHugepages().
+ */
+void
+qemuDomainReleaseHugepages(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm)
+{
+    virNumaPageLedgerRelease(driver->hugepageLedger, vm->def->name);
+}
+
+
+/**
+ * qemuDomainMetadataPriority:
+ * @def: domain definition
+ * @href: namespace of the metadata element
+ * @name: name of the metadata element
+ *
+ * Returns the priority given by the <@name priority='N'/> element in the
+ * @href namespace of the metadata of @def, 0 if there's none.
+ */
+int
+qemuDomainMetadataPriority(virDomainDefPtr def,
+                           const char *href,
+                           const char *name)
+{
+    xmlNodePtr node;
+    char *str;
+    int priority = 0;
+
+    if (!def->metadata ||
+        !(node = virXMLFindChildNodeByNs(def->metadata, href)) ||
+        !xmlStrEqual(node->name, BAD_CAST name) ||
+        !(str = virXMLPropString(node, "priority")))
+        return 0;
+
+    if (virStrToLong_i(str, NULL, 10, &priority) < 0) {
+        VIR_WARN("Ignoring invalid %s priority '%s' of domain %s",
+                 name, str, def->name);
+        priority = 0;
+    }
+
+    VIR_FREE(str);
+    return priority;
+}
+
+
+/* Returns the number of queues given to a device with queues='auto' */
+static unsigned int
+qemuDomainAutoQueues(const virDomainDef *def)
+{
+    return MIN(virDomainDefGetVcpusMax(def), QEMU_DOMAIN_AUTO_QUEUES_MAX);
+}
+
+
+/**
+ * qemuDomainNetPrepareAutoQueues:
+ * @def: domain definition
+ * @net: interface of @def, with its actual type already resolved
+ * @qemuCaps: capabilities of the QEMU binary
+ *
+ * Gives a virtio interface with queues='auto' one queue per vCPU if its
+ * actual type supports multiqueue, otherwise leaves it with a single one.
+ */
+void
+qemuDomainNetPrepareAutoQueues(const virDomainDef *def,
+                               virDomainNetDefPtr net,
+                               virQEMUCapsPtr qemuCaps)
+{
+    unsigned int queues;
+
+    if (!net->driver.virtio.queuesAuto || net->driver.virtio.queues ||
+        STRNEQ_NULLABLE(net->model, "virtio"))
+        return;
+
+    switch (virDomainNetGetActualType(net)) {
+    case VIR_DOMAIN_NET_TYPE_NETWORK:
+    case VIR_DOMAIN_NET_TYPE_BRIDGE:
+    case VIR_DOMAIN_NET_TYPE_DIRECT:
+    case VIR_DOMAIN_NET_TYPE_ETHERNET:
+        break;
+    case VIR_DOMAIN_NET_TYPE_VHOSTUSER:
+        if (virQEMUCapsGet(qemuCaps, QEMU_CAPS_VHOSTUSER_MULTIQUEUE))
+            break;
+        return;
+    case VIR_DOMAIN_NET_TYPE_USER:
+    case VIR_DOMAIN_NET_TYPE_SERVER:
+    case VIR_DOMAIN_NET_TYPE_CLIENT:
+    case VIR_DOMAIN_NET_TYPE_MCAST:
+    case VIR_DOMAIN_NET_TYPE_INTERNAL:
+    case VIR_DOMAIN_NET_TYPE_HOSTDEV:
+    case VIR_DOMAIN_NET_TYPE_UDP:
+    case VIR_DOMAIN_NET_TYPE_LAST:
+        return;
+    }
+
+    if ((queues = qemuDomainAutoQueues(def)) > 1)
+        net->driver.virtio.queues = queues;
+}
+
+
+static bool
+qemuDomainDiskSupportsIOThread(virDomainDiskDefPtr disk)
+{
+    return disk->bus == VIR_DOMAIN_DISK_BUS_VIRTIO &&
+           (disk->info.type == VIR_DOMAIN_DEVICE_ADDRESS_TYPE_PCI ||
+            disk->info.type == VIR_DOMAIN_DEVICE_ADDRESS_TYPE_CCW);
+}
+
+
+static bool
+qemuDomainControllerSupportsIOThread(virDomainControllerDefPtr cont,
+                                     virQEMUCapsPtr qemuCaps)
+{
+    return cont->type == VIR_DOMAIN_CONTROLLER_TYPE_SCSI &&
+           cont->model == VIR_DOMAIN_CONTROLLER_MODEL_SCSI_VIRTIO_SCSI &&
+           (cont->info.type == VIR_DOMAIN_DEVICE_ADDRESS_TYPE_PCI ||
+            cont->info.type == VIR_DOMAIN_DEVICE_ADDRESS_TYPE_CCW) &&
+           virQEMUCapsGet(qemuCaps, QEMU_CAPS_VIRTIO_SCSI_IOTHREAD);
+}
+
+
+/* Fills @cpuset with the host CPUs the vCPUs of @def may run on, or NULL
+ * if they aren't restricted */
+static int
+qemuDomainGetVcpusCpuset(virDomainDefPtr def,
+                         virBitmapPtr autoCpuset,
+                         virBitmapPtr *cpuset)
+{
+    virBitmapPtr ret = NULL;
+    ssize_t cpu;
+    size_t i;
+
+    *cpuset = NULL;
+
+    if (autoCpuset || def->cpumask) {
+        if (!(*cpuset = virBitmapNewCopy(autoCpuset ? autoCpuset
+                                                    : def->cpumask)))
+            return -1;
+        return 0;
+    }
+
+    /* Unless every vCPU is pinned, an unpinned one may run anywhere */
+    for (i = 0; i < virDomainDefGetVcpusMax(def); i++) {
+        if (!virDomainDefGetVcpu(def, i)->cpumask)
+            return 0;
+    }
+
+    if (!(ret = virBitmapNewEmpty()))
+        return -1;
+
+    for (i = 0; i < virDomainDefGetVcpusMax(def); i++) {
+        virBitmapPtr cpumask = virDomainDefGetVcpu(def, i)->cpumask;
+
+        cpu = -1;
+        while ((cpu = virBitmapNextSetBit(cpumask, cpu)) >= 0) {
+            if (virBitmapSetBitExpand(ret, cpu) < 0) {
+                virBitmapFree(ret);
+                return -1;
+            }
+        }
+    }
+
+    *cpuset = ret;
+    return 0;
+}
+
+
+/* Splits the host CPUs the vCPUs of @def may run on by host NUMA node.
+ * Leaves @sets empty if the vCPUs aren't restricted. */
+static int
+qemuDomainGetIOThreadsCpusets(virDomainDefPtr def,
+                              virCapsPtr caps,
+                              virBitmapPtr autoCpuset,
+                              virBitmapPtr **sets,
+                              size_t *nsets)
+{
+    virBitmapPtr cpuset;
+    virBitmapPtr nodeset = NULL;
+    size_t i;
+    int j;
+    int ret = -1;
+
+    *sets = NULL;
+    *nsets = 0;
+
+    if (qemuDomainGetVcpusCpuset(def, autoCpuset, &cpuset) < 0)
+        return -1;
+    if (!cpuset)
+        return 0;
+
+    for (i = 0; i < caps->host.nnumaCell; i++) {
+        virCapsHostNUMACellPtr cell = caps->host.numaCell[i];
+
+        if (!(nodeset = virBitmapNew(virBitmapSize(cpuset))))
+            goto cleanup;
+
+        for (j = 0; j < cell->ncpus; j++) {
+            if (virBitmapIsBitSet(cpuset, cell->cpus[j].id))
+                ignore_value(virBitmapSetBit(nodeset, cell->cpus[j].id));
+        }
+
+        if (virBitmapIsAllClear(nodeset)) {
+            virBitmapFree(nodeset);
+        } else if (VIR_APPEND_ELEMENT(*sets, *nsets, nodeset) < 0) {
+            goto cleanup;
+        }
+        nodeset = NULL;
+    }
+
+    /* Without NUMA information the whole set is used */
+    if (*nsets == 0 &&
+        VIR_APPEND_ELEMENT(*sets, *nsets, cpuset) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0) {
+        for (i = 0; i < *nsets; i++)
+            virBitmapFree((*sets)[i]);
+        VIR_FREE(*sets);
+        *nsets = 0;
+    }
+    virBitmapFree(nodeset);
+    virBitmapFree(cpuset);
+    return ret;
+}
+
+
+static ssize_t
+qemuDomainIOThreadIndex(const virDomainDef *def,
+                        unsigned int iothread_id)
+{
+    size_t i;
+
+    for (i = 0; i < def->niothreadids; i++) {
+        if (def->iothreadids[i]->iothread_id == iothread_id)
+            return i;
+    }
+
+    return -1;
+}
+
+
+/* Returns the index of the iothread with the fewest devices and accounts
+ * one more device to it */
+static size_t
+qemuDomainIOThreadLeastUsed(size_t *load,
+                            size_t nload)
+{
+    size_t best = 0;
+    size_t i;
+
+    for (i = 1; i < nload; i++) {
+        if (load[i] < load[best])
+            best = i;
+    }
+
+    load[best]++;
+    return best;
+}
+
+
+static int
+qemuDomainPrepareAutoIOThreads(virDomainDefPtr def,
+                               virQEMUCapsPtr qemuCaps,
+                               virCapsPtr caps,
+                               virBitmapPtr autoCpuset)
+{
+    virBitmapPtr *sets = NULL;
+    size_t nsets = 0;
+    size_t *load = NULL;
+    size_t ndevices = 0;
+    size_t count = 0;
+    size_t i;
+    ssize_t idx;
+    int ret = -1;
+
+    if (def->iothreadsPlacement != VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO)
+        return 0;
+
+    if (!virQEMUCapsGet(qemuCaps, QEMU_CAPS_OBJECT_IOTHREAD)) {
+        VIR_DEBUG("IOThreads not supported by QEMU, ignoring auto placement");
+        return 0;
+    }
+
+    for (i = 0; i < def->ndisks; i++) {
+        if (!def->disks[i]->iothread &&
+            qemuDomainDiskSupportsIOThread(def->disks[i]))
+            ndevices++;
+    }
+    for (i = 0; i < def->ncontrollers; i++) {
+        if (!def->controllers[i]->iothread &&
+            qemuDomainControllerSupportsIOThread(def->controllers[i],
+                                                 qemuCaps))
+            ndevices++;
+    }
+
+    if (qemuDomainGetIOThreadsCpusets(def, caps, autoCpuset,
+                                      &sets, &nsets) < 0)
+        goto cleanup;
+
+    /* The iothreads given explicitly are used as they are */
+    if (def->niothreadids == 0) {
+        count = VIR_DIV_UP(virDomainDefGetVcpusMax(def),
+                           QEMU_DOMAIN_AUTO_IOTHREAD_VCPUS);
+        count = MAX(count, nsets);
+        count = MIN(count, ndevices);
+
+        for (i = 0; i < count; i++) {
+            virDomainIOThreadIDDefPtr iothrid;
+
+            if (!(iothrid = virDomainIOThreadIDAdd(def, i + 1)))
+                goto cleanup;
+            iothrid->autofill = true;
+        }
+
+        VIR_DEBUG("Added %zu iothreads for %zu devices", count, ndevices);
+    }
+
+    for (i = 0; nsets && i < def->niothreadids; i++) {
+        virDomainIOThreadIDDefPtr iothrid = def->iothreadids[i];
+
+        if (iothrid->cpumask)
+            continue;
+        if (!(iothrid->cpumask = virBitmapNewCopy(sets[i % nsets])))
+            goto cleanup;
+    }
+
+    if (!def->niothreadids || !ndevices) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(load, def->niothreadids) < 0)
+        goto cleanup;
+
+    for (i = 0; i < def->ndisks; i++) {
+        if (def->disks[i]->iothread &&
+            (idx = qemuDomainIOThreadIndex(def, def->disks[i]->iothread)) >= 0)
+            load[idx]++;
+    }
+    for (i = 0; i < def->ncontrollers; i++) {
+        if (def->controllers[i]->iothread &&
+            (idx = qemuDomainIOThreadIndex(def,
+                                           def->controllers[i]->iothread)) >= 0)
+            load[idx]++;
+    }
+
+    for (i = 0; i < def->ndisks; i++) {
+        virDomainDiskDefPtr disk = def->disks[i];
+
+        if (disk->iothread || !qemuDomainDiskSupportsIOThread(disk))
+            continue;
+
+        idx = qemuDomainIOThreadLeastUsed(load, def->niothreadids);
+        disk->iothread = def->iothreadids[idx]->iothread_id;
+    }
+    for (i = 0; i < def->ncontrollers; i++) {
+        virDomainControllerDefPtr cont = def->controllers[i];
+
+        if (cont->iothread ||
+            !qemuDomainControllerSupportsIOThread(cont, qemuCaps))
+            continue;
+
+        idx = qemuDomainIOThreadLeastUsed(load, def->niothreadids);
+        cont->iothread = def->iothreadids[idx]->iothread_id;
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < nsets; i++)
+        virBitmapFree(sets[i]);
+    VIR_FREE(sets);
+    VIR_FREE(load);
+    return ret;
+}
+
+
+/**
+ * qemuDomainPrepareAutoPlacement:
+ * @def: definition of the domain being started
+ * @qemuCaps: capabilities of the QEMU binary
+ * @caps: host capabilities
+ * @autoCpuset: host CPUs advised by numad, or NULL
+ *
+ * Resolves <iothreads placement='auto'/> and queues='auto' of the
+ * virtio-scsi controllers of @def into the values the command line is
+ * built from, see the documentation of the domain XML. The interfaces
+ * are handled by qemuDomainNetPrepareAutoQueues once their actual type
+ * is known.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuDomainPrepareAutoPlacement(virDomainDefPtr def,
+                               virQEMUCapsPtr qemuCaps,
+                               virCapsPtr caps,
+                               virBitmapPtr autoCpuset)
+{
+    unsigned int queues = qemuDomainAutoQueues(def);
+    size_t i;
+
+    for (i = 0; i < def->ncontrollers; i++) {
+        virDomainControllerDefPtr cont = def->controllers[i];
+
+        if (cont->queuesAuto && !cont->queues && queues > 1 &&
+            cont->type == VIR_DOMAIN_CONTROLLER_TYPE_SCSI &&
+            cont->model == VIR_DOMAIN_CONTROLLER_MODEL_SCSI_VIRTIO_SCSI)
+            cont->queues = queues;
+    }
+
+    return qemuDomainPrepareAutoIOThreads(def, qemuCaps, caps, autoCpuset);
+}
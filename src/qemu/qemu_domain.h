@@ -30,12 +30,14 @@
 # include "domain_addr.h"
 # include "domain_conf.h"
 # include "snapshot_conf.h"
+# include "backup_conf.h"
 # include "qemu_monitor.h"
 # include "qemu_agent.h"
 # include "qemu_conf.h"
 # include "qemu_capabilities.h"
 # include "virmdev.h"
 # include "virchrdev.h"
+# include "virhook.h"
 # include "virobject.h"
 # include "logging/log_manager.h"
 
@@ -118,16 +120,55 @@ struct _qemuDomainJobInfo {
                             source and the beginning of Finish phase on the
                             destination. */
     bool timeDeltaSet;
+    /* Migration downtime limit in ms as last set by libvirt, 0 if unknown */
+    unsigned long long downtimeLimit;
+    /* Number of changes done by the migration auto-tuning controller */
+    unsigned int autoTuneAdjustments;
+    /* Guest dirty rate in MiB/s measured before the migration started,
+     * 0 if unknown */
+    unsigned long long dirtyRate;
     /* Raw values from QEMU */
     qemuMonitorMigrationStats stats;
 };
 
+/* Bucket N of the job time histograms counts the durations shorter than
+ * 10^N milliseconds, the last one all the longer ones */
+# define QEMU_DOMAIN_JOB_STATS_BUCKETS 6
+
+typedef struct _qemuDomainJobStats qemuDomainJobStats;
+typedef qemuDomainJobStats *qemuDomainJobStatsPtr;
+struct _qemuDomainJobStats {
+    unsigned long long started;     /* Jobs acquired */
+    unsigned long long failed;      /* Jobs which couldn't be acquired */
+    unsigned long long waitTotal;   /* Time spent waiting for the job (ms) */
+    unsigned long long waitMax;
+    unsigned long long holdTotal;   /* Time the job was held (ms) */
+    unsigned long long holdMax;
+    const char *holdMaxAPI;         /* The API which held it for holdMax */
+    unsigned long long waitBuckets[QEMU_DOMAIN_JOB_STATS_BUCKETS];
+    unsigned long long holdBuckets[QEMU_DOMAIN_JOB_STATS_BUCKETS];
+};
+
+typedef struct _qemuDomainHookStats qemuDomainHookStats;
+typedef qemuDomainHookStats *qemuDomainHookStatsPtr;
+struct _qemuDomainHookStats {
+    unsigned long long count;       /* Runs of the hook script */
+    unsigned long long failed;      /* Runs which failed or timed out */
+    unsigned long long total;       /* Time the script ran (ms) */
+    unsigned long long max;
+};
+
 struct qemuDomainJobObj {
     virCond cond;                       /* Use to coordinate jobs */
     qemuDomainJob active;               /* Currently running job */
     unsigned long long owner;           /* Thread id which set current job */
     const char *ownerAPI;               /* The API which owns the job */
     unsigned long long started;         /* When the current job started */
+    unsigned int nshared;               /* Threads sharing the current query
+                                         * job, 0 if it is exclusive */
+    unsigned int exclusiveWaiters;      /* Threads waiting for an exclusive
+                                         * job, no new sharers join while
+                                         * there are any */
 
     virCond asyncCond;                  /* Use to coordinate with async jobs */
     qemuDomainAsyncJob asyncJob;        /* Currently active async job */
@@ -144,6 +185,12 @@ struct qemuDomainJobObj {
                                          * should wait for it to finish */
     bool spiceMigrated;                 /* spice migration completed */
     bool postcopyEnabled;               /* post-copy migration was enabled */
+    bool dumpCompleted;                 /* dump completed */
+    char *dumpError;                    /* error reported by a detached dump */
+
+    qemuDomainJobStats stats[QEMU_JOB_LAST]; /* Wait and hold times of jobs */
+    qemuDomainJobStats asyncStats[QEMU_ASYNC_JOB_LAST]; /* and of async jobs */
+    qemuDomainHookStats hookStats[VIR_HOOK_QEMU_OP_LAST]; /* Hook run times */
 };
 
 typedef void (*qemuDomainCleanupCallback)(virQEMUDriverPtr driver,
@@ -213,6 +260,37 @@ struct _qemuDomainSecretInfo {
     } s;
 };
 
+/* Write threshold armed with virDomainSetBlockThreshold */
+typedef struct _qemuDomainBlockThreshold qemuDomainBlockThreshold;
+typedef qemuDomainBlockThreshold *qemuDomainBlockThresholdPtr;
+struct _qemuDomainBlockThreshold {
+    char *nodename;
+    unsigned long long threshold;
+};
+
+/* Disk of a block job group started by virDomainBlockJobGroupStart */
+typedef struct _qemuDomainBlockJobGroupDisk qemuDomainBlockJobGroupDisk;
+typedef qemuDomainBlockJobGroupDisk *qemuDomainBlockJobGroupDiskPtr;
+struct _qemuDomainBlockJobGroupDisk {
+    char *dst;
+    int state;  /* virDomainBlockJobGroupDiskState */
+    unsigned long long cur;  /* progress of the job when last seen */
+    unsigned long long end;
+};
+
+/* Block jobs run on several disks with shared limits, see qemu_blockjob.c */
+typedef struct _qemuDomainBlockJobGroup qemuDomainBlockJobGroup;
+typedef qemuDomainBlockJobGroup *qemuDomainBlockJobGroupPtr;
+struct _qemuDomainBlockJobGroup {
+    int type;  /* virDomainBlockJobType, PULL or COMMIT */
+    unsigned long long bandwidth;  /* bytes/s shared by the jobs, 0 if unlimited */
+    unsigned int concurrency;  /* most jobs running at once, 0 if unlimited */
+    unsigned long long started;  /* in ms */
+
+    size_t ndisks;
+    qemuDomainBlockJobGroupDiskPtr disks;
+};
+
 typedef struct _qemuDomainObjPrivate qemuDomainObjPrivate;
 typedef qemuDomainObjPrivate *qemuDomainObjPrivatePtr;
 struct _qemuDomainObjPrivate {
@@ -292,8 +370,62 @@ struct _qemuDomainObjPrivate {
     /* Used when fetching/storing the current 'tls-creds' migration setting */
     /* (not to be saved in our private XML). */
     char *migTLSAlias;
+
+    /* Statistics kept for VIR_CONNECT_GET_ALL_DOMAINS_STATS_CACHED */
+    virTypedParameterPtr statsCache;
+    int nstatsCache;
+    unsigned int statsCacheTypes;  /* virDomainStatsTypes gathered */
+    unsigned int statsCacheFlags;  /* QEMU_DOMAIN_STATS_* used */
+    unsigned long long statsCacheTime;  /* when they were gathered, in ms */
+
+    /* Periodic VIR_DOMAIN_EVENT_ID_STATS set up by virDomainSetStatsEvent */
+    int statsEventTimer;  /* -1 if disabled */
+    unsigned int statsEventTypes;
+    bool statsEventPending;  /* sampling is queued in the worker pool */
+    virTypedParameterPtr statsEventLast;  /* last reported values */
+    int nstatsEventLast;
+
+    /* Write thresholds which didn't fire yet, kept in the status XML so
+     * that the ones crossed while the daemon was down are reported */
+    qemuDomainBlockThresholdPtr blockThresholds;
+    size_t nblockThresholds;
+
+    /* Running backup job, see qemu_backup.c */
+    virDomainBackupDefPtr backup;
+
+    /* Running block job group, see qemu_blockjob.c */
+    qemuDomainBlockJobGroupPtr blockJobGroup;
+
+    /* Guest memory statistics of the virtio balloon, refreshed in the
+     * worker pool every memballoon period and on BALLOON_CHANGE */
+    int balloonStatsTimer;  /* -1 if not polling */
+    bool balloonStatsPending;  /* refresh is queued in the worker pool */
+    int nballoonStats;  /* -1 until the first refresh */
+    virDomainMemoryStatStruct balloonStats[VIR_DOMAIN_MEMORY_STAT_NR];
+
+    /* Samples taken by the NUMA rebalancing in qemu_placement.c */
+    unsigned long long placementCpuTime;  /* cpuacct usage, in ns */
+    unsigned long long placementStamp;    /* when it was read, in ms */
+    unsigned long long placementMoved;    /* when the domain was moved */
+
+    /* Journal of job and runtime state changes, see qemuDomainSaveStatus */
+    unsigned int journalGen;      /* generation of the saved status XML */
+    size_t journalRecords;        /* records journaled since it was saved */
+
+    /* true until qemuProcessReconnect picked up the domain after a daemon
+     * restart; new jobs wait for it to be cleared */
+    bool reconnecting;
 };
 
+void qemuDomainStatsCacheClear(qemuDomainObjPrivatePtr priv);
+void qemuDomainStatsEventClear(qemuDomainObjPrivatePtr priv);
+void qemuDomainBalloonStatsClear(qemuDomainObjPrivatePtr priv);
+int qemuDomainBlockThresholdSet(qemuDomainObjPrivatePtr priv,
+                                const char *nodename,
+                                unsigned long long threshold);
+void qemuDomainBlockThresholdsClear(qemuDomainObjPrivatePtr priv);
+void qemuDomainBlockJobGroupFree(qemuDomainBlockJobGroupPtr group);
+
 # define QEMU_DOMAIN_PRIVATE(vm)	\
     ((qemuDomainObjPrivatePtr) (vm)->privateData)
 
@@ -316,6 +448,7 @@ struct _qemuDomainDiskPrivate {
     bool blockJobSync; /* the block job needs synchronized termination */
 
     bool migrating; /* the disk is being migrated */
+    bool backup; /* the disk is exported by a backup job */
 
     /* for storage devices using auth/secret
      * NB: *not* to be written to qemu domain object XML */
@@ -400,6 +533,8 @@ typedef enum {
     QEMU_PROCESS_EVENT_SERIAL_CHANGED,
     QEMU_PROCESS_EVENT_BLOCK_JOB,
     QEMU_PROCESS_EVENT_MONITOR_EOF,
+    QEMU_PROCESS_EVENT_STATS,
+    QEMU_PROCESS_EVENT_BALLOON_STATS,
 
     QEMU_PROCESS_EVENT_LAST
 } qemuProcessEventType;
@@ -431,6 +566,15 @@ int qemuDomainObjBeginJob(virQEMUDriverPtr driver,
                           virDomainObjPtr obj,
                           qemuDomainJob job)
     ATTRIBUTE_RETURN_CHECK;
+int qemuDomainObjBeginJobWithTimeout(virQEMUDriverPtr driver,
+                                     virDomainObjPtr obj,
+                                     qemuDomainJob job,
+                                     unsigned long long timeout)
+    ATTRIBUTE_RETURN_CHECK;
+int qemuDomainObjBeginSharedJob(virQEMUDriverPtr driver,
+                                virDomainObjPtr obj,
+                                unsigned long long timeout)
+    ATTRIBUTE_RETURN_CHECK;
 int qemuDomainObjBeginAsyncJob(virQEMUDriverPtr driver,
                                virDomainObjPtr obj,
                                qemuDomainAsyncJob asyncJob)
@@ -445,6 +589,19 @@ void qemuDomainObjEndJob(virQEMUDriverPtr driver,
 void qemuDomainObjEndAsyncJob(virQEMUDriverPtr driver,
                               virDomainObjPtr obj);
 void qemuDomainObjAbortAsyncJob(virDomainObjPtr obj);
+void qemuDomainHookStatsAdd(virDomainObjPtr obj,
+                            virHookQemuOpType op,
+                            int ret,
+                            unsigned long long duration);
+int qemuDomainSaveStatus(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm);
+void qemuDomainSaveStatusBalloon(virQEMUDriverPtr driver,
+                                 virDomainObjPtr vm);
+void qemuDomainReplayStatusJournal(virQEMUDriverPtr driver,
+                                   virDomainObjPtr vm);
+void qemuDomainRemoveStatusJournal(virQEMUDriverConfigPtr cfg,
+                                   virDomainObjPtr vm);
+
 void qemuDomainObjSetJobPhase(virQEMUDriverPtr driver,
                               virDomainObjPtr obj,
                               int phase);
@@ -552,9 +709,13 @@ int qemuDomainLogAppendMessage(virQEMUDriverPtr driver,
 
 const char *qemuFindQemuImgBinary(virQEMUDriverPtr driver);
 
+int qemuDomainSnapshotLoadDom(virQEMUDriverPtr driver,
+                              virDomainSnapshotObjPtr snapshot);
+
 int qemuDomainSnapshotWriteMetadata(virDomainObjPtr vm,
                                     virDomainSnapshotObjPtr snapshot,
                                     virCapsPtr caps,
+                                    virDomainXMLOptionPtr xmlopt,
                                     char *snapshotDir);
 
 int qemuDomainSnapshotForEachQcow2(virQEMUDriverPtr driver,
@@ -699,6 +860,7 @@ int qemuDomainDefValidateMemoryHotplug(const virDomainDef *def,
 
 bool qemuDomainSupportsNewVcpuHotplug(virDomainObjPtr vm);
 bool qemuDomainHasVcpuPids(virDomainObjPtr vm);
+int qemuDomainGetHomeNode(virDomainObjPtr vm);
 pid_t qemuDomainGetVcpuPid(virDomainObjPtr vm, unsigned int vcpuid);
 int qemuDomainValidateVcpuInfo(virDomainObjPtr vm);
 int qemuDomainRefreshVcpuInfo(virQEMUDriverPtr driver,
@@ -706,6 +868,8 @@ int qemuDomainRefreshVcpuInfo(virQEMUDriverPtr driver,
                               int asyncJob,
                               bool state);
 bool qemuDomainGetVcpuHalted(virDomainObjPtr vm, unsigned int vcpu);
+void qemuDomainUpdateVcpuHalted(virDomainObjPtr vm,
+                                virBitmapPtr haltedmap);
 int qemuDomainRefreshVcpuHalted(virQEMUDriverPtr driver,
                                 virDomainObjPtr vm,
                                 int asyncJob);
@@ -891,4 +1055,27 @@ char *qemuDomainDiskBackingStoreGetName(virDomainDiskDefPtr disk,
 virStorageSourcePtr qemuDomainGetStorageSourceByDevstr(const char *devstr,
                                                        virDomainDefPtr def);
 
+int qemuDomainReserveHugepages(virQEMUDriverPtr driver,
+                               virDomainObjPtr vm,
+                               bool force);
+void qemuDomainReleaseHugepages(virQEMUDriverPtr driver,
+                                virDomainObjPtr vm);
+
+int qemuDomainMetadataPriority(virDomainDefPtr def,
+                               const char *href,
+                               const char *name);
+
+/* Upper limit on the queues of a device with queues='auto' */
+# define QEMU_DOMAIN_AUTO_QUEUES_MAX 8
+/* vCPUs per iothread added for <iothreads placement='auto'/> */
+# define QEMU_DOMAIN_AUTO_IOTHREAD_VCPUS 4
+
+int qemuDomainPrepareAutoPlacement(virDomainDefPtr def,
+                                   virQEMUCapsPtr qemuCaps,
+                                   virCapsPtr caps,
+                                   virBitmapPtr autoCpuset);
+void qemuDomainNetPrepareAutoQueues(const virDomainDef *def,
+                                    virDomainNetDefPtr net,
+                                    virQEMUCapsPtr qemuCaps);
+
 #endif /* __QEMU_DOMAIN_H__ */
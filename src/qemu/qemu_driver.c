@@ -46,6 +46,7 @@
 #include "qemu_driver.h"
 #include "qemu_agent.h"
 #include "qemu_alias.h"
+#include "qemu_backup.h"
 #include "qemu_block.h"
 #include "qemu_conf.h"
 #include "qemu_capabilities.h"
@@ -57,6 +58,7 @@
 #include "qemu_monitor.h"
 #include "qemu_process.h"
 #include "qemu_migration.h"
+#include "qemu_placement.h"
 #include "qemu_blockjob.h"
 #include "qemu_security.h"
 
@@ -65,6 +67,7 @@
 #include "datatypes.h"
 #include "virbuffer.h"
 #include "virhostcpu.h"
+#include "viratomic.h"
 #include "virhostmem.h"
 #include "virnetdevtap.h"
 #include "virnetdevopenvswitch.h"
@@ -137,6 +140,8 @@ VIR_LOG_INIT("qemu.qemu_driver");
 #define QEMU_NB_BANDWIDTH_PARAM 7
 
 static void qemuProcessEventHandler(void *data, void *opaque);
+static void qemuDomainGetStatsBatchWorker(void *data, void *opaque);
+static void processStatsEvent(virQEMUDriverPtr driver, virDomainObjPtr vm);
 
 static int qemuStateCleanup(void);
 
@@ -182,9 +187,33 @@ static virNWFilterCallbackDriver qemuCallbackDriver = {
 };
 
 
+#define QEMU_AUTOSTART_NAMESPACE_HREF \
+    "http://libvirt.org/schemas/domain/qemu/autostart/1.0"
+#define QEMU_AUTOSTART_ELEMENT "autostart"
+
+/* How long, in seconds, a domain start waits for the host load to
+ * drop below auto_start_max_load before it starts the domain anyway */
+#define QEMU_AUTOSTART_LOAD_WAIT_MAX 60
+
+struct qemuAutostartEntry {
+    virDomainObjPtr vm;
+    int priority;
+    size_t idx;
+};
+
 struct qemuAutostartData {
     virQEMUDriverPtr driver;
     virConnectPtr conn;
+
+    unsigned int maxLoad;
+    int ncpus;
+
+    /* the domains to start, in order; protected by lock once the
+     * workers are running */
+    virMutex lock;
+    struct qemuAutostartEntry *entries;
+    size_t nentries;
+    size_t next;
 };
 
 
@@ -293,6 +322,106 @@ qemuAutostartDomain(virDomainObjPtr vm,
 }
 
 
+static int
+qemuAutostartCollect(virDomainObjPtr vm,
+                     void *opaque)
+{
+    struct qemuAutostartData *data = opaque;
+    struct qemuAutostartEntry entry;
+    int ret = -1;
+
+    virObjectLock(vm);
+
+    if (!vm->autostart || virDomainObjIsActive(vm)) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    entry.vm = vm;
+    entry.priority = qemuDomainMetadataPriority(vm->def,
+                                                QEMU_AUTOSTART_NAMESPACE_HREF,
+                                                QEMU_AUTOSTART_ELEMENT);
+    entry.idx = data->nentries;
+
+    if (VIR_APPEND_ELEMENT(data->entries, data->nentries, entry) < 0)
+        goto cleanup;
+
+    virObjectRef(vm);
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(vm);
+    return ret;
+}
+
+
+static int
+qemuAutostartEntryCompare(const void *a,
+                          const void *b)
+{
+    const struct qemuAutostartEntry *ea = a;
+    const struct qemuAutostartEntry *eb = b;
+
+    /* highest priority first, keep the list order otherwise */
+    if (ea->priority != eb->priority)
+        return ea->priority > eb->priority ? -1 : 1;
+
+    return ea->idx < eb->idx ? -1 : ea->idx > eb->idx;
+}
+
+
+/* Holds the next start back while the 1 minute load average per host
+ * CPU is above auto_start_max_load percent, but not forever */
+static void
+qemuAutostartWaitForLoad(struct qemuAutostartData *data)
+{
+    double load;
+    size_t i;
+
+    if (!data->maxLoad || data->ncpus <= 0)
+        return;
+
+    for (i = 0; i < QEMU_AUTOSTART_LOAD_WAIT_MAX; i++) {
+        if (getloadavg(&load, 1) < 1 ||
+            load * 100 <= (double) data->maxLoad * data->ncpus)
+            return;
+
+        if (i == 0)
+            VIR_DEBUG("Host load %.2f is too high, delaying autostart", load);
+        sleep(1);
+    }
+
+    VIR_DEBUG("Host load is still %.2f, autostarting anyway", load);
+}
+
+
+static void
+qemuAutostartWorker(void *opaque)
+{
+    struct qemuAutostartData *data = opaque;
+    virDomainObjPtr vm;
+
+    for (;;) {
+        virMutexLock(&data->lock);
+        if (data->next == data->nentries) {
+            virMutexUnlock(&data->lock);
+            break;
+        }
+        vm = data->entries[data->next++].vm;
+        virMutexUnlock(&data->lock);
+
+        qemuAutostartWaitForLoad(data);
+
+        VIR_DEBUG("Autostarting domain %s", vm->def->name);
+        ignore_value(qemuAutostartDomain(vm, data));
+    }
+}
+
+
+/*
+ * Starts the autostart domains, highest autostart priority first, with up
+ * to auto_start_parallel of them starting at once.
+ */
 static void
 qemuAutostartDomains(virQEMUDriverPtr driver)
 {
@@ -305,9 +434,54 @@ qemuAutostartDomains(virQEMUDriverPtr driver)
     virConnectPtr conn = virConnectOpen(cfg->uri);
     /* Ignoring NULL conn which is mostly harmless here */
     struct qemuAutostartData data = { driver, conn };
+    virThreadPtr workers = NULL;
+    size_t nworkers = cfg->autoStartParallel;
+    size_t i;
+
+    data.maxLoad = cfg->autoStartMaxLoad;
+    data.ncpus = virHostCPUGetCount();
+    if (data.ncpus < 0)
+        virResetLastError();
+
+    if (virMutexInit(&data.lock) < 0) {
+        VIR_ERROR(_("Unable to initialize mutex"));
+        goto cleanup;
+    }
+
+    virDomainObjListForEach(driver->domains, qemuAutostartCollect, &data);
+
+    qsort(data.entries, data.nentries, sizeof(*data.entries),
+          qemuAutostartEntryCompare);
+
+    if (nworkers == 0)
+        nworkers = MAX(data.ncpus, 1);
+    if (nworkers > data.nentries)
+        nworkers = data.nentries;
+
+    /* this thread is one of the workers, which also covers a serial
+     * start or failing to create the other ones */
+    if (nworkers > 1 && VIR_ALLOC_N_QUIET(workers, nworkers - 1) < 0)
+        nworkers = 1;
+
+    for (i = 0; i + 1 < nworkers; i++) {
+        if (virThreadCreate(&workers[i], true, qemuAutostartWorker, &data) < 0) {
+            VIR_WARN("Unable to create autostart worker thread");
+            break;
+        }
+    }
+
+    qemuAutostartWorker(&data);
 
-    virDomainObjListForEach(driver->domains, qemuAutostartDomain, &data);
+    while (workers && i > 0)
+        virThreadJoin(&workers[--i]);
 
+    for (i = 0; i < data.nentries; i++)
+        virObjectUnref(data.entries[i].vm);
+    VIR_FREE(data.entries);
+    VIR_FREE(workers);
+    virMutexDestroy(&data.lock);
+
+ cleanup:
     virObjectUnref(conn);
     virObjectUnref(cfg);
 }
@@ -385,6 +559,8 @@ qemuSecurityInit(virQEMUDriverPtr driver)
         flags |= VIR_SECURITY_MANAGER_REQUIRE_CONFINED;
     if (virQEMUDriverIsPrivileged(driver))
         flags |= VIR_SECURITY_MANAGER_PRIVILEGED;
+    if (cfg->sharedBackingImages)
+        flags |= VIR_SECURITY_MANAGER_SHARED_BACKING;
 
     if (cfg->securityDriverNames &&
         cfg->securityDriverNames[0]) {
@@ -447,6 +623,67 @@ qemuSecurityInit(virQEMUDriverPtr driver)
 }
 
 
+/* Snapshot files parsed by each thread loading the snapshots of a
+ * domain, fewer files are parsed by the calling thread alone */
+#define QEMU_SNAPSHOT_LOAD_BATCH 64
+
+struct qemuDomainSnapshotLoadData {
+    virCapsPtr caps;
+    char **paths;
+    size_t npaths;
+    virDomainSnapshotDefPtr *defs;
+    int next; /* atomic, index of the next path to parse */
+};
+
+static virDomainSnapshotDefPtr
+qemuDomainSnapshotLoadFile(const char *fullpath,
+                           virCapsPtr caps)
+{
+    char *xmlStr;
+    virDomainSnapshotDefPtr def = NULL;
+    unsigned int flags = (VIR_DOMAIN_SNAPSHOT_PARSE_REDEFINE |
+                          VIR_DOMAIN_SNAPSHOT_PARSE_DISKS |
+                          VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL |
+                          VIR_DOMAIN_SNAPSHOT_PARSE_LAZY);
+
+    VIR_INFO("Loading snapshot file '%s'", fullpath);
+
+    if (virFileReadAll(fullpath, 1024*1024*1, &xmlStr) < 0) {
+        /* Nothing we can do here, skip this one */
+        virReportSystemError(errno,
+                             _("Failed to read snapshot file %s"),
+                             fullpath);
+        return NULL;
+    }
+
+    /* The domain definition of the snapshot is only parsed once it is
+     * needed, e.g. to revert to the snapshot */
+    def = virDomainSnapshotDefParseString(xmlStr, caps,
+                                          qemu_driver->xmlopt,
+                                          flags);
+    if (def == NULL) {
+        /* Nothing we can do here, skip this one */
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Failed to parse snapshot XML from file '%s'"),
+                       fullpath);
+    }
+
+    VIR_FREE(xmlStr);
+    return def;
+}
+
+static void
+qemuDomainSnapshotLoadWorker(void *opaque)
+{
+    struct qemuDomainSnapshotLoadData *data = opaque;
+    int i;
+
+    while ((i = virAtomicIntAdd(&data->next, 1)) < (int) data->npaths)
+        data->defs[i] = qemuDomainSnapshotLoadFile(data->paths[i], data->caps);
+
+    virResetLastError();
+}
+
 static int
 qemuDomainSnapshotLoad(virDomainObjPtr vm,
                        void *data)
@@ -455,17 +692,17 @@ qemuDomainSnapshotLoad(virDomainObjPtr vm,
     char *snapDir = NULL;
     DIR *dir = NULL;
     struct dirent *entry;
-    char *xmlStr;
     char *fullpath;
-    virDomainSnapshotDefPtr def = NULL;
+    struct qemuDomainSnapshotLoadData load = { 0 };
+    virThreadPtr threads = NULL;
+    size_t nthreads = 0;
+    int ncpus;
     virDomainSnapshotObjPtr snap = NULL;
     virDomainSnapshotObjPtr current = NULL;
-    unsigned int flags = (VIR_DOMAIN_SNAPSHOT_PARSE_REDEFINE |
-                          VIR_DOMAIN_SNAPSHOT_PARSE_DISKS |
-                          VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL);
     int ret = -1;
     virCapsPtr caps = NULL;
     int direrr;
+    size_t i;
 
     virObjectLock(vm);
     if (virAsprintf(&snapDir, "%s/%s", baseDir, vm->def->name) < 0) {
@@ -488,52 +725,63 @@ qemuDomainSnapshotLoad(virDomainObjPtr vm,
     while ((direrr = virDirRead(dir, &entry, NULL)) > 0) {
         /* NB: ignoring errors, so one malformed config doesn't
            kill the whole process */
-        VIR_INFO("Loading snapshot file '%s'", entry->d_name);
-
         if (virAsprintf(&fullpath, "%s/%s", snapDir, entry->d_name) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("Failed to allocate memory for path"));
             continue;
         }
 
-        if (virFileReadAll(fullpath, 1024*1024*1, &xmlStr) < 0) {
-            /* Nothing we can do here, skip this one */
-            virReportSystemError(errno,
-                                 _("Failed to read snapshot file %s"),
-                                 fullpath);
+        if (VIR_APPEND_ELEMENT(load.paths, load.npaths, fullpath) < 0)
             VIR_FREE(fullpath);
-            continue;
+    }
+    if (direrr < 0)
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Failed to fully read directory %s"),
+                       snapDir);
+
+    if (load.npaths && VIR_ALLOC_N(load.defs, load.npaths) < 0)
+        goto cleanup;
+    load.caps = caps;
+
+    /* Snapshots of CI images may come by the thousands, parse them in
+     * parallel but keep the order of the directory for the rest */
+    if ((ncpus = virHostCPUGetCount()) < 1)
+        ncpus = 1;
+    if ((size_t) ncpus > load.npaths / QEMU_SNAPSHOT_LOAD_BATCH)
+        ncpus = load.npaths / QEMU_SNAPSHOT_LOAD_BATCH;
+
+    if (ncpus > 1 && VIR_ALLOC_N_QUIET(threads, ncpus - 1) == 0) {
+        for (nthreads = 0; nthreads < (size_t) ncpus - 1; nthreads++) {
+            if (virThreadCreate(&threads[nthreads], true,
+                                qemuDomainSnapshotLoadWorker, &load) < 0) {
+                virResetLastError();
+                break;
+            }
         }
+    }
 
-        def = virDomainSnapshotDefParseString(xmlStr, caps,
-                                              qemu_driver->xmlopt,
-                                              flags);
-        if (def == NULL) {
-            /* Nothing we can do here, skip this one */
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("Failed to parse snapshot XML from file '%s'"),
-                           fullpath);
-            VIR_FREE(fullpath);
-            VIR_FREE(xmlStr);
+    VIR_DEBUG("Parsing %zu snapshot files of domain %s with %zu threads",
+              load.npaths, vm->def->name, nthreads + 1);
+
+    qemuDomainSnapshotLoadWorker(&load);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    for (i = 0; i < load.npaths; i++) {
+        if (!load.defs[i])
             continue;
-        }
 
-        snap = virDomainSnapshotAssignDef(vm->snapshots, def);
+        snap = virDomainSnapshotAssignDef(vm->snapshots, load.defs[i]);
         if (snap == NULL) {
-            virDomainSnapshotDefFree(def);
+            virDomainSnapshotDefFree(load.defs[i]);
         } else if (snap->def->current) {
             current = snap;
             if (!vm->current_snapshot)
                 vm->current_snapshot = snap;
         }
-
-        VIR_FREE(fullpath);
-        VIR_FREE(xmlStr);
+        load.defs[i] = NULL;
     }
-    if (direrr < 0)
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Failed to fully read directory %s"),
-                       snapDir);
 
     if (vm->current_snapshot != current) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -560,6 +808,9 @@ qemuDomainSnapshotLoad(virDomainObjPtr vm,
 
     ret = 0;
  cleanup:
+    VIR_FREE(threads);
+    VIR_FREE(load.defs);
+    virStringListFreeCount(load.paths, load.npaths);
     VIR_DIR_CLOSE(dir);
     VIR_FREE(snapDir);
     virObjectUnref(caps);
@@ -610,6 +861,52 @@ qemuDomainFindMaxID(virDomainObjPtr vm,
 }
 
 
+/* Reading the counters is just a few syscalls, so this runs right in
+ * the event loop, holding each domain locked only while it is sampled */
+static void
+qemuDomainPerfSampleTimer(int timer ATTRIBUTE_UNUSED,
+                          void *opaque)
+{
+    virQEMUDriverPtr driver = opaque;
+    virDomainObjPtr *vms = NULL;
+    size_t nvms = 0;
+    size_t i, j;
+
+    if (virDomainObjListCollect(driver->domains, NULL, &vms, &nvms, NULL,
+                                VIR_CONNECT_LIST_DOMAINS_ACTIVE) < 0) {
+        virResetLastError();
+        return;
+    }
+
+    for (i = 0; i < nvms; i++) {
+        virDomainObjPtr vm = vms[i];
+        qemuDomainObjPrivatePtr priv;
+
+        virObjectLock(vm);
+        priv = vm->privateData;
+
+        if (!virDomainObjIsActive(vm) || !priv->perf)
+            goto next;
+
+        for (j = 0; j < VIR_PERF_EVENT_LAST; j++) {
+            if (virPerfEventIsEnabled(priv->perf, j))
+                break;
+        }
+
+        if (j < VIR_PERF_EVENT_LAST && virPerfSample(priv->perf) < 0) {
+            VIR_WARN("Unable to sample perf events of domain %s: %s",
+                     vm->def->name, virGetLastErrorMessage());
+            virResetLastError();
+        }
+
+     next:
+        virObjectUnlock(vm);
+    }
+
+    virObjectListFreeCount(vms, nvms);
+}
+
+
 /**
  * qemuStateInitialize:
  *
@@ -637,11 +934,22 @@ qemuStateInitialize(bool privileged,
         VIR_FREE(qemu_driver);
         return -1;
     }
+    virMutexSetClass(&qemu_driver->lock, virMutexClassGet("virQEMUDriver"));
+
+    if (virMutexInit(&qemu_driver->cleanupLock) < 0 ||
+        virCondInit(&qemu_driver->cleanupCond) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize cleanup lock"));
+        virMutexDestroy(&qemu_driver->lock);
+        VIR_FREE(qemu_driver);
+        return -1;
+    }
 
     qemu_driver->inhibitCallback = callback;
     qemu_driver->inhibitOpaque = opaque;
 
     qemu_driver->privileged = privileged;
+    qemu_driver->perfSampleTimer = -1;
 
     if (!(qemu_driver->domains = virDomainObjListNew()))
         goto error;
@@ -758,7 +1066,15 @@ qemuStateInitialize(bool privileged,
     if (!(qemu_driver->hostdevMgr = virHostdevManagerGetDefault()))
         goto error;
 
-    if (!(qemu_driver->sharedDevices = virHashCreate(30, qemuSharedDeviceEntryFree)))
+    if (privileged && cfg->nhostdevVFIOPool)
+        virHostdevBindPCIStubPool(qemu_driver->hostdevMgr,
+                                  cfg->hostdevVFIOPool,
+                                  cfg->nhostdevVFIOPool);
+
+    if (!(qemu_driver->hugepageLedger = virNumaPageLedgerNew()))
+        goto error;
+
+    if (!(qemu_driver->sharedDevices = virHashAtomicNew(30, qemuSharedDeviceEntryFree)))
         goto error;
 
     if (qemuMigrationErrorInit(qemu_driver) < 0)
@@ -895,6 +1211,7 @@ qemuStateInitialize(bool privileged,
     conn = virConnectOpen(cfg->uri);
 
     /* Then inactive persistent configs */
+    virDomainObjListSetLazyLoad(qemu_driver->domains, cfg->lazyInactiveDefs);
     if (virDomainObjListLoadAllConfigs(qemu_driver->domains,
                                        cfg->configDir,
                                        cfg->autostartDir, 0,
@@ -911,12 +1228,66 @@ qemuStateInitialize(bool privileged,
                             qemuDomainManagedSaveLoad,
                             qemu_driver);
 
+    /* Before reconnecting, which stops the domains found dead */
+    if (cfg->processCleanupWorkers > 0 &&
+        !(qemu_driver->cleanupPool = virThreadPoolNew(0, cfg->processCleanupWorkers,
+                                                      0, qemuProcessStopCleanupWorker,
+                                                      qemu_driver)))
+        goto error;
+
+    if (qemuProcessStopCleanupRecover(qemu_driver) < 0)
+        goto error;
+
+    if (cfg->reconnectWorkers > 0 &&
+        !(qemu_driver->reconnectPool = virThreadPoolNew(0, cfg->reconnectWorkers,
+                                                        0, qemuProcessReconnectWorker,
+                                                        qemu_driver)))
+        goto error;
+
     qemuProcessReconnectAll(conn, qemu_driver);
 
     qemu_driver->workerPool = virThreadPoolNew(0, 1, 0, qemuProcessEventHandler, qemu_driver);
     if (!qemu_driver->workerPool)
         goto error;
 
+    if (cfg->statsWorkers > 1) {
+        if (cfg->statsWorkersNuma) {
+            if (!(qemu_driver->statsNumaPools =
+                  virThreadPoolNumaNew(0, cfg->statsWorkers,
+                                       qemuDomainGetStatsBatchWorker,
+                                       qemu_driver)))
+                goto error;
+        } else if (!(qemu_driver->statsPool =
+                     virThreadPoolNew(0, cfg->statsWorkers, 0,
+                                      qemuDomainGetStatsBatchWorker,
+                                      qemu_driver))) {
+            goto error;
+        }
+    }
+
+    if (cfg->numaRebalanceInterval) {
+        if (!virNumaIsAvailable())
+            VIR_WARN("Ignoring numa_rebalance_interval, NUMA is not available "
+                     "on this host");
+        else if (!(qemu_driver->placement =
+                   qemuPlacementNew(qemu_driver, cfg->numaRebalanceInterval)))
+            goto error;
+    }
+
+    if (cfg->perfSampleInterval &&
+        (qemu_driver->perfSampleTimer =
+         virEventAddTimeout(cfg->perfSampleInterval * 1000,
+                            qemuDomainPerfSampleTimer,
+                            qemu_driver, NULL)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("unable to add perf sample timer"));
+        goto error;
+    }
+
+    if (cfg->hookAsync &&
+        virHookAsyncInitialize(cfg->hookAsyncMaxWorkers) < 0)
+        goto error;
+
     virObjectUnref(conn);
 
     virNWFilterRegisterCallbackDriver(&qemuCallbackDriver);
@@ -1060,11 +1431,25 @@ qemuStateCleanup(void)
         return -1;
 
     virNWFilterUnRegisterCallbackDriver(&qemuCallbackDriver);
+    if (qemu_driver->perfSampleTimer != -1)
+        virEventRemoveTimeout(qemu_driver->perfSampleTimer);
+    qemuPlacementFree(qemu_driver->placement);
     virThreadPoolFree(qemu_driver->workerPool);
+    virThreadPoolFree(qemu_driver->statsPool);
+    virThreadPoolNumaFree(qemu_driver->statsNumaPools);
+    virThreadPoolFree(qemu_driver->reconnectPool);
+    /* Cleanups still queued are recorded and finished on next start */
+    virThreadPoolFree(qemu_driver->cleanupPool);
+    VIR_FREE(qemu_driver->cleanups);
+    virMutexDestroy(&qemu_driver->cleanupLock);
+    virCondDestroy(&qemu_driver->cleanupCond);
     virObjectUnref(qemu_driver->config);
     virObjectUnref(qemu_driver->hostdevMgr);
-    virHashFree(qemu_driver->sharedDevices);
+    virObjectUnref(qemu_driver->hugepageLedger);
+    virObjectUnref(qemu_driver->sharedDevices);
     virObjectUnref(qemu_driver->caps);
+    VIR_FREE(qemu_driver->capsStamp);
+    VIR_FREE(qemu_driver->capsXML);
     virQEMUCapsCacheFree(qemu_driver->qemuCapsCache);
 
     virObjectUnref(qemu_driver->domains);
@@ -1284,21 +1669,11 @@ qemuConnectGetMaxVcpus(virConnectPtr conn ATTRIBUTE_UNUSED, const char *type)
 
 static char *qemuConnectGetCapabilities(virConnectPtr conn) {
     virQEMUDriverPtr driver = conn->privateData;
-    virCapsPtr caps = NULL;
-    char *xml = NULL;
 
     if (virConnectGetCapabilitiesEnsureACL(conn) < 0)
         return NULL;
 
-    if (!(caps = virQEMUDriverGetCapabilities(driver, true)))
-        goto cleanup;
-
-    xml = virCapabilitiesFormatXML(caps);
-    virObjectUnref(caps);
-
- cleanup:
-
-    return xml;
+    return virQEMUDriverGetCapabilitiesXML(driver);
 }
 
 
@@ -1446,7 +1821,8 @@ qemuDomainHelperGetVcpus(virDomainObjPtr vm,
                          int maxinfo,
                          unsigned char *cpumaps,
                          int maplen,
-                         bool *cpuhalted)
+                         bool *cpuhalted,
+                         virProcessSchedStatPtr schedstats)
 {
     size_t ncpuinfo = 0;
     size_t i;
@@ -1481,9 +1857,13 @@ qemuDomainHelperGetVcpus(virDomainObjPtr vm,
             vcpuinfo->number = i;
             vcpuinfo->state = VIR_VCPU_RUNNING;
 
-            if (qemuGetProcessInfo(&vcpuinfo->cpuTime,
-                                   &vcpuinfo->cpu, NULL,
-                                   vm->pid, vcpupid) < 0) {
+            /* the batched statistics don't tell the pCPU, but save
+             * reading the stat file of every vCPU thread */
+            if (schedstats)
+                vcpuinfo->cpuTime = schedstats[ncpuinfo].runTime;
+            else if (qemuGetProcessInfo(&vcpuinfo->cpuTime,
+                                        &vcpuinfo->cpu, NULL,
+                                        vm->pid, vcpupid) < 0) {
                 virReportSystemError(errno, "%s",
                                      _("cannot get vCPU placement & pCPU time"));
                 return -1;
@@ -1516,6 +1896,41 @@ qemuDomainHelperGetVcpus(virDomainObjPtr vm,
 }
 
 
+/**
+ * qemuDomainHelperGetVcpuSchedStats:
+ * @vm: domain object
+ * @schedstats: array of at least @maxinfo elements
+ * @maxinfo: maximum number of vCPUs to fill in
+ *
+ * Fetch the scheduler statistics of the threads of online vCPUs in one
+ * go, in the order qemuDomainHelperGetVcpus() reports the vCPUs.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+qemuDomainHelperGetVcpuSchedStats(virDomainObjPtr vm,
+                                  virProcessSchedStatPtr schedstats,
+                                  size_t maxinfo)
+{
+    size_t nstats = 0;
+    size_t i;
+
+    if (!qemuDomainHasVcpuPids(vm))
+        return -1;
+
+    for (i = 0; i < virDomainDefGetVcpusMax(vm->def) && nstats < maxinfo; i++) {
+        virDomainVcpuDefPtr vcpu = virDomainDefGetVcpu(vm->def, i);
+
+        if (!vcpu->online)
+            continue;
+
+        schedstats[nstats++].tid = qemuDomainGetVcpuPid(vm, i);
+    }
+
+    return virProcessGetSchedStats(vm->pid, schedstats, nstats);
+}
+
+
 static virDomainPtr qemuDomainLookupByID(virConnectPtr conn,
                                          int id)
 {
@@ -1818,7 +2233,6 @@ static int qemuDomainSuspend(virDomainPtr dom)
     virDomainPausedReason reason;
     int eventDetail;
     int state;
-    virQEMUDriverConfigPtr cfg = NULL;
 
     if (!(vm = qemuDomObjFromDomain(dom)))
         return -1;
@@ -1826,7 +2240,6 @@ static int qemuDomainSuspend(virDomainPtr dom)
     if (virDomainSuspendEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    cfg = virQEMUDriverGetConfig(driver);
     priv = vm->privateData;
 
     if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_SUSPEND) < 0)
@@ -1864,7 +2277,7 @@ static int qemuDomainSuspend(virDomainPtr dom)
                                              eventDetail);
         }
     }
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         goto endjob;
     ret = 0;
 
@@ -1875,7 +2288,6 @@ static int qemuDomainSuspend(virDomainPtr dom)
     virDomainObjEndAPI(&vm);
 
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
     return ret;
 }
 
@@ -1888,13 +2300,10 @@ static int qemuDomainResume(virDomainPtr dom)
     virObjectEventPtr event = NULL;
     int state;
     int reason;
-    virQEMUDriverConfigPtr cfg = NULL;
 
     if (!(vm = qemuDomObjFromDomain(dom)))
         return -1;
 
-    cfg = virQEMUDriverGetConfig(driver);
-
     if (virDomainResumeEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
@@ -1931,7 +2340,7 @@ static int qemuDomainResume(virDomainPtr dom)
                                          VIR_DOMAIN_EVENT_RESUMED,
                                          VIR_DOMAIN_EVENT_RESUMED_UNPAUSED);
     }
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         goto endjob;
     ret = 0;
 
@@ -1941,7 +2350,6 @@ static int qemuDomainResume(virDomainPtr dom)
  cleanup:
     virDomainObjEndAPI(&vm);
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
     return ret;
 }
 
@@ -2474,7 +2882,10 @@ static int qemuDomainSetMemoryStatsPeriod(virDomainPtr dom, int period,
         }
 
         def->memballoon->period = period;
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
+            goto endjob;
+
+        if (qemuProcessSetupBalloonStats(driver, vm) < 0)
             goto endjob;
     }
 
@@ -2714,6 +3125,9 @@ qemuDomainGetControlInfo(virDomainPtr dom,
     if (priv->monError) {
         info->state = VIR_DOMAIN_CONTROL_ERROR;
         info->details = VIR_DOMAIN_CONTROL_ERROR_REASON_MONITOR;
+    } else if (priv->reconnecting) {
+        /* libvirtd has not reconnected to the monitor yet */
+        info->state = VIR_DOMAIN_CONTROL_OCCUPIED;
     } else if (priv->job.active) {
         if (virTimeMillisNow(&info->stateTime) < 0)
             goto cleanup;
@@ -2765,6 +3179,7 @@ typedef enum {
      */
     QEMU_SAVE_FORMAT_XZ = 3,
     QEMU_SAVE_FORMAT_LZOP = 4,
+    QEMU_SAVE_FORMAT_ZSTD = 5,
     /* Note: add new members only at the end.
        These values are used in the on-disk format.
        Do not change or re-use numbers. */
@@ -2778,7 +3193,8 @@ VIR_ENUM_IMPL(qemuSaveCompression, QEMU_SAVE_FORMAT_LAST,
               "gzip",
               "bzip2",
               "xz",
-              "lzop")
+              "lzop",
+              "zstd")
 
 VIR_ENUM_DECL(qemuDumpFormat)
 VIR_ENUM_IMPL(qemuDumpFormat, VIR_DOMAIN_CORE_DUMP_FORMAT_LAST,
@@ -2834,30 +3250,69 @@ qemuDomainSaveHeader(int fd, const char *path, const char *xml,
 }
 
 
+/* pigz writes the same format as gzip using all CPUs, so use it for
+ * gzip images whenever it is installed */
+static char *
+qemuCompressFindProgram(virQEMUSaveFormat compression)
+{
+    char *path;
+
+    if (compression == QEMU_SAVE_FORMAT_GZIP &&
+        (path = virFindFileInPath("pigz")))
+        return path;
+
+    return virFindFileInPath(qemuSaveCompressionTypeToString(compression));
+}
+
+
+/**
+ * qemuCompressGetCommand:
+ * @compression: format of the image
+ * @prog: the program to run or NULL to look for one
+ * @decompress: whether to decompress or compress the image
+ *
+ * Returns the command filtering a save image from its stdin to stdout.
+ */
 static virCommandPtr
-qemuCompressGetCommand(virQEMUSaveFormat compression)
+qemuCompressGetCommand(virQEMUSaveFormat compression,
+                       const char *prog,
+                       bool decompress)
 {
     virCommandPtr ret = NULL;
-    const char *prog = qemuSaveCompressionTypeToString(compression);
+    char *path = NULL;
 
-    if (!prog) {
+    if (!qemuSaveCompressionTypeToString(compression)) {
         virReportError(VIR_ERR_OPERATION_FAILED,
                        _("Invalid compressed save format %d"),
                        compression);
         return NULL;
     }
 
+    if (!prog) {
+        if (!(path = qemuCompressFindProgram(compression)))
+            prog = qemuSaveCompressionTypeToString(compression);
+        else
+            prog = path;
+    }
+
     ret = virCommandNew(prog);
-    virCommandAddArg(ret, "-dc");
+    virCommandAddArg(ret, decompress ? "-dc" : "-c");
 
     switch (compression) {
     case QEMU_SAVE_FORMAT_LZOP:
-        virCommandAddArg(ret, "--ignore-warn");
+        if (decompress)
+            virCommandAddArg(ret, "--ignore-warn");
+        break;
+    case QEMU_SAVE_FORMAT_ZSTD:
+        /* zstd is single threaded unless told otherwise */
+        if (!decompress)
+            virCommandAddArg(ret, "-T0");
         break;
     default:
         break;
     }
 
+    VIR_FREE(path);
     return ret;
 }
 
@@ -3042,8 +3497,10 @@ qemuDomainSaveMemory(virQEMUDriverPtr driver,
     int ret = -1;
     int fd = -1;
     int directFlag = 0;
+    virCommandPtr compressor = NULL;
     virFileWrapperFdPtr wrapperFd = NULL;
     unsigned int wrapperFlags = VIR_FILE_WRAPPER_NON_BLOCKING;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     memset(&header, 0, sizeof(header));
     memcpy(header.magic, QEMU_SAVE_PARTIAL, sizeof(header.magic));
@@ -3071,7 +3528,10 @@ qemuDomainSaveMemory(virQEMUDriverPtr driver,
     if (qemuSecuritySetImageFDLabel(driver->securityManager, vm->def, fd) < 0)
         goto cleanup;
 
-    if (!(wrapperFd = virFileWrapperFdNew(&fd, path, wrapperFlags)))
+    if (!(wrapperFd = virFileWrapperFdNew(&fd, path,
+                                          cfg->saveBufferSize * 1024,
+                                          cfg->saveBuffers,
+                                          wrapperFlags)))
         goto cleanup;
 
     /* Write header to file, followed by XML */
@@ -3079,7 +3539,12 @@ qemuDomainSaveMemory(virQEMUDriverPtr driver,
         goto cleanup;
 
     /* Perform the migration */
-    if (qemuMigrationToFile(driver, vm, fd, compressedpath, asyncJob) < 0)
+    if (compressedpath &&
+        !(compressor = qemuCompressGetCommand(compressed, compressedpath,
+                                              false)))
+        goto cleanup;
+
+    if (qemuMigrationToFile(driver, vm, fd, compressor, asyncJob) < 0)
         goto cleanup;
 
     /* Touch up file header to mark image complete. */
@@ -3115,7 +3580,9 @@ qemuDomainSaveMemory(virQEMUDriverPtr driver,
 
  cleanup:
     VIR_FORCE_CLOSE(fd);
+    virCommandFree(compressor);
     virFileWrapperFdFree(wrapperFd);
+    virObjectUnref(cfg);
 
     if (ret < 0 && needUnlink)
         unlink(path);
@@ -3283,7 +3750,7 @@ qemuGetCompressionProgram(const char *imageFormat,
     if (ret == QEMU_SAVE_FORMAT_RAW)
         return QEMU_SAVE_FORMAT_RAW;
 
-    if (!(*compresspath = virFindFileInPath(imageFormat)))
+    if (!(*compresspath = qemuCompressFindProgram(ret)))
         goto error;
 
     return ret;
@@ -3520,11 +3987,99 @@ qemuDomainManagedSaveRemove(virDomainPtr dom, unsigned int flags)
     return ret;
 }
 
+#define QEMU_DUMP_POLL_INTERVAL 1000 /* ms */
+
+static void
+qemuDumpUpdateJobInfo(qemuDomainJobInfoPtr jobInfo,
+                      qemuMonitorDumpStatsPtr stats)
+{
+    jobInfo->stats.ram_total = stats->total;
+    jobInfo->stats.ram_transferred = stats->completed;
+    jobInfo->stats.ram_remaining = stats->total - stats->completed;
+}
+
+
+/**
+ * qemuDumpWaitForCompletion:
+ *
+ * Waits for a detached dump-guest-memory to finish. Progress reported by
+ * query-dump is stored in the current job so that it can be watched by
+ * virDomainGetJobInfo while the dump runs in the background in QEMU.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+qemuDumpWaitForCompletion(virQEMUDriverPtr driver,
+                          virDomainObjPtr vm,
+                          qemuDomainAsyncJob asyncJob)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuMonitorDumpStats stats;
+    unsigned long long now;
+    int rc;
+
+    while (!priv->job.dumpCompleted) {
+        if (virTimeMillisNow(&now) < 0)
+            return -1;
+
+        if ((rc = virDomainObjWaitUntil(vm, now + QEMU_DUMP_POLL_INTERVAL)) < 0)
+            return -1;
+
+        if (!virDomainObjIsActive(vm)) {
+            virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                           _("domain is not running"));
+            return -1;
+        }
+
+        if (rc == 0 || priv->job.dumpCompleted)
+            continue;
+
+        memset(&stats, 0, sizeof(stats));
+        if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+            return -1;
+        rc = qemuMonitorQueryDump(priv->mon, &stats);
+        if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
+            return -1;
+
+        qemuDumpUpdateJobInfo(priv->job.current, &stats);
+
+        if (stats.status == QEMU_MONITOR_DUMP_STATUS_COMPLETED ||
+            stats.status == QEMU_MONITOR_DUMP_STATUS_FAILED) {
+            /* The event got lost, e.g. because libvirtd was reconnecting
+             * to the monitor; the final state is good enough. */
+            priv->job.dumpCompleted = true;
+            if (stats.status == QEMU_MONITOR_DUMP_STATUS_FAILED &&
+                !priv->job.dumpError &&
+                VIR_STRDUP(priv->job.dumpError, _("unknown error")) < 0)
+                return -1;
+        }
+    }
+
+    if (priv->job.dumpError) {
+        virReportError(VIR_ERR_OPERATION_FAILED,
+                       _("memory-only dump failed: %s"),
+                       priv->job.dumpError);
+        return -1;
+    }
+
+    if (qemuDomainJobInfoUpdateTime(priv->job.current) < 0)
+        return -1;
+
+    priv->job.current->type = VIR_DOMAIN_JOB_COMPLETED;
+    VIR_FREE(priv->job.completed);
+    if (VIR_ALLOC(priv->job.completed) == 0)
+        *priv->job.completed = *priv->job.current;
+
+    return 0;
+}
+
+
 static int qemuDumpToFd(virQEMUDriverPtr driver, virDomainObjPtr vm,
                         int fd, qemuDomainAsyncJob asyncJob,
                         const char *dumpformat)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
+    bool detach = virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_DUMP_COMPLETED);
     int ret = -1;
 
     if (!virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_DUMP_GUEST_MEMORY)) {
@@ -3536,7 +4091,12 @@ static int qemuDumpToFd(virQEMUDriverPtr driver, virDomainObjPtr vm,
     if (qemuSecuritySetImageFDLabel(driver->securityManager, vm->def, fd) < 0)
         return -1;
 
-    VIR_FREE(priv->job.current);
+    /* With a detached dump QEMU reports the progress which we put into the
+     * current job; otherwise there's nothing to report while it runs. */
+    if (detach)
+        priv->job.current->type = VIR_DOMAIN_JOB_UNBOUNDED;
+    else
+        VIR_FREE(priv->job.current);
     priv->job.dump_memory_only = true;
 
     if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
@@ -3555,10 +4115,14 @@ static int qemuDumpToFd(virQEMUDriverPtr driver, virDomainObjPtr vm,
         }
     }
 
-    ret = qemuMonitorDumpToFd(priv->mon, fd, dumpformat);
+    ret = qemuMonitorDumpToFd(priv->mon, fd, dumpformat, detach);
 
  cleanup:
-    ignore_value(qemuDomainObjExitMonitor(driver, vm));
+    if (qemuDomainObjExitMonitor(driver, vm) < 0)
+        ret = -1;
+
+    if (ret == 0 && detach)
+        ret = qemuDumpWaitForCompletion(driver, vm, asyncJob);
 
     return ret;
 }
@@ -3578,14 +4142,15 @@ doCoreDump(virQEMUDriverPtr driver,
     const char *memory_dump_format = NULL;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     char *compressedpath = NULL;
+    virCommandPtr compressor = NULL;
+    int compress;
 
     /* We reuse "save" flag for "dump" here. Then, we can support the same
      * format in "save" and "dump". This path doesn't need the compression
-     * program to exist and can ignore the return value - it only cares to
-     * get the compressedpath */
-    ignore_value(qemuGetCompressionProgram(cfg->dumpImageFormat,
-                                           &compressedpath,
-                                           "dump", true));
+     * program to exist and falls back to raw */
+    compress = qemuGetCompressionProgram(cfg->dumpImageFormat,
+                                         &compressedpath,
+                                         "dump", true);
 
     /* Create an empty file with appropriate ownership.  */
     if (dump_flags & VIR_DUMP_BYPASS_CACHE) {
@@ -3605,7 +4170,10 @@ doCoreDump(virQEMUDriverPtr driver,
                            NULL, NULL)) < 0)
         goto cleanup;
 
-    if (!(wrapperFd = virFileWrapperFdNew(&fd, path, flags)))
+    if (!(wrapperFd = virFileWrapperFdNew(&fd, path,
+                                          cfg->saveBufferSize * 1024,
+                                          cfg->saveBuffers,
+                                          flags)))
         goto cleanup;
 
     if (dump_flags & VIR_DUMP_MEMORY_ONLY) {
@@ -3632,7 +4200,12 @@ doCoreDump(virQEMUDriverPtr driver,
         if (!qemuMigrationIsAllowed(driver, vm, false, 0))
             goto cleanup;
 
-        ret = qemuMigrationToFile(driver, vm, fd, compressedpath,
+        if (compressedpath &&
+            !(compressor = qemuCompressGetCommand(compress, compressedpath,
+                                                  false)))
+            goto cleanup;
+
+        ret = qemuMigrationToFile(driver, vm, fd, compressor,
                                   QEMU_ASYNC_JOB_DUMP);
     }
 
@@ -3655,6 +4228,7 @@ doCoreDump(virQEMUDriverPtr driver,
     if (ret != 0)
         unlink(path);
     virFileWrapperFdFree(wrapperFd);
+    virCommandFree(compressor);
     VIR_FREE(compressedpath);
     virObjectUnref(cfg);
     return ret;
@@ -3991,7 +4565,6 @@ processGuestPanicEvent(virQEMUDriverPtr driver,
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
     virObjectEventPtr event = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     bool removeInactive = false;
 
     if (qemuDomainObjBeginAsyncJob(driver, vm, QEMU_ASYNC_JOB_DUMP) < 0)
@@ -4014,7 +4587,7 @@ processGuestPanicEvent(virQEMUDriverPtr driver,
 
     qemuDomainEventQueue(driver, event);
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+    if (qemuDomainSaveStatus(driver, vm) < 0) {
         VIR_WARN("Unable to save status on vm %s after state change",
                  vm->def->name);
     }
@@ -4064,7 +4637,6 @@ processGuestPanicEvent(virQEMUDriverPtr driver,
         qemuDomainRemoveInactive(driver, vm);
 
  cleanup:
-    virObjectUnref(cfg);
 }
 
 
@@ -4073,7 +4645,6 @@ processDeviceDeletedEvent(virQEMUDriverPtr driver,
                           virDomainObjPtr vm,
                           char *devAlias)
 {
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     virDomainDeviceDef dev;
 
     VIR_DEBUG("Removing device %s from domain %p %s",
@@ -4097,7 +4668,7 @@ processDeviceDeletedEvent(virQEMUDriverPtr driver,
             goto endjob;
     }
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         VIR_WARN("unable to save domain status after removing device %s",
                  devAlias);
 
@@ -4106,7 +4677,6 @@ processDeviceDeletedEvent(virQEMUDriverPtr driver,
 
  cleanup:
     VIR_FREE(devAlias);
-    virObjectUnref(cfg);
 }
 
 
@@ -4413,7 +4983,6 @@ processSerialChangedEvent(virQEMUDriverPtr driver,
                           char *devAlias,
                           bool connected)
 {
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     virDomainChrDeviceState newstate;
     virObjectEventPtr event = NULL;
     virDomainDeviceDef dev;
@@ -4464,7 +5033,7 @@ processSerialChangedEvent(virQEMUDriverPtr driver,
 
     dev.data.chr->state = newstate;
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         VIR_WARN("unable to save status of domain %s after updating state of "
                  "channel %s", vm->def->name, devAlias);
 
@@ -4490,7 +5059,6 @@ processSerialChangedEvent(virQEMUDriverPtr driver,
 
  cleanup:
     VIR_FREE(devAlias);
-    virObjectUnref(cfg);
 
 }
 
@@ -4522,6 +5090,57 @@ processBlockJobEvent(virQEMUDriverPtr driver,
 }
 
 
+/*
+ * Refresh the guest memory statistics of the balloon cached in the
+ * private data of @vm, see qemuProcessQueueBalloonStats. Called from the
+ * worker pool with @vm locked.
+ */
+static void
+processBalloonStatsEvent(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virDomainMemoryStatStruct stats[VIR_DOMAIN_MEMORY_STAT_NR];
+    int nstats;
+
+    priv->balloonStatsPending = false;
+
+    if (qemuDomainObjBeginSharedJob(driver, vm, cfg->statsJobTimeout) < 0) {
+        /* The timer or the next BALLOON_CHANGE will try again */
+        VIR_DEBUG("Skipping balloon stats refresh of domain %s: %s",
+                  vm->def->name, virGetLastErrorMessage());
+        virResetLastError();
+        goto cleanup;
+    }
+
+    if (!virDomainObjIsActive(vm) || !vm->def->memballoon)
+        goto endjob;
+
+    qemuDomainObjEnterMonitor(driver, vm);
+    nstats = qemuMonitorGetMemoryStats(priv->mon, vm->def->memballoon,
+                                       stats, VIR_DOMAIN_MEMORY_STAT_NR);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0)
+        nstats = -1;
+
+    if (nstats < 0) {
+        VIR_DEBUG("Unable to refresh balloon stats of domain %s: %s",
+                  vm->def->name, virGetLastErrorMessage());
+        virResetLastError();
+        goto endjob;
+    }
+
+    memcpy(priv->balloonStats, stats, sizeof(stats[0]) * nstats);
+    priv->nballoonStats = nstats;
+
+ endjob:
+    qemuDomainObjEndJob(driver, vm);
+
+ cleanup:
+    virObjectUnref(cfg);
+}
+
+
 static void
 processMonitorEOFEvent(virQEMUDriverPtr driver,
                        virDomainObjPtr vm)
@@ -4605,6 +5224,12 @@ static void qemuProcessEventHandler(void *data, void *opaque)
     case QEMU_PROCESS_EVENT_MONITOR_EOF:
         processMonitorEOFEvent(driver, vm);
         break;
+    case QEMU_PROCESS_EVENT_STATS:
+        processStatsEvent(driver, vm);
+        break;
+    case QEMU_PROCESS_EVENT_BALLOON_STATS:
+        processBalloonStatsEvent(driver, vm);
+        break;
     case QEMU_PROCESS_EVENT_LAST:
         break;
     }
@@ -4819,7 +5444,7 @@ qemuDomainPinVcpuLive(virDomainObjPtr vm,
     vcpuinfo->cpumask = tmpmap;
     tmpmap = NULL;
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         goto cleanup;
 
     if (snprintf(paramField, VIR_TYPED_PARAM_FIELD_LENGTH,
@@ -5044,7 +5669,7 @@ qemuDomainPinEmulator(virDomainPtr dom,
         if (!(def->cputune.emulatorpin = virBitmapNewCopy(pcpumap)))
             goto endjob;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
             goto endjob;
 
         str = virBitmapFormat(pcpumap);
@@ -5164,7 +5789,7 @@ qemuDomainGetVcpus(virDomainPtr dom,
     }
 
     ret = qemuDomainHelperGetVcpus(vm, info, NULL, maxinfo, cpumaps, maplen,
-                                   NULL);
+                                   NULL, NULL);
 
  cleanup:
     virDomainObjEndAPI(&vm);
@@ -5514,7 +6139,7 @@ qemuDomainPinIOThread(virDomainPtr dom,
         if (virProcessSetAffinity(iothrid->thread_id, pcpumap) < 0)
             goto endjob;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
             goto endjob;
 
         if (snprintf(paramField, VIR_TYPED_PARAM_FIELD_LENGTH,
@@ -5814,7 +6439,7 @@ qemuDomainChgIOThread(virQEMUDriverPtr driver,
                 goto endjob;
         }
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
             goto endjob;
     }
 
@@ -6188,10 +6813,21 @@ qemuDomainSaveImageOpen(virQEMUDriverPtr driver,
 
     if ((fd = qemuOpenFile(driver, NULL, path, oflags, NULL, NULL)) < 0)
         goto error;
-    if (bypass_cache &&
-        !(*wrapperFd = virFileWrapperFdNew(&fd, path,
-                                           VIR_FILE_WRAPPER_BYPASS_CACHE)))
-        goto error;
+    if (bypass_cache) {
+        virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+
+        *wrapperFd = virFileWrapperFdNew(&fd, path,
+                                         cfg->saveBufferSize * 1024,
+                                         cfg->saveBuffers,
+                                         VIR_FILE_WRAPPER_BYPASS_CACHE);
+        virObjectUnref(cfg);
+        if (!*wrapperFd)
+            goto error;
+    } else {
+        /* QEMU reads the image in small chunks, have the kernel read
+         * further ahead for it */
+        virFileAdviseSequential(fd);
+    }
 
     if (saferead(fd, &header, sizeof(header)) != sizeof(header)) {
         if (unlink_corrupt) {
@@ -6298,11 +6934,10 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
     int intermediatefd = -1;
     virCommandPtr cmd = NULL;
     char *errbuf = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     if ((header->version == 2) &&
         (header->compressed != QEMU_SAVE_FORMAT_RAW)) {
-        if (!(cmd = qemuCompressGetCommand(header->compressed)))
+        if (!(cmd = qemuCompressGetCommand(header->compressed, NULL, true)))
             goto cleanup;
 
         intermediatefd = *fd;
@@ -6373,7 +7008,7 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
                                "%s", _("failed to resume domain"));
             goto cleanup;
         }
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainSaveStatus(driver, vm) < 0) {
             VIR_WARN("Failed to save status on vm %s", vm->def->name);
             goto cleanup;
         }
@@ -6394,7 +7029,6 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
     if (qemuSecurityRestoreSavedStateLabel(driver->securityManager,
                                            vm->def, path) < 0)
         VIR_WARN("failed to restore save state label on %s", path);
-    virObjectUnref(cfg);
     return ret;
 }
 
@@ -7247,6 +7881,7 @@ qemuDomainAttachDeviceLive(virDomainObjPtr vm,
     switch ((virDomainDeviceType) dev->type) {
     case VIR_DOMAIN_DEVICE_DISK:
         qemuDomainObjCheckDiskTaint(driver, vm, dev->data.disk, NULL);
+        qemuProcessStopCleanupWaitDevice(driver, vm, dev);
         ret = qemuDomainAttachDeviceDiskLive(conn, driver, vm, dev);
         if (!ret) {
             alias = dev->data.disk->info.alias;
@@ -7280,6 +7915,7 @@ qemuDomainAttachDeviceLive(virDomainObjPtr vm,
 
     case VIR_DOMAIN_DEVICE_HOSTDEV:
         qemuDomainObjCheckHostdevTaint(driver, vm, dev->data.hostdev, NULL);
+        qemuProcessStopCleanupWaitDevice(driver, vm, dev);
         ret = qemuDomainAttachHostDevice(conn, driver, vm,
                                          dev->data.hostdev);
         if (!ret) {
@@ -7526,6 +8162,7 @@ qemuDomainUpdateDeviceLive(virConnectPtr conn,
     switch ((virDomainDeviceType) dev->type) {
     case VIR_DOMAIN_DEVICE_DISK:
         qemuDomainObjCheckDiskTaint(driver, vm, dev->data.disk, NULL);
+        qemuProcessStopCleanupWaitDevice(driver, vm, dev);
         ret = qemuDomainChangeDiskLive(conn, vm, dev, driver, force);
         break;
     case VIR_DOMAIN_DEVICE_GRAPHICS:
@@ -7996,16 +8633,21 @@ qemuDomainUpdateDeviceConfig(virDomainDefPtr vmdef,
     return 0;
 }
 
+/* Attach the @nxmls devices described by @xmls in order. The domain
+ * status and config are saved only once, after all of them have been
+ * processed. */
 static int
 qemuDomainAttachDeviceLiveAndConfig(virConnectPtr conn,
                                     virDomainObjPtr vm,
                                     virQEMUDriverPtr driver,
-                                    const char *xml,
+                                    const char **xmls,
+                                    size_t nxmls,
                                     unsigned int flags)
 {
     virDomainDefPtr vmdef = NULL;
     virQEMUDriverConfigPtr cfg = NULL;
-    virDomainDeviceDefPtr dev = NULL, dev_copy = NULL;
+    virDomainDeviceDefPtr *devs = NULL, *dev_copies = NULL;
+    size_t i;
     int ret = -1;
     virCapsPtr caps = NULL;
     unsigned int parse_flags = VIR_DOMAIN_DEF_PARSE_INACTIVE |
@@ -8019,21 +8661,30 @@ qemuDomainAttachDeviceLiveAndConfig(virConnectPtr conn,
     if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
         goto cleanup;
 
-    dev = dev_copy = virDomainDeviceDefParse(xml, vm->def,
-                                             caps, driver->xmlopt,
-                                             parse_flags);
-    if (dev == NULL)
+    if (VIR_ALLOC_N(devs, nxmls) < 0 ||
+        VIR_ALLOC_N(dev_copies, nxmls) < 0)
         goto cleanup;
 
-    if (flags & VIR_DOMAIN_AFFECT_CONFIG &&
-        flags & VIR_DOMAIN_AFFECT_LIVE) {
-        /* If we are affecting both CONFIG and LIVE
-         * create a deep copy of device as adding
-         * to CONFIG takes one instance.
-         */
-        dev_copy = virDomainDeviceDefCopy(dev, vm->def, caps, driver->xmlopt);
-        if (!dev_copy)
+    /* Parse everything first so that a typo in one of the devices
+     * doesn't leave the others half attached. */
+    for (i = 0; i < nxmls; i++) {
+        devs[i] = dev_copies[i] = virDomainDeviceDefParse(xmls[i], vm->def,
+                                                          caps, driver->xmlopt,
+                                                          parse_flags);
+        if (devs[i] == NULL)
             goto cleanup;
+
+        if (flags & VIR_DOMAIN_AFFECT_CONFIG &&
+            flags & VIR_DOMAIN_AFFECT_LIVE) {
+            /* If we are affecting both CONFIG and LIVE
+             * create a deep copy of device as adding
+             * to CONFIG takes one instance.
+             */
+            dev_copies[i] = virDomainDeviceDefCopy(devs[i], vm->def, caps,
+                                                   driver->xmlopt);
+            if (!dev_copies[i])
+                goto cleanup;
+        }
     }
 
     if (flags & VIR_DOMAIN_AFFECT_CONFIG) {
@@ -8042,47 +8693,56 @@ qemuDomainAttachDeviceLiveAndConfig(virConnectPtr conn,
         if (!vmdef)
             goto cleanup;
 
-        if (virDomainDefCompatibleDevice(vmdef, dev,
-                                         VIR_DOMAIN_DEVICE_ACTION_ATTACH) < 0)
-            goto cleanup;
-        if ((ret = qemuDomainAttachDeviceConfig(vmdef, dev, conn, caps,
-                                                parse_flags,
-                                                driver->xmlopt)) < 0)
-            goto cleanup;
+        for (i = 0; i < nxmls; i++) {
+            if (virDomainDefCompatibleDevice(vmdef, devs[i],
+                                             VIR_DOMAIN_DEVICE_ACTION_ATTACH) < 0)
+                goto cleanup;
+            if (qemuDomainAttachDeviceConfig(vmdef, devs[i], conn, caps,
+                                             parse_flags,
+                                             driver->xmlopt) < 0)
+                goto cleanup;
+        }
     }
 
     if (flags & VIR_DOMAIN_AFFECT_LIVE) {
-        if (virDomainDefCompatibleDevice(vm->def, dev_copy,
-                                         VIR_DOMAIN_DEVICE_ACTION_ATTACH) < 0)
-            goto cleanup;
+        for (i = 0; i < nxmls; i++) {
+            if (virDomainDefCompatibleDevice(vm->def, dev_copies[i],
+                                             VIR_DOMAIN_DEVICE_ACTION_ATTACH) < 0)
+                break;
 
-        if ((ret = qemuDomainAttachDeviceLive(vm, dev_copy, conn, driver)) < 0)
-            goto cleanup;
+            if (qemuDomainAttachDeviceLive(vm, dev_copies[i], conn, driver) < 0)
+                break;
+        }
         /*
          * update domain status forcibly because the domain status may be
          * changed even if we failed to attach the device. For example,
          * a new controller may be created.
          */
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
-            ret = -1;
+        if (qemuDomainSaveStatus(driver, vm) < 0 || i < nxmls)
             goto cleanup;
-        }
     }
 
     /* Finally, if no error until here, we can save config. */
     if (flags & VIR_DOMAIN_AFFECT_CONFIG) {
-        ret = virDomainSaveConfig(cfg->configDir, driver->caps, vmdef);
-        if (!ret) {
-            virDomainObjAssignDef(vm, vmdef, false, NULL);
-            vmdef = NULL;
-        }
+        if (virDomainSaveConfig(cfg->configDir, driver->caps, vmdef) < 0)
+            goto cleanup;
+
+        virDomainObjAssignDef(vm, vmdef, false, NULL);
+        vmdef = NULL;
     }
 
+    ret = 0;
+
  cleanup:
     virDomainDefFree(vmdef);
-    if (dev != dev_copy)
-        virDomainDeviceDefFree(dev_copy);
-    virDomainDeviceDefFree(dev);
+    for (i = 0; i < nxmls; i++) {
+        if (devs && dev_copies && devs[i] != dev_copies[i])
+            virDomainDeviceDefFree(dev_copies[i]);
+        if (devs)
+            virDomainDeviceDefFree(devs[i]);
+    }
+    VIR_FREE(dev_copies);
+    VIR_FREE(devs);
     virObjectUnref(cfg);
     virObjectUnref(caps);
 
@@ -8112,7 +8772,47 @@ qemuDomainAttachDeviceFlags(virDomainPtr dom,
     if (virDomainObjUpdateModificationImpact(vm, &flags) < 0)
         goto endjob;
 
-    if (qemuDomainAttachDeviceLiveAndConfig(dom->conn, vm, driver, xml, flags) < 0)
+    if (qemuDomainAttachDeviceLiveAndConfig(dom->conn, vm, driver,
+                                            &xml, 1, flags) < 0)
+        goto endjob;
+
+    ret = 0;
+
+ endjob:
+    qemuDomainObjEndJob(driver, vm);
+
+ cleanup:
+    virDomainObjEndAPI(&vm);
+    virNWFilterUnlockFilterUpdates();
+    return ret;
+}
+
+static int
+qemuDomainAttachDevices(virDomainPtr dom,
+                        const char **xmls,
+                        unsigned int ndevices,
+                        unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virDomainObjPtr vm = NULL;
+    int ret = -1;
+
+    virNWFilterReadLockFilterUpdates();
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
+
+    if (virDomainAttachDevicesEnsureACL(dom->conn, vm->def, flags) < 0)
+        goto cleanup;
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+        goto cleanup;
+
+    if (virDomainObjUpdateModificationImpact(vm, &flags) < 0)
+        goto endjob;
+
+    if (qemuDomainAttachDeviceLiveAndConfig(dom->conn, vm, driver,
+                                            xmls, ndevices, flags) < 0)
         goto endjob;
 
     ret = 0;
@@ -8225,7 +8925,7 @@ static int qemuDomainUpdateDeviceFlags(virDomainPtr dom,
          * changed even if we failed to attach the device. For example,
          * a new controller may be created.
          */
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainSaveStatus(driver, vm) < 0) {
             ret = -1;
             goto endjob;
         }
@@ -8326,7 +9026,7 @@ qemuDomainDetachDeviceLiveAndConfig(virQEMUDriverPtr driver,
          * changed even if we failed to attach the device. For example,
          * a new controller may be created.
          */
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainSaveStatus(driver, vm) < 0) {
             ret = -1;
             goto cleanup;
         }
@@ -8886,7 +9586,7 @@ qemuDomainSetBlkioParameters(virDomainPtr dom,
             }
         }
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
             goto endjob;
     }
     if (ret < 0)
@@ -9152,7 +9852,7 @@ qemuDomainSetMemoryParameters(virDomainPtr dom,
 #undef VIR_SET_MEM_PARAMETER
 
     if (def &&
-        virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        qemuDomainSaveStatus(driver, vm) < 0)
         goto endjob;
 
     if (persistentDef &&
@@ -9421,7 +10121,7 @@ qemuDomainSetNumaParameters(virDomainPtr dom,
                                  -1, mode, nodeset) < 0)
             goto endjob;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
             goto endjob;
     }
 
@@ -9612,7 +10312,7 @@ qemuDomainSetPerfEvents(virDomainPtr dom,
                 VIR_TRISTATE_BOOL_YES : VIR_TRISTATE_BOOL_NO;
         }
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
             goto endjob;
     }
 
@@ -10091,7 +10791,7 @@ qemuDomainSetSchedulerParametersFlags(virDomainPtr dom,
         }
     }
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         goto endjob;
 
     if (eventNparams) {
@@ -10580,7 +11280,7 @@ qemuDomainBlockStats(virDomainPtr dom,
     if (virDomainBlockStatsEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+    if (qemuDomainObjBeginSharedJob(driver, vm, 0) < 0)
         goto cleanup;
 
     if (!virDomainObjIsActive(vm)) {
@@ -10637,7 +11337,7 @@ qemuDomainBlockStatsFlags(virDomainPtr dom,
     if (virDomainBlockStatsFlagsEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+    if (qemuDomainObjBeginSharedJob(driver, vm, 0) < 0)
         goto cleanup;
 
     if (!virDomainObjIsActive(vm)) {
@@ -10899,7 +11599,7 @@ qemuDomainSetInterfaceParameters(virDomainPtr dom,
                 goto endjob;
         }
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
             goto endjob;
     }
 
@@ -11054,6 +11754,26 @@ qemuDomainGetInterfaceParameters(virDomainPtr dom,
     return ret;
 }
 
+/* Append the RSS of @vm to the @nstats entries of @stats */
+static int
+qemuDomainMemoryStatsAddRSS(virDomainObjPtr vm,
+                            virDomainMemoryStatPtr stats,
+                            int nstats)
+{
+    long rss;
+
+    if (qemuGetProcessInfo(NULL, NULL, &rss, vm->pid, 0) < 0) {
+        virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                       _("cannot get RSS for domain"));
+    } else {
+        stats[nstats].tag = VIR_DOMAIN_MEMORY_STAT_RSS;
+        stats[nstats].val = rss;
+        nstats++;
+    }
+
+    return nstats;
+}
+
 /* This functions assumes that job QEMU_JOB_QUERY is started by a caller */
 static int
 qemuDomainMemoryStatsInternal(virQEMUDriverPtr driver,
@@ -11063,7 +11783,6 @@ qemuDomainMemoryStatsInternal(virQEMUDriverPtr driver,
 
 {
     int ret = -1;
-    long rss;
 
     if (!virDomainObjIsActive(vm)) {
         virReportError(VIR_ERR_OPERATION_INVALID,
@@ -11085,16 +11804,29 @@ qemuDomainMemoryStatsInternal(virQEMUDriverPtr driver,
         ret = 0;
     }
 
-    if (qemuGetProcessInfo(NULL, NULL, &rss, vm->pid, 0) < 0) {
-        virReportError(VIR_ERR_OPERATION_FAILED, "%s",
-                       _("cannot get RSS for domain"));
-    } else {
-        stats[ret].tag = VIR_DOMAIN_MEMORY_STAT_RSS;
-        stats[ret].val = rss;
-        ret++;
-    }
+    return qemuDomainMemoryStatsAddRSS(vm, stats, ret);
+}
 
-    return ret;
+/* Fills @stats from the cache kept by processBalloonStatsEvent and
+ * returns their count, or -1 if it wasn't filled yet */
+static int
+qemuDomainMemoryStatsCached(virDomainObjPtr vm,
+                            virDomainMemoryStatPtr stats,
+                            unsigned int nr_stats)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    int nstats;
+
+    if (!virDomainObjIsActive(vm) || priv->nballoonStats < 0)
+        return -1;
+
+    nstats = MIN(priv->nballoonStats, nr_stats);
+    memcpy(stats, priv->balloonStats, sizeof(stats[0]) * nstats);
+
+    if (nstats >= nr_stats)
+        return nstats;
+
+    return qemuDomainMemoryStatsAddRSS(vm, stats, nstats);
 }
 
 static int
@@ -11115,7 +11847,11 @@ qemuDomainMemoryStats(virDomainPtr dom,
     if (virDomainMemoryStatsEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+    /* The cached statistics don't need the monitor, nor a job */
+    if ((ret = qemuDomainMemoryStatsCached(vm, stats, nr_stats)) >= 0)
+        goto cleanup;
+
+    if (qemuDomainObjBeginSharedJob(driver, vm, 0) < 0)
         goto cleanup;
 
     ret = qemuDomainMemoryStatsInternal(driver, vm, stats, nr_stats);
@@ -11503,11 +12239,8 @@ qemuDomainGetBlockInfo(virDomainPtr dom,
     }
 
     qemuDomainObjEnterMonitor(driver, vm);
-    rc = qemuMonitorGetAllBlockStatsInfo(qemuDomainGetMonitor(vm),
-                                         &stats, false);
-    if (rc >= 0)
-        rc = qemuMonitorBlockStatsUpdateCapacity(qemuDomainGetMonitor(vm),
-                                                 stats, false);
+    rc = qemuMonitorGetAllBlockStatsData(qemuDomainGetMonitor(vm),
+                                         &stats, false, NULL);
 
     if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
         goto endjob;
@@ -12737,6 +13470,24 @@ qemuConnectBaselineCPU(virConnectPtr conn ATTRIBUTE_UNUSED,
 }
 
 
+static int
+qemuConnectCompareCPUs(virConnectPtr conn,
+                       const char **xmlCPUs,
+                       unsigned int ncpus,
+                       int *results,
+                       char **baseline,
+                       unsigned int flags)
+{
+    virCheckFlags(VIR_CONNECT_BASELINE_CPU_EXPAND_FEATURES |
+                  VIR_CONNECT_BASELINE_CPU_MIGRATABLE, -1);
+
+    if (virConnectCompareCPUsEnsureACL(conn) < 0)
+        return -1;
+
+    return virCPUCompareMatrixXML(xmlCPUs, ncpus, results, baseline, flags);
+}
+
+
 static int
 qemuDomainGetJobStatsInternal(virQEMUDriverPtr driver,
                               virDomainObjPtr vm,
@@ -12981,6 +13732,10 @@ qemuDomainMigrateSetMaxDowntime(virDomainPtr dom,
     if (qemuDomainObjExitMonitor(driver, vm) < 0)
         ret = -1;
 
+    /* Let migration auto-tuning continue from the new limit */
+    if (ret == 0 && priv->job.current)
+        priv->job.current->downtimeLimit = downtime;
+
  endjob:
     qemuDomainObjEndJob(driver, vm);
 
@@ -14228,7 +14983,7 @@ qemuDomainSnapshotCreateDiskActive(virQEMUDriverPtr driver,
     }
 
     if (ret == 0 || !actions) {
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0 ||
+        if (qemuDomainSaveStatus(driver, vm) < 0 ||
             (persist && virDomainSaveConfig(cfg->configDir, driver->caps,
                                             vm->newDef) < 0))
             ret = -1;
@@ -14557,6 +15312,12 @@ qemuDomainSnapshotCreateXML(virDomainPtr domain,
     qemuDomainObjSetAsyncJobMask(vm, QEMU_JOB_NONE);
 
     if (redefine) {
+        /* a redefined snapshot may take over the domain definition of
+         * the one it replaces */
+        if ((other = virDomainSnapshotFindByName(vm->snapshots, def->name)) &&
+            qemuDomainSnapshotLoadDom(driver, other) < 0)
+            goto endjob;
+
         if (virDomainSnapshotRedefinePrep(domain, vm, &def, &snap,
                                           &update_current, flags) < 0)
             goto endjob;
@@ -14619,6 +15380,7 @@ qemuDomainSnapshotCreateXML(virDomainPtr domain,
             vm->current_snapshot->def->current = false;
             if (qemuDomainSnapshotWriteMetadata(vm, vm->current_snapshot,
                                                 driver->caps,
+                                                driver->xmlopt,
                                                 cfg->snapshotDir) < 0)
                 goto endjob;
             vm->current_snapshot = NULL;
@@ -14668,6 +15430,7 @@ qemuDomainSnapshotCreateXML(virDomainPtr domain,
  endjob:
     if (snapshot && !(flags & VIR_DOMAIN_SNAPSHOT_CREATE_NO_METADATA)) {
         if (qemuDomainSnapshotWriteMetadata(vm, snap, driver->caps,
+                                            driver->xmlopt,
                                             cfg->snapshotDir) < 0) {
             /* if writing of metadata fails, error out rather than trying
              * to silently carry on without completing the snapshot */
@@ -14682,10 +15445,7 @@ qemuDomainSnapshotCreateXML(virDomainPtr domain,
                 vm->current_snapshot = snap;
             other = virDomainSnapshotFindByName(vm->snapshots,
                                                 snap->def->parent);
-            snap->parent = other;
-            other->nchildren++;
-            snap->sibling = other->first_child;
-            other->first_child = snap;
+            virDomainSnapshotSetParent(snap, other);
         }
     } else if (snap) {
         virDomainSnapshotObjListRemove(vm->snapshots, snap);
@@ -15000,7 +15760,8 @@ qemuDomainSnapshotGetXMLDesc(virDomainSnapshotPtr snapshot,
     if (virDomainSnapshotGetXMLDescEnsureACL(snapshot->domain->conn, vm->def, flags) < 0)
         goto cleanup;
 
-    if (!(snap = qemuSnapObjFromSnapshot(vm, snapshot)))
+    if (!(snap = qemuSnapObjFromSnapshot(vm, snapshot)) ||
+        qemuDomainSnapshotLoadDom(driver, snap) < 0)
         goto cleanup;
 
     virUUIDFormat(snapshot->domain->uuid, uuidstr);
@@ -15144,7 +15905,8 @@ qemuDomainRevertToSnapshot(virDomainSnapshotPtr snapshot,
     if (qemuProcessBeginJob(driver, vm) < 0)
         goto cleanup;
 
-    if (!(snap = qemuSnapObjFromSnapshot(vm, snapshot)))
+    if (!(snap = qemuSnapObjFromSnapshot(vm, snapshot)) ||
+        qemuDomainSnapshotLoadDom(driver, snap) < 0)
         goto endjob;
 
     if (!vm->persistent &&
@@ -15186,7 +15948,8 @@ qemuDomainRevertToSnapshot(virDomainSnapshotPtr snapshot,
     if (vm->current_snapshot) {
         vm->current_snapshot->def->current = false;
         if (qemuDomainSnapshotWriteMetadata(vm, vm->current_snapshot,
-                                            driver->caps, cfg->snapshotDir) < 0)
+                                            driver->caps, driver->xmlopt,
+                                            cfg->snapshotDir) < 0)
             goto endjob;
         vm->current_snapshot = NULL;
         /* XXX Should we restore vm->current_snapshot after this point
@@ -15426,6 +16189,7 @@ qemuDomainRevertToSnapshot(virDomainSnapshotPtr snapshot,
  cleanup:
     if (ret == 0) {
         if (qemuDomainSnapshotWriteMetadata(vm, snap, driver->caps,
+                                            driver->xmlopt,
                                             cfg->snapshotDir) < 0)
             ret = -1;
         else
@@ -15462,8 +16226,8 @@ struct _virQEMUSnapReparent {
     virDomainSnapshotObjPtr parent;
     virDomainObjPtr vm;
     virCapsPtr caps;
+    virDomainXMLOptionPtr xmlopt;
     int err;
-    virDomainSnapshotObjPtr last;
 };
 
 
@@ -15487,10 +16251,8 @@ qemuDomainSnapshotReparentChildren(void *payload,
         return 0;
     }
 
-    if (!snap->sibling)
-        rep->last = snap;
-
     rep->err = qemuDomainSnapshotWriteMetadata(rep->vm, snap, rep->caps,
+                                               rep->xmlopt,
                                                rep->cfg->snapshotDir);
     return 0;
 }
@@ -15561,6 +16323,7 @@ qemuDomainSnapshotDelete(virDomainSnapshotPtr snapshot,
             if (flags & VIR_DOMAIN_SNAPSHOT_DELETE_CHILDREN_ONLY) {
                 snap->def->current = true;
                 if (qemuDomainSnapshotWriteMetadata(vm, snap, driver->caps,
+                                                    driver->xmlopt,
                                                     cfg->snapshotDir) < 0) {
                     virReportError(VIR_ERR_INTERNAL_ERROR,
                                    _("failed to set snapshot '%s' as current"),
@@ -15576,22 +16339,19 @@ qemuDomainSnapshotDelete(virDomainSnapshotPtr snapshot,
         rep.parent = snap->parent;
         rep.vm = vm;
         rep.err = 0;
-        rep.last = NULL;
         rep.caps = driver->caps;
+        rep.xmlopt = driver->xmlopt;
         virDomainSnapshotForEachChild(snap,
                                       qemuDomainSnapshotReparentChildren,
                                       &rep);
         if (rep.err < 0)
             goto endjob;
         /* Can't modify siblings during ForEachChild, so do it now.  */
-        snap->parent->nchildren += snap->nchildren;
-        rep.last->sibling = snap->parent->first_child;
-        snap->parent->first_child = snap->first_child;
+        virDomainSnapshotMoveChildren(snap, snap->parent);
     }
 
     if (flags & VIR_DOMAIN_SNAPSHOT_DELETE_CHILDREN_ONLY) {
-        snap->nchildren = 0;
-        snap->first_child = NULL;
+        virDomainSnapshotDropChildren(snap);
         ret = 0;
     } else {
         virDomainSnapshotDropParent(snap);
@@ -16145,7 +16905,6 @@ qemuDomainBlockJobAbort(virDomainPtr dom,
     virQEMUDriverPtr driver = dom->conn->privateData;
     char *device = NULL;
     virDomainDiskDefPtr disk = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     bool save = false;
     bool modern;
     bool pivot = !!(flags & VIR_DOMAIN_BLOCK_JOB_ABORT_PIVOT);
@@ -16218,7 +16977,7 @@ qemuDomainBlockJobAbort(virDomainPtr dom,
      * effort to save it now.  But we can ignore failure, since there
      * will be further changes when the event marks completion.  */
     if (save)
-        ignore_value(virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps));
+        ignore_value(qemuDomainSaveStatus(driver, vm));
 
     /* With synchronous block cancel, we must synthesize an event, and
      * we silently ignore the ABORT_ASYNC flag.  With asynchronous
@@ -16255,7 +17014,6 @@ qemuDomainBlockJobAbort(virDomainPtr dom,
     qemuDomainObjEndJob(driver, vm);
 
  cleanup:
-    virObjectUnref(cfg);
     VIR_FREE(device);
     virDomainObjEndAPI(&vm);
     return ret;
@@ -16363,11 +17121,9 @@ qemuDomainGetBlockJobInfo(virDomainPtr dom,
     if (disk->mirror &&
         rawInfo.ready != 0 &&
         info->cur == info->end && !disk->mirrorState) {
-        virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
         disk->mirrorState = VIR_DOMAIN_DISK_MIRROR_STATE_READY;
-        ignore_value(virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps));
-        virObjectUnref(cfg);
+        ignore_value(qemuDomainSaveStatus(driver, vm));
     }
  endjob:
     qemuDomainObjEndJob(driver, vm);
@@ -16630,7 +17386,7 @@ qemuDomainBlockCopyCommon(virDomainObjPtr vm,
     disk->mirrorJob = VIR_DOMAIN_BLOCK_JOB_TYPE_COPY;
     QEMU_DOMAIN_DISK_PRIVATE(disk)->blockjob = true;
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         VIR_WARN("Unable to save status on vm %s after state change",
                  vm->def->name);
 
@@ -17026,13 +17782,10 @@ qemuDomainBlockCommit(virDomainPtr dom,
 
     if (mirror) {
         if (ret == 0) {
-            virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
-
             mirror = NULL;
-            if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+            if (qemuDomainSaveStatus(driver, vm) < 0)
                 VIR_WARN("Unable to save status on vm %s after block job",
                          vm->def->name);
-            virObjectUnref(cfg);
         } else {
             disk->mirror = NULL;
             disk->mirrorJob = VIR_DOMAIN_BLOCK_JOB_TYPE_UNKNOWN;
@@ -17579,8 +18332,7 @@ qemuDomainSetBlockIoTune(virDomainPtr dom,
         if (virDomainDiskSetBlockIOTune(disk, &info) < 0)
             goto endjob;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir,
-                                vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
             goto endjob;
 
         if (eventNparams) {
@@ -18137,16 +18889,34 @@ qemuConnectListAllDomains(virConnectPtr conn,
     return ret;
 }
 
-static char *
-qemuDomainQemuAgentCommand(virDomainPtr domain,
-                           const char *cmd,
-                           int timeout,
-                           unsigned int flags)
+static int
+qemuConnectListAllDomainsFields(virConnectPtr conn,
+                                unsigned int fields,
+                                virDomainStatsRecordPtr **records,
+                                unsigned int flags)
 {
-    virQEMUDriverPtr driver = domain->conn->privateData;
-    virDomainObjPtr vm;
-    int ret = -1;
-    char *result = NULL;
+    virQEMUDriverPtr driver = conn->privateData;
+
+    virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ALL, -1);
+
+    if (virConnectListAllDomainsFieldsEnsureACL(conn) < 0)
+        return -1;
+
+    return virDomainObjListExportFields(driver->domains, conn, fields, records,
+                                        virConnectListAllDomainsFieldsCheckACL,
+                                        flags);
+}
+
+static char *
+qemuDomainQemuAgentCommand(virDomainPtr domain,
+                           const char *cmd,
+                           int timeout,
+                           unsigned int flags)
+{
+    virQEMUDriverPtr driver = domain->conn->privateData;
+    virDomainObjPtr vm;
+    int ret = -1;
+    char *result = NULL;
     qemuAgentPtr agent;
 
     virCheckFlags(0, NULL);
@@ -18646,11 +19416,18 @@ qemuNodeGetFreePages(virConnectPtr conn,
                      unsigned long long *counts,
                      unsigned int flags)
 {
-    virCheckFlags(0, -1);
+    virQEMUDriverPtr driver = conn->privateData;
+
+    virCheckFlags(VIR_NODE_GET_FREE_PAGES_RESERVED, -1);
 
     if (virNodeGetFreePagesEnsureACL(conn) < 0)
         return -1;
 
+    if (flags & VIR_NODE_GET_FREE_PAGES_RESERVED)
+        return virNumaPageLedgerGetReserved(driver->hugepageLedger,
+                                            npages, pages,
+                                            startCell, cellCount, counts);
+
     return virHostMemGetFreePages(npages, pages, startCell, cellCount, counts);
 }
 
@@ -18668,7 +19445,6 @@ qemuConnectGetDomainCapabilities(virConnectPtr conn,
     virQEMUCapsPtr qemuCaps = NULL;
     int virttype = VIR_DOMAIN_VIRT_NONE;
     virDomainVirtType capsType;
-    virDomainCapsPtr domCaps = NULL;
     int arch = virArchFromHost(); /* virArch */
     virQEMUDriverConfigPtr cfg = NULL;
     virCapsPtr caps = NULL;
@@ -18758,18 +19534,12 @@ qemuConnectGetDomainCapabilities(virConnectPtr conn,
         goto cleanup;
     }
 
-    if (!(domCaps = virDomainCapsNew(emulatorbin, machine, arch, virttype)))
-        goto cleanup;
-
-    if (virQEMUCapsFillDomainCaps(caps, domCaps, qemuCaps,
-                                  cfg->firmwares, cfg->nfirmwares) < 0)
-        goto cleanup;
-
-    ret = virDomainCapsFormat(domCaps);
+    ret = virQEMUCapsGetDomainCapsXML(caps, driver->qemuCapsCache, qemuCaps,
+                                      emulatorbin, machine, arch, virttype,
+                                      cfg->firmwares, cfg->nfirmwares);
  cleanup:
     virObjectUnref(cfg);
     virObjectUnref(caps);
-    virObjectUnref(domCaps);
     virObjectUnref(qemuCaps);
     return ret;
 }
@@ -18780,7 +19550,9 @@ qemuDomainGetStatsState(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                         virDomainObjPtr dom,
                         virDomainStatsRecordPtr record,
                         int *maxparams,
-                        unsigned int privflags ATTRIBUTE_UNUSED)
+                        unsigned int privflags ATTRIBUTE_UNUSED,
+                        qemuMonitorStatsPtr monstats ATTRIBUTE_UNUSED,
+                        virHashTablePtr netstats ATTRIBUTE_UNUSED)
 {
     if (virTypedParamsAddInt(&record->params,
                              &record->nparams,
@@ -18805,6 +19577,7 @@ typedef enum {
                                             accessed */
     QEMU_DOMAIN_STATS_BACKING  = 1 << 1, /* include backing chain in
                                             block stats */
+    QEMU_DOMAIN_STATS_CACHED   = 1 << 2, /* cached stats are acceptable */
 } qemuDomainStatsFlags;
 
 
@@ -18816,7 +19589,9 @@ qemuDomainGetStatsCpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                       virDomainObjPtr dom,
                       virDomainStatsRecordPtr record,
                       int *maxparams,
-                      unsigned int privflags ATTRIBUTE_UNUSED)
+                      unsigned int privflags ATTRIBUTE_UNUSED,
+                      qemuMonitorStatsPtr monstats ATTRIBUTE_UNUSED,
+                      virHashTablePtr netstats ATTRIBUTE_UNUSED)
 {
     qemuDomainObjPrivatePtr priv = dom->privateData;
     unsigned long long cpu_time = 0;
@@ -18853,15 +19628,17 @@ qemuDomainGetStatsCpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
 }
 
 static int
-qemuDomainGetStatsBalloon(virQEMUDriverPtr driver,
+qemuDomainGetStatsBalloon(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                           virDomainObjPtr dom,
                           virDomainStatsRecordPtr record,
                           int *maxparams,
-                          unsigned int privflags)
+                          unsigned int privflags ATTRIBUTE_UNUSED,
+                          qemuMonitorStatsPtr monstats ATTRIBUTE_UNUSED,
+                          virHashTablePtr netstats ATTRIBUTE_UNUSED)
 {
     qemuDomainObjPrivatePtr priv = dom->privateData;
     virDomainMemoryStatStruct stats[VIR_DOMAIN_MEMORY_STAT_NR];
-    int nr_stats;
+    int nr_stats = 0;
     unsigned long long cur_balloon = 0;
     size_t i;
     int err = 0;
@@ -18888,13 +19665,20 @@ qemuDomainGetStatsBalloon(virQEMUDriverPtr driver,
                                 virDomainDefGetMemoryTotal(dom->def)) < 0)
         return -1;
 
-    if (!HAVE_JOB(privflags) || !virDomainObjIsActive(dom))
+    if (!virDomainObjIsActive(dom))
         return 0;
 
-    nr_stats = qemuDomainMemoryStatsInternal(driver, dom, stats,
-                                             VIR_DOMAIN_MEMORY_STAT_NR);
-    if (nr_stats < 0)
-        return 0;
+    /* the guest memory stats come from the cache refreshed by
+     * processBalloonStatsEvent, the monitor isn't needed */
+    if (dom->def->memballoon &&
+        dom->def->memballoon->model == VIR_DOMAIN_MEMBALLOON_MODEL_VIRTIO) {
+        nr_stats = qemuDomainMemoryStatsCached(dom, stats,
+                                               VIR_DOMAIN_MEMORY_STAT_NR);
+        if (nr_stats < 0)
+            return 0;
+    } else {
+        nr_stats = qemuDomainMemoryStatsAddRSS(dom, stats, 0);
+    }
 
 #define STORE_MEM_RECORD(TAG, NAME)                                             \
     if (stats[i].tag == VIR_DOMAIN_MEMORY_STAT_ ##TAG)                          \
@@ -18924,11 +19708,13 @@ qemuDomainGetStatsBalloon(virQEMUDriverPtr driver,
 
 
 static int
-qemuDomainGetStatsVcpu(virQEMUDriverPtr driver,
+qemuDomainGetStatsVcpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                        virDomainObjPtr dom,
                        virDomainStatsRecordPtr record,
                        int *maxparams,
-                       unsigned int privflags)
+                       unsigned int privflags,
+                       qemuMonitorStatsPtr monstats,
+                       virHashTablePtr netstats ATTRIBUTE_UNUSED)
 {
     size_t i;
     int ret = -1;
@@ -18936,6 +19722,7 @@ qemuDomainGetStatsVcpu(virQEMUDriverPtr driver,
     virVcpuInfoPtr cpuinfo = NULL;
     unsigned long long *cpuwait = NULL;
     bool *cpuhalted = NULL;
+    virProcessSchedStatPtr schedstats = NULL;
 
     if (virTypedParamsAddUInt(&record->params,
                               &record->nparams,
@@ -18955,20 +19742,32 @@ qemuDomainGetStatsVcpu(virQEMUDriverPtr driver,
         VIR_ALLOC_N(cpuwait, virDomainDefGetVcpus(dom->def)) < 0)
         goto cleanup;
 
-    if (HAVE_JOB(privflags) && virDomainObjIsActive(dom)) {
-        if (qemuDomainRefreshVcpuHalted(driver, dom,
-                                        QEMU_ASYNC_JOB_NONE) < 0) {
-            /* it's ok to be silent and go ahead, because halted vcpu info
-             * wasn't here from the beginning */
-            virResetLastError();
-        } else if (VIR_ALLOC_N(cpuhalted, virDomainDefGetVcpus(dom->def)) < 0) {
+    /* the halted state is missing if it could not be fetched, which is
+     * fine, because halted vcpu info wasn't here from the beginning */
+    if (HAVE_JOB(privflags) && virDomainObjIsActive(dom) &&
+        monstats && monstats->halted) {
+        qemuDomainUpdateVcpuHalted(dom, monstats->halted);
+        if (VIR_ALLOC_N(cpuhalted, virDomainDefGetVcpus(dom->def)) < 0)
+            goto cleanup;
+    }
+
+    /* read the statistics of all vCPU threads at once where the host
+     * provides them, which also gives the run queue delay */
+    if (virDomainObjIsActive(dom)) {
+        size_t nvcpus = virDomainDefGetVcpus(dom->def);
+
+        if (VIR_ALLOC_N(schedstats, nvcpus) < 0)
             goto cleanup;
+
+        if (qemuDomainHelperGetVcpuSchedStats(dom, schedstats, nvcpus) < 0) {
+            virResetLastError();
+            VIR_FREE(schedstats);
         }
     }
 
     if (qemuDomainHelperGetVcpus(dom, cpuinfo, cpuwait,
                                  virDomainDefGetVcpus(dom->def),
-                                 NULL, 0, cpuhalted) < 0) {
+                                 NULL, 0, cpuhalted, schedstats) < 0) {
         virResetLastError();
         ret = 0; /* it's ok to be silent and go ahead */
         goto cleanup;
@@ -19005,6 +19804,17 @@ qemuDomainGetStatsVcpu(virQEMUDriverPtr driver,
                                     cpuwait[i]) < 0)
             goto cleanup;
 
+        if (schedstats) {
+            snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                     "vcpu.%u.delay", cpuinfo[i].number);
+            if (virTypedParamsAddULLong(&record->params,
+                                        &record->nparams,
+                                        maxparams,
+                                        param_name,
+                                        schedstats[i].waitTime) < 0)
+                goto cleanup;
+        }
+
         if (cpuhalted) {
             snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
                      "vcpu.%u.halted", cpuinfo[i].number);
@@ -19023,45 +19833,51 @@ qemuDomainGetStatsVcpu(virQEMUDriverPtr driver,
     VIR_FREE(cpuinfo);
     VIR_FREE(cpuwait);
     VIR_FREE(cpuhalted);
+    VIR_FREE(schedstats);
     return ret;
 }
 
+/* The stats records can have thousands of parameters, so their names
+ * are formatted straight into the record by virTypedParamsAppendFormat
+ * rather than going through a temporary buffer and the public
+ * virTypedParamsAdd* calls. */
 #define QEMU_ADD_COUNT_PARAM(record, maxparams, type, count) \
 do { \
-    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
-    snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, "%s.count", type); \
-    if (virTypedParamsAddUInt(&(record)->params, \
-                              &(record)->nparams, \
-                              maxparams, \
-                              param_name, \
-                              count) < 0) \
+    virTypedParameterPtr _par; \
+    if (!(_par = virTypedParamsAppendFormat(&(record)->params, \
+                                            &(record)->nparams, \
+                                            maxparams, \
+                                            VIR_TYPED_PARAM_UINT, \
+                                            "%s.count", type))) \
         goto cleanup; \
+    _par->value.ui = count; \
 } while (0)
 
 #define QEMU_ADD_NAME_PARAM(record, maxparams, type, subtype, num, name) \
 do { \
-    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
-    snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, \
-             "%s.%zu.%s", type, num, subtype); \
-    if (virTypedParamsAddString(&(record)->params, \
-                                &(record)->nparams, \
-                                maxparams, \
-                                param_name, \
-                                name) < 0) \
+    virTypedParameterPtr _par; \
+    if (!(_par = virTypedParamsAppendFormat(&(record)->params, \
+                                            &(record)->nparams, \
+                                            maxparams, \
+                                            VIR_TYPED_PARAM_STRING, \
+                                            "%s.%zu.%s", type, num, \
+                                            subtype)) || \
+        VIR_STRDUP(_par->value.s, name) < 0) \
         goto cleanup; \
 } while (0)
 
-#define QEMU_ADD_NET_PARAM(record, maxparams, num, name, value) \
+#define QEMU_ADD_NET_PARAM(record, maxparams, num, name, val) \
 do { \
-    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
-    snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, \
-             "net.%zu.%s", num, name); \
-    if (value >= 0 && virTypedParamsAddULLong(&(record)->params, \
-                                              &(record)->nparams, \
-                                              maxparams, \
-                                              param_name, \
-                                              value) < 0) \
-        return -1; \
+    virTypedParameterPtr _par; \
+    if (val >= 0) { \
+        if (!(_par = virTypedParamsAppendFormat(&(record)->params, \
+                                                &(record)->nparams, \
+                                                maxparams, \
+                                                VIR_TYPED_PARAM_ULLONG, \
+                                                "net.%zu.%s", num, name))) \
+            return -1; \
+        _par->value.ul = val; \
+    } \
 } while (0)
 
 static int
@@ -19069,10 +19885,13 @@ qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                             virDomainObjPtr dom,
                             virDomainStatsRecordPtr record,
                             int *maxparams,
-                            unsigned int privflags ATTRIBUTE_UNUSED)
+                            unsigned int privflags ATTRIBUTE_UNUSED,
+                            qemuMonitorStatsPtr monstats ATTRIBUTE_UNUSED,
+                            virHashTablePtr netstats)
 {
     size_t i;
     struct _virDomainInterfaceStats tmp;
+    virDomainInterfaceStatsPtr cached;
     int ret = -1;
 
     if (!virDomainObjIsActive(dom))
@@ -19096,6 +19915,10 @@ qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                 virResetLastError();
                 continue;
             }
+        } else if (netstats) {
+            if (!(cached = virHashLookup(netstats, dom->def->nets[i]->ifname)))
+                continue;
+            tmp = *cached;
         } else {
             if (virNetDevTapInterfaceStats(dom->def->nets[i]->ifname, &tmp) < 0) {
                 virResetLastError();
@@ -19128,44 +19951,36 @@ qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
 
 #undef QEMU_ADD_NET_PARAM
 
-#define QEMU_ADD_BLOCK_PARAM_UI(record, maxparams, num, name, value) \
-    do {                                                             \
-        char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];               \
-        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,           \
-                 "block.%zu.%s", num, name);                         \
-        if (virTypedParamsAddUInt(&(record)->params,                 \
-                                  &(record)->nparams,                \
-                                  maxparams,                         \
-                                  param_name,                        \
-                                  value) < 0)                        \
-            goto cleanup;                                            \
+#define QEMU_ADD_BLOCK_PARAM_UI(record, maxparams, num, name, val)    \
+    do {                                                              \
+        virTypedParameterPtr _par;                                    \
+        if (!(_par = virTypedParamsAppendFormat(&(record)->params,    \
+                                                &(record)->nparams,   \
+                                                maxparams,            \
+                                                VIR_TYPED_PARAM_UINT, \
+                                                "block.%zu.%s",       \
+                                                num, name)))          \
+            goto cleanup;                                             \
+        _par->value.ui = val;                                         \
     } while (0)
 
 /* expects a LL, but typed parameter must be ULL */
-#define QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, num, name, value) \
+#define QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, num, name, val) \
 do { \
-    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
-    snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, \
-             "block.%zu.%s", num, name); \
-    if (value >= 0 && virTypedParamsAddULLong(&(record)->params, \
-                                              &(record)->nparams, \
-                                              maxparams, \
-                                              param_name, \
-                                              value) < 0) \
-        goto cleanup; \
+    if (val >= 0) \
+        QEMU_ADD_BLOCK_PARAM_ULL(record, maxparams, num, name, val); \
 } while (0)
 
-#define QEMU_ADD_BLOCK_PARAM_ULL(record, maxparams, num, name, value) \
+#define QEMU_ADD_BLOCK_PARAM_ULL(record, maxparams, num, name, val) \
 do { \
-    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
-    snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, \
-             "block.%zu.%s", num, name); \
-    if (virTypedParamsAddULLong(&(record)->params, \
-                                &(record)->nparams, \
-                                maxparams, \
-                                param_name, \
-                                value) < 0) \
+    virTypedParameterPtr _par; \
+    if (!(_par = virTypedParamsAppendFormat(&(record)->params, \
+                                            &(record)->nparams, \
+                                            maxparams, \
+                                            VIR_TYPED_PARAM_ULLONG, \
+                                            "block.%zu.%s", num, name))) \
         goto cleanup; \
+    _par->value.ul = val; \
 } while (0)
 
 /* refresh information by opening images on the disk */
@@ -19325,39 +20140,25 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
                         virDomainObjPtr dom,
                         virDomainStatsRecordPtr record,
                         int *maxparams,
-                        unsigned int privflags)
+                        unsigned int privflags,
+                        qemuMonitorStatsPtr monstats,
+                        virHashTablePtr netstats ATTRIBUTE_UNUSED)
 {
     size_t i;
     int ret = -1;
-    int rc;
     virHashTablePtr stats = NULL;
     virHashTablePtr nodestats = NULL;
     virJSONValuePtr nodedata = NULL;
-    qemuDomainObjPrivatePtr priv = dom->privateData;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
-    bool fetchnodedata = virQEMUCapsGet(priv->qemuCaps,
-                                        QEMU_CAPS_QUERY_NAMED_BLOCK_NODES);
     int count_index = -1;
     size_t visited = 0;
     bool visitBacking = !!(privflags & QEMU_DOMAIN_STATS_BACKING);
 
-    if (HAVE_JOB(privflags) && virDomainObjIsActive(dom)) {
-        qemuDomainObjEnterMonitor(driver, dom);
-        rc = qemuMonitorGetAllBlockStatsInfo(priv->mon, &stats,
-                                             visitBacking);
-        if (rc >= 0)
-            ignore_value(qemuMonitorBlockStatsUpdateCapacity(priv->mon, stats,
-                                                             visitBacking));
-
-        if (fetchnodedata)
-            nodedata = qemuMonitorQueryNamedBlockNodes(priv->mon);
-
-        if (qemuDomainObjExitMonitor(driver, dom) < 0)
-            goto cleanup;
-
-        /* failure to retrieve stats is fine at this point */
-        if (rc < 0 || (fetchnodedata && !nodedata))
-            virResetLastError();
+    /* whatever block data qemuDomainGetStatsParams managed to fetch is
+     * used */
+    if (HAVE_JOB(privflags) && virDomainObjIsActive(dom) && monstats) {
+        VIR_STEAL_PTR(stats, monstats->blockstats);
+        VIR_STEAL_PTR(nodedata, monstats->nodedata);
     }
 
     if (nodedata &&
@@ -19403,19 +20204,15 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
 
 #undef QEMU_ADD_NAME_PARAM
 
-#undef QEMU_ADD_COUNT_PARAM
-
 static int
 qemuDomainGetStatsPerfOneEvent(virPerfPtr perf,
                                virPerfEventType type,
+                               uint64_t value,
                                virDomainStatsRecordPtr record,
                                int *maxparams)
 {
     char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];
-    uint64_t value = 0;
-
-    if (virPerfReadEvent(perf, type, &value) < 0)
-        return -1;
+    uint64_t rate;
 
     snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, "perf.%s",
              virPerfEventTypeToString(type));
@@ -19427,6 +20224,19 @@ qemuDomainGetStatsPerfOneEvent(virPerfPtr perf,
                                 value) < 0)
         return -1;
 
+    /* only if perf_sample_interval is set */
+    if (virPerfGetEventRate(perf, type, &rate) == 1) {
+        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, "perf.%s.rate",
+                 virPerfEventTypeToString(type));
+
+        if (virTypedParamsAddULLong(&record->params,
+                                    &record->nparams,
+                                    maxparams,
+                                    param_name,
+                                    rate) < 0)
+            return -1;
+    }
+
     return 0;
 }
 
@@ -19435,17 +20245,33 @@ qemuDomainGetStatsPerf(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                        virDomainObjPtr dom,
                        virDomainStatsRecordPtr record,
                        int *maxparams,
-                       unsigned int privflags ATTRIBUTE_UNUSED)
+                       unsigned int privflags ATTRIBUTE_UNUSED,
+                       qemuMonitorStatsPtr monstats ATTRIBUTE_UNUSED,
+                       virHashTablePtr netstats ATTRIBUTE_UNUSED)
 {
     size_t i;
     qemuDomainObjPrivatePtr priv = dom->privateData;
+    uint64_t values[VIR_PERF_EVENT_LAST];
+    bool enabled = false;
     int ret = -1;
 
+    for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
+        if (virPerfEventIsEnabled(priv->perf, i))
+            enabled = true;
+    }
+
+    if (!enabled)
+        return 0;
+
+    /* all the counters at once, so that they cover the same interval */
+    if (virPerfReadEvents(priv->perf, values) < 0)
+        goto cleanup;
+
     for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
         if (!virPerfEventIsEnabled(priv->perf, i))
              continue;
 
-        if (qemuDomainGetStatsPerfOneEvent(priv->perf, i,
+        if (qemuDomainGetStatsPerfOneEvent(priv->perf, i, values[i],
                                            record, maxparams) < 0)
             goto cleanup;
     }
@@ -19456,478 +20282,1837 @@ qemuDomainGetStatsPerf(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
     return ret;
 }
 
-typedef int
-(*qemuDomainGetStatsFunc)(virQEMUDriverPtr driver,
-                          virDomainObjPtr dom,
-                          virDomainStatsRecordPtr record,
-                          int *maxparams,
-                          unsigned int flags);
+static int
+qemuDomainGetStatsPressureOne(virDomainStatsRecordPtr record,
+                              int *maxparams,
+                              virCgroupPressureResource resource,
+                              const char *kind,
+                              virCgroupPressurePtr pressure)
+{
+    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];
+    const char *names[] = { "avg10", "avg60", "avg300" };
+    double avgs[] = { pressure->avg10, pressure->avg60, pressure->avg300 };
+    size_t i;
 
-struct qemuDomainGetStatsWorker {
-    qemuDomainGetStatsFunc func;
-    unsigned int stats;
-    bool monitor;
-};
+    for (i = 0; i < ARRAY_CARDINALITY(names); i++) {
+        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, "pressure.%s.%s.%s",
+                 virCgroupPressureResourceTypeToString(resource), kind,
+                 names[i]);
+        if (virTypedParamsAddDouble(&record->params,
+                                    &record->nparams,
+                                    maxparams,
+                                    param_name,
+                                    avgs[i]) < 0)
+            return -1;
+    }
 
-static struct qemuDomainGetStatsWorker qemuDomainGetStatsWorkers[] = {
-    { qemuDomainGetStatsState, VIR_DOMAIN_STATS_STATE, false },
-    { qemuDomainGetStatsCpu, VIR_DOMAIN_STATS_CPU_TOTAL, false },
-    { qemuDomainGetStatsBalloon, VIR_DOMAIN_STATS_BALLOON, true },
-    { qemuDomainGetStatsVcpu, VIR_DOMAIN_STATS_VCPU, true },
-    { qemuDomainGetStatsInterface, VIR_DOMAIN_STATS_INTERFACE, false },
-    { qemuDomainGetStatsBlock, VIR_DOMAIN_STATS_BLOCK, true },
-    { qemuDomainGetStatsPerf, VIR_DOMAIN_STATS_PERF, false },
-    { NULL, 0, false }
-};
+    snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, "pressure.%s.%s.total",
+             virCgroupPressureResourceTypeToString(resource), kind);
+    if (virTypedParamsAddULLong(&record->params,
+                                &record->nparams,
+                                maxparams,
+                                param_name,
+                                pressure->total) < 0)
+        return -1;
 
+    return 0;
+}
 
 static int
-qemuDomainGetStatsCheckSupport(unsigned int *stats,
-                               bool enforce)
+qemuDomainGetStatsPressure(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                           virDomainObjPtr dom,
+                           virDomainStatsRecordPtr record,
+                           int *maxparams,
+                           unsigned int privflags ATTRIBUTE_UNUSED,
+                           qemuMonitorStatsPtr monstats ATTRIBUTE_UNUSED,
+                           virHashTablePtr netstats ATTRIBUTE_UNUSED)
 {
-    unsigned int supportedstats = 0;
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    virCgroupPressure some;
+    virCgroupPressure full;
     size_t i;
+    int rc;
 
-    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++)
-        supportedstats |= qemuDomainGetStatsWorkers[i].stats;
+    if (!virCgroupSupportsPressure(priv->cgroup))
+        return 0;
 
-    if (*stats == 0) {
-        *stats = supportedstats;
+    for (i = 0; i < VIR_CGROUP_PRESSURE_LAST; i++) {
+        /* e.g. the io controller may not be enabled for the domain */
+        if ((rc = virCgroupGetPressure(priv->cgroup, i, &some, &full)) < 0) {
+            virResetLastError();
+            continue;
+        }
+
+        if (qemuDomainGetStatsPressureOne(record, maxparams, i,
+                                          "some", &some) < 0)
+            return -1;
+
+        if (rc > 0 &&
+            qemuDomainGetStatsPressureOne(record, maxparams, i,
+                                          "full", &full) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int
+qemuDomainGetStatsJobOne(virDomainStatsRecordPtr record,
+                         int *maxparams,
+                         const char *prefix,
+                         const char *type,
+                         qemuDomainJobStatsPtr stats)
+{
+    char name[VIR_TYPED_PARAM_FIELD_LENGTH];
+    virTypedParameterPtr par;
+    const char *fields[] = {
+        "count", "failed", "wait.total", "wait.max", "hold.total", "hold.max",
+    };
+    unsigned long long values[] = {
+        stats->started, stats->failed, stats->waitTotal, stats->waitMax,
+        stats->holdTotal, stats->holdMax,
+    };
+    char *c;
+    size_t i;
+
+    if (!stats->started && !stats->failed)
         return 0;
+
+    /* job type names such as "async nested" are made of several words */
+    snprintf(name, sizeof(name), "%s%s", prefix, type);
+    for (c = name; *c; c++) {
+        if (*c == ' ')
+            *c = '_';
     }
 
-    if (enforce &&
-        *stats & ~supportedstats) {
-        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
-                       _("Stats types bits 0x%x are not supported by this daemon"),
-                       *stats & ~supportedstats);
-        return -1;
+    for (i = 0; i < ARRAY_CARDINALITY(fields); i++) {
+        if (!(par = virTypedParamsAppendFormat(&record->params,
+                                               &record->nparams,
+                                               maxparams,
+                                               VIR_TYPED_PARAM_ULLONG,
+                                               "job.%s.%s", name, fields[i])))
+            return -1;
+        par->value.ul = values[i];
+    }
+
+    if (stats->holdMaxAPI) {
+        if (!(par = virTypedParamsAppendFormat(&record->params,
+                                               &record->nparams,
+                                               maxparams,
+                                               VIR_TYPED_PARAM_STRING,
+                                               "job.%s.hold.max.api", name)) ||
+            VIR_STRDUP(par->value.s, stats->holdMaxAPI) < 0)
+            return -1;
+    }
+
+    for (i = 0; i < QEMU_DOMAIN_JOB_STATS_BUCKETS; i++) {
+        if (!(par = virTypedParamsAppendFormat(&record->params,
+                                               &record->nparams,
+                                               maxparams,
+                                               VIR_TYPED_PARAM_ULLONG,
+                                               "job.%s.wait.bucket.%zu",
+                                               name, i)))
+            return -1;
+        par->value.ul = stats->waitBuckets[i];
+
+        if (!(par = virTypedParamsAppendFormat(&record->params,
+                                               &record->nparams,
+                                               maxparams,
+                                               VIR_TYPED_PARAM_ULLONG,
+                                               "job.%s.hold.bucket.%zu",
+                                               name, i)))
+            return -1;
+        par->value.ul = stats->holdBuckets[i];
     }
 
-    *stats &= supportedstats;
     return 0;
 }
 
-
-static bool
-qemuDomainGetStatsNeedMonitor(unsigned int stats)
+static int
+qemuDomainGetStatsJob(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                      virDomainObjPtr dom,
+                      virDomainStatsRecordPtr record,
+                      int *maxparams,
+                      unsigned int privflags ATTRIBUTE_UNUSED,
+                      qemuMonitorStatsPtr monstats ATTRIBUTE_UNUSED,
+                      virHashTablePtr netstats ATTRIBUTE_UNUSED)
 {
+    qemuDomainObjPrivatePtr priv = dom->privateData;
     size_t i;
 
-    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++)
-        if (stats & qemuDomainGetStatsWorkers[i].stats &&
-            qemuDomainGetStatsWorkers[i].monitor)
-            return true;
+    for (i = 0; i < QEMU_JOB_LAST; i++) {
+        /* async jobs are accounted for separately below */
+        if (i == QEMU_JOB_NONE || i == QEMU_JOB_ASYNC)
+            continue;
 
-    return false;
-}
+        if (qemuDomainGetStatsJobOne(record, maxparams, "",
+                                     qemuDomainJobTypeToString(i),
+                                     &priv->job.stats[i]) < 0)
+            return -1;
+    }
+
+    for (i = QEMU_ASYNC_JOB_NONE + 1; i < QEMU_ASYNC_JOB_LAST; i++) {
+        if (qemuDomainGetStatsJobOne(record, maxparams, "async.",
+                                     qemuDomainAsyncJobTypeToString(i),
+                                     &priv->job.asyncStats[i]) < 0)
+            return -1;
+    }
+
+    for (i = 0; i < VIR_HOOK_QEMU_OP_LAST; i++) {
+        qemuDomainHookStatsPtr stats = &priv->job.hookStats[i];
+        const char *fields[] = {
+            "count", "failed", "time.total", "time.max",
+        };
+        unsigned long long values[] = {
+            stats->count, stats->failed, stats->total, stats->max,
+        };
+        virTypedParameterPtr par;
+        size_t j;
+
+        if (!stats->count)
+            continue;
+
+        for (j = 0; j < ARRAY_CARDINALITY(fields); j++) {
+            if (!(par = virTypedParamsAppendFormat(&record->params,
+                                                   &record->nparams,
+                                                   maxparams,
+                                                   VIR_TYPED_PARAM_ULLONG,
+                                                   "job.hook.%s.%s",
+                                                   virHookQemuOpTypeToString(i),
+                                                   fields[j])))
+                return -1;
+            par->value.ul = values[j];
+        }
+    }
 
+    return 0;
+}
 
 static int
-qemuDomainGetStats(virConnectPtr conn,
-                   virDomainObjPtr dom,
-                   unsigned int stats,
-                   virDomainStatsRecordPtr *record,
-                   unsigned int flags)
+qemuDomainGetStatsMonitor(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                          virDomainObjPtr dom,
+                          virDomainStatsRecordPtr record,
+                          int *maxparams,
+                          unsigned int privflags ATTRIBUTE_UNUSED,
+                          qemuMonitorStatsPtr monstats ATTRIBUTE_UNUSED,
+                          virHashTablePtr netstats ATTRIBUTE_UNUSED)
 {
-    int maxparams = 0;
-    virDomainStatsRecordPtr tmp;
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    qemuMonitorCommandStatsPtr stats = NULL;
+    size_t nstats = 0;
     size_t i;
+    size_t j;
     int ret = -1;
 
-    if (VIR_ALLOC(tmp) < 0)
-        goto cleanup;
+    /* The monitor can only go away with the domain locked */
+    if (!virDomainObjIsActive(dom) || !priv->mon)
+        return 0;
 
-    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
-        if (stats & qemuDomainGetStatsWorkers[i].stats) {
-            if (qemuDomainGetStatsWorkers[i].func(conn->privateData, dom, tmp,
-                                                  &maxparams, flags) < 0)
+    if (qemuMonitorGetCommandStats(priv->mon, &stats, &nstats) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nstats; i++) {
+        const char *fields[] = {
+            "count", "time.total", "time.max", "time.p50", "time.p99",
+            "reply.bytes", "reply.max",
+        };
+        unsigned long long values[] = {
+            stats[i].count, stats[i].timeTotal, stats[i].timeMax,
+            stats[i].timeP50, stats[i].timeP99,
+            stats[i].replyBytes, stats[i].replyMax,
+        };
+        virTypedParameterPtr par;
+
+        for (j = 0; j < ARRAY_CARDINALITY(fields); j++) {
+            if (!(par = virTypedParamsAppendFormat(&record->params,
+                                                   &record->nparams,
+                                                   maxparams,
+                                                   VIR_TYPED_PARAM_ULLONG,
+                                                   "monitor.%s.%s",
+                                                   stats[i].name,
+                                                   fields[j])))
                 goto cleanup;
+            par->value.ul = values[j];
         }
     }
 
-    if (!(tmp->dom = virGetDomain(conn, dom->def->name,
-                                  dom->def->uuid, dom->def->id)))
-        goto cleanup;
-
-    *record = tmp;
-    tmp = NULL;
     ret = 0;
 
  cleanup:
-    if (tmp) {
-        virTypedParamsFree(tmp->params, tmp->nparams);
-        VIR_FREE(tmp);
-    }
-
+    qemuMonitorCommandStatsFree(stats, nstats);
     return ret;
 }
 
+/* Length of the dirty rate measurements started by the stats group */
+#define QEMU_DOMAIN_DIRTY_RATE_CALC_PERIOD 1
 
 static int
-qemuConnectGetAllDomainStats(virConnectPtr conn,
-                             virDomainPtr *doms,
-                             unsigned int ndoms,
-                             unsigned int stats,
-                             virDomainStatsRecordPtr **retStats,
-                             unsigned int flags)
+qemuDomainGetStatsDirtyRate(virQEMUDriverPtr driver,
+                            virDomainObjPtr dom,
+                            virDomainStatsRecordPtr record,
+                            int *maxparams,
+                            unsigned int privflags,
+                            qemuMonitorStatsPtr monstats,
+                            virHashTablePtr netstats ATTRIBUTE_UNUSED)
 {
-    virQEMUDriverPtr driver = conn->privateData;
-    virDomainObjPtr *vms = NULL;
-    virDomainObjPtr vm;
-    size_t nvms;
-    virDomainStatsRecordPtr *tmpstats = NULL;
-    bool enforce = !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS);
-    int nstats = 0;
-    size_t i;
-    int ret = -1;
-    unsigned int privflags = 0;
-    unsigned int domflags = 0;
-    unsigned int lflags = flags & (VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
-                                   VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
-                                   VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE);
+    qemuMonitorDirtyRateInfoPtr info;
+    int rc;
 
-    virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
-                  VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
-                  VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE |
-                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING |
-                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
-
-    if (virConnectGetAllDomainStatsEnsureACL(conn) < 0)
+    if (!monstats || monstats->dirtyrate.status < 0)
+        return 0;
+    info = &monstats->dirtyrate;
+
+    if (virTypedParamsAddInt(&record->params, &record->nparams, maxparams,
+                             "dirtyrate.calc_status", info->status) < 0 ||
+        virTypedParamsAddLLong(&record->params, &record->nparams, maxparams,
+                               "dirtyrate.calc_start_time",
+                               info->startTime) < 0 ||
+        virTypedParamsAddInt(&record->params, &record->nparams, maxparams,
+                             "dirtyrate.calc_period", info->calcTime) < 0)
         return -1;
 
-    if (qemuDomainGetStatsCheckSupport(&stats, enforce) < 0)
+    if (info->dirtyRate >= 0 &&
+        virTypedParamsAddLLong(&record->params, &record->nparams, maxparams,
+                               "dirtyrate.megabytes_per_second",
+                               info->dirtyRate) < 0)
         return -1;
 
-    if (ndoms) {
-        if (virDomainObjListConvert(driver->domains, conn, doms, ndoms, &vms,
-                                    &nvms, virConnectGetAllDomainStatsCheckACL,
-                                    lflags, true) < 0)
-            return -1;
-    } else {
-        if (virDomainObjListCollect(driver->domains, conn, &vms, &nvms,
-                                    virConnectGetAllDomainStatsCheckACL,
-                                    lflags) < 0)
+    /* The next query reports a fresh measurement, failing to start it
+     * only means the values stay as they are */
+    if (HAVE_JOB(privflags) && virDomainObjIsActive(dom) &&
+        info->status != QEMU_MONITOR_DIRTY_RATE_STATUS_MEASURING) {
+        qemuDomainObjEnterMonitor(driver, dom);
+        rc = qemuMonitorCalcDirtyRate(qemuDomainGetMonitor(dom),
+                                      QEMU_DOMAIN_DIRTY_RATE_CALC_PERIOD);
+        if (qemuDomainObjExitMonitor(driver, dom) < 0)
             return -1;
+        if (rc < 0)
+            virResetLastError();
     }
 
-    if (VIR_ALLOC_N(tmpstats, nvms + 1) < 0)
+    return 0;
+}
+
+#define QEMU_ADD_GUEST_PARAM_STR(record, maxparams, fmt, value, ...) \
+do { \
+    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
+    snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, \
+             "guest." fmt, __VA_ARGS__); \
+    if (value && \
+        virTypedParamsAddString(&(record)->params, \
+                                &(record)->nparams, \
+                                maxparams, \
+                                param_name, \
+                                value) < 0) \
+        goto cleanup; \
+} while (0)
+
+#define QEMU_ADD_GUEST_PARAM_UI(record, maxparams, fmt, value, ...) \
+do { \
+    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
+    snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, \
+             "guest." fmt, __VA_ARGS__); \
+    if (virTypedParamsAddUInt(&(record)->params, \
+                              &(record)->nparams, \
+                              maxparams, \
+                              param_name, \
+                              value) < 0) \
+        goto cleanup; \
+} while (0)
+
+static int
+qemuDomainGetStatsGuest(virQEMUDriverPtr driver,
+                        virDomainObjPtr dom,
+                        virDomainStatsRecordPtr record,
+                        int *maxparams,
+                        unsigned int privflags,
+                        qemuMonitorStatsPtr monstats ATTRIBUTE_UNUSED,
+                        virHashTablePtr netstats ATTRIBUTE_UNUSED)
+{
+    qemuAgentPtr agent;
+    virCapsPtr caps = NULL;
+    virDomainDefPtr def = NULL;
+    virDomainInterfacePtr *ifaces = NULL;
+    virDomainFSInfoPtr *fsinfo = NULL;
+    int nifaces = -1;
+    int nfsinfo = -1;
+    bool unresponsive = false;
+    size_t i, j;
+    int ret = -1;
+
+    /* the agent can be entered only with a job */
+    if (!HAVE_JOB(privflags) || !qemuDomainAgentAvailable(dom, false))
+        return 0;
+
+    if (!(caps = virQEMUDriverGetCapabilities(driver, false)) ||
+        !(def = virDomainDefCopy(dom->def, caps, driver->xmlopt, NULL, false)))
+        goto cleanup;
+
+    /* Failures of the agent only leave the fields out. Don't wait for
+     * the second query if the agent didn't answer the first one. */
+    agent = qemuDomainObjEnterAgent(dom);
+    if ((nifaces = qemuAgentGetInterfaces(agent, &ifaces,
+                                          VIR_DOMAIN_QEMU_AGENT_COMMAND_DEFAULT)) < 0) {
+        virErrorPtr err = virGetLastError();
+
+        unresponsive = err && err->code == VIR_ERR_AGENT_UNRESPONSIVE;
+        virResetLastError();
+    }
+    if (!unresponsive &&
+        (nfsinfo = qemuAgentGetFSInfo(agent, &fsinfo, def,
+                                      VIR_DOMAIN_QEMU_AGENT_COMMAND_DEFAULT)) < 0)
+        virResetLastError();
+    qemuDomainObjExitAgent(dom, agent);
+
+    if (nifaces >= 0) {
+        QEMU_ADD_COUNT_PARAM(record, maxparams, "guest.if", nifaces);
+
+        for (i = 0; i < nifaces; i++) {
+            virDomainInterfacePtr iface = ifaces[i];
+
+            QEMU_ADD_GUEST_PARAM_STR(record, maxparams, "if.%zu.name",
+                                     iface->name, i);
+            QEMU_ADD_GUEST_PARAM_STR(record, maxparams, "if.%zu.hwaddr",
+                                     iface->hwaddr, i);
+            QEMU_ADD_GUEST_PARAM_UI(record, maxparams, "if.%zu.addr.count",
+                                    iface->naddrs, i);
+
+            for (j = 0; j < iface->naddrs; j++) {
+                virDomainIPAddressPtr addr = iface->addrs + j;
+                const char *type = NULL;
+
+                if (addr->type == VIR_IP_ADDR_TYPE_IPV4)
+                    type = "ipv4";
+                else if (addr->type == VIR_IP_ADDR_TYPE_IPV6)
+                    type = "ipv6";
+
+                QEMU_ADD_GUEST_PARAM_STR(record, maxparams,
+                                         "if.%zu.addr.%zu.type", type, i, j);
+                QEMU_ADD_GUEST_PARAM_STR(record, maxparams,
+                                         "if.%zu.addr.%zu.addr", addr->addr,
+                                         i, j);
+                QEMU_ADD_GUEST_PARAM_UI(record, maxparams,
+                                        "if.%zu.addr.%zu.prefix", addr->prefix,
+                                        i, j);
+            }
+        }
+    }
+
+    if (nfsinfo >= 0) {
+        QEMU_ADD_COUNT_PARAM(record, maxparams, "guest.fs", nfsinfo);
+
+        for (i = 0; i < nfsinfo; i++) {
+            QEMU_ADD_GUEST_PARAM_STR(record, maxparams, "fs.%zu.mountpoint",
+                                     fsinfo[i]->mountpoint, i);
+            QEMU_ADD_GUEST_PARAM_STR(record, maxparams, "fs.%zu.name",
+                                     fsinfo[i]->name, i);
+            QEMU_ADD_GUEST_PARAM_STR(record, maxparams, "fs.%zu.fstype",
+                                     fsinfo[i]->fstype, i);
+            QEMU_ADD_GUEST_PARAM_UI(record, maxparams, "fs.%zu.disk.count",
+                                    fsinfo[i]->ndevAlias, i);
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; nifaces > 0 && i < nifaces; i++)
+        virDomainInterfaceFree(ifaces[i]);
+    VIR_FREE(ifaces);
+    for (i = 0; nfsinfo > 0 && i < nfsinfo; i++)
+        virDomainFSInfoFree(fsinfo[i]);
+    VIR_FREE(fsinfo);
+    virDomainDefFree(def);
+    virObjectUnref(caps);
+    return ret;
+}
+
+#undef QEMU_ADD_GUEST_PARAM_STR
+#undef QEMU_ADD_GUEST_PARAM_UI
+
+#undef QEMU_ADD_COUNT_PARAM
+
+typedef int
+(*qemuDomainGetStatsFunc)(virQEMUDriverPtr driver,
+                          virDomainObjPtr dom,
+                          virDomainStatsRecordPtr record,
+                          int *maxparams,
+                          unsigned int flags,
+                          qemuMonitorStatsPtr monstats,
+                          virHashTablePtr netstats);
+
+struct qemuDomainGetStatsWorker {
+    qemuDomainGetStatsFunc func;
+    unsigned int stats;
+    bool monitor;
+};
+
+static struct qemuDomainGetStatsWorker qemuDomainGetStatsWorkers[] = {
+    { qemuDomainGetStatsState, VIR_DOMAIN_STATS_STATE, false },
+    { qemuDomainGetStatsCpu, VIR_DOMAIN_STATS_CPU_TOTAL, false },
+    { qemuDomainGetStatsBalloon, VIR_DOMAIN_STATS_BALLOON, false },
+    { qemuDomainGetStatsVcpu, VIR_DOMAIN_STATS_VCPU, true },
+    { qemuDomainGetStatsInterface, VIR_DOMAIN_STATS_INTERFACE, false },
+    { qemuDomainGetStatsBlock, VIR_DOMAIN_STATS_BLOCK, true },
+    { qemuDomainGetStatsPerf, VIR_DOMAIN_STATS_PERF, false },
+    { qemuDomainGetStatsPressure, VIR_DOMAIN_STATS_PRESSURE, false },
+    { qemuDomainGetStatsJob, VIR_DOMAIN_STATS_JOB, false },
+    { qemuDomainGetStatsMonitor, VIR_DOMAIN_STATS_MONITOR, false },
+    { qemuDomainGetStatsDirtyRate, VIR_DOMAIN_STATS_DIRTYRATE, true },
+    { qemuDomainGetStatsGuest, VIR_DOMAIN_STATS_GUEST, true },
+    { NULL, 0, false }
+};
+
+
+static int
+qemuDomainGetStatsCheckSupport(unsigned int *stats,
+                               bool enforce)
+{
+    unsigned int supportedstats = 0;
+    size_t i;
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++)
+        supportedstats |= qemuDomainGetStatsWorkers[i].stats;
+
+    if (*stats == 0) {
+        /* querying all the guest agents is too expensive to be done
+         * unless asked for, and so is having QEMU track the writes to
+         * guest memory for the dirty rate */
+        *stats = supportedstats & ~(VIR_DOMAIN_STATS_GUEST |
+                                    VIR_DOMAIN_STATS_DIRTYRATE);
+        return 0;
+    }
+
+    if (enforce &&
+        *stats & ~supportedstats) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
+                       _("Stats types bits 0x%x are not supported by this daemon"),
+                       *stats & ~supportedstats);
         return -1;
+    }
 
-    if (qemuDomainGetStatsNeedMonitor(stats))
-        privflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
+    *stats &= supportedstats;
+    return 0;
+}
 
-    for (i = 0; i < nvms; i++) {
-        virDomainStatsRecordPtr tmp = NULL;
-        domflags = 0;
-        vm = vms[i];
 
-        virObjectLock(vm);
+static bool
+qemuDomainGetStatsNeedMonitor(unsigned int stats)
+{
+    size_t i;
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++)
+        if (stats & qemuDomainGetStatsWorkers[i].stats &&
+            qemuDomainGetStatsWorkers[i].monitor)
+            return true;
+
+    return false;
+}
+
+
+static unsigned int
+qemuDomainGetStatsMonitorFlags(virDomainObjPtr dom,
+                               unsigned int stats,
+                               unsigned int flags)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    unsigned int monflags = 0;
+
+    /* Not supported currently for TCG, see qemuDomainRefreshVcpuInfo.
+     * query-cpus-fast reports the halted state on s390 only, on the other
+     * architectures it is left out rather than interrupting all the vcpus
+     * with the slow query-cpus */
+    if (stats & VIR_DOMAIN_STATS_VCPU &&
+        dom->def->virtType != VIR_DOMAIN_VIRT_QEMU) {
+        if (!virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_QUERY_CPUS_FAST))
+            monflags |= QEMU_MONITOR_STATS_VCPU_HALTED;
+        else if (ARCH_IS_S390(dom->def->os.arch))
+            monflags |= QEMU_MONITOR_STATS_VCPU_HALTED |
+                        QEMU_MONITOR_STATS_VCPU_FAST;
+    }
+
+    if (stats & VIR_DOMAIN_STATS_BLOCK) {
+        monflags |= QEMU_MONITOR_STATS_BLOCK;
+        if (flags & QEMU_DOMAIN_STATS_BACKING)
+            monflags |= QEMU_MONITOR_STATS_BLOCK_BACKING;
+        if (virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_QUERY_NAMED_BLOCK_NODES))
+            monflags |= QEMU_MONITOR_STATS_BLOCK_NODES;
+    }
+
+    if (stats & VIR_DOMAIN_STATS_DIRTYRATE &&
+        virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_CALC_DIRTY_RATE))
+        monflags |= QEMU_MONITOR_STATS_DIRTY_RATE;
+
+    return monflags;
+}
+
+
+/*
+ * Run the workers of the @stats groups, filling the fields of the
+ * empty @record. On failure the fields gathered so far are left in
+ * @record.
+ *
+ * The monitor data of all the groups is fetched upfront in a single
+ * batch, so that the workers don't each need a round trip to QEMU.
+ * Likewise @netstats, if not NULL, holds the counters of all the host
+ * interfaces as returned by virNetDevTapInterfaceStatsAll.
+ */
+static int
+qemuDomainGetStatsParams(virQEMUDriverPtr driver,
+                         virDomainObjPtr dom,
+                         unsigned int stats,
+                         virDomainStatsRecordPtr record,
+                         unsigned int flags,
+                         virHashTablePtr netstats)
+{
+    qemuMonitorStats monstats;
+    qemuMonitorStatsPtr monstatsptr = NULL;
+    unsigned int monflags = 0;
+    int maxparams = 0;
+    size_t i;
+    int rc;
+    int ret = -1;
 
-        if (HAVE_JOB(privflags) &&
-            qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) == 0)
-            domflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
-        /* else: without a job it's still possible to gather some data */
+    if (HAVE_JOB(flags) && virDomainObjIsActive(dom))
+        monflags = qemuDomainGetStatsMonitorFlags(dom, stats, flags);
 
-        if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING)
-            domflags |= QEMU_DOMAIN_STATS_BACKING;
-        if (qemuDomainGetStats(conn, vm, stats, &tmp, domflags) < 0) {
-            if (HAVE_JOB(domflags) && vm)
-                qemuDomainObjEndJob(driver, vm);
+    if (monflags) {
+        qemuDomainObjEnterMonitor(driver, dom);
+        rc = qemuMonitorGetStats(qemuDomainGetMonitor(dom), monflags,
+                                 dom->def->memballoon,
+                                 virDomainDefGetVcpusMax(dom->def),
+                                 &monstats);
+        monstatsptr = &monstats;
 
-            virObjectUnlock(vm);
+        if (qemuDomainObjExitMonitor(driver, dom) < 0)
             goto cleanup;
+
+        /* failure to retrieve stats is fine at this point, whatever
+         * was fetched is used */
+        if (rc < 0)
+            virResetLastError();
+    }
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
+        if (stats & qemuDomainGetStatsWorkers[i].stats) {
+            if (qemuDomainGetStatsWorkers[i].func(driver, dom, record,
+                                                  &maxparams, flags,
+                                                  monstatsptr, netstats) < 0)
+                goto cleanup;
         }
+    }
 
-        if (tmp)
-            tmpstats[nstats++] = tmp;
+    ret = 0;
 
-        if (HAVE_JOB(domflags))
-            qemuDomainObjEndJob(driver, vm);
+ cleanup:
+    if (monstatsptr)
+        qemuMonitorStatsClear(monstatsptr);
+    return ret;
+}
 
-        virObjectUnlock(vm);
-    }
 
-    *retStats = tmpstats;
-    tmpstats = NULL;
+static int
+qemuDomainGetStats(virConnectPtr conn,
+                   virDomainObjPtr dom,
+                   unsigned int stats,
+                   virDomainStatsRecordPtr *record,
+                   unsigned int flags,
+                   virHashTablePtr netstats)
+{
+    virDomainStatsRecordPtr tmp;
+    int ret = -1;
 
-    ret = nstats;
+    if (VIR_ALLOC(tmp) < 0)
+        goto cleanup;
+
+    if (qemuDomainGetStatsParams(conn->privateData, dom, stats, tmp, flags,
+                                 netstats) < 0)
+        goto cleanup;
+
+    if (!(tmp->dom = virGetDomain(conn, dom->def->name,
+                                  dom->def->uuid, dom->def->id)))
+        goto cleanup;
+
+    *record = tmp;
+    tmp = NULL;
+    ret = 0;
 
  cleanup:
-    virDomainStatsRecordListFree(tmpstats);
-    virObjectListFreeCount(vms, nvms);
+    if (tmp) {
+        virTypedParamsFree(tmp->params, tmp->nparams);
+        VIR_FREE(tmp);
+    }
 
     return ret;
 }
 
 
+/*
+ * Return a copy of the statistics cached for @vm in @record if they
+ * were gathered for @stats and @flags no longer than @maxAge
+ * milliseconds ago. Returns 1 on cache hit, 0 on miss, -1 on error.
+ */
 static int
-qemuNodeAllocPages(virConnectPtr conn,
-                   unsigned int npages,
-                   unsigned int *pageSizes,
-                   unsigned long long *pageCounts,
-                   int startCell,
-                   unsigned int cellCount,
-                   unsigned int flags)
+qemuDomainGetStatsCached(virConnectPtr conn,
+                         virDomainObjPtr vm,
+                         unsigned int stats,
+                         unsigned int flags,
+                         unsigned int maxAge,
+                         virDomainStatsRecordPtr *record)
 {
-    bool add = !(flags & VIR_NODE_ALLOC_PAGES_SET);
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virDomainStatsRecordPtr tmp = NULL;
+    unsigned long long now;
 
-    virCheckFlags(VIR_NODE_ALLOC_PAGES_SET, -1);
+    if (!priv->statsCache ||
+        priv->statsCacheTypes != stats ||
+        priv->statsCacheFlags != flags)
+        return 0;
 
-    if (virNodeAllocPagesEnsureACL(conn) < 0)
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    if (now - priv->statsCacheTime > maxAge)
+        return 0;
+
+    if (VIR_ALLOC(tmp) < 0)
         return -1;
 
-    return virHostMemAllocPages(npages, pageSizes, pageCounts,
-                                startCell, cellCount, add);
+    if (virTypedParamsCopy(&tmp->params, priv->statsCache,
+                           priv->nstatsCache) < 0)
+        goto error;
+    tmp->nparams = priv->nstatsCache;
+
+    if (!(tmp->dom = virGetDomain(conn, vm->def->name,
+                                  vm->def->uuid, vm->def->id)))
+        goto error;
+
+    *record = tmp;
+    return 1;
+
+ error:
+    virTypedParamsFree(tmp->params, tmp->nparams);
+    VIR_FREE(tmp);
+    return -1;
+}
+
+
+/*
+ * Remember @record as the statistics of @vm gathered for @stats and
+ * @flags. Failing to do so is not fatal, the next caller will just
+ * query the domain again.
+ */
+static void
+qemuDomainSetStatsCache(virDomainObjPtr vm,
+                        unsigned int stats,
+                        unsigned int flags,
+                        virDomainStatsRecordPtr record)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virTypedParameterPtr params = NULL;
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0 ||
+        virTypedParamsCopy(&params, record->params, record->nparams) < 0) {
+        virResetLastError();
+        return;
+    }
+
+    qemuDomainStatsCacheClear(priv);
+    priv->statsCache = params;
+    priv->nstatsCache = record->nparams;
+    priv->statsCacheTypes = stats;
+    priv->statsCacheFlags = flags;
+    priv->statsCacheTime = now;
+}
+
+
+/*
+ * Gather the statistics of a single domain for
+ * qemuConnectGetAllDomainStats. @privflags is the set of
+ * QEMU_DOMAIN_STATS_* flags wanted by the caller, where HAVE_JOB
+ * means a job should be acquired if possible and CACHED that
+ * recently cached statistics may be returned instead. @netstats are
+ * the host interface counters shared by all domains of the sweep.
+ */
+static int
+qemuDomainGetStatsOne(virConnectPtr conn,
+                      virQEMUDriverPtr driver,
+                      virDomainObjPtr vm,
+                      unsigned int stats,
+                      unsigned int privflags,
+                      virHashTablePtr netstats,
+                      virDomainStatsRecordPtr *record)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    unsigned int domflags = privflags & QEMU_DOMAIN_STATS_BACKING;
+    bool cache = (privflags & QEMU_DOMAIN_STATS_CACHED) && cfg->statsCacheMaxAge;
+    int ret;
+
+    virObjectLock(vm);
+
+    if (cache &&
+        (ret = qemuDomainGetStatsCached(conn, vm, stats, domflags,
+                                        cfg->statsCacheMaxAge, record)) != 0) {
+        if (ret > 0)
+            ret = 0;
+        goto cleanup;
+    }
+
+    if (HAVE_JOB(privflags) &&
+        qemuDomainObjBeginSharedJob(driver, vm, cfg->statsJobTimeout) == 0)
+        domflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
+    /* else: without a job it's still possible to gather some data */
+
+    ret = qemuDomainGetStats(conn, vm, stats, record, domflags, netstats);
+
+    /* Only complete results are worth sharing with other callers */
+    if (ret == 0 && cache && *record &&
+        HAVE_JOB(domflags) == HAVE_JOB(privflags))
+        qemuDomainSetStatsCache(vm, stats,
+                                domflags & QEMU_DOMAIN_STATS_BACKING, *record);
+
+    if (HAVE_JOB(domflags))
+        qemuDomainObjEndJob(driver, vm);
+
+ cleanup:
+    virObjectUnlock(vm);
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
+typedef struct _qemuDomainGetStatsBatchData qemuDomainGetStatsBatchData;
+typedef qemuDomainGetStatsBatchData *qemuDomainGetStatsBatchDataPtr;
+struct _qemuDomainGetStatsBatchData {
+    virMutex lock;
+    virCond cond;
+    size_t pending;
+    virErrorPtr error;  /* first error hit by any of the workers */
+
+    virConnectPtr conn;
+    unsigned int stats;
+    unsigned int privflags;
+    virHashTablePtr netstats;
+    virDomainObjPtr *vms;
+    virDomainStatsRecordPtr *records;  /* indexed like @vms */
+};
+
+typedef struct _qemuDomainGetStatsBatchJob qemuDomainGetStatsBatchJob;
+typedef qemuDomainGetStatsBatchJob *qemuDomainGetStatsBatchJobPtr;
+struct _qemuDomainGetStatsBatchJob {
+    qemuDomainGetStatsBatchDataPtr batch;
+    size_t idx;
+};
+
+
+static void
+qemuDomainGetStatsBatchWorker(void *data, void *opaque)
+{
+    qemuDomainGetStatsBatchJobPtr job = data;
+    qemuDomainGetStatsBatchDataPtr batch = job->batch;
+    virQEMUDriverPtr driver = opaque;
+    int rc;
+
+    rc = qemuDomainGetStatsOne(batch->conn, driver, batch->vms[job->idx],
+                               batch->stats, batch->privflags,
+                               batch->netstats, &batch->records[job->idx]);
+
+    virMutexLock(&batch->lock);
+    if (rc < 0 && !batch->error)
+        batch->error = virSaveLastError();
+    if (--batch->pending == 0)
+        virCondSignal(&batch->cond);
+    virMutexUnlock(&batch->lock);
+}
+
+
+/*
+ * Gather the statistics of @vms in parallel, using the driver's
+ * statsPool, or statsNumaPools, which query each domain from the host
+ * NUMA node it lives on. @records is filled in the same order as @vms.
+ */
+static int
+qemuDomainGetStatsBatch(virConnectPtr conn,
+                        virQEMUDriverPtr driver,
+                        virDomainObjPtr *vms,
+                        size_t nvms,
+                        unsigned int stats,
+                        unsigned int privflags,
+                        virHashTablePtr netstats,
+                        virDomainStatsRecordPtr *records)
+{
+    qemuDomainGetStatsBatchData batch;
+    qemuDomainGetStatsBatchJobPtr jobs = NULL;
+    size_t i;
+    int ret = -1;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.conn = conn;
+    batch.stats = stats;
+    batch.privflags = privflags;
+    batch.netstats = netstats;
+    batch.vms = vms;
+    batch.records = records;
+
+    if (VIR_ALLOC_N(jobs, nvms) < 0)
+        return -1;
+
+    if (virMutexInit(&batch.lock) < 0) {
+        virReportSystemError(errno, "%s", _("cannot initialize mutex"));
+        goto cleanup;
+    }
+    if (virCondInit(&batch.cond) < 0) {
+        virReportSystemError(errno, "%s", _("cannot initialize condition"));
+        virMutexDestroy(&batch.lock);
+        goto cleanup;
+    }
+
+    virMutexLock(&batch.lock);
+    for (i = 0; i < nvms; i++) {
+        int rc;
+
+        jobs[i].batch = &batch;
+        jobs[i].idx = i;
+        batch.pending++;
+
+        if (driver->statsNumaPools) {
+            int node;
+
+            virObjectLock(vms[i]);
+            node = qemuDomainGetHomeNode(vms[i]);
+            virObjectUnlock(vms[i]);
+
+            rc = virThreadPoolNumaSendJob(driver->statsNumaPools, node,
+                                          0, &jobs[i]);
+        } else {
+            rc = virThreadPoolSendJob(driver->statsPool, 0, &jobs[i]);
+        }
+
+        if (rc < 0) {
+            /* Gather this one ourselves rather than failing */
+            batch.pending--;
+            virMutexUnlock(&batch.lock);
+            virResetLastError();
+            if (qemuDomainGetStatsOne(conn, driver, vms[i], stats,
+                                      privflags, netstats,
+                                      &records[i]) < 0) {
+                virMutexLock(&batch.lock);
+                if (!batch.error)
+                    batch.error = virSaveLastError();
+                continue;
+            }
+            virMutexLock(&batch.lock);
+        }
+    }
+
+    while (batch.pending) {
+        if (virCondWait(&batch.cond, &batch.lock) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("cannot wait on condition"));
+            /* Workers still reference @batch, so there is nothing
+             * better to do than to keep waiting */
+            virResetLastError();
+        }
+    }
+    virMutexUnlock(&batch.lock);
+
+    if (batch.error) {
+        virSetError(batch.error);
+        virFreeError(batch.error);
+    } else {
+        ret = 0;
+    }
+
+    virCondDestroy(&batch.cond);
+    virMutexDestroy(&batch.lock);
+
+ cleanup:
+    VIR_FREE(jobs);
+    return ret;
+}
+
+
+static int
+qemuConnectGetAllDomainStats(virConnectPtr conn,
+                             virDomainPtr *doms,
+                             unsigned int ndoms,
+                             unsigned int stats,
+                             virDomainStatsRecordPtr **retStats,
+                             unsigned int flags)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    virDomainObjPtr *vms = NULL;
+    size_t nvms;
+    virDomainStatsRecordPtr *tmpstats = NULL;
+    virHashTablePtr netstats = NULL;
+    bool enforce = !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS);
+    int nstats = 0;
+    size_t i;
+    int ret = -1;
+    unsigned int privflags = 0;
+    unsigned int lflags = flags & (VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                                   VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
+                                   VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE);
+
+    virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                  VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
+                  VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE |
+                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING |
+                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_CACHED |
+                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
+
+    if (virConnectGetAllDomainStatsEnsureACL(conn) < 0)
+        return -1;
+
+    if (qemuDomainGetStatsCheckSupport(&stats, enforce) < 0)
+        return -1;
+
+    if (ndoms) {
+        if (virDomainObjListConvert(driver->domains, conn, doms, ndoms, &vms,
+                                    &nvms, virConnectGetAllDomainStatsCheckACL,
+                                    lflags, true) < 0)
+            return -1;
+    } else {
+        if (virDomainObjListCollect(driver->domains, conn, &vms, &nvms,
+                                    virConnectGetAllDomainStatsCheckACL,
+                                    lflags) < 0)
+            return -1;
+    }
+
+    if (VIR_ALLOC_N(tmpstats, nvms + 1) < 0)
+        return -1;
+
+    if (qemuDomainGetStatsNeedMonitor(stats))
+        privflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
+    if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING)
+        privflags |= QEMU_DOMAIN_STATS_BACKING;
+    if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_CACHED)
+        privflags |= QEMU_DOMAIN_STATS_CACHED;
+
+    /* Read the counters of all the host interfaces at once rather than
+     * once per interface of each domain. Should that fail, the domains
+     * fall back to reading their own. */
+    if (stats & VIR_DOMAIN_STATS_INTERFACE &&
+        !(netstats = virNetDevTapInterfaceStatsAll()))
+        virResetLastError();
+
+    if ((driver->statsPool || driver->statsNumaPools) && nvms > 1) {
+        int rc = qemuDomainGetStatsBatch(conn, driver, vms, nvms, stats,
+                                         privflags, netstats, tmpstats);
+
+        /* Drop the holes left by domains which vanished meanwhile or
+         * failed. This has to happen even on error, as freeing the list
+         * stops at the first NULL. */
+        for (i = 0; i < nvms; i++) {
+            if (tmpstats[i])
+                tmpstats[nstats++] = tmpstats[i];
+        }
+        for (i = nstats; i < nvms; i++)
+            tmpstats[i] = NULL;
+
+        if (rc < 0)
+            goto cleanup;
+    } else {
+        for (i = 0; i < nvms; i++) {
+            virDomainStatsRecordPtr tmp = NULL;
+
+            if (qemuDomainGetStatsOne(conn, driver, vms[i], stats,
+                                      privflags, netstats, &tmp) < 0)
+                goto cleanup;
+
+            if (tmp)
+                tmpstats[nstats++] = tmp;
+        }
+    }
+
+    *retStats = tmpstats;
+    tmpstats = NULL;
+
+    ret = nstats;
+
+ cleanup:
+    virDomainStatsRecordListFree(tmpstats);
+    virObjectListFreeCount(vms, nvms);
+    virHashFree(netstats);
+
+    return ret;
+}
+
+
+static int
+qemuNodeAllocPages(virConnectPtr conn,
+                   unsigned int npages,
+                   unsigned int *pageSizes,
+                   unsigned long long *pageCounts,
+                   int startCell,
+                   unsigned int cellCount,
+                   unsigned int flags)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    bool add = !(flags & VIR_NODE_ALLOC_PAGES_SET);
+    int ret;
+
+    virCheckFlags(VIR_NODE_ALLOC_PAGES_SET, -1);
+
+    if (virNodeAllocPagesEnsureACL(conn) < 0)
+        return -1;
+
+    ret = virHostMemAllocPages(npages, pageSizes, pageCounts,
+                               startCell, cellCount, add);
+
+    /* The reservations are checked against the pool sizes. Should this
+     * fail, they'll be read again on the first failed check anyway. */
+    if (ret >= 0)
+        ignore_value(virNumaPageLedgerRefresh(driver->hugepageLedger));
+
+    return ret;
+}
+
+
+static int
+qemuDomainGetFSInfo(virDomainPtr dom,
+                    virDomainFSInfoPtr **info,
+                    unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virDomainObjPtr vm;
+    qemuAgentPtr agent;
+    virCapsPtr caps = NULL;
+    virDomainDefPtr def = NULL;
+    int ret = -1;
+
+    virCheckFlags(0, ret);
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        return ret;
+
+    if (virDomainGetFSInfoEnsureACL(dom->conn, vm->def) < 0)
+        goto cleanup;
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("domain is not running"));
+        goto endjob;
+    }
+
+    if (!qemuDomainAgentAvailable(vm, true))
+        goto endjob;
+
+    if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
+        goto endjob;
+
+    if (!(def = virDomainDefCopy(vm->def, caps, driver->xmlopt, NULL, false)))
+        goto endjob;
+
+    agent = qemuDomainObjEnterAgent(vm);
+    ret = qemuAgentGetFSInfo(agent, info, def,
+                             VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK);
+    qemuDomainObjExitAgent(vm, agent);
+
+ endjob:
+    qemuDomainObjEndJob(driver, vm);
+
+ cleanup:
+    virDomainObjEndAPI(&vm);
+    virDomainDefFree(def);
+    virObjectUnref(caps);
+    return ret;
+}
+
+static int
+qemuDomainInterfaceAddresses(virDomainPtr dom,
+                             virDomainInterfacePtr **ifaces,
+                             unsigned int source,
+                             unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virDomainObjPtr vm = NULL;
+    qemuAgentPtr agent;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
+
+    if (virDomainInterfaceAddressesEnsureACL(dom->conn, vm->def) < 0)
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("domain is not running"));
+        goto cleanup;
+    }
+
+    switch (source) {
+    case VIR_DOMAIN_INTERFACE_ADDRESSES_SRC_LEASE:
+        ret = qemuGetDHCPInterfaces(dom, vm, ifaces);
+        break;
+
+    case VIR_DOMAIN_INTERFACE_ADDRESSES_SRC_AGENT:
+        if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+            goto cleanup;
+
+        if (!qemuDomainAgentAvailable(vm, true))
+            goto endjob;
+
+        agent = qemuDomainObjEnterAgent(vm);
+        ret = qemuAgentGetInterfaces(agent, ifaces,
+                                     VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK);
+        qemuDomainObjExitAgent(vm, agent);
+
+    endjob:
+        qemuDomainObjEndJob(driver, vm);
+
+        break;
+
+    default:
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
+                       _("Unknown IP address data source %d"),
+                       source);
+        break;
+    }
+
+ cleanup:
+    virDomainObjEndAPI(&vm);
+    return ret;
+}
+
+static int
+qemuGetDHCPInterfaces(virDomainPtr dom,
+                      virDomainObjPtr vm,
+                      virDomainInterfacePtr **ifaces)
+{
+    int rv = -1;
+    int n_leases = 0;
+    size_t i, j;
+    size_t ifaces_count = 0;
+    virNetworkPtr network = NULL;
+    char macaddr[VIR_MAC_STRING_BUFLEN];
+    virDomainInterfacePtr iface = NULL;
+    virNetworkDHCPLeasePtr *leases = NULL;
+    virDomainInterfacePtr *ifaces_ret = NULL;
+
+    if (!dom->conn->networkDriver ||
+        !dom->conn->networkDriver->networkGetDHCPLeases) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Network driver does not support DHCP lease query"));
+        return -1;
+    }
+
+    for (i = 0; i < vm->def->nnets; i++) {
+        if (vm->def->nets[i]->type != VIR_DOMAIN_NET_TYPE_NETWORK)
+            continue;
+
+        virMacAddrFormat(&(vm->def->nets[i]->mac), macaddr);
+        virObjectUnref(network);
+        network = virNetworkLookupByName(dom->conn,
+                                         vm->def->nets[i]->data.network.name);
+
+        if ((n_leases = virNetworkGetDHCPLeases(network, macaddr,
+                                                &leases, 0)) < 0)
+            goto error;
+
+        if (n_leases) {
+            if (VIR_EXPAND_N(ifaces_ret, ifaces_count, 1) < 0)
+                goto error;
+
+            if (VIR_ALLOC(ifaces_ret[ifaces_count - 1]) < 0)
+                goto error;
+
+            iface = ifaces_ret[ifaces_count - 1];
+            /* Assuming each lease corresponds to a separate IP */
+            iface->naddrs = n_leases;
+
+            if (VIR_ALLOC_N(iface->addrs, iface->naddrs) < 0)
+                goto error;
+
+            if (VIR_STRDUP(iface->name, vm->def->nets[i]->ifname) < 0)
+                goto cleanup;
+
+            if (VIR_STRDUP(iface->hwaddr, macaddr) < 0)
+                goto cleanup;
+        }
+
+        for (j = 0; j < n_leases; j++) {
+            virNetworkDHCPLeasePtr lease = leases[j];
+            virDomainIPAddressPtr ip_addr = &iface->addrs[j];
+
+            if (VIR_STRDUP(ip_addr->addr, lease->ipaddr) < 0)
+                goto cleanup;
+
+            ip_addr->type = lease->type;
+            ip_addr->prefix = lease->prefix;
+        }
+
+        for (j = 0; j < n_leases; j++)
+            virNetworkDHCPLeaseFree(leases[j]);
+
+        VIR_FREE(leases);
+    }
+
+    *ifaces = ifaces_ret;
+    ifaces_ret = NULL;
+    rv = ifaces_count;
+
+ cleanup:
+    virObjectUnref(network);
+    if (leases) {
+        for (i = 0; i < n_leases; i++)
+            virNetworkDHCPLeaseFree(leases[i]);
+    }
+    VIR_FREE(leases);
+
+    return rv;
+
+ error:
+    if (ifaces_ret) {
+        for (i = 0; i < ifaces_count; i++)
+            virDomainInterfaceFree(ifaces_ret[i]);
+    }
+    VIR_FREE(ifaces_ret);
+
+    goto cleanup;
+}
+
+
+static int
+qemuDomainSetUserPassword(virDomainPtr dom,
+                          const char *user,
+                          const char *password,
+                          unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virDomainObjPtr vm;
+    qemuAgentPtr agent;
+    int ret = -1;
+    int rv;
+
+    virCheckFlags(VIR_DOMAIN_PASSWORD_ENCRYPTED, -1);
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        return ret;
+
+    if (virDomainSetUserPasswordEnsureACL(dom->conn, vm->def) < 0)
+        goto cleanup;
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("domain is not running"));
+        goto endjob;
+    }
+
+    if (!qemuDomainAgentAvailable(vm, true))
+        goto endjob;
+
+    agent = qemuDomainObjEnterAgent(vm);
+    rv = qemuAgentSetUserPassword(agent, user, password,
+                                  flags & VIR_DOMAIN_PASSWORD_ENCRYPTED);
+    qemuDomainObjExitAgent(vm, agent);
+
+    if (rv < 0)
+        goto endjob;
+
+    ret = 0;
+
+ endjob:
+    qemuDomainObjEndJob(driver, vm);
+
+ cleanup:
+    virDomainObjEndAPI(&vm);
+    return ret;
+}
+
+
+static int
+qemuDomainRenameCallback(virDomainObjPtr vm,
+                         const char *new_name,
+                         unsigned int flags,
+                         void *opaque)
+{
+    virQEMUDriverPtr driver = opaque;
+    virQEMUDriverConfigPtr cfg = NULL;
+    virObjectEventPtr event_new = NULL;
+    virObjectEventPtr event_old = NULL;
+    int ret = -1;
+    char *new_dom_name = NULL;
+    char *old_dom_name = NULL;
+    char *new_dom_cfg_file = NULL;
+    char *old_dom_cfg_file = NULL;
+
+    virCheckFlags(0, ret);
+
+    cfg = virQEMUDriverGetConfig(driver);
+
+    if (VIR_STRDUP(new_dom_name, new_name) < 0)
+        goto cleanup;
+
+    if (!(new_dom_cfg_file = virDomainConfigFile(cfg->configDir,
+                                                 new_dom_name)) ||
+        !(old_dom_cfg_file = virDomainConfigFile(cfg->configDir,
+                                                 vm->def->name)))
+        goto cleanup;
+
+    event_old = virDomainEventLifecycleNewFromObj(vm,
+                                            VIR_DOMAIN_EVENT_UNDEFINED,
+                                            VIR_DOMAIN_EVENT_UNDEFINED_RENAMED);
+
+    /* Switch name in domain definition. */
+    old_dom_name = vm->def->name;
+    vm->def->name = new_dom_name;
+    new_dom_name = NULL;
+
+    if (virDomainSaveConfig(cfg->configDir, driver->caps, vm->def) < 0)
+        goto rollback;
+
+    if (virFileExists(old_dom_cfg_file) &&
+        unlink(old_dom_cfg_file) < 0) {
+        virReportSystemError(errno,
+                             _("cannot remove old domain config file %s"),
+                             old_dom_cfg_file);
+        goto rollback;
+    }
+
+    /* Not fatal, the metadata of the old name is never loaded without its
+     * config */
+    ignore_value(virDomainDeleteMetadata(cfg->configDir, old_dom_name));
+
+    event_new = virDomainEventLifecycleNewFromObj(vm,
+                                              VIR_DOMAIN_EVENT_DEFINED,
+                                              VIR_DOMAIN_EVENT_DEFINED_RENAMED);
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(old_dom_cfg_file);
+    VIR_FREE(new_dom_cfg_file);
+    VIR_FREE(old_dom_name);
+    VIR_FREE(new_dom_name);
+    qemuDomainEventQueue(driver, event_old);
+    qemuDomainEventQueue(driver, event_new);
+    virObjectUnref(cfg);
+    return ret;
+
+ rollback:
+    if (old_dom_name) {
+        new_dom_name = vm->def->name;
+        vm->def->name = old_dom_name;
+        old_dom_name = NULL;
+    }
+
+    if (virFileExists(new_dom_cfg_file))
+        unlink(new_dom_cfg_file);
+
+    goto cleanup;
+}
+
+static int qemuDomainRename(virDomainPtr dom,
+                            const char *new_name,
+                            unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virDomainObjPtr vm = NULL;
+    int ret = -1;
+
+    virCheckFlags(0, ret);
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
+
+    if (virDomainRenameEnsureACL(dom->conn, vm->def) < 0)
+        goto cleanup;
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+        goto cleanup;
+
+    if (virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("cannot rename active domain"));
+        goto endjob;
+    }
+
+    if (!vm->persistent) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("cannot rename a transient domain"));
+        goto endjob;
+    }
+
+    if (vm->hasManagedSave) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("domain with a managed saved state can't be renamed"));
+        goto endjob;
+    }
+
+    if (virDomainObjGetState(vm, NULL) != VIR_DOMAIN_SHUTOFF) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("domain has to be shutoff before renaming"));
+        goto endjob;
+    }
+
+    if (virDomainSnapshotObjListNum(vm->snapshots, NULL, 0) > 0) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("cannot rename domain with snapshots"));
+        goto endjob;
+    }
+
+    if (virDomainObjListRename(driver->domains, vm, new_name, flags,
+                               qemuDomainRenameCallback, driver) < 0)
+        goto endjob;
+
+    /* Success, domain has been renamed. */
+    ret = 0;
+
+ endjob:
+    qemuDomainObjEndJob(driver, vm);
+
+ cleanup:
+    virDomainObjEndAPI(&vm);
+    return ret;
+}
+
+
+static int
+qemuDomainGetGuestVcpusParams(virTypedParameterPtr *params,
+                              unsigned int *nparams,
+                              qemuAgentCPUInfoPtr info,
+                              int ninfo)
+{
+    virTypedParameterPtr par = NULL;
+    int npar = 0;
+    int maxpar = 0;
+    virBitmapPtr vcpus = NULL;
+    virBitmapPtr online = NULL;
+    virBitmapPtr offlinable = NULL;
+    char *tmp = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (!(vcpus = virBitmapNew(QEMU_GUEST_VCPU_MAX_ID)) ||
+        !(online = virBitmapNew(QEMU_GUEST_VCPU_MAX_ID)) ||
+        !(offlinable = virBitmapNew(QEMU_GUEST_VCPU_MAX_ID)))
+        goto cleanup;
+
+    for (i = 0; i < ninfo; i++) {
+        if (virBitmapSetBit(vcpus, info[i].id) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("vcpu id '%u' reported by guest agent is out of "
+                             "range"), info[i].id);
+            goto cleanup;
+        }
+
+        if (info[i].online)
+            ignore_value(virBitmapSetBit(online, info[i].id));
+
+        if (info[i].offlinable)
+            ignore_value(virBitmapSetBit(offlinable, info[i].id));
+    }
+
+#define ADD_BITMAP(name)                                                       \
+    if (!(tmp = virBitmapFormat(name)))                                        \
+        goto cleanup;                                                          \
+    if (virTypedParamsAddString(&par, &npar, &maxpar, #name, tmp) < 0)         \
+        goto cleanup;                                                          \
+    VIR_FREE(tmp)
+
+    ADD_BITMAP(vcpus);
+    ADD_BITMAP(online);
+    ADD_BITMAP(offlinable);
+
+#undef ADD_BITMAP
+
+    *params = par;
+    *nparams = npar;
+    par = NULL;
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(tmp);
+    virBitmapFree(vcpus);
+    virBitmapFree(online);
+    virBitmapFree(offlinable);
+    virTypedParamsFree(par, npar);
+    return ret;
 }
 
 
 static int
-qemuDomainGetFSInfo(virDomainPtr dom,
-                    virDomainFSInfoPtr **info,
-                    unsigned int flags)
+qemuDomainGetGuestVcpus(virDomainPtr dom,
+                        virTypedParameterPtr *params,
+                        unsigned int *nparams,
+                        unsigned int flags)
 {
     virQEMUDriverPtr driver = dom->conn->privateData;
-    virDomainObjPtr vm;
+    virDomainObjPtr vm = NULL;
     qemuAgentPtr agent;
-    virCapsPtr caps = NULL;
-    virDomainDefPtr def = NULL;
+    qemuAgentCPUInfoPtr info = NULL;
+    int ninfo = 0;
     int ret = -1;
 
     virCheckFlags(0, ret);
 
     if (!(vm = qemuDomObjFromDomain(dom)))
-        return ret;
-
-    if (virDomainGetFSInfoEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+    if (virDomainGetGuestVcpusEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    if (!virDomainObjIsActive(vm)) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       "%s", _("domain is not running"));
-        goto endjob;
-    }
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+        goto cleanup;
 
     if (!qemuDomainAgentAvailable(vm, true))
         goto endjob;
 
-    if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
+    agent = qemuDomainObjEnterAgent(vm);
+    ninfo = qemuAgentGetVCPUs(agent, &info);
+    qemuDomainObjExitAgent(vm, agent);
+
+    if (ninfo < 0)
         goto endjob;
 
-    if (!(def = virDomainDefCopy(vm->def, caps, driver->xmlopt, NULL, false)))
+    if (qemuDomainGetGuestVcpusParams(params, nparams, info, ninfo) < 0)
         goto endjob;
 
-    agent = qemuDomainObjEnterAgent(vm);
-    ret = qemuAgentGetFSInfo(agent, info, def);
-    qemuDomainObjExitAgent(vm, agent);
+    ret = 0;
 
  endjob:
     qemuDomainObjEndJob(driver, vm);
 
  cleanup:
+    VIR_FREE(info);
     virDomainObjEndAPI(&vm);
-    virDomainDefFree(def);
-    virObjectUnref(caps);
     return ret;
 }
 
+
 static int
-qemuDomainInterfaceAddresses(virDomainPtr dom,
-                             virDomainInterfacePtr **ifaces,
-                             unsigned int source,
-                             unsigned int flags)
+qemuDomainSetGuestVcpus(virDomainPtr dom,
+                        const char *cpumap,
+                        int state,
+                        unsigned int flags)
 {
     virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm = NULL;
+    virBitmapPtr map = NULL;
+    qemuAgentCPUInfoPtr info = NULL;
     qemuAgentPtr agent;
+    int ninfo = 0;
+    size_t i;
     int ret = -1;
 
     virCheckFlags(0, -1);
 
+    if (state != 0 && state != 1) {
+        virReportInvalidArg(state, "%s", _("unsupported state value"));
+        return -1;
+    }
+
+    if (virBitmapParse(cpumap, &map, QEMU_GUEST_VCPU_MAX_ID) < 0)
+        goto cleanup;
+
     if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
 
-    if (virDomainInterfaceAddressesEnsureACL(dom->conn, vm->def) < 0)
+    if (virDomainSetGuestVcpusEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    if (!virDomainObjIsActive(vm)) {
-        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
-                       _("domain is not running"));
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
         goto cleanup;
-    }
 
-    switch (source) {
-    case VIR_DOMAIN_INTERFACE_ADDRESSES_SRC_LEASE:
-        ret = qemuGetDHCPInterfaces(dom, vm, ifaces);
-        break;
+    if (!qemuDomainAgentAvailable(vm, true))
+        goto endjob;
 
-    case VIR_DOMAIN_INTERFACE_ADDRESSES_SRC_AGENT:
-        if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
-            goto cleanup;
+    agent = qemuDomainObjEnterAgent(vm);
+    ninfo = qemuAgentGetVCPUs(agent, &info);
+    qemuDomainObjExitAgent(vm, agent);
+    agent = NULL;
 
-        if (!qemuDomainAgentAvailable(vm, true))
-            goto endjob;
+    if (ninfo < 0)
+        goto endjob;
 
-        agent = qemuDomainObjEnterAgent(vm);
-        ret = qemuAgentGetInterfaces(agent, ifaces);
-        qemuDomainObjExitAgent(vm, agent);
+    for (i = 0; i < ninfo; i++) {
+        if (!virBitmapIsBitSet(map, info[i].id))
+            continue;
 
-    endjob:
-        qemuDomainObjEndJob(driver, vm);
+        if (!state && !info[i].offlinable) {
+            virReportError(VIR_ERR_OPERATION_UNSUPPORTED,
+                           _("vCPU '%u' is not offlinable"), info[i].id);
+            goto endjob;
+        }
 
-        break;
+        info[i].online = !!state;
+        info[i].modified = true;
 
-    default:
-        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
-                       _("Unknown IP address data source %d"),
-                       source);
-        break;
+        ignore_value(virBitmapClearBit(map, info[i].id));
+    }
+
+    if (!virBitmapIsAllClear(map)) {
+        char *tmp = virBitmapFormat(map);
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("guest is missing vCPUs '%s'"), NULLSTR(tmp));
+        VIR_FREE(tmp);
+        goto endjob;
     }
 
+    if (!qemuDomainAgentAvailable(vm, true))
+        goto endjob;
+
+    agent = qemuDomainObjEnterAgent(vm);
+    ret = qemuAgentSetVCPUs(agent, info, ninfo);
+    qemuDomainObjExitAgent(vm, agent);
+
+ endjob:
+    qemuDomainObjEndJob(driver, vm);
+
  cleanup:
+    VIR_FREE(info);
+    virBitmapFree(map);
     virDomainObjEndAPI(&vm);
     return ret;
 }
 
+
 static int
-qemuGetDHCPInterfaces(virDomainPtr dom,
-                      virDomainObjPtr vm,
-                      virDomainInterfacePtr **ifaces)
+qemuDomainSetVcpu(virDomainPtr dom,
+                  const char *cpumap,
+                  int state,
+                  unsigned int flags)
 {
-    int rv = -1;
-    int n_leases = 0;
-    size_t i, j;
-    size_t ifaces_count = 0;
-    virNetworkPtr network = NULL;
-    char macaddr[VIR_MAC_STRING_BUFLEN];
-    virDomainInterfacePtr iface = NULL;
-    virNetworkDHCPLeasePtr *leases = NULL;
-    virDomainInterfacePtr *ifaces_ret = NULL;
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virDomainObjPtr vm = NULL;
+    virDomainDefPtr def = NULL;
+    virDomainDefPtr persistentDef = NULL;
+    virBitmapPtr map = NULL;
+    ssize_t lastvcpu;
+    int ret = -1;
 
-    if (!dom->conn->networkDriver ||
-        !dom->conn->networkDriver->networkGetDHCPLeases) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Network driver does not support DHCP lease query"));
+    virCheckFlags(VIR_DOMAIN_AFFECT_LIVE |
+                  VIR_DOMAIN_AFFECT_CONFIG, -1);
+
+    if (state != 0 && state != 1) {
+        virReportInvalidArg(state, "%s", _("unsupported state value"));
         return -1;
     }
 
-    for (i = 0; i < vm->def->nnets; i++) {
-        if (vm->def->nets[i]->type != VIR_DOMAIN_NET_TYPE_NETWORK)
-            continue;
-
-        virMacAddrFormat(&(vm->def->nets[i]->mac), macaddr);
-        virObjectUnref(network);
-        network = virNetworkLookupByName(dom->conn,
-                                         vm->def->nets[i]->data.network.name);
-
-        if ((n_leases = virNetworkGetDHCPLeases(network, macaddr,
-                                                &leases, 0)) < 0)
-            goto error;
-
-        if (n_leases) {
-            if (VIR_EXPAND_N(ifaces_ret, ifaces_count, 1) < 0)
-                goto error;
-
-            if (VIR_ALLOC(ifaces_ret[ifaces_count - 1]) < 0)
-                goto error;
-
-            iface = ifaces_ret[ifaces_count - 1];
-            /* Assuming each lease corresponds to a separate IP */
-            iface->naddrs = n_leases;
+    if (virBitmapParse(cpumap, &map, QEMU_GUEST_VCPU_MAX_ID) < 0)
+        goto cleanup;
 
-            if (VIR_ALLOC_N(iface->addrs, iface->naddrs) < 0)
-                goto error;
+    if ((lastvcpu = virBitmapLastSetBit(map)) < 0) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("no vcpus selected for modification"));
+        goto cleanup;
+    }
 
-            if (VIR_STRDUP(iface->name, vm->def->nets[i]->ifname) < 0)
-                goto cleanup;
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
 
-            if (VIR_STRDUP(iface->hwaddr, macaddr) < 0)
-                goto cleanup;
-        }
+    if (virDomainSetVcpuEnsureACL(dom->conn, vm->def, flags) < 0)
+        goto cleanup;
 
-        for (j = 0; j < n_leases; j++) {
-            virNetworkDHCPLeasePtr lease = leases[j];
-            virDomainIPAddressPtr ip_addr = &iface->addrs[j];
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+        goto cleanup;
 
-            if (VIR_STRDUP(ip_addr->addr, lease->ipaddr) < 0)
-                goto cleanup;
+    if (virDomainObjGetDefs(vm, flags, &def, &persistentDef) < 0)
+        goto endjob;
 
-            ip_addr->type = lease->type;
-            ip_addr->prefix = lease->prefix;
+    if (persistentDef) {
+        if (lastvcpu >= virDomainDefGetVcpusMax(persistentDef)) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("vcpu %zd is not present in persistent config"),
+                           lastvcpu);
+            goto endjob;
         }
-
-        for (j = 0; j < n_leases; j++)
-            virNetworkDHCPLeaseFree(leases[j]);
-
-        VIR_FREE(leases);
     }
 
-    *ifaces = ifaces_ret;
-    ifaces_ret = NULL;
-    rv = ifaces_count;
-
- cleanup:
-    virObjectUnref(network);
-    if (leases) {
-        for (i = 0; i < n_leases; i++)
-            virNetworkDHCPLeaseFree(leases[i]);
+    if (def) {
+        if (lastvcpu >= virDomainDefGetVcpusMax(def)) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("vcpu %zd is not present in live config"),
+                           lastvcpu);
+            goto endjob;
+        }
     }
-    VIR_FREE(leases);
 
-    return rv;
+    ret = qemuDomainSetVcpuInternal(driver, vm, def, persistentDef, map, !!state);
 
- error:
-    if (ifaces_ret) {
-        for (i = 0; i < ifaces_count; i++)
-            virDomainInterfaceFree(ifaces_ret[i]);
-    }
-    VIR_FREE(ifaces_ret);
+ endjob:
+    qemuDomainObjEndJob(driver, vm);
 
-    goto cleanup;
+ cleanup:
+    virBitmapFree(map);
+    virDomainObjEndAPI(&vm);
+    return ret;
 }
 
 
 static int
-qemuDomainSetUserPassword(virDomainPtr dom,
-                          const char *user,
-                          const char *password,
-                          unsigned int flags)
+qemuDomainSetBlockThreshold(virDomainPtr dom,
+                            const char *dev,
+                            unsigned long long threshold,
+                            unsigned int flags)
 {
     virQEMUDriverPtr driver = dom->conn->privateData;
-    virDomainObjPtr vm;
-    qemuAgentPtr agent;
+    qemuDomainObjPrivatePtr priv;
+    virDomainObjPtr vm = NULL;
+    virStorageSourcePtr src;
+    char *nodename = NULL;
+    int rc;
     int ret = -1;
-    int rv;
 
-    virCheckFlags(VIR_DOMAIN_PASSWORD_ENCRYPTED, -1);
+    virCheckFlags(0, -1);
 
     if (!(vm = qemuDomObjFromDomain(dom)))
-        return ret;
+        goto cleanup;
 
-    if (virDomainSetUserPasswordEnsureACL(dom->conn, vm->def) < 0)
+    priv = vm->privateData;
+
+    if (virDomainSetBlockThresholdEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
     if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
         goto cleanup;
 
     if (!virDomainObjIsActive(vm)) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       "%s", _("domain is not running"));
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("domain is not running"));
         goto endjob;
     }
 
-    if (!qemuDomainAgentAvailable(vm, true))
+    if (!virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_BLOCK_WRITE_THRESHOLD)) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("this qemu does not support setting device threshold"));
         goto endjob;
+    }
 
-    agent = qemuDomainObjEnterAgent(vm);
-    rv = qemuAgentSetUserPassword(agent, user, password,
-                                  flags & VIR_DOMAIN_PASSWORD_ENCRYPTED);
-    qemuDomainObjExitAgent(vm, agent);
+    if (!(src = qemuDomainGetStorageSourceByDevstr(dev, vm->def)))
+        goto endjob;
 
-    if (rv < 0)
+    if (!src->nodebacking &&
+        qemuBlockNodeNamesDetect(driver, vm) < 0)
+        goto endjob;
+
+    if (!src->nodebacking) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED,
+                       _("threshold currently can't be set for block device '%s'"),
+                       dev);
+        goto endjob;
+    }
+
+    if (VIR_STRDUP(nodename, src->nodebacking) < 0)
+        goto endjob;
+
+    qemuDomainObjEnterMonitor(driver, vm);
+    rc = qemuMonitorSetBlockThreshold(priv->mon, nodename, threshold);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
+        goto endjob;
+
+    if (qemuDomainBlockThresholdSet(priv, nodename, threshold) < 0 ||
+        qemuDomainSaveStatus(driver, vm) < 0)
         goto endjob;
 
     ret = 0;
@@ -19936,253 +22121,255 @@ qemuDomainSetUserPassword(virDomainPtr dom,
     qemuDomainObjEndJob(driver, vm);
 
  cleanup:
+    VIR_FREE(nodename);
     virDomainObjEndAPI(&vm);
     return ret;
 }
 
 
-static int
-qemuDomainRenameCallback(virDomainObjPtr vm,
-                         const char *new_name,
-                         unsigned int flags,
-                         void *opaque)
-{
-    virQEMUDriverPtr driver = opaque;
-    virQEMUDriverConfigPtr cfg = NULL;
-    virObjectEventPtr event_new = NULL;
-    virObjectEventPtr event_old = NULL;
-    int ret = -1;
-    char *new_dom_name = NULL;
-    char *old_dom_name = NULL;
-    char *new_dom_cfg_file = NULL;
-    char *old_dom_cfg_file = NULL;
-
-    virCheckFlags(0, ret);
-
-    cfg = virQEMUDriverGetConfig(driver);
+static bool
+qemuDomainStatsParamEqual(virTypedParameterPtr a,
+                          virTypedParameterPtr b)
+{
+    if (a->type != b->type)
+        return false;
+
+    switch ((virTypedParameterType) a->type) {
+    case VIR_TYPED_PARAM_INT:
+        return a->value.i == b->value.i;
+    case VIR_TYPED_PARAM_UINT:
+        return a->value.ui == b->value.ui;
+    case VIR_TYPED_PARAM_LLONG:
+        return a->value.l == b->value.l;
+    case VIR_TYPED_PARAM_ULLONG:
+        return a->value.ul == b->value.ul;
+    case VIR_TYPED_PARAM_DOUBLE:
+        return a->value.d == b->value.d;
+    case VIR_TYPED_PARAM_BOOLEAN:
+        return a->value.b == b->value.b;
+    case VIR_TYPED_PARAM_STRING:
+        return STREQ_NULLABLE(a->value.s, b->value.s);
+    case VIR_TYPED_PARAM_LAST:
+        break;
+    }
 
-    if (VIR_STRDUP(new_dom_name, new_name) < 0)
-        goto cleanup;
+    return false;
+}
 
-    if (!(new_dom_cfg_file = virDomainConfigFile(cfg->configDir,
-                                                 new_dom_name)) ||
-        !(old_dom_cfg_file = virDomainConfigFile(cfg->configDir,
-                                                 vm->def->name)))
-        goto cleanup;
 
-    event_old = virDomainEventLifecycleNewFromObj(vm,
-                                            VIR_DOMAIN_EVENT_UNDEFINED,
-                                            VIR_DOMAIN_EVENT_UNDEFINED_RENAMED);
+/*
+ * Store a copy of the fields of @params which are missing from @last or
+ * have a different value there into @delta. The stats workers produce
+ * the fields in a stable order, so the field at the same position in
+ * @last is checked before searching for it.
+ */
+static int
+qemuDomainStatsEventDelta(virTypedParameterPtr last,
+                          int nlast,
+                          virTypedParameterPtr params,
+                          int nparams,
+                          virTypedParameterPtr *delta,
+                          int *ndelta)
+{
+    virTypedParameterPtr ret = NULL;
+    virTypedParameterPtr prev;
+    int n = 0;
+    int i;
 
-    /* Switch name in domain definition. */
-    old_dom_name = vm->def->name;
-    vm->def->name = new_dom_name;
-    new_dom_name = NULL;
+    *delta = NULL;
+    *ndelta = 0;
 
-    if (virDomainSaveConfig(cfg->configDir, driver->caps, vm->def) < 0)
-        goto rollback;
+    if (nparams == 0)
+        return 0;
 
-    if (virFileExists(old_dom_cfg_file) &&
-        unlink(old_dom_cfg_file) < 0) {
-        virReportSystemError(errno,
-                             _("cannot remove old domain config file %s"),
-                             old_dom_cfg_file);
-        goto rollback;
-    }
+    if (VIR_ALLOC_N(ret, nparams) < 0)
+        return -1;
 
-    event_new = virDomainEventLifecycleNewFromObj(vm,
-                                              VIR_DOMAIN_EVENT_DEFINED,
-                                              VIR_DOMAIN_EVENT_DEFINED_RENAMED);
-    ret = 0;
+    for (i = 0; i < nparams; i++) {
+        if (i < nlast && STREQ(last[i].field, params[i].field))
+            prev = &last[i];
+        else
+            prev = virTypedParamsGet(last, nlast, params[i].field);
 
- cleanup:
-    VIR_FREE(old_dom_cfg_file);
-    VIR_FREE(new_dom_cfg_file);
-    VIR_FREE(old_dom_name);
-    VIR_FREE(new_dom_name);
-    qemuDomainEventQueue(driver, event_old);
-    qemuDomainEventQueue(driver, event_new);
-    virObjectUnref(cfg);
-    return ret;
+        if (prev && qemuDomainStatsParamEqual(prev, &params[i]))
+            continue;
 
- rollback:
-    if (old_dom_name) {
-        new_dom_name = vm->def->name;
-        vm->def->name = old_dom_name;
-        old_dom_name = NULL;
+        ret[n] = params[i];
+        if (params[i].type == VIR_TYPED_PARAM_STRING &&
+            VIR_STRDUP(ret[n].value.s, params[i].value.s) < 0) {
+            virTypedParamsFree(ret, n);
+            return -1;
+        }
+        n++;
     }
 
-    if (virFileExists(new_dom_cfg_file))
-        unlink(new_dom_cfg_file);
+    if (n == 0) {
+        VIR_FREE(ret);
+        return 0;
+    }
 
-    goto cleanup;
+    *delta = ret;
+    *ndelta = n;
+    return 0;
 }
 
-static int qemuDomainRename(virDomainPtr dom,
-                            const char *new_name,
-                            unsigned int flags)
-{
-    virQEMUDriverPtr driver = dom->conn->privateData;
-    virDomainObjPtr vm = NULL;
-    int ret = -1;
-
-    virCheckFlags(0, ret);
-
-    if (!(vm = qemuDomObjFromDomain(dom)))
-        goto cleanup;
-
-    if (virDomainRenameEnsureACL(dom->conn, vm->def) < 0)
-        goto cleanup;
-
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
-        goto cleanup;
 
-    if (virDomainObjIsActive(vm)) {
-        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
-                       _("cannot rename active domain"));
-        goto endjob;
-    }
+/*
+ * Sample the statistics of @vm for VIR_DOMAIN_EVENT_ID_STATS and queue
+ * the event with the fields which changed. Called from the worker pool
+ * with @vm locked.
+ */
+static void
+processStatsEvent(virQEMUDriverPtr driver,
+                  virDomainObjPtr vm)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virDomainStatsRecord record;
+    virTypedParameterPtr delta = NULL;
+    int ndelta = 0;
+    unsigned int flags = 0;
 
-    if (!vm->persistent) {
-        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
-                       _("cannot rename a transient domain"));
-        goto endjob;
-    }
+    memset(&record, 0, sizeof(record));
+    priv->statsEventPending = false;
 
-    if (vm->hasManagedSave) {
-        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
-                       _("domain with a managed saved state can't be renamed"));
-        goto endjob;
+    if (qemuDomainGetStatsNeedMonitor(priv->statsEventTypes)) {
+        if (qemuDomainObjBeginSharedJob(driver, vm,
+                                        cfg->statsJobTimeout) < 0) {
+            /* Try again on the next tick rather than stalling a worker */
+            VIR_DEBUG("Skipping stats event of domain %s: %s",
+                      vm->def->name, virGetLastErrorMessage());
+            virResetLastError();
+            goto cleanup;
+        }
+        flags |= QEMU_DOMAIN_STATS_HAVE_JOB;
     }
 
-    if (virDomainObjGetState(vm, NULL) != VIR_DOMAIN_SHUTOFF) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       "%s", _("domain has to be shutoff before renaming"));
+    /* The domain might have been stopped or the event disabled while
+     * waiting for the job */
+    if (priv->statsEventTimer == -1 || !virDomainObjIsActive(vm))
         goto endjob;
-    }
 
-    if (virDomainSnapshotObjListNum(vm->snapshots, NULL, 0) > 0) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       "%s", _("cannot rename domain with snapshots"));
+    if (qemuDomainGetStatsParams(driver, vm, priv->statsEventTypes,
+                                 &record, flags, NULL) < 0 ||
+        qemuDomainStatsEventDelta(priv->statsEventLast, priv->nstatsEventLast,
+                                  record.params, record.nparams,
+                                  &delta, &ndelta) < 0) {
+        VIR_WARN("Unable to gather stats of domain %s: %s",
+                 vm->def->name, virGetLastErrorMessage());
+        virResetLastError();
         goto endjob;
     }
 
-    if (virDomainObjListRename(driver->domains, vm, new_name, flags,
-                               qemuDomainRenameCallback, driver) < 0)
-        goto endjob;
+    virTypedParamsFree(priv->statsEventLast, priv->nstatsEventLast);
+    priv->statsEventLast = record.params;
+    priv->nstatsEventLast = record.nparams;
+    record.params = NULL;
+    record.nparams = 0;
 
-    /* Success, domain has been renamed. */
-    ret = 0;
+    if (ndelta)
+        qemuDomainEventQueue(driver,
+                             virDomainEventStatsNewFromObj(vm, delta, ndelta));
 
  endjob:
-    qemuDomainObjEndJob(driver, vm);
+    if (flags & QEMU_DOMAIN_STATS_HAVE_JOB)
+        qemuDomainObjEndJob(driver, vm);
 
  cleanup:
-    virDomainObjEndAPI(&vm);
-    return ret;
+    virTypedParamsFree(record.params, record.nparams);
+    virObjectUnref(cfg);
 }
 
 
-static int
-qemuDomainGetGuestVcpusParams(virTypedParameterPtr *params,
-                              unsigned int *nparams,
-                              qemuAgentCPUInfoPtr info,
-                              int ninfo)
+static void
+qemuDomainStatsEventTimer(int timer ATTRIBUTE_UNUSED,
+                          void *opaque)
 {
-    virTypedParameterPtr par = NULL;
-    int npar = 0;
-    int maxpar = 0;
-    virBitmapPtr vcpus = NULL;
-    virBitmapPtr online = NULL;
-    virBitmapPtr offlinable = NULL;
-    char *tmp = NULL;
-    size_t i;
-    int ret = -1;
-
-    if (!(vcpus = virBitmapNew(QEMU_GUEST_VCPU_MAX_ID)) ||
-        !(online = virBitmapNew(QEMU_GUEST_VCPU_MAX_ID)) ||
-        !(offlinable = virBitmapNew(QEMU_GUEST_VCPU_MAX_ID)))
-        goto cleanup;
-
-    for (i = 0; i < ninfo; i++) {
-        if (virBitmapSetBit(vcpus, info[i].id) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("vcpu id '%u' reported by guest agent is out of "
-                             "range"), info[i].id);
-            goto cleanup;
-        }
+    virDomainObjPtr vm = opaque;
+    qemuDomainObjPrivatePtr priv;
+    struct qemuProcessEvent *processEvent = NULL;
 
-        if (info[i].online)
-            ignore_value(virBitmapSetBit(online, info[i].id));
+    virObjectLock(vm);
+    priv = vm->privateData;
 
-        if (info[i].offlinable)
-            ignore_value(virBitmapSetBit(offlinable, info[i].id));
-    }
+    /* Don't queue up more samples if the previous one is still pending */
+    if (priv->statsEventPending || !virDomainObjIsActive(vm))
+        goto cleanup;
 
-#define ADD_BITMAP(name)                                                       \
-    if (!(tmp = virBitmapFormat(name)))                                        \
-        goto cleanup;                                                          \
-    if (virTypedParamsAddString(&par, &npar, &maxpar, #name, tmp) < 0)         \
-        goto cleanup;                                                          \
-    VIR_FREE(tmp)
+    if (VIR_ALLOC(processEvent) < 0)
+        goto cleanup;
 
-    ADD_BITMAP(vcpus);
-    ADD_BITMAP(online);
-    ADD_BITMAP(offlinable);
+    processEvent->eventType = QEMU_PROCESS_EVENT_STATS;
+    processEvent->vm = vm;
 
-#undef ADD_BITMAP
+    virObjectRef(vm);
+    if (virThreadPoolSendJob(qemu_driver->workerPool, 0, processEvent) < 0) {
+        ignore_value(virObjectUnref(vm));
+        VIR_FREE(processEvent);
+        goto cleanup;
+    }
 
-    *params = par;
-    *nparams = npar;
-    par = NULL;
-    ret = 0;
+    priv->statsEventPending = true;
 
  cleanup:
-    VIR_FREE(tmp);
-    virBitmapFree(vcpus);
-    virBitmapFree(online);
-    virBitmapFree(offlinable);
-    virTypedParamsFree(par, npar);
-    return ret;
+    virObjectUnlock(vm);
 }
 
 
 static int
-qemuDomainGetGuestVcpus(virDomainPtr dom,
-                        virTypedParameterPtr *params,
-                        unsigned int *nparams,
+qemuDomainSetStatsEvent(virDomainPtr dom,
+                        unsigned int stats,
+                        unsigned int interval,
                         unsigned int flags)
 {
     virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm = NULL;
-    qemuAgentPtr agent;
-    qemuAgentCPUInfoPtr info = NULL;
-    int ninfo = 0;
+    qemuDomainObjPrivatePtr priv;
     int ret = -1;
 
-    virCheckFlags(0, ret);
+    virCheckFlags(0, -1);
+
+    if (interval > INT_MAX / 1000) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("stats event interval %u is too large"), interval);
+        return -1;
+    }
 
     if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
 
-    if (virDomainGetGuestVcpusEnsureACL(dom->conn, vm->def) < 0)
+    priv = vm->privateData;
+
+    if (virDomainSetStatsEventEnsureACL(dom->conn, vm->def) < 0)
+        goto cleanup;
+
+    if (qemuDomainGetStatsCheckSupport(&stats, false) < 0)
         goto cleanup;
 
     if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
         goto cleanup;
 
-    if (!qemuDomainAgentAvailable(vm, true))
+    if (interval && !virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("domain is not running"));
         goto endjob;
+    }
 
-    agent = qemuDomainObjEnterAgent(vm);
-    ninfo = qemuAgentGetVCPUs(agent, &info);
-    qemuDomainObjExitAgent(vm, agent);
-
-    if (ninfo < 0)
-        goto endjob;
+    qemuDomainStatsEventClear(priv);
 
-    if (qemuDomainGetGuestVcpusParams(params, nparams, info, ninfo) < 0)
-        goto endjob;
+    if (interval) {
+        virObjectRef(vm);
+        if ((priv->statsEventTimer =
+             virEventAddTimeout(interval * 1000, qemuDomainStatsEventTimer,
+                                vm, virObjectFreeCallback)) < 0) {
+            virObjectUnref(vm);
+            priv->statsEventTimer = -1;
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("unable to add stats event timer"));
+            goto endjob;
+        }
+        priv->statsEventTypes = stats;
+    }
 
     ret = 0;
 
@@ -20190,240 +22377,215 @@ qemuDomainGetGuestVcpus(virDomainPtr dom,
     qemuDomainObjEndJob(driver, vm);
 
  cleanup:
-    VIR_FREE(info);
     virDomainObjEndAPI(&vm);
     return ret;
 }
 
 
 static int
-qemuDomainSetGuestVcpus(virDomainPtr dom,
-                        const char *cpumap,
-                        int state,
-                        unsigned int flags)
+qemuDomainBackupBegin(virDomainPtr dom,
+                      const char *backupXML,
+                      unsigned int flags)
 {
     virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm = NULL;
-    virBitmapPtr map = NULL;
-    qemuAgentCPUInfoPtr info = NULL;
-    qemuAgentPtr agent;
-    int ninfo = 0;
-    size_t i;
     int ret = -1;
 
     virCheckFlags(0, -1);
 
-    if (state != 0 && state != 1) {
-        virReportInvalidArg(state, "%s", _("unsupported state value"));
-        return -1;
-    }
-
-    if (virBitmapParse(cpumap, &map, QEMU_GUEST_VCPU_MAX_ID) < 0)
-        goto cleanup;
-
     if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
 
-    if (virDomainSetGuestVcpusEnsureACL(dom->conn, vm->def) < 0)
+    if (virDomainBackupBeginEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
-        goto cleanup;
+    ret = qemuBackupBegin(driver, vm, backupXML, flags);
 
-    if (!qemuDomainAgentAvailable(vm, true))
-        goto endjob;
+ cleanup:
+    virDomainObjEndAPI(&vm);
+    return ret;
+}
 
-    agent = qemuDomainObjEnterAgent(vm);
-    ninfo = qemuAgentGetVCPUs(agent, &info);
-    qemuDomainObjExitAgent(vm, agent);
-    agent = NULL;
 
-    if (ninfo < 0)
-        goto endjob;
+static char *
+qemuDomainBackupGetXMLDesc(virDomainPtr dom,
+                           unsigned int flags)
+{
+    virDomainObjPtr vm = NULL;
+    char *ret = NULL;
 
-    for (i = 0; i < ninfo; i++) {
-        if (!virBitmapIsBitSet(map, info[i].id))
-            continue;
+    virCheckFlags(0, NULL);
 
-        if (!state && !info[i].offlinable) {
-            virReportError(VIR_ERR_OPERATION_UNSUPPORTED,
-                           _("vCPU '%u' is not offlinable"), info[i].id);
-            goto endjob;
-        }
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
 
-        info[i].online = !!state;
-        info[i].modified = true;
+    if (virDomainBackupGetXMLDescEnsureACL(dom->conn, vm->def) < 0)
+        goto cleanup;
 
-        ignore_value(virBitmapClearBit(map, info[i].id));
-    }
+    ret = qemuBackupGetXMLDesc(vm, flags);
 
-    if (!virBitmapIsAllClear(map)) {
-        char *tmp = virBitmapFormat(map);
-        virReportError(VIR_ERR_INVALID_ARG,
-                       _("guest is missing vCPUs '%s'"), NULLSTR(tmp));
-        VIR_FREE(tmp);
-        goto endjob;
-    }
+ cleanup:
+    virDomainObjEndAPI(&vm);
+    return ret;
+}
 
-    if (!qemuDomainAgentAvailable(vm, true))
-        goto endjob;
 
-    agent = qemuDomainObjEnterAgent(vm);
-    ret = qemuAgentSetVCPUs(agent, info, ninfo);
-    qemuDomainObjExitAgent(vm, agent);
+static int
+qemuDomainBackupEnd(virDomainPtr dom,
+                    unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virDomainObjPtr vm = NULL;
+    int ret = -1;
 
- endjob:
-    qemuDomainObjEndJob(driver, vm);
+    virCheckFlags(VIR_DOMAIN_BACKUP_END_ABORT |
+                  VIR_DOMAIN_BACKUP_END_DROP_INCREMENTAL, -1);
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
+
+    if (virDomainBackupEndEnsureACL(dom->conn, vm->def) < 0)
+        goto cleanup;
+
+    ret = qemuBackupEnd(driver, vm, flags);
 
  cleanup:
-    VIR_FREE(info);
-    virBitmapFree(map);
     virDomainObjEndAPI(&vm);
     return ret;
 }
 
 
 static int
-qemuDomainSetVcpu(virDomainPtr dom,
-                  const char *cpumap,
-                  int state,
-                  unsigned int flags)
+qemuDomainBlockJobGroupStart(virDomainPtr dom,
+                             virTypedParameterPtr params,
+                             int nparams,
+                             unsigned int flags)
 {
     virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm = NULL;
-    virDomainDefPtr def = NULL;
-    virDomainDefPtr persistentDef = NULL;
-    virBitmapPtr map = NULL;
-    ssize_t lastvcpu;
     int ret = -1;
 
-    virCheckFlags(VIR_DOMAIN_AFFECT_LIVE |
-                  VIR_DOMAIN_AFFECT_CONFIG, -1);
+    virCheckFlags(0, -1);
 
-    if (state != 0 && state != 1) {
-        virReportInvalidArg(state, "%s", _("unsupported state value"));
+    if (virTypedParamsValidate(params, nparams,
+                               VIR_DOMAIN_BLOCK_JOB_GROUP_DISK,
+                               VIR_TYPED_PARAM_STRING |
+                               VIR_TYPED_PARAM_MULTIPLE,
+                               VIR_DOMAIN_BLOCK_JOB_GROUP_TYPE,
+                               VIR_TYPED_PARAM_INT,
+                               VIR_DOMAIN_BLOCK_JOB_GROUP_BANDWIDTH,
+                               VIR_TYPED_PARAM_ULLONG,
+                               VIR_DOMAIN_BLOCK_JOB_GROUP_CONCURRENCY,
+                               VIR_TYPED_PARAM_UINT,
+                               NULL) < 0)
         return -1;
-    }
-
-    if (virBitmapParse(cpumap, &map, QEMU_GUEST_VCPU_MAX_ID) < 0)
-        goto cleanup;
-
-    if ((lastvcpu = virBitmapLastSetBit(map)) < 0) {
-        virReportError(VIR_ERR_INVALID_ARG, "%s",
-                       _("no vcpus selected for modification"));
-        goto cleanup;
-    }
 
     if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
 
-    if (virDomainSetVcpuEnsureACL(dom->conn, vm->def, flags) < 0)
+    if (virDomainBlockJobGroupStartEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
     if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
         goto cleanup;
 
-    if (virDomainObjGetDefs(vm, flags, &def, &persistentDef) < 0)
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("domain is not running"));
         goto endjob;
-
-    if (persistentDef) {
-        if (lastvcpu >= virDomainDefGetVcpusMax(persistentDef)) {
-            virReportError(VIR_ERR_INVALID_ARG,
-                           _("vcpu %zd is not present in persistent config"),
-                           lastvcpu);
-            goto endjob;
-        }
-    }
-
-    if (def) {
-        if (lastvcpu >= virDomainDefGetVcpusMax(def)) {
-            virReportError(VIR_ERR_INVALID_ARG,
-                           _("vcpu %zd is not present in live config"),
-                           lastvcpu);
-            goto endjob;
-        }
     }
 
-    ret = qemuDomainSetVcpuInternal(driver, vm, def, persistentDef, map, !!state);
+    ret = qemuBlockJobGroupStart(driver, vm, params, nparams);
 
  endjob:
     qemuDomainObjEndJob(driver, vm);
 
  cleanup:
-    virBitmapFree(map);
     virDomainObjEndAPI(&vm);
     return ret;
 }
 
 
 static int
-qemuDomainSetBlockThreshold(virDomainPtr dom,
-                            const char *dev,
-                            unsigned long long threshold,
-                            unsigned int flags)
+qemuDomainBlockJobGroupGetStats(virDomainPtr dom,
+                                virTypedParameterPtr *params,
+                                int *nparams,
+                                unsigned int flags)
 {
     virQEMUDriverPtr driver = dom->conn->privateData;
     qemuDomainObjPrivatePtr priv;
     virDomainObjPtr vm = NULL;
-    virStorageSourcePtr src;
-    char *nodename = NULL;
-    int rc;
     int ret = -1;
 
     virCheckFlags(0, -1);
 
     if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-
     priv = vm->privateData;
 
-    if (virDomainSetBlockThresholdEnsureACL(dom->conn, vm->def) < 0)
+    if (virDomainBlockJobGroupGetStatsEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
         goto cleanup;
 
     if (!virDomainObjIsActive(vm)) {
-        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
-                       _("domain is not running"));
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("domain is not running"));
         goto endjob;
     }
 
-    if (!virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_BLOCK_WRITE_THRESHOLD)) {
-        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
-                       _("this qemu does not support setting device threshold"));
+    if (qemuBlockJobGroupRefresh(driver, vm) < 0)
         goto endjob;
-    }
 
-    if (!(src = qemuDomainGetStorageSourceByDevstr(dev, vm->def)))
+    if (!priv->blockJobGroup) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("no block job group is running"));
         goto endjob;
+    }
 
-    if (!src->nodebacking &&
-        qemuBlockNodeNamesDetect(driver, vm) < 0)
-        goto endjob;
+    ret = qemuBlockJobGroupStats(priv->blockJobGroup, params, nparams);
 
-    if (!src->nodebacking) {
-        virReportError(VIR_ERR_OPERATION_UNSUPPORTED,
-                       _("threshold currently can't be set for block device '%s'"),
-                       dev);
-        goto endjob;
-    }
+ endjob:
+    qemuDomainObjEndJob(driver, vm);
 
-    if (VIR_STRDUP(nodename, src->nodebacking) < 0)
-        goto endjob;
+ cleanup:
+    virDomainObjEndAPI(&vm);
+    return ret;
+}
 
-    qemuDomainObjEnterMonitor(driver, vm);
-    rc = qemuMonitorSetBlockThreshold(priv->mon, nodename, threshold);
-    if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
+
+static int
+qemuDomainBlockJobGroupAbort(virDomainPtr dom,
+                             unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virDomainObjPtr vm = NULL;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
+
+    if (virDomainBlockJobGroupAbortEnsureACL(dom->conn, vm->def) < 0)
+        goto cleanup;
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("domain is not running"));
         goto endjob;
+    }
 
-    ret = 0;
+    ret = qemuBlockJobGroupAbort(driver, vm);
 
  endjob:
     qemuDomainObjEndJob(driver, vm);
 
  cleanup:
-    VIR_FREE(nodename);
     virDomainObjEndAPI(&vm);
     return ret;
 }
@@ -20643,7 +22805,17 @@ static virHypervisorDriver qemuHypervisorDriver = {
     .domainGetGuestVcpus = qemuDomainGetGuestVcpus, /* 2.0.0 */
     .domainSetGuestVcpus = qemuDomainSetGuestVcpus, /* 2.0.0 */
     .domainSetVcpu = qemuDomainSetVcpu, /* 3.1.0 */
-    .domainSetBlockThreshold = qemuDomainSetBlockThreshold /* 3.2.0 */
+    .domainSetBlockThreshold = qemuDomainSetBlockThreshold, /* 3.2.0 */
+    .domainSetStatsEvent = qemuDomainSetStatsEvent, /* 3.3.0 */
+    .connectCompareCPUs = qemuConnectCompareCPUs, /* 3.3.0 */
+    .domainAttachDevices = qemuDomainAttachDevices, /* 3.3.0 */
+    .connectListAllDomainsFields = qemuConnectListAllDomainsFields, /* 3.3.0 */
+    .domainBackupBegin = qemuDomainBackupBegin, /* 3.3.0 */
+    .domainBackupGetXMLDesc = qemuDomainBackupGetXMLDesc, /* 3.3.0 */
+    .domainBackupEnd = qemuDomainBackupEnd, /* 3.3.0 */
+    .domainBlockJobGroupStart = qemuDomainBlockJobGroupStart, /* 3.3.0 */
+    .domainBlockJobGroupGetStats = qemuDomainBlockJobGroupGetStats, /* 3.3.0 */
+    .domainBlockJobGroupAbort = qemuDomainBlockJobGroupAbort, /* 3.3.0 */
 };
 
 
@@ -981,6 +981,8 @@ qemuDomainAttachNetDevice(virQEMUDriverPtr driver,
     if (networkAllocateActualDevice(vm->def, net) < 0)
         goto cleanup;
 
+    qemuDomainNetPrepareAutoQueues(vm->def, net, priv->qemuCaps);
+
     actualType = virDomainNetGetActualType(net);
 
     /* Currently only TAP/macvtap devices supports multiqueue. */
@@ -2273,6 +2275,9 @@ qemuDomainAttachMemory(virQEMUDriverPtr driver,
     if (qemuDomainAdjustMaxMemLock(vm) < 0)
         goto removedef;
 
+    if (qemuDomainReserveHugepages(driver, vm, false) < 0)
+        goto removedef;
+
     qemuDomainObjEnterMonitor(driver, vm);
     rv = qemuMonitorAddObject(priv->mon, backendType, objalias, props);
     props = NULL; /* qemuMonitorAddObject consumes */
@@ -2343,9 +2348,10 @@ qemuDomainAttachMemory(virQEMUDriverPtr driver,
     else
         mem = NULL;
 
-    /* reset the mlock limit */
+    /* reset the mlock limit and huge page reservation */
     orig_err = virSaveLastError();
     ignore_value(qemuDomainAdjustMaxMemLock(vm));
+    ignore_value(qemuDomainReserveHugepages(driver, vm, true));
     virSetError(orig_err);
     virFreeError(orig_err);
 
@@ -3795,6 +3801,8 @@ qemuDomainRemoveMemoryDevice(virQEMUDriverPtr driver,
     /* decrease the mlock limit after memory unplug if necessary */
     ignore_value(qemuDomainAdjustMaxMemLock(vm));
 
+    ignore_value(qemuDomainReserveHugepages(driver, vm, true));
+
     return 0;
 }
 
@@ -5435,44 +5443,94 @@ qemuDomainHotplugDelVcpu(virQEMUDriverPtr driver,
 }
 
 
+/**
+ * qemuDomainHotplugAddVcpus:
+ * @driver: qemu driver data
+ * @vm: domain object
+ * @vcpumap: bitmap of the vcpu entities to plug
+ *
+ * Plugs all the vcpu entities selected in @vcpumap. The device_add commands
+ * are sent to QEMU in a single batch and the vcpu information is refreshed
+ * only once afterwards, since each refresh interrupts all the vcpus of the
+ * guest unless query-cpus-fast is supported.
+ *
+ * Returns 0 on success, -1 if any of the vcpus failed to be plugged. The
+ * vcpus that were plugged are set up even in that case.
+ */
 static int
-qemuDomainHotplugAddVcpu(virQEMUDriverPtr driver,
-                         virDomainObjPtr vm,
-                         unsigned int vcpu)
+qemuDomainHotplugAddVcpus(virQEMUDriverPtr driver,
+                          virDomainObjPtr vm,
+                          virBitmapPtr vcpumap)
 {
-    virJSONValuePtr vcpuprops = NULL;
-    virDomainVcpuDefPtr vcpuinfo = virDomainDefGetVcpu(vm->def, vcpu);
-    qemuDomainVcpuPrivatePtr vcpupriv = QEMU_DOMAIN_VCPU_PRIVATE(vcpuinfo);
-    unsigned int nvcpus = vcpupriv->vcpus;
+    virJSONValuePtr *vcpuprops = NULL;
+    bool *added = NULL;
+    virDomainVcpuDefPtr vcpuinfo;
+    qemuDomainVcpuPrivatePtr vcpupriv;
     bool newhotplug = qemuDomainSupportsNewVcpuHotplug(vm);
-    int ret = -1;
-    int rc;
+    size_t nentities = virBitmapCountBits(vcpumap);
     int oldvcpus = virDomainDefGetVcpus(vm->def);
+    int curvcpus = oldvcpus;
+    bool anyadded = false;
+    ssize_t nextvcpu = -1;
+    size_t n;
     size_t i;
+    int ret = -1;
+    int rc = 0;
+
+    if (nentities == 0)
+        return 0;
+
+    if (VIR_ALLOC_N(vcpuprops, nentities) < 0 ||
+        VIR_ALLOC_N(added, nentities) < 0)
+        goto cleanup;
 
     if (newhotplug) {
-        if (virAsprintf(&vcpupriv->alias, "vcpu%u", vcpu) < 0)
-            goto cleanup;
+        for (n = 0; (nextvcpu = virBitmapNextSetBit(vcpumap, nextvcpu)) != -1; n++) {
+            vcpuinfo = virDomainDefGetVcpu(vm->def, nextvcpu);
+            vcpupriv = QEMU_DOMAIN_VCPU_PRIVATE(vcpuinfo);
 
-        if (!(vcpuprops = qemuBuildHotpluggableCPUProps(vcpuinfo)))
-            goto cleanup;
+            if (virAsprintf(&vcpupriv->alias, "vcpu%zd", nextvcpu) < 0 ||
+                !(vcpuprops[n] = qemuBuildHotpluggableCPUProps(vcpuinfo)))
+                goto error;
+        }
     }
 
     qemuDomainObjEnterMonitor(driver, vm);
 
     if (newhotplug) {
-        rc = qemuMonitorAddDeviceArgs(qemuDomainGetMonitor(vm), vcpuprops);
-        vcpuprops = NULL;
+        rc = qemuMonitorAddDevicesArgs(qemuDomainGetMonitor(vm),
+                                       vcpuprops, nentities, added);
     } else {
-        rc = qemuMonitorSetCPU(qemuDomainGetMonitor(vm), vcpu, true);
+        for (n = 0; (nextvcpu = virBitmapNextSetBit(vcpumap, nextvcpu)) != -1; n++) {
+            if ((rc = qemuMonitorSetCPU(qemuDomainGetMonitor(vm),
+                                        nextvcpu, true)) < 0)
+                break;
+            added[n] = true;
+        }
     }
 
     if (qemuDomainObjExitMonitor(driver, vm) < 0)
         goto cleanup;
 
-    virDomainAuditVcpu(vm, oldvcpus, oldvcpus + nvcpus, "update", rc == 0);
+    nextvcpu = -1;
+    for (n = 0; (nextvcpu = virBitmapNextSetBit(vcpumap, nextvcpu)) != -1; n++) {
+        vcpuinfo = virDomainDefGetVcpu(vm->def, nextvcpu);
+        vcpupriv = QEMU_DOMAIN_VCPU_PRIVATE(vcpuinfo);
 
-    if (rc < 0)
+        if (!added[n]) {
+            virDomainAuditVcpu(vm, curvcpus, curvcpus + vcpupriv->vcpus,
+                               "update", false);
+            VIR_FREE(vcpupriv->alias);
+            continue;
+        }
+
+        virDomainAuditVcpu(vm, curvcpus, curvcpus + vcpupriv->vcpus,
+                           "update", true);
+        curvcpus += vcpupriv->vcpus;
+        anyadded = true;
+    }
+
+    if (!anyadded)
         goto cleanup;
 
     /* start outputting of the new XML element to allow keeping unpluggability */
@@ -5483,25 +5541,47 @@ qemuDomainHotplugAddVcpu(virQEMUDriverPtr driver,
         goto cleanup;
 
     /* validation requires us to set the expected state prior to calling it */
-    for (i = vcpu; i < vcpu + nvcpus; i++) {
-        vcpuinfo = virDomainDefGetVcpu(vm->def, i);
+    nextvcpu = -1;
+    for (n = 0; (nextvcpu = virBitmapNextSetBit(vcpumap, nextvcpu)) != -1; n++) {
+        if (!added[n])
+            continue;
+
+        vcpuinfo = virDomainDefGetVcpu(vm->def, nextvcpu);
         vcpupriv = QEMU_DOMAIN_VCPU_PRIVATE(vcpuinfo);
 
-        vcpuinfo->online = true;
+        for (i = nextvcpu; i < nextvcpu + vcpupriv->vcpus; i++) {
+            virDomainVcpuDefPtr vcpu = virDomainDefGetVcpu(vm->def, i);
 
-        if (vcpupriv->tid > 0 &&
-            qemuProcessSetupVcpu(vm, i) < 0)
-            goto cleanup;
+            vcpu->online = true;
+
+            if (QEMU_DOMAIN_VCPU_PRIVATE(vcpu)->tid > 0 &&
+                qemuProcessSetupVcpu(vm, i) < 0)
+                goto cleanup;
+        }
     }
 
     if (qemuDomainValidateVcpuInfo(vm) < 0)
         goto cleanup;
 
-    ret = 0;
+    if (rc == 0)
+        ret = 0;
 
  cleanup:
-    virJSONValueFree(vcpuprops);
+    if (vcpuprops) {
+        for (n = 0; n < nentities; n++)
+            virJSONValueFree(vcpuprops[n]);
+    }
+    VIR_FREE(vcpuprops);
+    VIR_FREE(added);
     return ret;
+
+ error:
+    nextvcpu = -1;
+    while ((nextvcpu = virBitmapNextSetBit(vcpumap, nextvcpu)) != -1) {
+        vcpuinfo = virDomainDefGetVcpu(vm->def, nextvcpu);
+        VIR_FREE(QEMU_DOMAIN_VCPU_PRIVATE(vcpuinfo)->alias);
+    }
+    goto cleanup;
 }
 
 
@@ -5618,10 +5698,7 @@ qemuDomainSetVcpusLive(virQEMUDriverPtr driver,
         goto cleanup;
 
     if (enable) {
-        while ((nextvcpu = virBitmapNextSetBit(vcpumap, nextvcpu)) != -1) {
-            if ((rc = qemuDomainHotplugAddVcpu(driver, vm, nextvcpu)) < 0)
-                break;
-        }
+        rc = qemuDomainHotplugAddVcpus(driver, vm, vcpumap);
     } else {
         for (nextvcpu = virDomainDefGetVcpusMax(vm->def) - 1; nextvcpu >= 0; nextvcpu--) {
             if (!virBitmapIsBitSet(vcpumap, nextvcpu))
@@ -5634,7 +5711,7 @@ qemuDomainSetVcpusLive(virQEMUDriverPtr driver,
 
     qemuDomainVcpuPersistOrder(vm->def);
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         goto cleanup;
 
     if (rc < 0)
@@ -539,7 +539,7 @@ qemuMigrationStartNBDServer(virQEMUDriverPtr driver,
                 goto exit_monitor;
         }
 
-        if (qemuMonitorNBDServerAdd(priv->mon, diskAlias, true) < 0)
+        if (qemuMonitorNBDServerAdd(priv->mon, diskAlias, NULL, true, NULL) < 0)
             goto exit_monitor;
         if (qemuDomainObjExitMonitor(driver, vm) < 0)
             goto cleanup;
@@ -836,6 +836,223 @@ qemuMigrationCancelDriveMirror(virQEMUDriverPtr driver,
 }
 
 
+typedef struct _qemuMigrationMirrorDisk qemuMigrationMirrorDisk;
+typedef qemuMigrationMirrorDisk *qemuMigrationMirrorDiskPtr;
+struct _qemuMigrationMirrorDisk {
+    virDomainDiskDefPtr disk;
+    unsigned long long capacity;
+    size_t idx;
+};
+
+
+static int
+qemuMigrationMirrorDiskCompare(const void *a,
+                               const void *b)
+{
+    const qemuMigrationMirrorDisk *da = a;
+    const qemuMigrationMirrorDisk *db = b;
+
+    /* largest disks first */
+    if (da->capacity > db->capacity)
+        return -1;
+    if (da->capacity < db->capacity)
+        return 1;
+    /* keep the order of disks of the same size */
+    return da->idx < db->idx ? -1 : 1;
+}
+
+
+/**
+ * qemuMigrationDriveMirrorSort:
+ *
+ * Fills @disks with the disks which should be migrated ordered by their
+ * size so that the largest ones, which will take the longest, are copied
+ * first. Missing sizes are not fatal, such disks just come last.
+ */
+static int
+qemuMigrationDriveMirrorSort(virQEMUDriverPtr driver,
+                             virDomainObjPtr vm,
+                             size_t nmigrate_disks,
+                             const char **migrate_disks,
+                             qemuMigrationMirrorDiskPtr *disks,
+                             size_t *ndisks)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virHashTablePtr blockstats = NULL;
+    qemuBlockStatsPtr stats;
+    int rc;
+    size_t i;
+
+    *disks = NULL;
+    *ndisks = 0;
+
+    if (VIR_ALLOC_N(*disks, vm->def->ndisks) < 0)
+        return -1;
+
+    if (qemuDomainObjEnterMonitorAsync(driver, vm,
+                                       QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
+        return -1;
+    rc = qemuMonitorGetAllBlockStatsInfo(priv->mon, &blockstats, false);
+    if (rc >= 0)
+        rc = qemuMonitorBlockStatsUpdateCapacity(priv->mon, blockstats, false);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0) {
+        virHashFree(blockstats);
+        return -1;
+    }
+    if (rc < 0) {
+        VIR_DEBUG("Unable to get disk sizes, keeping their order");
+        virResetLastError();
+    }
+
+    for (i = 0; i < vm->def->ndisks; i++) {
+        virDomainDiskDefPtr disk = vm->def->disks[i];
+        qemuMigrationMirrorDiskPtr d = *disks + *ndisks;
+
+        if (!qemuMigrateDisk(disk, nmigrate_disks, migrate_disks))
+            continue;
+
+        d->disk = disk;
+        d->idx = i;
+        if (blockstats && disk->info.alias &&
+            (stats = virHashLookup(blockstats, disk->info.alias)))
+            d->capacity = stats->capacity;
+        (*ndisks)++;
+    }
+
+    qsort(*disks, *ndisks, sizeof(**disks), qemuMigrationMirrorDiskCompare);
+    virHashFree(blockstats);
+    return 0;
+}
+
+
+static int
+qemuMigrationDriveMirrorStart(virQEMUDriverPtr driver,
+                              virDomainObjPtr vm,
+                              virDomainDiskDefPtr disk,
+                              const char *hoststr,
+                              int port,
+                              unsigned long long speed,
+                              unsigned int mirror_flags)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainDiskPrivatePtr diskPriv = QEMU_DOMAIN_DISK_PRIVATE(disk);
+    char *diskAlias = NULL;
+    char *nbd_dest = NULL;
+    int mon_ret;
+    int ret = -1;
+
+    VIR_DEBUG("Starting drive mirror for disk %s", disk->dst);
+
+    if (!(diskAlias = qemuAliasFromDisk(disk)) ||
+        (virAsprintf(&nbd_dest, "nbd:%s:%d:exportname=%s",
+                     hoststr, port, diskAlias) < 0))
+        goto cleanup;
+
+    if (qemuDomainObjEnterMonitorAsync(driver, vm,
+                                       QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
+        goto cleanup;
+
+    qemuBlockJobSyncBegin(disk);
+    /* Force "raw" format for NBD export */
+    mon_ret = qemuMonitorDriveMirror(priv->mon, diskAlias, nbd_dest,
+                                     "raw", speed, 0, 0, mirror_flags);
+
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || mon_ret < 0) {
+        qemuBlockJobSyncEnd(driver, vm, disk);
+        goto cleanup;
+    }
+    diskPriv->migrating = true;
+
+    if (qemuDomainSaveStatus(driver, vm) < 0) {
+        VIR_WARN("Failed to save status on vm %s", vm->def->name);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(diskAlias);
+    VIR_FREE(nbd_dest);
+    return ret;
+}
+
+
+/**
+ * qemuMigrationDriveMirrorThrottle:
+ *
+ * Splits the migration bandwidth @speed evenly among the running mirrors
+ * so that all of them together stay within the limit. Returns the
+ * bandwidth each of them gets.
+ */
+static int
+qemuMigrationDriveMirrorThrottle(virQEMUDriverPtr driver,
+                                 virDomainObjPtr vm,
+                                 unsigned long long speed,
+                                 size_t nrunning,
+                                 unsigned long long *share)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long newShare = speed / MAX(nrunning, 1);
+    size_t i;
+    int rc = 0;
+
+    if (!speed || newShare == *share)
+        return 0;
+
+    VIR_DEBUG("Limiting each of %zu disk mirrors to %llu bytes/s",
+              nrunning, newShare);
+
+    if (qemuDomainObjEnterMonitorAsync(driver, vm,
+                                       QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
+        return -1;
+
+    for (i = 0; i < vm->def->ndisks && rc == 0; i++) {
+        virDomainDiskDefPtr disk = vm->def->disks[i];
+        char *diskAlias;
+
+        if (!QEMU_DOMAIN_DISK_PRIVATE(disk)->migrating)
+            continue;
+
+        if (!(diskAlias = qemuAliasFromDisk(disk))) {
+            rc = -1;
+            break;
+        }
+        rc = qemuMonitorBlockJobSetSpeed(priv->mon, diskAlias, newShare, true);
+        VIR_FREE(diskAlias);
+    }
+
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
+        return -1;
+
+    *share = newShare;
+    return 0;
+}
+
+
+/**
+ * qemuMigrationDriveMirrorCopying:
+ *
+ * Returns the number of running disk mirrors which did not copy the
+ * whole disk yet.
+ */
+static size_t
+qemuMigrationDriveMirrorCopying(virDomainObjPtr vm)
+{
+    size_t i;
+    size_t copying = 0;
+
+    for (i = 0; i < vm->def->ndisks; i++) {
+        virDomainDiskDefPtr disk = vm->def->disks[i];
+
+        if (QEMU_DOMAIN_DISK_PRIVATE(disk)->migrating &&
+            disk->mirrorState != VIR_DOMAIN_DISK_MIRROR_STATE_READY)
+            copying++;
+    }
+
+    return copying;
+}
+
+
 /**
  * qemuMigrationDriveMirror:
  * @driver: qemu driver
@@ -853,6 +1070,11 @@ qemuMigrationCancelDriveMirror(virQEMUDriverPtr driver,
  * expected to call qemuMigrationCancelDriveMirror to stop all
  * running mirrors.
  *
+ * The largest disks are started first and at most
+ * migration_max_parallel_mirrors (from qemu.conf) of them copy at the
+ * same time. The migration bandwidth @speed is shared among the running
+ * mirrors.
+ *
  * Returns 0 on success (@migrate_flags updated),
  *        -1 otherwise.
  */
@@ -868,16 +1090,18 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
                          virConnectPtr dconn)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     int ret = -1;
     int port;
-    size_t i;
-    char *diskAlias = NULL;
-    char *nbd_dest = NULL;
     char *hoststr = NULL;
     unsigned long long mirror_speed = speed;
+    unsigned long long share = 0;
     unsigned int mirror_flags = VIR_DOMAIN_BLOCK_REBASE_REUSE_EXT;
+    qemuMigrationMirrorDiskPtr disks = NULL;
+    size_t ndisks = 0;
+    size_t next = 0;
+    size_t maxCopying = cfg->migrationMaxParallelMirrors;
     int rv;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     VIR_DEBUG("Starting drive mirrors for domain %s", vm->def->name);
 
@@ -904,45 +1128,46 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
     if (*migrate_flags & QEMU_MONITOR_MIGRATE_NON_SHARED_INC)
         mirror_flags |= VIR_DOMAIN_BLOCK_REBASE_SHALLOW;
 
-    for (i = 0; i < vm->def->ndisks; i++) {
-        virDomainDiskDefPtr disk = vm->def->disks[i];
-        qemuDomainDiskPrivatePtr diskPriv = QEMU_DOMAIN_DISK_PRIVATE(disk);
-        int mon_ret;
+    if (qemuMigrationDriveMirrorSort(driver, vm, nmigrate_disks, migrate_disks,
+                                     &disks, &ndisks) < 0)
+        goto cleanup;
 
-        /* check whether disk should be migrated */
-        if (!qemuMigrateDisk(disk, nmigrate_disks, migrate_disks))
-            continue;
+    if (maxCopying == 0)
+        maxCopying = ndisks;
 
-        if (!(diskAlias = qemuAliasFromDisk(disk)) ||
-            (virAsprintf(&nbd_dest, "nbd:%s:%d:exportname=%s",
-                         hoststr, port, diskAlias) < 0))
-            goto cleanup;
+    for (;;) {
+        size_t copying = qemuMigrationDriveMirrorCopying(vm);
 
-        if (qemuDomainObjEnterMonitorAsync(driver, vm,
-                                           QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
-            goto cleanup;
+        if (next < ndisks && copying < maxCopying) {
+            size_t nstart = MIN(maxCopying - copying, ndisks - next);
 
-        qemuBlockJobSyncBegin(disk);
-        /* Force "raw" format for NBD export */
-        mon_ret = qemuMonitorDriveMirror(priv->mon, diskAlias, nbd_dest,
-                                         "raw", mirror_speed, 0, 0, mirror_flags);
-        VIR_FREE(diskAlias);
-        VIR_FREE(nbd_dest);
+            /* slow down the running mirrors before adding new ones */
+            if (qemuMigrationDriveMirrorThrottle(driver, vm, mirror_speed,
+                                                 copying + nstart, &share) < 0)
+                goto cleanup;
 
-        if (qemuDomainObjExitMonitor(driver, vm) < 0 || mon_ret < 0) {
-            qemuBlockJobSyncEnd(driver, vm, disk);
-            goto cleanup;
+            for (; nstart > 0; nstart--, next++) {
+                if (qemuMigrationDriveMirrorStart(driver, vm, disks[next].disk,
+                                                  hoststr, port, share,
+                                                  mirror_flags) < 0)
+                    goto cleanup;
+            }
         }
-        diskPriv->migrating = true;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
-            VIR_WARN("Failed to save status on vm %s", vm->def->name);
+        if ((rv = qemuMigrationDriveMirrorReady(driver, vm)) < 0)
             goto cleanup;
-        }
-    }
 
-    while ((rv = qemuMigrationDriveMirrorReady(driver, vm)) != 1) {
-        if (rv < 0)
+        if (rv == 1 && next == ndisks)
+            break;
+
+        /* start the next disks as soon as some mirrors got ready */
+        copying = qemuMigrationDriveMirrorCopying(vm);
+        if (next < ndisks && copying < maxCopying)
+            continue;
+
+        /* otherwise let the remaining copies use the freed bandwidth */
+        if (qemuMigrationDriveMirrorThrottle(driver, vm, mirror_speed,
+                                             copying, &share) < 0)
             goto cleanup;
 
         if (priv->job.abortJob) {
@@ -969,10 +1194,9 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
     ret = 0;
 
  cleanup:
-    virObjectUnref(cfg);
-    VIR_FREE(diskAlias);
-    VIR_FREE(nbd_dest);
+    VIR_FREE(disks);
     VIR_FREE(hoststr);
+    virObjectUnref(cfg);
     return ret;
 }
 
@@ -1451,6 +1675,7 @@ enum qemuMigrationCompletedFlags {
     QEMU_MIGRATION_COMPLETED_CHECK_STORAGE  = (1 << 1),
     QEMU_MIGRATION_COMPLETED_UPDATE_STATS   = (1 << 2),
     QEMU_MIGRATION_COMPLETED_POSTCOPY       = (1 << 3),
+    QEMU_MIGRATION_COMPLETED_POSTCOPY_AUTO  = (1 << 4),
 };
 
 /**
@@ -1525,6 +1750,237 @@ qemuMigrationCompleted(virQEMUDriverPtr driver,
 }
 
 
+/* Polling of QEMU without migration events starts at 50ms and slows down
+ * to this while the guest keeps running */
+#define QEMU_MIGRATION_POLL_INTERVAL 50
+#define QEMU_MIGRATION_POLL_INTERVAL_MAX 500
+
+/* How often the auto-tuning controller looks at migration statistics */
+#define QEMU_MIGRATION_AUTO_TUNE_INTERVAL 1000
+/* QEMU's default downtime limit, used until somebody changes it */
+#define QEMU_MIGRATION_AUTO_TUNE_DOWNTIME_DEFAULT 300
+/* Never let the controller stop the guest for longer than this */
+#define QEMU_MIGRATION_AUTO_TUNE_DOWNTIME_MAX 2000
+/* Upper limit for the CPU throttle increment of auto-converge */
+#define QEMU_MIGRATION_AUTO_TUNE_THROTTLE_MAX 40
+
+typedef struct _qemuMigrationAutoTune qemuMigrationAutoTune;
+typedef qemuMigrationAutoTune *qemuMigrationAutoTunePtr;
+struct _qemuMigrationAutoTune {
+    unsigned long long target;      /* desired migration time in ms */
+    unsigned long long next;        /* when to look at the stats again */
+    unsigned long long iteration;   /* RAM pass of the last adjustment */
+    unsigned long long pass;        /* RAM pass of the last check */
+    unsigned long long xbzrlePages;
+    unsigned long long xbzrleMisses;
+};
+
+
+/**
+ * qemuMigrationAutoTuneAdjust:
+ *
+ * Checks whether the migration is going to complete within the target
+ * time and if not, makes it converge faster by raising the downtime
+ * limit, the XBZRLE cache size and the CPU throttling increment. At
+ * most one round of adjustments is done per pass over guest memory so
+ * that QEMU has a chance to show their effect.
+ *
+ * Errors are not fatal for the migration, they are only logged.
+ */
+static void
+qemuMigrationAutoTuneAdjust(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm,
+                            qemuDomainAsyncJob asyncJob,
+                            qemuMigrationAutoTunePtr tune)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainJobInfoPtr jobInfo = priv->job.current;
+    qemuMonitorMigrationStatsPtr stats = &jobInfo->stats;
+    qemuMonitorMigrationParams migParams = { 0 };
+    unsigned long long pageSize = 4096;
+    unsigned long long dirty;
+    unsigned long long eta;
+    unsigned long long budget = 0;
+    unsigned long long downtime = 0;
+    unsigned long long cacheSize = 0;
+    int throttle = 0;
+
+    if (stats->status != QEMU_MONITOR_MIGRATION_STATUS_ACTIVE ||
+        stats->ram_iteration < 2 ||
+        stats->ram_iteration <= tune->iteration ||
+        stats->ram_bps == 0)
+        return;
+
+    if (stats->ram_normal)
+        pageSize = stats->ram_normal_bytes / stats->ram_normal;
+    dirty = stats->ram_dirty_rate * pageSize;
+
+    if (tune->target > jobInfo->timeElapsed)
+        budget = tune->target - jobInfo->timeElapsed;
+
+    if (stats->ram_bps > dirty)
+        eta = stats->ram_remaining * 1000 / (stats->ram_bps - dirty);
+    else
+        eta = ULLONG_MAX;
+
+    VIR_DEBUG("iteration=%llu remaining=%llu bps=%llu dirty=%llu "
+              "eta=%llums budget=%llums",
+              stats->ram_iteration, stats->ram_remaining, stats->ram_bps,
+              dirty, eta, budget);
+
+    if (eta <= budget)
+        return;
+
+    tune->iteration = stats->ram_iteration;
+
+    /* Allow a downtime long enough to send the remaining memory, doubling
+     * the limit at a time unless we're already late */
+    if (jobInfo->downtimeLimit == 0)
+        jobInfo->downtimeLimit = QEMU_MIGRATION_AUTO_TUNE_DOWNTIME_DEFAULT;
+    downtime = stats->ram_remaining * 1000 / stats->ram_bps;
+    if (budget > 0)
+        downtime = MIN(downtime, jobInfo->downtimeLimit * 2);
+    downtime = MIN(downtime, QEMU_MIGRATION_AUTO_TUNE_DOWNTIME_MAX);
+    if (downtime <= jobInfo->downtimeLimit)
+        downtime = 0;
+
+    /* Grow the XBZRLE cache if most pages miss it */
+    if (stats->xbzrle_set &&
+        stats->xbzrle_cache_size < stats->ram_total / 4 &&
+        stats->xbzrle_cache_miss - tune->xbzrleMisses >
+        stats->xbzrle_pages - tune->xbzrlePages)
+        cacheSize = MIN(stats->xbzrle_cache_size * 2, stats->ram_total / 4);
+    tune->xbzrlePages = stats->xbzrle_pages;
+    tune->xbzrleMisses = stats->xbzrle_cache_miss;
+
+    if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+        return;
+
+    if (downtime) {
+        VIR_DEBUG("Raising migration downtime limit to %llums", downtime);
+        if (qemuMonitorSetMigrationDowntime(priv->mon, downtime) < 0)
+            goto error;
+        jobInfo->downtimeLimit = downtime;
+        jobInfo->autoTuneAdjustments++;
+    }
+
+    if (cacheSize) {
+        VIR_DEBUG("Growing migration cache to %llu bytes", cacheSize);
+        if (qemuMonitorSetMigrationCacheSize(priv->mon, cacheSize) < 0)
+            goto error;
+        jobInfo->autoTuneAdjustments++;
+    }
+
+    /* Throttle the guest harder if auto-converge already kicked in and
+     * the memory is still dirtied faster than it can be sent */
+    if (stats->cpu_throttle_percentage > 0 && eta == ULLONG_MAX) {
+        if (qemuMonitorGetMigrationParams(priv->mon, &migParams) < 0)
+            goto error;
+
+        if (migParams.cpuThrottleIncrement_set &&
+            migParams.cpuThrottleIncrement <
+            QEMU_MIGRATION_AUTO_TUNE_THROTTLE_MAX) {
+            throttle = MIN(migParams.cpuThrottleIncrement * 2,
+                           QEMU_MIGRATION_AUTO_TUNE_THROTTLE_MAX);
+        }
+        qemuMigrationParamsClear(&migParams);
+
+        if (throttle) {
+            VIR_DEBUG("Raising CPU throttle increment to %d%%", throttle);
+            migParams.cpuThrottleIncrement_set = true;
+            migParams.cpuThrottleIncrement = throttle;
+            if (qemuMonitorSetMigrationParams(priv->mon, &migParams) < 0)
+                goto error;
+            jobInfo->autoTuneAdjustments++;
+        }
+    }
+
+    if (qemuDomainObjExitMonitor(driver, vm) < 0)
+        VIR_WARN("Domain %s exited while tuning migration", vm->def->name);
+    return;
+
+ error:
+    VIR_WARN("Unable to tune migration of domain %s: %s",
+             vm->def->name, virGetLastErrorMessage());
+    virResetLastError();
+    ignore_value(qemuDomainObjExitMonitor(driver, vm));
+}
+
+
+/* Pre-copy is expected to converge if the guest dirties its memory at
+ * most at this share (in percent) of the migration bandwidth */
+#define QEMU_MIGRATION_POSTCOPY_AUTO_DIRTY_RATIO 50
+/* Switch to post-copy anyway if pre-copy did not finish in this many
+ * passes over guest memory */
+#define QEMU_MIGRATION_POSTCOPY_AUTO_MAX_PASSES 5
+
+
+/**
+ * qemuMigrationPostcopyAuto:
+ *
+ * Predicts whether pre-copy migration is going to converge, comparing
+ * the rate at which the guest dirties its memory to the migration
+ * bandwidth, and switches the migration to post-copy if it isn't. The
+ * dirty rate measured by QEMU during the migration is preferred, the
+ * one measured before the migration started is used until it is known.
+ * Nothing is decided before the first pass over guest memory finished.
+ *
+ * Returns true once the migration was switched to post-copy, false if
+ * it continues in pre-copy mode. Errors are only logged.
+ */
+static bool
+qemuMigrationPostcopyAuto(virQEMUDriverPtr driver,
+                          virDomainObjPtr vm,
+                          qemuDomainAsyncJob asyncJob)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainJobInfoPtr jobInfo = priv->job.current;
+    qemuMonitorMigrationStatsPtr stats = &jobInfo->stats;
+    unsigned long long pageSize = 4096;
+    unsigned long long dirty;
+    int rc;
+
+    if (stats->status != QEMU_MONITOR_MIGRATION_STATUS_ACTIVE ||
+        stats->ram_iteration < 2 ||
+        stats->ram_bps == 0)
+        return false;
+
+    if (stats->ram_normal)
+        pageSize = stats->ram_normal_bytes / stats->ram_normal;
+
+    if (stats->ram_dirty_rate)
+        dirty = stats->ram_dirty_rate * pageSize;
+    else
+        dirty = jobInfo->dirtyRate * 1024 * 1024;
+
+    VIR_DEBUG("iteration=%llu bps=%llu dirty=%llu",
+              stats->ram_iteration, stats->ram_bps, dirty);
+
+    if (dirty * 100 <
+        stats->ram_bps * QEMU_MIGRATION_POSTCOPY_AUTO_DIRTY_RATIO &&
+        stats->ram_iteration <= QEMU_MIGRATION_POSTCOPY_AUTO_MAX_PASSES)
+        return false;
+
+    VIR_DEBUG("Pre-copy migration of domain %s is not going to converge, "
+              "switching to post-copy", vm->def->name);
+
+    if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+        return false;
+    rc = qemuMonitorMigrateStartPostCopy(priv->mon);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0)
+        return false;
+
+    if (rc < 0) {
+        VIR_WARN("Unable to switch migration of domain %s to post-copy: %s",
+                 vm->def->name, virGetLastErrorMessage());
+        virResetLastError();
+        return false;
+    }
+
+    return true;
+}
+
+
 /* Returns 0 on success, -2 when migration needs to be cancelled, or -1 when
  * QEMU reports failed migration.
  */
@@ -1538,21 +1994,79 @@ qemuMigrationWaitForCompletion(virQEMUDriverPtr driver,
     qemuDomainObjPrivatePtr priv = vm->privateData;
     qemuDomainJobInfoPtr jobInfo = priv->job.current;
     bool events = virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_MIGRATION_EVENT);
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuMigrationAutoTune tune = { 0 };
+    bool postcopyAuto = !!(flags & QEMU_MIGRATION_COMPLETED_POSTCOPY_AUTO);
+    unsigned long long pollInterval = QEMU_MIGRATION_POLL_INTERVAL;
+    unsigned long long now;
     int rv;
 
     flags |= QEMU_MIGRATION_COMPLETED_UPDATE_STATS;
 
+    if (asyncJob == QEMU_ASYNC_JOB_MIGRATION_OUT &&
+        !(flags & QEMU_MIGRATION_COMPLETED_POSTCOPY))
+        tune.target = cfg->migrationAutoTuneTarget * 1000ull;
+    virObjectUnref(cfg);
+
     jobInfo->type = VIR_DOMAIN_JOB_UNBOUNDED;
     while ((rv = qemuMigrationCompleted(driver, vm, asyncJob,
                                         dconn, flags)) != 1) {
         if (rv < 0)
             return rv;
 
-        if (events) {
+        if ((tune.target || postcopyAuto) && virTimeMillisNow(&now) == 0 &&
+            (now >= tune.next || jobInfo->stats.ram_iteration != tune.pass)) {
+            /* With migration events the statistics are not updated
+             * while waiting, so fetch them ourselves */
+            if (events &&
+                qemuMigrationUpdateJobStatus(driver, vm, asyncJob) < 0) {
+                VIR_WARN("Unable to get migration statistics");
+                virResetLastError();
+            } else if (postcopyAuto) {
+                if (qemuMigrationPostcopyAuto(driver, vm, asyncJob))
+                    postcopyAuto = false;
+            } else {
+                qemuMigrationAutoTuneAdjust(driver, vm, asyncJob, &tune);
+            }
+            tune.pass = jobInfo->stats.ram_iteration;
+            tune.next = now + QEMU_MIGRATION_AUTO_TUNE_INTERVAL;
+        }
+
+        if (events && (tune.target || postcopyAuto)) {
+            /* MIGRATION_PASS events wake us up for every pass, the timer
+             * covers QEMU which does not send them */
+            if (virDomainObjWaitUntil(vm, tune.next) < 0) {
+                jobInfo->type = VIR_DOMAIN_JOB_FAILED;
+                return -2;
+            }
+            if (!virDomainObjIsActive(vm)) {
+                virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                               _("domain is not running"));
+                jobInfo->type = VIR_DOMAIN_JOB_FAILED;
+                return -2;
+            }
+        } else if (events) {
             if (virDomainObjWait(vm) < 0) {
                 jobInfo->type = VIR_DOMAIN_JOB_FAILED;
                 return -2;
             }
+        } else if (priv->monJSON && virTimeMillisNow(&now) == 0) {
+            /* QEMU pauses the CPUs once the migration is about to complete,
+             * so wait for the STOP event or the next, gradually less
+             * frequent, poll for progress */
+            priv->signalStop = true;
+            rv = virDomainObjWaitUntil(vm, now + pollInterval);
+            priv->signalStop = false;
+            if (rv < 0) {
+                jobInfo->type = VIR_DOMAIN_JOB_FAILED;
+                return -2;
+            }
+
+            if (virDomainObjGetState(vm, NULL) == VIR_DOMAIN_RUNNING)
+                pollInterval = MIN(pollInterval * 2,
+                                   QEMU_MIGRATION_POLL_INTERVAL_MAX);
+            else
+                pollInterval = QEMU_MIGRATION_POLL_INTERVAL;
         } else {
             /* Poll every 50ms for progress & to allow cancellation */
             struct timespec ts = { .tv_sec = 0, .tv_nsec = 50 * 1000 * 1000ull };
@@ -1933,6 +2447,13 @@ qemuMigrationBeginPhase(virQEMUDriverPtr driver,
         goto cleanup;
     }
 
+    if (flags & VIR_MIGRATE_POSTCOPY_AUTO && !(flags & VIR_MIGRATE_POSTCOPY)) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED, "%s",
+                       _("automatic switch to post-copy requires post-copy "
+                         "migration to be enabled"));
+        goto cleanup;
+    }
+
     if (flags & (VIR_MIGRATE_NON_SHARED_DISK | VIR_MIGRATE_NON_SHARED_INC)) {
         bool has_drive_mirror =  virQEMUCapsGet(priv->qemuCaps,
                                                 QEMU_CAPS_DRIVE_MIRROR);
@@ -2742,6 +3263,10 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
         cookieFlags |= QEMU_MIGRATION_COOKIE_NBD;
     }
 
+    /* Let the source know we can accept larger tunnel packets */
+    if (tunnel)
+        cookieFlags |= QEMU_MIGRATION_COOKIE_TUNNEL;
+
     if (mig->lockState) {
         VIR_DEBUG("Received lockstate %s", mig->lockState);
         VIR_FREE(priv->lockState);
@@ -3114,7 +3639,6 @@ qemuMigrationConfirmPhase(virQEMUDriverPtr driver,
     qemuMigrationCookiePtr mig;
     virObjectEventPtr event;
     int rv = -1;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     qemuDomainObjPrivatePtr priv = vm->privateData;
     qemuDomainJobInfoPtr jobInfo = NULL;
 
@@ -3205,7 +3729,7 @@ qemuMigrationConfirmPhase(virQEMUDriverPtr driver,
 
         qemuMigrationReset(driver, vm, QEMU_ASYNC_JOB_MIGRATION_OUT);
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
             VIR_WARN("Failed to save status on vm %s", vm->def->name);
     }
 
@@ -3214,7 +3738,6 @@ qemuMigrationConfirmPhase(virQEMUDriverPtr driver,
     rv = 0;
 
  cleanup:
-    virObjectUnref(cfg);
     return rv;
 }
 
@@ -3301,6 +3824,21 @@ struct _qemuMigrationSpec {
 
 #define TUNNEL_SEND_BUF_SIZE 65536
 
+/* Number of packets read ahead from QEMU while the previous ones are
+ * being sent to the destination */
+#define TUNNEL_SEND_BUFFERS 4
+
+typedef struct _qemuMigrationIOBuffer qemuMigrationIOBuffer;
+typedef qemuMigrationIOBuffer *qemuMigrationIOBufferPtr;
+struct _qemuMigrationIOBuffer {
+    char *data;
+    size_t len;
+};
+
+/* The tunnel is served by two threads: qemuMigrationIOFunc reads
+ * QEMU's migration stream into @bufs while qemuMigrationIOSendFunc
+ * sends the @count buffers starting at @head over @st, so that
+ * reading from QEMU and talking to the destination overlap. */
 typedef struct _qemuMigrationIOThread qemuMigrationIOThread;
 typedef qemuMigrationIOThread *qemuMigrationIOThreadPtr;
 struct _qemuMigrationIOThread {
@@ -3310,21 +3848,118 @@ struct _qemuMigrationIOThread {
     virError err;
     int wakeupRecvFD;
     int wakeupSendFD;
+
+    virThread sendThread;
+    virMutex lock;
+    virCond cond;
+    qemuMigrationIOBuffer bufs[TUNNEL_SEND_BUFFERS];
+    size_t bufsize;
+    size_t head;
+    size_t count;
+    bool eof;           /* no more data coming from QEMU */
+    bool quit;          /* the tunnel is being aborted */
+    bool sendFailed;
+    virError sendErr;
 };
 
+static void qemuMigrationIOSendFunc(void *arg)
+{
+    qemuMigrationIOThreadPtr data = arg;
+    qemuMigrationIOBufferPtr buf;
+    int rc;
+
+    virMutexLock(&data->lock);
+
+    for (;;) {
+        while (data->count == 0 && !data->eof && !data->quit) {
+            if (virCondWait(&data->cond, &data->lock) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("failed to wait on condition"));
+                goto error;
+            }
+        }
+
+        if (data->quit || data->count == 0)
+            break;
+
+        buf = &data->bufs[data->head];
+        virMutexUnlock(&data->lock);
+
+        rc = virStreamSend(data->st, buf->data, buf->len);
+
+        virMutexLock(&data->lock);
+        if (rc < 0)
+            goto error;
+
+        data->head = (data->head + 1) % TUNNEL_SEND_BUFFERS;
+        data->count--;
+        virCondBroadcast(&data->cond);
+    }
+
+    virMutexUnlock(&data->lock);
+    return;
+
+ error:
+    data->sendFailed = true;
+    virCopyLastError(&data->sendErr);
+    virResetLastError();
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+/* Lets the sending thread know no more data is coming and waits for
+ * it to finish. Returns -1 with the error of the thread set if it
+ * failed to send the data. */
+static int
+qemuMigrationIOStopSend(qemuMigrationIOThreadPtr data,
+                        bool abort)
+{
+    int ret = 0;
+
+    virMutexLock(&data->lock);
+    if (abort)
+        data->quit = true;
+    else
+        data->eof = true;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+
+    virThreadJoin(&data->sendThread);
+
+    if (data->sendFailed) {
+        if (!abort)
+            virSetError(&data->sendErr);
+        virResetError(&data->sendErr);
+        ret = -1;
+    }
+
+    return ret;
+}
+
 static void qemuMigrationIOFunc(void *arg)
 {
     qemuMigrationIOThreadPtr data = arg;
-    char *buffer = NULL;
     struct pollfd fds[2];
     int timeout = -1;
     virErrorPtr err = NULL;
+    bool sending = false;
+    size_t i;
 
-    VIR_DEBUG("Running migration tunnel; stream=%p, sock=%d",
-              data->st, data->sock);
+    VIR_DEBUG("Running migration tunnel; stream=%p, sock=%d, bufsize=%zu",
+              data->st, data->sock, data->bufsize);
 
-    if (VIR_ALLOC_N(buffer, TUNNEL_SEND_BUF_SIZE) < 0)
+    for (i = 0; i < TUNNEL_SEND_BUFFERS; i++) {
+        if (VIR_ALLOC_N(data->bufs[i].data, data->bufsize) < 0)
+            goto abrt;
+    }
+
+    if (virThreadCreate(&data->sendThread, true,
+                        qemuMigrationIOSendFunc, data) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create migration thread"));
         goto abrt;
+    }
+    sending = true;
 
     fds[0].fd = data->sock;
     fds[1].fd = data->wakeupRecvFD;
@@ -3373,12 +4008,32 @@ static void qemuMigrationIOFunc(void *arg)
         }
 
         if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+            qemuMigrationIOBufferPtr buf;
             int nbytes;
 
-            nbytes = saferead(data->sock, buffer, TUNNEL_SEND_BUF_SIZE);
+            /* Wait for the sending thread to free a buffer */
+            virMutexLock(&data->lock);
+            while (data->count == TUNNEL_SEND_BUFFERS &&
+                   !data->sendFailed && !data->quit)
+                ignore_value(virCondWait(&data->cond, &data->lock));
+            buf = &data->bufs[(data->head + data->count) %
+                              TUNNEL_SEND_BUFFERS];
+            if (data->quit) {
+                virMutexUnlock(&data->lock);
+                goto abrt;
+            }
+            virMutexUnlock(&data->lock);
+
+            if (data->sendFailed)
+                break;
+
+            nbytes = saferead(data->sock, buf->data, data->bufsize);
             if (nbytes > 0) {
-                if (virStreamSend(data->st, buffer, nbytes) < 0)
-                    goto error;
+                virMutexLock(&data->lock);
+                buf->len = nbytes;
+                data->count++;
+                virCondBroadcast(&data->cond);
+                virMutexUnlock(&data->lock);
             } else if (nbytes < 0) {
                 virReportSystemError(errno, "%s",
                         _("tunnelled migration failed to read from qemu"));
@@ -3390,11 +4045,16 @@ static void qemuMigrationIOFunc(void *arg)
         }
     }
 
+    sending = false;
+    if (qemuMigrationIOStopSend(data, false) < 0)
+        goto error;
+
     if (virStreamFinish(data->st) < 0)
         goto error;
 
     VIR_FORCE_CLOSE(data->sock);
-    VIR_FREE(buffer);
+    for (i = 0; i < TUNNEL_SEND_BUFFERS; i++)
+        VIR_FREE(data->bufs[i].data);
 
     return;
 
@@ -3404,6 +4064,8 @@ static void qemuMigrationIOFunc(void *arg)
         virFreeError(err);
         err = NULL;
     }
+    if (sending)
+        ignore_value(qemuMigrationIOStopSend(data, true));
     virStreamAbort(data->st);
     if (err) {
         virSetError(err);
@@ -3417,13 +4079,15 @@ static void qemuMigrationIOFunc(void *arg)
     if (!virLastErrorIsSystemErrno(EPIPE))
         virCopyLastError(&data->err);
     virResetLastError();
-    VIR_FREE(buffer);
+    for (i = 0; i < TUNNEL_SEND_BUFFERS; i++)
+        VIR_FREE(data->bufs[i].data);
 }
 
 
 static qemuMigrationIOThreadPtr
 qemuMigrationStartTunnel(virStreamPtr st,
-                         int sock)
+                         int sock,
+                         size_t bufsize)
 {
     qemuMigrationIOThreadPtr io = NULL;
     int wakeupFD[2] = { -1, -1 };
@@ -3437,8 +4101,21 @@ qemuMigrationStartTunnel(virStreamPtr st,
     if (VIR_ALLOC(io) < 0)
         goto error;
 
+    if (virMutexInit(&io->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize mutex"));
+        goto error;
+    }
+    if (virCondInit(&io->cond) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize condition"));
+        virMutexDestroy(&io->lock);
+        goto error;
+    }
+
     io->st = st;
     io->sock = sock;
+    io->bufsize = bufsize;
     io->wakeupRecvFD = wakeupFD[0];
     io->wakeupSendFD = wakeupFD[1];
 
@@ -3447,6 +4124,8 @@ qemuMigrationStartTunnel(virStreamPtr st,
                         io) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to create migration thread"));
+        virCondDestroy(&io->cond);
+        virMutexDestroy(&io->lock);
         goto error;
     }
 
@@ -3465,6 +4144,14 @@ qemuMigrationStopTunnel(qemuMigrationIOThreadPtr io, bool error)
     int rv = -1;
     char stop = error ? 1 : 0;
 
+    /* don't let the IO thread wait for packets which will never be sent */
+    if (error) {
+        virMutexLock(&io->lock);
+        io->quit = true;
+        virCondBroadcast(&io->cond);
+        virMutexUnlock(&io->lock);
+    }
+
     /* make sure the thread finishes its job and is joinable */
     if (safewrite(io->wakeupSendFD, &stop, 1) != 1) {
         virReportSystemError(errno, "%s",
@@ -3489,6 +4176,8 @@ qemuMigrationStopTunnel(qemuMigrationIOThreadPtr io, bool error)
  cleanup:
     VIR_FORCE_CLOSE(io->wakeupSendFD);
     VIR_FORCE_CLOSE(io->wakeupRecvFD);
+    virCondDestroy(&io->cond);
+    virMutexDestroy(&io->lock);
     VIR_FREE(io);
     return rv;
 }
@@ -3620,6 +4309,9 @@ qemuMigrationRun(virQEMUDriverPtr driver,
             goto cleanup;
     }
 
+    if (spec->fwdType != MIGRATION_FWD_DIRECT)
+        cookieFlags |= QEMU_MIGRATION_COOKIE_TUNNEL;
+
     mig = qemuMigrationEatCookie(driver, vm, cookiein, cookieinlen,
                                  cookieFlags | QEMU_MIGRATION_COOKIE_GRAPHICS);
     if (!mig)
@@ -3729,6 +4421,23 @@ qemuMigrationRun(virQEMUDriverPtr driver,
     if (qemuMonitorSetMigrationSpeed(priv->mon, migrate_speed) < 0)
         goto exit_monitor;
 
+    /* The dirty rate measured last is what the automatic switch to
+     * post-copy relies on until QEMU measures it during the migration */
+    if (flags & VIR_MIGRATE_POSTCOPY_AUTO &&
+        virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_CALC_DIRTY_RATE)) {
+        qemuMonitorDirtyRateInfo dirtyrate;
+
+        if (qemuMonitorQueryDirtyRate(priv->mon, &dirtyrate) < 0) {
+            VIR_WARN("Unable to get the dirty rate of domain %s",
+                     vm->def->name);
+            virResetLastError();
+        } else if (dirtyrate.dirtyRate > 0) {
+            priv->job.current->dirtyRate = dirtyrate.dirtyRate;
+            VIR_DEBUG("Guest dirties %lld MiB/s, migration bandwidth is "
+                      "%lu MiB/s", dirtyrate.dirtyRate, migrate_speed);
+        }
+    }
+
     /* connect to the destination qemu if needed */
     if (spec->destType == MIGRATION_DEST_CONNECT_HOST &&
         qemuMigrationConnect(driver, vm, spec) < 0) {
@@ -3777,7 +4486,16 @@ qemuMigrationRun(virQEMUDriverPtr driver,
      * migration on source if anything goes wrong */
 
     if (spec->fwdType != MIGRATION_FWD_DIRECT) {
-        if (!(iothread = qemuMigrationStartTunnel(spec->fwd.stream, fd)))
+        size_t packetSize = TUNNEL_SEND_BUF_SIZE;
+
+        /* Older destinations don't advertise a packet size, stay with
+         * the default one for them */
+        if (mig->tunnelPacketSize)
+            packetSize = MIN(mig->tunnelPacketSize,
+                             QEMU_MIGRATION_TUNNEL_PACKET_SIZE);
+
+        if (!(iothread = qemuMigrationStartTunnel(spec->fwd.stream, fd,
+                                                  packetSize)))
             goto cancel;
         /* If we've created a tunnel, then the 'fd' will be closed in the
          * qemuMigrationIOFunc as data->sock.
@@ -3792,6 +4510,8 @@ qemuMigrationRun(virQEMUDriverPtr driver,
         waitFlags |= QEMU_MIGRATION_COMPLETED_CHECK_STORAGE;
     if (flags & VIR_MIGRATE_POSTCOPY)
         waitFlags |= QEMU_MIGRATION_COMPLETED_POSTCOPY;
+    if (flags & VIR_MIGRATE_POSTCOPY_AUTO)
+        waitFlags |= QEMU_MIGRATION_COMPLETED_POSTCOPY_AUTO;
 
     rc = qemuMigrationWaitForCompletion(driver, vm,
                                         QEMU_ASYNC_JOB_MIGRATION_OUT,
@@ -5112,7 +5832,6 @@ qemuMigrationFinish(virQEMUDriverPtr driver,
     virErrorPtr orig_err = NULL;
     int cookie_flags = 0;
     qemuDomainObjPrivatePtr priv = vm->privateData;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     unsigned short port;
     unsigned long long timeReceived = 0;
     virObjectEventPtr event;
@@ -5306,7 +6025,7 @@ qemuMigrationFinish(virQEMUDriverPtr driver,
     }
 
     if (virDomainObjIsActive(vm) &&
-        virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        qemuDomainSaveStatus(driver, vm) < 0)
         VIR_WARN("Failed to save status on vm %s", vm->def->name);
 
     /* Guest is successfully running, so cancel previous auto destroy */
@@ -5362,7 +6081,6 @@ qemuMigrationFinish(virQEMUDriverPtr driver,
         virSetError(orig_err);
         virFreeError(orig_err);
     }
-    virObjectUnref(cfg);
 
     /* Set a special error if Finish is expected to return NULL as a result of
      * successful call with retcode != 0
@@ -5373,17 +6091,19 @@ qemuMigrationFinish(virQEMUDriverPtr driver,
 }
 
 
-/* Helper function called while vm is active.  */
+/* Helper function called while vm is active. If @compressor is not NULL,
+ * the migration stream is piped through it into @fd, the caller keeps
+ * the ownership of the command. */
 int
 qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
                     int fd,
-                    const char *compressor,
+                    virCommandPtr compressor,
                     qemuDomainAsyncJob asyncJob)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
     int rc;
     int ret = -1;
-    virCommandPtr cmd = NULL;
+    virCommandPtr cmd = compressor;
     int pipeFD[2] = { -1, -1 };
     unsigned long saveMigBandwidth = priv->migMaxBandwidth;
     char *errbuf = NULL;
@@ -5428,14 +6148,6 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
                                     QEMU_MONITOR_MIGRATE_BACKGROUND,
                                     fd);
     } else {
-        const char *prog = compressor;
-        const char *args[] = {
-            prog,
-            "-c",
-            NULL
-        };
-
-        cmd = virCommandNewArgs(args);
         virCommandSetInputFD(cmd, pipeFD[0]);
         virCommandSetOutputFD(cmd, &fd);
         virCommandSetErrorBuffer(cmd, &errbuf);
@@ -5500,7 +6212,6 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
     if (cmd) {
         VIR_DEBUG("Compression binary stderr: %s", NULLSTR(errbuf));
         VIR_FREE(errbuf);
-        virCommandFree(cmd);
     }
 
     if (orig_err) {
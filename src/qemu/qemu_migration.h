@@ -46,7 +46,8 @@ typedef qemuMigrationCompression *qemuMigrationCompressionPtr;
      VIR_MIGRATE_AUTO_CONVERGE |                \
      VIR_MIGRATE_RDMA_PIN_ALL |                 \
      VIR_MIGRATE_POSTCOPY |                     \
-     VIR_MIGRATE_TLS)
+     VIR_MIGRATE_TLS |                          \
+     VIR_MIGRATE_POSTCOPY_AUTO)
 
 /* All supported migration parameters and their types. */
 # define QEMU_MIGRATION_PARAMETERS                                \
@@ -270,7 +271,7 @@ int
 qemuMigrationToFile(virQEMUDriverPtr driver,
                     virDomainObjPtr vm,
                     int fd,
-                    const char *compressor,
+                    virCommandPtr compressor,
                     qemuDomainAsyncJob asyncJob)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
 
@@ -48,7 +48,8 @@ VIR_ENUM_IMPL(qemuMigrationCookieFlag,
               "nbd",
               "statistics",
               "memory-hotplug",
-              "cpu-hotplug");
+              "cpu-hotplug",
+              "tunnel");
 
 
 static void
@@ -500,6 +501,14 @@ qemuMigrationCookieAddNBD(qemuMigrationCookiePtr mig,
 }
 
 
+static void
+qemuMigrationCookieAddTunnel(qemuMigrationCookiePtr mig)
+{
+    mig->tunnelPacketSize = QEMU_MIGRATION_TUNNEL_PACKET_SIZE;
+    mig->flags |= QEMU_MIGRATION_COOKIE_TUNNEL;
+}
+
+
 static int
 qemuMigrationCookieAddStatistics(qemuMigrationCookiePtr mig,
                                  virDomainObjPtr vm)
@@ -755,6 +764,10 @@ qemuMigrationCookieXMLFormat(virQEMUDriverPtr driver,
     if (mig->flags & QEMU_MIGRATION_COOKIE_STATS && mig->jobInfo)
         qemuMigrationCookieStatisticsXMLFormat(buf, mig->jobInfo);
 
+    if (mig->flags & QEMU_MIGRATION_COOKIE_TUNNEL && mig->tunnelPacketSize)
+        virBufferAsprintf(buf, "<tunnel packetSize='%u'/>\n",
+                          mig->tunnelPacketSize);
+
     virBufferAdjustIndent(buf, -2);
     virBufferAddLit(buf, "</qemu-migration>\n");
     return 0;
@@ -1198,6 +1211,17 @@ qemuMigrationCookieXMLParse(qemuMigrationCookiePtr mig,
         (!(mig->jobInfo = qemuMigrationCookieStatisticsXMLParse(ctxt))))
         goto error;
 
+    if (flags & QEMU_MIGRATION_COOKIE_TUNNEL &&
+        virXPathBoolean("boolean(./tunnel)", ctxt)) {
+        if (virXPathUInt("string(./tunnel/@packetSize)", ctxt,
+                         &mig->tunnelPacketSize) < 0 ||
+            mig->tunnelPacketSize == 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("malformed tunnel packetSize in migration data"));
+            goto error;
+        }
+    }
+
     virObjectUnref(caps);
     return 0;
 
@@ -1268,6 +1292,9 @@ qemuMigrationBakeCookie(qemuMigrationCookiePtr mig,
         qemuMigrationCookieAddStatistics(mig, dom) < 0)
         return -1;
 
+    if (flags & QEMU_MIGRATION_COOKIE_TUNNEL)
+        qemuMigrationCookieAddTunnel(mig);
+
     if (flags & QEMU_MIGRATION_COOKIE_MEMORY_HOTPLUG)
         mig->flagsMandatory |= QEMU_MIGRATION_COOKIE_MEMORY_HOTPLUG;
 
@@ -28,6 +28,7 @@ typedef enum {
     QEMU_MIGRATION_COOKIE_FLAG_STATS,
     QEMU_MIGRATION_COOKIE_FLAG_MEMORY_HOTPLUG,
     QEMU_MIGRATION_COOKIE_FLAG_CPU_HOTPLUG,
+    QEMU_MIGRATION_COOKIE_FLAG_TUNNEL,
 
     QEMU_MIGRATION_COOKIE_FLAG_LAST
 } qemuMigrationCookieFlags;
@@ -43,8 +44,13 @@ typedef enum {
     QEMU_MIGRATION_COOKIE_STATS = (1 << QEMU_MIGRATION_COOKIE_FLAG_STATS),
     QEMU_MIGRATION_COOKIE_MEMORY_HOTPLUG = (1 << QEMU_MIGRATION_COOKIE_FLAG_MEMORY_HOTPLUG),
     QEMU_MIGRATION_COOKIE_CPU_HOTPLUG = (1 << QEMU_MIGRATION_COOKIE_FLAG_CPU_HOTPLUG),
+    QEMU_MIGRATION_COOKIE_TUNNEL = (1 << QEMU_MIGRATION_COOKIE_FLAG_TUNNEL),
 } qemuMigrationCookieFeatures;
 
+/* Largest stream packet the destination of a tunnelled migration
+ * advertises, sources talking to older daemons stick to 64 KiB */
+# define QEMU_MIGRATION_TUNNEL_PACKET_SIZE (1024 * 1024)
+
 typedef struct _qemuMigrationCookieGraphics qemuMigrationCookieGraphics;
 typedef qemuMigrationCookieGraphics *qemuMigrationCookieGraphicsPtr;
 struct _qemuMigrationCookieGraphics {
@@ -122,6 +128,9 @@ struct _qemuMigrationCookie {
 
     /* If (flags & QEMU_MIGRATION_COOKIE_STATS) */
     qemuDomainJobInfoPtr jobInfo;
+
+    /* If (flags & QEMU_MIGRATION_COOKIE_TUNNEL) */
+    unsigned int tunnelPacketSize;
 };
 
 
@@ -28,6 +28,10 @@
 #include <sys/un.h>
 #include <unistd.h>
 #include <fcntl.h>
+#ifdef HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
+#include <dirname.h>
 
 #include "qemu_monitor.h"
 #include "qemu_monitor_text.h"
@@ -41,6 +45,7 @@
 #include "virprocess.h"
 #include "virobject.h"
 #include "virprobe.h"
+#include "virevent.h"
 #include "virstring.h"
 #include "virtime.h"
 
@@ -55,6 +60,11 @@ VIR_LOG_INIT("qemu.qemu_monitor");
 #define DEBUG_IO 0
 #define DEBUG_RAW_IO 0
 
+/* Minimum free space to read into and the size up to which the
+ * buffer is kept allocated once it is drained */
+#define QEMU_MONITOR_READ_MIN 1024
+#define QEMU_MONITOR_BUFFER_KEEP (64 * 1024)
+
 struct _qemuMonitor {
     virObjectLockable parent;
 
@@ -69,14 +79,20 @@ struct _qemuMonitor {
     qemuMonitorCallbacksPtr cb;
     void *callbackOpaque;
 
-    /* If there's a command being processed this will be
-     * non-NULL */
+    /* If there are commands being processed this will be
+     * the first of them, the rest is linked through the
+     * next pointer of each message */
     qemuMonitorMessagePtr msg;
 
     /* Buffer incoming data ready for Text/QMP monitor
-     * code to process & find message boundaries */
+     * code to process & find message boundaries. Unprocessed
+     * data lives between bufferStart and bufferOffset, the
+     * first bufferScanned bytes of which contain no complete
+     * line yet. */
+    size_t bufferStart;
     size_t bufferOffset;
     size_t bufferLength;
+    size_t bufferScanned;
     char *buffer;
 
     /* If anything went wrong, this will be fed back
@@ -99,6 +115,10 @@ struct _qemuMonitor {
     qemuMonitorReportDomainLogError logFunc;
     void *logOpaque;
     virFreeCallback logDestroy;
+
+    /* Latency and reply size of each command sent so far */
+    qemuMonitorCommandStatsPtr cmdStats;
+    size_t ncmdStats;
 };
 
 /**
@@ -169,6 +189,14 @@ VIR_ENUM_IMPL(qemuMonitorMigrationStatus,
               "completed", "failed",
               "cancelling", "cancelled")
 
+VIR_ENUM_IMPL(qemuMonitorDumpStatus,
+              QEMU_MONITOR_DUMP_STATUS_LAST,
+              "none", "active", "completed", "failed")
+
+VIR_ENUM_IMPL(qemuMonitorDirtyRateStatus,
+              QEMU_MONITOR_DIRTY_RATE_STATUS_LAST,
+              "unstarted", "measuring", "measured")
+
 VIR_ENUM_IMPL(qemuMonitorMigrationCaps,
               QEMU_MONITOR_MIGRATION_CAPS_LAST,
               "xbzrle", "auto-converge", "rdma-pin-all", "events",
@@ -323,6 +351,79 @@ qemuMonitorDispose(void *obj)
     VIR_FREE(mon->buffer);
     virJSONValueFree(mon->options);
     VIR_FREE(mon->balloonpath);
+    qemuMonitorCommandStatsFree(mon->cmdStats, mon->ncmdStats);
+}
+
+
+/* Longest wait between two attempts to connect to a monitor socket
+ * which is watched for being created, see qemuMonitorOpenUnixWait */
+#define QEMU_MONITOR_WATCH_INTERVAL 50
+
+
+/*
+ * Watches the directory of @monitor for new files so that connecting to
+ * the monitor of a freshly started QEMU is retried as soon as the socket
+ * shows up, rather than after the next polling interval, which grows up
+ * to a second. Returns the inotify FD, or -1 if none could be set up,
+ * which is not an error.
+ */
+#ifdef HAVE_SYS_INOTIFY_H
+static int
+qemuMonitorOpenUnixWatch(const char *monitor)
+{
+    int fd = -1;
+    char *dir;
+
+    if (!(dir = mdir_name(monitor)))
+        return -1;
+
+    if ((fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) < 0 ||
+        inotify_add_watch(fd, dir, IN_CREATE | IN_MOVED_TO) < 0) {
+        VIR_DEBUG("Unable to watch %s for monitor socket: %s",
+                  dir, strerror(errno));
+        VIR_FORCE_CLOSE(fd);
+    }
+
+    VIR_FREE(dir);
+    return fd;
+}
+#else /* !HAVE_SYS_INOTIFY_H */
+static int
+qemuMonitorOpenUnixWatch(const char *monitor ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+#endif /* !HAVE_SYS_INOTIFY_H */
+
+
+/* Waits before the next attempt to connect to the monitor, returns false
+ * once the timeout expired */
+static bool
+qemuMonitorOpenUnixWait(virTimeBackOffVar *timebackoff,
+                        int watchfd)
+{
+    struct pollfd pfd = { .fd = watchfd, .events = POLLIN };
+    unsigned long long now;
+    unsigned long long wait;
+    char buf[1024];
+
+    if (watchfd < 0)
+        return virTimeBackOffWait(timebackoff);
+
+    if (virTimeMillisNowRaw(&now) < 0 || now > timebackoff->limit_t)
+        return false;
+
+    /* A socket left behind by a previous QEMU, or one that is not
+     * listening yet, refuses the connection without creating anything,
+     * so the wait is still limited */
+    wait = MIN(timebackoff->limit_t - now, QEMU_MONITOR_WATCH_INTERVAL);
+    if (poll(&pfd, 1, wait) > 0) {
+        /* Only the wakeup matters, not which file was created */
+        while (read(watchfd, buf, sizeof(buf)) > 0)
+            ;
+    }
+
+    return true;
 }
 
 
@@ -333,6 +434,8 @@ qemuMonitorOpenUnix(const char *monitor,
 {
     struct sockaddr_un addr;
     int monfd;
+    int watchfd = -1;
+    int connerr = 0;
     virTimeBackOffVar timebackoff;
     int ret = -1;
 
@@ -350,9 +453,12 @@ qemuMonitorOpenUnix(const char *monitor,
         goto error;
     }
 
+    if (cpid)
+        watchfd = qemuMonitorOpenUnixWatch(monitor);
+
     if (virTimeBackOffStart(&timebackoff, 1, timeout * 1000) < 0)
         goto error;
-    while (virTimeBackOffWait(&timebackoff)) {
+    do {
         ret = connect(monfd, (struct sockaddr *) &addr, sizeof(addr));
 
         if (ret == 0)
@@ -362,6 +468,7 @@ qemuMonitorOpenUnix(const char *monitor,
             (!cpid || virProcessKill(cpid, 0) == 0)) {
             /* ENOENT       : Socket may not have shown up yet
              * ECONNREFUSED : Leftover socket hasn't been removed yet */
+            connerr = errno;
             continue;
         }
 
@@ -369,17 +476,19 @@ qemuMonitorOpenUnix(const char *monitor,
                              _("failed to connect to monitor socket"));
         goto error;
 
-    }
+    } while (qemuMonitorOpenUnixWait(&timebackoff, watchfd));
 
     if (ret != 0) {
-        virReportSystemError(errno, "%s",
+        virReportSystemError(connerr, "%s",
                              _("monitor socket did not show up"));
         goto error;
     }
 
+    VIR_FORCE_CLOSE(watchfd);
     return monfd;
 
  error:
+    VIR_FORCE_CLOSE(watchfd);
     VIR_FORCE_CLOSE(monfd);
     return -1;
 }
@@ -400,6 +509,73 @@ qemuMonitorOpenPty(const char *monitor)
 }
 
 
+/* Returns the first queued message which was not completely written
+ * yet. Replies of the JSON monitor are matched to their commands, so
+ * all messages can be sent at once, while the text monitor has to wait
+ * for the reply to a command before sending the next one. */
+static qemuMonitorMessagePtr
+qemuMonitorTxMessage(qemuMonitorPtr mon)
+{
+    qemuMonitorMessagePtr msg;
+
+    for (msg = mon->msg; msg; msg = msg->next) {
+        if (msg->txOffset < msg->txLength)
+            return msg;
+        if (!mon->json && !msg->finished)
+            return NULL;
+    }
+
+    return NULL;
+}
+
+
+/* Returns the first queued message waiting for its reply, that is,
+ * completely written but not finished yet */
+static qemuMonitorMessagePtr
+qemuMonitorRxMessage(qemuMonitorPtr mon)
+{
+    qemuMonitorMessagePtr msg;
+
+    for (msg = mon->msg; msg; msg = msg->next) {
+        if (msg->finished)
+            continue;
+        if (msg->txOffset < msg->txLength)
+            return NULL;
+        return msg;
+    }
+
+    return NULL;
+}
+
+
+static bool
+qemuMonitorMessagesFinished(qemuMonitorMessagePtr msg)
+{
+    for (; msg; msg = msg->next) {
+        if (!msg->finished)
+            return false;
+    }
+
+    return true;
+}
+
+
+/* Wakes up the waiter of the queued messages, if there's anyone left
+ * to be woken up, after a fatal error */
+static void
+qemuMonitorMessagesAbort(qemuMonitorPtr mon)
+{
+    qemuMonitorMessagePtr msg;
+
+    if (qemuMonitorMessagesFinished(mon->msg))
+        return;
+
+    for (msg = mon->msg; msg; msg = msg->next)
+        msg->finished = 1;
+    virCondBroadcast(&mon->notify);
+}
+
+
 /* This method processes data that has been received
  * from the monitor. Looking for async events and
  * replies/errors.
@@ -409,35 +585,39 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
 {
     int len;
     qemuMonitorMessagePtr msg = NULL;
+    char *data = mon->buffer + mon->bufferStart;
+    size_t avail = mon->bufferOffset - mon->bufferStart;
 
-    /* See if there's a message & whether its ready for its reply
-     * ie whether its completed writing all its data */
-    if (mon->msg && mon->msg->txOffset == mon->msg->txLength)
-        msg = mon->msg;
+    /* See if there's a message ready for its reply, ie whether it
+     * completed writing all its data. The JSON monitor gets all the
+     * queued messages and matches the reply itself. */
+    if (mon->json) {
+        if (mon->msg && qemuMonitorRxMessage(mon))
+            msg = mon->msg;
+    } else {
+        msg = qemuMonitorRxMessage(mon);
+    }
 
 #if DEBUG_IO
 # if DEBUG_RAW_IO
     char *str1 = qemuMonitorEscapeNonPrintable(msg ? msg->txBuffer : "");
-    char *str2 = qemuMonitorEscapeNonPrintable(mon->buffer);
-    VIR_ERROR(_("Process %d %p %p [[[[%s]]][[[%s]]]"), (int)mon->bufferOffset, mon->msg, msg, str1, str2);
+    char *str2 = qemuMonitorEscapeNonPrintable(data);
+    VIR_ERROR(_("Process %d %p %p [[[[%s]]][[[%s]]]"), (int)avail, mon->msg, msg, str1, str2);
     VIR_FREE(str1);
     VIR_FREE(str2);
 # else
-    VIR_DEBUG("Process %d", (int)mon->bufferOffset);
+    VIR_DEBUG("Process %d", (int)avail);
 # endif
 #endif
 
     PROBE(QEMU_MONITOR_IO_PROCESS,
-          "mon=%p buf=%s len=%zu", mon, mon->buffer, mon->bufferOffset);
+          "mon=%p buf=%s len=%zu", mon, data, avail);
 
     if (mon->json)
-        len = qemuMonitorJSONIOProcess(mon,
-                                       mon->buffer, mon->bufferOffset,
-                                       msg);
+        len = qemuMonitorJSONIOProcess(mon, data, avail,
+                                       &mon->bufferScanned, msg);
     else
-        len = qemuMonitorTextIOProcess(mon,
-                                       mon->buffer, mon->bufferOffset,
-                                       msg);
+        len = qemuMonitorTextIOProcess(mon, data, avail, msg);
 
     if (len < 0)
         return -1;
@@ -445,17 +625,25 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
     if (len && mon->waitGreeting)
         mon->waitGreeting = false;
 
-    if (len < mon->bufferOffset) {
-        memmove(mon->buffer, mon->buffer + len, mon->bufferOffset - len);
-        mon->bufferOffset -= len;
+    /* Rather than moving the remaining data to the front of the
+     * buffer after every message, just skip the processed part. The
+     * space is reclaimed once the buffer is drained, or by
+     * qemuMonitorIORead when it runs out of room. */
+    if (len < avail) {
+        mon->bufferStart += len;
     } else {
-        VIR_FREE(mon->buffer);
-        mon->bufferOffset = mon->bufferLength = 0;
+        mon->bufferStart = mon->bufferOffset = mon->bufferScanned = 0;
+        if (mon->bufferLength > QEMU_MONITOR_BUFFER_KEEP) {
+            VIR_FREE(mon->buffer);
+            mon->bufferLength = 0;
+        }
     }
 #if DEBUG_IO
-    VIR_DEBUG("Process done %d used %d", (int)mon->bufferOffset, len);
+    VIR_DEBUG("Process done %d used %d",
+              (int)(mon->bufferOffset - mon->bufferStart), len);
 #endif
-    if (msg && msg->finished)
+    /* Wake up the waiter only once all of its messages are answered */
+    if (msg && qemuMonitorMessagesFinished(mon->msg))
         virCondBroadcast(&mon->notify);
     return len;
 }
@@ -506,51 +694,63 @@ qemuMonitorIOWriteWithFD(qemuMonitorPtr mon,
 /*
  * Called when the monitor is able to write data
  * Call this function while holding the monitor lock.
+ *
+ * Writes as many of the queued messages as the monitor accepts.
  */
 static int
 qemuMonitorIOWrite(qemuMonitorPtr mon)
 {
+    qemuMonitorMessagePtr msg;
+    int total = 0;
     int done;
     char *buf;
     size_t len;
 
-    /* If no active message, or fully transmitted, the no-op */
-    if (!mon->msg || mon->msg->txOffset == mon->msg->txLength)
-        return 0;
+    while ((msg = qemuMonitorTxMessage(mon))) {
+        if (msg->txFD != -1 && !mon->hasSendFD) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Monitor does not support sending of file descriptors"));
+            return -1;
+        }
 
-    if (mon->msg->txFD != -1 && !mon->hasSendFD) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Monitor does not support sending of file descriptors"));
-        return -1;
-    }
+        buf = msg->txBuffer + msg->txOffset;
+        len = msg->txLength - msg->txOffset;
+        if (msg->txFD == -1)
+            done = write(mon->fd, buf, len);
+        else
+            done = qemuMonitorIOWriteWithFD(mon, buf, len, msg->txFD);
 
-    buf = mon->msg->txBuffer + mon->msg->txOffset;
-    len = mon->msg->txLength - mon->msg->txOffset;
-    if (mon->msg->txFD == -1)
-        done = write(mon->fd, buf, len);
-    else
-        done = qemuMonitorIOWriteWithFD(mon, buf, len, mon->msg->txFD);
+        PROBE(QEMU_MONITOR_IO_WRITE,
+              "mon=%p buf=%s len=%zu ret=%d errno=%d",
+              mon, buf, len, done, done < 0 ? errno : 0);
 
-    PROBE(QEMU_MONITOR_IO_WRITE,
-          "mon=%p buf=%s len=%zu ret=%d errno=%d",
-          mon, buf, len, done, done < 0 ? errno : 0);
+        if (msg->txFD != -1) {
+            PROBE(QEMU_MONITOR_IO_SEND_FD,
+                  "mon=%p fd=%d ret=%d errno=%d",
+                  mon, msg->txFD, done, done < 0 ? errno : 0);
+        }
 
-    if (mon->msg->txFD != -1) {
-        PROBE(QEMU_MONITOR_IO_SEND_FD,
-              "mon=%p fd=%d ret=%d errno=%d",
-              mon, mon->msg->txFD, done, done < 0 ? errno : 0);
-    }
+        if (done < 0) {
+            if (errno == EAGAIN)
+                break;
 
-    if (done < 0) {
-        if (errno == EAGAIN)
-            return 0;
+            virReportSystemError(errno, "%s",
+                                 _("Unable to write to monitor"));
+            return -1;
+        }
+        msg->txOffset += done;
+        total += done;
 
-        virReportSystemError(errno, "%s",
-                             _("Unable to write to monitor"));
-        return -1;
+        if (msg->txOffset == msg->txLength &&
+            virTimeMicrosNowRaw(&msg->txTime) < 0)
+            msg->txTime = 0;
+
+        /* The rest has to wait until the monitor is writable again */
+        if ((size_t) done < len)
+            break;
     }
-    mon->msg->txOffset += done;
-    return done;
+
+    return total;
 }
 
 
@@ -566,12 +766,30 @@ qemuMonitorIORead(qemuMonitorPtr mon)
     size_t avail = mon->bufferLength - mon->bufferOffset;
     int ret = 0;
 
-    if (avail < 1024) {
-        if (VIR_REALLOC_N(mon->buffer,
-                          mon->bufferLength + 1024) < 0)
-            return -1;
-        mon->bufferLength += 1024;
-        avail += 1024;
+    if (avail < QEMU_MONITOR_READ_MIN) {
+        size_t pending = mon->bufferOffset - mon->bufferStart;
+
+        /* Reclaim the space of already processed data first, the
+         * pending part is a single partial message at most */
+        if (mon->bufferStart) {
+            memmove(mon->buffer, mon->buffer + mon->bufferStart, pending);
+            mon->bufferStart = 0;
+            mon->bufferOffset = pending;
+            mon->buffer[pending] = '\0';
+            avail = mon->bufferLength - pending;
+        }
+
+        /* Grow geometrically so that large replies need only a
+         * logarithmic number of reallocations */
+        if (avail < QEMU_MONITOR_READ_MIN) {
+            size_t newlen = MAX(mon->bufferLength * 2,
+                                QEMU_MONITOR_READ_MIN * 4);
+
+            if (VIR_REALLOC_N(mon->buffer, newlen) < 0)
+                return -1;
+            avail += newlen - mon->bufferLength;
+            mon->bufferLength = newlen;
+        }
     }
 
     /* Read as much as we can get into our buffer,
@@ -599,7 +817,8 @@ qemuMonitorIORead(qemuMonitorPtr mon)
     }
 
 #if DEBUG_IO
-    VIR_DEBUG("Now read %d bytes of data", (int)mon->bufferOffset);
+    VIR_DEBUG("Now read %d bytes of data",
+              (int)(mon->bufferOffset - mon->bufferStart));
 #endif
 
     return ret;
@@ -619,8 +838,7 @@ qemuMonitorUpdateWatch(qemuMonitorPtr mon)
     if (mon->lastError.code == VIR_ERR_OK) {
         events |= VIR_EVENT_HANDLE_READABLE;
 
-        if ((mon->msg && mon->msg->txOffset < mon->msg->txLength) &&
-            !mon->waitGreeting)
+        if (qemuMonitorTxMessage(mon) && !mon->waitGreeting)
             events |= VIR_EVENT_HANDLE_WRITABLE;
     }
 
@@ -745,10 +963,7 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque)
         VIR_DEBUG("Error on monitor %s", NULLSTR(mon->lastError.message));
         /* If IO process resulted in an error & we have a message,
          * then wakeup that waiter */
-        if (mon->msg && !mon->msg->finished) {
-            mon->msg->finished = 1;
-            virCondSignal(&mon->notify);
-        }
+        qemuMonitorMessagesAbort(mon);
     }
 
     qemuMonitorUpdateWatch(mon);
@@ -761,7 +976,7 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque)
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         virObjectUnlock(mon);
         VIR_DEBUG("Triggering EOF callback");
         (eofNotify)(mon, vm, mon->callbackOpaque);
@@ -771,7 +986,7 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque)
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         virObjectUnlock(mon);
         VIR_DEBUG("Triggering error callback");
         (errorNotify)(mon, vm, mon->callbackOpaque);
@@ -838,13 +1053,15 @@ qemuMonitorOpenInternal(virDomainObjPtr vm,
 
     virObjectLock(mon);
     virObjectRef(mon);
-    if ((mon->watch = virEventAddHandle(mon->fd,
-                                        VIR_EVENT_HANDLE_HANGUP |
-                                        VIR_EVENT_HANDLE_ERROR |
-                                        VIR_EVENT_HANDLE_READABLE,
-                                        qemuMonitorIO,
-                                        mon,
-                                        virObjectFreeCallback)) < 0) {
+    /* Domains are spread over the event loop threads by their ID */
+    if ((mon->watch = virEventAddHandleAffinity(mon->fd,
+                                                VIR_EVENT_HANDLE_HANGUP |
+                                                VIR_EVENT_HANDLE_ERROR |
+                                                VIR_EVENT_HANDLE_READABLE,
+                                                qemuMonitorIO,
+                                                mon,
+                                                virObjectFreeCallback,
+                                                vm->def->id)) < 0) {
         virObjectUnref(mon);
         virObjectUnlock(mon);
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -987,8 +1204,7 @@ qemuMonitorClose(qemuMonitorPtr mon)
                 virResetLastError();
             }
         }
-        mon->msg->finished = 1;
-        virCondSignal(&mon->notify);
+        qemuMonitorMessagesAbort(mon);
     }
 
     /* Propagate existing monitor error in case the current thread has no
@@ -1012,12 +1228,105 @@ qemuMonitorNextCommandID(qemuMonitorPtr mon)
 }
 
 
+/**
+ * qemuMonitorCommandStatsBucket:
+ * @duration: reply latency in microseconds
+ *
+ * Returns the index of the histogram bucket @duration belongs to.
+ */
+static size_t
+qemuMonitorCommandStatsBucket(unsigned long long duration)
+{
+    size_t i;
+
+    for (i = 0; i < QEMU_MONITOR_COMMAND_STATS_BUCKETS - 1; i++) {
+        if (duration < (1ULL << i))
+            break;
+    }
+
+    return i;
+}
+
+
+/* Accounts the reply to @msg in the statistics of its command. Runs in
+ * the thread which sent it, so the monitor is locked. A failure to
+ * allocate the entry of a new command just loses the sample. */
+static void
+qemuMonitorCommandStatsAdd(qemuMonitorPtr mon,
+                           qemuMonitorMessagePtr msg)
+{
+    qemuMonitorCommandStatsPtr stats = NULL;
+    unsigned long long duration = 0;
+    size_t i;
+
+    if (!msg->cmd || !msg->txTime || !msg->rxTime)
+        return;
+
+    for (i = 0; i < mon->ncmdStats; i++) {
+        if (STREQ(mon->cmdStats[i].name, msg->cmd)) {
+            stats = &mon->cmdStats[i];
+            break;
+        }
+    }
+
+    if (!stats) {
+        char *name;
+
+        if (VIR_STRDUP_QUIET(name, msg->cmd) < 0)
+            return;
+        if (VIR_REALLOC_N_QUIET(mon->cmdStats, mon->ncmdStats + 1) < 0) {
+            VIR_FREE(name);
+            return;
+        }
+        stats = &mon->cmdStats[mon->ncmdStats++];
+        memset(stats, 0, sizeof(*stats));
+        stats->name = name;
+    }
+
+    if (msg->rxTime > msg->txTime)
+        duration = msg->rxTime - msg->txTime;
+
+    stats->count++;
+    stats->timeTotal += duration;
+    if (duration > stats->timeMax)
+        stats->timeMax = duration;
+    stats->buckets[qemuMonitorCommandStatsBucket(duration)]++;
+    stats->replyBytes += msg->rxBytes;
+    if (msg->rxBytes > stats->replyMax)
+        stats->replyMax = msg->rxBytes;
+}
+
+
+/**
+ * qemuMonitorSend:
+ * @mon: monitor object
+ * @msg: message to send
+ *
+ * Sends @msg and waits for its reply. @msg may be the first of a list of
+ * messages linked by their @next pointers, in which case all of them are
+ * queued at once and the caller is woken up only after the last reply
+ * arrives. The JSON monitor writes all of them without waiting for any
+ * reply, which saves a round trip per command.
+ *
+ * Returns 0 if all replies were received, -1 if the monitor failed.
+ */
 int
 qemuMonitorSend(qemuMonitorPtr mon,
                 qemuMonitorMessagePtr msg)
 {
+    qemuMonitorMessagePtr tmp;
     int ret = -1;
 
+    /* Threads sharing a query job may use the monitor at the same time,
+     * wait for the commands of the others to be answered first */
+    while (mon->msg && mon->lastError.code == VIR_ERR_OK) {
+        if (virCondWait(&mon->notify, &mon->parent.lock) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Unable to wait on monitor condition"));
+            return -1;
+        }
+    }
+
     /* Check whether qemu quit unexpectedly */
     if (mon->lastError.code != VIR_ERR_OK) {
         VIR_DEBUG("Attempt to send command while error is set %s",
@@ -1029,11 +1338,13 @@ qemuMonitorSend(qemuMonitorPtr mon,
     mon->msg = msg;
     qemuMonitorUpdateWatch(mon);
 
-    PROBE(QEMU_MONITOR_SEND_MSG,
-          "mon=%p msg=%s fd=%d",
-          mon, mon->msg->txBuffer, mon->msg->txFD);
+    for (tmp = msg; tmp; tmp = tmp->next) {
+        PROBE(QEMU_MONITOR_SEND_MSG,
+              "mon=%p msg=%s fd=%d",
+              mon, tmp->txBuffer, tmp->txFD);
+    }
 
-    while (!mon->msg->finished) {
+    while (!qemuMonitorMessagesFinished(mon->msg)) {
         if (virCondWait(&mon->notify, &mon->parent.lock) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("Unable to wait on monitor condition"));
@@ -1051,13 +1362,104 @@ qemuMonitorSend(qemuMonitorPtr mon,
     ret = 0;
 
  cleanup:
+    for (tmp = msg; tmp; tmp = tmp->next)
+        qemuMonitorCommandStatsAdd(mon, tmp);
+
     mon->msg = NULL;
     qemuMonitorUpdateWatch(mon);
+    virCondBroadcast(&mon->notify);
 
     return ret;
 }
 
 
+/* Estimates the @percent percentile of the latencies in @stats as the
+ * upper limit of the histogram bucket it falls into */
+static unsigned long long
+qemuMonitorCommandStatsPercentile(qemuMonitorCommandStatsPtr stats,
+                                  unsigned int percent)
+{
+    unsigned long long rank = (stats->count * percent + 99) / 100;
+    unsigned long long seen = 0;
+    size_t i;
+
+    for (i = 0; i < QEMU_MONITOR_COMMAND_STATS_BUCKETS - 1; i++) {
+        seen += stats->buckets[i];
+        if (seen >= rank)
+            return MIN(1ULL << i, stats->timeMax);
+    }
+
+    return stats->timeMax;
+}
+
+
+/**
+ * qemuMonitorGetCommandStats:
+ * @mon: monitor object
+ * @stats: filled with the statistics of the commands
+ * @nstats: filled with the number of items in @stats
+ *
+ * Copies the latency and reply size statistics of each command sent to
+ * the JSON monitor @mon, with the percentiles filled in. Free the result
+ * with qemuMonitorCommandStatsFree.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuMonitorGetCommandStats(qemuMonitorPtr mon,
+                           qemuMonitorCommandStatsPtr *stats,
+                           size_t *nstats)
+{
+    qemuMonitorCommandStatsPtr copy = NULL;
+    size_t ncopy = 0;
+    size_t i;
+    int ret = -1;
+
+    virObjectLock(mon);
+
+    if (mon->ncmdStats &&
+        VIR_ALLOC_N(copy, mon->ncmdStats) < 0)
+        goto cleanup;
+
+    for (; ncopy < mon->ncmdStats; ncopy++) {
+        copy[ncopy] = mon->cmdStats[ncopy];
+        if (VIR_STRDUP(copy[ncopy].name, mon->cmdStats[ncopy].name) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < ncopy; i++) {
+        copy[i].timeP50 = qemuMonitorCommandStatsPercentile(&copy[i], 50);
+        copy[i].timeP99 = qemuMonitorCommandStatsPercentile(&copy[i], 99);
+    }
+
+    *stats = copy;
+    *nstats = ncopy;
+    copy = NULL;
+    ncopy = 0;
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(mon);
+    qemuMonitorCommandStatsFree(copy, ncopy);
+    return ret;
+}
+
+
+void
+qemuMonitorCommandStatsFree(qemuMonitorCommandStatsPtr stats,
+                            size_t nstats)
+{
+    size_t i;
+
+    if (!stats)
+        return;
+
+    for (i = 0; i < nstats; i++)
+        VIR_FREE(stats[i].name);
+    VIR_FREE(stats);
+}
+
+
 /**
  * This function returns a new virError object; the caller is responsible
  * for freeing it.
@@ -1623,6 +2025,22 @@ qemuMonitorEmitBlockThreshold(qemuMonitorPtr mon,
 }
 
 
+int
+qemuMonitorEmitDumpCompleted(qemuMonitorPtr mon,
+                             qemuMonitorDumpStatsPtr stats,
+                             const char *error)
+{
+    int ret = -1;
+
+    VIR_DEBUG("mon=%p, stats=%p, error=%s", mon, stats, NULLSTR(error));
+
+    QEMU_MONITOR_CALLBACK(mon, ret, domainDumpCompleted, mon->vm,
+                          stats, error);
+
+    return ret;
+}
+
+
 int
 qemuMonitorSetCapabilities(qemuMonitorPtr mon)
 {
@@ -1927,6 +2345,7 @@ qemuMonitorGetCPUInfoHotplug(struct qemuMonitorQueryHotpluggableCpusEntry *hotpl
  * @vcpus: pointer filled by array of qemuMonitorCPUInfo structures
  * @maxvcpus: total possible number of vcpus
  * @hotplug: query data relevant for hotplug support
+ * @fast: use query-cpus-fast, which doesn't interrupt the vcpus
  *
  * Detects VCPU information. If qemu doesn't support or fails reporting
  * information this function will return success as other parts of libvirt
@@ -1939,7 +2358,8 @@ int
 qemuMonitorGetCPUInfo(qemuMonitorPtr mon,
                       qemuMonitorCPUInfoPtr *vcpus,
                       size_t maxvcpus,
-                      bool hotplug)
+                      bool hotplug,
+                      bool fast)
 {
     struct qemuMonitorQueryHotpluggableCpusEntry *hotplugcpus = NULL;
     size_t nhotplugcpus = 0;
@@ -1965,7 +2385,8 @@ qemuMonitorGetCPUInfo(qemuMonitorPtr mon,
         goto cleanup;
 
     if (mon->json)
-        rc = qemuMonitorJSONQueryCPUs(mon, &cpuentries, &ncpuentries, hotplug);
+        rc = qemuMonitorJSONQueryCPUs(mon, &cpuentries, &ncpuentries, hotplug,
+                                      fast);
     else
         rc = qemuMonitorTextQueryCPUs(mon, &cpuentries, &ncpuentries);
 
@@ -1999,6 +2420,26 @@ qemuMonitorGetCPUInfo(qemuMonitorPtr mon,
 }
 
 
+static virBitmapPtr
+qemuMonitorCpuEntriesHalted(struct qemuMonitorQueryCpusEntry *cpuentries,
+                            size_t ncpuentries,
+                            size_t maxvcpus)
+{
+    virBitmapPtr ret;
+    size_t i;
+
+    if (!(ret = virBitmapNew(maxvcpus)))
+        return NULL;
+
+    for (i = 0; i < ncpuentries; i++) {
+        if (cpuentries[i].halted)
+            ignore_value(virBitmapSetBit(ret, cpuentries[i].qemu_id));
+    }
+
+    return ret;
+}
+
+
 /**
  * qemuMonitorGetCpuHalted:
  *
@@ -2011,27 +2452,21 @@ qemuMonitorGetCpuHalted(qemuMonitorPtr mon,
 {
     struct qemuMonitorQueryCpusEntry *cpuentries = NULL;
     size_t ncpuentries = 0;
-    size_t i;
     int rc;
     virBitmapPtr ret = NULL;
 
     QEMU_CHECK_MONITOR_NULL(mon);
 
     if (mon->json)
-        rc = qemuMonitorJSONQueryCPUs(mon, &cpuentries, &ncpuentries, false);
+        rc = qemuMonitorJSONQueryCPUs(mon, &cpuentries, &ncpuentries, false,
+                                      false);
     else
         rc = qemuMonitorTextQueryCPUs(mon, &cpuentries, &ncpuentries);
 
     if (rc < 0)
         goto cleanup;
 
-    if (!(ret = virBitmapNew(maxvcpus)))
-        goto cleanup;
-
-    for (i = 0; i < ncpuentries; i++) {
-        if (cpuentries[i].halted)
-            ignore_value(virBitmapSetBit(ret, cpuentries[i].qemu_id));
-    }
+    ret = qemuMonitorCpuEntriesHalted(cpuentries, ncpuentries, maxvcpus);
 
  cleanup:
     qemuMonitorQueryCpusFree(cpuentries, ncpuentries);
@@ -2274,6 +2709,180 @@ qemuMonitorBlockStatsUpdateCapacity(qemuMonitorPtr mon,
 }
 
 
+/**
+ * qemuMonitorGetAllBlockStatsData:
+ * @mon: monitor object
+ * @ret_stats: pointer to return the hash of block stats into
+ * @backingChain: report stats of the backing chain members too
+ * @ret_nodedata: optional pointer to return the data of named block nodes
+ *
+ * Combines qemuMonitorGetAllBlockStatsInfo,
+ * qemuMonitorBlockStatsUpdateCapacity and, if @ret_nodedata is not NULL,
+ * qemuMonitorQueryNamedBlockNodes, sending all the commands at once.
+ *
+ * Returns the number of stats on success, -1 on error. On error, the
+ * parts which were fetched are still returned and have to be freed by
+ * the caller.
+ */
+int
+qemuMonitorGetAllBlockStatsData(qemuMonitorPtr mon,
+                                virHashTablePtr *ret_stats,
+                                bool backingChain,
+                                virJSONValuePtr *ret_nodedata)
+{
+    qemuMonitorStats stats;
+    unsigned int flags = QEMU_MONITOR_STATS_BLOCK;
+    int ret;
+
+    VIR_DEBUG("ret_stats=%p, backing=%d, ret_nodedata=%p",
+              ret_stats, backingChain, ret_nodedata);
+
+    if (backingChain)
+        flags |= QEMU_MONITOR_STATS_BLOCK_BACKING;
+    if (ret_nodedata)
+        flags |= QEMU_MONITOR_STATS_BLOCK_NODES;
+
+    ret = qemuMonitorGetStats(mon, flags, NULL, 0, &stats);
+    if (ret == 0)
+        ret = stats.nblockstats;
+
+    VIR_STEAL_PTR(*ret_stats, stats.blockstats);
+    if (ret_nodedata)
+        VIR_STEAL_PTR(*ret_nodedata, stats.nodedata);
+
+    qemuMonitorStatsClear(&stats);
+    return ret;
+}
+
+
+/**
+ * qemuMonitorGetStats:
+ * @mon: monitor object
+ * @flags: bitwise-OR of qemuMonitorStatsFlags selecting the data to fetch
+ * @balloon: balloon device definition, used for QEMU_MONITOR_STATS_BALLOON
+ * @maxvcpus: maximum vcpu count, used for QEMU_MONITOR_STATS_VCPU_HALTED
+ * @stats: filled with the data
+ *
+ * Fetches the data of several stats groups at once. The JSON monitor sends
+ * all the needed commands together, so it costs a single round trip to
+ * QEMU.
+ *
+ * Returns 0 on success, -1 if any of the data could not be fetched. The
+ * rest is filled in anyway, @stats must be freed by qemuMonitorStatsClear
+ * in both cases.
+ */
+int
+qemuMonitorGetStats(qemuMonitorPtr mon,
+                    unsigned int flags,
+                    virDomainMemballoonDefPtr balloon,
+                    size_t maxvcpus,
+                    qemuMonitorStatsPtr stats)
+{
+    struct qemuMonitorQueryCpusEntry *cpuentries = NULL;
+    size_t ncpuentries = 0;
+    bool backingChain = !!(flags & QEMU_MONITOR_STATS_BLOCK_BACKING);
+    int ret = -1;
+
+    VIR_DEBUG("flags=0x%x, maxvcpus=%zu", flags, maxvcpus);
+
+    memset(stats, 0, sizeof(*stats));
+    stats->nmemstats = -1;
+    stats->nblockstats = -1;
+    stats->dirtyrate.status = -1;
+
+    QEMU_CHECK_MONITOR(mon);
+
+    if (!mon->json) {
+        ret = 0;
+
+        if (flags & QEMU_MONITOR_STATS_BALLOON &&
+            (stats->nmemstats = qemuMonitorTextGetMemoryStats(mon,
+                                                              stats->memstats,
+                                                              VIR_DOMAIN_MEMORY_STAT_NR)) < 0)
+            ret = -1;
+
+        if (flags & QEMU_MONITOR_STATS_VCPU_HALTED &&
+            !(stats->halted = qemuMonitorGetCpuHalted(mon, maxvcpus)))
+            ret = -1;
+
+        /* The text monitor provides the block stats only, the capacity
+         * update reports the error */
+        if (flags & QEMU_MONITOR_STATS_BLOCK &&
+            ((stats->nblockstats =
+              qemuMonitorGetAllBlockStatsInfo(mon, &stats->blockstats,
+                                              backingChain)) < 0 ||
+             qemuMonitorBlockStatsUpdateCapacity(mon, stats->blockstats,
+                                                 backingChain) < 0))
+            ret = -1;
+
+        return ret;
+    }
+
+    if (flags & QEMU_MONITOR_STATS_BALLOON)
+        qemuMonitorInitBalloonObjectPath(mon, balloon);
+
+    if (flags & QEMU_MONITOR_STATS_BLOCK &&
+        !(stats->blockstats = virHashCreate(10, virHashValueFree)))
+        return -1;
+
+    ret = qemuMonitorJSONGetStats(mon, flags, mon->balloonpath, stats,
+                                  &cpuentries, &ncpuentries);
+
+    if (flags & QEMU_MONITOR_STATS_VCPU_HALTED && cpuentries &&
+        !(stats->halted = qemuMonitorCpuEntriesHalted(cpuentries, ncpuentries,
+                                                      maxvcpus)))
+        ret = -1;
+
+    qemuMonitorQueryCpusFree(cpuentries, ncpuentries);
+    return ret;
+}
+
+
+void
+qemuMonitorStatsClear(qemuMonitorStatsPtr stats)
+{
+    virBitmapFree(stats->halted);
+    stats->halted = NULL;
+    virHashFree(stats->blockstats);
+    stats->blockstats = NULL;
+    virJSONValueFree(stats->nodedata);
+    stats->nodedata = NULL;
+}
+
+
+/**
+ * qemuMonitorCalcDirtyRate:
+ * @mon: monitor object
+ * @seconds: length of the measurement
+ *
+ * Starts measuring the rate at which the guest dirties its memory. The
+ * command returns immediately, the result is available from
+ * qemuMonitorQueryDirtyRate once @seconds passed.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuMonitorCalcDirtyRate(qemuMonitorPtr mon,
+                         int seconds)
+{
+    VIR_DEBUG("seconds=%d", seconds);
+
+    QEMU_CHECK_MONITOR_JSON(mon);
+
+    return qemuMonitorJSONCalcDirtyRate(mon, seconds);
+}
+
+
+int
+qemuMonitorQueryDirtyRate(qemuMonitorPtr mon,
+                          qemuMonitorDirtyRateInfoPtr info)
+{
+    QEMU_CHECK_MONITOR_JSON(mon);
+
+    return qemuMonitorJSONQueryDirtyRate(mon, info);
+}
+
+
 int
 qemuMonitorBlockResize(qemuMonitorPtr mon,
                        const char *device,
@@ -2716,17 +3325,20 @@ qemuMonitorGetDumpGuestMemoryCapability(qemuMonitorPtr mon,
 
 
 int
-qemuMonitorDumpToFd(qemuMonitorPtr mon, int fd, const char *dumpformat)
+qemuMonitorDumpToFd(qemuMonitorPtr mon,
+                    int fd,
+                    const char *dumpformat,
+                    bool detach)
 {
     int ret;
-    VIR_DEBUG("fd=%d dumpformat=%s", fd, dumpformat);
+    VIR_DEBUG("fd=%d dumpformat=%s detach=%d", fd, dumpformat, detach);
 
     QEMU_CHECK_MONITOR_JSON(mon);
 
     if (qemuMonitorSendFileHandle(mon, "dump", fd) < 0)
         return -1;
 
-    ret = qemuMonitorJSONDump(mon, "fd:dump", dumpformat);
+    ret = qemuMonitorJSONDump(mon, "fd:dump", dumpformat, detach);
 
     if (ret < 0) {
         if (qemuMonitorCloseFileHandle(mon, "dump") < 0)
@@ -2737,6 +3349,16 @@ qemuMonitorDumpToFd(qemuMonitorPtr mon, int fd, const char *dumpformat)
 }
 
 
+int
+qemuMonitorQueryDump(qemuMonitorPtr mon,
+                     qemuMonitorDumpStatsPtr stats)
+{
+    QEMU_CHECK_MONITOR_JSON(mon);
+
+    return qemuMonitorJSONQueryDump(mon, stats);
+}
+
+
 int
 qemuMonitorGraphicsRelocate(qemuMonitorPtr mon,
                             int type,
@@ -3147,6 +3769,42 @@ qemuMonitorAddDeviceArgs(qemuMonitorPtr mon,
 }
 
 
+/**
+ * qemuMonitorAddDevicesArgs:
+ * @mon: monitor object
+ * @args: arguments of the devices to add, consumed on success or failure
+ * @nargs: number of @args
+ * @added: filled with whether each of the devices was added
+ *
+ * Adds all the devices described by @args in a single round trip to
+ * QEMU. Requires JSON monitor.
+ *
+ * Returns 0 if all of them were added, -1 on error.
+ */
+int
+qemuMonitorAddDevicesArgs(qemuMonitorPtr mon,
+                          virJSONValuePtr *args,
+                          size_t nargs,
+                          bool *added)
+{
+    size_t i;
+
+    VIR_DEBUG("nargs=%zu", nargs);
+
+    if (!mon || !mon->json) {
+        for (i = 0; i < nargs; i++) {
+            virJSONValueFree(args[i]);
+            args[i] = NULL;
+            added[i] = false;
+        }
+    }
+
+    QEMU_CHECK_MONITOR_JSON(mon);
+
+    return qemuMonitorJSONAddDevicesArgs(mon, args, nargs, added);
+}
+
+
 /**
  * qemuMonitorAddObject:
  * @mon: Pointer to monitor object
@@ -3306,6 +3964,102 @@ qemuMonitorTransaction(qemuMonitorPtr mon, virJSONValuePtr actions)
 }
 
 
+/* Add to @actions the creation of the dirty bitmap @name in @node.  */
+int
+qemuMonitorTransactionBitmapAdd(virJSONValuePtr actions,
+                                const char *node,
+                                const char *name,
+                                bool persistent,
+                                bool disabled)
+{
+    VIR_DEBUG("actions=%p node=%s name=%s persistent=%d disabled=%d",
+              actions, node, name, persistent, disabled);
+
+    return qemuMonitorJSONTransactionBitmapAdd(actions, node, name,
+                                               persistent, disabled);
+}
+
+
+/* Add to @actions the merge of bitmap @source into @target of @node.  */
+int
+qemuMonitorTransactionBitmapMerge(virJSONValuePtr actions,
+                                  const char *node,
+                                  const char *target,
+                                  const char *source)
+{
+    VIR_DEBUG("actions=%p node=%s target=%s source=%s",
+              actions, node, target, source);
+
+    return qemuMonitorJSONTransactionBitmapMerge(actions, node, target, source);
+}
+
+
+/* Add to @actions a blockdev-backup job of @device into the @target node.  */
+int
+qemuMonitorTransactionBackup(virJSONValuePtr actions,
+                             const char *device,
+                             const char *jobname,
+                             const char *target,
+                             const char *sync)
+{
+    VIR_DEBUG("actions=%p device=%s jobname=%s target=%s sync=%s",
+              actions, device, jobname, target, sync);
+
+    return qemuMonitorJSONTransactionBackup(actions, device, jobname,
+                                            target, sync);
+}
+
+
+int
+qemuMonitorBitmapRemove(qemuMonitorPtr mon,
+                        const char *node,
+                        const char *name)
+{
+    VIR_DEBUG("node=%s name=%s", node, name);
+
+    QEMU_CHECK_MONITOR_JSON(mon);
+
+    return qemuMonitorJSONBitmapRemove(mon, node, name);
+}
+
+
+/**
+ * qemuMonitorBlockdevAdd:
+ * @mon: monitor object
+ * @props: JSON object describing the new block node
+ *
+ * Adds a new block node to qemu. The function consumes @props.
+ *
+ * Returns 0 on success -1 on error.
+ */
+int
+qemuMonitorBlockdevAdd(qemuMonitorPtr mon,
+                       virJSONValuePtr props)
+{
+    VIR_DEBUG("props=%p", props);
+
+    QEMU_CHECK_MONITOR_JSON_GOTO(mon, error);
+
+    return qemuMonitorJSONBlockdevAdd(mon, props);
+
+ error:
+    virJSONValueFree(props);
+    return -1;
+}
+
+
+int
+qemuMonitorBlockdevDel(qemuMonitorPtr mon,
+                       const char *nodename)
+{
+    VIR_DEBUG("nodename=%s", nodename);
+
+    QEMU_CHECK_MONITOR_JSON(mon);
+
+    return qemuMonitorJSONBlockdevDel(mon, nodename);
+}
+
+
 /* Start a block-commit block job.  bandwidth is in bytes/sec.  */
 int
 qemuMonitorBlockCommit(qemuMonitorPtr mon, const char *device,
@@ -3866,6 +4620,55 @@ qemuMonitorGetObjectProps(qemuMonitorPtr mon,
 }
 
 
+/**
+ * qemuMonitorGetProbeInfo:
+ * @mon: monitor object
+ * @types: device types to list the properties of
+ * @ntypes: number of @types
+ * @info: filled with the data
+ *
+ * Fetches the events, the object types and the properties of each of
+ * @types, as qemuMonitorGetEvents, qemuMonitorGetObjectTypes and
+ * qemuMonitorGetObjectProps would. The commands are sent at once, so
+ * this costs a single round trip to QEMU rather than one per device
+ * type. @info must be freed by qemuMonitorProbeInfoClear even on
+ * failure.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuMonitorGetProbeInfo(qemuMonitorPtr mon,
+                        const char **types,
+                        size_t ntypes,
+                        qemuMonitorProbeInfoPtr info)
+{
+    VIR_DEBUG("types=%p ntypes=%zu", types, ntypes);
+
+    memset(info, 0, sizeof(*info));
+
+    QEMU_CHECK_MONITOR_JSON(mon);
+
+    return qemuMonitorJSONGetProbeInfo(mon, types, ntypes, info);
+}
+
+
+void
+qemuMonitorProbeInfoClear(qemuMonitorProbeInfoPtr info)
+{
+    size_t i;
+
+    virStringListFree(info->events);
+    virStringListFree(info->objectTypes);
+    for (i = 0; i < info->ntypes; i++) {
+        if (info->props)
+            virStringListFree(info->props[i]);
+    }
+    VIR_FREE(info->props);
+    VIR_FREE(info->nprops);
+    memset(info, 0, sizeof(*info));
+}
+
+
 char *
 qemuMonitorGetTargetArch(qemuMonitorPtr mon)
 {
@@ -3954,13 +4757,16 @@ qemuMonitorNBDServerStart(qemuMonitorPtr mon,
 int
 qemuMonitorNBDServerAdd(qemuMonitorPtr mon,
                         const char *deviceID,
-                        bool writable)
+                        const char *name,
+                        bool writable,
+                        const char *bitmap)
 {
-    VIR_DEBUG("deviceID=%s", deviceID);
+    VIR_DEBUG("deviceID=%s name=%s writable=%d bitmap=%s",
+              deviceID, NULLSTR(name), writable, NULLSTR(bitmap));
 
     QEMU_CHECK_MONITOR_JSON(mon);
 
-    return qemuMonitorJSONNBDServerAdd(mon, deviceID, writable);
+    return qemuMonitorJSONNBDServerAdd(mon, deviceID, name, writable, bitmap);
 }
 
 
@@ -4209,7 +5015,7 @@ qemuMonitorGetRTCTime(qemuMonitorPtr mon,
 }
 
 
-virHashTablePtr
+virJSONValuePtr
 qemuMonitorQueryQMPSchema(qemuMonitorPtr mon)
 {
     QEMU_CHECK_MONITOR_JSON_NULL(mon);
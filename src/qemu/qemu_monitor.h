@@ -60,6 +60,12 @@ struct _qemuMonitorMessage {
     int rxLength;
     /* Used by the JSON monitor to hold reply / error */
     void *rxObject;
+    /* If set, the JSON monitor passes the "return" member of the
+     * reply to this callback as it is parsed instead of storing it
+     * in rxObject. Runs in the event loop thread so it must not
+     * report errors, but record them in rxStreamOpaque instead. */
+    virJSONStreamCallback rxStream;
+    void *rxStreamOpaque;
 
     /* True if rxBuffer / rxObject are ready, or a
      * fatal error occurred on the monitor channel
@@ -68,6 +74,22 @@ struct _qemuMonitorMessage {
 
     qemuMonitorPasswordHandler passwordHandler;
     void *passwordOpaque;
+
+    /* The "id" of a JSON monitor command, its reply is
+     * matched by it */
+    char *id;
+
+    /* Name of the JSON monitor command for the per-command statistics,
+     * owned by the command object */
+    const char *cmd;
+    /* When the message was completely written and when its reply was
+     * received, in microseconds, and the length of the reply */
+    unsigned long long txTime;
+    unsigned long long rxTime;
+    size_t rxBytes;
+
+    /* Next message to send along with this one, see qemuMonitorSend */
+    qemuMonitorMessagePtr next;
 };
 
 typedef enum {
@@ -245,6 +267,32 @@ typedef int (*qemuMonitorDomainBlockThresholdCallback)(qemuMonitorPtr mon,
                                                        void *opaque);
 
 
+typedef enum {
+    QEMU_MONITOR_DUMP_STATUS_NONE,
+    QEMU_MONITOR_DUMP_STATUS_ACTIVE,
+    QEMU_MONITOR_DUMP_STATUS_COMPLETED,
+    QEMU_MONITOR_DUMP_STATUS_FAILED,
+
+    QEMU_MONITOR_DUMP_STATUS_LAST
+} qemuMonitorDumpStatus;
+
+VIR_ENUM_DECL(qemuMonitorDumpStatus)
+
+typedef struct _qemuMonitorDumpStats qemuMonitorDumpStats;
+typedef qemuMonitorDumpStats *qemuMonitorDumpStatsPtr;
+struct _qemuMonitorDumpStats {
+    int status; /* qemuMonitorDumpStatus */
+    unsigned long long completed; /* bytes written */
+    unsigned long long total; /* total bytes to be written */
+};
+
+typedef int (*qemuMonitorDomainDumpCompletedCallback)(qemuMonitorPtr mon,
+                                                      virDomainObjPtr vm,
+                                                      qemuMonitorDumpStatsPtr stats,
+                                                      const char *error,
+                                                      void *opaque);
+
+
 typedef struct _qemuMonitorCallbacks qemuMonitorCallbacks;
 typedef qemuMonitorCallbacks *qemuMonitorCallbacksPtr;
 struct _qemuMonitorCallbacks {
@@ -277,6 +325,7 @@ struct _qemuMonitorCallbacks {
     qemuMonitorDomainMigrationPassCallback domainMigrationPass;
     qemuMonitorDomainAcpiOstInfoCallback domainAcpiOstInfo;
     qemuMonitorDomainBlockThresholdCallback domainBlockThreshold;
+    qemuMonitorDomainDumpCompletedCallback domainDumpCompleted;
 };
 
 char *qemuMonitorEscapeArg(const char *in);
@@ -302,6 +351,31 @@ void qemuMonitorClose(qemuMonitorPtr mon);
 
 virErrorPtr qemuMonitorLastError(qemuMonitorPtr mon);
 
+/* Bucket N of the command latency histogram counts the replies which
+ * took less than 2^N microseconds, the last one all the slower ones */
+# define QEMU_MONITOR_COMMAND_STATS_BUCKETS 32
+
+typedef struct _qemuMonitorCommandStats qemuMonitorCommandStats;
+typedef qemuMonitorCommandStats *qemuMonitorCommandStatsPtr;
+struct _qemuMonitorCommandStats {
+    char *name;
+    unsigned long long count;       /* Replies received */
+    unsigned long long timeTotal;   /* Time waited for the replies (us) */
+    unsigned long long timeMax;
+    unsigned long long timeP50;     /* Estimated from the histogram by */
+    unsigned long long timeP99;     /* qemuMonitorGetCommandStats */
+    unsigned long long replyBytes;  /* Total length of the replies */
+    unsigned long long replyMax;
+    unsigned long long buckets[QEMU_MONITOR_COMMAND_STATS_BUCKETS];
+};
+
+int qemuMonitorGetCommandStats(qemuMonitorPtr mon,
+                               qemuMonitorCommandStatsPtr *stats,
+                               size_t *nstats)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+void qemuMonitorCommandStatsFree(qemuMonitorCommandStatsPtr stats,
+                                 size_t nstats);
+
 int qemuMonitorSetCapabilities(qemuMonitorPtr mon);
 
 int qemuMonitorSetLink(qemuMonitorPtr mon,
@@ -403,6 +477,10 @@ int qemuMonitorEmitBlockThreshold(qemuMonitorPtr mon,
                                   unsigned long long threshold,
                                   unsigned long long excess);
 
+int qemuMonitorEmitDumpCompleted(qemuMonitorPtr mon,
+                                 qemuMonitorDumpStatsPtr stats,
+                                 const char *error);
+
 int qemuMonitorStartCPUs(qemuMonitorPtr mon,
                          virConnectPtr conn);
 int qemuMonitorStopCPUs(qemuMonitorPtr mon);
@@ -501,7 +579,8 @@ void qemuMonitorCPUInfoFree(qemuMonitorCPUInfoPtr list,
 int qemuMonitorGetCPUInfo(qemuMonitorPtr mon,
                           qemuMonitorCPUInfoPtr *vcpus,
                           size_t maxvcpus,
-                          bool hotplug);
+                          bool hotplug,
+                          bool fast);
 virBitmapPtr qemuMonitorGetCpuHalted(qemuMonitorPtr mon, size_t maxvcpus);
 
 int qemuMonitorGetVirtType(qemuMonitorPtr mon,
@@ -549,6 +628,79 @@ int qemuMonitorBlockStatsUpdateCapacity(qemuMonitorPtr mon,
                                         bool backingChain)
     ATTRIBUTE_NONNULL(2);
 
+int qemuMonitorGetAllBlockStatsData(qemuMonitorPtr mon,
+                                    virHashTablePtr *ret_stats,
+                                    bool backingChain,
+                                    virJSONValuePtr *ret_nodedata)
+    ATTRIBUTE_NONNULL(2);
+
+typedef enum {
+    QEMU_MONITOR_DIRTY_RATE_STATUS_UNSTARTED,
+    QEMU_MONITOR_DIRTY_RATE_STATUS_MEASURING,
+    QEMU_MONITOR_DIRTY_RATE_STATUS_MEASURED,
+
+    QEMU_MONITOR_DIRTY_RATE_STATUS_LAST
+} qemuMonitorDirtyRateStatus;
+
+VIR_ENUM_DECL(qemuMonitorDirtyRateStatus)
+
+typedef struct _qemuMonitorDirtyRateInfo qemuMonitorDirtyRateInfo;
+typedef qemuMonitorDirtyRateInfo *qemuMonitorDirtyRateInfoPtr;
+struct _qemuMonitorDirtyRateInfo {
+    int status;             /* qemuMonitorDirtyRateStatus */
+    long long startTime;    /* start of the last calculation in seconds
+                               since the epoch */
+    int calcTime;           /* length of the calculation in seconds */
+    long long dirtyRate;    /* MiB/s, -1 unless measured */
+};
+
+int qemuMonitorCalcDirtyRate(qemuMonitorPtr mon,
+                             int seconds);
+int qemuMonitorQueryDirtyRate(qemuMonitorPtr mon,
+                              qemuMonitorDirtyRateInfoPtr info)
+    ATTRIBUTE_NONNULL(2);
+
+typedef enum {
+    QEMU_MONITOR_STATS_BALLOON = 1 << 0, /* memory stats of the balloon */
+    QEMU_MONITOR_STATS_VCPU_HALTED = 1 << 1, /* halted state of vcpus */
+    QEMU_MONITOR_STATS_VCPU_FAST = 1 << 2, /* use query-cpus-fast for the
+                                              halted state */
+    QEMU_MONITOR_STATS_BLOCK = 1 << 3, /* block stats with capacity */
+    QEMU_MONITOR_STATS_BLOCK_BACKING = 1 << 4, /* include backing chain in
+                                                  block stats */
+    QEMU_MONITOR_STATS_BLOCK_NODES = 1 << 5, /* data of named block nodes */
+    QEMU_MONITOR_STATS_DIRTY_RATE = 1 << 6, /* last dirty rate measurement */
+} qemuMonitorStatsFlags;
+
+typedef struct _qemuMonitorStats qemuMonitorStats;
+typedef qemuMonitorStats *qemuMonitorStatsPtr;
+struct _qemuMonitorStats {
+    /* QEMU_MONITOR_STATS_BALLOON, -1 if not fetched */
+    int nmemstats;
+    virDomainMemoryStatStruct memstats[VIR_DOMAIN_MEMORY_STAT_NR];
+
+    /* QEMU_MONITOR_STATS_VCPU_HALTED, indexed by the qemu id of vcpus */
+    virBitmapPtr halted;
+
+    /* QEMU_MONITOR_STATS_BLOCK, -1 if not fetched */
+    int nblockstats;
+    virHashTablePtr blockstats;
+
+    /* QEMU_MONITOR_STATS_BLOCK_NODES */
+    virJSONValuePtr nodedata;
+
+    /* QEMU_MONITOR_STATS_DIRTY_RATE, status is -1 if not fetched */
+    qemuMonitorDirtyRateInfo dirtyrate;
+};
+
+int qemuMonitorGetStats(qemuMonitorPtr mon,
+                        unsigned int flags,
+                        virDomainMemballoonDefPtr balloon,
+                        size_t maxvcpus,
+                        qemuMonitorStatsPtr stats)
+    ATTRIBUTE_NONNULL(5);
+void qemuMonitorStatsClear(qemuMonitorStatsPtr stats);
+
 int qemuMonitorBlockResize(qemuMonitorPtr mon,
                            const char *dev_name,
                            unsigned long long size);
@@ -740,7 +892,11 @@ int qemuMonitorGetDumpGuestMemoryCapability(qemuMonitorPtr mon,
 
 int qemuMonitorDumpToFd(qemuMonitorPtr mon,
                         int fd,
-                        const char *dumpformat);
+                        const char *dumpformat,
+                        bool detach);
+
+int qemuMonitorQueryDump(qemuMonitorPtr mon,
+                         qemuMonitorDumpStatsPtr stats);
 
 int qemuMonitorGraphicsRelocate(qemuMonitorPtr mon,
                                 int type,
@@ -800,6 +956,11 @@ int qemuMonitorAttachPCIDiskController(qemuMonitorPtr mon,
 
 int qemuMonitorAddDeviceArgs(qemuMonitorPtr mon,
                              virJSONValuePtr args);
+int qemuMonitorAddDevicesArgs(qemuMonitorPtr mon,
+                              virJSONValuePtr *args,
+                              size_t nargs,
+                              bool *added)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(4);
 int qemuMonitorAddDevice(qemuMonitorPtr mon,
                          const char *devicestr);
 
@@ -841,6 +1002,35 @@ int qemuMonitorDiskSnapshot(qemuMonitorPtr mon,
                             bool reuse);
 int qemuMonitorTransaction(qemuMonitorPtr mon, virJSONValuePtr actions)
     ATTRIBUTE_NONNULL(2);
+int qemuMonitorTransactionBitmapAdd(virJSONValuePtr actions,
+                                    const char *node,
+                                    const char *name,
+                                    bool persistent,
+                                    bool disabled)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+int qemuMonitorTransactionBitmapMerge(virJSONValuePtr actions,
+                                      const char *node,
+                                      const char *target,
+                                      const char *source)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3)
+    ATTRIBUTE_NONNULL(4);
+int qemuMonitorTransactionBackup(virJSONValuePtr actions,
+                                 const char *device,
+                                 const char *jobname,
+                                 const char *target,
+                                 const char *sync)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3)
+    ATTRIBUTE_NONNULL(4) ATTRIBUTE_NONNULL(5);
+int qemuMonitorBitmapRemove(qemuMonitorPtr mon,
+                            const char *node,
+                            const char *name)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+int qemuMonitorBlockdevAdd(qemuMonitorPtr mon,
+                           virJSONValuePtr props)
+    ATTRIBUTE_NONNULL(2);
+int qemuMonitorBlockdevDel(qemuMonitorPtr mon,
+                           const char *nodename)
+    ATTRIBUTE_NONNULL(2);
 int qemuMonitorDriveMirror(qemuMonitorPtr mon,
                            const char *device,
                            const char *file,
@@ -1040,6 +1230,27 @@ int qemuMonitorGetObjectTypes(qemuMonitorPtr mon,
 int qemuMonitorGetObjectProps(qemuMonitorPtr mon,
                               const char *type,
                               char ***props);
+
+typedef struct _qemuMonitorProbeInfo qemuMonitorProbeInfo;
+typedef qemuMonitorProbeInfo *qemuMonitorProbeInfoPtr;
+struct _qemuMonitorProbeInfo {
+    char **events;
+    int nevents;
+    char **objectTypes;
+    int nobjectTypes;
+
+    /* properties of each of the types passed to qemuMonitorGetProbeInfo */
+    size_t ntypes;
+    char ***props;
+    int *nprops;
+};
+
+int qemuMonitorGetProbeInfo(qemuMonitorPtr mon,
+                            const char **types,
+                            size_t ntypes,
+                            qemuMonitorProbeInfoPtr info)
+    ATTRIBUTE_NONNULL(4);
+void qemuMonitorProbeInfoClear(qemuMonitorProbeInfoPtr info);
 char *qemuMonitorGetTargetArch(qemuMonitorPtr mon);
 
 int qemuMonitorNBDServerStart(qemuMonitorPtr mon,
@@ -1047,7 +1258,9 @@ int qemuMonitorNBDServerStart(qemuMonitorPtr mon,
                               unsigned int port);
 int qemuMonitorNBDServerAdd(qemuMonitorPtr mon,
                             const char *deviceID,
-                            bool writable);
+                            const char *name,
+                            bool writable,
+                            const char *bitmap);
 int qemuMonitorNBDServerStop(qemuMonitorPtr);
 int qemuMonitorGetTPMModels(qemuMonitorPtr mon,
                             char ***tpmmodels);
@@ -1111,7 +1324,7 @@ int qemuMonitorMigrateStartPostCopy(qemuMonitorPtr mon);
 int qemuMonitorGetRTCTime(qemuMonitorPtr mon,
                           struct tm *tm);
 
-virHashTablePtr qemuMonitorQueryQMPSchema(qemuMonitorPtr mon);
+virJSONValuePtr qemuMonitorQueryQMPSchema(qemuMonitorPtr mon);
 
 int qemuMonitorSetBlockThreshold(qemuMonitorPtr mon,
                                  const char *nodename,
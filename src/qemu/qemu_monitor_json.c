@@ -44,6 +44,8 @@
 #include "virjson.h"
 #include "virprobe.h"
 #include "virstring.h"
+#include "virtime.h"
+#include "virtrace.h"
 #include "cpu/cpu_x86.h"
 #include "c-strcasestr.h"
 
@@ -90,6 +92,7 @@ static void qemuMonitorJSONHandleMigrationStatus(qemuMonitorPtr mon, virJSONValu
 static void qemuMonitorJSONHandleMigrationPass(qemuMonitorPtr mon, virJSONValuePtr data);
 static void qemuMonitorJSONHandleAcpiOstInfo(qemuMonitorPtr mon, virJSONValuePtr data);
 static void qemuMonitorJSONHandleBlockThreshold(qemuMonitorPtr mon, virJSONValuePtr data);
+static void qemuMonitorJSONHandleDumpCompleted(qemuMonitorPtr mon, virJSONValuePtr data);
 
 typedef struct {
     const char *type;
@@ -106,6 +109,7 @@ static qemuEventHandler eventHandlers[] = {
     { "BLOCK_WRITE_THRESHOLD", qemuMonitorJSONHandleBlockThreshold, },
     { "DEVICE_DELETED", qemuMonitorJSONHandleDeviceDeleted, },
     { "DEVICE_TRAY_MOVED", qemuMonitorJSONHandleTrayChange, },
+    { "DUMP_COMPLETED", qemuMonitorJSONHandleDumpCompleted, },
     { "GUEST_PANICKED", qemuMonitorJSONHandleGuestPanic, },
     { "MIGRATION", qemuMonitorJSONHandleMigrationStatus, },
     { "MIGRATION_PASS", qemuMonitorJSONHandleMigrationPass, },
@@ -182,18 +186,157 @@ qemuMonitorJSONIOProcessEvent(qemuMonitorPtr mon,
     return 0;
 }
 
+typedef struct _qemuMonitorJSONStreamLine qemuMonitorJSONStreamLine;
+typedef qemuMonitorJSONStreamLine *qemuMonitorJSONStreamLinePtr;
+struct _qemuMonitorJSONStreamLine {
+    qemuMonitorMessagePtr msg;
+    virJSONValuePtr obj;
+    bool streamed;
+    bool failed;
+};
+
+
+/* Builds the line object like virJSONValueFromString does, except for
+ * the "return" member of replies, which is passed to the stream callback
+ * of the message instead */
+static int
+qemuMonitorJSONStreamLineCallback(const virJSONStreamItem *item,
+                                  void *opaque)
+{
+    qemuMonitorJSONStreamLinePtr data = opaque;
+    virJSONStreamItem sub;
+    int rc;
+
+    if (item->depth == 0) {
+        switch ((virJSONStreamEvent) item->event) {
+        case VIR_JSON_STREAM_OBJECT_START:
+            if (!(data->obj = virJSONValueNewObject()))
+                return -1;
+            return 0;
+        case VIR_JSON_STREAM_CAPTURED:
+            /* not an object, the caller will complain */
+            data->obj = item->captured;
+            return 0;
+        case VIR_JSON_STREAM_OBJECT_END:
+            return 0;
+        case VIR_JSON_STREAM_ARRAY_START:
+        case VIR_JSON_STREAM_ARRAY_END:
+        case VIR_JSON_STREAM_SCALAR:
+            break;
+        }
+        return VIR_JSON_STREAM_CAPTURE;
+    }
+
+    if (item->depth == 1 && STRNEQ(item->key, "return")) {
+        if (item->event != VIR_JSON_STREAM_CAPTURED)
+            return VIR_JSON_STREAM_CAPTURE;
+
+        if (virJSONValueObjectAppend(data->obj, item->key,
+                                     item->captured) < 0) {
+            virJSONValueFree(item->captured);
+            return -1;
+        }
+        return 0;
+    }
+
+    data->streamed = true;
+
+    /* Once the stream callback failed, just ignore the rest */
+    if (data->failed) {
+        if (item->event == VIR_JSON_STREAM_CAPTURED)
+            virJSONValueFree(item->captured);
+        if (item->event == VIR_JSON_STREAM_OBJECT_START ||
+            item->event == VIR_JSON_STREAM_ARRAY_START)
+            return VIR_JSON_STREAM_SKIP;
+        return 0;
+    }
+
+    sub = *item;
+    if (--sub.depth == 0)
+        sub.key = NULL;
+
+    if ((rc = data->msg->rxStream(&sub, data->msg->rxStreamOpaque)) < 0) {
+        data->failed = true;
+        if (item->event == VIR_JSON_STREAM_OBJECT_START ||
+            item->event == VIR_JSON_STREAM_ARRAY_START)
+            return VIR_JSON_STREAM_SKIP;
+        return 0;
+    }
+
+    return rc;
+}
+
+
+static virJSONValuePtr
+qemuMonitorJSONStreamLineParse(const char *line,
+                               qemuMonitorMessagePtr msg)
+{
+    qemuMonitorJSONStreamLine data = { .msg = msg };
+
+    if (virJSONStreamParse(line, qemuMonitorJSONStreamLineCallback,
+                           &data) < 0)
+        goto error;
+
+    /* Keep the reply recognizable as such */
+    if (data.streamed &&
+        virJSONValueObjectAppendNull(data.obj, "return") < 0)
+        goto error;
+
+    return data.obj;
+
+ error:
+    virJSONValueFree(data.obj);
+    return NULL;
+}
+
+
+/* Returns the message from the @msg list the reply with @id belongs to,
+ * or the first one waiting for a reply if @id is NULL */
+static qemuMonitorMessagePtr
+qemuMonitorJSONFindMessage(qemuMonitorMessagePtr msg,
+                           const char *id)
+{
+    for (; msg; msg = msg->next) {
+        if (msg->finished)
+            continue;
+
+        /* Messages are written in order, none of the rest was sent */
+        if (msg->txOffset < msg->txLength)
+            break;
+
+        if (!id || STREQ_NULLABLE(msg->id, id))
+            return msg;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * @msg is the list of messages sent to the monitor, see qemuMonitorSend.
+ * A reply is matched to its message by the "id" member. QEMU answers the
+ * commands in the order they were sent, so a reply without a known id
+ * belongs to the first message still waiting for one.
+ */
 int
 qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
                              const char *line,
                              qemuMonitorMessagePtr msg)
 {
     virJSONValuePtr obj = NULL;
+    qemuMonitorMessagePtr pending = qemuMonitorJSONFindMessage(msg, NULL);
+    qemuMonitorMessagePtr target;
     int ret = -1;
 
     VIR_DEBUG("Line [%s]", line);
 
-    if (!(obj = virJSONValueFromString(line)))
+    /* Only the reply to the first pending message can come next */
+    if (pending && pending->rxStream) {
+        if (!(obj = qemuMonitorJSONStreamLineParse(line, pending)))
+            goto cleanup;
+    } else if (!(obj = virJSONValueFromStringArena(line))) {
         goto cleanup;
+    }
 
     if (obj->type != VIR_JSON_TYPE_OBJECT) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -209,11 +352,24 @@ qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
         ret = qemuMonitorJSONIOProcessEvent(mon, obj);
     } else if (virJSONValueObjectHasKey(obj, "error") == 1 ||
                virJSONValueObjectHasKey(obj, "return") == 1) {
+        const char *id = virJSONValueObjectGetString(obj, "id");
+
         PROBE(QEMU_MONITOR_RECV_REPLY,
               "mon=%p reply=%s", mon, line);
-        if (msg) {
-            msg->rxObject = obj;
-            msg->finished = 1;
+
+        if (!(target = qemuMonitorJSONFindMessage(msg, id))) {
+            VIR_DEBUG("No command with id '%s', using the oldest one",
+                      NULLSTR(id));
+            target = pending;
+        }
+
+        /* A streamed reply was already passed to its callback */
+        if (target && (!pending->rxStream || target == pending)) {
+            target->rxObject = obj;
+            target->finished = 1;
+            target->rxBytes = strlen(line);
+            if (virTimeMicrosNowRaw(&target->rxTime) < 0)
+                target->rxTime = 0;
             obj = NULL;
             ret = 0;
         } else {
@@ -230,58 +386,68 @@ qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
     return ret;
 }
 
+/*
+ * @data is the NUL terminated monitor buffer, whose complete lines are
+ * terminated in place and processed. @scanned holds the number of bytes at
+ * the beginning of @data that are already known not to contain a line
+ * ending, so that a large reply arriving in many reads is only scanned
+ * once. On return it is updated relative to the first unused byte.
+ */
 int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
-                             const char *data,
+                             char *data,
                              size_t len,
+                             size_t *scanned,
                              qemuMonitorMessagePtr msg)
 {
-    int used = 0;
+    size_t used = 0;
+    size_t skip = *scanned;
     /*VIR_DEBUG("Data %d bytes [%s]", len, data);*/
 
     while (used < len) {
-        char *nl = strstr(data + used, LINE_ENDING);
+        char *nl = strstr(data + used + skip, LINE_ENDING);
 
         if (nl) {
-            int got = nl - (data + used);
-            char *line;
-            if (VIR_STRNDUP(line, data + used, got) < 0)
-                return -1;
-            used += got + strlen(LINE_ENDING);
-            line[got] = '\0'; /* kill \n */
-            if (qemuMonitorJSONIOProcessLine(mon, line, msg) < 0) {
-                VIR_FREE(line);
+            *nl = '\0'; /* kill \r\n */
+            if (qemuMonitorJSONIOProcessLine(mon, data + used, msg) < 0)
                 return -1;
-            }
 
-            VIR_FREE(line);
+            used = nl - data + strlen(LINE_ENDING);
+            skip = 0;
         } else {
+            /* A partial line ending may be completed by the next read */
+            skip = len - used;
+            if (skip >= strlen(LINE_ENDING))
+                skip -= strlen(LINE_ENDING) - 1;
+            else
+                skip = 0;
             break;
         }
     }
 
-    VIR_DEBUG("Total used %d bytes out of %zd available in buffer", used, len);
+    *scanned = skip;
+
+    VIR_DEBUG("Total used %zu bytes out of %zu available in buffer", used, len);
     return used;
 }
 
 static int
-qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
-                             virJSONValuePtr cmd,
-                             int scm_fd,
-                             virJSONValuePtr *reply)
+qemuMonitorJSONMessageInit(qemuMonitorPtr mon,
+                           qemuMonitorMessagePtr msg,
+                           virJSONValuePtr cmd,
+                           int scm_fd,
+                           virJSONStreamCallback stream,
+                           void *streamOpaque)
 {
-    int ret = -1;
-    qemuMonitorMessage msg;
     char *cmdstr = NULL;
-    char *id = NULL;
-
-    *reply = NULL;
+    int ret = -1;
 
-    memset(&msg, 0, sizeof(msg));
+    memset(msg, 0, sizeof(*msg));
 
-    if (virJSONValueObjectHasKey(cmd, "execute") == 1) {
-        if (!(id = qemuMonitorNextCommandID(mon)))
+    msg->cmd = virJSONValueObjectGetString(cmd, "execute");
+    if (msg->cmd) {
+        if (!(msg->id = qemuMonitorNextCommandID(mon)))
             goto cleanup;
-        if (virJSONValueObjectAppendString(cmd, "id", id) < 0) {
+        if (virJSONValueObjectAppendString(cmd, "id", msg->id) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("Unable to append command 'id' string"));
             goto cleanup;
@@ -290,38 +456,98 @@ qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
 
     if (!(cmdstr = virJSONValueToString(cmd, false)))
         goto cleanup;
-    if (virAsprintf(&msg.txBuffer, "%s\r\n", cmdstr) < 0)
+    if (virAsprintf(&msg->txBuffer, "%s\r\n", cmdstr) < 0)
         goto cleanup;
-    msg.txLength = strlen(msg.txBuffer);
-    msg.txFD = scm_fd;
+    msg->txLength = strlen(msg->txBuffer);
+    msg->txFD = scm_fd;
+    msg->rxStream = stream;
+    msg->rxStreamOpaque = streamOpaque;
 
     VIR_DEBUG("Send command '%s' for write with FD %d", cmdstr, scm_fd);
 
-    ret = qemuMonitorSend(mon, &msg);
+    ret = 0;
 
-    VIR_DEBUG("Receive command reply ret=%d rxObject=%p",
-              ret, msg.rxObject);
+ cleanup:
+    VIR_FREE(cmdstr);
+    return ret;
+}
 
 
-    if (ret == 0) {
-        if (!msg.rxObject) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("Missing monitor reply object"));
-            ret = -1;
-        } else {
-            *reply = msg.rxObject;
-        }
+static void
+qemuMonitorJSONMessageClear(qemuMonitorMessagePtr msg)
+{
+    VIR_FREE(msg->id);
+    VIR_FREE(msg->txBuffer);
+    virJSONValueFree(msg->rxObject);
+    msg->rxObject = NULL;
+}
+
+
+static int
+qemuMonitorJSONMessageReply(qemuMonitorMessagePtr msg,
+                            virJSONValuePtr *reply)
+{
+    VIR_DEBUG("Receive command reply rxObject=%p", msg->rxObject);
+
+    if (!msg->rxObject) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Missing monitor reply object"));
+        return -1;
     }
 
+    *reply = msg->rxObject;
+    msg->rxObject = NULL;
+    return 0;
+}
+
+
+static int
+qemuMonitorJSONCommandFull(qemuMonitorPtr mon,
+                           virJSONValuePtr cmd,
+                           int scm_fd,
+                           virJSONStreamCallback stream,
+                           void *streamOpaque,
+                           virJSONValuePtr *reply)
+{
+    int ret = -1;
+    qemuMonitorMessage msg;
+    int span = virTraceSpanBegin("qemuMonitorSend");
+
+    *reply = NULL;
+
+    virTraceSpanTag(span, "command", "%s",
+                    NULLSTR(virJSONValueObjectGetString(cmd, "execute")));
+
+    if (qemuMonitorJSONMessageInit(mon, &msg, cmd, scm_fd,
+                                   stream, streamOpaque) < 0)
+        goto cleanup;
+
+    if (qemuMonitorSend(mon, &msg) < 0 ||
+        qemuMonitorJSONMessageReply(&msg, reply) < 0)
+        goto cleanup;
+
+    ret = 0;
+
  cleanup:
-    VIR_FREE(id);
-    VIR_FREE(cmdstr);
-    VIR_FREE(msg.txBuffer);
+    qemuMonitorJSONMessageClear(&msg);
+    if (ret < 0)
+        virTraceSpanTag(span, "error", "true");
+    virTraceSpanEnd(span);
 
     return ret;
 }
 
 
+static int
+qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
+                             virJSONValuePtr cmd,
+                             int scm_fd,
+                             virJSONValuePtr *reply)
+{
+    return qemuMonitorJSONCommandFull(mon, cmd, scm_fd, NULL, NULL, reply);
+}
+
+
 static int
 qemuMonitorJSONCommand(qemuMonitorPtr mon,
                        virJSONValuePtr cmd,
@@ -330,6 +556,108 @@ qemuMonitorJSONCommand(qemuMonitorPtr mon,
     return qemuMonitorJSONCommandWithFd(mon, cmd, -1, reply);
 }
 
+
+/* Like qemuMonitorJSONCommand, but the "return" member of the reply is
+ * passed to @stream while being parsed, see qemuMonitorMessage. @reply
+ * then contains only a null placeholder for it. */
+static int
+qemuMonitorJSONCommandStream(qemuMonitorPtr mon,
+                             virJSONValuePtr cmd,
+                             virJSONStreamCallback stream,
+                             void *streamOpaque,
+                             virJSONValuePtr *reply)
+{
+    return qemuMonitorJSONCommandFull(mon, cmd, -1, stream, streamOpaque,
+                                      reply);
+}
+
+/* A command sent by qemuMonitorJSONCommandBatch */
+typedef struct _qemuMonitorJSONBatchCommand qemuMonitorJSONBatchCommand;
+typedef qemuMonitorJSONBatchCommand *qemuMonitorJSONBatchCommandPtr;
+struct _qemuMonitorJSONBatchCommand {
+    virJSONValuePtr cmd;
+
+    /* Optional, see qemuMonitorJSONCommandStream */
+    virJSONStreamCallback stream;
+    void *streamOpaque;
+
+    /* Filled in with the reply on success */
+    virJSONValuePtr reply;
+};
+
+
+/* Sends all the @ncmds commands at once and waits for all their replies,
+ * which saves a round trip to QEMU per command compared to sending them
+ * one after another. Entries without a command are skipped. Returns -1 if
+ * any of the replies was not received, errors reported by QEMU have to be
+ * checked for each command. */
+static int
+qemuMonitorJSONCommandBatch(qemuMonitorPtr mon,
+                            qemuMonitorJSONBatchCommandPtr cmds,
+                            size_t ncmds)
+{
+    qemuMonitorMessagePtr msgs = NULL;
+    qemuMonitorMessagePtr first = NULL;
+    qemuMonitorMessagePtr last = NULL;
+    size_t i;
+    int span = -1;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(msgs, ncmds) < 0)
+        return -1;
+
+    for (i = 0; i < ncmds; i++) {
+        cmds[i].reply = NULL;
+
+        if (!cmds[i].cmd)
+            continue;
+
+        if (qemuMonitorJSONMessageInit(mon, &msgs[i], cmds[i].cmd, -1,
+                                       cmds[i].stream,
+                                       cmds[i].streamOpaque) < 0)
+            goto cleanup;
+
+        if (last)
+            last->next = &msgs[i];
+        else
+            first = &msgs[i];
+        last = &msgs[i];
+    }
+
+    if (!first) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    span = virTraceSpanBegin("qemuMonitorSend");
+    virTraceSpanTag(span, "batch", "%zu", ncmds);
+
+    if (qemuMonitorSend(mon, first) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ncmds; i++) {
+        if (cmds[i].cmd &&
+            qemuMonitorJSONMessageReply(&msgs[i], &cmds[i].reply) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < ncmds; i++)
+        qemuMonitorJSONMessageClear(&msgs[i]);
+    VIR_FREE(msgs);
+    virTraceSpanEnd(span);
+    if (ret < 0) {
+        for (i = 0; i < ncmds; i++) {
+            virJSONValueFree(cmds[i].reply);
+            cmds[i].reply = NULL;
+        }
+    }
+    return ret;
+}
+
+
 /* Ignoring OOM in this method, since we're already reporting
  * a more important error
  *
@@ -1143,6 +1471,66 @@ qemuMonitorJSONHandleBlockThreshold(qemuMonitorPtr mon, virJSONValuePtr data)
 }
 
 
+static int
+qemuMonitorJSONExtractDumpStats(virJSONValuePtr result,
+                                qemuMonitorDumpStatsPtr ret)
+{
+    const char *statusstr;
+
+    if (!(statusstr = virJSONValueObjectGetString(result, "status"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("incomplete result, failed to get status"));
+        return -1;
+    }
+
+    ret->status = qemuMonitorDumpStatusTypeFromString(statusstr);
+    if (ret->status < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("incomplete result, unknown status string '%s'"),
+                       statusstr);
+        return -1;
+    }
+
+    if (virJSONValueObjectGetNumberUlong(result, "total", &ret->total) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("incomplete result, failed to get total"));
+        return -1;
+    }
+
+    if (virJSONValueObjectGetNumberUlong(result, "completed", &ret->completed) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("incomplete result, failed to get completed"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void
+qemuMonitorJSONHandleDumpCompleted(qemuMonitorPtr mon,
+                                   virJSONValuePtr data)
+{
+    virJSONValuePtr result;
+    qemuMonitorDumpStats stats = { 0 };
+    const char *error = NULL;
+
+    if (!(result = virJSONValueObjectGetObject(data, "result"))) {
+        VIR_WARN("missing result in dump completed event");
+        return;
+    }
+
+    if (qemuMonitorJSONExtractDumpStats(result, &stats) < 0) {
+        VIR_WARN("invalid result in dump completed event");
+        return;
+    }
+
+    error = virJSONValueObjectGetString(data, "error");
+
+    qemuMonitorEmitDumpCompleted(mon, &stats, error);
+}
+
+
 int
 qemuMonitorJSONHumanCommandWithFd(qemuMonitorPtr mon,
                                   const char *cmd_str,
@@ -1403,9 +1791,21 @@ int qemuMonitorJSONSystemReset(qemuMonitorPtr mon)
  *    "thread_id": 2631237},
  *    {...}
  *  ]
+ *
+ * or, if @fast is true, the reply of query-cpus-fast which does not need
+ * to interrupt the vcpus and thus reports the halted state only on s390
+ *
+ * [{ "arch": "s390",
+ *    "cpu-index": 0,
+ *    "qom-path": "/machine/unattached/device[0]",
+ *    "thread-id": 2631237,
+ *    "cpu-state": "operating"},
+ *    {...}
+ *  ]
  */
 static int
 qemuMonitorJSONExtractCPUInfo(virJSONValuePtr data,
+                              bool fast,
                               struct qemuMonitorQueryCpusEntry **entries,
                               size_t *nentries)
 {
@@ -1431,12 +1831,21 @@ qemuMonitorJSONExtractCPUInfo(virJSONValuePtr data,
             goto cleanup;
         }
 
-        /* Some older qemu versions don't report the thread_id so treat this as
-         * non-fatal, simply returning no data */
-        ignore_value(virJSONValueObjectGetNumberInt(entry, "CPU", &cpuid));
-        ignore_value(virJSONValueObjectGetNumberInt(entry, "thread_id", &thread));
-        ignore_value(virJSONValueObjectGetBoolean(entry, "halted", &halted));
-        qom_path = virJSONValueObjectGetString(entry, "qom_path");
+        if (fast) {
+            const char *state = virJSONValueObjectGetString(entry, "cpu-state");
+
+            ignore_value(virJSONValueObjectGetNumberInt(entry, "cpu-index", &cpuid));
+            ignore_value(virJSONValueObjectGetNumberInt(entry, "thread-id", &thread));
+            halted = state && STRNEQ(state, "operating");
+            qom_path = virJSONValueObjectGetString(entry, "qom-path");
+        } else {
+            /* Some older qemu versions don't report the thread_id so treat
+             * this as non-fatal, simply returning no data */
+            ignore_value(virJSONValueObjectGetNumberInt(entry, "CPU", &cpuid));
+            ignore_value(virJSONValueObjectGetNumberInt(entry, "thread_id", &thread));
+            ignore_value(virJSONValueObjectGetBoolean(entry, "halted", &halted));
+            qom_path = virJSONValueObjectGetString(entry, "qom_path");
+        }
 
         cpus[i].qemu_id = cpuid;
         cpus[i].tid = thread;
@@ -1469,32 +1878,48 @@ qemuMonitorJSONExtractCPUInfo(virJSONValuePtr data,
  * Returns 0 on success success, -1 on a fatal error (oom ...) and -2 if the
  * query failed gracefully.
  */
+static int
+qemuMonitorJSONQueryCPUsReply(virJSONValuePtr cmd,
+                              virJSONValuePtr reply,
+                              bool fast,
+                              struct qemuMonitorQueryCpusEntry **entries,
+                              size_t *nentries,
+                              bool force)
+{
+    virJSONValuePtr data;
+
+    if (force && qemuMonitorJSONCheckError(cmd, reply) < 0)
+        return -1;
+
+    if (!(data = virJSONValueObjectGetArray(reply, "return")))
+        return -2;
+
+    return qemuMonitorJSONExtractCPUInfo(data, fast, entries, nentries);
+}
+
+
+/* With @fast, query-cpus-fast is used, which doesn't interrupt the
+ * vcpus but reports the halted state on s390 only */
 int
 qemuMonitorJSONQueryCPUs(qemuMonitorPtr mon,
                          struct qemuMonitorQueryCpusEntry **entries,
                          size_t *nentries,
-                         bool force)
+                         bool force,
+                         bool fast)
 {
     int ret = -1;
-    virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("query-cpus", NULL);
+    virJSONValuePtr cmd;
     virJSONValuePtr reply = NULL;
-    virJSONValuePtr data;
 
-    if (!cmd)
+    if (!(cmd = qemuMonitorJSONMakeCommand(fast ? "query-cpus-fast"
+                                                : "query-cpus", NULL)))
         return -1;
 
     if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
         goto cleanup;
 
-    if (force && qemuMonitorJSONCheckError(cmd, reply) < 0)
-        goto cleanup;
-
-    if (!(data = virJSONValueObjectGetArray(reply, "return"))) {
-        ret = -2;
-        goto cleanup;
-    }
-
-    ret = qemuMonitorJSONExtractCPUInfo(data, entries, nentries);
+    ret = qemuMonitorJSONQueryCPUsReply(cmd, reply, fast,
+                                        entries, nentries, force);
 
  cleanup:
     virJSONValueFree(cmd);
@@ -1655,46 +2080,57 @@ qemuMonitorJSONUpdateVideoVram64Size(qemuMonitorPtr mon,
 }
 
 
-int
-qemuMonitorJSONGetBalloonInfo(qemuMonitorPtr mon,
-                              unsigned long long *currmem)
+static int
+qemuMonitorJSONGetBalloonInfoReply(virJSONValuePtr cmd,
+                                   virJSONValuePtr reply,
+                                   unsigned long long *currmem)
 {
-    int ret = -1;
     virJSONValuePtr data;
     unsigned long long mem;
-    virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("query-balloon",
-                                                     NULL);
-    virJSONValuePtr reply = NULL;
 
     *currmem = 0;
 
-    if (!cmd)
-        return -1;
-
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
-        goto cleanup;
-
     /* See if balloon soft-failed */
     if (qemuMonitorJSONHasError(reply, "DeviceNotActive") ||
-        qemuMonitorJSONHasError(reply, "KVMMissingCap")) {
-        ret = 0;
-        goto cleanup;
-    }
+        qemuMonitorJSONHasError(reply, "KVMMissingCap"))
+        return 0;
 
     /* See if any other fatal error occurred */
     if (qemuMonitorJSONCheckError(cmd, reply) < 0)
-        goto cleanup;
+        return -1;
 
     data = virJSONValueObjectGetObject(reply, "return");
 
     if (virJSONValueObjectGetNumberUlong(data, "actual", &mem) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("info balloon reply was missing balloon data"));
-        goto cleanup;
+        return -1;
     }
 
     *currmem = (mem/1024);
-    ret = 1;
+    return 1;
+}
+
+
+int
+qemuMonitorJSONGetBalloonInfo(qemuMonitorPtr mon,
+                              unsigned long long *currmem)
+{
+    int ret = -1;
+    virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("query-balloon",
+                                                     NULL);
+    virJSONValuePtr reply = NULL;
+
+    *currmem = 0;
+
+    if (!cmd)
+        return -1;
+
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+        goto cleanup;
+
+    ret = qemuMonitorJSONGetBalloonInfoReply(cmd, reply, currmem);
+
  cleanup:
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
@@ -1739,37 +2175,18 @@ qemuMonitorJSONGetBalloonInfo(qemuMonitorPtr mon,
     }
 
 
-int qemuMonitorJSONGetMemoryStats(qemuMonitorPtr mon,
-                                  char *balloonpath,
-                                  virDomainMemoryStatPtr stats,
-                                  unsigned int nr_stats)
+/* Appends the stats from the qom-get @reply to the @got already
+ * present in @stats. Returns the new count, or -1 on failure */
+static int
+qemuMonitorJSONGetMemoryStatsReply(virJSONValuePtr cmd,
+                                   virJSONValuePtr reply,
+                                   virDomainMemoryStatPtr stats,
+                                   unsigned int nr_stats,
+                                   int got)
 {
-    int ret = -1;
-    virJSONValuePtr cmd = NULL;
-    virJSONValuePtr reply = NULL;
     virJSONValuePtr data;
     virJSONValuePtr statsdata;
     unsigned long long mem;
-    int got = 0;
-
-    ret = qemuMonitorJSONGetBalloonInfo(mon, &mem);
-    if (ret == 1 && (got < nr_stats)) {
-        stats[got].tag = VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON;
-        stats[got].val = mem;
-        got++;
-    }
-
-    if (!balloonpath)
-        goto cleanup;
-
-    if (!(cmd = qemuMonitorJSONMakeCommand("qom-get",
-                                           "s:path", balloonpath,
-                                           "s:property", "guest-stats",
-                                           NULL)))
-        goto cleanup;
-
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
-        goto cleanup;
 
     if ((data = virJSONValueObjectGetObject(reply, "error"))) {
         const char *klass = virJSONValueObjectGetString(data, "class");
@@ -1779,18 +2196,18 @@ int qemuMonitorJSONGetMemoryStats(qemuMonitorPtr mon,
             STREQ_NULLABLE(desc, "guest hasn't updated any stats yet")) {
             virReportError(VIR_ERR_OPERATION_INVALID, "%s",
                            _("the guest hasn't updated any stats yet"));
-            goto cleanup;
+            return -1;
         }
     }
 
     if (qemuMonitorJSONCheckError(cmd, reply) < 0)
-        goto cleanup;
+        return -1;
 
     data = virJSONValueObjectGetObject(reply, "return");
 
     if (!(statsdata = virJSONValueObjectGet(data, "stats"))) {
         VIR_DEBUG("data does not include 'stats'");
-        goto cleanup;
+        return -1;
     }
 
     GET_BALLOON_STATS(statsdata, "stat-swap-in",
@@ -1809,13 +2226,62 @@ int qemuMonitorJSONGetMemoryStats(qemuMonitorPtr mon,
                       VIR_DOMAIN_MEMORY_STAT_USABLE, 1024);
     GET_BALLOON_STATS(data, "last-update",
                       VIR_DOMAIN_MEMORY_STAT_LAST_UPDATE, 1);
-    ret = got;
+    return got;
+}
+#undef GET_BALLOON_STATS
+
+
+static int
+qemuMonitorJSONAddBalloonStat(unsigned long long mem,
+                              virDomainMemoryStatPtr stats,
+                              unsigned int nr_stats)
+{
+    if (nr_stats < 1)
+        return 0;
+
+    stats[0].tag = VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON;
+    stats[0].val = mem;
+    return 1;
+}
+
+
+int qemuMonitorJSONGetMemoryStats(qemuMonitorPtr mon,
+                                  char *balloonpath,
+                                  virDomainMemoryStatPtr stats,
+                                  unsigned int nr_stats)
+{
+    int ret = -1;
+    virJSONValuePtr cmd = NULL;
+    virJSONValuePtr reply = NULL;
+    unsigned long long mem;
+    int got = 0;
+    int rc;
+
+    ret = qemuMonitorJSONGetBalloonInfo(mon, &mem);
+    if (ret == 1)
+        got = qemuMonitorJSONAddBalloonStat(mem, stats, nr_stats);
+
+    if (!balloonpath)
+        goto cleanup;
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("qom-get",
+                                           "s:path", balloonpath,
+                                           "s:property", "guest-stats",
+                                           NULL)))
+        goto cleanup;
+
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+        goto cleanup;
+
+    if ((rc = qemuMonitorJSONGetMemoryStatsReply(cmd, reply, stats,
+                                                 nr_stats, got)) >= 0)
+        ret = rc;
+
  cleanup:
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
     return ret;
 }
-#undef GET_BALLOON_STATS
 
 
 /*
@@ -1850,6 +2316,25 @@ qemuMonitorJSONSetMemoryStatsPeriod(qemuMonitorPtr mon,
  *
  * Returns: NULL on error, reply on success
  */
+static virJSONValuePtr
+qemuMonitorJSONQueryBlockReply(virJSONValuePtr cmd,
+                               virJSONValuePtr reply)
+{
+    virJSONValuePtr devices;
+
+    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+        return NULL;
+
+    if (!(devices = virJSONValueObjectStealArray(reply, "return"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("query-block reply was missing device list"));
+        return NULL;
+    }
+
+    return devices;
+}
+
+
 static virJSONValuePtr
 qemuMonitorJSONQueryBlock(qemuMonitorPtr mon)
 {
@@ -1860,15 +2345,10 @@ qemuMonitorJSONQueryBlock(qemuMonitorPtr mon)
     if (!(cmd = qemuMonitorJSONMakeCommand("query-block", NULL)))
         return NULL;
 
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0 ||
-        qemuMonitorJSONCheckError(cmd, reply) < 0)
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
         goto cleanup;
 
-    if (!(devices = virJSONValueObjectStealArray(reply, "return"))) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("query-block reply was missing device list"));
-        goto cleanup;
-    }
+    devices = qemuMonitorJSONQueryBlockReply(cmd, reply);
 
  cleanup:
     virJSONValueFree(cmd);
@@ -1983,73 +2463,392 @@ int qemuMonitorJSONGetBlockInfo(qemuMonitorPtr mon,
 }
 
 
+/* query-blockstats replies can be huge with many disks and long backing
+ * chains, so they are decoded straight into qemuBlockStats while being
+ * parsed rather than through a virJSONValue tree. */
+static const struct {
+    const char *name;
+    size_t offset;
+    bool mandatory;
+} qemuMonitorJSONBlockStatsFields[] = {
+    { "rd_bytes", offsetof(qemuBlockStats, rd_bytes), true },
+    { "wr_bytes", offsetof(qemuBlockStats, wr_bytes), true },
+    { "rd_operations", offsetof(qemuBlockStats, rd_req), true },
+    { "wr_operations", offsetof(qemuBlockStats, wr_req), true },
+    { "rd_total_time_ns", offsetof(qemuBlockStats, rd_total_times), false },
+    { "wr_total_time_ns", offsetof(qemuBlockStats, wr_total_times), false },
+    { "flush_operations", offsetof(qemuBlockStats, flush_req), false },
+    { "flush_total_time_ns", offsetof(qemuBlockStats, flush_total_times), false },
+};
+
+typedef enum {
+    QEMU_MONITOR_JSON_BLOCK_STATS_LIST,
+    QEMU_MONITOR_JSON_BLOCK_STATS_IMAGE,
+    QEMU_MONITOR_JSON_BLOCK_STATS_STATS,
+    QEMU_MONITOR_JSON_BLOCK_STATS_PARENT,
+    QEMU_MONITOR_JSON_BLOCK_STATS_PARENT_STATS,
+} qemuMonitorJSONBlockStatsContext;
+
+typedef enum {
+    QEMU_MONITOR_JSON_BLOCK_STATS_ERROR_NONE,
+    QEMU_MONITOR_JSON_BLOCK_STATS_ERROR_DEVICE,
+    QEMU_MONITOR_JSON_BLOCK_STATS_ERROR_STATS,
+    QEMU_MONITOR_JSON_BLOCK_STATS_ERROR_STAT,
+} qemuMonitorJSONBlockStatsError;
+
+typedef struct _qemuMonitorJSONBlockStatsFrame qemuMonitorJSONBlockStatsFrame;
+struct _qemuMonitorJSONBlockStatsFrame {
+    int context; /* qemuMonitorJSONBlockStatsContext */
+    size_t level; /* position of the image in the backing chain */
+};
+
+typedef struct _qemuMonitorJSONBlockStatsImage qemuMonitorJSONBlockStatsImage;
+struct _qemuMonitorJSONBlockStatsImage {
+    qemuBlockStatsPtr bstats;
+    unsigned int found; /* bitmap of qemuMonitorJSONBlockStatsFields */
+    int nstats;
+    bool hasStats;
+};
+
+typedef struct _qemuMonitorJSONBlockStatsEntry qemuMonitorJSONBlockStatsEntry;
+struct _qemuMonitorJSONBlockStatsEntry {
+    char *device;
+    int depth;
+    qemuBlockStatsPtr bstats;
+};
+
+typedef struct _qemuMonitorJSONBlockStatsDecoder qemuMonitorJSONBlockStatsDecoder;
+typedef qemuMonitorJSONBlockStatsDecoder *qemuMonitorJSONBlockStatsDecoderPtr;
+struct _qemuMonitorJSONBlockStatsDecoder {
+    bool backingChain;
+    bool hasList;
+
+    qemuMonitorJSONBlockStatsFrame *frames;
+    size_t nframes;
+
+    /* The device being decoded and its backing chain */
+    char *device;
+    qemuMonitorJSONBlockStatsImage *images;
+    size_t nimages;
+
+    qemuMonitorJSONBlockStatsEntry *entries;
+    size_t nentries;
+    int nstats;
+
+    /* First failure, reported once the reply is complete */
+    bool oom;
+    int error; /* qemuMonitorJSONBlockStatsError */
+    const char *errorStat;
+};
+
+
+static void
+qemuMonitorJSONBlockStatsDecoderResetDevice(qemuMonitorJSONBlockStatsDecoderPtr dec)
+{
+    size_t i;
+
+    for (i = 0; i < dec->nimages; i++)
+        VIR_FREE(dec->images[i].bstats);
+    VIR_FREE(dec->images);
+    dec->nimages = 0;
+    VIR_FREE(dec->device);
+}
+
+
+static void
+qemuMonitorJSONBlockStatsDecoderClear(qemuMonitorJSONBlockStatsDecoderPtr dec)
+{
+    size_t i;
+
+    qemuMonitorJSONBlockStatsDecoderResetDevice(dec);
+    for (i = 0; i < dec->nentries; i++) {
+        VIR_FREE(dec->entries[i].device);
+        VIR_FREE(dec->entries[i].bstats);
+    }
+    VIR_FREE(dec->entries);
+    VIR_FREE(dec->frames);
+}
+
+
 static int
-qemuMonitorJSONGetOneBlockStatsInfo(virJSONValuePtr dev,
-                                    const char *dev_name,
-                                    int depth,
-                                    virHashTablePtr hash,
-                                    bool backingChain)
+qemuMonitorJSONBlockStatsPush(qemuMonitorJSONBlockStatsDecoderPtr dec,
+                              size_t depth,
+                              int context,
+                              size_t level)
+{
+    if (depth >= dec->nframes &&
+        VIR_EXPAND_N_QUIET(dec->frames, dec->nframes,
+                           depth + 1 - dec->nframes) < 0) {
+        dec->oom = true;
+        return -1;
+    }
+
+    dec->frames[depth].context = context;
+    dec->frames[depth].level = level;
+    return 0;
+}
+
+
+static int
+qemuMonitorJSONBlockStatsAddImage(qemuMonitorJSONBlockStatsDecoderPtr dec,
+                                  size_t depth)
+{
+    if (VIR_EXPAND_N_QUIET(dec->images, dec->nimages, 1) < 0 ||
+        VIR_ALLOC_QUIET(dec->images[dec->nimages - 1].bstats) < 0) {
+        dec->oom = true;
+        return -1;
+    }
+
+    return qemuMonitorJSONBlockStatsPush(dec, depth,
+                                         QEMU_MONITOR_JSON_BLOCK_STATS_IMAGE,
+                                         dec->nimages - 1);
+}
+
+
+/* Validate the decoded device and move its images to the entries */
+static int
+qemuMonitorJSONBlockStatsFinishDevice(qemuMonitorJSONBlockStatsDecoderPtr dec)
 {
-    qemuBlockStatsPtr bstats = NULL;
-    virJSONValuePtr stats;
-    virJSONValuePtr parent;
-    virJSONValuePtr parentstats;
+    size_t i;
+    size_t j;
+
+    if (!dec->device) {
+        dec->error = QEMU_MONITOR_JSON_BLOCK_STATS_ERROR_DEVICE;
+        return -1;
+    }
+
+    for (i = 0; i < dec->nimages; i++) {
+        if (!dec->images[i].hasStats) {
+            dec->error = QEMU_MONITOR_JSON_BLOCK_STATS_ERROR_STATS;
+            return -1;
+        }
+
+        for (j = 0; j < ARRAY_CARDINALITY(qemuMonitorJSONBlockStatsFields); j++) {
+            if (qemuMonitorJSONBlockStatsFields[j].mandatory &&
+                !(dec->images[i].found & (1U << j))) {
+                dec->error = QEMU_MONITOR_JSON_BLOCK_STATS_ERROR_STAT;
+                dec->errorStat = qemuMonitorJSONBlockStatsFields[j].name;
+                return -1;
+            }
+        }
+    }
+
+    if (VIR_EXPAND_N_QUIET(dec->entries, dec->nentries, dec->nimages) < 0) {
+        dec->oom = true;
+        return -1;
+    }
+
+    for (i = 0; i < dec->nimages; i++) {
+        qemuMonitorJSONBlockStatsEntry *entry;
+
+        entry = &dec->entries[dec->nentries - dec->nimages + i];
+        if (VIR_STRDUP_QUIET(entry->device, dec->device) < 0) {
+            dec->oom = true;
+            return -1;
+        }
+        entry->depth = i;
+        entry->bstats = dec->images[i].bstats;
+        dec->images[i].bstats = NULL;
+    }
+
+    /* The top image has all the stats the lower ones have */
+    if (dec->nimages && dec->images[0].nstats > dec->nstats)
+        dec->nstats = dec->images[0].nstats;
+
+    qemuMonitorJSONBlockStatsDecoderResetDevice(dec);
+    return 0;
+}
+
+
+static int
+qemuMonitorJSONBlockStatsStat(qemuMonitorJSONBlockStatsDecoderPtr dec,
+                              qemuMonitorJSONBlockStatsImage *image,
+                              const virJSONStreamItem *item)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(qemuMonitorJSONBlockStatsFields); i++) {
+        long long *value;
+
+        if (STRNEQ(item->key, qemuMonitorJSONBlockStatsFields[i].name))
+            continue;
+
+        value = (long long *)((char *)image->bstats +
+                              qemuMonitorJSONBlockStatsFields[i].offset);
+
+        if (item->type != VIR_JSON_TYPE_NUMBER ||
+            virStrToLong_ll(item->value, NULL, 10, value) < 0) {
+            dec->error = QEMU_MONITOR_JSON_BLOCK_STATS_ERROR_STAT;
+            dec->errorStat = qemuMonitorJSONBlockStatsFields[i].name;
+            return -1;
+        }
+
+        if (!(image->found & (1U << i))) {
+            image->found |= 1U << i;
+            image->nstats++;
+        }
+        break;
+    }
+
+    return 0;
+}
+
+
+static int
+qemuMonitorJSONBlockStatsStream(const virJSONStreamItem *item,
+                                void *opaque)
+{
+    qemuMonitorJSONBlockStatsDecoderPtr dec = opaque;
+    qemuMonitorJSONBlockStatsFrame parent;
+    qemuMonitorJSONBlockStatsImage *image = NULL;
+    bool start = item->event == VIR_JSON_STREAM_OBJECT_START ||
+                 item->event == VIR_JSON_STREAM_ARRAY_START;
+    bool object = item->event == VIR_JSON_STREAM_OBJECT_START;
+
+    if (item->event == VIR_JSON_STREAM_CAPTURED) {
+        virJSONValueFree(item->captured);
+        return 0;
+    }
+
+    if (item->depth == 0) {
+        if (item->event == VIR_JSON_STREAM_ARRAY_START) {
+            dec->hasList = true;
+            return qemuMonitorJSONBlockStatsPush(dec, 0,
+                                                 QEMU_MONITOR_JSON_BLOCK_STATS_LIST,
+                                                 0);
+        }
+        return start ? VIR_JSON_STREAM_SKIP : 0;
+    }
+
+    if (item->event == VIR_JSON_STREAM_OBJECT_END ||
+        item->event == VIR_JSON_STREAM_ARRAY_END) {
+        if (dec->frames[item->depth].context == QEMU_MONITOR_JSON_BLOCK_STATS_IMAGE &&
+            item->depth == 1)
+            return qemuMonitorJSONBlockStatsFinishDevice(dec);
+        return 0;
+    }
+
+    parent = dec->frames[item->depth - 1];
+    if (parent.context != QEMU_MONITOR_JSON_BLOCK_STATS_LIST)
+        image = &dec->images[parent.level];
+
+    switch ((qemuMonitorJSONBlockStatsContext) parent.context) {
+    case QEMU_MONITOR_JSON_BLOCK_STATS_LIST:
+        if (!object) {
+            dec->error = QEMU_MONITOR_JSON_BLOCK_STATS_ERROR_DEVICE;
+            return -1;
+        }
+        qemuMonitorJSONBlockStatsDecoderResetDevice(dec);
+        return qemuMonitorJSONBlockStatsAddImage(dec, item->depth);
+
+    case QEMU_MONITOR_JSON_BLOCK_STATS_IMAGE:
+        if (object && STREQ(item->key, "stats")) {
+            image->hasStats = true;
+            return qemuMonitorJSONBlockStatsPush(dec, item->depth,
+                                                 QEMU_MONITOR_JSON_BLOCK_STATS_STATS,
+                                                 parent.level);
+        }
+        if (object && STREQ(item->key, "parent"))
+            return qemuMonitorJSONBlockStatsPush(dec, item->depth,
+                                                 QEMU_MONITOR_JSON_BLOCK_STATS_PARENT,
+                                                 parent.level);
+        if (object && STREQ(item->key, "backing") && dec->backingChain)
+            return qemuMonitorJSONBlockStatsAddImage(dec, item->depth);
+        if (item->event == VIR_JSON_STREAM_SCALAR &&
+            item->type == VIR_JSON_TYPE_STRING &&
+            parent.level == 0 && STREQ(item->key, "device")) {
+            VIR_FREE(dec->device);
+            if (VIR_STRDUP_QUIET(dec->device, item->value) < 0) {
+                dec->oom = true;
+                return -1;
+            }
+        }
+        break;
+
+    case QEMU_MONITOR_JSON_BLOCK_STATS_STATS:
+        if (item->event == VIR_JSON_STREAM_SCALAR)
+            return qemuMonitorJSONBlockStatsStat(dec, image, item);
+        break;
+
+    case QEMU_MONITOR_JSON_BLOCK_STATS_PARENT:
+        if (object && STREQ(item->key, "stats"))
+            return qemuMonitorJSONBlockStatsPush(dec, item->depth,
+                                                 QEMU_MONITOR_JSON_BLOCK_STATS_PARENT_STATS,
+                                                 parent.level);
+        break;
+
+    case QEMU_MONITOR_JSON_BLOCK_STATS_PARENT_STATS:
+        if (item->event == VIR_JSON_STREAM_SCALAR &&
+            item->type == VIR_JSON_TYPE_NUMBER &&
+            STREQ(item->key, "wr_highest_offset") &&
+            virStrToLong_ull(item->value, NULL, 10,
+                             &image->bstats->wr_highest_offset) == 0)
+            image->bstats->wr_highest_offset_valid = true;
+        break;
+    }
+
+    return start ? VIR_JSON_STREAM_SKIP : 0;
+}
+
+
+/* Moves the stats decoded from the query-blockstats @reply into @hash */
+static int
+qemuMonitorJSONBlockStatsCollect(virJSONValuePtr cmd,
+                                 virJSONValuePtr reply,
+                                 qemuMonitorJSONBlockStatsDecoderPtr dec,
+                                 virHashTablePtr hash)
+{
+    char *entry_name = NULL;
+    size_t i;
     int ret = -1;
-    int nstats = 0;
-    char *entry_name = qemuDomainStorageAlias(dev_name, depth);
-    virJSONValuePtr backing;
 
-    if (!entry_name)
+    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
         goto cleanup;
-    if (VIR_ALLOC(bstats) < 0)
+
+    if (dec->oom) {
+        virReportOOMError();
         goto cleanup;
+    }
 
-    if ((stats = virJSONValueObjectGetObject(dev, "stats")) == NULL) {
+    switch ((qemuMonitorJSONBlockStatsError) dec->error) {
+    case QEMU_MONITOR_JSON_BLOCK_STATS_ERROR_NONE:
+        break;
+    case QEMU_MONITOR_JSON_BLOCK_STATS_ERROR_DEVICE:
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("blockstats device entry was not "
+                         "in expected format"));
+        goto cleanup;
+    case QEMU_MONITOR_JSON_BLOCK_STATS_ERROR_STATS:
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("blockstats stats entry was not "
                          "in expected format"));
         goto cleanup;
+    case QEMU_MONITOR_JSON_BLOCK_STATS_ERROR_STAT:
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot read %s statistic"), dec->errorStat);
+        goto cleanup;
     }
 
-#define QEMU_MONITOR_BLOCK_STAT_GET(NAME, VAR, MANDATORY)                      \
-    if (MANDATORY || virJSONValueObjectHasKey(stats, NAME)) {                  \
-        nstats++;                                                              \
-        if (virJSONValueObjectGetNumberLong(stats, NAME, &VAR) < 0) {          \
-            virReportError(VIR_ERR_INTERNAL_ERROR,                             \
-                           _("cannot read %s statistic"), NAME);               \
-            goto cleanup;                                                      \
-        }                                                                      \
+    if (!dec->hasList) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("blockstats reply was missing device list"));
+        goto cleanup;
     }
-    QEMU_MONITOR_BLOCK_STAT_GET("rd_bytes", bstats->rd_bytes, true);
-    QEMU_MONITOR_BLOCK_STAT_GET("wr_bytes", bstats->wr_bytes, true);
-    QEMU_MONITOR_BLOCK_STAT_GET("rd_operations", bstats->rd_req, true);
-    QEMU_MONITOR_BLOCK_STAT_GET("wr_operations", bstats->wr_req, true);
-    QEMU_MONITOR_BLOCK_STAT_GET("rd_total_time_ns", bstats->rd_total_times, false);
-    QEMU_MONITOR_BLOCK_STAT_GET("wr_total_time_ns", bstats->wr_total_times, false);
-    QEMU_MONITOR_BLOCK_STAT_GET("flush_operations", bstats->flush_req, false);
-    QEMU_MONITOR_BLOCK_STAT_GET("flush_total_time_ns", bstats->flush_total_times, false);
-#undef QEMU_MONITOR_BLOCK_STAT_GET
 
-    if ((parent = virJSONValueObjectGetObject(dev, "parent")) &&
-        (parentstats = virJSONValueObjectGetObject(parent, "stats"))) {
-        if (virJSONValueObjectGetNumberUlong(parentstats, "wr_highest_offset",
-                                             &bstats->wr_highest_offset) == 0)
-            bstats->wr_highest_offset_valid = true;
-    }
+    for (i = 0; i < dec->nentries; i++) {
+        if (!(entry_name = qemuDomainStorageAlias(dec->entries[i].device,
+                                                  dec->entries[i].depth)))
+            goto cleanup;
 
-    if (virHashAddEntry(hash, entry_name, bstats) < 0)
-        goto cleanup;
-    bstats = NULL;
+        if (virHashAddEntry(hash, entry_name, dec->entries[i].bstats) < 0)
+            goto cleanup;
+        dec->entries[i].bstats = NULL;
+        VIR_FREE(entry_name);
+    }
 
-    if (backingChain &&
-        (backing = virJSONValueObjectGetObject(dev, "backing")) &&
-        qemuMonitorJSONGetOneBlockStatsInfo(backing, dev_name, depth + 1,
-                                            hash, true) < 0)
-        goto cleanup;
+    ret = dec->nstats;
 
-    ret = nstats;
  cleanup:
-    VIR_FREE(bstats);
     VIR_FREE(entry_name);
     return ret;
 }
@@ -2061,59 +2860,24 @@ qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
                                     bool backingChain)
 {
     int ret = -1;
-    int nstats = 0;
-    int rc;
-    size_t i;
     virJSONValuePtr cmd;
     virJSONValuePtr reply = NULL;
-    virJSONValuePtr devices;
+    qemuMonitorJSONBlockStatsDecoder dec;
+
+    memset(&dec, 0, sizeof(dec));
+    dec.backingChain = backingChain;
 
     if (!(cmd = qemuMonitorJSONMakeCommand("query-blockstats", NULL)))
         return -1;
 
-    if ((rc = qemuMonitorJSONCommand(mon, cmd, &reply)) < 0)
-        goto cleanup;
-
-    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
-        goto cleanup;
-
-    if (!(devices = virJSONValueObjectGetArray(reply, "return"))) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("blockstats reply was missing device list"));
+    if (qemuMonitorJSONCommandStream(mon, cmd, qemuMonitorJSONBlockStatsStream,
+                                     &dec, &reply) < 0)
         goto cleanup;
-    }
-
-    for (i = 0; i < virJSONValueArraySize(devices); i++) {
-        virJSONValuePtr dev = virJSONValueArrayGet(devices, i);
-        const char *dev_name;
-
-        if (!dev || dev->type != VIR_JSON_TYPE_OBJECT) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("blockstats device entry was not "
-                             "in expected format"));
-            goto cleanup;
-        }
 
-        if (!(dev_name = virJSONValueObjectGetString(dev, "device"))) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("blockstats device entry was not "
-                             "in expected format"));
-            goto cleanup;
-        }
-
-        rc = qemuMonitorJSONGetOneBlockStatsInfo(dev, dev_name, 0, hash,
-                                                 backingChain);
-
-        if (rc < 0)
-            goto cleanup;
-
-        if (rc > nstats)
-            nstats = rc;
-    }
-
-    ret = nstats;
+    ret = qemuMonitorJSONBlockStatsCollect(cmd, reply, &dec, hash);
 
  cleanup:
+    qemuMonitorJSONBlockStatsDecoderClear(&dec);
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
     return ret;
@@ -2169,45 +2933,325 @@ qemuMonitorJSONBlockStatsUpdateCapacityOne(virJSONValuePtr image,
 }
 
 
+static int
+qemuMonitorJSONBlockStatsUpdateCapacityDevices(virJSONValuePtr devices,
+                                               virHashTablePtr stats,
+                                               bool backingChain)
+{
+    size_t i;
+
+    for (i = 0; i < virJSONValueArraySize(devices); i++) {
+        virJSONValuePtr dev;
+        virJSONValuePtr inserted;
+        virJSONValuePtr image;
+        const char *dev_name;
+
+        if (!(dev = qemuMonitorJSONGetBlockDev(devices, i)))
+            return -1;
+
+        if (!(dev_name = qemuMonitorJSONGetBlockDevDevice(dev)))
+            return -1;
+
+        /* drive may be empty */
+        if (!(inserted = virJSONValueObjectGetObject(dev, "inserted")) ||
+            !(image = virJSONValueObjectGetObject(inserted, "image")))
+            continue;
+
+        if (qemuMonitorJSONBlockStatsUpdateCapacityOne(image, dev_name, 0,
+                                                       stats,
+                                                       backingChain) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
 int
 qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
                                         virHashTablePtr stats,
                                         bool backingChain)
 {
-    int ret = -1;
-    size_t i;
+    int ret;
     virJSONValuePtr devices;
 
     if (!(devices = qemuMonitorJSONQueryBlock(mon)))
         return -1;
 
-    for (i = 0; i < virJSONValueArraySize(devices); i++) {
-        virJSONValuePtr dev;
-        virJSONValuePtr inserted;
-        virJSONValuePtr image;
-        const char *dev_name;
+    ret = qemuMonitorJSONBlockStatsUpdateCapacityDevices(devices, stats,
+                                                         backingChain);
+
+    virJSONValueFree(devices);
+    return ret;
+}
+
+
+static int
+qemuMonitorJSONQueryDirtyRateReply(virJSONValuePtr cmd,
+                                   virJSONValuePtr reply,
+                                   qemuMonitorDirtyRateInfoPtr info)
+{
+    virJSONValuePtr data;
+    const char *status;
+
+    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+        return -1;
+
+    if (!(data = virJSONValueObjectGetObject(reply, "return"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("query-dirty-rate reply was missing 'return' data"));
+        return -1;
+    }
+
+    if (!(status = virJSONValueObjectGetString(data, "status")) ||
+        (info->status = qemuMonitorDirtyRateStatusTypeFromString(status)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unexpected dirty rate status '%s'"), NULLSTR(status));
+        return -1;
+    }
+
+    if (virJSONValueObjectGetNumberLong(data, "start-time",
+                                        &info->startTime) < 0 ||
+        virJSONValueObjectGetNumberInt(data, "calc-time",
+                                       &info->calcTime) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("query-dirty-rate reply was missing the "
+                         "calculation time"));
+        return -1;
+    }
+
+    /* the rate is only reported once the measurement finished */
+    if (info->status != QEMU_MONITOR_DIRTY_RATE_STATUS_MEASURED ||
+        virJSONValueObjectGetNumberLong(data, "dirty-rate",
+                                        &info->dirtyRate) < 0)
+        info->dirtyRate = -1;
+
+    return 0;
+}
+
+
+int
+qemuMonitorJSONCalcDirtyRate(qemuMonitorPtr mon,
+                             int seconds)
+{
+    int ret = -1;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("calc-dirty-rate",
+                                           "i:calc-time", seconds,
+                                           NULL)))
+        return -1;
+
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+        goto cleanup;
+
+    ret = qemuMonitorJSONCheckError(cmd, reply);
+
+ cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
+int
+qemuMonitorJSONQueryDirtyRate(qemuMonitorPtr mon,
+                              qemuMonitorDirtyRateInfoPtr info)
+{
+    int ret = -1;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("query-dirty-rate", NULL)))
+        return -1;
+
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+        goto cleanup;
+
+    ret = qemuMonitorJSONQueryDirtyRateReply(cmd, reply, info);
+
+ cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
+enum {
+    QEMU_MONITOR_JSON_STATS_BALLOON,
+    QEMU_MONITOR_JSON_STATS_BALLOON_GUEST,
+    QEMU_MONITOR_JSON_STATS_CPUS,
+    QEMU_MONITOR_JSON_STATS_BLOCKSTATS,
+    QEMU_MONITOR_JSON_STATS_BLOCK,
+    QEMU_MONITOR_JSON_STATS_NODES,
+    QEMU_MONITOR_JSON_STATS_DIRTY_RATE,
+
+    QEMU_MONITOR_JSON_STATS_LAST
+};
+
+
+/**
+ * qemuMonitorJSONGetStats:
+ * @mon: monitor object
+ * @flags: bitwise-OR of qemuMonitorStatsFlags
+ * @balloonpath: QOM path of the balloon device, if known
+ * @stats: filled with the data selected by @flags, @stats->blockstats
+ *         must be an empty hash table if block stats are requested
+ * @cpuentries: filled with the vcpu data if requested
+ * @ncpuentries: number of @cpuentries
+ *
+ * Sends all the queries needed for @flags at once and processes each of
+ * the replies even if another one failed, so that the caller gets as much
+ * data as possible.
+ *
+ * Returns 0 on success, -1 if any of the data could not be fetched.
+ */
+int
+qemuMonitorJSONGetStats(qemuMonitorPtr mon,
+                        unsigned int flags,
+                        char *balloonpath,
+                        qemuMonitorStatsPtr stats,
+                        struct qemuMonitorQueryCpusEntry **cpuentries,
+                        size_t *ncpuentries)
+{
+    qemuMonitorJSONBatchCommand cmds[QEMU_MONITOR_JSON_STATS_LAST];
+    qemuMonitorJSONBatchCommandPtr cmd;
+    qemuMonitorJSONBlockStatsDecoder dec;
+    bool backingChain = !!(flags & QEMU_MONITOR_STATS_BLOCK_BACKING);
+    bool fast = !!(flags & QEMU_MONITOR_STATS_VCPU_FAST);
+    virJSONValuePtr devices = NULL;
+    unsigned long long mem;
+    size_t i;
+    int rc;
+    int ret = -1;
+
+    memset(cmds, 0, sizeof(cmds));
+    memset(&dec, 0, sizeof(dec));
+    dec.backingChain = backingChain;
+
+    if (flags & QEMU_MONITOR_STATS_BALLOON) {
+        if (!(cmds[QEMU_MONITOR_JSON_STATS_BALLOON].cmd =
+              qemuMonitorJSONMakeCommand("query-balloon", NULL)))
+            goto cleanup;
+
+        if (balloonpath &&
+            !(cmds[QEMU_MONITOR_JSON_STATS_BALLOON_GUEST].cmd =
+              qemuMonitorJSONMakeCommand("qom-get",
+                                         "s:path", balloonpath,
+                                         "s:property", "guest-stats",
+                                         NULL)))
+            goto cleanup;
+    }
+
+    if (flags & QEMU_MONITOR_STATS_VCPU_HALTED &&
+        !(cmds[QEMU_MONITOR_JSON_STATS_CPUS].cmd =
+          qemuMonitorJSONMakeCommand(fast ? "query-cpus-fast" : "query-cpus",
+                                     NULL)))
+        goto cleanup;
 
-        if (!(dev = qemuMonitorJSONGetBlockDev(devices, i)))
+    if (flags & QEMU_MONITOR_STATS_BLOCK) {
+        cmd = &cmds[QEMU_MONITOR_JSON_STATS_BLOCKSTATS];
+        if (!(cmd->cmd = qemuMonitorJSONMakeCommand("query-blockstats", NULL)))
             goto cleanup;
+        cmd->stream = qemuMonitorJSONBlockStatsStream;
+        cmd->streamOpaque = &dec;
 
-        if (!(dev_name = qemuMonitorJSONGetBlockDevDevice(dev)))
+        if (!(cmds[QEMU_MONITOR_JSON_STATS_BLOCK].cmd =
+              qemuMonitorJSONMakeCommand("query-block", NULL)))
             goto cleanup;
+    }
 
-        /* drive may be empty */
-        if (!(inserted = virJSONValueObjectGetObject(dev, "inserted")) ||
-            !(image = virJSONValueObjectGetObject(inserted, "image")))
-            continue;
+    if (flags & QEMU_MONITOR_STATS_BLOCK_NODES &&
+        !(cmds[QEMU_MONITOR_JSON_STATS_NODES].cmd =
+          qemuMonitorJSONMakeCommand("query-named-block-nodes", NULL)))
+        goto cleanup;
 
-        if (qemuMonitorJSONBlockStatsUpdateCapacityOne(image, dev_name, 0,
-                                                       stats,
-                                                       backingChain) < 0)
-            goto cleanup;
-    }
+    if (flags & QEMU_MONITOR_STATS_DIRTY_RATE &&
+        !(cmds[QEMU_MONITOR_JSON_STATS_DIRTY_RATE].cmd =
+          qemuMonitorJSONMakeCommand("query-dirty-rate", NULL)))
+        goto cleanup;
+
+    if (qemuMonitorJSONCommandBatch(mon, cmds, QEMU_MONITOR_JSON_STATS_LAST) < 0)
+        goto cleanup;
 
     ret = 0;
 
+    if (flags & QEMU_MONITOR_STATS_BALLOON) {
+        cmd = &cmds[QEMU_MONITOR_JSON_STATS_BALLOON];
+        stats->nmemstats = qemuMonitorJSONGetBalloonInfoReply(cmd->cmd,
+                                                              cmd->reply,
+                                                              &mem);
+        if (stats->nmemstats == 1)
+            stats->nmemstats = qemuMonitorJSONAddBalloonStat(mem,
+                                                             stats->memstats,
+                                                             VIR_DOMAIN_MEMORY_STAT_NR);
+
+        cmd = &cmds[QEMU_MONITOR_JSON_STATS_BALLOON_GUEST];
+        if (cmd->cmd &&
+            (rc = qemuMonitorJSONGetMemoryStatsReply(cmd->cmd, cmd->reply,
+                                                     stats->memstats,
+                                                     VIR_DOMAIN_MEMORY_STAT_NR,
+                                                     MAX(stats->nmemstats, 0))) >= 0)
+            stats->nmemstats = rc;
+
+        if (stats->nmemstats < 0)
+            ret = -1;
+    }
+
+    if (flags & QEMU_MONITOR_STATS_VCPU_HALTED) {
+        cmd = &cmds[QEMU_MONITOR_JSON_STATS_CPUS];
+        if (qemuMonitorJSONQueryCPUsReply(cmd->cmd, cmd->reply, fast,
+                                          cpuentries, ncpuentries, false) < 0)
+            ret = -1;
+    }
+
+    if (flags & QEMU_MONITOR_STATS_BLOCK) {
+        cmd = &cmds[QEMU_MONITOR_JSON_STATS_BLOCKSTATS];
+        if ((stats->nblockstats =
+             qemuMonitorJSONBlockStatsCollect(cmd->cmd, cmd->reply, &dec,
+                                              stats->blockstats)) < 0) {
+            ret = -1;
+        } else {
+            cmd = &cmds[QEMU_MONITOR_JSON_STATS_BLOCK];
+            if (!(devices = qemuMonitorJSONQueryBlockReply(cmd->cmd,
+                                                           cmd->reply)) ||
+                qemuMonitorJSONBlockStatsUpdateCapacityDevices(devices,
+                                                               stats->blockstats,
+                                                               backingChain) < 0)
+                ret = -1;
+        }
+    }
+
+    if (flags & QEMU_MONITOR_STATS_BLOCK_NODES) {
+        cmd = &cmds[QEMU_MONITOR_JSON_STATS_NODES];
+        if (qemuMonitorJSONCheckError(cmd->cmd, cmd->reply) < 0) {
+            ret = -1;
+        } else if (!(stats->nodedata =
+                     virJSONValueObjectStealArray(cmd->reply, "return"))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("query-named-block-nodes reply was missing "
+                             "node list"));
+            ret = -1;
+        }
+    }
+
+    if (flags & QEMU_MONITOR_STATS_DIRTY_RATE) {
+        cmd = &cmds[QEMU_MONITOR_JSON_STATS_DIRTY_RATE];
+        if (qemuMonitorJSONQueryDirtyRateReply(cmd->cmd, cmd->reply,
+                                               &stats->dirtyrate) < 0) {
+            stats->dirtyrate.status = -1;
+            ret = -1;
+        }
+    }
+
  cleanup:
+    qemuMonitorJSONBlockStatsDecoderClear(&dec);
     virJSONValueFree(devices);
+    for (i = 0; i < QEMU_MONITOR_JSON_STATS_LAST; i++) {
+        virJSONValueFree(cmds[i].cmd);
+        virJSONValueFree(cmds[i].reply);
+    }
     return ret;
 }
 
@@ -3099,25 +4143,19 @@ qemuMonitorJSONGetDumpGuestMemoryCapability(qemuMonitorPtr mon,
 int
 qemuMonitorJSONDump(qemuMonitorPtr mon,
                     const char *protocol,
-                    const char *dumpformat)
+                    const char *dumpformat,
+                    bool detach)
 {
     int ret = -1;
     virJSONValuePtr cmd = NULL;
     virJSONValuePtr reply = NULL;
 
-    if (dumpformat) {
-        cmd = qemuMonitorJSONMakeCommand("dump-guest-memory",
-                                         "b:paging", false,
-                                         "s:protocol", protocol,
-                                         "s:format", dumpformat,
-                                         NULL);
-    } else {
-        cmd = qemuMonitorJSONMakeCommand("dump-guest-memory",
-                                         "b:paging", false,
-                                         "s:protocol", protocol,
-                                         NULL);
-    }
-
+    cmd = qemuMonitorJSONMakeCommand("dump-guest-memory",
+                                     "b:paging", false,
+                                     "s:protocol", protocol,
+                                     "S:format", dumpformat,
+                                     "B:detach", detach,
+                                     NULL);
     if (!cmd)
         return -1;
 
@@ -3134,6 +4172,39 @@ qemuMonitorJSONDump(qemuMonitorPtr mon,
     return ret;
 }
 
+
+int
+qemuMonitorJSONQueryDump(qemuMonitorPtr mon,
+                         qemuMonitorDumpStatsPtr stats)
+{
+    int ret = -1;
+    virJSONValuePtr cmd = NULL;
+    virJSONValuePtr reply = NULL;
+    virJSONValuePtr result;
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("query-dump", NULL)))
+        return -1;
+
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+        goto cleanup;
+
+    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+        goto cleanup;
+
+    if (!(result = virJSONValueObjectGetObject(reply, "return"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("query-dump reply was missing 'return' data"));
+        goto cleanup;
+    }
+
+    ret = qemuMonitorJSONExtractDumpStats(result, stats);
+
+ cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
 int qemuMonitorJSONGraphicsRelocate(qemuMonitorPtr mon,
                                     int type,
                                     const char *hostname,
@@ -3732,6 +4803,72 @@ qemuMonitorJSONAddDeviceArgs(qemuMonitorPtr mon,
 }
 
 
+/**
+ * qemuMonitorJSONAddDevicesArgs:
+ * @mon: monitor object
+ * @args: arguments of the devices to add, consumed
+ * @nargs: number of @args
+ * @added: filled with whether each of the devices was added
+ *
+ * Sends a device_add for each of @args at once. QEMU executes them one
+ * after another and a failure doesn't stop the rest, so @added tells
+ * the caller which of the devices exist now.
+ *
+ * Returns 0 if all the devices were added, -1 otherwise, reporting the
+ * error of the first device that failed.
+ */
+int
+qemuMonitorJSONAddDevicesArgs(qemuMonitorPtr mon,
+                              virJSONValuePtr *args,
+                              size_t nargs,
+                              bool *added)
+{
+    qemuMonitorJSONBatchCommandPtr cmds = NULL;
+    size_t i;
+    int ret = -1;
+
+    for (i = 0; i < nargs; i++)
+        added[i] = false;
+
+    if (VIR_ALLOC_N(cmds, nargs) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nargs; i++) {
+        if (!(cmds[i].cmd = qemuMonitorJSONMakeCommand("device_add", NULL)) ||
+            virJSONValueObjectAppend(cmds[i].cmd, "arguments", args[i]) < 0)
+            goto cleanup;
+        args[i] = NULL;
+    }
+
+    if (qemuMonitorJSONCommandBatch(mon, cmds, nargs) < 0)
+        goto cleanup;
+
+    ret = 0;
+    for (i = 0; i < nargs; i++) {
+        if (ret == 0) {
+            if (qemuMonitorJSONCheckError(cmds[i].cmd, cmds[i].reply) < 0)
+                ret = -1;
+            else
+                added[i] = true;
+        } else {
+            added[i] = !virJSONValueObjectHasKey(cmds[i].reply, "error");
+        }
+    }
+
+ cleanup:
+    for (i = 0; i < nargs; i++) {
+        virJSONValueFree(args[i]);
+        args[i] = NULL;
+        if (cmds) {
+            virJSONValueFree(cmds[i].cmd);
+            virJSONValueFree(cmds[i].reply);
+        }
+    }
+    VIR_FREE(cmds);
+    return ret;
+}
+
+
 int
 qemuMonitorJSONAddDevice(qemuMonitorPtr mon,
                          const char *devicestr)
@@ -3857,69 +4994,247 @@ int qemuMonitorJSONDeleteSnapshot(qemuMonitorPtr mon, const char *name)
 }
 
 int
-qemuMonitorJSONDiskSnapshot(qemuMonitorPtr mon, virJSONValuePtr actions,
-                            const char *device, const char *file,
-                            const char *format, bool reuse)
+qemuMonitorJSONDiskSnapshot(qemuMonitorPtr mon, virJSONValuePtr actions,
+                            const char *device, const char *file,
+                            const char *format, bool reuse)
+{
+    int ret = -1;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+
+    cmd = qemuMonitorJSONMakeCommandRaw(actions != NULL,
+                                        "blockdev-snapshot-sync",
+                                        "s:device", device,
+                                        "s:snapshot-file", file,
+                                        "s:format", format,
+                                        "S:mode", reuse ? "existing" : NULL,
+                                        NULL);
+    if (!cmd)
+        return -1;
+
+    if (actions) {
+        if (virJSONValueArrayAppend(actions, cmd) == 0) {
+            ret = 0;
+            cmd = NULL;
+        }
+    } else {
+        if ((ret = qemuMonitorJSONCommand(mon, cmd, &reply)) < 0)
+            goto cleanup;
+
+        ret = qemuMonitorJSONCheckError(cmd, reply);
+    }
+
+ cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+/* speed is in bytes/sec */
+int
+qemuMonitorJSONDriveMirror(qemuMonitorPtr mon,
+                           const char *device, const char *file,
+                           const char *format, unsigned long long speed,
+                           unsigned int granularity,
+                           unsigned long long buf_size,
+                           unsigned int flags)
+{
+    int ret = -1;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+    bool shallow = (flags & VIR_DOMAIN_BLOCK_REBASE_SHALLOW) != 0;
+    bool reuse = (flags & VIR_DOMAIN_BLOCK_REBASE_REUSE_EXT) != 0;
+
+    cmd = qemuMonitorJSONMakeCommand("drive-mirror",
+                                     "s:device", device,
+                                     "s:target", file,
+                                     "Y:speed", speed,
+                                     "z:granularity", granularity,
+                                     "P:buf-size", buf_size,
+                                     "s:sync", shallow ? "top" : "full",
+                                     "s:mode", reuse ? "existing" : "absolute-paths",
+                                     "S:format", format,
+                                     NULL);
+    if (!cmd)
+        return -1;
+
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+        goto cleanup;
+
+    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+int
+qemuMonitorJSONTransaction(qemuMonitorPtr mon, virJSONValuePtr actions)
+{
+    int ret = -1;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+    bool protect = actions->protect;
+
+    /* We do NOT want to free actions when recursively freeing cmd.  */
+    actions->protect = true;
+    cmd = qemuMonitorJSONMakeCommand("transaction",
+                                     "a:actions", actions,
+                                     NULL);
+    if (!cmd)
+        goto cleanup;
+
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+        goto cleanup;
+
+    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    actions->protect = protect;
+    return ret;
+}
+
+int
+qemuMonitorJSONTransactionBitmapAdd(virJSONValuePtr actions,
+                                    const char *node,
+                                    const char *name,
+                                    bool persistent,
+                                    bool disabled)
+{
+    virJSONValuePtr cmd;
+
+    if (!(cmd = qemuMonitorJSONMakeCommandRaw(true, "block-dirty-bitmap-add",
+                                              "s:node", node,
+                                              "s:name", name,
+                                              "B:persistent", persistent,
+                                              "B:disabled", disabled,
+                                              NULL)))
+        return -1;
+
+    if (virJSONValueArrayAppend(actions, cmd) < 0) {
+        virJSONValueFree(cmd);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int
+qemuMonitorJSONTransactionBitmapMerge(virJSONValuePtr actions,
+                                      const char *node,
+                                      const char *target,
+                                      const char *source)
+{
+    virJSONValuePtr cmd = NULL;
+    virJSONValuePtr bitmaps = NULL;
+    virJSONValuePtr bitmap = NULL;
+
+    if (!(bitmaps = virJSONValueNewArray()) ||
+        !(bitmap = virJSONValueNewString(source)) ||
+        virJSONValueArrayAppend(bitmaps, bitmap) < 0)
+        goto error;
+    bitmap = NULL;
+
+    if (!(cmd = qemuMonitorJSONMakeCommandRaw(true, "block-dirty-bitmap-merge",
+                                              "s:node", node,
+                                              "s:target", target,
+                                              "a:bitmaps", bitmaps,
+                                              NULL)))
+        goto error;
+    bitmaps = NULL;
+
+    if (virJSONValueArrayAppend(actions, cmd) < 0)
+        goto error;
+
+    return 0;
+
+ error:
+    virJSONValueFree(bitmap);
+    virJSONValueFree(bitmaps);
+    virJSONValueFree(cmd);
+    return -1;
+}
+
+
+int
+qemuMonitorJSONTransactionBackup(virJSONValuePtr actions,
+                                 const char *device,
+                                 const char *jobname,
+                                 const char *target,
+                                 const char *sync)
+{
+    virJSONValuePtr cmd;
+
+    if (!(cmd = qemuMonitorJSONMakeCommandRaw(true, "blockdev-backup",
+                                              "s:device", device,
+                                              "s:job-id", jobname,
+                                              "s:target", target,
+                                              "s:sync", sync,
+                                              NULL)))
+        return -1;
+
+    if (virJSONValueArrayAppend(actions, cmd) < 0) {
+        virJSONValueFree(cmd);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int
+qemuMonitorJSONBitmapRemove(qemuMonitorPtr mon,
+                            const char *node,
+                            const char *name)
 {
     int ret = -1;
     virJSONValuePtr cmd;
     virJSONValuePtr reply = NULL;
 
-    cmd = qemuMonitorJSONMakeCommandRaw(actions != NULL,
-                                        "blockdev-snapshot-sync",
-                                        "s:device", device,
-                                        "s:snapshot-file", file,
-                                        "s:format", format,
-                                        "S:mode", reuse ? "existing" : NULL,
-                                        NULL);
-    if (!cmd)
+    if (!(cmd = qemuMonitorJSONMakeCommand("block-dirty-bitmap-remove",
+                                           "s:node", node,
+                                           "s:name", name,
+                                           NULL)))
         return -1;
 
-    if (actions) {
-        if (virJSONValueArrayAppend(actions, cmd) == 0) {
-            ret = 0;
-            cmd = NULL;
-        }
-    } else {
-        if ((ret = qemuMonitorJSONCommand(mon, cmd, &reply)) < 0)
-            goto cleanup;
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+        goto cleanup;
 
-        ret = qemuMonitorJSONCheckError(cmd, reply);
-    }
+    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+        goto cleanup;
 
+    ret = 0;
  cleanup:
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
     return ret;
 }
 
-/* speed is in bytes/sec */
+
 int
-qemuMonitorJSONDriveMirror(qemuMonitorPtr mon,
-                           const char *device, const char *file,
-                           const char *format, unsigned long long speed,
-                           unsigned int granularity,
-                           unsigned long long buf_size,
-                           unsigned int flags)
+qemuMonitorJSONBlockdevAdd(qemuMonitorPtr mon,
+                           virJSONValuePtr props)
 {
     int ret = -1;
     virJSONValuePtr cmd;
     virJSONValuePtr reply = NULL;
-    bool shallow = (flags & VIR_DOMAIN_BLOCK_REBASE_SHALLOW) != 0;
-    bool reuse = (flags & VIR_DOMAIN_BLOCK_REBASE_REUSE_EXT) != 0;
 
-    cmd = qemuMonitorJSONMakeCommand("drive-mirror",
-                                     "s:device", device,
-                                     "s:target", file,
-                                     "Y:speed", speed,
-                                     "z:granularity", granularity,
-                                     "P:buf-size", buf_size,
-                                     "s:sync", shallow ? "top" : "full",
-                                     "s:mode", reuse ? "existing" : "absolute-paths",
-                                     "S:format", format,
-                                     NULL);
-    if (!cmd)
-        return -1;
+    if (!(cmd = qemuMonitorJSONMakeCommand("blockdev-add", NULL)))
+        goto cleanup;
+
+    if (virJSONValueObjectAppend(cmd, "arguments", props) < 0)
+        goto cleanup;
+
+    /* @props is part of @cmd now. Avoid double free */
+    props = NULL;
 
     if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
         goto cleanup;
@@ -3931,24 +5246,23 @@ qemuMonitorJSONDriveMirror(qemuMonitorPtr mon,
  cleanup:
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
+    virJSONValueFree(props);
     return ret;
 }
 
+
 int
-qemuMonitorJSONTransaction(qemuMonitorPtr mon, virJSONValuePtr actions)
+qemuMonitorJSONBlockdevDel(qemuMonitorPtr mon,
+                           const char *nodename)
 {
     int ret = -1;
     virJSONValuePtr cmd;
     virJSONValuePtr reply = NULL;
-    bool protect = actions->protect;
 
-    /* We do NOT want to free actions when recursively freeing cmd.  */
-    actions->protect = true;
-    cmd = qemuMonitorJSONMakeCommand("transaction",
-                                     "a:actions", actions,
-                                     NULL);
-    if (!cmd)
-        goto cleanup;
+    if (!(cmd = qemuMonitorJSONMakeCommand("blockdev-del",
+                                           "s:node-name", nodename,
+                                           NULL)))
+        return -1;
 
     if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
         goto cleanup;
@@ -3960,7 +5274,6 @@ qemuMonitorJSONTransaction(qemuMonitorPtr mon, virJSONValuePtr actions)
  cleanup:
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
-    actions->protect = protect;
     return ret;
 }
 
@@ -5263,60 +6576,82 @@ qemuMonitorJSONGetCPUModelExpansion(qemuMonitorPtr mon,
 }
 
 
-int qemuMonitorJSONGetCommands(qemuMonitorPtr mon,
-                               char ***commands)
+/* Parses a reply holding an array of objects with a "name" member into
+ * a NULL terminated list of the names. An error of class @ignoreError
+ * results in an empty list. Returns the number of names or -1. */
+static int
+qemuMonitorJSONGetNameListReply(virJSONValuePtr cmd,
+                                virJSONValuePtr reply,
+                                const char *ignoreError,
+                                char ***names)
 {
-    int ret = -1;
-    virJSONValuePtr cmd;
-    virJSONValuePtr reply = NULL;
     virJSONValuePtr data;
-    char **commandlist = NULL;
+    char **namelist = NULL;
     ssize_t n = 0;
     size_t i;
 
-    *commands = NULL;
-
-    if (!(cmd = qemuMonitorJSONMakeCommand("query-commands", NULL)))
-        return -1;
+    *names = NULL;
 
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
-        goto cleanup;
+    if (ignoreError && qemuMonitorJSONHasError(reply, ignoreError))
+        return 0;
 
     if (qemuMonitorJSONCheckError(cmd, reply) < 0)
-        goto cleanup;
+        return -1;
 
     if (!(data = virJSONValueObjectGetArray(reply, "return")) ||
         (n = virJSONValueArraySize(data)) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("query-commands reply data was not an array"));
-        goto cleanup;
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("%s reply data was not an array"),
+                       qemuMonitorJSONCommandName(cmd));
+        return -1;
     }
 
     /* null-terminated list */
-    if (VIR_ALLOC_N(commandlist, n + 1) < 0)
-        goto cleanup;
+    if (VIR_ALLOC_N(namelist, n + 1) < 0)
+        return -1;
 
     for (i = 0; i < n; i++) {
         virJSONValuePtr child = virJSONValueArrayGet(data, i);
         const char *tmp;
 
         if (!(tmp = virJSONValueObjectGetString(child, "name"))) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("query-commands reply data was missing 'name'"));
-            goto cleanup;
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("%s reply data was missing 'name'"),
+                           qemuMonitorJSONCommandName(cmd));
+            goto error;
         }
 
-        if (VIR_STRDUP(commandlist[i], tmp) < 0)
-            goto cleanup;
+        if (VIR_STRDUP(namelist[i], tmp) < 0)
+            goto error;
     }
 
-    ret = n;
-    *commands = commandlist;
-    commandlist = NULL;
+    *names = namelist;
+    return n;
+
+ error:
+    virStringListFree(namelist);
+    return -1;
+}
+
+
+int qemuMonitorJSONGetCommands(qemuMonitorPtr mon,
+                               char ***commands)
+{
+    int ret = -1;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+
+    *commands = NULL;
 
+    if (!(cmd = qemuMonitorJSONMakeCommand("query-commands", NULL)))
+        return -1;
+
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+        goto cleanup;
+
+    ret = qemuMonitorJSONGetNameListReply(cmd, reply, NULL, commands);
 
  cleanup:
-    virStringListFree(commandlist);
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
     return ret;
@@ -5329,10 +6664,6 @@ int qemuMonitorJSONGetEvents(qemuMonitorPtr mon,
     int ret = -1;
     virJSONValuePtr cmd;
     virJSONValuePtr reply = NULL;
-    virJSONValuePtr data;
-    char **eventlist = NULL;
-    ssize_t n = 0;
-    size_t i;
 
     *events = NULL;
 
@@ -5342,45 +6673,10 @@ int qemuMonitorJSONGetEvents(qemuMonitorPtr mon,
     if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
         goto cleanup;
 
-    if (qemuMonitorJSONHasError(reply, "CommandNotFound")) {
-        ret = 0;
-        goto cleanup;
-    }
-
-    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
-        goto cleanup;
-
-    if (!(data = virJSONValueObjectGetArray(reply, "return")) ||
-        (n = virJSONValueArraySize(data)) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("query-events reply data was not an array"));
-        goto cleanup;
-    }
-
-    /* null-terminated list */
-    if (VIR_ALLOC_N(eventlist, n + 1) < 0)
-        goto cleanup;
-
-    for (i = 0; i < n; i++) {
-        virJSONValuePtr child = virJSONValueArrayGet(data, i);
-        const char *tmp;
-
-        if (!(tmp = virJSONValueObjectGetString(child, "name"))) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("query-events reply data was missing 'name'"));
-            goto cleanup;
-        }
-
-        if (VIR_STRDUP(eventlist[i], tmp) < 0)
-            goto cleanup;
-    }
-
-    ret = n;
-    *events = eventlist;
-    eventlist = NULL;
+    ret = qemuMonitorJSONGetNameListReply(cmd, reply, "CommandNotFound",
+                                          events);
 
  cleanup:
-    virStringListFree(eventlist);
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
     return ret;
@@ -5559,10 +6855,6 @@ int qemuMonitorJSONGetObjectTypes(qemuMonitorPtr mon,
     int ret = -1;
     virJSONValuePtr cmd;
     virJSONValuePtr reply = NULL;
-    virJSONValuePtr data;
-    char **typelist = NULL;
-    ssize_t n = 0;
-    size_t i;
 
     *types = NULL;
 
@@ -5572,40 +6864,9 @@ int qemuMonitorJSONGetObjectTypes(qemuMonitorPtr mon,
     if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
         goto cleanup;
 
-    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
-        goto cleanup;
-
-    if (!(data = virJSONValueObjectGetArray(reply, "return")) ||
-        (n = virJSONValueArraySize(data)) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("qom-list-types reply data was not an array"));
-        goto cleanup;
-    }
-
-    /* null-terminated list */
-    if (VIR_ALLOC_N(typelist, n + 1) < 0)
-        goto cleanup;
-
-    for (i = 0; i < n; i++) {
-        virJSONValuePtr child = virJSONValueArrayGet(data, i);
-        const char *tmp;
-
-        if (!(tmp = virJSONValueObjectGetString(child, "name"))) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("qom-list-types reply data was missing 'name'"));
-            goto cleanup;
-        }
-
-        if (VIR_STRDUP(typelist[i], tmp) < 0)
-            goto cleanup;
-    }
-
-    ret = n;
-    *types = typelist;
-    typelist = NULL;
+    ret = qemuMonitorJSONGetNameListReply(cmd, reply, NULL, types);
 
  cleanup:
-    virStringListFree(typelist);
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
     return ret;
@@ -5853,10 +7114,6 @@ int qemuMonitorJSONGetObjectProps(qemuMonitorPtr mon,
     int ret = -1;
     virJSONValuePtr cmd;
     virJSONValuePtr reply = NULL;
-    virJSONValuePtr data;
-    char **proplist = NULL;
-    ssize_t n = 0;
-    size_t i;
 
     *props = NULL;
 
@@ -5868,47 +7125,88 @@ int qemuMonitorJSONGetObjectProps(qemuMonitorPtr mon,
     if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
         goto cleanup;
 
-    if (qemuMonitorJSONHasError(reply, "DeviceNotFound")) {
-        ret = 0;
-        goto cleanup;
-    }
+    ret = qemuMonitorJSONGetNameListReply(cmd, reply, "DeviceNotFound",
+                                          props);
 
-    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+ cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
+/**
+ * qemuMonitorJSONGetProbeInfo:
+ * @mon: monitor object
+ * @types: device types to list the properties of
+ * @ntypes: number of @types
+ * @info: filled with the data
+ *
+ * Sends query-events, qom-list-types and device-list-properties for each
+ * of @types at once, see qemuMonitorGetProbeInfo.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuMonitorJSONGetProbeInfo(qemuMonitorPtr mon,
+                            const char **types,
+                            size_t ntypes,
+                            qemuMonitorProbeInfoPtr info)
+{
+    qemuMonitorJSONBatchCommandPtr cmds = NULL;
+    size_t ncmds = ntypes + 2;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(cmds, ncmds) < 0 ||
+        VIR_ALLOC_N(info->props, ntypes) < 0 ||
+        VIR_ALLOC_N(info->nprops, ntypes) < 0)
         goto cleanup;
+    info->ntypes = ntypes;
 
-    if (!(data = virJSONValueObjectGetArray(reply, "return")) ||
-        (n = virJSONValueArraySize(data)) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("device-list-properties reply data was not an array"));
+    if (!(cmds[0].cmd = qemuMonitorJSONMakeCommand("query-events", NULL)) ||
+        !(cmds[1].cmd = qemuMonitorJSONMakeCommand("qom-list-types", NULL)))
         goto cleanup;
+
+    for (i = 0; i < ntypes; i++) {
+        if (!(cmds[i + 2].cmd =
+              qemuMonitorJSONMakeCommand("device-list-properties",
+                                         "s:typename", types[i],
+                                         NULL)))
+            goto cleanup;
     }
 
-    /* null-terminated list */
-    if (VIR_ALLOC_N(proplist, n + 1) < 0)
+    if (qemuMonitorJSONCommandBatch(mon, cmds, ncmds) < 0)
         goto cleanup;
 
-    for (i = 0; i < n; i++) {
-        virJSONValuePtr child = virJSONValueArrayGet(data, i);
-        const char *tmp;
-
-        if (!(tmp = virJSONValueObjectGetString(child, "name"))) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("device-list-properties reply data was missing 'name'"));
-            goto cleanup;
-        }
+    if ((info->nevents =
+         qemuMonitorJSONGetNameListReply(cmds[0].cmd, cmds[0].reply,
+                                         "CommandNotFound",
+                                         &info->events)) < 0 ||
+        (info->nobjectTypes =
+         qemuMonitorJSONGetNameListReply(cmds[1].cmd, cmds[1].reply, NULL,
+                                         &info->objectTypes)) < 0)
+        goto cleanup;
 
-        if (VIR_STRDUP(proplist[i], tmp) < 0)
+    for (i = 0; i < ntypes; i++) {
+        if ((info->nprops[i] =
+             qemuMonitorJSONGetNameListReply(cmds[i + 2].cmd,
+                                             cmds[i + 2].reply,
+                                             "DeviceNotFound",
+                                             &info->props[i])) < 0)
             goto cleanup;
     }
 
-    ret = n;
-    *props = proplist;
-    proplist = NULL;
+    ret = 0;
 
  cleanup:
-    virStringListFree(proplist);
-    virJSONValueFree(cmd);
-    virJSONValueFree(reply);
+    if (cmds) {
+        for (i = 0; i < ncmds; i++) {
+            virJSONValueFree(cmds[i].cmd);
+            virJSONValueFree(cmds[i].reply);
+        }
+        VIR_FREE(cmds);
+    }
     return ret;
 }
 
@@ -6286,7 +7584,9 @@ qemuMonitorJSONNBDServerStart(qemuMonitorPtr mon,
 int
 qemuMonitorJSONNBDServerAdd(qemuMonitorPtr mon,
                             const char *deviceID,
-                            bool writable)
+                            const char *name,
+                            bool writable,
+                            const char *bitmap)
 {
     int ret = -1;
     virJSONValuePtr cmd;
@@ -6294,7 +7594,9 @@ qemuMonitorJSONNBDServerAdd(qemuMonitorPtr mon,
 
     if (!(cmd = qemuMonitorJSONMakeCommand("nbd-server-add",
                                            "s:device", deviceID,
+                                           "S:name", name,
                                            "b:writable", writable,
+                                           "S:bitmap", bitmap,
                                            NULL)))
         return ret;
 
@@ -7530,35 +8832,12 @@ qemuMonitorJSONGetHotpluggableCPUs(qemuMonitorPtr mon,
 }
 
 
-static int
-qemuMonitorJSONFillQMPSchema(size_t pos ATTRIBUTE_UNUSED,
-                             virJSONValuePtr item,
-                             void *opaque)
-{
-    const char *name;
-    virHashTablePtr schema = opaque;
-
-    if (!(name = virJSONValueObjectGetString(item, "name"))) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("malformed QMP schema"));
-        return -1;
-    }
-
-    if (virHashAddEntry(schema, name, item) < 0)
-        return -1;
-
-    return 0;
-}
-
-
-virHashTablePtr
+virJSONValuePtr
 qemuMonitorJSONQueryQMPSchema(qemuMonitorPtr mon)
 {
     virJSONValuePtr cmd;
     virJSONValuePtr reply = NULL;
-    virJSONValuePtr arr;
-    virHashTablePtr schema = NULL;
-    virHashTablePtr ret = NULL;
+    virJSONValuePtr ret = NULL;
 
     if (!(cmd = qemuMonitorJSONMakeCommand("query-qmp-schema", NULL)))
         return NULL;
@@ -7569,21 +8848,13 @@ qemuMonitorJSONQueryQMPSchema(qemuMonitorPtr mon)
     if (qemuMonitorJSONCheckError(cmd, reply) < 0)
         goto cleanup;
 
-    arr = virJSONValueObjectGet(reply, "return");
-
-    if (!(schema = virHashCreate(512, virJSONValueHashFree)))
-        goto cleanup;
-
-    if (virJSONValueArrayForeachSteal(arr, qemuMonitorJSONFillQMPSchema,
-                                      schema) < 0)
-        goto cleanup;
-
-    VIR_STEAL_PTR(ret, schema);
+    if (!(ret = virJSONValueObjectStealArray(reply, "return")))
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("query-qmp-schema reply was missing schema"));
 
  cleanup:
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
-    virHashFree(schema);
 
     return ret;
 }
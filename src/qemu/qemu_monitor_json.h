@@ -37,8 +37,9 @@ int qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
                                  qemuMonitorMessagePtr msg);
 
 int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
-                             const char *data,
+                             char *data,
                              size_t len,
+                             size_t *scanned,
                              qemuMonitorMessagePtr msg);
 
 int qemuMonitorJSONHumanCommandWithFd(qemuMonitorPtr mon,
@@ -61,7 +62,8 @@ int qemuMonitorJSONSystemReset(qemuMonitorPtr mon);
 int qemuMonitorJSONQueryCPUs(qemuMonitorPtr mon,
                              struct qemuMonitorQueryCpusEntry **entries,
                              size_t *nentries,
-                             bool force);
+                             bool force,
+                             bool fast);
 int qemuMonitorJSONGetVirtType(qemuMonitorPtr mon,
                                virDomainVirtType *virtType);
 int qemuMonitorJSONUpdateVideoMemorySize(qemuMonitorPtr mon,
@@ -87,6 +89,17 @@ int qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
 int qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
                                             virHashTablePtr stats,
                                             bool backingChain);
+int qemuMonitorJSONGetStats(qemuMonitorPtr mon,
+                            unsigned int flags,
+                            char *balloonpath,
+                            qemuMonitorStatsPtr stats,
+                            struct qemuMonitorQueryCpusEntry **cpuentries,
+                            size_t *ncpuentries);
+int qemuMonitorJSONCalcDirtyRate(qemuMonitorPtr mon,
+                                 int seconds);
+int qemuMonitorJSONQueryDirtyRate(qemuMonitorPtr mon,
+                                  qemuMonitorDirtyRateInfoPtr info);
+
 int qemuMonitorJSONBlockResize(qemuMonitorPtr mon,
                                const char *devce,
                                unsigned long long size);
@@ -166,7 +179,11 @@ int qemuMonitorJSONGetDumpGuestMemoryCapability(qemuMonitorPtr mon,
 
 int qemuMonitorJSONDump(qemuMonitorPtr mon,
                         const char *protocol,
-                        const char *dumpformat);
+                        const char *dumpformat,
+                        bool detach);
+
+int qemuMonitorJSONQueryDump(qemuMonitorPtr mon,
+                             qemuMonitorDumpStatsPtr stats);
 
 int qemuMonitorJSONGraphicsRelocate(qemuMonitorPtr mon,
                                     int type,
@@ -219,6 +236,10 @@ int qemuMonitorJSONAttachPCIDiskController(qemuMonitorPtr mon,
 
 int qemuMonitorJSONAddDeviceArgs(qemuMonitorPtr mon,
                                  virJSONValuePtr args);
+int qemuMonitorJSONAddDevicesArgs(qemuMonitorPtr mon,
+                                  virJSONValuePtr *args,
+                                  size_t nargs,
+                                  bool *added);
 int qemuMonitorJSONAddDevice(qemuMonitorPtr mon,
                              const char *devicestr);
 
@@ -251,6 +272,28 @@ int qemuMonitorJSONDiskSnapshot(qemuMonitorPtr mon,
     ATTRIBUTE_NONNULL(4) ATTRIBUTE_NONNULL(5);
 int qemuMonitorJSONTransaction(qemuMonitorPtr mon, virJSONValuePtr actions)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+int qemuMonitorJSONTransactionBitmapAdd(virJSONValuePtr actions,
+                                        const char *node,
+                                        const char *name,
+                                        bool persistent,
+                                        bool disabled);
+int qemuMonitorJSONTransactionBitmapMerge(virJSONValuePtr actions,
+                                          const char *node,
+                                          const char *target,
+                                          const char *source);
+int qemuMonitorJSONTransactionBackup(virJSONValuePtr actions,
+                                     const char *device,
+                                     const char *jobname,
+                                     const char *target,
+                                     const char *sync);
+int qemuMonitorJSONBitmapRemove(qemuMonitorPtr mon,
+                                const char *node,
+                                const char *name);
+int qemuMonitorJSONBlockdevAdd(qemuMonitorPtr mon,
+                               virJSONValuePtr props)
+    ATTRIBUTE_NONNULL(1);
+int qemuMonitorJSONBlockdevDel(qemuMonitorPtr mon,
+                               const char *nodename);
 int qemuMonitorJSONDriveMirror(qemuMonitorPtr mon,
                                const char *device,
                                const char *file,
@@ -444,6 +487,11 @@ int qemuMonitorJSONGetObjectProps(qemuMonitorPtr mon,
                                   const char *type,
                                   char ***props)
     ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+int qemuMonitorJSONGetProbeInfo(qemuMonitorPtr mon,
+                                const char **types,
+                                size_t ntypes,
+                                qemuMonitorProbeInfoPtr info)
+    ATTRIBUTE_NONNULL(4);
 char *qemuMonitorJSONGetTargetArch(qemuMonitorPtr mon);
 
 int qemuMonitorJSONNBDServerStart(qemuMonitorPtr mon,
@@ -451,7 +499,9 @@ int qemuMonitorJSONNBDServerStart(qemuMonitorPtr mon,
                                   unsigned int port);
 int qemuMonitorJSONNBDServerAdd(qemuMonitorPtr mon,
                                 const char *deviceID,
-                                bool writable);
+                                const char *name,
+                                bool writable,
+                                const char *bitmap);
 int qemuMonitorJSONNBDServerStop(qemuMonitorPtr mon);
 int qemuMonitorJSONGetTPMModels(qemuMonitorPtr mon,
                                 char ***tpmmodels)
@@ -511,7 +561,7 @@ int qemuMonitorJSONGetHotpluggableCPUs(qemuMonitorPtr mon,
                                        size_t *nentries)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
 
-virHashTablePtr qemuMonitorJSONQueryQMPSchema(qemuMonitorPtr mon)
+virJSONValuePtr qemuMonitorJSONQueryQMPSchema(qemuMonitorPtr mon)
     ATTRIBUTE_NONNULL(1);
 
 int qemuMonitorJSONSetBlockThreshold(qemuMonitorPtr mon,
@@ -0,0 +1,643 @@
+/*
+ * qemu_placement.c: NUMA rebalancing of automatically placed domains
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "domain_event.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virhostcpu.h"
+#include "virlog.h"
+#include "virnuma.h"
+#include "virprocess.h"
+#include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
+
+#include "qemu_cgroup.h"
+#include "qemu_domain.h"
+#include "qemu_placement.h"
+
+#define VIR_FROM_THIS VIR_FROM_QEMU
+
+VIR_LOG_INIT("qemu.qemu_placement");
+
+/* A domain is only moved away from nodes busier than this... */
+#define QEMU_PLACEMENT_BUSY 0.75
+/* ...to nodes which are expected to be less busy by at least this much */
+#define QEMU_PLACEMENT_MARGIN 0.2
+/* Domains using less than this many host CPUs aren't worth moving */
+#define QEMU_PLACEMENT_MIN_USAGE 0.25
+/* Time a domain stays where it was moved to at least, in ms */
+#define QEMU_PLACEMENT_SETTLE (5 * 60 * 1000)
+
+typedef struct _qemuPlacementNode qemuPlacementNode;
+typedef qemuPlacementNode *qemuPlacementNodePtr;
+struct _qemuPlacementNode {
+    int id;
+    unsigned int ncpus;          /* online CPUs */
+    double busy;                 /* busy CPUs in the last interval */
+    unsigned long long freemem;  /* in bytes */
+};
+
+typedef struct _qemuPlacementMove qemuPlacementMove;
+typedef qemuPlacementMove *qemuPlacementMovePtr;
+struct _qemuPlacementMove {
+    virDomainObjPtr vm;
+    virBitmapPtr from;
+    virBitmapPtr to;
+    double before;   /* load of the nodes the domain runs on */
+    double after;    /* expected load of the nodes it is moved to */
+};
+
+struct _qemuPlacement {
+    virQEMUDriverPtr driver;
+    unsigned long long interval;  /* in ms */
+
+    virMutex lock;
+    virCond cond;
+    bool quit;
+    virThread thread;
+
+    /* The previous sample, only used by the thread */
+    virHostCPUTimePtr times;
+    size_t ntimes;
+};
+
+
+static double
+qemuPlacementNodeLoad(const qemuPlacementNode *node)
+{
+    return node->busy / node->ncpus;
+}
+
+
+static int
+qemuPlacementNodeCompare(const void *a,
+                         const void *b)
+{
+    double loada = qemuPlacementNodeLoad(a);
+    double loadb = qemuPlacementNodeLoad(b);
+
+    if (loada < loadb)
+        return -1;
+    return loada > loadb;
+}
+
+
+/**
+ * qemuPlacementGetNodes:
+ *
+ * Compute how busy the host NUMA nodes were between the @prev and @cur
+ * samples of CPU times and how much free memory they have. The nodes
+ * are sorted from the least to the most busy one.
+ */
+static int
+qemuPlacementGetNodes(virCapsPtr caps,
+                      const virHostCPUTime *prev,
+                      size_t nprev,
+                      const virHostCPUTime *cur,
+                      size_t ncur,
+                      qemuPlacementNodePtr *nodes,
+                      size_t *nnodes)
+{
+    size_t i;
+    size_t j;
+
+    if (VIR_ALLOC_N(*nodes, caps->host.nnumaCell) < 0)
+        return -1;
+    *nnodes = 0;
+
+    for (i = 0; i < caps->host.nnumaCell; i++) {
+        virCapsHostNUMACellPtr cell = caps->host.numaCell[i];
+        qemuPlacementNodePtr node = &(*nodes)[*nnodes];
+        unsigned long long busy = 0;
+        unsigned long long total = 0;
+
+        for (j = 0; j < cell->ncpus; j++) {
+            unsigned int cpu = cell->cpus[j].id;
+
+            if (cpu >= nprev || cpu >= ncur ||
+                cur[cpu].total <= prev[cpu].total)
+                continue;
+
+            busy += cur[cpu].busy - prev[cpu].busy;
+            total += cur[cpu].total - prev[cpu].total;
+            node->ncpus++;
+        }
+
+        if (!node->ncpus ||
+            virNumaGetNodeMemory(cell->num, NULL, &node->freemem) < 0) {
+            virResetLastError();
+            memset(node, 0, sizeof(*node));
+            continue;
+        }
+
+        node->id = cell->num;
+        node->busy = (double) busy / total * node->ncpus;
+        (*nnodes)++;
+    }
+
+    qsort(*nodes, *nnodes, sizeof(**nodes), qemuPlacementNodeCompare);
+
+    return 0;
+}
+
+
+static void
+qemuPlacementMoveClear(qemuPlacementMovePtr move)
+{
+    virObjectUnref(move->vm);
+    virBitmapFree(move->from);
+    virBitmapFree(move->to);
+    memset(move, 0, sizeof(*move));
+}
+
+
+/**
+ * qemuPlacementEvaluate:
+ * @vm: locked domain object
+ * @nodes: host nodes sorted by load, NULL on the first pass
+ * @move: the best move found so far
+ *
+ * Sample the CPU usage of @vm and check whether moving it from the
+ * nodes it runs on to the least busy ones beats @move.
+ */
+static void
+qemuPlacementEvaluate(virDomainObjPtr vm,
+                      const qemuPlacementNode *nodes,
+                      size_t nnodes,
+                      unsigned long long now,
+                      qemuPlacementMovePtr move)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long cputime;
+    unsigned long long prevtime = priv->placementCpuTime;
+    unsigned long long prevstamp = priv->placementStamp;
+    unsigned long long need;
+    double usage;
+    double busy = 0;
+    double after = 0;
+    unsigned int ncpus = 0;
+    unsigned int ntarget = 0;
+    size_t nset;
+    size_t nmoved = 0;
+    size_t i;
+    virBitmapPtr target = NULL;
+
+    if (!virDomainObjIsActive(vm) ||
+        vm->def->placement_mode != VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO ||
+        !priv->autoNodeset || !priv->cgroup ||
+        !virCgroupHasController(priv->cgroup, VIR_CGROUP_CONTROLLER_CPUACCT))
+        return;
+
+    if (virCgroupGetCpuacctUsage(priv->cgroup, &cputime) < 0) {
+        virResetLastError();
+        return;
+    }
+
+    priv->placementCpuTime = cputime;
+    priv->placementStamp = now;
+
+    if (!nodes || !prevstamp || now <= prevstamp || cputime < prevtime ||
+        now - priv->placementMoved < QEMU_PLACEMENT_SETTLE ||
+        !virCgroupHasController(priv->cgroup, VIR_CGROUP_CONTROLLER_CPUSET))
+        return;
+
+    /* host CPUs used by the domain in the last interval */
+    usage = (double) (cputime - prevtime) / 1000000 / (now - prevstamp);
+    if (usage < QEMU_PLACEMENT_MIN_USAGE)
+        return;
+
+    for (i = 0; i < nnodes; i++) {
+        if (virBitmapIsBitSet(priv->autoNodeset, nodes[i].id)) {
+            busy += nodes[i].busy;
+            ncpus += nodes[i].ncpus;
+        }
+    }
+
+    if (!ncpus || busy / ncpus < QEMU_PLACEMENT_BUSY)
+        return;
+
+    /* Look for the same number of nodes as the domain uses now, the
+     * least busy ones which can also hold their share of its memory */
+    nset = virBitmapCountBits(priv->autoNodeset);
+    need = virDomainDefGetMemoryTotal(vm->def) * 1024 / nset;
+
+    if (!(target = virBitmapNew(virBitmapSize(priv->autoNodeset))))
+        goto cleanup;
+
+    for (i = 0; i < nnodes && virBitmapCountBits(target) < nset; i++) {
+        bool current = virBitmapIsBitSet(priv->autoNodeset, nodes[i].id);
+
+        if (nodes[i].id >= (int) virBitmapSize(target) ||
+            (!current && nodes[i].freemem < need))
+            continue;
+
+        ignore_value(virBitmapSetBit(target, nodes[i].id));
+        after += nodes[i].busy;
+        ntarget += nodes[i].ncpus;
+        if (!current)
+            nmoved++;
+    }
+
+    if (virBitmapCountBits(target) < nset || !nmoved)
+        goto cleanup;
+
+    /* the share of the domain's usage moving to new nodes adds to them */
+    after = (after + usage * nmoved / nset) / ntarget;
+
+    if (busy / ncpus - after < QEMU_PLACEMENT_MARGIN ||
+        (move->vm && move->before - move->after >= busy / ncpus - after))
+        goto cleanup;
+
+    qemuPlacementMoveClear(move);
+    if (!(move->from = virBitmapNewCopy(priv->autoNodeset)))
+        goto cleanup;
+    move->vm = virObjectRef(vm);
+    move->to = target;
+    move->before = busy / ncpus;
+    move->after = after;
+    target = NULL;
+
+ cleanup:
+    virResetLastError();
+    virBitmapFree(target);
+}
+
+
+static int
+qemuPlacementApplyThread(virDomainObjPtr vm,
+                         virCgroupThreadName nameval,
+                         int id,
+                         pid_t pid,
+                         virBitmapPtr cpuset,
+                         const char *mems)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virCgroupPtr cgroup = NULL;
+    int ret = -1;
+
+    if (virCgroupHasController(priv->cgroup, VIR_CGROUP_CONTROLLER_CPUSET)) {
+        if (virCgroupNewThread(priv->cgroup, nameval, id, false, &cgroup) < 0 ||
+            qemuSetupCgroupCpusetCpus(cgroup, cpuset) < 0)
+            goto cleanup;
+
+        /* memory_migrate makes the kernel move the pages already
+         * allocated along with the nodes */
+        if (mems &&
+            (virCgroupSetCpusetMemoryMigrate(cgroup, true) < 0 ||
+             virCgroupSetCpusetMems(cgroup, mems) < 0))
+            goto cleanup;
+    }
+
+    if (virProcessSetAffinity(pid, cpuset) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
+
+/**
+ * qemuPlacementApply:
+ *
+ * Move all threads of @vm which follow the automatic placement to
+ * @nodeset, together with its memory when the memory placement is
+ * automatic and strict, and emit a tunable event about it.
+ */
+static int
+qemuPlacementApply(virQEMUDriverPtr driver,
+                   virDomainObjPtr vm,
+                   virCapsPtr caps,
+                   virBitmapPtr nodeset,
+                   unsigned long long now)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virDomainNumatuneMemMode mode;
+    virBitmapPtr cpuset = NULL;
+    char *cpuset_str = NULL;
+    char *mems = NULL;
+    char paramField[VIR_TYPED_PARAM_FIELD_LENGTH];
+    virTypedParameterPtr eventParams = NULL;
+    int eventNparams = 0;
+    int eventMaxparams = 0;
+    size_t i;
+    int ret = -1;
+
+    if (!(cpuset = virCapabilitiesGetCpusForNodemask(caps, nodeset)) ||
+        !(cpuset_str = virBitmapFormat(cpuset)))
+        goto cleanup;
+
+    if (virDomainNumatuneGetMode(vm->def->numa, -1, &mode) == 0 &&
+        mode == VIR_DOMAIN_NUMATUNE_MEM_STRICT &&
+        virDomainNumatuneHasPlacementAuto(vm->def->numa) &&
+        !(mems = virBitmapFormat(nodeset)))
+        goto cleanup;
+
+    if (!vm->def->cputune.emulatorpin) {
+        if (qemuPlacementApplyThread(vm, VIR_CGROUP_THREAD_EMULATOR, 0,
+                                     vm->pid, cpuset, mems) < 0 ||
+            virTypedParamsAddString(&eventParams, &eventNparams,
+                                    &eventMaxparams,
+                                    VIR_DOMAIN_TUNABLE_CPU_EMULATORPIN,
+                                    cpuset_str) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < virDomainDefGetVcpusMax(vm->def); i++) {
+        virDomainVcpuDefPtr vcpu = virDomainDefGetVcpu(vm->def, i);
+        pid_t pid = qemuDomainGetVcpuPid(vm, i);
+
+        if (!vcpu->online || vcpu->cpumask || !pid)
+            continue;
+
+        snprintf(paramField, VIR_TYPED_PARAM_FIELD_LENGTH,
+                 VIR_DOMAIN_TUNABLE_CPU_VCPUPIN, (unsigned int) i);
+
+        if (qemuPlacementApplyThread(vm, VIR_CGROUP_THREAD_VCPU, i,
+                                     pid, cpuset, mems) < 0 ||
+            virTypedParamsAddString(&eventParams, &eventNparams,
+                                    &eventMaxparams, paramField,
+                                    cpuset_str) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < vm->def->niothreadids; i++) {
+        virDomainIOThreadIDDefPtr iothread = vm->def->iothreadids[i];
+
+        if (iothread->cpumask || !iothread->thread_id)
+            continue;
+
+        snprintf(paramField, VIR_TYPED_PARAM_FIELD_LENGTH,
+                 VIR_DOMAIN_TUNABLE_CPU_IOTHREADSPIN, iothread->iothread_id);
+
+        if (qemuPlacementApplyThread(vm, VIR_CGROUP_THREAD_IOTHREAD,
+                                     iothread->iothread_id,
+                                     iothread->thread_id, cpuset, mems) < 0 ||
+            virTypedParamsAddString(&eventParams, &eventNparams,
+                                    &eventMaxparams, paramField,
+                                    cpuset_str) < 0)
+            goto cleanup;
+    }
+
+    virBitmapFree(priv->autoNodeset);
+    if (!(priv->autoNodeset = virBitmapNewCopy(nodeset)))
+        goto cleanup;
+    virBitmapFree(priv->autoCpuset);
+    priv->autoCpuset = cpuset;
+    cpuset = NULL;
+    priv->placementMoved = now;
+
+    if (qemuDomainSaveStatus(driver, vm) < 0)
+        goto cleanup;
+
+    if (eventNparams) {
+        qemuDomainEventQueue(driver,
+                             virDomainEventTunableNewFromObj(vm, eventParams,
+                                                             eventNparams));
+        eventParams = NULL;
+        eventNparams = 0;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virTypedParamsFree(eventParams, eventNparams);
+    virBitmapFree(cpuset);
+    VIR_FREE(cpuset_str);
+    VIR_FREE(mems);
+    return ret;
+}
+
+
+static void
+qemuPlacementRunMove(virQEMUDriverPtr driver,
+                     virCapsPtr caps,
+                     qemuPlacementMovePtr move,
+                     unsigned long long now)
+{
+    virDomainObjPtr vm = move->vm;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    char *from = NULL;
+    char *to = NULL;
+
+    virObjectLock(vm);
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+        goto cleanup;
+
+    /* the domain could have gone or been moved in the meantime */
+    if (!virDomainObjIsActive(vm) || !priv->autoNodeset ||
+        !virBitmapEqual(priv->autoNodeset, move->from))
+        goto endjob;
+
+    if (!(from = virBitmapFormat(move->from)) ||
+        !(to = virBitmapFormat(move->to)))
+        goto endjob;
+
+    VIR_INFO("Moving domain '%s' from NUMA nodes %s (%.0f%% busy) "
+             "to %s (%.0f%% expected)",
+             vm->def->name, from, move->before * 100, to, move->after * 100);
+
+    if (qemuPlacementApply(driver, vm, caps, move->to, now) < 0)
+        VIR_WARN("Unable to move domain '%s' to NUMA nodes %s: %s",
+                 vm->def->name, to, virGetLastErrorMessage());
+
+ endjob:
+    qemuDomainObjEndJob(driver, vm);
+
+ cleanup:
+    virResetLastError();
+    VIR_FREE(from);
+    VIR_FREE(to);
+    virObjectUnlock(vm);
+}
+
+
+/**
+ * qemuPlacementRun:
+ *
+ * One pass of the engine: sample the host and all running domains and
+ * perform the single most useful move, if there is any. Moving at most
+ * one domain per pass lets the next samples show its effect before
+ * another one is moved.
+ */
+static void
+qemuPlacementRun(qemuPlacementPtr placement)
+{
+    virQEMUDriverPtr driver = placement->driver;
+    virCapsPtr caps = NULL;
+    virHostCPUTimePtr times = NULL;
+    size_t ntimes = 0;
+    qemuPlacementNodePtr nodes = NULL;
+    size_t nnodes = 0;
+    virDomainObjPtr *vms = NULL;
+    size_t nvms = 0;
+    qemuPlacementMove move = { 0 };
+    unsigned long long now;
+    size_t i;
+
+    if (!(caps = virQEMUDriverGetCapabilities(driver, false)) ||
+        virTimeMillisNow(&now) < 0 ||
+        virHostCPUGetTimes(&times, &ntimes) < 0)
+        goto cleanup;
+
+    if (placement->times &&
+        qemuPlacementGetNodes(caps, placement->times, placement->ntimes,
+                              times, ntimes, &nodes, &nnodes) < 0)
+        goto cleanup;
+
+    VIR_FREE(placement->times);
+    placement->times = times;
+    placement->ntimes = ntimes;
+    times = NULL;
+
+    if (virDomainObjListCollect(driver->domains, NULL, &vms, &nvms, NULL,
+                                VIR_CONNECT_LIST_DOMAINS_ACTIVE) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nvms; i++) {
+        virObjectLock(vms[i]);
+        qemuPlacementEvaluate(vms[i], nodes, nnodes, now, &move);
+        virObjectUnlock(vms[i]);
+    }
+
+    if (move.vm)
+        qemuPlacementRunMove(driver, caps, &move, now);
+
+ cleanup:
+    if (virGetLastError()) {
+        VIR_WARN("NUMA rebalancing failed: %s", virGetLastErrorMessage());
+        virResetLastError();
+    }
+    qemuPlacementMoveClear(&move);
+    virObjectListFreeCount(vms, nvms);
+    VIR_FREE(nodes);
+    VIR_FREE(times);
+    virObjectUnref(caps);
+}
+
+
+static void
+qemuPlacementWorker(void *opaque)
+{
+    qemuPlacementPtr placement = opaque;
+    unsigned long long when;
+
+    virMutexLock(&placement->lock);
+
+    while (!placement->quit) {
+        if (virTimeMillisNow(&when) < 0)
+            break;
+        when += placement->interval;
+
+        while (!placement->quit) {
+            if (virCondWaitUntil(&placement->cond, &placement->lock,
+                                 when) < 0) {
+                if (errno == ETIMEDOUT)
+                    break;
+                VIR_WARN("Unable to wait for the next NUMA rebalancing pass");
+                goto cleanup;
+            }
+        }
+
+        if (placement->quit)
+            break;
+
+        virMutexUnlock(&placement->lock);
+        qemuPlacementRun(placement);
+        virMutexLock(&placement->lock);
+    }
+
+ cleanup:
+    virMutexUnlock(&placement->lock);
+}
+
+
+/**
+ * qemuPlacementNew:
+ * @driver: the QEMU driver
+ * @interval: seconds between two passes
+ *
+ * Start a thread which periodically checks how busy the host NUMA nodes
+ * are and moves domains with automatic vCPU placement away from the
+ * overloaded ones.
+ *
+ * Returns the engine to be passed to qemuPlacementFree, NULL on error.
+ */
+qemuPlacementPtr
+qemuPlacementNew(virQEMUDriverPtr driver,
+                 unsigned int interval)
+{
+    qemuPlacementPtr placement;
+
+    if (VIR_ALLOC(placement) < 0)
+        return NULL;
+
+    placement->driver = driver;
+    placement->interval = interval * 1000ull;
+
+    if (virMutexInit(&placement->lock) < 0) {
+        VIR_FREE(placement);
+        return NULL;
+    }
+
+    if (virCondInit(&placement->cond) < 0) {
+        virMutexDestroy(&placement->lock);
+        VIR_FREE(placement);
+        return NULL;
+    }
+
+    if (virThreadCreate(&placement->thread, true,
+                        qemuPlacementWorker, placement) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create NUMA rebalancing thread"));
+        virCondDestroy(&placement->cond);
+        virMutexDestroy(&placement->lock);
+        VIR_FREE(placement);
+        return NULL;
+    }
+
+    return placement;
+}
+
+
+void
+qemuPlacementFree(qemuPlacementPtr placement)
+{
+    if (!placement)
+        return;
+
+    virMutexLock(&placement->lock);
+    placement->quit = true;
+    virCondSignal(&placement->cond);
+    virMutexUnlock(&placement->lock);
+
+    virThreadJoin(&placement->thread);
+
+    virCondDestroy(&placement->cond);
+    virMutexDestroy(&placement->lock);
+    VIR_FREE(placement->times);
+    VIR_FREE(placement);
+}
@@ -0,0 +1,30 @@
+/*
+ * qemu_placement.h: NUMA rebalancing of automatically placed domains
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __QEMU_PLACEMENT_H__
+# define __QEMU_PLACEMENT_H__
+
+# include "qemu_conf.h"
+
+qemuPlacementPtr qemuPlacementNew(virQEMUDriverPtr driver,
+                                  unsigned int interval);
+void qemuPlacementFree(qemuPlacementPtr placement);
+
+#endif /* __QEMU_PLACEMENT_H__ */
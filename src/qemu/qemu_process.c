@@ -35,6 +35,8 @@
 #include "qemu_process.h"
 #include "qemu_processpriv.h"
 #include "qemu_alias.h"
+#include "qemu_backup.h"
+#include "qemu_blockjob.h"
 #include "qemu_block.h"
 #include "qemu_domain.h"
 #include "qemu_domain_address.h"
@@ -107,6 +109,8 @@ qemuProcessRemoveDomainStatus(virQEMUDriverPtr driver,
                  vm->def->name, virStrerror(errno, ebuf, sizeof(ebuf)));
     VIR_FREE(file);
 
+    qemuDomainRemoveStatusJournal(cfg, vm);
+
     if (priv->pidfile &&
         unlink(priv->pidfile) < 0 &&
         errno != ENOENT)
@@ -486,7 +490,6 @@ qemuProcessHandleReset(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event;
     qemuDomainObjPrivatePtr priv;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
 
@@ -495,14 +498,13 @@ qemuProcessHandleReset(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     if (priv->agent)
         qemuAgentNotifyEvent(priv->agent, QEMU_AGENT_EVENT_RESET);
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         VIR_WARN("Failed to save status on vm %s", vm->def->name);
 
     virObjectUnlock(vm);
 
     qemuDomainEventQueue(driver, event);
 
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -522,7 +524,6 @@ qemuProcessFakeReboot(void *opaque)
     virDomainObjPtr vm = opaque;
     qemuDomainObjPrivatePtr priv = vm->privateData;
     virObjectEventPtr event = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     virDomainRunningReason reason = VIR_DOMAIN_RUNNING_BOOTED;
     int ret = -1, rc;
 
@@ -562,7 +563,7 @@ qemuProcessFakeReboot(void *opaque)
                                      VIR_DOMAIN_EVENT_RESUMED,
                                      VIR_DOMAIN_EVENT_RESUMED_UNPAUSED);
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+    if (qemuDomainSaveStatus(driver, vm) < 0) {
         VIR_WARN("Unable to save status on vm %s after state change",
                  vm->def->name);
     }
@@ -577,7 +578,6 @@ qemuProcessFakeReboot(void *opaque)
         ignore_value(qemuProcessKill(vm, VIR_QEMU_PROCESS_KILL_FORCE));
     virDomainObjEndAPI(&vm);
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
 }
 
 
@@ -639,7 +639,6 @@ qemuProcessHandleShutdown(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = opaque;
     qemuDomainObjPrivatePtr priv;
     virObjectEventPtr event = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     VIR_DEBUG("vm=%p", vm);
 
@@ -666,7 +665,7 @@ qemuProcessHandleShutdown(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                      VIR_DOMAIN_EVENT_SHUTDOWN,
                                      VIR_DOMAIN_EVENT_SHUTDOWN_FINISHED);
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+    if (qemuDomainSaveStatus(driver, vm) < 0) {
         VIR_WARN("Unable to save status on vm %s after state change",
                  vm->def->name);
     }
@@ -679,7 +678,6 @@ qemuProcessHandleShutdown(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
  unlock:
     virObjectUnlock(vm);
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
 
     return 0;
 }
@@ -694,7 +692,6 @@ qemuProcessHandleStop(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virObjectEventPtr event = NULL;
     virDomainPausedReason reason = VIR_DOMAIN_PAUSED_UNKNOWN;
     virDomainEventSuspendedDetailType detail = VIR_DOMAIN_EVENT_SUSPENDED_PAUSED;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     if (virDomainObjGetState(vm, NULL) == VIR_DOMAIN_RUNNING) {
@@ -735,7 +732,7 @@ qemuProcessHandleStop(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
             VIR_WARN("Unable to release lease on %s", vm->def->name);
         VIR_DEBUG("Preserving lock state '%s'", NULLSTR(priv->lockState));
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainSaveStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after state change",
                      vm->def->name);
         }
@@ -744,7 +741,6 @@ qemuProcessHandleStop(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
  unlock:
     virObjectUnlock(vm);
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
 
     return 0;
 }
@@ -757,7 +753,6 @@ qemuProcessHandleResume(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 {
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     if (virDomainObjGetState(vm, NULL) == VIR_DOMAIN_PAUSED) {
@@ -777,7 +772,7 @@ qemuProcessHandleResume(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                          VIR_DOMAIN_EVENT_RESUMED,
                                          VIR_DOMAIN_EVENT_RESUMED_UNPAUSED);
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainSaveStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after state change",
                      vm->def->name);
         }
@@ -786,7 +781,6 @@ qemuProcessHandleResume(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
  unlock:
     virObjectUnlock(vm);
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -798,7 +792,6 @@ qemuProcessHandleRTCChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 {
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
 
@@ -821,7 +814,7 @@ qemuProcessHandleRTCChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         offset += vm->def->clock.data.variable.adjustment0;
         vm->def->clock.data.variable.adjustment = offset;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
            VIR_WARN("unable to save domain status with RTC change");
     }
 
@@ -830,7 +823,6 @@ qemuProcessHandleRTCChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virObjectUnlock(vm);
 
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -844,7 +836,6 @@ qemuProcessHandleWatchdog(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr watchdogEvent = NULL;
     virObjectEventPtr lifecycleEvent = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     watchdogEvent = virDomainEventWatchdogNewFromObj(vm, action);
@@ -864,7 +855,7 @@ qemuProcessHandleWatchdog(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
             VIR_WARN("Unable to release lease on %s", vm->def->name);
         VIR_DEBUG("Preserving lock state '%s'", NULLSTR(priv->lockState));
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainSaveStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after watchdog event",
                      vm->def->name);
         }
@@ -893,7 +884,6 @@ qemuProcessHandleWatchdog(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     qemuDomainEventQueue(driver, watchdogEvent);
     qemuDomainEventQueue(driver, lifecycleEvent);
 
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -913,7 +903,6 @@ qemuProcessHandleIOError(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     const char *srcPath;
     const char *devAlias;
     virDomainDiskDefPtr disk;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     disk = qemuProcessFindDomainDiskByAlias(vm, diskAlias);
@@ -947,7 +936,7 @@ qemuProcessHandleIOError(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
             VIR_WARN("Unable to release lease on %s", vm->def->name);
         VIR_DEBUG("Preserving lock state '%s'", NULLSTR(priv->lockState));
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
             VIR_WARN("Unable to save status on vm %s after IO error", vm->def->name);
     }
     virObjectUnlock(vm);
@@ -955,7 +944,6 @@ qemuProcessHandleIOError(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     qemuDomainEventQueue(driver, ioErrorEvent);
     qemuDomainEventQueue(driver, ioErrorEvent2);
     qemuDomainEventQueue(driver, lifecycleEvent);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -978,6 +966,13 @@ qemuProcessHandleBlockJob(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     VIR_DEBUG("Block job for device %s (domain: %p,%s) type %d status %d",
               diskAlias, vm, vm->def->name, type, status);
 
+    /* backup jobs are named after the backup, not the disk; the only
+     * one interested in them is virDomainBackupEnd waiting for them */
+    if (qemuBackupIsJob(diskAlias)) {
+        virDomainObjBroadcast(vm);
+        goto cleanup;
+    }
+
     if (!(disk = qemuProcessFindDomainDiskByAlias(vm, diskAlias)))
         goto error;
     diskPriv = QEMU_DOMAIN_DISK_PRIVATE(disk);
@@ -1114,7 +1109,6 @@ qemuProcessHandleTrayChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event = NULL;
     virDomainDiskDefPtr disk;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     disk = qemuProcessFindDomainDiskByAlias(vm, devAlias);
@@ -1129,7 +1123,7 @@ qemuProcessHandleTrayChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         else if (reason == VIR_DOMAIN_EVENT_TRAY_CHANGE_CLOSE)
             disk->tray_status = VIR_DOMAIN_DISK_TRAY_CLOSED;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainSaveStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after tray moved event",
                      vm->def->name);
         }
@@ -1139,7 +1133,6 @@ qemuProcessHandleTrayChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 
     virObjectUnlock(vm);
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -1151,7 +1144,6 @@ qemuProcessHandlePMWakeup(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event = NULL;
     virObjectEventPtr lifecycleEvent = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     event = virDomainEventPMWakeupNewFromObj(vm);
@@ -1169,7 +1161,7 @@ qemuProcessHandlePMWakeup(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                                   VIR_DOMAIN_EVENT_STARTED,
                                                   VIR_DOMAIN_EVENT_STARTED_WAKEUP);
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainSaveStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after wakeup event",
                      vm->def->name);
         }
@@ -1178,7 +1170,6 @@ qemuProcessHandlePMWakeup(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virObjectUnlock(vm);
     qemuDomainEventQueue(driver, event);
     qemuDomainEventQueue(driver, lifecycleEvent);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -1190,7 +1181,6 @@ qemuProcessHandlePMSuspend(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event = NULL;
     virObjectEventPtr lifecycleEvent = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     event = virDomainEventPMSuspendNewFromObj(vm);
@@ -1207,7 +1197,7 @@ qemuProcessHandlePMSuspend(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                      VIR_DOMAIN_EVENT_PMSUSPENDED,
                                      VIR_DOMAIN_EVENT_PMSUSPENDED_MEMORY);
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainSaveStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after suspend event",
                      vm->def->name);
         }
@@ -1220,10 +1210,128 @@ qemuProcessHandlePMSuspend(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 
     qemuDomainEventQueue(driver, event);
     qemuDomainEventQueue(driver, lifecycleEvent);
-    virObjectUnref(cfg);
     return 0;
 }
 
+/**
+ * qemuProcessQueueBalloonStats:
+ * @driver: qemu driver data
+ * @vm: domain object, locked
+ *
+ * Queues a refresh of the guest memory statistics cached in the private
+ * data of @vm to the worker pool, unless one is already pending.
+ */
+void
+qemuProcessQueueBalloonStats(virQEMUDriverPtr driver,
+                             virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    struct qemuProcessEvent *processEvent;
+
+    if (priv->balloonStatsPending ||
+        !virDomainObjIsActive(vm) ||
+        !vm->def->memballoon ||
+        vm->def->memballoon->model != VIR_DOMAIN_MEMBALLOON_MODEL_VIRTIO)
+        return;
+
+    if (VIR_ALLOC(processEvent) < 0)
+        return;
+
+    processEvent->eventType = QEMU_PROCESS_EVENT_BALLOON_STATS;
+    processEvent->vm = vm;
+
+    virObjectRef(vm);
+    if (virThreadPoolSendJob(driver->workerPool, 0, processEvent) < 0) {
+        ignore_value(virObjectUnref(vm));
+        VIR_FREE(processEvent);
+        return;
+    }
+
+    priv->balloonStatsPending = true;
+}
+
+
+typedef struct _qemuProcessBalloonStatsData qemuProcessBalloonStatsData;
+typedef qemuProcessBalloonStatsData *qemuProcessBalloonStatsDataPtr;
+struct _qemuProcessBalloonStatsData {
+    virQEMUDriverPtr driver;
+    virDomainObjPtr vm;
+};
+
+
+static void
+qemuProcessBalloonStatsTimer(int timer ATTRIBUTE_UNUSED,
+                             void *opaque)
+{
+    qemuProcessBalloonStatsDataPtr data = opaque;
+
+    virObjectLock(data->vm);
+    qemuProcessQueueBalloonStats(data->driver, data->vm);
+    virObjectUnlock(data->vm);
+}
+
+
+static void
+qemuProcessBalloonStatsDataFree(void *opaque)
+{
+    qemuProcessBalloonStatsDataPtr data = opaque;
+
+    virObjectUnref(data->vm);
+    VIR_FREE(data);
+}
+
+
+/**
+ * qemuProcessSetupBalloonStats:
+ * @driver: qemu driver data
+ * @vm: domain object, locked
+ *
+ * (Re)starts refreshing the guest memory statistics of the balloon of
+ * @vm every memballoon period, QEMU doesn't update them more often
+ * anyway. A period of 0 only stops it. Either way a refresh is queued
+ * right away so that readers find the cache filled.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuProcessSetupBalloonStats(virQEMUDriverPtr driver,
+                             virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virDomainMemballoonDefPtr balloon = vm->def->memballoon;
+    qemuProcessBalloonStatsDataPtr data = NULL;
+
+    if (priv->balloonStatsTimer != -1) {
+        virEventRemoveTimeout(priv->balloonStatsTimer);
+        priv->balloonStatsTimer = -1;
+    }
+
+    if (!balloon || balloon->model != VIR_DOMAIN_MEMBALLOON_MODEL_VIRTIO)
+        return 0;
+
+    if (balloon->period > 0) {
+        if (VIR_ALLOC(data) < 0)
+            return -1;
+        data->driver = driver;
+        data->vm = virObjectRef(vm);
+
+        if ((priv->balloonStatsTimer =
+             virEventAddTimeout(MIN(balloon->period, INT_MAX / 1000) * 1000,
+                                qemuProcessBalloonStatsTimer, data,
+                                qemuProcessBalloonStatsDataFree)) < 0) {
+            qemuProcessBalloonStatsDataFree(data);
+            priv->balloonStatsTimer = -1;
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("unable to add balloon stats timer"));
+            return -1;
+        }
+    }
+
+    qemuProcessQueueBalloonStats(driver, vm);
+    return 0;
+}
+
+
 static int
 qemuProcessHandleBalloonChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                virDomainObjPtr vm,
@@ -1231,23 +1339,31 @@ qemuProcessHandleBalloonChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                void *opaque)
 {
     virQEMUDriverPtr driver = opaque;
+    qemuDomainObjPrivatePtr priv;
     virObjectEventPtr event = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    int i;
 
     virObjectLock(vm);
+    priv = vm->privateData;
     event = virDomainEventBalloonChangeNewFromObj(vm, actual);
 
     VIR_DEBUG("Updating balloon from %lld to %lld kb",
               vm->def->mem.cur_balloon, actual);
     vm->def->mem.cur_balloon = actual;
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
-        VIR_WARN("unable to save domain status with balloon change");
+    /* The new size is known right away, the guest's view of its memory
+     * is refreshed in the background */
+    for (i = 0; i < priv->nballoonStats; i++) {
+        if (priv->balloonStats[i].tag == VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON)
+            priv->balloonStats[i].val = actual;
+    }
+    qemuProcessQueueBalloonStats(driver, vm);
+
+    qemuDomainSaveStatusBalloon(driver, vm);
 
     virObjectUnlock(vm);
 
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -1259,7 +1375,6 @@ qemuProcessHandlePMSuspendDisk(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event = NULL;
     virObjectEventPtr lifecycleEvent = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     event = virDomainEventPMSuspendDiskNewFromObj(vm);
@@ -1276,7 +1391,7 @@ qemuProcessHandlePMSuspendDisk(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                      VIR_DOMAIN_EVENT_PMSUSPENDED,
                                      VIR_DOMAIN_EVENT_PMSUSPENDED_DISK);
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainSaveStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after suspend event",
                      vm->def->name);
         }
@@ -1289,7 +1404,6 @@ qemuProcessHandlePMSuspendDisk(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 
     qemuDomainEventQueue(driver, event);
     qemuDomainEventQueue(driver, lifecycleEvent);
-    virObjectUnref(cfg);
 
     return 0;
 }
@@ -1443,6 +1557,34 @@ qemuProcessHandleAcpiOstInfo(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 }
 
 
+static virObjectEventPtr
+qemuProcessBlockThresholdEvent(virDomainObjPtr vm,
+                               const char *nodename,
+                               unsigned long long threshold,
+                               unsigned long long excess)
+{
+    virObjectEventPtr event = NULL;
+    virDomainDiskDefPtr disk;
+    virStorageSourcePtr src;
+    unsigned int idx;
+    char *dev = NULL;
+    const char *path = NULL;
+
+    if ((disk = qemuDomainDiskLookupByNodename(vm->def, nodename, &src, &idx))) {
+        if (virStorageSourceIsLocalStorage(src))
+            path = src->path;
+
+        if ((dev = qemuDomainDiskBackingStoreGetName(disk, src, idx))) {
+            event = virDomainEventBlockThresholdNewFromObj(vm, dev, path,
+                                                           threshold, excess);
+            VIR_FREE(dev);
+        }
+    }
+
+    return event;
+}
+
+
 static int
 qemuProcessHandleBlockThreshold(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                 virDomainObjPtr vm,
@@ -1453,11 +1595,6 @@ qemuProcessHandleBlockThreshold(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 {
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event = NULL;
-    virDomainDiskDefPtr disk;
-    virStorageSourcePtr src;
-    unsigned int idx;
-    char *dev = NULL;
-    const char *path = NULL;
 
     virObjectLock(vm);
 
@@ -1465,15 +1602,13 @@ qemuProcessHandleBlockThreshold(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
               "threshold '%llu' exceeded by '%llu'",
               nodename, vm, vm->def->name, threshold, excess);
 
-    if ((disk = qemuDomainDiskLookupByNodename(vm->def, nodename, &src, &idx))) {
-        if (virStorageSourceIsLocalStorage(src))
-            path = src->path;
+    event = qemuProcessBlockThresholdEvent(vm, nodename, threshold, excess);
 
-        if ((dev = qemuDomainDiskBackingStoreGetName(disk, src, idx))) {
-            event = virDomainEventBlockThresholdNewFromObj(vm, dev, path,
-                                                           threshold, excess);
-            VIR_FREE(dev);
-        }
+    /* QEMU disarms the threshold once it fires */
+    if (qemuDomainBlockThresholdSet(vm->privateData, nodename, 0) < 0 ||
+        qemuDomainSaveStatus(driver, vm) < 0) {
+        VIR_WARN("Unable to save status on vm %s after block threshold event",
+                 vm->def->name);
     }
 
     virObjectUnlock(vm);
@@ -1643,6 +1778,9 @@ qemuProcessHandleMigrationPass(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         goto cleanup;
     }
 
+    priv->job.current->stats.ram_iteration = pass;
+    virDomainObjBroadcast(vm);
+
     qemuDomainEventQueue(driver,
                          virDomainEventMigrationIterationNewFromObj(vm, pass));
 
@@ -1652,6 +1790,45 @@ qemuProcessHandleMigrationPass(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 }
 
 
+static int
+qemuProcessHandleDumpCompleted(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
+                               virDomainObjPtr vm,
+                               qemuMonitorDumpStatsPtr stats,
+                               const char *error,
+                               void *opaque ATTRIBUTE_UNUSED)
+{
+    qemuDomainObjPrivatePtr priv;
+
+    virObjectLock(vm);
+
+    VIR_DEBUG("Dump completed for domain %p %s with stats=%p error='%s'",
+              vm, vm->def->name, stats, NULLSTR(error));
+
+    priv = vm->privateData;
+    if (priv->job.asyncJob == QEMU_ASYNC_JOB_NONE) {
+        VIR_DEBUG("got DUMP_COMPLETED event without a dump job");
+        goto cleanup;
+    }
+
+    if (priv->job.current) {
+        priv->job.current->stats.ram_total = stats->total;
+        priv->job.current->stats.ram_transferred = stats->completed;
+        priv->job.current->stats.ram_remaining = stats->total - stats->completed;
+    }
+
+    priv->job.dumpCompleted = true;
+    if (stats->status == QEMU_MONITOR_DUMP_STATUS_FAILED &&
+        VIR_STRDUP_QUIET(priv->job.dumpError,
+                         error ? error : _("unknown error")) < 0)
+        VIR_WARN("Unable to store dump error for domain %s", vm->def->name);
+    virDomainObjBroadcast(vm);
+
+ cleanup:
+    virObjectUnlock(vm);
+    return 0;
+}
+
+
 static qemuMonitorCallbacks monitorCallbacks = {
     .eofNotify = qemuProcessHandleMonitorEOF,
     .errorNotify = qemuProcessHandleMonitorError,
@@ -1680,6 +1857,7 @@ static qemuMonitorCallbacks monitorCallbacks = {
     .domainMigrationPass = qemuProcessHandleMigrationPass,
     .domainAcpiOstInfo = qemuProcessHandleAcpiOstInfo,
     .domainBlockThreshold = qemuProcessHandleBlockThreshold,
+    .domainDumpCompleted = qemuProcessHandleDumpCompleted,
 };
 
 static void
@@ -1703,6 +1881,7 @@ qemuConnectMonitor(virQEMUDriverPtr driver, virDomainObjPtr vm, int asyncJob,
     int ret = -1;
     qemuMonitorPtr mon = NULL;
     unsigned long long timeout = 0;
+    bool noMigrationEvent = false;
 
     if (qemuSecuritySetDaemonSocketLabel(driver->securityManager, vm->def) < 0) {
         VIR_ERROR(_("Failed to set security context for monitor for %s"),
@@ -1771,7 +1950,7 @@ qemuConnectMonitor(virQEMUDriverPtr driver, virDomainObjPtr vm, int asyncJob,
                                           QEMU_MONITOR_MIGRATION_CAPS_EVENTS,
                                           true) < 0) {
         VIR_DEBUG("Cannot enable migration events; clearing capability");
-        virQEMUCapsClear(priv->qemuCaps, QEMU_CAPS_MIGRATION_EVENT);
+        noMigrationEvent = true;
     }
 
     ret = 0;
@@ -1779,6 +1958,13 @@ qemuConnectMonitor(virQEMUDriverPtr driver, virDomainObjPtr vm, int asyncJob,
  cleanup:
     if (qemuDomainObjExitMonitor(driver, vm) < 0)
         ret = -1;
+
+    /* the capabilities may be shared with other domains */
+    if (ret == 0 && noMigrationEvent) {
+        if (virQEMUCapsMakeWritable(&priv->qemuCaps) < 0)
+            return -1;
+        virQEMUCapsClear(priv->qemuCaps, QEMU_CAPS_MIGRATION_EVENT);
+    }
     return ret;
 }
 
@@ -2065,6 +2251,79 @@ qemuRefreshRTC(virQEMUDriverPtr driver,
     vm->def->clock.data.variable.adjustment = then - now + localOffset;
 }
 
+/**
+ * qemuProcessRefreshBlockThresholds:
+ * @driver: qemu driver data
+ * @vm: domain object
+ *
+ * Delivers the VIR_DOMAIN_EVENT_ID_BLOCK_THRESHOLD events of the write
+ * thresholds which QEMU disarmed while the daemon wasn't running, how
+ * far they were exceeded is not known anymore. Called on reconnect once
+ * the node names are detected.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+qemuProcessRefreshBlockThresholds(virQEMUDriverPtr driver,
+                                  virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virJSONValuePtr data = NULL;
+    virHashTablePtr nodedata = NULL;
+    virJSONValuePtr node;
+    unsigned long long threshold;
+    size_t i;
+    int ret = -1;
+
+    if (!priv->nblockThresholds)
+        return 0;
+
+    qemuDomainObjEnterMonitor(driver, vm);
+    data = qemuMonitorQueryNamedBlockNodes(priv->mon);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || !data)
+        goto cleanup;
+
+    if (!(nodedata = qemuBlockGetNodeData(data)))
+        goto cleanup;
+
+    for (i = 0; i < priv->nblockThresholds;) {
+        qemuDomainBlockThresholdPtr entry = &priv->blockThresholds[i];
+
+        node = virHashLookup(nodedata, entry->nodename);
+        if (node &&
+            virJSONValueObjectGetNumberUlong(node, "write_threshold",
+                                             &threshold) == 0 &&
+            threshold > 0) {
+            /* still armed */
+            i++;
+            continue;
+        }
+
+        /* a node which is gone took its threshold along */
+        if (node) {
+            VIR_DEBUG("block threshold %llu of node '%s' fired while "
+                      "the daemon was not running",
+                      entry->threshold, entry->nodename);
+            qemuDomainEventQueue(driver,
+                                 qemuProcessBlockThresholdEvent(vm,
+                                                                entry->nodename,
+                                                                entry->threshold,
+                                                                0));
+        }
+
+        if (qemuDomainBlockThresholdSet(priv, entry->nodename, 0) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(nodedata);
+    virJSONValueFree(data);
+    return ret;
+}
+
+
 int
 qemuProcessRefreshBalloonState(virQEMUDriverPtr driver,
                                virDomainObjPtr vm,
@@ -2580,7 +2839,6 @@ qemuProcessUpdateVideoRamSize(virQEMUDriverPtr driver,
     ssize_t i;
     qemuDomainObjPrivatePtr priv = vm->privateData;
     virDomainVideoDefPtr video = NULL;
-    virQEMUDriverConfigPtr cfg = NULL;
 
     if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
         return -1;
@@ -2637,9 +2895,7 @@ qemuProcessUpdateVideoRamSize(virQEMUDriverPtr driver,
     if (qemuDomainObjExitMonitor(driver, vm) < 0)
         return -1;
 
-    cfg = virQEMUDriverGetConfig(driver);
-    ret = virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps);
-    virObjectUnref(cfg);
+    ret = qemuDomainSaveStatus(driver, vm);
 
     return ret;
 
@@ -3362,6 +3618,10 @@ qemuProcessReconnect(void *opaque)
 
     VIR_FREE(data);
 
+    /* apply the job and runtime state changes journaled after the status
+     * XML was saved */
+    qemuDomainReplayStatusJournal(driver, obj);
+
     qemuDomainObjRestoreJob(obj, &oldjob);
     if (oldjob.asyncJob == QEMU_ASYNC_JOB_MIGRATION_IN)
         stopFlags |= VIR_QEMU_PROCESS_STOP_MIGRATED;
@@ -3369,6 +3629,11 @@ qemuProcessReconnect(void *opaque)
     cfg = virQEMUDriverGetConfig(driver);
     priv = obj->privateData;
 
+    /* Jobs queued while the domain was waiting for its turn can proceed once
+     * we are done; the lock is not released until our job is started */
+    priv->reconnecting = false;
+    virCondBroadcast(&priv->job.cond);
+
     if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
         goto error;
 
@@ -3396,15 +3661,16 @@ qemuProcessReconnect(void *opaque)
     if (qemuHostdevUpdateActiveDomainDevices(driver, obj->def) < 0)
         goto error;
 
+    /* the pages are in use already, whether they fit or not */
+    if (qemuDomainReserveHugepages(driver, obj, true) < 0)
+        goto error;
+
     if (qemuConnectCgroup(driver, obj) < 0)
         goto error;
 
     if (qemuDomainPerfRestart(obj) < 0)
         goto error;
 
-    /* XXX: Need to change as long as lock is introduced for
-     * qemu_driver->sharedDevices.
-     */
     for (i = 0; i < obj->def->ndisks; i++) {
         virDomainDeviceDef dev;
 
@@ -3441,10 +3707,10 @@ qemuProcessReconnect(void *opaque)
      * caps in the domain status, so re-query them
      */
     if (!priv->qemuCaps &&
-        !(priv->qemuCaps = virQEMUCapsCacheLookupCopy(caps,
-                                                      driver->qemuCapsCache,
-                                                      obj->def->emulator,
-                                                      obj->def->os.machine)))
+        !(priv->qemuCaps = virQEMUCapsCacheLookupMachine(caps,
+                                                         driver->qemuCapsCache,
+                                                         obj->def->emulator,
+                                                         obj->def->os.machine)))
         goto error;
 
     /* In case the domain shutdown while we were not running,
@@ -3492,6 +3758,13 @@ qemuProcessReconnect(void *opaque)
     if (qemuBlockNodeNamesDetect(driver, obj) < 0)
         goto error;
 
+    qemuBackupReconnect(driver, obj);
+
+    qemuBlockJobGroupReconnect(driver, obj);
+
+    if (qemuProcessRefreshBlockThresholds(driver, obj) < 0)
+        goto error;
+
     if (qemuRefreshVirtioChannelState(driver, obj, QEMU_ASYNC_JOB_NONE) < 0)
         goto error;
 
@@ -3501,6 +3774,9 @@ qemuProcessReconnect(void *opaque)
     if (qemuProcessRefreshBalloonState(driver, obj, QEMU_ASYNC_JOB_NONE) < 0)
         goto error;
 
+    if (qemuProcessSetupBalloonStats(driver, obj) < 0)
+        goto error;
+
     if (qemuProcessRecoverJob(driver, obj, conn, &oldjob, &stopFlags) < 0)
         goto error;
 
@@ -3513,7 +3789,7 @@ qemuProcessReconnect(void *opaque)
         goto error;
 
     /* update domain state XML with possibly updated state in virDomainObj */
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, obj, driver->caps) < 0)
+    if (qemuDomainSaveStatus(driver, obj) < 0)
         goto error;
 
     /* Run an hook to allow admins to do some magic */
@@ -3573,34 +3849,21 @@ qemuProcessReconnect(void *opaque)
     goto cleanup;
 }
 
+/*
+ * Spawns a thread reconnecting to the domain of @data. The domain object
+ * must be referenced but not locked; both the reference and @data are
+ * consumed.
+ */
 static int
-qemuProcessReconnectHelper(virDomainObjPtr obj,
-                           void *opaque)
+qemuProcessReconnectSpawn(struct qemuProcessReconnectData *data)
 {
     virThread thread;
-    struct qemuProcessReconnectData *src = opaque;
-    struct qemuProcessReconnectData *data;
-
-    /* If the VM was inactive, we don't need to reconnect */
-    if (!obj->pid)
-        return 0;
-
-    if (VIR_ALLOC(data) < 0)
-        return -1;
-
-    memcpy(data, src, sizeof(*data));
-    data->obj = obj;
+    virQEMUDriverPtr driver = data->driver;
+    virDomainObjPtr obj = data->obj;
 
     /* this lock and reference will be eventually transferred to the thread
      * that handles the reconnect */
     virObjectLock(obj);
-    virObjectRef(obj);
-
-    /* Since we close the connection later on, we have to make sure that the
-     * threads we start see a valid connection throughout their lifetime. We
-     * simply increase the reference counter here.
-     */
-    virObjectRef(data->conn);
 
     if (virThreadCreate(&thread, false, qemuProcessReconnect, data) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -3611,9 +3874,10 @@ qemuProcessReconnectHelper(virDomainObjPtr obj,
          * is no thread that could be doing anything else with the same domain
          * object.
          */
-        qemuProcessStop(src->driver, obj, VIR_DOMAIN_SHUTOFF_FAILED,
+        ((qemuDomainObjPrivatePtr) obj->privateData)->reconnecting = false;
+        qemuProcessStop(driver, obj, VIR_DOMAIN_SHUTOFF_FAILED,
                         QEMU_ASYNC_JOB_NONE, 0);
-        qemuDomainRemoveInactive(src->driver, obj);
+        qemuDomainRemoveInactive(driver, obj);
 
         virDomainObjEndAPI(&obj);
         virObjectUnref(data->conn);
@@ -3624,36 +3888,166 @@ qemuProcessReconnectHelper(virDomainObjPtr obj,
     return 0;
 }
 
+
 /**
- * qemuProcessReconnectAll
+ * qemuProcessReconnectWorker:
+ * @jobdata: qemuProcessReconnectData of the domain
+ * @opaque: the driver
  *
- * Try to re-open the resources for live VMs that we care
- * about.
+ * Worker of the reconnect_workers pool.
  */
 void
-qemuProcessReconnectAll(virConnectPtr conn, virQEMUDriverPtr driver)
+qemuProcessReconnectWorker(void *jobdata,
+                           void *opaque ATTRIBUTE_UNUSED)
 {
-    struct qemuProcessReconnectData data = {.conn = conn, .driver = driver};
-    virDomainObjListForEach(driver->domains, qemuProcessReconnectHelper, &data);
+    struct qemuProcessReconnectData *data = jobdata;
+
+    virObjectLock(data->obj);
+    qemuProcessReconnect(data);
 }
 
-static int
-qemuProcessVNCAllocatePorts(virQEMUDriverPtr driver,
-                            virDomainGraphicsDefPtr graphics,
-                            bool allocate)
-{
-    unsigned short port;
 
-    if (!allocate) {
-        if (graphics->data.vnc.autoport)
-            graphics->data.vnc.port = 5900;
+#define QEMU_PROCESS_RECONNECT_NAMESPACE_HREF \
+    "http://libvirt.org/schemas/domain/qemu/reconnect/1.0"
+#define QEMU_PROCESS_RECONNECT_ELEMENT "reconnect"
 
-        return 0;
-    }
+struct qemuProcessReconnectEntry {
+    virDomainObjPtr vm;
+    int priority;
+    size_t idx;
+};
 
-    if (graphics->data.vnc.autoport) {
-        if (virPortAllocatorAcquire(driver->remotePorts, &port) < 0)
-            return -1;
+struct qemuProcessReconnectList {
+    struct qemuProcessReconnectEntry *entries;
+    size_t nentries;
+};
+
+
+static int
+qemuProcessReconnectCollect(virDomainObjPtr obj,
+                            void *opaque)
+{
+    struct qemuProcessReconnectList *list = opaque;
+    struct qemuProcessReconnectEntry entry;
+    int ret = -1;
+
+    virObjectLock(obj);
+
+    /* If the VM was inactive, we don't need to reconnect */
+    if (!obj->pid) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    entry.vm = obj;
+    entry.priority = qemuDomainMetadataPriority(obj->def,
+                                                QEMU_PROCESS_RECONNECT_NAMESPACE_HREF,
+                                                QEMU_PROCESS_RECONNECT_ELEMENT);
+    entry.idx = list->nentries;
+
+    if (VIR_APPEND_ELEMENT(list->entries, list->nentries, entry) < 0)
+        goto cleanup;
+
+    virObjectRef(obj);
+    ((qemuDomainObjPrivatePtr) obj->privateData)->reconnecting = true;
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(obj);
+    return ret;
+}
+
+
+static int
+qemuProcessReconnectEntryCompare(const void *a,
+                                 const void *b)
+{
+    const struct qemuProcessReconnectEntry *ea = a;
+    const struct qemuProcessReconnectEntry *eb = b;
+
+    /* highest priority first, keep the list order otherwise */
+    if (ea->priority != eb->priority)
+        return ea->priority > eb->priority ? -1 : 1;
+
+    return ea->idx < eb->idx ? -1 : ea->idx > eb->idx;
+}
+
+
+/**
+ * qemuProcessReconnectAll
+ *
+ * Try to re-open the resources for live VMs that we care
+ * about.
+ *
+ * The domains are reconnected in the order of their reconnect priority
+ * by the driver's reconnectPool, which bounds the number of reconnects
+ * running at once. Each domain is marked as reconnecting until its turn
+ * comes so that jobs started on it wait for the reconnect while the
+ * domains which were already reconnected can be used right away.
+ */
+void
+qemuProcessReconnectAll(virConnectPtr conn, virQEMUDriverPtr driver)
+{
+    struct qemuProcessReconnectList list = { NULL, 0 };
+    struct qemuProcessReconnectData *data;
+    size_t i;
+
+    virDomainObjListForEach(driver->domains, qemuProcessReconnectCollect, &list);
+
+    qsort(list.entries, list.nentries, sizeof(*list.entries),
+          qemuProcessReconnectEntryCompare);
+
+    for (i = 0; i < list.nentries; i++) {
+        virDomainObjPtr obj = list.entries[i].vm;
+
+        VIR_DEBUG("Reconnecting to domain %s with priority %d",
+                  obj->def->name, list.entries[i].priority);
+
+        if (VIR_ALLOC(data) < 0) {
+            virObjectLock(obj);
+            ((qemuDomainObjPrivatePtr) obj->privateData)->reconnecting = false;
+            virDomainObjEndAPI(&obj);
+            continue;
+        }
+
+        data->conn = conn;
+        data->driver = driver;
+        data->obj = obj;
+
+        /* Since we close the connection later on, we have to make sure that
+         * the threads reconnecting the domains see a valid connection
+         * throughout their lifetime. We simply increase the reference
+         * counter here.
+         */
+        virObjectRef(conn);
+
+        if (driver->reconnectPool &&
+            virThreadPoolSendJob(driver->reconnectPool, 0, data) == 0)
+            continue;
+
+        ignore_value(qemuProcessReconnectSpawn(data));
+    }
+
+    VIR_FREE(list.entries);
+}
+
+static int
+qemuProcessVNCAllocatePorts(virQEMUDriverPtr driver,
+                            virDomainGraphicsDefPtr graphics,
+                            bool allocate)
+{
+    unsigned short port;
+
+    if (!allocate) {
+        if (graphics->data.vnc.autoport)
+            graphics->data.vnc.port = 5900;
+
+        return 0;
+    }
+
+    if (graphics->data.vnc.autoport) {
+        if (virPortAllocatorAcquire(driver->remotePorts, &port) < 0)
+            return -1;
         graphics->data.vnc.port = port;
     }
 
@@ -4165,14 +4559,47 @@ qemuProcessEndJob(virQEMUDriverPtr driver,
 }
 
 
+typedef struct _qemuProcessRunHookData qemuProcessRunHookData;
+typedef qemuProcessRunHookData *qemuProcessRunHookDataPtr;
+struct _qemuProcessRunHookData {
+    virDomainObjPtr vm;
+    virHookQemuOpType op;
+};
+
+static void
+qemuProcessRunHookDone(int ret,
+                       unsigned long long duration,
+                       void *opaque)
+{
+    qemuProcessRunHookDataPtr data = opaque;
+
+    virObjectLock(data->vm);
+    qemuDomainHookStatsAdd(data->vm, data->op, ret, duration);
+    virObjectUnlock(data->vm);
+
+    virObjectUnref(data->vm);
+    VIR_FREE(data);
+}
+
+
+/*
+ * Runs the @op hook script with the domain XML as input. Unless the
+ * operation is configured to run asynchronously, in which case the
+ * script is only queued and 0 returned, the result of the script is
+ * returned.
+ */
 static int
-qemuProcessStartHook(virQEMUDriverPtr driver,
-                     virDomainObjPtr vm,
-                     virHookQemuOpType op,
-                     virHookSubopType subop)
+qemuProcessRunHook(virQEMUDriverPtr driver,
+                   virDomainObjPtr vm,
+                   virHookQemuOpType op,
+                   virHookSubopType subop)
 {
+    virQEMUDriverConfigPtr cfg = NULL;
+    qemuProcessRunHookDataPtr data = NULL;
+    unsigned long long start = 0;
+    unsigned long long end = 0;
     char *xml;
-    int ret;
+    int ret = -1;
 
     if (!virHookPresent(VIR_HOOK_DRIVER_QEMU))
         return 0;
@@ -4180,10 +4607,35 @@ qemuProcessStartHook(virQEMUDriverPtr driver,
     if (!(xml = qemuDomainDefFormatXML(driver, vm->def, 0)))
         return -1;
 
+    cfg = virQEMUDriverGetConfig(driver);
+
+    if (cfg->hookAsync & (1 << op)) {
+        if (VIR_ALLOC(data) < 0)
+            goto cleanup;
+        data->vm = virObjectRef(vm);
+        data->op = op;
+
+        ret = virHookCallAsync(VIR_HOOK_DRIVER_QEMU, vm->def->name, op, subop,
+                               NULL, xml, cfg->hookAsyncTimeout,
+                               qemuProcessRunHookDone, data);
+        if (ret != 0) {
+            virObjectUnref(data->vm);
+            VIR_FREE(data);
+        }
+        goto cleanup;
+    }
+
+    ignore_value(virTimeMillisNow(&start));
     ret = virHookCall(VIR_HOOK_DRIVER_QEMU, vm->def->name, op, subop,
                       NULL, xml, NULL);
-    VIR_FREE(xml);
+    ignore_value(virTimeMillisNow(&end));
 
+    if (ret != 1)
+        qemuDomainHookStatsAdd(vm, op, ret, end - start);
+
+ cleanup:
+    virObjectUnref(cfg);
+    VIR_FREE(xml);
     return ret;
 }
 
@@ -4822,6 +5274,484 @@ qemuProcessStartValidate(virQEMUDriverPtr driver,
 }
 
 
+void
+qemuProcessStopCleanupFree(qemuProcessStopCleanupPtr cleanup)
+{
+    if (!cleanup)
+        return;
+
+    virDomainDefFree(cleanup->def);
+    VIR_FREE(cleanup->machineName);
+    virCgroupFree(&cleanup->cgroup);
+    VIR_FREE(cleanup->record);
+    VIR_FREE(cleanup);
+}
+
+
+static char *
+qemuProcessStopCleanupRecordPath(virQEMUDriverConfigPtr cfg,
+                                 const unsigned char *uuid)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    char *path;
+
+    virUUIDFormat(uuid, uuidstr);
+    ignore_value(virAsprintf(&path, "%s/cleanup/%s.xml",
+                             cfg->stateDir, uuidstr));
+    return path;
+}
+
+
+char *
+qemuProcessStopCleanupFormat(virQEMUDriverPtr driver,
+                             virDomainDefPtr def,
+                             const char *machineName,
+                             bool reattach,
+                             unsigned int flags)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virCapsPtr caps = NULL;
+
+    if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
+        return NULL;
+
+    virBufferAsprintf(&buf, "<cleanup flags='%u' reattach='%s'>\n",
+                      flags, reattach ? "yes" : "no");
+    virBufferAdjustIndent(&buf, 2);
+    virBufferEscapeString(&buf, "<machineName>%s</machineName>\n",
+                          machineName);
+    if (virDomainDefFormatInternal(def, caps,
+                                   VIR_DOMAIN_DEF_FORMAT_SECURE |
+                                   VIR_DOMAIN_DEF_FORMAT_STATUS |
+                                   VIR_DOMAIN_DEF_FORMAT_ACTUAL_NET |
+                                   VIR_DOMAIN_DEF_FORMAT_PCI_ORIG_STATES,
+                                   &buf) < 0) {
+        virBufferFreeAndReset(&buf);
+        virObjectUnref(caps);
+        return NULL;
+    }
+    virBufferAdjustIndent(&buf, -2);
+    virBufferAddLit(&buf, "</cleanup>\n");
+
+    virObjectUnref(caps);
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+qemuProcessStopCleanupPtr
+qemuProcessStopCleanupParse(virQEMUDriverPtr driver,
+                            const char *xml)
+{
+    xmlDocPtr doc = NULL;
+    xmlXPathContextPtr ctxt = NULL;
+    xmlNodePtr node;
+    virCapsPtr caps = NULL;
+    char *reattach = NULL;
+    qemuProcessStopCleanupPtr cleanup = NULL;
+    qemuProcessStopCleanupPtr ret = NULL;
+
+    if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
+        goto cleanup;
+
+    if (!(doc = virXMLParseStringCtxt(xml, _("(domain_cleanup)"), &ctxt)))
+        goto cleanup;
+
+    if (VIR_ALLOC(cleanup) < 0)
+        goto cleanup;
+
+    if (virXPathUInt("string(./@flags)", ctxt, &cleanup->flags) < 0 ||
+        !(reattach = virXPathString("string(./@reattach)", ctxt)) ||
+        !(node = virXPathNode("./domain", ctxt))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed domain cleanup record"));
+        goto cleanup;
+    }
+
+    cleanup->reattach = STREQ(reattach, "yes");
+    cleanup->machineName = virXPathString("string(./machineName)", ctxt);
+
+    if (!(cleanup->def = virDomainDefParseNode(doc, node, caps,
+                                               driver->xmlopt, NULL,
+                                               VIR_DOMAIN_DEF_PARSE_STATUS |
+                                               VIR_DOMAIN_DEF_PARSE_ACTUAL_NET |
+                                               VIR_DOMAIN_DEF_PARSE_PCI_ORIG_STATES |
+                                               VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
+                                               VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE)))
+        goto cleanup;
+
+    VIR_STEAL_PTR(ret, cleanup);
+
+ cleanup:
+    qemuProcessStopCleanupFree(cleanup);
+    VIR_FREE(reattach);
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+    virObjectUnref(caps);
+    return ret;
+}
+
+
+/*
+ * Copy the state of @vm the cleanup needs and record it. The cgroup
+ * of @vm is taken over only once nothing can fail anymore, so the
+ * caller cleans up by itself if NULL is returned.
+ */
+static qemuProcessStopCleanupPtr
+qemuProcessStopCleanupNew(virQEMUDriverPtr driver,
+                          virDomainObjPtr vm,
+                          unsigned int flags)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuProcessStopCleanupPtr cleanup = NULL;
+    char *xml = NULL;
+    char *record = NULL;
+    bool reattach = true;
+    size_t i;
+
+    /* The network driver hands interfaces of type hostdev out to other
+     * domains as soon as they are released, give them back first */
+    for (i = 0; i < vm->def->nnets; i++) {
+        if (virDomainNetGetActualType(vm->def->nets[i]) ==
+            VIR_DOMAIN_NET_TYPE_HOSTDEV)
+            reattach = false;
+    }
+
+    if (!(xml = qemuProcessStopCleanupFormat(driver, vm->def,
+                                             priv->cgroup ? priv->machineName : NULL,
+                                             reattach, flags)) ||
+        !(cleanup = qemuProcessStopCleanupParse(driver, xml)))
+        goto error;
+
+    if (!(record = qemuProcessStopCleanupRecordPath(cfg, vm->def->uuid)) ||
+        virFileRewriteStr(record, S_IRUSR | S_IWUSR, xml) < 0)
+        goto error;
+
+    VIR_STEAL_PTR(cleanup->record, record);
+    if (priv->cgroup) {
+        VIR_STEAL_PTR(cleanup->cgroup, priv->cgroup);
+        VIR_FREE(priv->machineName);
+    }
+
+    VIR_FREE(xml);
+    virObjectUnref(cfg);
+    return cleanup;
+
+ error:
+    VIR_WARN("Unable to defer the cleanup of domain %s, doing it now",
+             vm->def->name);
+    qemuProcessStopCleanupFree(cleanup);
+    VIR_FREE(record);
+    VIR_FREE(xml);
+    virObjectUnref(cfg);
+    return NULL;
+}
+
+
+static void
+qemuProcessStopCleanupRun(virQEMUDriverPtr driver,
+                          qemuProcessStopCleanupPtr cleanup)
+{
+    virDomainDefPtr def = cleanup->def;
+    int ret;
+    int retries = 0;
+
+    VIR_DEBUG("Cleaning up after domain %s, flags=%x, reattach=%d",
+              def->name, cleanup->flags, cleanup->reattach);
+
+    /* qemuSecurityRestoreAllLabel needs the domain object, but does
+     * nothing more than this without a running process anyway */
+    if (!(cleanup->flags & VIR_QEMU_PROCESS_STOP_NO_RELABEL))
+        virSecurityManagerRestoreAllLabel(driver->securityManager, def,
+                                          !!(cleanup->flags & VIR_QEMU_PROCESS_STOP_MIGRATED));
+
+    qemuSecurityReleaseLabel(driver->securityManager, def);
+
+    if (cleanup->reattach)
+        qemuHostdevReAttachDomainDevices(driver, def);
+
+    if (cleanup->machineName &&
+        virCgroupTerminateMachine(cleanup->machineName) < 0) {
+        if (!virCgroupNewIgnoreError())
+            VIR_DEBUG("Failed to terminate cgroup for %s", def->name);
+    }
+
+ retry:
+    if (cleanup->cgroup &&
+        (ret = virCgroupRemove(cleanup->cgroup)) < 0) {
+        if (ret == -EBUSY && (retries++ < 5)) {
+            usleep(200*1000);
+            goto retry;
+        }
+        VIR_WARN("Failed to remove cgroup for %s", def->name);
+    }
+}
+
+
+static void
+qemuProcessStopCleanupDone(virQEMUDriverPtr driver,
+                           qemuProcessStopCleanupPtr cleanup)
+{
+    size_t i;
+
+    if (cleanup->record && unlink(cleanup->record) < 0 && errno != ENOENT)
+        VIR_WARN("Failed to remove cleanup record %s", cleanup->record);
+
+    virMutexLock(&driver->cleanupLock);
+    for (i = 0; i < driver->ncleanups; i++) {
+        if (driver->cleanups[i] == cleanup) {
+            VIR_DELETE_ELEMENT(driver->cleanups, i, driver->ncleanups);
+            break;
+        }
+    }
+    virCondBroadcast(&driver->cleanupCond);
+    virMutexUnlock(&driver->cleanupLock);
+
+    qemuProcessStopCleanupFree(cleanup);
+}
+
+
+void
+qemuProcessStopCleanupWorker(void *data,
+                             void *opaque)
+{
+    virQEMUDriverPtr driver = opaque;
+    qemuProcessStopCleanupPtr cleanup = data;
+
+    qemuProcessStopCleanupRun(driver, cleanup);
+    qemuProcessStopCleanupDone(driver, cleanup);
+}
+
+
+/* Hand @cleanup over to cleanupPool, or run it right away if that fails */
+static void
+qemuProcessStopCleanupQueue(virQEMUDriverPtr driver,
+                            qemuProcessStopCleanupPtr cleanup)
+{
+    if (!driver->cleanupPool)
+        goto error;
+
+    virMutexLock(&driver->cleanupLock);
+    if (VIR_APPEND_ELEMENT_COPY(driver->cleanups, driver->ncleanups,
+                                cleanup) < 0) {
+        virMutexUnlock(&driver->cleanupLock);
+        goto error;
+    }
+    virMutexUnlock(&driver->cleanupLock);
+
+    if (virThreadPoolSendJob(driver->cleanupPool, 0, cleanup) < 0)
+        goto error;
+
+    return;
+
+ error:
+    qemuProcessStopCleanupRun(driver, cleanup);
+    qemuProcessStopCleanupDone(driver, cleanup);
+}
+
+
+/* Whether @cleanup could undo the setup of @disks or @hostdevs */
+static bool
+qemuProcessStopCleanupConflictsDevices(qemuProcessStopCleanupPtr cleanup,
+                                       virDomainDiskDefPtr *disks,
+                                       size_t ndisks,
+                                       virDomainHostdevDefPtr *hostdevs,
+                                       size_t nhostdevs)
+{
+    size_t i, j;
+
+    for (i = 0; i < ndisks; i++) {
+        const char *src = virDomainDiskGetSource(disks[i]);
+
+        if (!src)
+            continue;
+
+        for (j = 0; j < cleanup->def->ndisks; j++) {
+            if (STREQ_NULLABLE(src,
+                               virDomainDiskGetSource(cleanup->def->disks[j])))
+                return true;
+        }
+    }
+
+    if (cleanup->reattach) {
+        for (i = 0; i < nhostdevs; i++) {
+            if (virDomainHostdevFind(cleanup->def, hostdevs[i], NULL) >= 0)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+
+bool
+qemuProcessStopCleanupConflicts(qemuProcessStopCleanupPtr cleanup,
+                                virDomainDefPtr def)
+{
+    if (!memcmp(cleanup->def->uuid, def->uuid, VIR_UUID_BUFLEN))
+        return true;
+
+    return qemuProcessStopCleanupConflictsDevices(cleanup,
+                                                  def->disks, def->ndisks,
+                                                  def->hostdevs, def->nhostdevs);
+}
+
+
+/*
+ * Wait until no cleanup of a stopped domain is left which could undo
+ * the setup of @disks and @hostdevs of @vm, or unless @self is false,
+ * of @vm itself. Called with @vm locked, the cleanups do not lock any
+ * domain.
+ */
+static void
+qemuProcessStopCleanupWaitDevices(virQEMUDriverPtr driver,
+                                  virDomainObjPtr vm,
+                                  bool self,
+                                  virDomainDiskDefPtr *disks,
+                                  size_t ndisks,
+                                  virDomainHostdevDefPtr *hostdevs,
+                                  size_t nhostdevs)
+{
+    qemuProcessStopCleanupPtr cleanup;
+    size_t i;
+
+    virMutexLock(&driver->cleanupLock);
+ retry:
+    for (i = 0; i < driver->ncleanups; i++) {
+        cleanup = driver->cleanups[i];
+
+        if ((self &&
+             !memcmp(cleanup->def->uuid, vm->def->uuid, VIR_UUID_BUFLEN)) ||
+            qemuProcessStopCleanupConflictsDevices(cleanup, disks, ndisks,
+                                                   hostdevs, nhostdevs)) {
+            VIR_DEBUG("Waiting for the cleanup of domain %s for %s",
+                      cleanup->def->name, vm->def->name);
+            if (virCondWait(&driver->cleanupCond, &driver->cleanupLock) < 0) {
+                VIR_WARN("Unable to wait for the cleanup of stopped domains");
+                break;
+            }
+            goto retry;
+        }
+    }
+    virMutexUnlock(&driver->cleanupLock);
+}
+
+
+/* Wait for the cleanups which could undo the setup of @vm, see
+ * qemuProcessStopCleanupWaitDevices */
+static void
+qemuProcessStopCleanupWait(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm)
+{
+    qemuProcessStopCleanupWaitDevices(driver, vm, true,
+                                      vm->def->disks, vm->def->ndisks,
+                                      vm->def->hostdevs, vm->def->nhostdevs);
+}
+
+
+/* Wait for the cleanups which could undo the setup of @dev when it is
+ * attached to the running domain @vm */
+void
+qemuProcessStopCleanupWaitDevice(virQEMUDriverPtr driver,
+                                 virDomainObjPtr vm,
+                                 virDomainDeviceDefPtr dev)
+{
+    switch ((virDomainDeviceType) dev->type) {
+    case VIR_DOMAIN_DEVICE_DISK:
+        qemuProcessStopCleanupWaitDevices(driver, vm, false,
+                                          &dev->data.disk, 1, NULL, 0);
+        break;
+
+    case VIR_DOMAIN_DEVICE_HOSTDEV:
+        qemuProcessStopCleanupWaitDevices(driver, vm, false,
+                                          NULL, 0, &dev->data.hostdev, 1);
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+/*
+ * Queue the cleanups recorded by a previous instance of the daemon
+ * which did not get to finish them.
+ */
+int
+qemuProcessStopCleanupRecover(virQEMUDriverPtr driver)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    DIR *dir = NULL;
+    struct dirent *entry;
+    char *dirPath = NULL;
+    char *path = NULL;
+    char *xml = NULL;
+    qemuProcessStopCleanupPtr cleanup;
+    int rc;
+    int ret = -1;
+
+    if (virAsprintf(&dirPath, "%s/cleanup", cfg->stateDir) < 0)
+        goto cleanup;
+
+    if (virFileMakePathWithMode(dirPath, S_IRWXU) < 0) {
+        virReportSystemError(errno, _("cannot create directory '%s'"),
+                             dirPath);
+        goto cleanup;
+    }
+
+    if (virDirOpen(&dir, dirPath) < 0)
+        goto cleanup;
+
+    while ((rc = virDirRead(dir, &entry, dirPath)) > 0) {
+        if (!virFileHasSuffix(entry->d_name, ".xml"))
+            continue;
+
+        if (virAsprintf(&path, "%s/%s", dirPath, entry->d_name) < 0)
+            goto cleanup;
+
+        if (virFileReadAll(path, INT_MAX, &xml) < 0 ||
+            !(cleanup = qemuProcessStopCleanupParse(driver, xml))) {
+            VIR_WARN("Dropping unreadable cleanup record %s", path);
+            virResetLastError();
+            unlink(path);
+            VIR_FREE(path);
+            VIR_FREE(xml);
+            continue;
+        }
+        VIR_FREE(xml);
+
+        VIR_DEBUG("Finishing the cleanup of domain %s", cleanup->def->name);
+        VIR_STEAL_PTR(cleanup->record, path);
+
+        /* Reattaching only gives back the devices the manager knows */
+        if (cleanup->reattach &&
+            qemuHostdevUpdateActiveDomainDevices(driver, cleanup->def) < 0) {
+            VIR_WARN("Unable to mark the host devices of %s active",
+                     cleanup->def->name);
+            virResetLastError();
+        }
+
+        qemuProcessStopCleanupQueue(driver, cleanup);
+    }
+
+    if (rc < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_DIR_CLOSE(dir);
+    VIR_FREE(dirPath);
+    VIR_FREE(path);
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
 /**
  * qemuProcessInit:
  *
@@ -4863,10 +5793,10 @@ qemuProcessInit(virQEMUDriverPtr driver,
 
     VIR_DEBUG("Determining emulator version");
     virObjectUnref(priv->qemuCaps);
-    if (!(priv->qemuCaps = virQEMUCapsCacheLookupCopy(caps,
-                                                      driver->qemuCapsCache,
-                                                      vm->def->emulator,
-                                                      vm->def->os.machine)))
+    if (!(priv->qemuCaps = virQEMUCapsCacheLookupMachine(caps,
+                                                         driver->qemuCapsCache,
+                                                         vm->def->emulator,
+                                                         vm->def->os.machine)))
         goto cleanup;
 
     if (qemuProcessStartValidate(driver, vm, priv->qemuCaps, caps, flags) < 0)
@@ -4886,6 +5816,8 @@ qemuProcessInit(virQEMUDriverPtr driver,
             goto cleanup;
         }
     } else {
+        qemuProcessStopCleanupWait(driver, vm);
+
         vm->def->id = qemuDriverAllocateID(driver);
         qemuDomainSetFakeReboot(driver, vm, false);
         virDomainObjSetState(vm, VIR_DOMAIN_PAUSED, VIR_DOMAIN_PAUSED_STARTING_UP);
@@ -4894,13 +5826,17 @@ qemuProcessInit(virQEMUDriverPtr driver,
             driver->inhibitCallback(true, driver->inhibitOpaque);
 
         /* Run an early hook to set-up missing devices */
-        if (qemuProcessStartHook(driver, vm,
-                                 VIR_HOOK_QEMU_OP_PREPARE,
-                                 VIR_HOOK_SUBOP_BEGIN) < 0)
+        if (qemuProcessRunHook(driver, vm,
+                               VIR_HOOK_QEMU_OP_PREPARE,
+                               VIR_HOOK_SUBOP_BEGIN) < 0)
             goto stop;
 
         if (qemuDomainSetPrivatePaths(driver, vm) < 0)
             goto stop;
+
+        /* Fail early rather than when QEMU runs out of huge pages */
+        if (qemuDomainReserveHugepages(driver, vm, false) < 0)
+            goto stop;
     }
 
     ret = 0;
@@ -4923,7 +5859,8 @@ qemuProcessInit(virQEMUDriverPtr driver,
  * qemuProcessNetworkPrepareDevices
  */
 static int
-qemuProcessNetworkPrepareDevices(virDomainDefPtr def)
+qemuProcessNetworkPrepareDevices(virDomainDefPtr def,
+                                 virQEMUCapsPtr qemuCaps)
 {
     int ret = -1;
     size_t i;
@@ -4939,6 +5876,8 @@ qemuProcessNetworkPrepareDevices(virDomainDefPtr def)
         if (networkAllocateActualDevice(def, net) < 0)
             goto cleanup;
 
+        qemuDomainNetPrepareAutoQueues(def, net, qemuCaps);
+
         actualType = virDomainNetGetActualType(net);
         if (actualType == VIR_DOMAIN_NET_TYPE_HOSTDEV &&
             net->type == VIR_DOMAIN_NET_TYPE_NETWORK) {
@@ -5190,7 +6129,8 @@ qemuProcessSetupHotpluggableVcpus(virQEMUDriverPtr driver,
     qemuCgroupEmulatorAllNodesDataPtr emulatorCgroup = NULL;
     virDomainVcpuDefPtr vcpu;
     qemuDomainVcpuPrivatePtr vcpupriv;
-    virJSONValuePtr vcpuprops = NULL;
+    virJSONValuePtr *vcpuprops = NULL;
+    bool *added = NULL;
     size_t i;
     int ret = -1;
     int rc;
@@ -5223,33 +6163,39 @@ qemuProcessSetupHotpluggableVcpus(virQEMUDriverPtr driver,
     if (qemuCgroupEmulatorAllNodesAllow(priv->cgroup, &emulatorCgroup) < 0)
         goto cleanup;
 
-    for (i = 0; i < nbootHotplug; i++) {
-        vcpu = bootHotplug[i];
-
-        if (!(vcpuprops = qemuBuildHotpluggableCPUProps(vcpu)))
-            goto cleanup;
+    if (VIR_ALLOC_N(vcpuprops, nbootHotplug) < 0 ||
+        VIR_ALLOC_N(added, nbootHotplug) < 0)
+        goto cleanup;
 
-        if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+    for (i = 0; i < nbootHotplug; i++) {
+        if (!(vcpuprops[i] = qemuBuildHotpluggableCPUProps(bootHotplug[i])))
             goto cleanup;
+    }
 
-        rc = qemuMonitorAddDeviceArgs(qemuDomainGetMonitor(vm), vcpuprops);
-        vcpuprops = NULL;
+    /* QEMU executes the batch in order, thus the sorting is kept */
+    if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+        goto cleanup;
 
-        if (qemuDomainObjExitMonitor(driver, vm) < 0)
-            goto cleanup;
+    rc = qemuMonitorAddDevicesArgs(qemuDomainGetMonitor(vm),
+                                   vcpuprops, nbootHotplug, added);
 
-        if (rc < 0)
-            goto cleanup;
+    if (qemuDomainObjExitMonitor(driver, vm) < 0)
+        goto cleanup;
 
-        virJSONValueFree(vcpuprops);
-    }
+    if (rc < 0)
+        goto cleanup;
 
     ret = 0;
 
  cleanup:
     qemuCgroupEmulatorAllNodesRestore(emulatorCgroup);
+    if (vcpuprops) {
+        for (i = 0; i < nbootHotplug; i++)
+            virJSONValueFree(vcpuprops[i]);
+    }
+    VIR_FREE(vcpuprops);
+    VIR_FREE(added);
     VIR_FREE(bootHotplug);
-    virJSONValueFree(vcpuprops);
     return ret;
 }
 
@@ -5401,6 +6347,11 @@ qemuProcessPrepareDomain(virConnectPtr conn,
     if (qemuAssignDeviceAliases(vm->def, priv->qemuCaps) < 0)
         goto cleanup;
 
+    VIR_DEBUG("Resolving automatic iothread and queue placement");
+    if (qemuDomainPrepareAutoPlacement(vm->def, priv->qemuCaps, caps,
+                                       priv->autoCpuset) < 0)
+        goto cleanup;
+
     VIR_DEBUG("Setting graphics devices");
     if (qemuProcessSetupGraphics(driver, vm, flags) < 0)
         goto cleanup;
@@ -5479,7 +6430,7 @@ qemuProcessPrepareHost(virQEMUDriverPtr driver,
      * will need to be setup.
      */
     VIR_DEBUG("Preparing network devices");
-    if (qemuProcessNetworkPrepareDevices(vm->def) < 0)
+    if (qemuProcessNetworkPrepareDevices(vm->def, priv->qemuCaps) < 0)
         goto cleanup;
 
     /* Must be run before security labelling */
@@ -5548,6 +6499,74 @@ qemuProcessPrepareHost(virQEMUDriverPtr driver,
 }
 
 
+struct qemuProcessLabelData {
+    virQEMUDriverPtr driver;
+    virDomainObjPtr vm;
+    const char *stdin_path;
+
+    bool started;
+    bool running;
+    virThread thread;
+    int ret;
+    virErrorPtr err;
+};
+
+
+static void
+qemuProcessSetAllLabelWorker(void *opaque)
+{
+    struct qemuProcessLabelData *data = opaque;
+
+    if ((data->ret = qemuSecuritySetAllLabel(data->driver, data->vm,
+                                             data->stdin_path)) < 0)
+        data->err = virSaveLastError();
+}
+
+
+/*
+ * Labelling the devices of a domain may take long, e.g. for images on
+ * network file systems or when the AppArmor profile is loaded. Since it
+ * only reads the domain definition, it runs in a separate thread while
+ * the caller, holding the domain lock, sets up the cgroups and tuning of
+ * the emulator.
+ */
+static void
+qemuProcessSetAllLabelStart(struct qemuProcessLabelData *data)
+{
+    data->started = true;
+
+    if (virThreadCreate(&data->thread, true,
+                        qemuProcessSetAllLabelWorker, data) < 0) {
+        VIR_DEBUG("Unable to create labelling thread, labelling in place: %s",
+                  virGetLastErrorMessage());
+        virResetLastError();
+        qemuProcessSetAllLabelWorker(data);
+        return;
+    }
+
+    data->running = true;
+}
+
+
+/* Returns the result of qemuSecuritySetAllLabel, reporting its error */
+static int
+qemuProcessSetAllLabelFinish(struct qemuProcessLabelData *data)
+{
+    if (data->running) {
+        virThreadJoin(&data->thread);
+        data->running = false;
+    }
+
+    if (data->ret < 0 && data->err) {
+        virSetError(data->err);
+        virFreeError(data->err);
+        data->err = NULL;
+    }
+
+    return data->ret;
+}
+
+
 /**
  * qemuProcessLaunch:
  *
@@ -5582,8 +6601,11 @@ qemuProcessLaunch(virConnectPtr conn,
     virCapsPtr caps = NULL;
     size_t nnicindexes = 0;
     int *nicindexes = NULL;
+    struct qemuProcessLabelData labelData;
     size_t i;
 
+    memset(&labelData, 0, sizeof(labelData));
+
     VIR_DEBUG("vm=%p name=%s id=%d asyncJob=%d "
               "incoming.launchURI=%s incoming.deferredURI=%s "
               "incoming.fd=%d incoming.path=%s "
@@ -5637,9 +6659,9 @@ qemuProcessLaunch(virConnectPtr conn,
         virCommandPassFD(cmd, incoming->fd, 0);
 
     /* now that we know it is about to start call the hook if present */
-    if (qemuProcessStartHook(driver, vm,
-                             VIR_HOOK_QEMU_OP_START,
-                             VIR_HOOK_SUBOP_BEGIN) < 0)
+    if (qemuProcessRunHook(driver, vm,
+                           VIR_HOOK_QEMU_OP_START,
+                           VIR_HOOK_SUBOP_BEGIN) < 0)
         goto cleanup;
 
     qemuLogOperation(vm, "starting up", cmd, logCtxt);
@@ -5700,7 +6722,7 @@ qemuProcessLaunch(virConnectPtr conn,
     }
 
     VIR_DEBUG("Writing early domain status to disk");
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         goto cleanup;
 
     VIR_DEBUG("Waiting for handshake from child");
@@ -5711,6 +6733,12 @@ qemuProcessLaunch(virConnectPtr conn,
         goto cleanup;
     }
 
+    VIR_DEBUG("Setting domain security labels");
+    labelData.driver = driver;
+    labelData.vm = vm;
+    labelData.stdin_path = incoming ? incoming->path : NULL;
+    qemuProcessSetAllLabelStart(&labelData);
+
     VIR_DEBUG("Setting up domain cgroup (if required)");
     if (qemuSetupCgroup(driver, vm, nnicindexes, nicindexes) < 0)
         goto cleanup;
@@ -5734,10 +6762,8 @@ qemuProcessLaunch(virConnectPtr conn,
     if (qemuProcessSetupEmulator(vm) < 0)
         goto cleanup;
 
-    VIR_DEBUG("Setting domain security labels");
-    if (qemuSecuritySetAllLabel(driver,
-                                vm,
-                                incoming ? incoming->path : NULL) < 0)
+    VIR_DEBUG("Waiting for domain security labels");
+    if (qemuProcessSetAllLabelFinish(&labelData) < 0)
         goto cleanup;
 
     /* Security manager labeled all devices, therefore
@@ -5858,6 +6884,9 @@ qemuProcessLaunch(virConnectPtr conn,
         qemuProcessRefreshBalloonState(driver, vm, asyncJob) < 0)
         goto cleanup;
 
+    if (qemuProcessSetupBalloonStats(driver, vm) < 0)
+        goto cleanup;
+
     VIR_DEBUG("Detecting actual memory size for video device");
     if (qemuProcessUpdateVideoRamSize(driver, vm, asyncJob) < 0)
         goto cleanup;
@@ -5873,6 +6902,15 @@ qemuProcessLaunch(virConnectPtr conn,
     ret = 0;
 
  cleanup:
+    if (labelData.running) {
+        virThreadJoin(&labelData.thread);
+        labelData.running = false;
+    }
+    /* The labels have to be restored even if something else failed
+     * while they were being set */
+    if (ret == -1 && labelData.started && labelData.ret == 0)
+        ret = -2;
+    virFreeError(labelData.err);
     qemuDomainSecretDestroy(vm);
     virCommandFree(cmd);
     qemuDomainLogContextFree(logCtxt);
@@ -5896,7 +6934,6 @@ qemuProcessFinishStartup(virConnectPtr conn,
                          bool startCPUs,
                          virDomainPausedReason pausedReason)
 {
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     int ret = -1;
 
     if (startCPUs) {
@@ -5914,18 +6951,17 @@ qemuProcessFinishStartup(virConnectPtr conn,
     }
 
     VIR_DEBUG("Writing domain status to disk");
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         goto cleanup;
 
-    if (qemuProcessStartHook(driver, vm,
-                             VIR_HOOK_QEMU_OP_STARTED,
-                             VIR_HOOK_SUBOP_BEGIN) < 0)
+    if (qemuProcessRunHook(driver, vm,
+                           VIR_HOOK_QEMU_OP_STARTED,
+                           VIR_HOOK_SUBOP_BEGIN) < 0)
         goto cleanup;
 
     ret = 0;
 
  cleanup:
-    virObjectUnref(cfg);
     return ret;
 }
 
@@ -6154,6 +7190,8 @@ void qemuProcessStop(virQEMUDriverPtr driver,
     virNetDevVPortProfilePtr vport = NULL;
     size_t i;
     char *timestamp;
+    qemuProcessStopCleanupPtr deferred;
+    bool reattach = true;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     VIR_DEBUG("Shutting down vm=%p name=%s id=%d pid=%lld, "
@@ -6187,6 +7225,11 @@ void qemuProcessStop(virQEMUDriverPtr driver,
 
     vm->def->id = -1;
 
+    qemuDomainStatsCacheClear(priv);
+    qemuDomainStatsEventClear(priv);
+    qemuDomainBalloonStatsClear(priv);
+    qemuDomainBlockThresholdsClear(priv);
+
     if (virAtomicIntDecAndTest(&driver->nactive) && driver->inhibitCallback)
         driver->inhibitCallback(false, driver->inhibitOpaque);
 
@@ -6220,6 +7263,8 @@ void qemuProcessStop(virQEMUDriverPtr driver,
     virPortAllocatorRelease(driver->migrationPorts, priv->nbdPort);
     priv->nbdPort = 0;
 
+    qemuDomainReleaseHugepages(driver, vm);
+
     if (priv->agent) {
         qemuAgentClose(priv->agent);
         priv->agent = NULL;
@@ -6259,27 +7304,35 @@ void qemuProcessStop(virQEMUDriverPtr driver,
 
     qemuDomainCleanupRun(driver, vm);
 
+    qemuBackupProcessStop(driver, vm);
+
+    qemuDomainBlockJobGroupFree(priv->blockJobGroup);
+    priv->blockJobGroup = NULL;
+
     /* Stop autodestroy in case guest is restarted */
     qemuProcessAutoDestroyRemove(driver, vm);
 
     /* now that we know it's stopped call the hook if present */
-    if (virHookPresent(VIR_HOOK_DRIVER_QEMU)) {
-        char *xml = qemuDomainDefFormatXML(driver, vm->def, 0);
+    /* we can't stop the operation even if the script raised an error */
+    ignore_value(qemuProcessRunHook(driver, vm,
+                                    VIR_HOOK_QEMU_OP_STOPPED,
+                                    VIR_HOOK_SUBOP_END));
+
+    /* Leave the slow parts of the cleanup to cleanupPool, which takes
+     * over the cgroup and works on a copy of the definition from here */
+    if (driver->cleanupPool &&
+        (deferred = qemuProcessStopCleanupNew(driver, vm, flags))) {
+        reattach = !deferred->reattach;
+        qemuProcessStopCleanupQueue(driver, deferred);
+    } else {
+        /* Reset Security Labels unless caller don't want us to */
+        if (!(flags & VIR_QEMU_PROCESS_STOP_NO_RELABEL))
+            qemuSecurityRestoreAllLabel(driver, vm,
+                                        !!(flags & VIR_QEMU_PROCESS_STOP_MIGRATED));
 
-        /* we can't stop the operation even if the script raised an error */
-        ignore_value(virHookCall(VIR_HOOK_DRIVER_QEMU, vm->def->name,
-                                 VIR_HOOK_QEMU_OP_STOPPED, VIR_HOOK_SUBOP_END,
-                                 NULL, xml, NULL));
-        VIR_FREE(xml);
+        qemuSecurityReleaseLabel(driver->securityManager, vm->def);
     }
 
-    /* Reset Security Labels unless caller don't want us to */
-    if (!(flags & VIR_QEMU_PROCESS_STOP_NO_RELABEL))
-        qemuSecurityRestoreAllLabel(driver, vm,
-                                    !!(flags & VIR_QEMU_PROCESS_STOP_MIGRATED));
-
-    qemuSecurityReleaseLabel(driver->securityManager, vm->def);
-
     for (i = 0; i < vm->def->ndisks; i++) {
         virDomainDeviceDef dev;
         virDomainDiskDefPtr disk = vm->def->disks[i];
@@ -6299,7 +7352,8 @@ void qemuProcessStop(virQEMUDriverPtr driver,
     virStringListFree(priv->qemuDevices);
     priv->qemuDevices = NULL;
 
-    qemuHostdevReAttachDomainDevices(driver, vm->def);
+    if (reattach)
+        qemuHostdevReAttachDomainDevices(driver, vm->def);
 
     def = vm->def;
     for (i = 0; i < def->nnets; i++) {
@@ -6434,15 +7488,10 @@ void qemuProcessStop(virQEMUDriverPtr driver,
     VIR_FREE(priv->pidfile);
 
     /* The "release" hook cleans up additional resources */
-    if (virHookPresent(VIR_HOOK_DRIVER_QEMU)) {
-        char *xml = qemuDomainDefFormatXML(driver, vm->def, 0);
-
-        /* we can't stop the operation even if the script raised an error */
-        virHookCall(VIR_HOOK_DRIVER_QEMU, vm->def->name,
-                    VIR_HOOK_QEMU_OP_RELEASE, VIR_HOOK_SUBOP_END,
-                    NULL, xml, NULL);
-        VIR_FREE(xml);
-    }
+    /* we can't stop the operation even if the script raised an error */
+    ignore_value(qemuProcessRunHook(driver, vm,
+                                    VIR_HOOK_QEMU_OP_RELEASE,
+                                    VIR_HOOK_SUBOP_END));
 
     virDomainObjRemoveTransientDef(vm);
 
@@ -6542,7 +7591,7 @@ int qemuProcessAttach(virConnectPtr conn ATTRIBUTE_UNUSED,
                                         vm->pid, seclabel) < 0)
             goto error;
 
-        if (VIR_STRDUP(seclabeldef->model, model) < 0)
+        if (virStringIntern(&seclabeldef->model, model) < 0)
             goto error;
 
         if (VIR_STRDUP(seclabeldef->label, seclabel->label) < 0)
@@ -6571,10 +7620,10 @@ int qemuProcessAttach(virConnectPtr conn ATTRIBUTE_UNUSED,
 
     VIR_DEBUG("Determining emulator version");
     virObjectUnref(priv->qemuCaps);
-    if (!(priv->qemuCaps = virQEMUCapsCacheLookupCopy(caps,
-                                                      driver->qemuCapsCache,
-                                                      vm->def->emulator,
-                                                      vm->def->os.machine)))
+    if (!(priv->qemuCaps = virQEMUCapsCacheLookupMachine(caps,
+                                                         driver->qemuCapsCache,
+                                                         vm->def->emulator,
+                                                         vm->def->os.machine)))
         goto error;
 
     VIR_DEBUG("Preparing monitor state");
@@ -6651,7 +7700,7 @@ int qemuProcessAttach(virConnectPtr conn ATTRIBUTE_UNUSED,
     }
 
     VIR_DEBUG("Writing domain status to disk");
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         goto error;
 
     /* Run an hook to allow admins to do some magic */
@@ -40,6 +40,7 @@ int qemuProcessStopCPUs(virQEMUDriverPtr driver,
 
 void qemuProcessAutostartAll(virQEMUDriverPtr driver);
 void qemuProcessReconnectAll(virConnectPtr conn, virQEMUDriverPtr driver);
+void qemuProcessReconnectWorker(void *jobdata, void *opaque);
 
 typedef struct _qemuProcessIncomingDef qemuProcessIncomingDef;
 typedef qemuProcessIncomingDef *qemuProcessIncomingDefPtr;
@@ -136,6 +137,13 @@ void qemuProcessStop(virQEMUDriverPtr driver,
                      qemuDomainAsyncJob asyncJob,
                      unsigned int flags);
 
+void qemuProcessStopCleanupWorker(void *data,
+                                  void *opaque);
+int qemuProcessStopCleanupRecover(virQEMUDriverPtr driver);
+void qemuProcessStopCleanupWaitDevice(virQEMUDriverPtr driver,
+                                      virDomainObjPtr vm,
+                                      virDomainDeviceDefPtr dev);
+
 int qemuProcessAttach(virConnectPtr conn,
                       virQEMUDriverPtr driver,
                       virDomainObjPtr vm,
@@ -187,6 +195,11 @@ int qemuProcessRefreshBalloonState(virQEMUDriverPtr driver,
                                    virDomainObjPtr vm,
                                    int asyncJob);
 
+void qemuProcessQueueBalloonStats(virQEMUDriverPtr driver,
+                                  virDomainObjPtr vm);
+int qemuProcessSetupBalloonStats(virQEMUDriverPtr driver,
+                                 virDomainObjPtr vm);
+
 int qemuProcessRefreshDisks(virQEMUDriverPtr driver,
                             virDomainObjPtr vm,
                             qemuDomainAsyncJob asyncJob);
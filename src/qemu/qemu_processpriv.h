@@ -24,6 +24,8 @@
 
 # include "domain_conf.h"
 # include "qemu_monitor.h"
+# include "qemu_conf.h"
+# include "vircgroup.h"
 
 /*
  * This header file should never be used outside unit tests.
@@ -34,4 +36,33 @@ int qemuProcessHandleDeviceDeleted(qemuMonitorPtr mon,
                                    const char *devAlias,
                                    void *opaque);
 
+/*
+ * The parts of qemuProcessStop which may take long, but which no longer
+ * need the domain object: restoring security labels, reattaching host
+ * devices and removing the cgroup. They run on a copy of the live
+ * definition in cleanupPool, so stopping many domains at once does not
+ * serialize on them. Each pending cleanup is recorded in the cleanup
+ * directory of stateDir, so that a restarted daemon finishes it.
+ */
+struct _qemuProcessStopCleanup {
+    virDomainDefPtr def;
+    unsigned int flags;     /* VIR_QEMU_PROCESS_STOP_* */
+    bool reattach;          /* host devices are left to reattach */
+    char *machineName;      /* NULL if there was no cgroup */
+    virCgroupPtr cgroup;    /* NULL when read back from a record */
+    char *record;
+};
+
+void qemuProcessStopCleanupFree(qemuProcessStopCleanupPtr cleanup);
+char *qemuProcessStopCleanupFormat(virQEMUDriverPtr driver,
+                                   virDomainDefPtr def,
+                                   const char *machineName,
+                                   bool reattach,
+                                   unsigned int flags);
+qemuProcessStopCleanupPtr
+qemuProcessStopCleanupParse(virQEMUDriverPtr driver,
+                            const char *xml);
+bool qemuProcessStopCleanupConflicts(qemuProcessStopCleanupPtr cleanup,
+                                     virDomainDefPtr def);
+
 #endif /* __QEMU_PROCESSPRIV_H__ */
@@ -26,6 +26,7 @@
 #include "qemu_domain.h"
 #include "qemu_security.h"
 #include "virlog.h"
+#include "virtrace.h"
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
 
@@ -37,10 +38,17 @@ qemuSecuritySetAllLabel(virQEMUDriverPtr driver,
                         virDomainObjPtr vm,
                         const char *stdin_path)
 {
+    int span = virTraceSpanBegin(__FUNCTION__);
     int ret = -1;
+    pid_t pid = -1;
 
-    if (qemuDomainNamespaceEnabled(vm, QEMU_DOMAIN_NS_MOUNT) &&
-        virSecurityManagerTransactionStart(driver->securityManager) < 0)
+    /* Labelling the whole domain is done in a transaction even without
+     * a namespace so that the paths are deduplicated and relabelled in
+     * parallel. */
+    if (qemuDomainNamespaceEnabled(vm, QEMU_DOMAIN_NS_MOUNT))
+        pid = vm->pid;
+
+    if (virSecurityManagerTransactionStart(driver->securityManager) < 0)
         goto cleanup;
 
     if (virSecurityManagerSetAllLabel(driver->securityManager,
@@ -48,14 +56,14 @@ qemuSecuritySetAllLabel(virQEMUDriverPtr driver,
                                       stdin_path) < 0)
         goto cleanup;
 
-    if (qemuDomainNamespaceEnabled(vm, QEMU_DOMAIN_NS_MOUNT) &&
-        virSecurityManagerTransactionCommit(driver->securityManager,
-                                            vm->pid) < 0)
+    if (virSecurityManagerTransactionCommit(driver->securityManager,
+                                            pid) < 0)
         goto cleanup;
 
     ret = 0;
  cleanup:
     virSecurityManagerTransactionAbort(driver->securityManager);
+    virTraceSpanEnd(span);
     return ret;
 }
 
@@ -65,6 +73,8 @@ qemuSecurityRestoreAllLabel(virQEMUDriverPtr driver,
                             virDomainObjPtr vm,
                             bool migrated)
 {
+    int span = virTraceSpanBegin(__FUNCTION__);
+
     /* In contrast to qemuSecuritySetAllLabel, do not use
      * secdriver transactions here. This function is called from
      * qemuProcessStop() which is meant to do cleanup after qemu
@@ -74,6 +84,7 @@ qemuSecurityRestoreAllLabel(virQEMUDriverPtr driver,
     virSecurityManagerRestoreAllLabel(driver->securityManager,
                                       vm->def,
                                       migrated);
+    virTraceSpanEnd(span);
 }
 
 
@@ -82,6 +93,7 @@ qemuSecuritySetDiskLabel(virQEMUDriverPtr driver,
                          virDomainObjPtr vm,
                          virDomainDiskDefPtr disk)
 {
+    int span = virTraceSpanBegin(__FUNCTION__);
     int ret = -1;
 
     if (qemuDomainNamespaceEnabled(vm, QEMU_DOMAIN_NS_MOUNT) &&
@@ -101,6 +113,7 @@ qemuSecuritySetDiskLabel(virQEMUDriverPtr driver,
     ret = 0;
  cleanup:
     virSecurityManagerTransactionAbort(driver->securityManager);
+    virTraceSpanEnd(span);
     return ret;
 }
 
@@ -110,6 +123,7 @@ qemuSecurityRestoreDiskLabel(virQEMUDriverPtr driver,
                              virDomainObjPtr vm,
                              virDomainDiskDefPtr disk)
 {
+    int span = virTraceSpanBegin(__FUNCTION__);
     int ret = -1;
 
     if (qemuDomainNamespaceEnabled(vm, QEMU_DOMAIN_NS_MOUNT) &&
@@ -129,6 +143,7 @@ qemuSecurityRestoreDiskLabel(virQEMUDriverPtr driver,
     ret = 0;
  cleanup:
     virSecurityManagerTransactionAbort(driver->securityManager);
+    virTraceSpanEnd(span);
     return ret;
 }
 
@@ -138,6 +153,7 @@ qemuSecuritySetImageLabel(virQEMUDriverPtr driver,
                           virDomainObjPtr vm,
                           virStorageSourcePtr src)
 {
+    int span = virTraceSpanBegin(__FUNCTION__);
     int ret = -1;
 
     if (qemuDomainNamespaceEnabled(vm, QEMU_DOMAIN_NS_MOUNT) &&
@@ -157,6 +173,7 @@ qemuSecuritySetImageLabel(virQEMUDriverPtr driver,
     ret = 0;
  cleanup:
     virSecurityManagerTransactionAbort(driver->securityManager);
+    virTraceSpanEnd(span);
     return ret;
 }
 
@@ -166,6 +183,7 @@ qemuSecurityRestoreImageLabel(virQEMUDriverPtr driver,
                               virDomainObjPtr vm,
                               virStorageSourcePtr src)
 {
+    int span = virTraceSpanBegin(__FUNCTION__);
     int ret = -1;
 
     if (qemuDomainNamespaceEnabled(vm, QEMU_DOMAIN_NS_MOUNT) &&
@@ -185,6 +203,7 @@ qemuSecurityRestoreImageLabel(virQEMUDriverPtr driver,
     ret = 0;
  cleanup:
     virSecurityManagerTransactionAbort(driver->securityManager);
+    virTraceSpanEnd(span);
     return ret;
 }
 
@@ -194,6 +213,7 @@ qemuSecuritySetHostdevLabel(virQEMUDriverPtr driver,
                             virDomainObjPtr vm,
                             virDomainHostdevDefPtr hostdev)
 {
+    int span = virTraceSpanBegin(__FUNCTION__);
     int ret = -1;
 
     if (qemuDomainNamespaceEnabled(vm, QEMU_DOMAIN_NS_MOUNT) &&
@@ -214,6 +234,7 @@ qemuSecuritySetHostdevLabel(virQEMUDriverPtr driver,
     ret = 0;
  cleanup:
     virSecurityManagerTransactionAbort(driver->securityManager);
+    virTraceSpanEnd(span);
     return ret;
 }
 
@@ -223,6 +244,7 @@ qemuSecurityRestoreHostdevLabel(virQEMUDriverPtr driver,
                                 virDomainObjPtr vm,
                                 virDomainHostdevDefPtr hostdev)
 {
+    int span = virTraceSpanBegin(__FUNCTION__);
     int ret = -1;
 
     if (qemuDomainNamespaceEnabled(vm, QEMU_DOMAIN_NS_MOUNT) &&
@@ -243,6 +265,7 @@ qemuSecurityRestoreHostdevLabel(virQEMUDriverPtr driver,
     ret = 0;
  cleanup:
     virSecurityManagerTransactionAbort(driver->securityManager);
+    virTraceSpanEnd(span);
     return ret;
 }
 
@@ -252,6 +275,7 @@ qemuSecuritySetMemoryLabel(virQEMUDriverPtr driver,
                            virDomainObjPtr vm,
                            virDomainMemoryDefPtr mem)
 {
+    int span = virTraceSpanBegin(__FUNCTION__);
     int ret = -1;
 
     if (qemuDomainNamespaceEnabled(vm, QEMU_DOMAIN_NS_MOUNT) &&
@@ -271,6 +295,7 @@ qemuSecuritySetMemoryLabel(virQEMUDriverPtr driver,
     ret = 0;
  cleanup:
     virSecurityManagerTransactionAbort(driver->securityManager);
+    virTraceSpanEnd(span);
     return ret;
 }
 
@@ -280,6 +305,7 @@ qemuSecurityRestoreMemoryLabel(virQEMUDriverPtr driver,
                                virDomainObjPtr vm,
                                virDomainMemoryDefPtr mem)
 {
+    int span = virTraceSpanBegin(__FUNCTION__);
     int ret = -1;
 
     if (qemuDomainNamespaceEnabled(vm, QEMU_DOMAIN_NS_MOUNT) &&
@@ -299,5 +325,6 @@ qemuSecurityRestoreMemoryLabel(virQEMUDriverPtr driver,
     ret = 0;
  cleanup:
     virSecurityManagerTransactionAbort(driver->securityManager);
+    virTraceSpanEnd(span);
     return ret;
 }
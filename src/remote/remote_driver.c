@@ -77,6 +77,62 @@ VIR_LOG_INIT("remote.remote_driver");
 
 static bool inside_daemon;
 
+/* Opt-in cache of the data clients keep asking for although it rarely
+ * changes. The data of the connection never does, the data of a domain
+ * is valid until the server reports one of remoteCacheEvents for it, or
+ * until this connection makes a call which may change any domain, see
+ * remoteCacheProcDone.
+ * The cache has a lock of its own, because the events are processed by
+ * whichever thread owns the client I/O, which may be an API waiting for
+ * its reply with the driver lock held. */
+typedef struct _remoteCacheDomainXML remoteCacheDomainXML;
+struct _remoteCacheDomainXML {
+    unsigned int flags;
+    char *xml;
+};
+
+typedef struct _remoteCacheDomain remoteCacheDomain;
+typedef remoteCacheDomain *remoteCacheDomainPtr;
+struct _remoteCacheDomain {
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    char *name;     /* NULL unless the domain was looked up */
+    int id;
+
+    size_t nxmls;
+    remoteCacheDomainXML *xmls;
+};
+
+typedef struct _remoteCache remoteCache;
+typedef remoteCache *remoteCachePtr;
+struct _remoteCache {
+    virMutex lock;
+    /* Bumped by each invalidation, so that the data fetched meanwhile
+     * is not stored */
+    unsigned long long gen;
+
+    char *capabilities;
+    char *hostname;
+    unsigned long hvVer;
+    bool hvVerCached;
+
+    bool domains;               /* Domain data is cached, see remoteCacheEvents */
+    virHashTablePtr byUUID;     /* UUID string -> remoteCacheDomain */
+    virHashTablePtr byName;     /* name -> domain in @byUUID, not owned */
+};
+
+/* Events which invalidate the cached data of a domain */
+static const int remoteCacheEvents[] = {
+    VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+    VIR_DOMAIN_EVENT_ID_DEVICE_ADDED,
+    VIR_DOMAIN_EVENT_ID_DEVICE_REMOVED,
+    VIR_DOMAIN_EVENT_ID_TUNABLE,
+    VIR_DOMAIN_EVENT_ID_BALLOON_CHANGE,
+    VIR_DOMAIN_EVENT_ID_TRAY_CHANGE,
+    VIR_DOMAIN_EVENT_ID_BLOCK_JOB_2,
+    VIR_DOMAIN_EVENT_ID_DISK_CHANGE,
+    VIR_DOMAIN_EVENT_ID_METADATA_CHANGE,
+};
+
 struct private_data {
     virMutex lock;
 
@@ -98,9 +154,12 @@ struct private_data {
     bool serverKeepAlive;       /* Does server support keepalive protocol? */
     bool serverEventFilter;     /* Does server support modern event filtering */
     bool serverCloseCallback;   /* Does server support driver close callback */
+    bool serverCallBatch;       /* Does server support batches of calls */
 
     virObjectEventStatePtr eventState;
     virConnectCloseCallbackDataPtr closeCallback;
+
+    remoteCachePtr cache;       /* NULL unless requested by the URI */
 };
 
 enum {
@@ -108,6 +167,9 @@ enum {
     REMOTE_CALL_LXC               = (1 << 1),
 };
 
+/* Maximum number of asynchronous calls kept in flight by callBatch */
+#define REMOTE_CALL_ASYNC_MAX 64
+
 
 static void remoteDriverLock(struct private_data *driver)
 {
@@ -119,6 +181,252 @@ static void remoteDriverUnlock(struct private_data *driver)
     virMutexUnlock(&driver->lock);
 }
 
+
+static void
+remoteCacheDomainFree(void *payload,
+                      const void *name ATTRIBUTE_UNUSED)
+{
+    remoteCacheDomainPtr entry = payload;
+    size_t i;
+
+    for (i = 0; i < entry->nxmls; i++)
+        VIR_FREE(entry->xmls[i].xml);
+    VIR_FREE(entry->xmls);
+    VIR_FREE(entry->name);
+    VIR_FREE(entry);
+}
+
+
+static remoteCachePtr
+remoteCacheNew(void)
+{
+    remoteCachePtr cache;
+
+    if (VIR_ALLOC(cache) < 0)
+        return NULL;
+
+    if (virMutexInit(&cache->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        VIR_FREE(cache);
+        return NULL;
+    }
+
+    if (!(cache->byUUID = virHashCreate(32, remoteCacheDomainFree)) ||
+        !(cache->byName = virHashCreate(32, NULL))) {
+        virHashFree(cache->byUUID);
+        virMutexDestroy(&cache->lock);
+        VIR_FREE(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+
+static void
+remoteCacheFree(remoteCachePtr cache)
+{
+    if (!cache)
+        return;
+
+    virHashFree(cache->byName);
+    virHashFree(cache->byUUID);
+    VIR_FREE(cache->capabilities);
+    VIR_FREE(cache->hostname);
+    virMutexDestroy(&cache->lock);
+    VIR_FREE(cache);
+}
+
+
+/* Get the cached data of the domain @uuid, creating it if @create is
+ * true. Called with the cache lock held */
+static remoteCacheDomainPtr
+remoteCacheDomainGet(remoteCachePtr cache,
+                     const unsigned char *uuid,
+                     bool create)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    remoteCacheDomainPtr entry;
+
+    virUUIDFormat(uuid, uuidstr);
+
+    if ((entry = virHashLookup(cache->byUUID, uuidstr)) || !create)
+        return entry;
+
+    if (VIR_ALLOC(entry) < 0)
+        return NULL;
+    memcpy(entry->uuid, uuid, VIR_UUID_BUFLEN);
+    entry->id = -1;
+
+    if (virHashAddEntry(cache->byUUID, uuidstr, entry) < 0) {
+        remoteCacheDomainFree(entry, NULL);
+        return NULL;
+    }
+
+    return entry;
+}
+
+
+/* Drop everything cached about the domain @uuid */
+static void
+remoteCacheDomainInvalidate(remoteCachePtr cache,
+                            const unsigned char *uuid)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    remoteCacheDomainPtr entry;
+
+    virMutexLock(&cache->lock);
+    cache->gen++;
+    if ((entry = remoteCacheDomainGet(cache, uuid, false))) {
+        if (entry->name)
+            virHashRemoveEntry(cache->byName, entry->name);
+        virUUIDFormat(uuid, uuidstr);
+        virHashRemoveEntry(cache->byUUID, uuidstr);
+    }
+    virMutexUnlock(&cache->lock);
+}
+
+
+/* Drop everything cached about any domain */
+static void
+remoteCacheDomainInvalidateAll(remoteCachePtr cache)
+{
+    virMutexLock(&cache->lock);
+    cache->gen++;
+    virHashRemoveAll(cache->byName);
+    virHashRemoveAll(cache->byUUID);
+    virMutexUnlock(&cache->lock);
+}
+
+
+/* Called for each of remoteCacheEvents the server reported */
+static void
+remoteCacheDomainEvent(struct private_data *priv,
+                       remote_nonnull_domain *dom)
+{
+    if (priv->cache)
+        remoteCacheDomainInvalidate(priv->cache, (unsigned char *) dom->uuid);
+}
+
+
+/* Remember the identity of a domain the server returned, unless the
+ * cache was invalidated since @gen */
+static void
+remoteCacheDomainStoreIdentity(remoteCachePtr cache,
+                               unsigned long long gen,
+                               virDomainPtr dom)
+{
+    remoteCacheDomainPtr entry;
+    char *name = NULL;
+
+    virMutexLock(&cache->lock);
+    if (!cache->domains || gen != cache->gen ||
+        !(entry = remoteCacheDomainGet(cache, dom->uuid, true)))
+        goto cleanup;
+
+    if (entry->name)
+        virHashRemoveEntry(cache->byName, entry->name);
+    VIR_FREE(entry->name);
+
+    if (VIR_STRDUP_QUIET(name, dom->name) < 0 ||
+        virHashAddEntry(cache->byName, name, entry) < 0) {
+        VIR_FREE(name);
+        goto cleanup;
+    }
+    entry->name = name;
+    entry->id = dom->id;
+
+ cleanup:
+    virMutexUnlock(&cache->lock);
+}
+
+
+/* Look up the domain of @name or @uuid in the cache */
+static virDomainPtr
+remoteCacheDomainLookup(virConnectPtr conn,
+                        remoteCachePtr cache,
+                        const char *name,
+                        const unsigned char *uuid,
+                        unsigned long long *gen)
+{
+    remoteCacheDomainPtr entry;
+    virDomainPtr dom = NULL;
+
+    virMutexLock(&cache->lock);
+    *gen = cache->gen;
+    if (!cache->domains)
+        entry = NULL;
+    else if (name)
+        entry = virHashLookup(cache->byName, name);
+    else
+        entry = remoteCacheDomainGet(cache, uuid, false);
+
+    if (entry && entry->name)
+        dom = virGetDomain(conn, entry->name, entry->uuid, entry->id);
+    virMutexUnlock(&cache->lock);
+
+    return dom;
+}
+
+
+/* Get a copy of the XML of the domain @uuid formatted with @flags */
+static char *
+remoteCacheDomainGetXML(remoteCachePtr cache,
+                        const unsigned char *uuid,
+                        unsigned int flags,
+                        unsigned long long *gen)
+{
+    remoteCacheDomainPtr entry;
+    char *xml = NULL;
+    size_t i;
+
+    virMutexLock(&cache->lock);
+    *gen = cache->gen;
+    if (cache->domains && (entry = remoteCacheDomainGet(cache, uuid, false))) {
+        for (i = 0; i < entry->nxmls; i++) {
+            if (entry->xmls[i].flags == flags) {
+                ignore_value(VIR_STRDUP_QUIET(xml, entry->xmls[i].xml));
+                break;
+            }
+        }
+    }
+    virMutexUnlock(&cache->lock);
+
+    return xml;
+}
+
+
+/* Remember the XML of the domain @uuid the server returned, unless the
+ * cache was invalidated since @gen. The inactive XML is never stored,
+ * because the APIs changing only the persistent config of a domain
+ * report no event */
+static void
+remoteCacheDomainStoreXML(remoteCachePtr cache,
+                          unsigned long long gen,
+                          const unsigned char *uuid,
+                          unsigned int flags,
+                          const char *xml)
+{
+    remoteCacheDomainPtr entry;
+    remoteCacheDomainXML item = { flags, NULL };
+
+    if (flags & VIR_DOMAIN_XML_INACTIVE)
+        return;
+
+    virMutexLock(&cache->lock);
+    if (!cache->domains || gen != cache->gen ||
+        !(entry = remoteCacheDomainGet(cache, uuid, true)))
+        goto cleanup;
+
+    if (VIR_STRDUP_QUIET(item.xml, xml) < 0 ||
+        VIR_APPEND_ELEMENT_QUIET(entry->xmls, entry->nxmls, item) < 0)
+        VIR_FREE(item.xml);
+
+ cleanup:
+    virMutexUnlock(&cache->lock);
+}
+
 static int call(virConnectPtr conn, struct private_data *priv,
                 unsigned int flags, int proc_nr,
                 xdrproc_t args_filter, char *args,
@@ -130,6 +438,17 @@ static int callFull(virConnectPtr conn, struct private_data *priv,
                     int proc_nr,
                     xdrproc_t args_filter, char *args,
                     xdrproc_t ret_filter, char *ret);
+static int callAsync(virConnectPtr conn, struct private_data *priv,
+                     unsigned int flags, int proc_nr,
+                     xdrproc_t args_filter, char *args,
+                     virNetClientProgramAsyncCallPtr *handle);
+static int callAsyncWait(virConnectPtr conn, struct private_data *priv,
+                         virNetClientProgramAsyncCallPtr handle,
+                         xdrproc_t ret_filter, char *ret);
+static int callBatch(virConnectPtr conn, struct private_data *priv,
+                     unsigned int flags,
+                     virNetClientProgramBatchCallPtr calls,
+                     size_t ncalls);
 static int remoteAuthenticate(virConnectPtr conn, struct private_data *priv,
                               virConnectAuthPtr auth, const char *authtype);
 #if WITH_SASL
@@ -400,6 +719,16 @@ remoteDomainBuildEventBlockThreshold(virNetClientProgramPtr prog,
                                      virNetClientPtr client,
                                      void *evdata, void *opaque);
 
+static void
+remoteDomainBuildEventCallbackStats(virNetClientProgramPtr prog,
+                                    virNetClientPtr client,
+                                    void *evdata, void *opaque);
+
+static void
+remoteDomainBuildEventCallbackBlockJobGroup(virNetClientProgramPtr prog,
+                                            virNetClientPtr client,
+                                            void *evdata, void *opaque);
+
 static void
 remoteConnectNotifyEventConnectionClosed(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
                                          virNetClientPtr client ATTRIBUTE_UNUSED,
@@ -611,6 +940,14 @@ static virNetClientProgramEvent remoteEvents[] = {
       remoteDomainBuildEventBlockThreshold,
       sizeof(remote_domain_event_block_threshold_msg),
       (xdrproc_t)xdr_remote_domain_event_block_threshold_msg },
+    { REMOTE_PROC_DOMAIN_EVENT_CALLBACK_STATS,
+      remoteDomainBuildEventCallbackStats,
+      sizeof(remote_domain_event_callback_stats_msg),
+      (xdrproc_t)xdr_remote_domain_event_callback_stats_msg },
+    { REMOTE_PROC_DOMAIN_EVENT_CALLBACK_BLOCK_JOB_GROUP,
+      remoteDomainBuildEventCallbackBlockJobGroup,
+      sizeof(remote_domain_event_callback_block_job_group_msg),
+      (xdrproc_t)xdr_remote_domain_event_callback_block_job_group_msg },
 };
 
 static void
@@ -810,6 +1147,7 @@ doRemoteOpen(virConnectPtr conn,
     char *name = NULL, *command = NULL, *sockname = NULL, *netcat = NULL;
     char *port = NULL, *authtype = NULL, *username = NULL;
     bool sanity = true, verify = true, tty ATTRIBUTE_UNUSED = true;
+    bool cache = false;
     char *pkipath = NULL, *keyfile = NULL, *sshauth = NULL;
 
     char *knownHostsVerify = NULL,  *knownHosts = NULL;
@@ -863,6 +1201,19 @@ doRemoteOpen(virConnectPtr conn,
             EXTRACT_URI_ARG_BOOL("no_verify", verify);
             EXTRACT_URI_ARG_BOOL("no_tty", tty);
 
+            if (STRCASEEQ(var->name, "cache")) {
+                int tmp;
+                if (virStrToLong_i(var->value, NULL, 10, &tmp) < 0) {
+                    virReportError(VIR_ERR_INVALID_ARG,
+                                   _("Failed to parse value of URI component %s"),
+                                   var->name);
+                    goto failed;
+                }
+                cache = tmp != 0;
+                var->ignore = 1;
+                continue;
+            }
+
             if (STRCASEEQ(var->name, "authfile")) {
                 /* Strip this param, used by virauth.c */
                 var->ignore = 1;
@@ -1237,6 +1588,25 @@ doRemoteOpen(virConnectPtr conn,
                  "by the remote side.");
     }
 
+    priv->serverCallBatch = remoteConnectSupportsFeatureUnlocked(conn,
+                                priv, VIR_DRV_FEATURE_REMOTE_CALL_BATCH);
+    if (!priv->serverCallBatch) {
+        VIR_INFO("Avoiding batches of calls since they are not "
+                 "supported by the server");
+    }
+
+    /* Asking tells the server we can receive large stream frames */
+    if (!remoteConnectSupportsFeatureUnlocked(conn, priv,
+                                              VIR_DRV_FEATURE_REMOTE_STREAM_LARGE_FRAMES)) {
+        VIR_INFO("Receiving stream data in legacy sized messages since "
+                 "larger ones are not supported by the server");
+    }
+
+    /* The domain data is cached once the events invalidating it are
+     * registered, see remoteCacheRegisterEvents */
+    if (cache && !(priv->cache = remoteCacheNew()))
+        goto failed;
+
     /* Successful. */
     retcode = VIR_DRV_OPEN_SUCCESS;
 
@@ -1276,6 +1646,8 @@ doRemoteOpen(virConnectPtr conn,
 #endif
 
     VIR_FREE(priv->hostname);
+    remoteCacheFree(priv->cache);
+    priv->cache = NULL;
     goto cleanup;
 }
 #undef EXTRACT_URI_ARG_STR
@@ -1300,6 +1672,45 @@ remoteAllocPrivateData(void)
     return priv;
 }
 
+/* Ask the server for the events invalidating the cached domain data.
+ * The events carry the callback IDs of the server, which no local
+ * callback is registered for, so they are dropped once they invalidated
+ * the cache. Without such filtered events, domain data is not cached. */
+static void
+remoteCacheRegisterEvents(virConnectPtr conn,
+                          struct private_data *priv)
+{
+    remote_connect_domain_event_callback_register_any_args args;
+    remote_connect_domain_event_callback_register_any_ret ret;
+    size_t i;
+
+    if (!priv->serverEventFilter) {
+        VIR_INFO("Not caching domain data since the server does not "
+                 "support event filtering");
+        return;
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(remoteCacheEvents); i++) {
+        args.eventID = remoteCacheEvents[i];
+        args.dom = NULL;
+
+        memset(&ret, 0, sizeof(ret));
+        if (call(conn, priv, 0, REMOTE_PROC_CONNECT_DOMAIN_EVENT_CALLBACK_REGISTER_ANY,
+                 (xdrproc_t) xdr_remote_connect_domain_event_callback_register_any_args, (char *) &args,
+                 (xdrproc_t) xdr_remote_connect_domain_event_callback_register_any_ret, (char *) &ret) == -1) {
+            VIR_WARN("Not caching domain data, registering event %d "
+                     "failed: %s", args.eventID, virGetLastErrorMessage());
+            virResetLastError();
+            return;
+        }
+    }
+
+    virMutexLock(&priv->cache->lock);
+    priv->cache->domains = true;
+    virMutexUnlock(&priv->cache->lock);
+}
+
+
 static virDrvOpenStatus
 remoteConnectOpen(virConnectPtr conn,
                   virConnectAuthPtr auth,
@@ -1369,12 +1780,41 @@ remoteConnectOpen(virConnectPtr conn,
         VIR_FREE(priv);
     } else {
         conn->privateData = priv;
+        /* Only now that the event callbacks can find @priv */
+        if (priv->cache)
+            remoteCacheRegisterEvents(conn, priv);
         remoteDriverUnlock(priv);
     }
     return ret;
 }
 
 
+/* Copy @str of the cache into @dst, returns true if there was any */
+static bool
+remoteCacheGetString(remoteCachePtr cache,
+                     char *const *str,
+                     char **dst)
+{
+    virMutexLock(&cache->lock);
+    ignore_value(VIR_STRDUP_QUIET(*dst, *str));
+    virMutexUnlock(&cache->lock);
+
+    return !!*dst;
+}
+
+
+static void
+remoteCacheSetString(remoteCachePtr cache,
+                     char **str,
+                     const char *src)
+{
+    virMutexLock(&cache->lock);
+    if (!*str)
+        ignore_value(VIR_STRDUP_QUIET(*str, src));
+    virMutexUnlock(&cache->lock);
+}
+
+
 /* In a string "driver+transport" return a pointer to "transport". */
 static char *
 get_transport_from_scheme(char *scheme)
@@ -1424,6 +1864,9 @@ doRemoteClose(virConnectPtr conn, struct private_data *priv)
     virObjectUnref(priv->eventState);
     priv->eventState = NULL;
 
+    remoteCacheFree(priv->cache);
+    priv->cache = NULL;
+
     return ret;
 }
 
@@ -1486,6 +1929,222 @@ remoteConnectGetType(virConnectPtr conn)
     return rv;
 }
 
+
+static char *
+remoteConnectGetCapabilities(virConnectPtr conn)
+{
+    char *rv = NULL;
+    struct private_data *priv = conn->privateData;
+    remote_connect_get_capabilities_ret ret;
+
+    if (priv->cache &&
+        remoteCacheGetString(priv->cache, &priv->cache->capabilities, &rv))
+        return rv;
+
+    remoteDriverLock(priv);
+
+    memset(&ret, 0, sizeof(ret));
+
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_GET_CAPABILITIES,
+             (xdrproc_t)xdr_void, (char *)NULL,
+             (xdrproc_t)xdr_remote_connect_get_capabilities_ret, (char *)&ret) == -1)
+        goto done;
+
+    rv = ret.capabilities;
+
+    if (priv->cache)
+        remoteCacheSetString(priv->cache, &priv->cache->capabilities, rv);
+
+ done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
+static int
+remoteConnectGetVersion(virConnectPtr conn, unsigned long *hv_ver)
+{
+    int rv = -1;
+    struct private_data *priv = conn->privateData;
+    remote_connect_get_version_ret ret;
+
+    if (priv->cache) {
+        virMutexLock(&priv->cache->lock);
+        if (priv->cache->hvVerCached) {
+            if (hv_ver)
+                *hv_ver = priv->cache->hvVer;
+            rv = 0;
+        }
+        virMutexUnlock(&priv->cache->lock);
+        if (rv == 0)
+            return rv;
+    }
+
+    remoteDriverLock(priv);
+
+    memset(&ret, 0, sizeof(ret));
+
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_GET_VERSION,
+             (xdrproc_t)xdr_void, (char *)NULL,
+             (xdrproc_t)xdr_remote_connect_get_version_ret, (char *)&ret) == -1)
+        goto done;
+
+    if (hv_ver)
+        HYPER_TO_ULONG(*hv_ver, ret.hv_ver);
+
+    if (priv->cache) {
+        virMutexLock(&priv->cache->lock);
+        HYPER_TO_ULONG(priv->cache->hvVer, ret.hv_ver);
+        priv->cache->hvVerCached = true;
+        virMutexUnlock(&priv->cache->lock);
+    }
+
+    rv = 0;
+
+ done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
+static char *
+remoteConnectGetHostname(virConnectPtr conn)
+{
+    char *rv = NULL;
+    struct private_data *priv = conn->privateData;
+    remote_connect_get_hostname_ret ret;
+
+    if (priv->cache &&
+        remoteCacheGetString(priv->cache, &priv->cache->hostname, &rv))
+        return rv;
+
+    remoteDriverLock(priv);
+
+    memset(&ret, 0, sizeof(ret));
+
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_GET_HOSTNAME,
+             (xdrproc_t)xdr_void, (char *)NULL,
+             (xdrproc_t)xdr_remote_connect_get_hostname_ret, (char *)&ret) == -1)
+        goto done;
+
+    rv = ret.hostname;
+
+    if (priv->cache)
+        remoteCacheSetString(priv->cache, &priv->cache->hostname, rv);
+
+ done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
+static virDomainPtr
+remoteDomainLookupByName(virConnectPtr conn, const char *name)
+{
+    virDomainPtr rv = NULL;
+    struct private_data *priv = conn->privateData;
+    remote_domain_lookup_by_name_args args;
+    remote_domain_lookup_by_name_ret ret;
+    unsigned long long gen = 0;
+
+    if (priv->cache &&
+        (rv = remoteCacheDomainLookup(conn, priv->cache, name, NULL, &gen)))
+        return rv;
+
+    remoteDriverLock(priv);
+
+    args.name = (char *)name;
+
+    memset(&ret, 0, sizeof(ret));
+
+    if (call(conn, priv, 0, REMOTE_PROC_DOMAIN_LOOKUP_BY_NAME,
+             (xdrproc_t)xdr_remote_domain_lookup_by_name_args, (char *)&args,
+             (xdrproc_t)xdr_remote_domain_lookup_by_name_ret, (char *)&ret) == -1)
+        goto done;
+
+    rv = get_nonnull_domain(conn, ret.dom);
+    xdr_free((xdrproc_t)xdr_remote_domain_lookup_by_name_ret, (char *)&ret);
+
+    if (rv && priv->cache)
+        remoteCacheDomainStoreIdentity(priv->cache, gen, rv);
+
+ done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
+static virDomainPtr
+remoteDomainLookupByUUID(virConnectPtr conn, const unsigned char *uuid)
+{
+    virDomainPtr rv = NULL;
+    struct private_data *priv = conn->privateData;
+    remote_domain_lookup_by_uuid_args args;
+    remote_domain_lookup_by_uuid_ret ret;
+    unsigned long long gen = 0;
+
+    if (priv->cache &&
+        (rv = remoteCacheDomainLookup(conn, priv->cache, NULL, uuid, &gen)))
+        return rv;
+
+    remoteDriverLock(priv);
+
+    memcpy(args.uuid, uuid, VIR_UUID_BUFLEN);
+
+    memset(&ret, 0, sizeof(ret));
+
+    if (call(conn, priv, 0, REMOTE_PROC_DOMAIN_LOOKUP_BY_UUID,
+             (xdrproc_t)xdr_remote_domain_lookup_by_uuid_args, (char *)&args,
+             (xdrproc_t)xdr_remote_domain_lookup_by_uuid_ret, (char *)&ret) == -1)
+        goto done;
+
+    rv = get_nonnull_domain(conn, ret.dom);
+    xdr_free((xdrproc_t)xdr_remote_domain_lookup_by_uuid_ret, (char *)&ret);
+
+    if (rv && priv->cache)
+        remoteCacheDomainStoreIdentity(priv->cache, gen, rv);
+
+ done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
+static char *
+remoteDomainGetXMLDesc(virDomainPtr dom, unsigned int flags)
+{
+    char *rv = NULL;
+    struct private_data *priv = dom->conn->privateData;
+    remote_domain_get_xml_desc_args args;
+    remote_domain_get_xml_desc_ret ret;
+    unsigned long long gen = 0;
+
+    if (priv->cache &&
+        (rv = remoteCacheDomainGetXML(priv->cache, dom->uuid, flags, &gen)))
+        return rv;
+
+    remoteDriverLock(priv);
+
+    make_nonnull_domain(&args.dom, dom);
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+
+    if (call(dom->conn, priv, 0, REMOTE_PROC_DOMAIN_GET_XML_DESC,
+             (xdrproc_t)xdr_remote_domain_get_xml_desc_args, (char *)&args,
+             (xdrproc_t)xdr_remote_domain_get_xml_desc_ret, (char *)&ret) == -1)
+        goto done;
+
+    rv = ret.xml;
+
+    if (priv->cache)
+        remoteCacheDomainStoreXML(priv->cache, gen, dom->uuid, flags, rv);
+
+ done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
 static int remoteConnectIsSecure(virConnectPtr conn)
 {
     int rv = -1;
@@ -1990,6 +2649,45 @@ remoteDomainGetPerfEvents(virDomainPtr domain,
     return rv;
 }
 
+static int
+remoteDomainBlockJobGroupGetStats(virDomainPtr domain,
+                                  virTypedParameterPtr *params,
+                                  int *nparams,
+                                  unsigned int flags)
+{
+    int rv = -1;
+    remote_domain_block_job_group_get_stats_args args;
+    remote_domain_block_job_group_get_stats_ret ret;
+    struct private_data *priv = domain->conn->privateData;
+
+    remoteDriverLock(priv);
+
+    make_nonnull_domain(&args.dom, domain);
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+    if (call(domain->conn, priv, 0, REMOTE_PROC_DOMAIN_BLOCK_JOB_GROUP_GET_STATS,
+             (xdrproc_t) xdr_remote_domain_block_job_group_get_stats_args, (char *) &args,
+             (xdrproc_t) xdr_remote_domain_block_job_group_get_stats_ret, (char *) &ret) == -1)
+        goto done;
+
+    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) ret.params.params_val,
+                                  ret.params.params_len,
+                                  REMOTE_DOMAIN_BLOCK_JOB_GROUP_PARAMETERS_MAX,
+                                  params,
+                                  nparams) < 0)
+        goto cleanup;
+
+    rv = 0;
+
+ cleanup:
+    xdr_free((xdrproc_t) xdr_remote_domain_block_job_group_get_stats_ret,
+             (char *) &ret);
+ done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
 static int
 remoteDomainGetBlkioParameters(virDomainPtr domain,
                                virTypedParameterPtr params, int *nparams,
@@ -4499,6 +5197,8 @@ remoteDomainBuildEventLifecycleHelper(virConnectPtr conn,
     virDomainPtr dom;
     virObjectEventPtr event = NULL;
 
+    remoteCacheDomainEvent(priv, &msg->dom);
+
     dom = get_nonnull_domain(conn, msg->dom);
     if (!dom)
         return;
@@ -4770,6 +5470,8 @@ remoteDomainBuildEventBlockJob2(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
     virDomainPtr dom;
     virObjectEventPtr event = NULL;
 
+    remoteCacheDomainEvent(priv, &msg->dom);
+
     dom = get_nonnull_domain(conn, msg->dom);
     if (!dom)
         return;
@@ -4925,6 +5627,8 @@ remoteDomainBuildEventDiskChangeHelper(virConnectPtr conn,
     virDomainPtr dom;
     virObjectEventPtr event = NULL;
 
+    remoteCacheDomainEvent(priv, &msg->dom);
+
     dom = get_nonnull_domain(conn, msg->dom);
     if (!dom)
         return;
@@ -4968,6 +5672,8 @@ remoteDomainBuildEventTrayChangeHelper(virConnectPtr conn,
     virDomainPtr dom;
     virObjectEventPtr event = NULL;
 
+    remoteCacheDomainEvent(priv, &msg->dom);
+
     dom = get_nonnull_domain(conn, msg->dom);
     if (!dom)
         return;
@@ -5089,6 +5795,8 @@ remoteDomainBuildEventBalloonChangeHelper(virConnectPtr conn,
     virDomainPtr dom;
     virObjectEventPtr event = NULL;
 
+    remoteCacheDomainEvent(priv, &msg->dom);
+
     dom = get_nonnull_domain(conn, msg->dom);
     if (!dom)
         return;
@@ -5168,6 +5876,8 @@ remoteDomainBuildEventDeviceRemovedHelper(virConnectPtr conn,
     virDomainPtr dom;
     virObjectEventPtr event = NULL;
 
+    remoteCacheDomainEvent(priv, &msg->dom);
+
     dom = get_nonnull_domain(conn, msg->dom);
     if (!dom)
         return;
@@ -5208,6 +5918,8 @@ remoteDomainBuildEventCallbackDeviceAdded(virNetClientProgramPtr prog ATTRIBUTE_
     virDomainPtr dom;
     virObjectEventPtr event = NULL;
 
+    remoteCacheDomainEvent(priv, &msg->dom);
+
     dom = get_nonnull_domain(conn, msg->dom);
     if (!dom)
         return;
@@ -5260,6 +5972,8 @@ remoteDomainBuildEventCallbackTunable(virNetClientProgramPtr prog ATTRIBUTE_UNUS
                                   &params, &nparams) < 0)
         return;
 
+    remoteCacheDomainEvent(priv, &msg->dom);
+
     dom = get_nonnull_domain(conn, msg->dom);
     if (!dom) {
         virTypedParamsFree(params, nparams);
@@ -5364,6 +6078,8 @@ remoteDomainBuildEventCallbackMetadataChange(virNetClientProgramPtr prog ATTRIBU
     virDomainPtr dom;
     virObjectEventPtr event = NULL;
 
+    remoteCacheDomainEvent(priv, &msg->dom);
+
     if (!(dom = get_nonnull_domain(conn, msg->dom)))
         return;
 
@@ -5606,20 +6322,151 @@ remoteDomainBuildEventBlockThreshold(virNetClientProgramPtr prog ATTRIBUTE_UNUSE
 
     virObjectUnref(dom);
 
-    remoteEventQueue(priv, event, msg->callbackID);
+    remoteEventQueue(priv, event, msg->callbackID);
+}
+
+
+static void
+remoteDomainBuildEventCallbackStats(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
+                                    virNetClientPtr client ATTRIBUTE_UNUSED,
+                                    void *evdata, void *opaque)
+{
+    virConnectPtr conn = opaque;
+    remote_domain_event_callback_stats_msg *msg = evdata;
+    struct private_data *priv = conn->privateData;
+    virDomainPtr dom;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    virObjectEventPtr event = NULL;
+
+    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) msg->params.params_val,
+                                  msg->params.params_len,
+                                  REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX,
+                                  &params, &nparams) < 0)
+        return;
+
+    if (!(dom = get_nonnull_domain(conn, msg->dom))) {
+        virTypedParamsFree(params, nparams);
+        return;
+    }
+
+    event = virDomainEventStatsNewFromDom(dom, params, nparams);
+
+    virObjectUnref(dom);
+
+    remoteEventQueue(priv, event, msg->callbackID);
+}
+
+
+static void
+remoteDomainBuildEventCallbackBlockJobGroup(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
+                                            virNetClientPtr client ATTRIBUTE_UNUSED,
+                                            void *evdata, void *opaque)
+{
+    virConnectPtr conn = opaque;
+    remote_domain_event_callback_block_job_group_msg *msg = evdata;
+    struct private_data *priv = conn->privateData;
+    virDomainPtr dom;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    virObjectEventPtr event = NULL;
+
+    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) msg->params.params_val,
+                                  msg->params.params_len,
+                                  REMOTE_DOMAIN_BLOCK_JOB_GROUP_PARAMETERS_MAX,
+                                  &params, &nparams) < 0)
+        return;
+
+    if (!(dom = get_nonnull_domain(conn, msg->dom))) {
+        virTypedParamsFree(params, nparams);
+        return;
+    }
+
+    event = virDomainEventBlockJobGroupNewFromDom(dom, params, nparams);
+
+    virObjectUnref(dom);
+
+    remoteEventQueue(priv, event, msg->callbackID);
+}
+
+
+static int
+remoteStreamSend(virStreamPtr st,
+                 const char *data,
+                 size_t nbytes)
+{
+    VIR_DEBUG("st=%p data=%p nbytes=%zu", st, data, nbytes);
+    struct private_data *priv = st->conn->privateData;
+    virNetClientStreamPtr privst = st->privateData;
+    int rv;
+
+    if (virNetClientStreamRaiseError(privst))
+        return -1;
+
+    remoteDriverLock(priv);
+    priv->localUses++;
+    remoteDriverUnlock(priv);
+
+    rv = virNetClientStreamSendPacket(privst,
+                                      priv->client,
+                                      VIR_NET_CONTINUE,
+                                      data,
+                                      nbytes);
+
+    remoteDriverLock(priv);
+    priv->localUses--;
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
+static int
+remoteStreamRecv(virStreamPtr st,
+                 char *data,
+                 size_t nbytes)
+{
+    VIR_DEBUG("st=%p data=%p nbytes=%zu", st, data, nbytes);
+    struct private_data *priv = st->conn->privateData;
+    virNetClientStreamPtr privst = st->privateData;
+    int rv;
+
+    if (virNetClientStreamRaiseError(privst))
+        return -1;
+
+    remoteDriverLock(priv);
+    priv->localUses++;
+    remoteDriverUnlock(priv);
+
+    rv = virNetClientStreamRecvPacket(privst,
+                                      priv->client,
+                                      data,
+                                      nbytes,
+                                      (st->flags & VIR_STREAM_NONBLOCK),
+                                      0);
+
+    VIR_DEBUG("Done %d", rv);
+
+    remoteDriverLock(priv);
+    priv->localUses--;
+    remoteDriverUnlock(priv);
+    return rv;
 }
 
 
 static int
-remoteStreamSend(virStreamPtr st,
-                 const char *data,
-                 size_t nbytes)
+remoteStreamRecvFlags(virStreamPtr st,
+                      char *data,
+                      size_t nbytes,
+                      unsigned int flags)
 {
-    VIR_DEBUG("st=%p data=%p nbytes=%zu", st, data, nbytes);
+    VIR_DEBUG("st=%p data=%p nbytes=%zu flags=%x",
+              st, data, nbytes, flags);
     struct private_data *priv = st->conn->privateData;
     virNetClientStreamPtr privst = st->privateData;
     int rv;
 
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
     if (virNetClientStreamRaiseError(privst))
         return -1;
 
@@ -5627,11 +6474,14 @@ remoteStreamSend(virStreamPtr st,
     priv->localUses++;
     remoteDriverUnlock(priv);
 
-    rv = virNetClientStreamSendPacket(privst,
+    rv = virNetClientStreamRecvPacket(privst,
                                       priv->client,
-                                      VIR_NET_CONTINUE,
                                       data,
-                                      nbytes);
+                                      nbytes,
+                                      (st->flags & VIR_STREAM_NONBLOCK),
+                                      flags);
+
+    VIR_DEBUG("Done %d", rv);
 
     remoteDriverLock(priv);
     priv->localUses--;
@@ -5641,15 +6491,18 @@ remoteStreamSend(virStreamPtr st,
 
 
 static int
-remoteStreamRecv(virStreamPtr st,
-                 char *data,
-                 size_t nbytes)
+remoteStreamSendHole(virStreamPtr st,
+                     long long length,
+                     unsigned int flags)
 {
-    VIR_DEBUG("st=%p data=%p nbytes=%zu", st, data, nbytes);
+    VIR_DEBUG("st=%p length=%lld flags=%x",
+              st, length, flags);
     struct private_data *priv = st->conn->privateData;
     virNetClientStreamPtr privst = st->privateData;
     int rv;
 
+    virCheckFlags(0, -1);
+
     if (virNetClientStreamRaiseError(privst))
         return -1;
 
@@ -5657,13 +6510,39 @@ remoteStreamRecv(virStreamPtr st,
     priv->localUses++;
     remoteDriverUnlock(priv);
 
-    rv = virNetClientStreamRecvPacket(privst,
-                                      priv->client,
-                                      data,
-                                      nbytes,
-                                      (st->flags & VIR_STREAM_NONBLOCK));
+    rv = virNetClientStreamSendHole(privst,
+                                    priv->client,
+                                    length,
+                                    flags);
 
-    VIR_DEBUG("Done %d", rv);
+    remoteDriverLock(priv);
+    priv->localUses--;
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
+static int
+remoteStreamRecvHole(virStreamPtr st,
+                     long long *length,
+                     unsigned int flags)
+{
+    VIR_DEBUG("st=%p length=%p flags=%x",
+              st, length, flags);
+    struct private_data *priv = st->conn->privateData;
+    virNetClientStreamPtr privst = st->privateData;
+    int rv;
+
+    virCheckFlags(0, -1);
+
+    if (virNetClientStreamRaiseError(privst))
+        return -1;
+
+    remoteDriverLock(priv);
+    priv->localUses++;
+    remoteDriverUnlock(priv);
+
+    rv = virNetClientStreamRecvHole(priv->client, privst, length);
 
     remoteDriverLock(priv);
     priv->localUses--;
@@ -5843,7 +6722,10 @@ remoteStreamAbort(virStreamPtr st)
 
 static virStreamDriver remoteStreamDrv = {
     .streamRecv = remoteStreamRecv,
+    .streamRecvFlags = remoteStreamRecvFlags,
     .streamSend = remoteStreamSend,
+    .streamSendHole = remoteStreamSendHole,
+    .streamRecvHole = remoteStreamRecvHole,
     .streamFinish = remoteStreamFinish,
     .streamAbort = remoteStreamAbort,
     .streamEventAddCallback = remoteStreamEventAddCallback,
@@ -6159,7 +7041,8 @@ remoteDomainMigratePrepareTunnel3(virConnectPtr dconn,
 
     if (!(netst = virNetClientStreamNew(priv->remoteProgram,
                                         REMOTE_PROC_DOMAIN_MIGRATE_PREPARE_TUNNEL3,
-                                        priv->counter)))
+                                        priv->counter,
+                                        false)))
         goto done;
 
     if (virNetClientAddStream(priv->client, netst) < 0) {
@@ -6603,6 +7486,26 @@ remoteDomainGetDiskErrors(virDomainPtr dom,
 #include "lxc_client_bodies.h"
 #include "qemu_client_bodies.h"
 
+/* Events report only some of the changes of domains and other clients
+ * of the server can make more, but at least the calls of this connection
+ * which may change any domain drop the cached data of all of them. The
+ * procedures of the QEMU and LXC programs are not classified, so these
+ * always do. */
+static void
+remoteCacheProcDone(struct private_data *priv,
+                    unsigned int flags,
+                    int proc_nr)
+{
+    if (!priv->cache)
+        return;
+
+    if (!(flags & (REMOTE_CALL_QEMU | REMOTE_CALL_LXC)) &&
+        remoteCacheProcIsReadOnly(proc_nr))
+        return;
+
+    remoteCacheDomainInvalidateAll(priv->cache);
+}
+
 /*
  * Serial a set of arguments into a method call message,
  * send that to the server and wait for reply
@@ -6648,6 +7551,8 @@ callFull(virConnectPtr conn ATTRIBUTE_UNUSED,
     remoteDriverLock(priv);
     priv->localUses--;
 
+    remoteCacheProcDone(priv, flags, proc_nr);
+
     return rv;
 }
 
@@ -6667,6 +7572,146 @@ call(virConnectPtr conn,
                     ret_filter, ret);
 }
 
+/*
+ * Send a call without waiting for its reply, which must be collected
+ * by callAsyncWait, so that many calls can be in flight at once.
+ */
+static int
+callAsync(virConnectPtr conn ATTRIBUTE_UNUSED,
+          struct private_data *priv,
+          unsigned int flags,
+          int proc_nr,
+          xdrproc_t args_filter, char *args,
+          virNetClientProgramAsyncCallPtr *handle)
+{
+    int rv;
+    virNetClientProgramPtr prog;
+    int counter = priv->counter++;
+    virNetClientPtr client = priv->client;
+    priv->localUses++;
+
+    if (flags & REMOTE_CALL_QEMU)
+        prog = priv->qemuProgram;
+    else if (flags & REMOTE_CALL_LXC)
+        prog = priv->lxcProgram;
+    else
+        prog = priv->remoteProgram;
+
+    remoteDriverUnlock(priv);
+    rv = virNetClientProgramCallAsync(prog,
+                                      client,
+                                      counter,
+                                      proc_nr,
+                                      args_filter, args,
+                                      handle);
+    remoteDriverLock(priv);
+    priv->localUses--;
+
+    return rv;
+}
+
+static int
+callAsyncWait(virConnectPtr conn ATTRIBUTE_UNUSED,
+              struct private_data *priv,
+              virNetClientProgramAsyncCallPtr handle,
+              xdrproc_t ret_filter, char *ret)
+{
+    int rv;
+    priv->localUses++;
+
+    /* Unlock, so that if we get any async events/stream data
+     * while processing the RPC, we don't deadlock when our
+     * callbacks for those are invoked
+     */
+    remoteDriverUnlock(priv);
+    rv = virNetClientProgramWaitAsync(handle, ret_filter, ret);
+    remoteDriverLock(priv);
+    priv->localUses--;
+
+    return rv;
+}
+
+/*
+ * Make all of @calls, for servers which support it in a single
+ * message, or otherwise as asynchronous calls in flight together. Errors reported by the
+ * individual calls are stored in them, see virNetClientProgramCallBatch.
+ */
+static int
+callBatch(virConnectPtr conn,
+          struct private_data *priv,
+          unsigned int flags,
+          virNetClientProgramBatchCallPtr calls,
+          size_t ncalls)
+{
+    int rv = 0;
+    virNetClientProgramPtr prog;
+    virNetClientPtr client = priv->client;
+    size_t i;
+    priv->localUses++;
+
+    if (flags & REMOTE_CALL_QEMU)
+        prog = priv->qemuProgram;
+    else if (flags & REMOTE_CALL_LXC)
+        prog = priv->lxcProgram;
+    else
+        prog = priv->remoteProgram;
+
+    if (priv->serverCallBatch) {
+        for (i = 0; i < ncalls && rv == 0; i += VIR_NET_MESSAGE_BATCH_MAX) {
+            size_t n = MIN(ncalls - i, VIR_NET_MESSAGE_BATCH_MAX);
+            int counter = priv->counter++;
+
+            /* Unlock, so that if we get any async events/stream data
+             * while processing the RPC, we don't deadlock when our
+             * callbacks for those are invoked
+             */
+            remoteDriverUnlock(priv);
+            rv = virNetClientProgramCallBatch(prog, client, counter,
+                                              n, calls + i);
+            remoteDriverLock(priv);
+        }
+    } else {
+        virNetClientProgramAsyncCallPtr *handles = NULL;
+
+        if (VIR_ALLOC_N(handles, ncalls) < 0) {
+            priv->localUses--;
+            return -1;
+        }
+
+        /* Keep up to REMOTE_CALL_ASYNC_MAX calls in flight, collecting
+         * the reply to the oldest one before sending another one */
+        for (i = 0; i < ncalls + REMOTE_CALL_ASYNC_MAX; i++) {
+            size_t j = i - REMOTE_CALL_ASYNC_MAX;
+
+            if (i < ncalls) {
+                calls[i].error = NULL;
+                if (callAsync(conn, priv, flags, calls[i].proc,
+                              calls[i].args_filter, calls[i].args,
+                              &handles[i]) < 0) {
+                    calls[i].error = virSaveLastError();
+                    virResetLastError();
+                }
+            }
+
+            if (i >= REMOTE_CALL_ASYNC_MAX && j < ncalls && handles[j] &&
+                callAsyncWait(conn, priv, handles[j],
+                              calls[j].ret_filter, calls[j].ret) < 0) {
+                calls[j].error = virSaveLastError();
+                virResetLastError();
+            }
+        }
+
+        VIR_FREE(handles);
+    }
+
+    priv->localUses--;
+
+    for (i = 0; i < ncalls; i++)
+        remoteCacheProcDone(priv, flags, calls[i].proc);
+
+    return rv;
+}
+
 
 static int
 remoteDomainGetInterfaceParameters(virDomainPtr domain,
@@ -7083,7 +8128,8 @@ remoteDomainMigratePrepareTunnel3Params(virConnectPtr dconn,
 
     if (!(netst = virNetClientStreamNew(priv->remoteProgram,
                                         REMOTE_PROC_DOMAIN_MIGRATE_PREPARE_TUNNEL3_PARAMS,
-                                        priv->counter)))
+                                        priv->counter,
+                                        false)))
         goto cleanup;
 
     if (virNetClientAddStream(priv->client, netst) < 0) {
@@ -7602,6 +8648,144 @@ remoteNetworkGetDHCPLeases(virNetworkPtr net,
 }
 
 
+static int
+remoteConnectLookupDomainsByUUID(virConnectPtr conn,
+                                 const unsigned char *uuids,
+                                 unsigned int nuuids,
+                                 virDomainPtr **doms,
+                                 unsigned int flags)
+{
+    int rv = -1;
+    struct private_data *priv = conn->privateData;
+    remote_domain_lookup_by_uuid_args *args = NULL;
+    remote_domain_lookup_by_uuid_ret *ret = NULL;
+    virNetClientProgramBatchCallPtr calls = NULL;
+    virDomainPtr *tmpdoms = NULL;
+    int found = 0;
+    size_t i;
+
+    virCheckFlags(0, -1);
+
+    remoteDriverLock(priv);
+
+    if (VIR_ALLOC_N(args, nuuids) < 0 ||
+        VIR_ALLOC_N(ret, nuuids) < 0 ||
+        VIR_ALLOC_N(calls, nuuids) < 0 ||
+        VIR_ALLOC_N(tmpdoms, nuuids) < 0)
+        goto done;
+
+    for (i = 0; i < nuuids; i++) {
+        memcpy(args[i].uuid, uuids + i * VIR_UUID_BUFLEN, VIR_UUID_BUFLEN);
+        calls[i].proc = REMOTE_PROC_DOMAIN_LOOKUP_BY_UUID;
+        calls[i].args_filter = (xdrproc_t)xdr_remote_domain_lookup_by_uuid_args;
+        calls[i].args = &args[i];
+        calls[i].ret_filter = (xdrproc_t)xdr_remote_domain_lookup_by_uuid_ret;
+        calls[i].ret = &ret[i];
+    }
+
+    if (callBatch(conn, priv, 0, calls, nuuids) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nuuids; i++) {
+        if (calls[i].error) {
+            /* Unknown domains are left NULL, other errors are fatal */
+            if (calls[i].error->code == VIR_ERR_NO_DOMAIN)
+                continue;
+            virSetError(calls[i].error);
+            goto cleanup;
+        }
+
+        if (!(tmpdoms[i] = get_nonnull_domain(conn, ret[i].dom)))
+            goto cleanup;
+        found++;
+    }
+
+    *doms = tmpdoms;
+    tmpdoms = NULL;
+    rv = found;
+
+ cleanup:
+    for (i = 0; i < nuuids; i++) {
+        if (calls[i].error)
+            virFreeError(calls[i].error);
+        else
+            xdr_free((xdrproc_t)xdr_remote_domain_lookup_by_uuid_ret,
+                     (char *)&ret[i]);
+        if (tmpdoms)
+            virObjectUnref(tmpdoms[i]);
+    }
+
+ done:
+    VIR_FREE(tmpdoms);
+    VIR_FREE(calls);
+    VIR_FREE(ret);
+    VIR_FREE(args);
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
+static int
+remoteConnectCompareCPUs(virConnectPtr conn,
+                         const char **xmlCPUs,
+                         unsigned int ncpus,
+                         int *results,
+                         char **baseline,
+                         unsigned int flags)
+{
+    int rv = -1;
+    remote_connect_compare_cpus_args args;
+    remote_connect_compare_cpus_ret ret;
+    struct private_data *priv = conn->privateData;
+
+    remoteDriverLock(priv);
+
+    if (ncpus > REMOTE_CPU_BASELINE_MAX) {
+        virReportError(VIR_ERR_RPC,
+                       _("too many CPUs: %u > %d"),
+                       ncpus, REMOTE_CPU_BASELINE_MAX);
+        goto done;
+    }
+
+    args.xmlCPUs.xmlCPUs_val = (char **) xmlCPUs;
+    args.xmlCPUs.xmlCPUs_len = ncpus;
+    args.want_baseline = !!baseline;
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_COMPARE_CPUS,
+             (xdrproc_t) xdr_remote_connect_compare_cpus_args, (char *)&args,
+             (xdrproc_t) xdr_remote_connect_compare_cpus_ret, (char *)&ret) == -1)
+        goto done;
+
+    if (ret.results.results_len != ncpus * ncpus) {
+        virReportError(VIR_ERR_RPC,
+                       _("unexpected number of CPU comparison results: %u"),
+                       ret.results.results_len);
+        goto cleanup;
+    }
+
+    if (baseline && !ret.baseline) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("missing baseline CPU in the reply"));
+        goto cleanup;
+    }
+
+    memcpy(results, ret.results.results_val, ncpus * ncpus * sizeof(*results));
+    if (baseline)
+        VIR_STEAL_PTR(*baseline, *ret.baseline);
+
+    rv = 0;
+
+ cleanup:
+    xdr_free((xdrproc_t) xdr_remote_connect_compare_cpus_ret, (char *) &ret);
+
+ done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
 static int
 remoteConnectGetAllDomainStats(virConnectPtr conn,
                                virDomainPtr *doms,
@@ -7693,6 +8877,85 @@ remoteConnectGetAllDomainStats(virConnectPtr conn,
 }
 
 
+static int
+remoteConnectListAllDomainsFields(virConnectPtr conn,
+                                  unsigned int fields,
+                                  virDomainStatsRecordPtr **records,
+                                  unsigned int flags)
+{
+    struct private_data *priv = conn->privateData;
+    int rv = -1;
+    size_t i;
+    remote_connect_list_all_domains_fields_args args;
+    remote_connect_list_all_domains_fields_ret ret;
+    virDomainStatsRecordPtr elem = NULL;
+    virDomainStatsRecordPtr *tmpret = NULL;
+
+    args.need_results = !!records;
+    args.fields = fields;
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+
+    remoteDriverLock(priv);
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_LIST_ALL_DOMAINS_FIELDS,
+             (xdrproc_t)xdr_remote_connect_list_all_domains_fields_args, (char *)&args,
+             (xdrproc_t)xdr_remote_connect_list_all_domains_fields_ret, (char *)&ret) == -1) {
+        remoteDriverUnlock(priv);
+        goto cleanup;
+    }
+    remoteDriverUnlock(priv);
+
+    if (ret.records.records_len > REMOTE_DOMAIN_LIST_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of domain records is %d, which exceeds max limit: %d"),
+                       ret.records.records_len, REMOTE_DOMAIN_LIST_MAX);
+        goto cleanup;
+    }
+
+    if (records) {
+        if (VIR_ALLOC_N(tmpret, ret.records.records_len + 1) < 0)
+            goto cleanup;
+
+        for (i = 0; i < ret.records.records_len; i++) {
+            remote_domain_stats_record *rec = ret.records.records_val + i;
+
+            if (VIR_ALLOC(elem) < 0)
+                goto cleanup;
+
+            if (!(elem->dom = get_nonnull_domain(conn, rec->dom)))
+                goto cleanup;
+
+            if (virTypedParamsDeserialize((virTypedParameterRemotePtr) rec->params.params_val,
+                                          rec->params.params_len,
+                                          REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX,
+                                          &elem->params,
+                                          &elem->nparams))
+                goto cleanup;
+
+            tmpret[i] = elem;
+            elem = NULL;
+        }
+
+        *records = tmpret;
+        tmpret = NULL;
+    }
+
+    rv = ret.ret;
+
+ cleanup:
+    if (elem) {
+        virObjectUnref(elem->dom);
+        VIR_FREE(elem);
+    }
+    virDomainStatsRecordListFree(tmpret);
+    xdr_free((xdrproc_t)xdr_remote_connect_list_all_domains_fields_ret,
+             (char *) &ret);
+
+    return rv;
+}
+
+
 static int
 remoteNodeAllocPages(virConnectPtr conn,
                      unsigned int npages,
@@ -8434,6 +9697,17 @@ static virHypervisorDriver hypervisor_driver = {
     .domainSetGuestVcpus = remoteDomainSetGuestVcpus, /* 2.0.0 */
     .domainSetVcpu = remoteDomainSetVcpu, /* 3.1.0 */
     .domainSetBlockThreshold = remoteDomainSetBlockThreshold, /* 3.2.0 */
+    .domainSetStatsEvent = remoteDomainSetStatsEvent, /* 3.3.0 */
+    .connectLookupDomainsByUUID = remoteConnectLookupDomainsByUUID, /* 3.3.0 */
+    .connectCompareCPUs = remoteConnectCompareCPUs, /* 3.3.0 */
+    .domainAttachDevices = remoteDomainAttachDevices, /* 3.3.0 */
+    .connectListAllDomainsFields = remoteConnectListAllDomainsFields, /* 3.3.0 */
+    .domainBackupBegin = remoteDomainBackupBegin, /* 3.3.0 */
+    .domainBackupGetXMLDesc = remoteDomainBackupGetXMLDesc, /* 3.3.0 */
+    .domainBackupEnd = remoteDomainBackupEnd, /* 3.3.0 */
+    .domainBlockJobGroupStart = remoteDomainBlockJobGroupStart, /* 3.3.0 */
+    .domainBlockJobGroupGetStats = remoteDomainBlockJobGroupGetStats, /* 3.3.0 */
+    .domainBlockJobGroupAbort = remoteDomainBlockJobGroupAbort, /* 3.3.0 */
 };
 
 static virNetworkDriver network_driver = {
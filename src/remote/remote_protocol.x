@@ -115,6 +115,9 @@ const REMOTE_DOMAIN_PERF_EVENTS_MAX = 64;
 /* Upper limit on block copy tunable parameters. */
 const REMOTE_DOMAIN_BLOCK_COPY_PARAMETERS_MAX = 16;
 
+/* Upper limit on block job group parameters and statistics. */
+const REMOTE_DOMAIN_BLOCK_JOB_GROUP_PARAMETERS_MAX = 1024;
+
 /* Upper limit on list of node cpu stats. */
 const REMOTE_NODE_CPU_STATS_MAX = 16;
 
@@ -186,6 +189,17 @@ const REMOTE_SECRET_LIST_MAX = 16384;
  */
 const REMOTE_CPU_BASELINE_MAX = 256;
 
+/*
+ * Upper limit on the results of comparing CPUs with each other, one for
+ * each pair of the at most REMOTE_CPU_BASELINE_MAX CPUs.
+ */
+const REMOTE_CPU_COMPARE_RESULTS_MAX = 65536;
+
+/*
+ * Upper limit on the number of devices attached by a single call.
+ */
+const REMOTE_DOMAIN_ATTACH_DEVICES_MAX = 256;
+
 /*
  * Max number of sending keycodes.
  */
@@ -3086,6 +3100,12 @@ struct remote_domain_event_callback_tunable_msg {
     remote_typed_param params<REMOTE_DOMAIN_EVENT_TUNABLE_MAX>;
 };
 
+struct remote_domain_event_callback_stats_msg {
+    int callbackID;
+    remote_nonnull_domain dom;
+    remote_typed_param params<REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX>;
+};
+
 struct remote_domain_event_callback_device_added_msg {
     int callbackID;
     remote_nonnull_domain dom;
@@ -3409,6 +3429,87 @@ struct remote_domain_set_block_threshold_args {
     unsigned int flags;
 };
 
+struct remote_domain_set_stats_event_args {
+    remote_nonnull_domain dom;
+    unsigned int stats;
+    unsigned int interval;
+    unsigned int flags;
+};
+
+struct remote_connect_compare_cpus_args {
+    remote_nonnull_string xmlCPUs<REMOTE_CPU_BASELINE_MAX>; /* (const char **) */
+    int want_baseline;
+    unsigned int flags;
+};
+
+struct remote_connect_compare_cpus_ret {
+    int results<REMOTE_CPU_COMPARE_RESULTS_MAX>;
+    remote_string baseline;
+};
+
+struct remote_domain_attach_devices_args {
+    remote_nonnull_domain dom;
+    remote_nonnull_string xmls<REMOTE_DOMAIN_ATTACH_DEVICES_MAX>; /* (const char **) */
+    unsigned int flags;
+};
+
+struct remote_connect_list_all_domains_fields_args {
+    int need_results;
+    unsigned int fields;
+    unsigned int flags;
+};
+
+struct remote_connect_list_all_domains_fields_ret {
+    remote_domain_stats_record records<REMOTE_DOMAIN_LIST_MAX>;
+    unsigned int ret;
+};
+
+struct remote_domain_backup_begin_args {
+    remote_nonnull_domain dom;
+    remote_nonnull_string backup_xml;
+    unsigned int flags;
+};
+
+struct remote_domain_backup_get_xml_desc_args {
+    remote_nonnull_domain dom;
+    unsigned int flags;
+};
+
+struct remote_domain_backup_get_xml_desc_ret {
+    remote_nonnull_string xml;
+};
+
+struct remote_domain_backup_end_args {
+    remote_nonnull_domain dom;
+    unsigned int flags;
+};
+
+struct remote_domain_block_job_group_start_args {
+    remote_nonnull_domain dom;
+    remote_typed_param params<REMOTE_DOMAIN_BLOCK_JOB_GROUP_PARAMETERS_MAX>;
+    unsigned int flags;
+};
+
+struct remote_domain_block_job_group_get_stats_args {
+    remote_nonnull_domain dom;
+    unsigned int flags;
+};
+
+struct remote_domain_block_job_group_get_stats_ret {
+    remote_typed_param params<REMOTE_DOMAIN_BLOCK_JOB_GROUP_PARAMETERS_MAX>;
+};
+
+struct remote_domain_block_job_group_abort_args {
+    remote_nonnull_domain dom;
+    unsigned int flags;
+};
+
+struct remote_domain_event_callback_block_job_group_msg {
+    int callbackID;
+    remote_nonnull_domain dom;
+    remote_typed_param params<REMOTE_DOMAIN_BLOCK_JOB_GROUP_PARAMETERS_MAX>;
+};
+
 
 /*----- Protocol. -----*/
 
@@ -3434,6 +3535,11 @@ enum remote_procedure {
      *   <paramnumber> specifies at which offset the stream parameter is inserted
      *   in the function parameter list.
      *
+     * - @sparseflag: flag
+     *
+     *   The @sparseflag annotation names the flag which, when passed to a
+     *   stream API, enables holes to be transferred within the stream.
+     *
      * - @priority: low|high
      *
      *   Each API that might eventually access hypervisor's monitor (and thus
@@ -3484,7 +3590,7 @@ enum remote_procedure {
     REMOTE_PROC_CONNECT_GET_TYPE = 3,
 
     /**
-     * @generate: both
+     * @generate: server
      * @priority: high
      * @acl: connect:getattr
      */
@@ -3505,7 +3611,7 @@ enum remote_procedure {
     REMOTE_PROC_NODE_GET_INFO = 6,
 
     /**
-     * @generate: both
+     * @generate: server
      * @acl: connect:read
      */
     REMOTE_PROC_CONNECT_GET_CAPABILITIES = 7,
@@ -3551,7 +3657,7 @@ enum remote_procedure {
     REMOTE_PROC_DOMAIN_DETACH_DEVICE = 13,
 
     /**
-     * @generate: both
+     * @generate: server
      * @acl: domain:read
      * @acl: domain:read_secure:VIR_DOMAIN_XML_SECURE
      * @acl: domain:read_secure:VIR_DOMAIN_XML_MIGRATABLE
@@ -3615,14 +3721,14 @@ enum remote_procedure {
     REMOTE_PROC_DOMAIN_LOOKUP_BY_ID = 22,
 
     /**
-     * @generate: both
+     * @generate: server
      * @priority: high
      * @acl: domain:getattr
      */
     REMOTE_PROC_DOMAIN_LOOKUP_BY_NAME = 23,
 
     /**
-     * @generate: both
+     * @generate: server
      * @priority: high
      * @acl: domain:getattr
      */
@@ -3858,12 +3964,12 @@ enum remote_procedure {
 
     /**
      * @generate: both
-     * @acl: domain:read
+     * @acl: domain:write
      */
     REMOTE_PROC_DOMAIN_SET_SCHEDULER_PARAMETERS = 58,
 
     /**
-     * @generate: both
+     * @generate: server
      * @priority: high
      * @acl: connect:getattr
      */
@@ -4845,7 +4951,7 @@ enum remote_procedure {
     REMOTE_PROC_DOMAIN_GET_VCPUS_FLAGS = 200,
 
     /**
-     * @generate: both
+     * @generate: client
      * @readstream: 2
      * @acl: domain:open_device
      */
@@ -4896,6 +5002,7 @@ enum remote_procedure {
     /**
      * @generate: both
      * @writestream: 1
+     * @sparseflag: VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM
      * @acl: storage_vol:data_write
      */
     REMOTE_PROC_STORAGE_VOL_UPLOAD = 208,
@@ -4903,6 +5010,7 @@ enum remote_procedure {
     /**
      * @generate: both
      * @readstream: 1
+     * @sparseflag: VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM
      * @acl: storage_vol:data_read
      */
     REMOTE_PROC_STORAGE_VOL_DOWNLOAD = 209,
@@ -5534,6 +5642,7 @@ enum remote_procedure {
 
     /**
      * @generate: none
+     * @writestream: 1
      * @acl: domain:migrate
      * @acl: domain:start
      * @acl: domain:write
@@ -6062,7 +6171,83 @@ enum remote_procedure {
      * @generate: both
      * @acl: domain:write
      */
-    REMOTE_PROC_DOMAIN_SET_BLOCK_THRESHOLD = 386
+    REMOTE_PROC_DOMAIN_SET_BLOCK_THRESHOLD = 386,
+
+    /**
+     * @generate: both
+     * @acl: domain:write
+     */
+    REMOTE_PROC_DOMAIN_SET_STATS_EVENT = 387,
+
+    /**
+     * @generate: both
+     * @acl: none
+     */
+    REMOTE_PROC_DOMAIN_EVENT_CALLBACK_STATS = 388,
+
+    /**
+     * @generate: none
+     * @acl: connect:read
+     */
+    REMOTE_PROC_CONNECT_COMPARE_CPUS = 389,
+
+    /**
+     * @generate: both
+     * @acl: domain:write
+     * @acl: domain:save:!VIR_DOMAIN_AFFECT_CONFIG|VIR_DOMAIN_AFFECT_LIVE
+     * @acl: domain:save:VIR_DOMAIN_AFFECT_CONFIG
+     */
+    REMOTE_PROC_DOMAIN_ATTACH_DEVICES = 390,
+
+    /**
+     * @generate: none
+     * @priority: high
+     * @acl: connect:search_domains
+     * @aclfilter: domain:getattr
+     */
+    REMOTE_PROC_CONNECT_LIST_ALL_DOMAINS_FIELDS = 391,
+
+    /**
+     * @generate: both
+     * @acl: domain:block_write
+     */
+    REMOTE_PROC_DOMAIN_BACKUP_BEGIN = 392,
+
+    /**
+     * @generate: both
+     * @acl: domain:read
+     */
+    REMOTE_PROC_DOMAIN_BACKUP_GET_XML_DESC = 393,
+
+    /**
+     * @generate: both
+     * @acl: domain:block_write
+     */
+    REMOTE_PROC_DOMAIN_BACKUP_END = 394,
+
+    /**
+     * @generate: both
+     * @acl: domain:block_write
+     */
+    REMOTE_PROC_DOMAIN_BLOCK_JOB_GROUP_START = 395,
+
+    /**
+     * @generate: none
+     * @acl: domain:read
+     */
+    REMOTE_PROC_DOMAIN_BLOCK_JOB_GROUP_GET_STATS = 396,
+
+    /**
+     * @generate: both
+     * @acl: domain:block_write
+     */
+    REMOTE_PROC_DOMAIN_BLOCK_JOB_GROUP_ABORT = 397,
+
+    /**
+     * @generate: both
+     * @acl: none
+     */
+    REMOTE_PROC_DOMAIN_EVENT_CALLBACK_BLOCK_JOB_GROUP = 398
 
 
 };
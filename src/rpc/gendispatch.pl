@@ -62,6 +62,7 @@ sub fixup_name {
     $name =~ s/Id$/ID/;
     $name =~ s/Mac$/MAC/;
     $name =~ s/Cpu$/CPU/;
+    $name =~ s/Cpus$/CPUs/;
     $name =~ s/Os$/OS/;
     $name =~ s/Nmi$/NMI/;
     $name =~ s/Pm/PM/;
@@ -281,6 +282,13 @@ while (<PROTOCOL>) {
             $calls{$name}->{streamflag} = "none";
         }
 
+        if (exists $opts{sparseflag}) {
+            die "\@sparseflag requires stream" unless $calls{$name}->{streamflag} ne "none";
+            $calls{$name}->{sparseflag} = $opts{sparseflag};
+        } else {
+            $calls{$name}->{sparseflag} = "none";
+        }
+
         $calls{$name}->{acl} = $opts{acl};
         $calls{$name}->{aclfilter} = $opts{aclfilter};
 
@@ -447,6 +455,7 @@ elsif ($mode eq "server") {
         print "{\n";
         print "  int rv;\n";
         print "  virThreadJobSet(\"$name\");\n";
+        print "  virTraceSetName(\"$name\");\n";
         print "  VIR_DEBUG(\"server=%p client=%p msg=%p rerr=%p args=%p ret=%p\",\n";
         print "            server, client, msg, rerr, args, ret);\n";
         print "  rv = $name(server, client, msg, rerr";
@@ -1024,7 +1033,13 @@ elsif ($mode eq "server") {
             print "    if (!(st = virStreamNew(priv->conn, VIR_STREAM_NONBLOCK)))\n";
             print "        goto cleanup;\n";
             print "\n";
-            print "    if (!(stream = daemonCreateClientStream(client, st, remoteProgram, &msg->header)))\n";
+            print "    if (!(stream = daemonCreateClientStream(client, st, remoteProgram, &msg->header, ";
+            if ($call->{sparseflag} ne "none") {
+                print "args->flags & $call->{sparseflag}";
+            } else {
+                print "false";
+            }
+            print ")))\n";
             print "        goto cleanup;\n";
             print "\n";
         }
@@ -1190,7 +1205,7 @@ elsif ($mode eq "server") {
 
     print "virNetServerProgramProc ${structprefix}Procs[] = {\n";
     for ($id = 0 ; $id <= $#calls ; $id++) {
-        my ($comment, $name, $argtype, $arglen, $argfilter, $retlen, $retfilter, $priority);
+        my ($comment, $name, $argtype, $arglen, $argfilter, $retlen, $retfilter, $priority, $stream);
 
         if (defined $calls[$id] && !$calls[$id]->{msg}) {
             $comment = "/* Method $calls[$id]->{ProcName} => $id */";
@@ -1214,8 +1229,10 @@ elsif ($mode eq "server") {
         }
 
     $priority = defined $calls[$id]->{priority} ? $calls[$id]->{priority} : 0;
+    $stream = defined $calls[$id] && defined $calls[$id]->{streamflag} &&
+        $calls[$id]->{streamflag} ne "none" ? "true" : "false";
 
-        print "{ $comment\n   ${name},\n   $arglen,\n   (xdrproc_t)$argfilter,\n   $retlen,\n   (xdrproc_t)$retfilter,\n   true,\n   $priority\n},\n";
+        print "{ $comment\n   ${name},\n   $arglen,\n   (xdrproc_t)$argfilter,\n   $retlen,\n   (xdrproc_t)$retfilter,\n   true,\n   $priority,\n   $stream\n},\n";
     }
     print "};\n";
     print "size_t ${structprefix}NProcs = ARRAY_CARDINALITY(${structprefix}Procs);\n";
@@ -1738,7 +1755,13 @@ elsif ($mode eq "client") {
 
         if ($call->{streamflag} ne "none") {
             print "\n";
-            print "    if (!(netst = virNetClientStreamNew(priv->remoteProgram, $call->{constname}, priv->counter)))\n";
+            print "    if (!(netst = virNetClientStreamNew(priv->remoteProgram, $call->{constname}, priv->counter, ";
+            if ($call->{sparseflag} ne "none") {
+                print "flags & $call->{sparseflag}";
+            } else {
+                print "false";
+            }
+            print ")))\n";
             print "        goto done;\n";
             print "\n";
             print "    if (virNetClientAddStream(priv->client, netst) < 0) {\n";
@@ -1944,6 +1967,36 @@ elsif ($mode eq "client") {
         print "    return rv;\n";
         print "}\n";
     }
+
+    # The remote driver keeps cached domain data across procedures which
+    # can only read it, see remoteCacheProcDone
+    if ($structprefix eq "remote") {
+        print "\n\n";
+        print "static bool\n";
+        print "remoteCacheProcIsReadOnly(int proc)\n";
+        print "{\n";
+        print "    switch (proc) {\n";
+
+        foreach (sort { $calls{$a}->{constname} cmp $calls{$b}->{constname} } keys %calls) {
+            my $call = $calls{$_};
+            my $readonly = 1;
+
+            foreach my $acl (@{$call->{acl}}) {
+                next if $acl eq "none";
+                my @bits = split /:/, $acl;
+                $readonly = 0
+                    unless $bits[1] =~ /^(read|read_secure|getattr|search_\w+)$/;
+            }
+
+            print "    case $call->{constname}:\n" if $readonly;
+        }
+
+        print "        return true;\n";
+        print "    default:\n";
+        print "        return false;\n";
+        print "    }\n";
+        print "}\n";
+    }
 } elsif ($mode eq "aclheader" ||
          $mode eq "aclbody" ||
          $mode eq "aclsym" ||
@@ -44,7 +44,11 @@ struct _virKeepAlive {
     unsigned int countToDeath;
     time_t lastPacketReceived;
     time_t intervalStart;
-    int timer;
+    bool started;
+
+    /* Position in the scheduler heap, -1 when not queued */
+    ssize_t schedIdx;
+    time_t deadline;
 
     virKeepAliveSendFunc sendCB;
     virKeepAliveDeadFunc deadCB;
@@ -53,6 +57,30 @@ struct _virKeepAlive {
 };
 
 
+/*
+ * Instead of a timer per connection, all the started keepalive objects of
+ * the process are kept in a single heap ordered by their deadline and one
+ * timer fires at the earliest deadline. All the connections due in the same
+ * second are thus handled in one sweep. Incoming traffic moves the deadline
+ * of a connection forward without touching the heap, the sweep just queues
+ * such a connection again without pinging it once it finds out.
+ *
+ * Lock ordering: a keepalive object lock may be held while taking the
+ * scheduler lock, never the other way round.
+ */
+typedef struct _virKeepAliveScheduler virKeepAliveScheduler;
+struct _virKeepAliveScheduler {
+    virMutex lock;
+    int timer;
+
+    /* Objects queued by the scheduler, each one holding a reference */
+    virKeepAlivePtr *heap;
+    size_t nheap;
+    size_t aheap;
+};
+
+static virKeepAliveScheduler virKeepAliveSched;
+
 static virClassPtr virKeepAliveClass;
 static void virKeepAliveDispose(void *obj);
 
@@ -64,6 +92,13 @@ static int virKeepAliveOnceInit(void)
                                           virKeepAliveDispose)))
         return -1;
 
+    if (virMutexInit(&virKeepAliveSched.lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize keepalive scheduler"));
+        return -1;
+    }
+    virKeepAliveSched.timer = -1;
+
     return 0;
 }
 
@@ -124,11 +159,8 @@ virKeepAliveTimerInternal(virKeepAlivePtr ka,
     if (ka->interval <= 0 || ka->intervalStart == 0)
         return false;
 
-    if (now - ka->intervalStart < ka->interval) {
-        timeval = ka->interval - (now - ka->intervalStart);
-        virEventUpdateTimeout(ka->timer, timeval * 1000);
+    if (now - ka->intervalStart < ka->interval)
         return false;
-    }
 
     timeval = now - ka->lastPacketReceived;
     PROBE(RPC_KEEPALIVE_TIMEOUT,
@@ -146,43 +178,214 @@ virKeepAliveTimerInternal(virKeepAlivePtr ka,
         ka->countToDeath--;
         ka->intervalStart = now;
         *msg = virKeepAliveMessage(ka, KEEPALIVE_PROC_PING);
-        virEventUpdateTimeout(ka->timer, ka->interval * 1000);
         return false;
     }
 }
 
 
+/* The virKeepAliveSched* helpers below have to be called with the
+ * scheduler lock held. */
+static void
+virKeepAliveSchedSwap(size_t i, size_t j)
+{
+    virKeepAlivePtr *heap = virKeepAliveSched.heap;
+    virKeepAlivePtr tmp = heap[i];
+
+    heap[i] = heap[j];
+    heap[j] = tmp;
+    heap[i]->schedIdx = i;
+    heap[j]->schedIdx = j;
+}
+
+
+static void
+virKeepAliveSchedSiftUp(size_t i)
+{
+    virKeepAlivePtr *heap = virKeepAliveSched.heap;
+
+    while (i > 0 && heap[(i - 1) / 2]->deadline > heap[i]->deadline) {
+        virKeepAliveSchedSwap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+
+static void
+virKeepAliveSchedSiftDown(size_t i)
+{
+    virKeepAlivePtr *heap = virKeepAliveSched.heap;
+    size_t n = virKeepAliveSched.nheap;
+
+    for (;;) {
+        size_t min = i;
+        size_t l = 2 * i + 1;
+        size_t r = 2 * i + 2;
+
+        if (l < n && heap[l]->deadline < heap[min]->deadline)
+            min = l;
+        if (r < n && heap[r]->deadline < heap[min]->deadline)
+            min = r;
+        if (min == i)
+            break;
+
+        virKeepAliveSchedSwap(i, min);
+        i = min;
+    }
+}
+
+
+/* Makes the timer fire at the earliest deadline of the queued objects */
+static void
+virKeepAliveSchedUpdateTimer(void)
+{
+    time_t timeout;
+
+    if (virKeepAliveSched.timer < 0)
+        return;
+
+    if (virKeepAliveSched.nheap == 0) {
+        virEventUpdateTimeout(virKeepAliveSched.timer, -1);
+        return;
+    }
+
+    timeout = virKeepAliveSched.heap[0]->deadline - time(NULL);
+    if (timeout < 0)
+        timeout = 0;
+    /* Guard against overflow */
+    if (timeout > INT_MAX / 1000)
+        timeout = INT_MAX / 1000;
+
+    virEventUpdateTimeout(virKeepAliveSched.timer, timeout * 1000);
+}
+
+
+/* Removes @ka from the heap, the caller takes over the reference the heap
+ * held */
 static void
-virKeepAliveTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
+virKeepAliveSchedRemove(virKeepAlivePtr ka)
+{
+    size_t i = ka->schedIdx;
+    size_t last = virKeepAliveSched.nheap - 1;
+
+    if (i != last) {
+        virKeepAliveSchedSwap(i, last);
+        virKeepAliveSched.nheap--;
+        virKeepAliveSchedSiftUp(i);
+        virKeepAliveSchedSiftDown(i);
+    } else {
+        virKeepAliveSched.nheap--;
+    }
+
+    virKeepAliveSched.heap[virKeepAliveSched.nheap] = NULL;
+    ka->schedIdx = -1;
+}
+
+
+static void virKeepAliveSchedTimer(int timer, void *opaque);
+
+
+/* Queues @ka, which must be locked, or moves it within the queue according
+ * to its current deadline. */
+static int
+virKeepAliveSchedule(virKeepAlivePtr ka)
+{
+    int ret = -1;
+    time_t now = time(NULL);
+
+    ka->deadline = ka->intervalStart + ka->interval;
+    if (ka->deadline <= now)
+        ka->deadline = now;
+
+    virMutexLock(&virKeepAliveSched.lock);
+
+    if (virKeepAliveSched.timer < 0 &&
+        (virKeepAliveSched.timer = virEventAddTimeout(-1,
+                                                      virKeepAliveSchedTimer,
+                                                      NULL, NULL)) < 0)
+        goto cleanup;
+
+    if (ka->schedIdx < 0) {
+        if (VIR_RESIZE_N(virKeepAliveSched.heap, virKeepAliveSched.aheap,
+                         virKeepAliveSched.nheap, 1) < 0)
+            goto cleanup;
+
+        ka->schedIdx = virKeepAliveSched.nheap;
+        virKeepAliveSched.heap[virKeepAliveSched.nheap++] = virObjectRef(ka);
+    }
+
+    virKeepAliveSchedSiftUp(ka->schedIdx);
+    virKeepAliveSchedSiftDown(ka->schedIdx);
+    virKeepAliveSchedUpdateTimer();
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&virKeepAliveSched.lock);
+    return ret;
+}
+
+
+/* Called with a reference to @ka which was just taken off the heap */
+static void
+virKeepAliveCheck(virKeepAlivePtr ka)
 {
-    virKeepAlivePtr ka = opaque;
     virNetMessagePtr msg = NULL;
     bool dead;
     void *client;
 
     virObjectLock(ka);
 
+    if (!ka->started) {
+        virObjectUnlock(ka);
+        return;
+    }
+
     client = ka->client;
     dead = virKeepAliveTimerInternal(ka, &msg);
 
-    if (!dead && !msg)
-        goto cleanup;
+    /* A dead connection is going to be closed by deadCB, there's no point
+     * in checking it again. Without an interval there's nothing to check
+     * either until virKeepAliveStart queues @ka again; requeueing it would
+     * make it due right away and the sweep would never end. */
+    if (!dead && ka->interval > 0 && ka->intervalStart != 0 &&
+        virKeepAliveSchedule(ka) < 0)
+        VIR_WARN("Failed to reschedule keepalive for client %p", client);
 
-    virObjectRef(ka);
     virObjectUnlock(ka);
 
     if (dead) {
         ka->deadCB(client);
-    } else if (ka->sendCB(client, msg) < 0) {
+    } else if (msg && ka->sendCB(client, msg) < 0) {
         VIR_WARN("Failed to send keepalive request to client %p", client);
         virNetMessageFree(msg);
     }
+}
 
-    virObjectLock(ka);
-    virObjectUnref(ka);
 
- cleanup:
-    virObjectUnlock(ka);
+static void
+virKeepAliveSchedTimer(int timer ATTRIBUTE_UNUSED,
+                       void *opaque ATTRIBUTE_UNUSED)
+{
+    time_t now = time(NULL);
+    virKeepAlivePtr ka;
+
+    /* Every checked object is either dropped or queued again with a
+     * deadline in the future, see virKeepAliveCheck, so this loop ends
+     * within one sweep. */
+    for (;;) {
+        virMutexLock(&virKeepAliveSched.lock);
+        if (virKeepAliveSched.nheap == 0 ||
+            virKeepAliveSched.heap[0]->deadline > now) {
+            virKeepAliveSchedUpdateTimer();
+            virMutexUnlock(&virKeepAliveSched.lock);
+            break;
+        }
+        ka = virKeepAliveSched.heap[0];
+        virKeepAliveSchedRemove(ka);
+        virMutexUnlock(&virKeepAliveSched.lock);
+
+        virKeepAliveCheck(ka);
+        virObjectUnref(ka);
+    }
 }
 
 
@@ -207,7 +410,7 @@ virKeepAliveNew(int interval,
     ka->interval = interval;
     ka->count = count;
     ka->countToDeath = count;
-    ka->timer = -1;
+    ka->schedIdx = -1;
     ka->client = client;
     ka->sendCB = sendCB;
     ka->deadCB = deadCB;
@@ -245,7 +448,7 @@ virKeepAliveStart(virKeepAlivePtr ka,
 
     virObjectLock(ka);
 
-    if (ka->timer >= 0) {
+    if (ka->started) {
         VIR_DEBUG("Keepalive messages already enabled");
         ret = 0;
         goto cleanup;
@@ -285,13 +488,10 @@ virKeepAliveStart(virKeepAlivePtr ka,
     else
         timeout = ka->interval - delay;
     ka->intervalStart = now - (ka->interval - timeout);
-    ka->timer = virEventAddTimeout(timeout * 1000, virKeepAliveTimer,
-                                   ka, virObjectFreeCallback);
-    if (ka->timer < 0)
+    if (virKeepAliveSchedule(ka) < 0)
         goto cleanup;
 
-    /* the timer now has another reference to this object */
-    virObjectRef(ka);
+    ka->started = true;
     ret = 0;
 
  cleanup:
@@ -309,9 +509,14 @@ virKeepAliveStop(virKeepAlivePtr ka)
           "ka=%p client=%p",
           ka, ka->client);
 
-    if (ka->timer > 0) {
-        virEventRemoveTimeout(ka->timer);
-        ka->timer = -1;
+    ka->started = false;
+    if (ka->schedIdx >= 0) {
+        virMutexLock(&virKeepAliveSched.lock);
+        virKeepAliveSchedRemove(ka);
+        virKeepAliveSchedUpdateTimer();
+        virMutexUnlock(&virKeepAliveSched.lock);
+        /* drop the reference the scheduler held */
+        virObjectUnref(ka);
     }
 
     virObjectUnlock(ka);
@@ -409,9 +614,6 @@ virKeepAliveCheckMessage(virKeepAlivePtr ka,
         }
     }
 
-    if (ka->timer >= 0)
-        virEventUpdateTimeout(ka->timer, ka->interval * 1000);
-
     virObjectUnlock(ka);
 
     return ret;
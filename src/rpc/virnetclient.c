@@ -43,9 +43,6 @@
 
 VIR_LOG_INIT("rpc.netclient");
 
-typedef struct _virNetClientCall virNetClientCall;
-typedef virNetClientCall *virNetClientCallPtr;
-
 enum {
     VIR_NET_CLIENT_MODE_WAIT_TX,
     VIR_NET_CLIENT_MODE_WAIT_RX,
@@ -59,6 +56,8 @@ struct _virNetClientCall {
     bool expectReply;
     bool nonBlock;
     bool haveThread;
+    bool async;   /* Owned by the caller of virNetClientSendAsync */
+    bool aborted; /* Async call dropped because the client was closed */
 
     virCond cond;
 
@@ -95,7 +94,8 @@ struct _virNetClient {
      * List of calls currently waiting for dispatch
      * The calls should all have threads waiting for
      * them, except possibly the first call in the list
-     * which might be a partially sent non-blocking call.
+     * which might be a partially sent non-blocking call,
+     * and asynchronous calls nobody waits for yet.
      */
     virNetClientCallPtr waitDispatch;
     /* True if a thread holds the buck */
@@ -1124,7 +1124,7 @@ virNetClientCallDispatchReply(virNetClientPtr client)
         return -1;
     }
 
-    if (VIR_REALLOC_N(thecall->msg->buffer, client->msg.bufferLength) < 0)
+    if (virNetMessageReserveBuffer(thecall->msg, client->msg.bufferLength) < 0)
         return -1;
 
     memcpy(thecall->msg->buffer, client->msg.buffer, client->msg.bufferLength);
@@ -1202,7 +1202,8 @@ static int virNetClientCallDispatchStream(virNetClientPtr client)
     /* Status is either
      *   - VIR_NET_OK - no payload for streams
      *   - VIR_NET_ERROR - followed by a remote_error struct
-     *   - VIR_NET_CONTINUE - followed by a raw data packet
+     *   - VIR_NET_CONTINUE - followed by a raw data packet,
+     *                        or a hole description for VIR_NET_STREAM_HOLE
      */
     switch (client->msg.header.status) {
     case VIR_NET_CONTINUE: {
@@ -1278,12 +1279,14 @@ virNetClientCallDispatch(virNetClientPtr client)
     switch (client->msg.header.type) {
     case VIR_NET_REPLY: /* Normal RPC replies */
     case VIR_NET_REPLY_WITH_FDS: /* Normal RPC replies with FDs */
+    case VIR_NET_REPLY_BATCH: /* Replies to a batch of RPC calls */
         return virNetClientCallDispatchReply(client);
 
     case VIR_NET_MESSAGE: /* Async notifications */
         return virNetClientCallDispatchMessage(client);
 
     case VIR_NET_STREAM: /* Stream protocol */
+    case VIR_NET_STREAM_HOLE: /* Sparse stream protocol */
         return virNetClientCallDispatchStream(client);
 
     default:
@@ -1310,9 +1313,22 @@ virNetClientIOWriteMessage(virNetClientPtr client,
             return ret;
 
         thecall->msg->bufferOffset += ret;
+        if (thecall->msg->bufferOffset < thecall->msg->bufferLength)
+            return ret;
     }
 
-    if (thecall->msg->bufferOffset == thecall->msg->bufferLength) {
+    if (thecall->msg->dataOffset < thecall->msg->dataLength) {
+        ret = virNetSocketWrite(client->sock,
+                                thecall->msg->data + thecall->msg->dataOffset,
+                                thecall->msg->dataLength - thecall->msg->dataOffset);
+        if (ret <= 0)
+            return ret;
+
+        thecall->msg->dataOffset += ret;
+    }
+
+    if (thecall->msg->bufferOffset == thecall->msg->bufferLength &&
+        thecall->msg->dataOffset == thecall->msg->dataLength) {
         size_t i;
         for (i = thecall->msg->donefds; i < thecall->msg->nfds; i++) {
             int rv;
@@ -1371,7 +1387,8 @@ virNetClientIOReadMessage(virNetClientPtr client)
     /* Start by reading length word */
     if (client->msg.bufferLength == 0) {
         client->msg.bufferLength = 4;
-        if (VIR_ALLOC_N(client->msg.buffer, client->msg.bufferLength) < 0)
+        if (virNetMessageReserveBuffer(&client->msg,
+                                       client->msg.bufferLength) < 0)
             return -ENOMEM;
     }
 
@@ -1451,7 +1468,7 @@ virNetClientIOHandleInput(virNetClientPtr client)
                 }
 
                 ret = virNetClientCallDispatch(client);
-                virNetMessageClear(&client->msg);
+                virNetMessageRecycle(&client->msg, VIR_NET_MESSAGE_RECYCLE_MAX);
                 /*
                  * We've completed one call, but we don't want to
                  * spin around the loop forever if there are many
@@ -1516,6 +1533,9 @@ static bool virNetClientIOEventLoopRemoveDone(virNetClientCallPtr call,
     if (call->haveThread) {
         VIR_DEBUG("Waking up sleep %p", call);
         virCondSignal(&call->cond);
+    } else if (call->async) {
+        /* Kept for virNetClientWaitAsync to collect */
+        VIR_DEBUG("Completed asynchronous call %p", call);
     } else {
         VIR_DEBUG("Removing completed call %p", call);
         if (call->expectReply)
@@ -1546,6 +1566,14 @@ virNetClientIOEventLoopRemoveAll(virNetClientCallPtr call,
     if (call == thiscall)
         return false;
 
+    if (call->async) {
+        VIR_DEBUG("Aborting asynchronous call %p", call);
+        call->aborted = true;
+        if (call->haveThread)
+            virCondSignal(&call->cond);
+        return true;
+    }
+
     VIR_DEBUG("Removing call %p", call);
     virCondDestroy(&call->cond);
     VIR_FREE(call->msg);
@@ -1851,6 +1879,9 @@ static void virNetClientIOUpdateCallback(virNetClientPtr client,
  * Returns 1 if the call was queued and will be completed later (only
  * for nonBlock == true), 0 if the call was completed and -1 on error.
  */
+static int virNetClientIOWait(virNetClientPtr client,
+                              virNetClientCallPtr thiscall);
+
 static int virNetClientIO(virNetClientPtr client,
                           virNetClientCallPtr thiscall)
 {
@@ -1885,9 +1916,31 @@ static int virNetClientIO(virNetClientPtr client,
         if (thiscall->nonBlock) {
             virNetClientIODetachNonBlocking(thiscall);
             rv = 1;
-            goto cleanup;
+            VIR_DEBUG("All done with our call head=%p call=%p rv=%d",
+                      client->waitDispatch, thiscall, rv);
+            return rv;
         }
+    }
 
+    return virNetClientIOWait(client, thiscall);
+}
+
+
+/*
+ * Wait for @thiscall, which is already in the wait queue, to
+ * complete, either by sleeping while another thread dispatches
+ * it or by catching the buck and dispatching it ourselves.
+ *
+ * Returns 1 if the call was queued and will be completed later (only
+ * for nonBlock == true), 0 if the call was completed and -1 on error.
+ */
+static int virNetClientIOWait(virNetClientPtr client,
+                              virNetClientCallPtr thiscall)
+{
+    int rv = -1;
+
+    /* Check to see if another thread is dispatching */
+    if (client->haveTheBuck) {
         VIR_DEBUG("Going to sleep head=%p call=%p",
                   client->waitDispatch, thiscall);
         /* Go to sleep while other thread is working... */
@@ -1916,6 +1969,12 @@ static int virNetClientIO(virNetClientPtr client,
             goto cleanup;
         }
 
+        if (thiscall->aborted) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("client socket is closed"));
+            goto cleanup;
+        }
+
         /* Grr, someone passed the buck to us ... */
     } else {
         client->haveTheBuck = true;
@@ -2192,6 +2251,116 @@ int virNetClientSendNonBlock(virNetClientPtr client,
     return ret;
 }
 
+/*
+ * @msg: a message allocated on the heap
+ * @call: filled with the handle of the call
+ *
+ * Send a message asynchronously, expecting a reply which is collected
+ * later by passing @call to virNetClientWaitAsync. This allows a single
+ * thread to have many calls in flight. Until then, the message is owned
+ * by the client and must neither be modified nor freed.
+ *
+ * Returns 0 if the message was queued, -1 on error
+ */
+int virNetClientSendAsync(virNetClientPtr client,
+                          virNetMessagePtr msg,
+                          virNetClientCallPtr *call)
+{
+    virNetClientCallPtr thiscall;
+    int ret = -1;
+
+    *call = NULL;
+
+    virObjectLock(client);
+
+    PROBE(RPC_CLIENT_MSG_TX_QUEUE,
+          "client=%p len=%zu prog=%u vers=%u proc=%u type=%u status=%u serial=%u",
+          client, msg->bufferLength,
+          msg->header.prog, msg->header.vers, msg->header.proc,
+          msg->header.type, msg->header.status, msg->header.serial);
+
+    if (!client->sock || client->wantClose) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("client socket is closed"));
+        goto cleanup;
+    }
+
+    if (!(thiscall = virNetClientCallNew(msg, true, false)))
+        goto cleanup;
+
+    /* Send as much as we can right away, without waiting for the reply */
+    thiscall->nonBlock = true;
+    thiscall->async = true;
+    thiscall->haveThread = true;
+
+    if (virNetClientIO(client, thiscall) < 0) {
+        virCondDestroy(&thiscall->cond);
+        VIR_FREE(thiscall);
+        goto cleanup;
+    }
+
+    /* Either complete already or detached and left in the queue */
+    thiscall->haveThread = false;
+    *call = thiscall;
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(client);
+    return ret;
+}
+
+
+/*
+ * @call: handle of a call sent by virNetClientSendAsync
+ *
+ * Wait for the reply to @call, which is then found in the message
+ * given to virNetClientSendAsync. Meanwhile any other pending calls
+ * are dispatched too. This must be called exactly once for every
+ * call, as it releases @call.
+ *
+ * The caller is responsible for free'ing the message
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int virNetClientWaitAsync(virNetClientPtr client,
+                          virNetClientCallPtr call)
+{
+    int ret = -1;
+
+    virObjectLock(client);
+
+    if (call->aborted) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("client socket is closed"));
+        goto cleanup;
+    }
+
+    if (call->mode == VIR_NET_CLIENT_MODE_COMPLETE) {
+        /* Completed calls are normally gone from the queue already */
+        virNetClientCallRemove(&client->waitDispatch, call);
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (!client->sock) {
+        virNetClientCallRemove(&client->waitDispatch, call);
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("client socket is closed"));
+        goto cleanup;
+    }
+
+    call->nonBlock = false;
+    call->haveThread = true;
+    ret = virNetClientIOWait(client, call);
+
+ cleanup:
+    virCondDestroy(&call->cond);
+    VIR_FREE(call);
+    virObjectUnlock(client);
+    return ret < 0 ? -1 : 0;
+}
+
+
 /*
  * @msg: a message allocated on heap or stack
  *
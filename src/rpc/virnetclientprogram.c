@@ -268,6 +268,88 @@ int virNetClientProgramDispatch(virNetClientProgramPtr prog,
 }
 
 
+/*
+ * Validate the reply to a call of @proc with @serial in @msg and
+ * decode the return values or raise the error it carries
+ *
+ * Returns 0 on success, -1 on failure
+ */
+static int
+virNetClientProgramCheckReply(virNetClientProgramPtr prog,
+                              virNetMessagePtr msg,
+                              unsigned serial,
+                              int proc,
+                              size_t *ninfds,
+                              int **infds,
+                              xdrproc_t ret_filter, void *ret)
+{
+    size_t i;
+
+    /* None of these 3 should ever happen here, because
+     * virNetClientSend should have validated the reply,
+     * but it doesn't hurt to check again.
+     */
+    if (msg->header.type != VIR_NET_REPLY &&
+        msg->header.type != VIR_NET_REPLY_WITH_FDS) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unexpected message type %d"), msg->header.type);
+        return -1;
+    }
+    if (msg->header.proc != proc) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unexpected message proc %d != %d"),
+                       msg->header.proc, proc);
+        return -1;
+    }
+    if (msg->header.serial != serial) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unexpected message serial %d != %d"),
+                       msg->header.serial, serial);
+        return -1;
+    }
+
+    switch (msg->header.status) {
+    case VIR_NET_OK:
+        if (infds && ninfds) {
+            *ninfds = msg->nfds;
+            if (VIR_ALLOC_N(*infds, *ninfds) < 0)
+                return -1;
+            for (i = 0; i < *ninfds; i++)
+                (*infds)[i] = -1;
+            for (i = 0; i < *ninfds; i++) {
+                if (((*infds)[i] = dup(msg->fds[i])) < 0) {
+                    virReportSystemError(errno,
+                                         _("Cannot duplicate FD %d"),
+                                         msg->fds[i]);
+                    return -1;
+                }
+                if (virSetInherit((*infds)[i], false) < 0) {
+                    virReportSystemError(errno,
+                                         _("Cannot set close-on-exec %d"),
+                                         (*infds)[i]);
+                    return -1;
+                }
+            }
+
+        }
+        if (virNetMessageDecodePayload(msg, ret_filter, ret) < 0)
+            return -1;
+        break;
+
+    case VIR_NET_ERROR:
+        virNetClientProgramDispatchError(prog, msg);
+        return -1;
+
+    default:
+        virReportError(VIR_ERR_RPC,
+                       _("Unexpected message status %d"), msg->header.status);
+        return -1;
+    }
+
+    return 0;
+}
+
+
 int virNetClientProgramCall(virNetClientProgramPtr prog,
                             virNetClientPtr client,
                             unsigned serial,
@@ -329,76 +411,314 @@ int virNetClientProgramCall(virNetClientProgramPtr prog,
     if (virNetClientSendWithReply(client, msg) < 0)
         goto error;
 
-    /* None of these 3 should ever happen here, because
-     * virNetClientSend should have validated the reply,
-     * but it doesn't hurt to check again.
-     */
-    if (msg->header.type != VIR_NET_REPLY &&
-        msg->header.type != VIR_NET_REPLY_WITH_FDS) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Unexpected message type %d"), msg->header.type);
+    if (virNetClientProgramCheckReply(prog, msg, serial, proc,
+                                      ninfds, infds, ret_filter, ret) < 0)
         goto error;
+
+    virNetMessageFree(msg);
+
+    return 0;
+
+ error:
+    virNetMessageFree(msg);
+    if (infds && ninfds) {
+        for (i = 0; i < *ninfds; i++)
+            VIR_FORCE_CLOSE((*infds)[i]);
     }
-    if (msg->header.proc != proc) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Unexpected message proc %d != %d"),
-                       msg->header.proc, proc);
+    return -1;
+}
+
+
+struct _virNetClientProgramAsyncCall {
+    virNetClientProgramPtr prog;
+    virNetClientPtr client;
+    virNetClientCallPtr call;
+    virNetMessagePtr msg;
+    unsigned serial;
+    int proc;
+};
+
+
+/*
+ * @prog: the program the call belongs to
+ * @client: the client to send the call with
+ * @serial: serial number of the call
+ * @proc: the procedure to call
+ * @call: filled with the handle of the call
+ *
+ * Sends a call of @proc to the server without waiting for its reply,
+ * which must be collected by virNetClientProgramWaitAsync.
+ *
+ * Returns 0 if the call was sent, -1 on error
+ */
+int virNetClientProgramCallAsync(virNetClientProgramPtr prog,
+                                 virNetClientPtr client,
+                                 unsigned serial,
+                                 int proc,
+                                 xdrproc_t args_filter, void *args,
+                                 virNetClientProgramAsyncCallPtr *call)
+{
+    virNetClientProgramAsyncCallPtr tmp = NULL;
+
+    *call = NULL;
+
+    if (VIR_ALLOC(tmp) < 0)
+        return -1;
+
+    if (!(tmp->msg = virNetMessageNew(false)))
+        goto error;
+
+    tmp->msg->header.prog = prog->program;
+    tmp->msg->header.vers = prog->version;
+    tmp->msg->header.status = VIR_NET_OK;
+    tmp->msg->header.type = VIR_NET_CALL;
+    tmp->msg->header.serial = serial;
+    tmp->msg->header.proc = proc;
+
+    if (virNetMessageEncodeHeader(tmp->msg) < 0)
         goto error;
+
+    if (virNetMessageEncodePayload(tmp->msg, args_filter, args) < 0)
+        goto error;
+
+    if (virNetClientSendAsync(client, tmp->msg, &tmp->call) < 0)
+        goto error;
+
+    tmp->prog = virObjectRef(prog);
+    tmp->client = virObjectRef(client);
+    tmp->serial = serial;
+    tmp->proc = proc;
+    *call = tmp;
+    return 0;
+
+ error:
+    virNetMessageFree(tmp->msg);
+    VIR_FREE(tmp);
+    return -1;
+}
+
+
+/*
+ * @call: handle of a call sent by virNetClientProgramCallAsync
+ *
+ * Waits for the reply to @call and decodes its return values into
+ * @ret. This must be called exactly once for every call, as it
+ * releases @call.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int virNetClientProgramWaitAsync(virNetClientProgramAsyncCallPtr call,
+                                 xdrproc_t ret_filter, void *ret)
+{
+    int rv = -1;
+
+    if (virNetClientWaitAsync(call->client, call->call) < 0)
+        goto cleanup;
+
+    if (virNetClientProgramCheckReply(call->prog, call->msg,
+                                      call->serial, call->proc,
+                                      NULL, NULL, ret_filter, ret) < 0)
+        goto cleanup;
+
+    rv = 0;
+
+ cleanup:
+    virNetMessageFree(call->msg);
+    virObjectUnref(call->client);
+    virObjectUnref(call->prog);
+    VIR_FREE(call);
+    return rv;
+}
+
+
+/* Encoded calls start with the length word and the fixed size header */
+#define VIR_NET_CLIENT_PROGRAM_PAYLOAD_OFFSET \
+    (VIR_NET_MESSAGE_HEADER_XDR_LEN + VIR_NET_MESSAGE_HEADER_MAX)
+
+/*
+ * @prog: the program the calls belong to
+ * @client: the client to send the calls with
+ * @serial: serial number of the batch
+ * @ncalls: number of calls in @calls
+ * @calls: the calls to make
+ *
+ * Sends all of @calls to the server in a single message and waits
+ * for the single message carrying their replies. Calls which fail
+ * have the error they reported stored in their 'error' field, while
+ * the return values of the other ones are decoded into their 'ret'.
+ * None of the calls may pass file descriptors or open streams; the
+ * server fails such calls. The whole batch is run by a regular worker
+ * whatever procedure its header names, so high priority procedures
+ * lose their priority if batched.
+ *
+ * Returns 0 if the batch was processed, even if some calls failed,
+ * or -1 if the batch failed as a whole
+ */
+int virNetClientProgramCallBatch(virNetClientProgramPtr prog,
+                                 virNetClientPtr client,
+                                 unsigned serial,
+                                 size_t ncalls,
+                                 virNetClientProgramBatchCallPtr calls)
+{
+    virNetMessagePtr msg = NULL;
+    virNetMessagePtr call = NULL;
+    virNetMessageBatch batch;
+    virNetMessageBatchReplies replies;
+    size_t ndone = 0;
+    size_t i;
+    int ret = -1;
+
+    memset(&batch, 0, sizeof(batch));
+    memset(&replies, 0, sizeof(replies));
+
+    for (i = 0; i < ncalls; i++)
+        calls[i].error = NULL;
+
+    if (ncalls > VIR_NET_MESSAGE_BATCH_MAX) {
+        virReportError(VIR_ERR_RPC,
+                       _("too many calls in a batch: %zu > %d"),
+                       ncalls, VIR_NET_MESSAGE_BATCH_MAX);
+        return -1;
     }
+
+    if (!(msg = virNetMessageNew(false)) ||
+        !(call = virNetMessageNew(false)))
+        goto cleanup;
+
+    if (VIR_ALLOC_N(batch.calls.calls_val, ncalls) < 0)
+        goto cleanup;
+    batch.calls.calls_len = ncalls;
+
+    /* Encode the arguments of each call on their own, reusing
+     * the buffer of the previous one */
+    for (i = 0; i < ncalls; i++) {
+        virNetMessageBatchCall *args = &batch.calls.calls_val[i];
+        size_t len;
+
+        virNetMessageRecycle(call, VIR_NET_MESSAGE_RECYCLE_MAX);
+
+        if (virNetMessageEncodeHeader(call) < 0 ||
+            virNetMessageEncodePayload(call, calls[i].args_filter,
+                                       calls[i].args) < 0)
+            goto cleanup;
+
+        args->proc = calls[i].proc;
+        len = call->bufferLength - VIR_NET_CLIENT_PROGRAM_PAYLOAD_OFFSET;
+        if (len) {
+            if (VIR_ALLOC_N(args->args.args_val, len) < 0)
+                goto cleanup;
+            memcpy(args->args.args_val,
+                   call->buffer + VIR_NET_CLIENT_PROGRAM_PAYLOAD_OFFSET, len);
+        }
+        args->args.args_len = len;
+    }
+
+    msg->header.prog = prog->program;
+    msg->header.vers = prog->version;
+    msg->header.status = VIR_NET_OK;
+    msg->header.type = VIR_NET_CALL_BATCH;
+    msg->header.serial = serial;
+    msg->header.proc = 0;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetMessageBatch,
+                                   &batch) < 0)
+        goto cleanup;
+
+    if (virNetClientSendWithReply(client, msg) < 0)
+        goto cleanup;
+
     if (msg->header.serial != serial) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Unexpected message serial %d != %d"),
                        msg->header.serial, serial);
-        goto error;
+        goto cleanup;
     }
 
-    switch (msg->header.status) {
-    case VIR_NET_OK:
-        if (infds && ninfds) {
-            *ninfds = msg->nfds;
-            if (VIR_ALLOC_N(*infds, *ninfds) < 0)
-                goto error;
-            for (i = 0; i < *ninfds; i++)
-                (*infds)[i] = -1;
-            for (i = 0; i < *ninfds; i++) {
-                if (((*infds)[i] = dup(msg->fds[i])) < 0) {
-                    virReportSystemError(errno,
-                                         _("Cannot duplicate FD %d"),
-                                         msg->fds[i]);
-                    goto error;
-                }
-                if (virSetInherit((*infds)[i], false) < 0) {
-                    virReportSystemError(errno,
-                                         _("Cannot set close-on-exec %d"),
-                                         (*infds)[i]);
-                    goto error;
-                }
-            }
-
-        }
-        if (virNetMessageDecodePayload(msg, ret_filter, ret) < 0)
-            goto error;
-        break;
-
-    case VIR_NET_ERROR:
+    /* Servers which don't know the program reply with a plain error */
+    if ((msg->header.type == VIR_NET_REPLY_BATCH ||
+         msg->header.type == VIR_NET_REPLY) &&
+        msg->header.status == VIR_NET_ERROR) {
         virNetClientProgramDispatchError(prog, msg);
-        goto error;
+        goto cleanup;
+    }
 
-    default:
+    if (msg->header.type != VIR_NET_REPLY_BATCH) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unexpected message type %d"), msg->header.type);
+        goto cleanup;
+    }
+
+    if (msg->header.status != VIR_NET_OK) {
         virReportError(VIR_ERR_RPC,
                        _("Unexpected message status %d"), msg->header.status);
-        goto error;
+        goto cleanup;
     }
 
-    virNetMessageFree(msg);
+    if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetMessageBatchReplies,
+                                   &replies) < 0)
+        goto cleanup;
 
-    return 0;
+    if (replies.replies.replies_len != ncalls) {
+        virReportError(VIR_ERR_RPC,
+                       _("Unexpected number of replies %u != %zu"),
+                       replies.replies.replies_len, ncalls);
+        goto cleanup;
+    }
 
- error:
-    virNetMessageFree(msg);
-    if (infds && ninfds) {
-        for (i = 0; i < *ninfds; i++)
-            VIR_FORCE_CLOSE((*infds)[i]);
+    for (ndone = 0; ndone < ncalls; ndone++) {
+        virNetMessageBatchReply *reply = &replies.replies.replies_val[ndone];
+
+        if (reply->proc != calls[ndone].proc) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Unexpected message proc %d != %d"),
+                           reply->proc, calls[ndone].proc);
+            goto cleanup;
+        }
+
+        virNetMessageRecycle(call, VIR_NET_MESSAGE_RECYCLE_MAX);
+        call->bufferLength = reply->ret.ret_len;
+        if (virNetMessageReserveBuffer(call, call->bufferLength) < 0)
+            goto cleanup;
+        if (call->bufferLength)
+            memcpy(call->buffer, reply->ret.ret_val, call->bufferLength);
+
+        switch (reply->status) {
+        case VIR_NET_OK:
+            if (virNetMessageDecodePayload(call, calls[ndone].ret_filter,
+                                           calls[ndone].ret) < 0)
+                goto cleanup;
+            break;
+
+        case VIR_NET_ERROR:
+            virNetClientProgramDispatchError(prog, call);
+            calls[ndone].error = virSaveLastError();
+            virResetLastError();
+            break;
+
+        default:
+            virReportError(VIR_ERR_RPC,
+                           _("Unexpected message status %d"), reply->status);
+            goto cleanup;
+        }
     }
-    return -1;
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0) {
+        for (i = 0; i < ndone; i++) {
+            if (!calls[i].error)
+                xdr_free(calls[i].ret_filter, calls[i].ret);
+            virFreeError(calls[i].error);
+            calls[i].error = NULL;
+        }
+    }
+    xdr_free((xdrproc_t)xdr_virNetMessageBatch, (void*)&batch);
+    xdr_free((xdrproc_t)xdr_virNetMessageBatchReplies, (void*)&replies);
+    virNetMessageFree(call);
+    virNetMessageFree(msg);
+    return ret;
 }
@@ -41,6 +41,12 @@ typedef virNetClientProgramEvent *virNetClientProgramEventPtr;
 typedef struct _virNetClientProgramErrorHandler virNetClientProgramErrorHander;
 typedef virNetClientProgramErrorHander *virNetClientProgramErrorHanderPtr;
 
+typedef struct _virNetClientProgramAsyncCall virNetClientProgramAsyncCall;
+typedef virNetClientProgramAsyncCall *virNetClientProgramAsyncCallPtr;
+
+typedef struct _virNetClientProgramBatchCall virNetClientProgramBatchCall;
+typedef virNetClientProgramBatchCall *virNetClientProgramBatchCallPtr;
+
 
 typedef void (*virNetClientProgramDispatchFunc)(virNetClientProgramPtr prog,
                                                 virNetClientPtr client,
@@ -54,6 +60,15 @@ struct _virNetClientProgramEvent {
     xdrproc_t msg_filter;
 };
 
+struct _virNetClientProgramBatchCall {
+    int proc;
+    xdrproc_t args_filter;
+    void *args;
+    xdrproc_t ret_filter;
+    void *ret;
+    virErrorPtr error; /* Error reported by the call, NULL if it succeeded */
+};
+
 virNetClientProgramPtr virNetClientProgramNew(unsigned program,
                                               unsigned version,
                                               virNetClientProgramEventPtr events,
@@ -81,6 +96,21 @@ int virNetClientProgramCall(virNetClientProgramPtr prog,
                             xdrproc_t args_filter, void *args,
                             xdrproc_t ret_filter, void *ret);
 
+int virNetClientProgramCallAsync(virNetClientProgramPtr prog,
+                                 virNetClientPtr client,
+                                 unsigned serial,
+                                 int proc,
+                                 xdrproc_t args_filter, void *args,
+                                 virNetClientProgramAsyncCallPtr *call);
+
+int virNetClientProgramWaitAsync(virNetClientProgramAsyncCallPtr call,
+                                 xdrproc_t ret_filter, void *ret);
+
+int virNetClientProgramCallBatch(virNetClientProgramPtr prog,
+                                 virNetClientPtr client,
+                                 unsigned serial,
+                                 size_t ncalls,
+                                 virNetClientProgramBatchCallPtr calls);
 
 
 #endif /* __VIR_NET_CLIENT_PROGRAM_H__ */
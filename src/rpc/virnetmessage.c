@@ -63,7 +63,70 @@ virNetMessageClearPayload(virNetMessagePtr msg)
 
     msg->bufferOffset = 0;
     msg->bufferLength = 0;
+    msg->bufferAlloc = 0;
     VIR_FREE(msg->buffer);
+
+    msg->data = NULL;
+    msg->dataLength = 0;
+    msg->dataOffset = 0;
+}
+
+
+/**
+ * virNetMessageReserveBuffer:
+ * @msg: the message
+ * @len: number of bytes to make room for
+ *
+ * Makes sure the buffer of @msg can hold @len bytes. The buffer is
+ * only reallocated if it is too small, so a buffer kept by
+ * virNetMessageRecycle is reused as long as it is big enough.
+ *
+ * Returns 0 on success, -1 on allocation failure
+ */
+int
+virNetMessageReserveBuffer(virNetMessagePtr msg,
+                           size_t len)
+{
+    if (msg->buffer && len <= msg->bufferAlloc)
+        return 0;
+
+    if (VIR_REALLOC_N(msg->buffer, len) < 0)
+        return -1;
+    msg->bufferAlloc = len;
+    return 0;
+}
+
+
+/**
+ * virNetMessageRecycle:
+ * @msg: the message
+ * @maxBuffer: largest buffer worth keeping
+ *
+ * Resets @msg like virNetMessageClear does, except for keeping its
+ * buffer allocated if it isn't larger than @maxBuffer, so that @msg
+ * can be used for another message without allocating a new one.
+ */
+void
+virNetMessageRecycle(virNetMessagePtr msg,
+                     size_t maxBuffer)
+{
+    bool tracked = msg->tracked;
+    char *buffer = NULL;
+    size_t bufferAlloc = 0;
+
+    VIR_DEBUG("msg=%p nfds=%zu bufferAlloc=%zu", msg, msg->nfds, msg->bufferAlloc);
+
+    if (msg->bufferAlloc <= maxBuffer) {
+        buffer = msg->buffer;
+        bufferAlloc = msg->bufferAlloc;
+        msg->buffer = NULL;
+    }
+
+    virNetMessageClearPayload(msg);
+    memset(msg, 0, sizeof(*msg));
+    msg->tracked = tracked;
+    msg->buffer = buffer;
+    msg->bufferAlloc = bufferAlloc;
 }
 
 
@@ -154,7 +217,7 @@ int virNetMessageDecodeLength(virNetMessagePtr msg)
     /* Extend our declared buffer length and carry
        on reading the header + payload */
     msg->bufferLength += len;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+    if (virNetMessageReserveBuffer(msg, msg->bufferLength) < 0)
         goto cleanup;
 
     VIR_DEBUG("Got length, now need %zu total (%u more)",
@@ -231,7 +294,7 @@ int virNetMessageEncodeHeader(virNetMessagePtr msg)
     unsigned int len = 0;
 
     msg->bufferLength = VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+    if (virNetMessageReserveBuffer(msg, msg->bufferLength) < 0)
         return ret;
     msg->bufferOffset = 0;
 
@@ -349,6 +412,25 @@ int virNetMessageEncodePayload(virNetMessagePtr msg,
 {
     XDR xdr;
     unsigned int msglen;
+#ifdef HAVE_XDR_SIZEOF
+    unsigned long payloadlen;
+
+    /* Size the buffer for the payload up front, so that large payloads
+     * are encoded just once instead of being retried with a buffer
+     * growing 4 times on each attempt */
+    payloadlen = xdr_sizeof(filter, data);
+    if (payloadlen > VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX -
+                     msg->bufferOffset) {
+        virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message payload"));
+        return -1;
+    }
+    if (msg->bufferOffset + payloadlen > msg->bufferLength) {
+        msg->bufferLength = msg->bufferOffset + payloadlen;
+        if (virNetMessageReserveBuffer(msg, msg->bufferLength) < 0)
+            return -1;
+        VIR_DEBUG("Sized message buffer length = %zu", msg->bufferLength);
+    }
+#endif /* HAVE_XDR_SIZEOF */
 
     /* Serialise payload of the message. This assumes that
      * virNetMessageEncodeHeader has already been run, so
@@ -369,7 +451,7 @@ int virNetMessageEncodePayload(virNetMessagePtr msg,
 
         msg->bufferLength = newlen + VIR_NET_MESSAGE_LEN_MAX;
 
-        if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+        if (virNetMessageReserveBuffer(msg, msg->bufferLength) < 0)
             goto error;
 
         xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
@@ -453,7 +535,7 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
 
         msg->bufferLength = msg->bufferOffset + len;
 
-        if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+        if (virNetMessageReserveBuffer(msg, msg->bufferLength) < 0)
             return -1;
 
         VIR_DEBUG("Increased message buffer length = %zu", msg->bufferLength);
@@ -482,6 +564,62 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
 }
 
 
+/**
+ * virNetMessageEncodePayloadRef:
+ * @msg: the message with its header encoded
+ * @data: the stream data
+ * @len: length of @data
+ *
+ * Like virNetMessageEncodePayloadRaw, but instead of copying @data
+ * into the message buffer, only a reference to it is kept and the
+ * data is written to the socket straight after the buffer. @data must
+ * therefore stay valid until the message was sent, which is the case
+ * for blocking sends only.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virNetMessageEncodePayloadRef(virNetMessagePtr msg,
+                                  const char *data,
+                                  size_t len)
+{
+    XDR xdr;
+    unsigned int msglen;
+
+    if ((msg->bufferOffset + len) >
+        (VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX)) {
+        virReportError(VIR_ERR_RPC,
+                       _("Stream data too long to send "
+                         "(%zu bytes needed, %zu bytes available)"),
+                       len,
+                       VIR_NET_MESSAGE_MAX +
+                       VIR_NET_MESSAGE_LEN_MAX -
+                       msg->bufferOffset);
+        return -1;
+    }
+
+    /* Re-encode the length word to cover the referenced data too. */
+    VIR_DEBUG("Encode length as %zu", msg->bufferOffset + len);
+    xdrmem_create(&xdr, msg->buffer, VIR_NET_MESSAGE_HEADER_XDR_LEN, XDR_ENCODE);
+    msglen = msg->bufferOffset + len;
+    if (!xdr_u_int(&xdr, &msglen)) {
+        virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message length"));
+        goto error;
+    }
+    xdr_destroy(&xdr);
+
+    msg->bufferLength = msg->bufferOffset;
+    msg->bufferOffset = 0;
+    msg->data = data;
+    msg->dataLength = len;
+    msg->dataOffset = 0;
+    return 0;
+
+ error:
+    xdr_destroy(&xdr);
+    return -1;
+}
+
+
 int virNetMessageEncodePayloadEmpty(virNetMessagePtr msg)
 {
     XDR xdr;
@@ -31,6 +31,10 @@ typedef virNetMessage *virNetMessagePtr;
 
 typedef void (*virNetMessageFreeCallback)(virNetMessagePtr msg, void *opaque);
 
+/* Largest buffer virNetMessageRecycle callers should keep around */
+# define VIR_NET_MESSAGE_RECYCLE_MAX \
+    ((VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX) * 4)
+
 struct _virNetMessage {
     bool tracked;
 
@@ -38,9 +42,18 @@ struct _virNetMessage {
                   /* Maximum   VIR_NET_MESSAGE_MAX     + VIR_NET_MESSAGE_LEN_MAX */
     size_t bufferLength;
     size_t bufferOffset;
+    size_t bufferAlloc; /* Allocated size of buffer, at least bufferLength */
+
+    /* Stream data sent after @buffer without being copied into it,
+     * see virNetMessageEncodePayloadRef */
+    const char *data;
+    size_t dataLength;
+    size_t dataOffset;
 
     virNetMessageHeader header;
 
+    unsigned long long received; /* When fully read, in microseconds, or 0 */
+
     virNetMessageFreeCallback cb;
     void *opaque;
 
@@ -60,6 +73,14 @@ void virNetMessageClear(virNetMessagePtr);
 
 void virNetMessageFree(virNetMessagePtr msg);
 
+int virNetMessageReserveBuffer(virNetMessagePtr msg,
+                               size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+
+void virNetMessageRecycle(virNetMessagePtr msg,
+                          size_t maxBuffer)
+    ATTRIBUTE_NONNULL(1);
+
 virNetMessagePtr virNetMessageQueueServe(virNetMessagePtr *queue)
     ATTRIBUTE_NONNULL(1);
 void virNetMessageQueuePush(virNetMessagePtr *queue,
@@ -89,6 +110,10 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
                                   const char *buf,
                                   size_t len)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+int virNetMessageEncodePayloadRef(virNetMessagePtr msg,
+                                  const char *buf,
+                                  size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 int virNetMessageEncodePayloadEmpty(virNetMessagePtr msg)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
@@ -39,6 +39,12 @@ const VIR_NET_MESSAGE_INITIAL = 65536;
  */
 const VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX = 262120;
 
+/*
+ * Max payload size of stream data messages sent to peers which
+ * announced VIR_DRV_FEATURE_REMOTE_STREAM_LARGE_FRAMES.
+ */
+const VIR_NET_MESSAGE_STREAM_PAYLOAD_MAX = 4194304;
+
 /* Maximum total message size (serialised). */
 const VIR_NET_MESSAGE_MAX = 16777216;
 
@@ -64,6 +70,11 @@ const VIR_NET_MESSAGE_STRING_MAX = 4194304;
  */
 const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
 
+/* Limit on number of procedure calls allowed to be
+ * batched in a single message
+ */
+const VIR_NET_MESSAGE_BATCH_MAX = 1024;
+
 /*
  * RPC wire format
  *
@@ -89,6 +100,15 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *  - type == VIR_NET_STREAM
  *      * serial matches that from the corresponding VIR_NET_CALL
  *
+ *  - type == VIR_NET_CALL_BATCH
+ *      * serial is set by client, like for VIR_NET_CALL
+ *
+ *  - type == VIR_NET_REPLY_BATCH
+ *      * serial matches that from the corresponding VIR_NET_CALL_BATCH
+ *
+ *  - type == VIR_NET_STREAM_HOLE
+ *      * serial matches that from the corresponding VIR_NET_CALL
+ *
  * and the 'status' field varies according to:
  *
  *  - type == VIR_NET_CALL
@@ -101,6 +121,14 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *  - type == VIR_NET_MESSAGE
  *     * VIR_NET_OK always
  *
+ *  - type == VIR_NET_CALL_BATCH
+ *     * VIR_NET_OK always
+ *
+ *  - type == VIR_NET_REPLY_BATCH
+ *     * VIR_NET_OK if the calls were dispatched, each of them
+ *       carrying its own status
+ *     * VIR_NET_ERROR if the batch as a whole was rejected
+ *
  *  - type == VIR_NET_STREAM
  *     * VIR_NET_CONTINUE if more data is following
  *     * VIR_NET_OK if stream is complete
@@ -108,6 +136,9 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *         server message: stream had an error
  *         client message: client aborted the stream
  *
+ *  - type == VIR_NET_STREAM_HOLE
+ *     * VIR_NET_CONTINUE always
+ *
  * Payload varies according to type and status:
  *
  *  - type == VIR_NET_CALL
@@ -143,6 +174,23 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *     * status == VIR_NET_ERROR
  *          remote_error    Error information
  *
+ *  - type == VIR_NET_CALL_BATCH
+ *          virNetMessageBatch         XXX_args for each procedure
+ *
+ *  - type == VIR_NET_REPLY_BATCH
+ *     * status == VIR_NET_OK
+ *          virNetMessageBatchReplies  XXX_ret or remote_error for each
+ *                                     procedure, in order of the calls
+ *     * status == VIR_NET_ERROR
+ *          remote_error    Error information
+ *
+ *  - type == VIR_NET_STREAM_HOLE
+ *     * status == VIR_NET_CONTINUE
+ *          virNetStreamHole    length of the hole
+ *
+ * The 'proc' field of a batch header is unused and set to zero.
+ * Calls within a batch can neither pass file descriptors nor open
+ * streams.
  */
 enum virNetMessageType {
     /* client -> server. args from a method call */
@@ -156,7 +204,13 @@ enum virNetMessageType {
     /* client -> server. args from a method call, with passed FDs */
     VIR_NET_CALL_WITH_FDS = 4,
     /* server -> client. reply/error from a method call, with passed FDs */
-    VIR_NET_REPLY_WITH_FDS = 5
+    VIR_NET_REPLY_WITH_FDS = 5,
+    /* client -> server. args from several method calls */
+    VIR_NET_CALL_BATCH = 6,
+    /* server -> client. replies/errors from a batch of method calls */
+    VIR_NET_REPLY_BATCH = 7,
+    /* either direction. hole in a sparse stream */
+    VIR_NET_STREAM_HOLE = 8
 };
 
 enum virNetMessageStatus {
@@ -236,3 +290,30 @@ struct virNetMessageError {
     int int2;
     virNetMessageNetwork net; /* unused */
 };
+
+/* A single method call within a VIR_NET_CALL_BATCH message */
+struct virNetMessageBatchCall {
+    int proc;                   /* Unique ID for the procedure within the program */
+    opaque args<VIR_NET_MESSAGE_PAYLOAD_MAX>; /* XDR encoded XXX_args */
+};
+
+struct virNetMessageBatch {
+    virNetMessageBatchCall calls<VIR_NET_MESSAGE_BATCH_MAX>;
+};
+
+/* The reply to a single method call within a VIR_NET_REPLY_BATCH message */
+struct virNetMessageBatchReply {
+    int proc;                   /* Procedure of the matching call */
+    virNetMessageStatus status; /* VIR_NET_OK or VIR_NET_ERROR */
+    opaque ret<VIR_NET_MESSAGE_PAYLOAD_MAX>; /* XDR encoded XXX_ret or remote_error */
+};
+
+struct virNetMessageBatchReplies {
+    virNetMessageBatchReply replies<VIR_NET_MESSAGE_BATCH_MAX>;
+};
+
+/* Payload of a VIR_NET_STREAM_HOLE message */
+struct virNetStreamHole {
+    hyper length;               /* Number of bytes of empty space */
+    unsigned int flags;         /* Currently unused, always zero */
+};
@@ -27,10 +27,13 @@
 #include "virlog.h"
 #include "viralloc.h"
 #include "virerror.h"
+#include "virhash.h"
 #include "virthread.h"
 #include "virthreadpool.h"
 #include "virnetservermdns.h"
 #include "virstring.h"
+#include "virtime.h"
+#include "virtokenbucket.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
@@ -73,6 +76,18 @@ struct _virNetServer {
     int keepaliveInterval;
     unsigned int keepaliveCount;
 
+    /* Requests in flight allowed to each client, 0 to use the limit
+     * of the service the client connected to */
+    size_t clientRequestsMax;
+
+    /* Limits on the rate of requests of each client, and of all the
+     * clients with the same identity together */
+    unsigned int clientRequestRate;
+    unsigned int clientRequestBurst;
+    unsigned int identityRequestRate;
+    unsigned int identityRequestBurst;
+    virHashTablePtr identityRequestRates; /* identity -> virTokenBucket */
+
 #ifdef WITH_GNUTLS
     virNetTLSContextPtr tls;
 #endif
@@ -127,7 +142,8 @@ static int virNetServerProcessMsg(virNetServerPtr srv,
          * must just log it & drop them
          */
         if (msg->header.type == VIR_NET_CALL ||
-            msg->header.type == VIR_NET_CALL_WITH_FDS) {
+            msg->header.type == VIR_NET_CALL_WITH_FDS ||
+            msg->header.type == VIR_NET_CALL_BATCH) {
             if (virNetServerProgramUnknownError(client,
                                                 msg,
                                                 &msg->header) < 0)
@@ -158,6 +174,77 @@ static int virNetServerProcessMsg(virNetServerPtr srv,
     return ret;
 }
 
+/* Get the key of the identity requests of @client are accounted
+ * to, or NULL if it has none */
+static char *
+virNetServerGetIdentityKey(virNetServerClientPtr client)
+{
+    virIdentityPtr identity;
+    const char *name = NULL;
+    char *key = NULL;
+
+    if (!(identity = virNetServerClientGetIdentity(client)))
+        return NULL;
+
+    if (virIdentityGetSASLUserName(identity, &name) == 0 && name)
+        ignore_value(virAsprintf(&key, "sasl:%s", name));
+    else if (virIdentityGetX509DName(identity, &name) == 0 && name)
+        ignore_value(virAsprintf(&key, "x509:%s", name));
+    else if (virIdentityGetUNIXUserName(identity, &name) == 0 && name)
+        ignore_value(virAsprintf(&key, "unix:%s", name));
+
+    virObjectUnref(identity);
+    return key;
+}
+
+
+/* Account a request of @client against the limit of its identity,
+ * pausing reads from it if the identity ran out of requests */
+static void
+virNetServerCheckIdentityRate(virNetServerPtr srv,
+                              virNetServerClientPtr client)
+{
+    virTokenBucketPtr bucket;
+    unsigned long long now;
+    unsigned long long wait = 0;
+    char *key = NULL;
+
+    virObjectLock(srv);
+    if (!srv->identityRequestRate) {
+        virObjectUnlock(srv);
+        return;
+    }
+    virObjectUnlock(srv);
+
+    if (!(key = virNetServerGetIdentityKey(client)) ||
+        virTimeMillisNowRaw(&now) < 0)
+        goto cleanup;
+
+    virObjectLock(srv);
+    if (!(bucket = virHashLookup(srv->identityRequestRates, key))) {
+        if (VIR_ALLOC(bucket) < 0 ||
+            virHashAddEntry(srv->identityRequestRates, key, bucket) < 0) {
+            VIR_FREE(bucket);
+            virObjectUnlock(srv);
+            goto cleanup;
+        }
+        virTokenBucketSetRate(bucket, srv->identityRequestRate,
+                              srv->identityRequestBurst, now);
+    }
+    wait = virTokenBucketTake(bucket, now);
+    virObjectUnlock(srv);
+
+    if (wait) {
+        VIR_DEBUG("Identity %s of client=%p exceeded its request rate",
+                  key, client);
+        virNetServerClientThrottle(client, wait);
+    }
+
+ cleanup:
+    VIR_FREE(key);
+}
+
+
 static void virNetServerHandleJob(void *jobOpaque, void *opaque)
 {
     virNetServerPtr srv = opaque;
@@ -166,6 +253,8 @@ static void virNetServerHandleJob(void *jobOpaque, void *opaque)
     VIR_DEBUG("server=%p client=%p message=%p prog=%p",
               srv, job->client, job->msg, job->prog);
 
+    virNetServerCheckIdentityRate(srv, job->client);
+
     if (virNetServerProcessMsg(srv, job->client, job->prog, job->msg) < 0)
         goto error;
 
@@ -215,10 +304,12 @@ static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
         if (prog) {
             virObjectRef(prog);
             job->prog = prog;
-            priority = virNetServerProgramGetPriority(prog, msg->header.proc);
+            priority = virNetServerProgramGetPriority(prog, &msg->header);
         }
 
-        ret = virThreadPoolSendJob(srv->workers, priority, job);
+        /* Jobs of each client are queued as a flow of their own, so
+         * that clients flooding the server do not starve others */
+        ret = virThreadPoolSendFlowJob(srv->workers, priority, client, job);
 
         if (ret < 0) {
             VIR_FREE(job);
@@ -292,6 +383,9 @@ int virNetServerAddClient(virNetServerPtr srv,
 
     virNetServerCheckLimits(srv);
 
+    virNetServerClientSetRequestRate(client, srv->clientRequestRate,
+                                     srv->clientRequestBurst);
+
     virNetServerClientSetDispatcher(client,
                                     virNetServerDispatchNewMessage,
                                     srv);
@@ -313,12 +407,19 @@ static int virNetServerDispatchNewClient(virNetServerServicePtr svc,
 {
     virNetServerPtr srv = opaque;
     virNetServerClientPtr client;
+    size_t nrequests_max;
+
+    virObjectLock(srv);
+    nrequests_max = srv->clientRequestsMax;
+    virObjectUnlock(srv);
+    if (!nrequests_max)
+        nrequests_max = virNetServerServiceGetMaxRequests(svc);
 
     if (!(client = virNetServerClientNew(virNetServerNextClientID(srv),
                                          clientsock,
                                          virNetServerServiceGetAuth(svc),
                                          virNetServerServiceIsReadonly(svc),
-                                         virNetServerServiceGetMaxRequests(svc),
+                                         nrequests_max,
 #if WITH_GNUTLS
                                          virNetServerServiceGetTLSContext(svc),
 #endif
@@ -371,6 +472,9 @@ virNetServerPtr virNetServerNew(const char *name,
     if (VIR_STRDUP(srv->name, name) < 0)
         goto error;
 
+    if (!(srv->identityRequestRates = virHashCreate(8, virHashValueFree)))
+        goto error;
+
     srv->next_client_id = next_client_id;
     srv->nclients_max = max_clients;
     srv->nclients_unauth_max = max_anonymous_clients;
@@ -783,6 +887,8 @@ void virNetServerDispose(void *obj)
     }
     VIR_FREE(srv->clients);
 
+    virHashFree(srv->identityRequestRates);
+
     VIR_FREE(srv->mdnsGroupName);
     virNetServerMDNSFree(srv->mdns);
 }
@@ -905,7 +1011,8 @@ virNetServerGetThreadPoolParameters(virNetServerPtr srv,
                                     size_t *nWorkers,
                                     size_t *freeWorkers,
                                     size_t *nPrioWorkers,
-                                    size_t *jobQueueDepth)
+                                    size_t *jobQueueDepth,
+                                    virThreadPoolJobWaitStatsPtr jobWait)
 {
     virObjectLock(srv);
 
@@ -915,11 +1022,59 @@ virNetServerGetThreadPoolParameters(virNetServerPtr srv,
     *nWorkers = virThreadPoolGetCurrentWorkers(srv->workers);
     *nPrioWorkers = virThreadPoolGetPriorityWorkers(srv->workers);
     *jobQueueDepth = virThreadPoolGetJobQueueDepth(srv->workers);
+    virThreadPoolGetJobWaitStats(srv->workers, jobWait);
 
     virObjectUnlock(srv);
     return 0;
 }
 
+/*
+ * @stats: filled with the statistics of the procedures called so far,
+ *         across all programs of @srv
+ * @nstats: filled with the number of entries in @stats
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virNetServerGetProcStats(virNetServerPtr srv,
+                         virNetServerProgramProcStatsPtr *stats,
+                         size_t *nstats)
+{
+    virNetServerProgramProcStatsPtr all = NULL;
+    size_t nall = 0;
+    virNetServerProgramProcStatsPtr progStats = NULL;
+    size_t nprogStats = 0;
+    size_t i;
+    int ret = -1;
+
+    virObjectLock(srv);
+
+    for (i = 0; i < srv->nprograms; i++) {
+        if (virNetServerProgramGetProcStats(srv->programs[i], &progStats,
+                                            &nprogStats) < 0)
+            goto cleanup;
+
+        if (nprogStats) {
+            if (VIR_EXPAND_N(all, nall, nprogStats) < 0)
+                goto cleanup;
+            memcpy(all + nall - nprogStats, progStats,
+                   nprogStats * sizeof(*progStats));
+        }
+        VIR_FREE(progStats);
+    }
+
+    *stats = all;
+    *nstats = nall;
+    all = NULL;
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(srv);
+    VIR_FREE(progStats);
+    VIR_FREE(all);
+    return ret;
+}
+
 int
 virNetServerSetThreadPoolParameters(virNetServerPtr srv,
                                     long long int minWorkers,
@@ -1071,3 +1226,150 @@ virNetServerSetClientLimits(virNetServerPtr srv,
     virObjectUnlock(srv);
     return ret;
 }
+
+void
+virNetServerGetRequestRateLimits(virNetServerPtr srv,
+                                 unsigned int *clientRate,
+                                 unsigned int *clientBurst,
+                                 unsigned int *identityRate,
+                                 unsigned int *identityBurst)
+{
+    virObjectLock(srv);
+    *clientRate = srv->clientRequestRate;
+    *clientBurst = srv->clientRequestBurst;
+    *identityRate = srv->identityRequestRate;
+    *identityBurst = srv->identityRequestBurst;
+    virObjectUnlock(srv);
+}
+
+/*
+ * @clientRate: requests per second allowed to each client
+ * @clientBurst: requests allowed at once to each client
+ * @identityRate: requests per second allowed to all the clients of
+ *                an identity together
+ * @identityBurst: requests allowed at once to all the clients of an
+ *                 identity together
+ *
+ * A rate of 0 disables the limit, a burst of 0 makes it the same as
+ * the rate. Negative values keep the current setting.
+ */
+void
+virNetServerSetRequestRateLimits(virNetServerPtr srv,
+                                 long long int clientRate,
+                                 long long int clientBurst,
+                                 long long int identityRate,
+                                 long long int identityBurst)
+{
+    virNetServerClientPtr *clients = NULL;
+    int nclients;
+    unsigned int rate;
+    unsigned int burst;
+    size_t i;
+
+    virObjectLock(srv);
+
+    if (clientRate >= 0)
+        srv->clientRequestRate = clientRate;
+    if (clientBurst >= 0)
+        srv->clientRequestBurst = clientBurst;
+    rate = srv->clientRequestRate;
+    burst = srv->clientRequestBurst;
+
+    if (identityRate >= 0)
+        srv->identityRequestRate = identityRate;
+    if (identityBurst >= 0)
+        srv->identityRequestBurst = identityBurst;
+
+    /* Identities start over with full buckets at the new rate */
+    if (identityRate >= 0 || identityBurst >= 0)
+        virHashRemoveAll(srv->identityRequestRates);
+
+    virObjectUnlock(srv);
+
+    /* Clients lock the server while they are locked when dispatching
+     * messages, so they must not be locked with the server locked */
+    if ((clientRate >= 0 || clientBurst >= 0) &&
+        (nclients = virNetServerGetClients(srv, &clients)) > 0) {
+        for (i = 0; i < nclients; i++)
+            virNetServerClientSetRequestRate(clients[i], rate, burst);
+        virObjectListFreeCount(clients, nclients);
+    }
+}
+
+
+void
+virNetServerGetKeepAlive(virNetServerPtr srv,
+                         int *interval,
+                         unsigned int *count)
+{
+    virObjectLock(srv);
+    *interval = srv->keepaliveInterval;
+    *count = srv->keepaliveCount;
+    virObjectUnlock(srv);
+}
+
+/*
+ * @interval: seconds of inactivity before a client is probed, -1 to
+ *            disable keepalive, less than -1 keeps the current setting
+ * @count: probes left unanswered before a client is closed, negative
+ *         values keep the current setting
+ *
+ * Only clients connecting afterwards are affected, the keepalive of
+ * the connected clients keeps running as negotiated.
+ */
+void
+virNetServerSetKeepAlive(virNetServerPtr srv,
+                         long long int interval,
+                         long long int count)
+{
+    virObjectLock(srv);
+    if (interval >= -1)
+        srv->keepaliveInterval = interval;
+    if (count >= 0)
+        srv->keepaliveCount = count;
+    virObjectUnlock(srv);
+}
+
+size_t
+virNetServerGetClientRequestsMax(virNetServerPtr srv)
+{
+    size_t ret;
+
+    virObjectLock(srv);
+    ret = srv->clientRequestsMax;
+    if (!ret && srv->nservices)
+        ret = virNetServerServiceGetMaxRequests(srv->services[0]);
+    virObjectUnlock(srv);
+
+    return ret;
+}
+
+/*
+ * @max: requests in flight allowed to each client, 0 keeps the
+ *       current setting
+ *
+ * Applies to the connected clients right away.
+ */
+void
+virNetServerSetClientRequestsMax(virNetServerPtr srv,
+                                 size_t max)
+{
+    virNetServerClientPtr *clients = NULL;
+    int nclients;
+    size_t i;
+
+    if (!max)
+        return;
+
+    virObjectLock(srv);
+    srv->clientRequestsMax = max;
+    virObjectUnlock(srv);
+
+    /* Clients must not be locked with the server locked, see
+     * virNetServerSetRequestRateLimits */
+    if ((nclients = virNetServerGetClients(srv, &clients)) > 0) {
+        for (i = 0; i < nclients; i++)
+            virNetServerClientSetMaxRequests(clients[i], max);
+        virObjectListFreeCount(clients, nclients);
+    }
+}
@@ -32,6 +32,7 @@
 # include "virnetserverservice.h"
 # include "virobject.h"
 # include "virjson.h"
+# include "virthreadpool.h"
 
 
 virNetServerPtr virNetServerNew(const char *name,
@@ -96,7 +97,12 @@ int virNetServerGetThreadPoolParameters(virNetServerPtr srv,
                                         size_t *nWorkers,
                                         size_t *freeWorkers,
                                         size_t *nPrioWorkers,
-                                        size_t *jobQueueDepth);
+                                        size_t *jobQueueDepth,
+                                        virThreadPoolJobWaitStatsPtr jobWait);
+
+int virNetServerGetProcStats(virNetServerPtr srv,
+                             virNetServerProgramProcStatsPtr *stats,
+                             size_t *nstats);
 
 int virNetServerSetThreadPoolParameters(virNetServerPtr srv,
                                         long long int minWorkers,
@@ -120,4 +126,29 @@ int virNetServerSetClientLimits(virNetServerPtr srv,
                                 long long int maxClients,
                                 long long int maxClientsUnauth);
 
+void virNetServerGetRequestRateLimits(virNetServerPtr srv,
+                                      unsigned int *clientRate,
+                                      unsigned int *clientBurst,
+                                      unsigned int *identityRate,
+                                      unsigned int *identityBurst);
+
+void virNetServerSetRequestRateLimits(virNetServerPtr srv,
+                                      long long int clientRate,
+                                      long long int clientBurst,
+                                      long long int identityRate,
+                                      long long int identityBurst);
+
+void virNetServerGetKeepAlive(virNetServerPtr srv,
+                              int *interval,
+                              unsigned int *count);
+
+void virNetServerSetKeepAlive(virNetServerPtr srv,
+                              long long int interval,
+                              long long int count);
+
+size_t virNetServerGetClientRequestsMax(virNetServerPtr srv);
+
+void virNetServerSetClientRequestsMax(virNetServerPtr srv,
+                                      size_t max);
+
 #endif /* __VIR_NET_SERVER_H__ */
@@ -38,6 +38,8 @@
 #include "virkeepalive.h"
 #include "virprobe.h"
 #include "virstring.h"
+#include "virtime.h"
+#include "virtokenbucket.h"
 #include "virutil.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
@@ -82,6 +84,13 @@ struct _virNetServerClient
     int sockTimer; /* Timer to be fired upon cached data,
                     * so we jump out from poll() immediately */
 
+    /* Limits the rate of requests read from the client. Once
+     * exceeded, reading is paused until rateTimer fires */
+    virTokenBucket requestRate;
+    bool throttled;
+    unsigned long long throttledUntil;
+    int rateTimer;
+
 
     virIdentityPtr identity;
 
@@ -106,6 +115,17 @@ struct _virNetServerClient
      * back to client, including async events */
     virNetMessagePtr tx;
 
+    /* Messages already sent, kept with their buffers
+     * for receiving further requests */
+    virNetMessagePtr msgPool;
+    size_t nmsgPool;
+    unsigned long long msgPoolHits;
+    unsigned long long msgPoolMisses;
+
+    /* Stream data received from and sent to the client */
+    unsigned long long streamBytesReceived;
+    unsigned long long streamBytesSent;
+
     /* Filters to capture messages that would otherwise
      * end up on the 'dx' queue */
     virNetServerClientFilterPtr filters;
@@ -125,6 +145,7 @@ struct _virNetServerClient
 
 static virClassPtr virNetServerClientClass;
 static void virNetServerClientDispose(void *obj);
+static void virNetServerClientMessagePoolFree(virNetServerClientPtr client);
 
 static int virNetServerClientOnceInit(void)
 {
@@ -178,7 +199,7 @@ virNetServerClientCalculateHandleMode(virNetServerClientPtr client)
             break;
         default:
         case VIR_NET_TLS_HANDSHAKE_COMPLETE:
-            if (client->rx)
+            if (client->rx && !client->throttled)
                 mode |= VIR_EVENT_HANDLE_READABLE;
             if (client->tx)
                 mode |= VIR_EVENT_HANDLE_WRITABLE;
@@ -186,9 +207,9 @@ virNetServerClientCalculateHandleMode(virNetServerClientPtr client)
     } else {
 #endif
         /* If there is a message on the rx queue, and
-         * we're not in middle of a delayedClose, then
-         * we're wanting more input */
-        if (client->rx && !client->delayedClose)
+         * we're not in middle of a delayedClose, nor
+         * throttled, then we're wanting more input */
+        if (client->rx && !client->delayedClose && !client->throttled)
             mode |= VIR_EVENT_HANDLE_READABLE;
 
         /* If there are one or more messages to send back to client,
@@ -241,7 +262,8 @@ static void virNetServerClientUpdateEvent(virNetServerClientPtr client)
 
     virNetSocketUpdateIOCallback(client->sock, mode);
 
-    if (client->rx && virNetSocketHasCachedData(client->sock))
+    if (client->rx && !client->throttled &&
+        virNetSocketHasCachedData(client->sock))
         virEventUpdateTimeout(client->sockTimer, 0);
 }
 
@@ -348,12 +370,189 @@ static void virNetServerClientSockTimerFunc(int timer,
     virEventUpdateTimeout(timer, -1);
     /* Although client->rx != NULL when this timer is enabled, it might have
      * changed since the client was unlocked in the meantime. */
-    if (client->rx)
+    if (client->rx && !client->throttled)
         virNetServerClientDispatchRead(client);
     virObjectUnlock(client);
 }
 
 
+static void virNetServerClientRateTimerFunc(int timer,
+                                            void *opaque)
+{
+    virNetServerClientPtr client = opaque;
+    virObjectLock(client);
+    virEventUpdateTimeout(timer, -1);
+    if (client->throttled) {
+        VIR_DEBUG("Resuming reads from client=%p", client);
+        client->throttled = false;
+        virNetServerClientUpdateEvent(client);
+    }
+    virObjectUnlock(client);
+}
+
+
+/*
+ * @client: a locked client object
+ * @wait: number of milliseconds to pause reading for
+ *
+ * Stop reading requests from @client for at least @wait milliseconds,
+ * leaving them in the socket.
+ */
+static void
+virNetServerClientThrottleLocked(virNetServerClientPtr client,
+                                 unsigned long long wait)
+{
+    unsigned long long now;
+
+    if (!client->sock || virTimeMillisNowRaw(&now) < 0)
+        return;
+
+    if (client->throttled && now + wait <= client->throttledUntil)
+        return;
+
+    if (client->rateTimer < 0) {
+        if ((client->rateTimer = virEventAddTimeout(wait,
+                                                    virNetServerClientRateTimerFunc,
+                                                    client, NULL)) < 0)
+            return;
+    } else {
+        virEventUpdateTimeout(client->rateTimer, wait);
+    }
+
+    VIR_DEBUG("Pausing reads from client=%p for %llums", client, wait);
+    client->throttled = true;
+    client->throttledUntil = now + wait;
+    virNetServerClientUpdateEvent(client);
+}
+
+
+void virNetServerClientThrottle(virNetServerClientPtr client,
+                                unsigned long long wait)
+{
+    virObjectLock(client);
+    virNetServerClientThrottleLocked(client, wait);
+    virObjectUnlock(client);
+}
+
+
+/*
+ * @rate: number of requests allowed per second, 0 for no limit
+ * @burst: number of requests allowed at once, 0 to use @rate
+ *
+ * Limit the rate at which requests are read from @client
+ */
+void virNetServerClientSetRequestRate(virNetServerClientPtr client,
+                                      unsigned int rate,
+                                      unsigned int burst)
+{
+    unsigned long long now;
+
+    if (virTimeMillisNowRaw(&now) < 0)
+        now = 0;
+
+    virObjectLock(client);
+    virTokenBucketSetRate(&client->requestRate, rate, burst, now);
+    virObjectUnlock(client);
+}
+
+
+/*
+ * Get a message ready for receiving a request, taking one from the
+ * pool of sent messages if possible. Called with the client locked.
+ */
+static virNetMessagePtr
+virNetServerClientMessageNew(virNetServerClientPtr client)
+{
+    virNetMessagePtr msg;
+
+    if ((msg = client->msgPool)) {
+        client->msgPool = msg->next;
+        client->nmsgPool--;
+        msg->next = NULL;
+        msg->tracked = true;
+        client->msgPoolHits++;
+    } else {
+        if (!(msg = virNetMessageNew(true)))
+            return NULL;
+        client->msgPoolMisses++;
+    }
+
+    msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+    if (virNetMessageReserveBuffer(msg, msg->bufferLength) < 0) {
+        virNetMessageFree(msg);
+        return NULL;
+    }
+
+    return msg;
+}
+
+
+/*
+ * Put a message which was sent back in the pool, or free it if the
+ * pool is full already. Called with the client locked.
+ */
+static void
+virNetServerClientMessageRelease(virNetServerClientPtr client,
+                                 virNetMessagePtr msg)
+{
+    if (!msg)
+        return;
+
+    if (msg->cb || client->nmsgPool >= client->nrequests_max) {
+        virNetMessageFree(msg);
+        return;
+    }
+
+    virNetMessageRecycle(msg, VIR_NET_MESSAGE_RECYCLE_MAX);
+    msg->next = client->msgPool;
+    client->msgPool = msg;
+    client->nmsgPool++;
+}
+
+
+static void
+virNetServerClientMessagePoolFree(virNetServerClientPtr client)
+{
+    while (client->msgPool) {
+        virNetMessagePtr msg = virNetMessageQueueServe(&client->msgPool);
+        virNetMessageFree(msg);
+    }
+    client->nmsgPool = 0;
+}
+
+
+/*
+ * @nrequests_max: number of requests @client may have in flight
+ *
+ * Lowering the limit lets the requests already in flight complete,
+ * raising it resumes reading from a client waiting on the old one.
+ */
+void virNetServerClientSetMaxRequests(virNetServerClientPtr client,
+                                      size_t nrequests_max)
+{
+    virObjectLock(client);
+
+    client->nrequests_max = nrequests_max;
+
+    while (client->nmsgPool > nrequests_max) {
+        virNetMessagePtr msg = virNetMessageQueueServe(&client->msgPool);
+        virNetMessageFree(msg);
+        client->nmsgPool--;
+    }
+
+    if (client->sock && !client->wantClose && !client->rx &&
+        client->nrequests < client->nrequests_max) {
+        if (!(client->rx = virNetServerClientMessageNew(client)))
+            client->wantClose = true;
+        else
+            client->nrequests++;
+        virNetServerClientUpdateEvent(client);
+    }
+
+    virObjectUnlock(client);
+}
+
+
 static virNetServerClientPtr
 virNetServerClientNewInternal(unsigned long long id,
                               virNetSocketPtr sock,
@@ -375,6 +574,9 @@ virNetServerClientNewInternal(unsigned long long id,
 
     client->id = id;
     client->sock = virObjectRef(sock);
+    /* Keep all I/O of a connection on a single event loop thread,
+     * spreading connections over the threads by their ID */
+    virNetSocketSetEventAffinity(client->sock, id);
     client->auth = auth;
     client->readonly = readonly;
 #ifdef WITH_GNUTLS
@@ -387,12 +589,10 @@ virNetServerClientNewInternal(unsigned long long id,
                                            client, NULL);
     if (client->sockTimer < 0)
         goto error;
+    client->rateTimer = -1;
 
     /* Prepare one for packet receive */
-    if (!(client->rx = virNetMessageNew(true)))
-        goto error;
-    client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_ALLOC_N(client->rx->buffer, client->rx->bufferLength) < 0)
+    if (!(client->rx = virNetServerClientMessageNew(client)))
         goto error;
     client->nrequests = 1;
 
@@ -943,6 +1143,9 @@ void virNetServerClientDispose(void *obj)
 #endif
     if (client->sockTimer > 0)
         virEventRemoveTimeout(client->sockTimer);
+    if (client->rateTimer > 0)
+        virEventRemoveTimeout(client->rateTimer);
+    virNetServerClientMessagePoolFree(client);
 #if WITH_GNUTLS
     virObjectUnref(client->tls);
     virObjectUnref(client->tlsCtxt);
@@ -1015,6 +1218,7 @@ void virNetServerClientClose(virNetServerClientPtr client)
             = virNetMessageQueueServe(&client->tx);
         virNetMessageFree(msg);
     }
+    virNetServerClientMessagePoolFree(client);
 
     if (client->sock) {
         virObjectUnref(client->sock);
@@ -1224,6 +1428,8 @@ static void virNetServerClientDispatchRead(virNetServerClientPtr client)
 
         /* Definitely finished reading, so remove from queue */
         virNetMessageQueueServe(&client->rx);
+        if (virTimeMicrosNowRaw(&msg->received) < 0)
+            msg->received = 0;
         PROBE(RPC_SERVER_CLIENT_MSG_RX,
               "client=%p len=%zu prog=%u vers=%u proc=%u type=%u status=%u serial=%u",
               client, msg->bufferLength,
@@ -1263,6 +1469,9 @@ static void virNetServerClientDispatchRead(virNetServerClientPtr client)
 
         /* Send off to for normal dispatch to workers */
         if (msg) {
+            unsigned long long now;
+            unsigned long long wait = 0;
+
             virObjectRef(client);
             if (!client->dispatchFunc ||
                 client->dispatchFunc(client, msg, client->dispatchOpaque) < 0) {
@@ -1271,21 +1480,20 @@ static void virNetServerClientDispatchRead(virNetServerClientPtr client)
                 virObjectUnref(client);
                 return;
             }
+
+            if (client->requestRate.rate &&
+                virTimeMillisNowRaw(&now) == 0)
+                wait = virTokenBucketTake(&client->requestRate, now);
+            if (wait)
+                virNetServerClientThrottleLocked(client, wait);
         }
 
         /* Possibly need to create another receive buffer */
         if (client->nrequests < client->nrequests_max) {
-            if (!(client->rx = virNetMessageNew(true))) {
+            if (!(client->rx = virNetServerClientMessageNew(client)))
                 client->wantClose = true;
-            } else {
-                client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                if (VIR_ALLOC_N(client->rx->buffer,
-                                client->rx->bufferLength) < 0) {
-                    client->wantClose = true;
-                } else {
-                    client->nrequests++;
-                }
-            }
+            else
+                client->nrequests++;
         }
         virNetServerClientUpdateEvent(client);
     }
@@ -1380,19 +1588,17 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
                 if (!client->rx &&
                     client->nrequests < client->nrequests_max) {
                     /* Ready to recv more messages */
-                    virNetMessageClear(msg);
-                    msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                    if (VIR_ALLOC_N(msg->buffer, msg->bufferLength) < 0) {
-                        virNetMessageFree(msg);
+                    virNetServerClientMessageRelease(client, msg);
+                    msg = NULL;
+                    if (!(client->rx = virNetServerClientMessageNew(client))) {
+                        client->wantClose = true;
                         return;
                     }
-                    client->rx = msg;
-                    msg = NULL;
                     client->nrequests++;
                 }
             }
 
-            virNetMessageFree(msg);
+            virNetServerClientMessageRelease(client, msg);
 
             virNetServerClientUpdateEvent(client);
 
@@ -1639,6 +1845,60 @@ virNetServerClientGetInfo(virNetServerClientPtr client,
 }
 
 
+/**
+ * virNetServerClientGetMessagePoolStats:
+ * @client: the client
+ * @hits: filled with the count of requests received into a pooled message
+ * @misses: filled with the count of requests which needed a new message
+ */
+void
+virNetServerClientGetMessagePoolStats(virNetServerClientPtr client,
+                                      unsigned long long *hits,
+                                      unsigned long long *misses)
+{
+    virObjectLock(client);
+    *hits = client->msgPoolHits;
+    *misses = client->msgPoolMisses;
+    virObjectUnlock(client);
+}
+
+
+/**
+ * virNetServerClientAddStreamBytes:
+ * @client: the client
+ * @received: stream data received from the client
+ * @sent: stream data sent to the client
+ */
+void
+virNetServerClientAddStreamBytes(virNetServerClientPtr client,
+                                 size_t received,
+                                 size_t sent)
+{
+    virObjectLock(client);
+    client->streamBytesReceived += received;
+    client->streamBytesSent += sent;
+    virObjectUnlock(client);
+}
+
+
+/**
+ * virNetServerClientGetStreamStats:
+ * @client: the client
+ * @received: filled with the stream data received from the client
+ * @sent: filled with the stream data sent to the client
+ */
+void
+virNetServerClientGetStreamStats(virNetServerClientPtr client,
+                                 unsigned long long *received,
+                                 unsigned long long *sent)
+{
+    virObjectLock(client);
+    *received = client->streamBytesReceived;
+    *sent = client->streamBytesSent;
+    virObjectUnlock(client);
+}
+
+
 /**
  * virNetServerClientSetQuietEOF:
  *
@@ -131,6 +131,14 @@ bool virNetServerClientWantClose(virNetServerClientPtr client);
 
 int virNetServerClientInit(virNetServerClientPtr client);
 
+void virNetServerClientSetRequestRate(virNetServerClientPtr client,
+                                      unsigned int rate,
+                                      unsigned int burst);
+void virNetServerClientSetMaxRequests(virNetServerClientPtr client,
+                                      size_t nrequests_max);
+void virNetServerClientThrottle(virNetServerClientPtr client,
+                                unsigned long long wait);
+
 int virNetServerClientInitKeepAlive(virNetServerClientPtr client,
                                     int interval,
                                     unsigned int count);
@@ -148,6 +156,15 @@ int virNetServerClientSendMessage(virNetServerClientPtr client,
 bool virNetServerClientNeedAuth(virNetServerClientPtr client);
 
 int virNetServerClientGetTransport(virNetServerClientPtr client);
+void virNetServerClientGetMessagePoolStats(virNetServerClientPtr client,
+                                           unsigned long long *hits,
+                                           unsigned long long *misses);
+void virNetServerClientAddStreamBytes(virNetServerClientPtr client,
+                                      size_t received,
+                                      size_t sent);
+void virNetServerClientGetStreamStats(virNetServerClientPtr client,
+                                      unsigned long long *received,
+                                      unsigned long long *sent);
 int virNetServerClientGetInfo(virNetServerClientPtr client,
                               bool *readonly, char **sock_addr,
                               virIdentityPtr *identity);
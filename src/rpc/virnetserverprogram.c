@@ -31,18 +31,23 @@
 #include "virlog.h"
 #include "virfile.h"
 #include "virthread.h"
+#include "virtime.h"
+#include "virtrace.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
 VIR_LOG_INIT("rpc.netserverprogram");
 
 struct _virNetServerProgram {
-    virObject object;
+    virObjectLockable parent;
 
     unsigned program;
     unsigned version;
     virNetServerProgramProcPtr procs;
     size_t nprocs;
+
+    /* One entry for each of procs, protected by the object lock */
+    virNetServerProgramProcStatsPtr stats;
 };
 
 
@@ -51,7 +56,7 @@ static void virNetServerProgramDispose(void *obj);
 
 static int virNetServerProgramOnceInit(void)
 {
-    if (!(virNetServerProgramClass = virClassNew(virClassForObject(),
+    if (!(virNetServerProgramClass = virClassNew(virClassForObjectLockable(),
                                                  "virNetServerProgram",
                                                  sizeof(virNetServerProgram),
                                                  virNetServerProgramDispose)))
@@ -73,7 +78,7 @@ virNetServerProgramPtr virNetServerProgramNew(unsigned program,
     if (virNetServerProgramInitialize() < 0)
         return NULL;
 
-    if (!(prog = virObjectNew(virNetServerProgramClass)))
+    if (!(prog = virObjectLockableNew(virNetServerProgramClass)))
         return NULL;
 
     prog->program = program;
@@ -81,6 +86,11 @@ virNetServerProgramPtr virNetServerProgramNew(unsigned program,
     prog->procs = procs;
     prog->nprocs = nprocs;
 
+    if (VIR_ALLOC_N(prog->stats, nprocs) < 0) {
+        virObjectUnref(prog);
+        return NULL;
+    }
+
     VIR_DEBUG("prog=%p", prog);
 
     return prog;
@@ -127,27 +137,157 @@ static virNetServerProgramProcPtr virNetServerProgramGetProc(virNetServerProgram
     return proc;
 }
 
+/*
+ * @header: the header of an incoming message
+ *
+ * Returns the priority of the job dispatching the message. The procedure
+ * in the header of a batch is whatever the client put there, while the
+ * calls inside of it may block, so batches never get a high priority.
+ */
 unsigned int
 virNetServerProgramGetPriority(virNetServerProgramPtr prog,
-                               int procedure)
+                               virNetMessageHeaderPtr header)
 {
-    virNetServerProgramProcPtr proc = virNetServerProgramGetProc(prog, procedure);
+    virNetServerProgramProcPtr proc;
+
+    if (header->type == VIR_NET_CALL_BATCH)
+        return 0;
 
-    if (!proc)
+    if (!(proc = virNetServerProgramGetProc(prog, header->proc)))
         return 0;
 
     return proc->priority;
 }
 
+
+/*
+ * @stats: filled with a copy of the statistics of procedures called so far
+ * @nstats: filled with the number of entries in @stats
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virNetServerProgramGetProcStats(virNetServerProgramPtr prog,
+                                virNetServerProgramProcStatsPtr *stats,
+                                size_t *nstats)
+{
+    virNetServerProgramProcStatsPtr tmp = NULL;
+    size_t ntmp = 0;
+    size_t i;
+    int ret = -1;
+
+    virObjectLock(prog);
+
+    for (i = 0; i < prog->nprocs; i++) {
+        if (!prog->stats[i].calls)
+            continue;
+
+        if (VIR_APPEND_ELEMENT_COPY(tmp, ntmp, prog->stats[i]) < 0)
+            goto cleanup;
+    }
+
+    *stats = tmp;
+    *nstats = ntmp;
+    tmp = NULL;
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(prog);
+    VIR_FREE(tmp);
+    return ret;
+}
+
+
+/*
+ * @msg: the method call, whose reply or error was just encoded
+ * @start: when the call started to run, or 0 if unknown
+ * @dispatched: when the call's handler returned, or 0 if it did not run
+ * @failed: whether an error was encoded as reply
+ *
+ * Account the time spent by the call waiting in the queue, in its
+ * handler and encoding its reply
+ */
+static void
+virNetServerProgramUpdateStats(virNetServerProgramPtr prog,
+                               virNetMessagePtr msg,
+                               unsigned long long start,
+                               unsigned long long dispatched,
+                               bool failed)
+{
+    virNetServerProgramProcStatsPtr stats;
+    unsigned long long now;
+    unsigned long long queue = 0;
+    unsigned long long dispatch;
+    unsigned long long encode;
+    unsigned long long limit = 10;
+    size_t bucket = 0;
+
+    if (!start ||
+        !virNetServerProgramGetProc(prog, msg->header.proc) ||
+        virTimeMicrosNowRaw(&now) < 0)
+        return;
+
+    if (dispatched < start)
+        dispatched = now;
+    if (now < dispatched)
+        now = dispatched;
+
+    if (msg->received && msg->received < start)
+        queue = start - msg->received;
+    dispatch = dispatched - start;
+    encode = now - dispatched;
+
+    while (bucket < VIR_NET_SERVER_PROGRAM_TIME_BUCKETS - 1 &&
+           dispatch >= limit) {
+        bucket++;
+        limit *= 10;
+    }
+
+    virObjectLock(prog);
+    stats = &prog->stats[msg->header.proc];
+    stats->program = prog->program;
+    stats->proc = msg->header.proc;
+    stats->calls++;
+    if (failed)
+        stats->errors++;
+    stats->queueTotal += queue;
+    if (queue > stats->queueMax)
+        stats->queueMax = queue;
+    stats->dispatchTotal += dispatch;
+    if (dispatch > stats->dispatchMax)
+        stats->dispatchMax = dispatch;
+    stats->encodeTotal += encode;
+    if (encode > stats->encodeMax)
+        stats->encodeMax = encode;
+    stats->buckets[bucket]++;
+    virObjectUnlock(prog);
+}
+
+
+static void
+virNetServerProgramTraceEnd(unsigned long long dispatched,
+                            bool failed)
+{
+    unsigned long long now;
+
+    if (!virTraceEnabled())
+        return;
+
+    if (dispatched && virTimeMicrosNowRaw(&now) == 0 && now >= dispatched)
+        virTraceSpanAdd("rpc.encode", dispatched, now);
+
+    virTraceEnd(failed);
+}
+
+
 static int
-virNetServerProgramSendError(unsigned program,
-                             unsigned version,
-                             virNetServerClientPtr client,
-                             virNetMessagePtr msg,
-                             virNetMessageErrorPtr rerr,
-                             int procedure,
-                             int type,
-                             unsigned int serial)
+virNetServerProgramEncodeError(unsigned program,
+                               unsigned version,
+                               virNetMessagePtr msg,
+                               virNetMessageErrorPtr rerr,
+                               int procedure,
+                               int type,
+                               unsigned int serial)
 {
     VIR_DEBUG("prog=%d ver=%d proc=%d type=%d serial=%u msg=%p rerr=%p",
               program, version, procedure, type, serial, msg, rerr);
@@ -169,10 +309,6 @@ virNetServerProgramSendError(unsigned program,
         goto error;
     xdr_free((xdrproc_t)xdr_virNetMessageError, (void*)rerr);
 
-    /* Put reply on end of tx queue to send out  */
-    if (virNetServerClientSendMessage(client, msg) < 0)
-        return -1;
-
     return 0;
 
  error:
@@ -182,6 +318,43 @@ virNetServerProgramSendError(unsigned program,
 }
 
 
+static int
+virNetServerProgramSendError(unsigned program,
+                             unsigned version,
+                             virNetServerClientPtr client,
+                             virNetMessagePtr msg,
+                             virNetMessageErrorPtr rerr,
+                             int procedure,
+                             int type,
+                             unsigned int serial)
+{
+    if (virNetServerProgramEncodeError(program, version, msg, rerr,
+                                       procedure, type, serial) < 0)
+        return -1;
+
+    /* Put reply on end of tx queue to send out  */
+    if (virNetServerClientSendMessage(client, msg) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+virNetServerProgramReplyType(virNetMessageHeaderPtr req)
+{
+    switch (req->type) {
+    case VIR_NET_STREAM:
+    case VIR_NET_STREAM_HOLE:
+        return VIR_NET_STREAM;
+    case VIR_NET_CALL_BATCH:
+        return VIR_NET_REPLY_BATCH;
+    default:
+        return VIR_NET_REPLY;
+    }
+}
+
+
 /*
  * @client: the client to send the error to
  * @req: the message this error is in reply to
@@ -200,6 +373,7 @@ virNetServerProgramSendReplyError(virNetServerProgramPtr prog,
     /*
      * For data streams, errors are sent back as data streams
      * For method calls, errors are sent back as method replies
+     * For batches of calls, errors are sent back as batch replies
      */
     return virNetServerProgramSendError(prog->program,
                                         prog->version,
@@ -207,7 +381,7 @@ virNetServerProgramSendReplyError(virNetServerProgramPtr prog,
                                         msg,
                                         rerr,
                                         req->proc,
-                                        req->type == VIR_NET_STREAM ? VIR_NET_STREAM : VIR_NET_REPLY,
+                                        virNetServerProgramReplyType(req),
                                         req->serial);
 }
 
@@ -246,7 +420,7 @@ int virNetServerProgramUnknownError(virNetServerClientPtr client,
                                         msg,
                                         &rerr,
                                         req->proc,
-                                        VIR_NET_REPLY,
+                                        virNetServerProgramReplyType(req),
                                         req->serial);
 }
 
@@ -257,6 +431,12 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
                                 virNetServerClientPtr client,
                                 virNetMessagePtr msg);
 
+static int
+virNetServerProgramDispatchBatch(virNetServerProgramPtr prog,
+                                 virNetServerPtr server,
+                                 virNetServerClientPtr client,
+                                 virNetMessagePtr msg);
+
 /*
  * @server: the unlocked server object
  * @client: the unlocked client object
@@ -307,7 +487,12 @@ int virNetServerProgramDispatch(virNetServerProgramPtr prog,
         ret = virNetServerProgramDispatchCall(prog, server, client, msg);
         break;
 
+    case VIR_NET_CALL_BATCH:
+        ret = virNetServerProgramDispatchBatch(prog, server, client, msg);
+        break;
+
     case VIR_NET_STREAM:
+    case VIR_NET_STREAM_HOLE:
         /* Since stream data is non-acked, async, we may continue to receive
          * stream packets after we closed down a stream. Just drop & ignore
          * these.
@@ -335,7 +520,8 @@ int virNetServerProgramDispatch(virNetServerProgramPtr prog,
 
  error:
     if (msg->header.type == VIR_NET_CALL ||
-        msg->header.type == VIR_NET_CALL_WITH_FDS) {
+        msg->header.type == VIR_NET_CALL_WITH_FDS ||
+        msg->header.type == VIR_NET_CALL_BATCH) {
         ret = virNetServerProgramSendReplyError(prog, client, msg, &rerr, &msg->header);
     } else {
         /* Send a dummy reply to free up 'msg' & unblock client rx */
@@ -357,19 +543,21 @@ int virNetServerProgramDispatch(virNetServerProgramPtr prog,
  * @server: the unlocked server object
  * @client: the unlocked client object
  * @msg: the complete incoming method call, with header already decoded
+ * @batched: whether the call is part of a VIR_NET_CALL_BATCH message
  *
- * This method is used to dispatch a message representing an
- * incoming method call from a client. It decodes the payload
- * to obtain method call arguments, invokves the method and
- * then sends a reply packet with the return values
+ * This method is used to run a method call from a client. It
+ * decodes the payload to obtain method call arguments, invokves
+ * the method and then encodes the return values, or the error
+ * it reported, as a reply into @msg
  *
- * Returns 0 if the reply was sent, or -1 upon fatal error
+ * Returns 0 if the reply was encoded, or -1 upon fatal error
  */
 static int
-virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
-                                virNetServerPtr server,
-                                virNetServerClientPtr client,
-                                virNetMessagePtr msg)
+virNetServerProgramRunCall(virNetServerProgramPtr prog,
+                           virNetServerPtr server,
+                           virNetServerClientPtr client,
+                           virNetMessagePtr msg,
+                           bool batched)
 {
     char *arg = NULL;
     char *ret = NULL;
@@ -378,9 +566,25 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
     virNetMessageError rerr;
     size_t i;
     virIdentityPtr identity = NULL;
+    unsigned long long start = 0;
+    unsigned long long dispatched = 0;
 
     memset(&rerr, 0, sizeof(rerr));
 
+    if (virTimeMicrosNowRaw(&start) < 0)
+        start = 0;
+
+    /* The dispatcher renames the trace after the procedure */
+    virTraceBegin("rpc", msg->received);
+    if (msg->received && msg->received < start)
+        virTraceSpanAdd("rpc.queue", msg->received, start);
+    virTraceSpanTag(0, "rpc.program", "%x", msg->header.prog);
+    virTraceSpanTag(0, "rpc.procedure", "%d", msg->header.proc);
+    virTraceSpanTag(0, "rpc.serial", "%u", msg->header.serial);
+    if (virTraceEnabled())
+        VIR_DEBUG("proc=%d serial=%u trace=%s", msg->header.proc,
+                  msg->header.serial, NULLSTR(virTraceGetID()));
+
     if (msg->header.status != VIR_NET_OK) {
         virReportError(VIR_ERR_RPC,
                        _("Unexpected message status %u"),
@@ -410,6 +614,16 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
         goto error;
     }
 
+    /* The stream would be registered under the serial of the batch,
+     * which the client never expects stream data for */
+    if (batched && dispatcher->stream) {
+        virReportError(VIR_ERR_RPC,
+                       _("procedure %d opens a stream and cannot be "
+                         "called in a batch"),
+                       msg->header.proc);
+        goto error;
+    }
+
     if (VIR_ALLOC_N(arg, dispatcher->arg_len) < 0)
         goto error;
     if (VIR_ALLOC_N(ret, dispatcher->ret_len) < 0)
@@ -436,6 +650,9 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
      */
     rv = (dispatcher->func)(server, client, msg, &rerr, arg, ret);
 
+    if (virTimeMicrosNowRaw(&dispatched) < 0)
+        dispatched = 0;
+
     if (virIdentitySetCurrent(NULL) < 0)
         goto error;
 
@@ -447,14 +664,25 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
      * Otherwise we must clear out the FDs we got from
      * the client originally.
      *
+     * Batch replies have no room for FDs, so these are
+     * dropped and the call fails.
      */
-    if (rv != 1) {
+    if (rv != 1 || batched) {
         for (i = 0; i < msg->nfds; i++)
             VIR_FORCE_CLOSE(msg->fds[i]);
         VIR_FREE(msg->fds);
         msg->nfds = 0;
     }
 
+    if (rv == 1 && batched) {
+        xdr_free(dispatcher->ret_filter, ret);
+        virReportError(VIR_ERR_RPC,
+                       _("procedure %d cannot return file descriptors "
+                         "in a batch"),
+                       msg->header.proc);
+        rv = -1;
+    }
+
     xdr_free(dispatcher->arg_filter, arg);
 
     if (rv < 0)
@@ -489,14 +717,25 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
     VIR_FREE(arg);
     VIR_FREE(ret);
 
+    virNetServerProgramUpdateStats(prog, msg, start, dispatched, false);
+    virNetServerProgramTraceEnd(dispatched, false);
+
     virObjectUnref(identity);
-    /* Put reply on end of tx queue to send out  */
-    return virNetServerClientSendMessage(client, msg);
+    return 0;
 
  error:
     /* Bad stuff (de-)serializing message, but we have an
      * RPC error message we can send back to the client */
-    rv = virNetServerProgramSendReplyError(prog, client, msg, &rerr, &msg->header);
+    rv = virNetServerProgramEncodeError(prog->program,
+                                        prog->version,
+                                        msg,
+                                        &rerr,
+                                        msg->header.proc,
+                                        virNetServerProgramReplyType(&msg->header),
+                                        msg->header.serial);
+
+    virNetServerProgramUpdateStats(prog, msg, start, dispatched, true);
+    virNetServerProgramTraceEnd(dispatched, true);
 
     VIR_FREE(arg);
     VIR_FREE(ret);
@@ -506,6 +745,153 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
 }
 
 
+/*
+ * @server: the unlocked server object
+ * @client: the unlocked client object
+ * @msg: the complete incoming method call, with header already decoded
+ *
+ * This method is used to dispatch a message representing an
+ * incoming method call from a client. It runs the method and
+ * then sends a reply packet with the return values
+ *
+ * Returns 0 if the reply was sent, or -1 upon fatal error
+ */
+static int
+virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
+                                virNetServerPtr server,
+                                virNetServerClientPtr client,
+                                virNetMessagePtr msg)
+{
+    if (virNetServerProgramRunCall(prog, server, client, msg, false) < 0)
+        return -1;
+
+    /* Put reply on end of tx queue to send out  */
+    return virNetServerClientSendMessage(client, msg);
+}
+
+
+/* Encoded replies start with the length word and the fixed size header */
+#define VIR_NET_SERVER_PROGRAM_REPLY_OFFSET \
+    (VIR_NET_MESSAGE_HEADER_XDR_LEN + VIR_NET_MESSAGE_HEADER_MAX)
+
+/*
+ * @server: the unlocked server object
+ * @client: the unlocked client object
+ * @msg: the complete incoming batch of method calls, with header
+ *       already decoded
+ *
+ * This method is used to dispatch a message carrying several
+ * method calls from a client. The calls are run one after another
+ * and a single reply packet with the return values, or errors, of
+ * each of them is sent back. Procedures opening streams or returning
+ * file descriptors are refused. The batch is queued without priority,
+ * see virNetServerProgramGetPriority, so high priority procedures in it
+ * lose theirs
+ *
+ * Returns 0 if the reply was sent, or -1 upon fatal error
+ */
+static int
+virNetServerProgramDispatchBatch(virNetServerProgramPtr prog,
+                                 virNetServerPtr server,
+                                 virNetServerClientPtr client,
+                                 virNetMessagePtr msg)
+{
+    virNetMessageBatch batch;
+    virNetMessageBatchReplies replies;
+    virNetMessagePtr call = NULL;
+    virNetMessageError rerr;
+    size_t i;
+    int rv = -1;
+
+    memset(&batch, 0, sizeof(batch));
+    memset(&replies, 0, sizeof(replies));
+    memset(&rerr, 0, sizeof(rerr));
+
+    if (msg->header.status != VIR_NET_OK) {
+        virReportError(VIR_ERR_RPC,
+                       _("Unexpected message status %u"),
+                       msg->header.status);
+        goto error;
+    }
+
+    if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetMessageBatch,
+                                   &batch) < 0)
+        goto error;
+
+    if (!(call = virNetMessageNew(false)))
+        goto error;
+
+    if (VIR_ALLOC_N(replies.replies.replies_val, batch.calls.calls_len) < 0)
+        goto error;
+    replies.replies.replies_len = batch.calls.calls_len;
+
+    for (i = 0; i < batch.calls.calls_len; i++) {
+        virNetMessageBatchCall *args = &batch.calls.calls_val[i];
+        virNetMessageBatchReply *reply = &replies.replies.replies_val[i];
+        size_t len;
+
+        VIR_DEBUG("Batch serial=%u call=%zu proc=%d",
+                  msg->header.serial, i, args->proc);
+
+        /* Keep the buffer of the previous call for this one */
+        virNetMessageRecycle(call, VIR_NET_MESSAGE_RECYCLE_MAX);
+        call->header = msg->header;
+        call->header.proc = args->proc;
+        call->header.type = VIR_NET_CALL;
+        call->received = msg->received;
+
+        call->bufferLength = args->args.args_len;
+        if (virNetMessageReserveBuffer(call, call->bufferLength) < 0)
+            goto error;
+        if (call->bufferLength)
+            memcpy(call->buffer, args->args.args_val, call->bufferLength);
+
+        if (virNetServerProgramRunCall(prog, server, client, call, true) < 0)
+            goto error;
+
+        reply->proc = args->proc;
+        reply->status = call->header.status;
+        len = call->bufferLength - VIR_NET_SERVER_PROGRAM_REPLY_OFFSET;
+        if (len) {
+            if (VIR_ALLOC_N(reply->ret.ret_val, len) < 0)
+                goto error;
+            memcpy(reply->ret.ret_val,
+                   call->buffer + VIR_NET_SERVER_PROGRAM_REPLY_OFFSET, len);
+        }
+        reply->ret.ret_len = len;
+    }
+
+    xdr_free((xdrproc_t)xdr_virNetMessageBatch, (void*)&batch);
+    virNetMessageFree(call);
+    call = NULL;
+
+    msg->header.type = VIR_NET_REPLY_BATCH;
+    msg->header.status = VIR_NET_OK;
+
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayload(msg,
+                                   (xdrproc_t)xdr_virNetMessageBatchReplies,
+                                   &replies) < 0)
+        goto error;
+
+    xdr_free((xdrproc_t)xdr_virNetMessageBatchReplies, (void*)&replies);
+
+    /* Put reply on end of tx queue to send out  */
+    return virNetServerClientSendMessage(client, msg);
+
+ error:
+    xdr_free((xdrproc_t)xdr_virNetMessageBatch, (void*)&batch);
+    xdr_free((xdrproc_t)xdr_virNetMessageBatchReplies, (void*)&replies);
+    virNetMessageFree(call);
+
+    /* Encoding the reply may have failed after the type was changed */
+    msg->header.type = VIR_NET_CALL_BATCH;
+    rv = virNetServerProgramSendReplyError(prog, client, msg, &rerr, &msg->header);
+
+    return rv;
+}
+
+
 int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
                                       virNetServerClientPtr client,
                                       virNetMessagePtr msg,
@@ -548,6 +934,44 @@ int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
 }
 
 
-void virNetServerProgramDispose(void *obj ATTRIBUTE_UNUSED)
+int virNetServerProgramSendStreamHole(virNetServerProgramPtr prog,
+                                      virNetServerClientPtr client,
+                                      virNetMessagePtr msg,
+                                      int procedure,
+                                      unsigned int serial,
+                                      long long length,
+                                      unsigned int flags)
+{
+    virNetStreamHole data;
+
+    VIR_DEBUG("client=%p msg=%p length=%lld", client, msg, length);
+
+    memset(&data, 0, sizeof(data));
+    data.length = length;
+    data.flags = flags;
+
+    msg->header.prog = prog->program;
+    msg->header.vers = prog->version;
+    msg->header.proc = procedure;
+    msg->header.type = VIR_NET_STREAM_HOLE;
+    msg->header.serial = serial;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        return -1;
+
+    if (virNetMessageEncodePayload(msg,
+                                   (xdrproc_t) xdr_virNetStreamHole,
+                                   &data) < 0)
+        return -1;
+
+    return virNetServerClientSendMessage(client, msg);
+}
+
+
+void virNetServerProgramDispose(void *obj)
 {
+    virNetServerProgramPtr prog = obj;
+
+    VIR_FREE(prog->stats);
 }
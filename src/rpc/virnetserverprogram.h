@@ -58,6 +58,29 @@ struct _virNetServerProgramProc {
     xdrproc_t ret_filter;
     bool needAuth;
     unsigned int priority;
+    bool stream; /* the procedure opens a stream */
+};
+
+/* Number of buckets in the dispatch time histogram, each covering a decade
+ * of microseconds: < 10us, < 100us, < 1ms, < 10ms, < 100ms, < 1s, longer */
+# define VIR_NET_SERVER_PROGRAM_TIME_BUCKETS 7
+
+typedef struct _virNetServerProgramProcStats virNetServerProgramProcStats;
+typedef virNetServerProgramProcStats *virNetServerProgramProcStatsPtr;
+
+/* All times are in microseconds */
+struct _virNetServerProgramProcStats {
+    unsigned program;
+    int proc;
+    unsigned long long calls;
+    unsigned long long errors;
+    unsigned long long queueTotal;
+    unsigned long long queueMax;
+    unsigned long long dispatchTotal;
+    unsigned long long dispatchMax;
+    unsigned long long encodeTotal;
+    unsigned long long encodeMax;
+    unsigned long long buckets[VIR_NET_SERVER_PROGRAM_TIME_BUCKETS];
 };
 
 virNetServerProgramPtr virNetServerProgramNew(unsigned program,
@@ -69,7 +92,11 @@ int virNetServerProgramGetID(virNetServerProgramPtr prog);
 int virNetServerProgramGetVersion(virNetServerProgramPtr prog);
 
 unsigned int virNetServerProgramGetPriority(virNetServerProgramPtr prog,
-                                            int procedure);
+                                            virNetMessageHeaderPtr header);
+
+int virNetServerProgramGetProcStats(virNetServerProgramPtr prog,
+                                    virNetServerProgramProcStatsPtr *stats,
+                                    size_t *nstats);
 
 int virNetServerProgramMatches(virNetServerProgramPtr prog,
                                virNetMessagePtr msg);
@@ -104,4 +131,12 @@ int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
                                       const char *data,
                                       size_t len);
 
+int virNetServerProgramSendStreamHole(virNetServerProgramPtr prog,
+                                      virNetServerClientPtr client,
+                                      virNetMessagePtr msg,
+                                      int procedure,
+                                      unsigned int serial,
+                                      long long length,
+                                      unsigned int flags);
+
 #endif /* __VIR_NET_SERVER_PROGRAM_H__ */
@@ -57,6 +57,7 @@
 #include "virpidfile.h"
 #include "virprobe.h"
 #include "virprocess.h"
+#include "virevent.h"
 #include "virstring.h"
 #include "dirname.h"
 #include "passfd.h"
@@ -83,6 +84,8 @@ struct _virNetSocket {
     bool client;
     bool ownsFd;
     bool quietEOF;
+    bool hasAffinity;
+    unsigned int affinity;
 
     /* Event callback fields */
     virNetSocketIOFunc func;
@@ -2169,11 +2172,20 @@ int virNetSocketAddIOCallback(virNetSocketPtr sock,
         goto cleanup;
     }
 
-    if ((sock->watch = virEventAddHandle(sock->fd,
-                                         events,
-                                         virNetSocketEventHandle,
-                                         sock,
-                                         virNetSocketEventFree)) < 0) {
+    if (sock->hasAffinity)
+        sock->watch = virEventAddHandleAffinity(sock->fd,
+                                                events,
+                                                virNetSocketEventHandle,
+                                                sock,
+                                                virNetSocketEventFree,
+                                                sock->affinity);
+    else
+        sock->watch = virEventAddHandle(sock->fd,
+                                        events,
+                                        virNetSocketEventHandle,
+                                        sock,
+                                        virNetSocketEventFree);
+    if (sock->watch < 0) {
         VIR_DEBUG("Failed to register watch on socket %p", sock);
         goto cleanup;
     }
@@ -2257,3 +2269,23 @@ virNetSocketSetQuietEOF(virNetSocketPtr sock)
 {
     sock->quietEOF = true;
 }
+
+
+/**
+ * virNetSocketSetEventAffinity:
+ * @sock: socket object pointer
+ * @key: value selecting the event loop thread
+ *
+ * Requests that I/O callbacks registered afterwards for @sock are
+ * dispatched by the event loop thread selected by @key, when the
+ * default event loop runs more than one thread.
+ */
+void
+virNetSocketSetEventAffinity(virNetSocketPtr sock,
+                             unsigned int key)
+{
+    virObjectLock(sock);
+    sock->hasAffinity = true;
+    sock->affinity = key;
+    virObjectUnlock(sock);
+}
@@ -145,6 +145,9 @@ int virNetSocketSetBlocking(virNetSocketPtr sock,
 
 void virNetSocketSetQuietEOF(virNetSocketPtr sock);
 
+void virNetSocketSetEventAffinity(virNetSocketPtr sock,
+                                  unsigned int key);
+
 ssize_t virNetSocketRead(virNetSocketPtr sock, char *buf, size_t len);
 ssize_t virNetSocketWrite(virNetSocketPtr sock, const char *buf, size_t len);
 
@@ -40,6 +40,7 @@
 #include "virlog.h"
 #include "virprobe.h"
 #include "virthread.h"
+#include "virhash.h"
 #include "configmake.h"
 
 #define DH_BITS 2048
@@ -66,6 +67,11 @@ struct _virNetTLSContext {
     bool requireValidCert;
     const char *const*x509dnWhitelist;
     char *priority;
+
+    /* Server: key protecting the session tickets handed to clients */
+    gnutls_datum_t ticketKey;
+    /* Client: certificate file, identifying us in the session cache */
+    char *certFile;
 };
 
 struct _virNetTLSSession {
@@ -80,6 +86,7 @@ struct _virNetTLSSession {
     virNetTLSSessionReadFunc readFunc;
     void *opaque;
     char *x509dname;
+    char *cacheKey; /* client: where to save the session for resumption */
 };
 
 static virClassPtr virNetTLSContextClass;
@@ -87,6 +94,26 @@ static virClassPtr virNetTLSSessionClass;
 static void virNetTLSContextDispose(void *obj);
 static void virNetTLSSessionDispose(void *obj);
 
+/* Client sessions which may be resumed by later connections to the
+ * same server, keyed by certificate file and hostname. Contexts are
+ * created for each connection so the cache can't live in them. */
+static virMutex virNetTLSSessionCacheLock;
+static virHashTablePtr virNetTLSSessionCache;
+
+
+static void
+virNetTLSSessionCacheEntryFree(void *payload,
+                               const void *name ATTRIBUTE_UNUSED)
+{
+    gnutls_datum_t *data = payload;
+
+    if (!data)
+        return;
+
+    gnutls_free(data->data);
+    VIR_FREE(data);
+}
+
 
 static int virNetTLSContextOnceInit(void)
 {
@@ -102,6 +129,15 @@ static int virNetTLSContextOnceInit(void)
                                               virNetTLSSessionDispose)))
         return -1;
 
+    if (virMutexInit(&virNetTLSSessionCacheLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+
+    if (!(virNetTLSSessionCache = virHashCreate(8, virNetTLSSessionCacheEntryFree)))
+        return -1;
+
     return 0;
 }
 
@@ -714,6 +750,9 @@ static virNetTLSContextPtr virNetTLSContextNew(const char *cacert,
     if (VIR_STRDUP(ctxt->priority, priority) < 0)
         goto error;
 
+    if (!isServer && VIR_STRDUP(ctxt->certFile, cert) < 0)
+        goto error;
+
     err = gnutls_certificate_allocate_credentials(&ctxt->x509cred);
     if (err) {
         virReportError(VIR_ERR_SYSTEM_ERROR,
@@ -752,6 +791,17 @@ static virNetTLSContextPtr virNetTLSContextNew(const char *cacert,
 
         gnutls_certificate_set_dh_params(ctxt->x509cred,
                                          ctxt->dhParams);
+
+#if LIBGNUTLS_VERSION_NUMBER >= 0x020a00
+        /* Let clients reconnect with an abbreviated handshake */
+        err = gnutls_session_ticket_key_generate(&ctxt->ticketKey);
+        if (err < 0) {
+            virReportError(VIR_ERR_SYSTEM_ERROR,
+                           _("Unable to generate TLS session ticket key: %s"),
+                           gnutls_strerror(err));
+            goto error;
+        }
+#endif
     }
 
     ctxt->requireValidCert = requireValidCert;
@@ -768,6 +818,8 @@ static virNetTLSContextPtr virNetTLSContextNew(const char *cacert,
     if (isServer)
         gnutls_dh_params_deinit(ctxt->dhParams);
     gnutls_certificate_free_credentials(ctxt->x509cred);
+    VIR_FREE(ctxt->certFile);
+    VIR_FREE(ctxt->priority);
     VIR_FREE(ctxt);
     return NULL;
 }
@@ -1149,6 +1201,11 @@ void virNetTLSContextDispose(void *obj)
           "ctxt=%p", ctxt);
 
     VIR_FREE(ctxt->priority);
+    VIR_FREE(ctxt->certFile);
+    if (ctxt->ticketKey.data) {
+        memset(ctxt->ticketKey.data, 0, ctxt->ticketKey.size);
+        gnutls_free(ctxt->ticketKey.data);
+    }
     gnutls_dh_params_deinit(ctxt->dhParams);
     gnutls_certificate_free_credentials(ctxt->x509cred);
 }
@@ -1235,6 +1292,33 @@ virNetTLSSessionPtr virNetTLSSessionNew(virNetTLSContextPtr ctxt,
         gnutls_certificate_server_set_request(sess->session, GNUTLS_CERT_REQUEST);
 
         gnutls_dh_set_prime_bits(sess->session, DH_BITS);
+
+#if LIBGNUTLS_VERSION_NUMBER >= 0x020a00
+        if ((err = gnutls_session_ticket_enable_server(sess->session,
+                                                       &ctxt->ticketKey)) != 0) {
+            virReportError(VIR_ERR_SYSTEM_ERROR,
+                           _("Failed to enable TLS session tickets: %s"),
+                           gnutls_strerror(err));
+            goto error;
+        }
+#endif
+    } else if (hostname) {
+        gnutls_datum_t *data;
+
+        if (virAsprintf(&sess->cacheKey, "%s:%s",
+                        NULLSTR(ctxt->certFile), hostname) < 0)
+            goto error;
+
+        /* Offer to resume the last session with this server. Should
+         * the server refuse, a full handshake is done instead. */
+        virMutexLock(&virNetTLSSessionCacheLock);
+        if ((data = virHashLookup(virNetTLSSessionCache, sess->cacheKey))) {
+            VIR_DEBUG("Trying to resume session with %s", hostname);
+            if ((err = gnutls_session_set_data(sess->session,
+                                               data->data, data->size)) != 0)
+                VIR_DEBUG("Cannot resume session: %s", gnutls_strerror(err));
+        }
+        virMutexUnlock(&virNetTLSSessionCacheLock);
     }
 
     gnutls_transport_set_ptr(sess->session, sess);
@@ -1342,7 +1426,8 @@ int virNetTLSSessionHandshake(virNetTLSSessionPtr sess)
     VIR_DEBUG("Ret=%d", ret);
     if (ret == 0) {
         sess->handshakeComplete = true;
-        VIR_DEBUG("Handshake is complete");
+        VIR_DEBUG("Handshake is complete, resumed=%d",
+                  gnutls_session_is_resumed(sess->session));
         goto cleanup;
     }
     if (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN) {
@@ -1411,6 +1496,30 @@ const char *virNetTLSSessionGetX509DName(virNetTLSSessionPtr sess)
     return ret;
 }
 
+static void
+virNetTLSSessionCacheSave(virNetTLSSessionPtr sess)
+{
+    gnutls_datum_t *data;
+    int err;
+
+    if (VIR_ALLOC_QUIET(data) < 0)
+        return;
+
+    if ((err = gnutls_session_get_data2(sess->session, data)) != 0) {
+        VIR_DEBUG("Cannot save session: %s", gnutls_strerror(err));
+        VIR_FREE(data);
+        return;
+    }
+
+    virMutexLock(&virNetTLSSessionCacheLock);
+    if (virHashUpdateEntry(virNetTLSSessionCache, sess->cacheKey, data) < 0) {
+        virNetTLSSessionCacheEntryFree(data, NULL);
+        virResetLastError();
+    }
+    virMutexUnlock(&virNetTLSSessionCacheLock);
+}
+
+
 void virNetTLSSessionDispose(void *obj)
 {
     virNetTLSSessionPtr sess = obj;
@@ -1418,6 +1527,13 @@ void virNetTLSSessionDispose(void *obj)
     PROBE(RPC_TLS_SESSION_DISPOSE,
           "sess=%p", sess);
 
+    /* Remember the session for the next connection to the same
+     * server. This is done only now because with TLS 1.3 the server
+     * sends its ticket some time after the handshake. */
+    if (sess->cacheKey && sess->handshakeComplete)
+        virNetTLSSessionCacheSave(sess);
+
+    VIR_FREE(sess->cacheKey);
     VIR_FREE(sess->x509dname);
     VIR_FREE(sess->hostname);
     gnutls_deinit(sess->session);
@@ -394,6 +394,65 @@ secretGetValue(virSecretPtr obj,
     return ret;
 }
 
+/* Fast path for the drivers consuming secrets, see virSecretGetSecretString */
+static unsigned char *
+secretLookupValue(virConnectPtr conn,
+                  const unsigned char *uuid,
+                  int usageType,
+                  const char *usageID,
+                  size_t *value_size,
+                  unsigned int internalFlags)
+{
+    unsigned char *ret = NULL;
+    virSecretObjPtr secret;
+    virSecretDefPtr def;
+
+    if (uuid) {
+        if (!(secret = virSecretObjListFindByUUID(driver->secrets, uuid))) {
+            char uuidstr[VIR_UUID_STRING_BUFLEN];
+            virUUIDFormat(uuid, uuidstr);
+            virReportError(VIR_ERR_NO_SECRET,
+                           _("no secret with matching uuid '%s'"), uuidstr);
+            goto cleanup;
+        }
+
+        def = virSecretObjGetDef(secret);
+        if (virSecretLookupByUUIDEnsureACL(conn, def) < 0)
+            goto cleanup;
+    } else {
+        if (!(secret = virSecretObjListFindByUsage(driver->secrets,
+                                                   usageType, usageID))) {
+            virReportError(VIR_ERR_NO_SECRET,
+                           _("no secret with matching usage '%s'"), usageID);
+            goto cleanup;
+        }
+
+        def = virSecretObjGetDef(secret);
+        if (virSecretLookupByUsageEnsureACL(conn, def) < 0)
+            goto cleanup;
+    }
+
+    if (virSecretGetValueEnsureACL(conn, def) < 0)
+        goto cleanup;
+
+    if ((internalFlags & VIR_SECRET_GET_VALUE_INTERNAL_CALL) == 0 &&
+        def->isprivate) {
+        virReportError(VIR_ERR_INVALID_SECRET, "%s",
+                       _("secret is private"));
+        goto cleanup;
+    }
+
+    if (!(ret = virSecretObjGetValue(secret)))
+        goto cleanup;
+
+    *value_size = virSecretObjGetValueSize(secret);
+
+ cleanup:
+    virSecretObjEndAPI(&secret);
+
+    return ret;
+}
+
 static int
 secretUndefine(virSecretPtr obj)
 {
@@ -564,6 +623,7 @@ static virSecretDriver secretDriver = {
     .secretGetXMLDesc = secretGetXMLDesc, /* 0.7.1 */
     .secretSetValue = secretSetValue, /* 0.7.1 */
     .secretGetValue = secretGetValue, /* 0.7.1 */
+    .secretLookupValue = secretLookupValue, /* 3.3.0 */
     .secretUndefine = secretUndefine, /* 0.7.1 */
     .connectSecretEventRegisterAny = secretConnectSecretEventRegisterAny, /* 3.0.0 */
     .connectSecretEventDeregisterAny = secretConnectSecretEventDeregisterAny, /* 3.0.0 */
@@ -42,7 +42,9 @@ VIR_LOG_INIT("secret.secret_util");
  * @secret_size: Return size of the secret - either raw text or base64
  *
  * Lookup the secret for the usage type and return it as raw text.
- * It is up to the caller to encode the secret further.
+ * It is up to the caller to encode the secret further. If the secret
+ * driver provides it, the value is fetched in a single call, without
+ * going through a virSecretPtr.
  *
  * Returns 0 on success, -1 on failure.  On success the memory in secret
  * needs to be cleared and free'd after usage.
@@ -57,6 +59,22 @@ virSecretGetSecretString(virConnectPtr conn,
     virSecretPtr sec = NULL;
     int ret = -1;
 
+    if (conn->secretDriver->secretLookupValue) {
+        const unsigned char *uuid = NULL;
+        const char *usageID = NULL;
+
+        if (seclookupdef->type == VIR_SECRET_LOOKUP_TYPE_UUID)
+            uuid = seclookupdef->u.uuid;
+        else
+            usageID = seclookupdef->u.usage;
+
+        *secret = conn->secretDriver->secretLookupValue(conn, uuid,
+                                                        secretUsageType,
+                                                        usageID, secret_size,
+                                                        VIR_SECRET_GET_VALUE_INTERNAL_CALL);
+        return *secret ? 0 : -1;
+    }
+
     switch (seclookupdef->type) {
     case VIR_SECRET_LOOKUP_TYPE_UUID:
         sec = conn->secretDriver->secretLookupByUUID(conn, seclookupdef->u.uuid);
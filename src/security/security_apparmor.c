@@ -462,7 +462,8 @@ AppArmorGenSecurityLabel(virSecurityManagerPtr mgr ATTRIBUTE_UNUSED,
     if (VIR_STRDUP(secdef->imagelabel, profile_name) < 0)
         goto err;
 
-    if (!secdef->model && VIR_STRDUP(secdef->model, SECURITY_APPARMOR_NAME) < 0)
+    if (!secdef->model &&
+        virStringIntern(&secdef->model, SECURITY_APPARMOR_NAME) < 0)
         goto err;
 
     /* Now that we have a label, load the profile into the kernel. */
@@ -479,7 +480,7 @@ AppArmorGenSecurityLabel(virSecurityManagerPtr mgr ATTRIBUTE_UNUSED,
  err:
     VIR_FREE(secdef->label);
     VIR_FREE(secdef->imagelabel);
-    VIR_FREE(secdef->model);
+    secdef->model = NULL;
 
  cleanup:
     VIR_FREE(profile_name);
@@ -555,7 +556,7 @@ AppArmorReleaseSecurityLabel(virSecurityManagerPtr mgr ATTRIBUTE_UNUSED,
     virSecurityLabelDefPtr secdef = virDomainDefGetSecurityLabelDef(def,
                                                         SECURITY_APPARMOR_NAME);
     if (secdef) {
-        VIR_FREE(secdef->model);
+        secdef->model = NULL;
         VIR_FREE(secdef->label);
         VIR_FREE(secdef->imagelabel);
     }
@@ -29,6 +29,7 @@
 #endif
 
 #include "security_dac.h"
+#include "security_relabel.h"
 #include "virerror.h"
 #include "virfile.h"
 #include "viralloc.h"
@@ -82,13 +83,24 @@ typedef struct _virSecurityDACChownList virSecurityDACChownList;
 typedef virSecurityDACChownList *virSecurityDACChownListPtr;
 struct _virSecurityDACChownList {
     virSecurityDACDataPtr priv;
-    virSecurityDACChownItemPtr *items;
-    size_t nItems;
+    virSecurityRelabelListPtr items;
 };
 
 
 virThreadLocal chownList;
 
+static void
+virSecurityDACChownItemFree(void *opaque)
+{
+    virSecurityDACChownItemPtr item = opaque;
+
+    if (!item)
+        return;
+
+    VIR_FREE(item->path);
+    VIR_FREE(item);
+}
+
 static int
 virSecurityDACChownListAppend(virSecurityDACChownListPtr list,
                               const char *path,
@@ -96,46 +108,32 @@ virSecurityDACChownListAppend(virSecurityDACChownListPtr list,
                               uid_t uid,
                               gid_t gid)
 {
-    int ret = -1;
-    char *tmp = NULL;
     virSecurityDACChownItemPtr item = NULL;
 
     if (VIR_ALLOC(item) < 0)
         return -1;
 
-    if (VIR_STRDUP(tmp, path) < 0)
-        goto cleanup;
+    if (VIR_STRDUP(item->path, path) < 0) {
+        virSecurityDACChownItemFree(item);
+        return -1;
+    }
 
-    item->path = tmp;
     item->src = src;
     item->uid = uid;
     item->gid = gid;
 
-    if (VIR_APPEND_ELEMENT(list->items, list->nItems, item) < 0)
-        goto cleanup;
-
-    tmp = NULL;
-
-    ret = 0;
- cleanup:
-    VIR_FREE(tmp);
-    VIR_FREE(item);
-    return ret;
+    return virSecurityRelabelListAdd(list->items, item->path, item);
 }
 
 static void
 virSecurityDACChownListFree(void *opaque)
 {
     virSecurityDACChownListPtr list = opaque;
-    size_t i;
 
     if (!list)
         return;
 
-    for (i = 0; i < list->nItems; i++) {
-        VIR_FREE(list->items[i]->path);
-        VIR_FREE(list->items[i]);
-    }
+    virSecurityRelabelListFree(list->items);
     VIR_FREE(list);
 }
 
@@ -176,6 +174,35 @@ static int virSecurityDACSetOwnershipInternal(const virSecurityDACData *priv,
                                               uid_t uid,
                                               gid_t gid);
 
+static int
+virSecurityDACTransactionRunItem(void *opaque,
+                                 void *data)
+{
+    virSecurityDACChownItemPtr item = opaque;
+    virSecurityDACChownListPtr list = data;
+    struct stat sb;
+
+    /* Paths shared within the domain (e.g. backing chains) are likely
+     * to be owned by the right user already. Don't bother the chown
+     * callback which may end up talking to the storage backend. */
+    if (item->path && item->src && list->priv &&
+        list->priv->chownCallback &&
+        stat(item->path, &sb) == 0 &&
+        sb.st_uid == item->uid && sb.st_gid == item->gid) {
+        VIR_DEBUG("Ownership of '%s' is already '%ld:%ld'",
+                  item->path, (long) item->uid, (long) item->gid);
+        return 0;
+    }
+
+    /* TODO Implement rollback */
+    return virSecurityDACSetOwnershipInternal(list->priv,
+                                              item->src,
+                                              item->path,
+                                              item->uid,
+                                              item->gid);
+}
+
+
 /**
  * virSecurityDACTransactionRun:
  * @pid: process pid
@@ -183,7 +210,8 @@ static int virSecurityDACSetOwnershipInternal(const virSecurityDACData *priv,
  *
  * This is the callback that runs in the same namespace as the domain we are
  * relabelling. For given transaction (@opaque) it relabels all the paths on
- * the list.
+ * the list. Each path is on the list only once and the paths are relabelled
+ * in parallel.
  *
  * Returns: 0 on success
  *         -1 otherwise.
@@ -193,21 +221,10 @@ virSecurityDACTransactionRun(pid_t pid ATTRIBUTE_UNUSED,
                              void *opaque)
 {
     virSecurityDACChownListPtr list = opaque;
-    size_t i;
 
-    for (i = 0; i < list->nItems; i++) {
-        virSecurityDACChownItemPtr item = list->items[i];
-
-        /* TODO Implement rollback */
-        if (virSecurityDACSetOwnershipInternal(list->priv,
-                                               item->src,
-                                               item->path,
-                                               item->uid,
-                                               item->gid) < 0)
-            return -1;
-    }
-
-    return 0;
+    return virSecurityRelabelListRun(list->items,
+                                     virSecurityDACTransactionRunItem,
+                                     list);
 }
 
 
@@ -459,10 +476,16 @@ virSecurityDACTransactionStart(virSecurityManagerPtr mgr)
 
     list->priv = priv;
 
+    list->items = virSecurityRelabelListNew(virSecurityDACChownItemFree);
+    if (!list->items) {
+        VIR_FREE(list);
+        return -1;
+    }
+
     if (virThreadLocalSet(&chownList, list) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to set thread local variable"));
-        VIR_FREE(list);
+        virSecurityDACChownListFree(list);
         return -1;
     }
 
@@ -475,7 +498,8 @@ virSecurityDACTransactionStart(virSecurityManagerPtr mgr)
  * @pid: domain's PID
  *
  * Enters the @pid namespace (usually @pid refers to a domain) and
- * performs all the chown()-s on the list. Note that the transaction is
+ * performs all the chown()-s on the list. If @pid is -1 the chown()-s
+ * are performed in the current namespace. Note that the transaction is
  * also freed, therefore new one has to be started after successful
  * return from this function. Also it is considered as error if there's
  * no transaction set and this function is called.
@@ -503,10 +527,15 @@ virSecurityDACTransactionCommit(virSecurityManagerPtr mgr ATTRIBUTE_UNUSED,
         goto cleanup;
     }
 
-    if (virProcessRunInMountNamespace(pid,
-                                      virSecurityDACTransactionRun,
-                                      list) < 0)
-        goto cleanup;
+    if (pid == -1) {
+        if (virSecurityDACTransactionRun(pid, list) < 0)
+            goto cleanup;
+    } else {
+        if (virProcessRunInMountNamespace(pid,
+                                          virSecurityDACTransactionRun,
+                                          list) < 0)
+            goto cleanup;
+    }
 
     ret = 0;
  cleanup:
@@ -721,6 +750,12 @@ virSecurityDACSetDiskLabel(virSecurityManagerPtr mgr,
     virStorageSourcePtr next;
 
     for (next = disk->src; next; next = next->backingStore) {
+        /* Shared backing images are labelled once by the admin and must
+         * not be chown()-ed for every domain using them. */
+        if (next != disk->src &&
+            virSecurityManagerGetSharedBacking(mgr))
+            break;
+
         if (virSecurityDACSetImageLabel(mgr, def, next) < 0)
             return -1;
     }
@@ -265,7 +265,8 @@ virSecurityManagerTransactionStart(virSecurityManagerPtr mgr)
  * @pid: domain's PID
  *
  * Enters the @pid namespace (usually @pid refers to a domain) and
- * performs all the operations on the transaction list. Note that the
+ * performs all the operations on the transaction list. If @pid is -1
+ * the operations are performed in the current namespace. Note that the
  * transaction is also freed, therefore new one has to be started after
  * successful return from this function. Also it is considered as error
  * if there's no transaction set and this function is called.
@@ -394,6 +395,21 @@ virSecurityManagerGetPrivileged(virSecurityManagerPtr mgr)
 }
 
 
+/**
+ * virSecurityManagerGetSharedBacking:
+ * @mgr: security manager object
+ *
+ * Returns true if the backing images of disks are expected to carry a
+ * persistent label shared by all domains, in which case the drivers
+ * neither set nor restore their labels.
+ */
+bool
+virSecurityManagerGetSharedBacking(virSecurityManagerPtr mgr)
+{
+    return mgr->flags & VIR_SECURITY_MANAGER_SHARED_BACKING;
+}
+
+
 /**
  * virSecurityManagerRestoreDiskLabel:
  * @mgr: security manager object
@@ -747,7 +763,7 @@ virSecurityManagerReleaseLabel(virSecurityManagerPtr mgr,
 
 
 static int virSecurityManagerCheckModel(virSecurityManagerPtr mgr,
-                                        char *secmodel)
+                                        const char *secmodel)
 {
     int ret = -1;
     size_t i;
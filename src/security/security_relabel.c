@@ -0,0 +1,254 @@
+/*
+ * security_relabel.c: batched relabelling of paths
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "security_relabel.h"
+
+#include "viralloc.h"
+#include "virerror.h"
+#include "virhash.h"
+#include "virlog.h"
+#include "virthread.h"
+#include "virutil.h"
+
+#define VIR_FROM_THIS VIR_FROM_SECURITY
+
+VIR_LOG_INIT("security.security_relabel");
+
+/* Relabelling is mostly waiting for the filesystem (NFS round trips,
+ * xattr writes), so a handful of threads is enough to hide the latency
+ * without hammering the storage. */
+#define VIR_SECURITY_RELABEL_THREADS 4
+
+struct _virSecurityRelabelList {
+    virFreeCallback itemFree;
+    virHashTablePtr paths;      /* path -> index into @items + 1 */
+    void **items;
+    size_t nitems;
+};
+
+typedef struct _virSecurityRelabelRunData virSecurityRelabelRunData;
+typedef virSecurityRelabelRunData *virSecurityRelabelRunDataPtr;
+struct _virSecurityRelabelRunData {
+    virMutex lock;
+    virSecurityRelabelListPtr list;
+    virSecurityRelabelCallback cb;
+    void *opaque;
+
+    size_t next;
+    bool failed;
+    virErrorPtr err;
+};
+
+
+/**
+ * virSecurityRelabelListNew:
+ * @itemFree: callback to free items added to the list
+ *
+ * Creates a new list of paths to relabel.
+ *
+ * Returns the list on success, NULL otherwise.
+ */
+virSecurityRelabelListPtr
+virSecurityRelabelListNew(virFreeCallback itemFree)
+{
+    virSecurityRelabelListPtr list;
+
+    if (VIR_ALLOC(list) < 0)
+        return NULL;
+
+    if (!(list->paths = virHashCreate(32, NULL))) {
+        VIR_FREE(list);
+        return NULL;
+    }
+
+    list->itemFree = itemFree;
+    return list;
+}
+
+
+void
+virSecurityRelabelListFree(virSecurityRelabelListPtr list)
+{
+    size_t i;
+
+    if (!list)
+        return;
+
+    if (list->itemFree) {
+        for (i = 0; i < list->nitems; i++)
+            list->itemFree(list->items[i]);
+    }
+    VIR_FREE(list->items);
+    virHashFree(list->paths);
+    VIR_FREE(list);
+}
+
+
+/**
+ * virSecurityRelabelListAdd:
+ * @list: relabel list
+ * @path: path the @item relabels (may be NULL)
+ * @item: driver specific item
+ *
+ * Adds @item onto @list. If @path is already on the list, the item
+ * queued previously for it is replaced by @item, so that the path is
+ * relabelled only once and to the label it would have ended up with
+ * had the items been processed one by one. Items with no @path are
+ * never merged. The @list takes ownership of @item even on failure.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+int
+virSecurityRelabelListAdd(virSecurityRelabelListPtr list,
+                          const char *path,
+                          void *item)
+{
+    size_t idx;
+
+    if (path && (idx = (size_t) virHashLookup(list->paths, path)) > 0) {
+        VIR_DEBUG("Merging relabel of '%s'", path);
+        if (list->itemFree)
+            list->itemFree(list->items[idx - 1]);
+        list->items[idx - 1] = item;
+        return 0;
+    }
+
+    if (VIR_APPEND_ELEMENT(list->items, list->nitems, item) < 0)
+        goto error;
+
+    if (path &&
+        virHashAddEntry(list->paths, path, (void *) list->nitems) < 0) {
+        list->nitems--;
+        goto error;
+    }
+
+    return 0;
+
+ error:
+    if (list->itemFree)
+        list->itemFree(item);
+    return -1;
+}
+
+
+size_t
+virSecurityRelabelListCount(virSecurityRelabelListPtr list)
+{
+    return list ? list->nitems : 0;
+}
+
+
+static void
+virSecurityRelabelWorker(void *opaque)
+{
+    virSecurityRelabelRunDataPtr data = opaque;
+    size_t i;
+
+    while (true) {
+        virMutexLock(&data->lock);
+        if (data->failed || data->next >= data->list->nitems) {
+            virMutexUnlock(&data->lock);
+            break;
+        }
+        i = data->next++;
+        virMutexUnlock(&data->lock);
+
+        if (data->cb(data->list->items[i], data->opaque) < 0) {
+            virMutexLock(&data->lock);
+            if (!data->failed) {
+                data->failed = true;
+                data->err = virSaveLastError();
+            }
+            virMutexUnlock(&data->lock);
+        }
+    }
+}
+
+
+/**
+ * virSecurityRelabelListRun:
+ * @list: relabel list
+ * @cb: callback to relabel one item
+ * @opaque: opaque data passed to @cb
+ *
+ * Calls @cb for every item on @list. The items are spread over a
+ * small pool of threads with the calling thread taking part too. If
+ * no thread can be spawned the items are processed by the calling
+ * thread alone. The first failure stops processing of items not yet
+ * started and its error is reported in the calling thread.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+int
+virSecurityRelabelListRun(virSecurityRelabelListPtr list,
+                          virSecurityRelabelCallback cb,
+                          void *opaque)
+{
+    virSecurityRelabelRunData data = { .list = list, .cb = cb,
+                                       .opaque = opaque };
+    virThreadPtr threads = NULL;
+    size_t nthreads = 0;
+    size_t i;
+
+    if (list->nitems == 0)
+        return 0;
+
+    if (virMutexInit(&data.lock) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to init mutex"));
+        return -1;
+    }
+
+    if (list->nitems > 1) {
+        size_t want = MIN(list->nitems, VIR_SECURITY_RELABEL_THREADS) - 1;
+
+        if (VIR_ALLOC_N_QUIET(threads, want) == 0) {
+            for (nthreads = 0; nthreads < want; nthreads++) {
+                if (virThreadCreate(&threads[nthreads], true,
+                                    virSecurityRelabelWorker, &data) < 0) {
+                    VIR_DEBUG("Unable to create relabel thread: %s",
+                              virGetLastErrorMessage());
+                    virResetLastError();
+                    break;
+                }
+            }
+        }
+    }
+
+    VIR_DEBUG("Relabelling %zu paths with %zu extra threads",
+              list->nitems, nthreads);
+
+    virSecurityRelabelWorker(&data);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+    VIR_FREE(threads);
+    virMutexDestroy(&data.lock);
+
+    if (data.failed) {
+        if (data.err)
+            virSetError(data.err);
+        virFreeError(data.err);
+        return -1;
+    }
+
+    return 0;
+}
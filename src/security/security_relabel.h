@@ -0,0 +1,47 @@
+/*
+ * security_relabel.h: batched relabelling of paths
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VIR_SECURITY_RELABEL_H__
+# define __VIR_SECURITY_RELABEL_H__
+
+# include "internal.h"
+
+typedef struct _virSecurityRelabelList virSecurityRelabelList;
+typedef virSecurityRelabelList *virSecurityRelabelListPtr;
+
+typedef int (*virSecurityRelabelCallback)(void *item,
+                                          void *opaque);
+
+virSecurityRelabelListPtr virSecurityRelabelListNew(virFreeCallback itemFree);
+void virSecurityRelabelListFree(virSecurityRelabelListPtr list);
+
+int virSecurityRelabelListAdd(virSecurityRelabelListPtr list,
+                              const char *path,
+                              void *item)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3);
+
+size_t virSecurityRelabelListCount(virSecurityRelabelListPtr list);
+
+int virSecurityRelabelListRun(virSecurityRelabelListPtr list,
+                              virSecurityRelabelCallback cb,
+                              void *opaque)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+#endif /* __VIR_SECURITY_RELABEL_H__ */
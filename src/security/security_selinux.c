@@ -33,6 +33,7 @@
 
 #include "security_driver.h"
 #include "security_selinux.h"
+#include "security_relabel.h"
 #include "virerror.h"
 #include "viralloc.h"
 #include "virlog.h"
@@ -91,8 +92,7 @@ typedef struct _virSecuritySELinuxContextList virSecuritySELinuxContextList;
 typedef virSecuritySELinuxContextList *virSecuritySELinuxContextListPtr;
 struct _virSecuritySELinuxContextList {
     bool privileged;
-    virSecuritySELinuxContextItemPtr *items;
-    size_t nItems;
+    virSecurityRelabelListPtr items;
 };
 
 #define SECURITY_SELINUX_VOID_DOI       "0"
@@ -108,8 +108,10 @@ virThreadLocal contextList;
 
 
 static void
-virSecuritySELinuxContextItemFree(virSecuritySELinuxContextItemPtr item)
+virSecuritySELinuxContextItemFree(void *opaque)
 {
+    virSecuritySELinuxContextItemPtr item = opaque;
+
     if (!item)
         return;
 
@@ -135,10 +137,8 @@ virSecuritySELinuxContextListAppend(virSecuritySELinuxContextListPtr list,
 
     item->optional = optional;
 
-    if (VIR_APPEND_ELEMENT(list->items, list->nItems, item) < 0)
-        goto cleanup;
+    return virSecurityRelabelListAdd(list->items, item->path, item);
 
-    ret = 0;
  cleanup:
     virSecuritySELinuxContextItemFree(item);
     return ret;
@@ -148,14 +148,11 @@ static void
 virSecuritySELinuxContextListFree(void *opaque)
 {
     virSecuritySELinuxContextListPtr list = opaque;
-    size_t i;
 
     if (!list)
         return;
 
-    for (i = 0; i < list->nItems; i++)
-        virSecuritySELinuxContextItemFree(list->items[i]);
-
+    virSecurityRelabelListFree(list->items);
     VIR_FREE(list);
 }
 
@@ -195,6 +192,36 @@ static int virSecuritySELinuxSetFileconHelper(const char *path,
                                               bool optional,
                                               bool privileged);
 
+static int
+virSecuritySELinuxTransactionRunItem(void *opaque,
+                                     void *data)
+{
+    virSecuritySELinuxContextItemPtr item = opaque;
+    virSecuritySELinuxContextListPtr list = data;
+    security_context_t econ;
+
+    /* Paths shared within the domain (e.g. backing chains) are likely
+     * to be labelled already. Reading the label is much cheaper than
+     * rewriting it. */
+    if (getfilecon_raw(item->path, &econ) >= 0) {
+        bool equal = STREQ(item->tcon, econ);
+
+        freecon(econ);
+        if (equal) {
+            VIR_DEBUG("SELinux context of '%s' is already '%s'",
+                      item->path, item->tcon);
+            return 0;
+        }
+    }
+
+    /* TODO Implement rollback */
+    return virSecuritySELinuxSetFileconHelper(item->path,
+                                              item->tcon,
+                                              item->optional,
+                                              list->privileged);
+}
+
+
 /**
  * virSecuritySELinuxTransactionRun:
  * @pid: process pid
@@ -202,7 +229,8 @@ static int virSecuritySELinuxSetFileconHelper(const char *path,
  *
  * This is the callback that runs in the same namespace as the domain we are
  * relabelling. For given transaction (@opaque) it relabels all the paths on
- * the list.
+ * the list. Each path is on the list only once and the paths are relabelled
+ * in parallel.
  *
  * Returns: 0 on success
  *         -1 otherwise.
@@ -212,20 +240,10 @@ virSecuritySELinuxTransactionRun(pid_t pid ATTRIBUTE_UNUSED,
                                  void *opaque)
 {
     virSecuritySELinuxContextListPtr list = opaque;
-    size_t i;
 
-    for (i = 0; i < list->nItems; i++) {
-        virSecuritySELinuxContextItemPtr item = list->items[i];
-
-        /* TODO Implement rollback */
-        if (virSecuritySELinuxSetFileconHelper(item->path,
-                                               item->tcon,
-                                               item->optional,
-                                               list->privileged) < 0)
-            return -1;
-    }
-
-    return 0;
+    return virSecurityRelabelListRun(list->items,
+                                     virSecuritySELinuxTransactionRunItem,
+                                     list);
 }
 
 
@@ -847,7 +865,7 @@ virSecuritySELinuxGenLabel(virSecurityManagerPtr mgr,
         goto cleanup;
 
     if (!seclabel->model &&
-        VIR_STRDUP(seclabel->model, SECURITY_SELINUX_NAME) < 0)
+        virStringIntern(&seclabel->model, SECURITY_SELINUX_NAME) < 0)
         goto cleanup;
 
     rc = 0;
@@ -859,7 +877,7 @@ virSecuritySELinuxGenLabel(virSecurityManagerPtr mgr,
         VIR_FREE(seclabel->imagelabel);
         if (seclabel->type == VIR_DOMAIN_SECLABEL_DYNAMIC &&
             !seclabel->baselabel)
-            VIR_FREE(seclabel->model);
+            seclabel->model = NULL;
     }
 
     if (ctx)
@@ -1025,10 +1043,16 @@ virSecuritySELinuxTransactionStart(virSecurityManagerPtr mgr)
 
     list->privileged = privileged;
 
+    list->items = virSecurityRelabelListNew(virSecuritySELinuxContextItemFree);
+    if (!list->items) {
+        VIR_FREE(list);
+        return -1;
+    }
+
     if (virThreadLocalSet(&contextList, list) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to set thread local variable"));
-        VIR_FREE(list);
+        virSecuritySELinuxContextListFree(list);
         return -1;
     }
 
@@ -1041,7 +1065,8 @@ virSecuritySELinuxTransactionStart(virSecurityManagerPtr mgr)
  * @pid: domain's PID
  *
  * Enters the @pid namespace (usually @pid refers to a domain) and
- * performs all the sefilecon()-s on the list. Note that the
+ * performs all the sefilecon()-s on the list. If @pid is -1 the
+ * sefilecon()-s are performed in the current namespace. Note that the
  * transaction is also freed, therefore new one has to be started after
  * successful return from this function. Also it is considered as error
  * if there's no transaction set and this function is called.
@@ -1054,7 +1079,7 @@ virSecuritySELinuxTransactionCommit(virSecurityManagerPtr mgr ATTRIBUTE_UNUSED,
                                     pid_t pid)
 {
     virSecuritySELinuxContextListPtr list;
-    int ret = 0;
+    int ret = -1;
 
     list = virThreadLocalGet(&contextList);
     if (!list)
@@ -1066,10 +1091,15 @@ virSecuritySELinuxTransactionCommit(virSecurityManagerPtr mgr ATTRIBUTE_UNUSED,
         goto cleanup;
     }
 
-    if (virProcessRunInMountNamespace(pid,
-                                      virSecuritySELinuxTransactionRun,
-                                      list) < 0)
-        goto cleanup;
+    if (pid == -1) {
+        if (virSecuritySELinuxTransactionRun(pid, list) < 0)
+            goto cleanup;
+    } else {
+        if (virProcessRunInMountNamespace(pid,
+                                          virSecuritySELinuxTransactionRun,
+                                          list) < 0)
+            goto cleanup;
+    }
 
     ret = 0;
  cleanup:
@@ -1674,6 +1704,11 @@ virSecuritySELinuxSetDiskLabel(virSecurityManagerPtr mgr,
     virStorageSourcePtr next;
 
     for (next = disk->src; next; next = next->backingStore) {
+        /* Shared backing images keep their persistent label (usually
+         * virt_content_t) and are not relabelled per domain. */
+        if (!first && virSecurityManagerGetSharedBacking(mgr))
+            break;
+
         if (virSecuritySELinuxSetImageLabelInternal(mgr, def, next, first) < 0)
             return -1;
 
@@ -2478,7 +2513,7 @@ virSecuritySELinuxReleaseLabel(virSecurityManagerPtr mgr,
         }
         VIR_FREE(secdef->label);
         if (!secdef->baselabel)
-            VIR_FREE(secdef->model);
+            secdef->model = NULL;
     }
     VIR_FREE(secdef->imagelabel);
 
@@ -109,6 +109,7 @@ struct _virStorageBackend {
     virStorageBackendStartPool startPool;
     virStorageBackendBuildPool buildPool;
     virStorageBackendRefreshPool refreshPool; /* Must be non-NULL */
+    bool refreshPoolKeepsVols; /* refreshPool takes over unchanged volumes */
     virStorageBackendStopPool stopPool;
     virStorageBackendDeletePool deletePool;
 
@@ -116,6 +117,8 @@ struct _virStorageBackend {
     virStorageBackendBuildVolFrom buildVolFrom;
     virStorageBackendCreateVol createVol;
     virStorageBackendRefreshVol refreshVol;
+    unsigned int refreshVolInterval; /* ms refreshVol results stay valid
+                                      * for; 0 to refresh on every query */
     virStorageBackendDeleteVol deleteVol;
     virStorageBackendVolumeResize resizeVol;
     virStorageBackendVolumeUpload uploadVol;
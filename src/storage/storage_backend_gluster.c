@@ -26,7 +26,9 @@
 #include "storage_backend_gluster.h"
 #include "storage_conf.h"
 #include "viralloc.h"
+#include "virbuffer.h"
 #include "virerror.h"
+#include "virhash.h"
 #include "virlog.h"
 #include "virstoragefile.h"
 #include "virstring.h"
@@ -566,9 +568,138 @@ typedef virStorageFileBackendGlusterPriv *virStorageFileBackendGlusterPrivPtr;
 struct _virStorageFileBackendGlusterPriv {
     glfs_t *vol;
     char *canonpath;
+    char *connkey;
 };
 
 
+/* Setting up a gluster connection takes several round trips to the
+ * volfile server. Connections are therefore shared by all storage
+ * files open at the same time on the same volume, which in particular
+ * means that probing a backing chain living on one gluster volume costs
+ * a single connection regardless of its depth. */
+typedef struct _virStorageFileBackendGlusterConn virStorageFileBackendGlusterConn;
+typedef virStorageFileBackendGlusterConn *virStorageFileBackendGlusterConnPtr;
+struct _virStorageFileBackendGlusterConn {
+    glfs_t *vol;
+    size_t refs;
+};
+
+static virMutex virStorageFileBackendGlusterConnLock = VIR_MUTEX_INITIALIZER;
+static virHashTablePtr virStorageFileBackendGlusterConns;
+
+
+static void
+virStorageFileBackendGlusterConnFree(void *payload,
+                                     const void *name ATTRIBUTE_UNUSED)
+{
+    virStorageFileBackendGlusterConnPtr conn = payload;
+
+    if (!conn)
+        return;
+
+    if (conn->vol)
+        glfs_fini(conn->vol);
+    VIR_FREE(conn);
+}
+
+
+static char *
+virStorageFileBackendGlusterConnKey(virStorageSourcePtr src)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+
+    virBufferAdd(&buf, src->volume, -1);
+    for (i = 0; i < src->nhosts; i++) {
+        virStorageNetHostDefPtr host = src->hosts + i;
+
+        virBufferAsprintf(&buf, "|%s:%s:%s:%s",
+                          virStorageNetHostTransportTypeToString(host->transport),
+                          NULLSTR(host->name),
+                          NULLSTR(host->port),
+                          NULLSTR(host->socket));
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+/* Returns the connection for @key with a reference added, or NULL */
+static glfs_t *
+virStorageFileBackendGlusterConnGet(const char *key)
+{
+    virStorageFileBackendGlusterConnPtr conn = NULL;
+
+    virMutexLock(&virStorageFileBackendGlusterConnLock);
+    if (virStorageFileBackendGlusterConns &&
+        (conn = virHashLookup(virStorageFileBackendGlusterConns, key)))
+        conn->refs++;
+    virMutexUnlock(&virStorageFileBackendGlusterConnLock);
+
+    return conn ? conn->vol : NULL;
+}
+
+
+/* Shares @vol under @key. If another connection for @key was added in
+ * the meantime, @vol is closed and the other one is returned. Returns
+ * NULL on error, in which case @vol is untouched. */
+static glfs_t *
+virStorageFileBackendGlusterConnAdd(const char *key,
+                                    glfs_t *vol)
+{
+    virStorageFileBackendGlusterConnPtr conn = NULL;
+    glfs_t *ret = NULL;
+
+    virMutexLock(&virStorageFileBackendGlusterConnLock);
+
+    if (!virStorageFileBackendGlusterConns &&
+        !(virStorageFileBackendGlusterConns =
+          virHashCreate(5, virStorageFileBackendGlusterConnFree)))
+        goto cleanup;
+
+    if ((conn = virHashLookup(virStorageFileBackendGlusterConns, key))) {
+        conn->refs++;
+        glfs_fini(vol);
+        ret = conn->vol;
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC(conn) < 0)
+        goto cleanup;
+
+    conn->vol = vol;
+    conn->refs = 1;
+
+    if (virHashAddEntry(virStorageFileBackendGlusterConns, key, conn) < 0) {
+        VIR_FREE(conn);
+        goto cleanup;
+    }
+
+    ret = vol;
+
+ cleanup:
+    virMutexUnlock(&virStorageFileBackendGlusterConnLock);
+    return ret;
+}
+
+
+static void
+virStorageFileBackendGlusterConnRelease(const char *key)
+{
+    virStorageFileBackendGlusterConnPtr conn;
+
+    virMutexLock(&virStorageFileBackendGlusterConnLock);
+    if (virStorageFileBackendGlusterConns &&
+        (conn = virHashLookup(virStorageFileBackendGlusterConns, key)) &&
+        --conn->refs == 0)
+        virHashRemoveEntry(virStorageFileBackendGlusterConns, key);
+    virMutexUnlock(&virStorageFileBackendGlusterConnLock);
+}
+
+
 static void
 virStorageFileBackendGlusterDeinit(virStorageSourcePtr src)
 {
@@ -578,8 +709,9 @@ virStorageFileBackendGlusterDeinit(virStorageSourcePtr src)
               src, src->hosts->name, src->hosts->port ? src->hosts->port : "0",
               src->volume, src->path);
 
-    if (priv->vol)
-        glfs_fini(priv->vol);
+    if (priv->connkey)
+        virStorageFileBackendGlusterConnRelease(priv->connkey);
+    VIR_FREE(priv->connkey);
     VIR_FREE(priv->canonpath);
 
     VIR_FREE(priv);
@@ -587,7 +719,7 @@ virStorageFileBackendGlusterDeinit(virStorageSourcePtr src)
 }
 
 static int
-virStorageFileBackendGlusterInitServer(virStorageFileBackendGlusterPrivPtr priv,
+virStorageFileBackendGlusterInitServer(glfs_t *vol,
                                        virStorageNetHostDefPtr host)
 {
     const char *transport = virStorageNetHostTransportTypeToString(host->transport);
@@ -618,9 +750,9 @@ virStorageFileBackendGlusterInitServer(virStorageFileBackendGlusterPrivPtr priv,
     }
 
     VIR_DEBUG("adding gluster host for %p: transport=%s host=%s port=%d",
-              priv, transport, hoststr, port);
+              vol, transport, hoststr, port);
 
-    if (glfs_set_volfile_server(priv->vol, transport, hoststr, port) < 0) {
+    if (glfs_set_volfile_server(vol, transport, hoststr, port) < 0) {
         virReportSystemError(errno,
                              _("failed to set gluster volfile server '%s'"),
                              hoststr);
@@ -631,11 +763,42 @@ virStorageFileBackendGlusterInitServer(virStorageFileBackendGlusterPrivPtr priv,
 }
 
 
+static glfs_t *
+virStorageFileBackendGlusterConnect(virStorageSourcePtr src)
+{
+    glfs_t *vol;
+    size_t i;
+
+    if (!(vol = glfs_new(src->volume))) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    for (i = 0; i < src->nhosts; i++) {
+        if (virStorageFileBackendGlusterInitServer(vol, src->hosts + i) < 0)
+            goto error;
+    }
+
+    if (glfs_init(vol) < 0) {
+        virReportSystemError(errno,
+                             _("failed to initialize gluster connection "
+                               "(src=%p vol=%p)"), src, vol);
+        goto error;
+    }
+
+    return vol;
+
+ error:
+    glfs_fini(vol);
+    return NULL;
+}
+
+
 static int
 virStorageFileBackendGlusterInit(virStorageSourcePtr src)
 {
     virStorageFileBackendGlusterPrivPtr priv = NULL;
-    size_t i;
+    glfs_t *vol = NULL;
 
     if (!src->volume) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -652,21 +815,21 @@ virStorageFileBackendGlusterInit(virStorageSourcePtr src)
               src, priv, src->volume, src->path,
               (unsigned int)src->drv->uid, (unsigned int)src->drv->gid);
 
-    if (!(priv->vol = glfs_new(src->volume))) {
-        virReportOOMError();
+    if (!(priv->connkey = virStorageFileBackendGlusterConnKey(src)))
         goto error;
-    }
 
-    for (i = 0; i < src->nhosts; i++) {
-        if (virStorageFileBackendGlusterInitServer(priv, src->hosts + i) < 0)
+    if (!(priv->vol = virStorageFileBackendGlusterConnGet(priv->connkey))) {
+        if (!(vol = virStorageFileBackendGlusterConnect(src)))
             goto error;
-    }
 
-    if (glfs_init(priv->vol) < 0) {
-        virReportSystemError(errno,
-                             _("failed to initialize gluster connection "
-                               "(src=%p priv=%p)"), src, priv);
-        goto error;
+        if (!(priv->vol = virStorageFileBackendGlusterConnAdd(priv->connkey,
+                                                              vol))) {
+            glfs_fini(vol);
+            goto error;
+        }
+    } else {
+        VIR_DEBUG("reusing gluster connection %p for %s",
+                  priv->vol, priv->connkey);
     }
 
     src->drv->priv = priv;
@@ -674,8 +837,7 @@ virStorageFileBackendGlusterInit(virStorageSourcePtr src)
     return 0;
 
  error:
-    if (priv->vol)
-        glfs_fini(priv->vol);
+    VIR_FREE(priv->connkey);
     VIR_FREE(priv);
 
     return -1;
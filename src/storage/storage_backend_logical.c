@@ -169,6 +169,7 @@ virStorageBackendLogicalInitializeDevice(const char *path)
 struct virStorageBackendLogicalPoolVolData {
     virStoragePoolObjPtr pool;
     virStorageVolDefPtr vol;
+    bool vgsize; /* pool capacity was filled in from the lvs report */
 };
 
 static int
@@ -313,6 +314,19 @@ virStorageBackendLogicalMakeVol(char **const groups,
     int ret = -1;
     const char *attrs = groups[9];
 
+    /* Every row carries the size of the volume group as well, which
+     * saves running vgs to get it */
+    if (!data->vol && !data->vgsize) {
+        if (virStrToLong_ull(groups[10], NULL, 10, &pool->def->capacity) < 0 ||
+            virStrToLong_ull(groups[11], NULL, 10, &pool->def->available) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("malformed volume group size value"));
+            return -1;
+        }
+        pool->def->allocation = pool->def->capacity - pool->def->available;
+        data->vgsize = true;
+    }
+
     /* Skip inactive volume */
     if (attrs[4] != 'a')
         return 0;
@@ -421,9 +435,11 @@ virStorageBackendLogicalMakeVol(char **const groups,
 #define VIR_STORAGE_VOL_LOGICAL_VG_EXTENT_SIZE_REGEX "([0-9]+)#"
 #define VIR_STORAGE_VOL_LOGICAL_SIZE_REGEX "([0-9]+)#"
 #define VIR_STORAGE_VOL_LOGICAL_LV_ATTR_REGEX "(\\S+)#"
+#define VIR_STORAGE_VOL_LOGICAL_VG_SIZE_REGEX "([0-9]+)#"
+#define VIR_STORAGE_VOL_LOGICAL_VG_FREE_REGEX "([0-9]+)#"
 #define VIR_STORAGE_VOL_LOGICAL_SUFFIX_REGEX "?\\s*$"
 
-#define VIR_STORAGE_VOL_LOGICAL_REGEX_COUNT 10
+#define VIR_STORAGE_VOL_LOGICAL_REGEX_COUNT 12
 #define VIR_STORAGE_VOL_LOGICAL_REGEX \
            VIR_STORAGE_VOL_LOGICAL_PREFIX_REGEX \
            VIR_STORAGE_VOL_LOGICAL_LV_NAME_REGEX \
@@ -436,25 +452,36 @@ virStorageBackendLogicalMakeVol(char **const groups,
            VIR_STORAGE_VOL_LOGICAL_VG_EXTENT_SIZE_REGEX \
            VIR_STORAGE_VOL_LOGICAL_SIZE_REGEX \
            VIR_STORAGE_VOL_LOGICAL_LV_ATTR_REGEX \
+           VIR_STORAGE_VOL_LOGICAL_VG_SIZE_REGEX \
+           VIR_STORAGE_VOL_LOGICAL_VG_FREE_REGEX \
            VIR_STORAGE_VOL_LOGICAL_SUFFIX_REGEX
 
+/*
+ * Fills in the volumes of the pool, or just @vol if it's not NULL, in
+ * which case only that logical volume is reported on. Returns 0 on
+ * success, -1 on error. If @vgsize is not NULL, it is set to whether the
+ * size of the volume group could be taken from the report, which is not
+ * the case for groups with no volumes.
+ */
 static int
 virStorageBackendLogicalFindLVs(virStoragePoolObjPtr pool,
-                                virStorageVolDefPtr vol)
+                                virStorageVolDefPtr vol,
+                                bool *vgsize)
 {
     /*
      * # lvs --separator # --noheadings --units b --unbuffered --nosuffix --options \
-     * "lv_name,origin,uuid,devices,segtype,stripes,seg_size,vg_extent_size,size,lv_attr" VGNAME
+     * "lv_name,origin,uuid,devices,segtype,stripes,seg_size,vg_extent_size,size,lv_attr,vg_size,vg_free" VGNAME
      *
-     * RootLV##06UgP5-2rhb-w3Bo-3mdR-WeoL-pytO-SAa2ky#/dev/hda2(0)#linear#1#5234491392#33554432#5234491392#-wi-ao
-     * SwapLV##oHviCK-8Ik0-paqS-V20c-nkhY-Bm1e-zgzU0M#/dev/hda2(156)#linear#1#1040187392#33554432#1040187392#-wi-ao
-     * Test2##3pg3he-mQsA-5Sui-h0i6-HNmc-Cz7W-QSndcR#/dev/hda2(219)#linear#1#1073741824#33554432#1073741824#owi-a-
-     * Test3##UB5hFw-kmlm-LSoX-EI1t-ioVd-h7GL-M0W8Ht#/dev/hda2(251)#linear#1#2181038080#33554432#2181038080#-wi-a-
-     * Test3#Test2#UB5hFw-kmlm-LSoX-EI1t-ioVd-h7GL-M0W8Ht#/dev/hda2(187)#linear#1#1040187392#33554432#1040187392#swi-a-
-     * test_stripes##fSLSZH-zAS2-yAIb-n4mV-Al9u-HA3V-oo9K1B#/dev/sdc1(10240),/dev/sdd1(0)#striped#2#42949672960#4194304#-wi-a-
+     * RootLV##06UgP5-2rhb-w3Bo-3mdR-WeoL-pytO-SAa2ky#/dev/hda2(0)#linear#1#5234491392#33554432#5234491392#-wi-ao#10603200512#4328521728
+     * SwapLV##oHviCK-8Ik0-paqS-V20c-nkhY-Bm1e-zgzU0M#/dev/hda2(156)#linear#1#1040187392#33554432#1040187392#-wi-ao#10603200512#4328521728
+     * Test2##3pg3he-mQsA-5Sui-h0i6-HNmc-Cz7W-QSndcR#/dev/hda2(219)#linear#1#1073741824#33554432#1073741824#owi-a-#10603200512#4328521728
+     * Test3##UB5hFw-kmlm-LSoX-EI1t-ioVd-h7GL-M0W8Ht#/dev/hda2(251)#linear#1#2181038080#33554432#2181038080#-wi-a-#10603200512#4328521728
+     * Test3#Test2#UB5hFw-kmlm-LSoX-EI1t-ioVd-h7GL-M0W8Ht#/dev/hda2(187)#linear#1#1040187392#33554432#1040187392#swi-a-#10603200512#4328521728
+     * test_stripes##fSLSZH-zAS2-yAIb-n4mV-Al9u-HA3V-oo9K1B#/dev/sdc1(10240),/dev/sdd1(0)#striped#2#42949672960#4194304#-wi-a-#10603200512#4328521728
      *
      * Pull out name, origin, & uuid, device, device extent start #,
-     * segment size, extent size, size, attrs
+     * segment size, extent size, size, attrs, and the size and free
+     * space of the volume group
      *
      * NB can be multiple rows per volume if they have many extents
      *
@@ -487,9 +514,13 @@ virStorageBackendLogicalFindLVs(virStoragePoolObjPtr pool,
                                "--unbuffered",
                                "--nosuffix",
                                "--options",
-                               "lv_name,origin,uuid,devices,segtype,stripes,seg_size,vg_extent_size,size,lv_attr",
-                               pool->def->source.name,
+                               "lv_name,origin,uuid,devices,segtype,stripes,seg_size,vg_extent_size,size,lv_attr,vg_size,vg_free",
                                NULL);
+    if (vol)
+        virCommandAddArgFormat(cmd, "%s/%s", pool->def->source.name, vol->name);
+    else
+        virCommandAddArg(cmd, pool->def->source.name);
+
     if (virCommandRunRegex(cmd,
                            1,
                            regexes,
@@ -500,6 +531,8 @@ virStorageBackendLogicalFindLVs(virStoragePoolObjPtr pool,
                            NULL) < 0)
         goto cleanup;
 
+    if (vgsize)
+        *vgsize = cbdata.vgsize;
     ret = 0;
  cleanup:
     virCommandFree(cmd);
@@ -849,14 +882,21 @@ virStorageBackendLogicalRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
         2
     };
     virCommandPtr cmd = NULL;
+    bool vgsize = false;
     int ret = -1;
 
     virWaitForDevices();
 
-    /* Get list of all logical volumes */
-    if (virStorageBackendLogicalFindLVs(pool, NULL) < 0)
+    /* Get list of all logical volumes, and usually the size of the
+     * volume group along with them */
+    if (virStorageBackendLogicalFindLVs(pool, NULL, &vgsize) < 0)
         goto cleanup;
 
+    if (vgsize) {
+        ret = 0;
+        goto cleanup;
+    }
+
     cmd = virCommandNewArgList(VGS,
                                "--separator", ":",
                                "--noheadings",
@@ -1049,7 +1089,7 @@ virStorageBackendLogicalCreateVol(virConnectPtr conn,
     }
 
     /* Fill in data about this new vol */
-    if (virStorageBackendLogicalFindLVs(pool, vol) < 0) {
+    if (virStorageBackendLogicalFindLVs(pool, vol, NULL) < 0) {
         virReportSystemError(errno,
                              _("cannot find newly created volume '%s'"),
                              vol->target.path);
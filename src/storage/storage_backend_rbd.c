@@ -353,16 +353,25 @@ virStorageBackendRBDSetAllocation(virStorageVolDefPtr vol ATTRIBUTE_UNUSED,
 }
 #endif
 
+/*
+ * Walking the allocation map of an image with rbd_diff_iterate2 is
+ * by far the most expensive part of refreshing it, even with fast-diff.
+ * When @exactAllocation is false (as during a pool refresh, which
+ * visits every image), estimate the allocation from the object count
+ * instead; the exact figure is computed when the volume itself is
+ * refreshed.
+ */
 static int
 volStorageBackendRBDRefreshVolInfo(virStorageVolDefPtr vol,
                                    virStoragePoolObjPtr pool,
-                                   virStorageBackendRBDStatePtr ptr)
+                                   virStorageBackendRBDStatePtr ptr,
+                                   bool exactAllocation)
 {
     int ret = -1;
     int r = 0;
     rbd_image_t image = NULL;
     rbd_image_info_t info;
-    uint64_t features;
+    uint64_t features = 0;
 
     if ((r = rbd_open_read_only(ptr->ioctx, vol->name, &image, NULL)) < 0) {
         ret = -r;
@@ -378,14 +387,15 @@ volStorageBackendRBDRefreshVolInfo(virStorageVolDefPtr vol,
         goto cleanup;
     }
 
-    if (volStorageBackendRBDGetFeatures(image, vol->name, &features) < 0)
-        goto cleanup;
-
     vol->target.capacity = info.size;
     vol->type = VIR_STORAGE_VOL_NETWORK;
     vol->target.format = VIR_STORAGE_FILE_RAW;
 
-    if (volStorageBackendRBDUseFastDiff(features)) {
+    if (exactAllocation &&
+        volStorageBackendRBDGetFeatures(image, vol->name, &features) < 0)
+        goto cleanup;
+
+    if (exactAllocation && volStorageBackendRBDUseFastDiff(features)) {
         VIR_DEBUG("RBD image %s/%s has fast-diff feature enabled. "
                   "Querying for actual allocation",
                   pool->def->source.name, vol->name);
@@ -487,7 +497,7 @@ virStorageBackendRBDRefreshPool(virConnectPtr conn,
 
         name += strlen(name) + 1;
 
-        r = volStorageBackendRBDRefreshVolInfo(vol, pool, ptr);
+        r = volStorageBackendRBDRefreshVolInfo(vol, pool, ptr, false);
 
         /* It could be that a volume has been deleted through a different route
          * then libvirt and that will cause a -ENOENT to be returned.
@@ -1078,7 +1088,7 @@ virStorageBackendRBDRefreshVol(virConnectPtr conn,
     if (!(ptr = virStorageBackendRBDNewState(conn, pool)))
         goto cleanup;
 
-    if (volStorageBackendRBDRefreshVolInfo(vol, pool, ptr) < 0)
+    if (volStorageBackendRBDRefreshVolInfo(vol, pool, ptr, true) < 0)
         goto cleanup;
 
     ret = 0;
@@ -1290,6 +1300,7 @@ virStorageBackend virStorageBackendRBD = {
     .buildVol = virStorageBackendRBDBuildVol,
     .buildVolFrom = virStorageBackendRBDBuildVolFrom,
     .refreshVol = virStorageBackendRBDRefreshVol,
+    .refreshVolInterval = 30 * 1000,
     .deleteVol = virStorageBackendRBDDeleteVol,
     .resizeVol = virStorageBackendRBDResizeVol,
     .wipeVol = virStorageBackendRBDVolWipe
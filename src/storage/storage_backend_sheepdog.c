@@ -414,6 +414,7 @@ virStorageBackend virStorageBackendSheepdog = {
     .createVol = virStorageBackendSheepdogCreateVol,
     .buildVol = virStorageBackendSheepdogBuildVol,
     .refreshVol = virStorageBackendSheepdogRefreshVol,
+    .refreshVolInterval = 30 * 1000,
     .deleteVol = virStorageBackendSheepdogDeleteVol,
     .resizeVol = virStorageBackendSheepdogResizeVol,
 };
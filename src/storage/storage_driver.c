@@ -35,6 +35,9 @@
 #endif
 #include <errno.h>
 #include <string.h>
+#ifdef HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
 
 #include "virerror.h"
 #include "datatypes.h"
@@ -42,6 +45,8 @@
 #include "storage_driver.h"
 #include "storage_conf.h"
 #include "storage_event.h"
+#include "virevent.h"
+#include "virthread.h"
 #include "viralloc.h"
 #include "storage_backend.h"
 #include "virlog.h"
@@ -49,9 +54,11 @@
 #include "virfdstream.h"
 #include "configmake.h"
 #include "virstring.h"
+#include "virtime.h"
 #include "viraccessapicheck.h"
 #include "dirname.h"
 #include "storage_util.h"
+#include "stat-time.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -78,6 +85,117 @@ static void storageDriverUnlock(void)
 }
 
 
+/* The target directories of active pools whose backend refreshes them
+ * incrementally are watched through one inotify instance, so that the
+ * volume list follows changes made behind libvirt's back without anyone
+ * having to call virStoragePoolRefresh. Pools sharing a directory share
+ * its watch descriptor, which is therefore reference counted. */
+typedef struct _virStorageInotifyWatch virStorageInotifyWatch;
+struct _virStorageInotifyWatch {
+    int wd;
+    size_t refs;
+};
+
+static virMutex storageInotifyLock = VIR_MUTEX_INITIALIZER;
+static int storageInotifyFD = -1;
+static int storageInotifyHandle = -1;
+static virStorageInotifyWatch *storageInotifyWatches;
+static size_t storageInotifyNWatches;
+
+#ifdef HAVE_SYS_INOTIFY_H
+# define VIR_STORAGE_INOTIFY_MASK \
+    (IN_CREATE | IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE | \
+     IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+static void
+storagePoolWatchTarget(virStoragePoolObjPtr pool)
+{
+    virStorageBackendPtr backend;
+    virStorageInotifyWatch watch = { 0, 1 };
+    char ebuf[1024];
+    size_t i;
+
+    if (storageInotifyFD < 0 || pool->targetWatch > 0 ||
+        !(backend = virStorageBackendForType(pool->def->type)) ||
+        !backend->refreshPoolKeepsVols)
+        return;
+
+    virMutexLock(&storageInotifyLock);
+
+    if ((watch.wd = inotify_add_watch(storageInotifyFD,
+                                      pool->def->target.path,
+                                      VIR_STORAGE_INOTIFY_MASK)) < 0) {
+        VIR_WARN("Unable to watch target directory '%s' of pool '%s': %s",
+                 pool->def->target.path, pool->def->name,
+                 virStrerror(errno, ebuf, sizeof(ebuf)));
+        goto cleanup;
+    }
+
+    for (i = 0; i < storageInotifyNWatches; i++) {
+        if (storageInotifyWatches[i].wd == watch.wd) {
+            storageInotifyWatches[i].refs++;
+            break;
+        }
+    }
+
+    if (i == storageInotifyNWatches &&
+        VIR_APPEND_ELEMENT(storageInotifyWatches,
+                           storageInotifyNWatches, watch) < 0) {
+        virResetLastError();
+        inotify_rm_watch(storageInotifyFD, watch.wd);
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Watching '%s' of pool '%s' as %d",
+              pool->def->target.path, pool->def->name, watch.wd);
+    pool->targetWatch = watch.wd;
+
+ cleanup:
+    virMutexUnlock(&storageInotifyLock);
+}
+
+
+static void
+storagePoolUnwatchTarget(virStoragePoolObjPtr pool)
+{
+    size_t i;
+
+    if (pool->targetWatch <= 0)
+        return;
+
+    virMutexLock(&storageInotifyLock);
+
+    for (i = 0; i < storageInotifyNWatches; i++) {
+        if (storageInotifyWatches[i].wd != pool->targetWatch)
+            continue;
+
+        if (--storageInotifyWatches[i].refs == 0) {
+            /* The watch is gone already if the directory was removed */
+            ignore_value(inotify_rm_watch(storageInotifyFD,
+                                          pool->targetWatch));
+            VIR_DELETE_ELEMENT(storageInotifyWatches, i,
+                               storageInotifyNWatches);
+        }
+        break;
+    }
+
+    virMutexUnlock(&storageInotifyLock);
+    pool->targetWatch = 0;
+}
+#else /* !HAVE_SYS_INOTIFY_H */
+static void
+storagePoolWatchTarget(virStoragePoolObjPtr pool ATTRIBUTE_UNUSED)
+{
+}
+
+
+static void
+storagePoolUnwatchTarget(virStoragePoolObjPtr pool ATTRIBUTE_UNUSED)
+{
+}
+#endif /* !HAVE_SYS_INOTIFY_H */
+
+
 /**
  * virStoragePoolUpdateInactive:
  * @poolptr: pointer to a variable holding the pool object pointer
@@ -91,6 +209,8 @@ virStoragePoolUpdateInactive(virStoragePoolObjPtr *poolptr)
 {
     virStoragePoolObjPtr pool = *poolptr;
 
+    storagePoolUnwatchTarget(pool);
+
     if (pool->configFile == NULL) {
         virStoragePoolObjRemove(&driver->pools, pool);
         *poolptr = NULL;
@@ -102,6 +222,217 @@ virStoragePoolUpdateInactive(virStoragePoolObjPtr *poolptr)
 }
 
 
+/*
+ * storagePoolRefreshActive:
+ * @conn: connection to pass to the backend, may be NULL
+ * @poolptr: pointer to a variable holding the active pool object pointer
+ * @backend: backend of the pool
+ * @event: filled with the event to queue
+ *
+ * Rescans the pool. If that fails the pool is stopped, and *poolptr is
+ * cleared if it was transient.
+ *
+ * Returns 0 on success, -1 if the pool was stopped.
+ */
+static int
+storagePoolRefreshActive(virConnectPtr conn,
+                         virStoragePoolObjPtr *poolptr,
+                         virStorageBackendPtr backend,
+                         virObjectEventPtr *event)
+{
+    virStoragePoolObjPtr pool = *poolptr;
+
+    if (!backend->refreshPoolKeepsVols)
+        virStoragePoolObjClearVols(pool);
+    if (backend->refreshPool(conn, pool) < 0) {
+        if (backend->stopPool)
+            backend->stopPool(conn, pool);
+
+        *event = virStoragePoolEventLifecycleNew(pool->def->name,
+                                                 pool->def->uuid,
+                                                 VIR_STORAGE_POOL_EVENT_STOPPED,
+                                                 0);
+        pool->active = false;
+
+        virStoragePoolUpdateInactive(poolptr);
+        return -1;
+    }
+
+    *event = virStoragePoolEventRefreshNew(pool->def->name,
+                                           pool->def->uuid);
+    return 0;
+}
+
+
+#ifdef HAVE_SYS_INOTIFY_H
+static void
+storageInotifyEvent(int watch ATTRIBUTE_UNUSED,
+                    int fd,
+                    int events ATTRIBUTE_UNUSED,
+                    void *opaque ATTRIBUTE_UNUSED)
+{
+    char buf[4096];
+    struct inotify_event e;
+    int *wds = NULL;
+    size_t nwds = 0;
+    size_t i, j;
+
+    /* Drain the queue, a burst of changes results in a single refresh */
+    for (;;) {
+        ssize_t got = read(fd, buf, sizeof(buf));
+        char *tmp = buf;
+
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            break;
+
+        while (got >= (ssize_t) sizeof(e)) {
+            memcpy(&e, tmp, sizeof(e));
+            tmp += sizeof(e) + e.len;
+            got -= sizeof(e) + e.len;
+
+            for (j = 0; j < nwds; j++) {
+                if (wds[j] == e.wd)
+                    break;
+            }
+            if (j == nwds &&
+                VIR_APPEND_ELEMENT_COPY(wds, nwds, e.wd) < 0)
+                goto cleanup;
+        }
+    }
+
+    storageDriverLock();
+    for (i = 0; i < driver->pools.count; i++) {
+        virStoragePoolObjPtr pool = driver->pools.objs[i];
+        virStorageBackendPtr backend;
+        virObjectEventPtr event = NULL;
+
+        virStoragePoolObjLock(pool);
+        for (j = 0; j < nwds; j++) {
+            if (pool->targetWatch == wds[j])
+                break;
+        }
+
+        /* A refresh would throw away volumes being built */
+        if (j == nwds || !virStoragePoolObjIsActive(pool) ||
+            pool->asyncjobs > 0 ||
+            !(backend = virStorageBackendForType(pool->def->type))) {
+            virStoragePoolObjUnlock(pool);
+            continue;
+        }
+
+        VIR_DEBUG("Target directory of pool '%s' changed", pool->def->name);
+        if (storagePoolRefreshActive(NULL, &pool, backend, &event) < 0)
+            VIR_WARN("Failed to refresh storage pool: %s",
+                     virGetLastErrorMessage());
+
+        if (event)
+            virObjectEventStateQueue(driver->storageEventState, event);
+        if (pool)
+            virStoragePoolObjUnlock(pool);
+        else
+            i--;
+    }
+    storageDriverUnlock();
+
+ cleanup:
+    VIR_FREE(wds);
+}
+
+
+static void
+storageInotifyInitialize(void)
+{
+    if ((storageInotifyFD = inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) < 0) {
+        VIR_WARN("Unable to initialize inotify, storage pools "
+                 "won't follow changes of their target directories");
+        return;
+    }
+
+    if ((storageInotifyHandle = virEventAddHandle(storageInotifyFD,
+                                                  VIR_EVENT_HANDLE_READABLE,
+                                                  storageInotifyEvent,
+                                                  NULL, NULL)) < 0) {
+        VIR_DEBUG("No event loop, not watching target directories");
+        VIR_FORCE_CLOSE(storageInotifyFD);
+    }
+}
+#else /* !HAVE_SYS_INOTIFY_H */
+static void
+storageInotifyInitialize(void)
+{
+}
+#endif /* !HAVE_SYS_INOTIFY_H */
+
+
+static void
+storageInotifyCleanup(void)
+{
+    if (storageInotifyHandle >= 0)
+        virEventRemoveHandle(storageInotifyHandle);
+    storageInotifyHandle = -1;
+    VIR_FORCE_CLOSE(storageInotifyFD);
+    VIR_FREE(storageInotifyWatches);
+    storageInotifyNWatches = 0;
+}
+
+
+/*
+ * Volumes of pools which are refreshed incrementally are saved when
+ * libvirtd shuts down, so that the next instance only has to probe the
+ * files that changed in the meantime.
+ */
+static void
+storagePoolSaveVolumes(virStoragePoolObjPtr pool)
+{
+    virStorageBackendPtr backend;
+    char *path = NULL;
+
+    if (!virStoragePoolObjIsActive(pool) ||
+        !(backend = virStorageBackendForType(pool->def->type)) ||
+        !backend->refreshPoolKeepsVols)
+        return;
+
+    if (!(path = virFileBuildPath(driver->stateDir,
+                                  pool->def->name, ".vols")) ||
+        virStoragePoolObjSaveVolumes(pool, path) < 0) {
+        VIR_WARN("Unable to save volumes of pool '%s': %s",
+                 pool->def->name, virGetLastErrorMessage());
+        virResetLastError();
+        if (path)
+            unlink(path);
+    }
+
+    VIR_FREE(path);
+}
+
+
+static void
+storagePoolLoadVolumes(virStoragePoolObjPtr pool,
+                       bool load)
+{
+    char *path;
+
+    if (!(path = virFileBuildPath(driver->stateDir,
+                                  pool->def->name, ".vols"))) {
+        virResetLastError();
+        return;
+    }
+
+    if (load && virFileExists(path) &&
+        virStoragePoolObjLoadVolumes(pool, path) < 0) {
+        VIR_WARN("Unable to load saved volumes of pool '%s': %s",
+                 pool->def->name, virGetLastErrorMessage());
+        virResetLastError();
+    }
+
+    /* Only good for the first refresh */
+    unlink(path);
+    VIR_FREE(path);
+}
+
+
 static void
 storagePoolUpdateState(virStoragePoolObjPtr pool)
 {
@@ -133,8 +464,10 @@ storagePoolUpdateState(virStoragePoolObjPtr pool)
      * it anyway, but if they do and fail, we want to log error and
      * continue with other pools.
      */
+    virStoragePoolObjClearVols(pool);
+    storagePoolLoadVolumes(pool, active && backend->refreshPoolKeepsVols);
+
     if (active) {
-        virStoragePoolObjClearVols(pool);
         if (backend->refreshPool(NULL, pool) < 0) {
             if (backend->stopPool)
                 backend->stopPool(NULL, pool);
@@ -147,7 +480,9 @@ storagePoolUpdateState(virStoragePoolObjPtr pool)
 
     pool->active = active;
 
-    if (!pool->active)
+    if (pool->active)
+        storagePoolWatchTarget(pool);
+    else
         virStoragePoolUpdateInactive(&pool);
 
  cleanup:
@@ -173,67 +508,284 @@ storagePoolUpdateAllState(void)
 }
 
 static void
-storageDriverAutostart(void)
+storagePoolAutostart(virConnectPtr conn,
+                     virStoragePoolObjPtr pool)
+{
+    virStorageBackendPtr backend;
+    char *stateFile = NULL;
+
+    virStoragePoolObjLock(pool);
+    if ((backend = virStorageBackendForType(pool->def->type)) == NULL)
+        goto cleanup;
+
+    if (!pool->autostart ||
+        virStoragePoolObjIsActive(pool))
+        goto cleanup;
+
+    if (backend->startPool &&
+        backend->startPool(conn, pool) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Failed to autostart storage pool '%s': %s"),
+                       pool->def->name, virGetLastErrorMessage());
+        goto cleanup;
+    }
+
+    virStoragePoolObjClearVols(pool);
+    stateFile = virFileBuildPath(driver->stateDir,
+                                 pool->def->name, ".xml");
+    if (!stateFile ||
+        virStoragePoolSaveState(stateFile, pool->def) < 0 ||
+        backend->refreshPool(conn, pool) < 0) {
+        if (stateFile)
+            unlink(stateFile);
+        if (backend->stopPool)
+            backend->stopPool(conn, pool);
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Failed to autostart storage pool '%s': %s"),
+                       pool->def->name, virGetLastErrorMessage());
+    } else {
+        pool->active = true;
+        storagePoolWatchTarget(pool);
+    }
+
+ cleanup:
+    VIR_FREE(stateFile);
+    virStoragePoolObjUnlock(pool);
+}
+
+
+/*
+ * Whether @def uses devices that appear only once @other is started,
+ * such as a logical pool on a LUN of an iSCSI pool.
+ */
+static bool
+storagePoolDependsOn(virStoragePoolDefPtr def,
+                     virStoragePoolDefPtr other)
 {
+    size_t len;
     size_t i;
-    virConnectPtr conn = NULL;
 
-    /* XXX Remove hardcoding of QEMU URI */
-    if (driver->privileged)
-        conn = virConnectOpen("qemu:///system");
-    else
-        conn = virConnectOpen("qemu:///session");
-    /* Ignoring NULL conn - let backends decide */
+    if (other->type != VIR_STORAGE_POOL_ISCSI &&
+        other->type != VIR_STORAGE_POOL_SCSI &&
+        other->type != VIR_STORAGE_POOL_MPATH)
+        return false;
 
-    for (i = 0; i < driver->pools.count; i++) {
-        virStoragePoolObjPtr pool = driver->pools.objs[i];
-        virStorageBackendPtr backend;
-        bool started = false;
+    if (!other->target.path || !*other->target.path || def == other)
+        return false;
 
-        virStoragePoolObjLock(pool);
-        if ((backend = virStorageBackendForType(pool->def->type)) == NULL) {
-            virStoragePoolObjUnlock(pool);
+    len = strlen(other->target.path);
+    for (i = 0; i < def->source.ndevice; i++) {
+        const char *path = def->source.devices[i].path;
+
+        if (path && STRPREFIX(path, other->target.path) &&
+            (path[len] == '/' || other->target.path[len - 1] == '/'))
+            return true;
+    }
+
+    return false;
+}
+
+
+#define STORAGE_AUTOSTART_THREADS 8
+
+typedef enum {
+    STORAGE_AUTOSTART_PENDING,
+    STORAGE_AUTOSTART_RUNNING,
+    STORAGE_AUTOSTART_DONE,
+} virStorageAutostartState;
+
+typedef struct _virStorageAutostartPool virStorageAutostartPool;
+struct _virStorageAutostartPool {
+    virStoragePoolObjPtr pool;
+    size_t *deps; /* indexes of the pools to wait for */
+    size_t ndeps;
+    virStorageAutostartState state;
+};
+
+typedef struct _virStorageAutostartData virStorageAutostartData;
+struct _virStorageAutostartData {
+    virConnectPtr conn;
+    virStorageAutostartPool *pools;
+    size_t npools;
+    size_t running;
+    virMutex lock;
+    virCond cond;
+};
+
+
+static virStorageAutostartPool *
+storageAutostartNext(virStorageAutostartData *data)
+{
+    virStorageAutostartPool *blocked = NULL;
+    size_t i, j;
+
+    for (i = 0; i < data->npools; i++) {
+        virStorageAutostartPool *item = &data->pools[i];
+
+        if (item->state != STORAGE_AUTOSTART_PENDING)
             continue;
+
+        for (j = 0; j < item->ndeps; j++) {
+            if (data->pools[item->deps[j]].state != STORAGE_AUTOSTART_DONE)
+                break;
         }
 
-        if (pool->autostart &&
-            !virStoragePoolObjIsActive(pool)) {
-            if (backend->startPool &&
-                backend->startPool(conn, pool) < 0) {
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("Failed to autostart storage pool '%s': %s"),
-                               pool->def->name, virGetLastErrorMessage());
-                virStoragePoolObjUnlock(pool);
-                continue;
-            }
-            started = true;
+        if (j == item->ndeps)
+            return item;
+
+        if (!blocked)
+            blocked = item;
+    }
+
+    if (!blocked || data->running > 0)
+        return NULL;
+
+    /* Nothing in flight can unblock the rest, so the dependencies are
+     * circular. Following unfinished dependencies long enough ends up
+     * in the cycle, start the pool reached there. */
+    for (i = 0; i < data->npools; i++) {
+        for (j = 0; j < blocked->ndeps; j++) {
+            if (data->pools[blocked->deps[j]].state != STORAGE_AUTOSTART_DONE)
+                break;
         }
+        blocked = &data->pools[blocked->deps[j]];
+    }
+
+    return blocked;
+}
+
+
+static void
+storageAutostartWorker(void *opaque)
+{
+    virStorageAutostartData *data = opaque;
+    virStorageAutostartPool *item;
+    size_t i;
 
-        if (started) {
-            char *stateFile;
-
-            virStoragePoolObjClearVols(pool);
-            stateFile = virFileBuildPath(driver->stateDir,
-                                         pool->def->name, ".xml");
-            if (!stateFile ||
-                virStoragePoolSaveState(stateFile, pool->def) < 0 ||
-                backend->refreshPool(conn, pool) < 0) {
-                if (stateFile)
-                    unlink(stateFile);
-                if (backend->stopPool)
-                    backend->stopPool(conn, pool);
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("Failed to autostart storage pool '%s': %s"),
-                               pool->def->name, virGetLastErrorMessage());
-            } else {
-                pool->active = true;
+    virMutexLock(&data->lock);
+    for (;;) {
+        if (!(item = storageAutostartNext(data))) {
+            for (i = 0; i < data->npools; i++) {
+                if (data->pools[i].state != STORAGE_AUTOSTART_DONE)
+                    break;
             }
-            VIR_FREE(stateFile);
+            if (i == data->npools)
+                break;
+
+            ignore_value(virCondWait(&data->cond, &data->lock));
+            continue;
         }
+
+        item->state = STORAGE_AUTOSTART_RUNNING;
+        data->running++;
+        virMutexUnlock(&data->lock);
+
+        storagePoolAutostart(data->conn, item->pool);
+
+        virMutexLock(&data->lock);
+        item->state = STORAGE_AUTOSTART_DONE;
+        data->running--;
+        virCondBroadcast(&data->cond);
+    }
+    virMutexUnlock(&data->lock);
+}
+
+
+/*
+ * Starting a pool can take long (think of iSCSI logins or NFS mounts)
+ * but rarely keeps the CPU busy, so pools are started by several
+ * threads at once. A pool on devices of another pool waits for that
+ * one to be started first. The calling thread takes part, so failing
+ * to create helper threads only makes this slower.
+ *
+ * Must be called with the driver lock held, which keeps the list of
+ * pools and their definitions from changing.
+ */
+static void
+storageDriverAutostart(void)
+{
+    virStorageAutostartData data = { 0 };
+    virThreadPtr threads = NULL;
+    size_t nthreads = 0;
+    size_t i, j;
+
+    for (i = 0; i < driver->pools.count; i++) {
+        virStoragePoolObjPtr pool = driver->pools.objs[i];
+        virStorageAutostartPool item = { .pool = pool };
+        bool autostart;
+
+        virStoragePoolObjLock(pool);
+        autostart = pool->autostart && !virStoragePoolObjIsActive(pool);
         virStoragePoolObjUnlock(pool);
+
+        if (autostart &&
+            VIR_APPEND_ELEMENT(data.pools, data.npools, item) < 0)
+            goto cleanup;
+    }
+
+    if (data.npools == 0)
+        goto cleanup;
+
+    for (i = 0; i < data.npools; i++) {
+        virStorageAutostartPool *item = &data.pools[i];
+
+        for (j = 0; j < data.npools; j++) {
+            if (storagePoolDependsOn(item->pool->def,
+                                     data.pools[j].pool->def) &&
+                VIR_APPEND_ELEMENT_COPY(item->deps, item->ndeps, j) < 0)
+                goto cleanup;
+        }
+
+        if (item->ndeps)
+            VIR_DEBUG("Pool '%s' waits for %zu other pools",
+                      item->pool->def->name, item->ndeps);
+    }
+
+    if (virMutexInit(&data.lock) < 0)
+        goto cleanup;
+    if (virCondInit(&data.cond) < 0) {
+        virMutexDestroy(&data.lock);
+        goto cleanup;
+    }
+
+    /* XXX Remove hardcoding of QEMU URI */
+    if (driver->privileged)
+        data.conn = virConnectOpen("qemu:///system");
+    else
+        data.conn = virConnectOpen("qemu:///session");
+    /* Ignoring NULL conn - let backends decide */
+
+    nthreads = MIN(data.npools, STORAGE_AUTOSTART_THREADS) - 1;
+    if (nthreads && VIR_ALLOC_N_QUIET(threads, nthreads) == 0) {
+        for (i = 0; i < nthreads; i++) {
+            if (virThreadCreate(&threads[i], true,
+                                storageAutostartWorker, &data) < 0) {
+                virResetLastError();
+                break;
+            }
+        }
+        nthreads = i;
+    } else {
+        nthreads = 0;
     }
 
-    virObjectUnref(conn);
+    VIR_DEBUG("Autostarting %zu pools with %zu threads",
+              data.npools, nthreads + 1);
+
+    storageAutostartWorker(&data);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    VIR_FREE(threads);
+    virObjectUnref(data.conn);
+    virCondDestroy(&data.cond);
+    virMutexDestroy(&data.lock);
+
+ cleanup:
+    for (i = 0; i < data.npools; i++)
+        VIR_FREE(data.pools[i].deps);
+    VIR_FREE(data.pools);
 }
 
 /**
@@ -299,6 +851,7 @@ storageStateInitialize(bool privileged,
                                         driver->autostartDir) < 0)
         goto error;
 
+    storageInotifyInitialize();
     storagePoolUpdateAllState();
 
     driver->storageEventState = virObjectEventStateNew();
@@ -366,13 +919,24 @@ storageStateReload(void)
 static int
 storageStateCleanup(void)
 {
+    size_t i;
+
     if (!driver)
         return -1;
 
     storageDriverLock();
 
+    storageInotifyCleanup();
     virObjectUnref(driver->storageEventState);
 
+    for (i = 0; i < driver->pools.count; i++) {
+        virStoragePoolObjPtr pool = driver->pools.objs[i];
+
+        virStoragePoolObjLock(pool);
+        storagePoolSaveVolumes(pool);
+        virStoragePoolObjUnlock(pool);
+    }
+
     /* free inactive pools */
     virStoragePoolObjListFree(&driver->pools);
 
@@ -773,6 +1337,7 @@ storagePoolCreateXML(virConnectPtr conn,
 
     VIR_INFO("Creating storage pool '%s'", pool->def->name);
     pool->active = true;
+    storagePoolWatchTarget(pool);
 
     ret = virGetStoragePool(conn, pool->def->name, pool->def->uuid,
                             NULL, NULL);
@@ -987,6 +1552,7 @@ storagePoolCreate(virStoragePoolPtr obj,
                                             0);
 
     pool->active = true;
+    storagePoolWatchTarget(pool);
     ret = 0;
 
  cleanup:
@@ -1205,24 +1771,9 @@ storagePoolRefresh(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    virStoragePoolObjClearVols(pool);
-    if (backend->refreshPool(obj->conn, pool) < 0) {
-        if (backend->stopPool)
-            backend->stopPool(obj->conn, pool);
-
-        event = virStoragePoolEventLifecycleNew(pool->def->name,
-                                                pool->def->uuid,
-                                                VIR_STORAGE_POOL_EVENT_STOPPED,
-                                                0);
-        pool->active = false;
-
-        virStoragePoolUpdateInactive(&pool);
-
+    if (storagePoolRefreshActive(obj->conn, &pool, backend, &event) < 0)
         goto cleanup;
-    }
 
-    event = virStoragePoolEventRefreshNew(pool->def->name,
-                                          pool->def->uuid);
     ret = 0;
 
  cleanup:
@@ -2238,7 +2789,7 @@ storageVolDownload(virStorageVolPtr obj,
     virStorageVolDefPtr vol = NULL;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM, -1);
 
     if (!(vol = virStorageVolDefFromVol(obj, &pool, &backend)))
         return -1;
@@ -2352,7 +2903,8 @@ virStorageVolPoolRefreshThread(void *opaque)
     if (!(backend = virStorageBackendForType(pool->def->type)))
         goto cleanup;
 
-    virStoragePoolObjClearVols(pool);
+    if (!backend->refreshPoolKeepsVols)
+        virStoragePoolObjClearVols(pool);
     if (backend->refreshPool(NULL, pool) < 0)
         VIR_DEBUG("Failed to refresh storage pool");
 
@@ -2406,7 +2958,7 @@ storageVolUpload(virStorageVolPtr obj,
     virStorageVolStreamInfoPtr cbdata = NULL;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM, -1);
 
     if (!(vol = virStorageVolDefFromVol(obj, &pool, &backend)))
         return -1;
@@ -2547,6 +3099,7 @@ storageVolResize(virStorageVolPtr obj,
         goto cleanup;
 
     vol->target.capacity = abs_capacity;
+    vol->refreshed = 0;
     /* Only update the allocation and pool values if we actually did the
      * allocation; otherwise, this is akin to a create operation with a
      * capacity value different and potentially much larger than available
@@ -2566,6 +3119,44 @@ storageVolResize(virStorageVolPtr obj,
 }
 
 
+
+/*
+ * Refresh @vol through its backend. Backends with an expensive
+ * refreshVol (e.g. one that has to walk all the extents of the
+ * volume) set refreshVolInterval so that repeated queries reuse the
+ * cached values until they get stale; @force bypasses the cache.
+ */
+static int
+storageVolRefresh(virConnectPtr conn,
+                  virStoragePoolObjPtr pool,
+                  virStorageBackendPtr backend,
+                  virStorageVolDefPtr vol,
+                  bool force)
+{
+    unsigned long long now = 0;
+
+    if (!backend->refreshVol)
+        return 0;
+
+    if (backend->refreshVolInterval) {
+        if (virTimeMillisNow(&now) < 0)
+            return -1;
+
+        if (!force && vol->refreshed &&
+            now >= vol->refreshed &&
+            now - vol->refreshed < backend->refreshVolInterval) {
+            VIR_DEBUG("Using cached info of volume '%s'", vol->name);
+            return 0;
+        }
+    }
+
+    if (backend->refreshVol(conn, pool, vol) < 0)
+        return -1;
+
+    vol->refreshed = now;
+    return 0;
+}
+
 static int
 storageVolWipePattern(virStorageVolPtr obj,
                       unsigned int algorithm,
@@ -2615,8 +3206,7 @@ storageVolWipePattern(virStorageVolPtr obj,
     if (backend->wipeVol(obj->conn, pool, vol, algorithm, flags) < 0)
         goto cleanup;
 
-    if (backend->refreshVol &&
-        backend->refreshVol(obj->conn, pool, vol) < 0)
+    if (storageVolRefresh(obj->conn, pool, backend, vol, true) < 0)
         goto cleanup;
 
     ret = 0;
@@ -2653,8 +3243,7 @@ storageVolGetInfoFlags(virStorageVolPtr obj,
     if (virStorageVolGetInfoFlagsEnsureACL(obj->conn, pool->def, vol) < 0)
         goto cleanup;
 
-    if (backend->refreshVol &&
-        backend->refreshVol(obj->conn, pool, vol) < 0)
+    if (storageVolRefresh(obj->conn, pool, backend, vol, false) < 0)
         goto cleanup;
 
     memset(info, 0, sizeof(*info));
@@ -2697,8 +3286,7 @@ storageVolGetXMLDesc(virStorageVolPtr obj,
     if (virStorageVolGetXMLDescEnsureACL(obj->conn, pool->def, vol) < 0)
         goto cleanup;
 
-    if (backend->refreshVol &&
-        backend->refreshVol(obj->conn, pool, vol) < 0)
+    if (storageVolRefresh(obj->conn, pool, backend, vol, false) < 0)
         goto cleanup;
 
     ret = virStorageVolDefFormat(pool->def, vol);
@@ -3229,6 +3817,145 @@ virStorageFileChown(const virStorageSource *src,
 }
 
 
+/* Headers of backing images read by virStorageFileGetMetadata are
+ * remembered process wide, because the same (golden) images tend to be
+ * shared by many domains and reading them over and over is expensive on
+ * remote filesystems. Entries are keyed by device and inode and are
+ * valid only as long as the size and the timestamps of the file do not
+ * change. Only local regular files are cached: the timestamps of block
+ * devices do not reflect writes to them. */
+#define VIR_STORAGE_FILE_HEADER_CACHE_MAX 1024
+
+typedef struct _virStorageFileHeaderCacheEntry virStorageFileHeaderCacheEntry;
+typedef virStorageFileHeaderCacheEntry *virStorageFileHeaderCacheEntryPtr;
+struct _virStorageFileHeaderCacheEntry {
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+
+    char *buf;
+    ssize_t len;
+};
+
+static virMutex virStorageFileHeaderCacheLock = VIR_MUTEX_INITIALIZER;
+static virHashTablePtr virStorageFileHeaderCache;
+
+
+static void
+virStorageFileHeaderCacheEntryFree(void *payload,
+                                   const void *name ATTRIBUTE_UNUSED)
+{
+    virStorageFileHeaderCacheEntryPtr entry = payload;
+
+    if (!entry)
+        return;
+
+    VIR_FREE(entry->buf);
+    VIR_FREE(entry);
+}
+
+
+static bool
+virStorageFileHeaderCacheEntryValid(virStorageFileHeaderCacheEntryPtr entry,
+                                    const struct stat *st)
+{
+    struct timespec mtim = get_stat_mtime(st);
+    struct timespec ctim = get_stat_ctime(st);
+
+    return entry->size == st->st_size &&
+        entry->mtime.tv_sec == mtim.tv_sec &&
+        entry->mtime.tv_nsec == mtim.tv_nsec &&
+        entry->ctime.tv_sec == ctim.tv_sec &&
+        entry->ctime.tv_nsec == ctim.tv_nsec;
+}
+
+
+/**
+ * virStorageFileReadHeaderCached:
+ * @src: storage source, initialized
+ * @buf: filled with the header
+ *
+ * Like virStorageFileReadHeader(src, VIR_STORAGE_MAX_HEADER, buf), but
+ * the header of local regular files is looked up in and stored into the
+ * process wide header cache.
+ *
+ * Returns the length of the header, or negative value on error.
+ */
+static ssize_t
+virStorageFileReadHeaderCached(virStorageSourcePtr src,
+                               char **buf)
+{
+    virStorageFileHeaderCacheEntryPtr entry = NULL;
+    struct stat st;
+    char *key = NULL;
+    ssize_t ret = -1;
+
+    if (virStorageSourceGetActualType(src) != VIR_STORAGE_TYPE_FILE ||
+        virStorageFileStat(src, &st) < 0 ||
+        !S_ISREG(st.st_mode)) {
+        virResetLastError();
+        return virStorageFileReadHeader(src, VIR_STORAGE_MAX_HEADER, buf);
+    }
+
+    if (virAsprintf(&key, "%llu:%llu",
+                    (unsigned long long) st.st_dev,
+                    (unsigned long long) st.st_ino) < 0)
+        return -1;
+
+    virMutexLock(&virStorageFileHeaderCacheLock);
+    if (virStorageFileHeaderCache &&
+        (entry = virHashLookup(virStorageFileHeaderCache, key)) &&
+        virStorageFileHeaderCacheEntryValid(entry, &st)) {
+        if (VIR_ALLOC_N(*buf, entry->len) == 0) {
+            memcpy(*buf, entry->buf, entry->len);
+            ret = entry->len;
+        }
+        virMutexUnlock(&virStorageFileHeaderCacheLock);
+        VIR_DEBUG("header of %s found in cache", src->path);
+        goto cleanup;
+    }
+    virMutexUnlock(&virStorageFileHeaderCacheLock);
+
+    if ((ret = virStorageFileReadHeader(src, VIR_STORAGE_MAX_HEADER, buf)) < 0)
+        goto cleanup;
+
+    if (VIR_ALLOC(entry) < 0 ||
+        VIR_ALLOC_N(entry->buf, ret) < 0) {
+        /* the cache is just an optimization */
+        virResetLastError();
+        virStorageFileHeaderCacheEntryFree(entry, NULL);
+        goto cleanup;
+    }
+
+    memcpy(entry->buf, *buf, ret);
+    entry->len = ret;
+    entry->size = st.st_size;
+    entry->mtime = get_stat_mtime(&st);
+    entry->ctime = get_stat_ctime(&st);
+
+    virMutexLock(&virStorageFileHeaderCacheLock);
+    if (!virStorageFileHeaderCache)
+        virStorageFileHeaderCache =
+            virHashCreate(32, virStorageFileHeaderCacheEntryFree);
+
+    if (virStorageFileHeaderCache &&
+        virHashSize(virStorageFileHeaderCache) >=
+        VIR_STORAGE_FILE_HEADER_CACHE_MAX)
+        virHashRemoveAll(virStorageFileHeaderCache);
+
+    if (!virStorageFileHeaderCache ||
+        virHashUpdateEntry(virStorageFileHeaderCache, key, entry) < 0) {
+        virResetLastError();
+        virStorageFileHeaderCacheEntryFree(entry, NULL);
+    }
+    virMutexUnlock(&virStorageFileHeaderCacheLock);
+
+ cleanup:
+    VIR_FREE(key);
+    return ret;
+}
+
+
 /* Recursive workhorse for virStorageFileGetMetadata.  */
 static int
 virStorageFileGetMetadataRecurse(virStorageSourcePtr src,
@@ -3287,8 +4014,7 @@ virStorageFileGetMetadataRecurse(virStorageSourcePtr src,
     if (virHashAddEntry(cycle, uniqueName, (void *)1) < 0)
         goto cleanup;
 
-    if ((headerLen = virStorageFileReadHeader(src, VIR_STORAGE_MAX_HEADER,
-                                              &buf)) < 0)
+    if ((headerLen = virStorageFileReadHeaderCached(src, &buf)) < 0)
         goto cleanup;
 
     if (virStorageFileGetMetadataInternal(src, buf, headerLen,
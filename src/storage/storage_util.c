@@ -36,6 +36,9 @@
 # ifndef FS_NOCOW_FL
 #  define FS_NOCOW_FL                     0x00800000 /* Do not cow file */
 # endif
+# ifndef FICLONE
+#  define FICLONE                         _IOW(0x94, 9, int)
+# endif
 #endif
 
 #if WITH_BLKID
@@ -76,26 +79,397 @@ VIR_LOG_INIT("storage.storage_util");
 #define READ_BLOCK_SIZE_DEFAULT  (1024 * 1024)
 #define WRITE_BLOCK_SIZE_DEFAULT (4 * 1024)
 
+/* Copying and wiping of large volumes is split into chunks that are
+ * processed by this many threads concurrently. Fast storage needs
+ * several requests in flight to reach its throughput. */
+#define STORAGE_IO_THREADS 4
+#define STORAGE_IO_CHUNK_SIZE (64 * 1024 * 1024)
+
 /*
- * Perform the O(1) btrfs clone operation, if possible.
+ * Perform the O(1) clone operation, if possible. FICLONE is the
+ * generic name of BTRFS_IOC_CLONE and works on XFS too.
  * Upon success, return 0.  Otherwise, return -1 and set errno.
  */
-#if HAVE_LINUX_BTRFS_H
+#ifdef __linux__
 static inline int
-btrfsCloneFile(int dest_fd, int src_fd)
+reflinkCloneFile(int dest_fd, int src_fd)
 {
-    return ioctl(dest_fd, BTRFS_IOC_CLONE, src_fd);
+    return ioctl(dest_fd, FICLONE, src_fd);
 }
 #else
 static inline int
-btrfsCloneFile(int dest_fd ATTRIBUTE_UNUSED,
-               int src_fd ATTRIBUTE_UNUSED)
+reflinkCloneFile(int dest_fd ATTRIBUTE_UNUSED,
+                 int src_fd ATTRIBUTE_UNUSED)
 {
     errno = ENOTSUP;
     return -1;
 }
 #endif
 
+#if HAVE_COPY_FILE_RANGE
+static inline ssize_t
+copyFileRange(int src_fd, off_t *src_off,
+              int dest_fd, off_t *dest_off,
+              size_t len)
+{
+    return copy_file_range(src_fd, src_off, dest_fd, dest_off, len, 0);
+}
+#else
+static inline ssize_t
+copyFileRange(int src_fd ATTRIBUTE_UNUSED,
+              off_t *src_off ATTRIBUTE_UNUSED,
+              int dest_fd ATTRIBUTE_UNUSED,
+              off_t *dest_off ATTRIBUTE_UNUSED,
+              size_t len ATTRIBUTE_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+#endif
+
+
+/*
+ * Copy up to @total bytes from @inputfd to @fd, both positioned at their
+ * beginning, without passing the data through userspace. If @want_sparse,
+ * holes of the input (as reported by SEEK_DATA/SEEK_HOLE) are skipped
+ * rather than copied; @fd has to be pre-sized by the caller then.
+ *
+ * Returns 0 if everything was copied, 1 if the caller has to copy the
+ * rest itself (e.g. the kernel or filesystem can't do this), in which
+ * case both file offsets are set to where the copying stopped. @total is
+ * decreased by the amount copied in both cases.
+ */
+static int
+virStorageBackendCopyFileRange(int inputfd,
+                               int fd,
+                               unsigned long long *total,
+                               bool want_sparse)
+{
+    struct stat inst;
+    struct stat outst;
+    off_t end;
+    off_t pos = 0;
+    bool fallback = false;
+
+    if (fstat(inputfd, &inst) < 0 || !S_ISREG(inst.st_mode) ||
+        fstat(fd, &outst) < 0 || !S_ISREG(outst.st_mode))
+        return 1;
+
+    end = inst.st_size;
+    if (*total < (unsigned long long) end)
+        end = *total;
+
+    while (pos < end) {
+        off_t data = pos;
+        off_t hole = end;
+        off_t inoff;
+        off_t outoff;
+
+        if (want_sparse) {
+            if ((data = lseek(inputfd, pos, SEEK_DATA)) < 0) {
+                if (errno != ENXIO) {
+                    /* not supported, copy everything */
+                    want_sparse = false;
+                    continue;
+                }
+                /* nothing but a hole up to EOF */
+                data = end;
+            }
+            if (data >= end) {
+                pos = end;
+                break;
+            }
+            if ((hole = lseek(inputfd, data, SEEK_HOLE)) < 0 || hole > end)
+                hole = end;
+        }
+
+        inoff = outoff = data;
+        while (inoff < hole) {
+            ssize_t rc = copyFileRange(inputfd, &inoff, fd, &outoff,
+                                       hole - inoff);
+
+            if (rc <= 0) {
+                /* Leave any error reporting to the userspace loop */
+                VIR_DEBUG("copy_file_range stopped at %lld: rc=%zd errno=%d",
+                          (long long) inoff, rc, rc < 0 ? errno : 0);
+                fallback = true;
+                break;
+            }
+        }
+        pos = inoff;
+
+        if (fallback)
+            break;
+    }
+
+    VIR_DEBUG("copied %lld bytes in kernel", (long long) pos);
+    *total -= pos;
+
+    if (lseek(inputfd, pos, SEEK_SET) < 0 ||
+        lseek(fd, pos, SEEK_SET) < 0)
+        return -1;
+
+    return fallback || pos < end ? 1 : 0;
+}
+
+
+typedef int (*storageBackendIOChunkFunc)(unsigned long long offset,
+                                         unsigned long long len,
+                                         char *buf,
+                                         size_t buflen,
+                                         void *opaque);
+
+typedef struct _storageBackendIOData storageBackendIOData;
+typedef storageBackendIOData *storageBackendIODataPtr;
+struct _storageBackendIOData {
+    virMutex lock;
+    unsigned long long next;
+    unsigned long long end;
+    size_t buflen;
+    storageBackendIOChunkFunc func;
+    void *opaque;
+
+    bool failed;
+    int errnum;
+    virErrorPtr err;
+};
+
+
+static void
+storageBackendIOWorker(void *opaque)
+{
+    storageBackendIODataPtr data = opaque;
+    char *buf = NULL;
+
+    if (VIR_ALLOC_N(buf, data->buflen) < 0) {
+        virMutexLock(&data->lock);
+        if (!data->failed) {
+            data->failed = true;
+            data->errnum = ENOMEM;
+            data->err = virSaveLastError();
+        }
+        virMutexUnlock(&data->lock);
+        return;
+    }
+
+    while (true) {
+        unsigned long long offset;
+        unsigned long long len;
+
+        virMutexLock(&data->lock);
+        if (data->failed || data->next >= data->end) {
+            virMutexUnlock(&data->lock);
+            break;
+        }
+        offset = data->next;
+        len = MIN(data->end - offset, STORAGE_IO_CHUNK_SIZE);
+        data->next += len;
+        virMutexUnlock(&data->lock);
+
+        if (data->func(offset, len, buf, data->buflen, data->opaque) < 0) {
+            int errnum = errno;
+
+            virMutexLock(&data->lock);
+            if (!data->failed) {
+                data->failed = true;
+                data->errnum = errnum;
+                data->err = virSaveLastError();
+            }
+            virMutexUnlock(&data->lock);
+        }
+    }
+
+    VIR_FREE(buf);
+}
+
+
+/*
+ * Call @func for chunks of [@offset, @offset + @len) on up to
+ * STORAGE_IO_THREADS threads (including the calling one), handing each
+ * of them a private buffer of @buflen bytes. The first failure stops
+ * all threads and is reported in the calling thread.
+ *
+ * Returns 0 on success, -errno on failure.
+ */
+static int
+storageBackendIORun(unsigned long long offset,
+                    unsigned long long len,
+                    size_t buflen,
+                    storageBackendIOChunkFunc func,
+                    void *opaque)
+{
+    storageBackendIOData data = { .next = offset, .end = offset + len,
+                                  .buflen = buflen, .func = func,
+                                  .opaque = opaque };
+    unsigned long long nchunks = (len + STORAGE_IO_CHUNK_SIZE - 1) /
+                                 STORAGE_IO_CHUNK_SIZE;
+    virThreadPtr threads = NULL;
+    size_t nthreads = 0;
+    size_t i;
+
+    if (virMutexInit(&data.lock) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to init mutex"));
+        return -errno;
+    }
+
+    if (nchunks > 1) {
+        size_t want = MIN(nchunks, STORAGE_IO_THREADS) - 1;
+
+        if (VIR_ALLOC_N_QUIET(threads, want) == 0) {
+            for (nthreads = 0; nthreads < want; nthreads++) {
+                if (virThreadCreate(&threads[nthreads], true,
+                                    storageBackendIOWorker, &data) < 0) {
+                    VIR_DEBUG("Unable to create I/O thread: %s",
+                              virGetLastErrorMessage());
+                    virResetLastError();
+                    break;
+                }
+            }
+        }
+    }
+
+    VIR_DEBUG("processing %llu bytes in %llu chunks with %zu extra threads",
+              len, nchunks, nthreads);
+
+    storageBackendIOWorker(&data);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+    VIR_FREE(threads);
+    virMutexDestroy(&data.lock);
+
+    if (data.failed) {
+        if (data.err)
+            virSetError(data.err);
+        virFreeError(data.err);
+        return data.errnum ? -data.errnum : -EIO;
+    }
+
+    return 0;
+}
+
+
+static int
+storageBackendPWriteAll(int fd,
+                        const char *buf,
+                        size_t len,
+                        off_t offset)
+{
+    while (len > 0) {
+        ssize_t rc = pwrite(fd, buf, len, offset);
+
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        buf += rc;
+        len -= rc;
+        offset += rc;
+    }
+
+    return 0;
+}
+
+
+typedef struct _storageBackendCopyData storageBackendCopyData;
+typedef storageBackendCopyData *storageBackendCopyDataPtr;
+struct _storageBackendCopyData {
+    int inputfd;
+    const char *inputpath;
+    int fd;
+    const char *path;
+    off_t outshift;         /* output offset minus input offset */
+    bool want_sparse;
+    const char *zerobuf;
+    size_t wbytes;
+};
+
+
+static int
+storageBackendCopyChunk(unsigned long long offset,
+                        unsigned long long len,
+                        char *buf,
+                        size_t buflen,
+                        void *opaque)
+{
+    storageBackendCopyDataPtr data = opaque;
+
+    while (len > 0) {
+        size_t want = MIN(len, buflen);
+        ssize_t amtread;
+        size_t done;
+
+        if ((amtread = pread(data->inputfd, buf, want, offset)) < 0) {
+            if (errno == EINTR)
+                continue;
+            virReportSystemError(errno,
+                                 _("failed reading from file '%s'"),
+                                 data->inputpath);
+            return -1;
+        }
+
+        if (amtread == 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("unexpected end of file '%s'"),
+                           data->inputpath);
+            errno = EIO;
+            return -1;
+        }
+
+        /* Look for sparse blocks to skip */
+        for (done = 0; done < (size_t) amtread; ) {
+            size_t interval = MIN((size_t) amtread - done, data->wbytes);
+
+            if (!(data->want_sparse &&
+                  memcmp(buf + done, data->zerobuf, interval) == 0) &&
+                storageBackendPWriteAll(data->fd, buf + done, interval,
+                                        offset + done + data->outshift) < 0) {
+                virReportSystemError(errno,
+                                     _("failed writing to file '%s'"),
+                                     data->path);
+                return -1;
+            }
+
+            done += interval;
+        }
+
+        offset += amtread;
+        len -= amtread;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Get the number of bytes left to read in @fd from its current offset,
+ * or -1 if that can't be determined (e.g. @fd is a pipe).
+ */
+static off_t
+storageBackendRemainingSize(int fd)
+{
+    struct stat st;
+    off_t cur;
+    off_t end;
+
+    if (fstat(fd, &st) < 0 ||
+        !(S_ISREG(st.st_mode) || S_ISBLK(st.st_mode)))
+        return -1;
+
+    if ((cur = lseek(fd, 0, SEEK_CUR)) < 0)
+        return -1;
+
+    if (S_ISREG(st.st_mode))
+        end = st.st_size;
+    else if ((end = lseek(fd, 0, SEEK_END)) < 0 ||
+             lseek(fd, cur, SEEK_SET) < 0)
+        return -1;
+
+    return end > cur ? end - cur : 0;
+}
+
 static int ATTRIBUTE_NONNULL(2)
 virStorageBackendCopyToFD(virStorageVolDefPtr vol,
                           virStorageVolDefPtr inputvol,
@@ -113,6 +487,7 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
     char *zerobuf = NULL;
     char *buf = NULL;
     struct stat st;
+    off_t insize;
 
     if ((inputfd = open(inputvol->target.path, O_RDONLY)) < 0) {
         ret = -errno;
@@ -142,18 +517,70 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
     }
 
     if (reflink_copy) {
-        if (btrfsCloneFile(fd, inputfd) < 0) {
+        if (reflinkCloneFile(fd, inputfd) < 0) {
             ret = -errno;
             virReportSystemError(errno,
                                  _("failed to clone files from '%s'"),
                                  inputvol->target.path);
             goto cleanup;
         } else {
-            VIR_DEBUG("btrfs clone finished.");
+            VIR_DEBUG("reflink clone finished.");
             goto cleanup;
         }
     }
 
+    switch (virStorageBackendCopyFileRange(inputfd, fd, total, want_sparse)) {
+    case 0:
+        /* all done, only sync is left */
+        amtread = 0;
+        break;
+    case 1:
+        break;
+    default:
+        ret = -errno;
+        virReportSystemError(errno,
+                             _("cannot seek in file '%s'"),
+                             vol->target.path);
+        goto cleanup;
+    }
+
+    /* If we know how much there is to copy, do it in parallel */
+    if (amtread != 0 &&
+        (insize = storageBackendRemainingSize(inputfd)) >= 0) {
+        storageBackendCopyData data = {
+            .inputfd = inputfd, .inputpath = inputvol->target.path,
+            .fd = fd, .path = vol->target.path,
+            .want_sparse = want_sparse,
+            .zerobuf = zerobuf, .wbytes = wbytes,
+        };
+        unsigned long long len = MIN(*total, (unsigned long long) insize);
+        off_t instart = lseek(inputfd, 0, SEEK_CUR);
+        off_t outstart = lseek(fd, 0, SEEK_CUR);
+
+        if (instart < 0 || outstart < 0) {
+            ret = -errno;
+            virReportSystemError(errno,
+                                 _("cannot seek in file '%s'"),
+                                 vol->target.path);
+            goto cleanup;
+        }
+        data.outshift = outstart - instart;
+
+        if ((ret = storageBackendIORun(instart, len, rbytes,
+                                       storageBackendCopyChunk, &data)) < 0)
+            goto cleanup;
+
+        *total -= len;
+        if (lseek(fd, outstart + len, SEEK_SET) < 0) {
+            ret = -errno;
+            virReportSystemError(errno,
+                                 _("cannot seek in file '%s'"),
+                                 vol->target.path);
+            goto cleanup;
+        }
+        amtread = 0;
+    }
+
     while (amtread != 0) {
         int amtleft;
 
@@ -2401,8 +2828,9 @@ virStorageBackendVolUploadLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     char *target_path = vol->target.path;
     int ret = -1;
     int has_snap = 0;
+    bool sparse = flags & VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM, -1);
     /* if volume has target format VIR_STORAGE_FILE_PLOOP
      * we need to restore DiskDescriptor.xml, according to
      * new contents of volume. This operation will be perfomed
@@ -2427,7 +2855,7 @@ virStorageBackendVolUploadLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     /* Not using O_CREAT because the file is required to already exist at
      * this point */
     ret = virFDStreamOpenBlockDevice(stream, target_path,
-                                     offset, len, O_WRONLY);
+                                     offset, len, sparse, O_WRONLY);
 
  cleanup:
     VIR_FREE(path);
@@ -2447,8 +2875,9 @@ virStorageBackendVolDownloadLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     char *target_path = vol->target.path;
     int ret = -1;
     int has_snap = 0;
+    bool sparse = flags & VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM, -1);
     if (vol->target.format == VIR_STORAGE_FILE_PLOOP) {
         has_snap = storageBackendPloopHasSnapshots(vol->target.path);
         if (has_snap < 0) {
@@ -2465,7 +2894,7 @@ virStorageBackendVolDownloadLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     }
 
     ret = virFDStreamOpenBlockDevice(stream, target_path,
-                                     offset, len, O_RDONLY);
+                                     offset, len, sparse, O_RDONLY);
 
  cleanup:
     VIR_FREE(path);
@@ -2512,61 +2941,73 @@ storageBackendVolZeroSparseFileLocal(const char *path,
 }
 
 
-static int
-storageBackendWipeLocal(const char *path,
-                        int fd,
-                        unsigned long long wipe_len,
-                        size_t writebuf_length)
-{
-    int ret = -1, written = 0;
-    unsigned long long remaining = 0;
-    size_t write_size = 0;
-    char *writebuf = NULL;
-
-    VIR_DEBUG("wiping start: 0 len: %llu", wipe_len);
+typedef struct _storageBackendWipeData storageBackendWipeData;
+typedef storageBackendWipeData *storageBackendWipeDataPtr;
+struct _storageBackendWipeData {
+    int fd;
+    const char *path;
+};
 
-    if (VIR_ALLOC_N(writebuf, writebuf_length) < 0)
-        goto cleanup;
 
-    if (lseek(fd, 0, SEEK_SET) < 0) {
-        virReportSystemError(errno,
-                             _("Failed to seek to the start in volume "
-                               "with path '%s'"),
-                             path);
-        goto cleanup;
-    }
+static int
+storageBackendWipeChunk(unsigned long long offset,
+                        unsigned long long len,
+                        char *buf,
+                        size_t buflen,
+                        void *opaque)
+{
+    storageBackendWipeDataPtr data = opaque;
 
-    remaining = wipe_len;
-    while (remaining > 0) {
+    /* @buf is zeroed on allocation and never written to */
+    while (len > 0) {
+        size_t write_size = MIN(len, buflen);
 
-        write_size = (writebuf_length < remaining) ? writebuf_length : remaining;
-        written = safewrite(fd, writebuf, write_size);
-        if (written < 0) {
+        if (storageBackendPWriteAll(data->fd, buf, write_size, offset) < 0) {
             virReportSystemError(errno,
                                  _("Failed to write %zu bytes to "
                                    "storage volume with path '%s'"),
-                                 write_size, path);
-
-            goto cleanup;
+                                 write_size, data->path);
+            return -1;
         }
 
-        remaining -= written;
+        offset += write_size;
+        len -= write_size;
     }
 
+    return 0;
+}
+
+
+static int
+storageBackendWipeLocal(const char *path,
+                        int fd,
+                        unsigned long long wipe_len,
+                        size_t writebuf_length)
+{
+    storageBackendWipeData data = { .fd = fd, .path = path };
+
+    VIR_DEBUG("wiping start: 0 len: %llu", wipe_len);
+
+    /* Write in bigger pieces, but keep them aligned to the block size */
+    if (writebuf_length == 0)
+        writebuf_length = WRITE_BLOCK_SIZE_DEFAULT;
+    if (writebuf_length < READ_BLOCK_SIZE_DEFAULT)
+        writebuf_length *= READ_BLOCK_SIZE_DEFAULT / writebuf_length;
+
+    if (storageBackendIORun(0, wipe_len, writebuf_length,
+                            storageBackendWipeChunk, &data) < 0)
+        return -1;
+
     if (fdatasync(fd) < 0) {
         virReportSystemError(errno,
                              _("cannot sync data to volume with path '%s'"),
                              path);
-        goto cleanup;
+        return -1;
     }
 
     VIR_DEBUG("Wrote %llu bytes to volume with path '%s'", wipe_len, path);
 
-    ret = 0;
-
- cleanup:
-    VIR_FREE(writebuf);
-    return ret;
+    return 0;
 }
 
 
@@ -3500,23 +3941,106 @@ storageBackendProbeTarget(virStorageSourcePtr target,
 }
 
 
+static void
+storageBackendVolDefHashFree(void *payload,
+                             const void *name ATTRIBUTE_UNUSED)
+{
+    virStorageVolDefFree(payload);
+}
+
+
+/*
+ * Hand over the volume @name found by the previous refresh of the pool
+ * if the file it describes did not change since, so that its header does
+ * not have to be probed again. Only regular files qualify, the size and
+ * timestamps of anything else do not reflect changes to its contents.
+ */
+static virStorageVolDefPtr
+storageBackendRefreshLocalReuse(virHashTablePtr oldvols,
+                                const char *dir,
+                                const char *name)
+{
+    virStorageVolDefPtr vol;
+    virStorageTimestampsPtr ts;
+    struct timespec mtim;
+    struct timespec ctim;
+    struct stat sb;
+
+    if (!(vol = virHashSteal(oldvols, name)))
+        return NULL;
+
+    /* Volumes saved by a previous libvirtd might predate a change of
+     * the target path */
+    if (!vol->target.path ||
+        !STRPREFIX(vol->target.path, dir) ||
+        vol->target.path[strlen(dir)] != '/' ||
+        STRNEQ(vol->target.path + strlen(dir) + 1, name))
+        goto drop;
+
+    if (!(ts = vol->target.timestamps) ||
+        stat(vol->target.path, &sb) < 0 ||
+        !S_ISREG(sb.st_mode) ||
+        vol->target.physical != sb.st_size)
+        goto drop;
+
+    mtim = get_stat_mtime(&sb);
+    ctim = get_stat_ctime(&sb);
+    if (ts->mtime.tv_sec != mtim.tv_sec ||
+        ts->mtime.tv_nsec != mtim.tv_nsec ||
+        ts->ctime.tv_sec != ctim.tv_sec ||
+        ts->ctime.tv_nsec != ctim.tv_nsec)
+        goto drop;
+
+    vol->target.allocation = (unsigned long long)sb.st_blocks *
+        (unsigned long long)DEV_BSIZE;
+    ts->atime = get_stat_atime(&sb);
+
+    VIR_DEBUG("volume '%s' did not change since the last refresh",
+              vol->target.path);
+    return vol;
+
+ drop:
+    virStorageVolDefFree(vol);
+    return NULL;
+}
+
+
 /**
  * Iterate over the pool's directory and enumerate all disk images
  * within it. This is non-recursive.
+ *
+ * Volumes already in the pool are taken over as long as their files did
+ * not change, everything else is probed from scratch.
  */
 int
 virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
                               virStoragePoolObjPtr pool)
 {
-    DIR *dir;
+    DIR *dir = NULL;
     struct dirent *ent;
     struct statvfs sb;
     struct stat statbuf;
     virStorageVolDefPtr vol = NULL;
     virStorageSourcePtr target = NULL;
+    virHashTablePtr oldvols = NULL;
+    size_t i;
     int direrr;
     int fd = -1, ret = -1;
 
+    if (pool->volumes.count) {
+        if (!(oldvols = virHashCreate(pool->volumes.count,
+                                      storageBackendVolDefHashFree)))
+            goto cleanup;
+
+        for (i = 0; i < pool->volumes.count; i++) {
+            if (virHashAddEntry(oldvols, pool->volumes.objs[i]->name,
+                                pool->volumes.objs[i]) < 0)
+                goto cleanup;
+            pool->volumes.objs[i] = NULL;
+        }
+        virStoragePoolObjClearVols(pool);
+    }
+
     if (virDirOpen(&dir, pool->def->target.path) < 0)
         goto cleanup;
 
@@ -3529,6 +4053,11 @@ virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
             continue;
         }
 
+        if ((vol = storageBackendRefreshLocalReuse(oldvols,
+                                                   pool->def->target.path,
+                                                   ent->d_name)))
+            goto append;
+
         if (VIR_ALLOC(vol) < 0)
             goto cleanup;
 
@@ -3571,6 +4100,7 @@ virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
         if (vol->target.format == VIR_STORAGE_FILE_PLOOP)
             vol->type = VIR_STORAGE_VOL_PLOOP;
 
+ append:
         if (vol->target.backingStore) {
             ignore_value(storageBackendUpdateVolTargetInfo(VIR_STORAGE_VOL_FILE,
                                                            vol->target.backingStore,
@@ -3636,6 +4166,7 @@ virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     VIR_FORCE_CLOSE(fd);
     virStorageVolDefFree(vol);
     virStorageSourceFree(target);
+    virHashFree(oldvols);
     if (ret < 0)
         virStoragePoolObjClearVols(pool);
     return ret;
@@ -4040,6 +4571,72 @@ processLU(virStoragePoolObjPtr pool,
 }
 
 
+/*
+ * Walk the device directory of a SCSI host looking for its LUs, which
+ * sit in the target directories below it, on iSCSI hosts below a session
+ * directory as well. This touches only the devices of @scanhost, whereas
+ * /sys/bus/scsi/devices lists the devices of every host.
+ *
+ * Returns 0 on success, -1 on fatal error.
+ */
+static int
+virStorageBackendSCSIFindHostLUs(virStoragePoolObjPtr pool,
+                                 uint32_t scanhost,
+                                 const char *path,
+                                 const char *devicepattern,
+                                 unsigned int depth,
+                                 int *found)
+{
+    uint32_t bus, target, lun;
+    DIR *dir = NULL;
+    struct dirent *ent = NULL;
+    char *subpath = NULL;
+    int ret = -1;
+    int direrr;
+
+    if (virDirOpenQuiet(&dir, path) < 0) {
+        /* Entries can go away as sessions are logged out */
+        ret = 0;
+        goto cleanup;
+    }
+
+    while ((direrr = virDirRead(dir, &ent, path)) > 0) {
+        int rc;
+
+        if (sscanf(ent->d_name, devicepattern, &bus, &target, &lun) == 3) {
+            VIR_DEBUG("Found possible LU '%s'", ent->d_name);
+
+            if ((rc = processLU(pool, scanhost, bus, target, lun)) == -1)
+                goto cleanup;
+            if (rc == 0)
+                (*found)++;
+            continue;
+        }
+
+        if (depth == 0 ||
+            !(STRPREFIX(ent->d_name, "target") ||
+              STRPREFIX(ent->d_name, "session")))
+            continue;
+
+        if (virAsprintf(&subpath, "%s/%s", path, ent->d_name) < 0 ||
+            virStorageBackendSCSIFindHostLUs(pool, scanhost, subpath,
+                                             devicepattern, depth - 1,
+                                             found) < 0)
+            goto cleanup;
+        VIR_FREE(subpath);
+    }
+    if (direrr < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(subpath);
+    VIR_DIR_CLOSE(dir);
+    return ret;
+}
+
+
 int
 virStorageBackendSCSIFindLUs(virStoragePoolObjPtr pool,
                               uint32_t scanhost)
@@ -4050,16 +4647,30 @@ virStorageBackendSCSIFindLUs(virStoragePoolObjPtr pool,
     DIR *devicedir = NULL;
     struct dirent *lun_dirent = NULL;
     char devicepattern[64];
+    char *host_path = NULL;
     int found = 0;
 
     VIR_DEBUG("Discovering LUs on host %u", scanhost);
 
     virWaitForDevices();
 
-    if (virDirOpen(&devicedir, device_path) < 0)
+    snprintf(devicepattern, sizeof(devicepattern), "%u:%%u:%%u:%%u\n", scanhost);
+
+    /* hostN/sessionM/targetN:B:T/N:B:T:L is as deep as it gets */
+    if (virAsprintf(&host_path, "%s/host%u", device_path, scanhost) < 0)
         return -1;
+    if (virFileIsDir(host_path)) {
+        retval = virStorageBackendSCSIFindHostLUs(pool, scanhost, host_path,
+                                                  devicepattern, 2, &found);
+        VIR_FREE(host_path);
+        if (retval < 0)
+            return -1;
+        goto done;
+    }
+    VIR_FREE(host_path);
 
-    snprintf(devicepattern, sizeof(devicepattern), "%u:%%u:%%u:%%u\n", scanhost);
+    if (virDirOpen(&devicedir, device_path) < 0)
+        return -1;
 
     while ((retval = virDirRead(devicedir, &lun_dirent, device_path)) > 0) {
         int rc;
@@ -4085,6 +4696,7 @@ virStorageBackendSCSIFindLUs(virStoragePoolObjPtr pool,
     if (retval < 0)
         return -1;
 
+ done:
     VIR_DEBUG("Found %d LUs for pool %s", found, pool->def->name);
 
     return found;
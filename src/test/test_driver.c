@@ -121,6 +121,14 @@ struct _testDriver {
     virDomainObjListPtr domains;
     virNetworkObjListPtr networks;
     virObjectEventStatePtr eventState;
+
+    /* test:///scale settings, immutable after testOpenScale */
+    unsigned int scaleDomains;
+    unsigned int scaleLatency; /* milliseconds added to domain APIs */
+    unsigned int scaleEventBurst; /* events per tick of the timer */
+    int scaleEventTimer;
+    /* only accessed from the timer */
+    size_t scaleEventNext;
 };
 typedef struct _testDriver testDriver;
 typedef testDriver *testDriverPtr;
@@ -421,6 +429,7 @@ testDriverNew(void)
         goto error;
 
     virAtomicIntSet(&ret->nextDomID, 1);
+    ret->scaleEventTimer = -1;
 
     return ret;
 
@@ -568,6 +577,14 @@ static const unsigned long long defaultPoolAlloc;
 static int testStoragePoolObjSetDefaults(virStoragePoolObjPtr pool);
 static int testNodeGetInfo(virConnectPtr conn, virNodeInfoPtr info);
 
+/* Simulates the time a hypervisor takes to answer in test:///scale */
+static void
+testScaleDelay(testDriverPtr driver)
+{
+    if (driver->scaleLatency)
+        usleep(driver->scaleLatency * 1000);
+}
+
 static virDomainObjPtr
 testDomObjFromDomain(virDomainPtr domain)
 {
@@ -575,6 +592,8 @@ testDomObjFromDomain(virDomainPtr domain)
     testDriverPtr driver = domain->conn->privateData;
     char uuidstr[VIR_UUID_STRING_BUFLEN];
 
+    testScaleDelay(driver);
+
     vm = virDomainObjListFindByUUIDRef(driver->domains, domain->uuid);
     if (!vm) {
         virUUIDFormat(domain->uuid, uuidstr);
@@ -1365,6 +1384,249 @@ testOpenDefault(virConnectPtr conn)
     return VIR_DRV_OPEN_ERROR;
 }
 
+
+#define TEST_SCALE_MAX_DOMAINS 100000
+#define TEST_SCALE_MAX_DISKS 256
+#define TEST_SCALE_EVENT_TICK 100 /* milliseconds */
+
+/* Pauses or resumes the next few domains of test:///scale in turn, each
+ * with the lifecycle event it would have caused */
+static void
+testScaleEventTimer(int timer ATTRIBUTE_UNUSED,
+                    void *opaque)
+{
+    testDriverPtr privconn = opaque;
+    char name[32];
+    size_t i;
+
+    for (i = 0; i < privconn->scaleEventBurst; i++) {
+        virObjectEventPtr event = NULL;
+        virDomainObjPtr vm;
+        int state;
+
+        snprintf(name, sizeof(name), "scale-%zu",
+                 privconn->scaleEventNext++ % privconn->scaleDomains);
+
+        if (!(vm = virDomainObjListFindByName(privconn->domains, name)))
+            continue;
+
+        state = virDomainObjGetState(vm, NULL);
+        if (state == VIR_DOMAIN_RUNNING) {
+            virDomainObjSetState(vm, VIR_DOMAIN_PAUSED,
+                                 VIR_DOMAIN_PAUSED_USER);
+            event = virDomainEventLifecycleNewFromObj(vm,
+                                                      VIR_DOMAIN_EVENT_SUSPENDED,
+                                                      VIR_DOMAIN_EVENT_SUSPENDED_PAUSED);
+        } else if (state == VIR_DOMAIN_PAUSED) {
+            virDomainObjSetState(vm, VIR_DOMAIN_RUNNING,
+                                 VIR_DOMAIN_RUNNING_UNPAUSED);
+            event = virDomainEventLifecycleNewFromObj(vm,
+                                                      VIR_DOMAIN_EVENT_RESUMED,
+                                                      VIR_DOMAIN_EVENT_RESUMED_UNPAUSED);
+        }
+
+        virDomainObjEndAPI(&vm);
+        testObjectEventQueue(privconn, event);
+    }
+}
+
+/* Frees the driver of a test:///scale connection once its timer is gone */
+static void
+testScaleEventTimerFree(void *opaque)
+{
+    testDriverPtr privconn = opaque;
+
+    testDriverLock(privconn);
+    testDriverFree(privconn);
+}
+
+static int
+testOpenScaleParams(testDriverPtr privconn,
+                    virURIPtr uri,
+                    unsigned int *disks,
+                    unsigned int *eventsPerSec)
+{
+    size_t i;
+
+    privconn->scaleDomains = 1000;
+    *disks = 1;
+    *eventsPerSec = 0;
+
+    for (i = 0; i < uri->paramsCount; i++) {
+        virURIParamPtr param = &uri->params[i];
+        unsigned int *value;
+
+        if (param->ignore)
+            continue;
+
+        if (STREQ(param->name, "domains")) {
+            value = &privconn->scaleDomains;
+        } else if (STREQ(param->name, "disks")) {
+            value = disks;
+        } else if (STREQ(param->name, "events_per_sec")) {
+            value = eventsPerSec;
+        } else if (STREQ(param->name, "latency")) {
+            value = &privconn->scaleLatency;
+        } else {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("unknown test:///scale parameter '%s'"),
+                           param->name);
+            return -1;
+        }
+
+        if (!param->value ||
+            virStrToLong_uip(param->value, NULL, 10, value) < 0) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("invalid value of test:///scale parameter '%s'"),
+                           param->name);
+            return -1;
+        }
+    }
+
+    if (privconn->scaleDomains < 1 ||
+        privconn->scaleDomains > TEST_SCALE_MAX_DOMAINS) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("test:///scale supports 1 to %d domains"),
+                       TEST_SCALE_MAX_DOMAINS);
+        return -1;
+    }
+
+    if (*disks > TEST_SCALE_MAX_DISKS) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("test:///scale supports up to %d disks"),
+                       TEST_SCALE_MAX_DISKS);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+testOpenScaleDomain(testDriverPtr privconn,
+                    size_t idx,
+                    unsigned int disks)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virDomainDefPtr def = NULL;
+    virDomainObjPtr obj = NULL;
+    char *xml = NULL;
+    char *dev;
+    size_t i;
+    int ret = -1;
+
+    virBufferAddLit(&buf, "<domain type='test'>\n");
+    virBufferAdjustIndent(&buf, 2);
+    virBufferAsprintf(&buf, "<name>scale-%zu</name>\n", idx);
+    virBufferAsprintf(&buf, "<uuid>00000000-0000-0000-0000-%012zx</uuid>\n",
+                      idx);
+    virBufferAddLit(&buf, "<memory unit='MiB'>1024</memory>\n");
+    virBufferAddLit(&buf, "<vcpu>2</vcpu>\n");
+    virBufferAddLit(&buf, "<os><type>hvm</type></os>\n");
+    virBufferAddLit(&buf, "<devices>\n");
+    virBufferAdjustIndent(&buf, 2);
+    for (i = 0; i < disks; i++) {
+        if (!(dev = virIndexToDiskName(i, "vd")))
+            goto cleanup;
+        virBufferAddLit(&buf, "<disk type='file' device='disk'>\n");
+        virBufferAsprintf(&buf, "  <source file='/var/lib/libvirt/images/"
+                          "scale-%zu-%s.img'/>\n", idx, dev);
+        virBufferAsprintf(&buf, "  <target dev='%s' bus='virtio'/>\n", dev);
+        virBufferAddLit(&buf, "</disk>\n");
+        VIR_FREE(dev);
+    }
+    virBufferAdjustIndent(&buf, -2);
+    virBufferAddLit(&buf, "</devices>\n");
+    virBufferAdjustIndent(&buf, -2);
+    virBufferAddLit(&buf, "</domain>\n");
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+    xml = virBufferContentAndReset(&buf);
+
+    if (!(def = virDomainDefParseString(xml, privconn->caps, privconn->xmlopt,
+                                        NULL, VIR_DOMAIN_DEF_PARSE_INACTIVE)))
+        goto cleanup;
+
+    if (!(obj = virDomainObjListAdd(privconn->domains, def, privconn->xmlopt,
+                                    0, NULL)))
+        goto cleanup;
+    def = NULL;
+
+    obj->persistent = 1;
+    if (testDomainStartState(privconn, obj, VIR_DOMAIN_RUNNING_BOOTED) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    if (obj)
+        virObjectUnlock(obj);
+    virDomainDefFree(def);
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(xml);
+    return ret;
+}
+
+/* test:///scale?domains=N&disks=N&events_per_sec=N&latency=MS generates
+ * a large population of running domains for load tests of the layers
+ * above the driver. Like for connections initialized from a file, the
+ * state is not shared with other connections. */
+static int
+testOpenScale(virConnectPtr conn)
+{
+    testDriverPtr privconn;
+    unsigned int disks;
+    unsigned int eventsPerSec;
+    unsigned int period;
+    size_t i;
+
+    if (!(privconn = testDriverNew()))
+        return VIR_DRV_OPEN_ERROR;
+
+    testDriverLock(privconn);
+    conn->privateData = privconn;
+
+    if (testOpenScaleParams(privconn, conn->uri, &disks, &eventsPerSec) < 0)
+        goto error;
+
+    memmove(&privconn->nodeInfo, &defaultNodeInfo, sizeof(defaultNodeInfo));
+
+    if (!(privconn->caps = testBuildCapabilities(conn)))
+        goto error;
+
+    for (i = 0; i < privconn->scaleDomains; i++) {
+        if (testOpenScaleDomain(privconn, i, disks) < 0)
+            goto error;
+    }
+
+    if (eventsPerSec) {
+        if (eventsPerSec * TEST_SCALE_EVENT_TICK >= 1000) {
+            period = TEST_SCALE_EVENT_TICK;
+            privconn->scaleEventBurst = eventsPerSec * TEST_SCALE_EVENT_TICK / 1000;
+        } else {
+            period = 1000 / eventsPerSec;
+            privconn->scaleEventBurst = 1;
+        }
+
+        if ((privconn->scaleEventTimer =
+             virEventAddTimeout(period, testScaleEventTimer, privconn,
+                                testScaleEventTimerFree)) < 0) {
+            virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                           _("events of test:///scale need an event loop"));
+            goto error;
+        }
+    }
+
+    testDriverUnlock(privconn);
+
+    return VIR_DRV_OPEN_SUCCESS;
+
+ error:
+    testDriverFree(privconn);
+    conn->privateData = NULL;
+    return VIR_DRV_OPEN_ERROR;
+}
+
 static int
 testConnectAuthenticate(virConnectPtr conn,
                         virConnectAuthPtr auth)
@@ -1450,6 +1712,8 @@ static virDrvOpenStatus testConnectOpen(virConnectPtr conn,
 
     if (STREQ(conn->uri->path, "/default"))
         ret = testOpenDefault(conn);
+    else if (STREQ(conn->uri->path, "/scale"))
+        ret = testOpenScale(conn);
     else
         ret = testOpenFromFile(conn,
                                conn->uri->path);
@@ -1479,7 +1743,14 @@ static int testConnectClose(virConnectPtr conn)
     }
 
     testDriverLock(privconn);
-    testDriverFree(privconn);
+    if (privconn->scaleEventTimer != -1) {
+        /* The timer may still be running, it frees the driver once it
+         * is removed for sure */
+        virEventRemoveTimeout(privconn->scaleEventTimer);
+        testDriverUnlock(privconn);
+    } else {
+        testDriverFree(privconn);
+    }
 
     if (dflt) {
         defaultConn = NULL;
@@ -1539,6 +1810,19 @@ testConnectBaselineCPU(virConnectPtr conn ATTRIBUTE_UNUSED,
     return cpu;
 }
 
+static int
+testConnectCompareCPUs(virConnectPtr conn ATTRIBUTE_UNUSED,
+                       const char **xmlCPUs,
+                       unsigned int ncpus,
+                       int *results,
+                       char **baseline,
+                       unsigned int flags)
+{
+    virCheckFlags(VIR_CONNECT_BASELINE_CPU_EXPAND_FEATURES, -1);
+
+    return virCPUCompareMatrixXML(xmlCPUs, ncpus, results, baseline, flags);
+}
+
 static int testNodeGetInfo(virConnectPtr conn,
                            virNodeInfoPtr info)
 {
@@ -1590,6 +1874,8 @@ static int testConnectNumOfDomains(virConnectPtr conn)
     testDriverPtr privconn = conn->privateData;
     int count;
 
+    testScaleDelay(privconn);
+
     testDriverLock(privconn);
     count = virDomainObjListNumOfDomains(privconn->domains, true, NULL, NULL);
     testDriverUnlock(privconn);
@@ -1750,6 +2036,8 @@ static int testConnectListDomains(virConnectPtr conn,
 {
     testDriverPtr privconn = conn->privateData;
 
+    testScaleDelay(privconn);
+
     return virDomainObjListGetActiveIDs(privconn->domains, ids, maxids,
                                         NULL, NULL);
 }
@@ -5914,10 +6202,211 @@ static int testConnectListAllDomains(virConnectPtr conn,
 
     virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ALL, -1);
 
+    testScaleDelay(privconn);
+
     return virDomainObjListExport(privconn->domains, conn, domains,
                                   NULL, flags);
 }
 
+static int
+testConnectListAllDomainsFields(virConnectPtr conn,
+                                unsigned int fields,
+                                virDomainStatsRecordPtr **records,
+                                unsigned int flags)
+{
+    testDriverPtr privconn = conn->privateData;
+
+    virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ALL, -1);
+
+    testScaleDelay(privconn);
+
+    return virDomainObjListExportFields(privconn->domains, conn, fields,
+                                        records, NULL, flags);
+}
+
+#define TEST_DOMAIN_STATS_SUPPORTED (VIR_DOMAIN_STATS_STATE | \
+                                     VIR_DOMAIN_STATS_CPU_TOTAL | \
+                                     VIR_DOMAIN_STATS_BALLOON | \
+                                     VIR_DOMAIN_STATS_VCPU | \
+                                     VIR_DOMAIN_STATS_BLOCK)
+
+/* Like the other statistics of the test driver, the counters only grow
+ * with the time of day so that consecutive calls see some activity */
+static int
+testDomainGetStatsOne(virConnectPtr conn,
+                      virDomainObjPtr dom,
+                      unsigned int stats,
+                      unsigned long long statbase,
+                      virDomainStatsRecordPtr *record)
+{
+    virDomainStatsRecordPtr tmp = NULL;
+    int maxparams = 0;
+    bool active = virDomainObjIsActive(dom);
+    unsigned long long base = statbase + dom->def->id * 1000;
+    char name[VIR_TYPED_PARAM_FIELD_LENGTH];
+    size_t i;
+    int state;
+    int reason;
+
+    if (VIR_ALLOC(tmp) < 0)
+        goto error;
+
+    if (!(tmp->dom = virGetDomain(conn, dom->def->name, dom->def->uuid,
+                                  dom->def->id)))
+        goto error;
+
+#define TEST_ADD_PARAM(type, ...) \
+    do { \
+        if (virTypedParamsAdd ## type(&tmp->params, &tmp->nparams, \
+                                      &maxparams, __VA_ARGS__) < 0) \
+            goto error; \
+    } while (0)
+
+    if (stats & VIR_DOMAIN_STATS_STATE) {
+        state = virDomainObjGetState(dom, &reason);
+        TEST_ADD_PARAM(Int, "state.state", state);
+        TEST_ADD_PARAM(Int, "state.reason", reason);
+    }
+
+    if (stats & VIR_DOMAIN_STATS_CPU_TOTAL && active) {
+        TEST_ADD_PARAM(ULLong, "cpu.time", base * 1000);
+        TEST_ADD_PARAM(ULLong, "cpu.user", base * 700);
+        TEST_ADD_PARAM(ULLong, "cpu.system", base * 200);
+    }
+
+    if (stats & VIR_DOMAIN_STATS_BALLOON) {
+        TEST_ADD_PARAM(ULLong, "balloon.current", dom->def->mem.cur_balloon);
+        TEST_ADD_PARAM(ULLong, "balloon.maximum",
+                       virDomainDefGetMemoryTotal(dom->def));
+    }
+
+    if (stats & VIR_DOMAIN_STATS_VCPU) {
+        TEST_ADD_PARAM(UInt, "vcpu.current", virDomainDefGetVcpus(dom->def));
+        TEST_ADD_PARAM(UInt, "vcpu.maximum",
+                       virDomainDefGetVcpusMax(dom->def));
+    }
+
+    if (stats & VIR_DOMAIN_STATS_BLOCK && active) {
+        TEST_ADD_PARAM(UInt, "block.count", dom->def->ndisks);
+
+        for (i = 0; i < dom->def->ndisks; i++) {
+            virDomainDiskDefPtr disk = dom->def->disks[i];
+            const char *path = virDomainDiskGetSource(disk);
+
+#define TEST_ADD_BLOCK_PARAM(type, field, value) \
+    do { \
+        snprintf(name, sizeof(name), "block.%zu.%s", i, field); \
+        TEST_ADD_PARAM(type, name, value); \
+    } while (0)
+
+            TEST_ADD_BLOCK_PARAM(String, "name", disk->dst);
+            if (path)
+                TEST_ADD_BLOCK_PARAM(String, "path", path);
+            TEST_ADD_BLOCK_PARAM(ULLong, "rd.reqs", (base + i) / 10);
+            TEST_ADD_BLOCK_PARAM(ULLong, "rd.bytes", (base + i) / 20 * 512);
+            TEST_ADD_BLOCK_PARAM(ULLong, "wr.reqs", (base + i) / 30);
+            TEST_ADD_BLOCK_PARAM(ULLong, "wr.bytes", (base + i) / 40 * 512);
+#undef TEST_ADD_BLOCK_PARAM
+        }
+    }
+
+#undef TEST_ADD_PARAM
+
+    *record = tmp;
+    return 0;
+
+ error:
+    if (tmp) {
+        virTypedParamsFree(tmp->params, tmp->nparams);
+        virObjectUnref(tmp->dom);
+        VIR_FREE(tmp);
+    }
+    return -1;
+}
+
+static int
+testConnectGetAllDomainStats(virConnectPtr conn,
+                             virDomainPtr *doms,
+                             unsigned int ndoms,
+                             unsigned int stats,
+                             virDomainStatsRecordPtr **retStats,
+                             unsigned int flags)
+{
+    testDriverPtr privconn = conn->privateData;
+    virDomainObjPtr *vms = NULL;
+    size_t nvms;
+    virDomainStatsRecordPtr *tmpstats = NULL;
+    bool enforce = !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS);
+    unsigned int lflags = flags & (VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                                   VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
+                                   VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE);
+    struct timeval tv;
+    int nstats = 0;
+    size_t i;
+    int ret = -1;
+
+    virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                  VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
+                  VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE |
+                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
+
+    if (!stats) {
+        stats = TEST_DOMAIN_STATS_SUPPORTED;
+    } else if (stats & ~TEST_DOMAIN_STATS_SUPPORTED) {
+        if (enforce) {
+            virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
+                           _("Stats types bits 0x%x are not supported by "
+                             "this daemon"),
+                           stats & ~TEST_DOMAIN_STATS_SUPPORTED);
+            return -1;
+        }
+        stats &= TEST_DOMAIN_STATS_SUPPORTED;
+    }
+
+    testScaleDelay(privconn);
+
+    if (gettimeofday(&tv, NULL) < 0) {
+        virReportSystemError(errno, "%s", _("getting time of day"));
+        return -1;
+    }
+
+    if (ndoms) {
+        if (virDomainObjListConvert(privconn->domains, conn, doms, ndoms, &vms,
+                                    &nvms, NULL, lflags, true) < 0)
+            return -1;
+    } else {
+        if (virDomainObjListCollect(privconn->domains, conn, &vms, &nvms,
+                                    NULL, lflags) < 0)
+            return -1;
+    }
+
+    if (VIR_ALLOC_N(tmpstats, nvms + 1) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nvms; i++) {
+        int rc;
+
+        virObjectLock(vms[i]);
+        rc = testDomainGetStatsOne(conn, vms[i], stats,
+                                   tv.tv_sec * 1000ULL + tv.tv_usec / 1000,
+                                   &tmpstats[nstats]);
+        virObjectUnlock(vms[i]);
+
+        if (rc < 0)
+            goto cleanup;
+        nstats++;
+    }
+
+    *retStats = tmpstats;
+    tmpstats = NULL;
+    ret = nstats;
+
+ cleanup:
+    virDomainStatsRecordListFree(tmpstats);
+    virObjectListFreeCount(vms, nvms);
+    return ret;
+}
+
 static int
 testNodeGetCPUMap(virConnectPtr conn ATTRIBUTE_UNUSED,
                   unsigned char **cpumap,
@@ -6521,10 +7010,7 @@ testDomainSnapshotCreateXML(virDomainPtr domain,
                 vm->current_snapshot = snap;
             other = virDomainSnapshotFindByName(vm->snapshots,
                                                 snap->def->parent);
-            snap->parent = other;
-            other->nchildren++;
-            snap->sibling = other->first_child;
-            other->first_child = snap;
+            virDomainSnapshotSetParent(snap, other);
         }
         virDomainObjEndAPI(&vm);
     }
@@ -6561,7 +7047,6 @@ struct _testSnapReparentData {
     virDomainSnapshotObjPtr parent;
     virDomainObjPtr vm;
     int err;
-    virDomainSnapshotObjPtr last;
 };
 
 static int
@@ -6584,8 +7069,6 @@ testDomainSnapshotReparentChildren(void *payload,
         return 0;
     }
 
-    if (!snap->sibling)
-        rep->last = snap;
     return 0;
 }
 
@@ -6625,7 +7108,6 @@ testDomainSnapshotDelete(virDomainSnapshotPtr snapshot,
         rep.parent = snap->parent;
         rep.vm = vm;
         rep.err = 0;
-        rep.last = NULL;
         virDomainSnapshotForEachChild(snap,
                                       testDomainSnapshotReparentChildren,
                                       &rep);
@@ -6633,14 +7115,11 @@ testDomainSnapshotDelete(virDomainSnapshotPtr snapshot,
             goto cleanup;
 
         /* Can't modify siblings during ForEachChild, so do it now.  */
-        snap->parent->nchildren += snap->nchildren;
-        rep.last->sibling = snap->parent->first_child;
-        snap->parent->first_child = snap->first_child;
+        virDomainSnapshotMoveChildren(snap, snap->parent);
     }
 
     if (flags & VIR_DOMAIN_SNAPSHOT_DELETE_CHILDREN_ONLY) {
-        snap->nchildren = 0;
-        snap->first_child = NULL;
+        virDomainSnapshotDropChildren(snap);
     } else {
         virDomainSnapshotDropParent(snap);
         if (snap == vm->current_snapshot) {
@@ -6892,6 +7371,8 @@ static virHypervisorDriver testHypervisorDriver = {
     .connectListDomains = testConnectListDomains, /* 0.1.1 */
     .connectNumOfDomains = testConnectNumOfDomains, /* 0.1.1 */
     .connectListAllDomains = testConnectListAllDomains, /* 0.9.13 */
+    .connectListAllDomainsFields = testConnectListAllDomainsFields, /* 3.3.0 */
+    .connectGetAllDomainStats = testConnectGetAllDomainStats, /* 3.3.0 */
     .domainCreateXML = testDomainCreateXML, /* 0.1.4 */
     .domainLookupByID = testDomainLookupByID, /* 0.1.1 */
     .domainLookupByUUID = testDomainLookupByUUID, /* 0.1.1 */
@@ -6977,6 +7458,7 @@ static virHypervisorDriver testHypervisorDriver = {
     .domainSnapshotDelete = testDomainSnapshotDelete, /* 1.1.4 */
 
     .connectBaselineCPU = testConnectBaselineCPU, /* 1.2.0 */
+    .connectCompareCPUs = testConnectCompareCPUs, /* 3.3.0 */
 };
 
 static virNetworkDriver testNetworkDriver = {
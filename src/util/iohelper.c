@@ -40,6 +40,7 @@
 #include "virrandom.h"
 #include "virstring.h"
 #include "virgettext.h"
+#include "virfdstream.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -72,12 +73,227 @@ prepare(const char *path, int oflags, int mode,
     return fd;
 }
 
+/* Copies @path to @fdout as a sequence of data and hole messages
+ * which virFDStream knows how to decode. */
 static int
-runIO(const char *path, int fd, int oflags, unsigned long long length)
+runIOReadSparse(const char *path, int fd, int fdout, const char *fdoutname,
+                char *buf, size_t buflen, unsigned long long length)
 {
-    void *base = NULL; /* Location to be freed */
-    char *buf = NULL; /* Aligned location within base */
-    size_t buflen = 1024*1024;
+    unsigned long long total = 0;
+
+    while (!length || total < length) {
+        virFDStreamMsgHeader msg;
+        int inData;
+        long long sectionLen;
+        ssize_t got;
+
+        if (virFileInData(fd, &inData, &sectionLen) < 0)
+            return -1;
+
+        if (length && (length - total) < (unsigned long long) sectionLen)
+            sectionLen = length - total;
+
+        if (sectionLen == 0)
+            break; /* End of file */
+
+        memset(&msg, 0, sizeof(msg));
+
+        if (!inData) {
+            msg.type = VIR_FDSTREAM_MSG_TYPE_HOLE;
+            msg.length = sectionLen;
+
+            if (lseek(fd, sectionLen, SEEK_CUR) == (off_t) -1) {
+                virReportSystemError(errno, _("Unable to seek %s"), path);
+                return -1;
+            }
+            if (safewrite(fdout, &msg, sizeof(msg)) < 0) {
+                virReportSystemError(errno, _("Unable to write %s"), fdoutname);
+                return -1;
+            }
+            total += sectionLen;
+            continue;
+        }
+
+        if ((got = saferead(fd, buf, MIN(buflen, sectionLen))) < 0) {
+            virReportSystemError(errno, _("Unable to read %s"), path);
+            return -1;
+        }
+        if (got == 0)
+            break; /* File shrunk underneath us */
+
+        msg.type = VIR_FDSTREAM_MSG_TYPE_DATA;
+        msg.length = got;
+
+        if (safewrite(fdout, &msg, sizeof(msg)) < 0 ||
+            safewrite(fdout, buf, got) < 0) {
+            virReportSystemError(errno, _("Unable to write %s"), fdoutname);
+            return -1;
+        }
+        total += got;
+    }
+
+    return 0;
+}
+
+/* Decodes the data and hole messages coming from virFDStream on
+ * @fdin, writing the data to @path and making holes in it. */
+static int
+runIOWriteSparse(const char *path, int fd, int fdin, const char *fdinname,
+                 char *buf, size_t buflen, unsigned long long length)
+{
+    unsigned long long total = 0;
+
+    while (1) {
+        virFDStreamMsgHeader msg;
+        unsigned long long left;
+        ssize_t got;
+
+        if ((got = saferead(fdin, &msg, sizeof(msg))) < 0) {
+            virReportSystemError(errno, _("Unable to read %s"), fdinname);
+            return -1;
+        }
+        if (got == 0)
+            break; /* End of stream */
+        if (got != sizeof(msg)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Truncated message header on %s"), fdinname);
+            return -1;
+        }
+
+        if (length && (length - total) < msg.length) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Too much data for %s"), path);
+            return -1;
+        }
+
+        switch ((virFDStreamMsgType) msg.type) {
+        case VIR_FDSTREAM_MSG_TYPE_HOLE:
+            if (virFilePunchHole(fd, msg.length) < 0)
+                return -1;
+            break;
+
+        case VIR_FDSTREAM_MSG_TYPE_DATA:
+            left = msg.length;
+            while (left) {
+                size_t want = MIN(buflen, left);
+
+                if ((got = saferead(fdin, buf, want)) < 0) {
+                    virReportSystemError(errno, _("Unable to read %s"),
+                                         fdinname);
+                    return -1;
+                }
+                if (got != want) {
+                    virReportError(VIR_ERR_INTERNAL_ERROR,
+                                   _("Truncated message on %s"), fdinname);
+                    return -1;
+                }
+                if (safewrite(fd, buf, got) < 0) {
+                    virReportSystemError(errno, _("Unable to write %s"), path);
+                    return -1;
+                }
+                left -= got;
+            }
+            break;
+
+        case VIR_FDSTREAM_MSG_TYPE_LAST:
+        default:
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Unknown message type %u on %s"),
+                           msg.type, fdinname);
+            return -1;
+        }
+
+        total += msg.length;
+    }
+
+    return 0;
+}
+
+/* The dense copy is a pipeline: a thread reads ahead into a ring of
+ * buffers, @count of them from @head on being filled, while runIO
+ * writes them out. */
+typedef struct _runIOBuffer runIOBuffer;
+struct _runIOBuffer {
+    char *data;
+    size_t want;    /* bytes requested from the input */
+    ssize_t got;    /* bytes read, 0 on EOF, -1 on error */
+    int err;
+};
+
+typedef struct _runIOPipeline runIOPipeline;
+struct _runIOPipeline {
+    virMutex lock;
+    virCond cond;
+
+    int fdin;
+    unsigned long long length;
+
+    runIOBuffer *bufs;
+    size_t nbufs;
+    size_t buflen;
+    size_t head;
+    size_t count;
+
+    bool quit;
+    bool done;      /* the reader thread finished */
+};
+
+static void
+runIOReader(void *opaque)
+{
+    runIOPipeline *pipeline = opaque;
+    unsigned long long total = 0;
+    runIOBuffer *buf;
+    size_t want;
+    ssize_t got;
+    int err;
+
+    virMutexLock(&pipeline->lock);
+
+    while (!pipeline->quit) {
+        if (pipeline->count == pipeline->nbufs) {
+            if (virCondWait(&pipeline->cond, &pipeline->lock) < 0)
+                break;
+            continue;
+        }
+
+        buf = &pipeline->bufs[(pipeline->head + pipeline->count) %
+                              pipeline->nbufs];
+        virMutexUnlock(&pipeline->lock);
+
+        want = pipeline->buflen;
+        if (pipeline->length &&
+            (pipeline->length - total) < want)
+            want = pipeline->length - total;
+
+        /* End of requested data from client */
+        got = want ? saferead(pipeline->fdin, buf->data, want) : 0;
+        err = errno;
+
+        virMutexLock(&pipeline->lock);
+        buf->want = want;
+        buf->got = got;
+        buf->err = err;
+        pipeline->count++;
+        virCondSignal(&pipeline->cond);
+
+        if (got <= 0)
+            break;
+        total += got;
+    }
+
+    pipeline->done = true;
+    virCondSignal(&pipeline->cond);
+    virMutexUnlock(&pipeline->lock);
+}
+
+static int
+runIO(const char *path, int fd, int oflags, unsigned long long length,
+      bool sparse, size_t buflen, size_t nbufs)
+{
+    runIOPipeline pipeline;
+    virThread reader;
+    bool running = false;
     intptr_t alignMask = 64*1024 - 1;
     int ret = -1;
     int fdin, fdout;
@@ -86,19 +302,48 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
     bool direct = O_DIRECT && ((oflags & O_DIRECT) != 0);
     bool shortRead = false; /* true if we hit a short read */
     off_t end = 0;
+    size_t i;
 
-#if HAVE_POSIX_MEMALIGN
-    if (posix_memalign(&base, alignMask + 1, buflen)) {
-        virReportOOMError();
-        goto cleanup;
+    memset(&pipeline, 0, sizeof(pipeline));
+
+    /* O_DIRECT needs whole aligned blocks */
+    buflen = VIR_ROUND_UP(buflen, alignMask + 1);
+
+    if (virMutexInit(&pipeline.lock) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to initialize mutex"));
+        return -1;
     }
-    buf = base;
-#else
-    if (VIR_ALLOC_N(buf, buflen + alignMask) < 0)
+    if (virCondInit(&pipeline.cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize condition variable"));
+        virMutexDestroy(&pipeline.lock);
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(pipeline.bufs, nbufs) < 0)
         goto cleanup;
-    base = buf;
-    buf = (char *) (((intptr_t) base + alignMask) & ~alignMask);
+    pipeline.nbufs = nbufs;
+    pipeline.buflen = buflen;
+
+    for (i = 0; i < nbufs; i++) {
+#if HAVE_POSIX_MEMALIGN
+        void *base;
+
+        if (posix_memalign(&base, alignMask + 1, buflen)) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        pipeline.bufs[i].data = base;
+#else
+        if (direct) {
+            virReportSystemError(ENOSYS, "%s",
+                                 _("O_DIRECT needs aligned buffers"));
+            goto cleanup;
+        }
+        if (VIR_ALLOC_N(pipeline.bufs[i].data, buflen) < 0)
+            goto cleanup;
 #endif
+    }
 
     switch (oflags & O_ACCMODE) {
     case O_RDONLY:
@@ -136,23 +381,63 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         goto cleanup;
     }
 
+    if (sparse) {
+        if (direct) {
+            virReportSystemError(EINVAL, "%s",
+                                 _("O_DIRECT cannot be used with sparse streams"));
+            goto cleanup;
+        }
+
+        if (fdin == fd) {
+            if (runIOReadSparse(path, fd, fdout, fdoutname,
+                                pipeline.bufs[0].data, buflen, length) < 0)
+                goto cleanup;
+        } else {
+            if (runIOWriteSparse(path, fd, fdin, fdinname,
+                                 pipeline.bufs[0].data, buflen, length) < 0)
+                goto cleanup;
+        }
+        goto sync;
+    }
+
+    pipeline.fdin = fdin;
+    pipeline.length = length;
+    if (virThreadCreate(&reader, true, runIOReader, &pipeline) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to create thread"));
+        goto cleanup;
+    }
+    running = true;
+
     while (1) {
+        runIOBuffer *buf;
         ssize_t got;
 
-        if (length &&
-            (length - total) < buflen)
-            buflen = length - total;
-
-        if (buflen == 0)
-            break; /* End of requested data from client */
+        virMutexLock(&pipeline.lock);
+        while (pipeline.count == 0 && !pipeline.done) {
+            if (virCondWait(&pipeline.cond, &pipeline.lock) < 0) {
+                virMutexUnlock(&pipeline.lock);
+                virReportSystemError(errno, "%s",
+                                     _("Unable to wait on condition"));
+                goto cleanup;
+            }
+        }
+        if (pipeline.count == 0) {
+            virMutexUnlock(&pipeline.lock);
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Unable to read %s"), fdinname);
+            goto cleanup;
+        }
+        buf = &pipeline.bufs[pipeline.head];
+        virMutexUnlock(&pipeline.lock);
 
-        if ((got = saferead(fdin, buf, buflen)) < 0) {
-            virReportSystemError(errno, _("Unable to read %s"), fdinname);
+        got = buf->got;
+        if (got < 0) {
+            virReportSystemError(buf->err, _("Unable to read %s"), fdinname);
             goto cleanup;
         }
         if (got == 0)
-            break; /* End of file before end of requested data */
-        if (got < buflen || (buflen & alignMask)) {
+            break; /* End of file or of requested data */
+        if (got < buf->want || (buf->want & alignMask)) {
             /* O_DIRECT can handle at most one short read, at end of file */
             if (direct && shortRead) {
                 virReportSystemError(EINVAL, "%s",
@@ -164,10 +449,10 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         total += got;
         if (fdout == fd && direct && shortRead) {
             end = total;
-            memset(buf + got, 0, buflen - got);
+            memset(buf->data + got, 0, buf->want - got);
             got = (got + alignMask) & ~alignMask;
         }
-        if (safewrite(fdout, buf, got) < 0) {
+        if (safewrite(fdout, buf->data, got) < 0) {
             virReportSystemError(errno, _("Unable to write %s"), fdoutname);
             goto cleanup;
         }
@@ -175,8 +460,15 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
             virReportSystemError(errno, _("Unable to truncate %s"), fdoutname);
             goto cleanup;
         }
+
+        virMutexLock(&pipeline.lock);
+        pipeline.head = (pipeline.head + 1) % pipeline.nbufs;
+        pipeline.count--;
+        virCondSignal(&pipeline.cond);
+        virMutexUnlock(&pipeline.lock);
     }
 
+ sync:
     /* Ensure all data is written */
     if (fdatasync(fdout) < 0) {
         if (errno != EINVAL && errno != EROFS) {
@@ -189,18 +481,59 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
     ret = 0;
 
  cleanup:
+    if (running) {
+        virMutexLock(&pipeline.lock);
+        pipeline.quit = true;
+        virCondSignal(&pipeline.cond);
+        running = !pipeline.done;
+        virMutexUnlock(&pipeline.lock);
+
+        if (running) {
+            /* The reader may be blocked on input which never comes,
+             * don't wait for it as the process exits on error anyway */
+            return -1;
+        }
+        virThreadJoin(&reader);
+    }
+
     if (VIR_CLOSE(fd) < 0 &&
         ret == 0) {
         virReportSystemError(errno, _("Unable to close %s"), path);
         ret = -1;
     }
 
-    VIR_FREE(base);
+    for (i = 0; i < pipeline.nbufs; i++)
+        VIR_FREE(pipeline.bufs[i].data);
+    VIR_FREE(pipeline.bufs);
+    virCondDestroy(&pipeline.cond);
+    virMutexDestroy(&pipeline.lock);
     return ret;
 }
 
 static const char *program_name;
 
+/* Reads the size_t value of the environment variable @name into
+ * @value, leaving it alone if the variable is not set. */
+static int
+getEnvSize(const char *name, size_t *value)
+{
+    const char *str = virGetEnvBlockSUID(name);
+    unsigned long long tmp;
+
+    if (!str)
+        return 0;
+
+    if (virStrToLong_ullp(str, NULL, 10, &tmp) < 0 ||
+        tmp == 0 || tmp > INT_MAX) {
+        fprintf(stderr, _("%s: malformed %s %s"),
+                program_name, name, str);
+        return -1;
+    }
+
+    *value = tmp;
+    return 0;
+}
+
 ATTRIBUTE_NORETURN static void
 usage(int status)
 {
@@ -208,7 +541,7 @@ usage(int status)
         fprintf(stderr, _("%s: try --help for more details"), program_name);
     } else {
         printf(_("Usage: %s FILENAME OFLAGS MODE OFFSET LENGTH DELETE\n"
-                 "   or: %s FILENAME LENGTH FD\n"),
+                 "   or: %s FILENAME LENGTH FD [SPARSE]\n"),
                program_name, program_name);
     }
     exit(status);
@@ -225,6 +558,9 @@ main(int argc, char **argv)
     unsigned int delete = 0;
     int fd = -1;
     int lengthIndex = 0;
+    unsigned int sparse = 0;
+    size_t buflen = 1024 * 1024;
+    size_t nbufs = 2;
 
     program_name = argv[0];
 
@@ -262,13 +598,18 @@ main(int argc, char **argv)
             exit(EXIT_FAILURE);
         }
         fd = prepare(path, oflags, mode, offset);
-    } else if (argc == 4) { /* FILENAME LENGTH FD */
+    } else if (argc == 4 || argc == 5) { /* FILENAME LENGTH FD [SPARSE] */
         lengthIndex = 2;
         if (virStrToLong_i(argv[3], NULL, 10, &fd) < 0) {
             fprintf(stderr, _("%s: malformed fd %s"),
                     program_name, argv[3]);
             exit(EXIT_FAILURE);
         }
+        if (argc == 5 && virStrToLong_ui(argv[4], NULL, 10, &sparse) < 0) {
+            fprintf(stderr, _("%s: malformed sparse flag %s"),
+                    program_name, argv[4]);
+            exit(EXIT_FAILURE);
+        }
 #ifdef F_GETFL
         oflags = fcntl(fd, F_GETFL);
 #else
@@ -293,7 +634,12 @@ main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    if (fd < 0 || runIO(path, fd, oflags, length) < 0)
+    if (getEnvSize("LIBVIRT_IOHELPER_BUFFER_SIZE", &buflen) < 0 ||
+        getEnvSize("LIBVIRT_IOHELPER_BUFFERS", &nbufs) < 0)
+        exit(EXIT_FAILURE);
+
+    if (fd < 0 ||
+        runIO(path, fd, oflags, length, sparse, buflen, nbufs) < 0)
         goto error;
 
     if (delete)
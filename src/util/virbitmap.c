@@ -34,6 +34,7 @@
 #include "viralloc.h"
 #include "virbuffer.h"
 #include "c-ctype.h"
+#include "count-leading-zeros.h"
 #include "count-one-bits.h"
 #include "virstring.h"
 #include "virerror.h"
@@ -265,6 +266,32 @@ int virBitmapClearBitExpand(virBitmapPtr bitmap, size_t b)
 }
 
 
+/* Sets the bits from @start to @last, both included, a unit at a time.
+ * Caller must ensure start <= last < bitmap->max_bit */
+static void
+virBitmapSetRange(virBitmapPtr bitmap,
+                  size_t start,
+                  size_t last)
+{
+    size_t first = VIR_BITMAP_UNIT_OFFSET(start);
+    size_t end = VIR_BITMAP_UNIT_OFFSET(last);
+    unsigned long startMask = ~(VIR_BITMAP_BIT(start) - 1);
+    unsigned long lastMask = -1UL >> (VIR_BITMAP_BITS_PER_UNIT - 1 -
+                                      VIR_BITMAP_BIT_OFFSET(last));
+    size_t i;
+
+    if (first == end) {
+        bitmap->map[first] |= startMask & lastMask;
+        return;
+    }
+
+    bitmap->map[first] |= startMask;
+    for (i = first + 1; i < end; i++)
+        bitmap->map[i] = -1UL;
+    bitmap->map[end] |= lastMask;
+}
+
+
 /* Helper function. caller must ensure b < bitmap->max_bit */
 static bool virBitmapIsSet(virBitmapPtr bitmap, size_t b)
 {
@@ -357,37 +384,28 @@ char *virBitmapString(virBitmapPtr bitmap)
 char *virBitmapFormat(virBitmapPtr bitmap)
 {
     virBuffer buf = VIR_BUFFER_INITIALIZER;
-    bool first = true;
-    int start, cur, prev;
+    ssize_t start;
+    ssize_t end;
 
-    if (!bitmap || (cur = virBitmapNextSetBit(bitmap, -1)) < 0) {
+    if (!bitmap || (start = virBitmapNextSetBit(bitmap, -1)) < 0) {
         char *ret;
         ignore_value(VIR_STRDUP(ret, ""));
         return ret;
     }
 
-    start = prev = cur;
-    while (prev >= 0) {
-        cur = virBitmapNextSetBit(bitmap, prev);
-
-        if (cur == prev + 1) {
-            prev = cur;
-            continue;
-        }
-
-        /* cur < 0 or cur > prev + 1 */
-
-        if (!first)
-            virBufferAddLit(&buf, ",");
-        else
-            first = false;
+    /* Both the start and the end of each run of set bits are searched
+     * for a unit at a time rather than bit by bit */
+    while (start >= 0) {
+        if ((end = virBitmapNextClearBit(bitmap, start)) < 0)
+            end = bitmap->max_bit;
 
-        if (prev == start)
-            virBufferAsprintf(&buf, "%d", start);
+        if (end == start + 1)
+            virBufferAsprintf(&buf, "%zd", start);
         else
-            virBufferAsprintf(&buf, "%d-%d", start, prev);
+            virBufferAsprintf(&buf, "%zd-%zd", start, end - 1);
 
-        start = prev = cur;
+        if ((start = virBitmapNextSetBit(bitmap, end)) >= 0)
+            virBufferAddLit(&buf, ",");
     }
 
     if (virBufferError(&buf)) {
@@ -430,7 +448,6 @@ virBitmapParseSeparator(const char *str,
     bool neg = false;
     const char *cur = str;
     char *tmp;
-    size_t i;
     int start, last;
 
     if (!(*bitmap = virBitmapNew(bitmapSize)))
@@ -485,15 +502,12 @@ virBitmapParseSeparator(const char *str,
 
             if (virStrToLong_i(cur, &tmp, 10, &last) < 0)
                 goto error;
-            if (last < start)
+            if (last < start || (size_t) last >= (*bitmap)->max_bit)
                 goto error;
 
             cur = tmp;
 
-            for (i = start; i <= last; i++) {
-                if (virBitmapSetBit(*bitmap, i) < 0)
-                    goto error;
-            }
+            virBitmapSetRange(*bitmap, start, last);
 
             virSkipSpaces(&cur);
         }
@@ -564,7 +578,6 @@ virBitmapParseUnlimited(const char *str)
     bool neg = false;
     const char *cur = str;
     char *tmp;
-    size_t i;
     int start, last;
 
     if (!(bitmap = virBitmapNewEmpty()))
@@ -624,10 +637,11 @@ virBitmapParseUnlimited(const char *str)
 
             cur = tmp;
 
-            for (i = start; i <= last; i++) {
-                if (virBitmapSetBitExpand(bitmap, i) < 0)
-                    goto error;
-            }
+            if (bitmap->max_bit <= (size_t) last &&
+                virBitmapExpand(bitmap, last) < 0)
+                goto error;
+
+            virBitmapSetRange(bitmap, start, last);
 
             virSkipSpaces(&cur);
         }
@@ -947,7 +961,6 @@ virBitmapNextSetBit(virBitmapPtr bitmap, ssize_t pos)
 ssize_t
 virBitmapLastSetBit(virBitmapPtr bitmap)
 {
-    ssize_t i;
     int unusedBits;
     ssize_t sz;
     unsigned long bits;
@@ -977,12 +990,8 @@ virBitmapLastSetBit(virBitmapPtr bitmap)
     return -1;
 
  found:
-    for (i = VIR_BITMAP_BITS_PER_UNIT - 1; i >= 0; i--) {
-        if (bits & 1UL << i)
-            return i + sz * VIR_BITMAP_BITS_PER_UNIT;
-    }
-
-    return -1;
+    return VIR_BITMAP_BITS_PER_UNIT - 1 - count_leading_zeros_l(bits) +
+           sz * VIR_BITMAP_BITS_PER_UNIT;
 }
 
 /**
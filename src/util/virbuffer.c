@@ -147,6 +147,11 @@ virBufferGrow(virBufferPtr buf, unsigned int len)
 
     size = buf->use + len + 1000;
 
+    /* grow geometrically so that building a large document piece by piece
+     * doesn't keep reallocating it */
+    if (buf->size < INT_MAX / 2 && size < buf->size * 2)
+        size = buf->size * 2;
+
     if (VIR_REALLOC_N_QUIET(buf->content, size) < 0) {
         virBufferSetError(buf, errno);
         return -1;
@@ -155,6 +160,24 @@ virBufferGrow(virBufferPtr buf, unsigned int len)
     return 0;
 }
 
+/**
+ * virBufferReserve:
+ * @buf: the buffer
+ * @len: number of bytes expected to be added
+ *
+ * Make room for @len more bytes in @buf so that the following additions
+ * of up to that many bytes don't need to reallocate it. This is just
+ * a hint and doesn't change the content of @buf.
+ */
+void
+virBufferReserve(virBufferPtr buf, unsigned int len)
+{
+    if (!buf)
+        return;
+
+    ignore_value(virBufferGrow(buf, len));
+}
+
 /**
  * virBufferAdd:
  * @buf: the buffer to append to
@@ -402,6 +425,12 @@ virBufferVasprintf(virBufferPtr buf, const char *format, va_list argptr)
     if (buf->error)
         return;
 
+    /* plain text needs no formatting */
+    if (!strchr(format, '%')) {
+        virBufferAdd(buf, format, -1);
+        return;
+    }
+
     virBufferAddLit(buf, ""); /* auto-indent */
 
     if (buf->size == 0 &&
@@ -441,6 +470,90 @@ virBufferVasprintf(virBufferPtr buf, const char *format, va_list argptr)
 VIR_WARNINGS_NO_WLOGICALOP_STRCHR
 
 
+/* Length of each character once escaped for XML. Characters copied as they
+ * are have 1, the forbidden control characters, which are silently dropped,
+ * and the terminating NUL have 0. Note that character over 0x80 are likely
+ * to give problem with UTF-8 XML, but since our string don't have an
+ * encoding it's hard to handle properly we have to assume it's UTF-8 too. */
+static const unsigned char virBufferXMLEscapeLen[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 1, 0, 0,  /* 0x00 */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1,  /* 0x10 */
+    1, 1, 6, 1, 1, 1, 5, 6, 1, 1, 1, 1, 1, 1, 1, 1,  /* 0x20 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 4, 1, 4, 1,  /* 0x30 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  /* 0x40 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  /* 0x50 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  /* 0x60 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  /* 0x70 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  /* 0x80 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  /* 0x90 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  /* 0xA0 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  /* 0xB0 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  /* 0xC0 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  /* 0xD0 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  /* 0xE0 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  /* 0xF0 */
+};
+
+/* Returns the length of @str escaped for XML */
+static size_t
+virBufferXMLEscapedLength(const char *str)
+{
+    const unsigned char *cur = (const unsigned char *) str;
+    size_t len = 0;
+
+    for (; *cur; cur++)
+        len += virBufferXMLEscapeLen[*cur];
+
+    return len;
+}
+
+/* Writes @str escaped for XML to @out, which must have room for
+ * virBufferXMLEscapedLength() bytes. Doesn't terminate @out. */
+static void
+virBufferXMLEscapeCopy(char *out, const char *str)
+{
+    const char *cur = str;
+
+    while (*cur) {
+        const char *run = cur;
+
+        /* copy the characters which don't need escaping at once */
+        while (virBufferXMLEscapeLen[(unsigned char) *cur] == 1)
+            cur++;
+        memcpy(out, run, cur - run);
+        out += cur - run;
+
+        switch (*cur) {
+        case '\0':
+            return;
+        case '<':
+            memcpy(out, "&lt;", 4);
+            out += 4;
+            break;
+        case '>':
+            memcpy(out, "&gt;", 4);
+            out += 4;
+            break;
+        case '&':
+            memcpy(out, "&amp;", 5);
+            out += 5;
+            break;
+        case '"':
+            memcpy(out, "&quot;", 6);
+            out += 6;
+            break;
+        case '\'':
+            memcpy(out, "&apos;", 6);
+            out += 6;
+            break;
+        default:
+            /* silently ignore control characters */
+            break;
+        }
+        cur++;
+    }
+}
+
 /**
  * virBufferEscapeString:
  * @buf: the buffer to append to
@@ -455,16 +568,10 @@ VIR_WARNINGS_NO_WLOGICALOP_STRCHR
 void
 virBufferEscapeString(virBufferPtr buf, const char *format, const char *str)
 {
-    int len;
-    char *escaped, *out;
-    const char *cur;
-    const char forbidden_characters[] = {
-        0x01,   0x02,   0x03,   0x04,   0x05,   0x06,   0x07,   0x08,
-        /*\t*/  /*\n*/  0x0B,   0x0C,   /*\r*/  0x0E,   0x0F,   0x10,
-        0x11,   0x12,   0x13,   0x14,   0x15,   0x16,   0x17,   0x18,
-        0x19,   '"',    '&',    '\'',   '<',    '>',
-        '\0'
-    };
+    const char *conv;
+    size_t len;
+    size_t suffixlen;
+    char *escaped;
 
     if ((format == NULL) || (buf == NULL) || (str == NULL))
         return;
@@ -472,65 +579,42 @@ virBufferEscapeString(virBufferPtr buf, const char *format, const char *str)
     if (buf->error)
         return;
 
-    len = strlen(str);
-    if (strcspn(str, forbidden_characters) == len) {
-        virBufferAsprintf(buf, format, str);
+    len = virBufferXMLEscapedLength(str);
+
+    /* Unless @format contains anything else than a single %s, the escaped
+     * string is written right into the buffer together with the text
+     * around the conversion. */
+    if ((conv = strstr(format, "%s")) &&
+        !memchr(format, '%', conv - format) &&
+        !strchr(conv + 2, '%')) {
+        suffixlen = strlen(conv + 2);
+
+        if (len > INT_MAX - suffixlen - 1) {
+            virBufferSetError(buf, ENOMEM);
+            return;
+        }
+
+        /* the text preceding the conversion, also applies auto-indent */
+        virBufferAdd(buf, format, conv - format);
+
+        if (virBufferGrow(buf, len + suffixlen + 1) < 0)
+            return;
+
+        virBufferXMLEscapeCopy(&buf->content[buf->use], str);
+        buf->use += len;
+        memcpy(&buf->content[buf->use], conv + 2, suffixlen);
+        buf->use += suffixlen;
+        buf->content[buf->use] = '\0';
         return;
     }
 
-    if (xalloc_oversized(6, len) ||
-        VIR_ALLOC_N_QUIET(escaped, 6 * len + 1) < 0) {
+    if (VIR_ALLOC_N_QUIET(escaped, len + 1) < 0) {
         virBufferSetError(buf, errno);
         return;
     }
 
-    cur = str;
-    out = escaped;
-    while (*cur != 0) {
-        if (*cur == '<') {
-            *out++ = '&';
-            *out++ = 'l';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '>') {
-            *out++ = '&';
-            *out++ = 'g';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '&') {
-            *out++ = '&';
-            *out++ = 'a';
-            *out++ = 'm';
-            *out++ = 'p';
-            *out++ = ';';
-        } else if (*cur == '"') {
-            *out++ = '&';
-            *out++ = 'q';
-            *out++ = 'u';
-            *out++ = 'o';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '\'') {
-            *out++ = '&';
-            *out++ = 'a';
-            *out++ = 'p';
-            *out++ = 'o';
-            *out++ = 's';
-            *out++ = ';';
-        } else if (!strchr(forbidden_characters, *cur)) {
-            /*
-             * default case, just copy !
-             * Note that character over 0x80 are likely to give problem
-             * with UTF-8 XML, but since our string don't have an encoding
-             * it's hard to handle properly we have to assume it's UTF-8 too
-             */
-            *out++ = *cur;
-        } else {
-            /* silently ignore control characters */
-        }
-        cur++;
-    }
-    *out = 0;
+    virBufferXMLEscapeCopy(escaped, str);
+    escaped[len] = '\0';
 
     virBufferAsprintf(buf, format, escaped);
     VIR_FREE(escaped);
@@ -81,6 +81,9 @@ VIR_ENUM_IMPL(virCgroupController, VIR_CGROUP_CONTROLLER_LAST,
               "freezer", "blkio", "net_cls", "perf_event",
               "name=systemd");
 
+VIR_ENUM_IMPL(virCgroupPressureResource, VIR_CGROUP_PRESSURE_LAST,
+              "cpu", "io", "memory");
+
 typedef enum {
     VIR_CGROUP_NONE = 0, /* create subdir under each cgroup if possible. */
     VIR_CGROUP_MEM_HIERACHY = 1 << 0, /* call virCgroupSetMemoryUseHierarchy
@@ -129,6 +132,20 @@ virCgroupGetDevicePermsString(int perms)
 
 
 #ifdef VIR_CGROUP_SUPPORTED
+/* The names of the controllers in the cgroup v2 unified hierarchy,
+ * "" for those whose files every group has and NULL for those with
+ * no v2 counterpart */
+static const char *virCgroupUnifiedControllers[VIR_CGROUP_CONTROLLER_LAST] = {
+    [VIR_CGROUP_CONTROLLER_CPU] = "cpu",
+    [VIR_CGROUP_CONTROLLER_CPUACCT] = "",
+    [VIR_CGROUP_CONTROLLER_CPUSET] = "cpuset",
+    [VIR_CGROUP_CONTROLLER_MEMORY] = "memory",
+    [VIR_CGROUP_CONTROLLER_BLKIO] = "io",
+    [VIR_CGROUP_CONTROLLER_PERF_EVENT] = "perf_event",
+    [VIR_CGROUP_CONTROLLER_SYSTEMD] = "",
+};
+
+
 bool
 virCgroupAvailable(void)
 {
@@ -145,9 +162,10 @@ virCgroupAvailable(void)
 
     while (getmntent_r(mounts, &entry, buf, sizeof(buf)) != NULL) {
         /* We're looking for at least one 'cgroup' fs mount,
-         * which is *not* a named mount. */
-        if (STREQ(entry.mnt_type, "cgroup") &&
-            !strstr(entry.mnt_opts, "name=")) {
+         * which is *not* a named mount, or the unified hierarchy. */
+        if ((STREQ(entry.mnt_type, "cgroup") &&
+             !strstr(entry.mnt_opts, "name=")) ||
+            STREQ(entry.mnt_type, "cgroup2")) {
             ret = true;
             break;
         }
@@ -365,6 +383,43 @@ virCgroupCopyMounts(virCgroupPtr group,
                        parent->controllers[i].linkPoint) < 0)
             return -1;
     }
+    group->unified = parent->unified;
+    return 0;
+}
+
+
+/*
+ * Use the cgroup v2 hierarchy mounted at @mountPoint for all the
+ * controllers it has a counterpart of, unless some v1 controllers
+ * are mounted, in which case the host is running in the hybrid mode
+ * where only systemd uses it for its own tracking.
+ */
+static int
+virCgroupSetUnifiedMounts(virCgroupPtr group,
+                          const char *mountPoint)
+{
+    size_t i;
+
+    for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
+        if (i != VIR_CGROUP_CONTROLLER_SYSTEMD &&
+            group->controllers[i].mountPoint) {
+            VIR_DEBUG("Ignoring cgroup v2 mount at %s in hybrid setup",
+                      mountPoint);
+            return 0;
+        }
+    }
+
+    for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
+        if (!virCgroupUnifiedControllers[i])
+            continue;
+
+        VIR_FREE(group->controllers[i].mountPoint);
+        VIR_FREE(group->controllers[i].linkPoint);
+        if (VIR_STRDUP(group->controllers[i].mountPoint, mountPoint) < 0)
+            return -1;
+    }
+
+    group->unified = true;
     return 0;
 }
 
@@ -382,6 +437,7 @@ virCgroupDetectMountsFromFile(virCgroupPtr group,
     FILE *mounts = NULL;
     struct mntent entry;
     char buf[CGROUP_MAX_VAL];
+    char *unified = NULL;
 
     mounts = fopen(path, "r");
     if (mounts == NULL) {
@@ -390,6 +446,12 @@ virCgroupDetectMountsFromFile(virCgroupPtr group,
     }
 
     while (getmntent_r(mounts, &entry, buf, sizeof(buf)) != NULL) {
+        if (STREQ(entry.mnt_type, "cgroup2")) {
+            if (!unified && VIR_STRDUP(unified, entry.mnt_dir) < 0)
+                goto error;
+            continue;
+        }
+
         if (STRNEQ(entry.mnt_type, "cgroup"))
             continue;
 
@@ -463,19 +525,78 @@ virCgroupDetectMountsFromFile(virCgroupPtr group,
         }
     }
 
+    if (unified && virCgroupSetUnifiedMounts(group, unified) < 0)
+        goto error;
+
+    VIR_FREE(unified);
     VIR_FORCE_FCLOSE(mounts);
 
     return 0;
 
  error:
+    VIR_FREE(unified);
     VIR_FORCE_FCLOSE(mounts);
     return -1;
 }
 
+
+/*
+ * Drop the controllers the unified hierarchy doesn't provide, as
+ * listed in cgroup.controllers of its root
+ */
+static int
+virCgroupDetectUnifiedControllers(virCgroupPtr group)
+{
+    char *path = NULL;
+    char *str = NULL;
+    char **names = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/cgroup.controllers",
+                    group->controllers[VIR_CGROUP_CONTROLLER_CPUACCT].mountPoint) < 0)
+        goto cleanup;
+
+    if (virFileReadAll(path, 1024, &str) < 0)
+        goto cleanup;
+
+    virStringTrimOptionalNewline(str);
+    if (!(names = virStringSplit(str, " ", 0)))
+        goto cleanup;
+
+    for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
+        const char *name = virCgroupUnifiedControllers[i];
+
+        if (!name || !*name ||
+            virStringListHasString((const char **) names, name))
+            continue;
+
+        VIR_DEBUG("Controller '%s' not available in the unified hierarchy",
+                  virCgroupControllerTypeToString(i));
+        VIR_FREE(group->controllers[i].mountPoint);
+    }
+
+    ret = 0;
+
+ cleanup:
+    virStringListFree(names);
+    VIR_FREE(str);
+    VIR_FREE(path);
+    return ret;
+}
+
+
 static int
 virCgroupDetectMounts(virCgroupPtr group)
 {
-    return virCgroupDetectMountsFromFile(group, "/proc/mounts", true);
+    if (virCgroupDetectMountsFromFile(group, "/proc/mounts", true) < 0)
+        return -1;
+
+    if (group->unified &&
+        virCgroupDetectUnifiedControllers(group) < 0)
+        return -1;
+
+    return 0;
 }
 
 
@@ -515,6 +636,28 @@ virCgroupCopyPlacement(virCgroupPtr group,
 }
 
 
+static int
+virCgroupSetPlacement(virCgroupPtr group,
+                      int controller,
+                      const char *selfpath,
+                      const char *path)
+{
+    /*
+     * selfpath == "/" + path="" -> "/"
+     * selfpath == "/libvirt.service" + path == "" -> "/libvirt.service"
+     * selfpath == "/libvirt.service" + path == "foo" -> "/libvirt.service/foo"
+     */
+    if (controller == VIR_CGROUP_CONTROLLER_SYSTEMD)
+        return VIR_STRDUP(group->controllers[controller].placement, selfpath);
+
+    return virAsprintf(&group->controllers[controller].placement,
+                       "%s%s%s", selfpath,
+                       (STREQ(selfpath, "/") ||
+                        STREQ(path, "") ? "" : "/"),
+                       path);
+}
+
+
 /*
  * virCgroupDetectPlacement:
  * @group: the group to process
@@ -535,6 +678,10 @@ virCgroupCopyPlacement(virCgroupPtr group,
  * 2:cpuset:/
  * 1:name=systemd:/user/berrange/2
  *
+ * or, with the unified hierarchy, a single line like
+ *
+ * 0::/user.slice/user-1000.slice/session-2.scope
+ *
  * It then appends @path to each detected path.
  */
 static int
@@ -582,6 +729,20 @@ virCgroupDetectPlacement(virCgroupPtr group,
         controllers++;
         selfpath++;
 
+        if (group->unified) {
+            /* Only the v2 entry has no controllers listed */
+            if (*controllers)
+                continue;
+
+            for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
+                if (group->controllers[i].mountPoint &&
+                    !group->controllers[i].placement &&
+                    virCgroupSetPlacement(group, i, selfpath, path) < 0)
+                    goto cleanup;
+            }
+            continue;
+        }
+
         for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
             const char *typestr = virCgroupControllerTypeToString(i);
             int typelen = strlen(typestr);
@@ -597,27 +758,11 @@ virCgroupDetectPlacement(virCgroupPtr group,
                     len = strlen(tmp);
                 }
 
-                /*
-                 * selfpath == "/" + path="" -> "/"
-                 * selfpath == "/libvirt.service" + path == "" -> "/libvirt.service"
-                 * selfpath == "/libvirt.service" + path == "foo" -> "/libvirt.service/foo"
-                 */
                 if (typelen == len && STREQLEN(typestr, tmp, len) &&
                     group->controllers[i].mountPoint != NULL &&
-                    group->controllers[i].placement == NULL) {
-                    if (i == VIR_CGROUP_CONTROLLER_SYSTEMD) {
-                        if (VIR_STRDUP(group->controllers[i].placement,
-                                       selfpath) < 0)
-                            goto cleanup;
-                    } else {
-                        if (virAsprintf(&group->controllers[i].placement,
-                                        "%s%s%s", selfpath,
-                                        (STREQ(selfpath, "/") ||
-                                         STREQ(path, "") ? "" : "/"),
-                                        path) < 0)
-                            goto cleanup;
-                    }
-                }
+                    group->controllers[i].placement == NULL &&
+                    virCgroupSetPlacement(group, i, selfpath, path) < 0)
+                    goto cleanup;
 
                 tmp = next;
             }
@@ -675,9 +820,11 @@ virCgroupDetect(virCgroupPtr group,
             if (!((1 << i) & controllers) &&
                 group->controllers[i].mountPoint) {
                 /* Check whether a request to disable a controller
-                 * clashes with co-mounting of controllers */
+                 * clashes with co-mounting of controllers, which
+                 * doesn't apply to the unified hierarchy where each
+                 * of them is enabled separately */
                 for (j = 0; j < VIR_CGROUP_CONTROLLER_LAST; j++) {
-                    if (j == i)
+                    if (j == i || group->unified)
                         continue;
                     if (!((1 << j) & controllers))
                         continue;
@@ -814,6 +961,158 @@ virCgroupSetValueStr(virCgroupPtr group,
 }
 
 
+/* The statistics read over and over by the drivers, which are kept
+ * open once the stat cache of a group is enabled */
+static const struct {
+    int controller;
+    const char *key;
+} virCgroupStatFiles[] = {
+    { VIR_CGROUP_CONTROLLER_CPUACCT, "cpuacct.usage" },
+    { VIR_CGROUP_CONTROLLER_CPUACCT, "cpuacct.usage_percpu" },
+    { VIR_CGROUP_CONTROLLER_CPUACCT, "cpuacct.stat" },
+    { VIR_CGROUP_CONTROLLER_MEMORY, "memory.usage_in_bytes" },
+    { VIR_CGROUP_CONTROLLER_BLKIO, "blkio.throttle.io_service_bytes" },
+    { VIR_CGROUP_CONTROLLER_BLKIO, "blkio.throttle.io_serviced" },
+    /* cgroup v2 */
+    { VIR_CGROUP_CONTROLLER_CPUACCT, "cpu.stat" },
+    { VIR_CGROUP_CONTROLLER_CPUACCT, "cpu.pressure" },
+    { VIR_CGROUP_CONTROLLER_MEMORY, "memory.current" },
+    { VIR_CGROUP_CONTROLLER_MEMORY, "memory.pressure" },
+    { VIR_CGROUP_CONTROLLER_BLKIO, "io.stat" },
+    { VIR_CGROUP_CONTROLLER_BLKIO, "io.pressure" },
+};
+
+#define VIR_CGROUP_STAT_BUF_SIZE_MIN 4096
+#define VIR_CGROUP_STAT_BUF_SIZE_MAX (1024 * 1024)
+
+
+static void
+virCgroupStatCacheClose(virCgroupPtr group)
+{
+    size_t i;
+
+    if (!group->statFds)
+        return;
+
+    for (i = 0; i < ARRAY_CARDINALITY(virCgroupStatFiles); i++)
+        VIR_FORCE_CLOSE(group->statFds[i]);
+}
+
+
+/*
+ * Read @key through the stat cache of @group. On success *@value
+ * points to the contents of the file, without the trailing newline,
+ * in a buffer that is only valid until the next read from @group.
+ *
+ * Returns 1 on success, 0 if the value has to be read from the file
+ * in the usual way, -1 on error.
+ */
+static int
+virCgroupGetCachedValue(virCgroupPtr group,
+                        int controller,
+                        const char *key,
+                        const char **value)
+{
+    size_t i;
+    size_t len = 0;
+    ssize_t rc;
+    int *fd;
+
+    if (!group->statFds)
+        return 0;
+
+    for (i = 0; i < ARRAY_CARDINALITY(virCgroupStatFiles); i++) {
+        if (virCgroupStatFiles[i].controller == controller &&
+            STREQ(virCgroupStatFiles[i].key, key))
+            break;
+    }
+    if (i == ARRAY_CARDINALITY(virCgroupStatFiles))
+        return 0;
+
+    fd = &group->statFds[i];
+    if (*fd < 0) {
+        char *keypath = NULL;
+
+        if (virCgroupPathOfController(group, controller, key, &keypath) < 0)
+            return -1;
+
+        /* Just don't cache the file if it can't be kept open, e.g.
+         * because we're running out of file descriptors */
+        *fd = open(keypath, O_RDONLY | O_CLOEXEC);
+        VIR_FREE(keypath);
+        if (*fd < 0)
+            return 0;
+    }
+
+    if (!group->statBuf) {
+        if (VIR_ALLOC_N(group->statBuf, VIR_CGROUP_STAT_BUF_SIZE_MIN) < 0)
+            return -1;
+        group->statBufSize = VIR_CGROUP_STAT_BUF_SIZE_MIN;
+    }
+
+    /* The files are regenerated whenever they are read from the start */
+    while ((rc = pread(*fd, group->statBuf + len,
+                       group->statBufSize - len - 1, len)) > 0) {
+        len += rc;
+        if (len < group->statBufSize - 1)
+            continue;
+
+        if (group->statBufSize >= VIR_CGROUP_STAT_BUF_SIZE_MAX) {
+            /* Too big to be worth caching */
+            VIR_FORCE_CLOSE(*fd);
+            return 0;
+        }
+
+        if (VIR_EXPAND_N(group->statBuf, group->statBufSize,
+                         group->statBufSize) < 0)
+            return -1;
+    }
+
+    if (rc < 0) {
+        /* Leave the reporting of the error to the usual code path */
+        VIR_FORCE_CLOSE(*fd);
+        return 0;
+    }
+
+    /* Terminated with '\n' has sometimes harmful effects to the caller */
+    if (len > 0 && group->statBuf[len - 1] == '\n')
+        len--;
+    group->statBuf[len] = '\0';
+
+    *value = group->statBuf;
+    return 1;
+}
+
+
+/**
+ * virCgroupEnableStatCache:
+ *
+ * @group: The group to enable the cache for
+ *
+ * Keeps the files of the statistics queried periodically, such as
+ * the CPU time or memory usage, open for as long as @group exists or
+ * until it is removed, instead of opening them for every query.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virCgroupEnableStatCache(virCgroupPtr group)
+{
+    size_t i;
+
+    if (group->statFds)
+        return 0;
+
+    if (VIR_ALLOC_N(group->statFds, ARRAY_CARDINALITY(virCgroupStatFiles)) < 0)
+        return -1;
+
+    for (i = 0; i < ARRAY_CARDINALITY(virCgroupStatFiles); i++)
+        group->statFds[i] = -1;
+
+    return 0;
+}
+
+
 static int
 virCgroupGetValueStr(virCgroupPtr group,
                      int controller,
@@ -821,10 +1120,17 @@ virCgroupGetValueStr(virCgroupPtr group,
                      char **value)
 {
     char *keypath = NULL;
+    const char *cached;
     int ret = -1, rc;
 
     *value = NULL;
 
+    if ((rc = virCgroupGetCachedValue(group, controller, key, &cached)) < 0)
+        return -1;
+
+    if (rc > 0)
+        return VIR_STRDUP(*value, cached) < 0 ? -1 : 0;
+
     if (virCgroupPathOfController(group, controller, key, &keypath) < 0)
         return -1;
 
@@ -928,15 +1234,22 @@ virCgroupGetValueI64(virCgroupPtr group,
                      long long int *value)
 {
     char *strval = NULL;
-    int ret = -1;
+    const char *str;
+    int ret = -1, rc;
 
-    if (virCgroupGetValueStr(group, controller, key, &strval) < 0)
+    if ((rc = virCgroupGetCachedValue(group, controller, key, &str)) < 0)
         goto cleanup;
 
-    if (virStrToLong_ll(strval, NULL, 10, value) < 0) {
+    if (rc == 0) {
+        if (virCgroupGetValueStr(group, controller, key, &strval) < 0)
+            goto cleanup;
+        str = strval;
+    }
+
+    if (virStrToLong_ll(str, NULL, 10, value) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Unable to parse '%s' as an integer"),
-                       strval);
+                       str);
         goto cleanup;
     }
 
@@ -955,15 +1268,22 @@ virCgroupGetValueU64(virCgroupPtr group,
                      unsigned long long int *value)
 {
     char *strval = NULL;
-    int ret = -1;
+    const char *str;
+    int ret = -1, rc;
 
-    if (virCgroupGetValueStr(group, controller, key, &strval) < 0)
+    if ((rc = virCgroupGetCachedValue(group, controller, key, &str)) < 0)
         goto cleanup;
 
-    if (virStrToLong_ull(strval, NULL, 10, value) < 0) {
+    if (rc == 0) {
+        if (virCgroupGetValueStr(group, controller, key, &strval) < 0)
+            goto cleanup;
+        str = strval;
+    }
+
+    if (virStrToLong_ull(str, NULL, 10, value) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Unable to parse '%s' as an integer"),
-                       strval);
+                       str);
         goto cleanup;
     }
 
@@ -1036,6 +1356,45 @@ virCgroupSetMemoryUseHierarchy(virCgroupPtr group)
 }
 
 
+/*
+ * In the unified hierarchy a group only gets the controllers its
+ * parent delegates to its children. That's not possible while the
+ * parent has tasks of its own, so this is only best effort: the
+ * statistics every group has are available in the new group anyway.
+ */
+static int
+virCgroupEnableSubtreeControllers(virCgroupPtr parent,
+                                  virCgroupPtr group)
+{
+    size_t i;
+
+    for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
+        const char *name = virCgroupUnifiedControllers[i];
+        char *path = NULL;
+        char *value = NULL;
+
+        if (!name || !*name || !group->controllers[i].mountPoint)
+            continue;
+
+        if (virCgroupPathOfController(parent, i, "cgroup.subtree_control",
+                                      &path) < 0 ||
+            virAsprintf(&value, "+%s", name) < 0) {
+            VIR_FREE(path);
+            return -1;
+        }
+
+        if (virFileWriteStr(path, value, 0) < 0)
+            VIR_DEBUG("Cannot enable controller %s in %s: %d",
+                      name, path, errno);
+
+        VIR_FREE(value);
+        VIR_FREE(path);
+    }
+
+    return 0;
+}
+
+
 static int
 virCgroupMakeGroup(virCgroupPtr parent,
                    virCgroupPtr group,
@@ -1046,6 +1405,10 @@ virCgroupMakeGroup(virCgroupPtr parent,
     int ret = -1;
 
     VIR_DEBUG("Make group %s", group->path);
+    if (group->unified && create && parent &&
+        virCgroupEnableSubtreeControllers(parent, group) < 0)
+        return -1;
+
     for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
         char *path = NULL;
 
@@ -1094,6 +1457,13 @@ virCgroupMakeGroup(virCgroupPtr parent,
                     goto cleanup;
                 }
             }
+            /* The unified hierarchy always inherits the cpuset
+             * and accounts memory hierarchically */
+            if (group->unified) {
+                VIR_FREE(path);
+                continue;
+            }
+
             if (group->controllers[VIR_CGROUP_CONTROLLER_CPUSET].mountPoint != NULL &&
                 (i == VIR_CGROUP_CONTROLLER_CPUSET ||
                  STREQ(group->controllers[i].mountPoint,
@@ -1184,6 +1554,15 @@ virCgroupNew(pid_t pid,
 }
 
 
+/* The file listing the tasks of @group, which only has processes
+ * with the unified hierarchy */
+static const char *
+virCgroupTasksFile(virCgroupPtr group)
+{
+    return group->unified ? "cgroup.procs" : "tasks";
+}
+
+
 static int
 virCgroupAddTaskInternal(virCgroupPtr group, pid_t pid, bool withSystemd)
 {
@@ -1203,6 +1582,10 @@ virCgroupAddTaskInternal(virCgroupPtr group, pid_t pid, bool withSystemd)
 
         if (virCgroupAddTaskController(group, pid, i) < 0)
             goto cleanup;
+
+        /* There's just the one hierarchy to add it to */
+        if (group->unified)
+            break;
     }
 
     ret = 0;
@@ -1270,7 +1653,8 @@ virCgroupAddTaskController(virCgroupPtr group, pid_t pid, int controller)
         return -1;
     }
 
-    return virCgroupSetValueI64(group, controller, "tasks", pid);
+    return virCgroupSetValueI64(group, controller,
+                                virCgroupTasksFile(group), pid);
 }
 
 
@@ -1799,6 +2183,9 @@ virCgroupFree(virCgroupPtr *group)
         VIR_FREE((*group)->controllers[i].placement);
     }
 
+    virCgroupStatCacheClose(*group);
+    VIR_FREE((*group)->statFds);
+    VIR_FREE((*group)->statBuf);
     VIR_FREE((*group)->path);
     VIR_FREE(*group);
 }
@@ -1875,6 +2262,148 @@ virCgroupPathOfController(virCgroupPtr group,
 }
 
 
+/*
+ * Find the value of @key in @str, made of "key value" lines like the
+ * statistics files of the unified hierarchy
+ */
+static int
+virCgroupGetKeyedValue(const char *str,
+                       const char *key,
+                       unsigned long long *value)
+{
+    size_t len = strlen(key);
+    const char *p = str;
+    char *end;
+
+    while (p && !(STRPREFIX(p, key) && p[len] == ' ')) {
+        if ((p = strchr(p, '\n')))
+            p++;
+    }
+
+    if (!p ||
+        virStrToLong_ull(p + len + 1, &end, 10, value) < 0 ||
+        (*end != '\0' && *end != '\n')) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Cannot parse '%s' stat in '%s'"), key, str);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Get the CPU times of @group from the single cpu.stat file of the
+ * unified hierarchy, in nanoseconds like cpuacct does
+ */
+static int
+virCgroupGetUnifiedCpuStat(virCgroupPtr group,
+                           unsigned long long *usage,
+                           unsigned long long *user,
+                           unsigned long long *sys)
+{
+    const char *keys[] = { "usage_usec", "user_usec", "system_usec" };
+    unsigned long long *values[] = { usage, user, sys };
+    char *str;
+    size_t i;
+    int ret = -1;
+
+    if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
+                             "cpu.stat", &str) < 0)
+        return -1;
+
+    for (i = 0; i < ARRAY_CARDINALITY(keys); i++) {
+        if (!values[i])
+            continue;
+
+        if (virCgroupGetKeyedValue(str, keys[i], values[i]) < 0)
+            goto cleanup;
+
+        *values[i] *= 1000;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(str);
+    return ret;
+}
+
+
+/*
+ * Sum up the statistics in @str, the contents of io.stat, which has
+ * lines like
+ *
+ * 8:0 rbytes=90430464 wbytes=299008000 rios=8950 wios=1252 dbytes=0 dios=0
+ *
+ * for all the devices, or only for the one given as "major:minor " in
+ * @dev.
+ */
+static int
+virCgroupParseUnifiedIoStat(char *str,
+                            const char *dev,
+                            long long *bytes_read,
+                            long long *bytes_write,
+                            long long *requests_read,
+                            long long *requests_write)
+{
+    const char *names[] = { "rbytes=", "wbytes=", "rios=", "wios=" };
+    long long *ptrs[] = {
+        bytes_read, bytes_write, requests_read, requests_write
+    };
+    char *line = str;
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(ptrs); i++)
+        *ptrs[i] = 0;
+
+    while (line && *line) {
+        char *next = strchr(line, '\n');
+        char *p = line;
+
+        if (next)
+            *next++ = '\0';
+
+        if (dev && !STRPREFIX(line, dev)) {
+            line = next;
+            continue;
+        }
+
+        while ((p = strchr(p, ' '))) {
+            long long stats_val;
+
+            p++;
+            for (i = 0; i < ARRAY_CARDINALITY(names); i++) {
+                if (!STRPREFIX(p, names[i]))
+                    continue;
+
+                if (virStrToLong_ll(p + strlen(names[i]), &p, 10,
+                                    &stats_val) < 0 ||
+                    stats_val < 0) {
+                    virReportError(VIR_ERR_INTERNAL_ERROR,
+                                   _("Cannot parse %s stat '%s'"),
+                                   names[i], line);
+                    return -1;
+                }
+
+                if (stats_val > 0 && *ptrs[i] > (LLONG_MAX - stats_val)) {
+                    virReportError(VIR_ERR_OVERFLOW,
+                                   _("Sum of %s stat overflows"),
+                                   names[i]);
+                    return -1;
+                }
+                *ptrs[i] += stats_val;
+                break;
+            }
+        }
+
+        line = next;
+    }
+
+    return 0;
+}
+
+
 /**
  * virCgroupGetBlkioIoServiced:
  *
@@ -1916,6 +2445,17 @@ virCgroupGetBlkioIoServiced(virCgroupPtr group,
     *requests_read = 0;
     *requests_write = 0;
 
+    if (group->unified) {
+        if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_BLKIO,
+                                 "io.stat", &str1) < 0 ||
+            virCgroupParseUnifiedIoStat(str1, NULL, bytes_read, bytes_write,
+                                        requests_read, requests_write) < 0)
+            goto cleanup;
+
+        ret = 0;
+        goto cleanup;
+    }
+
     if (virCgroupGetValueStr(group,
                              VIR_CGROUP_CONTROLLER_BLKIO,
                              "blkio.throttle.io_service_bytes", &str1) < 0)
@@ -2020,6 +2560,20 @@ virCgroupGetBlkioIoDeviceServiced(virCgroupPtr group,
         requests_write
     };
 
+    if (group->unified) {
+        /* Devices without any I/O yet are not listed, which leaves
+         * their statistics at zero */
+        if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_BLKIO,
+                                 "io.stat", &str1) < 0 ||
+            !(str3 = virCgroupGetBlockDevString(path)) ||
+            virCgroupParseUnifiedIoStat(str1, str3, bytes_read, bytes_write,
+                                        requests_read, requests_write) < 0)
+            goto cleanup;
+
+        ret = 0;
+        goto cleanup;
+    }
+
     if (virCgroupGetValueStr(group,
                              VIR_CGROUP_CONTROLLER_BLKIO,
                              "blkio.throttle.io_service_bytes", &str1) < 0)
@@ -2579,6 +3133,7 @@ virCgroupGetMemoryUsage(virCgroupPtr group, unsigned long *kb)
     int ret;
     ret = virCgroupGetValueU64(group,
                                VIR_CGROUP_CONTROLLER_MEMORY,
+                               group->unified ? "memory.current" :
                                "memory.usage_in_bytes", &usage_in_bytes);
     if (ret == 0)
         *kb = (unsigned long) usage_in_bytes >> 10;
@@ -3301,15 +3856,24 @@ virCgroupGetDomainTotalCpuStats(virCgroupPtr group,
                                 int nparams)
 {
     unsigned long long cpu_time;
+    unsigned long long user;
+    unsigned long long sys;
     int ret;
 
     if (nparams == 0) /* return supported number of params */
         return CGROUP_NB_TOTAL_CPU_STAT_PARAM;
-    /* entry 0 is cputime */
-    ret = virCgroupGetCpuacctUsage(group, &cpu_time);
-    if (ret < 0) {
-        virReportSystemError(-ret, "%s", _("unable to get cpu account"));
-        return -1;
+
+    if (group->unified) {
+        /* all of them are in cpu.stat, no need to read it twice */
+        if (virCgroupGetUnifiedCpuStat(group, &cpu_time, &user, &sys) < 0)
+            return -1;
+    } else {
+        /* entry 0 is cputime */
+        ret = virCgroupGetCpuacctUsage(group, &cpu_time);
+        if (ret < 0) {
+            virReportSystemError(-ret, "%s", _("unable to get cpu account"));
+            return -1;
+        }
     }
 
     if (virTypedParameterAssign(&params[0], VIR_DOMAIN_CPU_STATS_CPUTIME,
@@ -3317,13 +3881,13 @@ virCgroupGetDomainTotalCpuStats(virCgroupPtr group,
         return -1;
 
     if (nparams > 1) {
-        unsigned long long user;
-        unsigned long long sys;
-
-        ret = virCgroupGetCpuacctStat(group, &user, &sys);
-        if (ret < 0) {
-            virReportSystemError(-ret, "%s", _("unable to get cpu account"));
-            return -1;
+        if (!group->unified) {
+            ret = virCgroupGetCpuacctStat(group, &user, &sys);
+            if (ret < 0) {
+                virReportSystemError(-ret, "%s",
+                                     _("unable to get cpu account"));
+                return -1;
+            }
         }
 
         if (virTypedParameterAssign(&params[1],
@@ -3437,11 +4001,71 @@ virCgroupSetCpuCfsQuota(virCgroupPtr group, long long cfs_quota)
 int
 virCgroupGetCpuacctPercpuUsage(virCgroupPtr group, char **usage)
 {
+    if (group->unified) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("per-CPU statistics are not available with "
+                         "the unified cgroup hierarchy"));
+        return -1;
+    }
+
     return virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
                                 "cpuacct.usage_percpu", usage);
 }
 
 
+/**
+ * virCgroupGetThreads:
+ *
+ * @group: The cgroup to list the threads of
+ * @tids: filled with the IDs of the threads in @group
+ * @ntids: filled with the number of entries in @tids
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+virCgroupGetThreads(virCgroupPtr group, pid_t **tids, size_t *ntids)
+{
+    char *str = NULL;
+    const char *cur;
+    char *end;
+    int tid;
+    int ret = -1;
+
+    *tids = NULL;
+    *ntids = 0;
+
+    if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
+                             group->unified ? "cgroup.threads" : "tasks",
+                             &str) < 0)
+        return -1;
+
+    cur = str;
+    while (*cur) {
+        if (virStrToLong_i(cur, &end, 10, &tid) < 0 || end == cur) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Malformed thread list '%s'"), str);
+            goto cleanup;
+        }
+
+        if (VIR_APPEND_ELEMENT(*tids, *ntids, tid) < 0)
+            goto cleanup;
+
+        cur = end;
+        virSkipSpaces(&cur);
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0) {
+        VIR_FREE(*tids);
+        *ntids = 0;
+    }
+    VIR_FREE(str);
+    return ret;
+}
+
+
 int
 virCgroupRemoveRecursively(char *grppath)
 {
@@ -3511,6 +4135,7 @@ virCgroupRemove(virCgroupPtr group)
     char *grppath = NULL;
 
     VIR_DEBUG("Removing cgroup %s", group->path);
+    virCgroupStatCacheClose(group);
     for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
         /* Skip over controllers not mounted */
         if (!group->controllers[i].mountPoint)
@@ -3555,7 +4180,8 @@ virCgroupKillInternal(virCgroupPtr group, int signum, virHashTablePtr pids)
     VIR_DEBUG("group=%p path=%s signum=%d pids=%p",
               group, group->path, signum, pids);
 
-    if (virCgroupPathOfController(group, -1, "tasks", &keypath) < 0)
+    if (virCgroupPathOfController(group, -1, virCgroupTasksFile(group),
+                                  &keypath) < 0)
         return -1;
 
     /* PIDs may be forking as we kill them, so loop
@@ -3836,6 +4462,9 @@ virCgroupGetCpuCfsQuota(virCgroupPtr group, long long *cfs_quota)
 int
 virCgroupGetCpuacctUsage(virCgroupPtr group, unsigned long long *usage)
 {
+    if (group->unified)
+        return virCgroupGetUnifiedCpuStat(group, usage, NULL, NULL);
+
     return virCgroupGetValueU64(group,
                                 VIR_CGROUP_CONTROLLER_CPUACCT,
                                 "cpuacct.usage", usage);
@@ -3851,6 +4480,9 @@ virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
     int ret = -1;
     static double scale = -1.0;
 
+    if (group->unified)
+        return virCgroupGetUnifiedCpuStat(group, NULL, user, sys);
+
     if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
                              "cpuacct.stat", &str) < 0)
         return -1;
@@ -3891,6 +4523,129 @@ virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
 }
 
 
+/*
+ * Parse a line of a pressure file, like
+ *
+ * some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+ */
+static int
+virCgroupParsePressure(const char *line,
+                       virCgroupPressurePtr pressure)
+{
+    const char *names[] = { "avg10=", "avg60=", "avg300=" };
+    double *avgs[] = { &pressure->avg10, &pressure->avg60, &pressure->avg300 };
+    const char *p;
+    char *end;
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(names); i++) {
+        if (!(p = strstr(line, names[i])) ||
+            virStrToDouble(p + strlen(names[i]), &end, avgs[i]) < 0)
+            goto error;
+    }
+
+    if (!(p = strstr(line, "total=")) ||
+        virStrToLong_ull(p + strlen("total="), &end, 10,
+                         &pressure->total) < 0)
+        goto error;
+
+    return 0;
+
+ error:
+    virReportError(VIR_ERR_INTERNAL_ERROR,
+                   _("Cannot parse pressure stat '%s'"), line);
+    return -1;
+}
+
+
+/**
+ * virCgroupGetPressure:
+ *
+ * @group: The cgroup to get the pressure stall information for
+ * @resource: The resource the tasks are stalled on
+ * @some: Filled with the stalls of at least some of the tasks
+ * @full: Filled with the stalls of all of them at once
+ *
+ * The "full" figures are not always provided for the CPU, in which
+ * case @full is left zeroed.
+ *
+ * Returns: 1 if both @some and @full were filled in, 0 if only
+ * @some was, -1 on error.
+ */
+int
+virCgroupGetPressure(virCgroupPtr group,
+                     virCgroupPressureResource resource,
+                     virCgroupPressurePtr some,
+                     virCgroupPressurePtr full)
+{
+    static const int controllers[VIR_CGROUP_PRESSURE_LAST] = {
+        [VIR_CGROUP_PRESSURE_CPU] = VIR_CGROUP_CONTROLLER_CPUACCT,
+        [VIR_CGROUP_PRESSURE_IO] = VIR_CGROUP_CONTROLLER_BLKIO,
+        [VIR_CGROUP_PRESSURE_MEMORY] = VIR_CGROUP_CONTROLLER_MEMORY,
+    };
+    char *key = NULL;
+    char *str = NULL;
+    char *line;
+    bool haveSome = false;
+    bool haveFull = false;
+    int ret = -1;
+
+    if (resource < 0 || resource >= VIR_CGROUP_PRESSURE_LAST) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Pressure resource %d out of range"), resource);
+        return -1;
+    }
+
+    if (!group->unified) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("pressure stall information is only available "
+                         "with the unified cgroup hierarchy"));
+        return -1;
+    }
+
+    memset(some, 0, sizeof(*some));
+    memset(full, 0, sizeof(*full));
+
+    if (virAsprintf(&key, "%s.pressure",
+                    virCgroupPressureResourceTypeToString(resource)) < 0 ||
+        virCgroupGetValueStr(group, controllers[resource], key, &str) < 0)
+        goto cleanup;
+
+    line = str;
+    while (line) {
+        char *next = strchr(line, '\n');
+
+        if (next)
+            *next++ = '\0';
+
+        if (STRPREFIX(line, "some ")) {
+            if (virCgroupParsePressure(line, some) < 0)
+                goto cleanup;
+            haveSome = true;
+        } else if (STRPREFIX(line, "full ")) {
+            if (virCgroupParsePressure(line, full) < 0)
+                goto cleanup;
+            haveFull = true;
+        }
+
+        line = next;
+    }
+
+    if (!haveSome) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Cannot find pressure stats in '%s'"), key);
+        goto cleanup;
+    }
+
+    ret = haveFull ? 1 : 0;
+
+ cleanup:
+    VIR_FREE(str);
+    VIR_FREE(key);
+    return ret;
+}
+
+
 int
 virCgroupSetFreezerState(virCgroupPtr group, const char *state)
 {
@@ -4090,6 +4845,35 @@ virCgroupSupportsCpuBW(virCgroupPtr cgroup)
     return ret;
 }
 
+/**
+ * virCgroupSupportsPressure:
+ *
+ * Check whether the pressure stall information can be read from
+ * @cgroup, which needs the unified hierarchy and a kernel with PSI
+ * enabled.
+ */
+bool
+virCgroupSupportsPressure(virCgroupPtr cgroup)
+{
+    char *path = NULL;
+    bool ret = false;
+
+    if (!cgroup || !cgroup->unified)
+        return false;
+
+    if (virCgroupPathOfController(cgroup, VIR_CGROUP_CONTROLLER_CPUACCT,
+                                  "cpu.pressure", &path) < 0) {
+        virResetLastError();
+        goto cleanup;
+    }
+
+    ret = virFileExists(path);
+
+ cleanup:
+    VIR_FREE(path);
+    return ret;
+}
+
 int
 virCgroupHasEmptyTasks(virCgroupPtr cgroup, int controller)
 {
@@ -4099,7 +4883,8 @@ virCgroupHasEmptyTasks(virCgroupPtr cgroup, int controller)
     if (!cgroup)
         return -1;
 
-    ret = virCgroupGetValueStr(cgroup, controller, "tasks", &content);
+    ret = virCgroupGetValueStr(cgroup, controller,
+                               virCgroupTasksFile(cgroup), &content);
 
     if (ret == 0 && content[0] == '\0')
         ret = 1;
@@ -4258,6 +5043,15 @@ virCgroupFree(virCgroupPtr *group ATTRIBUTE_UNUSED)
 }
 
 
+int
+virCgroupEnableStatCache(virCgroupPtr group ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENXIO, "%s",
+                         _("Control groups not supported on this platform"));
+    return -1;
+}
+
+
 bool
 virCgroupHasController(virCgroupPtr cgroup ATTRIBUTE_UNUSED,
                        int controller ATTRIBUTE_UNUSED)
@@ -4800,6 +5594,17 @@ virCgroupGetCpuacctPercpuUsage(virCgroupPtr group ATTRIBUTE_UNUSED,
 }
 
 
+int
+virCgroupGetThreads(virCgroupPtr group ATTRIBUTE_UNUSED,
+                    pid_t **tids ATTRIBUTE_UNUSED,
+                    size_t *ntids ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("Control groups not supported on this platform"));
+    return -1;
+}
+
+
 int
 virCgroupGetCpuacctStat(virCgroupPtr group ATTRIBUTE_UNUSED,
                         unsigned long long *user ATTRIBUTE_UNUSED,
@@ -4811,6 +5616,18 @@ virCgroupGetCpuacctStat(virCgroupPtr group ATTRIBUTE_UNUSED,
 }
 
 
+int
+virCgroupGetPressure(virCgroupPtr group ATTRIBUTE_UNUSED,
+                     virCgroupPressureResource resource ATTRIBUTE_UNUSED,
+                     virCgroupPressurePtr some ATTRIBUTE_UNUSED,
+                     virCgroupPressurePtr full ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("Control groups not supported on this platform"));
+    return -1;
+}
+
+
 int
 virCgroupGetDomainTotalCpuStats(virCgroupPtr group ATTRIBUTE_UNUSED,
                                 virTypedParameterPtr params ATTRIBUTE_UNUSED,
@@ -4861,6 +5678,14 @@ virCgroupSupportsCpuBW(virCgroupPtr cgroup ATTRIBUTE_UNUSED)
 }
 
 
+bool
+virCgroupSupportsPressure(virCgroupPtr cgroup ATTRIBUTE_UNUSED)
+{
+    VIR_DEBUG("Control groups not supported on this platform");
+    return false;
+}
+
+
 int
 virCgroupGetPercpuStats(virCgroupPtr group ATTRIBUTE_UNUSED,
                         virTypedParameterPtr params ATTRIBUTE_UNUSED,
@@ -124,6 +124,8 @@ bool virCgroupNewIgnoreError(void);
 
 void virCgroupFree(virCgroupPtr *group);
 
+int virCgroupEnableStatCache(virCgroupPtr group);
+
 bool virCgroupHasController(virCgroupPtr cgroup, int controller);
 int virCgroupPathOfController(virCgroupPtr group,
                               int controller,
@@ -261,9 +263,37 @@ int virCgroupGetCpuCfsQuota(virCgroupPtr group, long long *cfs_quota);
 
 int virCgroupGetCpuacctUsage(virCgroupPtr group, unsigned long long *usage);
 int virCgroupGetCpuacctPercpuUsage(virCgroupPtr group, char **usage);
+int virCgroupGetThreads(virCgroupPtr group, pid_t **tids, size_t *ntids);
 int virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
                             unsigned long long *sys);
 
+typedef enum {
+    VIR_CGROUP_PRESSURE_CPU = 0,
+    VIR_CGROUP_PRESSURE_IO,
+    VIR_CGROUP_PRESSURE_MEMORY,
+
+    VIR_CGROUP_PRESSURE_LAST
+} virCgroupPressureResource;
+
+VIR_ENUM_DECL(virCgroupPressureResource);
+
+/* Pressure stall information, the share of time some (or all) of the
+ * tasks were stalled on a resource */
+typedef struct _virCgroupPressure virCgroupPressure;
+typedef virCgroupPressure *virCgroupPressurePtr;
+struct _virCgroupPressure {
+    double avg10; /* percentage over the last 10 seconds */
+    double avg60;
+    double avg300;
+    unsigned long long total; /* total stall time in microseconds */
+};
+
+int virCgroupGetPressure(virCgroupPtr group,
+                         virCgroupPressureResource resource,
+                         virCgroupPressurePtr some,
+                         virCgroupPressurePtr full)
+    ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4);
+
 int virCgroupSetFreezerState(virCgroupPtr group, const char *state);
 int virCgroupGetFreezerState(virCgroupPtr group, char **state);
 
@@ -288,6 +318,7 @@ int virCgroupBindMount(virCgroupPtr group,
                        const char *mountopts);
 
 bool virCgroupSupportsCpuBW(virCgroupPtr cgroup);
+bool virCgroupSupportsPressure(virCgroupPtr cgroup);
 
 int virCgroupSetOwner(virCgroupPtr cgroup,
                       uid_t uid,
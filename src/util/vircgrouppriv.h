@@ -46,6 +46,17 @@ struct virCgroup {
     char *path;
 
     struct virCgroupController controllers[VIR_CGROUP_CONTROLLER_LAST];
+
+    /* Whether all the controllers live in the cgroup v2 unified
+     * hierarchy rather than in separate v1 mounts */
+    bool unified;
+
+    /* With the stat cache enabled, the open files of the statistics
+     * in virCgroupStatFiles, -1 for those not opened yet, and the
+     * buffer they are read into */
+    int *statFds;
+    char *statBuf;
+    size_t statBufSize;
 };
 
 int virCgroupDetectMountsFromFile(virCgroupPtr group,
@@ -30,6 +30,12 @@
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <unistd.h>
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+# include <spawn.h>
+#endif
+#ifdef HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
 
 #if WITH_CAPNG
 # include <cap-ng.h>
@@ -44,6 +50,7 @@
 
 #define __VIR_COMMAND_PRIV_H_ALLOW__
 #include "vircommandpriv.h"
+#include "vircommandbroker.h"
 #include "viralloc.h"
 #include "virerror.h"
 #include "virutil.h"
@@ -53,7 +60,9 @@
 #include "virprocess.h"
 #include "virbuffer.h"
 #include "virthread.h"
+#include "virtrace.h"
 #include "virstring.h"
+#include "virbitmap.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -68,6 +77,7 @@ enum {
     VIR_EXEC_RUN_SYNC   = (1 << 3),
     VIR_EXEC_ASYNC_IO   = (1 << 4),
     VIR_EXEC_LISTEN_FDS = (1 << 5),
+    VIR_EXEC_BROKER     = (1 << 6),
 };
 
 typedef struct _virCommandFD virCommandFD;
@@ -117,6 +127,7 @@ struct _virCommand {
     void *opaque;
 
     pid_t pid;
+    int brokerfd; /* the command broker reports the status over this */
     char *pidfile;
     bool reap;
     bool rawStatus;
@@ -464,6 +475,298 @@ virCommandHandshakeChild(virCommandPtr cmd)
     return 0;
 }
 
+/* Close the file descriptors from 3 up, except the sorted @keep
+ * ones, with a syscall per range of them */
+static int
+virCommandMassCloseRange(const int *keep ATTRIBUTE_UNUSED,
+                         size_t nkeep ATTRIBUTE_UNUSED)
+{
+# ifdef __NR_close_range
+    unsigned int from = STDERR_FILENO + 1;
+    size_t i;
+
+    for (i = 0; i <= nkeep; i++) {
+        unsigned int to = i < nkeep ? keep[i] - 1 : ~0U;
+
+        if (from <= to && syscall(__NR_close_range, from, to, 0) < 0)
+            return -1;
+
+        if (i < nkeep)
+            from = keep[i] + 1;
+    }
+
+    return 0;
+# else
+    errno = ENOSYS;
+    return -1;
+# endif
+}
+
+
+static bool
+virCommandMassCloseKeep(int fd,
+                        const int *keep,
+                        size_t nkeep)
+{
+    size_t i;
+
+    for (i = 0; i < nkeep; i++) {
+        if (keep[i] == fd)
+            return true;
+    }
+
+    return false;
+}
+
+
+/* Close the file descriptors from 3 up, except the @keep ones, which
+ * are open according to /proc/self/fd */
+static int
+virCommandMassCloseProc(const int *keep ATTRIBUTE_UNUSED,
+                        size_t nkeep ATTRIBUTE_UNUSED)
+{
+# ifdef __linux__
+    virBitmapPtr fds = NULL;
+    struct dirent *ent;
+    DIR *dir = NULL;
+    ssize_t fd = STDERR_FILENO;
+    int rc;
+    int ret = -1;
+
+    if (virDirOpenQuiet(&dir, "/proc/self/fd") < 0 ||
+        !(fds = virBitmapNewEmpty()))
+        goto cleanup;
+
+    /* The descriptors are closed only after reading the directory, which
+     * has one open too */
+    while ((rc = virDirRead(dir, &ent, NULL)) > 0) {
+        int val;
+
+        if (virStrToLong_i(ent->d_name, NULL, 10, &val) < 0 ||
+            val <= STDERR_FILENO ||
+            virCommandMassCloseKeep(val, keep, nkeep))
+            continue;
+
+        if (virBitmapSetBitExpand(fds, val) < 0)
+            goto cleanup;
+    }
+
+    if (rc < 0)
+        goto cleanup;
+
+    VIR_DIR_CLOSE(dir);
+
+    while ((fd = virBitmapNextSetBit(fds, fd)) >= 0) {
+        int tmpfd = fd;
+
+        VIR_MASS_CLOSE(tmpfd);
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_DIR_CLOSE(dir);
+    virBitmapFree(fds);
+    return ret;
+# else
+    errno = ENOSYS;
+    return -1;
+# endif
+}
+
+
+/*
+ * Close all file descriptors of the child above the standard ones,
+ * except @childin, @childout, @childerr and the ones passed by
+ * virCommandPassFD(), which are made inheritable.
+ *
+ * Trying to close every descriptor up to _SC_OPEN_MAX, which can be in
+ * the hundreds of thousands, takes much longer than the rest of
+ * starting the child, so that is only done if closing them by ranges
+ * or closing just the open ones is not possible.
+ */
+static int
+virCommandMassClose(virCommandPtr cmd,
+                    int childin,
+                    int childout,
+                    int childerr)
+{
+    int std[] = { childin, childout, childerr };
+    int *keep = NULL;
+    size_t nkeep = 0;
+    size_t i, j;
+    int fd, openmax;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(keep, cmd->npassfd + ARRAY_CARDINALITY(std)) < 0)
+        return -1;
+
+    for (i = 0; i < ARRAY_CARDINALITY(std); i++) {
+        if (std[i] > STDERR_FILENO)
+            keep[nkeep++] = std[i];
+    }
+
+    for (i = 0; i < cmd->npassfd; i++) {
+        fd = cmd->passfd[i].fd;
+
+        if (fd <= STDERR_FILENO)
+            continue;
+
+        if (virSetInherit(fd, true) < 0) {
+            virReportSystemError(errno, _("failed to preserve fd %d"), fd);
+            goto cleanup;
+        }
+
+        keep[nkeep++] = fd;
+    }
+
+    /* insertion sort, dropping duplicates */
+    for (i = 0, j = 0; i < nkeep; i++) {
+        size_t k = j;
+
+        fd = keep[i];
+        while (k > 0 && keep[k - 1] > fd)
+            k--;
+
+        if (k > 0 && keep[k - 1] == fd)
+            continue;
+
+        memmove(keep + k + 1, keep + k, (j - k) * sizeof(*keep));
+        keep[k] = fd;
+        j++;
+    }
+    nkeep = j;
+
+    if (virCommandMassCloseRange(keep, nkeep) == 0 ||
+        virCommandMassCloseProc(keep, nkeep) == 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    openmax = sysconf(_SC_OPEN_MAX);
+    if (openmax < 0) {
+        virReportSystemError(errno,  "%s",
+                             _("sysconf(_SC_OPEN_MAX) failed"));
+        goto cleanup;
+    }
+
+    for (fd = STDERR_FILENO + 1; fd < openmax; fd++) {
+        int tmpfd = fd;
+
+        if (!virCommandMassCloseKeep(fd, keep, nkeep))
+            VIR_MASS_CLOSE(tmpfd);
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(keep);
+    return ret;
+}
+
+
+/* Whether all virExec has to do in the child for @cmd besides
+ * setting up its standard descriptors and closing the others is
+ * executing the binary, which the command broker or posix_spawn can
+ * do without copying the page tables of the whole daemon as fork
+ * does */
+static bool
+virExecIsPlain(virCommandPtr cmd)
+{
+    if (cmd->hook || cmd->handshake || cmd->npassfd ||
+        (cmd->flags & (VIR_EXEC_DAEMON | VIR_EXEC_CLEAR_CAPS |
+                       VIR_EXEC_LISTEN_FDS)) ||
+        cmd->uid != (uid_t)-1 || cmd->gid != (gid_t)-1 ||
+        cmd->capabilities || cmd->mask || cmd->pwd ||
+        cmd->maxMemLock || cmd->maxProcesses || cmd->maxFiles ||
+        cmd->setMaxCore)
+        return false;
+
+# if defined(WITH_SECDRIVER_SELINUX)
+    if (cmd->seLinuxLabel)
+        return false;
+# endif
+# if defined(WITH_SECDRIVER_APPARMOR)
+    if (cmd->appArmorProfile)
+        return false;
+# endif
+
+    return true;
+}
+
+
+# ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+static pid_t
+virExecSpawn(virCommandPtr cmd,
+             const char *binary,
+             int childin,
+             int childout,
+             int childerr)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t sigdefault, sigmask;
+    pid_t pid = -1;
+    int rc = 0;
+
+    if (posix_spawn_file_actions_init(&actions) != 0)
+        return -1;
+
+    if (posix_spawnattr_init(&attr) != 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        return -1;
+    }
+
+    /* Just like virFork, reset all signal handlers and unmask all
+     * signals; dup2() of a descriptor to itself makes it inheritable */
+    sigfillset(&sigdefault);
+    sigemptyset(&sigmask);
+
+    if ((rc = posix_spawnattr_setsigdefault(&attr, &sigdefault)) != 0 ||
+        (rc = posix_spawnattr_setsigmask(&attr, &sigmask)) != 0 ||
+        (rc = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF |
+                                              POSIX_SPAWN_SETSIGMASK)) != 0 ||
+        (rc = posix_spawn_file_actions_adddup2(&actions, childin,
+                                               STDIN_FILENO)) != 0 ||
+        (childout > 0 &&
+         (rc = posix_spawn_file_actions_adddup2(&actions, childout,
+                                                STDOUT_FILENO)) != 0) ||
+        (childerr > 0 &&
+         (rc = posix_spawn_file_actions_adddup2(&actions, childerr,
+                                                STDERR_FILENO)) != 0) ||
+        (rc = posix_spawn_file_actions_addclosefrom_np(&actions,
+                                                       STDERR_FILENO + 1)) != 0)
+        goto cleanup;
+
+    if ((rc = posix_spawn(&pid, binary, &actions, &attr, cmd->args,
+                          cmd->env ? cmd->env : environ)) != 0)
+        pid = -1;
+
+ cleanup:
+    if (pid < 0) {
+        char ebuf[1024];
+
+        VIR_DEBUG("Unable to spawn %s: %s",
+                  binary, virStrerror(rc, ebuf, sizeof(ebuf)));
+    }
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return pid;
+}
+# else /* !HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP */
+static pid_t
+virExecSpawn(virCommandPtr cmd ATTRIBUTE_UNUSED,
+             const char *binary ATTRIBUTE_UNUSED,
+             int childin ATTRIBUTE_UNUSED,
+             int childout ATTRIBUTE_UNUSED,
+             int childerr ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+# endif /* !HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP */
+
+
 /*
  * virExec:
  * @cmd virCommandPtr containing all information about the program to
@@ -473,13 +776,12 @@ static int
 virExec(virCommandPtr cmd)
 {
     pid_t pid;
-    int null = -1, fd, openmax;
+    int null = -1;
     int pipeout[2] = {-1, -1};
     int pipeerr[2] = {-1, -1};
     int childin = cmd->infd;
     int childout = -1;
     int childerr = -1;
-    int tmpfd;
     char *binarystr = NULL;
     const char *binary = NULL;
     int ret;
@@ -556,13 +858,26 @@ virExec(virCommandPtr cmd)
         childerr = null;
     }
 
-    if ((ngroups = virGetGroupList(cmd->uid, cmd->gid, &groups)) < 0)
-        goto cleanup;
+    /* The broker and posix_spawn fail right away if they can't run
+     * the command, the exit status of a child failing to execute the
+     * binary is left to doing it all by hand after fork */
+    pid = -1;
+    if (virExecIsPlain(cmd)) {
+        if (cmd->flags & VIR_EXEC_BROKER)
+            cmd->brokerfd = virCommandBrokerExec(binary, cmd->args, cmd->env,
+                                                 childin, childout, childerr,
+                                                 &pid);
+        if (pid < 0)
+            pid = virExecSpawn(cmd, binary, childin, childout, childerr);
+    }
 
-    pid = virFork();
+    if (pid < 0) {
+        if ((ngroups = virGetGroupList(cmd->uid, cmd->gid, &groups)) < 0)
+            goto cleanup;
 
-    if (pid < 0)
-        goto cleanup;
+        if ((pid = virFork()) < 0)
+            goto cleanup;
+    }
 
     if (pid) { /* parent */
         VIR_FORCE_CLOSE(null);
@@ -588,23 +903,8 @@ virExec(virCommandPtr cmd)
     if (cmd->mask)
         umask(cmd->mask);
     ret = EXIT_CANCELED;
-    openmax = sysconf(_SC_OPEN_MAX);
-    if (openmax < 0) {
-        virReportSystemError(errno,  "%s",
-                             _("sysconf(_SC_OPEN_MAX) failed"));
+    if (virCommandMassClose(cmd, childin, childout, childerr) < 0)
         goto fork_error;
-    }
-    for (fd = 3; fd < openmax; fd++) {
-        if (fd == childin || fd == childout || fd == childerr)
-            continue;
-        if (!virCommandFDIsSet(cmd, fd)) {
-            tmpfd = fd;
-            VIR_MASS_CLOSE(tmpfd);
-        } else if (virSetInherit(fd, true) < 0) {
-            virReportSystemError(errno, _("failed to preserve fd %d"), fd);
-            goto fork_error;
-        }
-    }
 
     if (prepareStdFd(childin, STDIN_FILENO) < 0) {
         virReportSystemError(errno,
@@ -905,6 +1205,7 @@ virCommandNewArgs(const char *const*args)
 
     cmd->infd = cmd->inpipe = cmd->outfd = cmd->errfd = -1;
     cmd->pid = -1;
+    cmd->brokerfd = -1;
     cmd->uid = -1;
     cmd->gid = -1;
 
@@ -2186,23 +2487,8 @@ int virCommandExec(virCommandPtr cmd ATTRIBUTE_UNUSED)
 }
 #endif
 
-/**
- * virCommandRun:
- * @cmd: command to run
- * @exitstatus: optional status collection
- *
- * Run the command and wait for completion.
- * Returns -1 on any error executing the
- * command. Returns 0 if the command executed,
- * with the exit status set.  If @exitstatus is NULL, then the
- * child must exit with status 0 for this to succeed.  By default,
- * a non-NULL @exitstatus contains the normal exit status of the child
- * (death from a signal is treated as execution error); but if
- * virCommandRawStatus() was used, it instead contains the raw exit
- * status that the caller must then decipher using WIFEXITED() and friends.
- */
-int
-virCommandRun(virCommandPtr cmd, int *exitstatus)
+static int
+virCommandRunInternal(virCommandPtr cmd, int *exitstatus)
 {
     int ret = 0;
     char *outbuf = NULL;
@@ -2324,6 +2610,37 @@ virCommandRun(virCommandPtr cmd, int *exitstatus)
 }
 
 
+/**
+ * virCommandRun:
+ * @cmd: command to run
+ * @exitstatus: optional status collection
+ *
+ * Run the command and wait for completion.
+ * Returns -1 on any error executing the
+ * command. Returns 0 if the command executed,
+ * with the exit status set.  If @exitstatus is NULL, then the
+ * child must exit with status 0 for this to succeed.  By default,
+ * a non-NULL @exitstatus contains the normal exit status of the child
+ * (death from a signal is treated as execution error); but if
+ * virCommandRawStatus() was used, it instead contains the raw exit
+ * status that the caller must then decipher using WIFEXITED() and friends.
+ */
+int
+virCommandRun(virCommandPtr cmd, int *exitstatus)
+{
+    int span = virTraceSpanBegin("virCommandRun");
+    int ret;
+
+    if (cmd && cmd->args)
+        virTraceSpanTag(span, "command", "%s", cmd->args[0]);
+
+    ret = virCommandRunInternal(cmd, exitstatus);
+
+    virTraceSpanEnd(span);
+    return ret;
+}
+
+
 static void
 virCommandDoAsyncIOHelper(void *opaque)
 {
@@ -2446,7 +2763,12 @@ virCommandRunAsync(virCommandPtr cmd, pid_t *pid)
     }
 
     VIR_DEBUG("About to run %s", str ? str : cmd->args[0]);
+    /* The broker reaps the commands it runs, so it can't be used when
+     * the caller is going to wait for the pid */
+    if (!pid)
+        cmd->flags |= VIR_EXEC_BROKER;
     ret = virExec(cmd);
+    cmd->flags &= ~VIR_EXEC_BROKER;
     VIR_DEBUG("Command result %d, with PID %d",
               ret, (int)cmd->pid);
 
@@ -2540,7 +2862,10 @@ virCommandWait(virCommandPtr cmd, int *exitstatus)
      * message is not as detailed as what we can provide.  So, we
      * guarantee that virProcessWait only fails due to failure to wait,
      * and repeat the exitstatus check code ourselves.  */
-    ret = virProcessWait(cmd->pid, &status, true);
+    if (cmd->brokerfd >= 0)
+        ret = virCommandBrokerWait(cmd->brokerfd, &status);
+    else
+        ret = virProcessWait(cmd->pid, &status, true);
     if (cmd->flags & VIR_EXEC_ASYNC_IO) {
         cmd->flags &= ~VIR_EXEC_ASYNC_IO;
         virThreadJoin(cmd->asyncioThread);
@@ -2558,6 +2883,7 @@ virCommandWait(virCommandPtr cmd, int *exitstatus)
     if (ret == 0) {
         cmd->pid = -1;
         cmd->reap = false;
+        VIR_FORCE_CLOSE(cmd->brokerfd);
         if (exitstatus && (cmd->rawStatus || WIFEXITED(status))) {
             *exitstatus = cmd->rawStatus ? status : WEXITSTATUS(status);
         } else if (status) {
@@ -2595,7 +2921,11 @@ virCommandAbort(virCommandPtr cmd)
 {
     if (!cmd || cmd->pid == -1)
         return;
-    virProcessAbort(cmd->pid);
+    /* The broker kills the command once we hang up */
+    if (cmd->brokerfd >= 0)
+        VIR_FORCE_CLOSE(cmd->brokerfd);
+    else
+        virProcessAbort(cmd->pid);
     cmd->pid = -1;
     cmd->reap = false;
 }
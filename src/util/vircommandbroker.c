@@ -0,0 +1,568 @@
+/*
+ * vircommandbroker.c: pre-forked helper running commands for the daemon
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <passfd.h>
+
+#include "vircommandbroker.h"
+#include "vircommand.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virlog.h"
+#include "virprocess.h"
+#include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("util.commandbroker");
+
+/*
+ * The broker is forked from the daemon when it starts, while it is
+ * still small and single threaded. For each command the daemon sends
+ * it one end of a new socket pair over the control socket, and the
+ * broker forks a worker serving the request on it: the worker receives
+ * the standard descriptors of the command, then its binary, arguments
+ * and environment, runs it and replies with its pid and later with its
+ * raw exit status. Closing the socket pair before the status arrived
+ * makes the worker kill the command.
+ *
+ * The output of the command goes straight to the descriptors passed by
+ * the daemon, so nothing has to be copied through the broker.
+ */
+
+/* Upper bound for the strings of one command */
+#define VIR_COMMAND_BROKER_MAX_REQUEST (4 * 1024 * 1024)
+
+typedef struct _virCommandBrokerRequest virCommandBrokerRequest;
+struct _virCommandBrokerRequest {
+    uint32_t nargs;
+    uint32_t nenv;
+    uint32_t len;  /* NUL separated binary, arguments and environment */
+};
+
+static virMutex brokerLock = VIR_MUTEX_INITIALIZER;
+static int brokerControl = -1;
+static pid_t brokerPid = -1;
+static virCommandBrokerStats brokerStats;
+
+
+static unsigned long long
+virCommandBrokerNow(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000ull;
+#else
+    unsigned long long now;
+
+    if (virTimeMillisNowRaw(&now) < 0)
+        return 0;
+
+    return now * 1000ull;
+#endif
+}
+
+
+#ifndef WIN32
+static int workerSignalFd = -1;
+
+static void
+virCommandBrokerWorkerSignal(int signum ATTRIBUTE_UNUSED)
+{
+    int saved_errno = errno;
+    char c = 0;
+
+    ignore_value(write(workerSignalFd, &c, 1));
+    errno = saved_errno;
+}
+
+
+/* Wait for @pid to exit, killing it like virProcessAbort would if the
+ * daemon closes @sock first, and return its raw status */
+static int
+virCommandBrokerWorkerWait(int sock, int sigfd, pid_t pid)
+{
+    struct pollfd pfd[2];
+    int killed = 0;
+    int status;
+    char c;
+
+    pfd[0].fd = sigfd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = sock;
+    pfd[1].events = POLLIN;
+
+    while (waitpid(pid, &status, WNOHANG) != pid) {
+        int rc = poll(pfd, killed ? 1 : 2, killed == 1 ? 10 : -1);
+
+        if (rc < 0 && errno != EINTR) {
+            kill(pid, SIGKILL);
+            while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+            break;
+        }
+
+        if (rc == 0) {
+            kill(pid, SIGKILL);
+            killed = 2;
+            continue;
+        }
+
+        while (read(sigfd, &c, 1) > 0);
+
+        if (!killed && pfd[1].revents) {
+            kill(pid, SIGTERM);
+            killed = 1;
+        }
+    }
+
+    return status;
+}
+
+
+static void ATTRIBUTE_NORETURN
+virCommandBrokerWorker(int sock)
+{
+    virCommandBrokerRequest req;
+    struct sigaction sig_action;
+    int fds[3] = { -1, -1, -1 };
+    int sigpipe[2] = { -1, -1 };
+    char *buf = NULL;
+    char **strs = NULL;
+    char *p;
+    size_t nstrs;
+    size_t i;
+    pid_t pid;
+    int32_t reply = -1;
+
+    for (i = 0; i < ARRAY_CARDINALITY(fds); i++) {
+        if ((fds[i] = recvfd(sock, O_CLOEXEC)) < 0)
+            goto error;
+    }
+
+    if (saferead(sock, &req, sizeof(req)) != sizeof(req) ||
+        req.len == 0 || req.len > VIR_COMMAND_BROKER_MAX_REQUEST ||
+        req.nargs == 0 || req.nargs > req.len || req.nenv > req.len)
+        goto error;
+
+    /* binary, arguments and NULL, environment and NULL */
+    nstrs = 1 + req.nargs + req.nenv;
+    if (VIR_ALLOC_N_QUIET(buf, req.len) < 0 ||
+        VIR_ALLOC_N_QUIET(strs, nstrs + 2) < 0 ||
+        saferead(sock, buf, req.len) != req.len ||
+        buf[req.len - 1] != '\0')
+        goto error;
+
+    for (p = buf, i = 0; p < buf + req.len; p += strlen(p) + 1, i++) {
+        if (i == nstrs)
+            goto error;
+        strs[i <= req.nargs ? i : i + 1] = p;
+    }
+    if (i != nstrs)
+        goto error;
+
+    if (pipe2(sigpipe, O_CLOEXEC | O_NONBLOCK) < 0)
+        goto error;
+    workerSignalFd = sigpipe[1];
+
+    memset(&sig_action, 0, sizeof(sig_action));
+    sig_action.sa_handler = virCommandBrokerWorkerSignal;
+    sig_action.sa_flags = SA_NOCLDSTOP;
+    sigemptyset(&sig_action.sa_mask);
+    if (sigaction(SIGCHLD, &sig_action, NULL) < 0)
+        goto error;
+
+    if ((pid = fork()) < 0)
+        goto error;
+
+    if (pid == 0) {
+        /* All other descriptors are close-on-exec */
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+
+        if (dup2(fds[0], STDIN_FILENO) < 0 ||
+            dup2(fds[1], STDOUT_FILENO) < 0 ||
+            dup2(fds[2], STDERR_FILENO) < 0)
+            _exit(EXIT_CANCELED);
+
+        execve(strs[0], strs + 1, strs + req.nargs + 2);
+        _exit(errno == ENOENT ? EXIT_ENOENT : EXIT_CANNOT_INVOKE);
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(fds); i++)
+        VIR_FORCE_CLOSE(fds[i]);
+
+    reply = pid;
+    ignore_value(safewrite(sock, &reply, sizeof(reply)));
+
+    reply = virCommandBrokerWorkerWait(sock, sigpipe[0], pid);
+    ignore_value(safewrite(sock, &reply, sizeof(reply)));
+    _exit(EXIT_SUCCESS);
+
+ error:
+    ignore_value(safewrite(sock, &reply, sizeof(reply)));
+    _exit(EXIT_FAILURE);
+}
+
+
+/* The broker never executes anything itself, so instead of closing the
+ * descriptors inherited from the daemon it only makes sure none of
+ * them leaks into the commands */
+static void
+virCommandBrokerSetCloseExec(void)
+{
+    DIR *dir;
+    struct dirent *ent;
+    int openmax;
+    int fd;
+
+    for (fd = STDIN_FILENO; fd <= STDERR_FILENO; fd++) {
+        if (fcntl(fd, F_GETFD) < 0 &&
+            open("/dev/null", O_RDWR) < 0)
+            _exit(EXIT_CANCELED);
+    }
+
+    if ((dir = opendir("/proc/self/fd"))) {
+        while ((ent = readdir(dir))) {
+            if (virStrToLong_i(ent->d_name, NULL, 10, &fd) == 0 &&
+                fd > STDERR_FILENO)
+                ignore_value(virSetCloseExec(fd));
+        }
+        closedir(dir);
+        return;
+    }
+
+    if ((openmax = sysconf(_SC_OPEN_MAX)) < 0)
+        openmax = 1024;
+
+    for (fd = STDERR_FILENO + 1; fd < openmax; fd++)
+        ignore_value(virSetCloseExec(fd));
+}
+
+
+static void ATTRIBUTE_NORETURN
+virCommandBrokerMain(int control)
+{
+    struct sigaction sig_action;
+    int sock;
+    pid_t pid;
+
+    virCommandBrokerSetCloseExec();
+
+    /* Workers are never waited for */
+    memset(&sig_action, 0, sizeof(sig_action));
+    sig_action.sa_handler = SIG_IGN;
+    sigemptyset(&sig_action.sa_mask);
+    ignore_value(sigaction(SIGCHLD, &sig_action, NULL));
+    ignore_value(sigaction(SIGPIPE, &sig_action, NULL));
+
+    while (true) {
+        if ((sock = recvfd(control, O_CLOEXEC)) < 0) {
+            if (errno == EINTR)
+                continue;
+            /* The daemon went away */
+            _exit(EXIT_SUCCESS);
+        }
+
+        if ((pid = fork()) == 0) {
+            VIR_FORCE_CLOSE(control);
+            virCommandBrokerWorker(sock);
+        }
+
+        if (pid < 0) {
+            int32_t reply = -1;
+
+            ignore_value(safewrite(sock, &reply, sizeof(reply)));
+        }
+        VIR_FORCE_CLOSE(sock);
+    }
+}
+
+
+/**
+ * virCommandBrokerStart:
+ *
+ * Fork the command broker. This should be done as early as possible,
+ * before the daemon starts any thread.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virCommandBrokerStart(void)
+{
+    int pair[2];
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to create command broker socket"));
+        return -1;
+    }
+
+    if ((pid = virFork()) < 0) {
+        VIR_FORCE_CLOSE(pair[0]);
+        VIR_FORCE_CLOSE(pair[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        VIR_FORCE_CLOSE(pair[0]);
+        virCommandBrokerMain(pair[1]);
+    }
+
+    VIR_FORCE_CLOSE(pair[1]);
+    if (virSetCloseExec(pair[0]) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to set close-on-exec flag"));
+        VIR_FORCE_CLOSE(pair[0]);
+        virProcessAbort(pid);
+        return -1;
+    }
+
+    virMutexLock(&brokerLock);
+    brokerControl = pair[0];
+    brokerPid = pid;
+    virMutexUnlock(&brokerLock);
+
+    VIR_DEBUG("Started command broker with pid %lld", (long long) pid);
+    return 0;
+}
+
+
+/* Hand the socket pair end @sock over to the broker, if it runs */
+static int
+virCommandBrokerSend(int sock)
+{
+    int ret = -1;
+
+    virMutexLock(&brokerLock);
+    if (brokerControl < 0)
+        goto cleanup;
+
+    if (sendfd(brokerControl, sock) < 0) {
+        VIR_WARN("Command broker %lld went away, running commands directly",
+                 (long long) brokerPid);
+        VIR_FORCE_CLOSE(brokerControl);
+        virProcessAbort(brokerPid);
+        brokerPid = -1;
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virMutexUnlock(&brokerLock);
+    return ret;
+}
+
+
+/**
+ * virCommandBrokerExec:
+ * @binary: absolute path to the binary to execute
+ * @argv: NULL terminated list of arguments, including argv[0]
+ * @envp: NULL terminated environment of the command, or NULL to pass
+ *        the environment of the daemon
+ * @childin: descriptor to use as the standard input of the command
+ * @childout: descriptor to use as the standard output of the command
+ * @childerr: descriptor to use as the standard error of the command
+ * @pid: filled with the pid of the command
+ *
+ * Have the broker run a command. Nothing is reported on failure, the
+ * caller is expected to run the command itself then.
+ *
+ * Returns a descriptor to pass to virCommandBrokerWait(), closing it
+ * before kills the command, or -1 if the broker didn't run it.
+ */
+int
+virCommandBrokerExec(const char *binary,
+                     char *const *argv,
+                     char *const *envp,
+                     int childin,
+                     int childout,
+                     int childerr,
+                     pid_t *pid)
+{
+    virCommandBrokerRequest req;
+    unsigned long long start = virCommandBrokerNow();
+    unsigned long long latency;
+    int pair[2] = { -1, -1 };
+    char *buf = NULL;
+    char *p;
+    size_t len;
+    size_t i;
+    int32_t reply;
+
+    virMutexLock(&brokerLock);
+    if (brokerControl < 0) {
+        virMutexUnlock(&brokerLock);
+        return -1;
+    }
+    virMutexUnlock(&brokerLock);
+
+    if (!envp)
+        envp = environ;
+
+    len = strlen(binary) + 1;
+    for (req.nargs = 0; argv[req.nargs]; req.nargs++)
+        len += strlen(argv[req.nargs]) + 1;
+    for (req.nenv = 0; envp[req.nenv]; req.nenv++)
+        len += strlen(envp[req.nenv]) + 1;
+
+    if (len > VIR_COMMAND_BROKER_MAX_REQUEST ||
+        VIR_ALLOC_N_QUIET(buf, len) < 0)
+        goto error;
+    req.len = len;
+
+    p = stpcpy(buf, binary) + 1;
+    for (i = 0; argv[i]; i++)
+        p = stpcpy(p, argv[i]) + 1;
+    for (i = 0; envp[i]; i++)
+        p = stpcpy(p, envp[i]) + 1;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0 ||
+        virSetCloseExec(pair[0]) < 0 ||
+        virSetCloseExec(pair[1]) < 0 ||
+        virCommandBrokerSend(pair[1]) < 0)
+        goto error;
+    VIR_FORCE_CLOSE(pair[1]);
+
+    if (sendfd(pair[0], childin) < 0 ||
+        sendfd(pair[0], childout) < 0 ||
+        sendfd(pair[0], childerr) < 0 ||
+        safewrite(pair[0], &req, sizeof(req)) != sizeof(req) ||
+        safewrite(pair[0], buf, len) != len ||
+        saferead(pair[0], &reply, sizeof(reply)) != sizeof(reply) ||
+        reply <= 0)
+        goto error;
+
+    *pid = reply;
+    latency = virCommandBrokerNow() - start;
+
+    virMutexLock(&brokerLock);
+    brokerStats.commands++;
+    brokerStats.latencyTotal += latency;
+    if (latency > brokerStats.latencyMax)
+        brokerStats.latencyMax = latency;
+    virMutexUnlock(&brokerLock);
+
+    VIR_DEBUG("Broker started %s with pid %lld in %llu us",
+              binary, (long long) *pid, latency);
+    VIR_FREE(buf);
+    return pair[0];
+
+ error:
+    VIR_DEBUG("Broker failed to start %s", binary);
+    virMutexLock(&brokerLock);
+    brokerStats.failures++;
+    virMutexUnlock(&brokerLock);
+
+    VIR_FORCE_CLOSE(pair[0]);
+    VIR_FORCE_CLOSE(pair[1]);
+    VIR_FREE(buf);
+    return -1;
+}
+
+
+/**
+ * virCommandBrokerWait:
+ * @fd: descriptor returned by virCommandBrokerExec()
+ * @status: filled with the raw exit status of the command
+ *
+ * Wait for a command run by the broker to exit. @fd is not closed.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virCommandBrokerWait(int fd, int *status)
+{
+    int32_t reply;
+
+    if (saferead(fd, &reply, sizeof(reply)) != sizeof(reply)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("command broker didn't report the exit status"));
+        return -1;
+    }
+
+    *status = reply;
+    return 0;
+}
+#else /* WIN32 */
+int
+virCommandBrokerStart(void)
+{
+    virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                   _("command broker is not supported on this platform"));
+    return -1;
+}
+
+
+int
+virCommandBrokerExec(const char *binary ATTRIBUTE_UNUSED,
+                     char *const *argv ATTRIBUTE_UNUSED,
+                     char *const *envp ATTRIBUTE_UNUSED,
+                     int childin ATTRIBUTE_UNUSED,
+                     int childout ATTRIBUTE_UNUSED,
+                     int childerr ATTRIBUTE_UNUSED,
+                     pid_t *pid ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+
+int
+virCommandBrokerWait(int fd ATTRIBUTE_UNUSED,
+                     int *status ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                   _("command broker is not supported on this platform"));
+    return -1;
+}
+#endif /* WIN32 */
+
+
+/**
+ * virCommandBrokerGetStats:
+ * @stats: filled with the statistics of the broker
+ *
+ * The latency of a command is the time from the request to the broker
+ * until its pid is known to the daemon.
+ */
+void
+virCommandBrokerGetStats(virCommandBrokerStatsPtr stats)
+{
+    virMutexLock(&brokerLock);
+    *stats = brokerStats;
+    virMutexUnlock(&brokerLock);
+}
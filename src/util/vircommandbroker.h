@@ -0,0 +1,52 @@
+/*
+ * vircommandbroker.h: pre-forked helper running commands for the daemon
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_COMMAND_BROKER_H__
+# define __VIR_COMMAND_BROKER_H__
+
+# include "internal.h"
+
+typedef struct _virCommandBrokerStats virCommandBrokerStats;
+typedef virCommandBrokerStats *virCommandBrokerStatsPtr;
+struct _virCommandBrokerStats {
+    unsigned long long commands;      /* started by the broker */
+    unsigned long long failures;      /* the broker couldn't start */
+    unsigned long long latencyTotal;  /* in microseconds */
+    unsigned long long latencyMax;    /* in microseconds */
+};
+
+int virCommandBrokerStart(void);
+
+int virCommandBrokerExec(const char *binary,
+                         char *const *argv,
+                         char *const *envp,
+                         int childin,
+                         int childout,
+                         int childerr,
+                         pid_t *pid)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(7);
+int virCommandBrokerWait(int fd, int *status)
+    ATTRIBUTE_NONNULL(2);
+
+void virCommandBrokerGetStats(virCommandBrokerStatsPtr stats)
+    ATTRIBUTE_NONNULL(1);
+
+#endif /* __VIR_COMMAND_BROKER_H__ */
@@ -38,6 +38,7 @@
 #include "internal.h"
 #include "datatypes.h"
 #include "virbitmap.h"
+#include "vircrypto.h"
 #include "virdnsmasq.h"
 #include "virutil.h"
 #include "vircommand.h"
@@ -53,6 +54,7 @@ VIR_LOG_INIT("util.dnsmasq");
 
 #define DNSMASQ_HOSTSFILE_SUFFIX "hostsfile"
 #define DNSMASQ_ADDNHOSTSFILE_SUFFIX "addnhosts"
+#define DNSMASQ_HOSTSDIR_SUFFIX "hostsdir"
 
 static void
 dhcphostFree(dnsmasqDhcpHost *host)
@@ -280,6 +282,43 @@ genericFileDelete(char *path)
     return 0;
 }
 
+/* Remove every entry from a dhcp-hostsdir, but keep the directory
+ * itself: dnsmasq holds an inotify watch on it for its whole lifetime.
+ */
+static int
+hostsdirClear(const char *path)
+{
+    DIR *dir = NULL;
+    struct dirent *ent;
+    char *file = NULL;
+    int direrr;
+    int ret = -1;
+
+    if ((direrr = virDirOpenIfExists(&dir, path)) <= 0)
+        return direrr;
+
+    while ((direrr = virDirRead(dir, &ent, path)) > 0) {
+        if (!(file = virFileBuildPath(path, ent->d_name, NULL)))
+            goto cleanup;
+
+        if (unlink(file) < 0 && errno != ENOENT) {
+            virReportSystemError(errno, _("cannot remove config file '%s'"),
+                                 file);
+            goto cleanup;
+        }
+        VIR_FREE(file);
+    }
+    if (direrr < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(file);
+    VIR_DIR_CLOSE(dir);
+    return ret;
+}
+
 static void
 hostsfileFree(dnsmasqHostsfile *hostsfile)
 {
@@ -475,6 +514,10 @@ dnsmasqContextNew(const char *network_name,
     if (VIR_STRDUP(ctx->config_dir, config_dir) < 0)
         goto error;
 
+    if (!(ctx->hostsdir = virFileBuildPath(config_dir, network_name,
+                                           "." DNSMASQ_HOSTSDIR_SUFFIX)))
+        goto error;
+
     if (!(ctx->hostsfile = hostsfileNew(network_name, config_dir)))
         goto error;
     if (!(ctx->addnhostsfile = addnhostsNew(network_name, config_dir)))
@@ -500,6 +543,7 @@ dnsmasqContextFree(dnsmasqContext *ctx)
         return;
 
     VIR_FREE(ctx->config_dir);
+    VIR_FREE(ctx->hostsdir);
 
     if (ctx->hostsfile)
         hostsfileFree(ctx->hostsfile);
@@ -570,6 +614,76 @@ dnsmasqSave(const dnsmasqContext *ctx)
             ret = addnhostsSave(ctx->addnhostsfile);
     }
 
+    /* The hostsfile now holds every dhcp-host, so drop the entries
+     * added at runtime; they are read again along with it on SIGHUP.
+     */
+    if (ret == 0) {
+        if (virFileMakePath(ctx->hostsdir) < 0) {
+            virReportSystemError(errno,
+                                 _("cannot create config directory '%s'"),
+                                 ctx->hostsdir);
+            return -1;
+        }
+        ret = hostsdirClear(ctx->hostsdir);
+    }
+
+    return ret;
+}
+
+
+/**
+ * dnsmasqSaveDhcpHostsdirEntry:
+ * @ctx: pointer to the dnsmasq context for each network
+ * @entry: a dhcp-host line, as stored in the hostsfile
+ *
+ * Add a single dhcp-host entry to a running dnsmasq by writing it to
+ * its own file in the dhcp-hostsdir, which dnsmasq watches with
+ * inotify, so that no SIGHUP or restart is needed.  Note that dnsmasq
+ * only picks up additions this way: a removed or changed entry stays
+ * in effect until the next dnsmasqSave() and dnsmasqReload().
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int
+dnsmasqSaveDhcpHostsdirEntry(const dnsmasqContext *ctx,
+                             const char *entry)
+{
+    char *hash = NULL;
+    char *path = NULL;
+    char *tmp = NULL;
+    char *content = NULL;
+    int ret = -1;
+
+    /* the name only has to be unique and safe to use as a file name */
+    if (virCryptoHashString(VIR_CRYPTO_HASH_SHA256, entry, &hash) < 0)
+        goto cleanup;
+
+    /* dnsmasq ignores files whose name starts with a dot, so write the
+     * entry there first and only rename it into place once complete.
+     */
+    if (virAsprintf(&path, "%s/%s", ctx->hostsdir, hash) < 0 ||
+        virAsprintf(&tmp, "%s/.%s.new", ctx->hostsdir, hash) < 0 ||
+        virAsprintf(&content, "%s\n", entry) < 0)
+        goto cleanup;
+
+    if (virFileWriteStr(tmp, content, 0644) < 0) {
+        virReportSystemError(errno, _("cannot write config file '%s'"), tmp);
+        goto cleanup;
+    }
+
+    if (rename(tmp, path) < 0) {
+        virReportSystemError(errno, _("cannot write config file '%s'"), path);
+        unlink(tmp);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(hash);
+    VIR_FREE(path);
+    VIR_FREE(tmp);
+    VIR_FREE(content);
     return ret;
 }
 
@@ -589,6 +703,9 @@ dnsmasqDelete(const dnsmasqContext *ctx)
         ret = genericFileDelete(ctx->hostsfile->path);
     if (ctx->addnhostsfile)
         ret = genericFileDelete(ctx->addnhostsfile->path);
+    if (hostsdirClear(ctx->hostsdir) < 0 ||
+        (rmdir(ctx->hostsdir) < 0 && errno != ENOENT))
+        ret = -1;
 
     return ret;
 }
@@ -691,13 +808,18 @@ dnsmasqCapsSetFromBuffer(dnsmasqCapsPtr caps, const char *buf)
     if (strstr(buf, "--ra-param"))
         dnsmasqCapsSet(caps, DNSMASQ_CAPS_RA_PARAM);
 
+    if (strstr(buf, "--dhcp-hostsdir"))
+        dnsmasqCapsSet(caps, DNSMASQ_CAPS_DHCP_HOSTSDIR);
+
     VIR_INFO("dnsmasq version is %d.%d, --bind-dynamic is %spresent, "
-             "SO_BINDTODEVICE is %sin use, --ra-param is %spresent",
+             "SO_BINDTODEVICE is %sin use, --ra-param is %spresent, "
+             "--dhcp-hostsdir is %spresent",
              (int)caps->version / 1000000,
              (int)(caps->version % 1000000) / 1000,
              dnsmasqCapsGet(caps, DNSMASQ_CAPS_BIND_DYNAMIC) ? "" : "NOT ",
              dnsmasqCapsGet(caps, DNSMASQ_CAPS_BINDTODEVICE) ? "" : "NOT ",
-             dnsmasqCapsGet(caps, DNSMASQ_CAPS_RA_PARAM) ? "" : "NOT ");
+             dnsmasqCapsGet(caps, DNSMASQ_CAPS_RA_PARAM) ? "" : "NOT ",
+             dnsmasqCapsGet(caps, DNSMASQ_CAPS_DHCP_HOSTSDIR) ? "" : "NOT ");
     return 0;
 
  fail:
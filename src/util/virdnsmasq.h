@@ -64,6 +64,7 @@ typedef struct
 typedef struct
 {
     char                 *config_dir;
+    char                 *hostsdir;  /* Absolute path of dnsmasq's dhcp-hostsdir. */
     dnsmasqHostsfile     *hostsfile;
     dnsmasqAddnHostsfile *addnhostsfile;
 } dnsmasqContext;
@@ -72,6 +73,7 @@ typedef enum {
    DNSMASQ_CAPS_BIND_DYNAMIC = 0, /* support for --bind-dynamic */
    DNSMASQ_CAPS_BINDTODEVICE = 1, /* uses SO_BINDTODEVICE for --bind-interfaces */
    DNSMASQ_CAPS_RA_PARAM = 2,     /* support for --ra-param */
+   DNSMASQ_CAPS_DHCP_HOSTSDIR = 3, /* support for --dhcp-hostsdir */
 
    DNSMASQ_CAPS_LAST,             /* this must always be the last item */
 } dnsmasqCapsFlags;
@@ -93,6 +95,8 @@ int              dnsmasqAddHost(dnsmasqContext *ctx,
                                 virSocketAddr *ip,
                                 const char *name);
 int              dnsmasqSave(const dnsmasqContext *ctx);
+int              dnsmasqSaveDhcpHostsdirEntry(const dnsmasqContext *ctx,
+                                              const char *entry);
 int              dnsmasqDelete(const dnsmasqContext *ctx);
 int              dnsmasqReload(pid_t pid);
 
@@ -78,6 +78,27 @@ virEventAddHandle(int fd,
     return addHandleImpl(fd, events, cb, opaque, ff);
 }
 
+/*
+ * virEventAddHandleAffinity:
+ *
+ * Same as virEventAddHandle, with @key selecting which event loop
+ * thread dispatches the callback when the default implementation
+ * runs more than one. Other implementations ignore @key.
+ */
+int
+virEventAddHandleAffinity(int fd,
+                          int events,
+                          virEventHandleCallback cb,
+                          void *opaque,
+                          virFreeCallback ff,
+                          unsigned int key)
+{
+    if (addHandleImpl == virEventPollAddHandle)
+        return virEventPollAddHandleAffinity(fd, events, cb, opaque, ff, key);
+
+    return virEventAddHandle(fd, events, cb, opaque, ff);
+}
+
 /**
  * virEventUpdateHandle:
  *
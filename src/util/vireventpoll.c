@@ -30,6 +30,12 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+#ifdef HAVE_DLADDR
+# include <dlfcn.h>
+#endif
 
 #include "virthread.h"
 #include "virlog.h"
@@ -40,6 +46,10 @@
 #include "virerror.h"
 #include "virprobe.h"
 #include "virtime.h"
+#include "virhash.h"
+#include "virhashcode.h"
+#include "viratomic.h"
+#include "virstring.h"
 
 #define EVENT_DEBUG(fmt, ...) VIR_DEBUG(fmt, __VA_ARGS__)
 
@@ -47,7 +57,9 @@
 
 VIR_LOG_INIT("util.eventpoll");
 
-static int virEventPollInterruptLocked(void);
+struct virEventPollLoop;
+
+static int virEventPollInterruptLocked(struct virEventPollLoop *loop);
 
 /* State for a single file handle being monitored */
 struct virEventPollHandle {
@@ -58,6 +70,7 @@ struct virEventPollHandle {
     virFreeCallback ff;
     void *opaque;
     int deleted;
+    size_t nextSameFD; /* Index+1 of next handle watching @fd, 0 if none */
 };
 
 /* State for a single timer being generated */
@@ -69,13 +82,38 @@ struct virEventPollTimeout {
     virFreeCallback ff;
     void *opaque;
     int deleted;
+    size_t heapIndex; /* Index+1 in the timer heap, 0 if not armed */
+};
+
+/* Per file descriptor state, indexed by the fd number */
+struct virEventPollFD {
+    size_t firstHandle; /* Index+1 of first handle watching this fd */
+    int events;         /* Native events currently in the interest set */
+    bool nonpollable;   /* Regular file or similar, always ready */
 };
 
 /* Allocate extra slots for virEventPollHandle/virEventPollTimeout
    records in this multiple */
 #define EVENT_ALLOC_EXTENT 10
 
-/* State for the main event loop */
+/* Kernel interface used to wait for events on the registered
+ * file handles. All callbacks except @wait are invoked with the
+ * event loop lock held. */
+struct virEventPollBackend {
+    const char *name;
+    int (*init)(struct virEventPollLoop *loop);
+    /* Resync the interest set for @fd after a handle change */
+    void (*updateFD)(struct virEventPollLoop *loop, int fd);
+    /* Gather the set of fds to wait on */
+    int (*prepare)(struct virEventPollLoop *loop);
+    /* Block until an event arrives or @timeout expires; returns the
+     * number of ready fds or -1 with errno set */
+    int (*wait)(struct virEventPollLoop *loop, int timeout);
+    /* Invoke callbacks for the @nready fds reported by @wait */
+    int (*dispatch)(struct virEventPollLoop *loop, int nready);
+};
+
+/* State for an event loop */
 struct virEventPollLoop {
     virMutex lock;
     int running;
@@ -84,68 +122,187 @@ struct virEventPollLoop {
     size_t handlesCount;
     size_t handlesAlloc;
     struct virEventPollHandle *handles;
+    /* Armed timers, as a binary min-heap ordered by expiry */
     size_t timeoutsCount;
     size_t timeoutsAlloc;
-    struct virEventPollTimeout *timeouts;
+    struct virEventPollTimeout **timeouts;
+    /* All live timers, keyed by timer ID */
+    virHashTablePtr timers;
+    /* Timers removed since the last cleanup, waiting for their
+     * free callback to be invoked */
+    size_t deletedTimeoutsCount;
+    size_t deletedTimeoutsAlloc;
+    struct virEventPollTimeout **deletedTimeouts;
+    /* Scratch list of expired timers used during dispatch */
+    size_t expiredAlloc;
+    struct virEventPollTimeout **expired;
+    virEventPollStats stats;
+    unsigned long long statsSecond;
+    unsigned long long statsSecondFired;
+
+    const struct virEventPollBackend *backend;
+    size_t fdsAlloc;
+    struct virEventPollFD *fds;
+    size_t nonpollable;
+
+    /* poll() backend state, rebuilt on every iteration */
+    int npollfds;
+    struct pollfd *pollfds;
+
+    /* epoll backend state, persistent across iterations */
+    int epollfd;
+    size_t epollRegistered;
+    size_t epollEventsAlloc;
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event *epollEvents;
+#endif
 };
 
-/* Only have one event loop */
+/* The main event loop, which owns all timers */
 static struct virEventPollLoop eventLoop;
 
-/* Unique ID for the next FD watch to be registered */
+/* Additional loops watching file handles only, each run by its
+ * own thread. They are started by virEventPollSetLoopThreads and never
+ * torn down, as handles registered with them may outlive any attempt
+ * to stop their threads. New handles are spread over the first
+ * nActiveLoops of them only. Atomic access only for the counts */
+#define VIR_EVENT_POLL_LOOPS_MAX 64
+static struct virEventPollLoop *extraLoops[VIR_EVENT_POLL_LOOPS_MAX - 1];
+static int nExtraLoops;
+static int nActiveLoops;
+static virMutex loopThreadsLock = VIR_MUTEX_INITIALIZER;
+
+/* Unique ID for the next FD watch to be registered, shared by
+ * all loops */
 static int nextWatch = 1;
 
 /* Unique ID for the next timer to be registered */
 static int nextTimer = 1;
 
+/* Callbacks taking longer than this many milliseconds are reported,
+ * 0 turns off timing callbacks. Atomic access only */
+static int stallThreshold;
+
+/* Time spent in each callback function, shared by all loops */
+struct virEventPollCallbackEntry {
+    const void *cb;
+    bool timer;
+    unsigned long long calls;
+    unsigned long long timeTotal;
+    unsigned long long timeMax;
+    unsigned long long stalls;
+};
+
+static virMutex callbackStatsLock = VIR_MUTEX_INITIALIZER;
+static virHashTablePtr callbackStats;
+
+
+/* Return loop @i, counting the main loop as 0 */
+static struct virEventPollLoop *virEventPollGetLoop(size_t i)
+{
+    return i == 0 ? &eventLoop : extraLoops[i - 1];
+}
+
+
 /*
- * Register a callback for monitoring file handle events.
+ * Register a callback for monitoring file handle events on @loop.
  * NB, it *must* be safe to call this from within a callback
  * For this reason we only ever append to existing list.
  */
-int virEventPollAddHandle(int fd, int events,
-                          virEventHandleCallback cb,
-                          void *opaque,
-                          virFreeCallback ff)
+static int virEventPollAddHandleLoop(struct virEventPollLoop *loop,
+                                     int fd, int events,
+                                     virEventHandleCallback cb,
+                                     void *opaque,
+                                     virFreeCallback ff)
 {
     int watch;
-    virMutexLock(&eventLoop.lock);
-    if (eventLoop.handlesCount == eventLoop.handlesAlloc) {
+    size_t *next;
+
+    if (fd < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Invalid file handle %d"), fd);
+        return -1;
+    }
+
+    virMutexLock(&loop->lock);
+    if (fd >= loop->fdsAlloc &&
+        VIR_EXPAND_N(loop->fds, loop->fdsAlloc,
+                     fd + 1 - loop->fdsAlloc) < 0) {
+        virMutexUnlock(&loop->lock);
+        return -1;
+    }
+
+    if (loop->handlesCount == loop->handlesAlloc) {
         EVENT_DEBUG("Used %zu handle slots, adding at least %d more",
-                    eventLoop.handlesAlloc, EVENT_ALLOC_EXTENT);
-        if (VIR_RESIZE_N(eventLoop.handles, eventLoop.handlesAlloc,
-                         eventLoop.handlesCount, EVENT_ALLOC_EXTENT) < 0) {
-            virMutexUnlock(&eventLoop.lock);
+                    loop->handlesAlloc, EVENT_ALLOC_EXTENT);
+        if (VIR_RESIZE_N(loop->handles, loop->handlesAlloc,
+                         loop->handlesCount, EVENT_ALLOC_EXTENT) < 0) {
+            virMutexUnlock(&loop->lock);
             return -1;
         }
     }
 
-    watch = nextWatch++;
+    watch = virAtomicIntAdd(&nextWatch, 1);
 
-    eventLoop.handles[eventLoop.handlesCount].watch = watch;
-    eventLoop.handles[eventLoop.handlesCount].fd = fd;
-    eventLoop.handles[eventLoop.handlesCount].events =
+    loop->handles[loop->handlesCount].watch = watch;
+    loop->handles[loop->handlesCount].fd = fd;
+    loop->handles[loop->handlesCount].events =
                                          virEventPollToNativeEvents(events);
-    eventLoop.handles[eventLoop.handlesCount].cb = cb;
-    eventLoop.handles[eventLoop.handlesCount].ff = ff;
-    eventLoop.handles[eventLoop.handlesCount].opaque = opaque;
-    eventLoop.handles[eventLoop.handlesCount].deleted = 0;
+    loop->handles[loop->handlesCount].cb = cb;
+    loop->handles[loop->handlesCount].ff = ff;
+    loop->handles[loop->handlesCount].opaque = opaque;
+    loop->handles[loop->handlesCount].deleted = 0;
+    loop->handles[loop->handlesCount].nextSameFD = 0;
+
+    /* Append to the tail of the list of handles watching @fd so
+     * that dispatch order matches registration order */
+    next = &loop->fds[fd].firstHandle;
+    while (*next)
+        next = &loop->handles[*next - 1].nextSameFD;
+    *next = loop->handlesCount + 1;
 
-    eventLoop.handlesCount++;
+    loop->handlesCount++;
 
-    virEventPollInterruptLocked();
+    loop->backend->updateFD(loop, fd);
+    virEventPollInterruptLocked(loop);
 
     PROBE(EVENT_POLL_ADD_HANDLE,
           "watch=%d fd=%d events=%d cb=%p opaque=%p ff=%p",
           watch, fd, events, cb, opaque, ff);
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
 
     return watch;
 }
 
+int virEventPollAddHandle(int fd, int events,
+                          virEventHandleCallback cb,
+                          void *opaque,
+                          virFreeCallback ff)
+{
+    return virEventPollAddHandleLoop(&eventLoop, fd, events, cb, opaque, ff);
+}
+
+int virEventPollAddHandleAffinity(int fd, int events,
+                                  virEventHandleCallback cb,
+                                  void *opaque,
+                                  virFreeCallback ff,
+                                  unsigned int key)
+{
+    struct virEventPollLoop *loop = &eventLoop;
+    int nloops = virAtomicIntGet(&nActiveLoops);
+
+    /* Keep the main loop free for timers and unbound handles
+     * whenever there are extra loops to spread the load over */
+    if (nloops)
+        loop = extraLoops[key % nloops];
+
+    return virEventPollAddHandleLoop(loop, fd, events, cb, opaque, ff);
+}
+
 void virEventPollUpdateHandle(int watch, int events)
 {
-    size_t i;
+    size_t i, j;
+    size_t nloops = virAtomicIntGet(&nExtraLoops);
     bool found = false;
     PROBE(EVENT_POLL_UPDATE_HANDLE,
           "watch=%d events=%d",
@@ -156,17 +313,22 @@ void virEventPollUpdateHandle(int watch, int events)
         return;
     }
 
-    virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.handlesCount; i++) {
-        if (eventLoop.handles[i].watch == watch) {
-            eventLoop.handles[i].events =
-                    virEventPollToNativeEvents(events);
-            virEventPollInterruptLocked();
-            found = true;
-            break;
+    for (j = 0; j <= nloops && !found; j++) {
+        struct virEventPollLoop *loop = virEventPollGetLoop(j);
+
+        virMutexLock(&loop->lock);
+        for (i = 0; i < loop->handlesCount; i++) {
+            if (loop->handles[i].watch == watch) {
+                loop->handles[i].events =
+                        virEventPollToNativeEvents(events);
+                loop->backend->updateFD(loop, loop->handles[i].fd);
+                virEventPollInterruptLocked(loop);
+                found = true;
+                break;
+            }
         }
+        virMutexUnlock(&loop->lock);
     }
-    virMutexUnlock(&eventLoop.lock);
 
     if (!found)
         VIR_WARN("Got update for non-existent handle watch %d", watch);
@@ -180,7 +342,8 @@ void virEventPollUpdateHandle(int watch, int events)
  */
 int virEventPollRemoveHandle(int watch)
 {
-    size_t i;
+    size_t i, j;
+    size_t nloops = virAtomicIntGet(&nExtraLoops);
     PROBE(EVENT_POLL_REMOVE_HANDLE,
           "watch=%d",
           watch);
@@ -190,28 +353,160 @@ int virEventPollRemoveHandle(int watch)
         return -1;
     }
 
-    virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.handlesCount; i++) {
-        if (eventLoop.handles[i].deleted)
-            continue;
-
-        if (eventLoop.handles[i].watch == watch) {
-            EVENT_DEBUG("mark delete %zu %d", i, eventLoop.handles[i].fd);
-            eventLoop.handles[i].deleted = 1;
-            virEventPollInterruptLocked();
-            virMutexUnlock(&eventLoop.lock);
-            return 0;
+    for (j = 0; j <= nloops; j++) {
+        struct virEventPollLoop *loop = virEventPollGetLoop(j);
+
+        virMutexLock(&loop->lock);
+        for (i = 0; i < loop->handlesCount; i++) {
+            if (loop->handles[i].deleted)
+                continue;
+
+            if (loop->handles[i].watch == watch) {
+                EVENT_DEBUG("mark delete %zu %d", i, loop->handles[i].fd);
+                loop->handles[i].deleted = 1;
+                loop->backend->updateFD(loop, loop->handles[i].fd);
+                virEventPollInterruptLocked(loop);
+                virMutexUnlock(&loop->lock);
+                return 0;
+            }
         }
+        virMutexUnlock(&loop->lock);
     }
-    virMutexUnlock(&eventLoop.lock);
     return -1;
 }
 
 
+/*
+ * Timers are kept in a binary min-heap ordered by expiry time,
+ * ties broken by timer ID so that timers due at the same time
+ * fire in registration order. Disabled timers (negative
+ * frequency) are kept out of the heap.
+ */
+static bool virEventPollTimeoutBefore(struct virEventPollTimeout *a,
+                                      struct virEventPollTimeout *b)
+{
+    if (a->expiresAt != b->expiresAt)
+        return a->expiresAt < b->expiresAt;
+    return a->timer < b->timer;
+}
+
+
+static void virEventPollTimeoutHeapSet(size_t i,
+                                       struct virEventPollTimeout *t)
+{
+    eventLoop.timeouts[i] = t;
+    t->heapIndex = i + 1;
+}
+
+
+static void virEventPollTimeoutHeapUp(size_t i)
+{
+    struct virEventPollTimeout *t = eventLoop.timeouts[i];
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!virEventPollTimeoutBefore(t, eventLoop.timeouts[parent]))
+            break;
+        virEventPollTimeoutHeapSet(i, eventLoop.timeouts[parent]);
+        i = parent;
+    }
+    virEventPollTimeoutHeapSet(i, t);
+}
+
+
+static void virEventPollTimeoutHeapDown(size_t i)
+{
+    struct virEventPollTimeout *t = eventLoop.timeouts[i];
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= eventLoop.timeoutsCount)
+            break;
+        if (child + 1 < eventLoop.timeoutsCount &&
+            virEventPollTimeoutBefore(eventLoop.timeouts[child + 1],
+                                      eventLoop.timeouts[child]))
+            child++;
+        if (!virEventPollTimeoutBefore(eventLoop.timeouts[child], t))
+            break;
+        virEventPollTimeoutHeapSet(i, eventLoop.timeouts[child]);
+        i = child;
+    }
+    virEventPollTimeoutHeapSet(i, t);
+}
+
+
+static int virEventPollTimeoutHeapInsert(struct virEventPollTimeout *t)
+{
+    if (VIR_RESIZE_N(eventLoop.timeouts, eventLoop.timeoutsAlloc,
+                     eventLoop.timeoutsCount, 1) < 0)
+        return -1;
+
+    eventLoop.timeouts[eventLoop.timeoutsCount] = t;
+    eventLoop.timeoutsCount++;
+    virEventPollTimeoutHeapUp(eventLoop.timeoutsCount - 1);
+    return 0;
+}
+
+
+static void virEventPollTimeoutHeapRemove(struct virEventPollTimeout *t)
+{
+    size_t i = t->heapIndex - 1;
+
+    t->heapIndex = 0;
+    eventLoop.timeoutsCount--;
+    if (i == eventLoop.timeoutsCount)
+        return;
+
+    virEventPollTimeoutHeapSet(i, eventLoop.timeouts[eventLoop.timeoutsCount]);
+    virEventPollTimeoutHeapUp(i);
+    virEventPollTimeoutHeapDown(eventLoop.timeouts[i]->heapIndex - 1);
+}
+
+
+/* Restore heap order after the expiry of an armed @t changed */
+static void virEventPollTimeoutHeapUpdate(struct virEventPollTimeout *t)
+{
+    virEventPollTimeoutHeapUp(t->heapIndex - 1);
+    virEventPollTimeoutHeapDown(t->heapIndex - 1);
+}
+
+
+static uint32_t virEventPollTimerCode(const void *name, uint32_t seed)
+{
+    int timer = (int)(intptr_t)name;
+    return virHashCodeGen(&timer, sizeof(timer), seed);
+}
+
+
+static bool virEventPollTimerEqual(const void *namea, const void *nameb)
+{
+    return namea == nameb;
+}
+
+
+static void *virEventPollTimerCopy(const void *name)
+{
+    return (void *)name;
+}
+
+
+static uint32_t virEventPollCallbackCode(const void *name, uint32_t seed)
+{
+    return virHashCodeGen(&name, sizeof(name), seed);
+}
+
+
+static struct virEventPollTimeout *virEventPollTimerLookup(int timer)
+{
+    return virHashLookup(eventLoop.timers, (void *)(intptr_t)timer);
+}
+
+
 /*
  * Register a callback for a timer event
  * NB, it *must* be safe to call this from within a callback
- * For this reason we only ever append to existing list.
+ * For this reason we never dispatch newly added timers until
+ * the next iteration.
  */
 int virEventPollAddTimeout(int frequency,
                            virEventTimeoutCallback cb,
@@ -219,47 +514,52 @@ int virEventPollAddTimeout(int frequency,
                            virFreeCallback ff)
 {
     unsigned long long now;
+    struct virEventPollTimeout *t;
     int ret;
 
     if (virTimeMillisNow(&now) < 0)
         return -1;
 
+    if (VIR_ALLOC(t) < 0)
+        return -1;
+
     virMutexLock(&eventLoop.lock);
-    if (eventLoop.timeoutsCount == eventLoop.timeoutsAlloc) {
-        EVENT_DEBUG("Used %zu timeout slots, adding at least %d more",
-                    eventLoop.timeoutsAlloc, EVENT_ALLOC_EXTENT);
-        if (VIR_RESIZE_N(eventLoop.timeouts, eventLoop.timeoutsAlloc,
-                         eventLoop.timeoutsCount, EVENT_ALLOC_EXTENT) < 0) {
-            virMutexUnlock(&eventLoop.lock);
-            return -1;
-        }
-    }
+    t->timer = nextTimer++;
+    t->frequency = frequency;
+    t->cb = cb;
+    t->ff = ff;
+    t->opaque = opaque;
+    t->deleted = 0;
+    t->expiresAt = frequency >= 0 ? frequency + now : 0;
+
+    if (virHashAddEntry(eventLoop.timers, (void *)(intptr_t)t->timer, t) < 0)
+        goto error;
 
-    eventLoop.timeouts[eventLoop.timeoutsCount].timer = nextTimer++;
-    eventLoop.timeouts[eventLoop.timeoutsCount].frequency = frequency;
-    eventLoop.timeouts[eventLoop.timeoutsCount].cb = cb;
-    eventLoop.timeouts[eventLoop.timeoutsCount].ff = ff;
-    eventLoop.timeouts[eventLoop.timeoutsCount].opaque = opaque;
-    eventLoop.timeouts[eventLoop.timeoutsCount].deleted = 0;
-    eventLoop.timeouts[eventLoop.timeoutsCount].expiresAt =
-        frequency >= 0 ? frequency + now : 0;
+    if (frequency >= 0 &&
+        virEventPollTimeoutHeapInsert(t) < 0) {
+        virHashRemoveEntry(eventLoop.timers, (void *)(intptr_t)t->timer);
+        goto error;
+    }
 
-    eventLoop.timeoutsCount++;
-    ret = nextTimer-1;
-    virEventPollInterruptLocked();
+    ret = t->timer;
+    virEventPollInterruptLocked(&eventLoop);
 
     PROBE(EVENT_POLL_ADD_TIMEOUT,
           "timer=%d frequency=%d cb=%p opaque=%p ff=%p",
           ret, frequency, cb, opaque, ff);
     virMutexUnlock(&eventLoop.lock);
     return ret;
+
+ error:
+    virMutexUnlock(&eventLoop.lock);
+    VIR_FREE(t);
+    return -1;
 }
 
 void virEventPollUpdateTimeout(int timer, int frequency)
 {
     unsigned long long now;
-    size_t i;
-    bool found = false;
+    struct virEventPollTimeout *t;
     PROBE(EVENT_POLL_UPDATE_TIMEOUT,
           "timer=%d frequency=%d",
           timer, frequency);
@@ -273,33 +573,38 @@ void virEventPollUpdateTimeout(int timer, int frequency)
         return;
 
     virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.timeoutsCount; i++) {
-        if (eventLoop.timeouts[i].timer == timer) {
-            eventLoop.timeouts[i].frequency = frequency;
-            eventLoop.timeouts[i].expiresAt =
-                frequency >= 0 ? frequency + now : 0;
-            VIR_DEBUG("Set timer freq=%d expires=%llu", frequency,
-                      eventLoop.timeouts[i].expiresAt);
-            virEventPollInterruptLocked();
-            found = true;
-            break;
-        }
+    if (!(t = virEventPollTimerLookup(timer))) {
+        virMutexUnlock(&eventLoop.lock);
+        VIR_WARN("Got update for non-existent timer %d", timer);
+        return;
     }
-    virMutexUnlock(&eventLoop.lock);
 
-    if (!found)
-        VIR_WARN("Got update for non-existent timer %d", timer);
+    t->frequency = frequency;
+    t->expiresAt = frequency >= 0 ? frequency + now : 0;
+    VIR_DEBUG("Set timer freq=%d expires=%llu", frequency, t->expiresAt);
+
+    if (frequency < 0) {
+        if (t->heapIndex)
+            virEventPollTimeoutHeapRemove(t);
+    } else if (t->heapIndex) {
+        virEventPollTimeoutHeapUpdate(t);
+    } else if (virEventPollTimeoutHeapInsert(t) < 0) {
+        VIR_WARN("Unable to arm timer %d", timer);
+    }
+
+    virEventPollInterruptLocked(&eventLoop);
+    virMutexUnlock(&eventLoop.lock);
 }
 
 /*
  * Unregister a callback for a timer
  * NB, it *must* be safe to call this from within a callback
- * For this reason we only ever set a flag in the existing list.
- * Actual deletion will be done out-of-band
+ * For this reason we only ever set a flag and unlink the
+ * timer. Actual deletion will be done out-of-band
  */
 int virEventPollRemoveTimeout(int timer)
 {
-    size_t i;
+    struct virEventPollTimeout *t;
     PROBE(EVENT_POLL_REMOVE_TIMEOUT,
           "timer=%d",
           timer);
@@ -310,23 +615,26 @@ int virEventPollRemoveTimeout(int timer)
     }
 
     virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.timeoutsCount; i++) {
-        if (eventLoop.timeouts[i].deleted)
-            continue;
-
-        if (eventLoop.timeouts[i].timer == timer) {
-            eventLoop.timeouts[i].deleted = 1;
-            virEventPollInterruptLocked();
-            virMutexUnlock(&eventLoop.lock);
-            return 0;
-        }
+    if (!(t = virEventPollTimerLookup(timer)) ||
+        VIR_RESIZE_N(eventLoop.deletedTimeouts, eventLoop.deletedTimeoutsAlloc,
+                     eventLoop.deletedTimeoutsCount, 1) < 0) {
+        virMutexUnlock(&eventLoop.lock);
+        return -1;
     }
+
+    t->deleted = 1;
+    if (t->heapIndex)
+        virEventPollTimeoutHeapRemove(t);
+    virHashRemoveEntry(eventLoop.timers, (void *)(intptr_t)timer);
+    eventLoop.deletedTimeouts[eventLoop.deletedTimeoutsCount++] = t;
+
+    virEventPollInterruptLocked(&eventLoop);
     virMutexUnlock(&eventLoop.lock);
-    return -1;
+    return 0;
 }
 
-/* Iterates over all registered timeouts and determine which
- * will be the first to expire.
+/* Determine when the first timer will expire, which is
+ * always the one at the top of the heap.
  * @timeout: filled with expiry time of soonest timer, or -1 if
  *           no timeout is pending
  * returns: 0 on success, -1 on error
@@ -334,23 +642,16 @@ int virEventPollRemoveTimeout(int timer)
 static int virEventPollCalculateTimeout(int *timeout)
 {
     unsigned long long then = 0;
-    size_t i;
     EVENT_DEBUG("Calculate expiry of %zu timers", eventLoop.timeoutsCount);
-    /* Figure out if we need a timeout */
-    for (i = 0; i < eventLoop.timeoutsCount; i++) {
-        if (eventLoop.timeouts[i].deleted)
-            continue;
-        if (eventLoop.timeouts[i].frequency < 0)
-            continue;
 
-        EVENT_DEBUG("Got a timeout scheduled for %llu", eventLoop.timeouts[i].expiresAt);
-        if (then == 0 ||
-            eventLoop.timeouts[i].expiresAt < then)
-            then = eventLoop.timeouts[i].expiresAt;
+    /* Figure out if we need a timeout */
+    if (eventLoop.timeoutsCount > 0) {
+        then = eventLoop.timeouts[0]->expiresAt;
+        EVENT_DEBUG("Got a timeout scheduled for %llu", then);
     }
 
     /* Calculate how long we should wait for a timeout if needed */
-    if (then > 0) {
+    if (eventLoop.timeoutsCount > 0) {
         unsigned long long now;
 
         if (virTimeMillisNow(&now) < 0)
@@ -373,140 +674,505 @@ static int virEventPollCalculateTimeout(int *timeout)
     return 0;
 }
 
-/*
- * Allocate a pollfd array containing data for all registered
- * file handles. The caller must free the returned data struct
- * returns: the pollfd array, or NULL on error
- */
-static struct pollfd *virEventPollMakePollFDs(int *nfds) {
-    struct pollfd *fds;
-    size_t i;
 
-    *nfds = 0;
-    for (i = 0; i < eventLoop.handlesCount; i++) {
-        if (eventLoop.handles[i].events && !eventLoop.handles[i].deleted)
-            (*nfds)++;
+/* Account for a timer firing @late milliseconds past its expiry */
+static void virEventPollUpdateTimerStats(unsigned long long now,
+                                         unsigned long long late)
+{
+    if (now / 1000 != eventLoop.statsSecond) {
+        /* Only report a full second's worth of data */
+        if (now / 1000 == eventLoop.statsSecond + 1)
+            eventLoop.stats.timersFiredRate = eventLoop.statsSecondFired;
+        else
+            eventLoop.stats.timersFiredRate = 0;
+        eventLoop.statsSecond = now / 1000;
+        eventLoop.statsSecondFired = 0;
     }
 
-    /* Setup the poll file handle data structs */
-    if (VIR_ALLOC_N(fds, *nfds) < 0)
-        return NULL;
+    eventLoop.statsSecondFired++;
+    eventLoop.stats.timersFired++;
+    eventLoop.stats.timersLateTotal += late;
+    if (late > eventLoop.stats.timersLateMax)
+        eventLoop.stats.timersLateMax = late;
+}
 
-    *nfds = 0;
-    for (i = 0; i < eventLoop.handlesCount; i++) {
-        EVENT_DEBUG("Prepare n=%zu w=%d, f=%d e=%d d=%d", i,
-                    eventLoop.handles[i].watch,
-                    eventLoop.handles[i].fd,
-                    eventLoop.handles[i].events,
-                    eventLoop.handles[i].deleted);
-        if (!eventLoop.handles[i].events || eventLoop.handles[i].deleted)
-            continue;
-        fds[*nfds].fd = eventLoop.handles[i].fd;
-        fds[*nfds].events = eventLoop.handles[i].events;
-        fds[*nfds].revents = 0;
-        (*nfds)++;
+
+static unsigned long long virEventPollCallbackStart(void)
+{
+    struct timespec ts;
+
+    if (!virAtomicIntGet(&stallThreshold) ||
+        clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+
+/* Formats the name of the callback function @cb into @buf */
+static const char *virEventPollCallbackName(const void *cb,
+                                            char *buf,
+                                            size_t buflen)
+{
+#ifdef HAVE_DLADDR
+    Dl_info info;
+
+    if (dladdr((void *)cb, &info) && info.dli_sname &&
+        info.dli_saddr == cb)
+        return info.dli_sname;
+#endif
+
+    snprintf(buf, buflen, "%p", cb);
+    return buf;
+}
+
+
+/* Account for callback @cb invoked at @start, which is 0 if callbacks
+ * were not timed at that point */
+static void virEventPollCallbackEnd(const void *cb,
+                                    bool timer,
+                                    unsigned long long start)
+{
+    struct virEventPollCallbackEntry *entry;
+    unsigned long long elapsed;
+    unsigned long long now;
+    int threshold;
+    char buf[32];
+
+    if (!start || !(now = virEventPollCallbackStart()) || now < start)
+        return;
+
+    elapsed = now - start;
+    threshold = virAtomicIntGet(&stallThreshold);
+
+    virMutexLock(&callbackStatsLock);
+    if (!(entry = virHashLookup(callbackStats, cb))) {
+        if (VIR_ALLOC_QUIET(entry) < 0 ||
+            virHashAddEntry(callbackStats, cb, entry) < 0) {
+            VIR_FREE(entry);
+            virResetLastError();
+            goto cleanup;
+        }
+        entry->cb = cb;
+        entry->timer = timer;
     }
 
-    return fds;
+    entry->calls++;
+    entry->timeTotal += elapsed;
+    if (elapsed > entry->timeMax)
+        entry->timeMax = elapsed;
+    if (threshold && elapsed >= threshold * 1000ull)
+        entry->stalls++;
+
+ cleanup:
+    virMutexUnlock(&callbackStatsLock);
+
+    if (threshold && elapsed >= threshold * 1000ull)
+        VIR_WARN("Event loop %s callback %s blocked the loop for %llu ms",
+                 timer ? "timer" : "handle",
+                 virEventPollCallbackName(cb, buf, sizeof(buf)),
+                 elapsed / 1000);
 }
 
 
 /*
- * Iterate over all timers and determine if any have expired.
- * Invoke the user supplied callback for each timer whose
- * expiry time is met, and schedule the next timeout. Does
- * not try to 'catch up' on time if the actual expiry time
- * was later than the requested time.
+ * Pick all timers which have expired from the top of the heap.
+ * Invoke the user supplied callback for each of them, and
+ * schedule the next timeout. Does not try to 'catch up' on time
+ * if the actual expiry time was later than the requested time.
  *
  * This method must cope with new timers being registered
- * by a callback, and must skip any timers marked as deleted.
+ * by a callback, and must skip any timers removed or
+ * rescheduled by an earlier callback.
  *
  * Returns 0 upon success, -1 if an error occurred
  */
 static int virEventPollDispatchTimeouts(void)
 {
     unsigned long long now;
+    size_t nexpired = 0;
     size_t i;
-    /* Save this now - it may be changed during dispatch */
-    int ntimeouts = eventLoop.timeoutsCount;
-    VIR_DEBUG("Dispatch %d", ntimeouts);
+    VIR_DEBUG("Dispatch %zu", eventLoop.timeoutsCount);
 
     if (virTimeMillisNow(&now) < 0)
         return -1;
 
-    for (i = 0; i < ntimeouts; i++) {
-        if (eventLoop.timeouts[i].deleted || eventLoop.timeouts[i].frequency < 0)
+    /* Collect the expired timers first, as callbacks can modify
+     * the heap. Ordering of the heap means each step costs
+     * O(log n) and we stop at the first timer which is not due.
+     *
+     * Add 20ms fuzz so we don't pointlessly spin doing
+     * <10ms sleeps, particularly on kernels with low HZ
+     * it is fine that a timer expires 20ms earlier than
+     * requested
+     */
+    while (eventLoop.timeoutsCount > 0 &&
+           eventLoop.timeouts[0]->expiresAt <= (now+20)) {
+        struct virEventPollTimeout *t = eventLoop.timeouts[0];
+
+        if (VIR_RESIZE_N(eventLoop.expired, eventLoop.expiredAlloc,
+                         nexpired, 1) < 0)
+            break;
+
+        virEventPollTimeoutHeapRemove(t);
+        eventLoop.expired[nexpired++] = t;
+    }
+
+    /* Put them back, so that callbacks see a consistent heap */
+    for (i = 0; i < nexpired; i++)
+        ignore_value(virEventPollTimeoutHeapInsert(eventLoop.expired[i]));
+
+    for (i = 0; i < nexpired; i++) {
+        struct virEventPollTimeout *t = eventLoop.expired[i];
+        virEventTimeoutCallback cb;
+        int timer;
+        void *opaque;
+        unsigned long long start;
+
+        /* An earlier callback may have removed, disabled or
+         * rescheduled this timer */
+        if (t->deleted || t->frequency < 0 || !t->heapIndex ||
+            t->expiresAt > (now+20))
             continue;
 
-        /* Add 20ms fuzz so we don't pointlessly spin doing
-         * <10ms sleeps, particularly on kernels with low HZ
-         * it is fine that a timer expires 20ms earlier than
-         * requested
-         */
-        if (eventLoop.timeouts[i].expiresAt <= (now+20)) {
-            virEventTimeoutCallback cb = eventLoop.timeouts[i].cb;
-            int timer = eventLoop.timeouts[i].timer;
-            void *opaque = eventLoop.timeouts[i].opaque;
-            eventLoop.timeouts[i].expiresAt =
-                now + eventLoop.timeouts[i].frequency;
-
-            PROBE(EVENT_POLL_DISPATCH_TIMEOUT,
-                  "timer=%d",
-                  timer);
-            virMutexUnlock(&eventLoop.lock);
-            (cb)(timer, opaque);
-            virMutexLock(&eventLoop.lock);
-        }
+        cb = t->cb;
+        timer = t->timer;
+        opaque = t->opaque;
+        virEventPollUpdateTimerStats(now,
+                                     now > t->expiresAt ? now - t->expiresAt : 0);
+        t->expiresAt = now + t->frequency;
+        virEventPollTimeoutHeapUpdate(t);
+
+        PROBE(EVENT_POLL_DISPATCH_TIMEOUT,
+              "timer=%d",
+              timer);
+        virMutexUnlock(&eventLoop.lock);
+        start = virEventPollCallbackStart();
+        (cb)(timer, opaque);
+        virEventPollCallbackEnd(cb, true, start);
+        virMutexLock(&eventLoop.lock);
     }
     return 0;
 }
 
 
-/* Iterate over all file handles and dispatch any which
- * have pending events listed in the poll() data. Invoke
- * the user supplied callback for each handle which has
- * pending events
+/* Compute the union of native events requested by all live
+ * handles watching @fd
+ */
+static int virEventPollEventsForFD(struct virEventPollLoop *loop, int fd)
+{
+    size_t i = loop->fds[fd].firstHandle;
+    int events = 0;
+
+    while (i) {
+        struct virEventPollHandle *handle = &loop->handles[i - 1];
+        if (!handle->deleted)
+            events |= handle->events;
+        i = handle->nextSameFD;
+    }
+
+    return events;
+}
+
+
+/* Invoke the callback of each handle watching @fd which is
+ * interested in @revents. Handles with an index of @nhandles
+ * or above were registered during this dispatch cycle and are
+ * not considered until the next iteration.
+ */
+static void virEventPollDispatchFD(struct virEventPollLoop *loop,
+                                   int fd, int revents, size_t nhandles)
+{
+    size_t i;
+
+    if (fd < 0 || fd >= loop->fdsAlloc)
+        return;
+
+    /* NB, re-fetch the list head and the next pointer from the
+     * arrays after every callback, since callbacks may add handles
+     * and thus reallocate them */
+    for (i = loop->fds[fd].firstHandle;
+         i && i <= nhandles;
+         i = loop->handles[i - 1].nextSameFD) {
+        struct virEventPollHandle *handle = &loop->handles[i - 1];
+        virEventHandleCallback cb;
+        void *opaque;
+        int watch;
+        int hEvents;
+        unsigned long long start;
+
+        VIR_DEBUG("i=%zu w=%d", i - 1, handle->watch);
+        if (handle->deleted) {
+            EVENT_DEBUG("Skip deleted n=%zu w=%d f=%d", i - 1,
+                        handle->watch, handle->fd);
+            continue;
+        }
+
+        if (!handle->events ||
+            !(revents & (handle->events | POLLERR | POLLHUP | POLLNVAL)))
+            continue;
+
+        cb = handle->cb;
+        watch = handle->watch;
+        opaque = handle->opaque;
+        hEvents = virEventPollFromNativeEvents(revents &
+                                               (handle->events | POLLERR |
+                                                POLLHUP | POLLNVAL));
+        PROBE(EVENT_POLL_DISPATCH_HANDLE,
+              "watch=%d events=%d",
+              watch, hEvents);
+        virMutexUnlock(&loop->lock);
+        start = virEventPollCallbackStart();
+        (cb)(watch, fd, hEvents, opaque);
+        virEventPollCallbackEnd(cb, false, start);
+        virMutexLock(&loop->lock);
+    }
+}
+
+
+/* Rebuild the per-fd handle lists after the handles array has
+ * been compacted
+ */
+static void virEventPollRebuildFDs(struct virEventPollLoop *loop)
+{
+    size_t i;
+
+    for (i = 0; i < loop->fdsAlloc; i++)
+        loop->fds[i].firstHandle = 0;
+
+    /* Walk backwards, pushing onto the head of each list, so that
+     * lists end up in registration order */
+    for (i = loop->handlesCount; i > 0; i--) {
+        struct virEventPollHandle *handle = &loop->handles[i - 1];
+        handle->nextSameFD = loop->fds[handle->fd].firstHandle;
+        loop->fds[handle->fd].firstHandle = i;
+    }
+}
+
+
+/*
+ * poll() backend.
  *
- * This method must cope with new handles being registered
- * by a callback, and must skip any handles marked as deleted.
+ * The interest set is transient: a pollfd array is built from the
+ * per-fd state before each wait.
+ */
+static int virEventPollPollInit(struct virEventPollLoop *loop ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+
+static void virEventPollPollUpdateFD(struct virEventPollLoop *loop, int fd)
+{
+    loop->fds[fd].events = virEventPollEventsForFD(loop, fd);
+}
+
+
+static int virEventPollPollPrepare(struct virEventPollLoop *loop)
+{
+    size_t i;
+    int nfds = 0;
+
+    for (i = 0; i < loop->fdsAlloc; i++) {
+        if (loop->fds[i].events)
+            nfds++;
+    }
+
+    VIR_FREE(loop->pollfds);
+    loop->npollfds = 0;
+    if (VIR_ALLOC_N(loop->pollfds, nfds) < 0)
+        return -1;
+
+    for (i = 0; i < loop->fdsAlloc; i++) {
+        if (!loop->fds[i].events)
+            continue;
+        EVENT_DEBUG("Prepare n=%d f=%zu e=%d", loop->npollfds,
+                    i, loop->fds[i].events);
+        loop->pollfds[loop->npollfds].fd = i;
+        loop->pollfds[loop->npollfds].events = loop->fds[i].events;
+        loop->pollfds[loop->npollfds].revents = 0;
+        loop->npollfds++;
+    }
+
+    return 0;
+}
+
+
+static int virEventPollPollWait(struct virEventPollLoop *loop, int timeout)
+{
+    PROBE(EVENT_POLL_RUN,
+          "nhandles=%d timeout=%d",
+          loop->npollfds, timeout);
+    return poll(loop->pollfds, loop->npollfds, timeout);
+}
+
+
+static int virEventPollPollDispatch(struct virEventPollLoop *loop,
+                                    int nready ATTRIBUTE_UNUSED)
+{
+    size_t nhandles = loop->handlesCount;
+    size_t n;
+    VIR_DEBUG("Dispatch %d", loop->npollfds);
+
+    for (n = 0; n < loop->npollfds; n++) {
+        if (loop->pollfds[n].revents)
+            virEventPollDispatchFD(loop, loop->pollfds[n].fd,
+                                   loop->pollfds[n].revents, nhandles);
+    }
+
+    return 0;
+}
+
+
+static const struct virEventPollBackend virEventPollBackendPoll = {
+    .name = "poll",
+    .init = virEventPollPollInit,
+    .updateFD = virEventPollPollUpdateFD,
+    .prepare = virEventPollPollPrepare,
+    .wait = virEventPollPollWait,
+    .dispatch = virEventPollPollDispatch,
+};
+
+
+#ifdef HAVE_SYS_EPOLL_H
+/*
+ * epoll backend.
  *
- * Returns 0 upon success, -1 if an error occurred
+ * The interest set lives in the kernel and is only modified when
+ * handles are added, updated or removed, so the cost of an
+ * iteration is proportional to the number of ready fds rather
+ * than to the number of registered ones.
  */
-static int virEventPollDispatchHandles(int nfds, struct pollfd *fds)
-{
-    size_t i, n;
-    VIR_DEBUG("Dispatch %d", nfds);
-
-    /* NB, use nfds not eventLoop.handlesCount, because new
-     * fds might be added on end of list, and they're not
-     * in the fds array we've got */
-    for (i = 0, n = 0; n < nfds && i < eventLoop.handlesCount; n++) {
-        while (i < eventLoop.handlesCount &&
-               (eventLoop.handles[i].fd != fds[n].fd ||
-                eventLoop.handles[i].events == 0)) {
-            i++;
+
+/* Native events are poll() flags, which epoll shares on Linux */
+verify(EPOLLIN == POLLIN);
+verify(EPOLLOUT == POLLOUT);
+verify(EPOLLERR == POLLERR);
+verify(EPOLLHUP == POLLHUP);
+
+static int virEventPollEpollInit(struct virEventPollLoop *loop)
+{
+    if ((loop->epollfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create epoll instance"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void virEventPollEpollUpdateFD(struct virEventPollLoop *loop, int fd)
+{
+    struct virEventPollFD *state = &loop->fds[fd];
+    struct epoll_event ev;
+    int events = virEventPollEventsForFD(loop, fd);
+    int op;
+    char ebuf[1024];
+
+    if (events == state->events)
+        return;
+
+    if (state->nonpollable) {
+        if (!events) {
+            state->nonpollable = false;
+            loop->nonpollable--;
         }
-        if (i == eventLoop.handlesCount)
-            break;
+        state->events = events;
+        return;
+    }
 
-        VIR_DEBUG("i=%zu w=%d", i, eventLoop.handles[i].watch);
-        if (eventLoop.handles[i].deleted) {
-            EVENT_DEBUG("Skip deleted n=%zu w=%d f=%d", i,
-                        eventLoop.handles[i].watch, eventLoop.handles[i].fd);
-            continue;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+
+    if (!state->events)
+        op = EPOLL_CTL_ADD;
+    else if (!events)
+        op = EPOLL_CTL_DEL;
+    else
+        op = EPOLL_CTL_MOD;
+
+    if (epoll_ctl(loop->epollfd, op, fd, &ev) < 0) {
+        if (op == EPOLL_CTL_ADD && errno == EEXIST) {
+            /* Stale registration left behind by an fd which was
+             * closed and reused before its handle was removed */
+            if (epoll_ctl(loop->epollfd, EPOLL_CTL_MOD, fd, &ev) < 0)
+                VIR_WARN("Unable to modify fd %d in epoll set: %s",
+                         fd, virStrerror(errno, ebuf, sizeof(ebuf)));
+        } else if (op == EPOLL_CTL_MOD && errno == ENOENT) {
+            /* The fd was closed and reopened under the same number,
+             * which silently dropped the old registration */
+            if (epoll_ctl(loop->epollfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+                VIR_WARN("Unable to add fd %d to epoll set: %s",
+                         fd, virStrerror(errno, ebuf, sizeof(ebuf)));
+        } else if (op != EPOLL_CTL_DEL && errno == EPERM) {
+            /* epoll refuses regular files, which poll() reports
+             * as always ready. Emulate that behaviour */
+            EVENT_DEBUG("fd %d does not support epoll, treating as ready", fd);
+            state->nonpollable = true;
+            loop->nonpollable++;
+            state->events = events;
+            return;
+        } else if (op != EPOLL_CTL_DEL) {
+            VIR_WARN("Unable to update fd %d in epoll set: %s",
+                     fd, virStrerror(errno, ebuf, sizeof(ebuf)));
         }
+        /* Failure to delete means the fd was already closed, which
+         * removed it from the set anyway */
+    }
 
-        if (fds[n].revents) {
-            virEventHandleCallback cb = eventLoop.handles[i].cb;
-            int watch = eventLoop.handles[i].watch;
-            void *opaque = eventLoop.handles[i].opaque;
-            int hEvents = virEventPollFromNativeEvents(fds[n].revents);
-            PROBE(EVENT_POLL_DISPATCH_HANDLE,
-                  "watch=%d events=%d",
-                  watch, hEvents);
-            virMutexUnlock(&eventLoop.lock);
-            (cb)(watch, fds[n].fd, hEvents, opaque);
-            virMutexLock(&eventLoop.lock);
+    if (op == EPOLL_CTL_ADD)
+        loop->epollRegistered++;
+    else if (op == EPOLL_CTL_DEL)
+        loop->epollRegistered--;
+    state->events = events;
+}
+
+
+static int virEventPollEpollPrepare(struct virEventPollLoop *loop)
+{
+    /* Size the result buffer for the worst case, so every ready
+     * fd is reported in a single call */
+    size_t nevents = MAX(loop->epollRegistered, 1);
+
+    if (nevents > loop->epollEventsAlloc &&
+        VIR_RESIZE_N(loop->epollEvents, loop->epollEventsAlloc,
+                     0, nevents) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int virEventPollEpollWait(struct virEventPollLoop *loop, int timeout)
+{
+    if (loop->nonpollable)
+        timeout = 0;
+
+    PROBE(EVENT_POLL_RUN,
+          "nhandles=%zu timeout=%d",
+          loop->handlesCount, timeout);
+    return epoll_wait(loop->epollfd, loop->epollEvents,
+                      loop->epollEventsAlloc, timeout);
+}
+
+
+static int virEventPollEpollDispatch(struct virEventPollLoop *loop, int nready)
+{
+    size_t nhandles = loop->handlesCount;
+    size_t n;
+    VIR_DEBUG("Dispatch %d", nready);
+
+    for (n = 0; n < nready; n++)
+        virEventPollDispatchFD(loop, loop->epollEvents[n].data.fd,
+                               loop->epollEvents[n].events, nhandles);
+
+    if (loop->nonpollable) {
+        for (n = 0; n < loop->fdsAlloc; n++) {
+            if (loop->fds[n].nonpollable)
+                virEventPollDispatchFD(loop, n, loop->fds[n].events,
+                                       nhandles);
         }
     }
 
@@ -514,49 +1180,49 @@ static int virEventPollDispatchHandles(int nfds, struct pollfd *fds)
 }
 
 
-/* Used post dispatch to actually remove any timers that
- * were previously marked as deleted. This asynchronous
- * cleanup is needed to make dispatch re-entrant safe.
+static const struct virEventPollBackend virEventPollBackendEpoll = {
+    .name = "epoll",
+    .init = virEventPollEpollInit,
+    .updateFD = virEventPollEpollUpdateFD,
+    .prepare = virEventPollEpollPrepare,
+    .wait = virEventPollEpollWait,
+    .dispatch = virEventPollEpollDispatch,
+};
+#endif /* HAVE_SYS_EPOLL_H */
+
+
+/* Used post dispatch to actually free any timers that
+ * were previously removed. This asynchronous cleanup is
+ * needed to make dispatch re-entrant safe.
  */
 static void virEventPollCleanupTimeouts(void)
 {
     size_t i;
-    size_t gap;
-    VIR_DEBUG("Cleanup %zu", eventLoop.timeoutsCount);
+    VIR_DEBUG("Cleanup %zu", eventLoop.deletedTimeoutsCount);
 
-    /* Remove deleted entries, shuffling down remaining
-     * entries as needed to form contiguous series
-     */
-    for (i = 0; i < eventLoop.timeoutsCount;) {
-        if (!eventLoop.timeouts[i].deleted) {
-            i++;
-            continue;
-        }
+    /* NB, free callbacks may remove further timers, which get
+     * appended to the list we are walking */
+    for (i = 0; i < eventLoop.deletedTimeoutsCount; i++) {
+        struct virEventPollTimeout *t = eventLoop.deletedTimeouts[i];
 
         PROBE(EVENT_POLL_PURGE_TIMEOUT,
               "timer=%d",
-              eventLoop.timeouts[i].timer);
-        if (eventLoop.timeouts[i].ff) {
-            virFreeCallback ff = eventLoop.timeouts[i].ff;
-            void *opaque = eventLoop.timeouts[i].opaque;
+              t->timer);
+        if (t->ff) {
+            virFreeCallback ff = t->ff;
+            void *opaque = t->opaque;
             virMutexUnlock(&eventLoop.lock);
             ff(opaque);
             virMutexLock(&eventLoop.lock);
         }
-
-        if ((i+1) < eventLoop.timeoutsCount) {
-            memmove(eventLoop.timeouts+i,
-                    eventLoop.timeouts+i+1,
-                    sizeof(struct virEventPollTimeout)*(eventLoop.timeoutsCount
-                                                    -(i+1)));
-        }
-        eventLoop.timeoutsCount--;
+        VIR_FREE(eventLoop.deletedTimeouts[i]);
     }
+    eventLoop.deletedTimeoutsCount = 0;
 
     /* Release some memory if we've got a big chunk free */
-    gap = eventLoop.timeoutsAlloc - eventLoop.timeoutsCount;
-    if (eventLoop.timeoutsCount == 0 ||
-        (gap > eventLoop.timeoutsCount && gap > EVENT_ALLOC_EXTENT)) {
+    if (eventLoop.timeoutsAlloc - eventLoop.timeoutsCount >
+        MAX(eventLoop.timeoutsCount, EVENT_ALLOC_EXTENT)) {
+        size_t gap = eventLoop.timeoutsAlloc - eventLoop.timeoutsCount;
         EVENT_DEBUG("Found %zu out of %zu timeout slots used, releasing %zu",
                     eventLoop.timeoutsCount, eventLoop.timeoutsAlloc, gap);
         VIR_SHRINK_N(eventLoop.timeouts, eventLoop.timeoutsAlloc, gap);
@@ -567,78 +1233,82 @@ static void virEventPollCleanupTimeouts(void)
  * were previously marked as deleted. This asynchronous
  * cleanup is needed to make dispatch re-entrant safe.
  */
-static void virEventPollCleanupHandles(void)
+static void virEventPollCleanupHandles(struct virEventPollLoop *loop)
 {
     size_t i;
     size_t gap;
-    VIR_DEBUG("Cleanup %zu", eventLoop.handlesCount);
+    bool removed = false;
+    VIR_DEBUG("Cleanup %zu", loop->handlesCount);
 
     /* Remove deleted entries, shuffling down remaining
      * entries as needed to form contiguous series
      */
-    for (i = 0; i < eventLoop.handlesCount;) {
-        if (!eventLoop.handles[i].deleted) {
+    for (i = 0; i < loop->handlesCount;) {
+        if (!loop->handles[i].deleted) {
             i++;
             continue;
         }
 
         PROBE(EVENT_POLL_PURGE_HANDLE,
               "watch=%d",
-              eventLoop.handles[i].watch);
-        if (eventLoop.handles[i].ff) {
-            virFreeCallback ff = eventLoop.handles[i].ff;
-            void *opaque = eventLoop.handles[i].opaque;
-            virMutexUnlock(&eventLoop.lock);
+              loop->handles[i].watch);
+        if (loop->handles[i].ff) {
+            virFreeCallback ff = loop->handles[i].ff;
+            void *opaque = loop->handles[i].opaque;
+            virMutexUnlock(&loop->lock);
             ff(opaque);
-            virMutexLock(&eventLoop.lock);
+            virMutexLock(&loop->lock);
         }
 
-        if ((i+1) < eventLoop.handlesCount) {
-            memmove(eventLoop.handles+i,
-                    eventLoop.handles+i+1,
-                    sizeof(struct virEventPollHandle)*(eventLoop.handlesCount
+        if ((i+1) < loop->handlesCount) {
+            memmove(loop->handles+i,
+                    loop->handles+i+1,
+                    sizeof(struct virEventPollHandle)*(loop->handlesCount
                                                    -(i+1)));
         }
-        eventLoop.handlesCount--;
+        loop->handlesCount--;
+        removed = true;
     }
 
+    if (removed)
+        virEventPollRebuildFDs(loop);
+
     /* Release some memory if we've got a big chunk free */
-    gap = eventLoop.handlesAlloc - eventLoop.handlesCount;
-    if (eventLoop.handlesCount == 0 ||
-        (gap > eventLoop.handlesCount && gap > EVENT_ALLOC_EXTENT)) {
+    gap = loop->handlesAlloc - loop->handlesCount;
+    if (loop->handlesCount == 0 ||
+        (gap > loop->handlesCount && gap > EVENT_ALLOC_EXTENT)) {
         EVENT_DEBUG("Found %zu out of %zu handles slots used, releasing %zu",
-                    eventLoop.handlesCount, eventLoop.handlesAlloc, gap);
-        VIR_SHRINK_N(eventLoop.handles, eventLoop.handlesAlloc, gap);
+                    loop->handlesCount, loop->handlesAlloc, gap);
+        VIR_SHRINK_N(loop->handles, loop->handlesAlloc, gap);
     }
 }
 
 /*
- * Run a single iteration of the event loop, blocking until
- * at least one file handle has an event, or a timer expires
+ * Run a single iteration of @loop, blocking until at least one
+ * file handle has an event, or a timer expires. Only the main
+ * loop has timers.
  */
-int virEventPollRunOnce(void)
+static int virEventPollRunOnceLoop(struct virEventPollLoop *loop)
 {
-    struct pollfd *fds = NULL;
-    int ret, timeout, nfds;
+    int ret, timeout = -1;
+    bool isMain = loop == &eventLoop;
 
-    virMutexLock(&eventLoop.lock);
-    eventLoop.running = 1;
-    virThreadSelf(&eventLoop.leader);
+    virMutexLock(&loop->lock);
+    loop->running = 1;
+    virThreadSelf(&loop->leader);
 
-    virEventPollCleanupTimeouts();
-    virEventPollCleanupHandles();
+    if (isMain)
+        virEventPollCleanupTimeouts();
+    virEventPollCleanupHandles(loop);
 
-    if (!(fds = virEventPollMakePollFDs(&nfds)) ||
-        virEventPollCalculateTimeout(&timeout) < 0)
+    if (loop->backend->prepare(loop) < 0 ||
+        (isMain && virEventPollCalculateTimeout(&timeout) < 0))
         goto error;
 
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
 
  retry:
-    PROBE(EVENT_POLL_RUN,
-          "nhandles=%d timeout=%d",
-          nfds, timeout);
-    ret = poll(fds, nfds, timeout);
+    ret = loop->backend->wait(loop, timeout);
     if (ret < 0) {
         EVENT_DEBUG("Poll got error event %d", errno);
         if (errno == EINTR || errno == EAGAIN)
@@ -649,91 +1319,332 @@ int virEventPollRunOnce(void)
     }
     EVENT_DEBUG("Poll got %d event(s)", ret);
 
-    virMutexLock(&eventLoop.lock);
-    if (virEventPollDispatchTimeouts() < 0)
+    virMutexLock(&loop->lock);
+    if (isMain && virEventPollDispatchTimeouts() < 0)
         goto error;
 
-    if (ret > 0 &&
-        virEventPollDispatchHandles(nfds, fds) < 0)
+    if ((ret > 0 || loop->nonpollable) &&
+        loop->backend->dispatch(loop, ret) < 0)
         goto error;
 
-    virEventPollCleanupTimeouts();
-    virEventPollCleanupHandles();
+    if (isMain)
+        virEventPollCleanupTimeouts();
+    virEventPollCleanupHandles(loop);
 
-    eventLoop.running = 0;
-    virMutexUnlock(&eventLoop.lock);
-    VIR_FREE(fds);
+    loop->running = 0;
+    virMutexUnlock(&loop->lock);
     return 0;
 
  error:
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
  error_unlocked:
-    VIR_FREE(fds);
     return -1;
 }
 
 
+int virEventPollRunOnce(void)
+{
+    return virEventPollRunOnceLoop(&eventLoop);
+}
+
+
 static void virEventPollHandleWakeup(int watch ATTRIBUTE_UNUSED,
                                      int fd,
                                      int events ATTRIBUTE_UNUSED,
-                                     void *opaque ATTRIBUTE_UNUSED)
+                                     void *opaque)
 {
+    struct virEventPollLoop *loop = opaque;
     char c;
-    virMutexLock(&eventLoop.lock);
+    virMutexLock(&loop->lock);
     ignore_value(saferead(fd, &c, sizeof(c)));
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
 }
 
-int virEventPollInit(void)
+
+/* Set up the lock, backend and wakeup pipe of @loop */
+static int virEventPollLoopInit(struct virEventPollLoop *loop)
 {
-    if (virMutexInit(&eventLoop.lock) < 0) {
+    if (virMutexInit(&loop->lock) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to initialize mutex"));
         return -1;
     }
 
-    if (pipe2(eventLoop.wakeupfd, O_CLOEXEC | O_NONBLOCK) < 0) {
+    loop->epollfd = -1;
+#ifdef HAVE_SYS_EPOLL_H
+    if (virEventPollBackendEpoll.init(loop) == 0) {
+        loop->backend = &virEventPollBackendEpoll;
+    } else {
+        VIR_WARN("Falling back to poll() based event loop");
+        virResetLastError();
+    }
+#endif
+    if (!loop->backend) {
+        if (virEventPollBackendPoll.init(loop) < 0)
+            return -1;
+        loop->backend = &virEventPollBackendPoll;
+    }
+    VIR_DEBUG("Using %s event loop backend", loop->backend->name);
+
+    if (pipe2(loop->wakeupfd, O_CLOEXEC | O_NONBLOCK) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to setup wakeup pipe"));
         return -1;
     }
 
-    if (virEventPollAddHandle(eventLoop.wakeupfd[0],
-                              VIR_EVENT_HANDLE_READABLE,
-                              virEventPollHandleWakeup, NULL, NULL) < 0) {
+    if (virEventPollAddHandleLoop(loop, loop->wakeupfd[0],
+                                  VIR_EVENT_HANDLE_READABLE,
+                                  virEventPollHandleWakeup, loop, NULL) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Unable to add handle %d to event loop"),
-                       eventLoop.wakeupfd[0]);
-        VIR_FORCE_CLOSE(eventLoop.wakeupfd[0]);
-        VIR_FORCE_CLOSE(eventLoop.wakeupfd[1]);
+                       loop->wakeupfd[0]);
+        VIR_FORCE_CLOSE(loop->wakeupfd[0]);
+        VIR_FORCE_CLOSE(loop->wakeupfd[1]);
         return -1;
     }
 
     return 0;
 }
 
-static int virEventPollInterruptLocked(void)
+
+int virEventPollInit(void)
+{
+    if (!(eventLoop.timers = virHashCreateFull(EVENT_ALLOC_EXTENT,
+                                               NULL,
+                                               virEventPollTimerCode,
+                                               virEventPollTimerEqual,
+                                               virEventPollTimerCopy,
+                                               NULL)))
+        return -1;
+
+    if (!(callbackStats = virHashCreateFull(EVENT_ALLOC_EXTENT,
+                                            virHashValueFree,
+                                            virEventPollCallbackCode,
+                                            virEventPollTimerEqual,
+                                            virEventPollTimerCopy,
+                                            NULL)))
+        return -1;
+
+    return virEventPollLoopInit(&eventLoop);
+}
+
+
+static void virEventPollLoopThread(void *opaque)
+{
+    struct virEventPollLoop *loop = opaque;
+
+    for (;;) {
+        if (virEventPollRunOnceLoop(loop) < 0) {
+            VIR_WARN("Event loop thread iteration failed: %s",
+                     virGetLastErrorMessage());
+            virResetLastError();
+        }
+    }
+}
+
+
+int virEventPollSetLoopThreads(size_t nthreads)
+{
+    size_t nloops;
+    size_t i;
+    int ret = -1;
+
+    if (nthreads > VIR_EVENT_POLL_LOOPS_MAX) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("at most %d event loop threads are supported"),
+                       VIR_EVENT_POLL_LOOPS_MAX);
+        return -1;
+    }
+
+    nloops = nthreads > 1 ? nthreads - 1 : 0;
+
+    virMutexLock(&loopThreadsLock);
+
+    for (i = nExtraLoops; i < nloops; i++) {
+        struct virEventPollLoop *loop;
+        virThread thread;
+
+        if (VIR_ALLOC(loop) < 0)
+            break;
+
+        if (virEventPollLoopInit(loop) < 0) {
+            VIR_FREE(loop);
+            break;
+        }
+
+        if (virThreadCreate(&thread, false,
+                            virEventPollLoopThread, loop) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create event loop thread"));
+            break;
+        }
+
+        /* Published before the count, handles may be added right away */
+        extraLoops[i] = loop;
+        virAtomicIntSet(&nExtraLoops, i + 1);
+    }
+
+    if (nExtraLoops < nloops) {
+        if (nExtraLoops == 0)
+            goto cleanup;
+
+        VIR_WARN("Only started %d out of %zu event loop threads",
+                 nExtraLoops + 1, nthreads);
+        virResetLastError();
+    }
+
+    /* Loops beyond the new count keep their current handles */
+    virAtomicIntSet(&nActiveLoops, MIN(nloops, nExtraLoops));
+    VIR_DEBUG("Running %d extra event loop threads, %d of them active",
+              nExtraLoops, nActiveLoops);
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&loopThreadsLock);
+    return ret;
+}
+
+
+size_t virEventPollGetLoopThreads(void)
+{
+    return virAtomicIntGet(&nActiveLoops) + 1;
+}
+
+
+static int virEventPollInterruptLocked(struct virEventPollLoop *loop)
 {
     char c = '\0';
 
-    if (!eventLoop.running ||
-        virThreadIsSelf(&eventLoop.leader)) {
-        VIR_DEBUG("Skip interrupt, %d %llu", eventLoop.running,
-                  virThreadID(&eventLoop.leader));
+    if (!loop->running ||
+        virThreadIsSelf(&loop->leader)) {
+        VIR_DEBUG("Skip interrupt, %d %llu", loop->running,
+                  virThreadID(&loop->leader));
         return 0;
     }
 
     VIR_DEBUG("Interrupting");
-    if (safewrite(eventLoop.wakeupfd[1], &c, sizeof(c)) != sizeof(c))
+    if (safewrite(loop->wakeupfd[1], &c, sizeof(c)) != sizeof(c))
         return -1;
     return 0;
 }
 
+void virEventPollGetStats(virEventPollStatsPtr stats)
+{
+    virMutexLock(&eventLoop.lock);
+    *stats = eventLoop.stats;
+    stats->timers = virHashSize(eventLoop.timers);
+    stats->timersArmed = eventLoop.timeoutsCount;
+    virMutexUnlock(&eventLoop.lock);
+}
+
+void virEventPollSetStallThreshold(unsigned int threshold)
+{
+    virAtomicIntSet(&stallThreshold, MIN(threshold, INT_MAX / 1000));
+}
+
+
+unsigned int virEventPollGetStallThreshold(void)
+{
+    return virAtomicIntGet(&stallThreshold);
+}
+
+
+static int virEventPollCallbackStatsCompare(const void *a, const void *b)
+{
+    const virEventPollCallbackStats *sa = a;
+    const virEventPollCallbackStats *sb = b;
+
+    /* the callbacks which blocked the loop for the longest time first */
+    if (sa->timeTotal != sb->timeTotal)
+        return sa->timeTotal > sb->timeTotal ? -1 : 1;
+    return 0;
+}
+
+
+struct virEventPollCallbackStatsData {
+    virEventPollCallbackStatsPtr stats;
+    size_t nstats;
+};
+
+
+static int virEventPollCallbackStatsCollect(void *payload,
+                                            const void *name ATTRIBUTE_UNUSED,
+                                            void *opaque)
+{
+    struct virEventPollCallbackEntry *entry = payload;
+    struct virEventPollCallbackStatsData *data = opaque;
+    virEventPollCallbackStatsPtr stats = &data->stats[data->nstats++];
+
+    stats->cb = entry->cb;
+    stats->timer = entry->timer;
+    stats->calls = entry->calls;
+    stats->timeTotal = entry->timeTotal;
+    stats->timeMax = entry->timeMax;
+    stats->stalls = entry->stalls;
+    return 0;
+}
+
+
+int virEventPollGetCallbackStats(virEventPollCallbackStatsPtr *stats,
+                                 size_t *nstats,
+                                 size_t max)
+{
+    struct virEventPollCallbackStatsData data = { NULL, 0 };
+    char buf[32];
+    size_t i;
+
+    *stats = NULL;
+    *nstats = 0;
+
+    virMutexLock(&callbackStatsLock);
+    if (callbackStats && virHashSize(callbackStats) > 0) {
+        if (VIR_ALLOC_N(data.stats, virHashSize(callbackStats)) < 0) {
+            virMutexUnlock(&callbackStatsLock);
+            return -1;
+        }
+        virHashForEach(callbackStats, virEventPollCallbackStatsCollect, &data);
+    }
+    virMutexUnlock(&callbackStatsLock);
+
+    if (data.nstats)
+        qsort(data.stats, data.nstats, sizeof(*data.stats),
+              virEventPollCallbackStatsCompare);
+
+    if (data.nstats > max)
+        data.nstats = max;
+
+    for (i = 0; i < data.nstats; i++) {
+        const char *name = virEventPollCallbackName(data.stats[i].cb,
+                                                    buf, sizeof(buf));
+
+        if (VIR_STRDUP(data.stats[i].name, name) < 0) {
+            virEventPollCallbackStatsFree(data.stats, i);
+            return -1;
+        }
+    }
+
+    *stats = data.stats;
+    *nstats = data.nstats;
+    return 0;
+}
+
+
+void virEventPollCallbackStatsFree(virEventPollCallbackStatsPtr stats,
+                                   size_t nstats)
+{
+    size_t i;
+
+    for (i = 0; i < nstats; i++)
+        VIR_FREE(stats[i].name);
+    VIR_FREE(stats);
+}
+
+
 int virEventPollInterrupt(void)
 {
     int ret;
     virMutexLock(&eventLoop.lock);
-    ret = virEventPollInterruptLocked();
+    ret = virEventPollInterruptLocked(&eventLoop);
     virMutexUnlock(&eventLoop.lock);
     return ret;
 }
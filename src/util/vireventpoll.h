@@ -41,6 +41,29 @@ int virEventPollAddHandle(int fd, int events,
                           void *opaque,
                           virFreeCallback ff);
 
+/**
+ * virEventPollAddHandleAffinity: register a callback on a loop thread
+ *
+ * @fd: file handle to monitor for events
+ * @events: bitset of events to watch from POLLnnn constants
+ * @cb: callback to invoke when an event occurs
+ * @opaque: user data to pass to callback
+ * @key: value used to pick the loop thread
+ *
+ * Like virEventPollAddHandle, but when extra loop threads were
+ * started by virEventPollSetLoopThreads, the callback is invoked
+ * from the thread selected by @key. Handles registered with the
+ * same key are always dispatched by the same thread.
+ *
+ * returns -1 if the file handle cannot be registered, a positive
+ * integer watch id upon success
+ */
+int virEventPollAddHandleAffinity(int fd, int events,
+                                  virEventHandleCallback cb,
+                                  void *opaque,
+                                  virFreeCallback ff,
+                                  unsigned int key);
+
 /**
  * virEventPollUpdateHandle: change event set for a monitored file handle
  *
@@ -107,6 +130,29 @@ int virEventPollRemoveTimeout(int timer);
  */
 int virEventPollInit(void);
 
+/**
+ * virEventPollSetLoopThreads: spread file handles over several threads
+ *
+ * @nthreads: total number of event loop threads, including the one
+ *            calling virEventPollRunOnce
+ *
+ * Starts @nthreads - 1 extra threads, each running its own loop
+ * for handles registered by virEventPollAddHandleAffinity. Timers
+ * are always dispatched by the main loop. May be called again at
+ * any time after virEventPollInit: growing starts more threads,
+ * shrinking only stops assigning new handles to the threads above
+ * @nthreads, which keep dispatching the handles they already have.
+ *
+ * returns -1 if no thread could be started, 0 upon success
+ */
+int virEventPollSetLoopThreads(size_t nthreads);
+
+/**
+ * virEventPollGetLoopThreads: number of threads new handles are
+ * spread over, including the main loop
+ */
+size_t virEventPollGetLoopThreads(void);
+
 /**
  * virEventPollRunOnce: run a single iteration of the event loop.
  *
@@ -128,5 +174,72 @@ int virEventPollToNativeEvents(int events);
  */
 int virEventPollInterrupt(void);
 
+typedef struct _virEventPollStats virEventPollStats;
+typedef virEventPollStats *virEventPollStatsPtr;
+struct _virEventPollStats {
+    size_t timers;                       /* registered timers */
+    size_t timersArmed;                  /* timers with a pending expiry */
+    unsigned long long timersFired;      /* callbacks invoked since start */
+    unsigned long long timersFiredRate;  /* callbacks invoked in the last
+                                            full second */
+    unsigned long long timersLateTotal;  /* sum of dispatch delays in ms */
+    unsigned long long timersLateMax;    /* worst dispatch delay in ms */
+};
+
+/**
+ * virEventPollGetStats: retrieve timer statistics of the event loop
+ *
+ * @stats: filled with a snapshot of the current statistics
+ */
+void virEventPollGetStats(virEventPollStatsPtr stats);
+
+/**
+ * virEventPollSetStallThreshold: time the callbacks of the event loop
+ *
+ * @threshold: time in milliseconds, 0 to stop timing callbacks
+ *
+ * Starts accounting for the time spent in each callback function
+ * and warns about any callback which blocks the event loop for
+ * @threshold milliseconds or more.
+ */
+void virEventPollSetStallThreshold(unsigned int threshold);
+
+/**
+ * virEventPollGetStallThreshold: the threshold set by
+ * virEventPollSetStallThreshold, 0 if callbacks are not timed
+ */
+unsigned int virEventPollGetStallThreshold(void);
+
+typedef struct _virEventPollCallbackStats virEventPollCallbackStats;
+typedef virEventPollCallbackStats *virEventPollCallbackStatsPtr;
+struct _virEventPollCallbackStats {
+    const void *cb;                 /* the callback function */
+    char *name;                     /* its symbol, or its address */
+    bool timer;                     /* timer rather than handle callback */
+    unsigned long long calls;       /* invocations while being timed */
+    unsigned long long timeTotal;   /* time spent in it, in microseconds */
+    unsigned long long timeMax;     /* longest invocation, in microseconds */
+    unsigned long long stalls;      /* invocations over the threshold */
+};
+
+/**
+ * virEventPollGetCallbackStats: retrieve callback timing statistics
+ *
+ * @stats: filled with an array of statistics
+ * @nstats: filled with the size of @stats
+ * @max: maximum number of callbacks to report
+ *
+ * Reports the @max callback functions which spent the most time
+ * blocking the event loop, in decreasing order. Free @stats with
+ * virEventPollCallbackStatsFree.
+ *
+ * returns -1 on error, 0 upon success
+ */
+int virEventPollGetCallbackStats(virEventPollCallbackStatsPtr *stats,
+                                 size_t *nstats,
+                                 size_t max);
+void virEventPollCallbackStatsFree(virEventPollCallbackStatsPtr stats,
+                                   size_t nstats);
+
 
 #endif /* __VIRTD_EVENT_H__ */
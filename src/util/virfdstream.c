@@ -49,14 +49,78 @@
 
 VIR_LOG_INIT("fdstream");
 
+/* O_DIRECT needs buffers, offsets and sizes aligned to the logical
+ * block size of the file; like the I/O helper use a generous value */
+#define VIR_FDSTREAM_IO_ALIGN (64 * 1024)
+
+/* Size and number of the buffers used by the I/O thread, see
+ * virFDStreamSetDirectIO() */
+static size_t virFDStreamIOBufSize = 1024 * 1024;
+static size_t virFDStreamIOQueueDepth = 4;
+
+typedef struct _virFDStreamIOBuf virFDStreamIOBuf;
+typedef virFDStreamIOBuf *virFDStreamIOBufPtr;
+struct _virFDStreamIOBuf {
+    char *data;
+    size_t len;
+};
+
+/* In-process replacement for the I/O helper, used for files opened
+ * with O_DIRECT. The thread moves data between @fd and a ring of
+ * @depth buffers, which saves both the helper process and the copy
+ * through a pipe. The stream side is only woken up through a pipe:
+ * one byte is queued for every filled buffer when reading @fd and
+ * for every empty buffer when writing it. */
+typedef struct _virFDStreamIOThread virFDStreamIOThread;
+typedef virFDStreamIOThread *virFDStreamIOThreadPtr;
+struct _virFDStreamIOThread {
+    virThread thread;
+    virMutex lock;
+    virCond cond;
+
+    char *path;
+    int fd;
+    int notify;         /* write end of the wakeup pipe */
+    bool output;        /* data goes into @fd */
+    bool direct;
+    unsigned long long length;
+    unsigned long long total;
+
+    /* Buffers from @head on, @count of them, are passed from the
+     * producer to the consumer: the thread when reading @fd, the
+     * stream when writing it. */
+    virFDStreamIOBufPtr bufs;
+    size_t bufsize;
+    size_t depth;
+    size_t head;
+    size_t count;
+    size_t consumed;    /* bytes of bufs[head] read by the stream */
+    bool filling;       /* stream is writing into the next buffer */
+
+    bool eof;
+    bool quit;
+    int err;
+};
+
 /* Tunnelled migration stream support */
 struct virFDStreamData {
     int fd;
     int errfd;
     virCommandPtr cmd;
+    virFDStreamIOThreadPtr thread;
     unsigned long long offset;
     unsigned long long length;
 
+    /* Sparse streams pass holes instead of zeroes. Without the I/O
+     * helper they are looked up in @fd directly, otherwise they are
+     * carried by the messages on the pipe; @msgDone counts the bytes
+     * of the current message header transferred so far, @msgLength
+     * the bytes of its payload still to go. */
+    bool sparse;
+    virFDStreamMsgHeader msg;
+    size_t msgDone;
+    unsigned long long msgLength;
+
     int watch;
     int events;         /* events the stream callback is subscribed for */
     bool cbRemoved;
@@ -80,6 +144,37 @@ struct virFDStreamData {
 };
 
 
+/* Streams written by the I/O thread wait for empty buffers on the
+ * read end of the wakeup pipe, translate between stream and handle
+ * events for them */
+static int
+virFDStreamEventsToHandle(struct virFDStreamData *fdst,
+                          int events)
+{
+    if (!fdst->thread || !fdst->thread->output)
+        return events;
+
+    if (events & VIR_STREAM_EVENT_WRITABLE)
+        return (events & ~VIR_STREAM_EVENT_WRITABLE) |
+            VIR_EVENT_HANDLE_READABLE;
+    return events & ~VIR_STREAM_EVENT_READABLE;
+}
+
+
+static int
+virFDStreamEventsFromHandle(struct virFDStreamData *fdst,
+                            int events)
+{
+    if (!fdst->thread || !fdst->thread->output)
+        return events;
+
+    if (events & VIR_EVENT_HANDLE_READABLE)
+        return (events & ~VIR_EVENT_HANDLE_READABLE) |
+            VIR_STREAM_EVENT_WRITABLE;
+    return events;
+}
+
+
 static int virFDStreamRemoveCallback(virStreamPtr stream)
 {
     struct virFDStreamData *fdst = stream->privateData;
@@ -135,7 +230,8 @@ static int virFDStreamUpdateCallback(virStreamPtr stream, int events)
         goto cleanup;
     }
 
-    virEventUpdateHandle(fdst->watch, events);
+    virEventUpdateHandle(fdst->watch,
+                         virFDStreamEventsToHandle(fdst, events));
     fdst->events = events;
 
     ret = 0;
@@ -169,6 +265,7 @@ static void virFDStreamEvent(int watch ATTRIBUTE_UNUSED,
     cb = fdst->cb;
     cbopaque = fdst->opaque;
     ff = fdst->ff;
+    events = virFDStreamEventsFromHandle(fdst, events);
     fdst->dispatching = true;
     virMutexUnlock(&fdst->lock);
 
@@ -217,7 +314,8 @@ virFDStreamAddCallback(virStreamPtr st,
     }
 
     if ((fdst->watch = virEventAddHandle(fdst->fd,
-                                         events,
+                                         virFDStreamEventsToHandle(fdst,
+                                                                   events),
                                          virFDStreamEvent,
                                          st,
                                          virFDStreamCallbackFree)) < 0) {
@@ -241,6 +339,424 @@ virFDStreamAddCallback(virStreamPtr st,
     return ret;
 }
 
+/* Caller must hold @thr->lock */
+static void
+virFDStreamIOThreadNotify(virFDStreamIOThreadPtr thr)
+{
+    char c = 0;
+
+    /* The pipe has room for far more bytes than there are buffers */
+    ignore_value(safewrite(thr->notify, &c, 1));
+}
+
+
+static ssize_t
+virFDStreamIOThreadReadBuf(virFDStreamIOThreadPtr thr,
+                           virFDStreamIOBufPtr buf)
+{
+    size_t want = thr->bufsize;
+    ssize_t got;
+
+    if (thr->length) {
+        if (thr->total == thr->length)
+            return 0;
+        /* O_DIRECT reads whole buffers, the excess is dropped below */
+        if (!thr->direct && (thr->length - thr->total) < want)
+            want = thr->length - thr->total;
+    }
+
+    if ((got = saferead(thr->fd, buf->data, want)) < 0)
+        return -1;
+
+    if (thr->length && (thr->length - thr->total) < got)
+        got = thr->length - thr->total;
+
+    buf->len = got;
+    thr->total += got;
+    return got;
+}
+
+
+static int
+virFDStreamIOThreadWriteBuf(virFDStreamIOThreadPtr thr,
+                            virFDStreamIOBufPtr buf)
+{
+    size_t len = buf->len;
+    off_t end = 0;
+
+    if (thr->direct && (len & (VIR_FDSTREAM_IO_ALIGN - 1))) {
+        /* O_DIRECT can't write the short tail of the stream, pad it
+         * to whole blocks and cut the file back afterwards */
+        if ((end = lseek(thr->fd, 0, SEEK_CUR)) < 0)
+            return -1;
+        end += len;
+        len = VIR_ROUND_UP(len, VIR_FDSTREAM_IO_ALIGN);
+        memset(buf->data + buf->len, 0, len - buf->len);
+    }
+
+    if (safewrite(thr->fd, buf->data, len) < 0)
+        return -1;
+
+    if (end && ftruncate(thr->fd, end) < 0)
+        return -1;
+
+    thr->total += buf->len;
+    return 0;
+}
+
+
+static void
+virFDStreamIOThreadMain(void *opaque)
+{
+    virFDStreamIOThreadPtr thr = opaque;
+    virFDStreamIOBufPtr buf;
+    ssize_t done;
+    int err;
+
+    virMutexLock(&thr->lock);
+
+    while (!thr->quit) {
+        if (thr->count == (thr->output ? 0 : thr->depth)) {
+            if (thr->output && thr->eof)
+                break;
+            if (virCondWait(&thr->cond, &thr->lock) < 0) {
+                thr->err = errno;
+                virFDStreamIOThreadNotify(thr);
+                break;
+            }
+            continue;
+        }
+
+        if (thr->output)
+            buf = &thr->bufs[thr->head];
+        else
+            buf = &thr->bufs[(thr->head + thr->count) % thr->depth];
+        virMutexUnlock(&thr->lock);
+
+        if (thr->output)
+            done = virFDStreamIOThreadWriteBuf(thr, buf);
+        else
+            done = virFDStreamIOThreadReadBuf(thr, buf);
+        err = errno;
+
+        virMutexLock(&thr->lock);
+        if (done < 0) {
+            thr->err = err;
+            virFDStreamIOThreadNotify(thr);
+            break;
+        }
+
+        if (thr->output) {
+            thr->head = (thr->head + 1) % thr->depth;
+            thr->count--;
+        } else if (done == 0) {
+            thr->eof = true;
+        } else {
+            thr->count++;
+        }
+        virFDStreamIOThreadNotify(thr);
+
+        if (!thr->output && thr->eof)
+            break;
+    }
+
+    if (thr->output && thr->eof && !thr->quit && !thr->err) {
+        virMutexUnlock(&thr->lock);
+        /* fdatasync() may fail on some special FDs */
+        if (fdatasync(thr->fd) < 0 && errno != EINVAL && errno != EROFS)
+            err = errno;
+        else
+            err = 0;
+        virMutexLock(&thr->lock);
+        thr->err = err;
+    }
+
+    virMutexUnlock(&thr->lock);
+}
+
+
+/* Caller must hold @thr->lock */
+static void
+virFDStreamIOThreadReportError(virFDStreamIOThreadPtr thr)
+{
+    if (thr->output)
+        virReportSystemError(thr->err, _("Unable to write %s"), thr->path);
+    else
+        virReportSystemError(thr->err, _("Unable to read %s"), thr->path);
+}
+
+
+static void
+virFDStreamIOThreadFree(virFDStreamIOThreadPtr thr)
+{
+    size_t i;
+
+    if (!thr)
+        return;
+
+    VIR_FORCE_CLOSE(thr->fd);
+    VIR_FORCE_CLOSE(thr->notify);
+    for (i = 0; i < thr->depth; i++)
+        VIR_FREE(thr->bufs[i].data);
+    VIR_FREE(thr->bufs);
+    VIR_FREE(thr->path);
+    virCondDestroy(&thr->cond);
+    virMutexDestroy(&thr->lock);
+    VIR_FREE(thr);
+}
+
+
+/*
+ * Starts an I/O thread serving @fd, which is either read or written
+ * depending on @output, and waking up the stream via @notify. The
+ * thread takes ownership of both file descriptors, even on failure.
+ */
+static virFDStreamIOThreadPtr
+virFDStreamIOThreadNew(const char *path,
+                       int fd,
+                       int notify,
+                       bool output,
+                       unsigned long long length)
+{
+    virFDStreamIOThreadPtr thr = NULL;
+    struct stat sb;
+    int oflags;
+    size_t i;
+
+    if ((oflags = fcntl(fd, F_GETFL)) < 0) {
+        virReportSystemError(errno, _("Unable to access stream for '%s'"),
+                             path);
+        goto error;
+    }
+
+    if (VIR_ALLOC(thr) < 0)
+        goto error;
+
+    if (virMutexInit(&thr->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize mutex"));
+        VIR_FREE(thr);
+        goto error;
+    }
+    if (virCondInit(&thr->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize condition variable"));
+        virMutexDestroy(&thr->lock);
+        VIR_FREE(thr);
+        goto error;
+    }
+
+    thr->fd = fd;
+    thr->notify = notify;
+    fd = notify = -1;
+    thr->output = output;
+    thr->direct = O_DIRECT && (oflags & O_DIRECT);
+    thr->length = length;
+    thr->bufsize = virFDStreamIOBufSize;
+    thr->depth = virFDStreamIOQueueDepth;
+
+    if (VIR_STRDUP(thr->path, path) < 0 ||
+        VIR_ALLOC_N(thr->bufs, thr->depth) < 0)
+        goto error;
+
+    /* To make the implementation simpler, we give up on any attempt
+     * to use O_DIRECT on anything but the whole of a new file when
+     * writing, just like the I/O helper does. */
+    if (thr->direct && output) {
+        if (fstat(thr->fd, &sb) < 0 || !S_ISREG(sb.st_mode) || sb.st_size) {
+            virReportSystemError(EINVAL, "%s",
+                                 _("O_DIRECT write needs empty seekable file"));
+            goto error;
+        }
+    }
+
+    for (i = 0; i < thr->depth; i++) {
+#if HAVE_POSIX_MEMALIGN
+        void *data;
+
+        if (posix_memalign(&data, VIR_FDSTREAM_IO_ALIGN, thr->bufsize)) {
+            virReportOOMError();
+            goto error;
+        }
+        thr->bufs[i].data = data;
+#else
+        if (thr->direct) {
+            virReportSystemError(ENOSYS, "%s",
+                                 _("O_DIRECT needs aligned buffers"));
+            goto error;
+        }
+        if (VIR_ALLOC_N(thr->bufs[i].data, thr->bufsize) < 0)
+            goto error;
+#endif
+    }
+
+    if (virSetNonBlock(thr->notify) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to set non-blocking mode"));
+        goto error;
+    }
+
+    /* Writers start out with all the buffers empty */
+    if (output) {
+        for (i = 0; i < thr->depth; i++)
+            virFDStreamIOThreadNotify(thr);
+    }
+
+    if (virThreadCreate(&thr->thread, true,
+                        virFDStreamIOThreadMain, thr) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create I/O thread"));
+        goto error;
+    }
+
+    return thr;
+
+ error:
+    VIR_FORCE_CLOSE(fd);
+    VIR_FORCE_CLOSE(notify);
+    virFDStreamIOThreadFree(thr);
+    return NULL;
+}
+
+
+/*
+ * Stops and frees the I/O thread @thr, waiting for it to write out
+ * all the buffered data unless @streamAbort is set.
+ *
+ * Returns 0 on success, -1 if the thread failed.
+ */
+static int
+virFDStreamIOThreadStop(virFDStreamIOThreadPtr thr,
+                        bool streamAbort)
+{
+    int ret = 0;
+
+    if (!thr)
+        return 0;
+
+    virMutexLock(&thr->lock);
+    if (thr->output && !streamAbort) {
+        if (thr->filling &&
+            thr->bufs[(thr->head + thr->count) % thr->depth].len)
+            thr->count++;
+        thr->filling = false;
+        thr->eof = true;
+    } else {
+        thr->quit = true;
+    }
+    virCondSignal(&thr->cond);
+    virMutexUnlock(&thr->lock);
+
+    virThreadJoin(&thr->thread);
+
+    if (thr->err && !streamAbort) {
+        virFDStreamIOThreadReportError(thr);
+        ret = -1;
+    }
+
+    virFDStreamIOThreadFree(thr);
+    return ret;
+}
+
+
+/* Caller must hold @fdst->lock */
+static int
+virFDStreamIOThreadRecv(struct virFDStreamData *fdst,
+                        char *bytes,
+                        size_t nbytes)
+{
+    virFDStreamIOThreadPtr thr = fdst->thread;
+    virFDStreamIOBufPtr buf;
+    char c;
+    int ret = -1;
+
+    virMutexLock(&thr->lock);
+
+    if (thr->count == 0) {
+        if (thr->err)
+            virFDStreamIOThreadReportError(thr);
+        else
+            ret = thr->eof ? 0 : -2;
+        goto cleanup;
+    }
+
+    buf = &thr->bufs[thr->head];
+    nbytes = MIN(nbytes, buf->len - thr->consumed);
+    memcpy(bytes, buf->data + thr->consumed, nbytes);
+    thr->consumed += nbytes;
+
+    if (thr->consumed == buf->len) {
+        /* Hand the buffer back to the thread along with its wakeup */
+        if (saferead(fdst->fd, &c, 1) != 1) {
+            virReportSystemError(errno, "%s",
+                                 _("cannot read from stream"));
+            goto cleanup;
+        }
+        thr->consumed = 0;
+        thr->head = (thr->head + 1) % thr->depth;
+        thr->count--;
+        virCondSignal(&thr->cond);
+    }
+
+    ret = nbytes;
+ cleanup:
+    virMutexUnlock(&thr->lock);
+    return ret;
+}
+
+
+/* Caller must hold @fdst->lock */
+static int
+virFDStreamIOThreadSend(struct virFDStreamData *fdst,
+                        const char *bytes,
+                        size_t nbytes)
+{
+    virFDStreamIOThreadPtr thr = fdst->thread;
+    virFDStreamIOBufPtr buf;
+    char c;
+    int ret = -1;
+
+    virMutexLock(&thr->lock);
+
+    if (thr->err) {
+        virFDStreamIOThreadReportError(thr);
+        goto cleanup;
+    }
+
+    buf = &thr->bufs[(thr->head + thr->count) % thr->depth];
+
+    if (!thr->filling) {
+        if (thr->count == thr->depth) {
+            ret = -2;
+            goto cleanup;
+        }
+        /* Take the wakeup belonging to the buffer */
+        if (saferead(fdst->fd, &c, 1) != 1) {
+            virReportSystemError(errno, "%s",
+                                 _("cannot write to stream"));
+            goto cleanup;
+        }
+        thr->filling = true;
+        buf->len = 0;
+    }
+
+    nbytes = MIN(nbytes, thr->bufsize - buf->len);
+    memcpy(buf->data + buf->len, bytes, nbytes);
+    buf->len += nbytes;
+
+    if (buf->len == thr->bufsize) {
+        thr->filling = false;
+        thr->count++;
+        virCondSignal(&thr->cond);
+    }
+
+    ret = nbytes;
+ cleanup:
+    virMutexUnlock(&thr->lock);
+    return ret;
+}
+
+
 static int
 virFDStreamCloseCommand(struct virFDStreamData *fdst, bool streamAbort)
 {
@@ -335,7 +851,10 @@ virFDStreamCloseInt(virStreamPtr st, bool streamAbort)
     }
 
     /* mutex locked */
-    ret = VIR_CLOSE(fdst->fd);
+    ret = virFDStreamIOThreadStop(fdst->thread, streamAbort);
+    fdst->thread = NULL;
+    if (VIR_CLOSE(fdst->fd) < 0)
+        ret = -1;
     if (virFDStreamCloseCommand(fdst, streamAbort) < 0)
         ret = -1;
 
@@ -376,6 +895,104 @@ virFDStreamAbort(virStreamPtr st)
     return virFDStreamCloseInt(st, true);
 }
 
+/*
+ * Finishes writing the header in @fdst->msg to the I/O helper. Should
+ * the pipe be full, the bytes written so far are kept in @fdst->msgDone
+ * for the next call to carry on from.
+ *
+ * Returns 0 on success, -1 on error and -2 if writing would block.
+ */
+static int
+virFDStreamWriteMsgHeader(struct virFDStreamData *fdst)
+{
+    while (fdst->msgDone < sizeof(fdst->msg)) {
+        ssize_t done = write(fdst->fd,
+                             (char *) &fdst->msg + fdst->msgDone,
+                             sizeof(fdst->msg) - fdst->msgDone);
+        if (done < 0) {
+            VIR_WARNINGS_NO_WLOGICALOP_EQUAL_EXPR
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            VIR_WARNINGS_RESET
+                return -2;
+            } else if (errno != EINTR) {
+                virReportSystemError(errno, "%s",
+                                     _("cannot write to stream"));
+                return -1;
+            }
+            continue;
+        }
+        fdst->msgDone += done;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Reads the header of the next message from the I/O helper into
+ * @fdst->msg unless it was read already.
+ *
+ * Returns 1 if the header is available, 0 on EOF, -1 on error and
+ * -2 if reading would block.
+ */
+static int
+virFDStreamReadMsgHeader(struct virFDStreamData *fdst)
+{
+    while (fdst->msgDone < sizeof(fdst->msg)) {
+        ssize_t got = read(fdst->fd,
+                           (char *) &fdst->msg + fdst->msgDone,
+                           sizeof(fdst->msg) - fdst->msgDone);
+        if (got < 0) {
+            VIR_WARNINGS_NO_WLOGICALOP_EQUAL_EXPR
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            VIR_WARNINGS_RESET
+                return -2;
+            } else if (errno != EINTR) {
+                virReportSystemError(errno, "%s",
+                                     _("cannot read from stream"));
+                return -1;
+            }
+            continue;
+        }
+
+        if (got == 0) {
+            if (fdst->msgDone == 0)
+                return 0;
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("truncated message in stream"));
+            return -1;
+        }
+
+        fdst->msgDone += got;
+        if (fdst->msgDone < sizeof(fdst->msg))
+            continue;
+
+        if (fdst->msg.type >= VIR_FDSTREAM_MSG_TYPE_LAST) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("unknown message type %u in stream"),
+                           fdst->msg.type);
+            return -1;
+        }
+
+        fdst->msgLength = fdst->msg.length;
+        if (fdst->msgLength == 0)
+            fdst->msgDone = 0;
+    }
+
+    return 1;
+}
+
+
+static void
+virFDStreamMsgConsume(struct virFDStreamData *fdst,
+                      unsigned long long len)
+{
+    fdst->msgLength -= len;
+    if (fdst->msgLength == 0)
+        fdst->msgDone = 0;
+}
+
+
 static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
 {
     struct virFDStreamData *fdst = st->privateData;
@@ -407,6 +1024,37 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
             nbytes = fdst->length - fdst->offset;
     }
 
+    if (fdst->thread) {
+        if ((ret = virFDStreamIOThreadSend(fdst, bytes, nbytes)) > 0 &&
+            fdst->length)
+            fdst->offset += ret;
+        goto cleanup;
+    }
+
+    if (fdst->sparse && fdst->cmd) {
+        if (fdst->msgDone &&
+            fdst->msg.type == VIR_FDSTREAM_MSG_TYPE_HOLE) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("cannot send data in the middle of a hole"));
+            ret = -1;
+            goto cleanup;
+        }
+
+        /* Start a new data message unless one is in flight */
+        if (fdst->msgDone == 0) {
+            nbytes = MIN(nbytes, VIR_FDSTREAM_MSG_DATA_MAX);
+            fdst->msg.type = VIR_FDSTREAM_MSG_TYPE_DATA;
+            fdst->msg.pad = 0;
+            fdst->msg.length = nbytes;
+            fdst->msgLength = nbytes;
+        }
+
+        if ((ret = virFDStreamWriteMsgHeader(fdst)) < 0)
+            goto cleanup;
+
+        nbytes = MIN(nbytes, fdst->msgLength);
+    }
+
  retry:
     ret = write(fdst->fd, bytes, nbytes);
     if (ret < 0) {
@@ -421,20 +1069,32 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
             virReportSystemError(errno, "%s",
                                  _("cannot write to stream"));
         }
-    } else if (fdst->length) {
-        fdst->offset += ret;
+    } else {
+        if (fdst->sparse && fdst->cmd)
+            virFDStreamMsgConsume(fdst, ret);
+        if (fdst->length)
+            fdst->offset += ret;
     }
 
+ cleanup:
     virMutexUnlock(&fdst->lock);
     return ret;
 }
 
 
-static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
+static int
+virFDStreamRecvFlags(virStreamPtr st,
+                     char *bytes,
+                     size_t nbytes,
+                     unsigned int flags)
 {
     struct virFDStreamData *fdst = st->privateData;
+    int inData;
+    long long sectionLen;
     int ret;
 
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
     if (nbytes > INT_MAX) {
         virReportSystemError(ERANGE, "%s",
                              _("Too many bytes to read from stream"));
@@ -459,6 +1119,56 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
             nbytes = fdst->length - fdst->offset;
     }
 
+    if (fdst->thread) {
+        if ((ret = virFDStreamIOThreadRecv(fdst, bytes, nbytes)) < 0)
+            goto cleanup;
+        goto done;
+    } else if (fdst->sparse && !fdst->cmd) {
+        /* Direct access to the file, ask it where the holes are */
+        if ((ret = virFileInData(fdst->fd, &inData, &sectionLen)) < 0)
+            goto cleanup;
+
+        if (!inData && sectionLen == 0)
+            goto cleanup; /* EOF */
+
+        if (!inData && (flags & VIR_STREAM_RECV_STOP_AT_HOLE)) {
+            ret = -3;
+            goto cleanup;
+        }
+
+        nbytes = MIN(nbytes, sectionLen);
+
+        if (!inData) {
+            if (lseek(fdst->fd, nbytes, SEEK_CUR) == (off_t) -1) {
+                virReportSystemError(errno, "%s",
+                                     _("cannot read from stream"));
+                ret = -1;
+                goto cleanup;
+            }
+            memset(bytes, 0, nbytes);
+            ret = nbytes;
+            goto done;
+        }
+    } else if (fdst->sparse) {
+        if ((ret = virFDStreamReadMsgHeader(fdst)) <= 0)
+            goto cleanup;
+
+        if (fdst->msg.type == VIR_FDSTREAM_MSG_TYPE_HOLE &&
+            (flags & VIR_STREAM_RECV_STOP_AT_HOLE)) {
+            ret = -3;
+            goto cleanup;
+        }
+
+        nbytes = MIN(nbytes, fdst->msgLength);
+
+        if (fdst->msg.type == VIR_FDSTREAM_MSG_TYPE_HOLE) {
+            memset(bytes, 0, nbytes);
+            virFDStreamMsgConsume(fdst, nbytes);
+            ret = nbytes;
+            goto done;
+        }
+    }
+
  retry:
     ret = read(fdst->fd, bytes, nbytes);
     if (ret < 0) {
@@ -473,10 +1183,157 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
             virReportSystemError(errno, "%s",
                                  _("cannot read from stream"));
         }
-    } else if (fdst->length) {
+        goto cleanup;
+    }
+
+    if (fdst->sparse && fdst->cmd) {
+        if (ret == 0 && nbytes) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("truncated message in stream"));
+            ret = -1;
+            goto cleanup;
+        }
+        virFDStreamMsgConsume(fdst, ret);
+    }
+
+ done:
+    if (fdst->length)
         fdst->offset += ret;
+
+ cleanup:
+    virMutexUnlock(&fdst->lock);
+    return ret;
+}
+
+
+static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
+{
+    return virFDStreamRecvFlags(st, bytes, nbytes, 0);
+}
+
+
+static int
+virFDStreamSendHole(virStreamPtr st,
+                    long long length,
+                    unsigned int flags)
+{
+    struct virFDStreamData *fdst = st->privateData;
+    int ret = -1;
+    int rc;
+
+    virCheckFlags(0, -1);
+
+    if (!fdst) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("stream is not open"));
+        return -1;
+    }
+
+    virMutexLock(&fdst->lock);
+
+    if (!fdst->sparse) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("stream does not support holes"));
+        goto cleanup;
+    }
+
+    if (fdst->length &&
+        (fdst->length - fdst->offset) < (unsigned long long) length) {
+        virReportSystemError(ENOSPC, "%s",
+                             _("cannot write to stream"));
+        goto cleanup;
+    }
+
+    if (!fdst->cmd) {
+        if (virFilePunchHole(fdst->fd, length) < 0)
+            goto cleanup;
+    } else {
+        if (fdst->msgDone == 0) {
+            fdst->msg.type = VIR_FDSTREAM_MSG_TYPE_HOLE;
+            fdst->msg.pad = 0;
+            fdst->msg.length = length;
+            fdst->msgLength = 0;
+        } else if (fdst->msg.type != VIR_FDSTREAM_MSG_TYPE_HOLE ||
+                   fdst->msg.length != (unsigned long long) length) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("cannot send hole in the middle of data"));
+            goto cleanup;
+        }
+
+        /* A full pipe leaves the header half written; the caller is to
+         * retry the same hole once the stream becomes writable. */
+        if ((rc = virFDStreamWriteMsgHeader(fdst)) < 0) {
+            ret = rc;
+            goto cleanup;
+        }
+        fdst->msgDone = 0;
     }
 
+    if (fdst->length)
+        fdst->offset += length;
+
+    ret = 0;
+ cleanup:
+    virMutexUnlock(&fdst->lock);
+    return ret;
+}
+
+
+static int
+virFDStreamRecvHole(virStreamPtr st,
+                    long long *length,
+                    unsigned int flags)
+{
+    struct virFDStreamData *fdst = st->privateData;
+    int inData;
+    long long sectionLen;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!fdst) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("stream is not open"));
+        return -1;
+    }
+
+    virMutexLock(&fdst->lock);
+
+    if (!fdst->sparse) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("stream does not support holes"));
+        goto cleanup;
+    }
+
+    *length = 0;
+
+    if (!fdst->cmd) {
+        if (virFileInData(fdst->fd, &inData, &sectionLen) < 0)
+            goto cleanup;
+
+        if (!inData && sectionLen) {
+            if (fdst->length &&
+                (fdst->length - fdst->offset) < (unsigned long long) sectionLen)
+                sectionLen = fdst->length - fdst->offset;
+
+            if (lseek(fdst->fd, sectionLen, SEEK_CUR) == (off_t) -1) {
+                virReportSystemError(errno, "%s",
+                                     _("cannot read from stream"));
+                goto cleanup;
+            }
+            *length = sectionLen;
+        }
+    } else if (fdst->msgDone == sizeof(fdst->msg) &&
+               fdst->msg.type == VIR_FDSTREAM_MSG_TYPE_HOLE) {
+        *length = fdst->msgLength;
+        virFDStreamMsgConsume(fdst, fdst->msgLength);
+    }
+
+    if (fdst->length)
+        fdst->offset += *length;
+
+    ret = 0;
+ cleanup:
     virMutexUnlock(&fdst->lock);
     return ret;
 }
@@ -485,6 +1342,9 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
 static virStreamDriver virFDStreamDrv = {
     .streamSend = virFDStreamWrite,
     .streamRecv = virFDStreamRead,
+    .streamRecvFlags = virFDStreamRecvFlags,
+    .streamSendHole = virFDStreamSendHole,
+    .streamRecvHole = virFDStreamRecvHole,
     .streamFinish = virFDStreamClose,
     .streamAbort = virFDStreamAbort,
     .streamEventAddCallback = virFDStreamAddCallback,
@@ -496,12 +1356,13 @@ static int virFDStreamOpenInternal(virStreamPtr st,
                                    int fd,
                                    virCommandPtr cmd,
                                    int errfd,
-                                   unsigned long long length)
+                                   unsigned long long length,
+                                   bool sparse)
 {
     struct virFDStreamData *fdst;
 
-    VIR_DEBUG("st=%p fd=%d cmd=%p errfd=%d length=%llu",
-              st, fd, cmd, errfd, length);
+    VIR_DEBUG("st=%p fd=%d cmd=%p errfd=%d length=%llu sparse=%d",
+              st, fd, cmd, errfd, length, sparse);
 
     if ((st->flags & VIR_STREAM_NONBLOCK) &&
         virSetNonBlock(fd) < 0) {
@@ -516,6 +1377,7 @@ static int virFDStreamOpenInternal(virStreamPtr st,
     fdst->cmd = cmd;
     fdst->errfd = errfd;
     fdst->length = length;
+    fdst->sparse = sparse;
     if (virMutexInit(&fdst->lock) < 0) {
         VIR_FREE(fdst);
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -533,7 +1395,7 @@ static int virFDStreamOpenInternal(virStreamPtr st,
 int virFDStreamOpen(virStreamPtr st,
                     int fd)
 {
-    return virFDStreamOpenInternal(st, fd, NULL, -1, 0);
+    return virFDStreamOpenInternal(st, fd, NULL, -1, 0, false);
 }
 
 
@@ -579,7 +1441,7 @@ int virFDStreamConnectUNIX(virStreamPtr st,
         goto error;
     }
 
-    if (virFDStreamOpenInternal(st, fd, NULL, -1, 0) < 0)
+    if (virFDStreamOpenInternal(st, fd, NULL, -1, 0, false) < 0)
         goto error;
     return 0;
 
@@ -605,17 +1467,20 @@ virFDStreamOpenFileInternal(virStreamPtr st,
                             unsigned long long length,
                             int oflags,
                             int mode,
-                            bool forceIOHelper)
+                            bool forceIOHelper,
+                            bool sparse)
 {
     int fd = -1;
     int childfd = -1;
     struct stat sb;
     virCommandPtr cmd = NULL;
+    virFDStreamIOThreadPtr thread = NULL;
+    struct virFDStreamData *fdst;
     int errfd = -1;
     char *iohelper_path = NULL;
 
-    VIR_DEBUG("st=%p path=%s oflags=%x offset=%llu length=%llu mode=%o",
-              st, path, oflags, offset, length, mode);
+    VIR_DEBUG("st=%p path=%s oflags=%x offset=%llu length=%llu mode=%o sparse=%d",
+              st, path, oflags, offset, length, mode, sparse);
 
     oflags |= O_NOCTTY | O_BINARY;
 
@@ -637,6 +1502,10 @@ virFDStreamOpenFileInternal(virStreamPtr st,
         goto error;
     }
 
+    /* Holes only make sense in files, anything else is pure data */
+    if (sparse && !S_ISREG(sb.st_mode))
+        sparse = false;
+
     if (offset &&
         lseek(fd, offset, SEEK_SET) < 0) {
         virReportSystemError(errno,
@@ -648,7 +1517,9 @@ virFDStreamOpenFileInternal(virStreamPtr st,
     /* Thanks to the POSIX i/o model, we can't reliably get
      * non-blocking I/O on block devs/regular files. To
      * support those we need to fork a helper process to do
-     * the I/O so we just have a fifo. Or use AIO :-(
+     * the I/O so we just have a fifo. O_DIRECT files, where
+     * the copy through the fifo hurts the most, are served
+     * by a thread of ours instead.
      */
     if ((st->flags & VIR_STREAM_NONBLOCK) &&
         ((!S_ISCHR(sb.st_mode) &&
@@ -668,45 +1539,61 @@ virFDStreamOpenFileInternal(virStreamPtr st,
             goto error;
         }
 
-        if (!(iohelper_path = virFileFindResource("libvirt_iohelper",
-                                                  abs_topbuilddir "/src",
-                                                  LIBEXECDIR)))
-            goto error;
-
-        cmd = virCommandNewArgList(iohelper_path,
-                                   path,
-                                   NULL);
-
-        VIR_FREE(iohelper_path);
-
-        virCommandAddArgFormat(cmd, "%llu", length);
-        virCommandPassFD(cmd, fd,
-                         VIR_COMMAND_PASS_FD_CLOSE_PARENT);
-        virCommandAddArgFormat(cmd, "%d", fd);
+        if (O_DIRECT && (oflags & O_DIRECT) && !sparse) {
+            bool output = (oflags & O_ACCMODE) != O_RDONLY;
 
-        if ((oflags & O_ACCMODE) == O_RDONLY) {
-            childfd = fds[1];
+            /* The thread owns the file and the write end of the pipe */
+            thread = virFDStreamIOThreadNew(path, fd, fds[1], output, length);
             fd = fds[0];
-            virCommandSetOutputFD(cmd, &childfd);
+            if (!thread)
+                goto error;
         } else {
-            childfd = fds[0];
-            fd = fds[1];
-            virCommandSetInputFD(cmd, childfd);
-        }
-        virCommandSetErrorFD(cmd, &errfd);
+            if (!(iohelper_path = virFileFindResource("libvirt_iohelper",
+                                                      abs_topbuilddir "/src",
+                                                      LIBEXECDIR)))
+                goto error;
+
+            cmd = virCommandNewArgList(iohelper_path,
+                                       path,
+                                       NULL);
+
+            VIR_FREE(iohelper_path);
+
+            virCommandAddArgFormat(cmd, "%llu", length);
+            virCommandPassFD(cmd, fd,
+                             VIR_COMMAND_PASS_FD_CLOSE_PARENT);
+            virCommandAddArgFormat(cmd, "%d", fd);
+            if (sparse)
+                virCommandAddArg(cmd, "1");
+
+            if ((oflags & O_ACCMODE) == O_RDONLY) {
+                childfd = fds[1];
+                fd = fds[0];
+                virCommandSetOutputFD(cmd, &childfd);
+            } else {
+                childfd = fds[0];
+                fd = fds[1];
+                virCommandSetInputFD(cmd, childfd);
+            }
+            virCommandSetErrorFD(cmd, &errfd);
 
-        if (virCommandRunAsync(cmd, NULL) < 0)
-            goto error;
+            if (virCommandRunAsync(cmd, NULL) < 0)
+                goto error;
 
-        VIR_FORCE_CLOSE(childfd);
+            VIR_FORCE_CLOSE(childfd);
+        }
     }
 
-    if (virFDStreamOpenInternal(st, fd, cmd, errfd, length) < 0)
+    if (virFDStreamOpenInternal(st, fd, cmd, errfd, length, sparse) < 0)
         goto error;
 
+    fdst = st->privateData;
+    fdst->thread = thread;
+
     return 0;
 
  error:
+    ignore_value(virFDStreamIOThreadStop(thread, true));
     virCommandFree(cmd);
     VIR_FORCE_CLOSE(fd);
     VIR_FORCE_CLOSE(childfd);
@@ -731,7 +1618,7 @@ int virFDStreamOpenFile(virStreamPtr st,
     }
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags, 0, false);
+                                       oflags, 0, false, false);
 }
 
 int virFDStreamCreateFile(virStreamPtr st,
@@ -744,7 +1631,7 @@ int virFDStreamCreateFile(virStreamPtr st,
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
                                        oflags | O_CREAT, mode,
-                                       false);
+                                       false, false);
 }
 
 #ifdef HAVE_CFMAKERAW
@@ -760,7 +1647,7 @@ int virFDStreamOpenPTY(virStreamPtr st,
     if (virFDStreamOpenFileInternal(st, path,
                                     offset, length,
                                     oflags | O_CREAT, 0,
-                                    false) < 0)
+                                    false, false) < 0)
         return -1;
 
     fdst = st->privateData;
@@ -797,7 +1684,7 @@ int virFDStreamOpenPTY(virStreamPtr st,
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
                                        oflags | O_CREAT, 0,
-                                       false);
+                                       false, false);
 }
 #endif /* !HAVE_CFMAKERAW */
 
@@ -805,11 +1692,40 @@ int virFDStreamOpenBlockDevice(virStreamPtr st,
                                const char *path,
                                unsigned long long offset,
                                unsigned long long length,
+                               bool sparse,
                                int oflags)
 {
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags, 0, true);
+                                       oflags, 0, true, sparse);
+}
+
+/**
+ * virFDStreamSetDirectIO:
+ * @bufsize: size of each buffer in bytes
+ * @depth: number of buffers
+ *
+ * Sets up the buffering of the I/O thread serving streams of files
+ * opened with O_DIRECT. Up to @depth buffers of @bufsize bytes are
+ * kept in flight between the file and the stream, @bufsize is rounded
+ * up to the alignment O_DIRECT requires. Applies to the streams opened
+ * afterwards.
+ *
+ * Returns 0 on success, -1 on invalid arguments.
+ */
+int virFDStreamSetDirectIO(size_t bufsize,
+                           size_t depth)
+{
+    if (bufsize == 0 || bufsize > INT_MAX || depth == 0) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("invalid I/O buffer size %zu or queue depth %zu"),
+                       bufsize, depth);
+        return -1;
+    }
+
+    virFDStreamIOBufSize = VIR_ROUND_UP(bufsize, VIR_FDSTREAM_IO_ALIGN);
+    virFDStreamIOQueueDepth = depth;
+    return 0;
 }
 
 int virFDStreamSetInternalCloseCb(virStreamPtr st,
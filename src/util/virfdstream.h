@@ -32,6 +32,27 @@ typedef void (*virFDStreamInternalCloseCb)(virStreamPtr st, void *opaque);
 
 typedef void (*virFDStreamInternalCloseCbFreeOpaque)(void *opaque);
 
+/* Sparse streams served by the I/O helper are split into messages
+ * on the pipe between the helper and the stream, each starting with
+ * this header. Data messages are followed by @length bytes of data,
+ * hole messages have no payload. */
+typedef enum {
+    VIR_FDSTREAM_MSG_TYPE_DATA = 0,
+    VIR_FDSTREAM_MSG_TYPE_HOLE,
+
+    VIR_FDSTREAM_MSG_TYPE_LAST
+} virFDStreamMsgType;
+
+typedef struct _virFDStreamMsgHeader virFDStreamMsgHeader;
+struct _virFDStreamMsgHeader {
+    uint32_t type; /* virFDStreamMsgType */
+    uint32_t pad;
+    uint64_t length;
+};
+
+/* Largest data payload put into a single message by the stream */
+# define VIR_FDSTREAM_MSG_DATA_MAX (256 * 1024)
+
 
 int virFDStreamOpen(virStreamPtr st,
                     int fd);
@@ -60,8 +81,12 @@ int virFDStreamOpenBlockDevice(virStreamPtr st,
                                const char *path,
                                unsigned long long offset,
                                unsigned long long length,
+                               bool sparse,
                                int oflags);
 
+int virFDStreamSetDirectIO(size_t bufsize,
+                           size_t depth);
+
 int virFDStreamSetInternalCloseCb(virStreamPtr st,
                                   virFDStreamInternalCloseCb cb,
                                   void *opaque,
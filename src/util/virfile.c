@@ -169,6 +169,28 @@ virFileDirectFdFlag(void)
     return O_DIRECT ? O_DIRECT : -1;
 }
 
+
+/**
+ * virFileAdviseSequential:
+ * @fd: file descriptor
+ *
+ * Tells the kernel @fd will be read sequentially, so that it reads
+ * further ahead. This is only a hint, failures are ignored.
+ */
+void
+virFileAdviseSequential(int fd ATTRIBUTE_UNUSED)
+{
+#if HAVE_POSIX_FADVISE
+    int rc = posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if (rc != 0) {
+        char ebuf[1024] ATTRIBUTE_UNUSED;
+        VIR_DEBUG("posix_fadvise failed on fd %d: %s",
+                  fd, virStrerror(rc, ebuf, sizeof(ebuf)));
+    }
+#endif
+}
+
 /* Opaque type for managing a wrapper around a fd.  For now,
  * read-write is not supported, just a single direction.  */
 struct _virFileWrapperFd {
@@ -181,6 +203,8 @@ struct _virFileWrapperFd {
  * virFileWrapperFdNew:
  * @fd: pointer to fd to wrap
  * @name: name of fd, for diagnostics
+ * @bufsize: size of the I/O buffers in bytes, 0 for the default
+ * @nbufs: number of I/O buffers, 0 for the default
  * @flags: bitwise-OR of virFileWrapperFdFlags
  *
  * Update @fd so that it meets parameters requested by @flags.
@@ -200,12 +224,17 @@ struct _virFileWrapperFd {
  * In some cases, @fd is changed to a non-seekable pipe; in this case, the
  * caller must not do anything further with the original fd.
  *
+ * The data is copied through @nbufs buffers of @bufsize bytes, so that
+ * reading the next buffers overlaps with writing out the previous ones.
+ *
  * On success, the new wrapper object is returned, which must be later
  * freed with virFileWrapperFdFree().  On failure, @fd is unchanged, an
  * error message is output, and NULL is returned.
  */
 virFileWrapperFdPtr
-virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
+virFileWrapperFdNew(int *fd, const char *name,
+                    size_t bufsize, size_t nbufs,
+                    unsigned int flags)
 {
     virFileWrapperFdPtr ret = NULL;
     bool output = false;
@@ -278,6 +307,12 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
      * iohelper's env so virLog functions print to stderr
      */
     virCommandAddEnvPair(ret->cmd, "LIBVIRT_LOG_OUTPUTS", "1:stderr");
+    if (bufsize)
+        virCommandAddEnvFormat(ret->cmd, "LIBVIRT_IOHELPER_BUFFER_SIZE=%zu",
+                               bufsize);
+    if (nbufs)
+        virCommandAddEnvFormat(ret->cmd, "LIBVIRT_IOHELPER_BUFFERS=%zu",
+                               nbufs);
     virCommandSetErrorBuffer(ret->cmd, &ret->err_msg);
     virCommandDoAsyncIO(ret->cmd);
 
@@ -304,6 +339,8 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
 virFileWrapperFdPtr
 virFileWrapperFdNew(int *fd ATTRIBUTE_UNUSED,
                     const char *name ATTRIBUTE_UNUSED,
+                    size_t bufsize ATTRIBUTE_UNUSED,
+                    size_t nbufs ATTRIBUTE_UNUSED,
                     unsigned int fdflags ATTRIBUTE_UNUSED)
 {
     virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -1908,7 +1945,8 @@ int virFileIsMountPoint(const char *file)
 #if defined HAVE_MNTENT_H && defined HAVE_GETMNTENT_R
 static int
 virFileGetMountSubtreeImpl(const char *mtabpath,
-                           const char *prefix,
+                           const char *const *prefixes,
+                           size_t nprefixes,
                            char ***mountsret,
                            size_t *nmountsret,
                            bool reverse)
@@ -1919,8 +1957,9 @@ virFileGetMountSubtreeImpl(const char *mtabpath,
     int ret = -1;
     char **mounts = NULL;
     size_t nmounts = 0;
+    size_t i;
 
-    VIR_DEBUG("prefix=%s", prefix);
+    VIR_DEBUG("prefix=%s nprefixes=%zu", prefixes[0], nprefixes);
 
     *mountsret = NULL;
     *nmountsret = 0;
@@ -1932,9 +1971,13 @@ virFileGetMountSubtreeImpl(const char *mtabpath,
     }
 
     while (getmntent_r(procmnt, &mntent, mntbuf, sizeof(mntbuf)) != NULL) {
-        if (!(STREQ(mntent.mnt_dir, prefix) ||
-              (STRPREFIX(mntent.mnt_dir, prefix) &&
-               mntent.mnt_dir[strlen(prefix)] == '/')))
+        for (i = 0; i < nprefixes; i++) {
+            if (STREQ(mntent.mnt_dir, prefixes[i]) ||
+                (STRPREFIX(mntent.mnt_dir, prefixes[i]) &&
+                 mntent.mnt_dir[strlen(prefixes[i])] == '/'))
+                break;
+        }
+        if (i == nprefixes)
             continue;
 
         if (VIR_EXPAND_N(mounts, nmounts, nmounts ? 1 : 2) < 0)
@@ -1960,7 +2003,8 @@ virFileGetMountSubtreeImpl(const char *mtabpath,
 #else /* ! defined HAVE_MNTENT_H && defined HAVE_GETMNTENT_R */
 static int
 virFileGetMountSubtreeImpl(const char *mtabpath ATTRIBUTE_UNUSED,
-                           const char *prefix ATTRIBUTE_UNUSED,
+                           const char *const *prefixes ATTRIBUTE_UNUSED,
+                           size_t nprefixes ATTRIBUTE_UNUSED,
                            char ***mountsret ATTRIBUTE_UNUSED,
                            size_t *nmountsret ATTRIBUTE_UNUSED,
                            bool reverse ATTRIBUTE_UNUSED)
@@ -1991,7 +2035,8 @@ int virFileGetMountSubtree(const char *mtabpath,
                            char ***mountsret,
                            size_t *nmountsret)
 {
-    return virFileGetMountSubtreeImpl(mtabpath, prefix, mountsret, nmountsret, false);
+    return virFileGetMountSubtreeImpl(mtabpath, &prefix, 1,
+                                      mountsret, nmountsret, false);
 }
 
 /**
@@ -2014,7 +2059,31 @@ int virFileGetMountReverseSubtree(const char *mtabpath,
                                   char ***mountsret,
                                   size_t *nmountsret)
 {
-    return virFileGetMountSubtreeImpl(mtabpath, prefix, mountsret, nmountsret, true);
+    return virFileGetMountSubtreeImpl(mtabpath, &prefix, 1,
+                                      mountsret, nmountsret, true);
+}
+
+/**
+ * virFileGetMountReverseSubtrees:
+ * @mtabpath: mount file to parser (eg /proc/mounts)
+ * @prefixes: mount path prefixes to match
+ * @nprefixes: number of entries in @prefixes
+ * @mountsret: allocated and filled with matching mounts
+ * @nmountsret: filled with number of matching mounts, not counting NULL terminator
+ *
+ * Like virFileGetMountReverseSubtree, but returns the mounts below any
+ * of @prefixes while reading @mtabpath just once.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virFileGetMountReverseSubtrees(const char *mtabpath,
+                                   const char *const *prefixes,
+                                   size_t nprefixes,
+                                   char ***mountsret,
+                                   size_t *nmountsret)
+{
+    return virFileGetMountSubtreeImpl(mtabpath, prefixes, nprefixes,
+                                      mountsret, nmountsret, true);
 }
 
 #ifndef WIN32
@@ -3904,3 +3973,224 @@ virFileReadValueBitmap(const char *path,
     VIR_FREE(buf);
     return ret;
 }
+
+
+/**
+ * virFileInData:
+ * @fd: file to check
+ * @inData: true if current position in the @fd is in data section
+ * @length: amount of bytes until the end of the current section
+ *
+ * With sparse files not every extent has to be physically stored on
+ * the disk. This results in so called data or hole sections. This
+ * function checks whether the current position in the file @fd is
+ * in a data section (@inData = 1) or in a hole (@inData = 0). Also,
+ * it sets @length to match the number of bytes remaining until the
+ * end of the current section.
+ *
+ * As a special case, there is an implicit hole at the end of any
+ * file. In this case, the function sets @inData = 0 and @length
+ * to the number of bytes between the current position and the end
+ * of the file, which is zero if positioned right at the end.
+ *
+ * Files on filesystems without SEEK_DATA support are reported as
+ * a single data section.
+ *
+ * Upon its return, the position in the @fd is left unchanged, i.e.
+ * despite this function lseek()-ing back and forth it always
+ * restores the original position in the file.
+ *
+ * Returns 0 on success,
+ *        -1 otherwise (with error reported).
+ */
+int
+virFileInData(int fd,
+              int *inData,
+              long long *length)
+{
+    int ret = -1;
+    off_t cur, data, hole, end;
+
+    /* Get current position */
+    cur = lseek(fd, 0, SEEK_CUR);
+    if (cur == (off_t) -1) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to get current position in file"));
+        goto cleanup;
+    }
+
+    /* Now try to get data and hole offsets */
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    data = lseek(fd, cur, SEEK_DATA);
+#else
+    data = -1;
+    errno = EINVAL;
+#endif
+
+    /* There are four options:
+     * 1) data == cur;  @cur is in data
+     * 2) data > cur; @cur is in a hole, next data at @data
+     * 3) data < 0, errno = ENXIO; either @cur is in trailing hole, or @cur is beyond EOF.
+     * 4) data < 0, errno != ENXIO; we learned nothing
+     */
+
+    if (data == (off_t) -1) {
+        /* cases 3 and 4 */
+        bool trailing = errno == ENXIO;
+
+        if (!trailing && errno != EINVAL && errno != ENOTSUP) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to seek to data"));
+            goto cleanup;
+        }
+
+        end = lseek(fd, 0, SEEK_END);
+        if (end == (off_t) -1) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to seek to EOF"));
+            goto cleanup;
+        }
+
+        /* Without SEEK_DATA support the whole file is data. */
+        *inData = !trailing && end > cur;
+        *length = end > cur ? end - cur : 0;
+    } else if (data > cur) {
+        /* case 2 */
+        *inData = 0;
+        *length = data - cur;
+    } else {
+        /* case 1, find out where the data section ends. There is
+         * always a hole at EOF, so anything but an offset past
+         * @data is an error. */
+        *inData = 1;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+        hole = lseek(fd, data, SEEK_HOLE);
+#else
+        hole = -1;
+#endif
+        if (hole == (off_t) -1 || hole == data) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to seek to hole"));
+            goto cleanup;
+        }
+
+        *length = hole - data;
+    }
+
+    ret = 0;
+ cleanup:
+    /* At any rate, reposition back to where we started. */
+    if (cur != (off_t) -1) {
+        int theerrno = errno;
+
+        if (lseek(fd, cur, SEEK_SET) == (off_t) -1) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to restore position in file"));
+            ret = -1;
+            if (theerrno == 0)
+                theerrno = errno;
+        }
+
+        errno = theerrno;
+    }
+    return ret;
+}
+
+
+/**
+ * virFilePunchHole:
+ * @fd: file to write to
+ * @length: size of the hole
+ *
+ * Creates @length bytes of empty space at the current position in
+ * @fd and moves the position past it. On regular files the range
+ * is deallocated if the filesystem supports punching holes and the
+ * file is extended as needed; everything else (and filesystems
+ * without hole punching) gets zeroes written instead.
+ *
+ * Returns 0 on success,
+ *        -1 otherwise (with error reported).
+ */
+int
+virFilePunchHole(int fd,
+                 long long length)
+{
+    struct stat sb;
+    off_t cur;
+    off_t end;
+    long long zerolen = length;
+    char *zeroes = NULL;
+    size_t zeroeslen = 1024 * 1024;
+    int ret = -1;
+
+    if (length <= 0)
+        return 0;
+
+    if (fstat(fd, &sb) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to stat file"));
+        return -1;
+    }
+
+    if ((cur = lseek(fd, 0, SEEK_CUR)) == (off_t) -1) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to get current position in file"));
+        return -1;
+    }
+    end = cur + length;
+
+    if (S_ISREG(sb.st_mode)) {
+        /* Only the part within the current file size has to be
+         * cleared, the rest is created by extending the file. */
+        zerolen = cur < sb.st_size ? MIN(end, sb.st_size) - cur : 0;
+
+#if HAVE_FALLOCATE - 0 && defined(FALLOC_FL_PUNCH_HOLE) && \
+    defined(FALLOC_FL_KEEP_SIZE)
+        if (zerolen > 0) {
+            if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                          cur, zerolen) == 0) {
+                zerolen = 0;
+            } else if (errno != EOPNOTSUPP && errno != ENOSYS) {
+                virReportSystemError(errno, "%s",
+                                     _("Unable to punch hole in file"));
+                return -1;
+            }
+        }
+#endif
+    }
+
+    if (zerolen > 0) {
+        if (VIR_ALLOC_N(zeroes, MIN(zeroeslen, zerolen)) < 0)
+            return -1;
+
+        while (zerolen > 0) {
+            size_t towrite = MIN(zeroeslen, zerolen);
+
+            if (safewrite(fd, zeroes, towrite) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("Unable to write zeroes to file"));
+                goto cleanup;
+            }
+            zerolen -= towrite;
+        }
+    }
+
+    if (S_ISREG(sb.st_mode)) {
+        if (end > sb.st_size && ftruncate(fd, end) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to extend file"));
+            goto cleanup;
+        }
+
+        if (lseek(fd, end, SEEK_SET) == (off_t) -1) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to seek past hole"));
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(zeroes);
+    return ret;
+}
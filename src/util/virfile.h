@@ -85,6 +85,8 @@ typedef virFileWrapperFd *virFileWrapperFdPtr;
 
 int virFileDirectFdFlag(void);
 
+void virFileAdviseSequential(int fd);
+
 typedef enum {
     VIR_FILE_WRAPPER_BYPASS_CACHE   = (1 << 0),
     VIR_FILE_WRAPPER_NON_BLOCKING   = (1 << 1),
@@ -92,6 +94,8 @@ typedef enum {
 
 virFileWrapperFdPtr virFileWrapperFdNew(int *fd,
                                         const char *name,
+                                        size_t bufsize,
+                                        size_t nbufs,
                                         unsigned int flags)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
 
@@ -212,6 +216,11 @@ int virFileGetMountReverseSubtree(const char *mtabpath,
                                   const char *prefix,
                                   char ***mountsret,
                                   size_t *nmountsret) ATTRIBUTE_RETURN_CHECK;
+int virFileGetMountReverseSubtrees(const char *mtabpath,
+                                   const char *const *prefixes,
+                                   size_t nprefixes,
+                                   char ***mountsret,
+                                   size_t *nmountsret) ATTRIBUTE_RETURN_CHECK;
 
 char *virFileSanitizePath(const char *path);
 
@@ -340,4 +349,10 @@ int virFileReadValueInt(const char *path, int *value);
 int virFileReadValueUint(const char *path, unsigned int *value);
 int virFileReadValueBitmap(const char *path, int maxlen, virBitmapPtr *value);
 
+int virFileInData(int fd,
+                  int *inData,
+                  long long *length);
+int virFilePunchHole(int fd,
+                     long long length);
+
 #endif /* __VIR_FILE_H */
@@ -107,6 +107,10 @@ VIR_ONCE_GLOBAL_INIT(virFirewall)
 static bool iptablesUseLock;
 static bool ip6tablesUseLock;
 static bool ebtablesUseLock;
+static bool iptablesRestore;
+static bool ip6tablesRestore;
+static bool iptablesRestoreUseLock;
+static bool ip6tablesRestoreUseLock;
 static bool lockOverride; /* true to avoid lock probes */
 
 void
@@ -130,6 +134,51 @@ virFirewallCheckUpdateLock(bool *lockflag,
     virCommandFree(cmd);
 }
 
+static bool
+virFirewallCheckRestore(const char *const*args)
+{
+    int status; /* Ignore failed commands without logging them */
+    virCommandPtr cmd;
+    bool ret = false;
+
+    if (!virFileIsExecutable(args[0]))
+        return false;
+
+    cmd = virCommandNewArgs(args);
+    virCommandSetInputBuffer(cmd, "");
+    if (virCommandRun(cmd, &status) < 0 || status) {
+        VIR_INFO("'%s' not supported by %s", args[1], args[0]);
+    } else {
+        VIR_INFO("%s supports '%s'", args[0], args[1]);
+        ret = true;
+    }
+    virCommandFree(cmd);
+    return ret;
+}
+
+static void
+virFirewallCheckUpdateRestore(void)
+{
+    const char *iptablesArgs[] = {
+        IPTABLES_RESTORE_PATH, "--noflush", "--test", NULL,
+    };
+    const char *iptablesLockArgs[] = {
+        IPTABLES_RESTORE_PATH, "-w", "--noflush", "--test", NULL,
+    };
+    const char *ip6tablesArgs[] = {
+        IP6TABLES_RESTORE_PATH, "--noflush", "--test", NULL,
+    };
+    const char *ip6tablesLockArgs[] = {
+        IP6TABLES_RESTORE_PATH, "-w", "--noflush", "--test", NULL,
+    };
+    if (lockOverride)
+        return;
+    if ((iptablesRestore = virFirewallCheckRestore(iptablesArgs)))
+        iptablesRestoreUseLock = virFirewallCheckRestore(iptablesLockArgs);
+    if ((ip6tablesRestore = virFirewallCheckRestore(ip6tablesArgs)))
+        ip6tablesRestoreUseLock = virFirewallCheckRestore(ip6tablesLockArgs);
+}
+
 static void
 virFirewallCheckUpdateLocking(void)
 {
@@ -155,6 +204,8 @@ virFirewallCheckUpdateLocking(void)
 static int
 virFirewallValidateBackend(virFirewallBackend backend)
 {
+    bool automatic = backend == VIR_FIREWALL_BACKEND_AUTOMATIC;
+
     VIR_DEBUG("Validating backend %d", backend);
     if (backend == VIR_FIREWALL_BACKEND_AUTOMATIC ||
         backend == VIR_FIREWALL_BACKEND_FIREWALLD) {
@@ -180,10 +231,14 @@ virFirewallValidateBackend(virFirewallBackend backend)
         }
     }
 
-    if (backend == VIR_FIREWALL_BACKEND_DIRECT) {
+    if (backend == VIR_FIREWALL_BACKEND_DIRECT ||
+        backend == VIR_FIREWALL_BACKEND_BATCH) {
         const char *commands[] = {
             IPTABLES_PATH, IP6TABLES_PATH, EBTABLES_PATH
         };
+        const char *restoreCommands[] = {
+            IPTABLES_RESTORE_PATH, IP6TABLES_RESTORE_PATH
+        };
         size_t i;
 
         for (i = 0; i < ARRAY_CARDINALITY(commands); i++) {
@@ -194,12 +249,31 @@ virFirewallValidateBackend(virFirewallBackend backend)
                 return -1;
             }
         }
+        if (backend == VIR_FIREWALL_BACKEND_BATCH) {
+            for (i = 0; i < ARRAY_CARDINALITY(restoreCommands); i++) {
+                if (!virFileIsExecutable(restoreCommands[i])) {
+                    virReportSystemError(errno,
+                                         _("batch firewall backend requested, but %s is not available"),
+                                         restoreCommands[i]);
+                    return -1;
+                }
+            }
+        }
         VIR_DEBUG("found iptables/ip6tables/ebtables, using direct backend");
     }
 
     currentBackend = backend;
 
     virFirewallCheckUpdateLocking();
+    virFirewallCheckUpdateRestore();
+
+    /* Prefer the batch backend if the restore commands turned out
+     * to be usable */
+    if (automatic && backend == VIR_FIREWALL_BACKEND_DIRECT &&
+        iptablesRestore && ip6tablesRestore) {
+        VIR_DEBUG("found iptables-restore/ip6tables-restore, using batch backend");
+        currentBackend = VIR_FIREWALL_BACKEND_BATCH;
+    }
 
     return 0;
 }
@@ -820,6 +894,7 @@ virFirewallApplyRule(virFirewallPtr firewall,
 
     switch (currentBackend) {
     case VIR_FIREWALL_BACKEND_DIRECT:
+    case VIR_FIREWALL_BACKEND_BATCH:
         if (virFirewallApplyRuleDirect(rule, ignoreErrors, &output) < 0)
             return -1;
         break;
@@ -860,19 +935,195 @@ virFirewallApplyRule(virFirewallPtr firewall,
     return ret;
 }
 
+static const char *
+virFirewallLayerRestoreCommand(virFirewallLayer layer)
+{
+    switch (layer) {
+    case VIR_FIREWALL_LAYER_IPV4:
+        return IPTABLES_RESTORE_PATH;
+    case VIR_FIREWALL_LAYER_IPV6:
+        return IP6TABLES_RESTORE_PATH;
+    case VIR_FIREWALL_LAYER_ETHERNET:
+    case VIR_FIREWALL_LAYER_LAST:
+        break;
+    }
+    return NULL;
+}
+
+
+/*
+ * Check whether @rule can be passed to iptables-restore, in which
+ * case @table is filled with its table and @start with the index of
+ * the argument starting the command (e.g. "-A"). Rules whose errors
+ * are ignored or whose output is needed by a query callback have to
+ * be run on their own, as have rules with arguments that can't be
+ * expressed in the restore format.
+ */
+static bool
+virFirewallRuleGetBatchInfo(virFirewallRulePtr rule,
+                            bool ignoreErrors,
+                            const char **table,
+                            size_t *start)
+{
+    const char *commands[] = {
+        "-A", "--append", "-I", "--insert", "-D", "--delete",
+        "-R", "--replace", "-N", "--new-chain", "-X", "--delete-chain",
+        "-F", "--flush", "-Z", "--zero", "-P", "--policy",
+        "-E", "--rename-chain", NULL
+    };
+    size_t i = 0;
+
+    if (ignoreErrors || rule->ignoreErrors || rule->queryCB ||
+        !virFirewallLayerRestoreCommand(rule->layer))
+        return false;
+
+    /* the lock is taken by the restore command as a whole */
+    if (i < rule->argsLen && STREQ(rule->args[i], "-w"))
+        i++;
+
+    *table = "filter";
+    if (i + 1 < rule->argsLen &&
+        (STREQ(rule->args[i], "-t") || STREQ(rule->args[i], "--table"))) {
+        *table = rule->args[i + 1];
+        i += 2;
+    }
+
+    if (i >= rule->argsLen ||
+        !virStringListHasString(commands, rule->args[i]))
+        return false;
+    *start = i;
+
+    for (; i < rule->argsLen; i++) {
+        if (!*rule->args[i] ||
+            strpbrk(rule->args[i], "\"'\\\n") ||
+            STREQ(rule->args[i], "-t") ||
+            STREQ(rule->args[i], "--table"))
+            return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Apply all the @nrules rules of the same layer at once by feeding
+ * them to iptables-restore/ip6tables-restore. Each table is committed
+ * atomically, so a failure leaves the table untouched and the usual
+ * rollback of the group takes care of the rest.
+ */
+static int
+virFirewallApplyRulesBatch(virFirewallRulePtr *rules,
+                           size_t nrules)
+{
+    virFirewallLayer layer = rules[0]->layer;
+    const char *bin = virFirewallLayerRestoreCommand(layer);
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virCommandPtr cmd = NULL;
+    const char *curTable = NULL;
+    const char *table;
+    char *input = NULL;
+    char *error = NULL;
+    size_t start;
+    size_t i, j;
+    int status;
+    int ret = -1;
+
+    for (i = 0; i < nrules; i++) {
+        ignore_value(virFirewallRuleGetBatchInfo(rules[i], false,
+                                                 &table, &start));
+
+        if (!curTable || STRNEQ(curTable, table)) {
+            if (curTable)
+                virBufferAddLit(&buf, "COMMIT\n");
+            virBufferAsprintf(&buf, "*%s\n", table);
+            curTable = table;
+        }
+
+        for (j = start; j < rules[i]->argsLen; j++) {
+            const char *arg = rules[i]->args[j];
+
+            if (j > start)
+                virBufferAddChar(&buf, ' ');
+            if (strpbrk(arg, " \t"))
+                virBufferAsprintf(&buf, "\"%s\"", arg);
+            else
+                virBufferAdd(&buf, arg, -1);
+        }
+        virBufferAddChar(&buf, '\n');
+    }
+    virBufferAddLit(&buf, "COMMIT\n");
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+    input = virBufferContentAndReset(&buf);
+
+    VIR_INFO("Applying %zu rules with %s", nrules, bin);
+    VIR_DEBUG("Rules: '%s'", input);
+
+    cmd = virCommandNewArgList(bin, NULL);
+    if ((layer == VIR_FIREWALL_LAYER_IPV4 && iptablesRestoreUseLock) ||
+        (layer == VIR_FIREWALL_LAYER_IPV6 && ip6tablesRestoreUseLock))
+        virCommandAddArg(cmd, "-w");
+    virCommandAddArg(cmd, "--noflush");
+    virCommandSetInputBuffer(cmd, input);
+    virCommandSetErrorBuffer(cmd, &error);
+
+    if (virCommandRun(cmd, &status) < 0)
+        goto cleanup;
+
+    if (status != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Failed to apply firewall rules %s: %s"),
+                       input, NULLSTR(error));
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(input);
+    VIR_FREE(error);
+    virCommandFree(cmd);
+    return ret;
+}
+
+
 static int
 virFirewallApplyGroup(virFirewallPtr firewall,
                       size_t idx)
 {
     virFirewallGroupPtr group = firewall->groups[idx];
     bool ignoreErrors = (group->actionFlags & VIR_FIREWALL_TRANSACTION_IGNORE_ERRORS);
-    size_t i;
+    const char *table;
+    size_t start;
+    size_t i, j;
 
     VIR_INFO("Starting transaction for firewall=%p group=%p flags=%x",
              firewall, group, group->actionFlags);
     firewall->currentGroup = idx;
     group->addingRollback = false;
     for (i = 0; i < group->naction; i++) {
+        /* Runs of consecutive rules of the same layer are applied by a
+         * single restore command, the rest one by one in order */
+        if (currentBackend == VIR_FIREWALL_BACKEND_BATCH &&
+            virFirewallRuleGetBatchInfo(group->action[i], ignoreErrors,
+                                        &table, &start)) {
+            for (j = i + 1; j < group->naction; j++) {
+                if (group->action[j]->layer != group->action[i]->layer ||
+                    !virFirewallRuleGetBatchInfo(group->action[j],
+                                                 ignoreErrors,
+                                                 &table, &start))
+                    break;
+            }
+
+            if (j - i > 1) {
+                if (virFirewallApplyRulesBatch(group->action + i, j - i) < 0)
+                    return -1;
+                i = j - 1;
+                continue;
+            }
+        }
+
         if (virFirewallApplyRule(firewall,
                                  group->action[i],
                                  ignoreErrors) < 0)
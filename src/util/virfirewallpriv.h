@@ -36,6 +36,8 @@ typedef enum {
     VIR_FIREWALL_BACKEND_AUTOMATIC,
     VIR_FIREWALL_BACKEND_DIRECT,
     VIR_FIREWALL_BACKEND_FIREWALLD,
+    VIR_FIREWALL_BACKEND_BATCH, /* direct, using *tables-restore
+                                   where possible */
 
     VIR_FIREWALL_BACKEND_LAST,
 } virFirewallBackend;
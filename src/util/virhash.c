@@ -1,5 +1,5 @@
 /*
- * virhash.c: chained hash tables
+ * virhash.c: open addressing hash tables
  *
  * Reference: Your favorite introductory book on algorithms
  *
@@ -32,12 +32,28 @@
 #include "virrandom.h"
 #include "virstring.h"
 #include "virobject.h"
+#include "virthread.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
 VIR_LOG_INIT("util.hash");
 
-#define MAX_HASH_LEN 8
+/* Default and minimal number of slots, which is always a power of two */
+#define VIR_HASH_DEFAULT_SIZE 32
+#define VIR_HASH_MIN_SIZE 8
+
+/* The table is rehashed before more than 7/8 of its slots are used,
+ * deleted ones included, so that probing always ends at an empty slot */
+#define VIR_HASH_MAX_USED(size) ((size) - (size) / 8)
+
+/* Each slot has a control byte that is either one of these or, for
+ * slots holding an entry, the top seven bits of the hash code of its key.
+ * Probing compares these bytes first and looks at an entry only when
+ * they match, which keeps the probes within a few cache lines. */
+#define VIR_HASH_EMPTY 0x80
+#define VIR_HASH_DELETED 0xfe
+#define VIR_HASH_TAG(code) ((uint8_t) ((code) >> 25))
+#define VIR_HASH_IS_FULL(ctrl) (!((ctrl) & 0x80))
 
 /* #define DEBUG_GROW */
 
@@ -48,24 +64,26 @@ VIR_LOG_INIT("util.hash");
     } while (0)
 
 /*
- * A single entry in the hash table
+ * A single entry in the hash table, stored in its slot
  */
 typedef struct _virHashEntry virHashEntry;
 typedef virHashEntry *virHashEntryPtr;
 struct _virHashEntry {
-    struct _virHashEntry *next;
     void *name;
     void *payload;
+    uint32_t code;
 };
 
 /*
- * The entire hash table
+ * The entire hash table, using linear probing
  */
 struct _virHashTable {
-    virHashEntryPtr *table;
+    uint8_t *ctrl;
+    virHashEntryPtr table;
     uint32_t seed;
     size_t size;
     size_t nbElems;
+    size_t nbDeleted;
     /* True iff we are iterating over hash entries. */
     bool iterating;
     /* Pointer to the current entry during iteration. */
@@ -77,17 +95,32 @@ struct _virHashTable {
     virHashKeyFree keyFree;
 };
 
-struct _virHashAtomic {
-    virObjectLockable parent;
+/* Number of independently locked parts of a virHashAtomic, which is
+ * a power of two. Threads working with keys in different stripes don't
+ * wait for each other. */
+#define VIR_HASH_ATOMIC_STRIPES 16
+
+typedef struct _virHashAtomicStripe virHashAtomicStripe;
+typedef virHashAtomicStripe *virHashAtomicStripePtr;
+struct _virHashAtomicStripe {
+    virMutex lock;
     virHashTablePtr hash;
 };
 
+struct _virHashAtomic {
+    virObject parent;
+    uint32_t seed;
+    virHashDataFree dataFree;
+    size_t nstripes;    /* number of initialized stripes */
+    virHashAtomicStripe stripes[VIR_HASH_ATOMIC_STRIPES];
+};
+
 static virClassPtr virHashAtomicClass;
 static void virHashAtomicDispose(void *obj);
 
 static int virHashAtomicOnceInit(void)
 {
-    virHashAtomicClass = virClassNew(virClassForObjectLockable(),
+    virHashAtomicClass = virClassNew(virClassForObject(),
                                      "virHashAtomic",
                                      sizeof(virHashAtomic),
                                      virHashAtomicDispose);
@@ -129,11 +162,88 @@ virHashValueFree(void *value, const void *name ATTRIBUTE_UNUSED)
 }
 
 
-static size_t
+static uint32_t
 virHashComputeKey(const virHashTable *table, const void *name)
 {
-    uint32_t value = table->keyCode(name, table->seed);
-    return value % table->size;
+    return table->keyCode(name, table->seed);
+}
+
+
+static int
+virHashAllocSlots(virHashTablePtr table, size_t size)
+{
+    if (VIR_ALLOC_N(table->ctrl, size) < 0)
+        return -1;
+
+    if (VIR_ALLOC_N(table->table, size) < 0) {
+        VIR_FREE(table->ctrl);
+        return -1;
+    }
+
+    memset(table->ctrl, VIR_HASH_EMPTY, size);
+    table->size = size;
+    return 0;
+}
+
+
+/* Find the slot of @name, NULL if it is not in @table */
+static virHashEntryPtr
+virHashFindEntry(const virHashTable *table, const void *name, uint32_t code)
+{
+    size_t mask = table->size - 1;
+    size_t i = code & mask;
+    uint8_t tag = VIR_HASH_TAG(code);
+
+    while (table->ctrl[i] != VIR_HASH_EMPTY) {
+        virHashEntryPtr entry = &table->table[i];
+
+        if (table->ctrl[i] == tag && entry->code == code &&
+            table->keyEqual(entry->name, name))
+            return entry;
+
+        i = (i + 1) & mask;
+    }
+
+    return NULL;
+}
+
+
+/* Find the first slot a new entry with @code can be stored in */
+static size_t
+virHashFindFree(const virHashTable *table, uint32_t code)
+{
+    size_t mask = table->size - 1;
+    size_t i = code & mask;
+
+    while (VIR_HASH_IS_FULL(table->ctrl[i]))
+        i = (i + 1) & mask;
+
+    return i;
+}
+
+
+static void
+virHashClearSlot(virHashTablePtr table, size_t i)
+{
+    /* Nothing probes past an empty slot, so the slot doesn't have to
+     * be kept as deleted if the next one is empty */
+    if (table->ctrl[(i + 1) & (table->size - 1)] == VIR_HASH_EMPTY) {
+        table->ctrl[i] = VIR_HASH_EMPTY;
+    } else {
+        table->ctrl[i] = VIR_HASH_DELETED;
+        table->nbDeleted++;
+    }
+    table->nbElems--;
+}
+
+
+static void
+virHashFreeEntry(virHashTablePtr table, virHashEntryPtr entry)
+{
+    if (table->dataFree)
+        table->dataFree(entry->payload, entry->name);
+    if (table->keyFree)
+        table->keyFree(entry->name);
 }
 
 /**
@@ -158,14 +268,18 @@ virHashTablePtr virHashCreateFull(ssize_t size,
 {
     virHashTablePtr table = NULL;
 
+    size_t slots = VIR_HASH_MIN_SIZE;
+
     if (size <= 0)
-        size = 256;
+        size = VIR_HASH_DEFAULT_SIZE;
+
+    while (slots < size)
+        slots <<= 1;
 
     if (VIR_ALLOC(table) < 0)
         return NULL;
 
     table->seed = virRandomBits(32);
-    table->size = size;
     table->nbElems = 0;
     table->dataFree = dataFree;
     table->keyCode = keyCode;
@@ -173,7 +287,7 @@ virHashTablePtr virHashCreateFull(ssize_t size,
     table->keyCopy = keyCopy;
     table->keyFree = keyFree;
 
-    if (VIR_ALLOC_N(table->table, size) < 0) {
+    if (virHashAllocSlots(table, slots) < 0) {
         VIR_FREE(table);
         return NULL;
     }
@@ -211,14 +325,34 @@ virHashAtomicNew(ssize_t size,
     if (virHashAtomicInitialize() < 0)
         return NULL;
 
-    if (!(hash = virObjectLockableNew(virHashAtomicClass)))
+    if (!(hash = virObjectNew(virHashAtomicClass)))
         return NULL;
 
-    if (!(hash->hash = virHashCreate(size, dataFree))) {
-        virObjectUnref(hash);
-        return NULL;
+    hash->seed = virRandomBits(32);
+    hash->dataFree = dataFree;
+
+    if (size > 0)
+        size = (size + VIR_HASH_ATOMIC_STRIPES - 1) / VIR_HASH_ATOMIC_STRIPES;
+
+    for (; hash->nstripes < VIR_HASH_ATOMIC_STRIPES; hash->nstripes++) {
+        virHashAtomicStripePtr stripe = &hash->stripes[hash->nstripes];
+
+        if (virMutexInit(&stripe->lock) < 0) {
+            virReportSystemError(errno, "%s", _("Unable to init mutex"));
+            goto error;
+        }
+
+        if (!(stripe->hash = virHashCreate(size, dataFree))) {
+            virMutexDestroy(&stripe->lock);
+            goto error;
+        }
     }
+
     return hash;
+
+ error:
+    virObjectUnref(hash);
+    return NULL;
 }
 
 
@@ -226,69 +360,71 @@ static void
 virHashAtomicDispose(void *obj)
 {
     virHashAtomicPtr hash = obj;
+    size_t i;
 
-    virHashFree(hash->hash);
+    for (i = 0; i < hash->nstripes; i++) {
+        virHashFree(hash->stripes[i].hash);
+        virMutexDestroy(&hash->stripes[i].lock);
+    }
+}
+
+
+/* Lock the stripe of @table holding @name */
+static virHashAtomicStripePtr
+virHashAtomicLockStripe(virHashAtomicPtr table,
+                        const void *name)
+{
+    virHashAtomicStripePtr stripe;
+
+    stripe = &table->stripes[virHashStrCode(name, table->seed) &
+                             (VIR_HASH_ATOMIC_STRIPES - 1)];
+    virMutexLock(&stripe->lock);
+    return stripe;
 }
 
 
 /**
  * virHashGrow:
  * @table: the hash table
- * @size: the new size of the hash table
+ * @size: the new number of slots of the hash table
  *
- * resize the hash table
+ * Move all entries to a new array of slots, dropping the deleted ones.
  *
  * Returns 0 in case of success, -1 in case of failure
  */
 static int
 virHashGrow(virHashTablePtr table, size_t size)
 {
-    size_t oldsize, i;
-    virHashEntryPtr *oldtable;
-
-#ifdef DEBUG_GROW
-    size_t nbElem = 0;
-#endif
-
-    if (table == NULL)
-        return -1;
-    if (size < 8)
-        return -1;
-    if (size > 8 * 2048)
-        return -1;
-
-    oldsize = table->size;
-    oldtable = table->table;
-    if (oldtable == NULL)
-        return -1;
+    size_t oldsize = table->size;
+    uint8_t *oldctrl = table->ctrl;
+    virHashEntryPtr oldtable = table->table;
+    size_t i;
 
-    if (VIR_ALLOC_N(table->table, size) < 0) {
+    if (virHashAllocSlots(table, size) < 0) {
+        table->ctrl = oldctrl;
         table->table = oldtable;
+        table->size = oldsize;
         return -1;
     }
-    table->size = size;
 
     for (i = 0; i < oldsize; i++) {
-        virHashEntryPtr iter = oldtable[i];
-        while (iter) {
-            virHashEntryPtr next = iter->next;
-            size_t key = virHashComputeKey(table, iter->name);
+        size_t slot;
 
-            iter->next = table->table[key];
-            table->table[key] = iter;
+        if (!VIR_HASH_IS_FULL(oldctrl[i]))
+            continue;
 
-#ifdef DEBUG_GROW
-            nbElem++;
-#endif
-            iter = next;
-        }
+        slot = virHashFindFree(table, oldtable[i].code);
+        table->ctrl[slot] = oldctrl[i];
+        table->table[slot] = oldtable[i];
     }
+    table->nbDeleted = 0;
 
+    VIR_FREE(oldctrl);
     VIR_FREE(oldtable);
 
 #ifdef DEBUG_GROW
-    VIR_DEBUG("virHashGrow : from %d to %d, %ld elems", oldsize,
-              size, nbElem);
+    VIR_DEBUG("virHashGrow : from %zu to %zu, %zu elems", oldsize,
+              size, table->nbElems);
 #endif
 
     return 0;
@@ -310,19 +446,11 @@ virHashFree(virHashTablePtr table)
         return;
 
     for (i = 0; i < table->size; i++) {
-        virHashEntryPtr iter = table->table[i];
-        while (iter) {
-            virHashEntryPtr next = iter->next;
-
-            if (table->dataFree)
-                table->dataFree(iter->payload, iter->name);
-            if (table->keyFree)
-                table->keyFree(iter->name);
-            VIR_FREE(iter);
-            iter = next;
-        }
+        if (VIR_HASH_IS_FULL(table->ctrl[i]))
+            virHashFreeEntry(table, &table->table[i]);
     }
 
+    VIR_FREE(table->ctrl);
     VIR_FREE(table->table);
     VIR_FREE(table);
 }
@@ -332,7 +460,8 @@ virHashAddOrUpdateEntry(virHashTablePtr table, const void *name,
                         void *userdata,
                         bool is_update)
 {
-    size_t key, len = 0;
+    uint32_t code;
+    size_t slot;
     virHashEntryPtr entry;
     void *new_name;
 
@@ -342,40 +471,54 @@ virHashAddOrUpdateEntry(virHashTablePtr table, const void *name,
     if (table->iterating)
         virHashIterationError(-1);
 
-    key = virHashComputeKey(table, name);
+    code = virHashComputeKey(table, name);
 
     /* Check for duplicate entry */
-    for (entry = table->table[key]; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name)) {
-            if (is_update) {
-                if (table->dataFree)
-                    table->dataFree(entry->payload, entry->name);
-                entry->payload = userdata;
-                return 0;
-            } else {
-                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                               _("Duplicate key"));
-                return -1;
-            }
+    if ((entry = virHashFindEntry(table, name, code))) {
+        if (is_update) {
+            if (table->dataFree)
+                table->dataFree(entry->payload, entry->name);
+            entry->payload = userdata;
+            return 0;
+        } else {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Duplicate key"));
+            return -1;
         }
-        len++;
     }
 
-    if (VIR_ALLOC(entry) < 0 || !(new_name = table->keyCopy(name))) {
-        VIR_FREE(entry);
-        return -1;
+    slot = virHashFindFree(table, code);
+
+    /* Using up an empty slot might leave too few of them, in which case
+     * the table either grows or, if it is mostly deleted slots which are
+     * used up, gets rid of them */
+    if (table->ctrl[slot] == VIR_HASH_EMPTY &&
+        table->nbElems + table->nbDeleted + 1 > VIR_HASH_MAX_USED(table->size)) {
+        size_t size = table->size;
+
+        if (table->nbElems + 1 > size / 2)
+            size *= 2;
+
+        if (virHashGrow(table, size) < 0)
+            return -1;
+
+        slot = virHashFindFree(table, code);
     }
 
+    if (!(new_name = table->keyCopy(name)))
+        return -1;
+
+    if (table->ctrl[slot] == VIR_HASH_DELETED)
+        table->nbDeleted--;
+
+    table->ctrl[slot] = VIR_HASH_TAG(code);
+    entry = &table->table[slot];
     entry->name = new_name;
     entry->payload = userdata;
-    entry->next = table->table[key];
-    table->table[key] = entry;
+    entry->code = code;
 
     table->nbElems++;
 
-    if (len > MAX_HASH_LEN)
-        virHashGrow(table, MAX_HASH_LEN * table->size);
-
     return 0;
 }
 
@@ -420,16 +563,70 @@ virHashAtomicUpdate(virHashAtomicPtr table,
                     const void *name,
                     void *userdata)
 {
+    virHashAtomicStripePtr stripe;
     int ret;
 
-    virObjectLock(table);
-    ret = virHashAddOrUpdateEntry(table->hash, name, userdata, true);
-    virObjectUnlock(table);
+    stripe = virHashAtomicLockStripe(table, name);
+    ret = virHashAddOrUpdateEntry(stripe->hash, name, userdata, true);
+    virMutexUnlock(&stripe->lock);
 
     return ret;
 }
 
 
+/**
+ * virHashAtomicModify:
+ * @table: the hash table
+ * @name: the name of the userdata
+ * @modify: callback to change the userdata
+ * @opaque: opaque data to pass to @modify
+ *
+ * Call @modify with a pointer to the userdata of @name, NULL if there
+ * is none, with no other thread accessing @name meanwhile. The userdata
+ * @modify leaves in the pointer replaces the one @name had before, which
+ * is freed with the function provided at creation time: setting it to
+ * NULL removes @name from the hash @table, setting it for a new @name
+ * adds it. The pointer is not looked at if @modify fails.
+ *
+ * Looking up an entry and changing it in one go this way is atomic,
+ * while any number of other threads work on other stripes of @table.
+ *
+ * Returns 0 on success, -1 if @modify or changing @table failed.
+ */
+int
+virHashAtomicModify(virHashAtomicPtr table,
+                    const void *name,
+                    virHashAtomicModifier modify,
+                    void *opaque)
+{
+    virHashAtomicStripePtr stripe;
+    void *payload;
+    void *old;
+    int ret = -1;
+
+    stripe = virHashAtomicLockStripe(table, name);
+
+    old = payload = virHashLookup(stripe->hash, name);
+
+    if (modify(&payload, name, opaque) < 0)
+        goto cleanup;
+
+    if (payload == old) {
+        ret = 0;
+    } else if (!payload) {
+        ret = virHashRemoveEntry(stripe->hash, name);
+    } else if ((ret = virHashUpdateEntry(stripe->hash, name, payload)) < 0) {
+        /* the table owns the new userdata either way */
+        if (table->dataFree)
+            table->dataFree(payload, name);
+    }
+
+ cleanup:
+    virMutexUnlock(&stripe->lock);
+    return ret;
+}
+
+
 /**
  * virHashLookup:
  * @table: the hash table
@@ -442,18 +639,16 @@ virHashAtomicUpdate(virHashAtomicPtr table,
 void *
 virHashLookup(const virHashTable *table, const void *name)
 {
-    size_t key;
     virHashEntryPtr entry;
 
     if (!table || !name)
         return NULL;
 
-    key = virHashComputeKey(table, name);
-    for (entry = table->table[key]; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name))
-            return entry->payload;
-    }
-    return NULL;
+    if (!(entry = virHashFindEntry(table, name,
+                                   virHashComputeKey(table, name))))
+        return NULL;
+
+    return entry->payload;
 }
 
 
@@ -483,11 +678,12 @@ void *
 virHashAtomicSteal(virHashAtomicPtr table,
                    const void *name)
 {
+    virHashAtomicStripePtr stripe;
     void *data;
 
-    virObjectLock(table);
-    data = virHashSteal(table->hash, name);
-    virObjectUnlock(table);
+    stripe = virHashAtomicLockStripe(table, name);
+    data = virHashSteal(stripe->hash, name);
+    virMutexUnlock(&stripe->lock);
 
     return data;
 }
@@ -514,7 +710,7 @@ virHashSize(const virHashTable *table)
  * virHashTableSize:
  * @table: the hash table
  *
- * Query the size of the hash @table, i.e., number of buckets in the table.
+ * Query the size of the hash @table, i.e., number of slots in the table.
  *
  * Returns the number of keys in the hash table or
  * -1 in case of error
@@ -528,6 +724,25 @@ virHashTableSize(const virHashTable *table)
 }
 
 
+/**
+ * virHashTableMemory:
+ * @table: the hash table
+ *
+ * Query how much memory the hash @table itself uses, not counting the
+ * keys and the userdata.
+ *
+ * Returns the size in bytes
+ */
+size_t
+virHashTableMemory(const virHashTable *table)
+{
+    if (table == NULL)
+        return 0;
+    return sizeof(*table) +
+        table->size * (sizeof(*table->ctrl) + sizeof(*table->table));
+}
+
+
 /**
  * virHashRemoveEntry:
  * @table: the hash table
@@ -543,30 +758,22 @@ int
 virHashRemoveEntry(virHashTablePtr table, const void *name)
 {
     virHashEntryPtr entry;
-    virHashEntryPtr *nextptr;
 
     if (table == NULL || name == NULL)
         return -1;
 
-    nextptr = table->table + virHashComputeKey(table, name);
-    for (entry = *nextptr; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name)) {
-            if (table->iterating && table->current != entry)
-                virHashIterationError(-1);
+    if (!(entry = virHashFindEntry(table, name,
+                                   virHashComputeKey(table, name))))
+        return -1;
 
-            if (table->dataFree)
-                table->dataFree(entry->payload, entry->name);
-            if (table->keyFree)
-                table->keyFree(entry->name);
-            *nextptr = entry->next;
-            VIR_FREE(entry);
-            table->nbElems--;
-            return 0;
-        }
-        nextptr = &entry->next;
-    }
+    if (table->iterating && table->current != entry)
+        virHashIterationError(-1);
 
-    return -1;
+    /* Entries never move while the table is iterated over, as no entry
+     * can be added, so the iteration just carries on with the next slot */
+    virHashFreeEntry(table, entry);
+    virHashClearSlot(table, entry - table->table);
+    return 0;
 }
 
 
@@ -599,18 +806,17 @@ virHashForEach(virHashTablePtr table, virHashIterator iter, void *data)
     table->iterating = true;
     table->current = NULL;
     for (i = 0; i < table->size; i++) {
-        virHashEntryPtr entry = table->table[i];
-        while (entry) {
-            virHashEntryPtr next = entry->next;
-            table->current = entry;
-            ret = iter(entry->payload, entry->name, data);
-            table->current = NULL;
+        virHashEntryPtr entry = &table->table[i];
 
-            if (ret < 0)
-                goto cleanup;
+        if (!VIR_HASH_IS_FULL(table->ctrl[i]))
+            continue;
 
-            entry = next;
-        }
+        table->current = entry;
+        ret = iter(entry->payload, entry->name, data);
+        table->current = NULL;
+
+        if (ret < 0)
+            goto cleanup;
     }
 
     ret = 0;
@@ -620,6 +826,40 @@ virHashForEach(virHashTablePtr table, virHashIterator iter, void *data)
 }
 
 
+/**
+ * virHashForEachShared
+ * @table: the hash table to process
+ * @iter: callback to process each element
+ * @data: opaque data to pass to the iterator
+ *
+ * Like virHashForEach, but the iteration is not recorded in @table,
+ * which allows several threads to iterate concurrently while holding
+ * a shared lock. The callback must not modify the hash table.
+ *
+ * Returns 0 on success or -1 on failure.
+ */
+int
+virHashForEachShared(const virHashTable *table,
+                     virHashIterator iter,
+                     void *data)
+{
+    size_t i;
+
+    if (table == NULL || iter == NULL)
+        return -1;
+
+    for (i = 0; i < table->size; i++) {
+        virHashEntryPtr entry = &table->table[i];
+
+        if (VIR_HASH_IS_FULL(table->ctrl[i]) &&
+            iter(entry->payload, entry->name, data) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
 /**
  * virHashRemoveSet
  * @table: the hash table to process
@@ -649,23 +889,15 @@ virHashRemoveSet(virHashTablePtr table,
     table->iterating = true;
     table->current = NULL;
     for (i = 0; i < table->size; i++) {
-        virHashEntryPtr *nextptr = table->table + i;
-
-        while (*nextptr) {
-            virHashEntryPtr entry = *nextptr;
-            if (!iter(entry->payload, entry->name, data)) {
-                nextptr = &entry->next;
-            } else {
-                count++;
-                if (table->dataFree)
-                    table->dataFree(entry->payload, entry->name);
-                if (table->keyFree)
-                    table->keyFree(entry->name);
-                *nextptr = entry->next;
-                VIR_FREE(entry);
-                table->nbElems--;
-            }
-        }
+        virHashEntryPtr entry = &table->table[i];
+
+        if (!VIR_HASH_IS_FULL(table->ctrl[i]) ||
+            !iter(entry->payload, entry->name, data))
+            continue;
+
+        count++;
+        virHashFreeEntry(table, entry);
+        virHashClearSlot(table, i);
     }
     table->iterating = false;
 
@@ -726,12 +958,12 @@ void *virHashSearch(const virHashTable *ctable,
     table->iterating = true;
     table->current = NULL;
     for (i = 0; i < table->size; i++) {
-        virHashEntryPtr entry;
-        for (entry = table->table[i]; entry; entry = entry->next) {
-            if (iter(entry->payload, entry->name, data)) {
-                table->iterating = false;
-                return entry->payload;
-            }
+        virHashEntryPtr entry = &table->table[i];
+
+        if (VIR_HASH_IS_FULL(table->ctrl[i]) &&
+            iter(entry->payload, entry->name, data)) {
+            table->iterating = false;
+            return entry->payload;
         }
     }
     table->iterating = false;
@@ -100,6 +100,19 @@ typedef void *(*virHashKeyCopy)(const void *name);
  * key @name
  */
 typedef void (*virHashKeyFree)(void *name);
+/**
+ * virHashAtomicModifier:
+ * @payload: the data in the hash, NULL if there is none
+ * @name: the hash key
+ * @opaque: user supplied data blob
+ *
+ * Callback to change or replace the data of @name in a virHashAtomic,
+ * see virHashAtomicModify
+ *
+ * Returns 0 on success, -1 on error
+ */
+typedef int (*virHashAtomicModifier)(void **payload, const void *name,
+                                     void *opaque);
 
 /*
  * Constructor and destructor.
@@ -117,6 +130,7 @@ virHashTablePtr virHashCreateFull(ssize_t size,
 void virHashFree(virHashTablePtr table);
 ssize_t virHashSize(const virHashTable *table);
 ssize_t virHashTableSize(const virHashTable *table);
+size_t virHashTableMemory(const virHashTable *table);
 
 /*
  * Add a new entry to the hash table.
@@ -129,6 +143,10 @@ int virHashUpdateEntry(virHashTablePtr table,
 int virHashAtomicUpdate(virHashAtomicPtr table,
                         const void *name,
                         void *userdata);
+int virHashAtomicModify(virHashAtomicPtr table,
+                        const void *name,
+                        virHashAtomicModifier modify,
+                        void *opaque);
 
 /*
  * Remove an entry from the hash table.
@@ -192,6 +210,9 @@ bool virHashEqual(const virHashTable *table1,
  * Iterators
  */
 int virHashForEach(virHashTablePtr table, virHashIterator iter, void *data);
+int virHashForEachShared(const virHashTable *table,
+                         virHashIterator iter,
+                         void *data);
 ssize_t virHashRemoveSet(virHashTablePtr table, virHashSearcher iter, const void *data);
 void *virHashSearch(const virHashTable *table, virHashSearcher iter,
                     const void *data);
@@ -38,6 +38,11 @@
 #include "virfile.h"
 #include "configmake.h"
 #include "vircommand.h"
+#include "virhash.h"
+#include "virstring.h"
+#include "virthread.h"
+#include "virthreadpool.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_HOOK
 
@@ -48,7 +53,6 @@ VIR_LOG_INIT("util.hook");
 VIR_ENUM_DECL(virHookDriver)
 VIR_ENUM_DECL(virHookDaemonOp)
 VIR_ENUM_DECL(virHookSubop)
-VIR_ENUM_DECL(virHookQemuOp)
 VIR_ENUM_DECL(virHookLxcOp)
 VIR_ENUM_DECL(virHookNetworkOp)
 VIR_ENUM_DECL(virHookLibxlOp)
@@ -204,44 +208,27 @@ virHookPresent(int driver)
     return 1;
 }
 
-/**
- * virHookCall:
- * @driver: the driver number (from virHookDriver enum)
- * @id: an id for the object '-' if non available for example on daemon hooks
- * @op: the operation on the id e.g. VIR_HOOK_QEMU_OP_START
- * @sub_op: a sub_operation, currently unused
- * @extra: optional string information
- * @input: extra input given to the script on stdin
- * @output: optional address of variable to store malloced result buffer
- *
- * Implement a hook call, where the external script for the driver is
- * called with the given information. This is a synchronous call, we wait for
- * execution completion. If @output is non-NULL, *output is guaranteed to be
- * allocated after successful virHookCall, and is best-effort allocated after
- * failed virHookCall; the caller is responsible for freeing *output.
+/*
+ * Builds the command running the hook script for the given parameters.
  *
- * Returns: 0 if the execution succeeded, 1 if the script was not found or
- *          invalid parameters, and -1 if script returned an error
+ * Returns 0 and sets @cmd if the hook should be run, 1 if the script was
+ * not found or invalid parameters, and -1 in case of error
  */
-int
-virHookCall(int driver,
-            const char *id,
-            int op,
-            int sub_op,
-            const char *extra,
-            const char *input,
-            char **output)
+static int
+virHookPrepare(int driver,
+               const char *id,
+               int op,
+               int sub_op,
+               const char *extra,
+               const char *input,
+               char **output,
+               virCommandPtr *cmd)
 {
-    int ret;
     char *path;
-    virCommandPtr cmd;
     const char *drvstr;
     const char *opstr;
     const char *subopstr;
 
-    if (output)
-        *output = NULL;
-
     if ((driver < VIR_HOOK_DRIVER_DAEMON) ||
         (driver >= VIR_HOOK_DRIVER_LAST))
         return 1;
@@ -300,14 +287,329 @@ virHookCall(int driver,
     VIR_DEBUG("Calling hook opstr=%s subopstr=%s extra=%s",
               opstr, subopstr, extra);
 
-    cmd = virCommandNewArgList(path, id, opstr, subopstr, extra, NULL);
+    *cmd = virCommandNewArgList(path, id, opstr, subopstr, extra, NULL);
 
-    virCommandAddEnvPassCommon(cmd);
+    virCommandAddEnvPassCommon(*cmd);
 
     if (input)
-        virCommandSetInputBuffer(cmd, input);
+        virCommandSetInputBuffer(*cmd, input);
     if (output)
-        virCommandSetOutputBuffer(cmd, output);
+        virCommandSetOutputBuffer(*cmd, output);
+
+    VIR_FREE(path);
+
+    return 0;
+}
+
+
+/*
+ * Runs @cmd and kills it if it didn't finish within @timeout seconds,
+ * 0 means no timeout.
+ *
+ * Returns 0 if the script succeeded, -1 otherwise
+ */
+static int
+virHookRun(virCommandPtr cmd, unsigned int timeout)
+{
+#ifndef WIN32
+    pid_t pid;
+    siginfo_t info;
+    unsigned long long now;
+    unsigned long long deadline;
+    unsigned int delay = 10;
+
+    if (timeout == 0)
+        return virCommandRun(cmd, NULL);
+
+    virCommandDoAsyncIO(cmd);
+
+    if (virCommandRunAsync(cmd, &pid) < 0 ||
+        virTimeMillisNow(&deadline) < 0) {
+        virCommandAbort(cmd);
+        return -1;
+    }
+    deadline += timeout * 1000ull;
+
+    /* Poll without reaping, virCommandWait does that */
+    while (true) {
+        memset(&info, 0, sizeof(info));
+        if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) < 0 &&
+            errno != EINTR) {
+            virReportSystemError(errno, _("unable to wait for process %lld"),
+                                 (long long) pid);
+            virCommandAbort(cmd);
+            return -1;
+        }
+
+        if (info.si_pid == pid)
+            break;
+
+        if (virTimeMillisNow(&now) < 0) {
+            virCommandAbort(cmd);
+            return -1;
+        }
+
+        if (now >= deadline) {
+            virCommandAbort(cmd);
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Hook script did not finish in %u seconds"),
+                           timeout);
+            return -1;
+        }
+
+        usleep(delay * 1000);
+        if (delay < 200)
+            delay *= 2;
+    }
+
+    return virCommandWait(cmd, NULL);
+#else /* WIN32 */
+    if (timeout)
+        VIR_DEBUG("Ignoring hook timeout of %u seconds", timeout);
+
+    return virCommandRun(cmd, NULL);
+#endif /* WIN32 */
+}
+
+
+/*
+ * Asynchronous hooks are queued per driver and object, the runs of one
+ * object happen one after another in the order they were requested.
+ * Synchronous hooks of an object wait until its queue is empty, so the
+ * script sees the operations in order no matter how they were run.
+ */
+typedef struct _virHookAsyncJob virHookAsyncJob;
+typedef virHookAsyncJob *virHookAsyncJobPtr;
+struct _virHookAsyncJob {
+    char *key;
+    virCommandPtr cmd;
+    unsigned int timeout;
+    virHookAsyncCallback cb;
+    void *opaque;
+};
+
+typedef struct _virHookAsyncQueue virHookAsyncQueue;
+typedef virHookAsyncQueue *virHookAsyncQueuePtr;
+struct _virHookAsyncQueue {
+    virHookAsyncJobPtr *jobs; /* the first one is running or about to */
+    size_t njobs;
+};
+
+static virMutex virHookAsyncLock;
+static virCond virHookAsyncCond; /* signaled when a queue became empty */
+static virHashTablePtr virHookAsyncQueues;
+static virThreadPoolPtr virHookAsyncPool;
+
+static void
+virHookAsyncJobFree(virHookAsyncJobPtr job)
+{
+    if (!job)
+        return;
+
+    VIR_FREE(job->key);
+    virCommandFree(job->cmd);
+    VIR_FREE(job);
+}
+
+static void
+virHookAsyncQueueFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    virHookAsyncQueuePtr queue = payload;
+    size_t i;
+
+    for (i = 0; i < queue->njobs; i++)
+        virHookAsyncJobFree(queue->jobs[i]);
+    VIR_FREE(queue->jobs);
+    VIR_FREE(queue);
+}
+
+static int
+virHookAsyncQueuesOnceInit(void)
+{
+    if (virMutexInit(&virHookAsyncLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+
+    if (virCondInit(&virHookAsyncCond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize condition variable"));
+        return -1;
+    }
+
+    if (!(virHookAsyncQueues = virHashCreate(32, virHookAsyncQueueFree)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virHookAsyncQueues)
+
+static char *
+virHookAsyncKey(int driver, const char *id)
+{
+    char *key;
+
+    if (virAsprintf(&key, "%d:%s", driver, id) < 0)
+        return NULL;
+
+    return key;
+}
+
+static void
+virHookAsyncWorker(void *jobdata, void *opaque ATTRIBUTE_UNUSED)
+{
+    virHookAsyncJobPtr job = jobdata;
+    virHookAsyncQueuePtr queue;
+    virHookAsyncJobPtr *skipped = NULL;
+    size_t nskipped = 0;
+    unsigned long long start = 0;
+    unsigned long long end = 0;
+    size_t i;
+    int ret;
+
+    ignore_value(virTimeMillisNow(&start));
+    ret = virHookRun(job->cmd, job->timeout);
+    ignore_value(virTimeMillisNow(&end));
+
+    if (ret < 0) {
+        VIR_WARN("Asynchronous hook for %s failed: %s",
+                 job->key, virGetLastErrorMessage());
+        virResetLastError();
+    }
+
+    virMutexLock(&virHookAsyncLock);
+
+    queue = virHashLookup(virHookAsyncQueues, job->key);
+    VIR_DELETE_ELEMENT(queue->jobs, 0, queue->njobs);
+
+    if (queue->njobs &&
+        virThreadPoolSendJob(virHookAsyncPool, 0, queue->jobs[0]) < 0) {
+        /* the remaining jobs can't be run, report them as failed */
+        VIR_WARN("Unable to run the pending asynchronous hooks for %s: %s",
+                 job->key, virGetLastErrorMessage());
+        virResetLastError();
+        VIR_STEAL_PTR(skipped, queue->jobs);
+        nskipped = queue->njobs;
+        queue->njobs = 0;
+    }
+
+    if (queue->njobs == 0) {
+        virHashRemoveEntry(virHookAsyncQueues, job->key);
+        virCondBroadcast(&virHookAsyncCond);
+    }
+
+    virMutexUnlock(&virHookAsyncLock);
+
+    /* The callbacks usually lock the object, which the caller of a
+     * synchronous hook may hold while waiting for the queue to drain */
+    if (job->cb)
+        job->cb(ret, end - start, job->opaque);
+    virHookAsyncJobFree(job);
+
+    for (i = 0; i < nskipped; i++) {
+        if (skipped[i]->cb)
+            skipped[i]->cb(-1, 0, skipped[i]->opaque);
+        virHookAsyncJobFree(skipped[i]);
+    }
+    VIR_FREE(skipped);
+}
+
+/* Waits until no asynchronous hook of @driver and @id is pending */
+static void
+virHookAsyncDrain(int driver, const char *id)
+{
+    char *key;
+
+    if (!virHookAsyncPool)
+        return;
+
+    if (!(key = virHookAsyncKey(driver, id))) {
+        virResetLastError();
+        return;
+    }
+
+    virMutexLock(&virHookAsyncLock);
+    while (virHashLookup(virHookAsyncQueues, key)) {
+        VIR_DEBUG("Waiting for asynchronous hooks of %s", key);
+        if (virCondWait(&virHookAsyncCond, &virHookAsyncLock) < 0)
+            break;
+    }
+    virMutexUnlock(&virHookAsyncLock);
+
+    VIR_FREE(key);
+}
+
+
+/**
+ * virHookAsyncInitialize:
+ * @maxWorkers: how many hook scripts may run asynchronously at once
+ *
+ * Enables virHookCallAsync. Only the first successful call sets the
+ * number of workers, which is shared by all the drivers.
+ *
+ * Returns 0 on success, -1 in case of failure
+ */
+int
+virHookAsyncInitialize(size_t maxWorkers)
+{
+    int ret = 0;
+
+    if (virHookAsyncQueuesInitialize() < 0)
+        return -1;
+
+    virMutexLock(&virHookAsyncLock);
+    if (!virHookAsyncPool &&
+        !(virHookAsyncPool = virThreadPoolNew(0, maxWorkers, 0,
+                                              virHookAsyncWorker, NULL)))
+        ret = -1;
+    virMutexUnlock(&virHookAsyncLock);
+
+    return ret;
+}
+
+
+/**
+ * virHookCall:
+ * @driver: the driver number (from virHookDriver enum)
+ * @id: an id for the object '-' if non available for example on daemon hooks
+ * @op: the operation on the id e.g. VIR_HOOK_QEMU_OP_START
+ * @sub_op: a sub_operation, currently unused
+ * @extra: optional string information
+ * @input: extra input given to the script on stdin
+ * @output: optional address of variable to store malloced result buffer
+ *
+ * Implement a hook call, where the external script for the driver is
+ * called with the given information. This is a synchronous call, we wait for
+ * execution completion, and for the asynchronous calls for the same object
+ * still pending. If @output is non-NULL, *output is guaranteed to be
+ * allocated after successful virHookCall, and is best-effort allocated after
+ * failed virHookCall; the caller is responsible for freeing *output.
+ *
+ * Returns: 0 if the execution succeeded, 1 if the script was not found or
+ *          invalid parameters, and -1 if script returned an error
+ */
+int
+virHookCall(int driver,
+            const char *id,
+            int op,
+            int sub_op,
+            const char *extra,
+            const char *input,
+            char **output)
+{
+    int ret;
+    virCommandPtr cmd = NULL;
+
+    if (output)
+        *output = NULL;
+
+    if ((ret = virHookPrepare(driver, id, op, sub_op, extra, input,
+                              output, &cmd)) != 0)
+        return ret;
+
+    virHookAsyncDrain(driver, id);
 
     ret = virCommandRun(cmd, NULL);
     if (ret < 0) {
@@ -318,7 +620,109 @@ virHookCall(int driver,
 
     virCommandFree(cmd);
 
-    VIR_FREE(path);
-
     return ret;
 }
+
+
+/**
+ * virHookCallAsync:
+ * @driver: the driver number (from virHookDriver enum)
+ * @id: an id for the object '-' if non available for example on daemon hooks
+ * @op: the operation on the id e.g. VIR_HOOK_QEMU_OP_STARTED
+ * @sub_op: a sub_operation, currently unused
+ * @extra: optional string information
+ * @input: extra input given to the script on stdin
+ * @timeout: seconds after which the script is killed, 0 for no limit
+ * @cb: optional function called from a worker thread once the script ended
+ * @opaque: data for @cb
+ *
+ * Like virHookCall, but queues the script to be run by a worker thread
+ * after the earlier asynchronous calls for the same object, instead of
+ * waiting for it. Failures of the script are only logged. If the call
+ * falls back to virHookCall because virHookAsyncInitialize wasn't called,
+ * @cb is called right away.
+ *
+ * Returns: 0 if the script was queued or run, 1 if the script was not
+ *          found or invalid parameters and -1 in case of error. @cb is
+ *          only called if 0 is returned.
+ */
+int
+virHookCallAsync(int driver,
+                 const char *id,
+                 int op,
+                 int sub_op,
+                 const char *extra,
+                 const char *input,
+                 unsigned int timeout,
+                 virHookAsyncCallback cb,
+                 void *opaque)
+{
+    virHookAsyncJobPtr job = NULL;
+    virHookAsyncQueuePtr queue;
+    virCommandPtr cmd = NULL;
+    unsigned long long start = 0;
+    unsigned long long end = 0;
+    int ret;
+
+    if (!virHookAsyncPool) {
+        ignore_value(virTimeMillisNow(&start));
+        ret = virHookCall(driver, id, op, sub_op, extra, input, NULL);
+        ignore_value(virTimeMillisNow(&end));
+
+        if (ret == 1)
+            return 1;
+
+        if (cb)
+            cb(ret, end - start, opaque);
+        return 0;
+    }
+
+    if ((ret = virHookPrepare(driver, id, op, sub_op, extra, input,
+                              NULL, &cmd)) != 0)
+        return ret;
+
+    if (VIR_ALLOC(job) < 0 ||
+        !(job->key = virHookAsyncKey(driver, id))) {
+        virCommandFree(cmd);
+        VIR_FREE(job);
+        return -1;
+    }
+
+    job->cmd = cmd;
+    job->timeout = timeout;
+    job->cb = cb;
+    job->opaque = opaque;
+
+    virMutexLock(&virHookAsyncLock);
+
+    if (!(queue = virHashLookup(virHookAsyncQueues, job->key))) {
+        if (VIR_ALLOC(queue) < 0 ||
+            virHashAddEntry(virHookAsyncQueues, job->key, queue) < 0) {
+            VIR_FREE(queue);
+            goto error;
+        }
+    }
+
+    if (VIR_APPEND_ELEMENT_COPY(queue->jobs, queue->njobs, job) < 0)
+        goto error;
+
+    if (queue->njobs == 1 &&
+        virThreadPoolSendJob(virHookAsyncPool, 0, job) < 0) {
+        VIR_DELETE_ELEMENT(queue->jobs, 0, queue->njobs);
+        goto error;
+    }
+
+    VIR_DEBUG("Queued asynchronous hook for %s, %zu pending",
+              job->key, queue->njobs);
+
+    virMutexUnlock(&virHookAsyncLock);
+
+    return 0;
+
+ error:
+    if (queue && queue->njobs == 0)
+        virHashRemoveEntry(virHookAsyncQueues, job->key);
+    virMutexUnlock(&virHookAsyncLock);
+    virHookAsyncJobFree(job);
+    return -1;
+}
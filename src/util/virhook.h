@@ -25,6 +25,7 @@
 # define __VIR_HOOKS_H__
 
 # include "internal.h"
+# include "virutil.h"
 
 typedef enum {
     VIR_HOOK_DRIVER_DAEMON = 0,        /* Daemon related events */
@@ -66,6 +67,8 @@ typedef enum {
     VIR_HOOK_QEMU_OP_LAST,
 } virHookQemuOpType;
 
+VIR_ENUM_DECL(virHookQemuOp)
+
 typedef enum {
     VIR_HOOK_LXC_OP_START,            /* domain is about to start */
     VIR_HOOK_LXC_OP_STOPPED,          /* domain has stopped */
@@ -107,4 +110,17 @@ int virHookPresent(int driver);
 int virHookCall(int driver, const char *id, int op, int sub_op,
                 const char *extra, const char *input, char **output);
 
+/* @ret is 0 if the script succeeded, -1 otherwise. @duration is how
+ * long it ran in milliseconds */
+typedef void (*virHookAsyncCallback)(int ret,
+                                     unsigned long long duration,
+                                     void *opaque);
+
+int virHookAsyncInitialize(size_t maxWorkers);
+
+int virHookCallAsync(int driver, const char *id, int op, int sub_op,
+                     const char *extra, const char *input,
+                     unsigned int timeout,
+                     virHookAsyncCallback cb, void *opaque);
+
 #endif /* __VIR_HOOKS_H__ */
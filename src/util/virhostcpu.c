@@ -832,6 +832,73 @@ virHostCPUGetStatsLinux(FILE *procstat,
 }
 
 
+/**
+ * virHostCPUGetTimesLinux:
+ * @procstat: opened /proc/stat
+ * @times: filled with an array of CPU times indexed by CPU ID
+ * @ntimes: filled with the number of elements in @times
+ *
+ * Read the times of all CPUs in one pass over @procstat. Unlike
+ * virHostCPUGetStatsLinux(), which wants the file to be read again for
+ * every CPU, this is meant to be sampled periodically for all CPUs of
+ * the host. CPUs missing in the file (because they are offline) get
+ * zero times.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virHostCPUGetTimesLinux(FILE *procstat,
+                        virHostCPUTimePtr *times,
+                        size_t *ntimes)
+{
+    char line[1024];
+    unsigned long long usr, ni, sys, idle, iowait;
+    unsigned long long irq, softirq, steal;
+    unsigned int cpu;
+
+    *times = NULL;
+    *ntimes = 0;
+
+    while (fgets(line, sizeof(line), procstat) != NULL) {
+        virHostCPUTimePtr cputime;
+
+        /* the summary line is "cpu " and the rest are "cpuN " */
+        if (!STRPREFIX(line, "cpu") || !c_isdigit(line[3]))
+            continue;
+
+        irq = softirq = steal = 0;
+        if (sscanf(line,
+                   "cpu%u %llu %llu %llu %llu %llu" // cpu ~ iowait
+                   "%llu %llu %llu",                // irq ~ steal
+                   &cpu, &usr, &ni, &sys, &idle, &iowait,
+                   &irq, &softirq, &steal) < 5)
+            continue;
+
+        if (cpu >= *ntimes &&
+            VIR_EXPAND_N(*times, *ntimes, cpu + 1 - *ntimes) < 0)
+            goto error;
+
+        /* guest time is already accounted in the user time */
+        cputime = &(*times)[cpu];
+        cputime->busy = (usr + ni + sys + irq + softirq + steal) * TICK_TO_NSEC;
+        cputime->total = cputime->busy + (idle + iowait) * TICK_TO_NSEC;
+    }
+
+    if (!*ntimes) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("no CPU times found in " PROCSTAT_PATH));
+        goto error;
+    }
+
+    return 0;
+
+ error:
+    VIR_FREE(*times);
+    *ntimes = 0;
+    return -1;
+}
+
+
 /* Determine the number of CPUs (maximum CPU id + 1) from a file containing
  * a list of CPU ids, like the Linux sysfs cpu/present file */
 static int
@@ -1002,6 +1069,33 @@ virHostCPUGetStats(int cpuNum ATTRIBUTE_UNUSED,
 }
 
 
+int
+virHostCPUGetTimes(virHostCPUTimePtr *times,
+                   size_t *ntimes)
+{
+#ifdef __linux__
+    int ret;
+    FILE *procstat = fopen(PROCSTAT_PATH, "r");
+
+    if (!procstat) {
+        virReportSystemError(errno,
+                             _("cannot open %s"), PROCSTAT_PATH);
+        return -1;
+    }
+    ret = virHostCPUGetTimesLinux(procstat, times, ntimes);
+    VIR_FORCE_FCLOSE(procstat);
+
+    return ret;
+#else
+    *times = NULL;
+    *ntimes = 0;
+    virReportError(VIR_ERR_NO_SUPPORT, "%s",
+                   _("host CPU times not implemented on this platform"));
+    return -1;
+#endif
+}
+
+
 int
 virHostCPUGetCount(void)
 {
@@ -34,6 +34,16 @@ int virHostCPUGetStats(int cpuNum,
                        int *nparams,
                        unsigned int flags);
 
+typedef struct _virHostCPUTime virHostCPUTime;
+typedef virHostCPUTime *virHostCPUTimePtr;
+struct _virHostCPUTime {
+    unsigned long long busy;  /* nanoseconds spent not idle */
+    unsigned long long total; /* nanoseconds accounted in total */
+};
+
+int virHostCPUGetTimes(virHostCPUTimePtr *times,
+                       size_t *ntimes);
+
 bool virHostCPUHasBitmap(void);
 virBitmapPtr virHostCPUGetPresentBitmap(void);
 virBitmapPtr virHostCPUGetOnlineBitmap(void);
@@ -38,6 +38,10 @@ int virHostCPUGetStatsLinux(FILE *procstat,
                             int cpuNum,
                             virNodeCPUStatsPtr params,
                             int *nparams);
+
+int virHostCPUGetTimesLinux(FILE *procstat,
+                            virHostCPUTimePtr *times,
+                            size_t *ntimes);
 # endif
 
 #endif /* __VIR_HOSTCPU_PRIV_H__ */
@@ -40,6 +40,7 @@
 #include "virlog.h"
 #include "virutil.h"
 #include "virnetdev.h"
+#include "virthread.h"
 #include "configmake.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -54,6 +55,9 @@ static virClassPtr virHostdevManagerClass;
 static void virHostdevManagerDispose(void *obj);
 static virHostdevManagerPtr virHostdevManagerNew(void);
 
+/* Not more than this many PCI devices are detached or reset at once */
+#define VIR_HOSTDEV_PCI_WORKERS 16
+
 struct virHostdevIsPCINodeDeviceUsedData {
     virHostdevManagerPtr mgr;
     const char *domainName;
@@ -306,6 +310,273 @@ virHostdevIsVirtualFunction(virDomainHostdevDefPtr hostdev)
 }
 
 
+static int
+virHostdevIsPCIVirtualFunction(virPCIDevicePtr pci)
+{
+    char *sysfs_path = NULL;
+    int ret = -1;
+
+    if (virPCIDeviceAddressGetSysfsFile(virPCIDeviceGetAddress(pci),
+                                        &sysfs_path) < 0)
+        return ret;
+
+    ret = virPCIIsVirtualFunction(sysfs_path);
+
+    VIR_FREE(sysfs_path);
+
+    return ret;
+}
+
+
+/*
+ * Binding a device to the stub driver and resetting it takes hundreds
+ * of milliseconds, mostly spent waiting for the kernel. With guests
+ * having a dozen or more SR-IOV VFs assigned that adds up, so these
+ * steps are done by several threads at once. Devices of a job are
+ * handled one after another, jobs are handed out to threads in order.
+ *
+ * The threads only ever read the bookkeeping lists, which are locked
+ * by the caller for the whole time.
+ */
+typedef int (*virHostdevPCIJobFunc)(virHostdevManagerPtr mgr,
+                                    virPCIDevicePtr pci);
+
+struct virHostdevPCIJob {
+    virPCIDevicePtr *devs;
+    size_t ndevs;
+    size_t done;        /* how many of @devs were handled successfully */
+    virErrorPtr err;    /* why handling devs[done] failed */
+};
+
+struct virHostdevPCIWork {
+    virHostdevManagerPtr mgr;
+    virHostdevPCIJobFunc func;
+    struct virHostdevPCIJob *jobs;
+    size_t njobs;
+    size_t next;
+    virMutex lock;
+};
+
+
+static void
+virHostdevPCIJobsFree(struct virHostdevPCIJob *jobs,
+                      size_t njobs)
+{
+    size_t i;
+
+    for (i = 0; i < njobs; i++) {
+        VIR_FREE(jobs[i].devs);
+        virFreeError(jobs[i].err);
+    }
+    VIR_FREE(jobs);
+}
+
+
+static void
+virHostdevPCIWorker(void *opaque)
+{
+    struct virHostdevPCIWork *work = opaque;
+    struct virHostdevPCIJob *job;
+
+    for (;;) {
+        virMutexLock(&work->lock);
+        job = NULL;
+        if (work->next < work->njobs)
+            job = &work->jobs[work->next++];
+        virMutexUnlock(&work->lock);
+
+        if (!job)
+            break;
+
+        for (; job->done < job->ndevs; job->done++) {
+            if (work->func(work->mgr, job->devs[job->done]) < 0) {
+                /* errors are per thread, keep it for the caller */
+                job->err = virSaveLastError();
+                virResetLastError();
+                break;
+            }
+        }
+    }
+}
+
+
+/*
+ * Run @func on the devices of all @jobs, returning only once all of
+ * them were handled so that the caller can roll back from a known
+ * state. The calling thread takes part in the work, so failing to
+ * create helper threads only makes this slower.
+ *
+ * Returns 0 on success, -1 with the error of the first failed job set
+ * otherwise.
+ */
+static int
+virHostdevRunPCIJobs(virHostdevManagerPtr mgr,
+                     virHostdevPCIJobFunc func,
+                     struct virHostdevPCIJob *jobs,
+                     size_t njobs)
+{
+    struct virHostdevPCIWork work = {
+        .mgr = mgr, .func = func, .jobs = jobs, .njobs = njobs
+    };
+    virThreadPtr threads = NULL;
+    size_t nthreads = 0;
+    size_t nworkers = MIN(njobs, VIR_HOSTDEV_PCI_WORKERS);
+    size_t i;
+
+    if (virMutexInit(&work.lock) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init mutex"));
+        return -1;
+    }
+
+    if (nworkers > 1 && VIR_ALLOC_N_QUIET(threads, nworkers - 1) == 0) {
+        for (nthreads = 0; nthreads < nworkers - 1; nthreads++) {
+            if (virThreadCreate(&threads[nthreads], true,
+                                virHostdevPCIWorker, &work) < 0) {
+                virResetLastError();
+                break;
+            }
+        }
+    }
+
+    VIR_DEBUG("Running %zu jobs with %zu helper threads", njobs, nthreads);
+
+    virHostdevPCIWorker(&work);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    VIR_FREE(threads);
+    virMutexDestroy(&work.lock);
+
+    for (i = 0; i < njobs; i++) {
+        if (jobs[i].done < jobs[i].ndevs) {
+            if (jobs[i].err)
+                virSetError(jobs[i].err);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+virHostdevAddPCIJob(struct virHostdevPCIJob **jobs,
+                    size_t *njobs,
+                    virPCIDevicePtr pci)
+{
+    struct virHostdevPCIJob job = { 0 };
+
+    if (pci && VIR_APPEND_ELEMENT(job.devs, job.ndevs, pci) < 0)
+        return -1;
+
+    if (VIR_APPEND_ELEMENT(*jobs, *njobs, job) < 0) {
+        VIR_FREE(job.devs);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* Only bind to the stub driver, the device is added to the inactive
+ * list by the thread holding the lock of the list afterwards */
+static int
+virHostdevBindPCIDeviceJob(virHostdevManagerPtr mgr,
+                           virPCIDevicePtr pci)
+{
+    if (!virPCIDeviceGetManaged(pci))
+        return 0;
+
+    VIR_DEBUG("Binding managed PCI device %s to the stub driver",
+              virPCIDeviceGetName(pci));
+    return virPCIDeviceDetach(pci, mgr->activePCIHostdevs, NULL);
+}
+
+
+static int
+virHostdevResetPCIDeviceJob(virHostdevManagerPtr mgr,
+                            virPCIDevicePtr pci)
+{
+    /* We can avoid looking up the actual device here, because performing
+     * a PCI reset on a device doesn't require any information other than
+     * the address, which 'pci' already contains */
+    VIR_DEBUG("Resetting PCI device %s", virPCIDeviceGetName(pci));
+    return virPCIDeviceReset(pci, mgr->activePCIHostdevs,
+                             mgr->inactivePCIHostdevs);
+}
+
+
+/*
+ * Every device gets a job of its own, so that jobs[i] is the one for
+ * the i-th device of @pcidevs.
+ */
+static int
+virHostdevBindPCIDevices(virHostdevManagerPtr mgr,
+                         virPCIDeviceListPtr pcidevs,
+                         struct virHostdevPCIJob **jobs,
+                         size_t *njobs)
+{
+    size_t i;
+
+    *jobs = NULL;
+    *njobs = 0;
+
+    for (i = 0; i < virPCIDeviceListCount(pcidevs); i++) {
+        if (virHostdevAddPCIJob(jobs, njobs,
+                                virPCIDeviceListGet(pcidevs, i)) < 0)
+            return -1;
+    }
+
+    ignore_value(virHostdevRunPCIJobs(mgr, virHostdevBindPCIDeviceJob,
+                                      *jobs, *njobs));
+    virResetLastError();
+    return 0;
+}
+
+
+/*
+ * SR-IOV VFs are required to support Function Level Reset, which
+ * doesn't affect any other device, so each of them is reset in a job
+ * of its own. Other devices might need a reset of the whole bus they
+ * are on, so they are all reset one after another in a single job.
+ */
+static int
+virHostdevResetPCIDevices(virHostdevManagerPtr mgr,
+                          virPCIDeviceListPtr pcidevs)
+{
+    struct virHostdevPCIJob *jobs = NULL;
+    size_t njobs = 0;
+    size_t i;
+    int ret = -1;
+
+    /* the job for devices which are not VFs */
+    if (virHostdevAddPCIJob(&jobs, &njobs, NULL) < 0)
+        goto cleanup;
+
+    for (i = 0; i < virPCIDeviceListCount(pcidevs); i++) {
+        virPCIDevicePtr pci = virPCIDeviceListGet(pcidevs, i);
+        int vf;
+
+        if ((vf = virHostdevIsPCIVirtualFunction(pci)) < 0)
+            virResetLastError();
+
+        if (vf == 1) {
+            if (virHostdevAddPCIJob(&jobs, &njobs, pci) < 0)
+                goto cleanup;
+        } else if (VIR_APPEND_ELEMENT(jobs[0].devs, jobs[0].ndevs, pci) < 0) {
+            goto cleanup;
+        }
+    }
+
+    ret = virHostdevRunPCIJobs(mgr, virHostdevResetPCIDeviceJob, jobs, njobs);
+
+ cleanup:
+    virHostdevPCIJobsFree(jobs, njobs);
+    return ret;
+}
+
+
 static int
 virHostdevNetDevice(virDomainHostdevDefPtr hostdev, char **linkdev,
                     int *vf)
@@ -604,6 +875,80 @@ virHostdevRestoreNetConfig(virDomainHostdevDefPtr hostdev,
     return ret;
 }
 
+/* Detach a managed device from the host, or make sure an unmanaged
+ * one has already been taken care of. Either way the device ends up
+ * in the inactive list. */
+static int
+virHostdevDetachPCIDevice(virHostdevManagerPtr mgr,
+                          virPCIDevicePtr pci)
+{
+    if (virPCIDeviceGetManaged(pci)) {
+
+        /* We can't look up the actual device because it has not been
+         * created yet: virPCIDeviceDetach() will insert a copy of 'pci'
+         * into the list of inactive devices, and that copy will be the
+         * actual device going forward */
+        VIR_DEBUG("Detaching managed PCI device %s",
+                  virPCIDeviceGetName(pci));
+        if (virPCIDeviceDetach(pci,
+                               mgr->activePCIHostdevs,
+                               mgr->inactivePCIHostdevs) < 0)
+            return -1;
+    } else {
+        char *driverPath;
+        char *driverName;
+        int stub;
+
+        /* Unmanaged devices should already have been marked as
+         * inactive: if that's the case, we can simply move on */
+        if (virPCIDeviceListFind(mgr->inactivePCIHostdevs, pci)) {
+            VIR_DEBUG("Not detaching unmanaged PCI device %s",
+                      virPCIDeviceGetName(pci));
+            return 0;
+        }
+
+        /* If that's not the case, though, it might be because the
+         * daemon has been restarted, causing us to lose track of the
+         * device. Try and recover by marking the device as inactive
+         * if it happens to be bound to a known stub driver.
+         *
+         * FIXME Get rid of this once a proper way to keep track of
+         *       information about active / inactive device across
+         *       daemon restarts has been implemented */
+
+        if (virPCIDeviceGetDriverPathAndName(pci,
+                                             &driverPath, &driverName) < 0)
+            return -1;
+
+        stub = virPCIStubDriverTypeFromString(driverName);
+
+        VIR_FREE(driverPath);
+        VIR_FREE(driverName);
+
+        if (stub > VIR_PCI_STUB_DRIVER_NONE &&
+            stub < VIR_PCI_STUB_DRIVER_LAST) {
+
+            /* The device is bound to a known stub driver: store this
+             * information and add a copy to the inactive list */
+            virPCIDeviceSetStubDriver(pci, stub);
+
+            VIR_DEBUG("Adding PCI device %s to inactive list",
+                      virPCIDeviceGetName(pci));
+            if (virPCIDeviceListAddCopy(mgr->inactivePCIHostdevs, pci) < 0)
+                return -1;
+        } else {
+            virReportError(VIR_ERR_OPERATION_INVALID,
+                           _("Unmanaged PCI device %s must be manually "
+                           "detached from the host"),
+                           virPCIDeviceGetName(pci));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
 int
 virHostdevPreparePCIDevices(virHostdevManagerPtr mgr,
                             const char *drv_name,
@@ -614,6 +959,10 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr mgr,
                             unsigned int flags)
 {
     virPCIDeviceListPtr pcidevs = NULL;
+    struct virHostdevPCIJob *bindJobs = NULL;
+    size_t nbindJobs = 0;
+    bool detachFailed = false;
+    virErrorPtr detachErr = NULL;
     int last_processed_hostdev_vf = -1;
     size_t i;
     int ret = -1;
@@ -686,72 +1035,33 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr mgr,
     }
 
     /* Step 2: detach managed devices and make sure unmanaged devices
-     *         have already been taken care of */
+     *         have already been taken care of. Managed devices are
+     *         all bound to the stub driver at once first, which is the
+     *         slow part; the loop can't stop at the first failure then,
+     *         every device bound has to get to the inactive list for
+     *         the rollback to find it */
+    if (virHostdevBindPCIDevices(mgr, pcidevs, &bindJobs, &nbindJobs) < 0)
+        goto cleanup;
+
     for (i = 0; i < virPCIDeviceListCount(pcidevs); i++) {
         virPCIDevicePtr pci = virPCIDeviceListGet(pcidevs, i);
 
-        if (virPCIDeviceGetManaged(pci)) {
-
-            /* We can't look up the actual device because it has not been
-             * created yet: virPCIDeviceDetach() will insert a copy of 'pci'
-             * into the list of inactive devices, and that copy will be the
-             * actual device going forward */
-            VIR_DEBUG("Detaching managed PCI device %s",
-                      virPCIDeviceGetName(pci));
-            if (virPCIDeviceDetach(pci,
-                                   mgr->activePCIHostdevs,
-                                   mgr->inactivePCIHostdevs) < 0)
-                goto reattachdevs;
-        } else {
-            char *driverPath;
-            char *driverName;
-            int stub;
-
-            /* Unmanaged devices should already have been marked as
-             * inactive: if that's the case, we can simply move on */
-            if (virPCIDeviceListFind(mgr->inactivePCIHostdevs, pci)) {
-                VIR_DEBUG("Not detaching unmanaged PCI device %s",
-                          virPCIDeviceGetName(pci));
-                continue;
-            }
-
-            /* If that's not the case, though, it might be because the
-             * daemon has been restarted, causing us to lose track of the
-             * device. Try and recover by marking the device as inactive
-             * if it happens to be bound to a known stub driver.
-             *
-             * FIXME Get rid of this once a proper way to keep track of
-             *       information about active / inactive device across
-             *       daemon restarts has been implemented */
-
-            if (virPCIDeviceGetDriverPathAndName(pci,
-                                                 &driverPath, &driverName) < 0)
-                goto reattachdevs;
-
-            stub = virPCIStubDriverTypeFromString(driverName);
-
-            VIR_FREE(driverPath);
-            VIR_FREE(driverName);
-
-            if (stub > VIR_PCI_STUB_DRIVER_NONE &&
-                stub < VIR_PCI_STUB_DRIVER_LAST) {
+        if (bindJobs[i].done < bindJobs[i].ndevs) {
+            if (bindJobs[i].err)
+                virSetError(bindJobs[i].err);
+        } else if (virHostdevDetachPCIDevice(mgr, pci) == 0) {
+            continue;
+        }
 
-                /* The device is bound to a known stub driver: store this
-                 * information and add a copy to the inactive list */
-                virPCIDeviceSetStubDriver(pci, stub);
+        if (!detachFailed)
+            detachErr = virSaveLastError();
+        detachFailed = true;
+    }
 
-                VIR_DEBUG("Adding PCI device %s to inactive list",
-                          virPCIDeviceGetName(pci));
-                if (virPCIDeviceListAddCopy(mgr->inactivePCIHostdevs, pci) < 0)
-                    goto reattachdevs;
-            } else {
-                virReportError(VIR_ERR_OPERATION_INVALID,
-                               _("Unmanaged PCI device %s must be manually "
-                               "detached from the host"),
-                               virPCIDeviceGetName(pci));
-                goto reattachdevs;
-            }
-        }
+    if (detachFailed) {
+        if (detachErr)
+            virSetError(detachErr);
+        goto reattachdevs;
     }
 
     /* At this point, all devices are attached to the stub driver and have
@@ -759,17 +1069,8 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr mgr,
 
     /* Step 3: Now that all the PCI hostdevs have been detached, we
      * can safely reset them */
-    for (i = 0; i < virPCIDeviceListCount(pcidevs); i++) {
-        virPCIDevicePtr pci = virPCIDeviceListGet(pcidevs, i);
-
-        /* We can avoid looking up the actual device here, because performing
-         * a PCI reset on a device doesn't require any information other than
-         * the address, which 'pci' already contains */
-        VIR_DEBUG("Resetting PCI device %s", virPCIDeviceGetName(pci));
-        if (virPCIDeviceReset(pci, mgr->activePCIHostdevs,
-                              mgr->inactivePCIHostdevs) < 0)
-            goto reattachdevs;
-    }
+    if (virHostdevResetPCIDevices(mgr, pcidevs) < 0)
+        goto reattachdevs;
 
     /* Step 4: For SRIOV network devices, Now that we have detached the
      * the network device, set the new netdev config */
@@ -898,6 +1199,8 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr mgr,
     }
 
  cleanup:
+    virHostdevPCIJobsFree(bindJobs, nbindJobs);
+    virFreeError(detachErr);
     virObjectUnref(pcidevs);
     virObjectUnlock(mgr->activePCIHostdevs);
     virObjectUnlock(mgr->inactivePCIHostdevs);
@@ -2250,3 +2553,76 @@ virHostdevUpdateActiveDomainDevices(virHostdevManagerPtr mgr,
 
     return 0;
 }
+
+
+/**
+ * virHostdevBindPCIStubPool:
+ * @mgr: hostdev manager
+ * @addrs: PCI devices to bind
+ * @naddrs: number of @addrs
+ *
+ * Bind the PCI devices of @addrs which are not used by any domain to
+ * vfio-pci, typically idle SR-IOV VFs. Preparing them for a domain then
+ * finds them bound to the stub driver already, and as it was not that
+ * which bound them, they are not bound back to the host driver once the
+ * domain stops using them either. A device which fails to bind is just
+ * skipped.
+ */
+void
+virHostdevBindPCIStubPool(virHostdevManagerPtr mgr,
+                          virPCIDeviceAddressPtr addrs,
+                          size_t naddrs)
+{
+    virPCIDeviceListPtr pcidevs = NULL;
+    struct virHostdevPCIJob *jobs = NULL;
+    size_t njobs = 0;
+    size_t i;
+
+    virObjectLock(mgr->activePCIHostdevs);
+    virObjectLock(mgr->inactivePCIHostdevs);
+
+    if (!(pcidevs = virPCIDeviceListNew()))
+        goto cleanup;
+
+    for (i = 0; i < naddrs; i++) {
+        virPCIDevicePtr pci;
+
+        if (!(pci = virPCIDeviceNew(addrs[i].domain, addrs[i].bus,
+                                    addrs[i].slot, addrs[i].function)))
+            goto cleanup;
+
+        virPCIDeviceSetManaged(pci, true);
+        virPCIDeviceSetStubDriver(pci, VIR_PCI_STUB_DRIVER_VFIO);
+
+        if (virPCIDeviceListFind(mgr->activePCIHostdevs, pci) ||
+            virPCIDeviceListFind(mgr->inactivePCIHostdevs, pci)) {
+            VIR_DEBUG("Not binding PCI device %s in use",
+                      virPCIDeviceGetName(pci));
+            virPCIDeviceFree(pci);
+            continue;
+        }
+
+        if (virPCIDeviceListAdd(pcidevs, pci) < 0) {
+            virPCIDeviceFree(pci);
+            goto cleanup;
+        }
+    }
+
+    if (virHostdevBindPCIDevices(mgr, pcidevs, &jobs, &njobs) < 0)
+        goto cleanup;
+
+    for (i = 0; i < njobs; i++) {
+        if (jobs[i].done < jobs[i].ndevs) {
+            VIR_WARN("Failed to bind PCI device %s to vfio-pci: %s",
+                     virPCIDeviceGetName(jobs[i].devs[0]),
+                     jobs[i].err ? jobs[i].err->message : "unknown error");
+        }
+    }
+
+ cleanup:
+    virResetLastError();
+    virHostdevPCIJobsFree(jobs, njobs);
+    virObjectUnref(pcidevs);
+    virObjectUnlock(mgr->activePCIHostdevs);
+    virObjectUnlock(mgr->inactivePCIHostdevs);
+}
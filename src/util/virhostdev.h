@@ -192,6 +192,12 @@ bool
 virHostdevIsSCSIDevice(virDomainHostdevDefPtr hostdev)
     ATTRIBUTE_NONNULL(1);
 
+void
+virHostdevBindPCIStubPool(virHostdevManagerPtr mgr,
+                          virPCIDeviceAddressPtr addrs,
+                          size_t naddrs)
+    ATTRIBUTE_NONNULL(1);
+
 /* functions used by NodeDevDetach/Reattach/Reset */
 int virHostdevPCINodeDeviceDetach(virHostdevManagerPtr mgr,
                                   virPCIDevicePtr pci)
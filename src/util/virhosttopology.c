@@ -0,0 +1,228 @@
+/*
+ * virhosttopology.c: cached snapshot of the host CPU and NUMA topology
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "virhosttopology.h"
+#include "viralloc.h"
+#include "virarch.h"
+#include "virerror.h"
+#include "virhostcpu.h"
+#include "virlog.h"
+#include "virnuma.h"
+#include "virthread.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("util.hosttopology");
+
+static virClassPtr virHostTopologyClass;
+
+/* The current snapshot, built on first use and dropped by
+ * virHostTopologyInvalidate() */
+static virMutex virHostTopologyLock = VIR_MUTEX_INITIALIZER;
+static virHostTopologyPtr virHostTopologyCurrent;
+
+
+static void
+virHostTopologyDispose(void *obj)
+{
+    virHostTopologyPtr topology = obj;
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < topology->ncells; i++) {
+        virHostTopologyNodePtr node = &topology->cells[i];
+
+        for (j = 0; j < node->ncpus; j++)
+            virBitmapFree(node->cpus[j].siblings);
+        VIR_FREE(node->cpus);
+        VIR_FREE(node->distances);
+    }
+    VIR_FREE(topology->cells);
+    virBitmapFree(topology->online);
+}
+
+
+static int
+virHostTopologyOnceInit(void)
+{
+    if (!(virHostTopologyClass = virClassNew(virClassForObject(),
+                                             "virHostTopology",
+                                             sizeof(virHostTopology),
+                                             virHostTopologyDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virHostTopology)
+
+
+/* Failing to detect the topology of a CPU is not fatal, the CPU is
+ * just reported without it */
+static void
+virHostTopologyFillCPU(virHostTopologyCPUPtr cpu,
+                       unsigned int id)
+{
+    cpu->id = id;
+
+#ifdef __linux__
+    if (virHostCPUGetSocket(id, &cpu->socket) < 0 ||
+        virHostCPUGetCore(id, &cpu->core) < 0 ||
+        !(cpu->siblings = virHostCPUGetSiblingsList(id)))
+        virResetLastError();
+#endif
+}
+
+
+static int
+virHostTopologyFillNode(virHostTopologyNodePtr node,
+                        int id,
+                        virBitmapPtr cpumap,
+                        int ncpus)
+{
+    unsigned long long memory = 0;
+    ssize_t cpu = -1;
+
+    node->id = id;
+
+    if (VIR_ALLOC_N(node->cpus, ncpus) < 0)
+        return -1;
+
+    while ((cpu = virBitmapNextSetBit(cpumap, cpu)) >= 0 &&
+           node->ncpus < ncpus)
+        virHostTopologyFillCPU(&node->cpus[node->ncpus++], cpu);
+
+    if (virNumaGetDistances(id, &node->distances, &node->ndistances) < 0)
+        return -1;
+
+    /* Detect the amount of memory in the numa cell in KiB */
+    virNumaGetNodeMemory(id, &memory, NULL);
+    node->memory = memory >> 10;
+
+    return 0;
+}
+
+
+static virHostTopologyPtr
+virHostTopologyNew(void)
+{
+    virHostTopologyPtr topology;
+    virBitmapPtr cpumap = NULL;
+    int max_node;
+    int ncpus;
+    int n;
+
+    if (!(topology = virObjectNew(virHostTopologyClass)))
+        return NULL;
+
+    if (virHostCPUGetInfo(virArchFromHost(),
+                          &topology->cpus, &topology->mhz,
+                          &topology->nodes, &topology->sockets,
+                          &topology->cores, &topology->threads) < 0)
+        goto error;
+
+    if (virHostCPUHasBitmap() &&
+        !(topology->online = virHostCPUGetOnlineBitmap()))
+        goto error;
+
+    if (!(topology->numa = virNumaIsAvailable()))
+        return topology;
+
+    if ((max_node = virNumaGetMaxNode()) < 0)
+        goto error;
+
+    if (VIR_ALLOC_N(topology->cells, max_node + 1) < 0)
+        goto error;
+
+    for (n = 0; n <= max_node; n++) {
+        if ((ncpus = virNumaGetNodeCPUs(n, &cpumap)) < 0) {
+            /* the node doesn't exist */
+            if (ncpus == -2)
+                continue;
+
+            goto error;
+        }
+
+        if (virHostTopologyFillNode(&topology->cells[topology->ncells++],
+                                    n, cpumap, ncpus) < 0)
+            goto error;
+
+        virBitmapFree(cpumap);
+        cpumap = NULL;
+    }
+
+    return topology;
+
+ error:
+    virBitmapFree(cpumap);
+    virObjectUnref(topology);
+    return NULL;
+}
+
+
+/**
+ * virHostTopologyGet:
+ *
+ * Get the snapshot of the host topology, reading it from sysfs and
+ * /proc only if there is no current one. Unlike the virHostCPU and
+ * virNuma functions it is built from, this can be called as often as
+ * needed, for example whenever capabilities are built.
+ *
+ * Returns a new reference to the snapshot, to be released with
+ * virObjectUnref(), or NULL on error.
+ */
+virHostTopologyPtr
+virHostTopologyGet(void)
+{
+    virHostTopologyPtr topology;
+
+    if (virHostTopologyInitialize() < 0)
+        return NULL;
+
+    virMutexLock(&virHostTopologyLock);
+    if (!virHostTopologyCurrent) {
+        VIR_DEBUG("Reading host topology");
+        virHostTopologyCurrent = virHostTopologyNew();
+    }
+    topology = virObjectRef(virHostTopologyCurrent);
+    virMutexUnlock(&virHostTopologyLock);
+
+    return topology;
+}
+
+
+/**
+ * virHostTopologyInvalidate:
+ *
+ * Drop the current snapshot so that the next virHostTopologyGet() reads
+ * the topology again, for example because a CPU or memory was hotplugged.
+ * References held to the old snapshot stay valid.
+ */
+void
+virHostTopologyInvalidate(void)
+{
+    virMutexLock(&virHostTopologyLock);
+    virObjectUnref(virHostTopologyCurrent);
+    virHostTopologyCurrent = NULL;
+    virMutexUnlock(&virHostTopologyLock);
+}
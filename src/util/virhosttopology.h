@@ -0,0 +1,80 @@
+/*
+ * virhosttopology.h: cached snapshot of the host CPU and NUMA topology
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_HOST_TOPOLOGY_H__
+# define __VIR_HOST_TOPOLOGY_H__
+
+# include "internal.h"
+# include "virbitmap.h"
+# include "virobject.h"
+
+typedef struct _virHostTopologyCPU virHostTopologyCPU;
+typedef virHostTopologyCPU *virHostTopologyCPUPtr;
+struct _virHostTopologyCPU {
+    unsigned int id;
+    unsigned int socket;
+    unsigned int core;
+    virBitmapPtr siblings;  /* NULL if the topology couldn't be detected */
+};
+
+typedef struct _virHostTopologyNode virHostTopologyNode;
+typedef virHostTopologyNode *virHostTopologyNodePtr;
+struct _virHostTopologyNode {
+    int id;
+    unsigned long long memory;  /* in KiB */
+
+    virHostTopologyCPUPtr cpus;
+    size_t ncpus;
+
+    /* as returned by virNumaGetDistances */
+    int *distances;
+    int ndistances;
+};
+
+/*
+ * The snapshot is immutable, so it can be used without any locking by
+ * anyone holding a reference to it. Hugepage pools are not part of it
+ * as they can be resized at any time.
+ */
+typedef struct _virHostTopology virHostTopology;
+typedef virHostTopology *virHostTopologyPtr;
+struct _virHostTopology {
+    virObject parent;
+
+    /* as returned by virHostCPUGetInfo */
+    unsigned int cpus;
+    unsigned int mhz;
+    unsigned int nodes;
+    unsigned int sockets;
+    unsigned int cores;
+    unsigned int threads;
+
+    virBitmapPtr online;  /* NULL if unknown on this platform */
+
+    bool numa;  /* false if NUMA is not available, no @cells then */
+    virHostTopologyNodePtr cells;
+    size_t ncells;
+};
+
+virHostTopologyPtr virHostTopologyGet(void);
+void virHostTopologyInvalidate(void);
+
+#endif /* __VIR_HOST_TOPOLOGY_H__ */
@@ -65,8 +65,242 @@ struct _virJSONParser {
     virJSONParserStatePtr state;
     size_t nstate;
     int wrap;
+    virJSONArenaPtr arena;
 };
 
+/* All the values of a tree parsed by virJSONValueFromStringArena are
+ * carved out of a few large chunks, so that parsing takes a handful
+ * of allocations and freeing the tree just releases the chunks.
+ *
+ * Such trees can still be modified: values stolen from them take a
+ * reference on the arena to stay valid after the tree is freed, and
+ * values allocated separately and appended to them are freed along
+ * with the arena. */
+#define VIR_JSON_ARENA_CHUNK_MIN 4096
+#define VIR_JSON_ARENA_CHUNK_MAX (1024 * 1024)
+#define VIR_JSON_ARENA_ALIGN (2 * sizeof(void *))
+
+typedef struct _virJSONArenaChunk virJSONArenaChunk;
+typedef virJSONArenaChunk *virJSONArenaChunkPtr;
+struct _virJSONArenaChunk {
+    virJSONArenaChunkPtr next;
+    size_t size;
+    size_t used;
+    char *data;
+};
+
+struct _virJSONArena {
+    size_t refs;
+    virJSONArenaChunkPtr chunks;
+
+    /* values not allocated from the arena but owned by its tree */
+    virJSONValuePtr *foreign;
+    size_t nforeign;
+};
+
+
+static virJSONArenaPtr
+virJSONArenaNew(void)
+{
+    virJSONArenaPtr arena;
+
+    if (VIR_ALLOC(arena) < 0)
+        return NULL;
+
+    arena->refs = 1;
+    return arena;
+}
+
+
+static void
+virJSONArenaUnref(virJSONArenaPtr arena)
+{
+    virJSONArenaChunkPtr chunk;
+    size_t i;
+
+    if (!arena || --arena->refs)
+        return;
+
+    for (i = 0; i < arena->nforeign; i++)
+        virJSONValueFree(arena->foreign[i]);
+    VIR_FREE(arena->foreign);
+
+    while ((chunk = arena->chunks)) {
+        arena->chunks = chunk->next;
+        VIR_FREE(chunk->data);
+        VIR_FREE(chunk);
+    }
+
+    VIR_FREE(arena);
+}
+
+
+/* Returns zeroed memory of @size bytes valid until @arena is freed */
+static void *
+virJSONArenaAlloc(virJSONArenaPtr arena,
+                  size_t size)
+{
+    virJSONArenaChunkPtr chunk = arena->chunks;
+    void *ret;
+
+    size = VIR_ROUND_UP(size, VIR_JSON_ARENA_ALIGN);
+
+    if (!chunk || chunk->size - chunk->used < size) {
+        size_t chunksize = VIR_JSON_ARENA_CHUNK_MIN;
+
+        /* Grow geometrically, large values get a chunk of their own */
+        if (chunk)
+            chunksize = MIN(chunk->size * 2, VIR_JSON_ARENA_CHUNK_MAX);
+        chunksize = MAX(chunksize, size);
+
+        if (VIR_ALLOC(chunk) < 0)
+            return NULL;
+        if (VIR_ALLOC_N(chunk->data, chunksize) < 0) {
+            VIR_FREE(chunk);
+            return NULL;
+        }
+        chunk->size = chunksize;
+
+        /* Keep filling the current chunk if the new one is for a large
+         * value only */
+        if (arena->chunks && size > VIR_JSON_ARENA_CHUNK_MAX / 2) {
+            chunk->next = arena->chunks->next;
+            arena->chunks->next = chunk;
+        } else {
+            chunk->next = arena->chunks;
+            arena->chunks = chunk;
+        }
+    }
+
+    ret = chunk->data + chunk->used;
+    chunk->used += size;
+    return ret;
+}
+
+
+static char *
+virJSONArenaStrndup(virJSONArenaPtr arena,
+                    const char *str,
+                    size_t len)
+{
+    char *ret;
+
+    if (!(ret = virJSONArenaAlloc(arena, len + 1)))
+        return NULL;
+
+    memcpy(ret, str, len);
+    return ret;
+}
+
+
+/* Grows the array of @count items of @size bytes at @ptr to hold one more
+ * item. Arena arrays are not grown by realloc but copied into a new one
+ * twice as large whenever @count is a power of two. */
+static int
+virJSONArenaExpand(virJSONArenaPtr arena,
+                   void *ptrptr,
+                   size_t size,
+                   size_t count)
+{
+    void **ptr = ptrptr;
+    void *tmp;
+
+    if (count & (count - 1))
+        return 0;
+
+    if (!(tmp = virJSONArenaAlloc(arena, size * MAX(count * 2, 1))))
+        return -1;
+
+    if (count)
+        memcpy(tmp, *ptr, size * count);
+    *ptr = tmp;
+    return 0;
+}
+
+
+/* Called once @value was added to @container */
+static int
+virJSONValueAttach(virJSONValuePtr container,
+                   virJSONValuePtr value)
+{
+    virJSONArenaPtr arena = container->arena;
+
+    if (!arena)
+        return 0;
+
+    /* The tree holds the reference on behalf of the value again */
+    if (value->arena == arena) {
+        if (value->arenaRef) {
+            value->arenaRef = false;
+            arena->refs--;
+        }
+        return 0;
+    }
+
+    return VIR_APPEND_ELEMENT_COPY(arena->foreign, arena->nforeign, value);
+}
+
+
+/* Called before @value is removed from @container */
+static void
+virJSONValueDetach(virJSONValuePtr container,
+                   virJSONValuePtr value)
+{
+    virJSONArenaPtr arena = container->arena;
+    size_t i;
+
+    if (!arena || !value)
+        return;
+
+    if (value->arena == arena) {
+        value->arenaRef = true;
+        arena->refs++;
+        return;
+    }
+
+    for (i = 0; i < arena->nforeign; i++) {
+        if (arena->foreign[i] == value) {
+            VIR_DELETE_ELEMENT(arena->foreign, i, arena->nforeign);
+            break;
+        }
+    }
+}
+
+
+static void
+virJSONValueObjectDeletePair(virJSONValuePtr object,
+                             size_t i)
+{
+    virJSONObjectPtr obj = &object->data.object;
+
+    if (!object->arena) {
+        VIR_FREE(obj->pairs[i].key);
+        VIR_DELETE_ELEMENT(obj->pairs, i, obj->npairs);
+        return;
+    }
+
+    memmove(obj->pairs + i, obj->pairs + i + 1,
+            sizeof(*obj->pairs) * (obj->npairs - i - 1));
+    obj->npairs--;
+}
+
+
+static void
+virJSONValueArrayDeleteValue(virJSONValuePtr array,
+                             size_t i)
+{
+    virJSONArrayPtr arr = &array->data.array;
+
+    if (!array->arena) {
+        VIR_DELETE_ELEMENT(arr->values, i, arr->nvalues);
+        return;
+    }
+
+    memmove(arr->values + i, arr->values + i + 1,
+            sizeof(*arr->values) * (arr->nvalues - i - 1));
+    arr->nvalues--;
+}
+
 
 /**
  * virJSONValueObjectAddVArgs:
@@ -348,6 +582,13 @@ virJSONValueFree(virJSONValuePtr value)
     if (!value || value->protect)
         return;
 
+    /* Values of arena trees are released all at once along with it */
+    if (value->arena) {
+        if (value->arenaRef)
+            virJSONArenaUnref(value->arena);
+        return;
+    }
+
     switch ((virJSONType) value->type) {
     case VIR_JSON_TYPE_OBJECT:
         for (i = 0; i < value->data.object.npairs; i++) {
@@ -580,19 +821,36 @@ virJSONValueObjectAppend(virJSONValuePtr object,
     if (virJSONValueObjectHasKey(object, key))
         return -1;
 
-    if (VIR_STRDUP(newkey, key) < 0)
-        return -1;
+    if (object->arena) {
+        if (!(newkey = virJSONArenaStrndup(object->arena, key, strlen(key))) ||
+            virJSONArenaExpand(object->arena, &object->data.object.pairs,
+                               sizeof(*object->data.object.pairs),
+                               object->data.object.npairs) < 0) {
+            virReportOOMError();
+            return -1;
+        }
+    } else {
+        if (VIR_STRDUP(newkey, key) < 0)
+            return -1;
 
-    if (VIR_REALLOC_N(object->data.object.pairs,
-                      object->data.object.npairs + 1) < 0) {
-        VIR_FREE(newkey);
-        return -1;
+        if (VIR_REALLOC_N(object->data.object.pairs,
+                          object->data.object.npairs + 1) < 0) {
+            VIR_FREE(newkey);
+            return -1;
+        }
     }
 
     object->data.object.pairs[object->data.object.npairs].key = newkey;
     object->data.object.pairs[object->data.object.npairs].value = value;
     object->data.object.npairs++;
 
+    if (virJSONValueAttach(object, value) < 0) {
+        object->data.object.npairs--;
+        if (!object->arena)
+            VIR_FREE(newkey);
+        return -1;
+    }
+
     return 0;
 }
 
@@ -731,13 +989,27 @@ virJSONValueArrayAppend(virJSONValuePtr array,
     if (array->type != VIR_JSON_TYPE_ARRAY)
         return -1;
 
-    if (VIR_REALLOC_N(array->data.array.values,
-                      array->data.array.nvalues + 1) < 0)
-        return -1;
+    if (array->arena) {
+        if (virJSONArenaExpand(array->arena, &array->data.array.values,
+                               sizeof(*array->data.array.values),
+                               array->data.array.nvalues) < 0) {
+            virReportOOMError();
+            return -1;
+        }
+    } else {
+        if (VIR_REALLOC_N(array->data.array.values,
+                          array->data.array.nvalues + 1) < 0)
+            return -1;
+    }
 
     array->data.array.values[array->data.array.nvalues] = value;
     array->data.array.nvalues++;
 
+    if (virJSONValueAttach(array, value) < 0) {
+        array->data.array.nvalues--;
+        return -1;
+    }
+
     return 0;
 }
 
@@ -791,9 +1063,8 @@ virJSONValueObjectSteal(virJSONValuePtr object,
     for (i = 0; i < object->data.object.npairs; i++) {
         if (STREQ(object->data.object.pairs[i].key, key)) {
             VIR_STEAL_PTR(obj, object->data.object.pairs[i].value);
-            VIR_FREE(object->data.object.pairs[i].key);
-            VIR_DELETE_ELEMENT(object->data.object.pairs, i,
-                               object->data.object.npairs);
+            virJSONValueDetach(object, obj);
+            virJSONValueObjectDeletePair(object, i);
             break;
         }
     }
@@ -828,6 +1099,7 @@ virJSONValueObjectStealByType(virJSONValuePtr object,
 
     if (value && value->type == type)
         return value;
+    virJSONValueFree(value);
     return NULL;
 }
 
@@ -874,14 +1146,13 @@ virJSONValueObjectRemoveKey(virJSONValuePtr object,
 
     for (i = 0; i < object->data.object.npairs; i++) {
         if (STREQ(object->data.object.pairs[i].key, key)) {
+            virJSONValueDetach(object, object->data.object.pairs[i].value);
             if (value) {
                 *value = object->data.object.pairs[i].value;
                 object->data.object.pairs[i].value = NULL;
             }
-            VIR_FREE(object->data.object.pairs[i].key);
             virJSONValueFree(object->data.object.pairs[i].value);
-            VIR_DELETE_ELEMENT(object->data.object.pairs, i,
-                               object->data.object.npairs);
+            virJSONValueObjectDeletePair(object, i);
             return 1;
         }
     }
@@ -949,9 +1220,8 @@ virJSONValueArraySteal(virJSONValuePtr array,
 
     ret = array->data.array.values[element];
 
-    VIR_DELETE_ELEMENT(array->data.array.values,
-                       element,
-                       array->data.array.nvalues);
+    virJSONValueDetach(array, ret);
+    virJSONValueArrayDeleteValue(array, element);
 
     return ret;
 }
@@ -989,13 +1259,28 @@ virJSONValueArrayForeachSteal(virJSONValuePtr array,
         return -1;
 
     for (i = 0; i < array->data.array.nvalues; i++) {
-        if ((rc = cb(i, array->data.array.values[i], opaque)) < 0) {
+        virJSONValuePtr value = array->data.array.values[i];
+        bool local = array->arena && value->arena == array->arena;
+
+        /* The callback may free the value right away, so arena values
+         * must hold their reference before it's called */
+        if (local)
+            virJSONValueDetach(array, value);
+
+        if ((rc = cb(i, value, opaque)) < 0) {
+            if (local)
+                ignore_value(virJSONValueAttach(array, value));
             ret = -1;
             break;
         }
 
-        if (rc == 0)
+        if (rc == 0) {
+            if (!local)
+                virJSONValueDetach(array, value);
             array->data.array.values[i] = NULL;
+        } else if (local) {
+            ignore_value(virJSONValueAttach(array, value));
+        }
     }
 
     /* condense the remaining entries at the beginning */
@@ -1413,12 +1698,49 @@ virJSONValueCopy(const virJSONValue *in)
 
 
 #if WITH_YAJL
+static virJSONValuePtr
+virJSONParserNewValue(virJSONParserPtr parser,
+                      int type)
+{
+    virJSONValuePtr value;
+
+    if (!parser->arena)
+        return NULL;
+
+    if (!(value = virJSONArenaAlloc(parser->arena, sizeof(*value))))
+        return NULL;
+
+    value->type = type;
+    value->arena = parser->arena;
+    return value;
+}
+
+
+static virJSONValuePtr
+virJSONParserNewStringLen(virJSONParserPtr parser,
+                          int type,
+                          const char *str,
+                          size_t len)
+{
+    virJSONValuePtr value;
+
+    if (!(value = virJSONParserNewValue(parser, type)) ||
+        !(value->data.string = virJSONArenaStrndup(parser->arena, str, len)))
+        return NULL;
+
+    return value;
+}
+
+
 static int
 virJSONParserInsertValue(virJSONParserPtr parser,
                          virJSONValuePtr value)
 {
     if (!parser->head) {
         parser->head = value;
+        /* The top level value owns the arena */
+        if (parser->arena)
+            value->arenaRef = true;
     } else {
         virJSONParserStatePtr state;
         if (!parser->nstate) {
@@ -1468,7 +1790,12 @@ static int
 virJSONParserHandleNull(void *ctx)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewNull();
+    virJSONValuePtr value;
+
+    if (parser->arena)
+        value = virJSONParserNewValue(parser, VIR_JSON_TYPE_NULL);
+    else
+        value = virJSONValueNewNull();
 
     VIR_DEBUG("parser=%p", parser);
 
@@ -1489,7 +1816,14 @@ virJSONParserHandleBoolean(void *ctx,
                            int boolean_)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewBoolean(boolean_);
+    virJSONValuePtr value;
+
+    if (parser->arena) {
+        if ((value = virJSONParserNewValue(parser, VIR_JSON_TYPE_BOOLEAN)))
+            value->data.boolean = boolean_;
+    } else {
+        value = virJSONValueNewBoolean(boolean_);
+    }
 
     VIR_DEBUG("parser=%p boolean=%d", parser, boolean_);
 
@@ -1514,12 +1848,16 @@ virJSONParserHandleNumber(void *ctx,
     char *str;
     virJSONValuePtr value;
 
-    if (VIR_STRNDUP(str, s, l) < 0)
-        return -1;
-    value = virJSONValueNewNumber(str);
-    VIR_FREE(str);
+    if (parser->arena) {
+        value = virJSONParserNewStringLen(parser, VIR_JSON_TYPE_NUMBER, s, l);
+    } else {
+        if (VIR_STRNDUP(str, s, l) < 0)
+            return -1;
+        value = virJSONValueNewNumber(str);
+        VIR_FREE(str);
+    }
 
-    VIR_DEBUG("parser=%p str=%s", parser, str);
+    VIR_DEBUG("parser=%p", parser);
 
     if (!value)
         return 0;
@@ -1539,8 +1877,13 @@ virJSONParserHandleString(void *ctx,
                           yajl_size_t stringLen)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewStringLen((const char *)stringVal,
-                                                     stringLen);
+    virJSONValuePtr value;
+
+    if (parser->arena)
+        value = virJSONParserNewStringLen(parser, VIR_JSON_TYPE_STRING,
+                                          (const char *)stringVal, stringLen);
+    else
+        value = virJSONValueNewStringLen((const char *)stringVal, stringLen);
 
     VIR_DEBUG("parser=%p str=%p", parser, (const char *)stringVal);
 
@@ -1582,7 +1925,12 @@ static int
 virJSONParserHandleStartMap(void *ctx)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewObject();
+    virJSONValuePtr value;
+
+    if (parser->arena)
+        value = virJSONParserNewValue(parser, VIR_JSON_TYPE_OBJECT);
+    else
+        value = virJSONValueNewObject();
 
     VIR_DEBUG("parser=%p", parser);
 
@@ -1634,7 +1982,12 @@ static int
 virJSONParserHandleStartArray(void *ctx)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewArray();
+    virJSONValuePtr value;
+
+    if (parser->arena)
+        value = virJSONParserNewValue(parser, VIR_JSON_TYPE_ARRAY);
+    else
+        value = virJSONValueNewArray();
 
     VIR_DEBUG("parser=%p", parser);
 
@@ -1696,12 +2049,12 @@ static const yajl_callbacks parserCallbacks = {
 };
 
 
-/* XXX add an incremental streaming parser - yajl trivially supports it */
-virJSONValuePtr
-virJSONValueFromString(const char *jsonstring)
+static virJSONValuePtr
+virJSONValueFromStringInternal(const char *jsonstring,
+                               bool arena)
 {
     yajl_handle hand;
-    virJSONParser parser = { NULL, NULL, 0, 0 };
+    virJSONParser parser = { NULL, NULL, 0, 0, NULL };
     virJSONValuePtr ret = NULL;
     int rc;
     size_t len = strlen(jsonstring);
@@ -1712,6 +2065,9 @@ virJSONValueFromString(const char *jsonstring)
 
     VIR_DEBUG("string=%s", jsonstring);
 
+    if (arena && !(parser.arena = virJSONArenaNew()))
+        return NULL;
+
 # ifdef WITH_YAJL2
     hand = yajl_alloc(&parserCallbacks, NULL, &parser);
 # else
@@ -1785,12 +2141,526 @@ virJSONValueFromString(const char *jsonstring)
         VIR_FREE(parser.state);
     }
 
+    /* Otherwise the top level value owned the arena */
+    if (!parser.head)
+        virJSONArenaUnref(parser.arena);
+
     VIR_DEBUG("result=%p", ret);
 
     return ret;
 }
 
 
+virJSONValuePtr
+virJSONValueFromString(const char *jsonstring)
+{
+    return virJSONValueFromStringInternal(jsonstring, false);
+}
+
+
+/**
+ * virJSONValueFromStringArena:
+ * @jsonstring: the JSON document
+ *
+ * Same as virJSONValueFromString, but the values of the returned tree are
+ * allocated from a few large regions rather than one by one, which makes
+ * parsing and freeing large documents much cheaper. The tree can be used
+ * and modified like any other, but its memory is only released once the
+ * tree and all the values taken out of it are freed.
+ */
+virJSONValuePtr
+virJSONValueFromStringArena(const char *jsonstring)
+{
+    return virJSONValueFromStringInternal(jsonstring, true);
+}
+
+
+typedef struct _virJSONStreamFrame virJSONStreamFrame;
+typedef virJSONStreamFrame *virJSONStreamFramePtr;
+struct _virJSONStreamFrame {
+    bool array;
+    char *key;
+    size_t index;
+};
+
+typedef struct _virJSONStreamParser virJSONStreamParser;
+typedef virJSONStreamParser *virJSONStreamParserPtr;
+struct _virJSONStreamParser {
+    virJSONStreamCallback cb;
+    void *opaque;
+    bool aborted;
+
+    virJSONStreamFramePtr frames;
+    size_t nframes;
+    int wrap;
+
+    /* Nesting of the container being skipped, if any */
+    size_t skip;
+
+    /* Builds the value being captured, if any */
+    bool capturing;
+    virJSONParser capture;
+
+    char *scratch;
+    size_t nscratch;
+};
+
+
+static void
+virJSONStreamParserResetCapture(virJSONStreamParserPtr parser)
+{
+    size_t i;
+
+    virJSONValueFree(parser->capture.head);
+    for (i = 0; i < parser->capture.nstate; i++)
+        VIR_FREE(parser->capture.state[i].key);
+    VIR_FREE(parser->capture.state);
+    memset(&parser->capture, 0, sizeof(parser->capture));
+    parser->capturing = false;
+}
+
+
+static int
+virJSONStreamParserCall(virJSONStreamParserPtr parser,
+                        virJSONStreamItemPtr item)
+{
+    int rc;
+
+    if (parser->nframes > parser->wrap) {
+        virJSONStreamFramePtr frame = &parser->frames[parser->nframes - 1];
+
+        if (frame->array)
+            item->index = frame->index;
+        else
+            item->key = frame->key;
+    }
+    item->depth = parser->nframes - parser->wrap;
+
+    if ((rc = parser->cb(item, parser->opaque)) < 0)
+        parser->aborted = true;
+
+    return rc;
+}
+
+
+/* Move past a complete value in its parent container */
+static void
+virJSONStreamParserValueDone(virJSONStreamParserPtr parser)
+{
+    virJSONStreamFramePtr frame;
+
+    if (!parser->nframes)
+        return;
+
+    frame = &parser->frames[parser->nframes - 1];
+    if (frame->array)
+        frame->index++;
+    else
+        VIR_FREE(frame->key);
+}
+
+
+static int
+virJSONStreamParserFinishCapture(virJSONStreamParserPtr parser)
+{
+    virJSONStreamItem item = { .event = VIR_JSON_STREAM_CAPTURED };
+
+    item.captured = parser->capture.head;
+    parser->capture.head = NULL;
+    virJSONStreamParserResetCapture(parser);
+
+    if (virJSONStreamParserCall(parser, &item) < 0)
+        return 0;
+
+    virJSONStreamParserValueDone(parser);
+    return 1;
+}
+
+
+static int
+virJSONStreamParserCaptureScalar(virJSONStreamParserPtr parser,
+                                 int type,
+                                 const char *str,
+                                 size_t len,
+                                 int boolean_)
+{
+    switch ((virJSONType) type) {
+    case VIR_JSON_TYPE_STRING:
+        return virJSONParserHandleString(&parser->capture,
+                                         (const unsigned char *)str, len) == 1;
+    case VIR_JSON_TYPE_NUMBER:
+        return virJSONParserHandleNumber(&parser->capture, str, len) == 1;
+    case VIR_JSON_TYPE_BOOLEAN:
+        return virJSONParserHandleBoolean(&parser->capture, boolean_) == 1;
+    case VIR_JSON_TYPE_NULL:
+        return virJSONParserHandleNull(&parser->capture) == 1;
+    case VIR_JSON_TYPE_OBJECT:
+    case VIR_JSON_TYPE_ARRAY:
+        break;
+    }
+
+    return 0;
+}
+
+
+static int
+virJSONStreamParserHandleScalar(virJSONStreamParserPtr parser,
+                                int type,
+                                const char *str,
+                                size_t len,
+                                int boolean_)
+{
+    virJSONStreamItem item = { .event = VIR_JSON_STREAM_SCALAR };
+    int rc;
+
+    if (parser->skip)
+        return 1;
+
+    if (parser->capturing)
+        return virJSONStreamParserCaptureScalar(parser, type, str, len,
+                                                boolean_);
+
+    item.type = type;
+    item.boolean = !!boolean_;
+    if (str) {
+        if (len >= parser->nscratch) {
+            if (VIR_REALLOC_N(parser->scratch, len + 1) < 0)
+                return 0;
+            parser->nscratch = len + 1;
+        }
+        memcpy(parser->scratch, str, len);
+        parser->scratch[len] = '\0';
+        item.value = parser->scratch;
+    }
+
+    if ((rc = virJSONStreamParserCall(parser, &item)) < 0)
+        return 0;
+
+    if (rc == VIR_JSON_STREAM_CAPTURE) {
+        parser->capturing = true;
+        if (!virJSONStreamParserCaptureScalar(parser, type, str, len, boolean_))
+            return 0;
+        return virJSONStreamParserFinishCapture(parser);
+    }
+
+    virJSONStreamParserValueDone(parser);
+    return 1;
+}
+
+
+static int
+virJSONStreamParserHandleNull(void *ctx)
+{
+    return virJSONStreamParserHandleScalar(ctx, VIR_JSON_TYPE_NULL,
+                                           NULL, 0, 0);
+}
+
+
+static int
+virJSONStreamParserHandleBoolean(void *ctx,
+                                 int boolean_)
+{
+    return virJSONStreamParserHandleScalar(ctx, VIR_JSON_TYPE_BOOLEAN,
+                                           NULL, 0, boolean_);
+}
+
+
+static int
+virJSONStreamParserHandleNumber(void *ctx,
+                                const char *s,
+                                yajl_size_t l)
+{
+    return virJSONStreamParserHandleScalar(ctx, VIR_JSON_TYPE_NUMBER,
+                                           s, l, 0);
+}
+
+
+static int
+virJSONStreamParserHandleString(void *ctx,
+                                const unsigned char *stringVal,
+                                yajl_size_t stringLen)
+{
+    return virJSONStreamParserHandleScalar(ctx, VIR_JSON_TYPE_STRING,
+                                           (const char *)stringVal,
+                                           stringLen, 0);
+}
+
+
+static int
+virJSONStreamParserHandleMapKey(void *ctx,
+                                const unsigned char *stringVal,
+                                yajl_size_t stringLen)
+{
+    virJSONStreamParserPtr parser = ctx;
+    virJSONStreamFramePtr frame;
+
+    if (parser->skip)
+        return 1;
+
+    if (parser->capturing)
+        return virJSONParserHandleMapKey(&parser->capture,
+                                         stringVal, stringLen);
+
+    if (!parser->nframes)
+        return 0;
+
+    frame = &parser->frames[parser->nframes - 1];
+    if (frame->array || frame->key)
+        return 0;
+    if (VIR_STRNDUP(frame->key, (const char *)stringVal, stringLen) < 0)
+        return 0;
+    return 1;
+}
+
+
+static int
+virJSONStreamParserHandleStart(virJSONStreamParserPtr parser,
+                               bool array)
+{
+    virJSONStreamItem item;
+    int rc;
+
+    if (parser->skip) {
+        parser->skip++;
+        return 1;
+    }
+
+    if (parser->capturing) {
+        if (array)
+            return virJSONParserHandleStartArray(&parser->capture);
+        return virJSONParserHandleStartMap(&parser->capture);
+    }
+
+    /* The array wrapping the input for yajl 1 is not reported */
+    if (!(array && parser->nframes < parser->wrap)) {
+        memset(&item, 0, sizeof(item));
+        item.event = array ? VIR_JSON_STREAM_ARRAY_START :
+                             VIR_JSON_STREAM_OBJECT_START;
+
+        if ((rc = virJSONStreamParserCall(parser, &item)) < 0)
+            return 0;
+
+        if (rc == VIR_JSON_STREAM_SKIP) {
+            parser->skip = 1;
+            return 1;
+        }
+
+        if (rc == VIR_JSON_STREAM_CAPTURE) {
+            parser->capturing = true;
+            if (array)
+                return virJSONParserHandleStartArray(&parser->capture);
+            return virJSONParserHandleStartMap(&parser->capture);
+        }
+    }
+
+    if (VIR_EXPAND_N(parser->frames, parser->nframes, 1) < 0)
+        return 0;
+    parser->frames[parser->nframes - 1].array = array;
+
+    return 1;
+}
+
+
+static int
+virJSONStreamParserHandleEnd(virJSONStreamParserPtr parser,
+                             bool array)
+{
+    virJSONStreamItem item;
+    virJSONStreamFramePtr frame;
+
+    if (parser->skip) {
+        if (--parser->skip == 0)
+            virJSONStreamParserValueDone(parser);
+        return 1;
+    }
+
+    if (parser->capturing) {
+        if (array) {
+            if (!virJSONParserHandleEndArray(&parser->capture))
+                return 0;
+        } else {
+            if (!virJSONParserHandleEndMap(&parser->capture))
+                return 0;
+        }
+
+        if (parser->capture.nstate == 0)
+            return virJSONStreamParserFinishCapture(parser);
+        return 1;
+    }
+
+    if (!parser->nframes)
+        return 0;
+
+    frame = &parser->frames[parser->nframes - 1];
+    if (frame->array != array || frame->key)
+        return 0;
+
+    if (parser->nframes <= parser->wrap) {
+        /* Only a single value may be wrapped */
+        if (frame->index != 1)
+            return 0;
+        VIR_SHRINK_N(parser->frames, parser->nframes, 1);
+        return 1;
+    }
+
+    VIR_SHRINK_N(parser->frames, parser->nframes, 1);
+
+    memset(&item, 0, sizeof(item));
+    item.event = array ? VIR_JSON_STREAM_ARRAY_END :
+                         VIR_JSON_STREAM_OBJECT_END;
+
+    if (virJSONStreamParserCall(parser, &item) < 0)
+        return 0;
+
+    virJSONStreamParserValueDone(parser);
+    return 1;
+}
+
+
+static int
+virJSONStreamParserHandleStartMap(void *ctx)
+{
+    return virJSONStreamParserHandleStart(ctx, false);
+}
+
+
+static int
+virJSONStreamParserHandleEndMap(void *ctx)
+{
+    return virJSONStreamParserHandleEnd(ctx, false);
+}
+
+
+static int
+virJSONStreamParserHandleStartArray(void *ctx)
+{
+    return virJSONStreamParserHandleStart(ctx, true);
+}
+
+
+static int
+virJSONStreamParserHandleEndArray(void *ctx)
+{
+    return virJSONStreamParserHandleEnd(ctx, true);
+}
+
+
+static const yajl_callbacks streamParserCallbacks = {
+    virJSONStreamParserHandleNull,
+    virJSONStreamParserHandleBoolean,
+    NULL,
+    NULL,
+    virJSONStreamParserHandleNumber,
+    virJSONStreamParserHandleString,
+    virJSONStreamParserHandleStartMap,
+    virJSONStreamParserHandleMapKey,
+    virJSONStreamParserHandleEndMap,
+    virJSONStreamParserHandleStartArray,
+    virJSONStreamParserHandleEndArray
+};
+
+
+/**
+ * virJSONStreamParse:
+ * @jsonstring: the JSON document
+ * @cb: callback to report the parsed items to
+ * @opaque: data passed to @cb
+ *
+ * Parse @jsonstring without building the virJSONValue tree for it. Each
+ * container start and end and each scalar value is reported to @cb as soon
+ * as parsed, along with its position in the document. The callback can
+ * decide to skip containers it is not interested in or to have any value
+ * captured into a virJSONValue, see VIR_JSON_STREAM_SKIP and
+ * VIR_JSON_STREAM_CAPTURE.
+ *
+ * Returns 0 on success, -1 if @jsonstring failed to parse with an error
+ * reported, or if @cb returned -1, in which case it is responsible for
+ * reporting the error.
+ */
+int
+virJSONStreamParse(const char *jsonstring,
+                   virJSONStreamCallback cb,
+                   void *opaque)
+{
+    yajl_handle hand;
+    virJSONStreamParser parser;
+    int ret = -1;
+    int rc;
+    size_t len = strlen(jsonstring);
+    size_t i;
+# ifndef WITH_YAJL2
+    yajl_parser_config cfg = { 0, 1 }; /* Match yajl 2 default behavior */
+# endif
+
+    VIR_DEBUG("string=%s", jsonstring);
+
+    memset(&parser, 0, sizeof(parser));
+    parser.cb = cb;
+    parser.opaque = opaque;
+
+# ifdef WITH_YAJL2
+    hand = yajl_alloc(&streamParserCallbacks, NULL, &parser);
+# else
+    hand = yajl_alloc(&streamParserCallbacks, &cfg, NULL, &parser);
+# endif
+    if (!hand) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to create JSON parser"));
+        goto cleanup;
+    }
+
+    /* See virJSONValueFromString for the wrapping on yajl 1 */
+# ifdef WITH_YAJL2
+    rc = yajl_parse(hand, (const unsigned char *)jsonstring, len);
+# else
+    parser.wrap = 1;
+    rc = yajl_parse(hand, (const unsigned char *)"[", 1);
+    if (VIR_YAJL_STATUS_OK(rc))
+        rc = yajl_parse(hand, (const unsigned char *)jsonstring, len);
+    if (VIR_YAJL_STATUS_OK(rc))
+        rc = yajl_parse(hand, (const unsigned char *)"]", 1);
+# endif
+    if (VIR_YAJL_STATUS_OK(rc))
+        rc = yajl_complete_parse(hand);
+
+    if (parser.aborted)
+        goto cleanup;
+
+    if (rc != yajl_status_ok) {
+        unsigned char *errstr = yajl_get_error(hand, 1,
+                                               (const unsigned char*)jsonstring,
+                                               len);
+
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot parse json %s: %s"),
+                       jsonstring, (const char*) errstr);
+        yajl_free_error(hand, errstr);
+        goto cleanup;
+    }
+
+    if (parser.nframes != 0 || parser.capturing) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot parse json %s: unterminated string/map/array"),
+                       jsonstring);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (hand)
+        yajl_free(hand);
+
+    virJSONStreamParserResetCapture(&parser);
+    for (i = 0; i < parser.nframes; i++)
+        VIR_FREE(parser.frames[i].key);
+    VIR_FREE(parser.frames);
+    VIR_FREE(parser.scratch);
+
+    return ret;
+}
+
+
 static int
 virJSONValueToStringOne(virJSONValuePtr object,
                         yajl_gen g)
@@ -1917,6 +2787,26 @@ virJSONValueFromString(const char *jsonstring ATTRIBUTE_UNUSED)
 }
 
 
+virJSONValuePtr
+virJSONValueFromStringArena(const char *jsonstring ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("No JSON parser implementation is available"));
+    return NULL;
+}
+
+
+int
+virJSONStreamParse(const char *jsonstring ATTRIBUTE_UNUSED,
+                   virJSONStreamCallback cb ATTRIBUTE_UNUSED,
+                   void *opaque ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("No JSON parser implementation is available"));
+    return -1;
+}
+
+
 char *
 virJSONValueToString(virJSONValuePtr object ATTRIBUTE_UNUSED,
                      bool pretty ATTRIBUTE_UNUSED)
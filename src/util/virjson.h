@@ -51,6 +51,9 @@ typedef virJSONObjectPair *virJSONObjectPairPtr;
 typedef struct _virJSONArray virJSONArray;
 typedef virJSONArray *virJSONArrayPtr;
 
+typedef struct _virJSONArena virJSONArena;
+typedef virJSONArena *virJSONArenaPtr;
+
 
 struct _virJSONObjectPair {
     char *key;
@@ -70,6 +73,8 @@ struct _virJSONArray {
 struct _virJSONValue {
     int type; /* enum virJSONType */
     bool protect; /* prevents deletion when embedded in another object */
+    bool arenaRef; /* the value keeps its arena alive */
+    virJSONArenaPtr arena; /* region the value was allocated from, if any */
 
     union {
         virJSONObject object;
@@ -169,6 +174,51 @@ int virJSONValueObjectRemoveKey(virJSONValuePtr object, const char *key,
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
 
 virJSONValuePtr virJSONValueFromString(const char *jsonstring);
+virJSONValuePtr virJSONValueFromStringArena(const char *jsonstring);
+
+typedef enum {
+    VIR_JSON_STREAM_OBJECT_START,
+    VIR_JSON_STREAM_OBJECT_END,
+    VIR_JSON_STREAM_ARRAY_START,
+    VIR_JSON_STREAM_ARRAY_END,
+    VIR_JSON_STREAM_SCALAR,
+    VIR_JSON_STREAM_CAPTURED,
+} virJSONStreamEvent;
+
+/* Values returned by virJSONStreamCallback besides 0 to continue
+ * and -1 to abort parsing */
+enum {
+    /* On _START, skip the container without reporting its contents */
+    VIR_JSON_STREAM_SKIP = 1,
+    /* On _START or _SCALAR, build the whole value and report it
+     * once complete by a VIR_JSON_STREAM_CAPTURED item */
+    VIR_JSON_STREAM_CAPTURE = 2,
+};
+
+typedef struct _virJSONStreamItem virJSONStreamItem;
+typedef virJSONStreamItem *virJSONStreamItemPtr;
+struct _virJSONStreamItem {
+    int event; /* enum virJSONStreamEvent */
+    size_t depth; /* 0 for the top level value */
+    const char *key; /* key in the parent object, NULL otherwise */
+    size_t index; /* position in the parent array */
+
+    /* Valid for VIR_JSON_STREAM_SCALAR only */
+    int type; /* enum virJSONType */
+    const char *value; /* text of a string or number */
+    bool boolean;
+
+    /* Valid for VIR_JSON_STREAM_CAPTURED only, owned by the callback */
+    virJSONValuePtr captured;
+};
+
+typedef int (*virJSONStreamCallback)(const virJSONStreamItem *item,
+                                     void *opaque);
+
+int virJSONStreamParse(const char *jsonstring,
+                       virJSONStreamCallback cb,
+                       void *opaque)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
 char *virJSONValueToString(virJSONValuePtr object,
                            bool pretty);
 
@@ -151,6 +151,120 @@ virLeaseReadCustomLeaseFile(virJSONValuePtr leases_array_new,
 }
 
 
+/**
+ * virLeaseToDBEntry:
+ * @lease: a lease, as stored in the custom lease file
+ * @entry: filled with pointers to the strings of @lease
+ *
+ * Returns 0 on success, -1 if @lease lacks its IP address.
+ */
+int
+virLeaseToDBEntry(virJSONValuePtr lease,
+                  virLeaseDBEntryPtr entry)
+{
+    memset(entry, 0, sizeof(*entry));
+
+    if (!(entry->ip = virJSONValueObjectGetString(lease, "ip-address"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("found lease without ip-address"));
+        return -1;
+    }
+
+    /* optional, like everything else */
+    ignore_value(virJSONValueObjectGetNumberLong(lease, "expiry-time",
+                                                 &entry->expirytime));
+    entry->mac = virJSONValueObjectGetString(lease, "mac-address");
+    entry->hostname = virJSONValueObjectGetString(lease, "hostname");
+    entry->clientid = virJSONValueObjectGetString(lease, "client-id");
+    entry->iaid = virJSONValueObjectGetString(lease, "iaid");
+    entry->serverduid = virJSONValueObjectGetString(lease, "server-duid");
+
+    return 0;
+}
+
+
+typedef struct {
+    virJSONValuePtr leases;
+    char **server_duid;
+} virLeaseReadLeaseDBData;
+
+static int
+virLeaseReadLeaseDBIterator(const virLeaseDBEntry *entry,
+                            void *opaque)
+{
+    virLeaseReadLeaseDBData *data = opaque;
+    virJSONValuePtr lease = NULL;
+    const char *server_duid = entry->serverduid;
+
+    /* Same treatment of ipv6 leases as virLeaseReadCustomLeaseFile() */
+    if (data->server_duid && strchr(entry->ip, ':')) {
+        if (server_duid) {
+            if (!*data->server_duid &&
+                VIR_STRDUP(*data->server_duid, server_duid) < 0)
+                return -1;
+        } else {
+            server_duid = *data->server_duid;
+        }
+    }
+
+    if (!(lease = virJSONValueNewObject()))
+        goto error;
+
+    if ((entry->iaid &&
+         virJSONValueObjectAppendString(lease, "iaid", entry->iaid) < 0) ||
+        virJSONValueObjectAppendString(lease, "ip-address", entry->ip) < 0 ||
+        (entry->mac &&
+         virJSONValueObjectAppendString(lease, "mac-address",
+                                        entry->mac) < 0) ||
+        (entry->hostname &&
+         virJSONValueObjectAppendString(lease, "hostname",
+                                        entry->hostname) < 0) ||
+        (entry->clientid &&
+         virJSONValueObjectAppendString(lease, "client-id",
+                                        entry->clientid) < 0) ||
+        (server_duid &&
+         virJSONValueObjectAppendString(lease, "server-duid",
+                                        server_duid) < 0) ||
+        (entry->expirytime &&
+         virJSONValueObjectAppendNumberLong(lease, "expiry-time",
+                                            entry->expirytime) < 0))
+        goto error;
+
+    if (virJSONValueArrayAppend(data->leases, lease) < 0)
+        goto error;
+
+    return 0;
+
+ error:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("failed to create json"));
+    virJSONValueFree(lease);
+    return -1;
+}
+
+
+/**
+ * virLeaseReadLeaseDB:
+ * @leases_array_new: JSON array to append the leases to
+ * @db: the lease database
+ * @server_duid: same as for virLeaseReadCustomLeaseFile()
+ *
+ * Convert all the leases of @db to the representation used by the
+ * custom lease file.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virLeaseReadLeaseDB(virJSONValuePtr leases_array_new,
+                    virLeaseDBPtr db,
+                    char **server_duid)
+{
+    virLeaseReadLeaseDBData data = { leases_array_new, server_duid };
+
+    return virLeaseDBForEach(db, virLeaseReadLeaseDBIterator, &data);
+}
+
+
 int
 virLeasePrintLeases(virJSONValuePtr leases_array_new,
                     const char *server_duid)
@@ -24,12 +24,20 @@
 # define __VIR_LEASE_H_
 
 # include "virjson.h"
+# include "virleasedb.h"
 
 int virLeaseReadCustomLeaseFile(virJSONValuePtr leases_array_new,
                                 const char *custom_lease_file,
                                 const char *ip_to_delete,
                                 char **server_duid);
 
+int virLeaseReadLeaseDB(virJSONValuePtr leases_array_new,
+                        virLeaseDBPtr db,
+                        char **server_duid);
+
+int virLeaseToDBEntry(virJSONValuePtr lease,
+                      virLeaseDBEntryPtr entry);
+
 int virLeasePrintLeases(virJSONValuePtr leases_array_new,
                         const char *server_duid);
 
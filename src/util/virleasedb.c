@@ -0,0 +1,1041 @@
+/*
+ * virleasedb.c: indexed DHCP lease database
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if HAVE_MMAP
+# include <sys/mman.h>
+#endif
+
+#include "c-ctype.h"
+#include "virleasedb.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virlog.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NETWORK
+
+VIR_LOG_INIT("util.leasedb");
+
+/*
+ * The database is a single file, in host byte order since it never
+ * leaves the host:
+ *
+ *   header
+ *   bucket heads, one array of @nbuckets offsets per lookup key
+ *   records, appended one after another
+ *
+ * Each record links to the previous record of its bucket for every
+ * key, so that a lookup only walks one short chain instead of the
+ * whole database.  Records are never changed once written, except
+ * for their flags: a removed or replaced lease is marked dead in
+ * place, and the space is reclaimed by writing a fresh copy of the
+ * live records to a new file which is renamed over the old one.
+ *
+ * Writers serialize on an fcntl() lock.  Readers take no lock at
+ * all: a record is complete before any bucket head points at it,
+ * and a reader still looking at the file replaced by a compaction
+ * keeps seeing a consistent, if slightly stale, database.
+ */
+
+#define VIR_LEASE_DB_MAGIC "LVLEASE"
+#define VIR_LEASE_DB_VERSION 1
+
+#define VIR_LEASE_DB_MIN_BUCKETS 64
+#define VIR_LEASE_DB_MAX_BUCKETS (1 << 20)
+
+/* don't bother rewriting the file for a handful of dead records */
+#define VIR_LEASE_DB_COMPACT_MIN_DEAD 64
+
+#define VIR_LEASE_DB_FILE_SIZE_MAX (256 * 1024 * 1024)
+
+#define VIR_LEASE_DB_RECORD_DEAD (1 << 0)
+
+/* The lookup keys must come first, in the same order */
+typedef enum {
+    VIR_LEASE_DB_FIELD_IP,
+    VIR_LEASE_DB_FIELD_MAC,
+    VIR_LEASE_DB_FIELD_HOSTNAME,
+    VIR_LEASE_DB_FIELD_CLIENTID,
+    VIR_LEASE_DB_FIELD_IAID,
+    VIR_LEASE_DB_FIELD_SERVERDUID,
+
+    VIR_LEASE_DB_FIELD_LAST
+} virLeaseDBField;
+
+verify((int) VIR_LEASE_DB_FIELD_IP == (int) VIR_LEASE_DB_KEY_IP);
+verify((int) VIR_LEASE_DB_FIELD_MAC == (int) VIR_LEASE_DB_KEY_MAC);
+verify((int) VIR_LEASE_DB_FIELD_HOSTNAME == (int) VIR_LEASE_DB_KEY_HOSTNAME);
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t nbuckets;      /* power of two */
+    uint64_t end;           /* offset right after the last record */
+    uint32_t nlive;
+    uint32_t ndead;
+} virLeaseDBHeader;
+
+typedef struct {
+    uint32_t size;          /* including the strings, multiple of 8 */
+    uint32_t flags;
+    uint64_t next[VIR_LEASE_DB_KEY_LAST];
+    int64_t expirytime;
+    uint16_t len[VIR_LEASE_DB_FIELD_LAST]; /* strlen() + 1, 0 if NULL */
+    uint32_t padding;
+    /* followed by the NUL terminated strings in field order */
+} virLeaseDBRecord;
+
+/* A database being built in memory */
+typedef struct {
+    char *data;
+    size_t len;
+} virLeaseDBImage;
+
+struct _virLeaseDB {
+    char *path;
+    int fd;
+    bool writable;
+    bool mapped;            /* whether @data is mmap()ed or allocated */
+    char *data;
+    size_t len;
+};
+
+
+static size_t
+virLeaseDBRecordsStart(uint32_t nbuckets)
+{
+    return sizeof(virLeaseDBHeader) +
+        sizeof(uint64_t) * VIR_LEASE_DB_KEY_LAST * nbuckets;
+}
+
+
+static size_t
+virLeaseDBHeadOffset(uint32_t nbuckets,
+                     virLeaseDBKey key,
+                     uint32_t bucket)
+{
+    return sizeof(virLeaseDBHeader) +
+        sizeof(uint64_t) * (key * nbuckets + bucket);
+}
+
+
+static const virLeaseDBHeader *
+virLeaseDBGetHeader(virLeaseDBPtr db)
+{
+    return (const virLeaseDBHeader *) db->data;
+}
+
+
+static uint64_t
+virLeaseDBGetHead(virLeaseDBPtr db,
+                  virLeaseDBKey key,
+                  uint32_t bucket)
+{
+    uint32_t nbuckets = virLeaseDBGetHeader(db)->nbuckets;
+
+    return *(const uint64_t *) (db->data +
+                                virLeaseDBHeadOffset(nbuckets, key, bucket));
+}
+
+
+static const char *
+virLeaseDBEntryGetField(const virLeaseDBEntry *entry,
+                        virLeaseDBField field)
+{
+    switch (field) {
+    case VIR_LEASE_DB_FIELD_IP:
+        return entry->ip;
+    case VIR_LEASE_DB_FIELD_MAC:
+        return entry->mac;
+    case VIR_LEASE_DB_FIELD_HOSTNAME:
+        return entry->hostname;
+    case VIR_LEASE_DB_FIELD_CLIENTID:
+        return entry->clientid;
+    case VIR_LEASE_DB_FIELD_IAID:
+        return entry->iaid;
+    case VIR_LEASE_DB_FIELD_SERVERDUID:
+        return entry->serverduid;
+    case VIR_LEASE_DB_FIELD_LAST:
+        break;
+    }
+
+    return NULL;
+}
+
+
+/* FNV-1a; MAC addresses are compared case insensitively */
+static uint32_t
+virLeaseDBHash(virLeaseDBKey key,
+               const char *value)
+{
+    uint32_t hash = 2166136261U;
+
+    for (; *value; value++) {
+        unsigned char c = *value;
+
+        if (key == VIR_LEASE_DB_KEY_MAC)
+            c = c_tolower(c);
+        hash = (hash ^ c) * 16777619U;
+    }
+
+    return hash;
+}
+
+
+static bool
+virLeaseDBKeyEqual(virLeaseDBKey key,
+                   const char *a,
+                   const char *b)
+{
+    if (key == VIR_LEASE_DB_KEY_MAC)
+        return STRCASEEQ(a, b);
+    return STREQ(a, b);
+}
+
+
+static void
+virLeaseDBUnmap(virLeaseDBPtr db)
+{
+    if (!db->data)
+        return;
+
+#if HAVE_MMAP
+    if (db->mapped)
+        munmap(db->data, db->len);
+    else
+#endif
+        VIR_FREE(db->data);
+
+    db->data = NULL;
+    db->len = 0;
+    db->mapped = false;
+}
+
+
+/* (Re)load the current contents of the database file */
+static int
+virLeaseDBMap(virLeaseDBPtr db)
+{
+    struct stat sb;
+
+    virLeaseDBUnmap(db);
+
+    if (fstat(db->fd, &sb) < 0) {
+        virReportSystemError(errno, _("cannot stat lease database '%s'"),
+                             db->path);
+        return -1;
+    }
+
+    if (sb.st_size > VIR_LEASE_DB_FILE_SIZE_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("lease database '%s' is too large"), db->path);
+        return -1;
+    }
+
+    if (sb.st_size == 0)
+        return 0;
+
+#if HAVE_MMAP
+    db->data = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, db->fd, 0);
+    if (db->data != MAP_FAILED) {
+        db->len = sb.st_size;
+        db->mapped = true;
+        return 0;
+    }
+    db->data = NULL;
+#endif
+
+    /* fall back to reading the file into memory */
+    if (VIR_ALLOC_N(db->data, sb.st_size) < 0)
+        return -1;
+
+    if (lseek(db->fd, 0, SEEK_SET) < 0 ||
+        saferead(db->fd, db->data, sb.st_size) != sb.st_size) {
+        virReportSystemError(errno, _("cannot read lease database '%s'"),
+                             db->path);
+        VIR_FREE(db->data);
+        return -1;
+    }
+    db->len = sb.st_size;
+
+    return 0;
+}
+
+
+static int
+virLeaseDBCheck(virLeaseDBPtr db)
+{
+    const virLeaseDBHeader *hdr = virLeaseDBGetHeader(db);
+
+    if (db->len < sizeof(*hdr) ||
+        memcmp(hdr->magic, VIR_LEASE_DB_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != VIR_LEASE_DB_VERSION ||
+        hdr->nbuckets < VIR_LEASE_DB_MIN_BUCKETS ||
+        hdr->nbuckets > VIR_LEASE_DB_MAX_BUCKETS ||
+        (hdr->nbuckets & (hdr->nbuckets - 1)) != 0 ||
+        hdr->end < virLeaseDBRecordsStart(hdr->nbuckets) ||
+        hdr->end > db->len) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("invalid lease database '%s'"), db->path);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Returns 0 on success, 1 if the record at @off was appended after
+ * the file was loaded and -1 if it is invalid.
+ */
+static int
+virLeaseDBReadRecord(virLeaseDBPtr db,
+                     uint64_t off,
+                     const virLeaseDBRecord **rec,
+                     virLeaseDBEntryPtr entry)
+{
+    const virLeaseDBRecord *r;
+    const char *fields[VIR_LEASE_DB_FIELD_LAST];
+    const char *p;
+    size_t left;
+    size_t i;
+
+    if (off < virLeaseDBRecordsStart(virLeaseDBGetHeader(db)->nbuckets) ||
+        off % 8 != 0)
+        goto corrupt;
+
+    if (off > db->len - sizeof(*r))
+        return 1;
+
+    r = (const virLeaseDBRecord *) (db->data + off);
+    if (r->size < sizeof(*r))
+        goto corrupt;
+    if (r->size > db->len - off)
+        return 1;
+
+    p = (const char *) (r + 1);
+    left = r->size - sizeof(*r);
+    for (i = 0; i < VIR_LEASE_DB_FIELD_LAST; i++) {
+        if (r->len[i] == 0) {
+            fields[i] = NULL;
+            continue;
+        }
+
+        if (r->len[i] > left || p[r->len[i] - 1] != '\0')
+            goto corrupt;
+
+        fields[i] = p;
+        p += r->len[i];
+        left -= r->len[i];
+    }
+
+    entry->expirytime = r->expirytime;
+    entry->ip = fields[VIR_LEASE_DB_FIELD_IP];
+    entry->mac = fields[VIR_LEASE_DB_FIELD_MAC];
+    entry->hostname = fields[VIR_LEASE_DB_FIELD_HOSTNAME];
+    entry->clientid = fields[VIR_LEASE_DB_FIELD_CLIENTID];
+    entry->iaid = fields[VIR_LEASE_DB_FIELD_IAID];
+    entry->serverduid = fields[VIR_LEASE_DB_FIELD_SERVERDUID];
+    *rec = r;
+
+    return 0;
+
+ corrupt:
+    virReportError(VIR_ERR_INTERNAL_ERROR,
+                   _("corrupted lease database '%s' at offset %llu"),
+                   db->path, (unsigned long long) off);
+    return -1;
+}
+
+
+/* Serialize @entry, with all its chain links cleared */
+static char *
+virLeaseDBRecordFormat(const virLeaseDBEntry *entry,
+                       size_t *size)
+{
+    virLeaseDBRecord rec;
+    char *buf;
+    char *p;
+    size_t i;
+
+    if (!entry->ip) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("a lease needs an IP address"));
+        return NULL;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    *size = sizeof(rec);
+    for (i = 0; i < VIR_LEASE_DB_FIELD_LAST; i++) {
+        const char *value = virLeaseDBEntryGetField(entry, i);
+        size_t len;
+
+        if (!value)
+            continue;
+
+        if ((len = strlen(value) + 1) > UINT16_MAX) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("lease field '%.32s...' is too long"), value);
+            return NULL;
+        }
+        rec.len[i] = len;
+        *size += len;
+    }
+    *size = VIR_ROUND_UP(*size, 8);
+    rec.size = *size;
+    rec.expirytime = entry->expirytime;
+
+    if (VIR_ALLOC_N(buf, *size) < 0)
+        return NULL;
+
+    memcpy(buf, &rec, sizeof(rec));
+    p = buf + sizeof(rec);
+    for (i = 0; i < VIR_LEASE_DB_FIELD_LAST; i++) {
+        if (rec.len[i]) {
+            memcpy(p, virLeaseDBEntryGetField(entry, i), rec.len[i]);
+            p += rec.len[i];
+        }
+    }
+
+    return buf;
+}
+
+
+static int
+virLeaseDBWriteAt(virLeaseDBPtr db,
+                  int fd,
+                  uint64_t off,
+                  const void *buf,
+                  size_t len)
+{
+    if (lseek(fd, off, SEEK_SET) < 0 ||
+        safewrite(fd, buf, len) != (ssize_t) len) {
+        virReportSystemError(errno, _("cannot write lease database '%s'"),
+                             db->path);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* Start an empty database in memory */
+static int
+virLeaseDBImageInit(virLeaseDBImage *image,
+                    uint32_t nbuckets)
+{
+    virLeaseDBHeader *hdr;
+
+    image->len = virLeaseDBRecordsStart(nbuckets);
+    if (VIR_ALLOC_N(image->data, image->len) < 0)
+        return -1;
+
+    hdr = (virLeaseDBHeader *) image->data;
+    memcpy(hdr->magic, VIR_LEASE_DB_MAGIC, sizeof(hdr->magic));
+    hdr->version = VIR_LEASE_DB_VERSION;
+    hdr->nbuckets = nbuckets;
+    hdr->end = image->len;
+
+    return 0;
+}
+
+
+static int
+virLeaseDBImageAppend(const virLeaseDBEntry *entry,
+                      void *opaque)
+{
+    virLeaseDBImage *image = opaque;
+    virLeaseDBHeader *hdr;
+    virLeaseDBRecord *rec;
+    uint64_t *head;
+    char *buf;
+    size_t size;
+    size_t i;
+
+    if (!(buf = virLeaseDBRecordFormat(entry, &size)))
+        return -1;
+
+    if (VIR_REALLOC_N(image->data, image->len + size) < 0) {
+        VIR_FREE(buf);
+        return -1;
+    }
+
+    memcpy(image->data + image->len, buf, size);
+    VIR_FREE(buf);
+
+    hdr = (virLeaseDBHeader *) image->data;
+    rec = (virLeaseDBRecord *) (image->data + image->len);
+    for (i = 0; i < VIR_LEASE_DB_KEY_LAST; i++) {
+        const char *value = virLeaseDBEntryGetField(entry, i);
+        uint32_t bucket;
+
+        if (!value)
+            continue;
+
+        bucket = virLeaseDBHash(i, value) & (hdr->nbuckets - 1);
+        head = (uint64_t *) (image->data +
+                             virLeaseDBHeadOffset(hdr->nbuckets, i, bucket));
+        rec->next[i] = *head;
+        *head = image->len;
+    }
+
+    image->len += size;
+    hdr->end = image->len;
+    hdr->nlive++;
+
+    return 0;
+}
+
+
+static int
+virLeaseDBOpenLocked(virLeaseDBPtr db)
+{
+    struct stat fdsb, pathsb;
+
+    /* a compaction renames a new file over the one we may be waiting
+     * on, so retry until the locked file is the current one
+     */
+    for (;;) {
+        int rc;
+
+        if ((db->fd = open(db->path, O_RDWR | O_CREAT | O_CLOEXEC,
+                           0644)) < 0) {
+            virReportSystemError(errno,
+                                 _("cannot open lease database '%s'"),
+                                 db->path);
+            return -1;
+        }
+
+        if ((rc = virFileLock(db->fd, false, 0, 0, true)) < 0) {
+            virReportSystemError(-rc, _("cannot lock lease database '%s'"),
+                                 db->path);
+            return -1;
+        }
+
+        if (fstat(db->fd, &fdsb) < 0) {
+            virReportSystemError(errno,
+                                 _("cannot stat lease database '%s'"),
+                                 db->path);
+            return -1;
+        }
+
+        if (stat(db->path, &pathsb) == 0 &&
+            pathsb.st_dev == fdsb.st_dev &&
+            pathsb.st_ino == fdsb.st_ino)
+            break;
+
+        VIR_FORCE_CLOSE(db->fd);
+    }
+
+    if (fdsb.st_size == 0) {
+        virLeaseDBImage image;
+        int ret;
+
+        if (virLeaseDBImageInit(&image, VIR_LEASE_DB_MIN_BUCKETS) < 0)
+            return -1;
+        ret = virLeaseDBWriteAt(db, db->fd, 0, image.data, image.len);
+        VIR_FREE(image.data);
+        if (ret < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virLeaseDBOpen:
+ * @db: filled with the database
+ * @path: path of the database file
+ * @flags: bitwise-OR of virLeaseDBOpenFlags
+ *
+ * Open the lease database at @path.  With VIR_LEASE_DB_OPEN_WRITE
+ * the database is created if it doesn't exist yet, and exclusively
+ * locked until virLeaseDBFree() so that it can be modified.
+ * Otherwise it is opened read-only, without any lock, and a
+ * missing file is not an error.
+ *
+ * Returns 1 if the database was opened, 0 if it doesn't exist (and
+ * read-only access was requested) and -1 on error.
+ */
+int
+virLeaseDBOpen(virLeaseDBPtr *db,
+               const char *path,
+               unsigned int flags)
+{
+    virLeaseDBPtr ret = NULL;
+
+    virCheckFlags(VIR_LEASE_DB_OPEN_WRITE, -1);
+
+    *db = NULL;
+
+    if (VIR_ALLOC(ret) < 0)
+        return -1;
+    ret->fd = -1;
+    ret->writable = !!(flags & VIR_LEASE_DB_OPEN_WRITE);
+
+    if (VIR_STRDUP(ret->path, path) < 0)
+        goto error;
+
+    if (ret->writable) {
+        if (virLeaseDBOpenLocked(ret) < 0)
+            goto error;
+    } else if ((ret->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        if (errno == ENOENT) {
+            virLeaseDBFree(ret);
+            return 0;
+        }
+        virReportSystemError(errno, _("cannot open lease database '%s'"),
+                             path);
+        goto error;
+    }
+
+    if (virLeaseDBMap(ret) < 0 ||
+        virLeaseDBCheck(ret) < 0)
+        goto error;
+
+    *db = ret;
+    return 1;
+
+ error:
+    virLeaseDBFree(ret);
+    return -1;
+}
+
+
+void
+virLeaseDBFree(virLeaseDBPtr db)
+{
+    if (!db)
+        return;
+
+    virLeaseDBUnmap(db);
+    VIR_FORCE_CLOSE(db->fd);
+    VIR_FREE(db->path);
+    VIR_FREE(db);
+}
+
+
+/**
+ * virLeaseDBIsEmpty:
+ * @db: the database
+ *
+ * Returns true if no lease was ever stored in @db.
+ */
+bool
+virLeaseDBIsEmpty(virLeaseDBPtr db)
+{
+    const virLeaseDBHeader *hdr = virLeaseDBGetHeader(db);
+
+    return hdr->nlive == 0 && hdr->ndead == 0;
+}
+
+
+/**
+ * virLeaseDBLookup:
+ * @db: the database
+ * @key: which field to look at
+ * @value: the value to look for
+ * @iter: called for each live lease whose @key field matches @value
+ * @opaque: passed to @iter
+ *
+ * Only the leases of one hash bucket are visited, from the most
+ * recently stored one to the oldest.  MAC addresses are compared
+ * case insensitively.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virLeaseDBLookup(virLeaseDBPtr db,
+                 virLeaseDBKey key,
+                 const char *value,
+                 virLeaseDBIterator iter,
+                 void *opaque)
+{
+    const virLeaseDBHeader *hdr = virLeaseDBGetHeader(db);
+    uint32_t bucket = virLeaseDBHash(key, value) & (hdr->nbuckets - 1);
+    uint64_t off = virLeaseDBGetHead(db, key, bucket);
+
+    while (off) {
+        const virLeaseDBRecord *rec;
+        virLeaseDBEntry entry;
+        const char *field;
+        int rc;
+
+        /* a lease stored since we loaded the file, and thus all
+         * older ones of this chain as well, will be seen next time
+         */
+        if ((rc = virLeaseDBReadRecord(db, off, &rec, &entry)) < 0)
+            return -1;
+        if (rc > 0)
+            break;
+
+        field = virLeaseDBEntryGetField(&entry, key);
+        if (!(rec->flags & VIR_LEASE_DB_RECORD_DEAD) &&
+            field && virLeaseDBKeyEqual(key, field, value)) {
+            if ((rc = iter(&entry, opaque)) < 0)
+                return -1;
+            if (rc > 0)
+                break;
+        }
+
+        /* chains always go back in the file, which also protects
+         * against loops in a damaged one
+         */
+        if (rec->next[key] >= off)
+            break;
+        off = rec->next[key];
+    }
+
+    return 0;
+}
+
+
+/**
+ * virLeaseDBForEach:
+ * @db: the database
+ * @iter: called for each live lease
+ * @opaque: passed to @iter
+ *
+ * Leases are visited in the order they were stored.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virLeaseDBForEach(virLeaseDBPtr db,
+                  virLeaseDBIterator iter,
+                  void *opaque)
+{
+    const virLeaseDBHeader *hdr = virLeaseDBGetHeader(db);
+    uint64_t off = virLeaseDBRecordsStart(hdr->nbuckets);
+    uint64_t end = hdr->end;
+
+    while (off < end) {
+        const virLeaseDBRecord *rec;
+        virLeaseDBEntry entry;
+        int rc;
+
+        if ((rc = virLeaseDBReadRecord(db, off, &rec, &entry)) < 0)
+            return -1;
+        if (rc > 0)
+            break;
+
+        if (!(rec->flags & VIR_LEASE_DB_RECORD_DEAD)) {
+            if ((rc = iter(&entry, opaque)) < 0)
+                return -1;
+            if (rc > 0)
+                break;
+        }
+
+        off += rec->size;
+    }
+
+    return 0;
+}
+
+
+static int
+virLeaseDBCheckWritable(virLeaseDBPtr db)
+{
+    if (!db->writable) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("lease database '%s' is opened read-only"),
+                       db->path);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* Mark every live lease for @ip as dead, accounting for it in @hdr */
+static int
+virLeaseDBKill(virLeaseDBPtr db,
+               const char *ip,
+               virLeaseDBHeader *hdr)
+{
+    uint32_t bucket = virLeaseDBHash(VIR_LEASE_DB_KEY_IP, ip) &
+        (hdr->nbuckets - 1);
+    uint64_t off = virLeaseDBGetHead(db, VIR_LEASE_DB_KEY_IP, bucket);
+
+    while (off) {
+        const virLeaseDBRecord *rec;
+        virLeaseDBEntry entry;
+        int rc;
+
+        if ((rc = virLeaseDBReadRecord(db, off, &rec, &entry)) < 0)
+            return -1;
+        if (rc > 0)
+            break;
+
+        if (!(rec->flags & VIR_LEASE_DB_RECORD_DEAD) &&
+            STREQ(entry.ip, ip)) {
+            uint32_t flags = rec->flags | VIR_LEASE_DB_RECORD_DEAD;
+
+            if (virLeaseDBWriteAt(db, db->fd,
+                                  off + offsetof(virLeaseDBRecord, flags),
+                                  &flags, sizeof(flags)) < 0)
+                return -1;
+            hdr->nlive--;
+            hdr->ndead++;
+        }
+
+        if (rec->next[VIR_LEASE_DB_KEY_IP] >= off)
+            break;
+        off = rec->next[VIR_LEASE_DB_KEY_IP];
+    }
+
+    return 0;
+}
+
+
+static bool
+virLeaseDBNeedsCompaction(const virLeaseDBHeader *hdr)
+{
+    if (hdr->ndead >= VIR_LEASE_DB_COMPACT_MIN_DEAD &&
+        hdr->ndead > hdr->nlive)
+        return true;
+
+    /* grow the index once chains get long */
+    return hdr->nlive > 2 * hdr->nbuckets &&
+        hdr->nbuckets < VIR_LEASE_DB_MAX_BUCKETS;
+}
+
+
+/* Write the updated header, and compact the database if worth it */
+static int
+virLeaseDBCommit(virLeaseDBPtr db,
+                 const virLeaseDBHeader *hdr)
+{
+    if (virLeaseDBWriteAt(db, db->fd, 0, hdr, sizeof(*hdr)) < 0 ||
+        virLeaseDBMap(db) < 0)
+        return -1;
+
+    if (virLeaseDBNeedsCompaction(hdr))
+        return virLeaseDBCompact(db);
+
+    return 0;
+}
+
+
+/**
+ * virLeaseDBAdd:
+ * @db: the database, opened for writing
+ * @entry: the lease to store
+ *
+ * Append @entry to the database, replacing any lease for the same
+ * IP address.  The strings are copied.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virLeaseDBAdd(virLeaseDBPtr db,
+              const virLeaseDBEntry *entry)
+{
+    virLeaseDBHeader hdr;
+    virLeaseDBRecord *rec;
+    uint64_t off;
+    char *buf = NULL;
+    size_t size;
+    size_t i;
+    int ret = -1;
+
+    if (virLeaseDBCheckWritable(db) < 0)
+        return -1;
+
+    if (!(buf = virLeaseDBRecordFormat(entry, &size)))
+        return -1;
+
+    memcpy(&hdr, virLeaseDBGetHeader(db), sizeof(hdr));
+
+    if (virLeaseDBKill(db, entry->ip, &hdr) < 0)
+        goto cleanup;
+
+    off = hdr.end;
+    if (off + size > VIR_LEASE_DB_FILE_SIZE_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("lease database '%s' is full"), db->path);
+        goto cleanup;
+    }
+
+    rec = (virLeaseDBRecord *) buf;
+    for (i = 0; i < VIR_LEASE_DB_KEY_LAST; i++) {
+        const char *value = virLeaseDBEntryGetField(entry, i);
+
+        if (value)
+            rec->next[i] = virLeaseDBGetHead(db, i,
+                                             virLeaseDBHash(i, value) &
+                                             (hdr.nbuckets - 1));
+    }
+
+    /* the record must be complete before anything points at it */
+    if (virLeaseDBWriteAt(db, db->fd, off, buf, size) < 0)
+        goto cleanup;
+
+    for (i = 0; i < VIR_LEASE_DB_KEY_LAST; i++) {
+        const char *value = virLeaseDBEntryGetField(entry, i);
+        uint32_t bucket;
+
+        if (!value)
+            continue;
+
+        bucket = virLeaseDBHash(i, value) & (hdr.nbuckets - 1);
+        if (virLeaseDBWriteAt(db, db->fd,
+                              virLeaseDBHeadOffset(hdr.nbuckets, i, bucket),
+                              &off, sizeof(off)) < 0)
+            goto cleanup;
+    }
+
+    hdr.end += size;
+    hdr.nlive++;
+
+    ret = virLeaseDBCommit(db, &hdr);
+
+ cleanup:
+    VIR_FREE(buf);
+    return ret;
+}
+
+
+/**
+ * virLeaseDBRemove:
+ * @db: the database, opened for writing
+ * @ip: IP address of the lease
+ *
+ * Remove the lease for @ip, if there's one.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virLeaseDBRemove(virLeaseDBPtr db,
+                 const char *ip)
+{
+    virLeaseDBHeader hdr;
+
+    if (virLeaseDBCheckWritable(db) < 0)
+        return -1;
+
+    memcpy(&hdr, virLeaseDBGetHeader(db), sizeof(hdr));
+
+    if (virLeaseDBKill(db, ip, &hdr) < 0)
+        return -1;
+
+    if (hdr.ndead == virLeaseDBGetHeader(db)->ndead)
+        return 0;
+
+    return virLeaseDBCommit(db, &hdr);
+}
+
+
+/**
+ * virLeaseDBCompact:
+ * @db: the database, opened for writing
+ *
+ * Rewrite the database with only its live leases, and an index
+ * sized for them.  This is done automatically by virLeaseDBAdd()
+ * and virLeaseDBRemove() when needed.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virLeaseDBCompact(virLeaseDBPtr db)
+{
+    const virLeaseDBHeader *hdr = virLeaseDBGetHeader(db);
+    uint32_t nbuckets = VIR_LEASE_DB_MIN_BUCKETS;
+    virLeaseDBImage image = { NULL, 0 };
+    char *tmp = NULL;
+    int fd = -1;
+    int rc;
+    int ret = -1;
+
+    if (virLeaseDBCheckWritable(db) < 0)
+        return -1;
+
+    while (nbuckets < hdr->nlive && nbuckets < VIR_LEASE_DB_MAX_BUCKETS)
+        nbuckets *= 2;
+
+    VIR_DEBUG("Compacting lease database '%s': %u live, %u dead, "
+              "%u buckets", db->path, hdr->nlive, hdr->ndead, nbuckets);
+
+    if (virLeaseDBImageInit(&image, nbuckets) < 0 ||
+        virLeaseDBForEach(db, virLeaseDBImageAppend, &image) < 0)
+        goto cleanup;
+
+    if (virAsprintf(&tmp, "%s.new", db->path) < 0)
+        goto cleanup;
+
+    if ((fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+        virReportSystemError(errno, _("cannot create lease database '%s'"),
+                             tmp);
+        goto cleanup;
+    }
+
+    /* take the lock before anyone else can see the new file */
+    if ((rc = virFileLock(fd, false, 0, 0, true)) < 0) {
+        virReportSystemError(-rc, _("cannot lock lease database '%s'"), tmp);
+        goto cleanup;
+    }
+
+    if (virLeaseDBWriteAt(db, fd, 0, image.data, image.len) < 0)
+        goto cleanup;
+
+    if (fsync(fd) < 0) {
+        virReportSystemError(errno, _("cannot sync lease database '%s'"),
+                             tmp);
+        goto cleanup;
+    }
+
+    if (rename(tmp, db->path) < 0) {
+        virReportSystemError(errno,
+                             _("cannot rename lease database '%s' to '%s'"),
+                             tmp, db->path);
+        goto cleanup;
+    }
+
+    /* closing the old file releases its lock, waiting writers notice
+     * the rename and move on to the new file
+     */
+    VIR_FORCE_CLOSE(db->fd);
+    db->fd = fd;
+    fd = -1;
+
+    if (virLeaseDBMap(db) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    if (fd >= 0) {
+        VIR_FORCE_CLOSE(fd);
+        unlink(tmp);
+    }
+    VIR_FREE(tmp);
+    VIR_FREE(image.data);
+    return ret;
+}
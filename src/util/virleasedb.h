@@ -0,0 +1,96 @@
+/*
+ * virleasedb.h: indexed DHCP lease database
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_LEASEDB_H__
+# define __VIR_LEASEDB_H__
+
+# include "internal.h"
+
+# define VIR_LEASE_DB_SUFFIX ".leasedb"
+
+typedef struct _virLeaseDB virLeaseDB;
+typedef virLeaseDB *virLeaseDBPtr;
+
+/* The fields a lease can be looked up by */
+typedef enum {
+    VIR_LEASE_DB_KEY_IP,
+    VIR_LEASE_DB_KEY_MAC,
+    VIR_LEASE_DB_KEY_HOSTNAME,
+
+    VIR_LEASE_DB_KEY_LAST
+} virLeaseDBKey;
+
+typedef struct _virLeaseDBEntry virLeaseDBEntry;
+typedef virLeaseDBEntry *virLeaseDBEntryPtr;
+struct _virLeaseDBEntry {
+    long long expirytime;
+    const char *ip;
+    const char *mac;
+    const char *hostname;
+    const char *clientid;
+    const char *iaid;
+    const char *serverduid;
+};
+
+/**
+ * virLeaseDBIterator:
+ * @entry: a live lease, only valid for the duration of the call
+ * @opaque: data passed by the caller
+ *
+ * Returns 0 to continue the iteration, 1 to stop it and -1 on
+ * error (which stops it as well).
+ */
+typedef int (*virLeaseDBIterator)(const virLeaseDBEntry *entry,
+                                  void *opaque);
+
+typedef enum {
+    VIR_LEASE_DB_OPEN_WRITE = (1 << 0), /* create the database if needed */
+} virLeaseDBOpenFlags;
+
+int virLeaseDBOpen(virLeaseDBPtr *db,
+                   const char *path,
+                   unsigned int flags)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+void virLeaseDBFree(virLeaseDBPtr db);
+
+bool virLeaseDBIsEmpty(virLeaseDBPtr db);
+
+int virLeaseDBLookup(virLeaseDBPtr db,
+                     virLeaseDBKey key,
+                     const char *value,
+                     virLeaseDBIterator iter,
+                     void *opaque)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4);
+int virLeaseDBForEach(virLeaseDBPtr db,
+                      virLeaseDBIterator iter,
+                      void *opaque)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+int virLeaseDBAdd(virLeaseDBPtr db,
+                  const virLeaseDBEntry *entry)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+int virLeaseDBRemove(virLeaseDBPtr db,
+                     const char *ip)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+int virLeaseDBCompact(virLeaseDBPtr db)
+    ATTRIBUTE_NONNULL(1);
+
+#endif /* __VIR_LEASEDB_H__ */
@@ -88,7 +88,7 @@ struct _virLogFilter {
     unsigned int flags;
 };
 
-static int virLogFiltersSerial = 1;
+unsigned int virLogFiltersSerial = 1;
 static virLogFilterPtr *virLogFilters;
 static size_t virLogNbFilters;
 
@@ -117,6 +117,7 @@ static virLogPriority virLogDefaultPriority = VIR_LOG_DEFAULT;
 
 static void virLogResetFilters(void);
 static void virLogResetOutputs(void);
+static void virLogQueueFlush(void);
 static void virLogOutputToFd(virLogSourcePtr src,
                              virLogPriority priority,
                              const char *filename,
@@ -135,16 +136,60 @@ static void virLogOutputToFd(virLogSourcePtr src,
  */
 virMutex virLogMutex;
 
+/*
+ * With asynchronous logging enabled, messages are queued for a writer
+ * thread instead of being written to the outputs by the thread logging
+ * them, which then only holds virLogQueueMutex for as long as it takes
+ * to append the message. Errors, and messages which want a stack trace,
+ * are still written right away, once the messages queued before them
+ * are. The queue is bounded, messages logged while it is full are
+ * dropped and counted.
+ *
+ * When both mutexes are needed, virLogMutex is the one to take first.
+ */
+typedef struct _virLogQueuedMessage virLogQueuedMessage;
+typedef virLogQueuedMessage *virLogQueuedMessagePtr;
+struct _virLogQueuedMessage {
+    virLogQueuedMessagePtr next;
+
+    virLogSourcePtr source;
+    virLogPriority priority;
+    const char *filename;
+    int linenr;
+    const char *funcname;
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+    virLogMetadataPtr metadata;
+    unsigned int flags;
+    char *str;
+    char *msg;
+};
+
+static virMutex virLogQueueMutex;
+static virCond virLogQueueCond;
+static virLogQueuedMessagePtr virLogQueueHead;
+static virLogQueuedMessagePtr virLogQueueTail;
+static size_t virLogQueueLength;
+static size_t virLogQueueMaxLength; /* 0 when logging synchronously */
+static unsigned long long virLogQueueDropped;
+static bool virLogQueueRunning;
+static bool virLogQueueQuit;
+static pid_t virLogQueuePid; /* of the process running the writer */
+static virThread virLogQueueWriter;
+
+/* Holding both mutexes makes it safe to fork while other threads are
+ * logging */
 void
 virLogLock(void)
 {
     virMutexLock(&virLogMutex);
+    virMutexLock(&virLogQueueMutex);
 }
 
 
 void
 virLogUnlock(void)
 {
+    virMutexUnlock(&virLogQueueMutex);
     virMutexUnlock(&virLogMutex);
 }
 
@@ -259,7 +304,9 @@ virLogPriorityString(virLogPriority lvl)
 static int
 virLogOnceInit(void)
 {
-    if (virMutexInit(&virLogMutex) < 0)
+    if (virMutexInit(&virLogMutex) < 0 ||
+        virMutexInit(&virLogQueueMutex) < 0 ||
+        virCondInit(&virLogQueueCond) < 0)
         return -1;
 
     virLogLock();
@@ -321,6 +368,7 @@ virLogSetDefaultPriority(virLogPriority priority)
         return -1;
 
     virLogDefaultPriority = priority;
+    virLogFiltersSerial++;
     return 0;
 }
 
@@ -380,6 +428,7 @@ virLogFilterListFree(virLogFilterPtr *list, int count)
 static void
 virLogResetOutputs(void)
 {
+    virLogQueueFlush();
     virLogOutputListFree(virLogOutputs, virLogNbOutputs);
     virLogOutputs = NULL;
     virLogNbOutputs = 0;
@@ -542,6 +591,390 @@ virLogMessage(virLogSourcePtr source,
 }
 
 
+/*
+ * Push the message to the outputs defined, if none exist then use
+ * stderr. Must be called with virLogMutex held.
+ */
+static bool virLogInitMessageStderr = true;
+
+static void
+virLogOutputMessage(virLogSourcePtr source,
+                    virLogPriority priority,
+                    const char *filename,
+                    int linenr,
+                    const char *funcname,
+                    const char *timestamp,
+                    virLogMetadataPtr metadata,
+                    unsigned int filterflags,
+                    const char *str,
+                    const char *msg)
+{
+    size_t i;
+
+    for (i = 0; i < virLogNbOutputs; i++) {
+        if (priority >= virLogOutputs[i]->priority) {
+            if (virLogOutputs[i]->logInitMessage) {
+                const char *rawinitmsg;
+                char *hoststr = NULL;
+                char *initmsg = NULL;
+                if (virLogVersionString(&rawinitmsg, &initmsg) >= 0)
+                    virLogOutputs[i]->f(&virLogSelf, VIR_LOG_INFO,
+                                       __FILE__, __LINE__, __func__,
+                                       timestamp, NULL, 0, rawinitmsg, initmsg,
+                                       virLogOutputs[i]->data);
+                VIR_FREE(initmsg);
+                if (virLogHostnameString(&hoststr, &initmsg) >= 0)
+                    virLogOutputs[i]->f(&virLogSelf, VIR_LOG_INFO,
+                                       __FILE__, __LINE__, __func__,
+                                       timestamp, NULL, 0, hoststr, initmsg,
+                                       virLogOutputs[i]->data);
+                VIR_FREE(hoststr);
+                VIR_FREE(initmsg);
+                virLogOutputs[i]->logInitMessage = false;
+            }
+            virLogOutputs[i]->f(source, priority,
+                               filename, linenr, funcname,
+                               timestamp, metadata, filterflags,
+                               str, msg, virLogOutputs[i]->data);
+        }
+    }
+    if (virLogNbOutputs == 0) {
+        if (virLogInitMessageStderr) {
+            const char *rawinitmsg;
+            char *hoststr = NULL;
+            char *initmsg = NULL;
+            if (virLogVersionString(&rawinitmsg, &initmsg) >= 0)
+                virLogOutputToFd(&virLogSelf, VIR_LOG_INFO,
+                                 __FILE__, __LINE__, __func__,
+                                 timestamp, NULL, 0, rawinitmsg, initmsg,
+                                 (void *) STDERR_FILENO);
+            VIR_FREE(initmsg);
+            if (virLogHostnameString(&hoststr, &initmsg) >= 0)
+                virLogOutputToFd(&virLogSelf, VIR_LOG_INFO,
+                                 __FILE__, __LINE__, __func__,
+                                 timestamp, NULL, 0, hoststr, initmsg,
+                                 (void *) STDERR_FILENO);
+            VIR_FREE(hoststr);
+            VIR_FREE(initmsg);
+            virLogInitMessageStderr = false;
+        }
+        virLogOutputToFd(source, priority,
+                         filename, linenr, funcname,
+                         timestamp, metadata, filterflags,
+                         str, msg, (void *) STDERR_FILENO);
+    }
+}
+
+
+static void
+virLogMetadataFree(virLogMetadataPtr metadata)
+{
+    size_t i;
+
+    if (!metadata)
+        return;
+
+    for (i = 0; metadata[i].key; i++) {
+        char *s = (char *) metadata[i].s;
+        VIR_FREE(s);
+    }
+    VIR_FREE(metadata);
+}
+
+
+/* The keys are expected to be string literals, only the string
+ * values are copied */
+static int
+virLogMetadataCopy(virLogMetadataPtr *dst,
+                   virLogMetadataPtr src)
+{
+    size_t n = 0;
+    size_t i;
+
+    *dst = NULL;
+    if (!src)
+        return 0;
+
+    while (src[n].key)
+        n++;
+
+    if (VIR_ALLOC_N_QUIET(*dst, n + 1) < 0)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        char *tmp = NULL;
+
+        if (VIR_STRDUP_QUIET(tmp, src[i].s) < 0) {
+            virLogMetadataFree(*dst);
+            *dst = NULL;
+            return -1;
+        }
+        (*dst)[i].key = src[i].key;
+        (*dst)[i].s = tmp;
+        (*dst)[i].iv = src[i].iv;
+    }
+
+    return 0;
+}
+
+
+static void
+virLogQueuedMessageFree(virLogQueuedMessagePtr entry)
+{
+    if (!entry)
+        return;
+
+    virLogMetadataFree(entry->metadata);
+    VIR_FREE(entry->str);
+    VIR_FREE(entry->msg);
+    VIR_FREE(entry);
+}
+
+
+/*
+ * Queue a message for the writer thread, taking @str and @msg over.
+ *
+ * Returns 0 if the message was queued or dropped, -1 if the caller has
+ * to write it.
+ */
+static int
+virLogQueueMessage(virLogSourcePtr source,
+                   virLogPriority priority,
+                   const char *filename,
+                   int linenr,
+                   const char *funcname,
+                   const char *timestamp,
+                   virLogMetadataPtr metadata,
+                   unsigned int filterflags,
+                   char **str,
+                   char **msg)
+{
+    virLogQueuedMessagePtr entry;
+
+    if (!virLogQueueMaxLength ||
+        priority >= VIR_LOG_ERROR ||
+        (filterflags & VIR_LOG_STACK_TRACE))
+        return -1;
+
+    if (VIR_ALLOC_QUIET(entry) < 0)
+        return -1;
+
+    if (virLogMetadataCopy(&entry->metadata, metadata) < 0) {
+        VIR_FREE(entry);
+        return -1;
+    }
+
+    entry->source = source;
+    entry->priority = priority;
+    entry->filename = filename;
+    entry->linenr = linenr;
+    entry->funcname = funcname;
+    ignore_value(virStrcpyStatic(entry->timestamp, timestamp));
+    entry->flags = filterflags;
+
+    virMutexLock(&virLogQueueMutex);
+
+    /* Stopped meanwhile */
+    if (!virLogQueueMaxLength) {
+        virMutexUnlock(&virLogQueueMutex);
+        virLogQueuedMessageFree(entry);
+        return -1;
+    }
+
+    if (virLogQueueLength >= virLogQueueMaxLength) {
+        virLogQueueDropped++;
+        virMutexUnlock(&virLogQueueMutex);
+        virLogQueuedMessageFree(entry);
+        return 0;
+    }
+
+    entry->str = *str;
+    entry->msg = *msg;
+    *str = NULL;
+    *msg = NULL;
+
+    if (virLogQueueTail)
+        virLogQueueTail->next = entry;
+    else
+        virLogQueueHead = entry;
+    virLogQueueTail = entry;
+
+    if (virLogQueueLength++ == 0)
+        virCondSignal(&virLogQueueCond);
+
+    virMutexUnlock(&virLogQueueMutex);
+    return 0;
+}
+
+
+/* Must be called with virLogQueueMutex held */
+static virLogQueuedMessagePtr
+virLogQueueTake(unsigned long long *dropped)
+{
+    virLogQueuedMessagePtr head = virLogQueueHead;
+
+    virLogQueueHead = virLogQueueTail = NULL;
+    virLogQueueLength = 0;
+    *dropped = virLogQueueDropped;
+    virLogQueueDropped = 0;
+
+    return head;
+}
+
+
+/* Must be called with virLogMutex held */
+static void
+virLogQueueWrite(virLogQueuedMessagePtr head,
+                 unsigned long long dropped)
+{
+    virLogQueuedMessagePtr next;
+
+    for (; head; head = next) {
+        next = head->next;
+        virLogOutputMessage(head->source, head->priority,
+                            head->filename, head->linenr, head->funcname,
+                            head->timestamp, head->metadata, head->flags,
+                            head->str, head->msg);
+        virLogQueuedMessageFree(head);
+    }
+
+    if (dropped) {
+        char timestamp[VIR_TIME_STRING_BUFLEN];
+        char *str = NULL;
+        char *msg = NULL;
+
+        if (virTimeStringNowRaw(timestamp) < 0)
+            timestamp[0] = '\0';
+
+        if (virAsprintfQuiet(&str, "Dropped %llu log messages while the "
+                             "queue was full", dropped) >= 0 &&
+            virLogFormatString(&msg, __LINE__, __func__,
+                               VIR_LOG_WARN, str) >= 0)
+            virLogOutputMessage(&virLogSelf, VIR_LOG_WARN,
+                                __FILE__, __LINE__, __func__,
+                                timestamp, NULL, 0, str, msg);
+        VIR_FREE(str);
+        VIR_FREE(msg);
+    }
+}
+
+
+/*
+ * Write the queued messages out, must be called with both virLogMutex
+ * and virLogQueueMutex held.
+ */
+static void
+virLogQueueFlush(void)
+{
+    virLogQueuedMessagePtr head;
+    virLogQueuedMessagePtr next;
+    unsigned long long dropped;
+
+    if (!virLogQueueHead && !virLogQueueDropped && !virLogQueueRunning)
+        return;
+
+    head = virLogQueueTake(&dropped);
+
+    if (virLogQueuePid == getpid()) {
+        virLogQueueWrite(head, dropped);
+        return;
+    }
+
+    /* A child forked while the messages were queued, they're for the
+     * parent to write and there is no writer thread here */
+    for (; head; head = next) {
+        next = head->next;
+        virLogQueuedMessageFree(head);
+    }
+    virLogQueueMaxLength = 0;
+    virLogQueueRunning = false;
+}
+
+
+static void
+virLogQueueWriterMain(void *opaque ATTRIBUTE_UNUSED)
+{
+    virLogQueuedMessagePtr head;
+    unsigned long long dropped;
+
+    virMutexLock(&virLogQueueMutex);
+    while (true) {
+        while (!virLogQueueHead && !virLogQueueQuit)
+            ignore_value(virCondWait(&virLogQueueCond, &virLogQueueMutex));
+
+        if (virLogQueueQuit)
+            break;
+        virMutexUnlock(&virLogQueueMutex);
+
+        virMutexLock(&virLogMutex);
+        virMutexLock(&virLogQueueMutex);
+        head = virLogQueueTake(&dropped);
+        virMutexUnlock(&virLogQueueMutex);
+        virLogQueueWrite(head, dropped);
+        virMutexUnlock(&virLogMutex);
+
+        virMutexLock(&virLogQueueMutex);
+    }
+    virMutexUnlock(&virLogQueueMutex);
+}
+
+
+/**
+ * virLogSetAsync:
+ * @length: maximum number of queued messages, or 0
+ *
+ * Have a dedicated thread write the log messages, so that logging
+ * doesn't make the threads wait for each other and for the outputs.
+ * Errors are still written synchronously. Up to @length messages can
+ * be waiting to be written, any further message is dropped and only
+ * counted. With @length being 0 all messages are written synchronously
+ * again.
+ *
+ * Child processes always log synchronously.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virLogSetAsync(size_t length)
+{
+    bool stop = false;
+    int rc = 0;
+
+    if (virLogInitialize() < 0)
+        return -1;
+
+    virLogLock();
+    if (length && !virLogQueueRunning) {
+        virLogQueueQuit = false;
+        if ((rc = virThreadCreate(&virLogQueueWriter, true,
+                                  virLogQueueWriterMain, NULL)) == 0) {
+            virLogQueuePid = getpid();
+            virLogQueueRunning = true;
+        }
+    } else if (!length && virLogQueueRunning) {
+        virLogQueueFlush();
+        virLogQueueQuit = true;
+        virLogQueueRunning = false;
+        virCondSignal(&virLogQueueCond);
+        stop = true;
+    }
+    if (rc == 0)
+        virLogQueueMaxLength = length;
+    virLogUnlock();
+
+    if (rc < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create log writer thread"));
+        return -1;
+    }
+
+    if (stop)
+        virThreadJoin(&virLogQueueWriter);
+
+    return 0;
+}
+
+
 /**
  * virLogVMessage:
  * @source: where is that message coming from
@@ -566,12 +999,10 @@ virLogVMessage(virLogSourcePtr source,
                const char *fmt,
                va_list vargs)
 {
-    static bool logInitMessageStderr = true;
     char *str = NULL;
     char *msg = NULL;
     char timestamp[VIR_TIME_STRING_BUFLEN];
     int ret;
-    size_t i;
     int saved_errno = errno;
     unsigned int filterflags = 0;
 
@@ -608,65 +1039,24 @@ virLogVMessage(virLogSourcePtr source,
     if (virTimeStringNowRaw(timestamp) < 0)
         timestamp[0] = '\0';
 
-    virLogLock();
+    if (virLogQueueMessage(source, priority, filename, linenr, funcname,
+                           timestamp, metadata, filterflags,
+                           &str, &msg) == 0)
+        goto cleanup;
 
-    /*
-     * Push the message to the outputs defined, if none exist then
-     * use stderr.
-     */
-    for (i = 0; i < virLogNbOutputs; i++) {
-        if (priority >= virLogOutputs[i]->priority) {
-            if (virLogOutputs[i]->logInitMessage) {
-                const char *rawinitmsg;
-                char *hoststr = NULL;
-                char *initmsg = NULL;
-                if (virLogVersionString(&rawinitmsg, &initmsg) >= 0)
-                    virLogOutputs[i]->f(&virLogSelf, VIR_LOG_INFO,
-                                       __FILE__, __LINE__, __func__,
-                                       timestamp, NULL, 0, rawinitmsg, initmsg,
-                                       virLogOutputs[i]->data);
-                VIR_FREE(initmsg);
-                if (virLogHostnameString(&hoststr, &initmsg) >= 0)
-                    virLogOutputs[i]->f(&virLogSelf, VIR_LOG_INFO,
-                                       __FILE__, __LINE__, __func__,
-                                       timestamp, NULL, 0, hoststr, initmsg,
-                                       virLogOutputs[i]->data);
-                VIR_FREE(hoststr);
-                VIR_FREE(initmsg);
-                virLogOutputs[i]->logInitMessage = false;
-            }
-            virLogOutputs[i]->f(source, priority,
-                               filename, linenr, funcname,
-                               timestamp, metadata, filterflags,
-                               str, msg, virLogOutputs[i]->data);
-        }
-    }
-    if (virLogNbOutputs == 0) {
-        if (logInitMessageStderr) {
-            const char *rawinitmsg;
-            char *hoststr = NULL;
-            char *initmsg = NULL;
-            if (virLogVersionString(&rawinitmsg, &initmsg) >= 0)
-                virLogOutputToFd(&virLogSelf, VIR_LOG_INFO,
-                                 __FILE__, __LINE__, __func__,
-                                 timestamp, NULL, 0, rawinitmsg, initmsg,
-                                 (void *) STDERR_FILENO);
-            VIR_FREE(initmsg);
-            if (virLogHostnameString(&hoststr, &initmsg) >= 0)
-                virLogOutputToFd(&virLogSelf, VIR_LOG_INFO,
-                                 __FILE__, __LINE__, __func__,
-                                 timestamp, NULL, 0, hoststr, initmsg,
-                                 (void *) STDERR_FILENO);
-            VIR_FREE(hoststr);
-            VIR_FREE(initmsg);
-            logInitMessageStderr = false;
-        }
-        virLogOutputToFd(source, priority,
-                         filename, linenr, funcname,
-                         timestamp, metadata, filterflags,
-                         str, msg, (void *) STDERR_FILENO);
+    virMutexLock(&virLogMutex);
+
+    /* Keep the order of messages by writing the queued ones first */
+    if (virLogQueueMaxLength) {
+        virMutexLock(&virLogQueueMutex);
+        virLogQueueFlush();
+        virMutexUnlock(&virLogQueueMutex);
     }
-    virLogUnlock();
+
+    virLogOutputMessage(source, priority, filename, linenr, funcname,
+                        timestamp, metadata, filterflags, str, msg);
+
+    virMutexUnlock(&virLogMutex);
 
  cleanup:
     VIR_FREE(str);
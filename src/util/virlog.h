@@ -81,6 +81,32 @@ struct _virLogSource {
         .flags = 0,                                     \
     };
 
+/*
+ * Bumped whenever the filters or the default priority change, which
+ * makes the priority cached by the sources stale.
+ */
+extern unsigned int virLogFiltersSerial;
+
+/*
+ * Check whether a message of @prio from @src may be logged without
+ * calling virLogMessage, so that a disabled message costs a couple of
+ * loads and a branch and its arguments are not even evaluated. A source
+ * whose cached priority is stale always passes, virLogVMessage then
+ * updates it and checks again.
+ *
+ * Like in virLogVMessage the reads are intentionally not thread safe,
+ * worst case a message is dropped or emitted while another thread is
+ * changing the filters.
+ */
+# define VIR_LOG_ENABLED(src, prio)                                      \
+    ((src)->serial < virLogFiltersSerial || (prio) >= (src)->priority)
+
+# define VIR_LOG_MESSAGE_INT(src, prio, filename, linenr, funcname, ...) \
+    (VIR_LOG_ENABLED(src, prio) ?                                       \
+     virLogMessage(src, prio, filename, linenr, funcname, NULL,         \
+                   __VA_ARGS__) :                                       \
+     (void) 0)
+
 /*
  * If configured with --enable-debug=yes then library calls
  * are printed to stderr for debugging or to an appropriate channel
@@ -88,7 +114,7 @@ struct _virLogSource {
  */
 # ifdef ENABLE_DEBUG
 #  define VIR_DEBUG_INT(src, filename, linenr, funcname, ...)           \
-    virLogMessage(src, VIR_LOG_DEBUG, filename, linenr, funcname, NULL, __VA_ARGS__)
+    VIR_LOG_MESSAGE_INT(src, VIR_LOG_DEBUG, filename, linenr, funcname, __VA_ARGS__)
 # else
 /**
  * virLogEatParams:
@@ -105,11 +131,11 @@ static inline void virLogEatParams(virLogSourcePtr unused, ...)
 # endif /* !ENABLE_DEBUG */
 
 # define VIR_INFO_INT(src, filename, linenr, funcname, ...)             \
-    virLogMessage(src, VIR_LOG_INFO, filename, linenr, funcname, NULL, __VA_ARGS__)
+    VIR_LOG_MESSAGE_INT(src, VIR_LOG_INFO, filename, linenr, funcname, __VA_ARGS__)
 # define VIR_WARN_INT(src, filename, linenr, funcname, ...)             \
-    virLogMessage(src, VIR_LOG_WARN, filename, linenr, funcname, NULL, __VA_ARGS__)
+    VIR_LOG_MESSAGE_INT(src, VIR_LOG_WARN, filename, linenr, funcname, __VA_ARGS__)
 # define VIR_ERROR_INT(src, filename, linenr, funcname, ...)            \
-    virLogMessage(src, VIR_LOG_ERROR, filename, linenr, funcname, NULL, __VA_ARGS__)
+    VIR_LOG_MESSAGE_INT(src, VIR_LOG_ERROR, filename, linenr, funcname, __VA_ARGS__)
 
 # define VIR_DEBUG(...)                                                 \
     VIR_DEBUG_INT(&virLogSelf, __FILE__, __LINE__, __func__, __VA_ARGS__)
@@ -199,6 +225,7 @@ int virLogSetDefaultOutput(const char *fname, bool godaemon, bool privileged);
 void virLogLock(void);
 void virLogUnlock(void);
 int virLogReset(void);
+int virLogSetAsync(size_t length);
 int virLogParseDefaultPriority(const char *priority);
 int virLogPriorityFromSyslog(int priority);
 void virLogMessage(virLogSourcePtr source,
@@ -23,12 +23,15 @@
 
 #include <config.h>
 
+#include <fcntl.h>
+
 #include "virmacmap.h"
 #include "virobject.h"
 #include "virlog.h"
 #include "virjson.h"
 #include "virfile.h"
 #include "virhash.h"
+#include "virbuffer.h"
 #include "virstring.h"
 #include "viralloc.h"
 
@@ -43,10 +46,30 @@ VIR_LOG_INIT("util.virmacmap");
  */
 #define VIR_MAC_MAP_FILE_SIZE_MAX (32 * 1024 * 1024)
 
+/**
+ * VIR_MAC_MAP_LOG_MIN:
+ *
+ * Number of changes the log next to the mac maps file can hold
+ * before it is folded back into the file. Past this, the file is
+ * rewritten once the log holds more changes than there are MACs
+ * in the map, which keeps the cost of a change constant.
+ */
+#define VIR_MAC_MAP_LOG_MIN 64
+
 struct virMacMap {
     virObjectLockable parent;
 
     virHashTablePtr macs;
+    size_t nmacs;
+
+    /* The file the map was last loaded from or written to, the
+     * number of changes in its log and the changes made to the map
+     * since, as log lines not yet written out. */
+    char *file;
+    size_t nlog;
+    char **pending;
+    size_t npending;
+    bool rewrite; /* the log can't be appended to */
 };
 
 
@@ -63,12 +86,23 @@ virMacMapHashFree(void *payload,
 }
 
 
+static void
+virMacMapClearPending(virMacMapPtr mgr)
+{
+    while (mgr->npending)
+        VIR_FREE(mgr->pending[--mgr->npending]);
+    VIR_FREE(mgr->pending);
+}
+
+
 static void
 virMacMapDispose(void *obj)
 {
     virMacMapPtr mgr = obj;
     virHashForEach(mgr->macs, virMacMapHashFree, NULL);
     virHashFree(mgr->macs);
+    VIR_FREE(mgr->file);
+    virMacMapClearPending(mgr);
 }
 
 
@@ -106,6 +140,7 @@ virMacMapAddLocked(virMacMapPtr mgr,
         goto cleanup;
     newMacsList = NULL;
     virStringListFree(macsList);
+    mgr->nmacs++;
 
     ret = 0;
  cleanup:
@@ -121,12 +156,15 @@ virMacMapRemoveLocked(virMacMapPtr mgr,
 {
     char **macsList = NULL;
     char **newMacsList = NULL;
+    size_t len;
 
     if (!(macsList = virHashLookup(mgr->macs, domain)))
         return 0;
 
+    len = virStringListLength((const char **) macsList);
     newMacsList = macsList;
     virStringListRemove(&newMacsList, mac);
+    mgr->nmacs -= len - virStringListLength((const char **) newMacsList);
     if (!newMacsList) {
         virHashSteal(mgr->macs, domain);
     } else {
@@ -139,27 +177,83 @@ virMacMapRemoveLocked(virMacMapPtr mgr,
 }
 
 
+/* Returns 0 on success, 1 if @entry is malformed, -1 on error */
 static int
-virMacMapLoadFile(virMacMapPtr mgr,
+virMacMapLoadLogEntry(virMacMapPtr mgr,
+                      virJSONValuePtr entry)
+{
+    const char *domain;
+    const char *mac;
+
+    if (!(domain = virJSONValueObjectGetString(entry, "domain")))
+        return 1;
+
+    if ((mac = virJSONValueObjectGetString(entry, "add")))
+        return virMacMapAddLocked(mgr, domain, mac);
+
+    if ((mac = virJSONValueObjectGetString(entry, "remove")))
+        return virMacMapRemoveLocked(mgr, domain, mac);
+
+    return 1;
+}
+
+
+/* Replay the changes recorded in @log on top of the map. A change
+ * is one JSON object per line. A line with no newline at its end
+ * was not completely written and is ignored. Such a line, or one
+ * that can't be understood, makes the next write fold the log
+ * back into the mac maps file. */
+static int
+virMacMapLoadLog(virMacMapPtr mgr,
+                 char *log,
+                 const char *file)
+{
+    char *line = log;
+    char *eol;
+
+    while (line && *line) {
+        virJSONValuePtr entry;
+        int rc = 1;
+
+        if (!(eol = strchr(line, '\n'))) {
+            VIR_WARN("Ignoring incomplete change at the end of %s", file);
+            mgr->rewrite = true;
+            break;
+        }
+        *eol = '\0';
+
+        if ((entry = virJSONValueFromString(line))) {
+            rc = virMacMapLoadLogEntry(mgr, entry);
+            virJSONValueFree(entry);
+        } else {
+            virResetLastError();
+        }
+
+        if (rc < 0)
+            return -1;
+
+        if (rc > 0) {
+            VIR_WARN("Ignoring malformed change in %s", file);
+            mgr->rewrite = true;
+        }
+
+        mgr->nlog++;
+        line = eol + 1;
+    }
+
+    return 0;
+}
+
+
+static int
+virMacMapLoadJSON(virMacMapPtr mgr,
+                  const char *map_str,
                   const char *file)
 {
-    char *map_str = NULL;
     virJSONValuePtr map = NULL;
-    int map_str_len = 0;
     size_t i;
     int ret = -1;
 
-    if (virFileExists(file) &&
-        (map_str_len = virFileReadAll(file,
-                                      VIR_MAC_MAP_FILE_SIZE_MAX,
-                                      &map_str)) < 0)
-        goto cleanup;
-
-    if (map_str_len == 0) {
-        ret = 0;
-        goto cleanup;
-    }
-
     if (!(map = virJSONValueFromString(map_str))) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("invalid json in file: %s"),
@@ -203,12 +297,60 @@ virMacMapLoadFile(virMacMapPtr mgr,
 
     ret = 0;
  cleanup:
-    VIR_FREE(map_str);
     virJSONValueFree(map);
     return ret;
 }
 
 
+static int
+virMacMapLoadFile(virMacMapPtr mgr,
+                  const char *file)
+{
+    char *map_str = NULL;
+    char *log = NULL;
+    char *log_str = NULL;
+    int map_str_len = 0;
+    int rc;
+    int ret = -1;
+
+    if (VIR_STRDUP(mgr->file, file) < 0 ||
+        virAsprintf(&log, "%s" VIR_MAC_MAP_LOG_SUFFIX, file) < 0)
+        goto cleanup;
+
+    /* The log is read before the file it applies to. The file is
+     * only replaced once it holds all the changes in the log, which
+     * is removed afterwards, and replaying a change that is already
+     * in the file does nothing. So whichever of the two is caught
+     * in the middle of being updated, the result is consistent. */
+    if ((rc = virFileReadAllQuiet(log, VIR_MAC_MAP_FILE_SIZE_MAX,
+                                  &log_str)) < 0 &&
+        rc != -ENOENT) {
+        virReportSystemError(-rc, _("Failed to read file '%s'"), log);
+        goto cleanup;
+    }
+
+    if (virFileExists(file) &&
+        (map_str_len = virFileReadAll(file,
+                                      VIR_MAC_MAP_FILE_SIZE_MAX,
+                                      &map_str)) < 0)
+        goto cleanup;
+
+    if (map_str_len > 0 &&
+        virMacMapLoadJSON(mgr, map_str, file) < 0)
+        goto cleanup;
+
+    if (virMacMapLoadLog(mgr, log_str, log) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(log);
+    VIR_FREE(log_str);
+    VIR_FREE(map_str);
+    return ret;
+}
+
+
 static int
 virMACMapHashDumper(void *payload,
                     const void *name,
@@ -274,21 +416,156 @@ virMacMapDumpStrLocked(virMacMapPtr mgr,
 }
 
 
+static bool
+virMacMapLogIsFull(virMacMapPtr mgr)
+{
+    size_t nlog = mgr->nlog + mgr->npending;
+
+    return nlog >= VIR_MAC_MAP_LOG_MIN && nlog > mgr->nmacs;
+}
+
+
+/* Queue a change to be appended to the log by the next write. */
+static int
+virMacMapLogChange(virMacMapPtr mgr,
+                   const char *op,
+                   const char *domain,
+                   const char *mac)
+{
+    virJSONValuePtr entry = NULL;
+    char *str = NULL;
+    char *line = NULL;
+    int ret = -1;
+
+    /* Nothing to append to, or the whole file will be written anyway */
+    if (!mgr->file || mgr->rewrite)
+        return 0;
+
+    if (virMacMapLogIsFull(mgr)) {
+        mgr->rewrite = true;
+        virMacMapClearPending(mgr);
+        return 0;
+    }
+
+    if (!(entry = virJSONValueNewObject()) ||
+        virJSONValueObjectAppendString(entry, "domain", domain) < 0 ||
+        virJSONValueObjectAppendString(entry, op, mac) < 0 ||
+        !(str = virJSONValueToString(entry, false)) ||
+        virAsprintf(&line, "%s\n", str) < 0 ||
+        VIR_APPEND_ELEMENT(mgr->pending, mgr->npending, line) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    if (ret < 0) {
+        mgr->rewrite = true;
+        virMacMapClearPending(mgr);
+    }
+    virJSONValueFree(entry);
+    VIR_FREE(str);
+    VIR_FREE(line);
+    return ret;
+}
+
+
+static int
+virMacMapAppendLogLocked(virMacMapPtr mgr)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *log = NULL;
+    char *str = NULL;
+    int fd = -1;
+    size_t i;
+    int ret = -1;
+
+    if (virAsprintf(&log, "%s" VIR_MAC_MAP_LOG_SUFFIX, mgr->file) < 0)
+        goto cleanup;
+
+    for (i = 0; i < mgr->npending; i++)
+        virBufferAdd(&buf, mgr->pending[i], -1);
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+    str = virBufferContentAndReset(&buf);
+
+    if ((fd = open(log, O_WRONLY | O_APPEND | O_CREAT, 0644)) < 0) {
+        virReportSystemError(errno, _("cannot open file '%s'"), log);
+        goto cleanup;
+    }
+
+    if (safewrite(fd, str, strlen(str)) < 0) {
+        virReportSystemError(errno, _("cannot write data to file '%s'"),
+                             log);
+        goto cleanup;
+    }
+
+    if (fsync(fd) < 0) {
+        virReportSystemError(errno, _("cannot sync file '%s'"), log);
+        goto cleanup;
+    }
+
+    if (VIR_CLOSE(fd) < 0) {
+        virReportSystemError(errno, _("cannot save file '%s'"), log);
+        goto cleanup;
+    }
+
+    mgr->nlog += mgr->npending;
+    virMacMapClearPending(mgr);
+
+    ret = 0;
+ cleanup:
+    /* A partially written log is replaced by the next write */
+    if (ret < 0)
+        mgr->rewrite = true;
+    VIR_FORCE_CLOSE(fd);
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(str);
+    VIR_FREE(log);
+    return ret;
+}
+
+
 static int
 virMacMapWriteFileLocked(virMacMapPtr mgr,
                          const char *file)
 {
-    char *str;
+    char *str = NULL;
+    char *log = NULL;
     int ret = -1;
 
-    if (virMacMapDumpStrLocked(mgr, &str) < 0)
+    if (!mgr->rewrite && STREQ_NULLABLE(mgr->file, file) &&
+        !virMacMapLogIsFull(mgr)) {
+        if (!mgr->npending)
+            return 0;
+        return virMacMapAppendLogLocked(mgr);
+    }
+
+    if (virMacMapDumpStrLocked(mgr, &str) < 0 ||
+        virAsprintf(&log, "%s" VIR_MAC_MAP_LOG_SUFFIX, file) < 0)
         goto cleanup;
 
     if (virFileRewriteStr(file, 0644, str) < 0)
         goto cleanup;
 
+    /* All the changes in the log are in the file now */
+    if (unlink(log) < 0 && errno != ENOENT) {
+        virReportSystemError(errno, _("Unable to remove file '%s'"), log);
+        goto cleanup;
+    }
+
+    if (STRNEQ_NULLABLE(mgr->file, file)) {
+        VIR_FREE(mgr->file);
+        if (VIR_STRDUP(mgr->file, file) < 0)
+            goto cleanup;
+    }
+
+    mgr->nlog = 0;
+    mgr->rewrite = false;
+    virMacMapClearPending(mgr);
+
     ret = 0;
  cleanup:
+    VIR_FREE(log);
     VIR_FREE(str);
     return ret;
 }
@@ -333,7 +610,8 @@ virMacMapAdd(virMacMapPtr mgr,
     int ret;
 
     virObjectLock(mgr);
-    ret = virMacMapAddLocked(mgr, domain, mac);
+    if ((ret = virMacMapAddLocked(mgr, domain, mac)) == 0)
+        ret = virMacMapLogChange(mgr, "add", domain, mac);
     virObjectUnlock(mgr);
     return ret;
 }
@@ -347,7 +625,8 @@ virMacMapRemove(virMacMapPtr mgr,
     int ret;
 
     virObjectLock(mgr);
-    ret = virMacMapRemoveLocked(mgr, domain, mac);
+    if ((ret = virMacMapRemoveLocked(mgr, domain, mac)) == 0)
+        ret = virMacMapLogChange(mgr, "remove", domain, mac);
     virObjectUnlock(mgr);
     return ret;
 }
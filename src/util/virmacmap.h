@@ -24,6 +24,10 @@
 #ifndef __VIR_MACMAP_H__
 # define __VIR_MACMAP_H__
 
+/* Changes to the map not yet folded into the mac maps file are
+ * appended to a log file named after it, with this suffix. */
+# define VIR_MAC_MAP_LOG_SUFFIX ".log"
+
 typedef struct virMacMap virMacMap;
 typedef virMacMap *virMacMapPtr;
 
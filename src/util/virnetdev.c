@@ -507,64 +507,226 @@ int virNetDevSetMTUFromDevice(const char *ifname,
 }
 
 
-/**
- * virNetDevSetNamespace:
- * @ifname: name of device
- * @pidInNs: PID of process in target net namespace
- *
- * Moves the given device into the target net namespace specified by the given
- * pid using this command:
- *     ip link set @iface netns @pidInNs
+/*
+ * The 802.11 wireless devices only move together with their PHY, so
+ * move the PHY of @ifname if it has one, using this command:
+ *     iw phy @phy set netns @pidInNs
  *
- * Returns 0 on success or -1 in case of error
+ * Returns 1 if the device was moved, 0 if it is not a wireless device
+ * or -1 in case of error
  */
-int virNetDevSetNamespace(const char *ifname, pid_t pidInNs)
+static int
+virNetDevSetNamespacePhy(const char *ifname, pid_t pidInNs)
 {
     int ret = -1;
     char *pid = NULL;
     char *phy = NULL;
     char *phy_path = NULL;
     int len;
+    const char *argv[] = {
+        "iw", "phy", NULL, "set", "netns", NULL, NULL
+    };
 
-    if (virAsprintf(&pid, "%lld", (long long) pidInNs) == -1)
-        return -1;
-
-    /* The 802.11 wireless devices only move together with their PHY. */
     if (virNetDevSysfsFile(&phy_path, ifname, "phy80211/name") < 0)
         goto cleanup;
 
     if ((len = virFileReadAllQuiet(phy_path, 1024, &phy)) <= 0) {
         /* Not a wireless device. */
-        const char *argv[] = {
-            "ip", "link", "set", ifname, "netns", NULL, NULL
-        };
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (virAsprintf(&pid, "%lld", (long long) pidInNs) == -1)
+        goto cleanup;
+
+    /* Remove a line break. */
+    phy[len - 1] = '\0';
+
+    argv[2] = phy;
+    argv[5] = pid;
+    if (virRun(argv, NULL) < 0)
+        goto cleanup;
+
+    ret = 1;
+ cleanup:
+    VIR_FREE(phy_path);
+    VIR_FREE(phy);
+    VIR_FREE(pid);
+    return ret;
+}
+
 
-        argv[5] = pid;
-        if (virRun(argv, NULL) < 0)
+#if defined(__linux__) && defined(HAVE_LIBNL)
+static struct nl_msg *
+virNetDevSetNamespaceMsg(const char *ifname, pid_t pidInNs)
+{
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+    struct nl_msg *nl_msg;
+
+    if (!(nl_msg = nlmsg_alloc_simple(RTM_NEWLINK, NLM_F_REQUEST))) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (nlmsg_append(nl_msg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0 ||
+        nla_put(nl_msg, IFLA_IFNAME, strlen(ifname) + 1, ifname) < 0 ||
+        nla_put_u32(nl_msg, IFLA_NET_NS_PID, pidInNs) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        nlmsg_free(nl_msg);
+        return NULL;
+    }
+
+    return nl_msg;
+}
+
+
+/**
+ * virNetDevSetNamespaces:
+ * @ifnames: names of devices
+ * @nifnames: number of devices in @ifnames
+ * @pidInNs: PID of process in target net namespace
+ *
+ * Moves the given devices into the target net namespace specified by the
+ * given pid. All devices but the wireless ones are moved by one batch
+ * of netlink messages, which is the same as running this command for
+ * each of them:
+ *     ip link set @iface netns @pidInNs
+ *
+ * Returns 0 on success or -1 in case of error
+ */
+int virNetDevSetNamespaces(char **ifnames, size_t nifnames, pid_t pidInNs)
+{
+    int ret = -1;
+    struct nl_msg **msgs = NULL;
+    const char **names = NULL;
+    int *errors = NULL;
+    size_t nmsgs = 0;
+    size_t i;
+    int rc;
+
+    if (VIR_ALLOC_N(msgs, nifnames) < 0 ||
+        VIR_ALLOC_N(names, nifnames) < 0 ||
+        VIR_ALLOC_N(errors, nifnames) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nifnames; i++) {
+        if ((rc = virNetDevSetNamespacePhy(ifnames[i], pidInNs)) < 0)
             goto cleanup;
+        if (rc > 0)
+            continue;
 
-    } else {
-        const char *argv[] = {
-            "iw", "phy", NULL, "set", "netns", NULL, NULL
-        };
+        if (!(msgs[nmsgs] = virNetDevSetNamespaceMsg(ifnames[i], pidInNs)))
+            goto cleanup;
+        names[nmsgs++] = ifnames[i];
+    }
 
-        /* Remove a line break. */
-        phy[len - 1] = '\0';
+    if (virNetlinkCommandBatch(msgs, nmsgs, errors, NETLINK_ROUTE) < 0)
+        goto cleanup;
 
-        argv[2] = phy;
-        argv[5] = pid;
-        if (virRun(argv, NULL) < 0)
+    for (i = 0; i < nmsgs; i++) {
+        if (errors[i] < 0) {
+            virReportSystemError(-errors[i],
+                                 _("Unable to move interface %s into "
+                                   "the namespace of process %lld"),
+                                 names[i], (long long) pidInNs);
             goto cleanup;
+        }
     }
 
     ret = 0;
  cleanup:
-    VIR_FREE(phy_path);
-    VIR_FREE(phy);
+    for (i = 0; i < nmsgs; i++)
+        nlmsg_free(msgs[i]);
+    VIR_FREE(msgs);
+    VIR_FREE(names);
+    VIR_FREE(errors);
+    return ret;
+}
+
+
+/**
+ * virNetDevSetNamespace:
+ * @ifname: name of device
+ * @pidInNs: PID of process in target net namespace
+ *
+ * Moves the given device into the target net namespace specified by the
+ * given pid using a netlink RTM_NEWLINK message, the same as this command:
+ *     ip link set @iface netns @pidInNs
+ *
+ * Returns 0 on success or -1 in case of error
+ */
+int virNetDevSetNamespace(const char *ifname, pid_t pidInNs)
+{
+    char *ifnames[] = { (char *) ifname };
+
+    return virNetDevSetNamespaces(ifnames, 1, pidInNs);
+}
+
+
+#else
+/**
+ * virNetDevSetNamespace:
+ * @ifname: name of device
+ * @pidInNs: PID of process in target net namespace
+ *
+ * Moves the given device into the target net namespace specified by the given
+ * pid using this command:
+ *     ip link set @iface netns @pidInNs
+ *
+ * Returns 0 on success or -1 in case of error
+ */
+int virNetDevSetNamespace(const char *ifname, pid_t pidInNs)
+{
+    int ret = -1;
+    char *pid = NULL;
+    int rc;
+    const char *argv[] = {
+        "ip", "link", "set", ifname, "netns", NULL, NULL
+    };
+
+    if ((rc = virNetDevSetNamespacePhy(ifname, pidInNs)) != 0)
+        return rc < 0 ? -1 : 0;
+
+    if (virAsprintf(&pid, "%lld", (long long) pidInNs) == -1)
+        return -1;
+
+    argv[5] = pid;
+    if (virRun(argv, NULL) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
     VIR_FREE(pid);
     return ret;
 }
 
+
+/**
+ * virNetDevSetNamespaces:
+ * @ifnames: names of devices
+ * @nifnames: number of devices in @ifnames
+ * @pidInNs: PID of process in target net namespace
+ *
+ * Moves the given devices into the target net namespace specified by the
+ * given pid, see virNetDevSetNamespace.
+ *
+ * Returns 0 on success or -1 in case of error
+ */
+int virNetDevSetNamespaces(char **ifnames, size_t nifnames, pid_t pidInNs)
+{
+    size_t i;
+
+    for (i = 0; i < nifnames; i++) {
+        if (virNetDevSetNamespace(ifnames[i], pidInNs) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+#endif
+
+
 #if defined(SIOCSIFNAME) && defined(HAVE_STRUCT_IFREQ)
 /**
  * virNetDevSetName:
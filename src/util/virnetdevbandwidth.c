@@ -23,12 +23,26 @@
 #include <config.h>
 #include <unistd.h>
 
-#include "virnetdevbandwidth.h"
+#if defined(__linux__) && defined(HAVE_LIBNL)
+# include <arpa/inet.h>
+# include <linux/if_ether.h>
+# include <linux/pkt_cls.h>
+# include <linux/pkt_sched.h>
+# include <linux/rtnetlink.h>
+#endif
+
+#define __VIR_NETDEV_BANDWIDTH_PRIV_H_ALLOW__
+#include "virnetdevbandwidthpriv.h"
 #include "vircommand.h"
 #include "viralloc.h"
 #include "virerror.h"
+#include "virfile.h"
+#include "virnetdev.h"
+#include "virnetlink.h"
+#include "virthread.h"
 #include "virstring.h"
 #include "virutil.h"
+#include "intprops.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -43,9 +57,8 @@ virNetDevBandwidthFree(virNetDevBandwidthPtr def)
     VIR_FREE(def);
 }
 
-static void
-virNetDevBandwidthCmdAddOptimalQuantum(virCommandPtr cmd,
-                                       const virNetDevBandwidthRate *rate)
+static unsigned long long
+virNetDevBandwidthOptimalQuantum(const virNetDevBandwidthRate *rate)
 {
     const unsigned long long mtu = 1500;
     unsigned long long r2q;
@@ -62,8 +75,16 @@ virNetDevBandwidthCmdAddOptimalQuantum(virCommandPtr cmd,
     if (!r2q)
         r2q = 1;
 
+    return r2q;
+}
+
+static void
+virNetDevBandwidthCmdAddOptimalQuantum(virCommandPtr cmd,
+                                       const virNetDevBandwidthRate *rate)
+{
     virCommandAddArg(cmd, "quantum");
-    virCommandAddArgFormat(cmd, "%llu", r2q);
+    virCommandAddArgFormat(cmd, "%llu",
+                           virNetDevBandwidthOptimalQuantum(rate));
 }
 
 /**
@@ -169,6 +190,858 @@ virNetDevBandwidthManipulateFilter(const char *ifname,
 }
 
 
+static virNetDevBandwidthBackend currentBackend = VIR_NETDEV_BANDWIDTH_BACKEND_AUTOMATIC;
+
+int
+virNetDevBandwidthSetBackend(virNetDevBandwidthBackend backend)
+{
+    if (backend >= VIR_NETDEV_BANDWIDTH_BACKEND_LAST) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unknown bandwidth backend %d"), backend);
+        return -1;
+    }
+
+#if !defined(__linux__) || !defined(HAVE_LIBNL)
+    if (backend == VIR_NETDEV_BANDWIDTH_BACKEND_NETLINK) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("netlink bandwidth backend is not available "
+                         "on this platform"));
+        return -1;
+    }
+#endif
+
+    currentBackend = backend;
+    return 0;
+}
+
+static bool
+virNetDevBandwidthUseNetlink(void)
+{
+#if defined(__linux__) && defined(HAVE_LIBNL)
+    return currentBackend != VIR_NETDEV_BANDWIDTH_BACKEND_TC;
+#else
+    return false;
+#endif
+}
+
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+
+/* Instead of forking tc(8) for each qdisc, class and filter, the
+ * netlink backend builds the very same rtnetlink requests tc would
+ * send and hands all of them that belong to one interface over to
+ * the kernel in a single batch. The helpers below mirror what tc
+ * computes from its command line, so that the resulting QoS
+ * hierarchy is identical whichever backend has created it. */
+
+# define VIR_NETDEV_BANDWIDTH_HTB_MTU 1600
+# define VIR_NETDEV_BANDWIDTH_POLICE_MTU (64 * 1024)
+# define VIR_NETDEV_BANDWIDTH_RTAB_SIZE 256
+
+/* 'kbps' is kilobytes per second and 'kb' is kibibytes to tc */
+# define VIR_NETDEV_BANDWIDTH_KBPS(x) ((x) * 1000ULL)
+# define VIR_NETDEV_BANDWIDTH_KB(x) ((x) * 1024ULL)
+
+static double pschedTickInUsec = 15.625;
+static unsigned int pschedHz = 100;
+
+static int
+virNetDevBandwidthPschedOnceInit(void)
+{
+    char *buf = NULL;
+    unsigned int t2us, us2t, clockRes, hz;
+
+    /* Same as tc does, fall back to the defaults if the kernel
+     * doesn't tell us its packet scheduler clock parameters. */
+    if (virFileReadAllQuiet("/proc/net/psched", 1024, &buf) < 0)
+        return 0;
+
+    if (sscanf(buf, "%08x%08x%08x%08x", &t2us, &us2t, &clockRes, &hz) == 4 &&
+        us2t) {
+        if (clockRes == 1000000000)
+            t2us = us2t;
+        pschedTickInUsec = (double) t2us / us2t * (clockRes / 1000000.0);
+        if (clockRes == 1000000)
+            pschedHz = hz;
+    }
+
+    VIR_FREE(buf);
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetDevBandwidthPsched)
+
+static unsigned int
+virNetDevBandwidthXmitTime(unsigned long long rate,
+                           unsigned long long size)
+{
+    return (unsigned int) ((unsigned int) (1000000.0 * size / rate) *
+                           pschedTickInUsec);
+}
+
+static uint32_t
+virNetDevBandwidthRate32(unsigned long long rate)
+{
+    return rate > UINT32_MAX ? UINT32_MAX : rate;
+}
+
+static void
+virNetDevBandwidthCalcRateTable(struct tc_ratespec *spec,
+                                uint32_t *rtab,
+                                unsigned int mtu)
+{
+    size_t i;
+    unsigned char cellLog = 0;
+
+    while ((mtu >> cellLog) > 255)
+        cellLog++;
+
+    for (i = 0; i < VIR_NETDEV_BANDWIDTH_RTAB_SIZE; i++)
+        rtab[i] = virNetDevBandwidthXmitTime(spec->rate, (i + 1) << cellLog);
+
+    spec->cell_align = -1;
+    spec->cell_log = cellLog;
+    spec->linklayer = TC_LINKLAYER_ETHERNET;
+}
+
+
+typedef struct _virNetDevBandwidthBatch virNetDevBandwidthBatch;
+struct _virNetDevBandwidthBatch {
+    const char *ifname;
+    int ifindex;
+    struct nl_msg **msgs;
+    bool *ignoreErrors;
+    size_t nmsgs;
+};
+
+static int
+virNetDevBandwidthBatchInit(virNetDevBandwidthBatch *batch,
+                            const char *ifname)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->ifname = ifname;
+
+    if (virNetDevBandwidthPschedInitialize() < 0)
+        return -1;
+
+    return virNetDevGetIndex(ifname, &batch->ifindex);
+}
+
+static void
+virNetDevBandwidthBatchFree(virNetDevBandwidthBatch *batch)
+{
+    size_t i;
+
+    for (i = 0; i < batch->nmsgs; i++)
+        nlmsg_free(batch->msgs[i]);
+    VIR_FREE(batch->msgs);
+    VIR_FREE(batch->ignoreErrors);
+    batch->nmsgs = 0;
+}
+
+/**
+ * virNetDevBandwidthBatchAdd:
+ * @batch: batch to append the message to
+ * @type: RTM_* message type
+ * @flags: additional NLM_F_* flags
+ * @parent: parent of the qdisc, class or filter
+ * @handle: handle of the qdisc, class or filter
+ * @info: filter priority and protocol
+ * @kind: name of the qdisc or filter (may be NULL)
+ * @ignoreErrors: whether our caller doesn't care about the outcome
+ *
+ * Start a new traffic control message for @batch's interface.
+ *
+ * Returns the message on success, NULL otherwise (with error
+ * reported).
+ */
+static struct nl_msg *
+virNetDevBandwidthBatchAdd(virNetDevBandwidthBatch *batch,
+                           int type,
+                           int flags,
+                           uint32_t parent,
+                           uint32_t handle,
+                           uint32_t info,
+                           const char *kind,
+                           bool ignoreErrors)
+{
+    struct nl_msg *nl_msg;
+    struct tcmsg tcm = {
+        .tcm_family = AF_UNSPEC,
+        .tcm_ifindex = batch->ifindex,
+        .tcm_parent = parent,
+        .tcm_handle = handle,
+        .tcm_info = info,
+    };
+
+    if (!(nl_msg = nlmsg_alloc_simple(type, flags))) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (nlmsg_append(nl_msg, &tcm, sizeof(tcm), NLMSG_ALIGNTO) < 0)
+        goto buffer_too_small;
+
+    if (kind && nla_put(nl_msg, TCA_KIND, strlen(kind) + 1, kind) < 0)
+        goto buffer_too_small;
+
+    if (VIR_REALLOC_N(batch->ignoreErrors, batch->nmsgs + 1) < 0) {
+        nlmsg_free(nl_msg);
+        return NULL;
+    }
+    batch->ignoreErrors[batch->nmsgs] = ignoreErrors;
+
+    if (VIR_APPEND_ELEMENT_COPY(batch->msgs, batch->nmsgs, nl_msg) < 0) {
+        nlmsg_free(nl_msg);
+        return NULL;
+    }
+
+    return nl_msg;
+
+ buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    nlmsg_free(nl_msg);
+    return NULL;
+}
+
+/**
+ * virNetDevBandwidthBatchRun:
+ * @batch: batch to send
+ *
+ * Send all messages collected in @batch to the kernel at once.
+ *
+ * Returns 0 if the kernel has accepted every message we care
+ * about, -1 otherwise (with error reported).
+ */
+static int
+virNetDevBandwidthBatchRun(virNetDevBandwidthBatch *batch)
+{
+    int ret = -1;
+    int *errors = NULL;
+    size_t i;
+
+    if (VIR_ALLOC_N(errors, batch->nmsgs) < 0)
+        return -1;
+
+    if (virNetlinkCommandBatch(batch->msgs, batch->nmsgs,
+                               errors, NETLINK_ROUTE) < 0)
+        goto cleanup;
+
+    for (i = 0; i < batch->nmsgs; i++) {
+        if (errors[i] < 0 && !batch->ignoreErrors[i]) {
+            virReportSystemError(-errors[i],
+                                 _("Unable to update traffic control "
+                                   "settings of interface '%s'"),
+                                 batch->ifname);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(errors);
+    return ret;
+}
+
+static int
+virNetDevBandwidthBatchDelQdisc(virNetDevBandwidthBatch *batch,
+                                uint32_t parent,
+                                uint32_t handle)
+{
+    if (!virNetDevBandwidthBatchAdd(batch, RTM_DELQDISC, 0,
+                                    parent, handle, 0, NULL, true))
+        return -1;
+    return 0;
+}
+
+/* tc qdisc add dev $ifname root handle 1: htb default $defcls */
+static int
+virNetDevBandwidthBatchAddQdiscHTB(virNetDevBandwidthBatch *batch,
+                                   uint32_t defcls)
+{
+    struct nl_msg *nl_msg;
+    struct nlattr *options;
+    struct tc_htb_glob opt = {
+        .version = 3,
+        .rate2quantum = 10,
+        .defcls = defcls,
+    };
+
+    if (!(nl_msg = virNetDevBandwidthBatchAdd(batch, RTM_NEWQDISC,
+                                              NLM_F_EXCL | NLM_F_CREATE,
+                                              TC_H_ROOT, TC_H_MAKE(1 << 16, 0),
+                                              0, "htb", false)))
+        return -1;
+
+    if (!(options = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        nla_put(nl_msg, TCA_HTB_INIT, sizeof(opt), &opt) < 0)
+        goto buffer_too_small;
+    nla_nest_end(nl_msg, options);
+
+    return 0;
+
+ buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    return -1;
+}
+
+/* tc class {add|change} dev $ifname parent $parent classid $classid htb
+ *    rate $rate ceil $ceil [burst $burst] quantum $quantum */
+static int
+virNetDevBandwidthBatchAddClassHTB(virNetDevBandwidthBatch *batch,
+                                   bool change,
+                                   uint32_t parent,
+                                   uint32_t classid,
+                                   unsigned long long rate,
+                                   unsigned long long ceil,
+                                   unsigned long long burst,
+                                   unsigned long long quantum)
+{
+    struct nl_msg *nl_msg;
+    struct nlattr *options;
+    struct tc_htb_opt opt;
+    uint32_t rtab[VIR_NETDEV_BANDWIDTH_RTAB_SIZE];
+    uint32_t ctab[VIR_NETDEV_BANDWIDTH_RTAB_SIZE];
+    unsigned long long cburst;
+
+    memset(&opt, 0, sizeof(opt));
+    opt.rate.rate = virNetDevBandwidthRate32(rate);
+    opt.ceil.rate = virNetDevBandwidthRate32(ceil);
+    opt.quantum = quantum;
+
+    if (!burst)
+        burst = rate / pschedHz + VIR_NETDEV_BANDWIDTH_HTB_MTU;
+    cburst = ceil / pschedHz + VIR_NETDEV_BANDWIDTH_HTB_MTU;
+
+    virNetDevBandwidthCalcRateTable(&opt.rate, rtab,
+                                    VIR_NETDEV_BANDWIDTH_HTB_MTU);
+    virNetDevBandwidthCalcRateTable(&opt.ceil, ctab,
+                                    VIR_NETDEV_BANDWIDTH_HTB_MTU);
+    opt.buffer = virNetDevBandwidthXmitTime(opt.rate.rate, burst);
+    opt.cbuffer = virNetDevBandwidthXmitTime(opt.ceil.rate, cburst);
+
+    if (!(nl_msg = virNetDevBandwidthBatchAdd(batch, RTM_NEWTCLASS,
+                                              change ? 0 :
+                                              NLM_F_EXCL | NLM_F_CREATE,
+                                              parent, classid,
+                                              0, "htb", false)))
+        return -1;
+
+    if (!(options = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        nla_put(nl_msg, TCA_HTB_PARMS, sizeof(opt), &opt) < 0 ||
+        nla_put(nl_msg, TCA_HTB_RTAB, sizeof(rtab), rtab) < 0 ||
+        nla_put(nl_msg, TCA_HTB_CTAB, sizeof(ctab), ctab) < 0)
+        goto buffer_too_small;
+    nla_nest_end(nl_msg, options);
+
+    return 0;
+
+ buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    return -1;
+}
+
+/* tc qdisc add dev $ifname parent $parent handle $handle sfq perturb 10 */
+static int
+virNetDevBandwidthBatchAddQdiscSFQ(virNetDevBandwidthBatch *batch,
+                                   uint32_t parent,
+                                   uint32_t handle)
+{
+    struct nl_msg *nl_msg;
+    struct tc_sfq_qopt opt = { .perturb_period = 10 };
+
+    if (!(nl_msg = virNetDevBandwidthBatchAdd(batch, RTM_NEWQDISC,
+                                              NLM_F_EXCL | NLM_F_CREATE,
+                                              parent, handle,
+                                              0, "sfq", false)))
+        return -1;
+
+    if (nla_put(nl_msg, TCA_OPTIONS, sizeof(opt), &opt) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* tc filter add dev $ifname parent 1:0 protocol all prio 1
+ *    handle 1 fw flowid 1 */
+static int
+virNetDevBandwidthBatchAddFilterFW(virNetDevBandwidthBatch *batch)
+{
+    struct nl_msg *nl_msg;
+    struct nlattr *options;
+    uint32_t classid = 1;
+
+    if (!(nl_msg = virNetDevBandwidthBatchAdd(batch, RTM_NEWTFILTER,
+                                              NLM_F_EXCL | NLM_F_CREATE,
+                                              TC_H_MAKE(1 << 16, 0), 1,
+                                              TC_H_MAKE(1 << 16,
+                                                        htons(ETH_P_ALL)),
+                                              "fw", false)))
+        return -1;
+
+    if (!(options = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        nla_put(nl_msg, TCA_FW_CLASSID, sizeof(classid), &classid) < 0)
+        goto buffer_too_small;
+    nla_nest_end(nl_msg, options);
+
+    return 0;
+
+ buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    return -1;
+}
+
+/* Append a u32 selector with @nkeys keys to @nl_msg */
+static int
+virNetDevBandwidthPutU32Sel(struct nl_msg *nl_msg,
+                            const struct tc_u32_key *keys,
+                            size_t nkeys)
+{
+    struct tc_u32_sel *sel = NULL;
+    size_t len = sizeof(*sel) + nkeys * sizeof(*keys);
+    int ret;
+
+    if (VIR_ALLOC_VAR(sel, struct tc_u32_key, nkeys) < 0)
+        return -1;
+
+    sel->flags = TC_U32_TERMINAL;
+    sel->nkeys = nkeys;
+    memcpy(sel->keys, keys, nkeys * sizeof(*keys));
+
+    if ((ret = nla_put(nl_msg, TCA_U32_SEL, len, sel)) < 0)
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+
+    VIR_FREE(sel);
+    return ret < 0 ? -1 : 0;
+}
+
+/* tc qdisc add dev $ifname ingress
+ * tc filter add dev $ifname parent ffff: protocol all u32 match u32 0 0
+ *    police rate $rate burst $burst mtu 64kb drop flowid :1 */
+static int
+virNetDevBandwidthBatchAddIngressPolice(virNetDevBandwidthBatch *batch,
+                                        unsigned long long rate,
+                                        unsigned long long burst)
+{
+    struct nl_msg *nl_msg;
+    struct nlattr *options;
+    struct nlattr *police;
+    struct tc_police opt;
+    struct tc_u32_key key = { 0 };
+    uint32_t rtab[VIR_NETDEV_BANDWIDTH_RTAB_SIZE];
+    uint32_t classid = 1;
+
+    if (!virNetDevBandwidthBatchAdd(batch, RTM_NEWQDISC,
+                                    NLM_F_EXCL | NLM_F_CREATE,
+                                    TC_H_INGRESS, TC_H_MAKE(TC_H_INGRESS, 0),
+                                    0, "ingress", false))
+        return -1;
+
+    memset(&opt, 0, sizeof(opt));
+    opt.action = TC_POLICE_SHOT;
+    opt.mtu = VIR_NETDEV_BANDWIDTH_POLICE_MTU;
+    opt.rate.rate = virNetDevBandwidthRate32(rate);
+    virNetDevBandwidthCalcRateTable(&opt.rate, rtab, opt.mtu);
+    opt.burst = virNetDevBandwidthXmitTime(opt.rate.rate, burst);
+
+    if (!(nl_msg = virNetDevBandwidthBatchAdd(batch, RTM_NEWTFILTER,
+                                              NLM_F_EXCL | NLM_F_CREATE,
+                                              TC_H_MAKE(TC_H_INGRESS, 0), 0,
+                                              TC_H_MAKE(0, htons(ETH_P_ALL)),
+                                              "u32", false)))
+        return -1;
+
+    if (!(options = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        !(police = nla_nest_start(nl_msg, TCA_U32_POLICE)) ||
+        nla_put(nl_msg, TCA_POLICE_TBF, sizeof(opt), &opt) < 0 ||
+        nla_put(nl_msg, TCA_POLICE_RATE, sizeof(rtab), rtab) < 0)
+        goto buffer_too_small;
+    nla_nest_end(nl_msg, police);
+
+    if (nla_put(nl_msg, TCA_U32_CLASSID, sizeof(classid), &classid) < 0)
+        goto buffer_too_small;
+
+    if (virNetDevBandwidthPutU32Sel(nl_msg, &key, 1) < 0)
+        return -1;
+    nla_nest_end(nl_msg, options);
+
+    return 0;
+
+ buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    return -1;
+}
+
+/* tc expects the ID in u32 filter handles 800::$id to be hexadecimal
+ * yet virNetDevBandwidthManipulateFilter formats it in decimal. Keep
+ * doing the same so that both backends agree on filter handles. */
+static int
+virNetDevBandwidthFilterHandle(unsigned int id,
+                               uint32_t *handle)
+{
+    char idstr[INT_BUFSIZE_BOUND(id)];
+    unsigned int nodeid;
+
+    snprintf(idstr, sizeof(idstr), "%u", id);
+    if (virStrToLong_ui(idstr, NULL, 16, &nodeid) < 0 ||
+        nodeid >= 0x1000) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Invalid filter ID %u"), id);
+        return -1;
+    }
+
+    *handle = 0x80000000 | nodeid;
+    return 0;
+}
+
+/* tc filter del dev $ifname prio 2 handle 800::$id u32 */
+static int
+virNetDevBandwidthBatchDelFilterMAC(virNetDevBandwidthBatch *batch,
+                                    unsigned int id)
+{
+    uint32_t handle;
+
+    if (virNetDevBandwidthFilterHandle(id, &handle) < 0)
+        return -1;
+
+    if (!virNetDevBandwidthBatchAdd(batch, RTM_DELTFILTER, 0,
+                                    TC_H_UNSPEC, handle,
+                                    TC_H_MAKE(2 << 16, 0), "u32", true))
+        return -1;
+
+    return 0;
+}
+
+/* tc filter add dev $ifname protocol ip prio 2 handle 800::$id u32
+ *    match u16 0x0800 0xffff at -2
+ *    match u32 $mac[2-5] 0xffffffff at -12
+ *    match u16 $mac[0-1] 0xffff at -14
+ *    flowid $classid */
+static int
+virNetDevBandwidthBatchAddFilterMAC(virNetDevBandwidthBatch *batch,
+                                    const virMacAddr *ifmac_ptr,
+                                    unsigned int id,
+                                    uint32_t classid)
+{
+    struct nl_msg *nl_msg;
+    struct nlattr *options;
+    unsigned char ifmac[VIR_MAC_BUFLEN];
+    struct tc_u32_key keys[3];
+    uint32_t handle;
+
+    if (virNetDevBandwidthFilterHandle(id, &handle) < 0)
+        return -1;
+
+    virMacAddrGetRaw(ifmac_ptr, ifmac);
+
+    memset(keys, 0, sizeof(keys));
+    keys[0].off = -4;
+    keys[0].val = htonl(0x0800);
+    keys[0].mask = htonl(0xffff);
+    keys[1].off = -12;
+    keys[1].val = htonl((ifmac[2] << 24) | (ifmac[3] << 16) |
+                        (ifmac[4] << 8) | ifmac[5]);
+    keys[1].mask = 0xffffffff;
+    keys[2].off = -16;
+    keys[2].val = htonl((ifmac[0] << 8) | ifmac[1]);
+    keys[2].mask = htonl(0xffff);
+
+    if (!(nl_msg = virNetDevBandwidthBatchAdd(batch, RTM_NEWTFILTER,
+                                              NLM_F_EXCL | NLM_F_CREATE,
+                                              TC_H_UNSPEC, handle,
+                                              TC_H_MAKE(2 << 16,
+                                                        htons(ETH_P_IP)),
+                                              "u32", false)))
+        return -1;
+
+    if (!(options = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        nla_put(nl_msg, TCA_U32_CLASSID, sizeof(classid), &classid) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        return -1;
+    }
+
+    if (virNetDevBandwidthPutU32Sel(nl_msg, keys, ARRAY_CARDINALITY(keys)) < 0)
+        return -1;
+    nla_nest_end(nl_msg, options);
+
+    return 0;
+}
+
+static int
+virNetDevBandwidthClearNetlink(const char *ifname)
+{
+    int ret = -1;
+    virNetDevBandwidthBatch batch;
+
+    if (virNetDevBandwidthBatchInit(&batch, ifname) < 0)
+        goto cleanup;
+
+    if (virNetDevBandwidthBatchDelQdisc(&batch, TC_H_ROOT, 0) < 0 ||
+        virNetDevBandwidthBatchDelQdisc(&batch, TC_H_INGRESS,
+                                        TC_H_MAKE(TC_H_INGRESS, 0)) < 0)
+        goto cleanup;
+
+    ret = virNetDevBandwidthBatchRun(&batch);
+
+ cleanup:
+    virNetDevBandwidthBatchFree(&batch);
+    return ret;
+}
+
+static int
+virNetDevBandwidthSetNetlink(const char *ifname,
+                             virNetDevBandwidthPtr bandwidth,
+                             bool hierarchical_class)
+{
+    int ret = -1;
+    virNetDevBandwidthBatch batch;
+
+    if (virNetDevBandwidthBatchInit(&batch, ifname) < 0)
+        goto cleanup;
+
+    /* Same as virNetDevBandwidthClear() */
+    if (virNetDevBandwidthBatchDelQdisc(&batch, TC_H_ROOT, 0) < 0 ||
+        virNetDevBandwidthBatchDelQdisc(&batch, TC_H_INGRESS,
+                                        TC_H_MAKE(TC_H_INGRESS, 0)) < 0)
+        goto cleanup;
+
+    /* See virNetDevBandwidthSet() for the description of the hierarchy */
+    if (bandwidth->in && bandwidth->in->average) {
+        unsigned long long average = VIR_NETDEV_BANDWIDTH_KBPS(bandwidth->in->average);
+        unsigned long long peak = VIR_NETDEV_BANDWIDTH_KBPS(bandwidth->in->peak);
+        unsigned long long burst = VIR_NETDEV_BANDWIDTH_KB(bandwidth->in->burst);
+        unsigned long long quantum = virNetDevBandwidthOptimalQuantum(bandwidth->in);
+        uint32_t parent = TC_H_MAKE(1 << 16, 0);
+        uint32_t classid = TC_H_MAKE(1 << 16, 1);
+
+        if (virNetDevBandwidthBatchAddQdiscHTB(&batch,
+                                               hierarchical_class ? 2 : 1) < 0)
+            goto cleanup;
+
+        if (hierarchical_class) {
+            if (virNetDevBandwidthBatchAddClassHTB(&batch, false,
+                                                   parent, classid,
+                                                   average,
+                                                   peak ? peak : average,
+                                                   0, quantum) < 0)
+                goto cleanup;
+            parent = classid;
+            classid = TC_H_MAKE(1 << 16, 2);
+        }
+
+        if (virNetDevBandwidthBatchAddClassHTB(&batch, false,
+                                               parent, classid,
+                                               average,
+                                               peak ? peak : average,
+                                               burst, quantum) < 0 ||
+            virNetDevBandwidthBatchAddQdiscSFQ(&batch, classid,
+                                               TC_H_MAKE(2 << 16, 0)) < 0 ||
+            virNetDevBandwidthBatchAddFilterFW(&batch) < 0)
+            goto cleanup;
+    }
+
+    if (bandwidth->out) {
+        unsigned long long average = VIR_NETDEV_BANDWIDTH_KBPS(bandwidth->out->average);
+        unsigned long long burst = VIR_NETDEV_BANDWIDTH_KB(bandwidth->out->burst ?
+                                                           bandwidth->out->burst :
+                                                           bandwidth->out->average);
+
+        if (virNetDevBandwidthBatchAddIngressPolice(&batch, average, burst) < 0)
+            goto cleanup;
+    }
+
+    ret = virNetDevBandwidthBatchRun(&batch);
+
+ cleanup:
+    virNetDevBandwidthBatchFree(&batch);
+    return ret;
+}
+
+static int
+virNetDevBandwidthPlugNetlink(const char *brname,
+                              virNetDevBandwidthPtr net_bandwidth,
+                              const virMacAddr *ifmac_ptr,
+                              virNetDevBandwidthPtr bandwidth,
+                              unsigned int id)
+{
+    int ret = -1;
+    virNetDevBandwidthBatch batch;
+    uint32_t classid = TC_H_MAKE(1 << 16, id);
+    unsigned long long floor = VIR_NETDEV_BANDWIDTH_KBPS(bandwidth->in->floor);
+    unsigned long long ceil = VIR_NETDEV_BANDWIDTH_KBPS(net_bandwidth->in->peak ?
+                                                        net_bandwidth->in->peak :
+                                                        net_bandwidth->in->average);
+
+    if (virNetDevBandwidthBatchInit(&batch, brname) < 0)
+        goto cleanup;
+
+    if (virNetDevBandwidthBatchAddClassHTB(&batch, false,
+                                           TC_H_MAKE(1 << 16, 1), classid,
+                                           floor, ceil, 0,
+                                           virNetDevBandwidthOptimalQuantum(bandwidth->in)) < 0 ||
+        virNetDevBandwidthBatchAddQdiscSFQ(&batch, classid,
+                                           TC_H_MAKE(id << 16, 0)) < 0 ||
+        virNetDevBandwidthBatchAddFilterMAC(&batch, ifmac_ptr, id, classid) < 0)
+        goto cleanup;
+
+    ret = virNetDevBandwidthBatchRun(&batch);
+
+ cleanup:
+    virNetDevBandwidthBatchFree(&batch);
+    return ret;
+}
+
+static int
+virNetDevBandwidthUnplugNetlink(const char *brname,
+                                unsigned int id)
+{
+    int ret = -1;
+    virNetDevBandwidthBatch batch;
+    uint32_t classid = TC_H_MAKE(1 << 16, id);
+
+    if (virNetDevBandwidthBatchInit(&batch, brname) < 0)
+        goto cleanup;
+
+    /* Unlike tc, the kernel refuses to delete a qdisc without knowing
+     * its parent. Don't treat kernel errors as fatal, but try to remove
+     * as much as possible. */
+    if (virNetDevBandwidthBatchDelQdisc(&batch, classid,
+                                        TC_H_MAKE(id << 16, 0)) < 0 ||
+        virNetDevBandwidthBatchDelFilterMAC(&batch, id) < 0 ||
+        !virNetDevBandwidthBatchAdd(&batch, RTM_DELTCLASS, 0,
+                                    TC_H_UNSPEC, classid, 0, NULL, true))
+        goto cleanup;
+
+    ret = virNetDevBandwidthBatchRun(&batch);
+
+ cleanup:
+    virNetDevBandwidthBatchFree(&batch);
+    return ret;
+}
+
+static int
+virNetDevBandwidthUpdateRateNetlink(const char *ifname,
+                                    unsigned int id,
+                                    virNetDevBandwidthPtr bandwidth,
+                                    unsigned long long new_rate)
+{
+    int ret = -1;
+    virNetDevBandwidthBatch batch;
+    unsigned long long ceil = VIR_NETDEV_BANDWIDTH_KBPS(bandwidth->in->peak ?
+                                                        bandwidth->in->peak :
+                                                        bandwidth->in->average);
+
+    if (virNetDevBandwidthBatchInit(&batch, ifname) < 0)
+        goto cleanup;
+
+    if (virNetDevBandwidthBatchAddClassHTB(&batch, true, TC_H_UNSPEC,
+                                           TC_H_MAKE(1 << 16, id),
+                                           VIR_NETDEV_BANDWIDTH_KBPS(new_rate),
+                                           ceil, 0,
+                                           virNetDevBandwidthOptimalQuantum(bandwidth->in)) < 0)
+        goto cleanup;
+
+    ret = virNetDevBandwidthBatchRun(&batch);
+
+ cleanup:
+    virNetDevBandwidthBatchFree(&batch);
+    return ret;
+}
+
+static int
+virNetDevBandwidthUpdateFilterNetlink(const char *ifname,
+                                      const virMacAddr *ifmac_ptr,
+                                      unsigned int id)
+{
+    int ret = -1;
+    virNetDevBandwidthBatch batch;
+
+    if (virNetDevBandwidthBatchInit(&batch, ifname) < 0)
+        goto cleanup;
+
+    if (virNetDevBandwidthBatchDelFilterMAC(&batch, id) < 0 ||
+        virNetDevBandwidthBatchAddFilterMAC(&batch, ifmac_ptr, id,
+                                            TC_H_MAKE(1 << 16, id)) < 0)
+        goto cleanup;
+
+    ret = virNetDevBandwidthBatchRun(&batch);
+
+ cleanup:
+    virNetDevBandwidthBatchFree(&batch);
+    return ret;
+}
+
+#else /* !defined(__linux__) || !defined(HAVE_LIBNL) */
+
+static const char *unsupported = N_("not supported on non-linux platforms");
+
+static int
+virNetDevBandwidthClearNetlink(const char *ifname ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+static int
+virNetDevBandwidthSetNetlink(const char *ifname ATTRIBUTE_UNUSED,
+                             virNetDevBandwidthPtr bandwidth ATTRIBUTE_UNUSED,
+                             bool hierarchical_class ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+static int
+virNetDevBandwidthPlugNetlink(const char *brname ATTRIBUTE_UNUSED,
+                              virNetDevBandwidthPtr net_bandwidth ATTRIBUTE_UNUSED,
+                              const virMacAddr *ifmac_ptr ATTRIBUTE_UNUSED,
+                              virNetDevBandwidthPtr bandwidth ATTRIBUTE_UNUSED,
+                              unsigned int id ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+static int
+virNetDevBandwidthUnplugNetlink(const char *brname ATTRIBUTE_UNUSED,
+                                unsigned int id ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+static int
+virNetDevBandwidthUpdateRateNetlink(const char *ifname ATTRIBUTE_UNUSED,
+                                    unsigned int id ATTRIBUTE_UNUSED,
+                                    virNetDevBandwidthPtr bandwidth ATTRIBUTE_UNUSED,
+                                    unsigned long long new_rate ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+static int
+virNetDevBandwidthUpdateFilterNetlink(const char *ifname ATTRIBUTE_UNUSED,
+                                      const virMacAddr *ifmac_ptr ATTRIBUTE_UNUSED,
+                                      unsigned int id ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+#endif /* !defined(__linux__) || !defined(HAVE_LIBNL) */
+
+
 /**
  * virNetDevBandwidthSet:
  * @ifname: on which interface
@@ -215,6 +1088,10 @@ virNetDevBandwidthSet(const char *ifname,
         return -1;
     }
 
+    if (virNetDevBandwidthUseNetlink())
+        return virNetDevBandwidthSetNetlink(ifname, bandwidth,
+                                            hierarchical_class);
+
     virNetDevBandwidthClear(ifname);
 
     if (bandwidth->in && bandwidth->in->average) {
@@ -405,6 +1282,9 @@ virNetDevBandwidthClear(const char *ifname)
     if (!ifname)
        return 0;
 
+    if (virNetDevBandwidthUseNetlink())
+        return virNetDevBandwidthClearNetlink(ifname);
+
     cmd = virCommandNew(TC);
     virCommandAddArgList(cmd, "qdisc", "del", "dev", ifname, "root", NULL);
 
@@ -562,6 +1442,10 @@ virNetDevBandwidthPlug(const char *brname,
         return -1;
     }
 
+    if (virNetDevBandwidthUseNetlink())
+        return virNetDevBandwidthPlugNetlink(brname, net_bandwidth,
+                                             ifmac_ptr, bandwidth, id);
+
     if (virAsprintf(&class_id, "1:%x", id) < 0 ||
         virAsprintf(&qdisc_id, "%x:", id) < 0 ||
         virAsprintf(&floor, "%llukbps", bandwidth->in->floor) < 0 ||
@@ -627,6 +1511,9 @@ virNetDevBandwidthUnplug(const char *brname,
         return -1;
     }
 
+    if (virNetDevBandwidthUseNetlink())
+        return virNetDevBandwidthUnplugNetlink(brname, id);
+
     if (virAsprintf(&class_id, "1:%x", id) < 0 ||
         virAsprintf(&qdisc_id, "%x:", id) < 0)
         goto cleanup;
@@ -687,6 +1574,10 @@ virNetDevBandwidthUpdateRate(const char *ifname,
     char *rate = NULL;
     char *ceil = NULL;
 
+    if (virNetDevBandwidthUseNetlink())
+        return virNetDevBandwidthUpdateRateNetlink(ifname, id, bandwidth,
+                                                   new_rate);
+
     if (virAsprintf(&class_id, "1:%x", id) < 0 ||
         virAsprintf(&rate, "%llukbps", new_rate) < 0 ||
         virAsprintf(&ceil, "%llukbps", bandwidth->in->peak ?
@@ -738,6 +1629,9 @@ virNetDevBandwidthUpdateFilter(const char *ifname,
     int ret = -1;
     char *class_id = NULL;
 
+    if (virNetDevBandwidthUseNetlink())
+        return virNetDevBandwidthUpdateFilterNetlink(ifname, ifmac_ptr, id);
+
     if (virAsprintf(&class_id, "1:%x", id) < 0)
         goto cleanup;
 
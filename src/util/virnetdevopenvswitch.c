@@ -27,14 +27,25 @@
 #include <config.h>
 
 #include <stdio.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "virnetdevopenvswitch.h"
 #include "vircommand.h"
 #include "viralloc.h"
 #include "virerror.h"
+#include "virfile.h"
+#include "virhash.h"
+#include "virjson.h"
 #include "virmacaddr.h"
 #include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
+#include "virutil.h"
 #include "virlog.h"
+#include "c-ctype.h"
+#include "configmake.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -63,6 +74,1184 @@ virNetDevOpenvswitchAddTimeout(virCommandPtr cmd)
     virCommandAddArgFormat(cmd, "--timeout=%u", virNetDevOpenvswitchTimeout);
 }
 
+/*
+ * Rather than forking ovs-vsctl for every request, talk to ovsdb-server
+ * directly over its JSON-RPC interface (RFC 7047). A single connection
+ * is shared by all callers. It monitors the few columns we are
+ * interested in, so that interface statistics and names can be looked up
+ * in the local copy, which is refreshed from the update notifications
+ * pending on the socket whenever the connection is used. Whenever the
+ * database can't be reached the ovs-vsctl based code is used instead.
+ */
+#define VIR_NETDEV_OVS_DB_SOCK LOCALSTATEDIR "/run/openvswitch/db.sock"
+#define VIR_NETDEV_OVS_DB_NAME "Open_vSwitch"
+
+typedef struct _virNetDevOpenvswitchDBIface virNetDevOpenvswitchDBIface;
+typedef virNetDevOpenvswitchDBIface *virNetDevOpenvswitchDBIfacePtr;
+struct _virNetDevOpenvswitchDBIface {
+    char *uuid;
+    bool hasStats;
+    virDomainInterfaceStatsStruct stats;
+};
+
+typedef struct _virNetDevOpenvswitchDB virNetDevOpenvswitchDB;
+struct _virNetDevOpenvswitchDB {
+    virMutex lock;
+    int fd;
+
+    /* received data not processed yet */
+    char *buf;
+    size_t buflen;
+    size_t bufalloc;
+
+    long long nextId;
+
+    /* local copy of the monitored tables */
+    virHashTablePtr ifaces; /* Interface name -> virNetDevOpenvswitchDBIface */
+    virHashTablePtr ports; /* Port name -> Port UUID */
+    long long curCfg;
+};
+
+static virNetDevOpenvswitchDB ovsdb = { .fd = -1 };
+
+static int
+virNetDevOpenvswitchDBOnceInit(void)
+{
+    if (virMutexInit(&ovsdb.lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize mutex"));
+        return -1;
+    }
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetDevOpenvswitchDB)
+
+static void
+virNetDevOpenvswitchDBIfaceFree(void *payload,
+                                const void *name ATTRIBUTE_UNUSED)
+{
+    virNetDevOpenvswitchDBIfacePtr iface = payload;
+
+    if (!iface)
+        return;
+
+    VIR_FREE(iface->uuid);
+    VIR_FREE(iface);
+}
+
+static void
+virNetDevOpenvswitchDBClose(void)
+{
+    VIR_FORCE_CLOSE(ovsdb.fd);
+    VIR_FREE(ovsdb.buf);
+    ovsdb.buflen = ovsdb.bufalloc = 0;
+    virHashFree(ovsdb.ifaces);
+    ovsdb.ifaces = NULL;
+    virHashFree(ovsdb.ports);
+    ovsdb.ports = NULL;
+}
+
+static int
+virNetDevOpenvswitchDBSend(virJSONValuePtr msg)
+{
+    char *str;
+    int ret = -1;
+
+    if (!(str = virJSONValueToString(msg, false)))
+        return -1;
+
+    VIR_DEBUG("Send OVSDB message %s", str);
+
+    if (safewrite(ovsdb.fd, str, strlen(str)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to send message to OVS database"));
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(str);
+    return ret;
+}
+
+/* OVSDB doesn't delimit JSON-RPC messages in any way, so find out
+ * where the top level object starting at @buf ends. Returns the
+ * length of the object or 0 if it hasn't been received completely. */
+static size_t
+virNetDevOpenvswitchDBMessageLen(const char *buf,
+                                 size_t len)
+{
+    size_t depth = 0;
+    bool string = false;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (string) {
+            if (buf[i] == '\\')
+                i++;
+            else if (buf[i] == '"')
+                string = false;
+            continue;
+        }
+
+        switch (buf[i]) {
+        case '"':
+            string = true;
+            break;
+        case '{':
+        case '[':
+            depth++;
+            break;
+        case '}':
+        case ']':
+            if (depth && --depth == 0)
+                return i + 1;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * virNetDevOpenvswitchDBRead:
+ * @deadline: time in milliseconds to wait until, 0 to not wait at all
+ *      and -1 to wait forever
+ * @msg: filled in with the message received
+ *
+ * Returns 1 if a message was received, 0 if none arrived before
+ * @deadline and -1 on error.
+ */
+static int
+virNetDevOpenvswitchDBRead(long long deadline,
+                           virJSONValuePtr *msg)
+{
+    size_t start;
+    size_t len;
+    ssize_t got;
+    char *str;
+
+    *msg = NULL;
+
+    for (;;) {
+        for (start = 0; start < ovsdb.buflen &&
+             c_isspace(ovsdb.buf[start]); start++)
+            ;
+
+        if ((len = virNetDevOpenvswitchDBMessageLen(ovsdb.buf + start,
+                                                    ovsdb.buflen - start))) {
+            if (VIR_STRNDUP(str, ovsdb.buf + start, len) < 0)
+                return -1;
+
+            start += len;
+            memmove(ovsdb.buf, ovsdb.buf + start, ovsdb.buflen - start);
+            ovsdb.buflen -= start;
+
+            VIR_DEBUG("Received OVSDB message %s", str);
+            *msg = virJSONValueFromString(str);
+            VIR_FREE(str);
+            return *msg ? 1 : -1;
+        }
+
+        if (deadline != -1) {
+            struct pollfd fds[1] = { { .fd = ovsdb.fd, .events = POLLIN } };
+            unsigned long long now = 0;
+            int timeout = 0;
+            int rc;
+
+            if (deadline > 0) {
+                if (virTimeMillisNow(&now) < 0)
+                    return -1;
+                if (deadline > now)
+                    timeout = deadline - now;
+            }
+
+            if ((rc = poll(fds, ARRAY_CARDINALITY(fds), timeout)) < 0) {
+                if (errno == EINTR)
+                    continue;
+                virReportSystemError(errno, "%s", _("error in poll call"));
+                return -1;
+            }
+
+            if (rc == 0)
+                return 0;
+        }
+
+        if (VIR_RESIZE_N(ovsdb.buf, ovsdb.bufalloc, ovsdb.buflen, 1024) < 0)
+            return -1;
+
+        got = read(ovsdb.fd, ovsdb.buf + ovsdb.buflen,
+                   ovsdb.bufalloc - ovsdb.buflen);
+        if (got < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            virReportSystemError(errno, "%s",
+                                 _("Unable to read from OVS database"));
+            return -1;
+        }
+
+        if (got == 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("OVS database closed the connection"));
+            return -1;
+        }
+
+        ovsdb.buflen += got;
+    }
+}
+
+/* Parse an OVSDB <map> of strings to integers, e.g. the statistics
+ * column, and store the values we know about into @stats. */
+static bool
+virNetDevOpenvswitchDBParseStats(virJSONValuePtr map,
+                                 virDomainInterfaceStatsPtr stats)
+{
+    virJSONValuePtr pairs;
+    unsigned int found = 0;
+    size_t i;
+
+    memset(stats, 0, sizeof(*stats));
+
+    if (!map || !virJSONValueIsArray(map) ||
+        STRNEQ_NULLABLE(virJSONValueGetString(virJSONValueArrayGet(map, 0)),
+                        "map") ||
+        !(pairs = virJSONValueArrayGet(map, 1)))
+        return false;
+
+    for (i = 0; i < virJSONValueArraySize(pairs); i++) {
+        virJSONValuePtr pair = virJSONValueArrayGet(pairs, i);
+        const char *key = virJSONValueGetString(virJSONValueArrayGet(pair, 0));
+        long long value;
+
+        if (!key ||
+            virJSONValueGetNumberLong(virJSONValueArrayGet(pair, 1),
+                                      &value) < 0)
+            continue;
+
+        /* The TX/RX fields appear to be swapped here
+         * because this is the host view. */
+        if (STREQ(key, "rx_bytes")) {
+            stats->tx_bytes = value;
+            found++;
+        } else if (STREQ(key, "rx_packets")) {
+            stats->tx_packets = value;
+            found++;
+        } else if (STREQ(key, "tx_bytes")) {
+            stats->rx_bytes = value;
+            found++;
+        } else if (STREQ(key, "tx_packets")) {
+            stats->rx_packets = value;
+            found++;
+        } else if (STREQ(key, "rx_errors")) {
+            stats->tx_errs = value;
+        } else if (STREQ(key, "rx_dropped")) {
+            stats->tx_drop = value;
+        } else if (STREQ(key, "tx_errors")) {
+            stats->rx_errs = value;
+        } else if (STREQ(key, "tx_dropped")) {
+            stats->rx_drop = value;
+        }
+    }
+
+    return found == 4;
+}
+
+/* Forget the row @uuid named @name in @table unless the name has been
+ * reused by another row in the meantime */
+static void
+virNetDevOpenvswitchDBRemoveName(virHashTablePtr table,
+                                 const char *name,
+                                 const char *uuid,
+                                 bool isIface)
+{
+    const void *entry = virHashLookup(table, name);
+    const char *entryUUID;
+
+    if (!entry)
+        return;
+
+    if (isIface)
+        entryUUID = ((const virNetDevOpenvswitchDBIface *) entry)->uuid;
+    else
+        entryUUID = entry;
+
+    if (STREQ(entryUUID, uuid))
+        ignore_value(virHashRemoveEntry(table, name));
+}
+
+/* Apply the <row-update> for the row @uuid of @table. As the tables
+ * are indexed by name, the old name must be forgotten when a row is
+ * deleted or renamed, in which case "old" holds it. */
+static int
+virNetDevOpenvswitchDBUpdateRow(const char *table,
+                                const char *uuid,
+                                virJSONValuePtr rowUpdate)
+{
+    virJSONValuePtr old = virJSONValueObjectGetObject(rowUpdate, "old");
+    virJSONValuePtr new = virJSONValueObjectGetObject(rowUpdate, "new");
+    virNetDevOpenvswitchDBIfacePtr iface = NULL;
+    char *portUUID = NULL;
+    const char *name;
+    bool isIface;
+
+    if (STREQ(table, "Open_vSwitch")) {
+        if (new)
+            ignore_value(virJSONValueObjectGetNumberLong(new, "cur_cfg",
+                                                         &ovsdb.curCfg));
+        return 0;
+    }
+
+    if (STREQ(table, "Interface"))
+        isIface = true;
+    else if (STREQ(table, "Port"))
+        isIface = false;
+    else
+        return 0;
+
+    if (old && (name = virJSONValueObjectGetString(old, "name")))
+        virNetDevOpenvswitchDBRemoveName(isIface ? ovsdb.ifaces : ovsdb.ports,
+                                         name, uuid, isIface);
+
+    if (!new || !(name = virJSONValueObjectGetString(new, "name")))
+        return 0;
+
+    if (isIface) {
+        if (VIR_ALLOC(iface) < 0 ||
+            VIR_STRDUP(iface->uuid, uuid) < 0)
+            goto error;
+
+        iface->hasStats =
+            virNetDevOpenvswitchDBParseStats(virJSONValueObjectGet(new,
+                                                                   "statistics"),
+                                             &iface->stats);
+
+        if (virHashUpdateEntry(ovsdb.ifaces, name, iface) < 0)
+            goto error;
+    } else {
+        if (VIR_STRDUP(portUUID, uuid) < 0 ||
+            virHashUpdateEntry(ovsdb.ports, name, portUUID) < 0)
+            goto error;
+    }
+
+    return 0;
+
+ error:
+    virNetDevOpenvswitchDBIfaceFree(iface, NULL);
+    VIR_FREE(portUUID);
+    return -1;
+}
+
+/* Apply <table-updates> to the local copy of the database */
+static int
+virNetDevOpenvswitchDBUpdate(virJSONValuePtr updates)
+{
+    int ntables;
+    size_t i, j;
+
+    if ((ntables = virJSONValueObjectKeysNumber(updates)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed OVS database update"));
+        return -1;
+    }
+
+    for (i = 0; i < ntables; i++) {
+        const char *table = virJSONValueObjectGetKey(updates, i);
+        virJSONValuePtr rows = virJSONValueObjectGetValue(updates, i);
+        int nrows = virJSONValueObjectKeysNumber(rows);
+
+        for (j = 0; nrows > 0 && j < nrows; j++) {
+            if (virNetDevOpenvswitchDBUpdateRow(table,
+                                                virJSONValueObjectGetKey(rows, j),
+                                                virJSONValueObjectGetValue(rows, j)) < 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Handle a notification or request sent by the server. Returns 1 if
+ * @msg is a reply to one of our requests, 0 if it was handled. */
+static int
+virNetDevOpenvswitchDBDispatch(virJSONValuePtr msg)
+{
+    const char *method = virJSONValueObjectGetString(msg, "method");
+    virJSONValuePtr params = virJSONValueObjectGet(msg, "params");
+    virJSONValuePtr reply = NULL;
+    int ret = -1;
+
+    if (!method)
+        return 1;
+
+    if (STREQ(method, "update")) {
+        if (virJSONValueArraySize(params) == 2 &&
+            virNetDevOpenvswitchDBUpdate(virJSONValueArrayGet(params, 1)) < 0)
+            return -1;
+        return 0;
+    }
+
+    if (STREQ(method, "echo")) {
+        virJSONValuePtr id = virJSONValueObjectGet(msg, "id");
+
+        if (!id || !params)
+            return 0;
+
+        if (virJSONValueObjectCreate(&reply,
+                                     "a:id", virJSONValueCopy(id),
+                                     "a:result", virJSONValueCopy(params),
+                                     "n:error",
+                                     NULL) < 0 ||
+            virNetDevOpenvswitchDBSend(reply) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virJSONValueFree(reply);
+    return ret;
+}
+
+/* Process all notifications received so far */
+static int
+virNetDevOpenvswitchDBProcessPending(void)
+{
+    virJSONValuePtr msg = NULL;
+    int rc;
+
+    while ((rc = virNetDevOpenvswitchDBRead(0, &msg)) > 0) {
+        rc = virNetDevOpenvswitchDBDispatch(msg);
+        virJSONValueFree(msg);
+        if (rc < 0)
+            return -1;
+    }
+
+    return rc;
+}
+
+static long long
+virNetDevOpenvswitchDBDeadline(void)
+{
+    unsigned long long now;
+
+    if (!virNetDevOpenvswitchTimeout)
+        return -1;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -2;
+
+    return now + virNetDevOpenvswitchTimeout * 1000ULL;
+}
+
+/**
+ * virNetDevOpenvswitchDBCall:
+ * @method: JSON-RPC method to call
+ * @params: its parameters, consumed
+ * @result: filled in with the result of the call
+ *
+ * Call @method and wait for its result, processing any notifications
+ * received in the meantime.
+ *
+ * Returns 0 on success, -1 otherwise (with error reported).
+ */
+static int
+virNetDevOpenvswitchDBCall(const char *method,
+                           virJSONValuePtr params,
+                           virJSONValuePtr *result)
+{
+    virJSONValuePtr req = NULL;
+    virJSONValuePtr msg = NULL;
+    long long id = ovsdb.nextId++;
+    long long deadline;
+    long long msgid;
+    int ret = -1;
+    int rc;
+
+    *result = NULL;
+
+    if ((deadline = virNetDevOpenvswitchDBDeadline()) == -2) {
+        virJSONValueFree(params);
+        return -1;
+    }
+
+    if (virJSONValueObjectCreate(&req,
+                                 "s:method", method,
+                                 "a:params", params,
+                                 "I:id", id,
+                                 NULL) < 0) {
+        virJSONValueFree(params);
+        return -1;
+    }
+
+    if (virNetDevOpenvswitchDBSend(req) < 0)
+        goto cleanup;
+
+    for (;;) {
+        if ((rc = virNetDevOpenvswitchDBRead(deadline, &msg)) < 0)
+            goto cleanup;
+
+        if (rc == 0) {
+            virReportError(VIR_ERR_OPERATION_TIMEOUT,
+                           _("Timed out waiting for reply to OVS database "
+                             "request '%s'"), method);
+            goto cleanup;
+        }
+
+        if ((rc = virNetDevOpenvswitchDBDispatch(msg)) < 0)
+            goto cleanup;
+
+        if (rc > 0 &&
+            virJSONValueObjectGetNumberLong(msg, "id", &msgid) == 0 &&
+            msgid == id)
+            break;
+
+        virJSONValueFree(msg);
+        msg = NULL;
+    }
+
+    if (!virJSONValueObjectIsNull(msg, "error")) {
+        virJSONValuePtr err = virJSONValueObjectGet(msg, "error");
+        char *errstr = virJSONValueToString(err, false);
+
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("OVS database request '%s' failed: %s"),
+                       method, NULLSTR(errstr));
+        VIR_FREE(errstr);
+        goto cleanup;
+    }
+
+    if (virJSONValueObjectRemoveKey(msg, "result", result) <= 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("OVS database reply to '%s' has no result"),
+                       method);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virJSONValueFree(req);
+    virJSONValueFree(msg);
+    return ret;
+}
+
+/* Open the connection and start monitoring the database. Returns 1 on
+ * success, 0 if the database isn't reachable and -1 on error. */
+static int
+virNetDevOpenvswitchDBOpen(void)
+{
+    struct sockaddr_un addr;
+    virJSONValuePtr params = NULL;
+    virJSONValuePtr requests = NULL;
+    virJSONValuePtr result = NULL;
+    int ret = -1;
+
+    if (ovsdb.fd >= 0)
+        return 1;
+
+#if !WITH_YAJL
+    /* without a JSON parser we couldn't make any sense of the replies */
+    return 0;
+#endif
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (virStrcpyStatic(addr.sun_path, VIR_NETDEV_OVS_DB_SOCK) == NULL)
+        return 0;
+
+    if ((ovsdb.fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("failed to create socket"));
+        return -1;
+    }
+
+    if (connect(ovsdb.fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        VIR_DEBUG("Unable to connect to %s: %s, falling back to "
+                  OVSVSCTL, VIR_NETDEV_OVS_DB_SOCK, strerror(errno));
+        VIR_FORCE_CLOSE(ovsdb.fd);
+        return 0;
+    }
+
+    if (virSetCloseExec(ovsdb.fd) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to set close-on-exec flag"));
+        goto cleanup;
+    }
+
+    if (!(ovsdb.ifaces = virHashCreate(32, virNetDevOpenvswitchDBIfaceFree)) ||
+        !(ovsdb.ports = virHashCreate(32, virHashValueFree)))
+        goto cleanup;
+    ovsdb.curCfg = 0;
+
+    if (virJSONValueObjectCreate(&requests,
+                                 "a:Interface",
+                                 virJSONValueFromString("{\"columns\":"
+                                                        "[\"name\",\"statistics\"]}"),
+                                 "a:Port",
+                                 virJSONValueFromString("{\"columns\":[\"name\"]}"),
+                                 "a:Open_vSwitch",
+                                 virJSONValueFromString("{\"columns\":[\"cur_cfg\"]}"),
+                                 NULL) < 0)
+        goto cleanup;
+
+    if (!(params = virJSONValueNewArray()) ||
+        virJSONValueArrayAppend(params,
+                                virJSONValueNewString(VIR_NETDEV_OVS_DB_NAME)) < 0 ||
+        virJSONValueArrayAppend(params, virJSONValueNewNull()) < 0 ||
+        virJSONValueArrayAppend(params, requests) < 0)
+        goto cleanup;
+    requests = NULL;
+
+    if (virNetDevOpenvswitchDBCall("monitor", params, &result) < 0) {
+        params = NULL;
+        goto cleanup;
+    }
+    params = NULL;
+
+    if (virNetDevOpenvswitchDBUpdate(result) < 0)
+        goto cleanup;
+
+    ret = 1;
+ cleanup:
+    if (ret < 0)
+        virNetDevOpenvswitchDBClose();
+    virJSONValueFree(requests);
+    virJSONValueFree(params);
+    virJSONValueFree(result);
+    return ret;
+}
+
+/**
+ * virNetDevOpenvswitchDBAcquire:
+ *
+ * Get access to the shared OVS database connection, opening it if
+ * needed and bringing the local copy of the database up to date.
+ *
+ * Returns 1 if the connection can be used, in which case the caller
+ * must call virNetDevOpenvswitchDBRelease() once done, 0 if ovs-vsctl
+ * has to be used instead and -1 on error.
+ */
+static int
+virNetDevOpenvswitchDBAcquire(void)
+{
+    size_t i;
+    int rc = 0;
+
+    if (virNetDevOpenvswitchDBInitialize() < 0)
+        return -1;
+
+    virMutexLock(&ovsdb.lock);
+
+    /* Reconnect once in case the server has been restarted */
+    for (i = 0; i < 2; i++) {
+        if ((rc = virNetDevOpenvswitchDBOpen()) <= 0 ||
+            virNetDevOpenvswitchDBProcessPending() == 0)
+            break;
+
+        VIR_WARN("Lost connection to OVS database: %s",
+                 virGetLastErrorMessage());
+        virResetLastError();
+        virNetDevOpenvswitchDBClose();
+        rc = 0;
+    }
+
+    if (rc < 0) {
+        VIR_WARN("Unable to use OVS database, falling back to "
+                 OVSVSCTL ": %s", virGetLastErrorMessage());
+        virResetLastError();
+        rc = 0;
+    }
+
+    if (rc == 0)
+        virMutexUnlock(&ovsdb.lock);
+
+    return rc;
+}
+
+static void
+virNetDevOpenvswitchDBRelease(void)
+{
+    virMutexUnlock(&ovsdb.lock);
+}
+
+/* Build the two element array [@tag, @value], consuming @value */
+static virJSONValuePtr
+virNetDevOpenvswitchDBPair(const char *tag,
+                           virJSONValuePtr value)
+{
+    virJSONValuePtr pair = NULL;
+
+    if (!value)
+        return NULL;
+
+    if (!(pair = virJSONValueNewArray()) ||
+        virJSONValueArrayAppend(pair, virJSONValueNewString(tag)) < 0 ||
+        virJSONValueArrayAppend(pair, value) < 0) {
+        virJSONValueFree(value);
+        virJSONValueFree(pair);
+        return NULL;
+    }
+
+    return pair;
+}
+
+/* Build the single condition or mutation list [[@column, @op, @value]],
+ * consuming @value */
+static virJSONValuePtr
+virNetDevOpenvswitchDBClause(const char *column,
+                             const char *op,
+                             virJSONValuePtr value)
+{
+    virJSONValuePtr triple = NULL;
+    virJSONValuePtr list = NULL;
+
+    if (!value)
+        return NULL;
+
+    if (!(triple = virJSONValueNewArray()) ||
+        virJSONValueArrayAppend(triple, virJSONValueNewString(column)) < 0 ||
+        virJSONValueArrayAppend(triple, virJSONValueNewString(op)) < 0) {
+        virJSONValueFree(value);
+        goto error;
+    }
+
+    if (virJSONValueArrayAppend(triple, value) < 0) {
+        virJSONValueFree(value);
+        goto error;
+    }
+
+    if (!(list = virJSONValueNewArray()) ||
+        virJSONValueArrayAppend(list, triple) < 0)
+        goto error;
+
+    return list;
+
+ error:
+    virJSONValueFree(triple);
+    virJSONValueFree(list);
+    return NULL;
+}
+
+/* Build the <set> containing the <uuid> or <named-uuid> @uuid */
+static virJSONValuePtr
+virNetDevOpenvswitchDBRefSet(const char *tag,
+                             const char *uuid)
+{
+    virJSONValuePtr ref;
+    virJSONValuePtr refs;
+
+    if (!(ref = virNetDevOpenvswitchDBPair(tag, virJSONValueNewString(uuid))))
+        return NULL;
+
+    if (!(refs = virJSONValueNewArray()) ||
+        virJSONValueArrayAppend(refs, ref) < 0) {
+        virJSONValueFree(ref);
+        virJSONValueFree(refs);
+        return NULL;
+    }
+
+    return virNetDevOpenvswitchDBPair("set", refs);
+}
+
+/* Start the parameters of a "transact" request */
+static virJSONValuePtr
+virNetDevOpenvswitchDBNewOps(void)
+{
+    virJSONValuePtr ops;
+
+    if (!(ops = virJSONValueNewArray()) ||
+        virJSONValueArrayAppend(ops,
+                                virJSONValueNewString(VIR_NETDEV_OVS_DB_NAME)) < 0) {
+        virJSONValueFree(ops);
+        return NULL;
+    }
+
+    return ops;
+}
+
+/* Append the operation built from the NULL terminated list of arguments
+ * as accepted by virJSONValueObjectCreate() to @ops */
+static int ATTRIBUTE_SENTINEL
+virNetDevOpenvswitchDBAddOp(virJSONValuePtr ops, ...)
+{
+    virJSONValuePtr op = NULL;
+    va_list args;
+    int rc;
+
+    va_start(args, ops);
+    rc = virJSONValueObjectCreateVArgs(&op, args);
+    va_end(args);
+
+    if (rc < 0 || virJSONValueArrayAppend(ops, op) < 0) {
+        virJSONValueFree(op);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Append the operation removing the port @uuid from its bridge, which
+ * makes ovsdb-server garbage collect the port and its interfaces */
+static int
+virNetDevOpenvswitchDBAddDelPort(virJSONValuePtr ops,
+                                 const char *uuid)
+{
+    return virNetDevOpenvswitchDBAddOp(ops,
+                                       "s:op", "mutate",
+                                       "s:table", "Bridge",
+                                       "a:where", virJSONValueNewArray(),
+                                       "a:mutations",
+                                       virNetDevOpenvswitchDBClause("ports", "delete",
+                                           virNetDevOpenvswitchDBRefSet("uuid",
+                                                                        uuid)),
+                                       NULL);
+}
+
+/**
+ * virNetDevOpenvswitchDBTransact:
+ * @ops: parameters of the "transact" request, consumed
+ *
+ * Run the operations in @ops as a single transaction and, the same way
+ * ovs-vsctl does, wait until ovs-vswitchd has applied the new
+ * configuration.
+ *
+ * Returns 0 on success, -1 otherwise (with error reported).
+ */
+static int
+virNetDevOpenvswitchDBTransact(virJSONValuePtr ops)
+{
+    virJSONValuePtr result = NULL;
+    virJSONValuePtr msg = NULL;
+    virJSONValuePtr rows;
+    long long nextCfg;
+    long long deadline;
+    ssize_t nresults;
+    size_t i;
+    int ret = -1;
+    int rc;
+
+    if (virNetDevOpenvswitchDBAddOp(ops,
+                                    "s:op", "mutate",
+                                    "s:table", "Open_vSwitch",
+                                    "a:where", virJSONValueNewArray(),
+                                    "a:mutations",
+                                    virNetDevOpenvswitchDBClause("next_cfg", "+=",
+                                        virJSONValueNewNumberInt(1)),
+                                    NULL) < 0 ||
+        virNetDevOpenvswitchDBAddOp(ops,
+                                    "s:op", "select",
+                                    "s:table", "Open_vSwitch",
+                                    "a:where", virJSONValueNewArray(),
+                                    "a:columns",
+                                    virJSONValueFromString("[\"next_cfg\"]"),
+                                    NULL) < 0) {
+        virJSONValueFree(ops);
+        return -1;
+    }
+
+    if (virNetDevOpenvswitchDBCall("transact", ops, &result) < 0)
+        goto cleanup;
+
+    /* A failed operation aborts the whole transaction */
+    nresults = virJSONValueArraySize(result);
+    for (i = 0; i < nresults; i++) {
+        virJSONValuePtr opres = virJSONValueArrayGet(result, i);
+        const char *error = virJSONValueObjectGetString(opres, "error");
+
+        if (error) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("OVS database transaction failed: %s: %s"),
+                           error,
+                           NULLSTR(virJSONValueObjectGetString(opres,
+                                                               "details")));
+            goto cleanup;
+        }
+    }
+
+    if (nresults <= 0 ||
+        !(rows = virJSONValueObjectGetArray(virJSONValueArrayGet(result,
+                                                                 nresults - 1),
+                                            "rows")) ||
+        virJSONValueObjectGetNumberLong(virJSONValueArrayGet(rows, 0),
+                                        "next_cfg", &nextCfg) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed OVS database transaction result"));
+        goto cleanup;
+    }
+
+    if ((deadline = virNetDevOpenvswitchDBDeadline()) == -2)
+        goto cleanup;
+
+    while (ovsdb.curCfg < nextCfg) {
+        if ((rc = virNetDevOpenvswitchDBRead(deadline, &msg)) < 0)
+            goto cleanup;
+
+        if (rc == 0) {
+            virReportError(VIR_ERR_OPERATION_TIMEOUT, "%s",
+                           _("Timed out waiting for ovs-vswitchd to "
+                             "reconfigure"));
+            goto cleanup;
+        }
+
+        rc = virNetDevOpenvswitchDBDispatch(msg);
+        virJSONValueFree(msg);
+        msg = NULL;
+        if (rc < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virJSONValueFree(result);
+    return ret;
+}
+
+/* Build the <map> of strings from the NULL terminated list of key and
+ * value pairs, skipping those with NULL value */
+static virJSONValuePtr ATTRIBUTE_SENTINEL
+virNetDevOpenvswitchDBMap(const char *key, ...)
+{
+    virJSONValuePtr pairs;
+    virJSONValuePtr pair;
+    va_list args;
+
+    if (!(pairs = virJSONValueNewArray()))
+        return NULL;
+
+    va_start(args, key);
+    for (; key; key = va_arg(args, const char *)) {
+        const char *value = va_arg(args, const char *);
+
+        if (!value)
+            continue;
+
+        if (!(pair = virNetDevOpenvswitchDBPair(key,
+                                                virJSONValueNewString(value))) ||
+            virJSONValueArrayAppend(pairs, pair) < 0) {
+            virJSONValueFree(pair);
+            virJSONValueFree(pairs);
+            pairs = NULL;
+            break;
+        }
+    }
+    va_end(args);
+
+    return virNetDevOpenvswitchDBPair("map", pairs);
+}
+
+/* Build the Port row for @ifname's port */
+static virJSONValuePtr
+virNetDevOpenvswitchDBPortRow(const char *ifname,
+                              virNetDevVlanPtr virtVlan)
+{
+    virJSONValuePtr row = NULL;
+    virJSONValuePtr trunks = NULL;
+    const char *vlanMode = NULL;
+    int tag = -1;
+    size_t i;
+
+    if (virtVlan && virtVlan->nTags > 0) {
+        switch (virtVlan->nativeMode) {
+        case VIR_NATIVE_VLAN_MODE_TAGGED:
+            vlanMode = "native-tagged";
+            tag = virtVlan->nativeTag;
+            break;
+        case VIR_NATIVE_VLAN_MODE_UNTAGGED:
+            vlanMode = "native-untagged";
+            tag = virtVlan->nativeTag;
+            break;
+        case VIR_NATIVE_VLAN_MODE_DEFAULT:
+        default:
+            break;
+        }
+
+        if (virtVlan->trunk) {
+            virJSONValuePtr tags;
+
+            if (!(tags = virJSONValueNewArray()))
+                return NULL;
+
+            for (i = 0; i < virtVlan->nTags; i++) {
+                if (virJSONValueArrayAppend(tags,
+                                            virJSONValueNewNumberUint(virtVlan->tag[i])) < 0) {
+                    virJSONValueFree(tags);
+                    return NULL;
+                }
+            }
+
+            if (!(trunks = virNetDevOpenvswitchDBPair("set", tags)))
+                return NULL;
+        } else {
+            tag = virtVlan->tag[0];
+        }
+    }
+
+    if (virJSONValueObjectCreate(&row,
+                                 "s:name", ifname,
+                                 "a:interfaces",
+                                 virNetDevOpenvswitchDBPair("named-uuid",
+                                     virJSONValueNewString("iface")),
+                                 "S:vlan_mode", vlanMode,
+                                 "A:trunks", trunks,
+                                 NULL) < 0) {
+        virJSONValueFree(trunks);
+        return NULL;
+    }
+
+    if (tag >= 0 &&
+        virJSONValueObjectAppendNumberInt(row, "tag", tag) < 0) {
+        virJSONValueFree(row);
+        return NULL;
+    }
+
+    return row;
+}
+
+/* Build the Interface row for @ifname */
+static virJSONValuePtr
+virNetDevOpenvswitchDBIfaceRow(const char *ifname,
+                               const char *macaddrstr,
+                               const char *ifuuidstr,
+                               const char *vmuuidstr,
+                               virNetDevVPortProfilePtr ovsport)
+{
+    virJSONValuePtr row = NULL;
+    virJSONValuePtr externalIDs;
+
+    externalIDs = virNetDevOpenvswitchDBMap("attached-mac", macaddrstr,
+                                            "iface-id", ifuuidstr,
+                                            "vm-id", vmuuidstr,
+                                            "port-profile",
+                                            ovsport->profileID[0] != '\0' ?
+                                            ovsport->profileID : NULL,
+                                            "iface-status", "active",
+                                            NULL);
+
+    if (virJSONValueObjectCreate(&row,
+                                 "s:name", ifname,
+                                 "a:external_ids", externalIDs,
+                                 NULL) < 0)
+        return NULL;
+
+    return row;
+}
+
+static int
+virNetDevOpenvswitchDBAddPort(const char *brname,
+                              const char *ifname,
+                              const char *macaddrstr,
+                              const char *ifuuidstr,
+                              const char *vmuuidstr,
+                              virNetDevVPortProfilePtr ovsport,
+                              virNetDevVlanPtr virtVlan)
+{
+    virJSONValuePtr ops;
+    const char *oldPort;
+
+    if (!(ops = virNetDevOpenvswitchDBNewOps()))
+        return -1;
+
+    /* --if-exists del-port $ifname */
+    if ((oldPort = virHashLookup(ovsdb.ports, ifname)) &&
+        virNetDevOpenvswitchDBAddDelPort(ops, oldPort) < 0)
+        goto error;
+
+    /* add-port $brname $ifname, which fails unless the bridge exists,
+     * followed by setting the external IDs of the interface */
+    if (virNetDevOpenvswitchDBAddOp(ops,
+                                    "s:op", "wait",
+                                    "s:table", "Bridge",
+                                    "a:where",
+                                    virNetDevOpenvswitchDBClause("name", "==",
+                                        virJSONValueNewString(brname)),
+                                    "a:columns",
+                                    virJSONValueFromString("[\"name\"]"),
+                                    "s:until", "!=",
+                                    "a:rows", virJSONValueNewArray(),
+                                    "i:timeout", 0,
+                                    NULL) < 0 ||
+        virNetDevOpenvswitchDBAddOp(ops,
+                                    "s:op", "insert",
+                                    "s:table", "Interface",
+                                    "s:uuid-name", "iface",
+                                    "a:row",
+                                    virNetDevOpenvswitchDBIfaceRow(ifname,
+                                                                   macaddrstr,
+                                                                   ifuuidstr,
+                                                                   vmuuidstr,
+                                                                   ovsport),
+                                    NULL) < 0 ||
+        virNetDevOpenvswitchDBAddOp(ops,
+                                    "s:op", "insert",
+                                    "s:table", "Port",
+                                    "s:uuid-name", "port",
+                                    "a:row",
+                                    virNetDevOpenvswitchDBPortRow(ifname,
+                                                                  virtVlan),
+                                    NULL) < 0 ||
+        virNetDevOpenvswitchDBAddOp(ops,
+                                    "s:op", "mutate",
+                                    "s:table", "Bridge",
+                                    "a:where",
+                                    virNetDevOpenvswitchDBClause("name", "==",
+                                        virJSONValueNewString(brname)),
+                                    "a:mutations",
+                                    virNetDevOpenvswitchDBClause("ports", "insert",
+                                        virNetDevOpenvswitchDBRefSet("named-uuid",
+                                                                     "port")),
+                                    NULL) < 0)
+        goto error;
+
+    return virNetDevOpenvswitchDBTransact(ops);
+
+ error:
+    virJSONValueFree(ops);
+    return -1;
+}
+
+static int
+virNetDevOpenvswitchDBRemovePort(const char *ifname)
+{
+    virJSONValuePtr ops;
+    const char *port;
+
+    /* --if-exists */
+    if (!(port = virHashLookup(ovsdb.ports, ifname)))
+        return 0;
+
+    if (!(ops = virNetDevOpenvswitchDBNewOps()))
+        return -1;
+
+    if (virNetDevOpenvswitchDBAddDelPort(ops, port) < 0) {
+        virJSONValueFree(ops);
+        return -1;
+    }
+
+    return virNetDevOpenvswitchDBTransact(ops);
+}
+
+static int
+virNetDevOpenvswitchDBInterfaceStats(const char *ifname,
+                                     virDomainInterfaceStatsPtr stats)
+{
+    virNetDevOpenvswitchDBIfacePtr iface;
+
+    if (!(iface = virHashLookup(ovsdb.ifaces, ifname))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Interface not found"));
+        return -1;
+    }
+
+    if (!iface->hasStats) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Interface doesn't have statistics"));
+        return -1;
+    }
+
+    *stats = iface->stats;
+    return 0;
+}
+
 /**
  * virNetDevOpenvswitchAddPort:
  * @brname: the bridge name
@@ -82,6 +1271,7 @@ int virNetDevOpenvswitchAddPort(const char *brname, const char *ifname,
                                    virNetDevVlanPtr virtVlan)
 {
     int ret = -1;
+    int rc;
     size_t i = 0;
     virCommandPtr cmd = NULL;
     char macaddrstr[VIR_MAC_STRING_BUFLEN];
@@ -97,6 +1287,17 @@ int virNetDevOpenvswitchAddPort(const char *brname, const char *ifname,
     virUUIDFormat(ovsport->interfaceID, ifuuidstr);
     virUUIDFormat(vmuuid, vmuuidstr);
 
+    if ((rc = virNetDevOpenvswitchDBAcquire()) < 0)
+        return -1;
+
+    if (rc > 0) {
+        ret = virNetDevOpenvswitchDBAddPort(brname, ifname, macaddrstr,
+                                            ifuuidstr, vmuuidstr,
+                                            ovsport, virtVlan);
+        virNetDevOpenvswitchDBRelease();
+        return ret;
+    }
+
     if (virAsprintf(&attachedmac_ex_id, "external-ids:attached-mac=\"%s\"",
                     macaddrstr) < 0)
         goto cleanup;
@@ -205,8 +1406,18 @@ int virNetDevOpenvswitchAddPort(const char *brname, const char *ifname,
 int virNetDevOpenvswitchRemovePort(const char *brname ATTRIBUTE_UNUSED, const char *ifname)
 {
     int ret = -1;
+    int rc;
     virCommandPtr cmd = NULL;
 
+    if ((rc = virNetDevOpenvswitchDBAcquire()) < 0)
+        return -1;
+
+    if (rc > 0) {
+        ret = virNetDevOpenvswitchDBRemovePort(ifname);
+        virNetDevOpenvswitchDBRelease();
+        return ret;
+    }
+
     cmd = virCommandNew(OVSVSCTL);
     virNetDevOpenvswitchAddTimeout(cmd);
     virCommandAddArgList(cmd, "--", "--if-exists", "del-port", ifname, NULL);
@@ -326,6 +1537,16 @@ virNetDevOpenvswitchInterfaceStats(const char *ifname,
     long long tx_errs;
     long long tx_drop;
     int ret = -1;
+    int rc;
+
+    if ((rc = virNetDevOpenvswitchDBAcquire()) < 0)
+        return -1;
+
+    if (rc > 0) {
+        ret = virNetDevOpenvswitchDBInterfaceStats(ifname, stats);
+        virNetDevOpenvswitchDBRelease();
+        return ret;
+    }
 
     /* Just ensure the interface exists in ovs */
     cmd = virCommandNew(OVSVSCTL);
@@ -430,6 +1651,7 @@ virNetDevOpenvswitchGetVhostuserIfname(const char *path,
     size_t ntokens = 0;
     int status;
     int ret = -1;
+    int rc;
     char *ovs_timeout = NULL;
 
     /* Openvswitch vhostuser path are hardcoded to
@@ -444,6 +1666,26 @@ virNetDevOpenvswitchGetVhostuserIfname(const char *path,
         goto cleanup;
     }
 
+    if ((rc = virNetDevOpenvswitchDBAcquire()) < 0)
+        goto cleanup;
+
+    if (rc > 0) {
+        bool found = !!virHashLookup(ovsdb.ifaces, tmpIfname + 1);
+
+        virNetDevOpenvswitchDBRelease();
+
+        if (!found) {
+            /* it's not a openvswitch vhostuser interface. */
+            ret = 0;
+            goto cleanup;
+        }
+
+        if (VIR_STRDUP(*ifname, tmpIfname + 1) < 0)
+            goto cleanup;
+        ret = 1;
+        goto cleanup;
+    }
+
     cmd = virCommandNew(OVSVSCTL);
     virNetDevOpenvswitchAddTimeout(cmd);
     virCommandAddArgList(cmd, "get", "Interface", tmpIfname, "name", NULL);
@@ -676,24 +676,22 @@ int virNetDevTapCreateInBridgePort(const char *brname,
  * the interface of a domain they own.  We do no such checking.
  */
 #ifdef __linux__
-int
-virNetDevTapInterfaceStats(const char *ifname,
+/*
+ * Read the next interface from the /proc/net/dev stream @fp, storing
+ * its name in @ifname and its counters in @stats. The name points
+ * into @line. Returns 1 when an interface was read, 0 at the end of
+ * the file.
+ */
+static int
+virNetDevTapReadProcNetDev(FILE *fp,
+                           char *line,
+                           int linelen,
+                           char **ifname,
                            virDomainInterfaceStatsPtr stats)
 {
-    int ifname_len;
-    FILE *fp;
-    char line[256], *colon;
-
-    fp = fopen("/proc/net/dev", "r");
-    if (!fp) {
-        virReportSystemError(errno, "%s",
-                             _("Could not open /proc/net/dev"));
-        return -1;
-    }
-
-    ifname_len = strlen(ifname);
+    char *colon;
 
-    while (fgets(line, sizeof(line), fp)) {
+    while (fgets(line, linelen, fp)) {
         long long dummy;
         long long rx_bytes;
         long long rx_packets;
@@ -711,32 +709,59 @@ virNetDevTapInterfaceStats(const char *ifname,
         colon = strchr(line, ':');
         if (!colon) continue;
         *colon = '\0';
-        if (colon-ifname_len >= line &&
-            STREQ(colon-ifname_len, ifname)) {
-            /* IMPORTANT NOTE!
-             * /proc/net/dev vif<domid>.nn sees the network from the point
-             * of view of dom0 / hypervisor.  So bytes TRANSMITTED by dom0
-             * are bytes RECEIVED by the domain.  That's why the TX/RX fields
-             * appear to be swapped here.
-             */
-            if (sscanf(colon+1,
-                       "%lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld",
-                       &tx_bytes, &tx_packets, &tx_errs, &tx_drop,
-                       &dummy, &dummy, &dummy, &dummy,
-                       &rx_bytes, &rx_packets, &rx_errs, &rx_drop,
-                       &dummy, &dummy, &dummy, &dummy) != 16)
-                continue;
-
-            stats->rx_bytes = rx_bytes;
-            stats->rx_packets = rx_packets;
-            stats->rx_errs = rx_errs;
-            stats->rx_drop = rx_drop;
-            stats->tx_bytes = tx_bytes;
-            stats->tx_packets = tx_packets;
-            stats->tx_errs = tx_errs;
-            stats->tx_drop = tx_drop;
-            VIR_FORCE_FCLOSE(fp);
 
+        /* IMPORTANT NOTE!
+         * /proc/net/dev vif<domid>.nn sees the network from the point
+         * of view of dom0 / hypervisor.  So bytes TRANSMITTED by dom0
+         * are bytes RECEIVED by the domain.  That's why the TX/RX fields
+         * appear to be swapped here.
+         */
+        if (sscanf(colon+1,
+                   "%lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld",
+                   &tx_bytes, &tx_packets, &tx_errs, &tx_drop,
+                   &dummy, &dummy, &dummy, &dummy,
+                   &rx_bytes, &rx_packets, &rx_errs, &rx_drop,
+                   &dummy, &dummy, &dummy, &dummy) != 16)
+            continue;
+
+        stats->rx_bytes = rx_bytes;
+        stats->rx_packets = rx_packets;
+        stats->rx_errs = rx_errs;
+        stats->rx_drop = rx_drop;
+        stats->tx_bytes = tx_bytes;
+        stats->tx_packets = tx_packets;
+        stats->tx_errs = tx_errs;
+        stats->tx_drop = tx_drop;
+
+        *ifname = line;
+        virSkipSpaces((const char **) ifname);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+int
+virNetDevTapInterfaceStats(const char *ifname,
+                           virDomainInterfaceStatsPtr stats)
+{
+    FILE *fp;
+    /* The counters are 64 bit wide, 16 of them don't fit in 256 bytes */
+    char line[512];
+    char *name;
+
+    fp = fopen("/proc/net/dev", "r");
+    if (!fp) {
+        virReportSystemError(errno, "%s",
+                             _("Could not open /proc/net/dev"));
+        return -1;
+    }
+
+    while (virNetDevTapReadProcNetDev(fp, line, sizeof(line),
+                                      &name, stats) > 0) {
+        if (STREQ(name, ifname)) {
+            VIR_FORCE_FCLOSE(fp);
             return 0;
         }
     }
@@ -746,6 +771,48 @@ virNetDevTapInterfaceStats(const char *ifname,
                    _("/proc/net/dev: Interface not found"));
     return -1;
 }
+
+
+virHashTablePtr
+virNetDevTapInterfaceStatsAll(void)
+{
+    FILE *fp;
+    char line[512];
+    char *name;
+    virDomainInterfaceStatsStruct tmp;
+    virDomainInterfaceStatsPtr stats = NULL;
+    virHashTablePtr ret = NULL;
+
+    fp = fopen("/proc/net/dev", "r");
+    if (!fp) {
+        virReportSystemError(errno, "%s",
+                             _("Could not open /proc/net/dev"));
+        return NULL;
+    }
+
+    if (!(ret = virHashCreate(32, virHashValueFree)))
+        goto error;
+
+    while (virNetDevTapReadProcNetDev(fp, line, sizeof(line),
+                                      &name, &tmp) > 0) {
+        if (VIR_ALLOC(stats) < 0)
+            goto error;
+        *stats = tmp;
+
+        if (virHashUpdateEntry(ret, name, stats) < 0)
+            goto error;
+        stats = NULL;
+    }
+    VIR_FORCE_FCLOSE(fp);
+
+    return ret;
+
+ error:
+    VIR_FREE(stats);
+    virHashFree(ret);
+    VIR_FORCE_FCLOSE(fp);
+    return NULL;
+}
 #elif defined(HAVE_GETIFADDRS) && defined(AF_LINK)
 int
 virNetDevTapInterfaceStats(const char *ifname,
@@ -792,6 +859,60 @@ virNetDevTapInterfaceStats(const char *ifname,
     freeifaddrs(ifap);
     return ret;
 }
+
+
+virHashTablePtr
+virNetDevTapInterfaceStatsAll(void)
+{
+    struct ifaddrs *ifap, *ifa;
+    struct if_data *ifd;
+    virDomainInterfaceStatsPtr stats = NULL;
+    virHashTablePtr ret = NULL;
+
+    if (getifaddrs(&ifap) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Could not get interface list"));
+        return NULL;
+    }
+
+    if (!(ret = virHashCreate(32, virHashValueFree)))
+        goto error;
+
+    for (ifa = ifap; ifa; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr->sa_family != AF_LINK)
+            continue;
+
+        if (VIR_ALLOC(stats) < 0)
+            goto error;
+
+        ifd = (struct if_data *)ifa->ifa_data;
+        stats->tx_bytes = ifd->ifi_ibytes;
+        stats->tx_packets = ifd->ifi_ipackets;
+        stats->tx_errs = ifd->ifi_ierrors;
+        stats->tx_drop = ifd->ifi_iqdrops;
+        stats->rx_bytes = ifd->ifi_obytes;
+        stats->rx_packets = ifd->ifi_opackets;
+        stats->rx_errs = ifd->ifi_oerrors;
+# ifdef HAVE_STRUCT_IF_DATA_IFI_OQDROPS
+        stats->rx_drop = ifd->ifi_oqdrops;
+# else
+        stats->rx_drop = 0;
+# endif
+
+        if (virHashUpdateEntry(ret, ifa->ifa_name, stats) < 0)
+            goto error;
+        stats = NULL;
+    }
+
+    freeifaddrs(ifap);
+    return ret;
+
+ error:
+    VIR_FREE(stats);
+    virHashFree(ret);
+    freeifaddrs(ifap);
+    return NULL;
+}
 #else
 int
 virNetDevTapInterfaceStats(const char *ifname ATTRIBUTE_UNUSED,
@@ -802,4 +923,13 @@ virNetDevTapInterfaceStats(const char *ifname ATTRIBUTE_UNUSED,
     return -1;
 }
 
+
+virHashTablePtr
+virNetDevTapInterfaceStatsAll(void)
+{
+    virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                   _("interface stats not implemented on this platform"));
+    return NULL;
+}
+
 #endif /* __linux__ */
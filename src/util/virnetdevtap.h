@@ -26,6 +26,7 @@
 # include "internal.h"
 # include "virnetdevvportprofile.h"
 # include "virnetdevvlan.h"
+# include "virhash.h"
 
 # ifdef __FreeBSD__
 /* This should be defined on OSes that don't automatically
@@ -93,4 +94,6 @@ int virNetDevTapInterfaceStats(const char *ifname,
                                virDomainInterfaceStatsPtr stats)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
+virHashTablePtr virNetDevTapInterfaceStatsAll(void);
+
 #endif /* __VIR_NETDEV_TAP_H__ */
@@ -34,6 +34,11 @@
 #include "virstring.h"
 #include "virutil.h"
 #include "virnetdev.h"
+#include "virnetlink.h"
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+# include <linux/veth.h>
+#endif
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -83,12 +88,173 @@ static int virNetDevVethGetFreeNum(int startDev)
     return -1;
 }
 
+#if defined(__linux__) && defined(HAVE_LIBNL)
+/*
+ * Create the pair with a single RTM_NEWLINK message, the peer's
+ * name, MAC address and MTU are nested in its VETH_INFO_PEER.
+ *
+ * Returns 0 on success, 1 if one of the names is taken already and
+ * -1 on any other error.
+ */
+static int
+virNetDevVethCreateInternal(const char *veth1,
+                            const char *veth2,
+                            const virMacAddr *mac2,
+                            unsigned int mtu)
+{
+    const char *type = "veth";
+    int rc = -1;
+    struct nlmsghdr *resp = NULL;
+    struct nlmsgerr *err;
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+    unsigned int recvbuflen;
+    struct nl_msg *nl_msg;
+    struct nlattr *linkinfo, *infodata, *peer;
+
+    nl_msg = nlmsg_alloc_simple(RTM_NEWLINK,
+                                NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL);
+    if (!nl_msg) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (nlmsg_append(nl_msg,  &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0)
+        goto buffer_too_small;
+    if (nla_put(nl_msg, IFLA_IFNAME, strlen(veth1)+1, veth1) < 0)
+        goto buffer_too_small;
+    if (mtu && nla_put_u32(nl_msg, IFLA_MTU, mtu) < 0)
+        goto buffer_too_small;
+
+    if (!(linkinfo = nla_nest_start(nl_msg, IFLA_LINKINFO)))
+        goto buffer_too_small;
+    if (nla_put(nl_msg, IFLA_INFO_KIND, strlen(type), type) < 0)
+        goto buffer_too_small;
+    if (!(infodata = nla_nest_start(nl_msg, IFLA_INFO_DATA)))
+        goto buffer_too_small;
+    if (!(peer = nla_nest_start(nl_msg, VETH_INFO_PEER)))
+        goto buffer_too_small;
+    if (nlmsg_append(nl_msg,  &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0)
+        goto buffer_too_small;
+    if (nla_put(nl_msg, IFLA_IFNAME, strlen(veth2)+1, veth2) < 0)
+        goto buffer_too_small;
+    if (mac2 && nla_put(nl_msg, IFLA_ADDRESS, VIR_MAC_BUFLEN, mac2->addr) < 0)
+        goto buffer_too_small;
+    if (mtu && nla_put_u32(nl_msg, IFLA_MTU, mtu) < 0)
+        goto buffer_too_small;
+    nla_nest_end(nl_msg, peer);
+    nla_nest_end(nl_msg, infodata);
+    nla_nest_end(nl_msg, linkinfo);
+
+    if (virNetlinkCommand(nl_msg, &resp, &recvbuflen, 0, 0,
+                          NETLINK_ROUTE, 0) < 0) {
+        goto cleanup;
+    }
+
+    if (recvbuflen < NLMSG_LENGTH(0) || resp == NULL)
+        goto malformed_resp;
+
+    switch (resp->nlmsg_type) {
+    case NLMSG_ERROR:
+        err = (struct nlmsgerr *)NLMSG_DATA(resp);
+        if (resp->nlmsg_len < NLMSG_LENGTH(sizeof(*err)))
+            goto malformed_resp;
+
+        switch (err->error) {
+        case 0:
+            break;
+        case -EEXIST:
+            VIR_DEBUG("Failed to create veth host: %s guest: %s: %s",
+                      veth1, veth2, "File exists");
+            rc = 1;
+            goto cleanup;
+        default:
+            virReportSystemError(-err->error,
+                                 _("error creating veth pair %s and %s"),
+                                 veth1, veth2);
+            goto cleanup;
+        }
+        break;
+
+    case NLMSG_DONE:
+        break;
+    default:
+        goto malformed_resp;
+    }
+
+    rc = 0;
+ cleanup:
+    nlmsg_free(nl_msg);
+    VIR_FREE(resp);
+    return rc;
+
+ malformed_resp:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("malformed netlink response message"));
+    goto cleanup;
+ buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    goto cleanup;
+}
+
+
+#else
+/*
+ * Create the pair using the ip command:
+ * ip link add veth1 type veth peer name veth2
+ * and set the peer's MAC address and both MTUs afterwards.
+ *
+ * Returns 0 on success, 1 if ip failed to create the pair and -1 on
+ * any other error.
+ */
+static int
+virNetDevVethCreateInternal(const char *veth1,
+                            const char *veth2,
+                            const virMacAddr *mac2,
+                            unsigned int mtu)
+{
+    virCommandPtr cmd = NULL;
+    int status;
+    int ret = -1;
+
+    cmd = virCommandNew("ip");
+    virCommandAddArgList(cmd, "link", "add", veth1,
+                         "type", "veth", "peer", "name", veth2,
+                         NULL);
+
+    if (virCommandRun(cmd, &status) < 0)
+        goto cleanup;
+
+    if (status != 0) {
+        VIR_DEBUG("Failed to create veth host: %s guest: %s: %d",
+                  veth1, veth2, status);
+        ret = 1;
+        goto cleanup;
+    }
+
+    if ((mac2 && virNetDevSetMAC(veth2, mac2) < 0) ||
+        (mtu && (virNetDevSetMTU(veth1, mtu) < 0 ||
+                 virNetDevSetMTU(veth2, mtu) < 0))) {
+        ignore_value(virNetDevVethDelete(veth1));
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virCommandFree(cmd);
+    return ret;
+}
+#endif
+
+
 /**
  * virNetDevVethCreate:
  * @veth1: pointer to name for parent end of veth pair
  * @veth2: pointer to return name for container end of veth pair
+ * @mac2: MAC address for the container end, or NULL
+ * @mtu: MTU of both ends, or 0 for the default
  *
- * Creates a veth device pair using the ip command:
+ * Creates a veth device pair, which is similar to the ip command:
  * ip link add veth1 type veth peer name veth2
  * If veth1 points to NULL on entry, it will be a valid interface on
  * return.  veth2 should point to NULL on entry.
@@ -103,18 +269,18 @@ static int virNetDevVethGetFreeNum(int startDev)
  *          is no longer visible in the parent namespace.  This seems to
  *          confuse the name assignment causing it to fail with File exists.
  *       Because of these issues, this function currently allocates names
- *       prior to using the ip command, and returns any allocated names
+ *       prior to creating the pair, and returns any allocated names
  *       to the caller.
  *
  * Returns 0 on success or -1 in case of error
  */
-int virNetDevVethCreate(char** veth1, char** veth2)
+int virNetDevVethCreate(char** veth1, char** veth2,
+                        const virMacAddr *mac2, unsigned int mtu)
 {
     int ret = -1;
     char *veth1auto = NULL;
     char *veth2auto = NULL;
     int vethNum = 0;
-    virCommandPtr cmd = NULL;
     size_t i;
 
     /*
@@ -125,7 +291,7 @@ int virNetDevVethCreate(char** veth1, char** veth2)
 #define MAX_VETH_RETRIES 10
 
     for (i = 0; i < MAX_VETH_RETRIES; i++) {
-        int status;
+        int rc;
         if (!*veth1) {
             int veth1num;
             if ((veth1num = virNetDevVethGetFreeNum(vethNum)) < 0)
@@ -145,17 +311,13 @@ int virNetDevVethCreate(char** veth1, char** veth2)
             vethNum = veth2num + 1;
         }
 
-        cmd = virCommandNew("ip");
-        virCommandAddArgList(cmd, "link", "add",
-                             *veth1 ? *veth1 : veth1auto,
-                             "type", "veth", "peer", "name",
-                             *veth2 ? *veth2 : veth2auto,
-                             NULL);
-
-        if (virCommandRun(cmd, &status) < 0)
+        rc = virNetDevVethCreateInternal(*veth1 ? *veth1 : veth1auto,
+                                         *veth2 ? *veth2 : veth2auto,
+                                         mac2, mtu);
+        if (rc < 0)
             goto cleanup;
 
-        if (status == 0) {
+        if (rc == 0) {
             if (veth1auto) {
                 *veth1 = veth1auto;
                 veth1auto = NULL;
@@ -169,14 +331,8 @@ int virNetDevVethCreate(char** veth1, char** veth2)
             goto cleanup;
         }
 
-        VIR_DEBUG("Failed to create veth host: %s guest: %s: %d",
-                  *veth1 ? *veth1 : veth1auto,
-                  *veth2 ? *veth2 : veth2auto,
-                  status);
         VIR_FREE(veth1auto);
         VIR_FREE(veth2auto);
-        virCommandFree(cmd);
-        cmd = NULL;
     }
 
     virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -185,7 +341,6 @@ int virNetDevVethCreate(char** veth1, char** veth2)
 
  cleanup:
     virMutexUnlock(&virNetDevVethCreateMutex);
-    virCommandFree(cmd);
     VIR_FREE(veth1auto);
     VIR_FREE(veth2auto);
     return ret;
@@ -196,12 +351,27 @@ int virNetDevVethCreate(char** veth1, char** veth2)
  * @veth: name for one end of veth pair
  *
  * This will delete both veth devices in a pair.  Only one end needs to
- * be specified.  The ip command will identify and delete the other veth
- * device as well.
+ * be specified.  The kernel will identify and delete the other veth
+ * device as well, the same way as
  * ip link del veth
  *
  * Returns 0 on success or -1 in case of error
  */
+#if defined(__linux__) && defined(HAVE_LIBNL)
+int virNetDevVethDelete(const char *veth)
+{
+    if (virNetlinkDelLink(veth, NULL) < 0) {
+        if (!virNetDevExists(veth)) {
+            virResetLastError();
+            VIR_DEBUG("Device %s already deleted (by kernel namespace cleanup)", veth);
+            return 0;
+        }
+        return -1;
+    }
+
+    return 0;
+}
+#else
 int virNetDevVethDelete(const char *veth)
 {
     virCommandPtr cmd = virCommandNewArgList("ip", "link", "del", veth, NULL);
@@ -227,3 +397,4 @@ int virNetDevVethDelete(const char *veth)
     virCommandFree(cmd);
     return ret;
 }
+#endif
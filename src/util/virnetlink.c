@@ -382,6 +382,137 @@ virNetlinkDumpCommand(struct nl_msg *nl_msg,
     return ret;
 }
 
+/**
+ * virNetlinkCommandBatch:
+ * @msgs: netlink messages to send
+ * @nmsgs: number of messages in @msgs
+ * @errors: filled in with the error code the kernel acknowledged each
+ *      message with, i.e. 0 or a negative errno value
+ * @protocol: netlink protocol
+ *
+ * Send all the given messages to the kernel in a single datagram and
+ * wait until each of them has been acknowledged. The kernel processes
+ * the messages in order and keeps going after one of them has failed,
+ * so it is up to the caller to decide what to do about @errors.
+ *
+ * Returns 0 if all messages were acknowledged, -1 on error.
+ */
+int
+virNetlinkCommandBatch(struct nl_msg **msgs, size_t nmsgs, int *errors,
+                       unsigned int protocol)
+{
+    int ret = -1;
+    struct sockaddr_nl nladdr;
+    virNetlinkHandle *nlhandle = NULL;
+    struct nlmsghdr *resp = NULL;
+    struct nlmsghdr *msg;
+    char *buf = NULL;
+    size_t buflen = 0;
+    size_t off = 0;
+    size_t nacked = 0;
+    size_t i;
+    int len;
+    int fd;
+
+    if (protocol >= MAX_LINKS) {
+        virReportSystemError(EINVAL,
+                             _("invalid protocol argument: %d"), protocol);
+        return -1;
+    }
+
+    if (!nmsgs)
+        return 0;
+
+    for (i = 0; i < nmsgs; i++)
+        buflen += NLMSG_ALIGN(nlmsg_hdr(msgs[i])->nlmsg_len);
+
+    if (VIR_ALLOC_N(buf, buflen) < 0)
+        return -1;
+
+    for (i = 0; i < nmsgs; i++) {
+        struct nlmsghdr *nlmsg = nlmsg_hdr(msgs[i]);
+
+        nlmsg->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+        nlmsg->nlmsg_seq = i + 1;
+        nlmsg->nlmsg_pid = getpid();
+        memcpy(buf + off, nlmsg, nlmsg->nlmsg_len);
+        off += NLMSG_ALIGN(nlmsg->nlmsg_len);
+
+        /* not acknowledged yet */
+        errors[i] = 1;
+    }
+
+    if (!(nlhandle = virNetlinkCreateSocket(protocol)))
+        goto cleanup;
+
+    fd = nl_socket_get_fd(nlhandle);
+    if (fd < 0) {
+        virReportSystemError(errno,
+                             "%s", _("cannot get netlink socket fd"));
+        goto cleanup;
+    }
+
+    if (nl_sendto(nlhandle, buf, buflen) < 0) {
+        virReportSystemError(errno,
+                             "%s", _("cannot send to netlink socket"));
+        goto cleanup;
+    }
+
+    while (nacked < nmsgs) {
+        struct pollfd fds[1] = { { .fd = fd, .events = POLLIN } };
+        int n = poll(fds, ARRAY_CARDINALITY(fds), NETLINK_ACK_TIMEOUT_S);
+
+        if (n <= 0) {
+            if (n < 0)
+                virReportSystemError(errno, "%s",
+                                     _("error in poll call"));
+            else
+                virReportSystemError(ETIMEDOUT, "%s",
+                                     _("no valid netlink response was received"));
+            goto cleanup;
+        }
+
+        len = nl_recv(nlhandle, &nladdr, (unsigned char **)&resp, NULL);
+        if (len <= 0) {
+            if (len == 0)
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("nl_recv failed - returned 0 bytes"));
+            else
+                virReportSystemError(errno, "%s", _("nl_recv failed"));
+            goto cleanup;
+        }
+
+        VIR_WARNINGS_NO_CAST_ALIGN
+        for (msg = resp; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+            VIR_WARNINGS_RESET
+            struct nlmsgerr *err;
+
+            if (msg->nlmsg_type != NLMSG_ERROR ||
+                msg->nlmsg_seq < 1 || msg->nlmsg_seq > nmsgs ||
+                errors[msg->nlmsg_seq - 1] != 1)
+                continue;
+
+            if (msg->nlmsg_len < NLMSG_LENGTH(sizeof(*err))) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("malformed netlink response message"));
+                goto cleanup;
+            }
+            err = (struct nlmsgerr *)NLMSG_DATA(msg);
+            errors[msg->nlmsg_seq - 1] = err->error;
+            nacked++;
+        }
+        VIR_FREE(resp);
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(resp);
+    VIR_FREE(buf);
+    virNetlinkFree(nlhandle);
+    return ret;
+}
+
 /**
  * virNetlinkDumpLink:
  *
@@ -1108,6 +1239,16 @@ int virNetlinkCommand(struct nl_msg *nl_msg ATTRIBUTE_UNUSED,
     return -1;
 }
 
+int
+virNetlinkCommandBatch(struct nl_msg **msgs ATTRIBUTE_UNUSED,
+                       size_t nmsgs ATTRIBUTE_UNUSED,
+                       int *errors ATTRIBUTE_UNUSED,
+                       unsigned int protocol ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
 int
 virNetlinkDumpCommand(struct nl_msg *nl_msg ATTRIBUTE_UNUSED,
                       virNetlinkDumpCallback callback ATTRIBUTE_UNUSED,
@@ -52,6 +52,9 @@ int virNetlinkCommand(struct nl_msg *nl_msg,
                       uint32_t src_pid, uint32_t dst_pid,
                       unsigned int protocol, unsigned int groups);
 
+int virNetlinkCommandBatch(struct nl_msg **msgs, size_t nmsgs, int *errors,
+                           unsigned int protocol);
+
 typedef int (*virNetlinkDumpCallback)(const struct nlmsghdr *resp,
                                       void *data);
 
@@ -46,6 +46,8 @@
 #include "virstring.h"
 #include "virfile.h"
 #include "virhostmem.h"
+#include "virhash.h"
+#include "virobject.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -1018,3 +1020,453 @@ virNumaGetHostMemoryNodeset(void)
 
     return nodeset;
 }
+
+
+/*
+ * Hugepage reservation ledger
+ *
+ * Huge pages backing a domain are not necessarily taken from the pool
+ * by the time the domain is started, so the free page counts in sysfs
+ * can't tell whether another domain still fits. The ledger remembers
+ * how many pages each domain was promised instead and compares that to
+ * the size of the pools, which only changes when a pool is resized.
+ */
+typedef struct _virNumaPagePool virNumaPagePool;
+typedef virNumaPagePool *virNumaPagePoolPtr;
+struct _virNumaPagePool {
+    int node;                       /* -1 for the host wide pool */
+    unsigned int page_size;         /* in KiB */
+    unsigned long long total;       /* pages in the pool */
+    unsigned long long reserved;    /* pages promised to owners */
+};
+
+typedef struct _virNumaPageOwner virNumaPageOwner;
+typedef virNumaPageOwner *virNumaPageOwnerPtr;
+struct _virNumaPageOwner {
+    virNumaPageReservationPtr res;
+    size_t nres;
+};
+
+struct _virNumaPageLedger {
+    virObjectLockable parent;
+
+    virNumaPagePoolPtr pools;
+    size_t npools;
+
+    virHashTablePtr owners;         /* owner name -> virNumaPageOwner */
+};
+
+static virClassPtr virNumaPageLedgerClass;
+
+static void
+virNumaPageLedgerDispose(void *obj)
+{
+    virNumaPageLedgerPtr ledger = obj;
+
+    VIR_FREE(ledger->pools);
+    virHashFree(ledger->owners);
+}
+
+static int
+virNumaOnceInit(void)
+{
+    if (!(virNumaPageLedgerClass = virClassNew(virClassForObjectLockable(),
+                                               "virNumaPageLedger",
+                                               sizeof(virNumaPageLedger),
+                                               virNumaPageLedgerDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNuma)
+
+
+static void
+virNumaPageOwnerFree(void *payload,
+                     const void *name ATTRIBUTE_UNUSED)
+{
+    virNumaPageOwnerPtr owner = payload;
+
+    VIR_FREE(owner->res);
+    VIR_FREE(owner);
+}
+
+
+static virNumaPagePoolPtr
+virNumaPageLedgerFindPool(virNumaPageLedgerPtr ledger,
+                          int node,
+                          unsigned int page_size)
+{
+    size_t i;
+
+    for (i = 0; i < ledger->npools; i++) {
+        if (ledger->pools[i].node == node &&
+            ledger->pools[i].page_size == page_size)
+            return &ledger->pools[i];
+    }
+
+    return NULL;
+}
+
+
+/* Account @res to the pools, or take it back if @add is false. Every
+ * reservation counts against the host wide pool too. */
+static void
+virNumaPageLedgerApply(virNumaPageLedgerPtr ledger,
+                       const virNumaPageReservation *res,
+                       size_t nres,
+                       bool add)
+{
+    virNumaPagePoolPtr pool;
+    size_t i;
+
+    for (i = 0; i < nres; i++) {
+        int nodes[] = { -1, res[i].node };
+        size_t j;
+
+        for (j = 0; j < (res[i].node < 0 ? 1 : 2); j++) {
+            if (!(pool = virNumaPageLedgerFindPool(ledger, nodes[j],
+                                                   res[i].page_size)))
+                continue;
+
+            if (add)
+                pool->reserved += res[i].npages;
+            else
+                pool->reserved -= MIN(pool->reserved, res[i].npages);
+        }
+    }
+}
+
+
+static int
+virNumaPageLedgerApplyOwner(void *payload,
+                            const void *name ATTRIBUTE_UNUSED,
+                            void *opaque)
+{
+    virNumaPageOwnerPtr owner = payload;
+
+    virNumaPageLedgerApply(opaque, owner->res, owner->nres, true);
+    return 0;
+}
+
+
+/* Returns true if none of the pools @res is taken from is promised
+ * more pages than it has, otherwise reports an error. Pools not known
+ * to the ledger are not checked at all. */
+static bool
+virNumaPageLedgerCheck(virNumaPageLedgerPtr ledger,
+                       const virNumaPageReservation *res,
+                       size_t nres)
+{
+    virNumaPagePoolPtr pool;
+    size_t i;
+
+    for (i = 0; i < nres; i++) {
+        if (res[i].node >= 0 &&
+            (pool = virNumaPageLedgerFindPool(ledger, res[i].node,
+                                              res[i].page_size)) &&
+            pool->reserved > pool->total) {
+            virReportError(VIR_ERR_OPERATION_FAILED,
+                           _("not enough huge pages of size %u KiB on "
+                             "NUMA node %d: %llu requested, %llu left"),
+                           res[i].page_size, res[i].node, res[i].npages,
+                           pool->total - MIN(pool->total,
+                                             pool->reserved - res[i].npages));
+            return false;
+        }
+
+        if ((pool = virNumaPageLedgerFindPool(ledger, -1,
+                                              res[i].page_size)) &&
+            pool->reserved > pool->total) {
+            virReportError(VIR_ERR_OPERATION_FAILED,
+                           _("not enough huge pages of size %u KiB: "
+                             "%llu requested, %llu left"),
+                           res[i].page_size, res[i].npages,
+                           pool->total - MIN(pool->total,
+                                             pool->reserved - res[i].npages));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+static int
+virNumaPageLedgerReadPools(virNumaPageLedgerPtr ledger)
+{
+    virNumaPagePoolPtr pools = NULL;
+    size_t npools = 0;
+    unsigned int *pages_size = NULL;
+    unsigned int *pages_avail = NULL;
+    size_t npages;
+    unsigned int system_page_size = virGetSystemPageSizeKB();
+    int max_node = -1;
+    int node;
+    size_t i;
+    int ret = -1;
+
+    if (virNumaIsAvailable() &&
+        (max_node = virNumaGetMaxNode()) < 0)
+        goto cleanup;
+
+    for (node = -1; node <= max_node; node++) {
+        if (node >= 0 && !virNumaNodeIsAvailable(node))
+            continue;
+
+        if (virNumaGetPages(node, &pages_size, &pages_avail,
+                            NULL, &npages) < 0)
+            goto cleanup;
+
+        for (i = 0; i < npages; i++) {
+            virNumaPagePool pool = { node, pages_size[i], pages_avail[i], 0 };
+
+            if (pages_size[i] == system_page_size)
+                continue;
+
+            if (VIR_APPEND_ELEMENT(pools, npools, pool) < 0)
+                goto cleanup;
+        }
+
+        VIR_FREE(pages_size);
+        VIR_FREE(pages_avail);
+    }
+
+    VIR_FREE(ledger->pools);
+    ledger->pools = pools;
+    ledger->npools = npools;
+    pools = NULL;
+
+    virHashForEach(ledger->owners, virNumaPageLedgerApplyOwner, ledger);
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(pools);
+    VIR_FREE(pages_size);
+    VIR_FREE(pages_avail);
+    return ret;
+}
+
+
+/**
+ * virNumaPageLedgerNew:
+ *
+ * Create a ledger of huge pages reserved from the host's pools. Not
+ * being able to read the pools is not fatal, nothing is checked by
+ * virNumaPageLedgerReserve() then.
+ *
+ * Returns the new ledger or NULL on error.
+ */
+virNumaPageLedgerPtr
+virNumaPageLedgerNew(void)
+{
+    virNumaPageLedgerPtr ledger;
+
+    if (virNumaInitialize() < 0)
+        return NULL;
+
+    if (!(ledger = virObjectLockableNew(virNumaPageLedgerClass)))
+        return NULL;
+
+    if (!(ledger->owners = virHashCreate(32, virNumaPageOwnerFree))) {
+        virObjectUnref(ledger);
+        return NULL;
+    }
+
+    if (virNumaPageLedgerReadPools(ledger) < 0) {
+        VIR_WARN("Unable to read huge page pools: %s",
+                 virGetLastErrorMessage());
+        virResetLastError();
+    }
+
+    return ledger;
+}
+
+
+/**
+ * virNumaPageLedgerRefresh:
+ * @ledger: the ledger
+ *
+ * Read the size of the huge page pools again, for example after they
+ * were resized.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virNumaPageLedgerRefresh(virNumaPageLedgerPtr ledger)
+{
+    int ret;
+
+    virObjectLock(ledger);
+    ret = virNumaPageLedgerReadPools(ledger);
+    virObjectUnlock(ledger);
+
+    return ret;
+}
+
+
+/**
+ * virNumaPageLedgerReserve:
+ * @ledger: the ledger
+ * @name: owner of the reservation
+ * @res: huge pages to reserve
+ * @nres: number of items in @res
+ * @force: don't check that there are enough huge pages
+ *
+ * Reserve huge pages for @name, replacing anything reserved for it
+ * before. Unless @force is true, this fails if a pool @res is taken
+ * from would be promised more pages than it has. As the pools might
+ * have been resized behind our back, they are read again before
+ * giving up.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virNumaPageLedgerReserve(virNumaPageLedgerPtr ledger,
+                         const char *name,
+                         const virNumaPageReservation *res,
+                         size_t nres,
+                         bool force)
+{
+    virNumaPageOwnerPtr owner = NULL;
+    virNumaPageOwnerPtr old;
+    int ret = -1;
+
+    virObjectLock(ledger);
+
+    if (VIR_ALLOC(owner) < 0 ||
+        VIR_ALLOC_N(owner->res, nres) < 0)
+        goto cleanup;
+    memcpy(owner->res, res, sizeof(*res) * nres);
+    owner->nres = nres;
+
+    if ((old = virHashLookup(ledger->owners, name)))
+        virNumaPageLedgerApply(ledger, old->res, old->nres, false);
+    virNumaPageLedgerApply(ledger, res, nres, true);
+
+    if (!force && !virNumaPageLedgerCheck(ledger, res, nres)) {
+        virErrorPtr err = virSaveLastError();
+
+        VIR_DEBUG("Reading huge page pools again for '%s'", name);
+        virNumaPageLedgerApply(ledger, res, nres, false);
+        if (old)
+            virNumaPageLedgerApply(ledger, old->res, old->nres, true);
+
+        if (virNumaPageLedgerReadPools(ledger) < 0) {
+            virSetError(err);
+            virFreeError(err);
+            goto cleanup;
+        }
+        virFreeError(err);
+
+        virNumaPageLedgerApply(ledger, res, nres, true);
+        if (old)
+            virNumaPageLedgerApply(ledger, old->res, old->nres, false);
+
+        if (!virNumaPageLedgerCheck(ledger, res, nres)) {
+            virNumaPageLedgerApply(ledger, res, nres, false);
+            if (old)
+                virNumaPageLedgerApply(ledger, old->res, old->nres, true);
+            goto cleanup;
+        }
+    }
+
+    if (virHashUpdateEntry(ledger->owners, name, owner) < 0) {
+        virNumaPageLedgerApply(ledger, res, nres, false);
+        if (old)
+            virNumaPageLedgerApply(ledger, old->res, old->nres, true);
+        goto cleanup;
+    }
+    owner = NULL;
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(ledger);
+    if (owner)
+        virNumaPageOwnerFree(owner, NULL);
+    return ret;
+}
+
+
+/**
+ * virNumaPageLedgerRelease:
+ * @ledger: the ledger
+ * @name: owner of the reservation
+ *
+ * Give back any huge pages reserved for @name.
+ */
+void
+virNumaPageLedgerRelease(virNumaPageLedgerPtr ledger,
+                         const char *name)
+{
+    virNumaPageOwnerPtr owner;
+
+    virObjectLock(ledger);
+    if ((owner = virHashLookup(ledger->owners, name))) {
+        virNumaPageLedgerApply(ledger, owner->res, owner->nres, false);
+        virHashRemoveEntry(ledger->owners, name);
+    }
+    virObjectUnlock(ledger);
+}
+
+
+/**
+ * virNumaPageLedgerGetReserved:
+ * @ledger: the ledger
+ * @npages: number of items in @pages
+ * @pages: page sizes to query, in KiB
+ * @startCell: first NUMA node to query
+ * @cellCount: maximum number of NUMA nodes to query
+ * @counts: returned counts of reserved pages
+ *
+ * The counterpart of virHostMemGetFreePages() telling how many pages
+ * are reserved on each NUMA node. Pages reserved without any NUMA node
+ * being known are only accounted to the host wide pools, which are
+ * queried with @startCell of -1.
+ *
+ * Returns the number of items stored in @counts, -1 on error.
+ */
+int
+virNumaPageLedgerGetReserved(virNumaPageLedgerPtr ledger,
+                             unsigned int npages,
+                             unsigned int *pages,
+                             int startCell,
+                             unsigned int cellCount,
+                             unsigned long long *counts)
+{
+    virNumaPagePoolPtr pool;
+    int cell, lastCell;
+    size_t i, ncounts = 0;
+
+    if ((lastCell = virNumaGetMaxNode()) < 0)
+        return 0;
+
+    if (startCell > lastCell) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("start cell %d out of range (0-%d)"),
+                       startCell, lastCell);
+        return -1;
+    }
+
+    lastCell = MIN(lastCell, startCell + (int) cellCount - 1);
+
+    virObjectLock(ledger);
+    for (cell = startCell; cell <= lastCell; cell++) {
+        for (i = 0; i < npages; i++) {
+            pool = virNumaPageLedgerFindPool(ledger, cell, pages[i]);
+            counts[ncounts++] = pool ? pool->reserved : 0;
+        }
+    }
+    virObjectUnlock(ledger);
+
+    if (!ncounts) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("no suitable info found"));
+        return -1;
+    }
+
+    return ncounts;
+}
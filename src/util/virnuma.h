@@ -64,4 +64,34 @@ int virNumaSetPagePoolSize(int node,
                            unsigned int page_size,
                            unsigned long long page_count,
                            bool add);
+
+typedef struct _virNumaPageReservation virNumaPageReservation;
+typedef virNumaPageReservation *virNumaPageReservationPtr;
+struct _virNumaPageReservation {
+    int node;                   /* host NUMA node, -1 if not bound to one */
+    unsigned int page_size;     /* in KiB */
+    unsigned long long npages;
+};
+
+typedef struct _virNumaPageLedger virNumaPageLedger;
+typedef virNumaPageLedger *virNumaPageLedgerPtr;
+
+virNumaPageLedgerPtr virNumaPageLedgerNew(void);
+int virNumaPageLedgerRefresh(virNumaPageLedgerPtr ledger);
+int virNumaPageLedgerReserve(virNumaPageLedgerPtr ledger,
+                             const char *name,
+                             const virNumaPageReservation *res,
+                             size_t nres,
+                             bool force)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+void virNumaPageLedgerRelease(virNumaPageLedgerPtr ledger,
+                              const char *name)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+int virNumaPageLedgerGetReserved(virNumaPageLedgerPtr ledger,
+                                 unsigned int npages,
+                                 unsigned int *pages,
+                                 int startCell,
+                                 unsigned int cellCount,
+                                 unsigned long long *counts)
+    ATTRIBUTE_NONNULL(1);
 #endif /* __VIR_NUMA_H__ */
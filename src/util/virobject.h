@@ -34,6 +34,9 @@ typedef virObject *virObjectPtr;
 typedef struct _virObjectLockable virObjectLockable;
 typedef virObjectLockable *virObjectLockablePtr;
 
+typedef struct _virObjectRWLockable virObjectRWLockable;
+typedef virObjectRWLockable *virObjectRWLockablePtr;
+
 typedef void (*virObjectDisposeCallback)(void *obj);
 
 /* Most code should not play with the contents of this struct; however,
@@ -59,9 +62,15 @@ struct _virObjectLockable {
     virMutex lock;
 };
 
+struct _virObjectRWLockable {
+    virObject parent;
+    virRWLock lock;
+};
+
 
 virClassPtr virClassForObject(void);
 virClassPtr virClassForObjectLockable(void);
+virClassPtr virClassForObjectRWLockable(void);
 
 # ifndef VIR_PARENT_REQUIRED
 #  define VIR_PARENT_REQUIRED ATTRIBUTE_NONNULL(1)
@@ -83,6 +92,7 @@ void *virObjectNew(virClassPtr klass)
     ATTRIBUTE_NONNULL(1);
 bool virObjectUnref(void *obj);
 void *virObjectRef(void *obj);
+int virObjectGetRefs(void *obj);
 
 bool virObjectIsClass(void *obj,
                       virClassPtr klass)
@@ -99,6 +109,16 @@ void virObjectLock(void *lockableobj)
 void virObjectUnlock(void *lockableobj)
     ATTRIBUTE_NONNULL(1);
 
+void *virObjectRWLockableNew(virClassPtr klass)
+    ATTRIBUTE_NONNULL(1);
+
+void virObjectRWLockRead(void *lockableobj)
+    ATTRIBUTE_NONNULL(1);
+void virObjectRWLockWrite(void *lockableobj)
+    ATTRIBUTE_NONNULL(1);
+void virObjectRWUnlock(void *lockableobj)
+    ATTRIBUTE_NONNULL(1);
+
 void virObjectListFree(void *list);
 void virObjectListFreeCount(void *list, size_t count);
 
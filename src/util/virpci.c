@@ -100,6 +100,25 @@ struct _virPCIDeviceList {
     virPCIDevicePtr *devs;
 };
 
+typedef struct _virPCITopologyDevice virPCITopologyDevice;
+typedef virPCITopologyDevice *virPCITopologyDevicePtr;
+struct _virPCITopologyDevice {
+    virPCIDeviceAddress address;
+    int iommuGroup;             /* -1 if there's none */
+    bool bridge;                /* PCI-to-PCI bridge with the buses below */
+    uint8_t secondary;
+    uint8_t subordinate;
+};
+
+typedef struct _virPCITopology virPCITopology;
+typedef virPCITopology *virPCITopologyPtr;
+struct _virPCITopology {
+    virObject parent;
+
+    virPCITopologyDevicePtr devices;  /* sorted by address */
+    size_t ndevices;
+};
+
 
 /* For virReportOOMError()  and virReportSystemError() */
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -198,8 +217,10 @@ struct _virPCIDeviceList {
 #define PCI_EXP_TYPE_ROOT_EC 0xa        /* Root Complex Event Collector */
 
 static virClassPtr virPCIDeviceListClass;
+static virClassPtr virPCITopologyClass;
 
 static void virPCIDeviceListDispose(void *obj);
+static void virPCITopologyDispose(void *obj);
 
 static int virPCIOnceInit(void)
 {
@@ -209,6 +230,12 @@ static int virPCIOnceInit(void)
                                               virPCIDeviceListDispose)))
         return -1;
 
+    if (!(virPCITopologyClass = virClassNew(virClassForObject(),
+                                            "virPCITopology",
+                                            sizeof(virPCITopology),
+                                            virPCITopologyDispose)))
+        return -1;
+
     return 0;
 }
 
@@ -437,73 +464,194 @@ virPCIDeviceWrite32(virPCIDevicePtr dev, int cfgfd, unsigned int pos, uint32_t v
     virPCIDeviceWrite(dev, cfgfd, pos, &buf[0], sizeof(buf));
 }
 
-typedef int (*virPCIDeviceIterPredicate)(virPCIDevicePtr, virPCIDevicePtr,
-                                         void *);
-
-/* Iterate over available PCI devices calling @predicate
- * to compare each one to @dev.
- * Return -1 on error since we don't want to assume it is
- * safe to reset if there is an error.
+/*
+ * The PCI topology index
+ *
+ * Finding out which devices share a bus, which bridge a device is
+ * behind or which devices share an IOMMU group would need a walk over
+ * all of PCI_SYSFS "devices" each time, reading the config space of
+ * every bridge on the way. The index holds the bits of all the devices
+ * these questions are answered from. It is built on first use and
+ * thrown away on hotplug by virPCITopologyInvalidate(), or whenever a
+ * device missing from it is asked about.
  */
+static virMutex virPCITopologyLock = VIR_MUTEX_INITIALIZER;
+static virPCITopologyPtr virPCITopologyCurrent;
+
+
 static int
-virPCIDeviceIterDevices(virPCIDeviceIterPredicate predicate,
-                        virPCIDevicePtr dev,
-                        virPCIDevicePtr *matched,
-                        void *data)
+virPCITopologyDeviceCompare(const void *a, const void *b)
+{
+    const virPCIDeviceAddress *aa = &((const virPCITopologyDevice *) a)->address;
+    const virPCIDeviceAddress *ba = &((const virPCITopologyDevice *) b)->address;
+
+    if (aa->domain != ba->domain)
+        return aa->domain < ba->domain ? -1 : 1;
+    if (aa->bus != ba->bus)
+        return aa->bus < ba->bus ? -1 : 1;
+    if (aa->slot != ba->slot)
+        return aa->slot < ba->slot ? -1 : 1;
+    if (aa->function != ba->function)
+        return aa->function < ba->function ? -1 : 1;
+    return 0;
+}
+
+
+static void
+virPCITopologyDispose(void *obj)
 {
-    DIR *dir;
+    virPCITopologyPtr topology = obj;
+
+    VIR_FREE(topology->devices);
+}
+
+
+/* Failing to read anything but the address makes the device a plain
+ * one with no IOMMU group, just as if it was skipped by a walk over
+ * sysfs */
+static int
+virPCITopologyFillDevice(virPCITopologyDevicePtr entry)
+{
+    virPCIDevicePtr dev;
+    uint16_t device_class;
+    int fd;
+
+    entry->iommuGroup = virPCIDeviceAddressGetIOMMUGroupNum(&entry->address);
+    if (entry->iommuGroup < 0) {
+        if (entry->iommuGroup == -1)
+            virResetLastError();
+        entry->iommuGroup = -1;
+    }
+
+    if (!(dev = virPCIDeviceNew(entry->address.domain, entry->address.bus,
+                                entry->address.slot, entry->address.function)))
+        return -1;
+
+    if (virPCIDeviceReadClass(dev, &device_class) < 0) {
+        virResetLastError();
+        goto cleanup;
+    }
+
+    if (device_class != PCI_CLASS_BRIDGE_PCI ||
+        (fd = virPCIDeviceConfigOpen(dev, false)) < 0)
+        goto cleanup;
+
+    if ((virPCIDeviceRead8(dev, fd, PCI_HEADER_TYPE) &
+         PCI_HEADER_TYPE_MASK) == PCI_HEADER_TYPE_BRIDGE) {
+        entry->bridge = true;
+        entry->secondary = virPCIDeviceRead8(dev, fd, PCI_SECONDARY_BUS);
+        entry->subordinate = virPCIDeviceRead8(dev, fd, PCI_SUBORDINATE_BUS);
+    }
+
+    virPCIDeviceConfigClose(dev, fd);
+
+ cleanup:
+    virPCIDeviceFree(dev);
+    return 0;
+}
+
+
+static virPCITopologyPtr
+virPCITopologyNew(void)
+{
+    virPCITopologyPtr topology;
+    DIR *dir = NULL;
     struct dirent *entry;
-    int ret = 0;
     int rc;
 
-    *matched = NULL;
+    if (!(topology = virObjectNew(virPCITopologyClass)))
+        return NULL;
 
-    VIR_DEBUG("%s %s: iterating over " PCI_SYSFS "devices", dev->id, dev->name);
+    VIR_DEBUG("Indexing " PCI_SYSFS "devices");
 
     if (virDirOpen(&dir, PCI_SYSFS "devices") < 0)
-        return -1;
+        goto error;
 
-    while ((ret = virDirRead(dir, &entry, PCI_SYSFS "devices")) > 0) {
-        unsigned int domain, bus, slot, function;
-        virPCIDevicePtr check;
-        char *tmp;
+    while ((rc = virDirRead(dir, &entry, PCI_SYSFS "devices")) > 0) {
+        virPCITopologyDevice dev = { .iommuGroup = -1 };
 
         /* expected format: <domain>:<bus>:<slot>.<function> */
-        if (/* domain */
-            virStrToLong_ui(entry->d_name, &tmp, 16, &domain) < 0 || *tmp != ':' ||
-            /* bus */
-            virStrToLong_ui(tmp + 1, &tmp, 16, &bus) < 0 || *tmp != ':' ||
-            /* slot */
-            virStrToLong_ui(tmp + 1, &tmp, 16, &slot) < 0 || *tmp != '.' ||
-            /* function */
-            virStrToLong_ui(tmp + 1, NULL, 16, &function) < 0) {
+        if (virPCIDeviceAddressParse(entry->d_name, &dev.address) < 0) {
             VIR_WARN("Unusual entry in " PCI_SYSFS "devices: %s", entry->d_name);
             continue;
         }
 
-        check = virPCIDeviceNew(domain, bus, slot, function);
-        if (!check) {
-            ret = -1;
-            break;
+        if (virPCITopologyFillDevice(&dev) < 0 ||
+            VIR_APPEND_ELEMENT(topology->devices, topology->ndevices, dev) < 0)
+            goto error;
+    }
+    if (rc < 0)
+        goto error;
+
+    VIR_DIR_CLOSE(dir);
+
+    qsort(topology->devices, topology->ndevices,
+          sizeof(*topology->devices), virPCITopologyDeviceCompare);
+
+    return topology;
+
+ error:
+    VIR_DIR_CLOSE(dir);
+    virObjectUnref(topology);
+    return NULL;
+}
+
+
+/* Get the index along with the entry for @addr. If @addr is not in
+ * the index, it is built again in case the device has just appeared,
+ * @entry is NULL if it is still missing. */
+static virPCITopologyPtr
+virPCITopologyGet(virPCIDeviceAddressPtr addr,
+                  virPCITopologyDevicePtr *entry)
+{
+    virPCITopologyPtr topology = NULL;
+    virPCITopologyDevice key = { .address = *addr };
+    virPCITopologyDevicePtr found = NULL;
+    size_t attempt;
+
+    if (virPCIInitialize() < 0)
+        return NULL;
+
+    virMutexLock(&virPCITopologyLock);
+    for (attempt = 0; attempt < 2 && !found; attempt++) {
+        if (attempt > 0) {
+            VIR_DEBUG("%.4x:%.2x:%.2x.%.1x is not indexed yet",
+                      addr->domain, addr->bus, addr->slot, addr->function);
+            virObjectUnref(virPCITopologyCurrent);
+            virPCITopologyCurrent = NULL;
         }
 
-        rc = predicate(dev, check, data);
-        if (rc < 0) {
-            /* the predicate returned an error, bail */
-            virPCIDeviceFree(check);
-            ret = -1;
-            break;
-        } else if (rc == 1) {
-            VIR_DEBUG("%s %s: iter matched on %s", dev->id, dev->name, check->name);
-            *matched = check;
-            ret = 1;
+        if (!virPCITopologyCurrent &&
+            !(virPCITopologyCurrent = virPCITopologyNew()))
             break;
-        }
 
-        virPCIDeviceFree(check);
+        found = bsearch(&key, virPCITopologyCurrent->devices,
+                        virPCITopologyCurrent->ndevices,
+                        sizeof(*virPCITopologyCurrent->devices),
+                        virPCITopologyDeviceCompare);
     }
-    VIR_DIR_CLOSE(dir);
-    return ret;
+    topology = virObjectRef(virPCITopologyCurrent);
+    virMutexUnlock(&virPCITopologyLock);
+
+    if (entry)
+        *entry = found;
+    return topology;
+}
+
+
+/**
+ * virPCITopologyInvalidate:
+ *
+ * Throw away the index of PCI devices, so that it's built again the
+ * next time it's needed, e.g. because a PCI device (dis)appeared.
+ */
+void
+virPCITopologyInvalidate(void)
+{
+    virMutexLock(&virPCITopologyLock);
+    virObjectUnref(virPCITopologyCurrent);
+    virPCITopologyCurrent = NULL;
+    virMutexUnlock(&virPCITopologyLock);
 }
 
 static uint8_t
@@ -653,133 +801,100 @@ virPCIDeviceDetectPowerManagementReset(virPCIDevicePtr dev, int cfgfd)
 }
 
 /* Any active devices on the same domain/bus ? */
-static int
-virPCIDeviceSharesBusWithActive(virPCIDevicePtr dev, virPCIDevicePtr check, void *data)
-{
-    virPCIDeviceList *inactiveDevs = data;
-
-    /* Different domain, different bus, or simply identical device */
-    if (dev->address.domain != check->address.domain ||
-        dev->address.bus != check->address.bus ||
-        (dev->address.slot == check->address.slot &&
-         dev->address.function == check->address.function))
-        return 0;
-
-    /* same bus, but inactive, i.e. about to be assigned to guest */
-    if (inactiveDevs && virPCIDeviceListFind(inactiveDevs, check))
-        return 0;
-
-    return 1;
-}
-
 static virPCIDevicePtr
 virPCIDeviceBusContainsActiveDevices(virPCIDevicePtr dev,
                                      virPCIDeviceList *inactiveDevs)
 {
+    virPCITopologyPtr topology;
     virPCIDevicePtr active = NULL;
-    if (virPCIDeviceIterDevices(virPCIDeviceSharesBusWithActive,
-                                dev, &active, inactiveDevs) < 0)
+    size_t i;
+
+    if (!(topology = virPCITopologyGet(&dev->address, NULL)))
         return NULL;
+
+    for (i = 0; i < topology->ndevices; i++) {
+        virPCIDeviceAddressPtr addr = &topology->devices[i].address;
+
+        /* Different domain, different bus, or simply identical device */
+        if (dev->address.domain != addr->domain ||
+            dev->address.bus != addr->bus ||
+            (dev->address.slot == addr->slot &&
+             dev->address.function == addr->function))
+            continue;
+
+        /* same bus, but inactive, i.e. about to be assigned to guest */
+        if (inactiveDevs &&
+            virPCIDeviceListFindByIDs(inactiveDevs, addr->domain, addr->bus,
+                                      addr->slot, addr->function))
+            continue;
+
+        if ((active = virPCIDeviceNew(addr->domain, addr->bus,
+                                      addr->slot, addr->function)))
+            VIR_DEBUG("%s %s: found active device %s",
+                      dev->id, dev->name, active->name);
+        break;
+    }
+
+    virObjectUnref(topology);
     return active;
 }
 
-/* Is @check the parent of @dev ? */
+/* Find the bridge @dev is behind. Returns 1 if it is directly behind
+ * @parent, 0 if @parent is the closest bridge having the bus of @dev
+ * in its range, or NULL if there's none, -1 on error. */
 static int
-virPCIDeviceIsParent(virPCIDevicePtr dev, virPCIDevicePtr check, void *data)
+virPCIDeviceGetParent(virPCIDevicePtr dev, virPCIDevicePtr *parent)
 {
-    uint16_t device_class;
-    uint8_t header_type, secondary, subordinate;
-    virPCIDevicePtr *best = data;
+    virPCITopologyPtr topology;
+    virPCITopologyDevicePtr best = NULL;
     int ret = 0;
-    int fd;
-
-    if (dev->address.domain != check->address.domain)
-        return 0;
-
-    if ((fd = virPCIDeviceConfigOpen(check, false)) < 0)
-        return 0;
-
-    /* Is it a bridge? */
-    ret = virPCIDeviceReadClass(check, &device_class);
-    if (ret < 0 || device_class != PCI_CLASS_BRIDGE_PCI)
-        goto cleanup;
+    size_t i;
 
-    /* Is it a plane? */
-    header_type = virPCIDeviceRead8(check, fd, PCI_HEADER_TYPE);
-    if ((header_type & PCI_HEADER_TYPE_MASK) != PCI_HEADER_TYPE_BRIDGE)
-        goto cleanup;
+    *parent = NULL;
 
-    secondary   = virPCIDeviceRead8(check, fd, PCI_SECONDARY_BUS);
-    subordinate = virPCIDeviceRead8(check, fd, PCI_SUBORDINATE_BUS);
+    if (!(topology = virPCITopologyGet(&dev->address, NULL)))
+        return -1;
 
-    VIR_DEBUG("%s %s: found parent device %s", dev->id, dev->name, check->name);
+    for (i = 0; i < topology->ndevices; i++) {
+        virPCITopologyDevicePtr check = &topology->devices[i];
 
-    /* if the secondary bus exactly equals the device's bus, then we found
-     * the direct parent.  No further work is necessary
-     */
-    if (dev->address.bus == secondary) {
-        ret = 1;
-        goto cleanup;
-    }
+        if (!check->bridge ||
+            check->address.domain != dev->address.domain)
+            continue;
 
-    /* otherwise, SRIOV allows VFs to be on different buses than their PFs.
-     * In this case, what we need to do is look for the "best" match; i.e.
-     * the most restrictive match that still satisfies all of the conditions.
-     */
-    if (dev->address.bus > secondary && dev->address.bus <= subordinate) {
-        if (*best == NULL) {
-            *best = virPCIDeviceNew(check->address.domain,
-                                    check->address.bus,
-                                    check->address.slot,
-                                    check->address.function);
-            if (*best == NULL) {
-                ret = -1;
-                goto cleanup;
-            }
-        } else {
-            /* OK, we had already recorded a previous "best" match for the
-             * parent.  See if the current device is more restrictive than the
-             * best, and if so, make it the new best
-             */
-            int bestfd;
-            uint8_t best_secondary;
-
-            if ((bestfd = virPCIDeviceConfigOpen(*best, false)) < 0)
-                goto cleanup;
-            best_secondary = virPCIDeviceRead8(*best, bestfd, PCI_SECONDARY_BUS);
-            virPCIDeviceConfigClose(*best, bestfd);
-
-            if (secondary > best_secondary) {
-                virPCIDeviceFree(*best);
-                *best = virPCIDeviceNew(check->address.domain,
-                                        check->address.bus,
-                                        check->address.slot,
-                                        check->address.function);
-                if (*best == NULL) {
-                    ret = -1;
-                    goto cleanup;
-                }
-            }
+        /* if the secondary bus exactly equals the device's bus, then we
+         * found the direct parent.  No further work is necessary
+         */
+        if (dev->address.bus == check->secondary) {
+            best = check;
+            ret = 1;
+            break;
         }
+
+        /* otherwise, SRIOV allows VFs to be on different buses than their
+         * PFs. In this case, what we need to do is look for the "best"
+         * match; i.e. the most restrictive match that still satisfies all
+         * of the conditions.
+         */
+        if (dev->address.bus > check->secondary &&
+            dev->address.bus <= check->subordinate &&
+            (!best || check->secondary > best->secondary))
+            best = check;
     }
 
- cleanup:
-    virPCIDeviceConfigClose(check, fd);
-    return ret;
-}
+    if (best) {
+        VIR_DEBUG("%s %s: found parent device %.4x:%.2x:%.2x.%.1x",
+                  dev->id, dev->name, best->address.domain, best->address.bus,
+                  best->address.slot, best->address.function);
 
-static int
-virPCIDeviceGetParent(virPCIDevicePtr dev, virPCIDevicePtr *parent)
-{
-    virPCIDevicePtr best = NULL;
-    int ret;
+        if (!(*parent = virPCIDeviceNew(best->address.domain,
+                                        best->address.bus,
+                                        best->address.slot,
+                                        best->address.function)))
+            ret = -1;
+    }
 
-    *parent = NULL;
-    ret = virPCIDeviceIterDevices(virPCIDeviceIsParent, dev, parent, &best);
-    if (ret == 1)
-        virPCIDeviceFree(best);
-    else if (ret == 0)
-        *parent = best;
+    virObjectUnref(topology);
     return ret;
 }
 
@@ -2189,44 +2304,35 @@ virPCIDeviceAddressIOMMUGroupIterate(virPCIDeviceAddressPtr orig,
                                      virPCIDeviceAddressActor actor,
                                      void *opaque)
 {
-    char *groupPath = NULL;
-    DIR *groupDir = NULL;
+    virPCITopologyPtr topology;
+    virPCITopologyDevicePtr entry;
     int ret = -1;
-    struct dirent *ent;
-    int direrr;
+    size_t i;
 
-    if (virAsprintf(&groupPath,
-                    PCI_SYSFS "devices/%04x:%02x:%02x.%x/iommu_group/devices",
-                    orig->domain, orig->bus, orig->slot, orig->function) < 0)
-        goto cleanup;
+    if (!(topology = virPCITopologyGet(orig, &entry)))
+        return -1;
 
-    if (virDirOpenQuiet(&groupDir, groupPath) < 0) {
+    if (!entry || entry->iommuGroup < 0) {
         /* just process the original device, nothing more */
         ret = (actor)(orig, opaque);
         goto cleanup;
     }
 
-    while ((direrr = virDirRead(groupDir, &ent, groupPath)) > 0) {
+    for (i = 0; i < topology->ndevices; i++) {
         virPCIDeviceAddress newDev;
 
-        if (virPCIDeviceAddressParse(ent->d_name, &newDev) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("Found invalid device link '%s' in '%s'"),
-                           ent->d_name, groupPath);
-            goto cleanup;
-        }
+        if (topology->devices[i].iommuGroup != entry->iommuGroup)
+            continue;
 
+        newDev = topology->devices[i].address;
         if ((actor)(&newDev, opaque) < 0)
             goto cleanup;
     }
-    if (direrr < 0)
-        goto cleanup;
 
     ret = 0;
 
  cleanup:
-    VIR_FREE(groupPath);
-    VIR_DIR_CLOSE(groupDir);
+    virObjectUnref(topology);
     return ret;
 }
 
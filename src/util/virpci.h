@@ -243,4 +243,6 @@ int virPCIGetHeaderType(virPCIDevicePtr dev, int *hdrType);
 
 void virPCIEDeviceInfoFree(virPCIEDeviceInfoPtr dev);
 
+void virPCITopologyInvalidate(void);
+
 #endif /* __VIR_PCI_H__ */
@@ -31,6 +31,7 @@
 #include "virlog.h"
 #include "virfile.h"
 #include "virstring.h"
+#include "virtime.h"
 #include "virtypedparam.h"
 
 VIR_LOG_INIT("util.perf");
@@ -53,6 +54,8 @@ struct virPerfEvent {
     int type;
     int fd;
     bool enabled;
+    bool grouped;   /* a member of the group, read along with it */
+    uint64_t id;    /* identifies the event in a read of the group */
     union {
         /* cmt */
         struct {
@@ -62,8 +65,30 @@ struct virPerfEvent {
 };
 typedef struct virPerfEvent *virPerfEventPtr;
 
+/* Counter values at one point in time, @valid tells which events were
+ * enabled since the previous sample */
+struct virPerfSample {
+    unsigned long long timestamp;   /* in milliseconds */
+    uint64_t values[VIR_PERF_EVENT_LAST];
+    unsigned long long valid;
+};
+typedef struct virPerfSample *virPerfSamplePtr;
+
+verify(VIR_PERF_EVENT_LAST <= sizeof(unsigned long long) * CHAR_BIT);
+
 struct virPerf {
     struct virPerfEvent events[VIR_PERF_EVENT_LAST];
+
+    /* The leader of the group all counters are put in if possible, so
+     * that they count over the same intervals and can be read by one
+     * read(). -1 if it is not open. */
+    int groupFd;
+    size_t ngroupedHardware;
+
+    /* ring buffer of the last samples, @nextSample is the oldest */
+    struct virPerfSample samples[VIR_PERF_SAMPLES];
+    size_t nsamples;
+    size_t nextSample;
 };
 
 #if defined(__linux__) && defined(HAVE_SYS_SYSCALL_H)
@@ -199,6 +224,19 @@ virPerfRdtAttrInit(void)
 }
 
 
+/* Forget the samples of @type, for example because its counter starts
+ * from zero again */
+static void
+virPerfSamplesInvalidate(virPerfPtr perf,
+                         virPerfEventType type)
+{
+    size_t i;
+
+    for (i = 0; i < VIR_PERF_SAMPLES; i++)
+        perf->samples[i].valid &= ~(1ULL << type);
+}
+
+
 static virPerfEventPtr
 virPerfGetEvent(virPerfPtr perf,
                 virPerfEventType type)
@@ -216,6 +254,87 @@ virPerfGetEvent(virPerfPtr perf,
     return perf->events + type;
 }
 
+
+# if defined(PERF_COUNT_SW_DUMMY) && defined(PERF_EVENT_IOC_ID)
+/* All events of a group are scheduled on the PMU together and a group
+ * needing more counters than the PMU has is never scheduled at all, so
+ * any hardware events beyond this many are counted on their own */
+#  define VIR_PERF_GROUP_MAX_HARDWARE 4
+
+/* The leader is a software event counting nothing, so that it never
+ * fails to be scheduled and stays around while the events in the group
+ * are enabled and disabled */
+static int
+virPerfGroupOpen(virPerfPtr perf,
+                 pid_t pid)
+{
+    struct perf_event_attr attr;
+
+    if (perf->groupFd >= 0)
+        return 0;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.inherit = 1;
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_DUMMY;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID;
+
+    perf->groupFd = syscall(__NR_perf_event_open, &attr, pid, -1, -1, 0);
+    if (perf->groupFd < 0) {
+        char ebuf[1024];
+
+        VIR_DEBUG("Unable to open perf event group: %s",
+                  virStrerror(errno, ebuf, sizeof(ebuf)));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static bool
+virPerfGroupAccepts(virPerfPtr perf,
+                    virPerfEventAttrPtr event_attr)
+{
+    if (event_attr->attrType == PERF_TYPE_SOFTWARE)
+        return true;
+
+    return event_attr->attrType == PERF_TYPE_HARDWARE &&
+        perf->ngroupedHardware < VIR_PERF_GROUP_MAX_HARDWARE;
+}
+
+
+static int
+virPerfGroupGetID(virPerfEventPtr event)
+{
+    return ioctl(event->fd, PERF_EVENT_IOC_ID, &event->id);
+}
+# else
+static int
+virPerfGroupOpen(virPerfPtr perf ATTRIBUTE_UNUSED,
+                 pid_t pid ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+
+static bool
+virPerfGroupAccepts(virPerfPtr perf ATTRIBUTE_UNUSED,
+                    virPerfEventAttrPtr event_attr ATTRIBUTE_UNUSED)
+{
+    return false;
+}
+
+
+static int
+virPerfGroupGetID(virPerfEventPtr event ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+# endif
+
+
 int
 virPerfEventEnable(virPerfPtr perf,
                    virPerfEventType type,
@@ -263,7 +382,21 @@ virPerfEventEnable(virPerfPtr perf,
     attr.type = event_attr->attrType;
     attr.config = event_attr->attrConfig;
 
-    event->fd = syscall(__NR_perf_event_open, &attr, pid, -1, -1, 0);
+    /* Joining the group is best effort, the event is counted on its
+     * own if that fails */
+    if (virPerfGroupAccepts(perf, event_attr) &&
+        virPerfGroupOpen(perf, pid) == 0) {
+        event->fd = syscall(__NR_perf_event_open, &attr, pid, -1,
+                            perf->groupFd, 0);
+        if (event->fd >= 0 && virPerfGroupGetID(event) == 0)
+            event->grouped = true;
+        else
+            VIR_FORCE_CLOSE(event->fd);
+    }
+
+    if (!event->grouped)
+        event->fd = syscall(__NR_perf_event_open, &attr, pid, -1, -1, 0);
+
     if (event->fd < 0) {
         virReportSystemError(errno,
                              _("unable to open host cpu perf event for %s"),
@@ -278,10 +411,15 @@ virPerfEventEnable(virPerfPtr perf,
         goto error;
     }
 
+    if (event->grouped && event_attr->attrType == PERF_TYPE_HARDWARE)
+        perf->ngroupedHardware++;
+
+    virPerfSamplesInvalidate(perf, type);
     event->enabled = true;
     return 0;
 
  error:
+    event->grouped = false;
     VIR_FORCE_CLOSE(event->fd);
     VIR_FREE(buf);
     return -1;
@@ -305,7 +443,12 @@ virPerfEventDisable(virPerfPtr perf,
         return -1;
     }
 
+    if (event->grouped && attrs[type].attrType == PERF_TYPE_HARDWARE)
+        perf->ngroupedHardware--;
+
+    virPerfSamplesInvalidate(perf, type);
     event->enabled = false;
+    event->grouped = false;
     VIR_FORCE_CLOSE(event->fd);
     return 0;
 }
@@ -341,6 +484,75 @@ virPerfReadEvent(virPerfPtr perf,
     return 0;
 }
 
+
+/**
+ * virPerfReadEvents:
+ * @perf: perf events of a domain
+ * @values: array of VIR_PERF_EVENT_LAST counter values
+ *
+ * Read the counters of all enabled events into @values, indexed by the
+ * type of the event. The counters of all events in the group are read
+ * by a single syscall, on top of one for each of the other events.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virPerfReadEvents(virPerfPtr perf,
+                  uint64_t *values)
+{
+    /* { nr, { value, id } * nr }, the group leader included */
+    uint64_t buf[1 + 2 * (VIR_PERF_EVENT_LAST + 1)];
+    bool group = false;
+    ssize_t len;
+    size_t i, j;
+
+    for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
+        if (!perf->events[i].enabled)
+            continue;
+
+        if (perf->events[i].grouped)
+            group = true;
+        else if (virPerfReadEvent(perf, i, &values[i]) < 0)
+            return -1;
+    }
+
+    if (!group)
+        return 0;
+
+    /* saferead would try reading again if less than the whole buffer
+     * was returned */
+    do {
+        len = read(perf->groupFd, buf, sizeof(buf));
+    } while (len < 0 && errno == EINTR);
+
+    if (len < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to read perf event group"));
+        return -1;
+    }
+
+    if (len < sizeof(buf[0]) ||
+        len < sizeof(buf[0]) * (1 + 2 * buf[0])) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Short read of perf event group: %zd bytes"), len);
+        return -1;
+    }
+
+    for (j = 0; j < buf[0]; j++) {
+        for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
+            virPerfEventPtr event = &perf->events[i];
+
+            if (event->enabled && event->grouped &&
+                event->id == buf[2 + 2 * j]) {
+                values[i] = buf[1 + 2 * j];
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
 #else
 static int
 virPerfRdtAttrInit(void)
@@ -385,8 +597,101 @@ virPerfReadEvent(virPerfPtr perf ATTRIBUTE_UNUSED,
     return -1;
 }
 
+int
+virPerfReadEvents(virPerfPtr perf ATTRIBUTE_UNUSED,
+                  uint64_t *values ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENXIO, "%s",
+                         _("Perf not supported on this platform"));
+    return -1;
+}
+
 #endif
 
+
+/**
+ * virPerfSample:
+ * @perf: perf events of a domain
+ *
+ * Read the counters of all enabled events and add them to the samples
+ * kept by @perf, replacing the oldest one once there are
+ * VIR_PERF_SAMPLES of them.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virPerfSample(virPerfPtr perf)
+{
+    struct virPerfSample sample = { 0 };
+    size_t i;
+
+    if (virTimeMillisNow(&sample.timestamp) < 0 ||
+        virPerfReadEvents(perf, sample.values) < 0)
+        return -1;
+
+    for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
+        if (perf->events[i].enabled)
+            sample.valid |= 1ULL << i;
+    }
+
+    perf->samples[perf->nextSample] = sample;
+    perf->nextSample = (perf->nextSample + 1) % VIR_PERF_SAMPLES;
+    if (perf->nsamples < VIR_PERF_SAMPLES)
+        perf->nsamples++;
+
+    return 0;
+}
+
+
+/**
+ * virPerfGetEventRate:
+ * @perf: perf events of a domain
+ * @type: event
+ * @rate: filled with the number of events per second
+ *
+ * Compute how often @type happened per second between the oldest and
+ * the newest sample of it. Not available for events which are not
+ * counters, like VIR_PERF_EVENT_CMT.
+ *
+ * Returns 1 if @rate was set, 0 if there are less than two samples of
+ * @type to compute it from.
+ */
+int
+virPerfGetEventRate(virPerfPtr perf,
+                    virPerfEventType type,
+                    uint64_t *rate)
+{
+    virPerfSamplePtr newest = NULL;
+    virPerfSamplePtr oldest = NULL;
+    size_t i;
+
+    if (type == VIR_PERF_EVENT_CMT)
+        return 0;
+
+    /* walk from the newest sample back for as long as @type was valid */
+    for (i = 1; i <= perf->nsamples; i++) {
+        virPerfSamplePtr sample;
+
+        sample = &perf->samples[(perf->nextSample + VIR_PERF_SAMPLES - i) %
+                                VIR_PERF_SAMPLES];
+        if (!(sample->valid & (1ULL << type)))
+            break;
+
+        if (!newest)
+            newest = sample;
+        oldest = sample;
+    }
+
+    if (!newest || newest == oldest ||
+        newest->timestamp <= oldest->timestamp ||
+        newest->values[type] < oldest->values[type])
+        return 0;
+
+    *rate = (newest->values[type] - oldest->values[type]) * 1000 /
+        (newest->timestamp - oldest->timestamp);
+    return 1;
+}
+
 virPerfPtr
 virPerfNew(void)
 {
@@ -401,6 +706,7 @@ virPerfNew(void)
         perf->events[i].fd = -1;
         perf->events[i].enabled = false;
     }
+    perf->groupFd = -1;
 
     if (virPerfRdtAttrInit() < 0)
         virResetLastError();
@@ -421,5 +727,6 @@ virPerfFree(virPerfPtr perf)
             virPerfEventDisable(perf, i);
     }
 
+    VIR_FORCE_CLOSE(perf->groupFd);
     VIR_FREE(perf);
 }
@@ -62,6 +62,9 @@ typedef enum {
 
 VIR_ENUM_DECL(virPerfEvent);
 
+/* Number of samples of the counters kept by virPerfSample */
+# define VIR_PERF_SAMPLES 16
+
 struct virPerf;
 typedef struct virPerf *virPerfPtr;
 
@@ -83,4 +86,13 @@ int virPerfReadEvent(virPerfPtr perf,
                      virPerfEventType type,
                      uint64_t *value);
 
+int virPerfReadEvents(virPerfPtr perf,
+                      uint64_t *values);
+
+int virPerfSample(virPerfPtr perf);
+
+int virPerfGetEventRate(virPerfPtr perf,
+                        virPerfEventType type,
+                        uint64_t *rate);
+
 #endif /* __VIR_PERF_H__ */
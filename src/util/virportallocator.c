@@ -32,13 +32,24 @@
 #include "virerror.h"
 #include "virfile.h"
 #include "virstring.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
+/* How long ports found in use by someone else are skipped, in ms */
+#define VIR_PORT_ALLOCATOR_QUARANTINE 30000
+
 struct _virPortAllocator {
     virObjectLockable parent;
     virBitmapPtr bitmap;
 
+    /* no port below this index in @bitmap is free */
+    size_t next;
+
+    /* ports which failed to bind, not probed again until @quarantineEnd */
+    virBitmapPtr quarantine;
+    unsigned long long quarantineEnd;
+
     char *name;
 
     unsigned short start;
@@ -55,6 +66,7 @@ virPortAllocatorDispose(void *obj)
     virPortAllocatorPtr pa = obj;
 
     virBitmapFree(pa->bitmap);
+    virBitmapFree(pa->quarantine);
     VIR_FREE(pa->name);
 }
 
@@ -95,6 +107,7 @@ virPortAllocatorPtr virPortAllocatorNew(const char *name,
     pa->end = end;
 
     if (!(pa->bitmap = virBitmapNew((end-start)+1)) ||
+        !(pa->quarantine = virBitmapNew((end-start)+1)) ||
         VIR_STRDUP(pa->name, name) < 0) {
         virObjectUnref(pa);
         return NULL;
@@ -172,45 +185,92 @@ static int virPortAllocatorBindToPort(bool *used,
     return ret;
 }
 
-int virPortAllocatorAcquire(virPortAllocatorPtr pa,
-                            unsigned short *port)
+/* Finds the lowest port which is neither reserved nor quarantined and
+ * is not bound by anyone else, skipping the reserved ports below
+ * pa->next right away. Ports found in use are quarantined. Returns 1
+ * and sets @idx if a port was found, 0 if none, -1 on error */
+static int
+virPortAllocatorFindFree(virPortAllocatorPtr pa,
+                         size_t *idx)
 {
-    int ret = -1;
-    size_t i;
-
-    *port = 0;
-    virObjectLock(pa);
+    ssize_t pos = (ssize_t)pa->next - 1;
+    bool lowest = true;
+    unsigned long long now;
 
-    for (i = pa->start; i <= pa->end && !*port; i++) {
+    while ((pos = virBitmapNextClearBit(pa->bitmap, pos)) >= 0) {
+        unsigned short port = pa->start + pos;
         bool used = false, v6used = false;
 
-        if (virBitmapIsBitSet(pa->bitmap, i - pa->start))
+        if (virBitmapIsBitSet(pa->quarantine, pos)) {
+            lowest = false;
             continue;
+        }
 
         if (!(pa->flags & VIR_PORT_ALLOCATOR_SKIP_BIND_CHECK)) {
-            if (virPortAllocatorBindToPort(&v6used, i, AF_INET6) < 0 ||
-                virPortAllocatorBindToPort(&used, i, AF_INET) < 0)
-                goto cleanup;
+            if (virPortAllocatorBindToPort(&v6used, port, AF_INET6) < 0 ||
+                virPortAllocatorBindToPort(&used, port, AF_INET) < 0)
+                return -1;
         }
 
         if (!used && !v6used) {
-            /* Add port to bitmap of reserved ports */
-            if (virBitmapSetBit(pa->bitmap,
-                                i - pa->start) < 0) {
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("Failed to reserve port %zu"), i);
-                goto cleanup;
-            }
-            *port = i;
-            ret = 0;
+            if (lowest)
+                pa->next = pos + 1;
+            *idx = pos;
+            return 1;
         }
+
+        if (virBitmapIsAllClear(pa->quarantine) &&
+            virTimeMillisNow(&now) == 0)
+            pa->quarantineEnd = now + VIR_PORT_ALLOCATOR_QUARANTINE;
+        ignore_value(virBitmapSetBit(pa->quarantine, pos));
+        lowest = false;
+    }
+
+    return 0;
+}
+
+int virPortAllocatorAcquire(virPortAllocatorPtr pa,
+                            unsigned short *port)
+{
+    int ret = -1;
+    int rc;
+    size_t idx;
+    unsigned long long now;
+
+    *port = 0;
+    virObjectLock(pa);
+
+    if (!virBitmapIsAllClear(pa->quarantine) &&
+        (virTimeMillisNow(&now) < 0 || now >= pa->quarantineEnd))
+        virBitmapClearAll(pa->quarantine);
+
+    rc = virPortAllocatorFindFree(pa, &idx);
+
+    /* Rather than failing, probe the quarantined ports again */
+    if (rc == 0 && !virBitmapIsAllClear(pa->quarantine)) {
+        virBitmapClearAll(pa->quarantine);
+        rc = virPortAllocatorFindFree(pa, &idx);
     }
 
-    if (*port == 0) {
+    if (rc < 0)
+        goto cleanup;
+
+    if (rc == 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Unable to find an unused port in range '%s' (%d-%d)"),
                        pa->name, pa->start, pa->end);
+        goto cleanup;
     }
+
+    /* Add port to bitmap of reserved ports */
+    if (virBitmapSetBit(pa->bitmap, idx) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Failed to reserve port %zu"), pa->start + idx);
+        goto cleanup;
+    }
+    *port = pa->start + idx;
+    ret = 0;
+
  cleanup:
     virObjectUnlock(pa);
     return ret;
@@ -240,6 +300,7 @@ int virPortAllocatorRelease(virPortAllocatorPtr pa,
                        port);
         goto cleanup;
     }
+    pa->next = MIN(pa->next, port - pa->start);
 
     ret = 0;
  cleanup:
@@ -276,6 +337,7 @@ int virPortAllocatorSetUsed(virPortAllocatorPtr pa,
                            port);
             goto cleanup;
         }
+        pa->next = MIN(pa->next, port - pa->start);
     }
 
     ret = 0;
@@ -62,6 +62,21 @@ virBitmapPtr virProcessGetAffinity(pid_t pid);
 
 int virProcessGetPids(pid_t pid, size_t *npids, pid_t **pids);
 
+typedef struct _virProcessSchedStat virProcessSchedStat;
+typedef virProcessSchedStat *virProcessSchedStatPtr;
+struct _virProcessSchedStat {
+    pid_t tid;
+    unsigned long long runTime;    /* nanoseconds spent on a CPU */
+    unsigned long long waitTime;   /* nanoseconds spent runnable, but
+                                      waiting for a CPU */
+    unsigned long long timeslices; /* number of times run on a CPU */
+};
+
+int virProcessGetSchedStats(pid_t pid,
+                            virProcessSchedStatPtr stats,
+                            size_t nstats)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+
 int virProcessGetStartTime(pid_t pid,
                            unsigned long long *timestamp);
 
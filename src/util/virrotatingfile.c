@@ -57,6 +57,12 @@ struct virRotatingFileWriter {
     size_t maxbackup;
     mode_t mode;
     size_t maxlen;
+
+    /* Data appended but not yet written to entry->fd. It's already
+     * accounted for in entry->pos and entry->len */
+    char *buf;
+    size_t bufsize;
+    size_t buflen;
 };
 
 
@@ -421,6 +427,90 @@ virRotatingFileWriterRollover(virRotatingFileWriterPtr file)
 }
 
 
+/**
+ * virRotatingFileWriterSetBufferSize:
+ * @file: the file context
+ * @size: the size of the buffer, or 0
+ *
+ * Have data appended to @file collected in a buffer of @size bytes
+ * and only written once it's full, on rollover, or when explicitly
+ * flushed with virRotatingFileWriterFlush(). This saves a system
+ * call for each small write, at the cost of readers only seeing
+ * the data once it's flushed. With @size being 0, which is the
+ * default, data is written as soon as it's appended.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virRotatingFileWriterSetBufferSize(virRotatingFileWriterPtr file,
+                                   size_t size)
+{
+    if (virRotatingFileWriterFlush(file) < 0)
+        return -1;
+
+    if (VIR_REALLOC_N(file->buf, size) < 0)
+        return -1;
+    file->bufsize = size;
+
+    return 0;
+}
+
+
+/**
+ * virRotatingFileWriterFlush:
+ * @file: the file context
+ *
+ * Write out the data buffered since the last flush. On failure the
+ * buffered data is discarded.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virRotatingFileWriterFlush(virRotatingFileWriterPtr file)
+{
+    size_t len = file->buflen;
+
+    if (!len)
+        return 0;
+
+    file->buflen = 0;
+    if (safewrite(file->entry->fd, file->buf, len) != len) {
+        virReportSystemError(errno,
+                             _("Unable to write to file %s"),
+                             file->basepath);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+virRotatingFileWriterWrite(virRotatingFileWriterPtr file,
+                           const char *buf,
+                           size_t len)
+{
+    if (file->buflen + len > file->bufsize &&
+        virRotatingFileWriterFlush(file) < 0)
+        return -1;
+
+    if (len <= file->bufsize) {
+        memcpy(file->buf + file->buflen, buf, len);
+        file->buflen += len;
+        return 0;
+    }
+
+    if (safewrite(file->entry->fd, buf, len) != len) {
+        virReportSystemError(errno,
+                             _("Unable to write to file %s"),
+                             file->basepath);
+        return -1;
+    }
+
+    return 0;
+}
+
+
 /**
  * virRotatingFileWriterAppend:
  * @file: the file context
@@ -467,12 +557,8 @@ virRotatingFileWriterAppend(virRotatingFileWriterPtr file,
         }
 
         if (towrite) {
-            if (safewrite(file->entry->fd, buf, towrite) != towrite) {
-                virReportSystemError(errno,
-                                     _("Unable to write to file %s"),
-                                     file->basepath);
+            if (virRotatingFileWriterWrite(file, buf, towrite) < 0)
                 return -1;
-            }
 
             len -= towrite;
             buf += towrite;
@@ -487,7 +573,8 @@ virRotatingFileWriterAppend(virRotatingFileWriterPtr file,
             VIR_DEBUG("Hit max size %zu on %s (force=%d)\n",
                       file->maxlen, file->basepath, forceRollover);
 
-            if (virRotatingFileWriterRollover(file) < 0)
+            if (virRotatingFileWriterFlush(file) < 0 ||
+                virRotatingFileWriterRollover(file) < 0)
                 return -1;
 
             if (!(file->entry = virRotatingFileWriterEntryNew(file->basepath,
@@ -609,7 +696,8 @@ virRotatingFileReaderConsume(virRotatingFileReaderPtr file,
  * virRotatingFileWriterFree:
  * @file: the file context
  *
- * Close the current file and release all resources
+ * Write out any buffered data, close the current file and
+ * release all resources
  */
 void
 virRotatingFileWriterFree(virRotatingFileWriterPtr file)
@@ -617,6 +705,11 @@ virRotatingFileWriterFree(virRotatingFileWriterPtr file)
     if (!file)
         return;
 
+    if (file->entry &&
+        virRotatingFileWriterFlush(file) < 0)
+        virResetLastError();
+
+    VIR_FREE(file->buf);
     virRotatingFileWriterEntryFree(file->entry);
     VIR_FREE(file->basepath);
     VIR_FREE(file);
@@ -44,6 +44,10 @@ const char *virRotatingFileWriterGetPath(virRotatingFileWriterPtr file);
 ino_t virRotatingFileWriterGetINode(virRotatingFileWriterPtr file);
 off_t virRotatingFileWriterGetOffset(virRotatingFileWriterPtr file);
 
+int virRotatingFileWriterSetBufferSize(virRotatingFileWriterPtr file,
+                                       size_t size);
+int virRotatingFileWriterFlush(virRotatingFileWriterPtr file);
+
 ssize_t virRotatingFileWriterAppend(virRotatingFileWriterPtr file,
                                     const char *buf,
                                     size_t len);
@@ -34,7 +34,6 @@ virSecurityLabelDefFree(virSecurityLabelDefPtr def)
 {
     if (!def)
         return;
-    VIR_FREE(def->model);
     VIR_FREE(def->label);
     VIR_FREE(def->imagelabel);
     VIR_FREE(def->baselabel);
@@ -47,7 +46,6 @@ virSecurityDeviceLabelDefFree(virSecurityDeviceLabelDefPtr def)
 {
     if (!def)
         return;
-    VIR_FREE(def->model);
     VIR_FREE(def->label);
     VIR_FREE(def);
 }
@@ -59,7 +57,7 @@ virSecurityLabelDefNew(const char *model)
     virSecurityLabelDefPtr seclabel = NULL;
 
     if (VIR_ALLOC(seclabel) < 0 ||
-        VIR_STRDUP(seclabel->model, model) < 0) {
+        virStringIntern(&seclabel->model, model) < 0) {
         virSecurityLabelDefFree(seclabel);
         return NULL;
     }
@@ -75,7 +73,7 @@ virSecurityDeviceLabelDefNew(const char *model)
     virSecurityDeviceLabelDefPtr seclabel = NULL;
 
     if (VIR_ALLOC(seclabel) < 0 ||
-        VIR_STRDUP(seclabel->model, model) < 0) {
+        virStringIntern(&seclabel->model, model) < 0) {
         virSecurityDeviceLabelDefFree(seclabel);
         seclabel = NULL;
     }
@@ -95,8 +93,9 @@ virSecurityDeviceLabelDefCopy(const virSecurityDeviceLabelDef *src)
     ret->relabel = src->relabel;
     ret->labelskip = src->labelskip;
 
-    if (VIR_STRDUP(ret->model, src->model) < 0 ||
-        VIR_STRDUP(ret->label, src->label) < 0)
+    ret->model = src->model;
+
+    if (VIR_STRDUP(ret->label, src->label) < 0)
         goto error;
 
     return ret;
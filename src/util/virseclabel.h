@@ -35,7 +35,7 @@ typedef enum {
 typedef struct _virSecurityLabelDef virSecurityLabelDef;
 typedef virSecurityLabelDef *virSecurityLabelDefPtr;
 struct _virSecurityLabelDef {
-    char *model;        /* name of security model */
+    const char *model;  /* name of security model, see virStringIntern */
     char *label;        /* security label string */
     char *imagelabel;   /* security image label string */
     char *baselabel;    /* base name of label string */
@@ -49,7 +49,7 @@ struct _virSecurityLabelDef {
 typedef struct _virSecurityDeviceLabelDef virSecurityDeviceLabelDef;
 typedef virSecurityDeviceLabelDef *virSecurityDeviceLabelDefPtr;
 struct _virSecurityDeviceLabelDef {
-    char *model;
+    const char *model;  /* see virStringIntern */
     char *label;        /* image label string */
     bool relabel;       /* true (default) for allowing relabels */
     bool labelskip;     /* live-only; true if skipping failed label attempt */
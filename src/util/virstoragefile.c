@@ -2037,13 +2037,13 @@ virStorageSourceCopy(const virStorageSource *src,
     ret->physical = src->physical;
     ret->readonly = src->readonly;
     ret->shared = src->shared;
+    ret->driverName = src->driverName;
 
     /* storage driver metadata are not copied */
     ret->drv = NULL;
 
     if (VIR_STRDUP(ret->path, src->path) < 0 ||
         VIR_STRDUP(ret->volume, src->volume) < 0 ||
-        VIR_STRDUP(ret->driverName, src->driverName) < 0 ||
         VIR_STRDUP(ret->relPath, src->relPath) < 0 ||
         VIR_STRDUP(ret->backingStoreRaw, src->backingStoreRaw) < 0 ||
         VIR_STRDUP(ret->snapshot, src->snapshot) < 0 ||
@@ -2128,9 +2128,8 @@ virStorageSourceInitChainElement(virStorageSourcePtr newelem,
         virStorageSourceSeclabelsCopy(newelem, old) < 0)
         goto cleanup;
 
-    if (!newelem->driverName &&
-        VIR_STRDUP(newelem->driverName, old->driverName) < 0)
-        goto cleanup;
+    if (!newelem->driverName)
+        newelem->driverName = old->driverName;
 
     newelem->shared = old->shared;
     newelem->readonly = old->readonly;
@@ -2259,7 +2258,7 @@ virStorageSourceClear(virStorageSourcePtr def)
     VIR_FREE(def->snapshot);
     VIR_FREE(def->configFile);
     virStorageSourcePoolDefFree(def->srcpool);
-    VIR_FREE(def->driverName);
+    def->driverName = NULL;
     virBitmapFree(def->features);
     VIR_FREE(def->compat);
     virStorageEncryptionFree(def->encryption);
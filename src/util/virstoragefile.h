@@ -239,7 +239,7 @@ struct _virStorageSource {
     virStorageAuthDefPtr auth;
     virStorageEncryptionPtr encryption;
 
-    char *driverName;
+    const char *driverName; /* see virStringIntern */
     int format; /* virStorageFileFormat in domain backing chains, but
                  * pool-specific enum for storage volumes */
     virBitmapPtr features;
@@ -31,7 +31,10 @@
 #include "viralloc.h"
 #include "virbuffer.h"
 #include "virerror.h"
+#include "virhash.h"
+#include "virhashcode.h"
 #include "virlog.h"
+#include "virthread.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -1180,3 +1183,106 @@ virStringEncodeBase64(const uint8_t *buf, size_t buflen)
 
     return ret;
 }
+
+
+/* The strings shared by virStringIntern, never freed */
+static virMutex virStringInternLock = VIR_MUTEX_INITIALIZER;
+static virHashTablePtr virStringInternTable;
+static size_t virStringInternBytes;
+static unsigned long long virStringInternHits;
+
+static uint32_t
+virStringInternCode(const void *name,
+                    uint32_t seed)
+{
+    return virHashCodeGen(name, strlen(name), seed);
+}
+
+static bool
+virStringInternEqual(const void *namea,
+                     const void *nameb)
+{
+    return STREQ(namea, nameb);
+}
+
+/* The key is the shared copy stored as the payload, so only one copy
+ * of each string exists */
+static void *
+virStringInternKeyCopy(const void *name)
+{
+    return (void *) name;
+}
+
+/**
+ * virStringIntern:
+ * @dest: where to store the shared string
+ * @str: the string to share, can be NULL
+ *
+ * Makes @dest point to a copy of @str shared with all the other callers
+ * passing an equal string. The copies live as long as the process, so
+ * this is only for values of a small set repeated in many objects, like
+ * the names of security models or drivers. The result must neither be
+ * modified nor freed.
+ *
+ * Returns -1 on OOM, 0 if @str is NULL, 1 otherwise.
+ */
+int
+virStringIntern(const char **dest,
+                const char *str)
+{
+    char *tmp = NULL;
+    int ret = -1;
+
+    *dest = NULL;
+    if (!str)
+        return 0;
+
+    virMutexLock(&virStringInternLock);
+
+    if (!virStringInternTable &&
+        !(virStringInternTable = virHashCreateFull(32, NULL,
+                                                   virStringInternCode,
+                                                   virStringInternEqual,
+                                                   virStringInternKeyCopy,
+                                                   NULL)))
+        goto cleanup;
+
+    if ((tmp = virHashLookup(virStringInternTable, str))) {
+        virStringInternHits++;
+    } else {
+        if (VIR_STRDUP(tmp, str) < 0)
+            goto cleanup;
+
+        if (virHashAddEntry(virStringInternTable, tmp, tmp) < 0) {
+            VIR_FREE(tmp);
+            goto cleanup;
+        }
+        virStringInternBytes += strlen(tmp) + 1;
+    }
+
+    *dest = tmp;
+    ret = 1;
+
+ cleanup:
+    virMutexUnlock(&virStringInternLock);
+    return ret;
+}
+
+
+/**
+ * virStringInternGetStats:
+ * @nstrings: filled with the number of shared strings
+ * @bytes: filled with the size of the shared strings
+ * @hits: filled with how often an existing string was shared
+ */
+void
+virStringInternGetStats(size_t *nstrings,
+                        size_t *bytes,
+                        unsigned long long *hits)
+{
+    virMutexLock(&virStringInternLock);
+    *nstrings = virStringInternTable ? virHashSize(virStringInternTable) : 0;
+    *bytes = virStringInternBytes;
+    *hits = virStringInternHits;
+    virMutexUnlock(&virStringInternLock);
+}
@@ -288,6 +288,12 @@ bool virStringBufferIsPrintable(const uint8_t *buf, size_t buflen);
 
 char *virStringEncodeBase64(const uint8_t *buf, size_t buflen);
 
+int virStringIntern(const char **dest, const char *str)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+void virStringInternGetStats(size_t *nstrings,
+                             size_t *bytes,
+                             unsigned long long *hits);
+
 static inline void
 virStringTrimOptionalNewline(char *str)
 {
@@ -25,13 +25,46 @@
 
 #include <unistd.h>
 #include <inttypes.h>
+#include <time.h>
 #if HAVE_SYS_SYSCALL_H
 # include <sys/syscall.h>
 #endif
+#ifdef HAVE_DLADDR
+# include <dlfcn.h>
+#endif
 
 #include "viralloc.h"
+#include "viratomic.h"
+#include "virstring.h"
 #include "virthreadjob.h"
 
+#define VIR_FROM_THIS VIR_FROM_THREAD
+
+
+/* Contention profiling keeps a fixed table of lock classes, one per
+ * virObjectLockable class plus the few named driver locks, so that
+ * recording a wait never has to allocate or take a profiled lock */
+#define VIR_MUTEX_CLASSES_MAX 256
+
+struct _virMutexClass {
+    const char *name;
+    pthread_mutex_t lock;
+    unsigned long long contended;
+    unsigned long long waitTotal;
+    unsigned long long waitMax;
+    size_t nholders;
+    struct {
+        const void *site;
+        unsigned long long contended;
+        unsigned long long waitTotal;
+    } holders[VIR_MUTEX_CONTENTION_HOLDERS_MAX];
+};
+
+static int mutexProfiling;
+static pthread_mutex_t mutexClassesLock = PTHREAD_MUTEX_INITIALIZER;
+static virMutexClass mutexClasses[VIR_MUTEX_CLASSES_MAX];
+static size_t nmutexClasses;
+
 
 /* Nothing special required for pthreads */
 int virThreadInitialize(void)
@@ -84,9 +117,165 @@ void virMutexDestroy(virMutexPtr m)
     pthread_mutex_destroy(&m->lock);
 }
 
+/**
+ * virMutexClassGet:
+ * @name: name of the lock class, must stay valid for the lifetime of
+ *        the process
+ *
+ * Looks up the lock class @name used to aggregate the contention of
+ * all the mutexes assigned to it, creating it if needed.
+ *
+ * Returns the class or NULL if there are too many classes already.
+ */
+virMutexClassPtr virMutexClassGet(const char *name)
+{
+    virMutexClassPtr klass = NULL;
+    size_t i;
+
+    pthread_mutex_lock(&mutexClassesLock);
+
+    for (i = 0; i < nmutexClasses; i++) {
+        if (STREQ(mutexClasses[i].name, name)) {
+            klass = &mutexClasses[i];
+            goto cleanup;
+        }
+    }
+
+    if (nmutexClasses < VIR_MUTEX_CLASSES_MAX &&
+        pthread_mutex_init(&mutexClasses[nmutexClasses].lock, NULL) == 0) {
+        klass = &mutexClasses[nmutexClasses++];
+        klass->name = name;
+    }
+
+ cleanup:
+    pthread_mutex_unlock(&mutexClassesLock);
+    return klass;
+}
+
+
+/**
+ * virMutexSetClass:
+ * @m: the mutex
+ * @klass: lock class from virMutexClassGet, or NULL
+ *
+ * Makes waits for @m count towards @klass while contention profiling
+ * is enabled. Mutexes without a class are never profiled.
+ */
+void virMutexSetClass(virMutexPtr m, virMutexClassPtr klass)
+{
+    m->klass = klass;
+}
+
+
+/**
+ * virMutexSetProfiling:
+ * @enable: whether to profile lock contention
+ *
+ * While enabled, locking a mutex that has a class first tries to take
+ * it without blocking. Only when that fails the wait is timed and
+ * accounted to the class along with the call site that acquired the
+ * mutex last, which is usually the one holding it. While disabled
+ * locking costs a single extra load.
+ */
+void virMutexSetProfiling(bool enable)
+{
+    virAtomicIntSet(&mutexProfiling, enable ? 1 : 0);
+}
+
+
+bool virMutexGetProfiling(void)
+{
+    return virAtomicIntGet(&mutexProfiling) != 0;
+}
+
+
+static unsigned long long virMutexTimeNow(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+
+static void virMutexClassRecord(virMutexClassPtr klass,
+                                const void *holder,
+                                unsigned long long wait)
+{
+    size_t i;
+    size_t victim = 0;
+
+    pthread_mutex_lock(&klass->lock);
+
+    klass->contended++;
+    klass->waitTotal += wait;
+    if (wait > klass->waitMax)
+        klass->waitMax = wait;
+
+    for (i = 0; i < klass->nholders; i++) {
+        if (klass->holders[i].site == holder)
+            break;
+        if (klass->holders[i].waitTotal < klass->holders[victim].waitTotal)
+            victim = i;
+    }
+
+    if (i == klass->nholders) {
+        if (klass->nholders < VIR_MUTEX_CONTENTION_HOLDERS_MAX) {
+            klass->nholders++;
+        } else {
+            /* keep the sites that made others wait the most */
+            i = victim;
+        }
+        klass->holders[i].site = holder;
+        klass->holders[i].contended = 0;
+        klass->holders[i].waitTotal = 0;
+    }
+
+    klass->holders[i].contended++;
+    klass->holders[i].waitTotal += wait;
+
+    pthread_mutex_unlock(&klass->lock);
+}
+
+
+/**
+ * virMutexLockCaller:
+ * @m: the mutex
+ * @caller: the call site to report as the holder of @m
+ *
+ * Same as virMutexLock, for wrappers like virObjectLock which want
+ * their own caller to show up in the contention statistics.
+ */
+void virMutexLockCaller(virMutexPtr m, const void *caller)
+{
+    const void *holder;
+    unsigned long long start;
+    unsigned long long end;
+
+    if (!virAtomicIntGet(&mutexProfiling) || !m->klass) {
+        pthread_mutex_lock(&m->lock);
+        return;
+    }
+
+    if (pthread_mutex_trylock(&m->lock) != 0) {
+        /* read without the lock, the holder may just be leaving */
+        holder = m->holder;
+        start = virMutexTimeNow();
+        pthread_mutex_lock(&m->lock);
+        end = virMutexTimeNow();
+
+        virMutexClassRecord(m->klass, holder, end > start ? end - start : 0);
+    }
+
+    m->holder = caller;
+}
+
+
 void virMutexLock(virMutexPtr m)
 {
-    pthread_mutex_lock(&m->lock);
+    virMutexLockCaller(m, __builtin_return_address(0));
 }
 
 void virMutexUnlock(virMutexPtr m)
@@ -95,6 +284,143 @@ void virMutexUnlock(virMutexPtr m)
 }
 
 
+static char *virMutexSiteName(const void *site)
+{
+    char *name = NULL;
+#ifdef HAVE_DLADDR
+    Dl_info info;
+
+    if (site && dladdr((void *)site, &info) && info.dli_sname) {
+        ignore_value(virAsprintfQuiet(&name, "%s+0x%zx", info.dli_sname,
+                                      (size_t)((const char *)site -
+                                               (const char *)info.dli_saddr)));
+        return name;
+    }
+#endif
+
+    if (site)
+        ignore_value(virAsprintfQuiet(&name, "%p", site));
+    else
+        ignore_value(VIR_STRDUP_QUIET(name, "unknown"));
+    return name;
+}
+
+
+static int virMutexContentionStatsCompare(const void *a, const void *b)
+{
+    const virMutexContentionStats *sa = a;
+    const virMutexContentionStats *sb = b;
+
+    if (sa->waitTotal > sb->waitTotal)
+        return -1;
+    if (sa->waitTotal < sb->waitTotal)
+        return 1;
+    return 0;
+}
+
+
+/**
+ * virMutexGetContentionStats:
+ * @stats: filled with a newly allocated list of the lock classes
+ * @nstats: filled with the number of entries in @stats
+ * @max: maximum number of classes to report
+ *
+ * Reports the lock classes that had contended acquisitions, the ones
+ * with the longest total wait first. Free the list with
+ * virMutexContentionStatsFree.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int virMutexGetContentionStats(virMutexContentionStatsPtr *stats,
+                               size_t *nstats,
+                               size_t max)
+{
+    virMutexContentionStatsPtr list = NULL;
+    size_t nlist = 0;
+    size_t nclasses;
+    size_t i;
+    size_t j;
+
+    *stats = NULL;
+    *nstats = 0;
+
+    pthread_mutex_lock(&mutexClassesLock);
+    nclasses = nmutexClasses;
+    pthread_mutex_unlock(&mutexClassesLock);
+
+    if (nclasses && VIR_ALLOC_N(list, nclasses) < 0)
+        return -1;
+
+    /* classes are never removed and their name never changes */
+    for (i = 0; i < nclasses; i++) {
+        virMutexClassPtr klass = &mutexClasses[i];
+        virMutexContentionStatsPtr entry = &list[nlist];
+        const void *sites[VIR_MUTEX_CONTENTION_HOLDERS_MAX];
+
+        pthread_mutex_lock(&klass->lock);
+        entry->contended = klass->contended;
+        entry->waitTotal = klass->waitTotal;
+        entry->waitMax = klass->waitMax;
+        entry->nholders = klass->nholders;
+        for (j = 0; j < klass->nholders; j++) {
+            sites[j] = klass->holders[j].site;
+            entry->holders[j].contended = klass->holders[j].contended;
+            entry->holders[j].waitTotal = klass->holders[j].waitTotal;
+        }
+        pthread_mutex_unlock(&klass->lock);
+
+        if (!entry->contended)
+            continue;
+
+        if (VIR_STRDUP(entry->name, klass->name) < 0)
+            goto error;
+        for (j = 0; j < entry->nholders; j++) {
+            if (!(entry->holders[j].site = virMutexSiteName(sites[j]))) {
+                virReportOOMError();
+                entry->nholders = j;
+                nlist++;
+                goto error;
+            }
+        }
+        nlist++;
+    }
+
+    qsort(list, nlist, sizeof(*list), virMutexContentionStatsCompare);
+
+    for (i = max; i < nlist; i++) {
+        VIR_FREE(list[i].name);
+        for (j = 0; j < list[i].nholders; j++)
+            VIR_FREE(list[i].holders[j].site);
+    }
+
+    *stats = list;
+    *nstats = nlist < max ? nlist : max;
+    return 0;
+
+ error:
+    virMutexContentionStatsFree(list, nlist);
+    return -1;
+}
+
+
+void virMutexContentionStatsFree(virMutexContentionStatsPtr stats,
+                                 size_t nstats)
+{
+    size_t i;
+    size_t j;
+
+    if (!stats)
+        return;
+
+    for (i = 0; i < nstats; i++) {
+        VIR_FREE(stats[i].name);
+        for (j = 0; j < stats[i].nholders; j++)
+            VIR_FREE(stats[i].holders[j].site);
+    }
+    VIR_FREE(stats);
+}
+
+
 int virRWLockInit(virRWLockPtr m)
 {
     int ret;
@@ -155,6 +481,8 @@ int virCondWait(virCondPtr c, virMutexPtr m)
         errno = ret;
         return -1;
     }
+    if (m->klass)
+        m->holder = __builtin_return_address(0);
     return 0;
 }
 
@@ -170,6 +498,8 @@ int virCondWaitUntil(virCondPtr c, virMutexPtr m, unsigned long long whenms)
         errno = ret;
         return -1;
     }
+    if (m->klass)
+        m->holder = __builtin_return_address(0);
     return 0;
 }
 
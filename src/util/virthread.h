@@ -27,11 +27,17 @@
 
 # include <pthread.h>
 
+typedef struct _virMutexClass virMutexClass;
+typedef virMutexClass *virMutexClassPtr;
+
 typedef struct virMutex virMutex;
 typedef virMutex *virMutexPtr;
 
 struct virMutex {
     pthread_mutex_t lock;
+    /* contention profiling, see virMutexSetProfiling */
+    virMutexClassPtr klass;
+    const void *holder;
 };
 
 typedef struct virRWLock virRWLock;
@@ -132,8 +138,42 @@ int virMutexInitRecursive(virMutexPtr m) ATTRIBUTE_RETURN_CHECK;
 void virMutexDestroy(virMutexPtr m);
 
 void virMutexLock(virMutexPtr m);
+void virMutexLockCaller(virMutexPtr m, const void *caller);
 void virMutexUnlock(virMutexPtr m);
 
+/* Maximum number of holder call sites tracked per lock class */
+# define VIR_MUTEX_CONTENTION_HOLDERS_MAX 8
+
+typedef struct _virMutexContentionHolder virMutexContentionHolder;
+typedef virMutexContentionHolder *virMutexContentionHolderPtr;
+struct _virMutexContentionHolder {
+    char *site;                     /* function and offset holding the lock */
+    unsigned long long contended;   /* acquisitions that waited for it */
+    unsigned long long waitTotal;   /* microseconds waited for it */
+};
+
+typedef struct _virMutexContentionStats virMutexContentionStats;
+typedef virMutexContentionStats *virMutexContentionStatsPtr;
+struct _virMutexContentionStats {
+    char *name;
+    unsigned long long contended;
+    unsigned long long waitTotal;   /* in microseconds */
+    unsigned long long waitMax;     /* in microseconds */
+    size_t nholders;
+    virMutexContentionHolder holders[VIR_MUTEX_CONTENTION_HOLDERS_MAX];
+};
+
+virMutexClassPtr virMutexClassGet(const char *name);
+void virMutexSetClass(virMutexPtr m, virMutexClassPtr klass);
+
+void virMutexSetProfiling(bool enable);
+bool virMutexGetProfiling(void);
+int virMutexGetContentionStats(virMutexContentionStatsPtr *stats,
+                               size_t *nstats,
+                               size_t max);
+void virMutexContentionStatsFree(virMutexContentionStatsPtr stats,
+                                 size_t nstats);
+
 
 int virRWLockInit(virRWLockPtr m) ATTRIBUTE_RETURN_CHECK;
 void virRWLockDestroy(virRWLockPtr m);
@@ -30,16 +30,26 @@
 #include "viralloc.h"
 #include "virthread.h"
 #include "virerror.h"
+#include "virhash.h"
+#include "virhashcode.h"
+#include "virtime.h"
+#include "virbitmap.h"
+#include "virnuma.h"
+#include "virprocess.h"
+#include "virlog.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
+VIR_LOG_INIT("util.threadpool");
+
 typedef struct _virThreadPoolJob virThreadPoolJob;
 typedef virThreadPoolJob *virThreadPoolJobPtr;
 
 struct _virThreadPoolJob {
-    virThreadPoolJobPtr prev;
     virThreadPoolJobPtr next;
     unsigned int priority;
+    unsigned long long seq;      /* submission order across both queues */
+    unsigned long long queued;   /* submission time in ms */
 
     void *data;
 };
@@ -50,9 +60,23 @@ typedef virThreadPoolJobList *virThreadPoolJobListPtr;
 struct _virThreadPoolJobList {
     virThreadPoolJobPtr head;
     virThreadPoolJobPtr tail;
-    virThreadPoolJobPtr firstPrio;
 };
 
+typedef struct _virThreadPoolFlow virThreadPoolFlow;
+typedef virThreadPoolFlow *virThreadPoolFlowPtr;
+
+struct _virThreadPoolFlow {
+    const void *key;
+    virThreadPoolJobList jobs;
+
+    /* Ring of the flows with queued jobs */
+    virThreadPoolFlowPtr prev;
+    virThreadPoolFlowPtr next;
+};
+
+/* Upper limit of finished job records kept around for reuse */
+#define VIR_THREADPOOL_FREE_JOBS_MAX 128
+
 
 struct _virThreadPool {
     bool quit;
@@ -60,8 +84,26 @@ struct _virThreadPool {
     virThreadPoolJobFunc jobFunc;
     const char *jobFuncName;
     void *jobOpaque;
-    virThreadPoolJobList jobList;
+    /* Ordinary and priority jobs are queued separately, so that both
+     * kinds of workers pick their next job in constant time. Ordinary
+     * jobs are further queued per flow, and the flows with queued jobs
+     * take turns, one job at a time */
+    virHashTablePtr flows;          /* key -> flow with queued jobs */
+    virThreadPoolFlow defaultFlow;  /* jobs submitted without a flow */
+    virThreadPoolFlowPtr curFlow;   /* next flow to serve, NULL if none */
+    virThreadPoolJobList prioJobList;
     size_t jobQueueDepth;
+    unsigned long long jobSeq;
+
+    virThreadPoolJobPtr freeJobs;
+    size_t nFreeJobs;
+
+    virThreadPoolJobWaitStats jobWait;
+
+    /* CPUs the workers are pinned to, NULL if they aren't. The workers
+     * compare the generation with the one they applied last */
+    virBitmapPtr affinity;
+    unsigned int affinityGen;
 
     virMutex mutex;
     virCond cond;
@@ -85,6 +127,220 @@ struct virThreadPoolWorkerData {
     bool priority;
 };
 
+static virThreadPoolJobPtr
+virThreadPoolJobListShift(virThreadPoolJobListPtr list)
+{
+    virThreadPoolJobPtr job = list->head;
+
+    list->head = job->next;
+    if (!list->head)
+        list->tail = NULL;
+    job->next = NULL;
+
+    return job;
+}
+
+
+static void
+virThreadPoolJobListPush(virThreadPoolJobListPtr list,
+                         virThreadPoolJobPtr job)
+{
+    if (list->tail)
+        list->tail->next = job;
+    else
+        list->head = job;
+    list->tail = job;
+}
+
+
+static uint32_t
+virThreadPoolFlowCode(const void *key, uint32_t seed)
+{
+    return virHashCodeGen(&key, sizeof(key), seed);
+}
+
+
+static bool
+virThreadPoolFlowEqual(const void *keya, const void *keyb)
+{
+    return keya == keyb;
+}
+
+
+static void *
+virThreadPoolFlowCopy(const void *key)
+{
+    return (void *)key;
+}
+
+
+/* Find the flow to queue a job of @key on, making it take its turn
+ * after all the other flows with queued jobs if it had none */
+static virThreadPoolFlowPtr
+virThreadPoolFlowGet(virThreadPoolPtr pool, const void *key)
+{
+    virThreadPoolFlowPtr flow = &pool->defaultFlow;
+
+    if (key && !(flow = virHashLookup(pool->flows, key))) {
+        if (VIR_ALLOC(flow) < 0)
+            return NULL;
+        flow->key = key;
+        if (virHashAddEntry(pool->flows, key, flow) < 0) {
+            VIR_FREE(flow);
+            return NULL;
+        }
+    }
+
+    if (flow->next)
+        return flow;
+
+    if (pool->curFlow) {
+        flow->next = pool->curFlow;
+        flow->prev = pool->curFlow->prev;
+        flow->prev->next = flow;
+        flow->next->prev = flow;
+    } else {
+        flow->next = flow->prev = flow;
+        pool->curFlow = flow;
+    }
+
+    return flow;
+}
+
+
+/* Take @flow out of the ring once it has no more queued jobs */
+static void
+virThreadPoolFlowRemove(virThreadPoolPtr pool, virThreadPoolFlowPtr flow)
+{
+    if (flow->next == flow) {
+        pool->curFlow = NULL;
+    } else {
+        flow->prev->next = flow->next;
+        flow->next->prev = flow->prev;
+        if (pool->curFlow == flow)
+            pool->curFlow = flow->next;
+    }
+    flow->next = flow->prev = NULL;
+
+    if (flow != &pool->defaultFlow) {
+        virHashRemoveEntry(pool->flows, flow->key);
+        VIR_FREE(flow);
+    }
+}
+
+
+/* Take the next job to run off the queues. Ordinary workers take
+ * the next job of the flow whose turn it is, unless a priority job
+ * has been waiting longer, priority workers only take priority jobs.
+ * Called with the pool mutex held, with at least one matching job
+ * queued.
+ */
+static virThreadPoolJobPtr
+virThreadPoolJobListPop(virThreadPoolPtr pool, bool priority)
+{
+    virThreadPoolFlowPtr flow = pool->curFlow;
+    virThreadPoolJobPtr job;
+
+    if (priority || !flow ||
+        (pool->prioJobList.head &&
+         pool->prioJobList.head->seq < flow->jobs.head->seq))
+        return virThreadPoolJobListShift(&pool->prioJobList);
+
+    job = virThreadPoolJobListShift(&flow->jobs);
+    if (!flow->jobs.head)
+        virThreadPoolFlowRemove(pool, flow);
+    else
+        pool->curFlow = flow->next;
+
+    return job;
+}
+
+
+/* Get a job record, reusing a finished one if possible */
+static virThreadPoolJobPtr
+virThreadPoolJobAcquire(virThreadPoolPtr pool)
+{
+    virThreadPoolJobPtr job;
+
+    if (!pool->freeJobs) {
+        ignore_value(VIR_ALLOC(job));
+        return job;
+    }
+
+    job = pool->freeJobs;
+    pool->freeJobs = job->next;
+    pool->nFreeJobs--;
+    memset(job, 0, sizeof(*job));
+    return job;
+}
+
+
+static void
+virThreadPoolJobRelease(virThreadPoolPtr pool,
+                        virThreadPoolJobPtr job)
+{
+    if (pool->nFreeJobs >= VIR_THREADPOOL_FREE_JOBS_MAX) {
+        VIR_FREE(job);
+        return;
+    }
+
+    job->next = pool->freeJobs;
+    pool->freeJobs = job;
+    pool->nFreeJobs++;
+}
+
+
+/* Account for the time @job spent waiting in the queue */
+static void
+virThreadPoolJobWaitRecord(virThreadPoolPtr pool,
+                           virThreadPoolJobPtr job)
+{
+    unsigned long long now;
+    unsigned long long wait = 0;
+    unsigned long long limit = 1;
+    size_t i;
+
+    if (job->queued && virTimeMillisNowRaw(&now) == 0 && now > job->queued)
+        wait = now - job->queued;
+
+    pool->jobWait.jobs++;
+    pool->jobWait.total += wait;
+    if (wait > pool->jobWait.max)
+        pool->jobWait.max = wait;
+
+    /* Buckets are decades of milliseconds, the last one collects
+     * everything above */
+    for (i = 0; i < VIR_THREADPOOL_JOB_WAIT_BUCKETS - 1; i++) {
+        if (wait < limit)
+            break;
+        limit *= 10;
+    }
+    pool->jobWait.buckets[i]++;
+}
+
+
+/* Pin the calling worker to the CPUs of the pool if they changed since
+ * it did last. Called with the pool mutex held */
+static void
+virThreadPoolWorkerApplyAffinity(virThreadPoolPtr pool,
+                                 unsigned int *gen)
+{
+    if (*gen == pool->affinityGen)
+        return;
+    *gen = pool->affinityGen;
+
+    if (!pool->affinity)
+        return;
+
+    /* pid 0 stands for the calling thread */
+    if (virProcessSetAffinity(0, pool->affinity) < 0) {
+        VIR_WARN("Unable to pin %s worker: %s",
+                 pool->jobFuncName, virGetLastErrorMessage());
+        virResetLastError();
+    }
+}
+
+
 /* Test whether the worker needs to quit if the current number of workers @count
  * is greater than @limit actually allows.
  */
@@ -102,12 +358,15 @@ static void virThreadPoolWorker(void *opaque)
     size_t *curWorkers = priority ? &pool->nPrioWorkers : &pool->nWorkers;
     size_t *maxLimit = priority ? &pool->maxPrioWorkers : &pool->maxWorkers;
     virThreadPoolJobPtr job = NULL;
+    unsigned int affinityGen = 0;
 
     VIR_FREE(data);
 
     virMutexLock(&pool->mutex);
 
     while (1) {
+        virThreadPoolWorkerApplyAffinity(pool, &affinityGen);
+
         /* In order to support async worker termination, we need ensure that
          * both busy and free workers know if they need to terminated. Thus,
          * busy workers need to check for this fact before they start waiting for
@@ -117,8 +376,8 @@ static void virThreadPoolWorker(void *opaque)
         if (virThreadPoolWorkerQuitHelper(*curWorkers, *maxLimit))
             goto out;
         while (!pool->quit &&
-               ((!priority && !pool->jobList.head) ||
-                (priority && !pool->jobList.firstPrio))) {
+               !pool->prioJobList.head &&
+               (priority || !pool->curFlow)) {
             if (!priority)
                 pool->freeWorkers++;
             if (virCondWait(cond, &pool->mutex) < 0) {
@@ -136,37 +395,18 @@ static void virThreadPoolWorker(void *opaque)
         if (pool->quit)
             break;
 
-        if (priority) {
-            job = pool->jobList.firstPrio;
-        } else {
-            job = pool->jobList.head;
-        }
-
-        if (job == pool->jobList.firstPrio) {
-            virThreadPoolJobPtr tmp = job->next;
-            while (tmp) {
-                if (tmp->priority)
-                    break;
-                tmp = tmp->next;
-            }
-            pool->jobList.firstPrio = tmp;
-        }
-
-        if (job->prev)
-            job->prev->next = job->next;
-        else
-            pool->jobList.head = job->next;
-        if (job->next)
-            job->next->prev = job->prev;
-        else
-            pool->jobList.tail = job->prev;
+        virThreadPoolWorkerApplyAffinity(pool, &affinityGen);
 
+        job = virThreadPoolJobListPop(pool, priority);
         pool->jobQueueDepth--;
+        virThreadPoolJobWaitRecord(pool, job);
 
         virMutexUnlock(&pool->mutex);
         (pool->jobFunc)(job->data, pool->jobOpaque);
-        VIR_FREE(job);
         virMutexLock(&pool->mutex);
+
+        virThreadPoolJobRelease(pool, job);
+        job = NULL;
     }
 
  out:
@@ -233,19 +473,25 @@ virThreadPoolNewFull(size_t minWorkers,
     if (VIR_ALLOC(pool) < 0)
         return NULL;
 
-    pool->jobList.tail = pool->jobList.head = NULL;
-
     pool->jobFunc = func;
     pool->jobFuncName = funcName;
     pool->jobOpaque = opaque;
 
     if (virMutexInit(&pool->mutex) < 0)
         goto error;
+    virMutexSetClass(&pool->mutex, virMutexClassGet("virThreadPool"));
     if (virCondInit(&pool->cond) < 0)
         goto error;
     if (virCondInit(&pool->quit_cond) < 0)
         goto error;
 
+    if (!(pool->flows = virHashCreateFull(32, NULL,
+                                          virThreadPoolFlowCode,
+                                          virThreadPoolFlowEqual,
+                                          virThreadPoolFlowCopy,
+                                          NULL)))
+        goto error;
+
     pool->minWorkers = minWorkers;
     pool->maxWorkers = maxWorkers;
     pool->maxPrioWorkers = prioWorkers;
@@ -289,12 +535,27 @@ void virThreadPoolFree(virThreadPoolPtr pool)
     while (pool->nWorkers > 0 || pool->nPrioWorkers > 0)
         ignore_value(virCondWait(&pool->quit_cond, &pool->mutex));
 
-    while ((job = pool->jobList.head)) {
-        pool->jobList.head = pool->jobList.head->next;
+    while (pool->curFlow) {
+        virThreadPoolFlowPtr flow = pool->curFlow;
+
+        while ((job = flow->jobs.head)) {
+            flow->jobs.head = flow->jobs.head->next;
+            VIR_FREE(job);
+        }
+        virThreadPoolFlowRemove(pool, flow);
+    }
+    virHashFree(pool->flows);
+    while ((job = pool->prioJobList.head)) {
+        pool->prioJobList.head = pool->prioJobList.head->next;
+        VIR_FREE(job);
+    }
+    while ((job = pool->freeJobs)) {
+        pool->freeJobs = pool->freeJobs->next;
         VIR_FREE(job);
     }
 
     VIR_FREE(pool->workers);
+    virBitmapFree(pool->affinity);
     virMutexUnlock(&pool->mutex);
     virMutexDestroy(&pool->mutex);
     virCondDestroy(&pool->quit_cond);
@@ -373,6 +634,14 @@ size_t virThreadPoolGetJobQueueDepth(virThreadPoolPtr pool)
     return ret;
 }
 
+void virThreadPoolGetJobWaitStats(virThreadPoolPtr pool,
+                                  virThreadPoolJobWaitStatsPtr stats)
+{
+    virMutexLock(&pool->mutex);
+    *stats = pool->jobWait;
+    virMutexUnlock(&pool->mutex);
+}
+
 /*
  * @priority - job priority
  * Return: 0 on success, -1 otherwise
@@ -380,8 +649,28 @@ size_t virThreadPoolGetJobQueueDepth(virThreadPoolPtr pool)
 int virThreadPoolSendJob(virThreadPoolPtr pool,
                          unsigned int priority,
                          void *jobData)
+{
+    return virThreadPoolSendFlowJob(pool, priority, NULL, jobData);
+}
+
+/*
+ * @priority - job priority
+ * @flow - key of the flow the job belongs to, or NULL
+ *
+ * Ordinary jobs of different flows take turns to run, so that a flow
+ * queueing many jobs does not delay the jobs of other flows for long.
+ * Jobs without a flow all belong to the same one. Priority jobs run
+ * in the order they were queued regardless of their flow.
+ *
+ * Return: 0 on success, -1 otherwise
+ */
+int virThreadPoolSendFlowJob(virThreadPoolPtr pool,
+                             unsigned int priority,
+                             const void *flow,
+                             void *jobData)
 {
     virThreadPoolJobPtr job;
+    virThreadPoolFlowPtr jobFlow = NULL;
 
     virMutexLock(&pool->mutex);
     if (pool->quit)
@@ -392,22 +681,22 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
         virThreadPoolExpand(pool, 1, false) < 0)
         goto error;
 
-    if (VIR_ALLOC(job) < 0)
+    if (!priority && !(jobFlow = virThreadPoolFlowGet(pool, flow)))
+        goto error;
+
+    if (!(job = virThreadPoolJobAcquire(pool))) {
+        if (jobFlow && !jobFlow->jobs.head)
+            virThreadPoolFlowRemove(pool, jobFlow);
         goto error;
+    }
 
     job->data = jobData;
     job->priority = priority;
+    job->seq = pool->jobSeq++;
+    ignore_value(virTimeMillisNowRaw(&job->queued));
 
-    job->prev = pool->jobList.tail;
-    if (pool->jobList.tail)
-        pool->jobList.tail->next = job;
-    pool->jobList.tail = job;
-
-    if (!pool->jobList.head)
-        pool->jobList.head = job;
-
-    if (priority && !pool->jobList.firstPrio)
-        pool->jobList.firstPrio = job;
+    virThreadPoolJobListPush(priority ? &pool->prioJobList : &jobFlow->jobs,
+                             job);
 
     pool->jobQueueDepth++;
 
@@ -473,3 +762,169 @@ virThreadPoolSetParameters(virThreadPoolPtr pool,
     virMutexUnlock(&pool->mutex);
     return -1;
 }
+
+
+/**
+ * virThreadPoolSetAffinity:
+ * @pool: the pool
+ * @cpumap: CPUs to run the workers on, or NULL to let them run anywhere
+ *
+ * Pins all the workers of @pool to @cpumap, both the existing ones, next
+ * time they wake up, and the ones created later. Unpinning the workers
+ * leaves the existing ones where they are.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virThreadPoolSetAffinity(virThreadPoolPtr pool,
+                         virBitmapPtr cpumap)
+{
+    virBitmapPtr copy = NULL;
+
+    if (cpumap && !(copy = virBitmapNewCopy(cpumap)))
+        return -1;
+
+    virMutexLock(&pool->mutex);
+    virBitmapFree(pool->affinity);
+    pool->affinity = copy;
+    pool->affinityGen++;
+    virCondBroadcast(&pool->cond);
+    if (pool->nPrioWorkers > 0)
+        virCondBroadcast(&pool->prioCond);
+    virMutexUnlock(&pool->mutex);
+
+    return 0;
+}
+
+
+struct _virThreadPoolNuma {
+    /* Indexed by host NUMA node, NULL for the nodes without CPUs */
+    virThreadPoolPtr *nodes;
+    size_t nnodes;
+
+    /* Unpinned pool for the jobs not bound to any node */
+    virThreadPoolPtr fallback;
+};
+
+
+/**
+ * virThreadPoolNumaNewFull:
+ * @minWorkers: minimum number of workers per pool
+ * @maxWorkers: maximum number of workers per pool
+ * @func: function the workers run for each job
+ * @funcName: name of @func, used as the name of the worker threads
+ * @opaque: data passed to @func along with each job
+ *
+ * Creates a pool per NUMA node of the host, whose workers only run on the
+ * CPUs of that node, plus an unpinned pool for the jobs that don't belong
+ * to any node. On hosts without NUMA, only the latter exists.
+ *
+ * Returns the pools on success, NULL on error.
+ */
+virThreadPoolNumaPtr
+virThreadPoolNumaNewFull(size_t minWorkers,
+                         size_t maxWorkers,
+                         virThreadPoolJobFunc func,
+                         const char *funcName,
+                         void *opaque)
+{
+    virThreadPoolNumaPtr pools;
+    virBitmapPtr cpus = NULL;
+    int maxnode;
+    int ncpus;
+    size_t i;
+
+    if (VIR_ALLOC(pools) < 0)
+        return NULL;
+
+    if (!(pools->fallback = virThreadPoolNewFull(minWorkers, maxWorkers, 0,
+                                                 func, funcName, opaque)))
+        goto error;
+
+    if (!virNumaIsAvailable() || (maxnode = virNumaGetMaxNode()) < 0) {
+        virResetLastError();
+        return pools;
+    }
+
+    if (VIR_ALLOC_N(pools->nodes, maxnode + 1) < 0)
+        goto error;
+    pools->nnodes = maxnode + 1;
+
+    for (i = 0; i < pools->nnodes; i++) {
+        if (!virNumaNodeIsAvailable(i))
+            continue;
+
+        if ((ncpus = virNumaGetNodeCPUs(i, &cpus)) == -2) {
+            virResetLastError();
+            continue;
+        }
+        if (ncpus < 0)
+            goto error;
+
+        if (ncpus == 0) {
+            virBitmapFree(cpus);
+            cpus = NULL;
+            continue;
+        }
+
+        /* Pinned before any worker is created */
+        if (!(pools->nodes[i] = virThreadPoolNewFull(0, maxWorkers, 0,
+                                                     func, funcName, opaque)) ||
+            virThreadPoolSetAffinity(pools->nodes[i], cpus) < 0 ||
+            virThreadPoolSetParameters(pools->nodes[i], minWorkers, -1, -1) < 0)
+            goto error;
+
+        virBitmapFree(cpus);
+        cpus = NULL;
+    }
+
+    return pools;
+
+ error:
+    virBitmapFree(cpus);
+    virThreadPoolNumaFree(pools);
+    return NULL;
+}
+
+
+void
+virThreadPoolNumaFree(virThreadPoolNumaPtr pools)
+{
+    size_t i;
+
+    if (!pools)
+        return;
+
+    for (i = 0; i < pools->nnodes; i++)
+        virThreadPoolFree(pools->nodes[i]);
+    VIR_FREE(pools->nodes);
+    virThreadPoolFree(pools->fallback);
+    VIR_FREE(pools);
+}
+
+
+/**
+ * virThreadPoolNumaSendJob:
+ * @pools: the pools
+ * @node: host NUMA node the job should run on, or -1 for any
+ * @priority: job priority
+ * @jobdata: data of the job
+ *
+ * Queues @jobdata on the pool of @node, or on the unpinned pool if @node
+ * is -1 or has no pool of its own.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+int
+virThreadPoolNumaSendJob(virThreadPoolNumaPtr pools,
+                         int node,
+                         unsigned int priority,
+                         void *jobdata)
+{
+    virThreadPoolPtr pool = pools->fallback;
+
+    if (node >= 0 && (size_t) node < pools->nnodes && pools->nodes[node])
+        pool = pools->nodes[node];
+
+    return virThreadPoolSendJob(pool, priority, jobdata);
+}
@@ -27,6 +27,7 @@
 # define __VIR_THREADPOOL_H__
 
 # include "internal.h"
+# include "virbitmap.h"
 
 typedef struct _virThreadPool virThreadPool;
 typedef virThreadPool *virThreadPoolPtr;
@@ -50,6 +51,22 @@ size_t virThreadPoolGetCurrentWorkers(virThreadPoolPtr pool);
 size_t virThreadPoolGetFreeWorkers(virThreadPoolPtr pool);
 size_t virThreadPoolGetJobQueueDepth(virThreadPoolPtr pool);
 
+/* Histogram buckets of queue wait times: below 1ms, 10ms, 100ms,
+ * 1s, and everything longer */
+# define VIR_THREADPOOL_JOB_WAIT_BUCKETS 5
+
+typedef struct _virThreadPoolJobWaitStats virThreadPoolJobWaitStats;
+typedef virThreadPoolJobWaitStats *virThreadPoolJobWaitStatsPtr;
+struct _virThreadPoolJobWaitStats {
+    unsigned long long jobs;    /* jobs taken off the queue */
+    unsigned long long total;   /* sum of their queue wait times in ms */
+    unsigned long long max;     /* longest queue wait time in ms */
+    unsigned long long buckets[VIR_THREADPOOL_JOB_WAIT_BUCKETS];
+};
+
+void virThreadPoolGetJobWaitStats(virThreadPoolPtr pool,
+                                  virThreadPoolJobWaitStatsPtr stats);
+
 void virThreadPoolFree(virThreadPoolPtr pool);
 
 int virThreadPoolSendJob(virThreadPoolPtr pool,
@@ -57,9 +74,40 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
                          void *jobdata) ATTRIBUTE_NONNULL(1)
                                         ATTRIBUTE_RETURN_CHECK;
 
+int virThreadPoolSendFlowJob(virThreadPoolPtr pool,
+                             unsigned int priority,
+                             const void *flow,
+                             void *jobdata) ATTRIBUTE_NONNULL(1)
+                                            ATTRIBUTE_RETURN_CHECK;
+
 int virThreadPoolSetParameters(virThreadPoolPtr pool,
                                long long int minWorkers,
                                long long int maxWorkers,
                                long long int prioWorkers);
 
+int virThreadPoolSetAffinity(virThreadPoolPtr pool,
+                             virBitmapPtr cpumap) ATTRIBUTE_NONNULL(1);
+
+/* Set of pools whose workers are pinned to each NUMA node of the host */
+typedef struct _virThreadPoolNuma virThreadPoolNuma;
+typedef virThreadPoolNuma *virThreadPoolNumaPtr;
+
+# define virThreadPoolNumaNew(min, max, func, opaque) \
+    virThreadPoolNumaNewFull(min, max, func, #func, opaque)
+
+virThreadPoolNumaPtr virThreadPoolNumaNewFull(size_t minWorkers,
+                                              size_t maxWorkers,
+                                              virThreadPoolJobFunc func,
+                                              const char *funcName,
+                                              void *opaque)
+    ATTRIBUTE_NONNULL(3);
+
+void virThreadPoolNumaFree(virThreadPoolNumaPtr pools);
+
+int virThreadPoolNumaSendJob(virThreadPoolNumaPtr pools,
+                             int node,
+                             unsigned int priority,
+                             void *jobdata) ATTRIBUTE_NONNULL(1)
+                                            ATTRIBUTE_RETURN_CHECK;
+
 #endif
@@ -0,0 +1,135 @@
+/*
+ * virtokenbucket.c: token bucket rate limiting
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "virtokenbucket.h"
+
+/* Levels are kept in thousandths of a token, so that refilling at
+ * a rate given in tokens per second from a time in milliseconds
+ * needs no division */
+#define VIR_TOKEN_BUCKET_UNIT 1000LL
+
+
+static void
+virTokenBucketRefill(virTokenBucketPtr bucket,
+                     unsigned long long now)
+{
+    long long full = bucket->burst * VIR_TOKEN_BUCKET_UNIT;
+
+    if (now > bucket->last) {
+        unsigned long long gain = (now - bucket->last) * bucket->rate;
+
+        if (gain > full - bucket->level)
+            bucket->level = full;
+        else
+            bucket->level += gain;
+    }
+
+    bucket->last = now;
+}
+
+
+/**
+ * virTokenBucketSetRate:
+ * @bucket: the bucket
+ * @rate: number of tokens added each second, 0 to disable limiting
+ * @burst: most tokens the bucket can hold, 0 to use @rate
+ * @now: current time in milliseconds
+ *
+ * Change the rate of @bucket. A bucket which was not limited so far
+ * starts full, otherwise it keeps the tokens it holds, up to @burst.
+ */
+void
+virTokenBucketSetRate(virTokenBucketPtr bucket,
+                      unsigned int rate,
+                      unsigned int burst,
+                      unsigned long long now)
+{
+    bool wasLimited = bucket->rate != 0;
+
+    if (wasLimited)
+        virTokenBucketRefill(bucket, now);
+
+    if (!burst)
+        burst = rate;
+
+    bucket->rate = rate;
+    bucket->burst = burst;
+    bucket->last = now;
+
+    if (!wasLimited || bucket->level > burst * VIR_TOKEN_BUCKET_UNIT)
+        bucket->level = burst * VIR_TOKEN_BUCKET_UNIT;
+}
+
+
+/**
+ * virTokenBucketTake:
+ * @bucket: the bucket
+ * @now: current time in milliseconds
+ *
+ * Take a token from @bucket. The token is always granted, since the
+ * caller has usually received the work it accounts for already, but
+ * the bucket may go in debt for it, up to its burst.
+ *
+ * Returns the number of milliseconds until @bucket holds a whole
+ * token again, or 0 if it still does or it is not limited.
+ */
+unsigned long long
+virTokenBucketTake(virTokenBucketPtr bucket,
+                   unsigned long long now)
+{
+    long long debt = -(bucket->burst * VIR_TOKEN_BUCKET_UNIT);
+
+    if (!bucket->rate)
+        return 0;
+
+    virTokenBucketRefill(bucket, now);
+
+    bucket->level -= VIR_TOKEN_BUCKET_UNIT;
+    if (bucket->level < debt)
+        bucket->level = debt;
+
+    if (bucket->level >= VIR_TOKEN_BUCKET_UNIT)
+        return 0;
+
+    return (VIR_TOKEN_BUCKET_UNIT - bucket->level + bucket->rate - 1) /
+        bucket->rate;
+}
+
+
+/**
+ * virTokenBucketIsFull:
+ * @bucket: the bucket
+ * @now: current time in milliseconds
+ *
+ * Returns true if @bucket holds as many tokens as it can, that is
+ * if it has not been used for a while, or if it is not limited.
+ */
+bool
+virTokenBucketIsFull(virTokenBucketPtr bucket,
+                     unsigned long long now)
+{
+    if (!bucket->rate)
+        return true;
+
+    virTokenBucketRefill(bucket, now);
+
+    return bucket->level >= bucket->burst * VIR_TOKEN_BUCKET_UNIT;
+}
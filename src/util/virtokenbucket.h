@@ -0,0 +1,51 @@
+/*
+ * virtokenbucket.h: token bucket rate limiting
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_TOKEN_BUCKET_H__
+# define __VIR_TOKEN_BUCKET_H__
+
+# include "internal.h"
+
+typedef struct _virTokenBucket virTokenBucket;
+typedef virTokenBucket *virTokenBucketPtr;
+
+/* Callers provide the locking and the current time, in milliseconds */
+struct _virTokenBucket {
+    unsigned int rate;          /* tokens added per second, 0 if unlimited */
+    unsigned int burst;         /* most tokens the bucket can hold */
+    long long level;            /* tokens held in thousandths, negative
+                                   while in debt */
+    unsigned long long last;    /* time of the last refill */
+};
+
+void virTokenBucketSetRate(virTokenBucketPtr bucket,
+                           unsigned int rate,
+                           unsigned int burst,
+                           unsigned long long now)
+    ATTRIBUTE_NONNULL(1);
+
+unsigned long long virTokenBucketTake(virTokenBucketPtr bucket,
+                                      unsigned long long now)
+    ATTRIBUTE_NONNULL(1);
+
+bool virTokenBucketIsFull(virTokenBucketPtr bucket,
+                          unsigned long long now)
+    ATTRIBUTE_NONNULL(1);
+
+#endif /* __VIR_TOKEN_BUCKET_H__ */
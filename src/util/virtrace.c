@@ -0,0 +1,593 @@
+/*
+ * virtrace.c: request tracing across the layers of the daemon
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+
+#include "virtrace.h"
+#include "viralloc.h"
+#include "viratomic.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virjson.h"
+#include "virlog.h"
+#include "virrandom.h"
+#include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("util.trace");
+
+/*
+ * A trace follows a single request, typically an RPC call, through the
+ * thread handling it. The request is the root span and every layer it
+ * goes through, like waiting for a domain job, talking to the QEMU
+ * monitor or running a helper command, opens a child span of the span
+ * currently open on the thread. Once the request is done all its spans
+ * are written on a single line of the trace output, as a JSON array of
+ * spans in the Zipkin v2 format which tracing collectors accept as is.
+ */
+
+#define VIR_TRACE_ID_BUFLEN 33
+
+typedef struct _virTraceTag virTraceTag;
+typedef virTraceTag *virTraceTagPtr;
+struct _virTraceTag {
+    char *key;
+    char *value;
+};
+
+typedef struct _virTraceSpan virTraceSpan;
+typedef virTraceSpan *virTraceSpanPtr;
+struct _virTraceSpan {
+    char *name;
+    uint64_t id;
+    int parent;
+    unsigned long long start;   /* microseconds since the epoch */
+    unsigned long long end;
+
+    virTraceTagPtr tags;
+    size_t ntags;
+};
+
+typedef struct _virTraceContext virTraceContext;
+typedef virTraceContext *virTraceContextPtr;
+struct _virTraceContext {
+    char id[VIR_TRACE_ID_BUFLEN];
+    unsigned int depth;
+
+    virTraceSpanPtr spans;
+    size_t nspans;
+    size_t nspans_max;
+    size_t dropped;
+
+    /* the innermost open span, new spans are its children */
+    int current;
+};
+
+static int virTraceActive;
+static virMutex virTraceLock = VIR_MUTEX_INITIALIZER;
+static int virTraceFD = -1;
+static char *virTraceService;
+static virThreadLocal virTraceCurrent;
+
+
+static int
+virTraceOnceInit(void)
+{
+    return virThreadLocalInit(&virTraceCurrent, NULL);
+}
+
+VIR_ONCE_GLOBAL_INIT(virTrace)
+
+
+/**
+ * virTraceSetOutput:
+ * @path: file to append the traces to, or NULL to stop tracing
+ * @service: name of the process in the traces
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virTraceSetOutput(const char *path,
+                  const char *service)
+{
+    int fd = -1;
+    char *tmp = NULL;
+
+    if (virTraceInitialize() < 0)
+        return -1;
+
+    if (path) {
+        if ((fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                       S_IRUSR | S_IWUSR)) < 0) {
+            virReportSystemError(errno,
+                                 _("unable to open trace output '%s'"),
+                                 path);
+            return -1;
+        }
+
+        if (VIR_STRDUP(tmp, service) < 0) {
+            VIR_FORCE_CLOSE(fd);
+            return -1;
+        }
+    }
+
+    virMutexLock(&virTraceLock);
+    VIR_FORCE_CLOSE(virTraceFD);
+    VIR_FREE(virTraceService);
+    virTraceFD = fd;
+    virTraceService = tmp;
+    virAtomicIntSet(&virTraceActive, fd >= 0);
+    virMutexUnlock(&virTraceLock);
+
+    return 0;
+}
+
+
+bool
+virTraceEnabled(void)
+{
+    return virAtomicIntGet(&virTraceActive) != 0;
+}
+
+
+static virTraceContextPtr
+virTraceGetContext(void)
+{
+    if (!virTraceEnabled() || virTraceInitialize() < 0)
+        return NULL;
+
+    return virThreadLocalGet(&virTraceCurrent);
+}
+
+
+static void
+virTraceContextFree(virTraceContextPtr ctx)
+{
+    size_t i;
+    size_t j;
+
+    if (!ctx)
+        return;
+
+    for (i = 0; i < ctx->nspans; i++) {
+        for (j = 0; j < ctx->spans[i].ntags; j++) {
+            VIR_FREE(ctx->spans[i].tags[j].key);
+            VIR_FREE(ctx->spans[i].tags[j].value);
+        }
+        VIR_FREE(ctx->spans[i].tags);
+        VIR_FREE(ctx->spans[i].name);
+    }
+    VIR_FREE(ctx->spans);
+    VIR_FREE(ctx);
+}
+
+
+static int
+virTraceContextAddSpan(virTraceContextPtr ctx,
+                       const char *name,
+                       unsigned long long start)
+{
+    virTraceSpanPtr span;
+
+    if (ctx->nspans >= VIR_TRACE_SPANS_MAX ||
+        VIR_RESIZE_N_QUIET(ctx->spans, ctx->nspans_max, ctx->nspans, 1) < 0) {
+        ctx->dropped++;
+        return -1;
+    }
+
+    span = &ctx->spans[ctx->nspans];
+    if (VIR_STRDUP_QUIET(span->name, name) < 0) {
+        ctx->dropped++;
+        return -1;
+    }
+    span->id = virRandomBits(64);
+    span->parent = ctx->current;
+    span->start = start;
+
+    return ctx->nspans++;
+}
+
+
+/**
+ * virTraceBegin:
+ * @name: name of the request
+ * @start: when the request was received, in microseconds since the
+ *         epoch, or 0 for now
+ *
+ * Starts tracing a request handled by the current thread, if tracing is
+ * enabled. A request begun while another one is traced on the thread is
+ * part of the latter. Every virTraceBegin must be matched by a
+ * virTraceEnd.
+ */
+void
+virTraceBegin(const char *name,
+              unsigned long long start)
+{
+    virTraceContextPtr ctx;
+    unsigned long long now;
+
+    if (!virTraceEnabled() || virTraceInitialize() < 0)
+        return;
+
+    if ((ctx = virThreadLocalGet(&virTraceCurrent))) {
+        ctx->depth++;
+        return;
+    }
+
+    if (start)
+        now = start;
+    else if (virTimeMicrosNowRaw(&now) < 0)
+        return;
+
+    if (VIR_ALLOC_QUIET(ctx) < 0)
+        return;
+
+    snprintf(ctx->id, sizeof(ctx->id), "%016llx%016llx",
+             (unsigned long long) virRandomBits(64),
+             (unsigned long long) virRandomBits(64));
+    ctx->current = -1;
+
+    if (virTraceContextAddSpan(ctx, name, now) < 0 ||
+        virThreadLocalSet(&virTraceCurrent, ctx) < 0) {
+        virTraceContextFree(ctx);
+        return;
+    }
+    ctx->current = 0;
+}
+
+
+static virJSONValuePtr
+virTraceSpanFormat(virTraceContextPtr ctx,
+                   virTraceSpanPtr span,
+                   const char *service)
+{
+    virJSONValuePtr obj = NULL;
+    virJSONValuePtr endpoint = NULL;
+    virJSONValuePtr tags = NULL;
+    char id[17];
+    size_t i;
+
+    if (!(obj = virJSONValueNewObject()))
+        goto error;
+
+    snprintf(id, sizeof(id), "%016llx", (unsigned long long) span->id);
+    if (virJSONValueObjectAppendString(obj, "traceId", ctx->id) < 0 ||
+        virJSONValueObjectAppendString(obj, "id", id) < 0)
+        goto error;
+
+    if (span->parent >= 0) {
+        snprintf(id, sizeof(id), "%016llx",
+                 (unsigned long long) ctx->spans[span->parent].id);
+        if (virJSONValueObjectAppendString(obj, "parentId", id) < 0)
+            goto error;
+    } else if (virJSONValueObjectAppendString(obj, "kind", "SERVER") < 0) {
+        goto error;
+    }
+
+    if (virJSONValueObjectAppendString(obj, "name", span->name) < 0 ||
+        virJSONValueObjectAppendNumberUlong(obj, "timestamp",
+                                            span->start) < 0 ||
+        virJSONValueObjectAppendNumberUlong(obj, "duration",
+                                            span->end - span->start) < 0)
+        goto error;
+
+    if (!(endpoint = virJSONValueNewObject()) ||
+        virJSONValueObjectAppendString(endpoint, "serviceName",
+                                       service) < 0 ||
+        virJSONValueObjectAppend(obj, "localEndpoint", endpoint) < 0)
+        goto error;
+    endpoint = NULL;
+
+    if (span->ntags) {
+        if (!(tags = virJSONValueNewObject()))
+            goto error;
+
+        for (i = 0; i < span->ntags; i++) {
+            if (virJSONValueObjectAppendString(tags, span->tags[i].key,
+                                               span->tags[i].value) < 0)
+                goto error;
+        }
+
+        if (virJSONValueObjectAppend(obj, "tags", tags) < 0)
+            goto error;
+        tags = NULL;
+    }
+
+    return obj;
+
+ error:
+    virJSONValueFree(tags);
+    virJSONValueFree(endpoint);
+    virJSONValueFree(obj);
+    return NULL;
+}
+
+
+static void
+virTraceContextWrite(virTraceContextPtr ctx)
+{
+    virJSONValuePtr spans = NULL;
+    virJSONValuePtr span;
+    char *json = NULL;
+    char *str = NULL;
+    char ebuf[1024];
+    size_t i;
+
+    virMutexLock(&virTraceLock);
+
+    if (virTraceFD < 0)
+        goto cleanup;
+
+    if (!(spans = virJSONValueNewArray()))
+        goto cleanup;
+
+    for (i = 0; i < ctx->nspans; i++) {
+        if (!(span = virTraceSpanFormat(ctx, &ctx->spans[i],
+                                        virTraceService)))
+            goto cleanup;
+
+        if (virJSONValueArrayAppend(spans, span) < 0) {
+            virJSONValueFree(span);
+            goto cleanup;
+        }
+    }
+
+    if (!(json = virJSONValueToString(spans, false)) ||
+        virAsprintfQuiet(&str, "%s\n", json) < 0)
+        goto cleanup;
+
+    /* a single write, so that traces of other threads never interleave */
+    if (safewrite(virTraceFD, str, strlen(str)) < 0)
+        VIR_WARN("Unable to write trace %s: %s", ctx->id,
+                 virStrerror(errno, ebuf, sizeof(ebuf)));
+
+ cleanup:
+    virMutexUnlock(&virTraceLock);
+    virResetLastError();
+    virJSONValueFree(spans);
+    VIR_FREE(json);
+    VIR_FREE(str);
+}
+
+
+static void ATTRIBUTE_FMT_PRINTF(4, 0)
+virTraceContextTagV(virTraceContextPtr ctx,
+                    int span,
+                    const char *key,
+                    const char *fmt,
+                    va_list args)
+{
+    virTraceSpanPtr sp = &ctx->spans[span];
+    virTraceTag tag = { NULL, NULL };
+
+    if (virVasprintfQuiet(&tag.value, fmt, args) < 0 ||
+        VIR_STRDUP_QUIET(tag.key, key) < 0 ||
+        VIR_APPEND_ELEMENT_QUIET(sp->tags, sp->ntags, tag) < 0) {
+        VIR_FREE(tag.key);
+        VIR_FREE(tag.value);
+    }
+}
+
+
+static void ATTRIBUTE_FMT_PRINTF(4, 5)
+virTraceContextTag(virTraceContextPtr ctx,
+                   int span,
+                   const char *key,
+                   const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    virTraceContextTagV(ctx, span, key, fmt, args);
+    va_end(args);
+}
+
+
+/**
+ * virTraceEnd:
+ * @failed: whether the request failed
+ *
+ * Finishes the request started by virTraceBegin and writes its trace.
+ */
+void
+virTraceEnd(bool failed)
+{
+    virTraceContextPtr ctx;
+    unsigned long long now;
+    size_t i;
+
+    if (virTraceInitialize() < 0 ||
+        !(ctx = virThreadLocalGet(&virTraceCurrent)))
+        return;
+
+    if (ctx->depth) {
+        ctx->depth--;
+        return;
+    }
+
+    ignore_value(virThreadLocalSet(&virTraceCurrent, NULL));
+
+    if (virTimeMicrosNowRaw(&now) < 0)
+        now = ctx->spans[0].start;
+
+    /* spans left open end with the request */
+    for (i = 0; i < ctx->nspans; i++) {
+        if (!ctx->spans[i].end)
+            ctx->spans[i].end = now;
+        if (ctx->spans[i].end < ctx->spans[i].start)
+            ctx->spans[i].end = ctx->spans[i].start;
+    }
+    ctx->current = 0;
+
+    if (failed)
+        virTraceContextTag(ctx, 0, "error", "true");
+    if (ctx->dropped)
+        virTraceContextTag(ctx, 0, "droppedSpans", "%zu", ctx->dropped);
+
+    if (virTraceEnabled())
+        virTraceContextWrite(ctx);
+
+    virTraceContextFree(ctx);
+}
+
+
+/**
+ * virTraceSetName:
+ * @name: the name of the request
+ *
+ * Renames the request traced on the current thread, for requests only
+ * known precisely once they are decoded.
+ */
+void
+virTraceSetName(const char *name)
+{
+    virTraceContextPtr ctx;
+    char *tmp;
+
+    if (!(ctx = virTraceGetContext()) ||
+        VIR_STRDUP_QUIET(tmp, name) < 0)
+        return;
+
+    VIR_FREE(ctx->spans[0].name);
+    ctx->spans[0].name = tmp;
+}
+
+
+/**
+ * virTraceGetID:
+ *
+ * Returns the ID of the trace of the current thread, or NULL.
+ */
+const char *
+virTraceGetID(void)
+{
+    virTraceContextPtr ctx = virTraceGetContext();
+
+    return ctx ? ctx->id : NULL;
+}
+
+
+/**
+ * virTraceSpanBegin:
+ * @name: name of the span
+ *
+ * Opens a span for an operation done while handling the request traced
+ * on the current thread. Spans opened until it is closed by
+ * virTraceSpanEnd are its children.
+ *
+ * Returns the span to pass to virTraceSpanEnd, or -1 if the thread does
+ * not trace any request, which virTraceSpanEnd ignores.
+ */
+int
+virTraceSpanBegin(const char *name)
+{
+    virTraceContextPtr ctx;
+    unsigned long long now;
+    int span;
+
+    if (!(ctx = virTraceGetContext()) ||
+        virTimeMicrosNowRaw(&now) < 0)
+        return -1;
+
+    if ((span = virTraceContextAddSpan(ctx, name, now)) < 0)
+        return -1;
+
+    ctx->current = span;
+    return span;
+}
+
+
+void
+virTraceSpanEnd(int span)
+{
+    virTraceContextPtr ctx;
+
+    if (span < 0 ||
+        !(ctx = virTraceGetContext()) ||
+        (size_t) span >= ctx->nspans)
+        return;
+
+    if (virTimeMicrosNowRaw(&ctx->spans[span].end) < 0)
+        ctx->spans[span].end = ctx->spans[span].start;
+
+    ctx->current = ctx->spans[span].parent;
+}
+
+
+/**
+ * virTraceSpanAdd:
+ * @name: name of the span
+ * @start: when the operation started, in microseconds since the epoch
+ * @end: when the operation ended
+ *
+ * Records an operation measured by the caller, like the time a request
+ * spent queued before the thread picked it up, as a child of the
+ * current span.
+ *
+ * Returns the span for virTraceSpanTag, or -1.
+ */
+int
+virTraceSpanAdd(const char *name,
+                unsigned long long start,
+                unsigned long long end)
+{
+    virTraceContextPtr ctx;
+    int span;
+
+    if (!(ctx = virTraceGetContext()) ||
+        (span = virTraceContextAddSpan(ctx, name, start)) < 0)
+        return -1;
+
+    ctx->spans[span].end = end;
+    return span;
+}
+
+
+/**
+ * virTraceSpanTag:
+ * @span: the span returned by virTraceSpanBegin, or 0 for the request
+ * @key: name of the tag
+ * @fmt: format of the value
+ *
+ * Attaches a detail, like the name of a monitor command, to @span.
+ */
+void
+virTraceSpanTag(int span,
+                const char *key,
+                const char *fmt, ...)
+{
+    virTraceContextPtr ctx;
+    va_list args;
+
+    if (span < 0 ||
+        !(ctx = virTraceGetContext()) ||
+        (size_t) span >= ctx->nspans)
+        return;
+
+    va_start(args, fmt);
+    virTraceContextTagV(ctx, span, key, fmt, args);
+    va_end(args);
+}
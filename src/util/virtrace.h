@@ -0,0 +1,51 @@
+/*
+ * virtrace.h: request tracing across the layers of the daemon
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_TRACE_H__
+# define __VIR_TRACE_H__
+
+# include "internal.h"
+
+/* Upper limit on the spans recorded for a single trace, the ones
+ * opened past it are counted but dropped */
+# define VIR_TRACE_SPANS_MAX 256
+
+int virTraceSetOutput(const char *path,
+                      const char *service);
+bool virTraceEnabled(void);
+
+void virTraceBegin(const char *name,
+                   unsigned long long start);
+void virTraceEnd(bool failed);
+void virTraceSetName(const char *name);
+const char *virTraceGetID(void);
+
+int virTraceSpanBegin(const char *name);
+void virTraceSpanEnd(int span);
+int virTraceSpanAdd(const char *name,
+                    unsigned long long start,
+                    unsigned long long end);
+void virTraceSpanTag(int span,
+                     const char *key,
+                     const char *fmt, ...)
+    ATTRIBUTE_FMT_PRINTF(3, 4);
+
+#endif /* __VIR_TRACE_H__ */
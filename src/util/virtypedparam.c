@@ -418,6 +418,50 @@ virTypedParamsReplaceString(virTypedParameterPtr *params,
 }
 
 
+/* Append a parameter of TYPE to PARAMS, growing the array as needed,
+ * and format its name from FMT directly into the field rather than
+ * copying it from a temporary buffer as virTypedParamsAdd* would. The
+ * value is zeroed for the caller to fill in; a string value must be
+ * allocated. Meant for stats code adding lots of generated names such
+ * as "block.12.rd.bytes". Return the new parameter, or NULL after an
+ * error message on failure.  */
+virTypedParameterPtr
+virTypedParamsAppendFormat(virTypedParameterPtr *params,
+                           int *nparams,
+                           int *maxparams,
+                           int type,
+                           const char *fmt, ...)
+{
+    va_list ap;
+    size_t max = *maxparams;
+    size_t n = *nparams;
+    virTypedParameterPtr param;
+    int len;
+
+    if (VIR_RESIZE_N(*params, max, n, 1) < 0)
+        return NULL;
+    *maxparams = max;
+
+    param = *params + n;
+    memset(param, 0, sizeof(*param));
+
+    va_start(ap, fmt);
+    len = vsnprintf(param->field, VIR_TYPED_PARAM_FIELD_LENGTH, fmt, ap);
+    va_end(ap);
+
+    if (len < 0 || len >= VIR_TYPED_PARAM_FIELD_LENGTH) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Field name '%s' too long"), param->field);
+        memset(param, 0, sizeof(*param));
+        return NULL;
+    }
+
+    param->type = type;
+    *nparams += 1;
+    return param;
+}
+
+
 int
 virTypedParamsCopy(virTypedParameterPtr *dst,
                    virTypedParameterPtr src,
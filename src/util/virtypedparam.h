@@ -97,6 +97,14 @@ int virTypedParamsReplaceString(virTypedParameterPtr *params,
                                 const char *name,
                                 const char *value);
 
+virTypedParameterPtr virTypedParamsAppendFormat(virTypedParameterPtr *params,
+                                                int *nparams,
+                                                int *maxparams,
+                                                int type,
+                                                const char *fmt, ...)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3)
+    ATTRIBUTE_FMT_PRINTF(5, 6) ATTRIBUTE_RETURN_CHECK;
+
 int virTypedParamsCopy(virTypedParameterPtr *dst,
                        virTypedParameterPtr src,
                        int nparams);
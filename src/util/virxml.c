@@ -36,7 +36,9 @@
 #include "virutil.h"
 #include "viralloc.h"
 #include "virfile.h"
+#include "virhash.h"
 #include "virstring.h"
+#include "virthread.h"
 
 #define VIR_FROM_THIS VIR_FROM_XML
 
@@ -56,6 +58,70 @@ struct virParserData {
  *									*
  ************************************************************************/
 
+/* Most expressions are constant strings evaluated again for every
+ * document parsed, so keep them compiled.  The cache is bounded as
+ * some callers format indexes or names into their expressions. */
+#define VIR_XPATH_CACHE_MAX 4096
+
+static virMutex virXPathCacheLock = VIR_MUTEX_INITIALIZER;
+static virHashTablePtr virXPathCache;
+
+
+static void
+virXPathCacheFree(void *payload,
+                  const void *name ATTRIBUTE_UNUSED)
+{
+    xmlXPathFreeCompExpr(payload);
+}
+
+
+/**
+ * virXPathEval:
+ * @xpath: the XPath string to evaluate
+ * @ctxt: an XPath context
+ *
+ * Like xmlXPathEval(), except the compiled form of @xpath is kept for
+ * evaluating it again.  A compiled expression doesn't depend on the
+ * context, so it is shared by all threads.
+ *
+ * Returns the resulting object, to be freed with xmlXPathFreeObject(),
+ * or NULL if the evaluation failed.
+ */
+static xmlXPathObjectPtr
+virXPathEval(const char *xpath,
+             xmlXPathContextPtr ctxt)
+{
+    xmlXPathCompExprPtr comp;
+    xmlXPathObjectPtr obj;
+    bool cached = false;
+
+    virMutexLock(&virXPathCacheLock);
+    if (!virXPathCache)
+        virXPathCache = virHashCreate(256, virXPathCacheFree);
+
+    if (virXPathCache &&
+        (comp = virHashLookup(virXPathCache, xpath))) {
+        virMutexUnlock(&virXPathCacheLock);
+        return xmlXPathCompiledEval(comp, ctxt);
+    }
+
+    if (!(comp = xmlXPathCompile(BAD_CAST xpath))) {
+        virMutexUnlock(&virXPathCacheLock);
+        return NULL;
+    }
+
+    if (virXPathCache &&
+        virHashSize(virXPathCache) < VIR_XPATH_CACHE_MAX &&
+        virHashAddEntry(virXPathCache, xpath, comp) == 0)
+        cached = true;
+    virMutexUnlock(&virXPathCacheLock);
+
+    obj = xmlXPathCompiledEval(comp, ctxt);
+    if (!cached)
+        xmlXPathFreeCompExpr(comp);
+    return obj;
+}
+
 /**
  * virXPathString:
  * @xpath: the XPath string to evaluate
@@ -80,7 +146,7 @@ virXPathString(const char *xpath,
         return NULL;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj == NULL) || (obj->type != XPATH_STRING) ||
         (obj->stringval == NULL) || (obj->stringval[0] == 0)) {
@@ -147,7 +213,7 @@ virXPathNumber(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj == NULL) || (obj->type != XPATH_NUMBER) ||
         (isnan(obj->floatval))) {
@@ -176,7 +242,7 @@ virXPathLongBase(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj != NULL) && (obj->type == XPATH_STRING) &&
         (obj->stringval != NULL) && (obj->stringval[0] != 0)) {
@@ -281,7 +347,7 @@ virXPathULongBase(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj != NULL) && (obj->type == XPATH_STRING) &&
         (obj->stringval != NULL) && (obj->stringval[0] != 0)) {
@@ -397,7 +463,7 @@ virXPathULongLong(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj != NULL) && (obj->type == XPATH_STRING) &&
         (obj->stringval != NULL) && (obj->stringval[0] != 0)) {
@@ -443,7 +509,7 @@ virXPathLongLong(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj != NULL) && (obj->type == XPATH_STRING) &&
         (obj->stringval != NULL) && (obj->stringval[0] != 0)) {
@@ -529,7 +595,7 @@ virXPathBoolean(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj == NULL) || (obj->type != XPATH_BOOLEAN) ||
         (obj->boolval < 0) || (obj->boolval > 1)) {
@@ -566,7 +632,7 @@ virXPathNode(const char *xpath,
         return NULL;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj == NULL) || (obj->type != XPATH_NODESET) ||
         (obj->nodesetval == NULL) || (obj->nodesetval->nodeNr <= 0) ||
@@ -610,7 +676,7 @@ virXPathNodeSet(const char *xpath,
         *list = NULL;
 
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if (obj == NULL)
         return 0;
@@ -917,6 +983,23 @@ virXMLChildElementCount(xmlNodePtr node)
     return ret;
 }
 
+/* Returns the first child element of node called name, or NULL if
+ * there is none.  Cheaper than an XPath lookup of ./name.  */
+xmlNodePtr
+virXMLChildElement(xmlNodePtr node,
+                   const char *name)
+{
+    xmlNodePtr cur;
+
+    for (cur = node->children; cur; cur = cur->next) {
+        if (cur->type == XML_ELEMENT_NODE &&
+            xmlStrEqual(cur->name, BAD_CAST name))
+            return cur;
+    }
+
+    return NULL;
+}
+
 
 /**
  * virXMLNodeToString: convert an XML node ptr to an XML string
@@ -1255,23 +1338,166 @@ virXMLValidatorValidate(virXMLValidatorPtr validator,
 }
 
 
-int
-virXMLValidateAgainstSchema(const char *schemafile,
-                            xmlDocPtr doc)
+/* Compiling a schema parses it with all its includes, which costs far
+ * more than validating a document against it. The compiled schemas are
+ * thus kept for the lifetime of the process. They are never modified
+ * once compiled, so all threads share them, each validating through
+ * validation contexts of its own. */
+static virMutex virXMLSchemaLock = VIR_MUTEX_INITIALIZER;
+static virHashTablePtr virXMLSchemas;   /* schema file -> xmlRelaxNGPtr */
+static virThreadLocal virXMLThreadValidators;
+
+static void
+virXMLSchemaFree(void *payload,
+                 const void *name ATTRIBUTE_UNUSED)
+{
+    xmlRelaxNGFree(payload);
+}
+
+
+static void
+virXMLThreadValidatorFree(void *payload,
+                          const void *name ATTRIBUTE_UNUSED)
+{
+    virXMLValidatorFree(payload);
+}
+
+
+static void
+virXMLThreadValidatorsFree(void *opaque)
+{
+    virHashFree(opaque);
+}
+
+
+static int
+virXMLOnceInit(void)
+{
+    if (virThreadLocalInit(&virXMLThreadValidators,
+                           virXMLThreadValidatorsFree) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize thread local validators"));
+        return -1;
+    }
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virXML)
+
+
+/* Get the compiled @schemafile, compiling it on first use */
+static xmlRelaxNGPtr
+virXMLSchemaGet(const char *schemafile)
 {
     virXMLValidatorPtr validator = NULL;
-    int ret = -1;
+    xmlRelaxNGPtr rng = NULL;
+
+    virMutexLock(&virXMLSchemaLock);
+
+    if (!virXMLSchemas &&
+        !(virXMLSchemas = virHashCreate(8, virXMLSchemaFree)))
+        goto cleanup;
+
+    if ((rng = virHashLookup(virXMLSchemas, schemafile)))
+        goto cleanup;
 
     if (!(validator = virXMLValidatorInit(schemafile)))
-        return -1;
+        goto cleanup;
 
-    if (virXMLValidatorValidate(validator, doc) < 0)
+    if (virHashAddEntry(virXMLSchemas, schemafile, validator->rng) < 0)
         goto cleanup;
 
-    ret = 0;
+    VIR_STEAL_PTR(rng, validator->rng);
+
  cleanup:
+    virMutexUnlock(&virXMLSchemaLock);
     virXMLValidatorFree(validator);
-    return ret;
+    return rng;
+}
+
+
+/* Get the validator of the calling thread for @schemafile */
+static virXMLValidatorPtr
+virXMLThreadValidatorGet(const char *schemafile)
+{
+    virHashTablePtr validators;
+    virXMLValidatorPtr validator;
+    xmlRelaxNGPtr rng;
+
+    if (virXMLInitialize() < 0)
+        return NULL;
+
+    if (!(validators = virThreadLocalGet(&virXMLThreadValidators))) {
+        if (!(validators = virHashCreate(8, virXMLThreadValidatorFree)))
+            return NULL;
+
+        if (virThreadLocalSet(&virXMLThreadValidators, validators) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to set thread local validators"));
+            virHashFree(validators);
+            return NULL;
+        }
+    }
+
+    if ((validator = virHashLookup(validators, schemafile)))
+        return validator;
+
+    if (!(rng = virXMLSchemaGet(schemafile)))
+        return NULL;
+
+    if (VIR_ALLOC(validator) < 0)
+        return NULL;
+
+    validator->rng = rng;
+    validator->sharedRng = true;
+
+    if (VIR_STRDUP(validator->schemafile, schemafile) < 0)
+        goto error;
+
+    if (!(validator->rngValid = xmlRelaxNGNewValidCtxt(validator->rng))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to create RNG validation context %s"),
+                       validator->schemafile);
+        goto error;
+    }
+
+    xmlRelaxNGSetValidErrors(validator->rngValid,
+                             catchRNGError,
+                             ignoreRNGError,
+                             &validator->buf);
+
+    if (virHashAddEntry(validators, schemafile, validator) < 0)
+        goto error;
+
+    return validator;
+
+ error:
+    virXMLValidatorFree(validator);
+    return NULL;
+}
+
+
+/**
+ * virXMLValidateAgainstSchema:
+ * @schemafile: path to the RelaxNG schema
+ * @doc: document to validate
+ *
+ * Validates @doc against @schemafile, which is compiled only once per
+ * process, see virXMLSchemaGet.
+ *
+ * Returns 0 if @doc is valid, -1 otherwise.
+ */
+int
+virXMLValidateAgainstSchema(const char *schemafile,
+                            xmlDocPtr doc)
+{
+    virXMLValidatorPtr validator;
+
+    if (!(validator = virXMLThreadValidatorGet(schemafile)))
+        return -1;
+
+    return virXMLValidatorValidate(validator, doc);
 }
 
 
@@ -1285,6 +1511,7 @@ virXMLValidatorFree(virXMLValidatorPtr validator)
     virBufferFreeAndReset(&validator->buf);
     xmlRelaxNGFreeParserCtxt(validator->rngParser);
     xmlRelaxNGFreeValidCtxt(validator->rngValid);
-    xmlRelaxNGFree(validator->rng);
+    if (!validator->sharedRng)
+        xmlRelaxNGFree(validator->rng);
     VIR_FREE(validator);
 }
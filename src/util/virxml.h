@@ -74,6 +74,8 @@ int              virXPathNodeSet(const char *xpath,
 char *          virXMLPropString(xmlNodePtr node,
                                  const char *name);
 long     virXMLChildElementCount(xmlNodePtr node);
+xmlNodePtr    virXMLChildElement(xmlNodePtr node,
+                                 const char *name);
 
 /* Internal function; prefer the macros below.  */
 xmlDocPtr      virXMLParseHelper(int domcode,
@@ -188,6 +190,7 @@ int virXMLCheckIllegalChars(const char *nodeName,
 struct _virXMLValidator {
     xmlRelaxNGParserCtxtPtr rngParser;
     xmlRelaxNGPtr rng;
+    bool sharedRng;     /* @rng belongs to the process wide schema cache */
     xmlRelaxNGValidCtxtPtr rngValid;
     virBuffer buf;
     char *schemafile;
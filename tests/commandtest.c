@@ -33,6 +33,7 @@
 #include "internal.h"
 #include "viralloc.h"
 #include "vircommand.h"
+#include "vircommandbroker.h"
 #include "virfile.h"
 #include "virpidfile.h"
 #include "virerror.h"
@@ -1130,6 +1131,30 @@ static int test25(const void *unused ATTRIBUTE_UNUSED)
 }
 
 
+/*
+ * Commands rerun through the command broker must have been run by it.
+ */
+static int test26(const void *unused ATTRIBUTE_UNUSED)
+{
+    virCommandBrokerStats stats;
+
+    virCommandBrokerGetStats(&stats);
+
+    if (stats.commands == 0 || stats.failures != 0) {
+        printf("Broker ran %llu commands and failed %llu\n",
+               stats.commands, stats.failures);
+        return -1;
+    }
+
+    if (stats.latencyMax > stats.latencyTotal) {
+        printf("Maximum latency %llu is over the total %llu\n",
+               stats.latencyMax, stats.latencyTotal);
+        return -1;
+    }
+
+    return 0;
+}
+
 static void virCommandThreadWorker(void *opaque)
 {
     virCommandTestDataPtr test = opaque;
@@ -1284,6 +1309,25 @@ mymain(void)
     DO_TEST(test24);
     DO_TEST(test25);
 
+    /* Rerun the plain commands through the command broker */
+    if (virCommandBrokerStart() < 0)
+        ret = -1;
+
+# define DO_TEST_BROKER(NAME)                                         \
+    if (virTestRun("Command Broker " #NAME " test",                   \
+                   NAME, NULL) < 0)                                   \
+        ret = -1
+
+    DO_TEST_BROKER(test1);
+    DO_TEST_BROKER(test2);
+    DO_TEST_BROKER(test9);
+    DO_TEST_BROKER(test12);
+    DO_TEST_BROKER(test13);
+    DO_TEST_BROKER(test14);
+    DO_TEST_BROKER(test17);
+    DO_TEST_BROKER(test20);
+    DO_TEST(test26);
+
     virMutexLock(&test->lock);
     if (test->running) {
         test->quit = true;
@@ -387,6 +387,90 @@ cpuTestBaseline(const void *arg)
 }
 
 
+static int
+cpuTestCompareMatrix(const void *arg)
+{
+    const struct data *data = arg;
+    int ret = -1;
+    virCPUDefPtr *cpus = NULL;
+    unsigned int ncpus = 0;
+    char **xmlCPUs = NULL;
+    int *results = NULL;
+    char *baseline = NULL;
+    char *file = NULL;
+    xmlDocPtr doc = NULL;
+    xmlXPathContextPtr ctxt = NULL;
+    xmlNodePtr *nodes = NULL;
+    size_t i;
+    size_t j;
+
+    if (!(cpus = cpuTestLoadMultiXML(data->arch, data->name, &ncpus)))
+        goto cleanup;
+
+    if (virAsprintf(&file, "%s/cputestdata/%s-%s.xml",
+                    abs_srcdir, virArchToString(data->arch), data->name) < 0 ||
+        !(doc = virXMLParseFileCtxt(file, &ctxt)) ||
+        virXPathNodeSet("/cpuTest/cpu", ctxt, &nodes) != (int) ncpus)
+        goto cleanup;
+
+    if (VIR_ALLOC_N(xmlCPUs, ncpus) < 0 ||
+        VIR_ALLOC_N(results, ncpus * ncpus) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ncpus; i++) {
+        if (!(xmlCPUs[i] = virXMLNodeToString(doc, nodes[i])))
+            goto cleanup;
+    }
+
+    if (virCPUCompareMatrixXML((const char **) xmlCPUs, ncpus,
+                               results, &baseline, data->flags) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ncpus; i++) {
+        for (j = 0; j < ncpus; j++) {
+            virCPUCompareResult cmp;
+
+            cmp = virCPUCompare(cpus[i]->arch, cpus[i], cpus[j], false);
+            if (results[i * ncpus + j] != cmp) {
+                VIR_TEST_VERBOSE("\nCPU %zu on host %zu: expected %s, got %s\n",
+                                 j, i, cpuTestCompResStr(cmp),
+                                 cpuTestCompResStr(results[i * ncpus + j]));
+                goto cleanup;
+            }
+        }
+    }
+
+    VIR_FREE(file);
+    if (virAsprintf(&file, "%s/cputestdata/%s-%s-result.xml",
+                    abs_srcdir, virArchToString(data->arch), data->name) < 0)
+        goto cleanup;
+
+    if (virTestCompareToFile(baseline, file) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    if (cpus) {
+        for (i = 0; i < ncpus; i++)
+            virCPUDefFree(cpus[i]);
+        VIR_FREE(cpus);
+    }
+    if (xmlCPUs) {
+        for (i = 0; i < ncpus; i++)
+            VIR_FREE(xmlCPUs[i]);
+        VIR_FREE(xmlCPUs);
+    }
+    VIR_FREE(results);
+    VIR_FREE(baseline);
+    VIR_FREE(file);
+    VIR_FREE(nodes);
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+    return ret;
+}
+
+
 static int
 cpuTestUpdate(const void *arg)
 {
@@ -811,6 +895,10 @@ mymain(void)
         VIR_FREE(label);                                                \
     } while (0)
 
+#define DO_TEST_COMPARE_MATRIX(arch, name)                              \
+    DO_TEST(arch, cpuTestCompareMatrix, name, NULL,                     \
+            "baseline-" name, NULL, 0, 0, 0)
+
 #define DO_TEST_HASFEATURE(arch, host, feature, result)                 \
     DO_TEST(arch, cpuTestHasFeature,                                    \
             host "/" feature " (" #result ")",                          \
@@ -942,6 +1030,12 @@ mymain(void)
     DO_TEST_BASELINE(VIR_ARCH_PPC64, "same-model", 0, 0);
     DO_TEST_BASELINE(VIR_ARCH_PPC64, "legacy", 0, -1);
 
+    /* comparing CPUs with each other */
+    DO_TEST_COMPARE_MATRIX(VIR_ARCH_X86_64, "1");
+    DO_TEST_COMPARE_MATRIX(VIR_ARCH_X86_64, "2");
+    DO_TEST_COMPARE_MATRIX(VIR_ARCH_X86_64, "7");
+    DO_TEST_COMPARE_MATRIX(VIR_ARCH_PPC64, "same-model");
+
     /* CPU features */
     DO_TEST_HASFEATURE(VIR_ARCH_X86_64, "host", "vmx", YES);
     DO_TEST_HASFEATURE(VIR_ARCH_X86_64, "host", "lm", YES);
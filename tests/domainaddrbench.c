@@ -0,0 +1,117 @@
+/*
+ * domainaddrbench.c: benchmarks of device address assignment
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+#include "domain_addr.h"
+#include "viralloc.h"
+#include "virlog.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("tests.domainaddrbench");
+
+/* A pci-root with enough pci-bridges for all the devices */
+#define BENCH_PCI_BUSES 20
+#define BENCH_PCI_DEVICES 500
+
+
+static virDomainPCIAddressSetPtr
+benchPCIAddressSetNew(void)
+{
+    virDomainPCIAddressSetPtr addrs;
+    size_t i;
+
+    if (!(addrs = virDomainPCIAddressSetAlloc(BENCH_PCI_BUSES)))
+        return NULL;
+
+    for (i = 0; i < BENCH_PCI_BUSES; i++) {
+        virDomainControllerModelPCI model = i == 0 ?
+            VIR_DOMAIN_CONTROLLER_MODEL_PCI_ROOT :
+            VIR_DOMAIN_CONTROLLER_MODEL_PCI_BRIDGE;
+
+        if (virDomainPCIAddressBusSetModel(&addrs->buses[i], model) < 0) {
+            virDomainPCIAddressSetFree(addrs);
+            return NULL;
+        }
+    }
+
+    return addrs;
+}
+
+
+/* Assigns addresses to all the devices, then releases every other one
+ * and assigns them again, as hotplug and unplug would */
+static int
+benchPCIAddressAssign(const void *data)
+{
+    virDomainDeviceInfoPtr infos = (virDomainDeviceInfoPtr) data;
+    virDomainPCIConnectFlags flags = (VIR_PCI_CONNECT_HOTPLUGGABLE |
+                                      VIR_PCI_CONNECT_TYPE_PCI_DEVICE);
+    virDomainPCIAddressSetPtr addrs;
+    size_t i;
+    int ret = -1;
+
+    if (!(addrs = benchPCIAddressSetNew()))
+        return -1;
+
+    for (i = 0; i < BENCH_PCI_DEVICES; i++) {
+        if (virDomainPCIAddressReserveNextAddr(addrs, &infos[i], flags, -1) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < BENCH_PCI_DEVICES; i += 2) {
+        if (virDomainPCIAddressReleaseAddr(addrs, &infos[i].addr.pci) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < BENCH_PCI_DEVICES; i += 2) {
+        if (virDomainPCIAddressReserveNextAddr(addrs, &infos[i], flags, -1) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virDomainPCIAddressSetFree(addrs);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    virDomainDeviceInfoPtr infos = NULL;
+    int ret = 0;
+
+    if (VIR_ALLOC_N(infos, BENCH_PCI_DEVICES) < 0)
+        return EXIT_FAILURE;
+
+    if (virTestBench("PCI address assignment of 500 devices",
+                     benchPCIAddressAssign, infos) < 0)
+        ret = -1;
+
+    VIR_FREE(infos);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
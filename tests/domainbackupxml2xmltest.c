@@ -0,0 +1,82 @@
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "backup_conf.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+static int
+testCompareXMLToXMLFiles(const char *inxml, const char *outxml)
+{
+    char *inXmlData = NULL;
+    char *actual = NULL;
+    int ret = -1;
+    virDomainBackupDefPtr def = NULL;
+
+    if (virTestLoadFile(inxml, &inXmlData) < 0)
+        goto cleanup;
+
+    if (!(def = virDomainBackupDefParseString(inXmlData, 0)))
+        goto cleanup;
+
+    if (!(actual = virDomainBackupDefFormat(def, 0)))
+        goto cleanup;
+
+    if (virTestCompareToFile(actual, outxml) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(inXmlData);
+    VIR_FREE(actual);
+    virDomainBackupDefFree(def);
+    return ret;
+}
+
+static int
+testCompareXMLToXMLHelper(const void *data)
+{
+    int result = -1;
+    char *inxml = NULL;
+    char *outxml = NULL;
+    const char *name = data;
+
+    if (virAsprintf(&inxml, "%s/domainbackupxml2xmlin/%s.xml",
+                    abs_srcdir, name) < 0 ||
+        virAsprintf(&outxml, "%s/domainbackupxml2xmlout/%s.xml",
+                    abs_srcdir, name) < 0)
+        goto cleanup;
+
+    result = testCompareXMLToXMLFiles(inxml, outxml);
+
+ cleanup:
+    VIR_FREE(inxml);
+    VIR_FREE(outxml);
+
+    return result;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#define DO_TEST(name)                                           \
+    do {                                                        \
+        if (virTestRun("Backup XML->XML " name,                 \
+                       testCompareXMLToXMLHelper, name) < 0)    \
+            ret = -1;                                           \
+    } while (0)
+
+    DO_TEST("full");
+    DO_TEST("incremental");
+    DO_TEST("disks");
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
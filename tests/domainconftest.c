@@ -79,10 +79,160 @@ static int testGetFilesystem(const void *opaque)
     return ret;
 }
 
+
+struct testParseCacheData {
+    virDomainXMLOptionPtr xmlopt;
+    bool uuid;
+};
+
+static int testParseCache(const void *opaque)
+{
+    const struct testParseCacheData *data = opaque;
+    int ret = -1;
+    char *filename = NULL;
+    char *xml = NULL;
+    char *formatted[3] = { NULL, NULL, NULL };
+    virDomainDefPtr def = NULL;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    size_t i;
+
+    if (virAsprintf(&filename, "%s/domainconfdata/getfilesystem.xml",
+                    abs_srcdir) < 0)
+        goto cleanup;
+
+    if (virTestLoadFile(filename, &xml) < 0)
+        goto cleanup;
+
+    if (!data->uuid) {
+        char *tmp = strstr(xml, "<uuid>");
+        char *end;
+
+        if (!tmp || !(end = strstr(tmp, "\n")))
+            goto cleanup;
+        memmove(tmp, end, strlen(end) + 1);
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(formatted); i++) {
+        if (!(def = virDomainDefParseString(xml, caps, data->xmlopt, NULL,
+                                            VIR_DOMAIN_DEF_PARSE_INACTIVE)))
+            goto cleanup;
+
+        if (i > 0 && !data->uuid &&
+            memcmp(uuid, def->uuid, VIR_UUID_BUFLEN) == 0) {
+            fprintf(stderr, "Generated UUID was reused\n");
+            goto cleanup;
+        }
+        memcpy(uuid, def->uuid, VIR_UUID_BUFLEN);
+
+        if (!(formatted[i] = virDomainDefFormat(def, caps, 0)))
+            goto cleanup;
+
+        if (data->uuid && i > 0 &&
+            virTestCompareToString(formatted[0], formatted[i]) < 0)
+            goto cleanup;
+
+        virDomainDefFree(def);
+        def = NULL;
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < ARRAY_CARDINALITY(formatted); i++)
+        VIR_FREE(formatted[i]);
+    virDomainDefFree(def);
+    VIR_FREE(xml);
+    VIR_FREE(filename);
+    return ret;
+}
+
+
+/* The driver state the stamp test's post parse callback depends on */
+static const char *testParseCacheState = "one";
+
+static int
+testParseCacheStampPostParse(virDomainDefPtr def,
+                             virCapsPtr caps ATTRIBUTE_UNUSED,
+                             unsigned int parseFlags ATTRIBUTE_UNUSED,
+                             void *opaque ATTRIBUTE_UNUSED,
+                             void *parseOpaque ATTRIBUTE_UNUSED)
+{
+    if (def->title)
+        return 0;
+
+    return VIR_STRDUP(def->title, testParseCacheState);
+}
+
+static char *
+testParseCacheStampCallback(const virDomainDef *def ATTRIBUTE_UNUSED,
+                            virCapsPtr caps ATTRIBUTE_UNUSED,
+                            void *opaque ATTRIBUTE_UNUSED)
+{
+    char *ret;
+
+    ignore_value(VIR_STRDUP(ret, testParseCacheState));
+    return ret;
+}
+
+static int testParseCacheStamp(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainDefParserConfig config = {
+        .domainPostParseCallback = testParseCacheStampPostParse,
+        .parseCacheStampCallback = testParseCacheStampCallback,
+        .parseCacheSize = 1,
+    };
+    const char *states[] = { "one", "one", "two", "two" };
+    virDomainXMLOptionPtr stampXmlopt = NULL;
+    virDomainDefPtr def = NULL;
+    char *filename = NULL;
+    char *xml = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (!(stampXmlopt = virDomainXMLOptionNew(&config, NULL, NULL)))
+        goto cleanup;
+
+    if (virAsprintf(&filename, "%s/domainconfdata/getfilesystem.xml",
+                    abs_srcdir) < 0)
+        goto cleanup;
+
+    if (virTestLoadFile(filename, &xml) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ARRAY_CARDINALITY(states); i++) {
+        testParseCacheState = states[i];
+
+        if (!(def = virDomainDefParseString(xml, caps, stampXmlopt, NULL,
+                                            VIR_DOMAIN_DEF_PARSE_INACTIVE)))
+            goto cleanup;
+
+        if (STRNEQ_NULLABLE(def->title, states[i])) {
+            fprintf(stderr, "Expected title '%s', got '%s'\n",
+                    states[i], NULLSTR(def->title));
+            goto cleanup;
+        }
+
+        virDomainDefFree(def);
+        def = NULL;
+    }
+
+    ret = 0;
+
+ cleanup:
+    testParseCacheState = "one";
+    virDomainDefFree(def);
+    virObjectUnref(stampXmlopt);
+    VIR_FREE(xml);
+    VIR_FREE(filename);
+    return ret;
+}
+
 static int
 mymain(void)
 {
     int ret = 0;
+    virDomainDefParserConfig cacheConfig = { .parseCacheSize = 1 };
+    virDomainXMLOptionPtr cacheXmlopt = NULL;
 
     if ((caps = virTestGenericCapsInit()) == NULL)
         goto cleanup;
@@ -106,6 +256,26 @@ mymain(void)
     DO_TEST_GET_FS("/dev/pts", false);
     DO_TEST_GET_FS("/doesnotexist", false);
 
+    if (!(cacheXmlopt = virDomainXMLOptionNew(&cacheConfig, NULL, NULL)))
+        goto cleanup;
+
+#define DO_TEST_PARSE_CACHE(name, hasUUID)                              \
+    do {                                                                \
+        struct testParseCacheData data = {                              \
+            .xmlopt = cacheXmlopt,                                      \
+            .uuid = hasUUID,                                            \
+        };                                                              \
+        if (virTestRun("Parse cache " name, testParseCache, &data) < 0) \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST_PARSE_CACHE("with UUID", true);
+    DO_TEST_PARSE_CACHE("without UUID", false);
+
+    if (virTestRun("Parse cache stamp", testParseCacheStamp, NULL) < 0)
+        ret = -1;
+
+    virObjectUnref(cacheXmlopt);
     virObjectUnref(caps);
     virObjectUnref(xmlopt);
 
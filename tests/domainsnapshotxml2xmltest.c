@@ -74,7 +74,8 @@ testCompareXMLToXMLFiles(const char *inxml,
                          const char *outxml,
                          const char *uuid,
                          bool internal,
-                         bool redefine)
+                         bool redefine,
+                         bool lazy)
 {
     char *inXmlData = NULL;
     char *outXmlData = NULL;
@@ -89,6 +90,9 @@ testCompareXMLToXMLFiles(const char *inxml,
     if (redefine)
         flags |= VIR_DOMAIN_SNAPSHOT_PARSE_REDEFINE;
 
+    if (lazy)
+        flags |= VIR_DOMAIN_SNAPSHOT_PARSE_LAZY;
+
     if (virTestLoadFile(inxml, &inXmlData) < 0)
         goto cleanup;
 
@@ -100,6 +104,11 @@ testCompareXMLToXMLFiles(const char *inxml,
                                                 flags)))
         goto cleanup;
 
+    if (lazy &&
+        (def->dom ||
+         virDomainSnapshotDefLoadDom(def, driver.caps, driver.xmlopt) < 0))
+        goto cleanup;
+
     if (!(actual = virDomainSnapshotDefFormat(uuid, def, driver.caps,
                                               VIR_DOMAIN_DEF_FORMAT_SECURE,
                                               internal)))
@@ -134,6 +143,7 @@ struct testInfo {
     const char *uuid;
     bool internal;
     bool redefine;
+    bool lazy;
 };
 
 
@@ -143,7 +153,8 @@ testCompareXMLToXMLHelper(const void *data)
     const struct testInfo *info = data;
 
     return testCompareXMLToXMLFiles(info->inxml, info->outxml, info->uuid,
-                                    info->internal, info->redefine);
+                                    info->internal, info->redefine,
+                                    info->lazy);
 }
 
 
@@ -170,16 +181,21 @@ mymain(void)
     }
 
 
-# define DO_TEST(prefix, name, inpath, outpath, uuid, internal, redefine)     \
+# define DO_TEST_FULL(prefix, name, inpath, outpath, uuid, internal, redefine, \
+                      lazy)                                                   \
     do {                                                                      \
         const struct testInfo info = {abs_srcdir "/" inpath "/" name ".xml",  \
                                       abs_srcdir "/" outpath "/" name ".xml", \
-                                      uuid, internal, redefine};              \
+                                      uuid, internal, redefine, lazy};        \
         if (virTestRun("SNAPSHOT XML-2-XML " prefix " " name,                 \
                        testCompareXMLToXMLHelper, &info) < 0)                 \
             ret = -1;                                                         \
     } while (0)
 
+# define DO_TEST(prefix, name, inpath, outpath, uuid, internal, redefine)     \
+    DO_TEST_FULL(prefix, name, inpath, outpath, uuid, internal, redefine,     \
+                 false)
+
 # define DO_TEST_IN(name, uuid) DO_TEST("in->in", name,\
                                         "domainsnapshotxml2xmlin",\
                                         "domainsnapshotxml2xmlin",\
@@ -190,6 +206,12 @@ mymain(void)
                                                    "domainsnapshotxml2xmlout",\
                                                    uuid, internal, true)
 
+# define DO_TEST_LAZY(name, uuid, internal) \
+    DO_TEST_FULL("lazy out->out", name,\
+                 "domainsnapshotxml2xmlout",\
+                 "domainsnapshotxml2xmlout",\
+                 uuid, internal, true, true)
+
 # define DO_TEST_INOUT(name, uuid, internal, redefine) \
     DO_TEST("in->out", name,\
             "domainsnapshotxml2xmlin",\
@@ -210,6 +232,9 @@ mymain(void)
     DO_TEST_OUT("metadata", "c7a5fdbd-edaf-9455-926a-d65c16db1809", false);
     DO_TEST_OUT("external_vm_redefine", "c7a5fdbd-edaf-9455-926a-d65c16db1809", false);
 
+    DO_TEST_LAZY("all_parameters", "9d37b878-a7cc-9f9a-b78f-49b3abad25a8", true);
+    DO_TEST_LAZY("full_domain", "c7a5fdbd-edaf-9455-926a-d65c16db1809", true);
+
     DO_TEST_INOUT("empty", "9d37b878-a7cc-9f9a-b78f-49b3abad25a8", false, false);
     DO_TEST_INOUT("noparent", "9d37b878-a7cc-9f9a-b78f-49b3abad25a8", false, false);
     DO_TEST_INOUT("external_vm", NULL, false, false);
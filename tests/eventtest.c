@@ -154,6 +154,26 @@ testTimer(int timer, void *data)
         virEventPollRemoveTimeout(info->delete);
 }
 
+static pthread_mutex_t affinityMutex = PTHREAD_MUTEX_INITIALIZER;
+static int affinityFD[2];
+static int affinityWatch;
+static int affinityFired;
+
+static void
+testAffinityReader(int watch, int fd, int events ATTRIBUTE_UNUSED,
+                   void *data ATTRIBUTE_UNUSED)
+{
+    char one;
+
+    if (read(fd, &one, 1) != 1)
+        return;
+
+    pthread_mutex_lock(&affinityMutex);
+    if (watch == affinityWatch)
+        affinityFired = 1;
+    pthread_mutex_unlock(&affinityMutex);
+}
+
 static pthread_mutex_t eventThreadMutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t eventThreadRunCond = PTHREAD_COND_INITIALIZER;
 static int eventThreadRunOnce;
@@ -316,6 +336,9 @@ mymain(void)
     size_t i;
     pthread_t eventThread;
     char one = '1';
+    virEventPollStats stats;
+    virEventPollCallbackStatsPtr cbstats = NULL;
+    size_t ncbstats = 0;
 
     for (i = 0; i < NUM_FDS; i++) {
         if (pipe(handles[i].pipeFD) < 0) {
@@ -424,12 +447,37 @@ mymain(void)
 
 
 
-    /* Run a timer on its own */
+    /* Run a timer on its own, timing its callback */
+    virEventPollSetStallThreshold(60 * 1000);
     virEventPollUpdateTimeout(timers[1].timer, 100);
     startJob();
     if (finishJob("Firing a timer", -1, 1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
     virEventPollUpdateTimeout(timers[1].timer, -1);
+    virEventPollSetStallThreshold(0);
+
+    if (virEventPollGetCallbackStats(&cbstats, &ncbstats, 10) < 0 ||
+        ncbstats != 1 || !cbstats[0].timer || cbstats[0].calls != 1 ||
+        cbstats[0].stalls != 0 || !cbstats[0].name) {
+        testEventReport("Callback statistics", 1,
+                        "Expected 1 timer callback called once, got %zu\n",
+                        ncbstats);
+        return EXIT_FAILURE;
+    }
+    virEventPollCallbackStatsFree(cbstats, ncbstats);
+    testEventReport("Callback statistics", 0, NULL);
+
+    virEventPollGetStats(&stats);
+    if (stats.timers != NUM_TIME || stats.timersArmed != 0 ||
+        stats.timersFired != 1) {
+        testEventReport("Timer statistics", 1,
+                        "Expected %d timers, 0 armed, 1 fired, "
+                        "got %zu, %zu, %llu\n",
+                        NUM_TIME, stats.timers, stats.timersArmed,
+                        stats.timersFired);
+        return EXIT_FAILURE;
+    }
+    testEventReport("Timer statistics", 0, NULL);
 
     resetAll();
 
@@ -523,6 +571,34 @@ mymain(void)
     if (finishJob("Write duplicate", 1, -1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
+    /* Handles with an affinity are dispatched by the extra loop
+     * threads, without the main loop running at all */
+    if (virEventPollSetLoopThreads(2) < 0 ||
+        pipe(affinityFD) < 0)
+        return EXIT_FAILURE;
+
+    pthread_mutex_lock(&affinityMutex);
+    affinityWatch = virEventPollAddHandleAffinity(affinityFD[0],
+                                                  VIR_EVENT_HANDLE_READABLE,
+                                                  testAffinityReader,
+                                                  NULL, NULL, 7);
+    pthread_mutex_unlock(&affinityMutex);
+    if (affinityWatch < 0 ||
+        safewrite(affinityFD[1], &one, 1) != 1)
+        return EXIT_FAILURE;
+    for (i = 0; i < 500; i++) {
+        int fired;
+
+        pthread_mutex_lock(&affinityMutex);
+        fired = affinityFired;
+        pthread_mutex_unlock(&affinityMutex);
+        if (fired)
+            break;
+        usleep(10 * 1000);
+    }
+    testEventReport("Loop thread affinity", i == 500 ||
+                    virEventPollRemoveHandle(affinityWatch) < 0, NULL);
+
     //pthread_kill(eventThread, SIGTERM);
 
     return EXIT_SUCCESS;
@@ -22,6 +22,7 @@
 
 #include <stdlib.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 
 #include "testutils.h"
 
@@ -314,6 +315,282 @@ static int testFDStreamWriteNonblock(const void *data)
     return testFDStreamWriteCommon(data, false);
 }
 
+#define SPARSE_CHUNK (64 * 1024)
+#define SPARSE_LEN (SPARSE_CHUNK * 32)
+
+/* Reads a sparse file through the stream, reassembling the holes it
+ * reports, and checks the result matches the file. Filesystems which
+ * can't report holes just send everything as data. */
+static int testFDStreamSparseReadCommon(const char *scratchdir, bool blocking)
+{
+    int fd = -1;
+    char *file = NULL;
+    int ret = -1;
+    char *pattern = NULL;
+    char *expect = NULL;
+    char *buf = NULL;
+    virStreamPtr st = NULL;
+    size_t i;
+    size_t offset = 0;
+    virConnectPtr conn = NULL;
+    int flags = 0;
+
+    if (!blocking)
+        flags |= VIR_STREAM_NONBLOCK;
+
+    if (!(conn = virConnectOpen("test:///default")))
+        goto cleanup;
+
+    if (VIR_ALLOC_N(pattern, SPARSE_CHUNK) < 0 ||
+        VIR_ALLOC_N(expect, SPARSE_LEN) < 0 ||
+        VIR_ALLOC_N(buf, SPARSE_LEN) < 0)
+        goto cleanup;
+
+    for (i = 0; i < SPARSE_CHUNK; i++)
+        pattern[i] = i;
+
+    if (virAsprintf(&file, "%s/sparse.data", scratchdir) < 0)
+        goto cleanup;
+
+    if ((fd = open(file, O_CREAT|O_WRONLY|O_EXCL, 0600)) < 0)
+        goto cleanup;
+
+    /* Data in chunks 0 and 16, holes everywhere else */
+    for (i = 0; i < SPARSE_LEN; i += SPARSE_CHUNK * 16) {
+        if (lseek(fd, i, SEEK_SET) < 0 ||
+            safewrite(fd, pattern, SPARSE_CHUNK) != SPARSE_CHUNK)
+            goto cleanup;
+        memcpy(expect + i, pattern, SPARSE_CHUNK);
+    }
+
+    if (ftruncate(fd, SPARSE_LEN) < 0 ||
+        VIR_CLOSE(fd) < 0)
+        goto cleanup;
+
+    if (!(st = virStreamNew(conn, flags)))
+        goto cleanup;
+
+    if (virFDStreamOpenBlockDevice(st, file, 0, 0, true, O_RDONLY) < 0)
+        goto cleanup;
+
+    while (1) {
+        int got;
+        long long length;
+
+        got = st->driver->streamRecvFlags(st, buf + offset,
+                                          SPARSE_LEN - offset,
+                                          VIR_STREAM_RECV_STOP_AT_HOLE);
+        if (got == -2 && !blocking) {
+            usleep(20 * 1000);
+            continue;
+        }
+        if (got == -3) {
+            if (st->driver->streamRecvHole(st, &length, 0) < 0) {
+                virFilePrintf(stderr, "Failed to receive hole: %s\n",
+                              virGetLastErrorMessage());
+                goto cleanup;
+            }
+            if (length <= 0 || offset + length > SPARSE_LEN) {
+                virFilePrintf(stderr, "Unexpected hole length %lld at %zu\n",
+                              length, offset);
+                goto cleanup;
+            }
+            offset += length;
+            continue;
+        }
+        if (got < 0) {
+            virFilePrintf(stderr, "Failed to read stream: %s\n",
+                          virGetLastErrorMessage());
+            goto cleanup;
+        }
+        if (got == 0)
+            break;
+        offset += got;
+    }
+
+    if (offset != SPARSE_LEN) {
+        virFilePrintf(stderr, "Expected %d bytes, got %zu\n",
+                      SPARSE_LEN, offset);
+        goto cleanup;
+    }
+
+    if (memcmp(buf, expect, SPARSE_LEN) != 0) {
+        virFilePrintf(stderr, "Mismatched sparse data\n");
+        goto cleanup;
+    }
+
+    if (st->driver->streamFinish(st) != 0) {
+        virFilePrintf(stderr, "Failed to finish stream: %s\n",
+                      virGetLastErrorMessage());
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    if (st)
+        virStreamFree(st);
+    VIR_FORCE_CLOSE(fd);
+    if (file != NULL)
+        unlink(file);
+    if (conn)
+        virConnectClose(conn);
+    VIR_FREE(file);
+    VIR_FREE(pattern);
+    VIR_FREE(expect);
+    VIR_FREE(buf);
+    return ret;
+}
+
+
+static int testFDStreamSparseReadBlock(const void *data)
+{
+    return testFDStreamSparseReadCommon(data, true);
+}
+static int testFDStreamSparseReadNonblock(const void *data)
+{
+    return testFDStreamSparseReadCommon(data, false);
+}
+
+#define DIRECT_LEN (64 * 1024 * 5 + 1000)
+#define DIRECT_CHUNK 10000
+
+/* Writes a file with O_DIRECT through a non-blocking stream and reads
+ * it back, using few small buffers so the I/O thread has to wait for
+ * the stream on both ends. */
+static int testFDStreamDirectNonblock(const void *data)
+{
+    const char *scratchdir = data;
+    int fd = -1;
+    char *file = NULL;
+    int ret = -1;
+    char *pattern = NULL;
+    char *buf = NULL;
+    virStreamPtr st = NULL;
+    size_t i;
+    size_t done;
+    struct stat sb;
+    virConnectPtr conn = NULL;
+
+    if (!O_DIRECT)
+        return EXIT_AM_SKIP;
+
+    if (!(conn = virConnectOpen("test:///default")))
+        goto cleanup;
+
+    if (VIR_ALLOC_N(pattern, DIRECT_LEN) < 0 ||
+        VIR_ALLOC_N(buf, DIRECT_LEN) < 0)
+        goto cleanup;
+
+    for (i = 0; i < DIRECT_LEN; i++)
+        pattern[i] = i % 251;
+
+    if (virAsprintf(&file, "%s/direct.data", scratchdir) < 0)
+        goto cleanup;
+
+    /* Not every filesystem can do O_DIRECT */
+    if ((fd = open(file, O_CREAT|O_WRONLY|O_DIRECT, 0600)) < 0) {
+        ret = errno == EINVAL ? EXIT_AM_SKIP : -1;
+        goto cleanup;
+    }
+    VIR_FORCE_CLOSE(fd);
+
+    if (virFDStreamSetDirectIO(64 * 1024, 2) < 0)
+        goto cleanup;
+
+    if (!(st = virStreamNew(conn, VIR_STREAM_NONBLOCK)))
+        goto cleanup;
+
+    if (virFDStreamCreateFile(st, file, 0, 0, O_WRONLY|O_DIRECT, 0600) < 0)
+        goto cleanup;
+
+    for (done = 0; done < DIRECT_LEN;) {
+        int got = st->driver->streamSend(st, pattern + done,
+                                         MIN(DIRECT_CHUNK, DIRECT_LEN - done));
+        if (got == -2) {
+            usleep(1000);
+            continue;
+        }
+        if (got <= 0) {
+            virFilePrintf(stderr, "Failed to write stream: %s\n",
+                          virGetLastErrorMessage());
+            goto cleanup;
+        }
+        done += got;
+    }
+
+    if (st->driver->streamFinish(st) != 0) {
+        virFilePrintf(stderr, "Failed to finish stream: %s\n",
+                      virGetLastErrorMessage());
+        goto cleanup;
+    }
+    virStreamFree(st);
+    st = NULL;
+
+    if (stat(file, &sb) < 0 || sb.st_size != DIRECT_LEN) {
+        virFilePrintf(stderr, "Unexpected size of written file\n");
+        goto cleanup;
+    }
+
+    if (!(st = virStreamNew(conn, VIR_STREAM_NONBLOCK)))
+        goto cleanup;
+
+    if (virFDStreamOpenFile(st, file, 0, 0, O_RDONLY|O_DIRECT) < 0)
+        goto cleanup;
+
+    for (done = 0; ;) {
+        int got = st->driver->streamRecv(st, buf + done,
+                                         MIN(DIRECT_CHUNK, DIRECT_LEN - done));
+        if (got == -2) {
+            usleep(1000);
+            continue;
+        }
+        if (got < 0) {
+            virFilePrintf(stderr, "Failed to read stream: %s\n",
+                          virGetLastErrorMessage());
+            goto cleanup;
+        }
+        if (got == 0)
+            break;
+        done += got;
+        if (done == DIRECT_LEN) {
+            /* Make sure there is nothing beyond the data written */
+            char c;
+            while ((got = st->driver->streamRecv(st, &c, 1)) == -2)
+                usleep(1000);
+            if (got != 0) {
+                virFilePrintf(stderr, "Expected EOF at end of file\n");
+                goto cleanup;
+            }
+            break;
+        }
+    }
+
+    if (done != DIRECT_LEN || memcmp(buf, pattern, DIRECT_LEN) != 0) {
+        virFilePrintf(stderr, "Mismatched data read back\n");
+        goto cleanup;
+    }
+
+    if (st->driver->streamFinish(st) != 0) {
+        virFilePrintf(stderr, "Failed to finish stream: %s\n",
+                      virGetLastErrorMessage());
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    if (st)
+        virStreamFree(st);
+    VIR_FORCE_CLOSE(fd);
+    if (file != NULL)
+        unlink(file);
+    if (conn)
+        virConnectClose(conn);
+    VIR_FREE(file);
+    VIR_FREE(pattern);
+    VIR_FREE(buf);
+    return ret;
+}
+
 #define SCRATCHDIRTEMPLATE abs_builddir "/fakesysfsdir-XXXXXX"
 
 static int
@@ -335,6 +612,12 @@ mymain(void)
         ret = -1;
     if (virTestRun("Stream write non-blocking ", testFDStreamWriteNonblock, scratchdir) < 0)
         ret = -1;
+    if (virTestRun("Stream sparse read blocking ", testFDStreamSparseReadBlock, scratchdir) < 0)
+        ret = -1;
+    if (virTestRun("Stream sparse read non-blocking ", testFDStreamSparseReadNonblock, scratchdir) < 0)
+        ret = -1;
+    if (virTestRun("Stream direct I/O non-blocking ", testFDStreamDirectNonblock, scratchdir) < 0)
+        ret = -1;
 
     if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
         virFileDeleteTree(scratchdir);
@@ -7,8 +7,11 @@
 
 #include "internal.h"
 #include "virjson.h"
+#include "virbuffer.h"
 #include "testutils.h"
 
+#define VIR_FROM_THIS VIR_FROM_NONE
+
 struct testInfo {
     const char *doc;
     const char *expect;
@@ -311,6 +314,266 @@ testJSONCopy(const void *data)
 }
 
 
+static int
+testJSONStreamCallback(const virJSONStreamItem *item,
+                       void *opaque)
+{
+    virBufferPtr buf = opaque;
+    char *str;
+
+    /* Ends and captured values are reported at the position of the
+     * value they complete, which has already been printed */
+    if (item->event != VIR_JSON_STREAM_OBJECT_END &&
+        item->event != VIR_JSON_STREAM_ARRAY_END &&
+        item->event != VIR_JSON_STREAM_CAPTURED) {
+        if (item->key)
+            virBufferAsprintf(buf, "%s:", item->key);
+        else if (item->depth)
+            virBufferAsprintf(buf, "#%zu:", item->index);
+    }
+
+    switch ((virJSONStreamEvent) item->event) {
+    case VIR_JSON_STREAM_OBJECT_START:
+    case VIR_JSON_STREAM_ARRAY_START:
+        if (STREQ_NULLABLE(item->key, "skip")) {
+            virBufferAddLit(buf, "... ");
+            return VIR_JSON_STREAM_SKIP;
+        }
+        if (STREQ_NULLABLE(item->key, "capture")) {
+            virBufferAddLit(buf, "(");
+            return VIR_JSON_STREAM_CAPTURE;
+        }
+        virBufferAsprintf(buf, "%s ",
+                          item->event == VIR_JSON_STREAM_OBJECT_START ?
+                          "{" : "[");
+        break;
+
+    case VIR_JSON_STREAM_OBJECT_END:
+        virBufferAddLit(buf, "} ");
+        break;
+
+    case VIR_JSON_STREAM_ARRAY_END:
+        virBufferAddLit(buf, "] ");
+        break;
+
+    case VIR_JSON_STREAM_SCALAR:
+        if (STREQ_NULLABLE(item->key, "capture")) {
+            virBufferAddLit(buf, "(");
+            return VIR_JSON_STREAM_CAPTURE;
+        }
+        if (STREQ_NULLABLE(item->key, "fail"))
+            return -1;
+
+        if (item->type == VIR_JSON_TYPE_STRING)
+            virBufferAsprintf(buf, "'%s' ", item->value);
+        else if (item->type == VIR_JSON_TYPE_NUMBER)
+            virBufferAsprintf(buf, "%s ", item->value);
+        else if (item->type == VIR_JSON_TYPE_BOOLEAN)
+            virBufferAsprintf(buf, "%s ", item->boolean ? "true" : "false");
+        else
+            virBufferAddLit(buf, "null ");
+        break;
+
+    case VIR_JSON_STREAM_CAPTURED:
+        if (!(str = virJSONValueToString(item->captured, false))) {
+            virJSONValueFree(item->captured);
+            return -1;
+        }
+        virBufferAsprintf(buf, "%s) ", str);
+        VIR_FREE(str);
+        virJSONValueFree(item->captured);
+        break;
+    }
+
+    return 0;
+}
+
+
+static int
+testJSONStream(const void *data)
+{
+    const struct testInfo *info = data;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *result = NULL;
+    int ret = -1;
+    int rc;
+
+    rc = virJSONStreamParse(info->doc, testJSONStreamCallback, &buf);
+
+    if (!info->pass) {
+        if (rc == 0) {
+            VIR_TEST_VERBOSE("Should not have parsed %s\n", info->doc);
+            goto cleanup;
+        }
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (rc < 0) {
+        VIR_TEST_VERBOSE("Fail to parse %s\n", info->doc);
+        goto cleanup;
+    }
+
+    virBufferTrim(&buf, " ", -1);
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+    result = virBufferContentAndReset(&buf);
+
+    if (STRNEQ_NULLABLE(info->expect, result)) {
+        virTestDifference(stderr, info->expect, result);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(result);
+    return ret;
+}
+
+
+static int
+testJSONArena(const void *data)
+{
+    const struct testInfo *info = data;
+    virJSONValuePtr heap = NULL;
+    virJSONValuePtr arena = NULL;
+    char *expect = NULL;
+    char *result = NULL;
+    int ret = -1;
+
+    if (!(heap = virJSONValueFromString(info->doc)) ||
+        !(arena = virJSONValueFromStringArena(info->doc))) {
+        VIR_TEST_VERBOSE("Fail to parse %s\n", info->doc);
+        goto cleanup;
+    }
+
+    if (!(expect = virJSONValueToString(heap, false)) ||
+        !(result = virJSONValueToString(arena, false))) {
+        VIR_TEST_VERBOSE("%s", "failed to stringize result\n");
+        goto cleanup;
+    }
+
+    if (STRNEQ(expect, result)) {
+        virTestDifference(stderr, expect, result);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virJSONValueFree(heap);
+    virJSONValueFree(arena);
+    VIR_FREE(expect);
+    VIR_FREE(result);
+    return ret;
+}
+
+
+static int
+testJSONArenaStealCallback(size_t pos ATTRIBUTE_UNUSED,
+                           virJSONValuePtr item,
+                           void *opaque)
+{
+    virJSONValuePtr *kept = opaque;
+
+    /* steal the numbers, leave everything else in the array */
+    if (item->type != VIR_JSON_TYPE_NUMBER)
+        return 1;
+
+    if (*kept) {
+        virJSONValueFree(item);
+        return 0;
+    }
+
+    *kept = item;
+    return 0;
+}
+
+
+static int
+testJSONArenaModify(const void *data ATTRIBUTE_UNUSED)
+{
+    const char *doc =
+        "{ \"list\": [ 1, \"two\", 3, { \"four\": 4 } ],"
+        "  \"name\": \"sample\", \"empty\": {} }";
+    const char *expect = "{\"empty\":{},\"heap\":[true]}";
+    virJSONValuePtr json = NULL;
+    virJSONValuePtr list = NULL;
+    virJSONValuePtr name = NULL;
+    virJSONValuePtr four = NULL;
+    virJSONValuePtr number = NULL;
+    virJSONValuePtr heap = NULL;
+    char *result = NULL;
+    int ret = -1;
+
+    if (!(json = virJSONValueFromStringArena(doc))) {
+        VIR_TEST_VERBOSE("Fail to parse %s\n", doc);
+        goto cleanup;
+    }
+
+    if (!(list = virJSONValueObjectStealArray(json, "list")) ||
+        virJSONValueObjectRemoveKey(json, "name", &name) != 1 ||
+        !(four = virJSONValueArraySteal(list, 3))) {
+        VIR_TEST_VERBOSE("%s", "failed to take values out of the tree\n");
+        goto cleanup;
+    }
+
+    if (!(heap = virJSONValueNewArray()) ||
+        virJSONValueArrayAppend(heap, virJSONValueNewBoolean(true)) < 0 ||
+        virJSONValueObjectAppend(json, "heap", heap) < 0) {
+        VIR_TEST_VERBOSE("%s", "failed to add a value to the tree\n");
+        goto cleanup;
+    }
+    heap = NULL;
+
+    if (!(result = virJSONValueToString(json, false)) ||
+        STRNEQ(expect, result)) {
+        virTestDifference(stderr, expect, NULLSTR(result));
+        goto cleanup;
+    }
+
+    /* the values taken out must outlive the tree they came from */
+    virJSONValueFree(json);
+    json = NULL;
+
+    if (virJSONValueArrayForeachSteal(list, testJSONArenaStealCallback,
+                                      &number) < 0 ||
+        virJSONValueArraySize(list) != 1) {
+        VIR_TEST_VERBOSE("%s", "failed to steal values from the array\n");
+        goto cleanup;
+    }
+
+    if (STRNEQ_NULLABLE(virJSONValueGetString(name), "sample") ||
+        STRNEQ_NULLABLE(virJSONValueGetString(virJSONValueArrayGet(list, 0)),
+                        "two") ||
+        !virJSONValueObjectHasKey(four, "four") ||
+        !number || number->type != VIR_JSON_TYPE_NUMBER) {
+        VIR_TEST_VERBOSE("%s", "unexpected values after freeing the tree\n");
+        goto cleanup;
+    }
+
+    if (virJSONValueObjectRemoveKey(four, "four", NULL) != 1 ||
+        virJSONValueObjectKeysNumber(four) != 0) {
+        VIR_TEST_VERBOSE("%s", "failed to remove key\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virJSONValueFree(json);
+    virJSONValueFree(list);
+    virJSONValueFree(name);
+    virJSONValueFree(four);
+    virJSONValueFree(number);
+    virJSONValueFree(heap);
+    VIR_FREE(result);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -448,6 +711,32 @@ mymain(void)
                  "{ \"a\": {}, \"b\": 1, \"c\": \"str\", \"d\": [] }",
                  NULL, true);
 
+    DO_TEST_FULL("stream scalar", Stream,
+                 "1", "1", true);
+    DO_TEST_FULL("stream nested", Stream,
+                 "{ \"a\": [ 1, \"two\", true, null ], \"b\": { \"c\": {} } }",
+                 "{ a:[ #0:1 #1:'two' #2:true #3:null ] b:{ c:{ } } }", true);
+    DO_TEST_FULL("stream skip", Stream,
+                 "[ { \"skip\": { \"a\": [ 1, 2 ], \"b\": {} }, \"c\": 3 }, 4 ]",
+                 "[ #0:{ skip:... c:3 } #1:4 ]", true);
+    DO_TEST_FULL("stream capture", Stream,
+                 "{ \"capture\": { \"a\": [ 1, 2 ] }, \"b\": [ { \"capture\": 5 } ] }",
+                 "{ capture:({\"a\":[1,2]}) b:[ #0:{ capture:(5) } ] }", true);
+    DO_TEST_FULL("stream abort", Stream,
+                 "{ \"a\": 1, \"fail\": 2, \"b\": 3 }", NULL, false);
+    DO_TEST_FULL("stream unterminated", Stream,
+                 "{ \"a\": [ 1, 2 }", NULL, false);
+    DO_TEST_FULL("stream trailing garbage", Stream,
+                 "[] []", NULL, false);
+
+    DO_TEST_FULL("arena scalar", Arena,
+                 "[ 1, -2.5, \"str\", true, false, null ]", NULL, true);
+    DO_TEST_FULL("arena nested", Arena,
+                 "{ \"a\": { \"b\": [ {}, [], { \"c\": [ 1, 2, 3 ] } ] },"
+                 "  \"d\": \"x\", \"e\": [ [ [ \"deep\" ] ] ] }",
+                 NULL, true);
+    DO_TEST_FULL("arena modify", ArenaModify, NULL, NULL, true);
+
     return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -25,6 +25,7 @@
 
 # include "testutils.h"
 # include "nwfilter/nwfilter_ebiptables_driver.h"
+# include "nwfilter/nwfilter_nftables_driver.h"
 # include "virbuffer.h"
 
 # define __VIR_FIREWALL_PRIV_H_ALLOW__
@@ -418,6 +419,72 @@ static int testCompareXMLToArgvFiles(const char *xml,
     return ret;
 }
 
+static void
+testNftablesDryRunHook(const char *const*args ATTRIBUTE_UNUSED,
+                       const char *const*env ATTRIBUTE_UNUSED,
+                       const char *input,
+                       char **output ATTRIBUTE_UNUSED,
+                       char **error ATTRIBUTE_UNUSED,
+                       int *status ATTRIBUTE_UNUSED,
+                       void *opaque)
+{
+    virBufferPtr buf = opaque;
+
+    /* the rules are fed to nft on stdin */
+    virBufferAdd(buf, input, -1);
+}
+
+static int testCompareXMLToNftFiles(const char *xml,
+                                    const char *script)
+{
+    char *actual = NULL;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virNWFilterHashTablePtr vars = virNWFilterHashTableCreate(0);
+    virNWFilterInst inst;
+    int ret = -1;
+
+    memset(&inst, 0, sizeof(inst));
+
+    virCommandSetDryRun(&buf, testNftablesDryRunHook, &buf);
+
+    if (!vars)
+        goto cleanup;
+
+    if (testSetDefaultParameters(vars) < 0)
+        goto cleanup;
+
+    if (virNWFilterDefToInst(xml,
+                             vars,
+                             &inst) < 0)
+        goto cleanup;
+
+    if (nftables_driver.applyNewRules("vnet0", inst.rules, inst.nrules) < 0)
+        goto cleanup;
+
+    if (virBufferError(&buf))
+        goto cleanup;
+
+    actual = virBufferContentAndReset(&buf);
+    virTestClearCommandPath(actual);
+
+    /* drops the pending rules */
+    if (nftables_driver.tearNewRules("vnet0") < 0)
+        goto cleanup;
+
+    if (virTestCompareToFile(actual, script) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virCommandSetDryRun(NULL, NULL, NULL);
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(actual);
+    virNWFilterInstReset(&inst);
+    virNWFilterHashTableFree(vars);
+    return ret;
+}
+
 struct testInfo {
     const char *name;
 };
@@ -446,6 +513,29 @@ testCompareXMLToIPTablesHelper(const void *data)
 }
 
 
+static int
+testCompareXMLToNftHelper(const void *data)
+{
+    int result = -1;
+    const struct testInfo *info = data;
+    char *xml = NULL;
+    char *script = NULL;
+
+    if (virAsprintf(&xml, "%s/nwfilterxml2firewalldata/%s.xml",
+                    abs_srcdir, info->name) < 0 ||
+        virAsprintf(&script, "%s/nwfilterxml2firewalldata/%s-nft.args",
+                    abs_srcdir, info->name) < 0)
+        goto cleanup;
+
+    result = testCompareXMLToNftFiles(xml, script);
+
+ cleanup:
+    VIR_FREE(xml);
+    VIR_FREE(script);
+    return result;
+}
+
+
 static int
 mymain(void)
 {
@@ -465,6 +555,16 @@ mymain(void)
             ret = -1;                                                   \
     } while (0)
 
+# define DO_TEST_NFT(name)                                              \
+    do {                                                                \
+        static struct testInfo info = {                                 \
+            name,                                                       \
+        };                                                              \
+        if (virTestRun("NWFilter XML-2-nftables " name,                 \
+                       testCompareXMLToNftHelper, &info) < 0)           \
+            ret = -1;                                                   \
+    } while (0)
+
     virFirewallSetLockOverride(true);
 
     if (virFirewallSetBackend(VIR_FIREWALL_BACKEND_DIRECT) < 0) {
@@ -512,6 +612,23 @@ mymain(void)
     DO_TEST("udplite-ipv6");
     DO_TEST("vlan");
 
+    DO_TEST_NFT("comment");
+    DO_TEST_NFT("conntrack");
+    DO_TEST_NFT("example-1");
+    DO_TEST_NFT("example-2");
+    DO_TEST_NFT("icmp");
+    DO_TEST_NFT("icmpv6");
+    DO_TEST_NFT("ip");
+    DO_TEST_NFT("ipv6");
+    DO_TEST_NFT("iter1");
+    DO_TEST_NFT("iter3");
+    DO_TEST_NFT("mac");
+    DO_TEST_NFT("rarp");
+    DO_TEST_NFT("target");
+    DO_TEST_NFT("tcp");
+    DO_TEST_NFT("udp");
+    DO_TEST_NFT("vlan");
+
  cleanup:
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -468,6 +468,71 @@ testDomainStartStopEvent(const void *data)
     return ret;
 }
 
+static int
+testDomainStartStopEventFiltered(const void *data)
+{
+    const objecteventTest *test = data;
+    lifecycleEventCounter domCounter;
+    lifecycleEventCounter allCounter;
+    int eventId = VIR_DOMAIN_EVENT_ID_LIFECYCLE;
+    int domId = -1;
+    int allId = -1;
+    int ret = -1;
+    virDomainPtr dom;
+    virDomainPtr other = NULL;
+
+    lifecycleEventCounter_reset(&domCounter);
+    lifecycleEventCounter_reset(&allCounter);
+
+    dom = virDomainLookupByName(test->conn, "test");
+    if (dom == NULL)
+        return -1;
+
+    domId = virConnectDomainEventRegisterAny(test->conn, dom, eventId,
+                           VIR_DOMAIN_EVENT_CALLBACK(&domainLifecycleCb),
+                           &domCounter, NULL);
+    allId = virConnectDomainEventRegisterAny(test->conn, NULL, eventId,
+                           VIR_DOMAIN_EVENT_CALLBACK(&domainLifecycleCb),
+                           &allCounter, NULL);
+    if (domId < 0 || allId < 0)
+        goto cleanup;
+
+    /* Events of another domain only reach the global callback */
+    if (!(other = virDomainCreateXML(test->conn, domainDef, 0)) ||
+        virEventRunDefaultImpl() < 0)
+        goto cleanup;
+
+    if (domCounter.startEvents != 0 || allCounter.startEvents != 1)
+        goto cleanup;
+
+    /* While those of the filtered domain reach both */
+    virDomainDestroy(dom);
+    if (virDomainCreate(dom) < 0)
+        goto cleanup;
+
+    if (virEventRunDefaultImpl() < 0)
+        goto cleanup;
+
+    if (domCounter.startEvents != 1 || domCounter.stopEvents != 1 ||
+        allCounter.startEvents != 2 || allCounter.stopEvents != 1 ||
+        domCounter.unexpectedEvents > 0 || allCounter.unexpectedEvents > 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    if (domId >= 0)
+        virConnectDomainEventDeregisterAny(test->conn, domId);
+    if (allId >= 0)
+        virConnectDomainEventDeregisterAny(test->conn, allId);
+    virDomainFree(dom);
+    if (other) {
+        virDomainDestroy(other);
+        virDomainFree(other);
+    }
+
+    return ret;
+}
+
 static int
 testNetworkCreateXML(const void *data)
 {
@@ -797,6 +862,9 @@ mymain(void)
         ret = EXIT_FAILURE;
     if (virTestRun("Domain start stop events", testDomainStartStopEvent, &test) < 0)
         ret = EXIT_FAILURE;
+    if (virTestRun("Domain start stop events filtered on one domain",
+                   testDomainStartStopEventFiltered, &test) < 0)
+        ret = EXIT_FAILURE;
 
     /* Network event tests */
     /* Tests requiring the test network not to be set up*/
@@ -49,9 +49,6 @@ testQemuAgentFSFreeze(const void *data)
                                "{ \"return\" : 5 }") < 0)
         goto cleanup;
 
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItem(test, "guest-fsfreeze-freeze",
                                "{ \"return\" : 7 }") < 0)
         goto cleanup;
@@ -100,9 +97,6 @@ testQemuAgentFSThaw(const void *data)
                                "{ \"return\" : 5 }") < 0)
         goto cleanup;
 
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItem(test, "guest-fsfreeze-thaw",
                                "{ \"return\" : 7 }") < 0)
         goto cleanup;
@@ -221,7 +215,8 @@ testQemuAgentGetFSInfo(const void *data)
         goto cleanup;
 
     if ((ninfo = qemuAgentGetFSInfo(qemuMonitorTestGetAgent(test),
-                                    &info, def)) < 0)
+                                    &info, def,
+                                    VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK)) < 0)
         goto cleanup;
 
     if (ninfo != 3) {
@@ -266,9 +261,6 @@ testQemuAgentGetFSInfo(const void *data)
         goto cleanup;
     }
 
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItem(test, "guest-get-fsinfo",
                                "{\"error\":"
                                "    {\"class\":\"CommandDisabled\","
@@ -280,7 +272,8 @@ testQemuAgentGetFSInfo(const void *data)
                                "}") < 0)
         goto cleanup;
 
-    if (qemuAgentGetFSInfo(qemuMonitorTestGetAgent(test), &info, def) != -1) {
+    if (qemuAgentGetFSInfo(qemuMonitorTestGetAgent(test), &info, def,
+                           VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK) != -1) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        "agent get-fsinfo command should have failed");
         goto cleanup;
@@ -318,16 +311,10 @@ testQemuAgentSuspend(const void *data)
                                "{ \"return\" : {} }") < 0)
         goto cleanup;
 
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItem(test, "guest-suspend-disk",
                                "{ \"return\" : {} }") < 0)
         goto cleanup;
 
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItem(test, "guest-suspend-hybrid",
                                "{ \"return\" : {} }") < 0)
         goto cleanup;
@@ -561,9 +548,6 @@ testQemuAgentCPU(const void *data)
     if (qemuAgentUpdateCPUInfo(2, cpuinfo, nvcpus) < 0)
         goto cleanup;
 
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItemParams(test, "guest-set-vcpus",
                                      "{ \"return\" : 1 }",
                                      "vcpus", testQemuAgentCPUArguments1,
@@ -574,18 +558,12 @@ testQemuAgentCPU(const void *data)
         goto cleanup;
 
     /* try to hotplug two, second one will fail*/
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItemParams(test, "guest-set-vcpus",
                                      "{ \"return\" : 1 }",
                                      "vcpus", testQemuAgentCPUArguments2,
                                      NULL) < 0)
         goto cleanup;
 
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItemParams(test, "guest-set-vcpus",
                                      "{ \"error\" : \"random error\" }",
                                      "vcpus", testQemuAgentCPUArguments3,
@@ -806,7 +784,8 @@ testQemuAgentGetInterfaces(const void *data)
         goto cleanup;
 
     if ((ifaces_count = qemuAgentGetInterfaces(qemuMonitorTestGetAgent(test),
-                                               &ifaces)) < 0)
+                                               &ifaces,
+                                               VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK)) < 0)
         goto cleanup;
 
     if (ifaces_count != 4) {
@@ -887,6 +866,19 @@ testQemuAgentGetInterfaces(const void *data)
         goto cleanup;
     }
 
+    for (i = 0; i < ifaces_count; i++)
+        virDomainInterfaceFree(ifaces[i]);
+    VIR_FREE(ifaces);
+
+    /* no command is queued, the reply has to come from the cache */
+    if ((ifaces_count = qemuAgentGetInterfaces(qemuMonitorTestGetAgent(test),
+                                               &ifaces,
+                                               VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK)) != 4) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "expected 4 cached interfaces, got %d", ifaces_count);
+        goto cleanup;
+    }
+
     ret = 0;
 
  cleanup:
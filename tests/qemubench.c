@@ -0,0 +1,275 @@
+/*
+ * qemubench.c: benchmarks of the QEMU driver's XML and QMP processing
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+
+#ifdef WITH_QEMU
+
+# include <dirent.h>
+
+# include "testutilsqemu.h"
+# include "qemumonitortestutils.h"
+# include "virerror.h"
+# include "virlog.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("tests.qemubench");
+
+# define BENCH_BLOCKSTATS_DISKS 40
+
+static virQEMUDriver driver;
+
+struct benchDomains {
+    char **xmls;
+    size_t nxmls;
+    virDomainDefPtr *defs;
+    size_t ndefs;
+};
+
+struct benchMonitor {
+    qemuMonitorTestPtr test;
+    const char *reply;
+};
+
+
+static void
+benchDomainsClear(struct benchDomains *domains)
+{
+    size_t i;
+
+    for (i = 0; i < domains->nxmls; i++)
+        VIR_FREE(domains->xmls[i]);
+    VIR_FREE(domains->xmls);
+    for (i = 0; i < domains->ndefs; i++)
+        virDomainDefFree(domains->defs[i]);
+    VIR_FREE(domains->defs);
+}
+
+
+/* Loads all qemuxml2argvdata inputs the driver accepts, the ones meant
+ * to fail parsing are left out */
+static int
+benchDomainsLoad(struct benchDomains *domains)
+{
+    const char *dirname = abs_srcdir "/qemuxml2argvdata";
+    DIR *dir = NULL;
+    struct dirent *ent;
+    char *path = NULL;
+    char *xml = NULL;
+    virDomainDefPtr def = NULL;
+    int rc;
+    int ret = -1;
+
+    if (virDirOpen(&dir, dirname) < 0)
+        return -1;
+
+    while ((rc = virDirRead(dir, &ent, dirname)) > 0) {
+        if (!STRPREFIX(ent->d_name, "qemuxml2argv-") ||
+            !virFileHasSuffix(ent->d_name, ".xml"))
+            continue;
+
+        if (virAsprintf(&path, "%s/%s", dirname, ent->d_name) < 0 ||
+            virTestLoadFile(path, &xml) < 0)
+            goto cleanup;
+        VIR_FREE(path);
+
+        if (!(def = virDomainDefParseString(xml, driver.caps, driver.xmlopt,
+                                            NULL,
+                                            VIR_DOMAIN_DEF_PARSE_INACTIVE))) {
+            virResetLastError();
+            VIR_FREE(xml);
+            continue;
+        }
+
+        if (VIR_APPEND_ELEMENT(domains->xmls, domains->nxmls, xml) < 0 ||
+            VIR_APPEND_ELEMENT(domains->defs, domains->ndefs, def) < 0)
+            goto cleanup;
+    }
+
+    if (rc < 0)
+        goto cleanup;
+
+    VIR_TEST_DEBUG("loaded %zu domain definitions\n", domains->ndefs);
+    ret = 0;
+
+ cleanup:
+    virDomainDefFree(def);
+    VIR_FREE(path);
+    VIR_FREE(xml);
+    VIR_DIR_CLOSE(dir);
+    return ret;
+}
+
+
+static int
+benchDomainDefParse(const void *data)
+{
+    const struct benchDomains *domains = data;
+    virDomainDefPtr def;
+    size_t i;
+
+    for (i = 0; i < domains->nxmls; i++) {
+        if (!(def = virDomainDefParseString(domains->xmls[i],
+                                            driver.caps, driver.xmlopt, NULL,
+                                            VIR_DOMAIN_DEF_PARSE_INACTIVE)))
+            return -1;
+        virDomainDefFree(def);
+    }
+
+    return 0;
+}
+
+
+static int
+benchDomainDefFormat(const void *data)
+{
+    const struct benchDomains *domains = data;
+    char *xml;
+    size_t i;
+
+    for (i = 0; i < domains->ndefs; i++) {
+        if (!(xml = virDomainDefFormat(domains->defs[i], driver.caps,
+                                       VIR_DOMAIN_DEF_FORMAT_SECURE)))
+            return -1;
+        VIR_FREE(xml);
+    }
+
+    return 0;
+}
+
+
+static char *
+benchBlockStatsReply(void)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+
+    virBufferAddLit(&buf, "{\"return\": [");
+    for (i = 0; i < BENCH_BLOCKSTATS_DISKS; i++) {
+        virBufferAsprintf(&buf,
+                          "%s{\"device\": \"drive-virtio-disk%zu\","
+                          " \"stats\": {\"rd_bytes\": 104857600,"
+                          " \"wr_bytes\": 52428800, \"rd_operations\": 2048,"
+                          " \"wr_operations\": 1024, \"flush_operations\": 12,"
+                          " \"rd_total_time_ns\": 81234567,"
+                          " \"wr_total_time_ns\": 91234567,"
+                          " \"flush_total_time_ns\": 1234567,"
+                          " \"wr_highest_offset\": 1073741824}}",
+                          i ? ", " : "", i);
+    }
+    virBufferAddLit(&buf, "], \"id\": \"libvirt-42\"}");
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+/* A whole command round trip over the monitor socket, from formatting
+ * the command to the parsed stats */
+static int
+benchMonitorBlockStats(const void *data)
+{
+    const struct benchMonitor *monitor = data;
+    virHashTablePtr stats = NULL;
+
+    if (qemuMonitorTestAddItem(monitor->test, "query-blockstats",
+                               monitor->reply) < 0)
+        return -1;
+
+    if (qemuMonitorGetAllBlockStatsInfo(qemuMonitorTestGetMonitor(monitor->test),
+                                        &stats, false) < 0)
+        return -1;
+
+    if (virHashSize(stats) != BENCH_BLOCKSTATS_DISKS) {
+        virHashFree(stats);
+        return -1;
+    }
+
+    virHashFree(stats);
+    return 0;
+}
+
+
+static int
+mymain(void)
+{
+    struct benchDomains domains = { 0 };
+    struct benchMonitor monitor = { 0 };
+    virQEMUCapsPtr qemuCaps = NULL;
+    char *reply = NULL;
+    int ret = -1;
+
+    if (qemuTestDriverInit(&driver) < 0)
+        return EXIT_FAILURE;
+
+    if (!(qemuCaps = virQEMUCapsNew()))
+        goto cleanup;
+    virQEMUCapsSetList(qemuCaps, QEMU_CAPS_LAST);
+
+    if (qemuTestCapsCacheInsert(driver.qemuCapsCache, "qemubench",
+                                qemuCaps) < 0 ||
+        benchDomainsLoad(&domains) < 0)
+        goto cleanup;
+
+    if (!(reply = benchBlockStatsReply()) ||
+        !(monitor.test = qemuMonitorTestNewSimple(true, driver.xmlopt)))
+        goto cleanup;
+    monitor.reply = reply;
+
+    ret = 0;
+
+    if (virTestBench("virDomainDefParse qemuxml2argvdata",
+                     benchDomainDefParse, &domains) < 0)
+        ret = -1;
+
+    if (virTestBench("virDomainDefFormat qemuxml2argvdata",
+                     benchDomainDefFormat, &domains) < 0)
+        ret = -1;
+
+    if (virTestBench("QMP query-blockstats",
+                     benchMonitorBlockStats, &monitor) < 0)
+        ret = -1;
+
+ cleanup:
+    qemuMonitorTestFree(monitor.test);
+    VIR_FREE(reply);
+    benchDomainsClear(&domains);
+    virObjectUnref(qemuCaps);
+    qemuTestDriverFree(&driver);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN_PRELOAD(mymain, abs_builddir "/.libs/qemuxml2xmlmock.so")
+
+#else
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WITH_QEMU */
@@ -126,6 +126,108 @@ testQemuCapsCopy(const void *opaque)
 }
 
 
+static int
+testQemuCapsDomCaps(const void *opaque)
+{
+    int ret = -1;
+    const testQemuData *data = opaque;
+    char *capsFile = NULL;
+    char *tmpdir = NULL;
+    char *tmpfile = NULL;
+    virCapsPtr caps = NULL;
+    virQEMUCapsPtr orig = NULL;
+    virQEMUCapsPtr loaded = NULL;
+    char *domCaps = NULL;
+    char *domCapsAgain = NULL;
+    char *domCapsLoaded = NULL;
+    char *expect = NULL;
+    char *actual = NULL;
+    const char *machine;
+    virArch arch = virArchFromString(data->archName);
+    time_t selfctime;
+    unsigned long selfvers;
+
+    if (virAsprintf(&capsFile, "%s/qemucapabilitiesdata/%s.%s.xml",
+                    abs_srcdir, data->base, data->archName) < 0 ||
+        VIR_STRDUP(tmpdir, abs_builddir "/qemucapabilitiesdata-XXXXXX") < 0)
+        goto cleanup;
+
+    if (!mkdtemp(tmpdir)) {
+        VIR_TEST_DEBUG("Cannot create temporary directory");
+        VIR_FREE(tmpdir);
+        goto cleanup;
+    }
+
+    if (virAsprintf(&tmpfile, "%s/caps.xml", tmpdir) < 0)
+        goto cleanup;
+
+    if (!(caps = virCapabilitiesNew(arch, false, false)))
+        goto cleanup;
+
+    if (!(orig = qemuTestParseCapabilities(caps, capsFile)))
+        goto cleanup;
+
+    machine = virQEMUCapsGetDefaultMachine(orig);
+
+#define GET_DOM_CAPS(qemuCaps) \
+    virQEMUCapsGetDomainCapsXML(caps, NULL, qemuCaps, "/usr/bin/qemu", \
+                                machine, arch, VIR_DOMAIN_VIRT_QEMU, \
+                                NULL, 0)
+
+    if (!(domCaps = GET_DOM_CAPS(orig)) ||
+        !(domCapsAgain = GET_DOM_CAPS(orig)))
+        goto cleanup;
+
+    if (virTestCompareToString(domCaps, domCapsAgain) < 0)
+        goto cleanup;
+
+    /* the domain capabilities are stored with the QEMU capabilities */
+    if (!(expect = virQEMUCapsFormatCache(orig, 0, 0)))
+        goto cleanup;
+
+    if (!strstr(expect, "<domCaps key=")) {
+        VIR_TEST_DEBUG("Domain capabilities were not stored");
+        goto cleanup;
+    }
+
+    if (virFileWriteStr(tmpfile, expect, 0600) < 0)
+        goto cleanup;
+
+    if (!(loaded = virQEMUCapsNew()) ||
+        virQEMUCapsLoadCache(caps, loaded, tmpfile,
+                             &selfctime, &selfvers) < 0)
+        goto cleanup;
+
+    if (!(actual = virQEMUCapsFormatCache(loaded, 0, 0)) ||
+        virTestCompareToString(expect, actual) < 0)
+        goto cleanup;
+
+    if (!(domCapsLoaded = GET_DOM_CAPS(loaded)) ||
+        virTestCompareToString(domCaps, domCapsLoaded) < 0)
+        goto cleanup;
+
+#undef GET_DOM_CAPS
+
+    ret = 0;
+
+ cleanup:
+    if (tmpdir)
+        virFileDeleteTree(tmpdir);
+    VIR_FREE(capsFile);
+    VIR_FREE(tmpdir);
+    VIR_FREE(tmpfile);
+    virObjectUnref(caps);
+    virObjectUnref(orig);
+    virObjectUnref(loaded);
+    VIR_FREE(domCaps);
+    VIR_FREE(domCapsAgain);
+    VIR_FREE(domCapsLoaded);
+    VIR_FREE(expect);
+    VIR_FREE(actual);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -176,6 +278,12 @@ mymain(void)
     DO_TEST("s390x", "caps_2.7.0");
     DO_TEST("s390x", "caps_2.8.0");
 
+    data.archName = "x86_64";
+    data.base = "caps_2.9.0";
+    if (virTestRun("domain capabilities caps_2.9.0(x86_64)",
+                   testQemuCapsDomCaps, &data) < 0)
+        ret = -1;
+
     /*
      * Run "tests/qemucapsprobe /path/to/qemu/binary >foo.replies"
      * to generate updated or new *.replies data files.
@@ -45,9 +45,12 @@ int
 qemuMonitorSend(qemuMonitorPtr mon,
                 qemuMonitorMessagePtr msg)
 {
+    qemuMonitorMessagePtr tmp;
+
     REAL_SYM(realQemuMonitorSend);
 
-    fprintf(stderr, "%s", msg->txBuffer);
+    for (tmp = msg; tmp; tmp = tmp->next)
+        fprintf(stderr, "%s", tmp->txBuffer);
 
     return realQemuMonitorSend(mon, msg);
 }
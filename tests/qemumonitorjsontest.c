@@ -229,6 +229,88 @@ testQemuMonitorJSONGetStatus(const void *data)
     return ret;
 }
 
+static int
+testQemuMonitorJSONCommandStats(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    qemuMonitorCommandStatsPtr stats = NULL;
+    size_t nstats = 0;
+    const char *status = "{\"return\": {\"status\": \"running\", "
+                         "\"singlestep\": false, \"running\": true}}";
+    const char *reset = "{\"return\": {}}";
+    bool running;
+    size_t i;
+    int ret = -1;
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-status", status) < 0 ||
+        qemuMonitorTestAddItem(test, "query-status", status) < 0 ||
+        qemuMonitorTestAddItem(test, "system_reset", reset) < 0)
+        goto cleanup;
+
+    if (qemuMonitorGetStatus(qemuMonitorTestGetMonitor(test),
+                             &running, NULL) < 0 ||
+        qemuMonitorGetStatus(qemuMonitorTestGetMonitor(test),
+                             &running, NULL) < 0 ||
+        qemuMonitorSystemReset(qemuMonitorTestGetMonitor(test)) < 0)
+        goto cleanup;
+
+    if (qemuMonitorGetCommandStats(qemuMonitorTestGetMonitor(test),
+                                   &stats, &nstats) < 0)
+        goto cleanup;
+
+    if (nstats != 2) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "expected stats of 2 commands, got %zu", nstats);
+        goto cleanup;
+    }
+
+    for (i = 0; i < nstats; i++) {
+        unsigned long long count = 1;
+        size_t bytes = strlen(reset);
+
+        if (STREQ(stats[i].name, "query-status")) {
+            count = 2;
+            bytes = strlen(status);
+        } else if (STRNEQ(stats[i].name, "system_reset")) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           "unexpected command '%s'", stats[i].name);
+            goto cleanup;
+        }
+
+        if (stats[i].count != count ||
+            stats[i].replyBytes != count * bytes ||
+            stats[i].replyMax != bytes) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           "command '%s': count=%llu reply.bytes=%llu "
+                           "reply.max=%llu", stats[i].name, stats[i].count,
+                           stats[i].replyBytes, stats[i].replyMax);
+            goto cleanup;
+        }
+
+        if (stats[i].timeP50 > stats[i].timeP99 ||
+            stats[i].timeP99 > stats[i].timeMax ||
+            stats[i].timeMax > stats[i].timeTotal) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           "command '%s': inconsistent times p50=%llu "
+                           "p99=%llu max=%llu total=%llu", stats[i].name,
+                           stats[i].timeP50, stats[i].timeP99,
+                           stats[i].timeMax, stats[i].timeTotal);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    qemuMonitorCommandStatsFree(stats, nstats);
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
 static int
 testQemuMonitorJSONGetVersion(const void *data)
 {
@@ -1319,7 +1401,7 @@ GEN_TEST_FUNC(qemuMonitorJSONSetMigrationDowntime, 1)
 GEN_TEST_FUNC(qemuMonitorJSONMigrate, QEMU_MONITOR_MIGRATE_BACKGROUND |
               QEMU_MONITOR_MIGRATE_NON_SHARED_DISK |
               QEMU_MONITOR_MIGRATE_NON_SHARED_INC, "tcp:localhost:12345")
-GEN_TEST_FUNC(qemuMonitorJSONDump, "dummy_protocol", "dummy_memory_dump_format")
+GEN_TEST_FUNC(qemuMonitorJSONDump, "dummy_protocol", "dummy_memory_dump_format", true)
 GEN_TEST_FUNC(qemuMonitorJSONGraphicsRelocate, VIR_DOMAIN_GRAPHICS_TYPE_SPICE,
               "localhost", 12345, 12346, NULL)
 GEN_TEST_FUNC(qemuMonitorJSONAddNetdev, "some_dummy_netdevstr")
@@ -1334,7 +1416,10 @@ GEN_TEST_FUNC(qemuMonitorJSONDrivePivot, "vdb")
 GEN_TEST_FUNC(qemuMonitorJSONScreendump, "/foo/bar")
 GEN_TEST_FUNC(qemuMonitorJSONOpenGraphics, "spice", "spicefd", false)
 GEN_TEST_FUNC(qemuMonitorJSONNBDServerStart, "localhost", 12345)
-GEN_TEST_FUNC(qemuMonitorJSONNBDServerAdd, "vda", true)
+GEN_TEST_FUNC(qemuMonitorJSONNBDServerAdd, "vda", NULL, true, NULL)
+GEN_TEST_FUNC(qemuMonitorJSONBitmapRemove, "#block123", "checkpoint0")
+GEN_TEST_FUNC(qemuMonitorJSONBlockdevDel, "backup-vda")
+GEN_TEST_FUNC(qemuMonitorJSONCalcDirtyRate, 1)
 GEN_TEST_FUNC(qemuMonitorJSONDetachCharDev, "serial1")
 
 static bool
@@ -1408,7 +1493,7 @@ testQemuMonitorJSONqemuMonitorJSONQueryCPUs(const void *data)
         goto cleanup;
 
     if (qemuMonitorJSONQueryCPUs(qemuMonitorTestGetMonitor(test),
-                                 &cpudata, &ncpudata, true) < 0)
+                                 &cpudata, &ncpudata, true, false) < 0)
         goto cleanup;
 
     if (ncpudata != 4) {
@@ -1434,6 +1519,217 @@ testQemuMonitorJSONqemuMonitorJSONQueryCPUs(const void *data)
     return ret;
 }
 
+static int
+testQemuMonitorJSONqemuMonitorGetStats(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    virDomainMemballoonDef balloon;
+    qemuMonitorStats stats;
+    int ret = -1;
+
+    memset(&stats, 0, sizeof(stats));
+    memset(&balloon, 0, sizeof(balloon));
+    balloon.model = VIR_DOMAIN_MEMBALLOON_MODEL_VIRTIO;
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-balloon",
+                               "{"
+                               "    \"return\": {"
+                               "        \"actual\": 4294967296"
+                               "    }"
+                               "}") < 0 ||
+        qemuMonitorTestAddItem(test, "query-cpus-fast",
+                               "{"
+                               "    \"return\": ["
+                               "        {"
+                               "            \"arch\": \"s390\","
+                               "            \"cpu-index\": 0,"
+                               "            \"qom-path\": \"/machine/unattached/device[0]\","
+                               "            \"thread-id\": 17622,"
+                               "            \"cpu-state\": \"operating\""
+                               "        },"
+                               "        {"
+                               "            \"arch\": \"s390\","
+                               "            \"cpu-index\": 1,"
+                               "            \"qom-path\": \"/machine/unattached/device[1]\","
+                               "            \"thread-id\": 17624,"
+                               "            \"cpu-state\": \"stopped\""
+                               "        }"
+                               "    ]"
+                               "}") < 0)
+        goto cleanup;
+
+    if (qemuMonitorGetStats(qemuMonitorTestGetMonitor(test),
+                            QEMU_MONITOR_STATS_BALLOON |
+                            QEMU_MONITOR_STATS_VCPU_HALTED |
+                            QEMU_MONITOR_STATS_VCPU_FAST,
+                            &balloon, 2, &stats) < 0)
+        goto cleanup;
+
+    if (stats.nmemstats != 1 ||
+        stats.memstats[0].tag != VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON ||
+        stats.memstats[0].val != 4194304) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "unexpected balloon stats, nmemstats=%d",
+                       stats.nmemstats);
+        goto cleanup;
+    }
+
+    if (!stats.halted ||
+        virBitmapIsBitSet(stats.halted, 0) ||
+        !virBitmapIsBitSet(stats.halted, 1)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "unexpected halted vcpu map");
+        goto cleanup;
+    }
+
+    if (stats.blockstats || stats.nodedata) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "block stats were not requested");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    qemuMonitorStatsClear(&stats);
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
+static int
+testQemuMonitorJSONqemuMonitorGetProbeInfo(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    const char *types[] = { "virtio-blk-pci", "no-such-device" };
+    qemuMonitorProbeInfo info;
+    int ret = -1;
+
+    memset(&info, 0, sizeof(info));
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-events",
+                               "{"
+                               "    \"return\": ["
+                               "        { \"name\": \"SHUTDOWN\" },"
+                               "        { \"name\": \"RESET\" }"
+                               "    ]"
+                               "}") < 0 ||
+        qemuMonitorTestAddItem(test, "qom-list-types",
+                               "{"
+                               "    \"return\": ["
+                               "        { \"name\": \"virtio-blk-pci\" }"
+                               "    ]"
+                               "}") < 0 ||
+        qemuMonitorTestAddItem(test, "device-list-properties",
+                               "{"
+                               "    \"return\": ["
+                               "        { \"name\": \"scsi\","
+                               "          \"type\": \"bool\" },"
+                               "        { \"name\": \"iothread\","
+                               "          \"type\": \"link<iothread>\" }"
+                               "    ]"
+                               "}") < 0 ||
+        qemuMonitorTestAddItem(test, "device-list-properties",
+                               "{"
+                               "    \"error\": {"
+                               "        \"class\": \"DeviceNotFound\","
+                               "        \"desc\": \"Device 'no-such-device' not found\""
+                               "    }"
+                               "}") < 0)
+        goto cleanup;
+
+    if (qemuMonitorGetProbeInfo(qemuMonitorTestGetMonitor(test),
+                                types, ARRAY_CARDINALITY(types), &info) < 0)
+        goto cleanup;
+
+    if (info.nevents != 2 ||
+        STRNEQ(info.events[0], "SHUTDOWN") ||
+        STRNEQ(info.events[1], "RESET") ||
+        info.nobjectTypes != 1 ||
+        STRNEQ(info.objectTypes[0], "virtio-blk-pci")) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "unexpected events or object types");
+        goto cleanup;
+    }
+
+    if (info.ntypes != 2 ||
+        info.nprops[0] != 2 ||
+        STRNEQ(info.props[0][0], "scsi") ||
+        STRNEQ(info.props[0][1], "iothread") ||
+        info.nprops[1] != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "unexpected device properties");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    qemuMonitorProbeInfoClear(&info);
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
+static int
+testQemuMonitorJSONqemuMonitorAddDevicesArgs(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    virJSONValuePtr args[3] = { NULL, NULL, NULL };
+    bool added[3];
+    size_t i;
+    int ret = -1;
+
+    if (!test)
+        return -1;
+
+    for (i = 0; i < ARRAY_CARDINALITY(args); i++) {
+        if (virJSONValueObjectCreate(&args[i],
+                                     "s:driver", "qemu64-x86_64-cpu",
+                                     "i:socket-id", (int) i, NULL) < 0)
+            goto cleanup;
+    }
+
+    if (qemuMonitorTestAddItem(test, "device_add", "{\"return\": {}}") < 0 ||
+        qemuMonitorTestAddItem(test, "device_add",
+                               "{"
+                               "    \"error\": {"
+                               "        \"class\": \"GenericError\","
+                               "        \"desc\": \"CPU is already present\""
+                               "    }"
+                               "}") < 0 ||
+        qemuMonitorTestAddItem(test, "device_add", "{\"return\": {}}") < 0)
+        goto cleanup;
+
+    if (qemuMonitorAddDevicesArgs(qemuMonitorTestGetMonitor(test),
+                                  args, ARRAY_CARDINALITY(args), added) == 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "failure of the second device wasn't reported");
+        goto cleanup;
+    }
+
+    if (!added[0] || added[1] || !added[2]) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "unexpected state of the added devices");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < ARRAY_CARDINALITY(args); i++)
+        virJSONValueFree(args[i]);
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
 static int
 testQemuMonitorJSONqemuMonitorJSONGetBalloonInfo(const void *data)
 {
@@ -1772,6 +2068,102 @@ testQemuMonitorJSONqemuMonitorJSONGetBlockStatsInfo(const void *data)
     return ret;
 }
 
+static int
+testQemuMonitorJSONqemuMonitorJSONGetAllBlockStatsData(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    virHashTablePtr blockstats = NULL;
+    virJSONValuePtr nodedata = NULL;
+    qemuBlockStatsPtr stats;
+    int ret = -1;
+
+    const char *blockstatsReply =
+        "{"
+        "    \"return\": ["
+        "        {"
+        "            \"device\": \"drive-virtio-disk0\","
+        "            \"stats\": {"
+        "                \"flush_total_time_ns\": 0,"
+        "                \"wr_highest_offset\": 5256018944,"
+        "                \"wr_total_time_ns\": 530699221,"
+        "                \"wr_bytes\": 2845696,"
+        "                \"rd_total_time_ns\": 640616474,"
+        "                \"flush_operations\": 0,"
+        "                \"wr_operations\": 174,"
+        "                \"rd_bytes\": 28505088,"
+        "                \"rd_operations\": 1279"
+        "            }"
+        "        }"
+        "    ]"
+        "}";
+    const char *blockReply =
+        "{"
+        "    \"return\": ["
+        "        {"
+        "            \"device\": \"drive-virtio-disk0\","
+        "            \"inserted\": {"
+        "                \"image\": {"
+        "                    \"virtual-size\": 10737418240,"
+        "                    \"actual-size\": 5368709120"
+        "                }"
+        "            }"
+        "        }"
+        "    ]"
+        "}";
+    const char *nodesReply =
+        "{"
+        "    \"return\": ["
+        "        {"
+        "            \"node-name\": \"#block134\""
+        "        }"
+        "    ]"
+        "}";
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-blockstats", blockstatsReply) < 0 ||
+        qemuMonitorTestAddItem(test, "query-block", blockReply) < 0 ||
+        qemuMonitorTestAddItem(test, "query-named-block-nodes", nodesReply) < 0)
+        goto cleanup;
+
+    if (qemuMonitorGetAllBlockStatsData(qemuMonitorTestGetMonitor(test),
+                                        &blockstats, false, &nodedata) != 1)
+        goto cleanup;
+
+    if (!(stats = virHashLookup(blockstats, "virtio-disk0"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "block stats for device 'virtio-disk0' are missing");
+        goto cleanup;
+    }
+
+    if (stats->rd_req != 1279 || stats->wr_bytes != 2845696 ||
+        stats->capacity != 10737418240ULL ||
+        stats->physical != 5368709120ULL) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "unexpected stats rd_req=%lld wr_bytes=%lld "
+                       "capacity=%llu physical=%llu",
+                       stats->rd_req, stats->wr_bytes,
+                       stats->capacity, stats->physical);
+        goto cleanup;
+    }
+
+    if (virJSONValueArraySize(nodedata) != 1) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "unexpected named block nodes data");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    qemuMonitorTestFree(test);
+    virHashFree(blockstats);
+    virJSONValueFree(nodedata);
+    return ret;
+}
+
 static int
 testQemuMonitorJSONqemuMonitorJSONGetMigrationParams(const void *data)
 {
@@ -1889,6 +2281,68 @@ testQemuMonitorJSONqemuMonitorJSONGetMigrationCacheSize(const void *data)
     return ret;
 }
 
+static int
+testQemuMonitorJSONqemuMonitorJSONQueryDirtyRate(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    qemuMonitorDirtyRateInfo info;
+    int ret = -1;
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-dirty-rate",
+                               "{"
+                               "    \"return\": {"
+                               "        \"status\": \"measured\","
+                               "        \"start-time\": 1492600000,"
+                               "        \"calc-time\": 1,"
+                               "        \"dirty-rate\": 108"
+                               "    },"
+                               "    \"id\": \"libvirt-12\""
+                               "}") < 0 ||
+        qemuMonitorTestAddItem(test, "query-dirty-rate",
+                               "{"
+                               "    \"return\": {"
+                               "        \"status\": \"measuring\","
+                               "        \"start-time\": 1492600010,"
+                               "        \"calc-time\": 1"
+                               "    },"
+                               "    \"id\": \"libvirt-13\""
+                               "}") < 0)
+        goto cleanup;
+
+    if (qemuMonitorJSONQueryDirtyRate(qemuMonitorTestGetMonitor(test),
+                                      &info) < 0)
+        goto cleanup;
+
+    if (info.status != QEMU_MONITOR_DIRTY_RATE_STATUS_MEASURED ||
+        info.startTime != 1492600000 || info.calcTime != 1 ||
+        info.dirtyRate != 108) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "Invalid measured dirty rate");
+        goto cleanup;
+    }
+
+    if (qemuMonitorJSONQueryDirtyRate(qemuMonitorTestGetMonitor(test),
+                                      &info) < 0)
+        goto cleanup;
+
+    if (info.status != QEMU_MONITOR_DIRTY_RATE_STATUS_MEASURING ||
+        info.dirtyRate != -1) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "Invalid dirty rate while measuring");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
 static int
 testQemuMonitorJSONqemuMonitorJSONGetMigrationStats(const void *data)
 {
@@ -1938,6 +2392,49 @@ testQemuMonitorJSONqemuMonitorJSONGetMigrationStats(const void *data)
     return ret;
 }
 
+static int
+testQemuMonitorJSONqemuMonitorJSONQueryDump(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    int ret = -1;
+    qemuMonitorDumpStats stats, expectedStats;
+
+    if (!test)
+        return -1;
+
+    memset(&expectedStats, 0, sizeof(expectedStats));
+
+    expectedStats.status = QEMU_MONITOR_DUMP_STATUS_ACTIVE;
+    expectedStats.total = 1073741824;
+    expectedStats.completed = 536870912;
+
+    if (qemuMonitorTestAddItem(test, "query-dump",
+                               "{"
+                               "    \"return\": {"
+                               "        \"status\": \"active\","
+                               "        \"total\": 1073741824,"
+                               "        \"completed\": 536870912"
+                               "    },"
+                               "    \"id\": \"libvirt-13\""
+                               "}") < 0)
+        goto cleanup;
+
+    if (qemuMonitorJSONQueryDump(qemuMonitorTestGetMonitor(test), &stats) < 0)
+        goto cleanup;
+
+    if (memcmp(&stats, &expectedStats, sizeof(stats)) != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "Invalid dump status");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
 static int
 testHashEqualChardevInfo(const void *value1, const void *value2)
 {
@@ -2659,7 +3156,7 @@ testQemuMonitorCPUInfo(const void *opaque)
         goto cleanup;
 
     rc = qemuMonitorGetCPUInfo(qemuMonitorTestGetMonitor(test),
-                               &vcpus, data->maxvcpus, true);
+                               &vcpus, data->maxvcpus, true, false);
 
     if (rc < 0)
         goto cleanup;
@@ -2837,6 +3334,7 @@ mymain(void)
     } while (0)
 
     DO_TEST(GetStatus);
+    DO_TEST(CommandStats);
     DO_TEST(GetVersion);
     DO_TEST(GetMachines);
     DO_TEST(GetCPUDefinitions);
@@ -2889,13 +3387,22 @@ mymain(void)
     DO_TEST_GEN(qemuMonitorJSONOpenGraphics);
     DO_TEST_GEN(qemuMonitorJSONNBDServerStart);
     DO_TEST_GEN(qemuMonitorJSONNBDServerAdd);
+    DO_TEST_GEN(qemuMonitorJSONBitmapRemove);
+    DO_TEST_GEN(qemuMonitorJSONBlockdevDel);
+    DO_TEST_GEN(qemuMonitorJSONCalcDirtyRate);
     DO_TEST_GEN(qemuMonitorJSONDetachCharDev);
     DO_TEST(qemuMonitorJSONGetBalloonInfo);
     DO_TEST(qemuMonitorJSONGetBlockInfo);
     DO_TEST(qemuMonitorJSONGetBlockStatsInfo);
+    DO_TEST(qemuMonitorJSONGetAllBlockStatsData);
+    DO_TEST(qemuMonitorGetStats);
+    DO_TEST(qemuMonitorGetProbeInfo);
+    DO_TEST(qemuMonitorAddDevicesArgs);
     DO_TEST(qemuMonitorJSONGetMigrationCacheSize);
     DO_TEST(qemuMonitorJSONGetMigrationParams);
     DO_TEST(qemuMonitorJSONGetMigrationStats);
+    DO_TEST(qemuMonitorJSONQueryDirtyRate);
+    DO_TEST(qemuMonitorJSONQueryDump);
     DO_TEST(qemuMonitorJSONGetChardevInfo);
     DO_TEST(qemuMonitorJSONSetBlockIoThrottle);
     DO_TEST(qemuMonitorJSONGetTargetArch);
@@ -0,0 +1,201 @@
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "testutils.h"
+
+#ifdef WITH_QEMU
+
+# include "internal.h"
+# include "virstring.h"
+# include "conf/domain_conf.h"
+# include "qemu/qemu_processpriv.h"
+
+# include "testutilsqemu.h"
+
+# define VIR_FROM_THIS VIR_FROM_QEMU
+
+static virQEMUDriver driver;
+
+struct testInfo {
+    const char *name;
+    bool reattach;
+    bool conflicts;
+};
+
+
+static virDomainDefPtr
+testParseDomain(const char *name)
+{
+    virDomainDefPtr def;
+    char *path = NULL;
+
+    if (virAsprintf(&path, "%s/qemuprocessdata/qemuprocess-%s.xml",
+                    abs_srcdir, name) < 0)
+        return NULL;
+
+    def = virDomainDefParseFile(path, driver.caps, driver.xmlopt, NULL,
+                                VIR_DOMAIN_DEF_PARSE_INACTIVE);
+    VIR_FREE(path);
+    return def;
+}
+
+
+static qemuProcessStopCleanupPtr
+testNewCleanup(bool reattach,
+               char **xmlret)
+{
+    virDomainDefPtr def = NULL;
+    char *xml = NULL;
+    qemuProcessStopCleanupPtr cleanup = NULL;
+
+    if (!(def = testParseDomain("stopped")) ||
+        !(xml = qemuProcessStopCleanupFormat(&driver, def, "qemu-1-stopped",
+                                             reattach, 0x3)))
+        goto cleanup;
+
+    cleanup = qemuProcessStopCleanupParse(&driver, xml);
+
+ cleanup:
+    if (xmlret)
+        VIR_STEAL_PTR(*xmlret, xml);
+    VIR_FREE(xml);
+    virDomainDefFree(def);
+    return cleanup;
+}
+
+
+static int
+testCleanupRecord(const void *data)
+{
+    const struct testInfo *info = data;
+    qemuProcessStopCleanupPtr cleanup = NULL;
+    char *xml = NULL;
+    char *actual = NULL;
+    char *expected = NULL;
+    int ret = -1;
+
+    if (virAsprintf(&expected, "%s/qemuprocessdata/qemuprocess-%s.xml",
+                    abs_srcdir, info->name) < 0)
+        goto cleanup;
+
+    if (!(cleanup = testNewCleanup(info->reattach, &xml)))
+        goto cleanup;
+
+    if (virTestCompareToFile(xml, expected) < 0)
+        goto cleanup;
+
+    if (cleanup->flags != 0x3 ||
+        cleanup->reattach != info->reattach ||
+        STRNEQ_NULLABLE(cleanup->machineName, "qemu-1-stopped")) {
+        VIR_TEST_DEBUG("Cleanup record parsed as flags=%x reattach=%d "
+                       "machineName=%s\n", cleanup->flags, cleanup->reattach,
+                       NULLSTR(cleanup->machineName));
+        goto cleanup;
+    }
+
+    if (!(actual = qemuProcessStopCleanupFormat(&driver, cleanup->def,
+                                                cleanup->machineName,
+                                                cleanup->reattach,
+                                                cleanup->flags)))
+        goto cleanup;
+
+    if (STRNEQ(xml, actual)) {
+        virTestDifference(stderr, xml, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    qemuProcessStopCleanupFree(cleanup);
+    VIR_FREE(expected);
+    VIR_FREE(actual);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+static int
+testCleanupConflicts(const void *data)
+{
+    const struct testInfo *info = data;
+    qemuProcessStopCleanupPtr cleanup = NULL;
+    virDomainDefPtr def = NULL;
+    bool conflicts;
+    int ret = -1;
+
+    if (!(cleanup = testNewCleanup(info->reattach, NULL)) ||
+        !(def = testParseDomain(info->name)))
+        goto cleanup;
+
+    conflicts = qemuProcessStopCleanupConflicts(cleanup, def);
+    if (conflicts != info->conflicts) {
+        VIR_TEST_DEBUG("Expected %s to %sconflict with the cleanup\n",
+                       info->name, info->conflicts ? "" : "not ");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    qemuProcessStopCleanupFree(cleanup);
+    virDomainDefFree(def);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (qemuTestDriverInit(&driver) < 0)
+        return EXIT_FAILURE;
+
+# define DO_TEST_RECORD(name, reattach) \
+    do { \
+        static struct testInfo info = { name, reattach, false }; \
+        if (virTestRun("Cleanup record " name, \
+                       testCleanupRecord, &info) < 0) \
+            ret = -1; \
+    } while (0)
+
+# define DO_TEST_CONFLICTS(name, reattach, conflicts) \
+    do { \
+        static struct testInfo info = { name, reattach, conflicts }; \
+        if (virTestRun("Cleanup conflicts " name " reattach=" #reattach, \
+                       testCleanupConflicts, &info) < 0) \
+            ret = -1; \
+    } while (0)
+
+    DO_TEST_RECORD("cleanup-reattach", true);
+    DO_TEST_RECORD("cleanup-noreattach", false);
+
+    DO_TEST_CONFLICTS("same-uuid", true, true);
+    DO_TEST_CONFLICTS("same-uuid", false, true);
+    DO_TEST_CONFLICTS("same-disk", true, true);
+    DO_TEST_CONFLICTS("same-disk", false, true);
+    /* Host devices left attached to the host driver are not given
+     * back, so they cannot be taken away from the new domain */
+    DO_TEST_CONFLICTS("same-hostdev", true, true);
+    DO_TEST_CONFLICTS("same-hostdev", false, false);
+    DO_TEST_CONFLICTS("unrelated", true, false);
+    DO_TEST_CONFLICTS("unrelated", false, false);
+
+    qemuTestDriverFree(&driver);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
+
+#else
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WITH_QEMU */
@@ -97,7 +97,8 @@ static const char testStatusXMLPrefixFooter[] =
 "  </devices>\n"
 "  <numad nodeset='0-2'/>\n"
 "  <libDir path='/tmp'/>\n"
-"  <channelTargetDir path='/tmp/channel'/>\n";
+"  <channelTargetDir path='/tmp/channel'/>\n"
+"  <journal generation='3'/>\n";
 
 static const char testStatusXMLSuffix[] =
 "</domstatus>\n";
@@ -419,6 +420,7 @@ mymain(void)
     DO_TEST("hugepages-pages", NONE);
     DO_TEST("hugepages-pages2", NONE);
     DO_TEST("hugepages-pages3", NONE);
+    DO_TEST("hugepages-prealloc-threads", NONE);
     DO_TEST("hugepages-shared", NONE);
     DO_TEST("nosharepages", NONE);
     DO_TEST("restore-v2", NONE);
@@ -583,6 +585,7 @@ mymain(void)
     DO_TEST("iothreads-ids-partial", NONE);
     DO_TEST("cputune-iothreads", NONE);
     DO_TEST("iothreads-disk", NONE);
+    DO_TEST("iothreads-auto", NONE);
     DO_TEST("iothreads-disk-virtio-ccw",
             QEMU_CAPS_VIRTIO_CCW, QEMU_CAPS_VIRTIO_S390);
     DO_TEST("iothreads-virtio-scsi-pci",
@@ -116,6 +116,8 @@ mymain(void)
     DO_TEST("pool-gluster", "vol-gluster-dir-neg-uid");
     DO_TEST_FULL("pool-dir", "vol-qcow2-nocapacity",
                  VIR_VOL_XML_PARSE_NO_CAPACITY);
+    DO_TEST_FULL("pool-dir", "vol-file-state",
+                 VIR_VOL_XML_PARSE_STATE);
 
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
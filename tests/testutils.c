@@ -34,6 +34,7 @@
 #include <string.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <time.h>
 #include "testutils.h"
 #include "internal.h"
 #include "viralloc.h"
@@ -47,6 +48,7 @@
 #include "dirname.h"
 #include "virprocess.h"
 #include "virstring.h"
+#include "virperf.h"
 
 #ifdef TEST_OOM
 # ifdef TEST_OOM_TRACE
@@ -289,6 +291,178 @@ virTestRun(const char *title,
     return ret;
 }
 
+
+/* A benchmark repeats its body until it ran for at least this long */
+#define VIR_TEST_BENCH_MIN_TIME (200 * 1000 * 1000ULL) /* ns */
+
+static const virPerfEventType virTestBenchEvents[] = {
+    VIR_PERF_EVENT_CPU_CYCLES,
+    VIR_PERF_EVENT_INSTRUCTIONS,
+    VIR_PERF_EVENT_CACHE_MISSES,
+    VIR_PERF_EVENT_BRANCH_MISSES,
+};
+
+struct virTestBenchInfo {
+    const char *title;
+    int (*body)(const void *data);
+    const void *data;
+};
+
+static unsigned long long
+virTestBenchNow(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static int
+virTestBenchReport(const struct virTestBenchInfo *info,
+                   virPerfPtr perf,
+                   unsigned long long iterations,
+                   unsigned long long elapsed,
+                   const uint64_t *before,
+                   const uint64_t *after)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    const char *path = getenv("VIR_TEST_BENCH_OUTPUT");
+    FILE *out = stdout;
+    char *line = NULL;
+    size_t i;
+    int ret = -1;
+
+    virBufferAsprintf(&buf, "{\"program\": \"%s\", \"name\": \"%s\", "
+                      "\"iterations\": %llu, \"time_ns\": %llu",
+                      progname, info->title, iterations, elapsed);
+    for (i = 0; i < ARRAY_CARDINALITY(virTestBenchEvents); i++) {
+        virPerfEventType type = virTestBenchEvents[i];
+
+        if (perf && virPerfEventIsEnabled(perf, type))
+            virBufferAsprintf(&buf, ", \"%s\": %llu",
+                              virPerfEventTypeToString(type),
+                              (unsigned long long) (after[type] - before[type]));
+    }
+    virBufferAddLit(&buf, "}\n");
+
+    if (virBufferCheckError(&buf) < 0)
+        return -1;
+    line = virBufferContentAndReset(&buf);
+
+    if (path && !(out = fopen(path, "a"))) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        goto cleanup;
+    }
+
+    if (fputs(line, out) == EOF) {
+        fprintf(stderr, "Cannot write benchmark results\n");
+        goto cleanup;
+    }
+
+    VIR_TEST_DEBUG("%s: %llu iterations, %llu ns each\n",
+                   info->title, iterations, elapsed / iterations);
+
+    ret = 0;
+
+ cleanup:
+    if (out != stdout)
+        VIR_FORCE_FCLOSE(out);
+    VIR_FREE(line);
+    return ret;
+}
+
+
+static int
+virTestBenchBody(const void *opaque)
+{
+    const struct virTestBenchInfo *info = opaque;
+    uint64_t before[VIR_PERF_EVENT_LAST] = { 0 };
+    uint64_t after[VIR_PERF_EVENT_LAST] = { 0 };
+    unsigned long long iterations;
+    unsigned long long elapsed;
+    unsigned long long start;
+    unsigned long long i;
+    bool calibrate;
+    virPerfPtr perf;
+    int ret = -1;
+
+    /* The first run warms up caches and makes sure the body works */
+    if (info->body(info->data) < 0)
+        return -1;
+
+    /* Hardware counters are optional, perf_event_paranoid or a virtual
+     * machine can easily deny them */
+    if ((perf = virPerfNew())) {
+        for (i = 0; i < ARRAY_CARDINALITY(virTestBenchEvents); i++) {
+            if (virPerfEventEnable(perf, virTestBenchEvents[i], 0) < 0) {
+                VIR_TEST_DEBUG("perf event %s unavailable\n",
+                               virPerfEventTypeToString(virTestBenchEvents[i]));
+                virResetLastError();
+            }
+        }
+    }
+
+    iterations = virTestGetFlag("VIR_TEST_BENCH_ITERATIONS");
+    if ((calibrate = iterations == 0))
+        iterations = 1;
+
+    /* Double the number of iterations until the loop takes long enough
+     * to be measured reliably, the last round is the one reported */
+    while (true) {
+        if (perf && virPerfReadEvents(perf, before) < 0)
+            goto cleanup;
+
+        start = virTestBenchNow();
+        for (i = 0; i < iterations; i++) {
+            if (info->body(info->data) < 0)
+                goto cleanup;
+        }
+        elapsed = virTestBenchNow() - start;
+
+        if (perf && virPerfReadEvents(perf, after) < 0)
+            goto cleanup;
+
+        if (!calibrate || elapsed >= VIR_TEST_BENCH_MIN_TIME)
+            break;
+        iterations *= 2;
+    }
+
+    ret = virTestBenchReport(info, perf, iterations, elapsed, before, after);
+
+ cleanup:
+    virPerfFree(perf);
+    return ret;
+}
+
+
+/**
+ * virTestBench:
+ * @title: name of the benchmark
+ * @body: runs one iteration of the benchmark, returns -1 on failure
+ * @data: opaque data passed to @body
+ *
+ * Runs @body repeatedly in a test until it took at least 200ms, or
+ * exactly VIR_TEST_BENCH_ITERATIONS times if set. The result is
+ * written as a line of JSON with the number of iterations, the time
+ * they took and the CPU cycles, instructions, cache misses and branch
+ * misses perf counted, if available. The lines are appended to the
+ * file VIR_TEST_BENCH_OUTPUT names or printed to stdout.
+ *
+ * Returns 0 on success, -1 if @body failed.
+ */
+int
+virTestBench(const char *title,
+             int (*body)(const void *data),
+             const void *data)
+{
+    struct virTestBenchInfo info = { title, body, data };
+
+    return virTestRun(title, virTestBenchBody, &info);
+}
+
 /* Allocate BUF to the size of FILE. Read FILE into buffer BUF.
    Upon any failure, diagnose it and return -1, but don't bother trying
    to preserve errno. Otherwise, return the number of bytes copied into BUF. */
@@ -929,7 +1103,9 @@ int virTestMain(int argc,
         fprintf(stderr, "Usage: %s\n", argv[0]);
         fputs("effective environment variables:\n"
               "VIR_TEST_VERBOSE set to show names of individual tests\n"
-              "VIR_TEST_DEBUG set to show information for debugging failures\n",
+              "VIR_TEST_DEBUG set to show information for debugging failures\n"
+              "VIR_TEST_BENCH_ITERATIONS set to run benchmarks that many times\n"
+              "VIR_TEST_BENCH_OUTPUT set to the file benchmark results are appended to\n",
               stderr);
         return EXIT_FAILURE;
     }
@@ -51,6 +51,9 @@ bool virTestOOMActive(void);
 int virTestRun(const char *title,
                int (*body)(const void *data),
                const void *data);
+int virTestBench(const char *title,
+                 int (*body)(const void *data),
+                 const void *data);
 int virTestLoadFile(const char *file, char **buf);
 int virTestCaptureProgramOutput(const char *const argv[], char **buf, int maxlen);
 
@@ -665,6 +665,72 @@ test12(const void *opaque ATTRIBUTE_UNUSED)
 #undef TEST_MAP
 
 
+/* test ranges starting and ending at unit boundaries and in between */
+static int
+test13(const void *opaque ATTRIBUTE_UNUSED)
+{
+    static const char *strs[] = {
+        "0-63", "0-64", "1-62", "63-64", "63", "64", "0-127", "1-126",
+        "5,63-200,250-255", "0-255", "0,2,4-6,255", "100-191,193",
+    };
+    virBitmapPtr map = NULL;
+    virBitmapPtr unlimited = NULL;
+    char *str = NULL;
+    ssize_t last;
+    ssize_t i;
+    size_t j;
+    int ret = -1;
+
+    for (j = 0; j < ARRAY_CARDINALITY(strs); j++) {
+        if (virBitmapParse(strs[j], &map, 256) < 0 ||
+            !(unlimited = virBitmapParseUnlimited(strs[j])))
+            goto cleanup;
+
+        if (!(str = virBitmapFormat(map)) || STRNEQ(str, strs[j])) {
+            fprintf(stderr, "\n expected '%s', got '%s'\n",
+                    strs[j], NULLSTR(str));
+            goto cleanup;
+        }
+
+        if (!virBitmapEqual(map, unlimited)) {
+            fprintf(stderr, "\n unlimited bitmap '%s' differs\n", strs[j]);
+            goto cleanup;
+        }
+
+        for (last = -1, i = 0; i < 256; i++) {
+            if (virBitmapIsBitSet(map, i))
+                last = i;
+        }
+
+        if (virBitmapLastSetBit(map) != last ||
+            virBitmapLastSetBit(unlimited) != last) {
+            fprintf(stderr, "\n last set bit of '%s' is not %zd\n",
+                    strs[j], last);
+            goto cleanup;
+        }
+
+        VIR_FREE(str);
+        virBitmapFree(map);
+        virBitmapFree(unlimited);
+        map = unlimited = NULL;
+    }
+
+    /* ranges beyond the end of the bitmap are rejected */
+    if (virBitmapParse("200-256", &map, 256) == 0) {
+        fprintf(stderr, "\n parsed a range beyond the bitmap\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(str);
+    virBitmapFree(map);
+    virBitmapFree(unlimited);
+    return ret;
+}
+
+
 #define TESTBINARYOP(A, B, RES, FUNC)                                         \
     testBinaryOpData.a = A;                                                   \
     testBinaryOpData.b = B;                                                   \
@@ -710,6 +776,8 @@ mymain(void)
 
     if (virTestRun("test12", test12, NULL) < 0)
         ret = -1;
+    if (virTestRun("test13", test13, NULL) < 0)
+        ret = -1;
 
     return ret;
 }
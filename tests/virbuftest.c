@@ -375,6 +375,92 @@ testBufEscapeStr(const void *opaque ATTRIBUTE_UNUSED)
 }
 
 
+/* Escapes @str the way virBufferEscapeString is documented to */
+static void
+testBufEscapeStrReference(virBufferPtr buf, const char *str)
+{
+    for (; *str; str++) {
+        switch (*str) {
+        case '<':
+            virBufferAddLit(buf, "&lt;");
+            break;
+        case '>':
+            virBufferAddLit(buf, "&gt;");
+            break;
+        case '&':
+            virBufferAddLit(buf, "&amp;");
+            break;
+        case '"':
+            virBufferAddLit(buf, "&quot;");
+            break;
+        case '\'':
+            virBufferAddLit(buf, "&apos;");
+            break;
+        case '\t':
+        case '\n':
+        case '\r':
+            virBufferAddChar(buf, *str);
+            break;
+        default:
+            if ((unsigned char) *str >= 0x1A)
+                virBufferAddChar(buf, *str);
+            break;
+        }
+    }
+}
+
+
+/*
+ * Checks virBufferEscapeString on a string containing every character.
+ */
+static int
+testBufEscapeStrAll(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virBuffer expectbuf = VIR_BUFFER_INITIALIZER;
+    const size_t len = 64 * 1024;
+    char *str = NULL;
+    char *actual = NULL;
+    char *expect = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(str, len + 1) < 0)
+        goto cleanup;
+
+    /* mostly plain text with every other character sprinkled in */
+    for (i = 0; i < len; i++)
+        str[i] = i % 16 ? 'a' + i % 26 : 1 + (i / 16) % 255;
+
+    virBufferAddLit(&expectbuf, "<el a='");
+    testBufEscapeStrReference(&expectbuf, str);
+    virBufferAddLit(&expectbuf, "'/>\n");
+    if (!(expect = virBufferContentAndReset(&expectbuf)))
+        goto cleanup;
+
+    virBufferEscapeString(&buf, "<el a='%s'/>\n", str);
+
+    if (!(actual = virBufferContentAndReset(&buf))) {
+        VIR_TEST_DEBUG("buf is empty");
+        goto cleanup;
+    }
+
+    if (STRNEQ(actual, expect)) {
+        VIR_TEST_DEBUG("testBufEscapeStrAll(): Strings don't match");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&expectbuf);
+    VIR_FREE(str);
+    VIR_FREE(actual);
+    VIR_FREE(expect);
+    return ret;
+}
+
+
 static int
 testBufEscapeN(const void *opaque)
 {
@@ -432,6 +518,46 @@ testBufSetIndent(const void *opaque ATTRIBUTE_UNUSED)
 }
 
 
+static int
+testBufReserve(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *actual = NULL;
+    size_t i;
+    int ret = -1;
+
+    virBufferReserve(&buf, 4096);
+    if (buf.a < 4096 || virBufferUse(&buf) != 0) {
+        VIR_TEST_DEBUG("Wrong reservation");
+        goto cleanup;
+    }
+
+    virBufferAdjustIndent(&buf, 2);
+    for (i = 0; i < 1000; i++) {
+        virBufferAsprintf(&buf, "<a/>\n");
+        virBufferAsprintf(&buf, "<b i='%zu'/>\n", i % 10);
+    }
+
+    if (!(actual = virBufferContentAndReset(&buf))) {
+        VIR_TEST_DEBUG("buf is empty");
+        goto cleanup;
+    }
+
+    if (strlen(actual) != 1000 * (7 + 13) ||
+        !STRPREFIX(actual, "  <a/>\n  <b i='0'/>\n  <a/>\n  <b i='1'/>\n") ||
+        STRNEQ(actual + strlen(actual) - 20, "  <a/>\n  <b i='9'/>\n")) {
+        VIR_TEST_DEBUG("Wrong content");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(actual);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -451,6 +577,7 @@ mymain(void)
     DO_TEST("Trim", testBufTrim, 0);
     DO_TEST("AddBuffer", testBufAddBuffer, 0);
     DO_TEST("set indent", testBufSetIndent, 0);
+    DO_TEST("Reserve", testBufReserve, 0);
 
 #define DO_TEST_ADD_STR(DATA, EXPECT)                                  \
     do {                                                               \
@@ -480,6 +607,8 @@ mymain(void)
     DO_TEST_ESCAPE("\x01\x01\x02\x03\x05\x08",
                    "<c>\n  <el></el>\n</c>");
 
+    DO_TEST("EscapeString all characters", testBufEscapeStrAll, 0);
+
 #define DO_TEST_ESCAPEN(data, expect)                                   \
     do {                                                                \
         struct testBufAddStrData info = { data, expect };               \
@@ -25,6 +25,7 @@
 #include "testutils.h"
 #include "capabilities.h"
 #include "virbitmap.h"
+#include "virhosttopology.h"
 #include "virsysfspriv.h"
 
 
@@ -53,6 +54,7 @@ test_virCapabilities(const void *opaque)
         goto cleanup;
 
     virSysfsSetSystemPath(dir);
+    virHostTopologyInvalidate();
     caps = virCapabilitiesNew(data->arch, data->offlineMigrate, data->liveMigrate);
 
     if (!caps)
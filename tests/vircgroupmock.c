@@ -158,6 +158,28 @@ const char *proccgroupslogind =
     "blkio     0  1  1\n"
     "perf_event  0  1  1\n";
 
+/*
+ * The unified hierarchy, which has no 'devices' and 'freezer'
+ * controllers and uses BPF for the former instead
+ */
+const char *procmountsunified =
+    "rootfs / rootfs rw 0 0\n"
+    "tmpfs /run tmpfs rw,seclabel,nosuid,nodev,mode=755 0 0\n"
+    "cgroup2 /not/really/sys/fs/cgroup/unified cgroup2 rw,nosuid,nodev,noexec,relatime,nsdelegate 0 0\n"
+    "/dev/sda1 /boot ext4 rw,seclabel,relatime,data=ordered 0 0\n";
+
+const char *procselfcgroupsunified =
+    "0::/system\n";
+
+const char *proccgroupsunified =
+    "#subsys_name    hierarchy       num_cgroups     enabled\n"
+    "cpuset    0  4  1\n"
+    "cpu       0  4  1\n"
+    "cpuacct   0  4  1\n"
+    "memory    0  4  1\n"
+    "devices   0  4  1\n"
+    "freezer   0  4  1\n"
+    "blkio     0  4  1\n";
 
 
 static int make_file(const char *path,
@@ -309,6 +331,37 @@ static int make_controller(const char *path, mode_t mode)
         MAKE_FILE("memory.swappiness", "60\n");
         MAKE_FILE("memory.usage_in_bytes", "1455321088\n");
         MAKE_FILE("memory.use_hierarchy", "0\n");
+    } else if (STRPREFIX(controller, "unified")) {
+        MAKE_FILE("cgroup.controllers", "cpuset cpu io memory pids\n");
+        MAKE_FILE("cgroup.procs", "");
+        MAKE_FILE("cgroup.subtree_control", "");
+        MAKE_FILE("cpu.max", "max 100000\n");
+        MAKE_FILE("cpu.pressure",
+                  "some avg10=1.50 avg60=0.75 avg300=0.25 total=1234567\n");
+        MAKE_FILE("cpu.stat",
+                  "usage_usec 2787788855\n"
+                  "user_usec 2166870250\n"
+                  "system_usec 434213960\n"
+                  "nr_periods 0\n"
+                  "nr_throttled 0\n"
+                  "throttled_usec 0\n");
+        MAKE_FILE("cpu.weight", "100\n");
+        MAKE_FILE("io.pressure",
+                  "some avg10=0.00 avg60=0.12 avg300=0.05 total=98765\n"
+                  "full avg10=0.00 avg60=0.10 avg300=0.04 total=87654\n");
+        MAKE_FILE("io.stat",
+                  "8:0 rbytes=59542107136 wbytes=411440480256 rios=4832583 "
+                  "wios=36641903 dbytes=0 dios=0\n"
+                  "9:0 rbytes=59542107137 wbytes=411440480257 rios=4832584 "
+                  "wios=36641904 dbytes=0 dios=0\n");
+        MAKE_FILE("memory.current", "1455321088\n");
+        MAKE_FILE("memory.max", "max\n");
+        MAKE_FILE("memory.pressure",
+                  "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n"
+                  "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+        MAKE_FILE("memory.stat",
+                  "anon 97792000\n"
+                  "file 1336619008\n");
     } else if (STRPREFIX(controller, "freezer")) {
         MAKE_FILE("freezer.state", "THAWED");
     } else if (STRPREFIX(controller, "blkio")) {
@@ -441,6 +494,8 @@ static void init_sysfs(void)
     MAKE_CONTROLLER("blkio");
     MAKE_CONTROLLER("memory");
     MAKE_CONTROLLER("freezer");
+    MAKE_CONTROLLER("unified");
+    MAKE_CONTROLLER("unified/system");
 
     if (make_file(fakesysfscgroupdir,
                   SYSFS_CPU_PRESENT_MOCKED, "8-23,48-159\n") < 0)
@@ -451,7 +506,7 @@ static void init_sysfs(void)
 FILE *fopen(const char *path, const char *mode)
 {
     const char *mock;
-    bool allinone = false, logind = false;
+    bool allinone = false, logind = false, unified = false;
     init_syms();
 
     mock = getenv("VIR_CGROUP_MOCK_MODE");
@@ -460,6 +515,8 @@ FILE *fopen(const char *path, const char *mode)
             allinone = true;
         else if (STREQ(mock, "logind"))
             logind = true;
+        else if (STREQ(mock, "unified"))
+            unified = true;
     }
 
     if (STREQ(path, "/proc/mounts")) {
@@ -470,6 +527,9 @@ FILE *fopen(const char *path, const char *mode)
             else if (logind)
                 return fmemopen((void *)procmountslogind,
                                 strlen(procmountslogind), mode);
+            else if (unified)
+                return fmemopen((void *)procmountsunified,
+                                strlen(procmountsunified), mode);
             else
                 return fmemopen((void *)procmounts, strlen(procmounts), mode);
         } else {
@@ -485,6 +545,9 @@ FILE *fopen(const char *path, const char *mode)
             else if (logind)
                 return fmemopen((void *)proccgroupslogind,
                                 strlen(proccgroupslogind), mode);
+            else if (unified)
+                return fmemopen((void *)proccgroupsunified,
+                                strlen(proccgroupsunified), mode);
             else
                 return fmemopen((void *)proccgroups, strlen(proccgroups), mode);
         } else {
@@ -500,6 +563,9 @@ FILE *fopen(const char *path, const char *mode)
             else if (logind)
                 return fmemopen((void *)procselfcgroupslogind,
                                 strlen(procselfcgroupslogind), mode);
+            else if (unified)
+                return fmemopen((void *)procselfcgroupsunified,
+                                strlen(procselfcgroupsunified), mode);
             else
                 return fmemopen((void *)procselfcgroups, strlen(procselfcgroups), mode);
         } else {
@@ -125,6 +125,17 @@ const char *mountsLogind[VIR_CGROUP_CONTROLLER_LAST] = {
     [VIR_CGROUP_CONTROLLER_SYSTEMD] = "/not/really/sys/fs/cgroup/systemd",
 };
 
+const char *mountsUnified[VIR_CGROUP_CONTROLLER_LAST] = {
+    [VIR_CGROUP_CONTROLLER_CPU] = "/not/really/sys/fs/cgroup/unified",
+    [VIR_CGROUP_CONTROLLER_CPUACCT] = "/not/really/sys/fs/cgroup/unified",
+    [VIR_CGROUP_CONTROLLER_CPUSET] = "/not/really/sys/fs/cgroup/unified",
+    [VIR_CGROUP_CONTROLLER_MEMORY] = "/not/really/sys/fs/cgroup/unified",
+    [VIR_CGROUP_CONTROLLER_DEVICES] = NULL,
+    [VIR_CGROUP_CONTROLLER_FREEZER] = NULL,
+    [VIR_CGROUP_CONTROLLER_BLKIO] = "/not/really/sys/fs/cgroup/unified",
+    [VIR_CGROUP_CONTROLLER_SYSTEMD] = "/not/really/sys/fs/cgroup/unified",
+};
+
 const char *links[VIR_CGROUP_CONTROLLER_LAST] = {
     [VIR_CGROUP_CONTROLLER_CPU] = "/not/really/sys/fs/cgroup/cpu",
     [VIR_CGROUP_CONTROLLER_CPUACCT] = "/not/really/sys/fs/cgroup/cpuacct",
@@ -565,6 +576,39 @@ static int testCgroupNewForSelfLogind(const void *args ATTRIBUTE_UNUSED)
 }
 
 
+static int testCgroupNewForSelfUnified(const void *args ATTRIBUTE_UNUSED)
+{
+    virCgroupPtr cgroup = NULL;
+    int ret = -1;
+    const char *placement[VIR_CGROUP_CONTROLLER_LAST] = {
+        [VIR_CGROUP_CONTROLLER_CPU] = "/system",
+        [VIR_CGROUP_CONTROLLER_CPUACCT] = "/system",
+        [VIR_CGROUP_CONTROLLER_CPUSET] = "/system",
+        [VIR_CGROUP_CONTROLLER_MEMORY] = "/system",
+        [VIR_CGROUP_CONTROLLER_DEVICES] = NULL,
+        [VIR_CGROUP_CONTROLLER_FREEZER] = NULL,
+        [VIR_CGROUP_CONTROLLER_BLKIO] = "/system",
+        [VIR_CGROUP_CONTROLLER_SYSTEMD] = "/system",
+    };
+
+    if (virCgroupNewSelf(&cgroup) < 0) {
+        fprintf(stderr, "Cannot create cgroup for self\n");
+        goto cleanup;
+    }
+
+    if (!cgroup->unified) {
+        fprintf(stderr, "Unified hierarchy not detected\n");
+        goto cleanup;
+    }
+
+    ret = validateCgroup(cgroup, "", mountsUnified, linksAllInOne, placement);
+
+ cleanup:
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
+
 static int testCgroupAvailable(const void *args)
 {
     bool got = virCgroupAvailable();
@@ -692,11 +736,12 @@ static int testCgroupGetPercpuStats(const void *args ATTRIBUTE_UNUSED)
     return ret;
 }
 
-static int testCgroupGetMemoryUsage(const void *args ATTRIBUTE_UNUSED)
+static int testCgroupGetMemoryUsage(const void *args)
 {
     virCgroupPtr cgroup = NULL;
     int rv, ret = -1;
     unsigned long kb;
+    size_t i;
 
     if ((rv = virCgroupNewPartition("/virtualmachines", true,
                                     (1 << VIR_CGROUP_CONTROLLER_MEMORY),
@@ -705,16 +750,87 @@ static int testCgroupGetMemoryUsage(const void *args ATTRIBUTE_UNUSED)
         goto cleanup;
     }
 
-    if ((rv = virCgroupGetMemoryUsage(cgroup, &kb)) < 0) {
-        fprintf(stderr, "Could not retrieve GetMemoryUsage for /virtualmachines cgroup: %d\n", -rv);
+    /* with the stat cache, the second read goes through the open file */
+    if (args && virCgroupEnableStatCache(cgroup) < 0)
+        goto cleanup;
+
+    for (i = 0; i < (args ? 2 : 1); i++) {
+        if ((rv = virCgroupGetMemoryUsage(cgroup, &kb)) < 0) {
+            fprintf(stderr, "Could not retrieve GetMemoryUsage for /virtualmachines cgroup: %d\n", -rv);
+            goto cleanup;
+        }
+
+        if (kb != 1421212UL) {
+            fprintf(stderr,
+                    "Wrong value from virCgroupGetMemoryUsage (expected %ld)\n",
+                    1421212UL);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
+static int testCgroupGetPercpuStatsUnified(const void *args ATTRIBUTE_UNUSED)
+{
+    virCgroupPtr cgroup = NULL;
+    virTypedParameter params[1];
+    int ret = -1;
+
+    if (virCgroupNewSelf(&cgroup) < 0)
+        goto cleanup;
+
+    /* There is no per-CPU accounting in the unified hierarchy */
+    if (virCgroupGetPercpuStats(cgroup, params, 1, 0, 1, NULL) >= 0) {
+        fprintf(stderr, "Unexpected per-CPU stats with the unified hierarchy\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
+static int testCgroupGetCpuTimesUnified(const void *args ATTRIBUTE_UNUSED)
+{
+    virCgroupPtr cgroup = NULL;
+    virTypedParameter params[3];
+    unsigned long long usage, user, sys;
+    const unsigned long long expected[] = {
+        2787788855000ULL,
+        2166870250000ULL,
+        434213960000ULL,
+    };
+    size_t i;
+    int ret = -1;
+
+    if (virCgroupNewSelf(&cgroup) < 0)
+        goto cleanup;
+
+    if (virCgroupGetCpuacctUsage(cgroup, &usage) < 0 ||
+        virCgroupGetCpuacctStat(cgroup, &user, &sys) < 0)
+        goto cleanup;
+
+    if (usage != expected[0] || user != expected[1] || sys != expected[2]) {
+        fprintf(stderr, "Wrong CPU times %llu %llu %llu\n", usage, user, sys);
         goto cleanup;
     }
 
-    if (kb != 1421212UL) {
-        fprintf(stderr,
-                "Wrong value from virCgroupGetMemoryUsage (expected %ld)\n",
-                1421212UL);
+    if (virCgroupGetDomainTotalCpuStats(cgroup, params, 3) != 3)
         goto cleanup;
+
+    for (i = 0; i < ARRAY_CARDINALITY(expected); i++) {
+        if (params[i].value.ul != expected[i]) {
+            fprintf(stderr, "Wrong value %llu for %s (expected %llu)\n",
+                    params[i].value.ul, params[i].field, expected[i]);
+            goto cleanup;
+        }
     }
 
     ret = 0;
@@ -724,10 +840,54 @@ static int testCgroupGetMemoryUsage(const void *args ATTRIBUTE_UNUSED)
     return ret;
 }
 
-static int testCgroupGetBlkioIoServiced(const void *args ATTRIBUTE_UNUSED)
+static int testCgroupGetPressure(const void *args)
 {
     virCgroupPtr cgroup = NULL;
+    virCgroupPressure some, full;
+    int rv, ret = -1;
     size_t i;
+
+    if (virCgroupNewSelf(&cgroup) < 0)
+        goto cleanup;
+
+    if (args && virCgroupEnableStatCache(cgroup) < 0)
+        goto cleanup;
+
+    if (!virCgroupSupportsPressure(cgroup)) {
+        fprintf(stderr, "Pressure stall information not supported\n");
+        goto cleanup;
+    }
+
+    for (i = 0; i < (args ? 2 : 1); i++) {
+        /* no "full" line for the CPU */
+        if ((rv = virCgroupGetPressure(cgroup, VIR_CGROUP_PRESSURE_CPU,
+                                       &some, &full)) != 0 ||
+            some.avg10 != 1.5 || some.avg60 != 0.75 || some.avg300 != 0.25 ||
+            some.total != 1234567 || full.total != 0) {
+            fprintf(stderr, "Wrong CPU pressure (%d)\n", rv);
+            goto cleanup;
+        }
+
+        if ((rv = virCgroupGetPressure(cgroup, VIR_CGROUP_PRESSURE_IO,
+                                       &some, &full)) != 1 ||
+            some.avg60 != 0.12 || some.total != 98765 ||
+            full.avg60 != 0.1 || full.avg300 != 0.04 || full.total != 87654) {
+            fprintf(stderr, "Wrong I/O pressure (%d)\n", rv);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
+static int testCgroupGetBlkioIoServiced(const void *args)
+{
+    virCgroupPtr cgroup = NULL;
+    size_t i, j;
     int rv, ret = -1;
 
     const long long expected_values[] = {
@@ -751,20 +911,25 @@ static int testCgroupGetBlkioIoServiced(const void *args ATTRIBUTE_UNUSED)
         goto cleanup;
     }
 
-    if ((rv = virCgroupGetBlkioIoServiced(cgroup,
-                                          values, &values[1],
-                                          &values[2], &values[3])) < 0) {
-        fprintf(stderr, "Could not retrieve BlkioIoServiced for /virtualmachines cgroup: %d\n", -rv);
+    if (args && virCgroupEnableStatCache(cgroup) < 0)
         goto cleanup;
-    }
 
-    for (i = 0; i < ARRAY_CARDINALITY(expected_values); i++) {
-        if (expected_values[i] != values[i]) {
-            fprintf(stderr,
-                    "Wrong value for %s from virCgroupBlkioIoServiced (expected %lld)\n",
-                    names[i], expected_values[i]);
+    for (j = 0; j < (args ? 2 : 1); j++) {
+        if ((rv = virCgroupGetBlkioIoServiced(cgroup,
+                                              values, &values[1],
+                                              &values[2], &values[3])) < 0) {
+            fprintf(stderr, "Could not retrieve BlkioIoServiced for /virtualmachines cgroup: %d\n", -rv);
             goto cleanup;
         }
+
+        for (i = 0; i < ARRAY_CARDINALITY(expected_values); i++) {
+            if (expected_values[i] != values[i]) {
+                fprintf(stderr,
+                        "Wrong value for %s from virCgroupBlkioIoServiced (expected %lld)\n",
+                        names[i], expected_values[i]);
+                goto cleanup;
+            }
+        }
     }
 
     ret = 0;
@@ -885,6 +1050,8 @@ mymain(void)
     DETECT_MOUNTS("cgroups3");
     DETECT_MOUNTS("all-in-one");
     DETECT_MOUNTS("no-cgroups");
+    DETECT_MOUNTS("unified");
+    DETECT_MOUNTS("hybrid");
 
     if (virTestRun("New cgroup for self", testCgroupNewForSelf, NULL) < 0)
         ret = -1;
@@ -913,12 +1080,20 @@ mymain(void)
     if (virTestRun("virCgroupGetBlkioIoServiced works", testCgroupGetBlkioIoServiced, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("virCgroupGetBlkioIoServiced works with the stat cache",
+                   testCgroupGetBlkioIoServiced, (void*)0x1) < 0)
+        ret = -1;
+
     if (virTestRun("virCgroupGetBlkioIoDeviceServiced works", testCgroupGetBlkioIoDeviceServiced, NULL) < 0)
         ret = -1;
 
     if (virTestRun("virCgroupGetMemoryUsage works", testCgroupGetMemoryUsage, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("virCgroupGetMemoryUsage works with the stat cache",
+                   testCgroupGetMemoryUsage, (void*)0x1) < 0)
+        ret = -1;
+
     if (virTestRun("virCgroupGetPercpuStats works", testCgroupGetPercpuStats, NULL) < 0)
         ret = -1;
 
@@ -936,6 +1111,35 @@ mymain(void)
         ret = -1;
     unsetenv("VIR_CGROUP_MOCK_MODE");
 
+    setenv("VIR_CGROUP_MOCK_MODE", "unified", 1);
+    if (virTestRun("New cgroup for self (unified)", testCgroupNewForSelfUnified, NULL) < 0)
+        ret = -1;
+    if (virTestRun("Cgroup available (unified)", testCgroupAvailable, (void*)0x1) < 0)
+        ret = -1;
+    if (virTestRun("virCgroupGetBlkioIoServiced works (unified)",
+                   testCgroupGetBlkioIoServiced, NULL) < 0)
+        ret = -1;
+    if (virTestRun("virCgroupGetBlkioIoServiced works with the stat cache (unified)",
+                   testCgroupGetBlkioIoServiced, (void*)0x1) < 0)
+        ret = -1;
+    if (virTestRun("virCgroupGetBlkioIoDeviceServiced works (unified)",
+                   testCgroupGetBlkioIoDeviceServiced, NULL) < 0)
+        ret = -1;
+    if (virTestRun("virCgroupGetMemoryUsage works (unified)",
+                   testCgroupGetMemoryUsage, NULL) < 0)
+        ret = -1;
+    if (virTestRun("virCgroupGetPercpuStats fails (unified)",
+                   testCgroupGetPercpuStatsUnified, NULL) < 0)
+        ret = -1;
+    if (virTestRun("CPU times (unified)", testCgroupGetCpuTimesUnified, NULL) < 0)
+        ret = -1;
+    if (virTestRun("virCgroupGetPressure works", testCgroupGetPressure, NULL) < 0)
+        ret = -1;
+    if (virTestRun("virCgroupGetPressure works with the stat cache",
+                   testCgroupGetPressure, (void*)0x1) < 0)
+        ret = -1;
+    unsetenv("VIR_CGROUP_MOCK_MODE");
+
     if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
         virFileDeleteTree(fakerootdir);
 
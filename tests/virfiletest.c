@@ -87,6 +87,37 @@ static int testFileGetMountSubtree(const void *opaque)
     virStringListFree(gotmounts);
     return ret;
 }
+
+struct testFileGetMountSubtreesData {
+    const char *path;
+    const char *const *prefixes;
+    size_t nprefixes;
+    const char *const *mounts;
+    size_t nmounts;
+};
+
+static int testFileGetMountSubtrees(const void *opaque)
+{
+    int ret = -1;
+    char **gotmounts = NULL;
+    size_t gotnmounts = 0;
+    const struct testFileGetMountSubtreesData *data = opaque;
+
+    if (virFileGetMountReverseSubtrees(data->path,
+                                       data->prefixes,
+                                       data->nprefixes,
+                                       &gotmounts,
+                                       &gotnmounts) < 0)
+        goto cleanup;
+
+    ret = testFileCheckMounts(data->prefixes[0],
+                              gotmounts, gotnmounts,
+                              data->mounts, data->nmounts);
+
+ cleanup:
+    virStringListFree(gotmounts);
+    return ret;
+}
 #endif /* ! defined HAVE_MNTENT_H && defined HAVE_GETMNTENT_R */
 
 struct testFileSanitizePathData
@@ -140,6 +171,13 @@ mymain(void)
     static const char *wantmounts2b[] = {
         "/etc/aliases.db"
     };
+    static const char *prefixes1multi[] = {
+        "/proc", "/dev"
+    };
+    static const char *wantmounts1multi[] = {
+        "/proc/sys/fs/binfmt_misc", "/proc/sys/fs/binfmt_misc", "/proc",
+        "/dev/shm", "/dev/pts", "/dev/mqueue", "/dev/hugepages", "/dev"
+    };
 
 # define DO_TEST_MOUNT_SUBTREE(name, path, prefix, mounts, rev)    \
     do {                                                           \
@@ -154,6 +192,19 @@ mymain(void)
     DO_TEST_MOUNT_SUBTREE("/proc reverse", MTAB_PATH1, "/proc", wantmounts1rev, true);
     DO_TEST_MOUNT_SUBTREE("/etc/aliases", MTAB_PATH2, "/etc/aliases", wantmounts2a, false);
     DO_TEST_MOUNT_SUBTREE("/etc/aliases.db", MTAB_PATH2, "/etc/aliases.db", wantmounts2b, false);
+
+# define DO_TEST_MOUNT_SUBTREES(name, path, prefixes, mounts)          \
+    do {                                                               \
+        struct testFileGetMountSubtreesData data = {                   \
+            path, prefixes, ARRAY_CARDINALITY(prefixes),               \
+            mounts, ARRAY_CARDINALITY(mounts)                          \
+        };                                                             \
+        if (virTestRun(name, testFileGetMountSubtrees, &data) < 0)     \
+            ret = -1;                                                  \
+    } while (0)
+
+    DO_TEST_MOUNT_SUBTREES("/proc and /dev reverse", MTAB_PATH1,
+                           prefixes1multi, wantmounts1multi);
 #endif /* ! defined HAVE_MNTENT_H && defined HAVE_GETMNTENT_R */
 
 #define DO_TEST_SANITIZE_PATH(PATH, EXPECT)                                    \
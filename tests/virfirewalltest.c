@@ -1123,6 +1123,210 @@ testFirewallQuery(const void *opaque ATTRIBUTE_UNUSED)
     return ret;
 }
 
+static void
+testFirewallBatchHook(const char *const*args ATTRIBUTE_UNUSED,
+                      const char *const*env ATTRIBUTE_UNUSED,
+                      const char *input,
+                      char **output ATTRIBUTE_UNUSED,
+                      char **error ATTRIBUTE_UNUSED,
+                      int *status,
+                      void *opaque)
+{
+    virBufferPtr buf = opaque;
+
+    if (!input)
+        return;
+
+    virBufferAdd(buf, input, -1);
+    /* Fake failure of the batch with this IP addr */
+    if (strstr(input, "192.168.122.255"))
+        *status = 1;
+}
+
+
+static int
+testFirewallBatch(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virBuffer cmdbuf = VIR_BUFFER_INITIALIZER;
+    virFirewallPtr fw = NULL;
+    int ret = -1;
+    const char *actual = NULL;
+    const char *expected =
+        IPTABLES_RESTORE_PATH " --noflush\n"
+        "*filter\n"
+        "-A INPUT --source-host 192.168.122.1 --jump ACCEPT\n"
+        "COMMIT\n"
+        "*nat\n"
+        "-A POSTROUTING --out-interface virbr0 --jump MASQUERADE\n"
+        "COMMIT\n"
+        "*filter\n"
+        "-A INPUT -m comment --comment \"libvirt rule\" --jump ACCEPT\n"
+        "COMMIT\n"
+        IPTABLES_PATH " -D INPUT --source-host 192.168.122.2 --jump ACCEPT\n"
+        IP6TABLES_PATH " -A INPUT --source-host ::1 --jump ACCEPT\n"
+        EBTABLES_PATH " -A INPUT --source 00:11:22:33:44:55 --jump ACCEPT\n";
+
+    if (virFirewallSetBackend(VIR_FIREWALL_BACKEND_BATCH) < 0)
+        goto cleanup;
+
+    virCommandSetDryRun(&cmdbuf, testFirewallBatchHook, &cmdbuf);
+
+    fw = virFirewallNew();
+
+    virFirewallStartTransaction(fw, 0);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "INPUT",
+                       "--source-host", "192.168.122.1",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "--table", "nat",
+                       "-A", "POSTROUTING",
+                       "--out-interface", "virbr0",
+                       "--jump", "MASQUERADE", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "INPUT",
+                       "-m", "comment", "--comment", "libvirt rule",
+                       "--jump", "ACCEPT", NULL);
+
+    /* errors of this one must be ignored, so it can't be batched */
+    virFirewallAddRuleFull(fw, VIR_FIREWALL_LAYER_IPV4,
+                           true, NULL, NULL,
+                           "-D", "INPUT",
+                           "--source-host", "192.168.122.2",
+                           "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV6,
+                       "-A", "INPUT",
+                       "--source-host", "::1",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                       "-A", "INPUT",
+                       "--source", "00:11:22:33:44:55",
+                       "--jump", "ACCEPT", NULL);
+
+    if (virFirewallApply(fw) < 0)
+        goto cleanup;
+
+    if (virBufferError(&cmdbuf))
+        goto cleanup;
+
+    actual = virBufferCurrentContent(&cmdbuf);
+
+    if (STRNEQ_NULLABLE(expected, actual)) {
+        fprintf(stderr, "Unexected command execution\n");
+        virTestDifference(stderr, expected, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virBufferFreeAndReset(&cmdbuf);
+    virCommandSetDryRun(NULL, NULL, NULL);
+    virFirewallFree(fw);
+    return ret;
+}
+
+
+static int
+testFirewallBatchRollback(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virBuffer cmdbuf = VIR_BUFFER_INITIALIZER;
+    virFirewallPtr fw = NULL;
+    int ret = -1;
+    const char *actual = NULL;
+    const char *expected =
+        IPTABLES_RESTORE_PATH " --noflush\n"
+        "*filter\n"
+        "-A INPUT --source-host 192.168.122.1 --jump ACCEPT\n"
+        "-A INPUT --source-host !192.168.122.1 --jump REJECT\n"
+        "COMMIT\n"
+        IPTABLES_RESTORE_PATH " --noflush\n"
+        "*filter\n"
+        "-A INPUT --source-host 192.168.122.127 --jump REJECT\n"
+        "-A INPUT --source-host 192.168.122.255 --jump REJECT\n"
+        "COMMIT\n"
+        IPTABLES_PATH " -D INPUT --source-host 192.168.122.127 --jump REJECT\n"
+        IPTABLES_PATH " -D INPUT --source-host 192.168.122.255 --jump REJECT\n";
+
+    if (virFirewallSetBackend(VIR_FIREWALL_BACKEND_BATCH) < 0)
+        goto cleanup;
+
+    virCommandSetDryRun(&cmdbuf, testFirewallBatchHook, &cmdbuf);
+
+    fw = virFirewallNew();
+
+    virFirewallStartTransaction(fw, 0);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "INPUT",
+                       "--source-host", "192.168.122.1",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "INPUT",
+                       "--source-host", "!192.168.122.1",
+                       "--jump", "REJECT", NULL);
+
+    virFirewallStartRollback(fw, 0);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-D", "INPUT",
+                       "--source-host", "192.168.122.1",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallStartTransaction(fw, 0);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "INPUT",
+                       "--source-host", "192.168.122.127",
+                       "--jump", "REJECT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "INPUT",
+                       "--source-host", "192.168.122.255",
+                       "--jump", "REJECT", NULL);
+
+    virFirewallStartRollback(fw, 0);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-D", "INPUT",
+                       "--source-host", "192.168.122.127",
+                       "--jump", "REJECT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-D", "INPUT",
+                       "--source-host", "192.168.122.255",
+                       "--jump", "REJECT", NULL);
+
+    if (virFirewallApply(fw) == 0) {
+        fprintf(stderr, "Firewall apply unexpectedly worked\n");
+        goto cleanup;
+    }
+
+    if (virBufferError(&cmdbuf))
+        goto cleanup;
+
+    actual = virBufferCurrentContent(&cmdbuf);
+
+    if (STRNEQ_NULLABLE(expected, actual)) {
+        fprintf(stderr, "Unexected command execution\n");
+        virTestDifference(stderr, expected, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virBufferFreeAndReset(&cmdbuf);
+    virCommandSetDryRun(NULL, NULL, NULL);
+    virFirewallFree(fw);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -1179,6 +1383,10 @@ mymain(void)
     RUN_TEST("many rollback", testFirewallManyRollback);
     RUN_TEST("chained rollback", testFirewallChainedRollback);
     RUN_TEST("query transaction", testFirewallQuery);
+    if (virTestRun("batch transaction", testFirewallBatch, NULL) < 0)
+        ret = -1;
+    if (virTestRun("batch rollback", testFirewallBatchRollback, NULL) < 0)
+        ret = -1;
 
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -12,6 +12,7 @@
 #include "viralloc.h"
 #include "virlog.h"
 #include "virstring.h"
+#include "virthread.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -358,6 +359,53 @@ testHashForEach(const void *data ATTRIBUTE_UNUSED)
 }
 
 
+struct testHashForEachSharedData {
+    virHashTablePtr hash;
+    size_t count;
+};
+
+static int
+testHashForEachSharedIter(void *payload ATTRIBUTE_UNUSED,
+                          const void *name ATTRIBUTE_UNUSED,
+                          void *opaque)
+{
+    struct testHashForEachSharedData *data = opaque;
+
+    /* Nested shared iterations stand in for concurrent readers */
+    return virHashForEachShared(data->hash, testHashCheckForEachCount,
+                                &data->count);
+}
+
+static int
+testHashForEachShared(const void *data ATTRIBUTE_UNUSED)
+{
+    struct testHashForEachSharedData iterdata = { NULL, 0 };
+    size_t count = ARRAY_CARDINALITY(uuids);
+    int ret = -1;
+
+    if (!(iterdata.hash = testHashInit(0)))
+        return -1;
+
+    if (virHashForEachShared(iterdata.hash, testHashForEachSharedIter,
+                             &iterdata) < 0) {
+        VIR_TEST_VERBOSE("\nnested virHashForEachShared failed");
+        goto cleanup;
+    }
+
+    if (iterdata.count != count * count) {
+        VIR_TEST_VERBOSE("\nexpected %zu iterations, got %zu",
+                         count * count, iterdata.count);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(iterdata.hash);
+    return ret;
+}
+
+
 static int
 testHashRemoveSetIter(const void *payload ATTRIBUTE_UNUSED,
                       const void *name,
@@ -597,6 +645,169 @@ testHashEqual(const void *data ATTRIBUTE_UNUSED)
 }
 
 
+#define ATOMIC_THREADS 4
+#define ATOMIC_ROUNDS 1000
+
+/* Counts the updates of a key, dropping it after the last one */
+static int
+testHashAtomicModifier(void **payload,
+                       const void *name ATTRIBUTE_UNUSED,
+                       void *opaque)
+{
+    int *count = *payload;
+    bool *finish = opaque;
+
+    if (!count && VIR_ALLOC(count) < 0)
+        return -1;
+
+    /* removing the entry frees @count */
+    if (++*count == ATOMIC_THREADS * ATOMIC_ROUNDS && *finish) {
+        *payload = NULL;
+        return 0;
+    }
+
+    *payload = count;
+    return 0;
+}
+
+
+struct testHashAtomicData {
+    virHashAtomicPtr hash;
+    bool finish;
+    int ret;
+};
+
+static void
+testHashAtomicWorker(void *opaque)
+{
+    struct testHashAtomicData *data = opaque;
+    size_t i, j;
+
+    for (i = 0; i < ATOMIC_ROUNDS; i++) {
+        for (j = 0; j < ARRAY_CARDINALITY(uuids_subset); j++) {
+            if (virHashAtomicModify(data->hash, uuids_subset[j],
+                                    testHashAtomicModifier,
+                                    &data->finish) < 0)
+                data->ret = -1;
+        }
+    }
+}
+
+
+static int
+testHashAtomic(const void *data ATTRIBUTE_UNUSED)
+{
+    struct testHashAtomicData workers[ATOMIC_THREADS];
+    virThread threads[ATOMIC_THREADS];
+    virHashAtomicPtr hash;
+    size_t nthreads = 0;
+    size_t i;
+    int *count;
+    int ret = -1;
+
+    if (!(hash = virHashAtomicNew(0, virHashValueFree)))
+        return -1;
+
+    /* The last worker to finish removes the entries, the others must
+     * have left all their updates to them */
+    for (i = 0; i < ATOMIC_THREADS; i++) {
+        workers[i].hash = hash;
+        workers[i].finish = i == ATOMIC_THREADS - 1;
+        workers[i].ret = 0;
+    }
+
+    for (i = 0; i < ATOMIC_THREADS - 1; i++) {
+        if (virThreadCreate(&threads[i], true, testHashAtomicWorker,
+                            &workers[i]) < 0)
+            goto cleanup;
+        nthreads++;
+    }
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+    nthreads = 0;
+
+    testHashAtomicWorker(&workers[ATOMIC_THREADS - 1]);
+
+    for (i = 0; i < ATOMIC_THREADS; i++) {
+        if (workers[i].ret < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(uuids_subset); i++) {
+        if ((count = virHashAtomicSteal(hash, uuids_subset[i]))) {
+            VIR_TEST_VERBOSE("\nentry \"%s\" left over with %d updates\n",
+                             uuids_subset[i], *count);
+            VIR_FREE(count);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+    virObjectUnref(hash);
+    return ret;
+}
+
+
+#define MANY_ENTRIES 100000
+
+/* Checks the table with many entries and, with VIR_TEST_DEBUG set,
+ * reports how much memory the table used. virutilbench measures how
+ * fast it is. */
+static int
+testHashManyEntries(const void *data ATTRIBUTE_UNUSED)
+{
+    virHashTablePtr hash = NULL;
+    char **keys = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(keys, MANY_ENTRIES) < 0)
+        return -1;
+
+    for (i = 0; i < MANY_ENTRIES; i++) {
+        if (virAsprintf(&keys[i], "domain-%zu", i) < 0)
+            goto cleanup;
+    }
+
+    if (!(hash = virHashCreate(0, NULL)))
+        goto cleanup;
+
+    for (i = 0; i < MANY_ENTRIES; i++) {
+        if (virHashAddEntry(hash, keys[i], keys[i]) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < MANY_ENTRIES; i++) {
+        if (virHashLookup(hash, keys[i]) != keys[i]) {
+            VIR_TEST_VERBOSE("\nentry \"%s\" could not be found\n", keys[i]);
+            goto cleanup;
+        }
+    }
+
+    if (testHashCheckCount(hash, MANY_ENTRIES) < 0)
+        goto cleanup;
+
+    VIR_TEST_DEBUG("\n%d entries: %zu bytes per entry in %zd slots\n",
+                   MANY_ENTRIES,
+                   virHashTableMemory(hash) / MANY_ENTRIES,
+                   virHashTableSize(hash));
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(hash);
+    for (i = 0; i < MANY_ENTRIES; i++)
+        VIR_FREE(keys[i]);
+    VIR_FREE(keys);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -631,10 +842,13 @@ mymain(void)
     DO_TEST_DATA("Remove in ForEach", RemoveForEach, Forbidden);
     DO_TEST("Steal", Steal);
     DO_TEST("Forbidden ops in ForEach", ForEach);
+    DO_TEST("Nested ForEachShared", ForEachShared);
     DO_TEST("RemoveSet", RemoveSet);
     DO_TEST("Search", Search);
     DO_TEST("GetItems", GetItems);
     DO_TEST("Equal", Equal);
+    DO_TEST("Atomic", Atomic);
+    DO_TEST("Many entries", ManyEntries);
 
     return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -219,6 +219,71 @@ linuxTestNodeCPUStats(const void *data)
 }
 
 
+/* The times of all CPUs read at once must match the statistics of
+ * every single one of them */
+static int
+linuxTestCPUTimes(const void *data)
+{
+    const struct nodeCPUStatsData *testData = data;
+    int ret = -1;
+    char *cpustatfile = NULL;
+    FILE *cpustat = NULL;
+    virHostCPUTimePtr times = NULL;
+    size_t ntimes = 0;
+    virNodeCPUStatsPtr params = NULL;
+    int nparams = 0;
+    size_t i;
+
+    if (virAsprintf(&cpustatfile, "%s/virhostcpudata/linux-cpustat-%s.stat",
+                    abs_srcdir, testData->name) < 0)
+        goto cleanup;
+
+    if (!(cpustat = fopen(cpustatfile, "r"))) {
+        virReportSystemError(errno, "failed to open '%s': ", cpustatfile);
+        goto cleanup;
+    }
+
+    if (virHostCPUGetTimesLinux(cpustat, &times, &ntimes) < 0)
+        goto cleanup;
+
+    if (ntimes != testData->ncpus) {
+        fprintf(stderr, "expected %d CPUs, got %zu\n",
+                testData->ncpus, ntimes);
+        goto cleanup;
+    }
+
+    if (virHostCPUGetStatsLinux(NULL, 0, NULL, &nparams) < 0 ||
+        VIR_ALLOC_N(params, nparams) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ntimes; i++) {
+        unsigned long long busy;
+
+        rewind(cpustat);
+        if (virHostCPUGetStatsLinux(cpustat, i, params, &nparams) < 0)
+            goto cleanup;
+
+        /* kernel, user, idle, iowait */
+        busy = params[0].value + params[1].value;
+        if (times[i].busy != busy ||
+            times[i].total != busy + params[2].value + params[3].value) {
+            fprintf(stderr, "CPU %zu: busy %llu total %llu don't match "
+                    "the statistics\n", i, times[i].busy, times[i].total);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_FCLOSE(cpustat);
+    VIR_FREE(cpustatfile);
+    VIR_FREE(times);
+    VIR_FREE(params);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -258,6 +323,8 @@ mymain(void)
         static struct nodeCPUStatsData data = { name, ncpus }; \
         if (virTestRun("CPU stats " name, linuxTestNodeCPUStats, &data) < 0) \
             ret = -1; \
+        if (virTestRun("CPU times " name, linuxTestCPUTimes, &data) < 0) \
+            ret = -1; \
     } while (0)
 
     DO_TEST_CPU_STATS("24cpu", 24);
@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <sys/stat.h>
+
+#include "testutils.h"
+#include "virleasedb.h"
+#include "virfile.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define SCRATCHDIRTEMPLATE abs_builddir "/leasedbdir-XXXXXX"
+
+static char scratchdir[] = SCRATCHDIRTEMPLATE;
+
+
+struct testCollectData {
+    char **ips;
+    size_t nips;
+};
+
+static int
+testCollect(const virLeaseDBEntry *entry,
+            void *opaque)
+{
+    struct testCollectData *data = opaque;
+    char *ip;
+
+    if (VIR_STRDUP(ip, entry->ip) < 0 ||
+        VIR_APPEND_ELEMENT(data->ips, data->nips, ip) < 0) {
+        VIR_FREE(ip);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+testCollectReset(struct testCollectData *data)
+{
+    while (data->nips)
+        VIR_FREE(data->ips[--data->nips]);
+    VIR_FREE(data->ips);
+}
+
+/* Check that looking up @value gives exactly @ips, in that order */
+static int
+testCheckLookup(virLeaseDBPtr db,
+                virLeaseDBKey key,
+                const char *value,
+                const char **ips)
+{
+    struct testCollectData data = { NULL, 0 };
+    size_t i;
+    int ret = -1;
+
+    if (key == VIR_LEASE_DB_KEY_LAST) {
+        if (virLeaseDBForEach(db, testCollect, &data) < 0)
+            goto cleanup;
+    } else if (virLeaseDBLookup(db, key, value, testCollect, &data) < 0) {
+        goto cleanup;
+    }
+
+    for (i = 0; i < data.nips && ips[i]; i++) {
+        if (STRNEQ(data.ips[i], ips[i])) {
+            fprintf(stderr, "lookup of '%s': expected '%s', got '%s'\n",
+                    NULLSTR(value), ips[i], data.ips[i]);
+            goto cleanup;
+        }
+    }
+
+    if (i != data.nips || ips[i]) {
+        fprintf(stderr, "lookup of '%s': expected %zu leases, got %zu\n",
+                NULLSTR(value), i + virStringListLength(ips + i),
+                data.nips);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    testCollectReset(&data);
+    return ret;
+}
+
+
+static int
+testLeaseDBAdd(virLeaseDBPtr db,
+               const char *ip,
+               const char *mac,
+               const char *hostname)
+{
+    virLeaseDBEntry entry = {
+        .expirytime = 1500000000,
+        .ip = ip,
+        .mac = mac,
+        .hostname = hostname,
+    };
+
+    return virLeaseDBAdd(db, &entry);
+}
+
+
+static int
+testLeaseDBBasic(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virLeaseDBPtr db = NULL;
+    virLeaseDBPtr ro = NULL;
+    char *path = NULL;
+    const char *all[] = { "192.168.122.2", "192.168.122.3",
+                          "2001:db8:ca2:2::10", NULL };
+    const char *foo[] = { "2001:db8:ca2:2::10", "192.168.122.2", NULL };
+    const char *bar[] = { "192.168.122.3", NULL };
+    const char *none[] = { NULL };
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/basic" VIR_LEASE_DB_SUFFIX, scratchdir) < 0)
+        goto cleanup;
+
+    if (virLeaseDBOpen(&ro, path, 0) != 0 || ro) {
+        fprintf(stderr, "missing database not reported as such\n");
+        goto cleanup;
+    }
+
+    if (virLeaseDBOpen(&db, path, VIR_LEASE_DB_OPEN_WRITE) != 1)
+        goto cleanup;
+
+    if (!virLeaseDBIsEmpty(db))
+        goto cleanup;
+
+    if (testLeaseDBAdd(db, "192.168.122.2", "52:54:00:00:00:01", "foo") < 0 ||
+        testLeaseDBAdd(db, "192.168.122.3", "52:54:00:00:00:02", "bar") < 0 ||
+        testLeaseDBAdd(db, "2001:db8:ca2:2::10", "52:54:00:00:00:01",
+                       "foo") < 0)
+        goto cleanup;
+
+    if (testCheckLookup(db, VIR_LEASE_DB_KEY_LAST, NULL, all) < 0 ||
+        testCheckLookup(db, VIR_LEASE_DB_KEY_HOSTNAME, "foo", foo) < 0 ||
+        testCheckLookup(db, VIR_LEASE_DB_KEY_MAC,
+                        "52:54:00:00:00:01", foo) < 0 ||
+        testCheckLookup(db, VIR_LEASE_DB_KEY_IP, "192.168.122.3", bar) < 0 ||
+        testCheckLookup(db, VIR_LEASE_DB_KEY_HOSTNAME, "baz", none) < 0)
+        goto cleanup;
+
+    /* a reader sees what the writer committed */
+    if (virLeaseDBOpen(&ro, path, 0) != 1 ||
+        testCheckLookup(ro, VIR_LEASE_DB_KEY_LAST, NULL, all) < 0 ||
+        testCheckLookup(ro, VIR_LEASE_DB_KEY_HOSTNAME, "bar", bar) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virLeaseDBFree(ro);
+    virLeaseDBFree(db);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+static int
+testLeaseDBReplace(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virLeaseDBPtr db = NULL;
+    char *path = NULL;
+    const char *all[] = { "192.168.122.3", "192.168.122.2", NULL };
+    const char *renamed[] = { "192.168.122.2", NULL };
+    const char *left[] = { "192.168.122.3", NULL };
+    const char *none[] = { NULL };
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/replace" VIR_LEASE_DB_SUFFIX, scratchdir) < 0)
+        goto cleanup;
+
+    if (virLeaseDBOpen(&db, path, VIR_LEASE_DB_OPEN_WRITE) != 1)
+        goto cleanup;
+
+    if (testLeaseDBAdd(db, "192.168.122.2", "52:54:00:00:00:01", "foo") < 0 ||
+        testLeaseDBAdd(db, "192.168.122.3", "52:54:00:00:00:0a", NULL) < 0 ||
+        testLeaseDBAdd(db, "192.168.122.2", "52:54:00:00:00:01", "bar") < 0)
+        goto cleanup;
+
+    if (testCheckLookup(db, VIR_LEASE_DB_KEY_LAST, NULL, all) < 0 ||
+        testCheckLookup(db, VIR_LEASE_DB_KEY_HOSTNAME, "foo", none) < 0 ||
+        testCheckLookup(db, VIR_LEASE_DB_KEY_HOSTNAME, "bar", renamed) < 0 ||
+        testCheckLookup(db, VIR_LEASE_DB_KEY_MAC,
+                        "52:54:00:00:00:01", renamed) < 0)
+        goto cleanup;
+
+    if (virLeaseDBRemove(db, "192.168.122.2") < 0 ||
+        virLeaseDBRemove(db, "192.168.122.9") < 0)
+        goto cleanup;
+
+    if (testCheckLookup(db, VIR_LEASE_DB_KEY_LAST, NULL, left) < 0 ||
+        testCheckLookup(db, VIR_LEASE_DB_KEY_HOSTNAME, "bar", none) < 0 ||
+        /* MAC addresses don't care about case */
+        testCheckLookup(db, VIR_LEASE_DB_KEY_MAC,
+                        "52:54:00:00:00:0A", left) < 0 ||
+        testCheckLookup(db, VIR_LEASE_DB_KEY_MAC,
+                        "52:54:00:00:00:01", none) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virLeaseDBFree(db);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+#define TEST_MANY_LEASES 1000
+
+static int
+testLeaseDBCompact(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virLeaseDBPtr db = NULL;
+    virLeaseDBPtr ro = NULL;
+    char *path = NULL;
+    char ip[32], mac[32], name[32];
+    struct stat before, after;
+    const char *one[] = { ip, NULL };
+    const char *none[] = { NULL };
+    size_t i;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/compact" VIR_LEASE_DB_SUFFIX, scratchdir) < 0)
+        goto cleanup;
+
+    if (virLeaseDBOpen(&db, path, VIR_LEASE_DB_OPEN_WRITE) != 1)
+        goto cleanup;
+
+    /* enough leases for the index to be grown on the way */
+    for (i = 0; i < TEST_MANY_LEASES; i++) {
+        snprintf(ip, sizeof(ip), "10.0.%zu.%zu", i / 250, i % 250 + 1);
+        snprintf(mac, sizeof(mac), "52:54:00:00:%02zx:%02zx",
+                 i / 256, i % 256);
+        snprintf(name, sizeof(name), "guest%zu", i);
+        if (testLeaseDBAdd(db, ip, mac, name) < 0)
+            goto cleanup;
+    }
+
+    /* keep a reader on the file about to be replaced */
+    if (virLeaseDBOpen(&ro, path, 0) != 1 ||
+        stat(path, &before) < 0)
+        goto cleanup;
+
+    for (i = 0; i < TEST_MANY_LEASES - 10; i++) {
+        snprintf(ip, sizeof(ip), "10.0.%zu.%zu", i / 250, i % 250 + 1);
+        if (virLeaseDBRemove(db, ip) < 0)
+            goto cleanup;
+    }
+
+    if (stat(path, &after) < 0)
+        goto cleanup;
+
+    if (after.st_ino == before.st_ino || after.st_size >= before.st_size) {
+        fprintf(stderr, "database was not compacted\n");
+        goto cleanup;
+    }
+
+    for (i = 0; i < TEST_MANY_LEASES; i++) {
+        snprintf(ip, sizeof(ip), "10.0.%zu.%zu", i / 250, i % 250 + 1);
+        snprintf(name, sizeof(name), "guest%zu", i);
+
+        if (testCheckLookup(db, VIR_LEASE_DB_KEY_HOSTNAME, name,
+                            i < TEST_MANY_LEASES - 10 ? none : one) < 0)
+            goto cleanup;
+
+        /* the reader still looking at the replaced file doesn't see
+         * the leases removed after the compaction, but can still use
+         * it without any error */
+        if (i >= TEST_MANY_LEASES - 10 &&
+            testCheckLookup(ro, VIR_LEASE_DB_KEY_HOSTNAME, name, one) < 0)
+            goto cleanup;
+    }
+
+    /* and a new one sees the compacted database */
+    virLeaseDBFree(ro);
+    if (virLeaseDBOpen(&ro, path, 0) != 1 ||
+        testCheckLookup(ro, VIR_LEASE_DB_KEY_MAC,
+                        "52:54:00:00:03:e7", one) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virLeaseDBFree(ro);
+    virLeaseDBFree(db);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (!mkdtemp(scratchdir)) {
+        virFilePrintf(stderr, "Cannot create leasedbdir");
+        abort();
+    }
+
+    if (virTestRun("Lease database basic", testLeaseDBBasic, NULL) < 0)
+        ret = -1;
+    if (virTestRun("Lease database replace", testLeaseDBReplace, NULL) < 0)
+        ret = -1;
+    if (virTestRun("Lease database compaction", testLeaseDBCompact, NULL) < 0)
+        ret = -1;
+
+    if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(scratchdir);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
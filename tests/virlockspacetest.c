@@ -30,6 +30,7 @@
 #include "viralloc.h"
 #include "virfile.h"
 #include "virlog.h"
+#include "virstring.h"
 
 #include "virlockspace.h"
 
@@ -340,6 +341,65 @@ static int testLockSpaceResourceLockPath(const void *args ATTRIBUTE_UNUSED)
 
 
 
+static int testLockSpaceResourceReleaseOwner(const void *args ATTRIBUTE_UNUSED)
+{
+    virLockSpacePtr lockspace;
+    pid_t owner = geteuid();
+    pid_t other = owner + 1;
+    char name[32];
+    char *path = NULL;
+    int ret = -1;
+    size_t i;
+
+    rmdir(LOCKSPACE_DIR);
+
+    if (!(lockspace = virLockSpaceNew(LOCKSPACE_DIR)))
+        goto cleanup;
+
+    /* Enough resources to end up in all the shards */
+    for (i = 0; i < 64; i++) {
+        snprintf(name, sizeof(name), "res%zu", i);
+        if (virLockSpaceAcquireResource(lockspace, name, i % 4 ? owner : other,
+                                        VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE) < 0)
+            goto cleanup;
+    }
+
+    if (virLockSpaceReleaseResourcesForOwner(lockspace, owner) != 48)
+        goto cleanup;
+
+    for (i = 0; i < 64; i++) {
+        snprintf(name, sizeof(name), "res%zu", i);
+        if (i % 4) {
+            if (virLockSpaceAcquireResource(lockspace, name, owner,
+                                            VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE) < 0)
+                goto cleanup;
+        } else {
+            if (virLockSpaceAcquireResource(lockspace, name, owner,
+                                            VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE) == 0)
+                goto cleanup;
+            virResetLastError();
+        }
+    }
+
+    if (virLockSpaceReleaseResourcesForOwner(lockspace, owner) != 48 ||
+        virLockSpaceReleaseResourcesForOwner(lockspace, other) != 16)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virLockSpaceFree(lockspace);
+    for (i = 0; i < 64; i++) {
+        if (virAsprintf(&path, LOCKSPACE_DIR "/res%zu", i) < 0)
+            break;
+        unlink(path);
+        VIR_FREE(path);
+    }
+    rmdir(LOCKSPACE_DIR);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -368,6 +428,9 @@ mymain(void)
     if (virTestRun("Lockspace res full path", testLockSpaceResourceLockPath, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Lockspace res release owner", testLockSpaceResourceReleaseOwner, NULL) < 0)
+        ret = -1;
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -21,7 +21,13 @@
 
 #include "testutils.h"
 
+#include "viralloc.h"
 #include "virlog.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("tests.logtest");
 
 struct testLogData {
     const char *str;
@@ -107,6 +113,132 @@ testLogParseFilters(const void *opaque)
     return ret;
 }
 
+static int testLogQueueCount;
+static bool testLogQueueOrdered;
+
+static void
+testLogQueueOutput(virLogSourcePtr source,
+                   virLogPriority priority ATTRIBUTE_UNUSED,
+                   const char *filename ATTRIBUTE_UNUSED,
+                   int linenr ATTRIBUTE_UNUSED,
+                   const char *funcname ATTRIBUTE_UNUSED,
+                   const char *timestamp ATTRIBUTE_UNUSED,
+                   virLogMetadataPtr metadata ATTRIBUTE_UNUSED,
+                   unsigned int flags ATTRIBUTE_UNUSED,
+                   const char *rawstr,
+                   const char *str ATTRIBUTE_UNUSED,
+                   void *data ATTRIBUTE_UNUSED)
+{
+    int n;
+
+    if (source != &virLogSelf)
+        return;
+
+    if (virStrToLong_i(rawstr, NULL, 10, &n) < 0 ||
+        n != testLogQueueCount)
+        testLogQueueOrdered = false;
+    testLogQueueCount++;
+}
+
+static int
+testLogSetOutput(virLogPriority priority)
+{
+    virLogOutputPtr *outputs = NULL;
+
+    testLogQueueCount = 0;
+    testLogQueueOrdered = true;
+
+    if (VIR_ALLOC_N(outputs, 1) < 0)
+        return -1;
+
+    if (!(outputs[0] = virLogOutputNew(testLogQueueOutput, NULL, NULL,
+                                       VIR_LOG_DEBUG, VIR_LOG_TO_STDERR,
+                                       NULL)) ||
+        virLogDefineOutputs(outputs, 1) < 0) {
+        virLogOutputListFree(outputs, 1);
+        return -1;
+    }
+
+    return virLogSetDefaultPriority(priority);
+}
+
+static int
+testLogEnabled(const void *opaque ATTRIBUTE_UNUSED)
+{
+    int evaluated = 0;
+    int ret = -1;
+
+    if (testLogSetOutput(VIR_LOG_WARN) < 0)
+        goto cleanup;
+
+    /* the first message updates the priority cached by the source */
+    VIR_WARN("%d", evaluated++);
+    VIR_INFO("%d", evaluated++);
+    if (evaluated != 1) {
+        VIR_TEST_DEBUG("Arguments of a disabled message were evaluated\n");
+        goto cleanup;
+    }
+
+    /* changing the default priority invalidates it */
+    if (virLogSetDefaultPriority(VIR_LOG_INFO) < 0)
+        goto cleanup;
+    VIR_INFO("%d", evaluated++);
+    if (evaluated != 2 || testLogQueueCount != 2) {
+        VIR_TEST_DEBUG("Expected 2 messages, got %d\n", testLogQueueCount);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virLogReset();
+    return ret;
+}
+
+static int
+testLogQueue(const void *opaque ATTRIBUTE_UNUSED)
+{
+    int ret = -1;
+    int i;
+
+    if (testLogSetOutput(VIR_LOG_INFO) < 0)
+        goto cleanup;
+
+    if (virLogSetAsync(1000) < 0)
+        goto cleanup;
+
+    for (i = 0; i < 100; i++)
+        VIR_INFO("%d", i);
+
+    /* errors are written right away, after what was queued */
+    VIR_ERROR("%d", i);
+    if (testLogQueueCount != 101) {
+        VIR_TEST_DEBUG("Expected 101 messages, got %d\n", testLogQueueCount);
+        goto cleanup;
+    }
+
+    for (i = 101; i < 200; i++)
+        VIR_INFO("%d", i);
+
+    if (virLogSetAsync(0) < 0)
+        goto cleanup;
+
+    if (testLogQueueCount != 200) {
+        VIR_TEST_DEBUG("Expected 200 messages, got %d\n", testLogQueueCount);
+        goto cleanup;
+    }
+
+    if (!testLogQueueOrdered) {
+        VIR_TEST_DEBUG("Messages were written out of order\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virLogSetAsync(0);
+    virLogReset();
+    return ret;
+}
+
 static int
 mymain(void)
 {
@@ -151,6 +283,11 @@ mymain(void)
     TEST_PARSE_FILTERS_FAIL(":foo", 1);
     TEST_PARSE_FILTERS_FAIL("1:+", 1);
 
+    if (virTestRun("testLogEnabled", testLogEnabled, NULL) < 0)
+        ret = -1;
+    if (virTestRun("testLogQueue", testLogQueue, NULL) < 0)
+        ret = -1;
+
     return ret;
 }
 
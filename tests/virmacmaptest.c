@@ -22,9 +22,14 @@
 
 #include "testutils.h"
 #include "virmacmap.h"
+#include "virfile.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
+#define SCRATCHDIRTEMPLATE abs_builddir "/virmacmapdir-XXXXXX"
+
+static char scratchdir[] = SCRATCHDIRTEMPLATE;
+
 struct testData {
     const char *file;
     const char *domain;
@@ -151,12 +156,133 @@ testMACFlush(const void *opaque)
 }
 
 
+/* Check that loading @file gives the same MACs as @mgr has */
+static int
+testMACCompareLoaded(virMacMapPtr mgr,
+                     const char *file)
+{
+    const char *domains[] = { "f24", "f25", "f26", "f27" };
+    virMacMapPtr loaded = NULL;
+    size_t i, j;
+    int ret = -1;
+
+    if (!(loaded = virMacMapNew(file)))
+        goto cleanup;
+
+    for (i = 0; i < ARRAY_CARDINALITY(domains); i++) {
+        const char * const *expect = virMacMapLookup(mgr, domains[i]);
+        const char * const *actual = virMacMapLookup(loaded, domains[i]);
+
+        if (virStringListLength(expect) != virStringListLength(actual)) {
+            fprintf(stderr, "Expected %zu MACs for %s, got %zu\n",
+                    virStringListLength(expect), domains[i],
+                    virStringListLength(actual));
+            goto cleanup;
+        }
+
+        for (j = 0; expect && expect[j]; j++) {
+            if (!virStringListHasString((const char **) actual, expect[j])) {
+                fprintf(stderr, "Expected %s in the MACs of %s\n",
+                        expect[j], domains[i]);
+                goto cleanup;
+            }
+        }
+    }
+
+    ret = 0;
+ cleanup:
+    virObjectUnref(loaded);
+    return ret;
+}
+
+
+static int
+testMACLog(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virMacMapPtr mgr = NULL;
+    char *file = NULL;
+    char *log = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (virAsprintf(&file, "%s/virbr0.macs", scratchdir) < 0 ||
+        virAsprintf(&log, "%s" VIR_MAC_MAP_LOG_SUFFIX, file) < 0)
+        goto cleanup;
+
+    if (!(mgr = virMacMapNew(file)))
+        goto cleanup;
+
+    /* changes go to the log only */
+    if (virMacMapAdd(mgr, "f24", "aa:bb:cc:dd:ee:ff") < 0 ||
+        virMacMapWriteFile(mgr, file) < 0 ||
+        virMacMapAdd(mgr, "f24", "a1:b2:c3:d4:e5:f6") < 0 ||
+        virMacMapAdd(mgr, "f25", "00:11:22:33:44:55") < 0 ||
+        virMacMapWriteFile(mgr, file) < 0 ||
+        virMacMapRemove(mgr, "f24", "aa:bb:cc:dd:ee:ff") < 0 ||
+        virMacMapWriteFile(mgr, file) < 0)
+        goto cleanup;
+
+    if (virFileExists(file) || !virFileExists(log)) {
+        fprintf(stderr, "changes were not appended to the log\n");
+        goto cleanup;
+    }
+
+    if (testMACCompareLoaded(mgr, file) < 0)
+        goto cleanup;
+
+    /* until there are enough of them for the log to be folded */
+    for (i = 0; i < 100 && virFileExists(log); i++) {
+        if (virMacMapRemove(mgr, "f25", "00:11:22:33:44:55") < 0 ||
+            virMacMapAdd(mgr, "f25", "00:11:22:33:44:55") < 0 ||
+            virMacMapWriteFile(mgr, file) < 0)
+            goto cleanup;
+    }
+
+    if (!virFileExists(file) || virFileExists(log)) {
+        fprintf(stderr, "log was not folded into the file\n");
+        goto cleanup;
+    }
+
+    /* an incomplete change at the end of the log is ignored, and
+     * the next write replaces the log */
+    if (virFileWriteStr(log, "{\"domain\":\"f26\",\"add", 0644) < 0 ||
+        testMACCompareLoaded(mgr, file) < 0)
+        goto cleanup;
+
+    virObjectUnref(mgr);
+    if (!(mgr = virMacMapNew(file)) ||
+        virMacMapAdd(mgr, "f26", "aa:bb:cc:00:11:22") < 0 ||
+        virMacMapWriteFile(mgr, file) < 0)
+        goto cleanup;
+
+    if (virFileExists(log)) {
+        fprintf(stderr, "incomplete log was not replaced\n");
+        goto cleanup;
+    }
+
+    if (testMACCompareLoaded(mgr, file) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(file);
+    VIR_FREE(log);
+    virObjectUnref(mgr);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
     int ret = 0;
     virMacMapPtr mgr = NULL;
 
+    if (!mkdtemp(scratchdir)) {
+        virFilePrintf(stderr, "Cannot create virmacmapdir");
+        abort();
+    }
+
 #define DO_TEST_BASIC(f, d, ...)                                    \
     do {                                                            \
         const char * const m[] = {__VA_ARGS__, NULL };              \
@@ -230,7 +356,14 @@ mymain(void)
     DO_TEST_FLUSH("dom1", "9e:89:49:99:51:0e", "89:b4:3f:08:88:2c", "54:0b:4c:e2:0a:39");
     DO_TEST_FLUSH("dom1", "bb:88:07:19:51:9d", "b7:f1:1a:40:a2:95", "88:94:39:a3:90:b4");
     DO_TEST_FLUSH_EPILOGUE("complex");
+
+    if (virTestRun("Log", testMACLog, NULL) < 0)
+        ret = -1;
+
  cleanup:
+    if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(scratchdir);
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -23,7 +23,8 @@
 #include "testutils.h"
 #define __VIR_COMMAND_PRIV_H_ALLOW__
 #include "vircommandpriv.h"
-#include "virnetdevbandwidth.h"
+#define __VIR_NETDEV_BANDWIDTH_PRIV_H_ALLOW__
+#include "virnetdevbandwidthpriv.h"
 #include "netdev_bandwidth_conf.c"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -115,6 +116,10 @@ mymain(void)
 {
     int ret = 0;
 
+    /* The expected output is a list of tc(8) invocations */
+    if (virNetDevBandwidthSetBackend(VIR_NETDEV_BANDWIDTH_BACKEND_TC) < 0)
+        return EXIT_FAILURE;
+
 #define DO_TEST_SET(Band, Exp_cmd, ...)                     \
     do {                                                    \
         struct testSetStruct data = {.band = Band,          \
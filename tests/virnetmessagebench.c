@@ -0,0 +1,167 @@
+/*
+ * virnetmessagebench.c: benchmarks of RPC message encoding and decoding
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <signal.h>
+
+#include "testutils.h"
+#include "virerror.h"
+#include "virlog.h"
+#include "rpc/virnetmessage.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+VIR_LOG_INIT("tests.netmessagebench");
+
+#define BENCH_STREAM_SIZE (64 * 1024)
+
+
+static void
+benchMessageSetHeader(virNetMessagePtr msg,
+                      virNetMessageType type,
+                      virNetMessageStatus status)
+{
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = type;
+    msg->header.serial = 0x99;
+    msg->header.status = status;
+}
+
+
+/* Encodes an error reply and decodes it again the way virNetSocket
+ * reads it, first the length and then the rest */
+static int
+benchMessageErrorRoundTrip(const void *data)
+{
+    virNetMessageErrorPtr err = (virNetMessageErrorPtr) data;
+    virNetMessageError decoded;
+    virNetMessagePtr msg = NULL;
+    virNetMessagePtr reply = NULL;
+    int ret = -1;
+
+    memset(&decoded, 0, sizeof(decoded));
+
+    if (!(msg = virNetMessageNew(true)) ||
+        !(reply = virNetMessageNew(true)))
+        goto cleanup;
+
+    benchMessageSetHeader(msg, VIR_NET_REPLY, VIR_NET_ERROR);
+
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetMessageError,
+                                   err) < 0)
+        goto cleanup;
+
+    reply->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+    if (VIR_ALLOC_N(reply->buffer, reply->bufferLength) < 0)
+        goto cleanup;
+    memcpy(reply->buffer, msg->buffer, reply->bufferLength);
+
+    if (virNetMessageDecodeLength(reply) < 0)
+        goto cleanup;
+
+    memcpy(reply->buffer, msg->buffer, reply->bufferLength);
+
+    if (virNetMessageDecodeHeader(reply) < 0 ||
+        virNetMessageDecodePayload(reply, (xdrproc_t)xdr_virNetMessageError,
+                                   &decoded) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    xdr_free((xdrproc_t)xdr_virNetMessageError, (void *)&decoded);
+    virNetMessageFree(reply);
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
+static int
+benchMessageStreamEncode(const void *data)
+{
+    virNetMessagePtr msg;
+    int ret = -1;
+
+    if (!(msg = virNetMessageNew(true)))
+        return -1;
+
+    benchMessageSetHeader(msg, VIR_NET_STREAM, VIR_NET_CONTINUE);
+
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayloadRaw(msg, data, BENCH_STREAM_SIZE) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    virNetMessageError err;
+    char *stream = NULL;
+    int ret = -1;
+    size_t i;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    memset(&err, 0, sizeof(err));
+
+    err.code = VIR_ERR_OPERATION_INVALID;
+    err.domain = VIR_FROM_QEMU;
+    err.level = VIR_ERR_ERROR;
+
+    if (VIR_ALLOC(err.message) < 0 ||
+        VIR_STRDUP(*err.message,
+                   "Requested operation is not valid: domain is not running") < 0 ||
+        VIR_ALLOC(err.str1) < 0 ||
+        VIR_STRDUP(*err.str1, "domain is not running") < 0)
+        goto cleanup;
+
+    if (VIR_ALLOC_N(stream, BENCH_STREAM_SIZE) < 0)
+        goto cleanup;
+    for (i = 0; i < BENCH_STREAM_SIZE; i++)
+        stream[i] = i % 251;
+
+    ret = 0;
+
+    if (virTestBench("Message error reply encode and decode",
+                     benchMessageErrorRoundTrip, &err) < 0)
+        ret = -1;
+
+    if (virTestBench("Message 64KiB stream payload encode",
+                     benchMessageStreamEncode, stream) < 0)
+        ret = -1;
+
+ cleanup:
+    xdr_free((xdrproc_t)xdr_virNetMessageError, (void *)&err);
+    VIR_FREE(stream);
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
@@ -291,6 +291,74 @@ static int testMessagePayloadEncode(const void *args ATTRIBUTE_UNUSED)
     return ret;
 }
 
+static int testMessagePayloadEncodeLarge(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessageError err;
+    virNetMessagePtr msg = virNetMessageNew(true);
+    size_t msglen = 100000;
+    size_t expectlen;
+    int ret = -1;
+
+    if (!msg)
+        return -1;
+
+    memset(&err, 0, sizeof(err));
+
+    err.code = VIR_ERR_INTERNAL_ERROR;
+    err.domain = VIR_FROM_RPC;
+    err.level = VIR_ERR_ERROR;
+
+    /* Make the payload exceed the initial buffer */
+    if (VIR_ALLOC(err.message) < 0 ||
+        VIR_ALLOC_N(*err.message, msglen + 1) < 0)
+        goto cleanup;
+    memset(*err.message, 'x', msglen);
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_MESSAGE;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_ERROR;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetMessageError, &err) < 0)
+        goto cleanup;
+
+    /* Length and header, 12 words of error fields and the message */
+    expectlen = 4 + 24 + 12 * 4 + msglen;
+    if (msg->bufferLength != expectlen) {
+        VIR_DEBUG("Expect message length %zu got %zu",
+                  expectlen, msg->bufferLength);
+        goto cleanup;
+    }
+
+    if (msg->bufferOffset != 0) {
+        VIR_DEBUG("Expect message offset 0 got %zu",
+                  msg->bufferOffset);
+        goto cleanup;
+    }
+
+    if (((unsigned char)msg->buffer[0] << 24 |
+         (unsigned char)msg->buffer[1] << 16 |
+         (unsigned char)msg->buffer[2] << 8 |
+         (unsigned char)msg->buffer[3]) != expectlen) {
+        VIR_DEBUG("Length word doesn't match message length %zu",
+                  expectlen);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    if (err.message)
+        VIR_FREE(*err.message);
+    VIR_FREE(err.message);
+    virNetMessageFree(msg);
+    return ret;
+}
+
 static int testMessagePayloadDecode(const void *args ATTRIBUTE_UNUSED)
 {
     virNetMessageError err;
@@ -521,6 +589,188 @@ static int testMessagePayloadStreamEncode(const void *args ATTRIBUTE_UNUSED)
     return ret;
 }
 
+static int testMessagePayloadStreamEncodeRef(const void *args ATTRIBUTE_UNUSED)
+{
+    char stream[] = "The quick brown fox jumps over the lazy dog";
+    virNetMessagePtr msg = virNetMessageNew(true);
+    static const char expect[] = {
+        0x00, 0x00, 0x00, 0x47,  /* Length */
+        0x11, 0x22, 0x33, 0x44,  /* Program */
+        0x00, 0x00, 0x00, 0x01,  /* Version */
+        0x00, 0x00, 0x06, 0x66,  /* Procedure */
+        0x00, 0x00, 0x00, 0x03,  /* Type */
+        0x00, 0x00, 0x00, 0x99,  /* Serial */
+        0x00, 0x00, 0x00, 0x02,  /* Status */
+    };
+    int ret = -1;
+
+    if (!msg)
+        return -1;
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_STREAM;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayloadRef(msg, stream, strlen(stream)) < 0)
+        goto cleanup;
+
+    /* Only the header is in the buffer, the length covers the data */
+    if (ARRAY_CARDINALITY(expect) != msg->bufferLength) {
+        VIR_DEBUG("Expect message length %zu got %zu",
+                  sizeof(expect), msg->bufferLength);
+        goto cleanup;
+    }
+
+    if (memcmp(expect, msg->buffer, sizeof(expect)) != 0) {
+        virTestDifferenceBin(stderr, expect, msg->buffer, sizeof(expect));
+        goto cleanup;
+    }
+
+    if (msg->data != stream ||
+        msg->dataLength != strlen(stream) ||
+        msg->dataOffset != 0) {
+        VIR_DEBUG("Expect data %p/%zu got %p/%zu",
+                  stream, strlen(stream), msg->data, msg->dataLength);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virNetMessageFree(msg);
+    return ret;
+}
+
+static int testMessagePayloadBatch(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessageBatch batch;
+    virNetMessageBatch decoded;
+    virNetMessageBatchCall calls[2];
+    virNetMessagePtr msg = virNetMessageNew(true);
+    char args0[] = { 0x00, 0x00, 0x00, 0x2a };
+    int ret = -1;
+
+    memset(&batch, 0, sizeof(batch));
+    memset(&decoded, 0, sizeof(decoded));
+    memset(calls, 0, sizeof(calls));
+
+    if (!msg)
+        return -1;
+
+    calls[0].proc = 0x10;
+    calls[0].args.args_len = sizeof(args0);
+    calls[0].args.args_val = args0;
+    calls[1].proc = 0x20;
+
+    batch.calls.calls_len = ARRAY_CARDINALITY(calls);
+    batch.calls.calls_val = calls;
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.type = VIR_NET_CALL_BATCH;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_OK;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetMessageBatch,
+                                   &batch) < 0)
+        goto cleanup;
+
+    /* Length and header, number of calls, then proc, length and
+     * args of each call */
+    if (msg->bufferLength != 4 + 24 + 4 + (8 + sizeof(args0)) + 8) {
+        VIR_DEBUG("Unexpected batch length %zu", msg->bufferLength);
+        goto cleanup;
+    }
+
+    /* Read it back as if it was just received */
+    msg->bufferLength = 4;
+    if (virNetMessageDecodeLength(msg) < 0 ||
+        virNetMessageDecodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (msg->header.type != VIR_NET_CALL_BATCH) {
+        VIR_DEBUG("Expect type %d got %d",
+                  VIR_NET_CALL_BATCH, msg->header.type);
+        goto cleanup;
+    }
+
+    if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetMessageBatch,
+                                   &decoded) < 0)
+        goto cleanup;
+
+    if (decoded.calls.calls_len != 2 ||
+        decoded.calls.calls_val[0].proc != 0x10 ||
+        decoded.calls.calls_val[0].args.args_len != sizeof(args0) ||
+        memcmp(decoded.calls.calls_val[0].args.args_val, args0,
+               sizeof(args0)) != 0 ||
+        decoded.calls.calls_val[1].proc != 0x20 ||
+        decoded.calls.calls_val[1].args.args_len != 0) {
+        VIR_DEBUG("Decoded batch doesn't match");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    xdr_free((xdrproc_t)xdr_virNetMessageBatch, (void*)&decoded);
+    virNetMessageFree(msg);
+    return ret;
+}
+
+static int testMessageRecycle(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessagePtr msg = virNetMessageNew(true);
+    char *buffer;
+    size_t bufferAlloc;
+    int ret = -1;
+
+    if (!msg)
+        return -1;
+
+    msg->header.prog = 0x11223344;
+    msg->header.serial = 0x99;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    buffer = msg->buffer;
+    bufferAlloc = msg->bufferAlloc;
+
+    virNetMessageRecycle(msg, VIR_NET_MESSAGE_RECYCLE_MAX);
+
+    if (msg->buffer != buffer || msg->bufferAlloc != bufferAlloc) {
+        VIR_DEBUG("Expect buffer %p size %zu got %p size %zu",
+                  buffer, bufferAlloc, msg->buffer, msg->bufferAlloc);
+        goto cleanup;
+    }
+
+    if (msg->bufferLength != 0 || msg->bufferOffset != 0 ||
+        msg->header.prog != 0 || msg->header.serial != 0 || !msg->tracked) {
+        VIR_DEBUG("Expect message to be reset");
+        goto cleanup;
+    }
+
+    /* Buffers over the limit are not kept */
+    virNetMessageRecycle(msg, bufferAlloc - 1);
+
+    if (msg->buffer || msg->bufferAlloc != 0) {
+        VIR_DEBUG("Expect buffer to be freed");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virNetMessageFree(msg);
+    return ret;
+}
+
 
 static int
 mymain(void)
@@ -538,12 +788,25 @@ mymain(void)
     if (virTestRun("Message Payload Encode", testMessagePayloadEncode, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Message Payload Encode Large", testMessagePayloadEncodeLarge, NULL) < 0)
+        ret = -1;
+
     if (virTestRun("Message Payload Decode", testMessagePayloadDecode, NULL) < 0)
         ret = -1;
 
     if (virTestRun("Message Payload Stream Encode", testMessagePayloadStreamEncode, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Message Payload Stream Encode Ref",
+                   testMessagePayloadStreamEncodeRef, NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("Message Payload Batch", testMessagePayloadBatch, NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("Message Recycle", testMessageRecycle, NULL) < 0)
+        ret = -1;
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+#include "virerror.h"
+#include "rpc/virnetserverprogram.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+#define TEST_PROGRAM 0x11223344
+#define TEST_VERSION 1
+
+enum {
+    TEST_PROC_LOW = 1,
+    TEST_PROC_HIGH = 2,
+};
+
+static int
+testDispatch(virNetServerPtr server ATTRIBUTE_UNUSED,
+             virNetServerClientPtr client ATTRIBUTE_UNUSED,
+             virNetMessagePtr msg ATTRIBUTE_UNUSED,
+             virNetMessageErrorPtr rerr ATTRIBUTE_UNUSED,
+             void *args ATTRIBUTE_UNUSED,
+             void *ret ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+static virNetServerProgramProc testProcs[] = {
+    { NULL, 0, (xdrproc_t)xdr_void, 0, (xdrproc_t)xdr_void, true, 0, false },
+    { testDispatch, 0, (xdrproc_t)xdr_void, 0, (xdrproc_t)xdr_void,
+      true, 0, false },
+    { testDispatch, 0, (xdrproc_t)xdr_void, 0, (xdrproc_t)xdr_void,
+      true, 1, false },
+};
+
+struct testPriorityData {
+    int type;
+    int proc;
+    unsigned int priority;
+};
+
+static int
+testPriority(const void *opaque)
+{
+    const struct testPriorityData *data = opaque;
+    virNetServerProgramPtr prog;
+    virNetMessageHeader header;
+    unsigned int priority;
+    int ret = -1;
+
+    if (!(prog = virNetServerProgramNew(TEST_PROGRAM, TEST_VERSION, testProcs,
+                                        ARRAY_CARDINALITY(testProcs))))
+        return -1;
+
+    memset(&header, 0, sizeof(header));
+    header.prog = TEST_PROGRAM;
+    header.vers = TEST_VERSION;
+    header.type = data->type;
+    header.proc = data->proc;
+
+    if ((priority = virNetServerProgramGetPriority(prog, &header)) !=
+        data->priority) {
+        VIR_TEST_DEBUG("Expected priority %u, got %u\n",
+                       data->priority, priority);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(prog);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#define DO_TEST_PRIORITY(name, msgtype, msgproc, prio)                 \
+    do {                                                                \
+        struct testPriorityData data = {                                \
+            .type = msgtype, .proc = msgproc, .priority = prio,         \
+        };                                                              \
+        if (virTestRun("Priority " name, testPriority, &data) < 0)      \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST_PRIORITY("low priority call", VIR_NET_CALL, TEST_PROC_LOW, 0);
+    DO_TEST_PRIORITY("high priority call", VIR_NET_CALL, TEST_PROC_HIGH, 1);
+    DO_TEST_PRIORITY("unknown call", VIR_NET_CALL, 42, 0);
+    DO_TEST_PRIORITY("batch", VIR_NET_CALL_BATCH, 0, 0);
+    DO_TEST_PRIORITY("batch naming a high priority call",
+                     VIR_NET_CALL_BATCH, TEST_PROC_HIGH, 0);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
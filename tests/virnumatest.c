@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+#include "virnuma.h"
+#include "virsysfspriv.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* The pools in virnumamock.c have 4096 pages of 2 MiB on node 0,
+ * 6144 on node 1 and 67584 on the host as a whole */
+#define PAGE_SIZE_2M 2048
+
+
+static int
+testCheckReserved(virNumaPageLedgerPtr ledger,
+                  int node,
+                  unsigned long long expected)
+{
+    unsigned int pagesize = PAGE_SIZE_2M;
+    unsigned long long count;
+
+    if (virNumaPageLedgerGetReserved(ledger, 1, &pagesize,
+                                     node, 1, &count) != 1)
+        return -1;
+
+    if (count != expected) {
+        fprintf(stderr, "node %d: expected %llu reserved pages, got %llu\n",
+                node, expected, count);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+testNumaPageLedgerNode(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNumaPageLedgerPtr ledger = NULL;
+    virNumaPageReservation all = { 0, PAGE_SIZE_2M, 4096 };
+    virNumaPageReservation most = { 0, PAGE_SIZE_2M, 4000 };
+    virNumaPageReservation one = { 0, PAGE_SIZE_2M, 1 };
+    virNumaPageReservation other = { 1, PAGE_SIZE_2M, 6144 };
+    int ret = -1;
+
+    if (!(ledger = virNumaPageLedgerNew()))
+        goto cleanup;
+
+    if (virNumaPageLedgerReserve(ledger, "a", &most, 1, false) < 0 ||
+        virNumaPageLedgerReserve(ledger, "b", &other, 1, false) < 0 ||
+        testCheckReserved(ledger, 0, 4000) < 0 ||
+        testCheckReserved(ledger, 1, 6144) < 0 ||
+        testCheckReserved(ledger, -1, 10144) < 0)
+        goto cleanup;
+
+    /* replacing a reservation doesn't count the old one */
+    if (virNumaPageLedgerReserve(ledger, "a", &all, 1, false) < 0 ||
+        testCheckReserved(ledger, 0, 4096) < 0)
+        goto cleanup;
+
+    if (virNumaPageLedgerReserve(ledger, "c", &one, 1, false) == 0) {
+        fprintf(stderr, "overcommitted node 0\n");
+        goto cleanup;
+    }
+
+    /* a failed reservation leaves the ledger as it was */
+    if (testCheckReserved(ledger, 0, 4096) < 0)
+        goto cleanup;
+
+    virNumaPageLedgerRelease(ledger, "a");
+    if (testCheckReserved(ledger, 0, 0) < 0 ||
+        virNumaPageLedgerReserve(ledger, "c", &one, 1, false) < 0 ||
+        testCheckReserved(ledger, 0, 1) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(ledger);
+    return ret;
+}
+
+
+static int
+testNumaPageLedgerHost(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNumaPageLedgerPtr ledger = NULL;
+    virNumaPageReservation any = { -1, PAGE_SIZE_2M, 67584 - 4096 };
+    virNumaPageReservation node[] = { { 0, PAGE_SIZE_2M, 4096 },
+                                      { -1, 1048576, 1 } };
+    virNumaPageReservation unknown = { 0, 16, 1000000 };
+    int ret = -1;
+
+    if (!(ledger = virNumaPageLedgerNew()))
+        goto cleanup;
+
+    if (virNumaPageLedgerReserve(ledger, "a", &any, 1, false) < 0 ||
+        virNumaPageLedgerReserve(ledger, "b", node, 2, false) < 0 ||
+        testCheckReserved(ledger, 0, 4096) < 0 ||
+        testCheckReserved(ledger, -1, 67584) < 0)
+        goto cleanup;
+
+    /* node 1 has pages left, but the host doesn't */
+    node[0].node = 1;
+    if (virNumaPageLedgerReserve(ledger, "c", node, 1, false) == 0) {
+        fprintf(stderr, "overcommitted the host\n");
+        goto cleanup;
+    }
+
+    /* unless told to not check at all */
+    if (virNumaPageLedgerReserve(ledger, "c", node, 1, true) < 0 ||
+        testCheckReserved(ledger, 1, 4096) < 0)
+        goto cleanup;
+
+    /* pools the ledger doesn't know about are not checked */
+    if (virNumaPageLedgerReserve(ledger, "d", &unknown, 1, false) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(ledger);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    virSysfsSetSystemPath(abs_srcdir "/vircaps2xmldata/linux-basic");
+
+    if (virTestRun("Huge page ledger per node",
+                   testNumaPageLedgerNode, NULL) < 0)
+        ret = -1;
+    if (virTestRun("Huge page ledger for the host",
+                   testNumaPageLedgerHost, NULL) < 0)
+        ret = -1;
+
+    virSysfsSetSystemPath(NULL);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN_PRELOAD(mymain, abs_builddir "/.libs/virnumamock.so")
@@ -152,6 +152,54 @@ static int testAllocReuse(const void *args ATTRIBUTE_UNUSED)
 }
 
 
+static int testAllocSetUsed(const void *args ATTRIBUTE_UNUSED)
+{
+    virPortAllocatorPtr alloc = virPortAllocatorNew("test", 5900, 5910, 0);
+    int ret = -1;
+    unsigned short p1, p2, p3;
+
+    if (!alloc)
+        return -1;
+
+    if (virPortAllocatorSetUsed(alloc, 5901, true) < 0 ||
+        virPortAllocatorSetUsed(alloc, 5902, true) < 0)
+        goto cleanup;
+
+    if (virPortAllocatorAcquire(alloc, &p1) < 0)
+        goto cleanup;
+    if (p1 != 5903) {
+        VIR_TEST_DEBUG("Expected 5903, got %d", p1);
+        goto cleanup;
+    }
+
+    if (virPortAllocatorSetUsed(alloc, 5902, false) < 0)
+        goto cleanup;
+
+    if (virPortAllocatorAcquire(alloc, &p2) < 0)
+        goto cleanup;
+    if (p2 != 5902) {
+        VIR_TEST_DEBUG("Expected 5902, got %d", p2);
+        goto cleanup;
+    }
+
+    if (virPortAllocatorRelease(alloc, 5901) < 0)
+        goto cleanup;
+
+    /* 5900 is in use by someone else, the next free port is 5901 */
+    if (virPortAllocatorAcquire(alloc, &p3) < 0)
+        goto cleanup;
+    if (p3 != 5901) {
+        VIR_TEST_DEBUG("Expected 5901, got %d", p3);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virObjectUnref(alloc);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -163,6 +211,9 @@ mymain(void)
     if (virTestRun("Test alloc reuse", testAllocReuse, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Test alloc set used", testAllocSetUsed, NULL) < 0)
+        ret = -1;
+
     setenv("LIBVIRT_TEST_IPV4ONLY", "really", 1);
 
     if (virTestRun("Test IPv4-only alloc all", testAllocAll, NULL) < 0)
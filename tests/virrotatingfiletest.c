@@ -473,6 +473,73 @@ static int testRotatingFileWriterRolloverMany(const void *data ATTRIBUTE_UNUSED)
 }
 
 
+static int testRotatingFileWriterBuffered(const void *data ATTRIBUTE_UNUSED)
+{
+    virRotatingFileWriterPtr file;
+    int ret = -1;
+    char buf[300];
+
+    if (testRotatingFileInitFiles((off_t)-1,
+                                  (off_t)-1,
+                                  (off_t)-1) < 0)
+        return -1;
+
+    file = virRotatingFileWriterNew(FILENAME,
+                                    1024,
+                                    2,
+                                    false,
+                                    0700);
+    if (!file)
+        goto cleanup;
+
+    if (virRotatingFileWriterSetBufferSize(file, 512) < 0)
+        goto cleanup;
+
+    memset(buf, 0x5e, sizeof(buf));
+
+    /* Nothing is written until the buffer fills up */
+    virRotatingFileWriterAppend(file, buf, sizeof(buf));
+    if (testRotatingFileWriterAssertFileSizes(0,
+                                              (off_t)-1,
+                                              (off_t)-1) < 0)
+        goto cleanup;
+
+    virRotatingFileWriterAppend(file, buf, sizeof(buf));
+    if (testRotatingFileWriterAssertFileSizes(300,
+                                              (off_t)-1,
+                                              (off_t)-1) < 0)
+        goto cleanup;
+
+    if (virRotatingFileWriterGetOffset(file) != 600) {
+        fprintf(stderr, "Offset should be 600 not %llu\n",
+                (unsigned long long)virRotatingFileWriterGetOffset(file));
+        goto cleanup;
+    }
+
+    /* Rollover writes out the buffered data first */
+    virRotatingFileWriterAppend(file, buf, sizeof(buf));
+    virRotatingFileWriterAppend(file, buf, sizeof(buf));
+    if (testRotatingFileWriterAssertFileSizes(0,
+                                              1024,
+                                              (off_t)-1) < 0)
+        goto cleanup;
+
+    if (virRotatingFileWriterFlush(file) < 0 ||
+        testRotatingFileWriterAssertFileSizes(176,
+                                              1024,
+                                              (off_t)-1) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virRotatingFileWriterFree(file);
+    unlink(FILENAME);
+    unlink(FILENAME0);
+    unlink(FILENAME1);
+    return ret;
+}
+
+
 static int testRotatingFileWriterRolloverLineBreak(const void *data ATTRIBUTE_UNUSED)
 {
     virRotatingFileWriterPtr file;
@@ -720,6 +787,9 @@ mymain(void)
     if (virTestRun("Rotating file write rollover many", testRotatingFileWriterRolloverMany, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Rotating file write buffered", testRotatingFileWriterBuffered, NULL) < 0)
+        ret = -1;
+
     if (virTestRun("Rotating file write rollover line break", testRotatingFileWriterRolloverLineBreak, NULL) < 0)
         ret = -1;
 
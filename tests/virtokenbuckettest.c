@@ -0,0 +1,128 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+#include "virlog.h"
+
+#include "virtokenbucket.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("tests.tokenbuckettest");
+
+#define CHECK_TAKE(now, expect)                                         \
+    do {                                                                \
+        unsigned long long wait = virTokenBucketTake(&bucket, now);     \
+        if (wait != (expect)) {                                         \
+            VIR_TEST_DEBUG("At %llu expected to wait %llu, got %llu\n", \
+                           (unsigned long long) (now),                  \
+                           (unsigned long long) (expect), wait);        \
+            return -1;                                                  \
+        }                                                               \
+    } while (0)
+
+
+static int
+testTokenBucketUnlimited(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virTokenBucket bucket = { 0 };
+    size_t i;
+
+    for (i = 0; i < 1000; i++)
+        CHECK_TAKE(0, 0);
+
+    if (!virTokenBucketIsFull(&bucket, 0))
+        return -1;
+
+    return 0;
+}
+
+
+static int
+testTokenBucketBurst(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virTokenBucket bucket = { 0 };
+
+    /* 10 tokens a second, up to 3 at once */
+    virTokenBucketSetRate(&bucket, 10, 3, 1000);
+
+    CHECK_TAKE(1000, 0);
+    CHECK_TAKE(1000, 0);
+    /* Last token gone, next one comes in 100ms */
+    CHECK_TAKE(1000, 100);
+    /* Half a token came back, but this goes in debt */
+    CHECK_TAKE(1050, 150);
+    CHECK_TAKE(1050, 250);
+
+    /* Idle for long enough to fill up again */
+    CHECK_TAKE(5000, 0);
+    if (virTokenBucketIsFull(&bucket, 5000))
+        return -1;
+    if (!virTokenBucketIsFull(&bucket, 5100))
+        return -1;
+
+    return 0;
+}
+
+
+static int
+testTokenBucketDebt(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virTokenBucket bucket = { 0 };
+    size_t i;
+
+    /* Burst defaults to the rate */
+    virTokenBucketSetRate(&bucket, 2, 0, 0);
+
+    CHECK_TAKE(0, 0);
+    CHECK_TAKE(0, 500);
+
+    /* Debt is capped at a burst worth of tokens */
+    for (i = 0; i < 10; i++)
+        virTokenBucketTake(&bucket, 0);
+    CHECK_TAKE(0, 1500);
+
+    /* Lowering the burst drops the tokens above it */
+    virTokenBucketSetRate(&bucket, 2, 1, 10000);
+    CHECK_TAKE(10000, 500);
+
+    /* Disabling the limit grants everything */
+    virTokenBucketSetRate(&bucket, 0, 0, 10000);
+    CHECK_TAKE(10000, 0);
+
+    return 0;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virTestRun("Unlimited", testTokenBucketUnlimited, NULL) < 0)
+        ret = -1;
+    if (virTestRun("Burst", testTokenBucketBurst, NULL) < 0)
+        ret = -1;
+    if (virTestRun("Debt", testTokenBucketDebt, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
@@ -151,6 +151,48 @@ testTypedParamsAddStringList(const void *opaque ATTRIBUTE_UNUSED)
     return rv;
 }
 
+static int
+testTypedParamsAppendFormat(const void *opaque ATTRIBUTE_UNUSED)
+{
+    int rv = -1;
+    virTypedParameterPtr params = NULL;
+    virTypedParameterPtr par;
+    int nparams = 0, maxparams = 0;
+    unsigned long long value;
+    char longname[VIR_TYPED_PARAM_FIELD_LENGTH + 1];
+    size_t i;
+
+    for (i = 0; i < 100; i++) {
+        if (!(par = virTypedParamsAppendFormat(&params, &nparams, &maxparams,
+                                               VIR_TYPED_PARAM_ULLONG,
+                                               "block.%zu.rd.bytes", i)))
+            goto cleanup;
+        par->value.ul = i * 512;
+    }
+
+    if (nparams != 100 || maxparams < nparams)
+        goto cleanup;
+
+    if (virTypedParamsGetULLong(params, nparams, "block.42.rd.bytes",
+                                &value) != 1 ||
+        value != 42 * 512)
+        goto cleanup;
+
+    memset(longname, 'a', sizeof(longname) - 1);
+    longname[sizeof(longname) - 1] = '\0';
+
+    if (virTypedParamsAppendFormat(&params, &nparams, &maxparams,
+                                   VIR_TYPED_PARAM_UINT, "%s", longname) ||
+        nparams != 100)
+        goto cleanup;
+    virResetLastError();
+
+    rv = 0;
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    return rv;
+}
+
 static int
 testTypedParamsGetStringList(const void *opaque ATTRIBUTE_UNUSED)
 {
@@ -302,6 +344,9 @@ mymain(void)
     if (virTestRun("Add string list", testTypedParamsAddStringList, NULL) < 0)
         rv = -1;
 
+    if (virTestRun("Append formatted", testTypedParamsAppendFormat, NULL) < 0)
+        rv = -1;
+
     if (rv < 0)
         return EXIT_FAILURE;
     return EXIT_SUCCESS;
@@ -0,0 +1,355 @@
+/*
+ * virutilbench.c: benchmarks of utility code on hot paths
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+#include "virbitmap.h"
+#include "virbuffer.h"
+#include "virhash.h"
+#include "virhashdata.h"
+#include "virjson.h"
+#include "virlog.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("tests.utilbench");
+
+#define BENCH_BITMAP_SIZE 4096
+#define BENCH_ESCAPE_SIZE 4096
+#define BENCH_HASH_ENTRIES 100000
+#define BENCH_BLOCKSTATS_DISKS 40
+
+
+static int
+benchHashAddLookupRemove(const void *data ATTRIBUTE_UNUSED)
+{
+    virHashTablePtr hash;
+    size_t i;
+    int ret = -1;
+
+    if (!(hash = virHashCreate(32, NULL)))
+        return -1;
+
+    for (i = 0; i < ARRAY_CARDINALITY(uuids); i++) {
+        if (virHashAddEntry(hash, uuids[i], (void *) uuids[i]) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(uuids); i++) {
+        if (virHashLookup(hash, uuids[i]) != uuids[i])
+            goto cleanup;
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(uuids); i++) {
+        if (virHashRemoveEntry(hash, uuids[i]) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(hash);
+    return ret;
+}
+
+
+/* The lookups dominate, as a table that large only grows a few times */
+static int
+benchHashManyEntries(const void *data)
+{
+    char *const *keys = data;
+    virHashTablePtr hash;
+    size_t i;
+    int ret = -1;
+
+    if (!(hash = virHashCreate(0, NULL)))
+        return -1;
+
+    for (i = 0; i < BENCH_HASH_ENTRIES; i++) {
+        if (virHashAddEntry(hash, keys[i], keys[i]) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < BENCH_HASH_ENTRIES; i++) {
+        if (virHashLookup(hash, keys[i]) != keys[i])
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(hash);
+    return ret;
+}
+
+
+static int
+benchBitmapSetFormatParse(const void *data ATTRIBUTE_UNUSED)
+{
+    virBitmapPtr bitmap;
+    virBitmapPtr parsed = NULL;
+    char *str = NULL;
+    ssize_t pos = -1;
+    size_t count = 0;
+    size_t i;
+    int ret = -1;
+
+    if (!(bitmap = virBitmapNew(BENCH_BITMAP_SIZE)))
+        return -1;
+
+    /* runs of set bits with gaps, like a host CPU list */
+    for (i = 0; i < BENCH_BITMAP_SIZE; i++) {
+        if (i % 16 < 6 && virBitmapSetBit(bitmap, i) < 0)
+            goto cleanup;
+    }
+
+    while ((pos = virBitmapNextSetBit(bitmap, pos)) >= 0)
+        count++;
+
+    if (count != virBitmapCountBits(bitmap))
+        goto cleanup;
+
+    if (!(str = virBitmapFormat(bitmap)) ||
+        virBitmapParse(str, &parsed, BENCH_BITMAP_SIZE) < 0)
+        goto cleanup;
+
+    if (!virBitmapEqual(bitmap, parsed))
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virBitmapFree(parsed);
+    virBitmapFree(bitmap);
+    VIR_FREE(str);
+    return ret;
+}
+
+
+/* ranges starting and ending off unit boundaries, like a CPU list */
+static int
+benchBitmapParseRanges(const void *data ATTRIBUTE_UNUSED)
+{
+    virBitmapPtr bitmap = NULL;
+    int ret = -1;
+
+    if (virBitmapParse("1-62,70-1000,^500,1030-4000,4090",
+                       &bitmap, BENCH_BITMAP_SIZE) < 0)
+        return -1;
+
+    if (virBitmapLastSetBit(bitmap) != 4090)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virBitmapFree(bitmap);
+    return ret;
+}
+
+
+static int
+benchBufferEscape(const void *data)
+{
+    const char *str = data;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *result;
+
+    virBufferEscapeString(&buf, "<description>%s</description>\n", str);
+
+    if (!(result = virBufferContentAndReset(&buf)))
+        return -1;
+
+    VIR_FREE(result);
+    return 0;
+}
+
+
+#if WITH_YAJL
+static int
+benchJSONParse(const void *data)
+{
+    virJSONValuePtr json;
+
+    if (!(json = virJSONValueFromString(data)))
+        return -1;
+
+    virJSONValueFree(json);
+    return 0;
+}
+
+
+static int
+benchJSONParseArena(const void *data)
+{
+    virJSONValuePtr json;
+
+    if (!(json = virJSONValueFromStringArena(data)))
+        return -1;
+
+    virJSONValueFree(json);
+    return 0;
+}
+
+
+static int
+benchJSONFormat(const void *data)
+{
+    char *str;
+
+    if (!(str = virJSONValueToString((virJSONValuePtr) data, false)))
+        return -1;
+
+    VIR_FREE(str);
+    return 0;
+}
+
+
+/* A query-blockstats reply of a domain with many disks */
+static char *
+benchJSONBlockstatsReply(void)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+
+    virBufferAddLit(&buf, "{\"return\": [");
+    for (i = 0; i < BENCH_BLOCKSTATS_DISKS; i++) {
+        virBufferAsprintf(&buf,
+                          "%s{\"device\": \"drive-virtio-disk%zu\","
+                          " \"node-name\": \"#block%zu\","
+                          " \"stats\": {\"rd_bytes\": 104857600,"
+                          " \"wr_bytes\": 52428800, \"rd_operations\": 2048,"
+                          " \"wr_operations\": 1024, \"flush_operations\": 12,"
+                          " \"rd_total_time_ns\": 81234567,"
+                          " \"wr_total_time_ns\": 91234567,"
+                          " \"flush_total_time_ns\": 1234567,"
+                          " \"wr_highest_offset\": 1073741824,"
+                          " \"invalid_rd_operations\": 0,"
+                          " \"timed_stats\": [], \"idle_time_ns\": 123}, "
+                          "\"parent\": {\"node-name\": \"#block%zu\","
+                          " \"stats\": {\"wr_highest_offset\": 65536}}}",
+                          i ? ", " : "", i, i * 2, i * 2 + 1);
+    }
+    virBufferAddLit(&buf, "], \"id\": \"libvirt-42\"}");
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+#endif /* WITH_YAJL */
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    char *escape = NULL;
+    char **keys = NULL;
+#if WITH_YAJL
+    char *reply = NULL;
+    char *blockstats = NULL;
+    virJSONValuePtr json = NULL;
+#endif
+    size_t i;
+
+    if (virTestBench("virHash add, lookup and remove",
+                     benchHashAddLookupRemove, NULL) < 0)
+        ret = -1;
+
+    if (VIR_ALLOC_N(keys, BENCH_HASH_ENTRIES) < 0)
+        return EXIT_FAILURE;
+    for (i = 0; i < BENCH_HASH_ENTRIES; i++) {
+        if (virAsprintf(&keys[i], "domain-%zu", i) < 0) {
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    if (virTestBench("virHash 100000 entries",
+                     benchHashManyEntries, keys) < 0)
+        ret = -1;
+
+    if (virTestBench("virBitmap set, format and parse",
+                     benchBitmapSetFormatParse, NULL) < 0)
+        ret = -1;
+
+    if (virTestBench("virBitmap parse ranges",
+                     benchBitmapParseRanges, NULL) < 0)
+        ret = -1;
+
+    /* mostly plain text with the characters needing escapes mixed in */
+    if (VIR_ALLOC_N(escape, BENCH_ESCAPE_SIZE + 1) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+    for (i = 0; i < BENCH_ESCAPE_SIZE; i++)
+        escape[i] = i % 32 ? 'a' + i % 26 : "<>&'\"\n"[(i / 32) % 6];
+
+    if (virTestBench("virBuffer escape string",
+                     benchBufferEscape, escape) < 0)
+        ret = -1;
+
+#if WITH_YAJL
+    if (virTestLoadFile(abs_srcdir "/cputestdata/x86_64-cpuid-Core-i7-4600U.json",
+                        &reply) < 0 ||
+        !(json = virJSONValueFromString(reply))) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (virTestBench("virJSON parse QMP reply", benchJSONParse, reply) < 0)
+        ret = -1;
+
+    if (virTestBench("virJSON format QMP reply", benchJSONFormat, json) < 0)
+        ret = -1;
+
+    if (!(blockstats = benchJSONBlockstatsReply())) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (virTestBench("virJSON parse query-blockstats reply",
+                     benchJSONParse, blockstats) < 0)
+        ret = -1;
+
+    if (virTestBench("virJSON parse query-blockstats reply into an arena",
+                     benchJSONParseArena, blockstats) < 0)
+        ret = -1;
+#endif /* WITH_YAJL */
+
+ cleanup:
+#if WITH_YAJL
+    virJSONValueFree(json);
+    VIR_FREE(reply);
+    VIR_FREE(blockstats);
+#endif /* WITH_YAJL */
+    if (keys) {
+        for (i = 0; i < BENCH_HASH_ENTRIES; i++)
+            VIR_FREE(keys[i]);
+        VIR_FREE(keys);
+    }
+    VIR_FREE(escape);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
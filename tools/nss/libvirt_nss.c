@@ -40,6 +40,7 @@
 #endif
 
 #include "virlease.h"
+#include "virleasedb.h"
 #include "viralloc.h"
 #include "virfile.h"
 #include "virtime.h"
@@ -85,20 +86,14 @@ typedef struct {
 static int
 appendAddr(leaseAddress **tmpAddress,
            size_t *ntmpAddress,
-           virJSONValuePtr lease,
+           const char *ipAddr,
            int af)
 {
     int ret = -1;
-    const char *ipAddr;
     virSocketAddr sa;
     int family;
     size_t i;
 
-    if (!(ipAddr = virJSONValueObjectGetString(lease, "ip-address"))) {
-        ERROR("ip-address field missing for %s", name);
-        goto cleanup;
-    }
-
     DEBUG("IP address: %s", ipAddr);
 
     if (virSocketAddrParse(&sa, ipAddr, AF_UNSPEC) < 0) {
@@ -165,6 +160,7 @@ findLeaseInJSON(leaseAddress **tmpAddress,
 
     for (i = 0; i < nleases; i++) {
         virJSONValuePtr lease = virJSONValueArrayGet(leases_array, i);
+        const char *ipAddr;
 
         if (!lease) {
             /* This should never happen (TM) */
@@ -205,12 +201,95 @@ findLeaseInJSON(leaseAddress **tmpAddress,
         DEBUG("Found record for %s", name);
         *found = true;
 
-        if (appendAddr(tmpAddress, ntmpAddress, lease, af) < 0)
+        if (!(ipAddr = virJSONValueObjectGetString(lease, "ip-address"))) {
+            ERROR("ip-address field missing for %s", name);
             goto cleanup;
+        }
+
+        if (appendAddr(tmpAddress, ntmpAddress, ipAddr, af) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    return ret;
+}
+
+
+typedef struct {
+    leaseAddress **tmpAddress;
+    size_t *ntmpAddress;
+    const char *name;
+    int af;
+    bool *found;
+    long long currtime;
+} findLeaseInDBData;
+
+static int
+findLeaseInDBIterator(const virLeaseDBEntry *entry,
+                      void *opaque)
+{
+    findLeaseInDBData *data = opaque;
+
+    /* Do not report expired lease */
+    if (entry->expirytime < data->currtime) {
+        DEBUG("Skipping expired lease for %s", data->name);
+        return 0;
+    }
+
+    DEBUG("Found record for %s", data->name);
+    *data->found = true;
+
+    return appendAddr(data->tmpAddress, data->ntmpAddress,
+                      entry->ip, data->af);
+}
+
+
+/* Like findLeaseInJSON, but only visit the leases of @path that
+ * match, through the lease database index. */
+static int
+findLeaseInDB(leaseAddress **tmpAddress,
+              size_t *ntmpAddress,
+              const char *path,
+              const char *name,
+              const char **macs,
+              int af,
+              bool *found)
+{
+    virLeaseDBPtr db = NULL;
+    findLeaseInDBData data = { tmpAddress, ntmpAddress, name, af, found, 0 };
+    time_t currtime;
+    size_t i;
+    int ret = -1;
+
+    if ((currtime = time(NULL)) == (time_t) - 1) {
+        ERROR("Failed to get current system time");
+        goto cleanup;
+    }
+    data.currtime = currtime;
+
+    DEBUG("Processing %s", path);
+    if ((ret = virLeaseDBOpen(&db, path, 0)) <= 0) {
+        if (ret < 0)
+            ERROR("Unable to open %s", path);
+        goto cleanup;
+    }
+    ret = -1;
+
+    if (macs) {
+        for (i = 0; macs[i]; i++) {
+            if (virLeaseDBLookup(db, VIR_LEASE_DB_KEY_MAC, macs[i],
+                                 findLeaseInDBIterator, &data) < 0)
+                goto cleanup;
+        }
+    } else if (virLeaseDBLookup(db, VIR_LEASE_DB_KEY_HOSTNAME, name,
+                                findLeaseInDBIterator, &data) < 0) {
+        goto cleanup;
     }
 
     ret = 0;
  cleanup:
+    virLeaseDBFree(db);
     return ret;
 }
 
@@ -253,6 +332,9 @@ findLease(const char *name,
     size_t ntmpAddress = 0;
     virMacMapPtr *macmaps = NULL;
     size_t nMacmaps = 0;
+    char **leaseDBs = NULL;
+    size_t nLeaseDBs = 0;
+    size_t i;
 
     *address = NULL;
     *naddress = 0;
@@ -277,10 +359,38 @@ findLease(const char *name,
     while ((ret = virDirRead(dir, &entry, leaseDir)) > 0) {
         char *path;
 
-        if (virFileHasSuffix(entry->d_name, ".status")) {
+        if (virFileHasSuffix(entry->d_name, VIR_LEASE_DB_SUFFIX)) {
             if (!(path = virFileBuildPath(leaseDir, entry->d_name, NULL)))
                 goto cleanup;
 
+            if (VIR_APPEND_ELEMENT_QUIET(leaseDBs, nLeaseDBs, path) < 0) {
+                VIR_FREE(path);
+                goto cleanup;
+            }
+        } else if (virFileHasSuffix(entry->d_name, ".status")) {
+            char *dbPath;
+            bool hasDB;
+
+            if (!(path = virFileBuildPath(leaseDir, entry->d_name, NULL)))
+                goto cleanup;
+
+            /* leaseshelper moves the leases of this file into the
+             * lease database, and stops updating it */
+            if (virAsprintfQuiet(&dbPath, "%s%.*s" VIR_LEASE_DB_SUFFIX,
+                                 leaseDir,
+                                 (int) (strlen(entry->d_name) -
+                                        strlen(".status")),
+                                 entry->d_name) < 0) {
+                VIR_FREE(path);
+                goto cleanup;
+            }
+            hasDB = virFileExists(dbPath);
+            VIR_FREE(dbPath);
+            if (hasDB) {
+                VIR_FREE(path);
+                continue;
+            }
+
             DEBUG("Processing %s", path);
             if (virLeaseReadCustomLeaseFile(leases_array, path, NULL, NULL) < 0) {
                 ERROR("Unable to parse %s", path);
@@ -319,11 +429,17 @@ findLease(const char *name,
                         name, NULL, af, found) < 0)
         goto cleanup;
 
+    for (i = 0; i < nLeaseDBs; i++) {
+        if (findLeaseInDB(&tmpAddress, &ntmpAddress,
+                          leaseDBs[i], name, NULL, af, found) < 0)
+            goto cleanup;
+    }
+
 #else /* defined(LIBVIRT_NSS_GUEST) */
 
-    size_t i;
     for (i = 0; i < nMacmaps; i++) {
         const char **macs = (const char **) virMacMapLookup(macmaps[i], name);
+        size_t j;
 
         if (!macs)
             continue;
@@ -332,6 +448,12 @@ findLease(const char *name,
                             leases_array, nleases,
                             name, macs, af, found) < 0)
             goto cleanup;
+
+        for (j = 0; j < nLeaseDBs; j++) {
+            if (findLeaseInDB(&tmpAddress, &ntmpAddress,
+                              leaseDBs[j], name, macs, af, found) < 0)
+                goto cleanup;
+        }
     }
 
 #endif /* defined(LIBVIRT_NSS_GUEST) */
@@ -351,6 +473,9 @@ findLease(const char *name,
     while (nMacmaps)
         virObjectUnref(macmaps[--nMacmaps]);
     VIR_FREE(macmaps);
+    while (nLeaseDBs)
+        VIR_FREE(leaseDBs[--nLeaseDBs]);
+    VIR_FREE(leaseDBs);
     return ret;
 }
 
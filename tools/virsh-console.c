@@ -154,6 +154,24 @@ virConsoleEventOnStream(virStreamPtr st,
             virConsoleShutdown(con);
             return;
         }
+        /* Write straight to the terminal if nothing is queued before
+         * this, saving the round trip through the event loop */
+        if (con->streamToTerminal.offset == 0) {
+            ssize_t done = write(STDOUT_FILENO,
+                                 con->streamToTerminal.data, got);
+            if (done < 0) {
+                if (errno != EAGAIN) {
+                    virConsoleShutdown(con);
+                    return;
+                }
+                done = 0;
+            }
+            memmove(con->streamToTerminal.data,
+                    con->streamToTerminal.data + done,
+                    got - done);
+            got -= done;
+        }
+
         con->streamToTerminal.offset += got;
         if (con->streamToTerminal.offset)
             virEventUpdateHandle(con->stdoutWatch,
@@ -237,6 +255,23 @@ virConsoleEventOnStdin(int watch ATTRIBUTE_UNUSED,
             return;
         }
 
+        /* Likewise keystrokes are sent right away unless older input
+         * is still waiting for the stream to become writable */
+        if (con->terminalToStream.offset == 0) {
+            int done = virStreamSend(con->st,
+                                     con->terminalToStream.data, got);
+            if (done == -2) {
+                done = 0;
+            } else if (done < 0) {
+                virConsoleShutdown(con);
+                return;
+            }
+            memmove(con->terminalToStream.data,
+                    con->terminalToStream.data + done,
+                    got - done);
+            got -= done;
+        }
+
         con->terminalToStream.offset += got;
         if (con->terminalToStream.offset)
             virStreamEventUpdateCallback(con->st,
@@ -35,6 +35,7 @@
 #include "conf/virdomainobjlist.h"
 #include "intprops.h"
 #include "viralloc.h"
+#include "virjson.h"
 #include "virmacaddr.h"
 #include "virsh-domain.h"
 #include "virxml.h"
@@ -1482,6 +1483,8 @@ virshDomainSorter(const void *a, const void *b)
 struct virshDomainList {
     virDomainPtr *domains;
     size_t ndomains;
+    virDomainStatsRecordPtr *records; /* matching @domains, if listed
+                                       * with virConnectListAllDomainsFields */
 };
 typedef struct virshDomainList *virshDomainListPtr;
 
@@ -1497,6 +1500,8 @@ virshDomainListFree(virshDomainListPtr domlist)
         }
         VIR_FREE(domlist->domains);
     }
+    if (domlist)
+        virDomainStatsRecordListFree(domlist->records);
     VIR_FREE(domlist);
 }
 
@@ -1720,6 +1725,51 @@ virshDomainListCollect(vshControl *ctl, unsigned int flags)
     return list;
 }
 
+static int
+virshDomainRecordSorter(const void *a, const void *b)
+{
+    virDomainStatsRecordPtr *ra = (virDomainStatsRecordPtr *) a;
+    virDomainStatsRecordPtr *rb = (virDomainStatsRecordPtr *) b;
+
+    return virshDomainSorter(&(*ra)->dom, &(*rb)->dom);
+}
+
+/* Like virshDomainListCollect, but get @fields of all the domains in the
+ * same call if the server supports it */
+static virshDomainListPtr
+virshDomainListCollectFields(vshControl *ctl,
+                             unsigned int flags,
+                             unsigned int fields)
+{
+    virshControlPtr priv = ctl->privData;
+    virDomainStatsRecordPtr *records = NULL;
+    virshDomainListPtr list;
+    size_t i;
+    int ret;
+
+    if ((ret = virConnectListAllDomainsFields(priv->conn, fields,
+                                              &records, flags)) < 0) {
+        /* let the old way deal with older servers and any errors */
+        vshResetLibvirtError();
+        return virshDomainListCollect(ctl, flags);
+    }
+
+    if (ret)
+        qsort(records, ret, sizeof(*records), virshDomainRecordSorter);
+
+    list = vshMalloc(ctl, sizeof(*list));
+    list->domains = vshCalloc(ctl, ret + 1, sizeof(*list->domains));
+    list->ndomains = ret;
+    list->records = records;
+
+    for (i = 0; i < list->ndomains; i++) {
+        list->domains[i] = records[i]->dom;
+        virDomainRef(list->domains[i]);
+    }
+
+    return list;
+}
+
 static const vshCmdOptDef opts_list[] = {
     {.name = "inactive",
      .type = VSH_OT_BOOL,
@@ -1854,7 +1904,19 @@ cmdList(vshControl *ctl, const vshCmd *cmd)
     if (!optUUID && !optName)
         optTable = true;
 
-    if (!(list = virshDomainListCollect(ctl, flags)))
+    if (optTable) {
+        unsigned int fields = VIR_DOMAIN_LIST_FIELD_STATE;
+
+        if (managed)
+            fields |= VIR_DOMAIN_LIST_FIELD_MANAGEDSAVE;
+        if (optTitle)
+            fields |= VIR_DOMAIN_LIST_FIELD_TITLE;
+
+        list = virshDomainListCollectFields(ctl, flags, fields);
+    } else {
+        list = virshDomainListCollect(ctl, flags);
+    }
+    if (!list)
         goto cleanup;
 
     /* print table header in legacy mode */
@@ -1879,7 +1941,20 @@ cmdList(vshControl *ctl, const vshCmd *cmd)
         else
             ignore_value(virStrcpyStatic(id_buf, "-"));
 
-        if (optTable) {
+        if (optTable && list->records) {
+            virDomainStatsRecordPtr rec = list->records[i];
+            int mansave = 0;
+
+            if (virTypedParamsGetInt(rec->params, rec->nparams,
+                                     "state", &state) != 1)
+                state = VIR_DOMAIN_NOSTATE;
+
+            if (managed && state == VIR_DOMAIN_SHUTOFF &&
+                virTypedParamsGetBoolean(rec->params, rec->nparams,
+                                         "managedsave", &mansave) == 1 &&
+                mansave)
+                state = -2;
+        } else if (optTable) {
             state = virshDomainState(ctl, dom, NULL);
 
             /* Domain could've been removed in the meantime */
@@ -1889,10 +1964,22 @@ cmdList(vshControl *ctl, const vshCmd *cmd)
             if (managed && state == VIR_DOMAIN_SHUTOFF &&
                 virDomainHasManagedSaveImage(dom, 0) > 0)
                 state = -2;
+        }
 
+        if (optTable) {
             if (optTitle) {
-                if (!(title = virshGetDomainDescription(ctl, dom, true, 0)))
+                if (list->records) {
+                    virDomainStatsRecordPtr rec = list->records[i];
+                    const char *str = NULL;
+
+                    ignore_value(virTypedParamsGetString(rec->params,
+                                                         rec->nparams,
+                                                         "title", &str));
+                    title = vshStrdup(ctl, str ? str : "");
+                } else if (!(title = virshGetDomainDescription(ctl, dom,
+                                                               true, 0))) {
                     goto cleanup;
+                }
 
                 vshPrint(ctl, " %-5s %-30s %-10s %-20s\n", id_buf,
                          virDomainGetName(dom),
@@ -1973,6 +2060,26 @@ static const vshCmdOptDef opts_domstats[] = {
      .type = VSH_OT_BOOL,
      .help = N_("report domain perf event statistics"),
     },
+    {.name = "pressure",
+     .type = VSH_OT_BOOL,
+     .help = N_("report domain resource pressure statistics"),
+    },
+    {.name = "job",
+     .type = VSH_OT_BOOL,
+     .help = N_("report domain job wait and hold times"),
+    },
+    {.name = "monitor",
+     .type = VSH_OT_BOOL,
+     .help = N_("report QEMU monitor command latencies"),
+    },
+    {.name = "dirtyrate",
+     .type = VSH_OT_BOOL,
+     .help = N_("report the rate at which the guest dirties its memory"),
+    },
+    {.name = "guest",
+     .type = VSH_OT_BOOL,
+     .help = N_("report information provided by the guest agent"),
+    },
     {.name = "list-active",
      .type = VSH_OT_BOOL,
      .help = N_("list only active domains"),
@@ -2017,6 +2124,19 @@ static const vshCmdOptDef opts_domstats[] = {
      .type = VSH_OT_BOOL,
      .help = N_("add backing chain information to block stats"),
     },
+    {.name = "cached",
+     .type = VSH_OT_BOOL,
+     .help = N_("allow recently cached stats to be returned"),
+    },
+    {.name = "json",
+     .type = VSH_OT_BOOL,
+     .help = N_("print every record as a single line JSON object"),
+    },
+    {.name = "interval",
+     .type = VSH_OT_INT,
+     .help = N_("repeat every N seconds printing the difference of "
+                "integer values to the previous sample"),
+    },
     {.name = "domain",
      .type = VSH_OT_ARGV,
      .flags = VSH_OFLAG_NONE,
@@ -2026,9 +2146,122 @@ static const vshCmdOptDef opts_domstats[] = {
 };
 
 
+/* Turn the integer value of @par into its difference to the same field
+ * of @prev.  Unsigned counters which went backwards (e.g. because the
+ * domain was restarted) are left as they are. */
+static void
+virshDomainStatsDelta(virTypedParameterPtr par,
+                      virDomainStatsRecordPtr prev)
+{
+    virTypedParameterPtr old;
+
+    if (!prev ||
+        !(old = virTypedParamsGet(prev->params, prev->nparams, par->field)) ||
+        old->type != par->type)
+        return;
+
+    switch ((virTypedParameterType) par->type) {
+    case VIR_TYPED_PARAM_INT:
+        par->value.i -= old->value.i;
+        break;
+    case VIR_TYPED_PARAM_UINT:
+        if (par->value.ui >= old->value.ui)
+            par->value.ui -= old->value.ui;
+        break;
+    case VIR_TYPED_PARAM_LLONG:
+        par->value.l -= old->value.l;
+        break;
+    case VIR_TYPED_PARAM_ULLONG:
+        if (par->value.ul >= old->value.ul)
+            par->value.ul -= old->value.ul;
+        break;
+    case VIR_TYPED_PARAM_DOUBLE:
+    case VIR_TYPED_PARAM_BOOLEAN:
+    case VIR_TYPED_PARAM_STRING:
+    case VIR_TYPED_PARAM_LAST:
+        break;
+    }
+}
+
+static int
+virshDomainStatsAppendJSON(virJSONValuePtr obj,
+                           virTypedParameterPtr par)
+{
+    switch ((virTypedParameterType) par->type) {
+    case VIR_TYPED_PARAM_INT:
+        return virJSONValueObjectAppendNumberInt(obj, par->field,
+                                                 par->value.i);
+    case VIR_TYPED_PARAM_UINT:
+        return virJSONValueObjectAppendNumberUint(obj, par->field,
+                                                  par->value.ui);
+    case VIR_TYPED_PARAM_LLONG:
+        return virJSONValueObjectAppendNumberLong(obj, par->field,
+                                                  par->value.l);
+    case VIR_TYPED_PARAM_ULLONG:
+        return virJSONValueObjectAppendNumberUlong(obj, par->field,
+                                                   par->value.ul);
+    case VIR_TYPED_PARAM_DOUBLE:
+        return virJSONValueObjectAppendNumberDouble(obj, par->field,
+                                                    par->value.d);
+    case VIR_TYPED_PARAM_BOOLEAN:
+        return virJSONValueObjectAppendBoolean(obj, par->field,
+                                               par->value.b);
+    case VIR_TYPED_PARAM_STRING:
+        return virJSONValueObjectAppendString(obj, par->field,
+                                              par->value.s);
+    case VIR_TYPED_PARAM_LAST:
+        break;
+    }
+
+    return 0;
+}
+
+static bool
+virshDomainStatsPrintJSON(vshControl *ctl,
+                          virDomainStatsRecordPtr record,
+                          virDomainStatsRecordPtr prev)
+{
+    virJSONValuePtr obj = NULL;
+    virJSONValuePtr stats = NULL;
+    char *str = NULL;
+    size_t i;
+    bool ret = false;
+
+    if (!(obj = virJSONValueNewObject()) ||
+        !(stats = virJSONValueNewObject()) ||
+        virJSONValueObjectAppendString(obj, "domain",
+                                       virDomainGetName(record->dom)) < 0)
+        goto cleanup;
+
+    for (i = 0; i < record->nparams; i++) {
+        virTypedParameter par = record->params[i];
+
+        virshDomainStatsDelta(&par, prev);
+        if (virshDomainStatsAppendJSON(stats, &par) < 0)
+            goto cleanup;
+    }
+
+    if (virJSONValueObjectAppend(obj, "stats", stats) < 0)
+        goto cleanup;
+    stats = NULL;
+
+    if (!(str = virJSONValueToString(obj, false)))
+        goto cleanup;
+
+    vshPrint(ctl, "%s\n", str);
+    ret = true;
+
+ cleanup:
+    VIR_FREE(str);
+    virJSONValueFree(stats);
+    virJSONValueFree(obj);
+    return ret;
+}
+
 static bool
 virshDomainStatsPrintRecord(vshControl *ctl ATTRIBUTE_UNUSED,
                             virDomainStatsRecordPtr record,
+                            virDomainStatsRecordPtr prev,
                             bool raw ATTRIBUTE_UNUSED)
 {
     char *param;
@@ -2039,10 +2272,13 @@ virshDomainStatsPrintRecord(vshControl *ctl ATTRIBUTE_UNUSED,
     /* XXX: Implement pretty-printing */
 
     for (i = 0; i < record->nparams; i++) {
-        if (!(param = vshGetTypedParamValue(ctl, record->params + i)))
+        virTypedParameter par = record->params[i];
+
+        virshDomainStatsDelta(&par, prev);
+        if (!(param = vshGetTypedParamValue(ctl, &par)))
             return false;
 
-        vshPrint(ctl, "  %s=%s\n", record->params[i].field, param);
+        vshPrint(ctl, "  %s=%s\n", par.field, param);
 
         VIR_FREE(param);
     }
@@ -2050,6 +2286,21 @@ virshDomainStatsPrintRecord(vshControl *ctl ATTRIBUTE_UNUSED,
     return true;
 }
 
+/* Find the record of the domain of @record in the previous sample */
+static virDomainStatsRecordPtr
+virshDomainStatsFindPrev(virDomainStatsRecordPtr record,
+                         virDomainStatsRecordPtr *prev)
+{
+    const char *name = virDomainGetName(record->dom);
+
+    for (; prev && *prev; prev++) {
+        if (STREQ(name, virDomainGetName((*prev)->dom)))
+            return *prev;
+    }
+
+    return NULL;
+}
+
 static bool
 cmdDomstats(vshControl *ctl, const vshCmd *cmd)
 {
@@ -2059,7 +2310,10 @@ cmdDomstats(vshControl *ctl, const vshCmd *cmd)
     size_t ndoms = 0;
     virDomainStatsRecordPtr *records = NULL;
     virDomainStatsRecordPtr *next;
+    virDomainStatsRecordPtr *prev = NULL;
     bool raw = vshCommandOptBool(cmd, "raw");
+    bool json = vshCommandOptBool(cmd, "json");
+    int interval = 0;
     int flags = 0;
     const vshCmdOpt *opt = NULL;
     bool ret = false;
@@ -2086,6 +2340,21 @@ cmdDomstats(vshControl *ctl, const vshCmd *cmd)
     if (vshCommandOptBool(cmd, "perf"))
         stats |= VIR_DOMAIN_STATS_PERF;
 
+    if (vshCommandOptBool(cmd, "guest"))
+        stats |= VIR_DOMAIN_STATS_GUEST;
+
+    if (vshCommandOptBool(cmd, "pressure"))
+        stats |= VIR_DOMAIN_STATS_PRESSURE;
+
+    if (vshCommandOptBool(cmd, "job"))
+        stats |= VIR_DOMAIN_STATS_JOB;
+
+    if (vshCommandOptBool(cmd, "monitor"))
+        stats |= VIR_DOMAIN_STATS_MONITOR;
+
+    if (vshCommandOptBool(cmd, "dirtyrate"))
+        stats |= VIR_DOMAIN_STATS_DIRTYRATE;
+
     if (vshCommandOptBool(cmd, "list-active"))
         flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE;
 
@@ -2116,6 +2385,16 @@ cmdDomstats(vshControl *ctl, const vshCmd *cmd)
     if (vshCommandOptBool(cmd, "backing"))
         flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING;
 
+    if (vshCommandOptBool(cmd, "cached"))
+        flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_CACHED;
+
+    if (vshCommandOptInt(ctl, cmd, "interval", &interval) < 0)
+        return false;
+    if (interval < 0 || interval > INT_MAX / 1000) {
+        vshError(ctl, _("invalid interval: %d"), interval);
+        return false;
+    }
+
     if (vshCommandOptBool(cmd, "domain")) {
         if (VIR_ALLOC_N(domlist, 1) < 0)
             goto cleanup;
@@ -2130,37 +2409,183 @@ cmdDomstats(vshControl *ctl, const vshCmd *cmd)
             if (VIR_INSERT_ELEMENT(domlist, ndoms - 1, ndoms, dom) < 0)
                 goto cleanup;
         }
-
-        if (virDomainListGetStats(domlist,
-                                  stats,
-                                  &records,
-                                  flags) < 0)
-            goto cleanup;
-    } else {
-       if ((virConnectGetAllDomainStats(priv->conn,
-                                        stats,
-                                        &records,
-                                        flags)) < 0)
-           goto cleanup;
     }
 
-    next = records;
-    while (*next) {
-        if (!virshDomainStatsPrintRecord(ctl, *next, raw))
-            goto cleanup;
+    /* With --interval the connection stays open and every sample after
+     * the first one reports integer values relative to the previous one */
+    while (true) {
+        if (domlist) {
+            if (virDomainListGetStats(domlist,
+                                      stats,
+                                      &records,
+                                      flags) < 0)
+                goto cleanup;
+        } else {
+           if ((virConnectGetAllDomainStats(priv->conn,
+                                            stats,
+                                            &records,
+                                            flags)) < 0)
+               goto cleanup;
+        }
+
+        for (next = records; *next; next++) {
+            virDomainStatsRecordPtr old = virshDomainStatsFindPrev(*next, prev);
+
+            if (json) {
+                if (!virshDomainStatsPrintJSON(ctl, *next, old))
+                    goto cleanup;
+                continue;
+            }
+
+            if (!virshDomainStatsPrintRecord(ctl, *next, old, raw))
+                goto cleanup;
 
-        if (*(++next))
-            vshPrint(ctl, "\n");
+            if (next[1] || interval)
+                vshPrint(ctl, "\n");
+        }
+        fflush(stdout);
+
+        virDomainStatsRecordListFree(prev);
+        prev = records;
+        records = NULL;
+
+        if (!interval)
+            break;
+
+        /* sleep until the next sample, or until interrupted */
+        if (vshEventStart(ctl, interval * 1000) < 0)
+            goto cleanup;
+        if (vshEventWait(ctl) != VSH_EVENT_TIMEOUT) {
+            vshEventCleanup(ctl);
+            break;
+        }
+        vshEventCleanup(ctl);
     }
 
     ret = true;
  cleanup:
     virDomainStatsRecordListFree(records);
+    virDomainStatsRecordListFree(prev);
     virObjectListFree(domlist);
 
     return ret;
 }
 
+/*
+ * "domstatsevent" command
+ */
+static const vshCmdInfo info_domstatsevent[] = {
+    {.name = "help",
+     .data = N_("set up periodic stats events for a domain")
+    },
+    {.name = "desc",
+     .data = N_("Makes a running domain report its statistics as "
+                "'stats' events every given number of seconds")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_domstatsevent[] = {
+    VIRSH_COMMON_OPT_DOMAIN_FULL,
+    {.name = "interval",
+     .type = VSH_OT_INT,
+     .flags = VSH_OFLAG_REQ,
+     .help = N_("period of the event in seconds, 0 to stop it")
+    },
+    {.name = "state",
+     .type = VSH_OT_BOOL,
+     .help = N_("report domain state"),
+    },
+    {.name = "cpu-total",
+     .type = VSH_OT_BOOL,
+     .help = N_("report domain physical cpu usage"),
+    },
+    {.name = "balloon",
+     .type = VSH_OT_BOOL,
+     .help = N_("report domain balloon statistics"),
+    },
+    {.name = "vcpu",
+     .type = VSH_OT_BOOL,
+     .help = N_("report domain virtual cpu information"),
+    },
+    {.name = "interface",
+     .type = VSH_OT_BOOL,
+     .help = N_("report domain network interface information"),
+    },
+    {.name = "block",
+     .type = VSH_OT_BOOL,
+     .help = N_("report domain block device statistics"),
+    },
+    {.name = "perf",
+     .type = VSH_OT_BOOL,
+     .help = N_("report domain perf event statistics"),
+    },
+    {.name = "pressure",
+     .type = VSH_OT_BOOL,
+     .help = N_("report domain resource pressure statistics"),
+    },
+    {.name = "job",
+     .type = VSH_OT_BOOL,
+     .help = N_("report domain job wait and hold times"),
+    },
+    {.name = "monitor",
+     .type = VSH_OT_BOOL,
+     .help = N_("report QEMU monitor command latencies"),
+    },
+    {.name = "dirtyrate",
+     .type = VSH_OT_BOOL,
+     .help = N_("report the rate at which the guest dirties its memory"),
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdDomstatsEvent(vshControl *ctl, const vshCmd *cmd)
+{
+    virDomainPtr dom;
+    unsigned int stats = 0;
+    unsigned int interval;
+    bool ret = false;
+
+    if (vshCommandOptUInt(ctl, cmd, "interval", &interval) < 0)
+        return false;
+
+    if (vshCommandOptBool(cmd, "state"))
+        stats |= VIR_DOMAIN_STATS_STATE;
+    if (vshCommandOptBool(cmd, "cpu-total"))
+        stats |= VIR_DOMAIN_STATS_CPU_TOTAL;
+    if (vshCommandOptBool(cmd, "balloon"))
+        stats |= VIR_DOMAIN_STATS_BALLOON;
+    if (vshCommandOptBool(cmd, "vcpu"))
+        stats |= VIR_DOMAIN_STATS_VCPU;
+    if (vshCommandOptBool(cmd, "interface"))
+        stats |= VIR_DOMAIN_STATS_INTERFACE;
+    if (vshCommandOptBool(cmd, "block"))
+        stats |= VIR_DOMAIN_STATS_BLOCK;
+    if (vshCommandOptBool(cmd, "perf"))
+        stats |= VIR_DOMAIN_STATS_PERF;
+    if (vshCommandOptBool(cmd, "pressure"))
+        stats |= VIR_DOMAIN_STATS_PRESSURE;
+    if (vshCommandOptBool(cmd, "job"))
+        stats |= VIR_DOMAIN_STATS_JOB;
+    if (vshCommandOptBool(cmd, "monitor"))
+        stats |= VIR_DOMAIN_STATS_MONITOR;
+    if (vshCommandOptBool(cmd, "dirtyrate"))
+        stats |= VIR_DOMAIN_STATS_DIRTYRATE;
+
+    if (!(dom = virshCommandOptDomain(ctl, cmd, NULL)))
+        return false;
+
+    if (virDomainSetStatsEvent(dom, stats, interval, 0) < 0)
+        goto cleanup;
+
+    ret = true;
+
+ cleanup:
+    virDomainFree(dom);
+    return ret;
+}
+
 /* "domifaddr" command
  */
 static const vshCmdInfo info_domifaddr[] = {
@@ -2377,6 +2802,12 @@ const vshCmdDef domMonitoringCmds[] = {
      .info = info_domstats,
      .flags = 0
     },
+    {.name = "domstatsevent",
+     .handler = cmdDomstatsEvent,
+     .opts = opts_domstatsevent,
+     .info = info_domstatsevent,
+     .flags = 0
+    },
     {.name = "domtime",
      .handler = cmdDomTime,
      .opts = opts_domtime,
@@ -2950,6 +2950,10 @@ static const vshCmdOptDef opts_console[] = {
      .type = VSH_OT_BOOL,
      .help =  N_("only connect if safe console handling is supported")
     },
+    {.name = "coalesce",
+     .type = VSH_OT_BOOL,
+     .help =  N_("let the server batch bursts of console output")
+    },
     {.name = NULL}
 };
 
@@ -2995,6 +2999,7 @@ cmdConsole(vshControl *ctl, const vshCmd *cmd)
     bool ret = false;
     bool force = vshCommandOptBool(cmd, "force");
     bool safe = vshCommandOptBool(cmd, "safe");
+    bool coalesce = vshCommandOptBool(cmd, "coalesce");
     unsigned int flags = 0;
     const char *name = NULL;
 
@@ -3008,6 +3013,8 @@ cmdConsole(vshControl *ctl, const vshCmd *cmd)
         flags |= VIR_DOMAIN_CONSOLE_FORCE;
     if (safe)
         flags |= VIR_DOMAIN_CONSOLE_SAFE;
+    if (coalesce)
+        flags |= VIR_DOMAIN_CONSOLE_COALESCE;
 
     ret = cmdRunConsole(ctl, dom, name, flags);
 
@@ -5767,6 +5774,7 @@ cmdDomjobinfo(vshControl *ctl, const vshCmd *cmd)
     unsigned long long value;
     unsigned int flags = 0;
     int ivalue;
+    unsigned int uivalue;
     int rc;
 
     if (!(dom = virshCommandOptDomain(ctl, cmd, NULL)))
@@ -6010,6 +6018,22 @@ cmdDomjobinfo(vshControl *ctl, const vshCmd *cmd)
         vshPrint(ctl, "%-17s %-13d\n", _("Auto converge throttle:"), ivalue);
     }
 
+    if ((rc = virTypedParamsGetUInt(params, nparams,
+                                    VIR_DOMAIN_JOB_AUTO_TUNE_ADJUSTMENTS,
+                                    &uivalue)) < 0) {
+        goto save_error;
+    } else if (rc) {
+        vshPrint(ctl, "%-17s %-13u\n", _("Auto tune adjustments:"), uivalue);
+    }
+
+    if ((rc = virTypedParamsGetULLong(params, nparams,
+                                      VIR_DOMAIN_JOB_AUTO_TUNE_DOWNTIME,
+                                      &value)) < 0) {
+        goto save_error;
+    } else if (rc) {
+        vshPrint(ctl, "%-17s %-13llu ms\n", _("Auto tune downtime:"), value);
+    }
+
     ret = true;
 
  cleanup:
@@ -7154,6 +7178,360 @@ cmdDomblkthreshold(vshControl *ctl, const vshCmd *cmd)
 }
 
 
+/*
+ * "backup-begin" command
+ */
+static const vshCmdInfo info_backup_begin[] = {
+    {.name = "help",
+     .data = N_("start a backup job of a running domain")
+    },
+    {.name = "desc",
+     .data = N_("Export the point-in-time content of the domain disks "
+                "over NBD as described by an XML file.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_backup_begin[] = {
+    VIRSH_COMMON_OPT_DOMAIN_FULL,
+    VIRSH_COMMON_OPT_FILE(N_("file containing the backup XML")),
+    {.name = NULL}
+};
+
+static bool
+cmdBackupBegin(vshControl *ctl, const vshCmd *cmd)
+{
+    virDomainPtr dom;
+    const char *from = NULL;
+    char *buffer = NULL;
+    bool ret = false;
+
+    if (vshCommandOptStringReq(ctl, cmd, "file", &from) < 0)
+        return false;
+
+    if (!(dom = virshCommandOptDomain(ctl, cmd, NULL)))
+        return false;
+
+    if (virFileReadAll(from, VSH_MAX_XML_FILE, &buffer) < 0) {
+        vshReportError(ctl);
+        goto cleanup;
+    }
+
+    if (virDomainBackupBegin(dom, buffer, 0) < 0) {
+        vshError(ctl, _("Failed to start backup from %s"), from);
+        goto cleanup;
+    }
+
+    vshPrintExtra(ctl, "%s", _("Backup started\n"));
+    ret = true;
+
+ cleanup:
+    VIR_FREE(buffer);
+    virDomainFree(dom);
+    return ret;
+}
+
+
+/*
+ * "backup-dumpxml" command
+ */
+static const vshCmdInfo info_backup_dumpxml[] = {
+    {.name = "help",
+     .data = N_("dump the XML of a running backup job")
+    },
+    {.name = "desc",
+     .data = N_("Output the backup job of the domain, including the server "
+                "address, as an XML dump to stdout.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_backup_dumpxml[] = {
+    VIRSH_COMMON_OPT_DOMAIN_FULL,
+    {.name = NULL}
+};
+
+static bool
+cmdBackupDumpXML(vshControl *ctl, const vshCmd *cmd)
+{
+    virDomainPtr dom;
+    char *xml;
+    bool ret = false;
+
+    if (!(dom = virshCommandOptDomain(ctl, cmd, NULL)))
+        return false;
+
+    if (!(xml = virDomainBackupGetXMLDesc(dom, 0)))
+        goto cleanup;
+
+    vshPrint(ctl, "%s", xml);
+    VIR_FREE(xml);
+    ret = true;
+
+ cleanup:
+    virDomainFree(dom);
+    return ret;
+}
+
+
+/*
+ * "backup-end" command
+ */
+static const vshCmdInfo info_backup_end[] = {
+    {.name = "help",
+     .data = N_("finish a backup job")
+    },
+    {.name = "desc",
+     .data = N_("Stop exporting the disks of the domain and remove the "
+                "scratch files of the backup.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_backup_end[] = {
+    VIRSH_COMMON_OPT_DOMAIN_FULL,
+    {.name = "abort",
+     .type = VSH_OT_BOOL,
+     .help = N_("the backup was not completed, drop the checkpoint it created")
+    },
+    {.name = "drop-incremental",
+     .type = VSH_OT_BOOL,
+     .help = N_("drop the checkpoint the backup was incremental to")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdBackupEnd(vshControl *ctl, const vshCmd *cmd)
+{
+    virDomainPtr dom;
+    unsigned int flags = 0;
+    bool ret = false;
+
+    VSH_EXCLUSIVE_OPTIONS("abort", "drop-incremental");
+
+    if (vshCommandOptBool(cmd, "abort"))
+        flags |= VIR_DOMAIN_BACKUP_END_ABORT;
+    if (vshCommandOptBool(cmd, "drop-incremental"))
+        flags |= VIR_DOMAIN_BACKUP_END_DROP_INCREMENTAL;
+
+    if (!(dom = virshCommandOptDomain(ctl, cmd, NULL)))
+        return false;
+
+    if (virDomainBackupEnd(dom, flags) < 0) {
+        vshError(ctl, "%s", _("Failed to finish backup"));
+        goto cleanup;
+    }
+
+    vshPrintExtra(ctl, "%s", _("Backup finished\n"));
+    ret = true;
+
+ cleanup:
+    virDomainFree(dom);
+    return ret;
+}
+
+
+/*
+ * "blockjobgroup-start" command
+ */
+static const vshCmdInfo info_blockjobgroup_start[] = {
+    {.name = "help",
+     .data = N_("start a block job on several disks")
+    },
+    {.name = "desc",
+     .data = N_("Pull or commit the backing chains of several disks of a "
+                "running domain, sharing a bandwidth limit.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_blockjobgroup_start[] = {
+    VIRSH_COMMON_OPT_DOMAIN_FULL,
+    {.name = "disks",
+     .type = VSH_OT_DATA,
+     .flags = VSH_OFLAG_REQ,
+     .help = N_("comma separated list of disk targets or sources")
+    },
+    {.name = "commit",
+     .type = VSH_OT_BOOL,
+     .help = N_("commit the intermediate images into the base instead of "
+                "pulling the chain into the active image")
+    },
+    {.name = "bandwidth",
+     .type = VSH_OT_INT,
+     .help = N_("bandwidth limit of the whole group in bytes/s")
+    },
+    {.name = "concurrency",
+     .type = VSH_OT_INT,
+     .help = N_("maximum number of jobs running at once")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdBlockJobGroupStart(vshControl *ctl, const vshCmd *cmd)
+{
+    virDomainPtr dom = NULL;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    int maxparams = 0;
+    const char *disks = NULL;
+    char **list = NULL;
+    unsigned long long bandwidth = 0;
+    unsigned int concurrency = 0;
+    int rv;
+    bool ret = false;
+
+    if (vshCommandOptStringReq(ctl, cmd, "disks", &disks) < 0)
+        return false;
+
+    if (!(list = virStringSplit(disks, ",", 0)) ||
+        virTypedParamsAddStringList(&params, &nparams, &maxparams,
+                                    VIR_DOMAIN_BLOCK_JOB_GROUP_DISK,
+                                    (const char **)list) < 0)
+        goto save_error;
+
+    if (vshCommandOptBool(cmd, "commit") &&
+        virTypedParamsAddInt(&params, &nparams, &maxparams,
+                             VIR_DOMAIN_BLOCK_JOB_GROUP_TYPE,
+                             VIR_DOMAIN_BLOCK_JOB_TYPE_COMMIT) < 0)
+        goto save_error;
+
+    if ((rv = vshCommandOptULongLong(ctl, cmd, "bandwidth", &bandwidth)) < 0)
+        goto cleanup;
+    if (rv > 0 &&
+        virTypedParamsAddULLong(&params, &nparams, &maxparams,
+                                VIR_DOMAIN_BLOCK_JOB_GROUP_BANDWIDTH,
+                                bandwidth) < 0)
+        goto save_error;
+
+    if ((rv = vshCommandOptUInt(ctl, cmd, "concurrency", &concurrency)) < 0)
+        goto cleanup;
+    if (rv > 0 &&
+        virTypedParamsAddUInt(&params, &nparams, &maxparams,
+                              VIR_DOMAIN_BLOCK_JOB_GROUP_CONCURRENCY,
+                              concurrency) < 0)
+        goto save_error;
+
+    if (!(dom = virshCommandOptDomain(ctl, cmd, NULL)))
+        goto cleanup;
+
+    if (virDomainBlockJobGroupStart(dom, params, nparams, 0) < 0) {
+        vshError(ctl, "%s", _("Failed to start block job group"));
+        goto cleanup;
+    }
+
+    vshPrintExtra(ctl, "%s", _("Block job group started\n"));
+    ret = true;
+
+ cleanup:
+    virStringListFree(list);
+    virTypedParamsFree(params, nparams);
+    if (dom)
+        virDomainFree(dom);
+    return ret;
+
+ save_error:
+    vshSaveLibvirtError();
+    goto cleanup;
+}
+
+
+/*
+ * "blockjobgroup-info" command
+ */
+static const vshCmdInfo info_blockjobgroup_info[] = {
+    {.name = "help",
+     .data = N_("report the progress of a block job group")
+    },
+    {.name = "desc",
+     .data = N_("Print the statistics of the block job group running on "
+                "the domain.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_blockjobgroup_info[] = {
+    VIRSH_COMMON_OPT_DOMAIN_FULL,
+    {.name = NULL}
+};
+
+static bool
+cmdBlockJobGroupInfo(vshControl *ctl, const vshCmd *cmd)
+{
+    virDomainPtr dom;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    size_t i;
+    char *value;
+    bool ret = false;
+
+    if (!(dom = virshCommandOptDomain(ctl, cmd, NULL)))
+        return false;
+
+    if (virDomainBlockJobGroupGetStats(dom, &params, &nparams, 0) < 0) {
+        vshError(ctl, "%s", _("Failed to get block job group statistics"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < nparams; i++) {
+        if (!(value = virTypedParameterToString(&params[i])))
+            goto cleanup;
+        vshPrint(ctl, "%-15s: %s\n", params[i].field, value);
+        VIR_FREE(value);
+    }
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    virDomainFree(dom);
+    return ret;
+}
+
+
+/*
+ * "blockjobgroup-abort" command
+ */
+static const vshCmdInfo info_blockjobgroup_abort[] = {
+    {.name = "help",
+     .data = N_("cancel a block job group")
+    },
+    {.name = "desc",
+     .data = N_("Drop the disks still waiting for their job and abort the "
+                "running jobs of the block job group.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_blockjobgroup_abort[] = {
+    VIRSH_COMMON_OPT_DOMAIN_FULL,
+    {.name = NULL}
+};
+
+static bool
+cmdBlockJobGroupAbort(vshControl *ctl, const vshCmd *cmd)
+{
+    virDomainPtr dom;
+    bool ret = false;
+
+    if (!(dom = virshCommandOptDomain(ctl, cmd, NULL)))
+        return false;
+
+    if (virDomainBlockJobGroupAbort(dom, 0) < 0) {
+        vshError(ctl, "%s", _("Failed to abort block job group"));
+        goto cleanup;
+    }
+
+    vshPrintExtra(ctl, "%s", _("Block job group aborted\n"));
+    ret = true;
+
+ cleanup:
+    virDomainFree(dom);
+    return ret;
+}
+
+
 /*
  * "iothreadinfo" command
  */
@@ -10207,6 +10585,10 @@ static const vshCmdOptDef opts_migrate[] = {
      .type = VSH_OT_BOOL,
      .help = N_("automatically switch to post-copy migration after one pass of pre-copy")
     },
+    {.name = "postcopy-auto",
+     .type = VSH_OT_BOOL,
+     .help = N_("let the hypervisor switch to post-copy migration if pre-copy is not going to converge")
+    },
     {.name = "migrateuri",
      .type = VSH_OT_STRING,
      .help = N_("migration URI, usually can be omitted")
@@ -10525,6 +10907,9 @@ doMigrate(void *opaque)
     if (vshCommandOptBool(cmd, "postcopy"))
         flags |= VIR_MIGRATE_POSTCOPY;
 
+    if (vshCommandOptBool(cmd, "postcopy-auto"))
+        flags |= VIR_MIGRATE_POSTCOPY_AUTO;
+
     if (vshCommandOptBool(cmd, "tls"))
         flags |= VIR_MIGRATE_TLS;
 
@@ -10621,6 +11006,8 @@ cmdMigrate(vshControl *ctl, const vshCmd *cmd)
     VSH_EXCLUSIVE_OPTIONS("live", "offline");
     VSH_EXCLUSIVE_OPTIONS("timeout-suspend", "timeout-postcopy");
     VSH_REQUIRE_OPTION("postcopy-after-precopy", "postcopy");
+    VSH_REQUIRE_OPTION("postcopy-auto", "postcopy");
+    VSH_EXCLUSIVE_OPTIONS("postcopy-auto", "postcopy-after-precopy");
     VSH_REQUIRE_OPTION("persistent-xml", "persistent");
 
     if (!(dom = virshCommandOptDomain(ctl, cmd, NULL)))
@@ -12954,6 +13341,54 @@ virshEventBlockThresholdPrint(virConnectPtr conn ATTRIBUTE_UNUSED,
 }
 
 
+static void
+virshEventStatsPrint(virConnectPtr conn ATTRIBUTE_UNUSED,
+                     virDomainPtr dom,
+                     virTypedParameterPtr params,
+                     int nparams,
+                     void *opaque)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+    char *value;
+
+    virBufferAsprintf(&buf, _("event 'stats' for domain %s:\n"),
+                      virDomainGetName(dom));
+    for (i = 0; i < nparams; i++) {
+        value = virTypedParameterToString(&params[i]);
+        if (value) {
+            virBufferAsprintf(&buf, "\t%s: %s\n", params[i].field, value);
+            VIR_FREE(value);
+        }
+    }
+    virshEventPrint(opaque, &buf);
+}
+
+
+static void
+virshEventBlockJobGroupPrint(virConnectPtr conn ATTRIBUTE_UNUSED,
+                             virDomainPtr dom,
+                             virTypedParameterPtr params,
+                             int nparams,
+                             void *opaque)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+    char *value;
+
+    virBufferAsprintf(&buf, _("event 'block-job-group' for domain %s:\n"),
+                      virDomainGetName(dom));
+    for (i = 0; i < nparams; i++) {
+        value = virTypedParameterToString(&params[i]);
+        if (value) {
+            virBufferAsprintf(&buf, "\t%s: %s\n", params[i].field, value);
+            VIR_FREE(value);
+        }
+    }
+    virshEventPrint(opaque, &buf);
+}
+
+
 static vshEventCallback vshEventCallbacks[] = {
     { "lifecycle",
       VIR_DOMAIN_EVENT_CALLBACK(virshEventLifecyclePrint), },
@@ -13003,6 +13438,10 @@ static vshEventCallback vshEventCallbacks[] = {
       VIR_DOMAIN_EVENT_CALLBACK(virshEventMetadataChangePrint), },
     { "block-threshold",
       VIR_DOMAIN_EVENT_CALLBACK(virshEventBlockThresholdPrint), },
+    { "stats",
+      VIR_DOMAIN_EVENT_CALLBACK(virshEventStatsPrint), },
+    { "block-job-group",
+      VIR_DOMAIN_EVENT_CALLBACK(virshEventBlockJobGroupPrint), },
 };
 verify(VIR_DOMAIN_EVENT_ID_LAST == ARRAY_CARDINALITY(vshEventCallbacks));
 
@@ -14131,5 +14570,41 @@ const vshCmdDef domManagementCmds[] = {
      .info = info_domblkthreshold,
      .flags = 0
     },
+    {.name = "backup-begin",
+     .handler = cmdBackupBegin,
+     .opts = opts_backup_begin,
+     .info = info_backup_begin,
+     .flags = 0
+    },
+    {.name = "backup-dumpxml",
+     .handler = cmdBackupDumpXML,
+     .opts = opts_backup_dumpxml,
+     .info = info_backup_dumpxml,
+     .flags = 0
+    },
+    {.name = "backup-end",
+     .handler = cmdBackupEnd,
+     .opts = opts_backup_end,
+     .info = info_backup_end,
+     .flags = 0
+    },
+    {.name = "blockjobgroup-abort",
+     .handler = cmdBlockJobGroupAbort,
+     .opts = opts_blockjobgroup_abort,
+     .info = info_blockjobgroup_abort,
+     .flags = 0
+    },
+    {.name = "blockjobgroup-info",
+     .handler = cmdBlockJobGroupInfo,
+     .opts = opts_blockjobgroup_info,
+     .info = info_blockjobgroup_info,
+     .flags = 0
+    },
+    {.name = "blockjobgroup-start",
+     .handler = cmdBlockJobGroupStart,
+     .opts = opts_blockjobgroup_start,
+     .info = info_blockjobgroup_start,
+     .flags = 0
+    },
     {.name = NULL}
 };
@@ -285,6 +285,10 @@ static const vshCmdOptDef opts_freepages[] = {
      .type = VSH_OT_BOOL,
      .help = N_("show free pages for all NUMA cells")
     },
+    {.name = "reserved",
+     .type = VSH_OT_BOOL,
+     .help = N_("show pages reserved for domains instead of free pages")
+    },
     {.name = NULL}
 };
 
@@ -316,10 +320,14 @@ cmdFreepages(vshControl *ctl, const vshCmd *cmd)
     bool all = vshCommandOptBool(cmd, "all");
     bool cellno = vshCommandOptBool(cmd, "cellno");
     bool pagesz = vshCommandOptBool(cmd, "pagesize");
+    unsigned int flags = 0;
     virshControlPtr priv = ctl->privData;
 
     VSH_EXCLUSIVE_OPTIONS_VAR(all, cellno);
 
+    if (vshCommandOptBool(cmd, "reserved"))
+        flags |= VIR_NODE_GET_FREE_PAGES_RESERVED;
+
     if (vshCommandOptScaledInt(ctl, cmd, "pagesize", &bytes, 1024, UINT_MAX) < 0)
         goto cleanup;
     kibibytes = VIR_DIV_UP(bytes, 1024);
@@ -403,7 +411,7 @@ cmdFreepages(vshControl *ctl, const vshCmd *cmd)
             VIR_FREE(val);
 
             if (virNodeGetFreePages(priv->conn, npages, pagesize,
-                                    cell, 1, counts, 0) < 0)
+                                    cell, 1, counts, flags) < 0)
                 goto cleanup;
 
             vshPrint(ctl, _("Node %d:\n"), cell);
@@ -439,7 +447,7 @@ cmdFreepages(vshControl *ctl, const vshCmd *cmd)
         counts = vshMalloc(ctl, sizeof(*counts));
 
         if (virNodeGetFreePages(priv->conn, 1, pagesize,
-                                cell, 1, counts, 0) < 0)
+                                cell, 1, counts, flags) < 0)
             goto cleanup;
 
         vshPrint(ctl, "%uKiB: %lld\n", *pagesize, counts[0]);
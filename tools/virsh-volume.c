@@ -659,6 +659,14 @@ static const vshCmdOptDef opts_vol_upload[] = {
      .type = VSH_OT_INT,
      .help = N_("amount of data to upload")
     },
+    {.name = "sparse",
+     .type = VSH_OT_BOOL,
+     .help = N_("preserve sparseness of volume")
+    },
+    {.name = "parallel",
+     .type = VSH_OT_INT,
+     .help = N_("number of streams to upload with")
+    },
     {.name = NULL}
 };
 
@@ -671,6 +679,90 @@ cmdVolUploadSource(virStreamPtr st ATTRIBUTE_UNUSED,
     return saferead(*fd, bytes, nbytes);
 }
 
+#define VIRSH_VOL_SPARSE_BUFLEN (256 * 1024)
+
+/* Local file of a parallel transfer, its start matches @base in the
+ * volume */
+typedef struct virshVolRangeFile virshVolRangeFile;
+struct virshVolRangeFile {
+    int fd;
+    unsigned long long base;
+};
+
+static int
+cmdVolUploadRangeSource(virStorageVolPtr vol ATTRIBUTE_UNUSED,
+                        unsigned long long offset,
+                        char *bytes, size_t nbytes, void *opaque)
+{
+    virshVolRangeFile *file = opaque;
+    ssize_t got;
+
+    do {
+        got = pread(file->fd, bytes, nbytes, offset - file->base);
+    } while (got < 0 && errno == EINTR);
+
+    if (got < 0)
+        virReportSystemError(errno, "%s", _("unable to read file"));
+
+    return got;
+}
+
+/* Sends the contents of @fd to @st announcing its holes rather
+ * than reading and sending them as zeroes. */
+static int
+cmdVolUploadSparse(virStreamPtr st, int fd)
+{
+    char *buf = NULL;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(buf, VIRSH_VOL_SPARSE_BUFLEN) < 0)
+        return -1;
+
+    while (1) {
+        int inData;
+        long long sectionLen;
+        ssize_t got;
+        ssize_t offset;
+
+        if (virFileInData(fd, &inData, &sectionLen) < 0)
+            goto cleanup;
+
+        if (!inData) {
+            if (sectionLen == 0)
+                break; /* End of file */
+
+            if (virStreamSendHole(st, sectionLen, 0) < 0)
+                goto cleanup;
+
+            if (lseek(fd, sectionLen, SEEK_CUR) == (off_t) -1) {
+                virReportSystemError(errno, "%s", _("unable to seek in file"));
+                goto cleanup;
+            }
+            continue;
+        }
+
+        if ((got = saferead(fd, buf, MIN(sectionLen,
+                                         VIRSH_VOL_SPARSE_BUFLEN))) < 0) {
+            virReportSystemError(errno, "%s", _("unable to read file"));
+            goto cleanup;
+        }
+        if (got == 0)
+            break;
+
+        for (offset = 0; offset < got;) {
+            int sent = virStreamSend(st, buf + offset, got - offset);
+            if (sent < 0)
+                goto cleanup;
+            offset += sent;
+        }
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(buf);
+    return ret;
+}
+
 static bool
 cmdVolUpload(vshControl *ctl, const vshCmd *cmd)
 {
@@ -682,6 +774,13 @@ cmdVolUpload(vshControl *ctl, const vshCmd *cmd)
     const char *name = NULL;
     unsigned long long offset = 0, length = 0;
     virshControlPtr priv = ctl->privData;
+    unsigned int flags = 0;
+    bool sparse = vshCommandOptBool(cmd, "sparse");
+    unsigned int parallel = 0;
+    struct stat sb;
+    int rc;
+
+    VSH_EXCLUSIVE_OPTIONS("sparse", "parallel");
 
     if (vshCommandOptULongLong(ctl, cmd, "offset", &offset) < 0)
         return false;
@@ -689,6 +788,9 @@ cmdVolUpload(vshControl *ctl, const vshCmd *cmd)
     if (vshCommandOptULongLongWrap(ctl, cmd, "length", &length) < 0)
         return false;
 
+    if (vshCommandOptUInt(ctl, cmd, "parallel", &parallel) < 0)
+        return false;
+
     if (!(vol = virshCommandOptVol(ctl, cmd, "vol", "pool", &name)))
         return false;
 
@@ -700,17 +802,54 @@ cmdVolUpload(vshControl *ctl, const vshCmd *cmd)
         goto cleanup;
     }
 
+    if (parallel) {
+        virshVolRangeFile range = { fd, offset };
+
+        if (!length) {
+            if (fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode)) {
+                vshError(ctl, "%s",
+                         _("--length is required unless uploading a regular file"));
+                goto cleanup;
+            }
+            length = sb.st_size;
+        }
+
+        if (virStorageVolUploadParallel(vol, offset, length, parallel,
+                                        cmdVolUploadRangeSource, &range,
+                                        0) < 0) {
+            vshError(ctl, _("cannot upload to volume %s"), name);
+            goto cleanup;
+        }
+
+        ret = true;
+        goto cleanup;
+    }
+
+    /* Only regular files can be asked about their holes */
+    if (sparse && fstat(fd, &sb) == 0 && !S_ISREG(sb.st_mode))
+        sparse = false;
+
+    if (sparse)
+        flags |= VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM;
+
     if (!(st = virStreamNew(priv->conn, 0))) {
         vshError(ctl, _("cannot create a new stream"));
         goto cleanup;
     }
 
-    if (virStorageVolUpload(vol, st, offset, length, 0) < 0) {
+    if (virStorageVolUpload(vol, st, offset, length, flags) < 0) {
         vshError(ctl, _("cannot upload to volume %s"), name);
         goto cleanup;
     }
 
-    if (virStreamSendAll(st, cmdVolUploadSource, &fd) < 0) {
+    if (sparse) {
+        if ((rc = cmdVolUploadSparse(st, fd)) < 0)
+            virStreamAbort(st);
+    } else {
+        rc = virStreamSendAll(st, cmdVolUploadSource, &fd);
+    }
+
+    if (rc < 0) {
         vshError(ctl, _("cannot send data to volume %s"), name);
         goto cleanup;
     }
@@ -762,9 +901,76 @@ static const vshCmdOptDef opts_vol_download[] = {
      .type = VSH_OT_INT,
      .help = N_("amount of data to download")
     },
+    {.name = "sparse",
+     .type = VSH_OT_BOOL,
+     .help = N_("preserve sparseness of volume")
+    },
+    {.name = "parallel",
+     .type = VSH_OT_INT,
+     .help = N_("number of streams to download with")
+    },
     {.name = NULL}
 };
 
+static int
+cmdVolDownloadRangeSink(virStorageVolPtr vol ATTRIBUTE_UNUSED,
+                        unsigned long long offset,
+                        const char *bytes, size_t nbytes, void *opaque)
+{
+    virshVolRangeFile *file = opaque;
+    ssize_t done;
+
+    do {
+        done = pwrite(file->fd, bytes, nbytes, offset - file->base);
+    } while (done < 0 && errno == EINTR);
+
+    if (done < 0)
+        virReportSystemError(errno, "%s", _("unable to write file"));
+
+    return done;
+}
+
+/* Receives the contents of @st into @fd creating holes where the
+ * stream announces them. */
+static int
+cmdVolDownloadSparse(virStreamPtr st, int fd)
+{
+    char *buf = NULL;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(buf, VIRSH_VOL_SPARSE_BUFLEN) < 0)
+        return -1;
+
+    while (1) {
+        int got = virStreamRecvFlags(st, buf, VIRSH_VOL_SPARSE_BUFLEN,
+                                     VIR_STREAM_RECV_STOP_AT_HOLE);
+
+        if (got == -3) {
+            long long length;
+
+            if (virStreamRecvHole(st, &length, 0) < 0 ||
+                virFilePunchHole(fd, length) < 0)
+                goto cleanup;
+            continue;
+        }
+
+        if (got < 0)
+            goto cleanup;
+        if (got == 0)
+            break;
+
+        if (safewrite(fd, buf, got) < 0) {
+            virReportSystemError(errno, "%s", _("unable to write file"));
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(buf);
+    return ret;
+}
+
 static bool
 cmdVolDownload(vshControl *ctl, const vshCmd *cmd)
 {
@@ -777,6 +983,17 @@ cmdVolDownload(vshControl *ctl, const vshCmd *cmd)
     unsigned long long offset = 0, length = 0;
     bool created = false;
     virshControlPtr priv = ctl->privData;
+    unsigned int flags = 0;
+    unsigned int parallel = 0;
+    int rc;
+
+    VSH_EXCLUSIVE_OPTIONS("sparse", "parallel");
+
+    if (vshCommandOptBool(cmd, "sparse"))
+        flags |= VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM;
+
+    if (vshCommandOptUInt(ctl, cmd, "parallel", &parallel) < 0)
+        return false;
 
     if (vshCommandOptULongLong(ctl, cmd, "offset", &offset) < 0)
         return false;
@@ -800,17 +1017,43 @@ cmdVolDownload(vshControl *ctl, const vshCmd *cmd)
         created = true;
     }
 
+    if (parallel) {
+        virshVolRangeFile range = { fd, offset };
+
+        if (virStorageVolDownloadParallel(vol, offset, length, parallel,
+                                          cmdVolDownloadRangeSink, &range,
+                                          0) < 0) {
+            vshError(ctl, _("cannot download from volume %s"), name);
+            goto cleanup;
+        }
+
+        if (VIR_CLOSE(fd) < 0) {
+            vshError(ctl, _("cannot close file %s"), file);
+            goto cleanup;
+        }
+
+        ret = true;
+        goto cleanup;
+    }
+
     if (!(st = virStreamNew(priv->conn, 0))) {
         vshError(ctl, _("cannot create a new stream"));
         goto cleanup;
     }
 
-    if (virStorageVolDownload(vol, st, offset, length, 0) < 0) {
+    if (virStorageVolDownload(vol, st, offset, length, flags) < 0) {
         vshError(ctl, _("cannot download from volume %s"), name);
         goto cleanup;
     }
 
-    if (virStreamRecvAll(st, virshStreamSink, &fd) < 0) {
+    if (flags & VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM) {
+        if ((rc = cmdVolDownloadSparse(st, fd)) < 0)
+            virStreamAbort(st);
+    } else {
+        rc = virStreamRecvAll(st, virshStreamSink, &fd);
+    }
+
+    if (rc < 0) {
         vshError(ctl, _("cannot receive data from volume %s"), name);
         goto cleanup;
     }
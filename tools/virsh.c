@@ -442,6 +442,7 @@ virshDeinit(vshControl *ctl)
 
     vshDeinit(ctl);
     VIR_FREE(ctl->connname);
+    VIR_FREE(ctl->batchfile);
     if (priv->conn) {
         int ret;
         virConnectUnregisterCloseCallback(priv->conn, virshCatchDisconnect);
@@ -491,10 +492,12 @@ virshUsage(void)
     fprintf(stdout, _("\n%s [options]... [<command_string>]"
                       "\n%s [options]... <command> [args...]\n\n"
                       "  options:\n"
+                      "    -b | --batch=FILE       run commands read from FILE ('-' for stdin)\n"
                       "    -c | --connect=URI      hypervisor connection URI\n"
                       "    -d | --debug=NUM        debug level [0-4]\n"
                       "    -e | --escape <char>    set escape sequence for console\n"
                       "    -h | --help             this help\n"
+                      "    -j | --jobs=NUM         number of commands run at once in batch mode\n"
                       "    -k | --keepalive-interval=NUM\n"
                       "                            keepalive interval in seconds, 0 for disable\n"
                       "    -K | --keepalive-count=NUM\n"
@@ -706,10 +709,12 @@ virshParseArgv(vshControl *ctl, int argc, char **argv)
     int longindex = -1;
     virshControlPtr priv = ctl->privData;
     struct option opt[] = {
+        {"batch", required_argument, NULL, 'b'},
         {"connect", required_argument, NULL, 'c'},
         {"debug", required_argument, NULL, 'd'},
         {"escape", required_argument, NULL, 'e'},
         {"help", no_argument, NULL, 'h'},
+        {"jobs", required_argument, NULL, 'j'},
         {"keepalive-interval", required_argument, NULL, 'k'},
         {"keepalive-count", required_argument, NULL, 'K'},
         {"log", required_argument, NULL, 'l'},
@@ -723,8 +728,12 @@ virshParseArgv(vshControl *ctl, int argc, char **argv)
     /* Standard (non-command) options. The leading + ensures that no
      * argument reordering takes place, so that command options are
      * not confused with top-level virsh options. */
-    while ((arg = getopt_long(argc, argv, "+:c:d:e:hk:K:l:qrtvV", opt, &longindex)) != -1) {
+    while ((arg = getopt_long(argc, argv, "+:b:c:d:e:hj:k:K:l:qrtvV", opt, &longindex)) != -1) {
         switch (arg) {
+        case 'b':
+            VIR_FREE(ctl->batchfile);
+            ctl->batchfile = vshStrdup(ctl, optarg);
+            break;
         case 'c':
             VIR_FREE(ctl->connname);
             ctl->connname = vshStrdup(ctl, optarg);
@@ -758,6 +767,15 @@ virshParseArgv(vshControl *ctl, int argc, char **argv)
             virshUsage();
             exit(EXIT_SUCCESS);
             break;
+        case 'j':
+            if (virStrToLong_ui(optarg, NULL, 10, &ctl->batchjobs) < 0 ||
+                ctl->batchjobs == 0) {
+                vshError(ctl,
+                         _("option %s requires a positive integer argument"),
+                         longindex == -1 ? "-j" : "--jobs");
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'k':
             if (virStrToLong_i(optarg, NULL, 0, &keepalive) < 0) {
                 vshError(ctl,
@@ -837,7 +855,14 @@ virshParseArgv(vshControl *ctl, int argc, char **argv)
         longindex = -1;
     }
 
-    if (argc == optind) {
+    if (ctl->batchfile) {
+        if (argc != optind) {
+            vshError(ctl, "%s",
+                     _("commands cannot be given together with --batch"));
+            exit(EXIT_FAILURE);
+        }
+        ctl->imode = false;
+    } else if (argc == optind) {
         ctl->imode = true;
     } else {
         /* parse command */
@@ -957,7 +982,9 @@ main(int argc, char **argv)
         ctl->connname = vshStrdup(ctl,
                                   virGetEnvBlockSUID("VIRSH_DEFAULT_CONNECT_URI"));
 
-    if (!ctl->imode) {
+    if (ctl->batchfile) {
+        ret = vshBatchRun(ctl, ctl->batchfile, ctl->batchjobs);
+    } else if (!ctl->imode) {
         ret = vshCommandRun(ctl, ctl->cmd);
     } else {
         /* interactive mode */
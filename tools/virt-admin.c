@@ -457,8 +457,130 @@ cmdSrvThreadpoolInfo(vshControl *ctl, const vshCmd *cmd)
         goto cleanup;
     }
 
-    for (i = 0; i < nparams; i++)
-        vshPrint(ctl, "%-15s: %u\n", params[i].field, params[i].value.ui);
+    for (i = 0; i < nparams; i++) {
+        char *str = vshGetTypedParamValue(ctl, &params[i]);
+        vshPrint(ctl, "%-17s: %s\n", params[i].field, str);
+        VIR_FREE(str);
+    }
+
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    if (srv)
+        virAdmServerFree(srv);
+    return ret;
+}
+
+/* ---------------------
+ * Command srv-rpc-stats
+ * ---------------------
+ */
+
+static const vshCmdInfo info_srv_rpc_stats[] = {
+    {.name = "help",
+     .data = N_("get server RPC statistics")
+    },
+    {.name = "desc",
+     .data = N_("Retrieve per-procedure call counts and latencies of the "
+                "RPC calls dispatched by a server.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_srv_rpc_stats[] = {
+    {.name = "server",
+     .type = VSH_OT_DATA,
+     .flags = VSH_OFLAG_REQ,
+     .help = N_("Server to retrieve RPC statistics from."),
+    },
+    {.name = "raw",
+     .type = VSH_OT_BOOL,
+     .help = N_("print all the statistics as reported by the server"),
+    },
+    {.name = NULL}
+};
+
+static unsigned long long
+vshAdmRPCStatsGet(virTypedParameterPtr params,
+                  int nparams,
+                  size_t num,
+                  const char *name)
+{
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    unsigned long long value = 0;
+
+    snprintf(field, sizeof(field), "rpc.%zu.%s", num, name);
+    ignore_value(virTypedParamsGetULLong(params, nparams, field, &value));
+    return value;
+}
+
+static bool
+cmdSrvRPCStats(vshControl *ctl, const vshCmd *cmd)
+{
+    bool ret = false;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    unsigned int count = 0;
+    size_t i;
+    const char *srvname = NULL;
+    virAdmServerPtr srv = NULL;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (vshCommandOptStringReq(ctl, cmd, "server", &srvname) < 0)
+        return false;
+
+    if (!(srv = virAdmConnectLookupServer(priv->conn, srvname, 0)))
+        goto cleanup;
+
+    if (virAdmServerGetRPCStats(srv, &params, &nparams, 0) < 0) {
+        vshError(ctl, "%s", _("Unable to get server RPC statistics"));
+        goto cleanup;
+    }
+
+    if (vshCommandOptBool(cmd, "raw")) {
+        for (i = 0; i < nparams; i++) {
+            char *str = vshGetTypedParamValue(ctl, &params[i]);
+            vshPrint(ctl, "%-30s: %s\n", params[i].field, str);
+            VIR_FREE(str);
+        }
+        ret = true;
+        goto cleanup;
+    }
+
+    if (virTypedParamsGetUInt(params, nparams,
+                              VIR_SERVER_RPC_STATS_COUNT, &count) < 0)
+        goto cleanup;
+
+    vshPrintExtra(ctl, " %-10s %-5s %12s %8s %10s %10s %10s %10s\n",
+                  _("Program"), _("Proc"), _("Calls"), _("Errors"),
+                  _("Queue(us)"), _("Run(us)"), _("RunMax(us)"),
+                  _("Encode(us)"));
+    vshPrintExtra(ctl, "-----------------------------------------------"
+                  "-------------------------------------\n");
+
+    for (i = 0; i < count; i++) {
+        char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+        unsigned int program = 0;
+        int proc = 0;
+        unsigned long long calls;
+
+        snprintf(field, sizeof(field), "rpc.%zu.program", i);
+        ignore_value(virTypedParamsGetUInt(params, nparams, field, &program));
+        snprintf(field, sizeof(field), "rpc.%zu.proc", i);
+        ignore_value(virTypedParamsGetInt(params, nparams, field, &proc));
+
+        if (!(calls = vshAdmRPCStatsGet(params, nparams, i, "calls")))
+            continue;
+
+        vshPrint(ctl, " 0x%-8x %-5d %12llu %8llu %10llu %10llu %10llu %10llu\n",
+                 program, proc, calls,
+                 vshAdmRPCStatsGet(params, nparams, i, "errors"),
+                 vshAdmRPCStatsGet(params, nparams, i, "queueTimeTotal") / calls,
+                 vshAdmRPCStatsGet(params, nparams, i, "dispatchTimeTotal") / calls,
+                 vshAdmRPCStatsGet(params, nparams, i, "dispatchTimeMax"),
+                 vshAdmRPCStatsGet(params, nparams, i, "encodeTimeTotal") / calls);
+    }
 
     ret = true;
 
@@ -856,8 +978,11 @@ cmdSrvClientsInfo(vshControl *ctl, const vshCmd *cmd)
         goto cleanup;
     }
 
-    for (i = 0; i < nparams; i++)
-        vshPrint(ctl, "%-20s: %u\n", params[i].field, params[i].value.ui);
+    for (i = 0; i < nparams; i++) {
+        char *str = vshGetTypedParamValue(ctl, &params[i]);
+        vshPrint(ctl, "%-22s: %s\n", params[i].field, str);
+        VIR_FREE(str);
+    }
 
     ret = true;
 
@@ -899,6 +1024,42 @@ static const vshCmdOptDef opts_srv_clients_set[] = {
      .help = N_("Change the upper limit to number of clients waiting for "
                 "authentication to be connected to the server"),
     },
+    {.name = "client-request-rate",
+     .type = VSH_OT_INT,
+     .help = N_("Change the upper limit to number of requests per second "
+                "accepted from a single client, 0 for unlimited"),
+    },
+    {.name = "client-request-burst",
+     .type = VSH_OT_INT,
+     .help = N_("Change the number of requests an idle client can send "
+                "at once"),
+    },
+    {.name = "identity-request-rate",
+     .type = VSH_OT_INT,
+     .help = N_("Change the upper limit to number of requests per second "
+                "accepted from all clients of the same identity, "
+                "0 for unlimited"),
+    },
+    {.name = "identity-request-burst",
+     .type = VSH_OT_INT,
+     .help = N_("Change the number of requests the idle clients of the same "
+                "identity can send at once"),
+    },
+    {.name = "client-requests-max",
+     .type = VSH_OT_INT,
+     .help = N_("Change the upper limit to number of requests a single "
+                "client can have in flight"),
+    },
+    {.name = "keepalive-interval",
+     .type = VSH_OT_INT,
+     .help = N_("Change the number of seconds a new client can stay silent "
+                "before it is probed, -1 to disable keepalive"),
+    },
+    {.name = "keepalive-count",
+     .type = VSH_OT_INT,
+     .help = N_("Change the number of probes a new client can leave "
+                "unanswered before it is disconnected"),
+    },
     {.name = NULL}
 };
 
@@ -908,6 +1069,7 @@ cmdSrvClientsSet(vshControl *ctl, const vshCmd *cmd)
     bool ret = false;
     int rv = 0;
     unsigned int val, max, unauth_max;
+    int interval;
     int maxparams = 0;
     int nparams = 0;
     const char *srvname = NULL;
@@ -930,12 +1092,39 @@ cmdSrvClientsSet(vshControl *ctl, const vshCmd *cmd)
 
     PARSE_CMD_TYPED_PARAM("max-clients", VIR_SERVER_CLIENTS_MAX);
     PARSE_CMD_TYPED_PARAM("max-unauth-clients", VIR_SERVER_CLIENTS_UNAUTH_MAX);
+    PARSE_CMD_TYPED_PARAM("client-request-rate",
+                          VIR_SERVER_CLIENTS_REQUEST_RATE);
+    PARSE_CMD_TYPED_PARAM("client-request-burst",
+                          VIR_SERVER_CLIENTS_REQUEST_BURST);
+    PARSE_CMD_TYPED_PARAM("identity-request-rate",
+                          VIR_SERVER_IDENTITY_REQUEST_RATE);
+    PARSE_CMD_TYPED_PARAM("identity-request-burst",
+                          VIR_SERVER_IDENTITY_REQUEST_BURST);
+    PARSE_CMD_TYPED_PARAM("client-requests-max",
+                          VIR_SERVER_CLIENTS_REQUESTS_MAX);
+    PARSE_CMD_TYPED_PARAM("keepalive-count", VIR_SERVER_KEEPALIVE_COUNT);
 
 #undef PARSE_CMD_TYPED_PARAM
 
+    if ((rv = vshCommandOptInt(ctl, cmd, "keepalive-interval",
+                               &interval)) < 0) {
+        goto cleanup;
+    } else if (rv > 0) {
+        if (virTypedParamsAddInt(&params, &nparams, &maxparams,
+                                 VIR_SERVER_KEEPALIVE_INTERVAL,
+                                 interval) < 0)
+            goto save_error;
+    }
+
     if (!nparams) {
         vshError(ctl, "%s", _("At least one of options --max-clients, "
-                              "--max-unauth-clients is mandatory"));
+                              "--max-unauth-clients, --client-request-rate, "
+                              "--client-request-burst, "
+                              "--identity-request-rate, "
+                              "--identity-request-burst, "
+                              "--client-requests-max, "
+                              "--keepalive-interval, "
+                              "--keepalive-count is mandatory"));
         goto cleanup;
     }
 
@@ -971,6 +1160,316 @@ cmdSrvClientsSet(vshControl *ctl, const vshCmd *cmd)
     goto cleanup;
 }
 
+/* ------------------------------
+ * Command daemon-event-loop-stats
+ * ------------------------------
+ */
+static const vshCmdInfo info_daemon_event_loop_stats[] = {
+    {.name = "help",
+     .data = N_("get daemon event loop statistics")
+    },
+    {.name = "desc",
+     .data = N_("Retrieve statistics about the timers of the daemon's "
+                "event loop.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_daemon_event_loop_stats[] = {
+    {.name = "callbacks",
+     .type = VSH_OT_BOOL,
+     .help = N_("also report the callbacks which blocked the event loop "
+                "the longest")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdDaemonEventLoopStats(vshControl *ctl, const vshCmd *cmd)
+{
+    bool ret = false;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    unsigned int flags = 0;
+    size_t i;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (vshCommandOptBool(cmd, "callbacks"))
+        flags |= VIR_ADMIN_EVENT_LOOP_STATS_CALLBACKS;
+
+    if (virAdmConnectGetEventLoopStats(priv->conn, &params,
+                                       &nparams, flags) < 0) {
+        vshError(ctl, "%s",
+                 _("Unable to get daemon event loop statistics"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < nparams; i++) {
+        char *str = vshGetTypedParamValue(ctl, &params[i]);
+        vshPrint(ctl, "%-15s: %s\n", params[i].field, str);
+        VIR_FREE(str);
+    }
+
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    return ret;
+}
+
+/* ------------------------------
+ * Command daemon-event-loop-info
+ * ------------------------------
+ */
+static const vshCmdInfo info_daemon_event_loop_info[] = {
+    {.name = "help",
+     .data = N_("get daemon event loop parameters")
+    },
+    {.name = "desc",
+     .data = N_("Retrieve the current tunables of the daemon's event loop.")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdDaemonEventLoopInfo(vshControl *ctl, const vshCmd *cmd ATTRIBUTE_UNUSED)
+{
+    bool ret = false;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    size_t i;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (virAdmConnectGetEventLoopParameters(priv->conn, &params,
+                                            &nparams, 0) < 0) {
+        vshError(ctl, "%s",
+                 _("Unable to get daemon event loop parameters"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < nparams; i++) {
+        char *str = vshGetTypedParamValue(ctl, &params[i]);
+        vshPrint(ctl, "%-15s: %s\n", params[i].field, str);
+        VIR_FREE(str);
+    }
+
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    return ret;
+}
+
+/* -----------------------------
+ * Command daemon-event-loop-set
+ * -----------------------------
+ */
+static const vshCmdInfo info_daemon_event_loop_set[] = {
+    {.name = "help",
+     .data = N_("set daemon event loop parameters")
+    },
+    {.name = "desc",
+     .data = N_("Tune the daemon's event loop while it keeps running. "
+                "See OPTIONS for currently supported attributes.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_daemon_event_loop_set[] = {
+    {.name = "threads",
+     .type = VSH_OT_INT,
+     .help = N_("Change the number of threads new clients are spread over, "
+                "including the main event loop"),
+    },
+    {.name = "stall-threshold",
+     .type = VSH_OT_INT,
+     .help = N_("Change the time in milliseconds a callback can block the "
+                "event loop before a warning is logged, 0 to stop timing "
+                "callbacks"),
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdDaemonEventLoopSet(vshControl *ctl, const vshCmd *cmd)
+{
+    bool ret = false;
+    int rv = 0;
+    unsigned int val;
+    int maxparams = 0;
+    int nparams = 0;
+    virTypedParameterPtr params = NULL;
+    vshAdmControlPtr priv = ctl->privData;
+
+#define PARSE_CMD_TYPED_PARAM(NAME, FIELD)                                   \
+    if ((rv = vshCommandOptUInt(ctl, cmd, NAME, &val)) < 0) {                \
+        vshError(ctl, _("Unable to parse integer parameter '%s'"), NAME);    \
+        goto cleanup;                                                        \
+    } else if (rv > 0) {                                                     \
+        if (virTypedParamsAddUInt(&params, &nparams, &maxparams,             \
+                                  FIELD, val) < 0)                           \
+        goto save_error;                                                     \
+    }
+
+    PARSE_CMD_TYPED_PARAM("threads", VIR_EVENT_LOOP_THREADS);
+    PARSE_CMD_TYPED_PARAM("stall-threshold", VIR_EVENT_LOOP_STALL_THRESHOLD);
+
+#undef PARSE_CMD_TYPED_PARAM
+
+    if (!nparams) {
+        vshError(ctl, "%s", _("At least one of options --threads, "
+                              "--stall-threshold is mandatory"));
+        goto cleanup;
+    }
+
+    if (virAdmConnectSetEventLoopParameters(priv->conn, params,
+                                            nparams, 0) < 0)
+        goto error;
+
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    return ret;
+
+ save_error:
+    vshSaveLibvirtError();
+
+ error:
+    vshError(ctl, "%s", _("Unable to change daemon event loop parameters"));
+    goto cleanup;
+}
+
+/* ----------------------------------
+ * Command daemon-command-broker-stats
+ * ----------------------------------
+ */
+static const vshCmdInfo info_daemon_command_broker_stats[] = {
+    {.name = "help",
+     .data = N_("get daemon command broker statistics")
+    },
+    {.name = "desc",
+     .data = N_("Retrieve statistics about the commands run by the "
+                "daemon's command broker.")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdDaemonCommandBrokerStats(vshControl *ctl,
+                            const vshCmd *cmd ATTRIBUTE_UNUSED)
+{
+    bool ret = false;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    size_t i;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (virAdmConnectGetCommandBrokerStats(priv->conn, &params,
+                                           &nparams, 0) < 0) {
+        vshError(ctl, "%s",
+                 _("Unable to get daemon command broker statistics"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < nparams; i++) {
+        char *str = vshGetTypedParamValue(ctl, &params[i]);
+        vshPrint(ctl, "%-15s: %s\n", params[i].field, str);
+        VIR_FREE(str);
+    }
+
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    return ret;
+}
+
+/* ---------------------------
+ * Command daemon-memory-stats
+ * ---------------------------
+ */
+static const vshCmdInfo info_daemon_memory_stats[] = {
+    {.name = "help",
+     .data = N_("get daemon memory statistics")
+    },
+    {.name = "desc",
+     .data = N_("Retrieve statistics about the memory used by the daemon.")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdDaemonMemoryStats(vshControl *ctl,
+                     const vshCmd *cmd ATTRIBUTE_UNUSED)
+{
+    bool ret = false;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    size_t i;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (virAdmConnectGetMemoryStats(priv->conn, &params, &nparams, 0) < 0) {
+        vshError(ctl, "%s", _("Unable to get daemon memory statistics"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < nparams; i++) {
+        char *str = vshGetTypedParamValue(ctl, &params[i]);
+        vshPrint(ctl, "%-15s: %s\n", params[i].field, str);
+        VIR_FREE(str);
+    }
+
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    return ret;
+}
+
+/* -------------------------
+ * Command daemon-lock-stats
+ * -------------------------
+ */
+static const vshCmdInfo info_daemon_lock_stats[] = {
+    {.name = "help",
+     .data = N_("get daemon lock contention statistics")
+    },
+    {.name = "desc",
+     .data = N_("Retrieve statistics about the threads of the daemon "
+                "waiting for each other's locks.")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdDaemonLockStats(vshControl *ctl,
+                   const vshCmd *cmd ATTRIBUTE_UNUSED)
+{
+    bool ret = false;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    size_t i;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (virAdmConnectGetLockStats(priv->conn, &params, &nparams, 0) < 0) {
+        vshError(ctl, "%s", _("Unable to get daemon lock statistics"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < nparams; i++) {
+        char *str = vshGetTypedParamValue(ctl, &params[i]);
+        vshPrint(ctl, "%-15s: %s\n", params[i].field, str);
+        VIR_FREE(str);
+    }
+
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    return ret;
+}
+
 /* --------------------------
  * Command daemon-log-filters
  * --------------------------
@@ -1419,6 +1918,52 @@ static const vshCmdDef monitoringCmds[] = {
      .info = info_srv_clients_info,
      .flags = 0
     },
+    {.name = "srv-rpc-stats",
+     .flags = VSH_CMD_FLAG_ALIAS,
+     .alias = "server-rpc-stats"
+    },
+    {.name = "server-rpc-stats",
+     .handler = cmdSrvRPCStats,
+     .opts = opts_srv_rpc_stats,
+     .info = info_srv_rpc_stats,
+     .flags = 0
+    },
+    {.name = "daemon-event-loop-stats",
+     .handler = cmdDaemonEventLoopStats,
+     .opts = opts_daemon_event_loop_stats,
+     .info = info_daemon_event_loop_stats,
+     .flags = 0
+    },
+    {.name = "daemon-event-loop-info",
+     .handler = cmdDaemonEventLoopInfo,
+     .opts = NULL,
+     .info = info_daemon_event_loop_info,
+     .flags = 0
+    },
+    {.name = "daemon-event-loop-set",
+     .handler = cmdDaemonEventLoopSet,
+     .opts = opts_daemon_event_loop_set,
+     .info = info_daemon_event_loop_set,
+     .flags = 0
+    },
+    {.name = "daemon-command-broker-stats",
+     .handler = cmdDaemonCommandBrokerStats,
+     .opts = NULL,
+     .info = info_daemon_command_broker_stats,
+     .flags = 0
+    },
+    {.name = "daemon-memory-stats",
+     .handler = cmdDaemonMemoryStats,
+     .opts = NULL,
+     .info = info_daemon_memory_stats,
+     .flags = 0
+    },
+    {.name = "daemon-lock-stats",
+     .handler = cmdDaemonLockStats,
+     .opts = NULL,
+     .info = info_daemon_lock_stats,
+     .flags = 0
+    },
     {.name = NULL}
 };
 
@@ -54,6 +54,8 @@
 #include <libvirt/libvirt-lxc.h>
 #include "virfile.h"
 #include "virthread.h"
+#include "virthreadpool.h"
+#include "virjson.h"
 #include "vircommand.h"
 #include "conf/domain_conf.h"
 #include "virtypedparam.h"
@@ -236,7 +238,59 @@ vshStringToArray(const char *str,
     return nstr_tokens;
 }
 
-virErrorPtr last_error;
+/* Per-thread state, so that commands run concurrently by vshBatchRun
+ * neither mix up their libvirt errors nor their output */
+typedef struct _vshThreadData vshThreadData;
+struct _vshThreadData {
+    virErrorPtr lastError;
+    virBufferPtr out;           /* captures stdout if non-NULL */
+    virBufferPtr err;           /* captures errors if non-NULL */
+};
+
+static virThreadLocal vshThreadDataLocal;
+
+static void
+vshThreadDataFree(void *opaque)
+{
+    vshThreadData *data = opaque;
+
+    if (!data)
+        return;
+
+    virFreeError(data->lastError);
+    VIR_FREE(data);
+}
+
+static int
+vshThreadDataOnceInit(void)
+{
+    return virThreadLocalInit(&vshThreadDataLocal, vshThreadDataFree);
+}
+
+VIR_ONCE_GLOBAL_INIT(vshThreadData)
+
+static vshThreadData *
+vshThreadDataGet(void)
+{
+    vshThreadData *data;
+
+    if (vshThreadDataInitialize() < 0)
+        vshErrorOOM();
+
+    if (!(data = virThreadLocalGet(&vshThreadDataLocal))) {
+        if (VIR_ALLOC_QUIET(data) < 0 ||
+            virThreadLocalSet(&vshThreadDataLocal, data) < 0)
+            vshErrorOOM();
+    }
+
+    return data;
+}
+
+virErrorPtr *
+vshLastError(void)
+{
+    return &vshThreadDataGet()->lastError;
+}
 
 /*
  * Quieten libvirt until we're done with the command.
@@ -1686,6 +1740,342 @@ vshCommandStringParse(vshControl *ctl, char *cmdstr)
     return vshCommandParse(ctl, &parser);
 }
 
+/* ----------
+ * Batch mode
+ * ----------
+ */
+
+typedef struct _vshBatchJob vshBatchJob;
+struct _vshBatchJob {
+    size_t line;                /* line number in the input */
+    char *cmdstr;
+    vshCmd *cmd;
+    bool ret;
+    bool done;
+    virBuffer out;
+    virBuffer err;
+};
+
+typedef struct _vshBatch vshBatch;
+struct _vshBatch {
+    vshControl *ctl;
+    virMutex lock;
+    virCond cond;
+    size_t maxRunning;
+    size_t running;             /* jobs handed to the pool, not done yet */
+    vshBatchJob **jobs;         /* jobs not printed yet, in input order */
+    size_t njobs;
+    bool ret;                   /* false once any command failed */
+};
+
+static void
+vshBatchJobFree(vshBatchJob *job)
+{
+    if (!job)
+        return;
+
+    vshCommandFree(job->cmd);
+    VIR_FREE(job->cmdstr);
+    virBufferFreeAndReset(&job->out);
+    virBufferFreeAndReset(&job->err);
+    VIR_FREE(job);
+}
+
+/* Run the command of @job with its output captured in @job */
+static void
+vshBatchJobRun(vshControl *ctl, vshBatchJob *job)
+{
+    vshThreadData *data = vshThreadDataGet();
+
+    data->out = &job->out;
+    data->err = &job->err;
+
+    vshResetLibvirtError();
+    job->ret = vshCommandRun(ctl, job->cmd);
+    /* drop the separator vshCommandRun prints after the last command */
+    virBufferTrim(&job->out, "\n", -1);
+
+    data->out = NULL;
+    data->err = NULL;
+}
+
+static void
+vshBatchWorker(void *jobdata, void *opaque)
+{
+    vshBatchJob *job = jobdata;
+    vshBatch *batch = opaque;
+
+    vshBatchJobRun(batch->ctl, job);
+
+    virMutexLock(&batch->lock);
+    job->done = true;
+    batch->running--;
+    virCondBroadcast(&batch->cond);
+    virMutexUnlock(&batch->lock);
+}
+
+/* Print @job as a single line JSON object.  Called with batch->lock held. */
+static int
+vshBatchJobPrint(vshControl *ctl, vshBatchJob *job)
+{
+    virJSONValuePtr obj = NULL;
+    char *out = virBufferContentAndReset(&job->out);
+    char *err = virBufferContentAndReset(&job->err);
+    char *str = NULL;
+    int ret = -1;
+
+    if (!(obj = virJSONValueNewObject()) ||
+        virJSONValueObjectAppendNumberUlong(obj, "line", job->line) < 0 ||
+        virJSONValueObjectAppendString(obj, "command", job->cmdstr) < 0 ||
+        virJSONValueObjectAppendBoolean(obj, "success", job->ret) < 0 ||
+        virJSONValueObjectAppendString(obj, "output", out ? out : "") < 0 ||
+        (err ? virJSONValueObjectAppendString(obj, "error", err) :
+               virJSONValueObjectAppendNull(obj, "error")) < 0 ||
+        !(str = virJSONValueToString(obj, false))) {
+        vshSaveLibvirtError();
+        vshReportError(ctl);
+        goto cleanup;
+    }
+
+    fprintf(stdout, "%s\n", str);
+    fflush(stdout);
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(str);
+    VIR_FREE(out);
+    VIR_FREE(err);
+    virJSONValueFree(obj);
+    return ret;
+}
+
+/* Print the finished jobs at the head of the queue, so that the results
+ * come out in the order of the input no matter which command finished
+ * first.  Called with batch->lock held. */
+static void
+vshBatchFlush(vshBatch *batch)
+{
+    size_t i;
+
+    for (i = 0; i < batch->njobs && batch->jobs[i]->done; i++) {
+        if (vshBatchJobPrint(batch->ctl, batch->jobs[i]) < 0 ||
+            !batch->jobs[i]->ret)
+            batch->ret = false;
+        vshBatchJobFree(batch->jobs[i]);
+    }
+
+    memmove(batch->jobs, batch->jobs + i,
+            sizeof(*batch->jobs) * (batch->njobs - i));
+    batch->njobs -= i;
+}
+
+/* Read one line of @fp into @line, without the trailing newline.
+ * Returns 1 on success, 0 on end of file. */
+static int
+vshBatchReadLine(vshControl *ctl, FILE *fp, char **line)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char chunk[1024];
+    bool eof = true;
+    size_t len;
+
+    while (fgets(chunk, sizeof(chunk), fp)) {
+        eof = false;
+        len = strlen(chunk);
+        if (len && chunk[len - 1] == '\n') {
+            virBufferAdd(&buf, chunk, len - 1);
+            break;
+        }
+        virBufferAdd(&buf, chunk, len);
+    }
+
+    if (eof)
+        return 0;
+
+    if (virBufferCheckError(&buf) < 0)
+        vshErrorOOM();
+
+    if (!(*line = virBufferContentAndReset(&buf)))
+        *line = vshStrdup(ctl, "");
+    return 1;
+}
+
+/* Commands that don't need a connection (cd, connect, quit, ...) change the
+ * state all the other commands run in, so they are not run concurrently
+ * with anything else. */
+static bool
+vshBatchCommandIsBarrier(const vshCmd *cmd)
+{
+    for (; cmd; cmd = cmd->next) {
+        if (cmd->def->flags & VSH_CMD_FLAG_NOCONNECT)
+            return true;
+    }
+    return false;
+}
+
+static bool
+vshBatchCommandIsQuit(const vshCmd *cmd)
+{
+    for (; cmd; cmd = cmd->next) {
+        if (STREQ(cmd->def->name, "quit") ||
+            STREQ(cmd->def->name, "exit"))
+            return true;
+    }
+    return false;
+}
+
+/* Wait until no more than @max jobs are running. Called with
+ * batch->lock held; prints whatever finished in the meantime. */
+static void
+vshBatchWait(vshBatch *batch, size_t max)
+{
+    vshBatchFlush(batch);
+    while (batch->running > max) {
+        if (virCondWait(&batch->cond, &batch->lock) < 0) {
+            vshError(batch->ctl, "%s", _("failed to wait on condition"));
+            exit(EXIT_FAILURE);
+        }
+        vshBatchFlush(batch);
+    }
+}
+
+/**
+ * vshBatchRun:
+ * @ctl: virtshell control structure
+ * @path: file to read commands from, "-" for stdin
+ * @jobs: how many commands may run at once
+ *
+ * Read commands from @path, one command string per line, and run them
+ * over the single connection of @ctl, with up to @jobs of them in flight
+ * at once.  Empty lines and lines starting with '#' are skipped.  The
+ * result of every command is printed to stdout as a single line JSON
+ * object, in the order of the input:
+ *
+ *   {"line":1,"command":"...","success":true,"output":"...","error":null}
+ *
+ * Returns true if all commands succeeded.
+ */
+bool
+vshBatchRun(vshControl *ctl, const char *path, size_t jobs)
+{
+    vshBatch batch;
+    virThreadPoolPtr pool = NULL;
+    vshThreadData *data = vshThreadDataGet();
+    const vshClientHooks *hooks = ctl->hooks;
+    vshBatchJob *job = NULL;
+    FILE *fp = NULL;
+    char *line = NULL;
+    size_t lineno = 0;
+    bool quit = false;
+    bool ret = false;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.ctl = ctl;
+    batch.maxRunning = jobs ? jobs : 1;
+    batch.ret = true;
+
+    if (STREQ(path, "-")) {
+        fp = stdin;
+    } else if (!(fp = fopen(path, "r"))) {
+        vshError(ctl, _("cannot open batch file '%s': %s"),
+                 path, strerror(errno));
+        return false;
+    }
+
+    if (virMutexInit(&batch.lock) < 0) {
+        vshError(ctl, "%s", _("Failed to initialize mutex"));
+        goto cleanup;
+    }
+    if (virCondInit(&batch.cond) < 0) {
+        vshError(ctl, "%s", _("Failed to initialize condition"));
+        virMutexDestroy(&batch.lock);
+        goto cleanup;
+    }
+
+    if (!(pool = virThreadPoolNew(batch.maxRunning, batch.maxRunning, 0,
+                                  vshBatchWorker, &batch))) {
+        vshReportError(ctl);
+        goto destroy;
+    }
+
+    virMutexLock(&batch.lock);
+    while (!quit && vshBatchReadLine(ctl, fp, &line) > 0) {
+        const char *p = line;
+
+        lineno++;
+        virSkipSpaces(&p);
+        if (*p == '\0' || *p == '#') {
+            VIR_FREE(line);
+            continue;
+        }
+
+        if (VIR_ALLOC_QUIET(job) < 0)
+            vshErrorOOM();
+        job->line = lineno;
+        job->cmdstr = line;
+        line = NULL;
+
+        /* syntax errors are reported as the result of the line */
+        data->err = &job->err;
+        if (vshCommandStringParse(ctl, job->cmdstr)) {
+            job->cmd = ctl->cmd;
+            ctl->cmd = NULL;
+        }
+        data->err = NULL;
+
+        if (!job->cmd) {
+            job->done = true;
+        } else if (vshBatchCommandIsBarrier(job->cmd)) {
+            vshBatchWait(&batch, 0);
+            virMutexUnlock(&batch.lock);
+            vshBatchJobRun(ctl, job);
+            virMutexLock(&batch.lock);
+            job->done = true;
+            quit = vshBatchCommandIsQuit(job->cmd);
+        } else {
+            vshBatchWait(&batch, batch.maxRunning - 1);
+
+            /* Open the connection, or reconnect after losing it, before
+             * the commands start to share it */
+            if (batch.running == 0 && hooks && hooks->connHandler) {
+                virMutexUnlock(&batch.lock);
+                ignore_value(hooks->connHandler(ctl));
+                virMutexLock(&batch.lock);
+            }
+
+            if (virThreadPoolSendJob(pool, 0, job) < 0) {
+                vshReportError(ctl);
+                job->done = true;
+            } else {
+                batch.running++;
+            }
+        }
+
+        if (VIR_APPEND_ELEMENT_QUIET(batch.jobs, batch.njobs, job) < 0)
+            vshErrorOOM();
+        vshBatchFlush(&batch);
+    }
+    vshBatchWait(&batch, 0);
+    virMutexUnlock(&batch.lock);
+
+    if (ferror(fp)) {
+        vshError(ctl, _("failed to read batch file '%s'"), path);
+        batch.ret = false;
+    }
+
+    ret = batch.ret;
+    virThreadPoolFree(pool);
+    VIR_FREE(batch.jobs);
+ destroy:
+    virCondDestroy(&batch.cond);
+    virMutexDestroy(&batch.lock);
+ cleanup:
+    if (fp != stdin)
+        VIR_FORCE_FCLOSE(fp);
+    VIR_FREE(line);
+    return ret;
+}
+
 /**
  * virshCommandOptTimeoutToMs:
  * @ctl virsh control structure
@@ -1774,6 +2164,19 @@ vshGetTypedParamValue(vshControl *ctl, virTypedParameterPtr item)
     return str;
 }
 
+/* Print @str to stdout, or into the capture buffer of the current
+ * thread if it is running a batch command */
+static void
+vshOutputString(const char *str)
+{
+    vshThreadData *data = vshThreadDataGet();
+
+    if (data->out)
+        virBufferAdd(data->out, str, -1);
+    else
+        fputs(str, stdout);
+}
+
 void
 vshDebug(vshControl *ctl, int level, const char *format, ...)
 {
@@ -1798,7 +2201,7 @@ vshDebug(vshControl *ctl, int level, const char *format, ...)
         return;
     }
     va_end(ap);
-    fputs(str, stdout);
+    vshOutputString(str);
     VIR_FREE(str);
 }
 
@@ -1815,7 +2218,7 @@ vshPrintExtra(vshControl *ctl, const char *format, ...)
     if (virVasprintfQuiet(&str, format, ap) < 0)
         vshErrorOOM();
     va_end(ap);
-    fputs(str, stdout);
+    vshOutputString(str);
     VIR_FREE(str);
 }
 
@@ -1830,7 +2233,7 @@ vshPrint(vshControl *ctl ATTRIBUTE_UNUSED, const char *format, ...)
     if (virVasprintfQuiet(&str, format, ap) < 0)
         vshErrorOOM();
     va_end(ap);
-    fputs(str, stdout);
+    vshOutputString(str);
     VIR_FREE(str);
 }
 
@@ -1946,6 +2349,7 @@ vshError(vshControl *ctl, const char *format, ...)
 {
     va_list ap;
     char *str;
+    vshThreadData *data;
 
     if (ctl != NULL) {
         va_start(ap, format);
@@ -1953,6 +2357,19 @@ vshError(vshControl *ctl, const char *format, ...)
         va_end(ap);
     }
 
+    data = vshThreadDataGet();
+    if (data->err) {
+        va_start(ap, format);
+        ignore_value(virVasprintf(&str, format, ap));
+        va_end(ap);
+
+        if (virBufferUse(data->err))
+            virBufferAddChar(data->err, '\n');
+        virBufferAdd(data->err, NULLSTR(str), -1);
+        VIR_FREE(str);
+        return;
+    }
+
     /* Most output is to stdout, but if someone ran virsh 2>&1, then
      * printing to stderr will not interleave correctly with stdout
      * unless we flush between every transition between streams.  */
@@ -204,6 +204,8 @@ struct _vshControl {
     vshCmd *cmd;                /* the current command */
     char *cmdstr;               /* string with command */
     bool imode;                 /* interactive mode? */
+    char *batchfile;            /* batch mode input, "-" for stdin */
+    unsigned int batchjobs;     /* commands run at once in batch mode */
     bool quiet;                 /* quiet mode */
     bool timing;                /* print timing info? */
     int debug;                  /* print debug messages? */
@@ -300,6 +302,7 @@ int vshBlockJobOptionBandwidth(vshControl *ctl,
 bool vshCommandOptBool(const vshCmd *cmd, const char *name);
 bool vshCommandRun(vshControl *ctl, const vshCmd *cmd);
 bool vshCommandStringParse(vshControl *ctl, char *cmdstr);
+bool vshBatchRun(vshControl *ctl, const char *path, size_t jobs);
 
 const vshCmdOpt *vshCommandOptArgv(vshControl *ctl, const vshCmd *cmd,
                                    const vshCmdOpt *opt);
@@ -336,7 +339,8 @@ int vshTreePrint(vshControl *ctl, vshTreeLookup lookup, void *opaque,
                  int num_devices, int devid);
 
 /* error handling */
-extern virErrorPtr last_error;
+virErrorPtr *vshLastError(void);
+# define last_error (*vshLastError())
 void vshErrorHandler(void *opaque, virErrorPtr error);
 void vshReportError(vshControl *ctl);
 void vshResetLibvirtError(void);